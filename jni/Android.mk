@@ -38,6 +38,22 @@ CONFIGURE_CPPFLAGS := \
 
 CONFIGURE := configure
 
+# NEON is always there on arm64-v8a, it has to be enabled on armeabi-v7a
+# for the text and RAID kernels
+ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+CONFIGURE_HOST := aarch64-linux-android
+else
+CONFIGURE_HOST := arm-linux-androideabi
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+CONFIGURE_CFLAGS += -march=armv7-a -mfloat-abi=softfp -mfpu=neon
+endif
+endif
+
+# usb:fd=N reads a USB mass storage device without root access, N is the
+# file descriptor given by UsbDeviceConnection.getFileDescriptor().
+# It needs libusb-1.0 built for this ABI in $(SYSROOT)/usr, otherwise
+# replace --with-usb by --without-usb
+
 #.SECONDARYEXPANSION:
 #CONFIGURE_TARGETS :=
 
@@ -55,13 +71,13 @@ testdisk-configure-real:
 	CPPFLAGS="$(CONFIGURE_CPPFLAGS)" \
 	PKG_CONFIG_LIBDIR=$(CONFIGURE_PKG_CONFIG_LIBDIR) \
 	PKG_CONFIG_TOP_BUILD_DIR=/ \
-	$(abspath $(testdisk_TOP))/configure --host=arm-linux-androideabi \
+	$(abspath $(testdisk_TOP))/configure --host=$(CONFIGURE_HOST) \
 	--prefix=/system \
 	--libexec /system/bin \
 	--datarootdir /system/usr/share \
 	--without-ncurses --without-ext2fs --without-jpeg \
 	--without-ntfs --without-ntfs3g --without-ewf \
-	--enable-missing-uuid-ok
+	--with-usb --enable-missing-uuid-ok
 	rm -f $(TD_BUILT_MAKEFILES)
 	for file in $(TD_BUILT_MAKEFILES); do \
 		echo "make -C $$(dirname $$file) $$(basename $$file)" ; \
@@ -75,8 +91,8 @@ CONFIGURE_TARGETS += testdisk-configure
 -include $(TD_BUILT_MAKEFILES)
 
 run:
-	adb push libs/armeabi/photorec /data/local/bin/photorec
-	adb push libs/armeabi/testdisk /data/local/bin/testdisk
+	adb push libs/$(TARGET_ARCH_ABI)/photorec /data/local/bin/photorec
+	adb push libs/$(TARGET_ARCH_ABI)/testdisk /data/local/bin/testdisk
 	adb shell chmod 755 /data/local/bin/photorec /data/local/bin/testdisk
 	adb shell /data/local/bin/testdisk -lu
 	adb shell /data/local/bin/photorec
@@ -78,6 +78,7 @@ extern const arch_fnct_t arch_xbox;
 #endif
 
 #define DEFAULT_IMAGE_NAME "image.dd"
+#define DEFAULT_EWF_IMAGE_NAME "image"
 
 static int is_part_hfs(const partition_t *partition)
 {
@@ -315,6 +316,8 @@ static const char *adv_get_options_for_partition(const partition_t *partition)
   {
     return "tscq";
   }
+  else if(partition->upart_type==UP_ISO)
+    return "tlcq";
   return "tcq";
 }
 #endif
@@ -383,10 +386,31 @@ static void adv_menu_image_selected(disk_t *disk, const partition_t *partition,
   if(dst_path[0]!='\0')
   {
     char *filename=(char *)MALLOC(strlen(dst_path) + 1 + strlen(DEFAULT_IMAGE_NAME) + 1);
+    int ewf=0;
+#if defined(HAVE_LIBEWF_H) && defined(HAVE_LIBEWF)
+    if(*current_cmd!=NULL)
+    {
+      skip_comma_in_command(current_cmd);
+      if(check_command(current_cmd,"ewf",3)==0)
+	ewf=1;
+    }
+#ifdef HAVE_NCURSES
+    else
+      ewf=ask_confirmation("Create an EWF image, image.E01, instead of image.dd ? (Y/N)");
+#endif
+#endif
     strcpy(filename, dst_path);
     strcat(filename, "/");
-    strcat(filename, DEFAULT_IMAGE_NAME);
-    disk_image(disk, partition, filename);
+    if(ewf)
+    {
+      strcat(filename, DEFAULT_EWF_IMAGE_NAME);
+      disk_image_ewf(disk, partition, filename);
+    }
+    else
+    {
+      strcat(filename, DEFAULT_IMAGE_NAME);
+      disk_image(disk, partition, filename);
+    }
     free(filename);
   }
 }
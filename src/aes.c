@@ -0,0 +1,533 @@
+/*
+
+    File: aes.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(DISABLED_FOR_FRAMAC)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define AES_NI
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)) && !defined(DISABLED_FOR_FRAMAC)
+#include <arm_neon.h>
+#define AES_ARM
+#endif
+#include "types.h"
+#include "aes.h"
+
+/* AES (FIPS-197). Decryption is the hot path: the sectors of an
+ * encrypted volume are decrypted with AES-NI or the ARMv8 AES
+ * instructions when available, four blocks at a time, or with the
+ * usual 32-bit tables. Encryption is only used once per sector for the
+ * XTS tweak or the ESSIV IV, it stays byte oriented. */
+#define AES_BATCH	32
+
+static unsigned char aes_sbox[256];
+static unsigned char aes_inv_sbox[256];
+static uint32_t aes_td[4][256];
+static int aes_tables_ready=0;
+
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL8(x, n)	((unsigned char)(((x) << (n)) | ((x) >> (8 - (n)))))
+
+static unsigned char aes_xtime(const unsigned char x)
+{
+  return (x << 1) ^ ((x & 0x80)!=0 ? 0x1b : 0);
+}
+
+static unsigned char aes_mul(unsigned char a, unsigned char b)
+{
+  unsigned char res=0;
+  while(b!=0)
+  {
+    if((b & 1)!=0)
+      res^=a;
+    a=aes_xtime(a);
+    b>>=1;
+  }
+  return res;
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, const uint32_t v)
+{
+  p[0]=v >> 24;
+  p[1]=v >> 16;
+  p[2]=v >> 8;
+  p[3]=v;
+}
+
+/* The tables are computed by the first aes_set_key(), before any
+ * thread decrypts something */
+static void aes_init_tables(void)
+{
+  unsigned char p=1;
+  unsigned char q=1;
+  unsigned int i;
+  if(aes_tables_ready!=0)
+    return;
+  /* p runs over the multiplicative group, q is its inverse */
+  do
+  {
+    p=p ^ (unsigned char)(p << 1) ^ ((p & 0x80)!=0 ? 0x1b : 0);
+    q^=q << 1;
+    q^=q << 2;
+    q^=q << 4;
+    if((q & 0x80)!=0)
+      q^=0x09;
+    aes_sbox[p]=q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4) ^ 0x63;
+  } while(p!=1);
+  aes_sbox[0]=0x63;
+  for(i=0; i<256; i++)
+    aes_inv_sbox[aes_sbox[i]]=i;
+  for(i=0; i<256; i++)
+  {
+    const unsigned char x=aes_inv_sbox[i];
+    const uint32_t w=((uint32_t)aes_mul(x, 0x0e) << 24) | ((uint32_t)aes_mul(x, 0x09) << 16) |
+      ((uint32_t)aes_mul(x, 0x0d) << 8) | aes_mul(x, 0x0b);
+    aes_td[0][i]=w;
+    aes_td[1][i]=ROTR32(w, 8);
+    aes_td[2][i]=ROTR32(w, 16);
+    aes_td[3][i]=ROTR32(w, 24);
+  }
+  aes_tables_ready=1;
+}
+
+static uint32_t aes_inv_mix_column(const uint32_t w)
+{
+  const unsigned char b0=w >> 24, b1=w >> 16, b2=w >> 8, b3=w;
+  return ((uint32_t)(aes_mul(b0, 0x0e) ^ aes_mul(b1, 0x0b) ^ aes_mul(b2, 0x0d) ^ aes_mul(b3, 0x09)) << 24) |
+    ((uint32_t)(aes_mul(b0, 0x09) ^ aes_mul(b1, 0x0e) ^ aes_mul(b2, 0x0b) ^ aes_mul(b3, 0x0d)) << 16) |
+    ((uint32_t)(aes_mul(b0, 0x0d) ^ aes_mul(b1, 0x09) ^ aes_mul(b2, 0x0e) ^ aes_mul(b3, 0x0b)) << 8) |
+    (uint32_t)(aes_mul(b0, 0x0b) ^ aes_mul(b1, 0x0d) ^ aes_mul(b2, 0x09) ^ aes_mul(b3, 0x0e));
+}
+
+int aes_set_key(aes_key_t *ctx, const unsigned char *key, const unsigned int key_len)
+{
+  uint32_t w[(AES_MAX_ROUNDS+1)*4];
+  const unsigned int nk=key_len / 4;
+  unsigned int nr;
+  unsigned int i;
+  unsigned char rcon=1;
+  if(key_len!=16 && key_len!=24 && key_len!=32)
+    return -1;
+  aes_init_tables();
+  nr=nk + 6;
+  ctx->rounds=nr;
+  for(i=0; i<nk; i++)
+    w[i]=get_be32(&key[4*i]);
+  for(; i<4*(nr+1); i++)
+  {
+    uint32_t t=w[i-1];
+    if(i % nk==0)
+    {
+      t=(t << 8) | (t >> 24);
+      t=((uint32_t)aes_sbox[t >> 24] << 24) | ((uint32_t)aes_sbox[(t >> 16) & 0xff] << 16) |
+	((uint32_t)aes_sbox[(t >> 8) & 0xff] << 8) | aes_sbox[t & 0xff];
+      t^=(uint32_t)rcon << 24;
+      rcon=aes_xtime(rcon);
+    }
+    else if(nk > 6 && i % nk==4)
+    {
+      t=((uint32_t)aes_sbox[t >> 24] << 24) | ((uint32_t)aes_sbox[(t >> 16) & 0xff] << 16) |
+	((uint32_t)aes_sbox[(t >> 8) & 0xff] << 8) | aes_sbox[t & 0xff];
+    }
+    w[i]=w[i-nk] ^ t;
+  }
+  for(i=0; i<4*(nr+1); i++)
+    put_be32(&ctx->enc[4*i], w[i]);
+  /* Equivalent inverse cipher: the round keys in reverse order, the
+   * InvMixColumns applied to all but the first and the last */
+  for(i=0; i<4; i++)
+  {
+    put_be32(&ctx->dec[4*i], w[4*nr+i]);
+    put_be32(&ctx->dec[16*nr+4*i], w[i]);
+  }
+  for(i=1; i<nr; i++)
+  {
+    unsigned int j;
+    for(j=0; j<4; j++)
+      put_be32(&ctx->dec[16*i+4*j], aes_inv_mix_column(w[4*(nr-i)+j]));
+  }
+  return 0;
+}
+
+static void aes_encrypt_block_soft(const aes_key_t *ctx, const unsigned char *in, unsigned char *out)
+{
+  unsigned char s[AES_BLOCK_SIZE];
+  unsigned int r;
+  unsigned int i;
+  for(i=0; i<AES_BLOCK_SIZE; i++)
+    s[i]=in[i] ^ ctx->enc[i];
+  for(r=1; r<=ctx->rounds; r++)
+  {
+    unsigned char t[AES_BLOCK_SIZE];
+    unsigned int c;
+    /* SubBytes and ShiftRows */
+    for(c=0; c<4; c++)
+      for(i=0; i<4; i++)
+	t[4*c+i]=aes_sbox[s[4*((c+i)%4)+i]];
+    if(r < ctx->rounds)
+    {
+      /* MixColumns */
+      for(c=0; c<4; c++)
+      {
+	const unsigned char a0=t[4*c], a1=t[4*c+1], a2=t[4*c+2], a3=t[4*c+3];
+	const unsigned char all=a0 ^ a1 ^ a2 ^ a3;
+	t[4*c]^=all ^ aes_xtime(a0 ^ a1);
+	t[4*c+1]^=all ^ aes_xtime(a1 ^ a2);
+	t[4*c+2]^=all ^ aes_xtime(a2 ^ a3);
+	t[4*c+3]^=all ^ aes_xtime(a3 ^ a0);
+      }
+    }
+    for(i=0; i<AES_BLOCK_SIZE; i++)
+      s[i]=t[i] ^ ctx->enc[16*r+i];
+  }
+  memcpy(out, s, AES_BLOCK_SIZE);
+}
+
+static void aes_decrypt_block_soft(const aes_key_t *ctx, unsigned char *block)
+{
+  const unsigned char *rk=ctx->dec;
+  uint32_t s0=get_be32(&block[0]) ^ get_be32(&rk[0]);
+  uint32_t s1=get_be32(&block[4]) ^ get_be32(&rk[4]);
+  uint32_t s2=get_be32(&block[8]) ^ get_be32(&rk[8]);
+  uint32_t s3=get_be32(&block[12]) ^ get_be32(&rk[12]);
+  unsigned int r;
+  for(r=1; r<ctx->rounds; r++)
+  {
+    uint32_t t0, t1, t2, t3;
+    rk+=AES_BLOCK_SIZE;
+    t0=aes_td[0][s0 >> 24] ^ aes_td[1][(s3 >> 16) & 0xff] ^ aes_td[2][(s2 >> 8) & 0xff] ^ aes_td[3][s1 & 0xff] ^ get_be32(&rk[0]);
+    t1=aes_td[0][s1 >> 24] ^ aes_td[1][(s0 >> 16) & 0xff] ^ aes_td[2][(s3 >> 8) & 0xff] ^ aes_td[3][s2 & 0xff] ^ get_be32(&rk[4]);
+    t2=aes_td[0][s2 >> 24] ^ aes_td[1][(s1 >> 16) & 0xff] ^ aes_td[2][(s0 >> 8) & 0xff] ^ aes_td[3][s3 & 0xff] ^ get_be32(&rk[8]);
+    t3=aes_td[0][s3 >> 24] ^ aes_td[1][(s2 >> 16) & 0xff] ^ aes_td[2][(s1 >> 8) & 0xff] ^ aes_td[3][s0 & 0xff] ^ get_be32(&rk[12]);
+    s0=t0;
+    s1=t1;
+    s2=t2;
+    s3=t3;
+  }
+  rk+=AES_BLOCK_SIZE;
+  put_be32(&block[0], (((uint32_t)aes_inv_sbox[s0 >> 24] << 24) | ((uint32_t)aes_inv_sbox[(s3 >> 16) & 0xff] << 16) |
+	((uint32_t)aes_inv_sbox[(s2 >> 8) & 0xff] << 8) | aes_inv_sbox[s1 & 0xff]) ^ get_be32(&rk[0]));
+  put_be32(&block[4], (((uint32_t)aes_inv_sbox[s1 >> 24] << 24) | ((uint32_t)aes_inv_sbox[(s0 >> 16) & 0xff] << 16) |
+	((uint32_t)aes_inv_sbox[(s3 >> 8) & 0xff] << 8) | aes_inv_sbox[s2 & 0xff]) ^ get_be32(&rk[4]));
+  put_be32(&block[8], (((uint32_t)aes_inv_sbox[s2 >> 24] << 24) | ((uint32_t)aes_inv_sbox[(s1 >> 16) & 0xff] << 16) |
+	((uint32_t)aes_inv_sbox[(s0 >> 8) & 0xff] << 8) | aes_inv_sbox[s3 & 0xff]) ^ get_be32(&rk[8]));
+  put_be32(&block[12], (((uint32_t)aes_inv_sbox[s3 >> 24] << 24) | ((uint32_t)aes_inv_sbox[(s2 >> 16) & 0xff] << 16) |
+	((uint32_t)aes_inv_sbox[(s1 >> 8) & 0xff] << 8) | aes_inv_sbox[s0 & 0xff]) ^ get_be32(&rk[12]));
+}
+
+#ifdef AES_NI
+static int aes_has_aesni(void)
+{
+  static int has_aesni=-1;
+  if(has_aesni < 0)
+  {
+    unsigned int eax, ebx, ecx, edx;
+    has_aesni=(__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+	(ecx & bit_AES)!=0 && (edx & bit_SSE2)!=0);
+  }
+  return has_aesni;
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_encrypt_block_aesni(const aes_key_t *ctx, const unsigned char *in, unsigned char *out)
+{
+  const __m128i *rk=(const __m128i *)ctx->enc;
+  __m128i b=_mm_xor_si128(_mm_loadu_si128((const __m128i *)in), _mm_loadu_si128(&rk[0]));
+  unsigned int r;
+  for(r=1; r<ctx->rounds; r++)
+    b=_mm_aesenc_si128(b, _mm_loadu_si128(&rk[r]));
+  b=_mm_aesenclast_si128(b, _mm_loadu_si128(&rk[ctx->rounds]));
+  _mm_storeu_si128((__m128i *)out, b);
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_decrypt_blocks_aesni(const aes_key_t *ctx, unsigned char *buffer, const unsigned int nbr)
+{
+  __m128i rk[AES_MAX_ROUNDS+1];
+  const unsigned int nr=ctx->rounds;
+  unsigned int i;
+  unsigned int r;
+  for(r=0; r<=nr; r++)
+    rk[r]=_mm_loadu_si128((const __m128i *)&ctx->dec[16*r]);
+  /* Four independent blocks hide the latency of aesdec */
+  for(i=0; i + 4 <= nbr; i+=4)
+  {
+    __m128i *p=(__m128i *)&buffer[16*i];
+    __m128i b0=_mm_xor_si128(_mm_loadu_si128(&p[0]), rk[0]);
+    __m128i b1=_mm_xor_si128(_mm_loadu_si128(&p[1]), rk[0]);
+    __m128i b2=_mm_xor_si128(_mm_loadu_si128(&p[2]), rk[0]);
+    __m128i b3=_mm_xor_si128(_mm_loadu_si128(&p[3]), rk[0]);
+    for(r=1; r<nr; r++)
+    {
+      b0=_mm_aesdec_si128(b0, rk[r]);
+      b1=_mm_aesdec_si128(b1, rk[r]);
+      b2=_mm_aesdec_si128(b2, rk[r]);
+      b3=_mm_aesdec_si128(b3, rk[r]);
+    }
+    _mm_storeu_si128(&p[0], _mm_aesdeclast_si128(b0, rk[nr]));
+    _mm_storeu_si128(&p[1], _mm_aesdeclast_si128(b1, rk[nr]));
+    _mm_storeu_si128(&p[2], _mm_aesdeclast_si128(b2, rk[nr]));
+    _mm_storeu_si128(&p[3], _mm_aesdeclast_si128(b3, rk[nr]));
+  }
+  for(; i < nbr; i++)
+  {
+    __m128i *p=(__m128i *)&buffer[16*i];
+    __m128i b=_mm_xor_si128(_mm_loadu_si128(p), rk[0]);
+    for(r=1; r<nr; r++)
+      b=_mm_aesdec_si128(b, rk[r]);
+    _mm_storeu_si128(p, _mm_aesdeclast_si128(b, rk[nr]));
+  }
+}
+
+/* Multiply the XTS tweak by x: shift the 128-bit value, bit 63 goes to
+ * bit 64 and bit 127 comes back as 0x87 */
+__attribute__((target("sse2")))
+static inline __m128i aes_xts_mul_x(const __m128i t)
+{
+  const __m128i carry=_mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x13);
+  return _mm_xor_si128(_mm_add_epi64(t, t), _mm_and_si128(carry, _mm_set_epi32(0, 1, 0, 0x87)));
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_xts_decrypt_aesni(const aes_key_t *key1, const aes_key_t *key2, unsigned char *buffer, const unsigned int nbr, const uint64_t tweak)
+{
+  __m128i rk[AES_MAX_ROUNDS+1];
+  const unsigned int nr=key1->rounds;
+  unsigned char iv[AES_BLOCK_SIZE];
+  __m128i t;
+  unsigned int i;
+  unsigned int r;
+  memset(iv, 0, sizeof(iv));
+  for(i=0; i<8; i++)
+    iv[i]=tweak >> (8*i);
+  aes_encrypt_block_aesni(key2, iv, iv);
+  t=_mm_loadu_si128((const __m128i *)iv);
+  for(r=0; r<=nr; r++)
+    rk[r]=_mm_loadu_si128((const __m128i *)&key1->dec[16*r]);
+  for(i=0; i + 4 <= nbr; i+=4)
+  {
+    __m128i *p=(__m128i *)&buffer[16*i];
+    const __m128i t0=t;
+    const __m128i t1=aes_xts_mul_x(t0);
+    const __m128i t2=aes_xts_mul_x(t1);
+    const __m128i t3=aes_xts_mul_x(t2);
+    __m128i b0=_mm_xor_si128(_mm_loadu_si128(&p[0]), _mm_xor_si128(t0, rk[0]));
+    __m128i b1=_mm_xor_si128(_mm_loadu_si128(&p[1]), _mm_xor_si128(t1, rk[0]));
+    __m128i b2=_mm_xor_si128(_mm_loadu_si128(&p[2]), _mm_xor_si128(t2, rk[0]));
+    __m128i b3=_mm_xor_si128(_mm_loadu_si128(&p[3]), _mm_xor_si128(t3, rk[0]));
+    t=aes_xts_mul_x(t3);
+    for(r=1; r<nr; r++)
+    {
+      b0=_mm_aesdec_si128(b0, rk[r]);
+      b1=_mm_aesdec_si128(b1, rk[r]);
+      b2=_mm_aesdec_si128(b2, rk[r]);
+      b3=_mm_aesdec_si128(b3, rk[r]);
+    }
+    _mm_storeu_si128(&p[0], _mm_xor_si128(_mm_aesdeclast_si128(b0, rk[nr]), t0));
+    _mm_storeu_si128(&p[1], _mm_xor_si128(_mm_aesdeclast_si128(b1, rk[nr]), t1));
+    _mm_storeu_si128(&p[2], _mm_xor_si128(_mm_aesdeclast_si128(b2, rk[nr]), t2));
+    _mm_storeu_si128(&p[3], _mm_xor_si128(_mm_aesdeclast_si128(b3, rk[nr]), t3));
+  }
+  for(; i < nbr; i++)
+  {
+    __m128i *p=(__m128i *)&buffer[16*i];
+    __m128i b=_mm_xor_si128(_mm_loadu_si128(p), _mm_xor_si128(t, rk[0]));
+    for(r=1; r<nr; r++)
+      b=_mm_aesdec_si128(b, rk[r]);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_aesdeclast_si128(b, rk[nr]), t));
+    t=aes_xts_mul_x(t);
+  }
+}
+#endif
+
+#ifdef AES_ARM
+static void aes_encrypt_block_arm(const aes_key_t *ctx, const unsigned char *in, unsigned char *out)
+{
+  uint8x16_t b=vld1q_u8(in);
+  unsigned int r;
+  for(r=0; r<ctx->rounds-1; r++)
+    b=vaesmcq_u8(vaeseq_u8(b, vld1q_u8(&ctx->enc[16*r])));
+  b=vaeseq_u8(b, vld1q_u8(&ctx->enc[16*(ctx->rounds-1)]));
+  vst1q_u8(out, veorq_u8(b, vld1q_u8(&ctx->enc[16*ctx->rounds])));
+}
+
+static void aes_decrypt_blocks_arm(const aes_key_t *ctx, unsigned char *buffer, const unsigned int nbr)
+{
+  uint8x16_t rk[AES_MAX_ROUNDS+1];
+  const unsigned int nr=ctx->rounds;
+  unsigned int i;
+  unsigned int r;
+  for(r=0; r<=nr; r++)
+    rk[r]=vld1q_u8(&ctx->dec[16*r]);
+  /* aesd adds the round key before InvShiftRows and InvSubBytes */
+  for(i=0; i + 4 <= nbr; i+=4)
+  {
+    unsigned char *p=&buffer[16*i];
+    uint8x16_t b0=vld1q_u8(p);
+    uint8x16_t b1=vld1q_u8(p + 16);
+    uint8x16_t b2=vld1q_u8(p + 32);
+    uint8x16_t b3=vld1q_u8(p + 48);
+    for(r=0; r<nr-1; r++)
+    {
+      b0=vaesimcq_u8(vaesdq_u8(b0, rk[r]));
+      b1=vaesimcq_u8(vaesdq_u8(b1, rk[r]));
+      b2=vaesimcq_u8(vaesdq_u8(b2, rk[r]));
+      b3=vaesimcq_u8(vaesdq_u8(b3, rk[r]));
+    }
+    vst1q_u8(p, veorq_u8(vaesdq_u8(b0, rk[nr-1]), rk[nr]));
+    vst1q_u8(p + 16, veorq_u8(vaesdq_u8(b1, rk[nr-1]), rk[nr]));
+    vst1q_u8(p + 32, veorq_u8(vaesdq_u8(b2, rk[nr-1]), rk[nr]));
+    vst1q_u8(p + 48, veorq_u8(vaesdq_u8(b3, rk[nr-1]), rk[nr]));
+  }
+  for(; i < nbr; i++)
+  {
+    unsigned char *p=&buffer[16*i];
+    uint8x16_t b=vld1q_u8(p);
+    for(r=0; r<nr-1; r++)
+      b=vaesimcq_u8(vaesdq_u8(b, rk[r]));
+    vst1q_u8(p, veorq_u8(vaesdq_u8(b, rk[nr-1]), rk[nr]));
+  }
+}
+#endif
+
+void aes_encrypt_block(const aes_key_t *ctx, const unsigned char *in, unsigned char *out)
+{
+#if defined(AES_NI)
+  if(aes_has_aesni())
+  {
+    aes_encrypt_block_aesni(ctx, in, out);
+    return;
+  }
+#elif defined(AES_ARM)
+  aes_encrypt_block_arm(ctx, in, out);
+  return;
+#endif
+  aes_encrypt_block_soft(ctx, in, out);
+}
+
+static void aes_decrypt_blocks(const aes_key_t *ctx, unsigned char *buffer, const unsigned int nbr)
+{
+  unsigned int i;
+#if defined(AES_NI)
+  if(aes_has_aesni())
+  {
+    aes_decrypt_blocks_aesni(ctx, buffer, nbr);
+    return;
+  }
+#elif defined(AES_ARM)
+  aes_decrypt_blocks_arm(ctx, buffer, nbr);
+  return;
+#endif
+  for(i=0; i<nbr; i++)
+    aes_decrypt_block_soft(ctx, &buffer[16*i]);
+}
+
+static void aes_xor_block(unsigned char *dst, const unsigned char *src)
+{
+  unsigned int i;
+  for(i=0; i<AES_BLOCK_SIZE; i++)
+    dst[i]^=src[i];
+}
+
+void aes_xts_decrypt(const aes_key_t *key1, const aes_key_t *key2, unsigned char *buffer, const unsigned int size, const uint64_t tweak)
+{
+  unsigned char t[AES_BLOCK_SIZE];
+  unsigned char tweaks[AES_BATCH*AES_BLOCK_SIZE];
+  const unsigned int nbr=size / AES_BLOCK_SIZE;
+  unsigned int i;
+#if defined(AES_NI)
+  if(aes_has_aesni())
+  {
+    aes_xts_decrypt_aesni(key1, key2, buffer, nbr, tweak);
+    return;
+  }
+#endif
+  memset(t, 0, sizeof(t));
+  for(i=0; i<8; i++)
+    t[i]=tweak >> (8*i);
+  aes_encrypt_block(key2, t, t);
+  for(i=0; i<nbr; i+=AES_BATCH)
+  {
+    const unsigned int batch=(nbr - i < AES_BATCH ? nbr - i : AES_BATCH);
+    unsigned char *p=&buffer[16*i];
+    unsigned int j;
+    for(j=0; j<batch; j++)
+    {
+      unsigned int k;
+      unsigned int carry=0;
+      memcpy(&tweaks[16*j], t, AES_BLOCK_SIZE);
+      aes_xor_block(&p[16*j], t);
+      /* Multiply the tweak by x in GF(2^128) */
+      for(k=0; k<AES_BLOCK_SIZE; k++)
+      {
+	const unsigned int next=t[k] >> 7;
+	t[k]=(t[k] << 1) | carry;
+	carry=next;
+      }
+      if(carry!=0)
+	t[0]^=0x87;
+    }
+    aes_decrypt_blocks(key1, p, batch);
+    for(j=0; j<batch; j++)
+      aes_xor_block(&p[16*j], &tweaks[16*j]);
+  }
+}
+
+void aes_cbc_decrypt(const aes_key_t *ctx, unsigned char *buffer, const unsigned int size, const unsigned char *iv)
+{
+  unsigned char prev[(AES_BATCH+1)*AES_BLOCK_SIZE];
+  const unsigned int nbr=size / AES_BLOCK_SIZE;
+  unsigned int i;
+  memcpy(prev, iv, AES_BLOCK_SIZE);
+  for(i=0; i<nbr; i+=AES_BATCH)
+  {
+    const unsigned int batch=(nbr - i < AES_BATCH ? nbr - i : AES_BATCH);
+    unsigned char *p=&buffer[16*i];
+    unsigned int j;
+    memcpy(&prev[AES_BLOCK_SIZE], p, batch*AES_BLOCK_SIZE);
+    aes_decrypt_blocks(ctx, p, batch);
+    for(j=0; j<batch; j++)
+      aes_xor_block(&p[16*j], &prev[16*j]);
+    memcpy(prev, &prev[16*batch], AES_BLOCK_SIZE);
+  }
+}
+
+const char *aes_implementation(void)
+{
+#if defined(AES_NI)
+  if(aes_has_aesni())
+    return "AES-NI";
+#elif defined(AES_ARM)
+  return "ARMv8 AES";
+#endif
+  return "software";
+}
@@ -0,0 +1,79 @@
+/*
+
+    File: aes.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _AES_H
+#define _AES_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AES_BLOCK_SIZE	16
+#define AES_MAX_ROUNDS	14
+
+typedef struct
+{
+  unsigned int rounds;
+  /* Round keys in byte order, enc for the cipher and dec for the
+   * equivalent inverse cipher */
+  unsigned char enc[(AES_MAX_ROUNDS+1)*AES_BLOCK_SIZE];
+  unsigned char dec[(AES_MAX_ROUNDS+1)*AES_BLOCK_SIZE];
+} aes_key_t;
+
+/* key_len is 16, 24 or 32, return -1 for other sizes */
+/*@
+  @ requires \valid(ctx);
+  @ requires \valid_read(key + (0 .. key_len-1));
+  @*/
+int aes_set_key(aes_key_t *ctx, const unsigned char *key, const unsigned int key_len);
+
+/*@
+  @ requires \valid_read(ctx);
+  @ requires \valid_read(in + (0 .. AES_BLOCK_SIZE-1));
+  @ requires \valid(out + (0 .. AES_BLOCK_SIZE-1));
+  @*/
+void aes_encrypt_block(const aes_key_t *ctx, const unsigned char *in, unsigned char *out);
+
+/* Decrypt in place a data unit encrypted with AES-XTS (IEEE 1619),
+ * key1 decrypts the data, key2 encrypts the tweak, size is a multiple
+ * of AES_BLOCK_SIZE */
+/*@
+  @ requires \valid_read(key1);
+  @ requires \valid_read(key2);
+  @ requires \valid(buffer + (0 .. size-1));
+  @*/
+void aes_xts_decrypt(const aes_key_t *key1, const aes_key_t *key2, unsigned char *buffer, const unsigned int size, const uint64_t tweak);
+
+/* Decrypt in place a data unit encrypted with AES-CBC,
+ * size is a multiple of AES_BLOCK_SIZE */
+/*@
+  @ requires \valid_read(ctx);
+  @ requires \valid(buffer + (0 .. size-1));
+  @ requires \valid_read(iv + (0 .. AES_BLOCK_SIZE-1));
+  @*/
+void aes_cbc_decrypt(const aes_key_t *ctx, unsigned char *buffer, const unsigned int size, const unsigned char *iv);
+
+/* "AES-NI", "ARMv8 AES" or "software" */
+const char *aes_implementation(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -24,6 +24,7 @@
 #endif
 
 #include <stdio.h>
+#include <stddef.h>
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -67,6 +68,266 @@
 #include "parti386.h"
 #include "log.h"
 
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Filesystem probes keyed on their signature: a recover_*() function is
+ * only called when its magic is found at the expected offset. The probes of
+ * a table are tried in order and the first one accepting the data wins, the
+ * multiple signatures of a filesystem are consecutive entries. */
+typedef struct
+{
+  unsigned int offset;
+  unsigned int length;
+  const char *magic;
+  int (*recover)(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind);
+} fs_probe_t;
+
+static int fs_probe(const fs_probe_t *probes, const unsigned char *buffer, disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
+{
+  const fs_probe_t *probe;
+  for(probe=probes; probe->recover!=NULL; probe++)
+  {
+    if(memcmp(&buffer[probe->offset], probe->magic, probe->length)==0)
+    {
+      if(probe->recover(disk, buffer, partition, verbose, dump_ind)==0)
+	return 1;
+      while(probe[1].recover==probe->recover)
+	probe++;
+    }
+  }
+  return 0;
+}
+
+static int probe_APFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_APFS(disk, (const nx_superblock_t *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_Linux_SWAP(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_Linux_SWAP((const union swap_header *)buffer, partition);
+}
+
+static int probe_LVM(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_LVM(disk, (const pv_disk_t *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_FAT(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_FAT(disk, (const struct fat_boot_sector *)buffer, partition, verbose, dump_ind, 0);
+}
+
+static int probe_exFAT(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_exFAT(disk, (const struct exfat_super_block *)buffer, partition);
+}
+
+static int probe_HPFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_HPFS(disk, (const struct fat_boot_sector *)buffer, partition, verbose);
+}
+
+static int probe_OS2MB(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_OS2MB(disk, (const struct fat_boot_sector *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_NTFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_NTFS(disk, (const struct ntfs_boot_sector *)buffer, partition, verbose, dump_ind, 0);
+}
+
+static int probe_netware(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_netware(disk, (const struct disk_netware *)buffer, partition);
+}
+
+static int probe_xfs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_xfs(disk, (const struct xfs_sb *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_FATX(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_FATX((const struct disk_fatx *)buffer, partition);
+}
+
+static int probe_LUKS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_LUKS(disk, (const struct luks_phdr *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_ReFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_ReFS(disk, (const struct ReFS_boot_sector *)buffer, partition);
+}
+
+/* MD 1.1 */
+static int probe_MD_1_1(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  const struct mdp_superblock_1 *sb1=(const struct mdp_superblock_1 *)buffer;
+  if(recover_MD(disk, (const struct mdp_superblock_s*)buffer, partition, verbose, dump_ind)!=0)
+    return 1;
+  partition->part_offset-=le64(sb1->super_offset)*512;
+  return 0;
+}
+
+static int probe_WBFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_WBFS(disk, (const struct wbfs_head *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_cramfs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_cramfs(disk, (const struct cramfs_super *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_BSD(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  const struct disklabel *bsd_header=(const struct disklabel *)buffer;
+  if(le32(bsd_header->d_magic2)!=DISKMAGIC)
+    return 1;
+  return recover_BSD(disk, bsd_header, partition, verbose, dump_ind);
+}
+
+static int probe_BeFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_BeFS(disk, (const struct disk_super_block *)buffer, partition, dump_ind);
+}
+
+static int probe_sysv(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_sysv(disk, (const struct sysv4_super_block *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_LVM2(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_LVM2(disk, buffer, partition, verbose, dump_ind);
+}
+
+static int probe_sun_i386(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_sun_i386(disk, (const sun_partition_i386 *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_EXT2(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_EXT2(disk, (const struct ext2_super_block *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_HFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_HFS(disk, (const hfs_mdb_t *)buffer, partition, verbose, dump_ind, 0);
+}
+
+static int probe_HFSP(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_HFSP(disk, (const struct hfsp_vh *)buffer, partition, verbose, dump_ind, 0);
+}
+
+static int probe_f2fs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_f2fs(disk, (const struct f2fs_super_block *)buffer, partition);
+}
+
+static int probe_ufs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_ufs(disk, (const struct ufs_super_block *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_ZFS(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_ZFS(disk, (const struct vdev_boot_header *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_rfs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_rfs(disk, (const struct reiserfs_super_block *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_btrfs(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_btrfs(disk, (const struct btrfs_super_block *)buffer, partition, verbose, dump_ind);
+}
+
+static int probe_gfs2(disk_t *disk, const unsigned char *buffer, partition_t *partition, const int verbose, const int dump_ind)
+{
+  return recover_gfs2(disk, (const struct gfs2_sb *)buffer, partition, dump_ind);
+}
+
+/* Sector 0, 8k buffer to handle the SWAP detection */
+static const fs_probe_t probes_0[]=
+{
+  { offsetof(nx_superblock_t, nx_magic),		4, "NXSB",		&probe_APFS },
+  { offsetof(union swap_header, magic.magic),		4, "SWAP",		&probe_Linux_SWAP },
+  { offsetof(union swap_header, magic8k.magic),		4, "SWAP",		&probe_Linux_SWAP },
+  { offsetof(pv_disk_t, id),				2, LVM_ID,		&probe_LVM },
+  { offsetof(struct fat_boot_sector, marker),		2, "\x55\xAA",		&probe_FAT },
+  { offsetof(struct exfat_super_block, signature),	2, "\x55\xAA",		&probe_exFAT },
+  { offsetof(struct fat_boot_sector, marker),		2, "\x55\xAA",		&probe_HPFS },
+  { offsetof(struct fat_boot_sector, marker),		2, "\x55\xAA",		&probe_OS2MB },
+  { offsetof(struct ntfs_boot_sector, marker),		2, "\x55\xAA",		&probe_NTFS },
+  { offsetof(struct disk_netware, magic),		12, "Nw_PaRtItIoN",	&probe_netware },
+  { offsetof(struct xfs_sb, sb_magicnum),		4, "XFSB",		&probe_xfs },
+  { offsetof(struct disk_fatx, magic),			4, "FATX",		&probe_FATX },
+  { offsetof(struct luks_phdr, magic),			LUKS_MAGIC_L, "LUKS\xba\xbe",	&probe_LUKS },
+  { offsetof(struct ReFS_boot_sector, fsname),		4, "ReFS",		&probe_ReFS },
+  { offsetof(struct mdp_superblock_1, major_version),	4, "\x01\x00\x00\x00",	&probe_MD_1_1 },
+  { offsetof(struct wbfs_head, magic),			4, "WBFS",		&probe_WBFS },
+  { offsetof(struct cramfs_super, magic),		4, "\x45\x3d\xcd\x28",	&probe_cramfs },
+  { 0, 0, NULL, NULL }
+};
+
+/* Sector 1 */
+static const fs_probe_t probes_1[]=
+{
+  { offsetof(struct disklabel, d_magic),		4, "\x57\x45\x56\x82",	&probe_BSD },
+  { offsetof(struct disk_super_block, magic1),		4, "1SFB",		&probe_BeFS },
+  { offsetof(struct cramfs_super, magic),		4, "\x45\x3d\xcd\x28",	&probe_cramfs },
+  { offsetof(struct sysv4_super_block, s_magic),	4, "\x20\x7e\x18\xfd",	&probe_sysv },
+  { offsetof(struct sysv4_super_block, s_magic),	4, "\xfd\x18\x7e\x20",	&probe_sysv },
+  { offsetof(struct lvm2_label_header, type),		8, LVM2_LABEL,		&probe_LVM2 },
+  { offsetof(sun_partition_i386, magic_start),		4, "\xee\xde\x0d\x60",	&probe_sun_i386 },
+  { 0, 0, NULL, NULL }
+};
+
+/* 1k offset */
+static const fs_probe_t probes_2[]=
+{
+  { offsetof(struct ext2_super_block, s_magic),		2, "\x53\xef",		&probe_EXT2 },
+  { offsetof(hfs_mdb_t, drSigWord),			2, "BD",		&probe_HFS },
+  { offsetof(struct hfsp_vh, version),			2, "\x00\x04",		&probe_HFSP },
+  { offsetof(struct hfsp_vh, version),			2, "\x00\x05",		&probe_HFSP },
+  { offsetof(struct f2fs_super_block, magic),		4, "\x10\x20\xf5\xf2",	&probe_f2fs },
+  { 0, 0, NULL, NULL }
+};
+
+#define PROBES_UFS \
+  { offsetof(struct ufs_super_block, fs_magic),		4, "\x54\x19\x01\x00",	&probe_ufs }, \
+  { offsetof(struct ufs_super_block, fs_magic),		4, "\x00\x01\x19\x54",	&probe_ufs }, \
+  { offsetof(struct ufs_super_block, fs_magic),		4, "\x19\x01\x54\x19",	&probe_ufs }, \
+  { offsetof(struct ufs_super_block, fs_magic),		4, "\x19\x54\x01\x19",	&probe_ufs }
+
+/* 8k offset */
+static const fs_probe_t probes_16[]=
+{
+  PROBES_UFS,
+  { offsetof(struct vdev_boot_header, vb_magic),	8, "\x0c\xb1\x07\xb0\xf5\x02\x00\x00",	&probe_ZFS },
+  { 0, 0, NULL, NULL }
+};
+
+/* 64k offset */
+static const fs_probe_t probes_128[]=
+{
+  { offsetof(struct reiserfs_super_block, s_magic),	4, "ReIs",		&probe_rfs },
+  { offsetof(struct reiser4_master_sb, magic),		sizeof(REISERFS4_SUPER_MAGIC), REISERFS4_SUPER_MAGIC,	&probe_rfs },
+  PROBES_UFS,
+  { offsetof(struct btrfs_super_block, magic),		8, BTRFS_MAGIC,		&probe_btrfs },
+  { offsetof(struct gfs2_sb, sb_header.mh_magic),	4, "\x01\x16\x19\x70",	&probe_gfs2 },
+  { 0, 0, NULL, NULL }
+};
+#endif
+
 int search_NTFS_backup(unsigned char *buffer, disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
 {
   if(disk->pread(disk, buffer, DEFAULT_SECTOR_SIZE, partition->part_offset) != DEFAULT_SECTOR_SIZE)
@@ -142,87 +403,14 @@ int search_FAT_backup(unsigned char *buffer, disk_t *disk, partition_t *partitio
 
 int search_type_0(const unsigned char *buffer, disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
 {
-#if !defined(DISABLED_FOR_FRAMAC)
-  /* Expect a buffer filled with 8k to handle the SWAP detection */
-  const pv_disk_t *pv=(const pv_disk_t *)buffer;
-  const struct cramfs_super *cramfs=(const struct cramfs_super *)buffer;
-  const struct disk_fatx *fatx_block=(const struct disk_fatx*)buffer;
-  const struct disk_netware *netware_block=(const struct disk_netware *)buffer;
-  const struct exfat_super_block *exfat_header=(const struct exfat_super_block *)buffer;
-  const struct fat_boot_sector *fat_header=(const struct fat_boot_sector *)buffer;
-  const struct luks_phdr *luks=(const struct luks_phdr *)buffer;
-  const struct mdp_superblock_1 *sb1=(const struct mdp_superblock_1 *)buffer;
-  const struct ntfs_boot_sector *ntfs_header=(const struct ntfs_boot_sector*)buffer;
-  const struct wbfs_head *wbfs=(const struct wbfs_head *)buffer;
-  const struct xfs_sb *xfs=(const struct xfs_sb *)buffer;
-  const union swap_header *swap_header=(const union swap_header *)buffer;
-  const struct ReFS_boot_sector *refs_header=(const struct ReFS_boot_sector *)buffer;
-  const nx_superblock_t *apfs=(const nx_superblock_t *)buffer;
-  static const uint8_t LUKS_MAGIC[LUKS_MAGIC_L] = {'L','U','K','S', 0xba, 0xbe};
-//  assert(sizeof(union swap_header)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(pv_disk_t)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(struct fat_boot_sector)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(struct ntfs_boot_sector)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(struct disk_netware)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(struct xfs_sb)<=8*DEFAULT_SECTOR_SIZE);
-//  assert(sizeof(struct disk_fatx)<=8*DEFAULT_SECTOR_SIZE);
   if(verbose>2)
   {
     log_trace("search_type_0 lba=%lu\n",
 	(long unsigned)(partition->part_offset/disk->sector_size));
   }
-  if(le32(apfs->nx_magic)== 0x4253584e &&
-    recover_APFS(disk, apfs, partition, verbose, dump_ind)==0)
-    return 1;
-  if((memcmp(swap_header->magic.magic, "SWAP", 4)==0 ||
-	memcmp(swap_header->magic8k.magic, "SWAP", 4)==0) &&
-      recover_Linux_SWAP(swap_header, partition)==0)
-    return 1;
-  if(memcmp((const char *)pv->id,LVM_ID,sizeof(pv->id)) == 0 &&
-      recover_LVM(disk, pv, partition, verbose, dump_ind)==0)
-    return 1;
-  if(le16(fat_header->marker)==0xAA55 &&
-      recover_FAT(disk, fat_header, partition, verbose, dump_ind, 0)==0)
-    return 1;
-  if(le16(exfat_header->signature)==0xAA55 &&
-      recover_exFAT(disk, exfat_header, partition)==0)
-    return 1;
-  if(le16(fat_header->marker)==0xAA55 &&
-      recover_HPFS(disk, fat_header, partition, verbose)==0)
-    return 1;
-  if(le16(fat_header->marker)==0xAA55 &&
-      recover_OS2MB(disk, fat_header, partition, verbose, dump_ind)==0)
-    return 1;
-  if(le16(ntfs_header->marker)==0xAA55 &&
-      recover_NTFS(disk, ntfs_header, partition, verbose, dump_ind, 0)==0)
-    return 1;
-  if(memcmp(netware_block->magic, "Nw_PaRtItIoN", 12)==0 &&
-      recover_netware(disk, netware_block, partition)==0)
-    return 1;
-  if (xfs->sb_magicnum==be32(XFS_SB_MAGIC) &&
-      recover_xfs(disk, xfs, partition, verbose, dump_ind)==0)
-    return 1;
-  if(memcmp(fatx_block->magic,"FATX",4)==0 &&
-      recover_FATX(fatx_block, partition)==0)
-    return 1;
-  if(memcmp(luks->magic,LUKS_MAGIC,LUKS_MAGIC_L)==0 &&
-      recover_LUKS(disk, luks, partition, verbose, dump_ind)==0)
-    return 1;
-  if(refs_header->fsname==be32(0x52654653) &&
-      recover_ReFS(disk, refs_header, partition)==0)
-    return 1;
-  /* MD 1.1 */
-  if(le32(sb1->major_version)==1 &&
-      recover_MD(disk, (const struct mdp_superblock_s*)buffer, partition, verbose, dump_ind)==0)
-  {
-    partition->part_offset-=le64(sb1->super_offset)*512;
-    return 1;
-  }
-  if(memcmp(&wbfs->magic,"WBFS",4)==0 &&
-      recover_WBFS(disk, wbfs, partition, verbose, dump_ind)==0)
-    return 1;
-  if(cramfs->magic==le32(CRAMFS_MAGIC) &&
-      recover_cramfs(disk, cramfs, partition, verbose, dump_ind)==0)
+#if !defined(DISABLED_FOR_FRAMAC)
+  /* Expect a buffer filled with 8k to handle the SWAP detection */
+  if(fs_probe(probes_0, buffer, disk, partition, verbose, dump_ind)!=0)
     return 1;
 #endif
 #if !defined(SINGLE_PARTITION_TYPE) || defined(SINGLE_PARTITION_I386)
@@ -235,42 +423,15 @@ int search_type_0(const unsigned char *buffer, disk_t *disk, partition_t *partit
   return 0;
 }
 
-int search_type_1(const unsigned char *buffer, const disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
+int search_type_1(const unsigned char *buffer, disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
 {
-#if !defined(DISABLED_FOR_FRAMAC)
-  const struct disklabel *bsd_header=(const struct disklabel *)(buffer+0x200);
-  const struct disk_super_block *beos_block=(const struct disk_super_block*)(buffer+0x200);
-  const struct cramfs_super *cramfs=(const struct cramfs_super *)(buffer+0x200);
-  const struct lvm2_label_header *lvm2=(const struct lvm2_label_header *)(buffer+0x200);
-  const struct sysv4_super_block *sysv4=(const struct sysv4_super_block *)(buffer+0x200);
-  const sun_partition_i386 *sunlabel=(const sun_partition_i386*)(buffer+0x200);
-//  assert(sizeof(struct disklabel)<=2*0x200);
-//  assert(sizeof(struct disk_super_block)<=0x200);
-//  assert(sizeof(struct cramfs_super)<=2*0x200);
-//  assert(sizeof(struct sysv4_super_block)<=2*0x200);
-//  assert(sizeof(sun_partition_i386)<=2*0x200);
   if(verbose>2)
   {
     log_trace("search_type_1 lba=%lu\n",
 	(long unsigned)(partition->part_offset/disk->sector_size));
   }
-  if(le32(bsd_header->d_magic) == DISKMAGIC && le32(bsd_header->d_magic2)==DISKMAGIC &&
-	recover_BSD(disk, bsd_header, partition, verbose, dump_ind)==0)
-    return 1;
-  if(beos_block->magic1==le32(SUPER_BLOCK_MAGIC1) &&
-      recover_BeFS(disk, beos_block, partition, dump_ind)==0)
-    return 1;
-  if(cramfs->magic==le32(CRAMFS_MAGIC) &&
-    recover_cramfs(disk, cramfs, partition, verbose, dump_ind)==0)
-    return 1;
-  if(((unsigned)sysv4->s_magic == le32(0xfd187e20) || (unsigned)sysv4->s_magic == be32(0xfd187e20)) &&
-      recover_sysv(disk, sysv4, partition, verbose, dump_ind)==0)
-    return 1;
-  if(memcmp((const char *)lvm2->type, LVM2_LABEL, sizeof(lvm2->type)) == 0 &&
-      recover_LVM2(disk, (buffer+0x200), partition, verbose, dump_ind)==0)
-    return 1;
-  if(le32(sunlabel->magic_start) == SUN_LABEL_MAGIC_START &&
-      recover_sun_i386(disk, sunlabel, partition, verbose, dump_ind)==0)
+#if !defined(DISABLED_FOR_FRAMAC)
+  if(fs_probe(probes_1, buffer+0x200, disk, partition, verbose, dump_ind)!=0)
     return 1;
 #endif
   return 0;
@@ -278,31 +439,13 @@ int search_type_1(const unsigned char *buffer, const disk_t *disk, partition_t *
 
 int search_type_2(const unsigned char *buffer, disk_t *disk, partition_t *partition, const int verbose, const int dump_ind)
 {
-#if !defined(DISABLED_FOR_FRAMAC)
-  const hfs_mdb_t *hfs_mdb=(const hfs_mdb_t *)(buffer+0x400);
-  const struct hfsp_vh *vh=(const struct hfsp_vh *)(buffer+0x400);
-  const struct ext2_super_block *sb=(const struct ext2_super_block*)(buffer+0x400);
-  const struct f2fs_super_block *sb_f2fs=(const struct f2fs_super_block *)(buffer+0x400);
-//  assert(sizeof(struct ext2_super_block)<=1024);
-//  assert(sizeof(hfs_mdb_t)<=1024);
-//  assert(sizeof(struct hfsp_vh)<=1024);
-//  assert(sizeof(struct f2fs_super_block)==3072);
   if(verbose>2)
   {
     log_trace("search_type_2 lba=%lu\n",
 	(long unsigned)(partition->part_offset/disk->sector_size));
   }
-  if(le16(sb->s_magic)==EXT2_SUPER_MAGIC &&
-      recover_EXT2(disk, sb, partition, verbose, dump_ind)==0)
-    return 1;
-  if(hfs_mdb->drSigWord==be16(HFS_SUPER_MAGIC) &&
-      recover_HFS(disk, hfs_mdb, partition, verbose, dump_ind, 0)==0)
-    return 1;
-  if((be16(vh->version)==4 || be16(vh->version)==5) &&
-      recover_HFSP(disk, vh, partition, verbose, dump_ind, 0)==0)
-    return 1;
-  if(sb_f2fs->magic == le32(F2FS_SUPER_MAGIC) &&
-      recover_f2fs(disk, sb_f2fs, partition)==0)
+#if !defined(DISABLED_FOR_FRAMAC)
+  if(fs_probe(probes_2, buffer+0x400, disk, partition, verbose, dump_ind)!=0)
     return 1;
 #endif
   return 0;
@@ -342,18 +485,8 @@ int search_type_16(unsigned char *buffer, disk_t *disk,partition_t *partition,co
   if(disk->pread(disk, buffer, 3 * DEFAULT_SECTOR_SIZE, partition->part_offset + 16 * 512) != 3 * DEFAULT_SECTOR_SIZE)
     return -1;
 #if !defined(DISABLED_FOR_FRAMAC)
-  {
-    const struct ufs_super_block *ufs=(const struct ufs_super_block *)buffer;
-    const struct vdev_boot_header *zfs=(const struct vdev_boot_header*)buffer;
-    /* Test UFS */
-    if((le32(ufs->fs_magic)==UFS_MAGIC || be32(ufs->fs_magic)==UFS_MAGIC ||
-	  le32(ufs->fs_magic)==UFS2_MAGIC || be32(ufs->fs_magic)==UFS2_MAGIC) &&
-	recover_ufs(disk, ufs, partition, verbose, dump_ind)==0)
-      return 1;
-    if(le64(zfs->vb_magic)==VDEV_BOOT_MAGIC &&
-	recover_ZFS(disk, zfs, partition, verbose, dump_ind)==0)
-      return 1;
-  }
+  if(fs_probe(probes_16, buffer, disk, partition, verbose, dump_ind)!=0)
+    return 1;
 #endif
   return 0;
 }
@@ -390,31 +523,9 @@ int search_type_128(unsigned char *buffer, disk_t *disk, partition_t *partition,
   if(disk->pread(disk, buffer, 11 * DEFAULT_SECTOR_SIZE, partition->part_offset + 126 * 512) != 11 * DEFAULT_SECTOR_SIZE)
     return -1;
 #if !defined(DISABLED_FOR_FRAMAC)
-  {
-    const unsigned char *buffer_1024=buffer+0x400;
-    const struct reiserfs_super_block *rfs=(const struct reiserfs_super_block *)buffer_1024;
-    const struct reiser4_master_sb *rfs4=(const struct reiser4_master_sb *)buffer_1024;
-    const struct ufs_super_block *ufs=(const struct ufs_super_block *)buffer_1024;
-    const struct btrfs_super_block *btrfs=(const struct btrfs_super_block*)buffer_1024;
-    const struct gfs2_sb *gfs2=(const struct gfs2_sb *)buffer_1024;
-    /* 64k offset */
-    /* Test ReiserFS */
-    if((memcmp(rfs->s_magic,"ReIs",4) == 0 ||
-	  memcmp(rfs4->magic,REISERFS4_SUPER_MAGIC,sizeof(REISERFS4_SUPER_MAGIC)) == 0) &&
-	recover_rfs(disk, rfs, partition, verbose, dump_ind)==0)
-      return 1;
-    /* Test UFS2 */
-    if((le32(ufs->fs_magic)==UFS_MAGIC || be32(ufs->fs_magic)==UFS_MAGIC ||
-	  le32(ufs->fs_magic)==UFS2_MAGIC || be32(ufs->fs_magic)==UFS2_MAGIC) &&
-	recover_ufs(disk, ufs, partition, verbose, dump_ind)==0)
-      return 1;
-    if(memcmp(&btrfs->magic, BTRFS_MAGIC, 8)==0 &&
-      recover_btrfs(disk, btrfs, partition, verbose, dump_ind)==0)
-      return 1;
-    if(gfs2->sb_header.mh_magic==be32(GFS2_MAGIC) &&
-	recover_gfs2(disk, gfs2, partition, dump_ind)==0)
-      return 1;
-  }
+  /* 64k offset */
+  if(fs_probe(probes_128, buffer+0x400, disk, partition, verbose, dump_ind)!=0)
+    return 1;
 #endif
   return 0;
 }
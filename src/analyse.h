@@ -36,14 +36,14 @@ extern "C" {
 int search_type_0(const unsigned char *buffer, disk_t *disk_car,partition_t *partition,const int verbose, const int dump_ind);
 
 /*@
-  @ requires \valid_read(disk_car);
+  @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
   @ requires \valid(partition);
   @ requires valid_partition(partition);
   @ requires \separated(buffer, disk_car, partition);
   @ decreases 0;
   @*/
-int search_type_1(const unsigned char *buffer, const disk_t *disk_car, partition_t *partition, const int verbose, const int dump_ind);
+int search_type_1(const unsigned char *buffer, disk_t *disk_car, partition_t *partition, const int verbose, const int dump_ind);
 
 /*@
   @ requires \valid(disk_car);
@@ -0,0 +1,540 @@
+/*
+
+    File: analyse_cache.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "log.h"
+#include "analyse_cache.h"
+
+extern const arch_fnct_t arch_i386;
+
+#define ANALYSE_CACHE_REGION_SIZE	(1024*1024)
+#define ANALYSE_CACHE_VERSION		1
+#define ANALYSE_CACHE_MAX_CONFIGS	8
+
+typedef struct
+{
+  uint64_t location;
+  partition_t part;
+} analyse_cache_part_t;
+
+/* Stored as is at the beginning of the cache file, the file is only read
+ * back by the same build */
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t sizeof_part;
+  uint64_t disk_id;
+  uint64_t disk_size;
+  uint32_t sector_size;
+  uint32_t location_boundary;
+  int32_t fast_mode;
+  uint32_t heads_per_cylinder;
+  uint32_t sectors_per_head;
+  uint32_t nbr_regions;
+  uint32_t nbr_hints;
+  uint32_t nbr_parts;
+  char arch[32];
+} analyse_cache_header_t;
+
+struct analyse_cache_struct
+{
+  analyse_cache_header_t hdr;
+  const arch_fnct_t *arch;
+  unsigned char *done;
+  /* Hints used when probing the regions, sorted */
+  uint64_t *hints;
+  unsigned int nbr_hints;
+  unsigned int max_hints;
+  /* Hints in the probed regions that weren't used to probe them, sorted */
+  uint64_t *new_hints;
+  unsigned int nbr_new_hints;
+  unsigned int max_new_hints;
+  /* Sorted by location, in the order they have been found */
+  analyse_cache_part_t *parts;
+  unsigned int nbr_parts;
+  unsigned int max_parts;
+};
+
+/* The caches of the last disk analysed, one for each set of parameters */
+static analyse_cache_t *session_caches[ANALYSE_CACHE_MAX_CONFIGS];
+static unsigned int nbr_session_caches=0;
+static char *session_filename=NULL;
+static int analyse_cache_enabled=1;
+
+static uint64_t analyse_cache_hash(uint64_t hash, const char *str)
+{
+  if(str==NULL)
+    return hash;
+  for(; *str!='\0'; str++)
+  {
+    hash^=(unsigned char)*str;
+    hash*=0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void analyse_cache_set_config(analyse_cache_t *cache, const disk_t *disk, const unsigned int location_boundary, const int fast_mode)
+{
+  analyse_cache_header_t *hdr=&cache->hdr;
+  hdr->location_boundary=location_boundary;
+  hdr->fast_mode=fast_mode;
+  /* The Intel probes follow the cylinder boundaries */
+  hdr->heads_per_cylinder=(disk->arch==&arch_i386 ? disk->geom.heads_per_cylinder : 0);
+  hdr->sectors_per_head=(disk->arch==&arch_i386 ? disk->geom.sectors_per_head : 0);
+  memset(hdr->arch, 0, sizeof(hdr->arch));
+  strncpy(hdr->arch, disk->arch->part_name_option, sizeof(hdr->arch)-1);
+  cache->arch=disk->arch;
+}
+
+static int analyse_cache_same_config(const analyse_cache_header_t *a, const analyse_cache_header_t *b)
+{
+  return (a->location_boundary==b->location_boundary &&
+      a->fast_mode==b->fast_mode &&
+      a->heads_per_cylinder==b->heads_per_cylinder &&
+      a->sectors_per_head==b->sectors_per_head &&
+      strcmp(a->arch, b->arch)==0);
+}
+
+static void analyse_cache_free(analyse_cache_t *cache)
+{
+  free(cache->done);
+  free(cache->hints);
+  free(cache->new_hints);
+  free(cache->parts);
+  free(cache);
+}
+
+/* Index of the first value >= offset */
+static unsigned int offset_lower_bound(const uint64_t *tab, const unsigned int nbr, const uint64_t offset)
+{
+  unsigned int lo=0;
+  unsigned int hi=nbr;
+  while(lo<hi)
+  {
+    const unsigned int mid=(lo+hi)/2;
+    if(tab[mid]<offset)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return lo;
+}
+
+static void offset_insert(uint64_t **tab, unsigned int *nbr, unsigned int *max, const uint64_t offset)
+{
+  const unsigned int i=offset_lower_bound(*tab, *nbr, offset);
+  if(i<*nbr && (*tab)[i]==offset)
+    return;
+  if(*nbr>=*max)
+  {
+    *max=(*max==0 ? 64 : *max*2);
+    *tab=(uint64_t *)realloc(*tab, *max*sizeof(uint64_t));
+    if(*tab==NULL)
+    {
+      log_critical("analyse_cache: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(&(*tab)[i+1], &(*tab)[i], (*nbr-i)*sizeof(uint64_t));
+  (*tab)[i]=offset;
+  (*nbr)++;
+}
+
+static int offset_contains(const uint64_t *tab, const unsigned int nbr, const uint64_t offset)
+{
+  const unsigned int i=offset_lower_bound(tab, nbr, offset);
+  return (i<nbr && tab[i]==offset);
+}
+
+/* Index of the first partition found at a location >= offset */
+static unsigned int part_lower_bound(const analyse_cache_t *cache, const uint64_t location)
+{
+  unsigned int lo=0;
+  unsigned int hi=cache->nbr_parts;
+  while(lo<hi)
+  {
+    const unsigned int mid=(lo+hi)/2;
+    if(cache->parts[mid].location<location)
+      lo=mid+1;
+    else
+      hi=mid;
+  }
+  return lo;
+}
+
+/* Results outside the probed regions come from an interrupted scan,
+ * they will be found again */
+static void analyse_cache_prune(analyse_cache_t *cache)
+{
+  unsigned int i;
+  unsigned int j=0;
+  for(i=0; i<cache->nbr_parts; i++)
+  {
+    if(analyse_cache_is_done(cache, cache->parts[i].location))
+      cache->parts[j++]=cache->parts[i];
+  }
+  cache->nbr_parts=j;
+  j=0;
+  for(i=0; i<cache->nbr_hints; i++)
+  {
+    if(analyse_cache_is_done(cache, cache->hints[i]))
+      cache->hints[j++]=cache->hints[i];
+  }
+  cache->nbr_hints=j;
+  cache->nbr_new_hints=0;
+}
+
+static char *analyse_cache_filename(const uint64_t disk_id)
+{
+  const char *log_filename=log_get_filename();
+  const char *sep;
+  char *filename;
+  unsigned int dir_len;
+  if(log_filename==NULL)
+    return NULL;
+  sep=strrchr(log_filename, '/');
+#if defined(__CYGWIN__) || defined(__MINGW32__)
+  if(strrchr(log_filename, '\\') > sep)
+    sep=strrchr(log_filename, '\\');
+#endif
+  dir_len=(sep==NULL ? 0 : sep - log_filename + 1);
+  filename=(char *)MALLOC(dir_len + 40);
+  memcpy(filename, log_filename, dir_len);
+  sprintf(&filename[dir_len], "testdisk_%016llx.cache", (long long unsigned)disk_id);
+  return filename;
+}
+
+static analyse_cache_t *analyse_cache_new(const disk_t *disk, const uint64_t disk_id)
+{
+  analyse_cache_t *cache=(analyse_cache_t *)MALLOC(sizeof(*cache));
+  memset(cache, 0, sizeof(*cache));
+  memcpy(cache->hdr.magic, "TDACACHE", sizeof(cache->hdr.magic));
+  cache->hdr.version=ANALYSE_CACHE_VERSION;
+  cache->hdr.sizeof_part=sizeof(partition_t);
+  cache->hdr.disk_id=disk_id;
+  cache->hdr.disk_size=disk->disk_real_size;
+  cache->hdr.sector_size=disk->sector_size;
+  cache->hdr.nbr_regions=(disk->disk_real_size + ANALYSE_CACHE_REGION_SIZE - 1) / ANALYSE_CACHE_REGION_SIZE;
+  cache->done=(unsigned char *)MALLOC((cache->hdr.nbr_regions+7)/8+1);
+  memset(cache->done, 0, (cache->hdr.nbr_regions+7)/8+1);
+  cache->arch=disk->arch;
+  return cache;
+}
+
+/* Read the next cache of the file, NULL at the end of the file or if it
+ * isn't a cache of this disk */
+static analyse_cache_t *analyse_cache_read(FILE *handle, const disk_t *disk, const uint64_t disk_id)
+{
+  analyse_cache_t *cache=analyse_cache_new(disk, disk_id);
+  analyse_cache_header_t hdr;
+  unsigned int i;
+  if(fread(&hdr, sizeof(hdr), 1, handle)!=1 ||
+      memcmp(hdr.magic, cache->hdr.magic, sizeof(hdr.magic))!=0 ||
+      hdr.version!=ANALYSE_CACHE_VERSION ||
+      hdr.sizeof_part!=sizeof(partition_t) ||
+      hdr.disk_id!=cache->hdr.disk_id ||
+      hdr.disk_size!=cache->hdr.disk_size ||
+      hdr.sector_size!=cache->hdr.sector_size ||
+      hdr.nbr_regions!=cache->hdr.nbr_regions ||
+      fread(cache->done, (hdr.nbr_regions+7)/8, 1, handle)!=1)
+  {
+    analyse_cache_free(cache);
+    return NULL;
+  }
+  for(i=0; i<hdr.nbr_hints; i++)
+  {
+    uint64_t offset;
+    if(fread(&offset, sizeof(offset), 1, handle)!=1)
+    {
+      analyse_cache_free(cache);
+      return NULL;
+    }
+    offset_insert(&cache->hints, &cache->nbr_hints, &cache->max_hints, offset);
+  }
+  if(hdr.nbr_parts>0)
+  {
+    cache->parts=(analyse_cache_part_t *)MALLOC(hdr.nbr_parts*sizeof(analyse_cache_part_t));
+    cache->max_parts=hdr.nbr_parts;
+    if(fread(cache->parts, sizeof(analyse_cache_part_t), hdr.nbr_parts, handle)!=hdr.nbr_parts)
+    {
+      analyse_cache_free(cache);
+      return NULL;
+    }
+    cache->nbr_parts=hdr.nbr_parts;
+  }
+  cache->hdr=hdr;
+  for(i=0; i<cache->nbr_parts; i++)
+    cache->parts[i].part.arch=cache->arch;
+  return cache;
+}
+
+static void analyse_cache_load(const disk_t *disk, const uint64_t disk_id)
+{
+  FILE *handle;
+  analyse_cache_t *cache;
+  if(session_filename==NULL)
+    return ;
+  handle=fopen(session_filename, "rb");
+  if(handle==NULL)
+    return ;
+  while(nbr_session_caches<ANALYSE_CACHE_MAX_CONFIGS &&
+      (cache=analyse_cache_read(handle, disk, disk_id))!=NULL)
+    session_caches[nbr_session_caches++]=cache;
+  fclose(handle);
+}
+
+void analyse_cache_set_enable(const int enable)
+{
+  analyse_cache_enabled=enable;
+}
+
+analyse_cache_t *analyse_cache_get(const disk_t *disk, const unsigned int location_boundary, const int fast_mode)
+{
+  analyse_cache_t *cache=NULL;
+  unsigned int i;
+  uint64_t disk_id=0xcbf29ce484222325ULL;
+  if(analyse_cache_enabled==0)
+    return NULL;
+  disk_id=analyse_cache_hash(disk_id, disk->device);
+  disk_id=analyse_cache_hash(disk_id, disk->model);
+  disk_id=analyse_cache_hash(disk_id, disk->serial_no);
+  if(nbr_session_caches>0 &&
+      (session_caches[0]->hdr.disk_id!=disk_id ||
+       session_caches[0]->hdr.disk_size!=disk->disk_real_size ||
+       session_caches[0]->hdr.sector_size!=disk->sector_size))
+  {
+    for(i=0; i<nbr_session_caches; i++)
+      analyse_cache_free(session_caches[i]);
+    nbr_session_caches=0;
+    free(session_filename);
+    session_filename=NULL;
+  }
+  if(nbr_session_caches==0 && session_filename==NULL)
+  {
+    session_filename=analyse_cache_filename(disk_id);
+    analyse_cache_load(disk, disk_id);
+  }
+  {
+    analyse_cache_t *tmp=analyse_cache_new(disk, disk_id);
+    analyse_cache_set_config(tmp, disk, location_boundary, fast_mode);
+    for(i=0; i<nbr_session_caches && cache==NULL; i++)
+      if(analyse_cache_same_config(&session_caches[i]->hdr, &tmp->hdr))
+	cache=session_caches[i];
+    if(cache==NULL)
+    {
+      /* Forget the oldest set of parameters */
+      if(nbr_session_caches==ANALYSE_CACHE_MAX_CONFIGS)
+      {
+	analyse_cache_free(session_caches[0]);
+	nbr_session_caches--;
+	memmove(&session_caches[0], &session_caches[1], nbr_session_caches*sizeof(analyse_cache_t *));
+      }
+      session_caches[nbr_session_caches++]=tmp;
+      return tmp;
+    }
+    analyse_cache_free(tmp);
+  }
+  cache->arch=disk->arch;
+  analyse_cache_prune(cache);
+  {
+    unsigned int nbr_done=0;
+    for(i=0; i<cache->hdr.nbr_regions; i++)
+      if((cache->done[i/8]&(1<<(i%8)))!=0)
+	nbr_done++;
+    if(nbr_done>0)
+      log_info("Using the previous analysis of %u MiB of the disk\n", nbr_done);
+  }
+  return cache;
+}
+
+int analyse_cache_is_done(const analyse_cache_t *cache, const uint64_t offset)
+{
+  const uint64_t region=offset / ANALYSE_CACHE_REGION_SIZE;
+  if(cache==NULL || region >= cache->hdr.nbr_regions)
+    return 0;
+  return ((cache->done[region/8] & (1<<(region%8)))!=0);
+}
+
+void analyse_cache_set_done(analyse_cache_t *cache, const uint64_t start, const uint64_t end)
+{
+  uint64_t region;
+  uint64_t last;
+  if(cache==NULL || cache->hdr.nbr_regions<3)
+    return ;
+  /* The partition tables may have been modified, always probe them */
+  region=(start + ANALYSE_CACHE_REGION_SIZE - 1) / ANALYSE_CACHE_REGION_SIZE;
+  if(region==0)
+    region=1;
+  last=end / ANALYSE_CACHE_REGION_SIZE;
+  if(last > cache->hdr.nbr_regions - 1)
+    last=cache->hdr.nbr_regions - 1;
+  for(; region<last; region++)
+    cache->done[region/8]|=(1<<(region%8));
+}
+
+void analyse_cache_add_hint(analyse_cache_t *cache, const uint64_t offset)
+{
+  if(cache==NULL)
+    return ;
+  if(!analyse_cache_is_done(cache, offset))
+    offset_insert(&cache->hints, &cache->nbr_hints, &cache->max_hints, offset);
+  else if(!offset_contains(cache->hints, cache->nbr_hints, offset))
+    offset_insert(&cache->new_hints, &cache->nbr_new_hints, &cache->max_new_hints, offset);
+}
+
+int analyse_cache_is_new_hint(const analyse_cache_t *cache, const uint64_t offset)
+{
+  if(cache==NULL)
+    return 0;
+  return offset_contains(cache->new_hints, cache->nbr_new_hints, offset);
+}
+
+void analyse_cache_reprobe(analyse_cache_t *cache, const uint64_t offset)
+{
+  unsigned int first;
+  unsigned int nbr;
+  if(cache==NULL)
+    return ;
+  nbr=analyse_cache_find(cache, offset, &first);
+  if(nbr>0)
+  {
+    memmove(&cache->parts[first], &cache->parts[first+nbr],
+	(cache->nbr_parts-first-nbr)*sizeof(analyse_cache_part_t));
+    cache->nbr_parts-=nbr;
+  }
+  if(analyse_cache_is_new_hint(cache, offset))
+    offset_insert(&cache->hints, &cache->nbr_hints, &cache->max_hints, offset);
+}
+
+void analyse_cache_add_part(analyse_cache_t *cache, const uint64_t location, const partition_t *partition)
+{
+  unsigned int i;
+  if(cache==NULL)
+    return ;
+  if(cache->nbr_parts>=cache->max_parts)
+  {
+    cache->max_parts=(cache->max_parts==0 ? 16 : cache->max_parts*2);
+    cache->parts=(analyse_cache_part_t *)realloc(cache->parts, cache->max_parts*sizeof(analyse_cache_part_t));
+    if(cache->parts==NULL)
+    {
+      log_critical("analyse_cache: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* After the partitions already found at this location */
+  i=part_lower_bound(cache, location+1);
+  memmove(&cache->parts[i+1], &cache->parts[i], (cache->nbr_parts-i)*sizeof(analyse_cache_part_t));
+  cache->parts[i].location=location;
+  dup_partition_t(&cache->parts[i].part, partition);
+  cache->nbr_parts++;
+}
+
+unsigned int analyse_cache_find(const analyse_cache_t *cache, const uint64_t location, unsigned int *first)
+{
+  unsigned int i;
+  *first=0;
+  if(cache==NULL)
+    return 0;
+  *first=part_lower_bound(cache, location);
+  for(i=*first; i<cache->nbr_parts && cache->parts[i].location==location; i++);
+  return i-*first;
+}
+
+const partition_t *analyse_cache_part(const analyse_cache_t *cache, const unsigned int i)
+{
+  return &cache->parts[i].part;
+}
+
+static int analyse_cache_write(FILE *handle, const analyse_cache_t *cache)
+{
+  analyse_cache_header_t hdr;
+  unsigned int i;
+  hdr=cache->hdr;
+  hdr.nbr_hints=cache->nbr_hints;
+  hdr.nbr_parts=0;
+  for(i=0; i<cache->nbr_parts; i++)
+    if(analyse_cache_is_done(cache, cache->parts[i].location))
+      hdr.nbr_parts++;
+  if(fwrite(&hdr, sizeof(hdr), 1, handle)!=1 ||
+      fwrite(cache->done, (hdr.nbr_regions+7)/8, 1, handle)!=1)
+    return -1;
+  if(cache->nbr_hints>0 &&
+      fwrite(cache->hints, sizeof(uint64_t), cache->nbr_hints, handle)!=cache->nbr_hints)
+    return -1;
+  for(i=0; i<cache->nbr_parts; i++)
+  {
+    if(analyse_cache_is_done(cache, cache->parts[i].location))
+    {
+      analyse_cache_part_t rec=cache->parts[i];
+      rec.part.arch=NULL;
+      if(fwrite(&rec, sizeof(rec), 1, handle)!=1)
+	return -1;
+    }
+  }
+  return 0;
+}
+
+void analyse_cache_save(const analyse_cache_t *cache)
+{
+  char *tmp_filename;
+  FILE *handle;
+  unsigned int i;
+  int ok=1;
+  if(cache==NULL || session_filename==NULL)
+    return ;
+  tmp_filename=(char *)MALLOC(strlen(session_filename)+5);
+  sprintf(tmp_filename, "%s.tmp", session_filename);
+  handle=fopen(tmp_filename, "wb");
+  if(handle==NULL)
+  {
+    free(tmp_filename);
+    return ;
+  }
+  for(i=0; ok && i<nbr_session_caches; i++)
+    if(analyse_cache_write(handle, session_caches[i])<0)
+      ok=0;
+  if(fclose(handle)!=0)
+    ok=0;
+  if(ok==0 || rename(tmp_filename, session_filename)!=0)
+  {
+    log_warning("Failed to save the analysis in %s\n", session_filename);
+    unlink(tmp_filename);
+  }
+  free(tmp_filename);
+}
@@ -0,0 +1,117 @@
+/*
+
+    File: analyse_cache.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _ANALYSE_CACHE_H
+#define _ANALYSE_CACHE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Results of search_part() kept for the next analysis of the same disk.
+ * The disk is divided in 1 MiB regions, a bit is set for each region where
+ * every location has been probed without read error. The partitions found
+ * are recorded with the location that was probed when they were found.
+ * A new analysis replays the results of those regions instead of reading
+ * them again, as long as the probes would be the same: same partition
+ * table type, same search mode, same geometry for the Intel type whose probes
+ * follow the cylinders. The first and last regions, where the partition
+ * tables are written, are always probed again.
+ * The cache is saved next to the log file, so a later run of TestDisk, e.g.
+ * after a crash, reuses it too. */
+typedef struct analyse_cache_struct analyse_cache_t;
+
+/* enable==0: analyse_cache_get() returns NULL, every location is probed
+ * and nothing is saved. Enabled by default */
+void analyse_cache_set_enable(const int enable);
+
+/* Cache of disk for a search with these parameters. The caches of the
+ * last disk analysed are kept, up to 8 sets of parameters */
+/*@
+  @ requires \valid_read(disk);
+  @ requires valid_disk(disk);
+  @*/
+analyse_cache_t *analyse_cache_get(const disk_t *disk, const unsigned int location_boundary, const int fast_mode);
+
+/* Return 1 if the region holding offset has been completely probed */
+/*@
+  @ requires cache == \null || \valid_read(cache);
+  @ assigns \nothing;
+  @*/
+int analyse_cache_is_done(const analyse_cache_t *cache, const uint64_t offset);
+
+/* Every location in [start, end[ has been probed */
+/*@
+  @ requires cache == \null || \valid(cache);
+  @*/
+void analyse_cache_set_done(analyse_cache_t *cache, const uint64_t start, const uint64_t end);
+
+/* Offset is a location hint given before the scan, e.g. by the current
+ * partition table */
+/*@
+  @ requires cache == \null || \valid(cache);
+  @*/
+void analyse_cache_add_hint(analyse_cache_t *cache, const uint64_t offset);
+
+/* Return 1 if offset is a hint in a probed region that wasn't one when this
+ * region was probed: this location must be probed again */
+/*@
+  @ requires cache == \null || \valid_read(cache);
+  @ assigns \nothing;
+  @*/
+int analyse_cache_is_new_hint(const analyse_cache_t *cache, const uint64_t offset);
+
+/* The location is going to be probed again, forget its results */
+/*@
+  @ requires cache == \null || \valid(cache);
+  @*/
+void analyse_cache_reprobe(analyse_cache_t *cache, const uint64_t offset);
+
+/* partition has been found when probing location */
+/*@
+  @ requires cache == \null || \valid(cache);
+  @ requires \valid_read(partition);
+  @*/
+void analyse_cache_add_part(analyse_cache_t *cache, const uint64_t location, const partition_t *partition);
+
+/* Number of partitions found when probing location, *first is set to the
+ * index of the first one for analyse_cache_part() */
+/*@
+  @ requires cache == \null || \valid_read(cache);
+  @ requires \valid(first);
+  @ assigns *first;
+  @*/
+unsigned int analyse_cache_find(const analyse_cache_t *cache, const uint64_t location, unsigned int *first);
+
+/*@
+  @ requires \valid_read(cache);
+  @*/
+const partition_t *analyse_cache_part(const analyse_cache_t *cache, const unsigned int i);
+
+/* Write the caches of the disk next to the log file, no-op without log file */
+/*@
+  @ requires cache == \null || \valid_read(cache);
+  @*/
+void analyse_cache_save(const analyse_cache_t *cache);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
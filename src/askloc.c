@@ -182,7 +182,7 @@ void ask_location(char *dst_directory, const unsigned int dst_size, const char *
   {
     DIR* dir;
     file_info_t dir_list;
-    TD_INIT_LIST_HEAD(&dir_list.list);
+    init_list_file(&dir_list);
     wmove(window,5,0);
     wclrtoeol(window);	/* before addstr for BSD compatibility */
     if(has_colors())
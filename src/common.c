@@ -28,6 +28,7 @@
 #ifdef DISABLED_FOR_FRAMAC
 #undef HAVE_POSIX_MEMALIGN
 #undef HAVE_MEMALIGN
+#undef HAVE_MADVISE
 #undef HAVE_NCURSES
 #endif
 
@@ -50,6 +51,9 @@
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <assert.h>
 #include "types.h"
 #include "common.h"
@@ -105,6 +109,33 @@ void *MALLOC(size_t size)
   return res;
 }
 
+#define HUGE_PAGE_SIZE	(2*1024*1024)
+
+static int io_hugepages=1;
+
+void set_io_hugepages(const int enable)
+{
+  io_hugepages=enable;
+}
+
+void *MALLOC_IO(size_t size)
+{
+#if defined(HAVE_POSIX_MEMALIGN) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+  if(size>=HUGE_PAGE_SIZE && io_hugepages>0)
+  {
+    void *res;
+    if(posix_memalign(&res, HUGE_PAGE_SIZE, size)==0)
+    {
+      /* Before the first access, so the pages are allocated as huge pages */
+      madvise(res, size/HUGE_PAGE_SIZE*HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+      memset(res,0,size);
+      return res;
+    }
+  }
+#endif
+  return MALLOC(size);
+}
+
 #ifndef HAVE_SNPRINTF
 int snprintf(char *str, size_t size, const char *format, ...)
 {
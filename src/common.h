@@ -31,6 +31,20 @@ extern "C" {
 #include <string.h>
 #endif
 
+/* Carving state of a pass. Each thread running photorec_aux() gets its
+ * own copy and must free it before it exits. The search space node
+ * pools, used by the thread that creates the search space too, and the
+ * write buffers stay shared by the process behind a mutex. */
+#if defined(DISABLED_FOR_FRAMAC) || defined(__FRAMAC__)
+#define TD_THREAD_LOCAL
+#elif defined(__GNUC__)
+#define TD_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define TD_THREAD_LOCAL __declspec(thread)
+#else
+#define TD_THREAD_LOCAL
+#endif
+
 struct efi_guid_s
 {
   uint32_t time_low;
@@ -242,6 +256,13 @@ typedef struct efi_guid_s efi_guid_t;
 #define TESTDISK_O_READAHEAD_8K 04
 #define TESTDISK_O_READAHEAD_32K 010
 #define TESTDISK_O_ALL		020
+#define TESTDISK_O_MMAP		0100
+
+/* Hints for disk_t advise(), how a range of the disk will be read */
+#define TESTDISK_ADVISE_NORMAL		0
+#define TESTDISK_ADVISE_SEQUENTIAL	1
+#define TESTDISK_ADVISE_WILLNEED	2
+#define TESTDISK_ADVISE_DONTNEED	3
 
 enum upart_type {
   UP_UNK=0,
@@ -428,6 +449,8 @@ struct param_disk_struct
   int (*pwrite)(disk_t *disk, const void *buf, const unsigned int count, const uint64_t offset);
   int (*sync)(disk_t *disk);
   void (*clean)(disk_t *disk);
+  /* Optional, NULL if the hints are useless for this kind of disk */
+  void (*advise)(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint);
   const arch_fnct_t *arch;
   const arch_fnct_t *arch_autodetected;
   void *data;
@@ -525,6 +548,22 @@ struct my_data_struct
   @*/
 void *MALLOC(size_t size);
 
+/* Buffer for the disk reads: sector aligned like MALLOC(), large buffers
+ * are aligned on 2 MiB and backed by transparent huge pages */
+/*@
+  @ requires size > 0;
+  @ ensures \valid(((char *)\result)+(0..size-1));
+  @ ensures zero_initialization: \subset(((char *)\result)[0..size-1], {0});
+  @ assigns __fc_heap_status;
+  @*/
+void *MALLOC_IO(size_t size);
+
+/* 0 to allocate the large read buffers like MALLOC() */
+/*@
+  @ assigns \nothing;
+  @*/
+void set_io_hugepages(const int enable);
+
 /*@
   @ requires \valid(partition);
   @ requires valid_partition(partition);
@@ -43,6 +43,9 @@
 #include <string.h>
 #endif
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef HAVE_SYS_UTSNAME_H
 #include <sys/utsname.h>
 #endif
@@ -66,22 +69,248 @@
 #include "file_gz.h"
 #include "ntfs_dir.h"
 #include "misc.h"
+#include "log.h"
+#include "phash.h"
+#include "paffinity.h"
 #include "dfxml.h"
 
+/* Output is formatted in memory and written by blocks of complete
+ * entries, by a background thread when available. */
+#define XML_BUFFER_SIZE (256*1024)
+
+typedef struct
+{
+  char *data;
+  unsigned int size;
+  unsigned int alloc;
+} xml_buffer_t;
+
 static FILE *xml_handle = NULL;
+static FILE *jsonl_handle = NULL;
+static int jsonl_enabled = 0;
 static int xml_stack_depth = 0;
 static char *command_line = NULL;
+static xml_buffer_t xml_buf = { NULL, 0, 0 };
+static xml_buffer_t jsonl_buf = { NULL, 0, 0 };
+static time_t xml_flush_time = 0;
+
+#ifdef HAVE_PTHREAD
+static struct
+{
+  int thread_ok;
+  int pending;
+  int quit;
+  xml_buffer_t buf[2];
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} xml_writer;
+static int xml_atfork_done = 0;
+#endif
 
 static const char *xml_header = "<?xml version='1.0' encoding='UTF-8'?>\n";
 static char xml_dir[2048];
 static char xml_fname[2048];			/* what photorec uses elsewhere */
 
+static void xml_reserve(xml_buffer_t *buffer, const unsigned int len)
+{
+  if(buffer->size + len <= buffer->alloc)
+    return ;
+  if(buffer->alloc==0)
+    buffer->alloc=XML_BUFFER_SIZE;
+  while(buffer->size + len > buffer->alloc)
+    buffer->alloc*=2;
+  buffer->data=(char *)realloc(buffer->data, buffer->alloc);
+  if(buffer->data==NULL)
+  {
+    log_critical("dfxml: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void xml_write(xml_buffer_t *buffer, const char *data, const unsigned int len)
+{
+  xml_reserve(buffer, len);
+  memcpy(&buffer->data[buffer->size], data, len);
+  buffer->size+=len;
+}
+
+static void xml_puts(xml_buffer_t *buffer, const char *str)
+{
+  xml_write(buffer, str, strlen(str));
+}
+
+static void xml_putc(xml_buffer_t *buffer, const char c)
+{
+  xml_reserve(buffer, 1);
+  buffer->data[buffer->size++]=c;
+}
+
+static void xml_put_u64(xml_buffer_t *buffer, uint64_t value)
+{
+  char tmp[20];
+  unsigned int i=sizeof(tmp);
+  do
+  {
+    tmp[--i]='0' + (value % 10);
+    value/=10;
+  } while(value > 0);
+  xml_write(buffer, &tmp[i], sizeof(tmp) - i);
+}
+
+static void xml_put_hex(xml_buffer_t *buffer, const unsigned char *data, const unsigned int len)
+{
+  static const char hex[]="0123456789abcdef";
+  unsigned int i;
+  xml_reserve(buffer, 2 * len);
+  for(i=0; i<len; i++)
+  {
+    buffer->data[buffer->size++]=hex[data[i] >> 4];
+    buffer->data[buffer->size++]=hex[data[i] & 0x0f];
+  }
+}
+
+static void xml_vprintf(xml_buffer_t *buffer, const char *fmt, va_list ap) __attribute__((format(printf, 2, 0)));
+static void xml_vprintf(xml_buffer_t *buffer, const char *fmt, va_list ap)
+{
+  int len;
+  va_list ap2;
+  xml_reserve(buffer, 256);
+  va_copy(ap2, ap);
+  len=vsnprintf(&buffer->data[buffer->size], buffer->alloc - buffer->size, fmt, ap2);
+  va_end(ap2);
+  if(len < 0)
+    return ;
+  if((unsigned int)len >= buffer->alloc - buffer->size)
+  {
+    xml_reserve(buffer, len + 1);
+    vsnprintf(&buffer->data[buffer->size], buffer->alloc - buffer->size, fmt, ap);
+  }
+  buffer->size+=len;
+}
+
+static void xml_write_buffer(FILE *handle, xml_buffer_t *buffer)
+{
+  if(handle!=NULL && buffer->size > 0)
+  {
+    if(fwrite(buffer->data, buffer->size, 1, handle)!=1)
+      log_error("dfxml: write error: %s\n", strerror(errno));
+    fflush(handle);
+  }
+  buffer->size=0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *xml_writer_thread(void *arg)
+{
+  paffinity_writer();
+  pthread_mutex_lock(&xml_writer.mutex);
+  while(1)
+  {
+    while(xml_writer.pending==0 && xml_writer.quit==0)
+      pthread_cond_wait(&xml_writer.cond, &xml_writer.mutex);
+    if(xml_writer.pending==0)
+      break;
+    /* The main thread doesn't touch the pending buffers nor the files */
+    pthread_mutex_unlock(&xml_writer.mutex);
+    xml_write_buffer(xml_handle, &xml_writer.buf[0]);
+    xml_write_buffer(jsonl_handle, &xml_writer.buf[1]);
+    pthread_mutex_lock(&xml_writer.mutex);
+    xml_writer.pending=0;
+    pthread_cond_broadcast(&xml_writer.cond);
+  }
+  pthread_mutex_unlock(&xml_writer.mutex);
+  return arg;
+}
+
+/* A forked worker has no writer thread, it writes its entries itself */
+static void xml_atfork_child(void)
+{
+  xml_writer.thread_ok=0;
+  xml_writer.pending=0;
+}
+
+static void xml_writer_wait(void)
+{
+  pthread_mutex_lock(&xml_writer.mutex);
+  while(xml_writer.pending!=0)
+    pthread_cond_wait(&xml_writer.cond, &xml_writer.mutex);
+  pthread_mutex_unlock(&xml_writer.mutex);
+}
+#endif
+
+/* Hand the formatted entries to the writer */
+static void xml_flush_async(void)
+{
+#ifdef HAVE_PTHREAD
+  if(xml_writer.thread_ok!=0)
+  {
+    xml_buffer_t tmp;
+    if(xml_buf.size==0 && jsonl_buf.size==0)
+      return ;
+    pthread_mutex_lock(&xml_writer.mutex);
+    while(xml_writer.pending!=0)
+      pthread_cond_wait(&xml_writer.cond, &xml_writer.mutex);
+    tmp=xml_writer.buf[0];
+    xml_writer.buf[0]=xml_buf;
+    xml_buf=tmp;
+    tmp=xml_writer.buf[1];
+    xml_writer.buf[1]=jsonl_buf;
+    jsonl_buf=tmp;
+    xml_writer.pending=1;
+    pthread_cond_broadcast(&xml_writer.cond);
+    pthread_mutex_unlock(&xml_writer.mutex);
+    xml_buf.size=0;
+    jsonl_buf.size=0;
+    return ;
+  }
+#endif
+  xml_write_buffer(xml_handle, &xml_buf);
+  xml_write_buffer(jsonl_handle, &jsonl_buf);
+}
+
+void xml_flush(void)
+{
+  xml_flush_async();
+#ifdef HAVE_PTHREAD
+  if(xml_writer.thread_ok!=0)
+    xml_writer_wait();
+#endif
+}
+
+void xml_set_jsonl(const int enable)
+{
+  jsonl_enabled=enable;
+}
 
 FILE *xml_open(const char *recup_dir, const unsigned int dir_num)
 {
   snprintf(xml_dir, sizeof(xml_dir), "%s.%u/", recup_dir,dir_num);
   snprintf(xml_fname, sizeof(xml_fname), "%s.%u/report.xml", recup_dir, dir_num);
   xml_handle = fopen(xml_fname,"w");
+  if(xml_handle==NULL)
+    return NULL;
+  if(jsonl_enabled!=0)
+  {
+    char jsonl_fname[2048];
+    snprintf(jsonl_fname, sizeof(jsonl_fname), "%s.%u/report.jsonl", recup_dir, dir_num);
+    jsonl_handle = fopen(jsonl_fname,"w");
+    if(jsonl_handle==NULL)
+      log_error("Can't create %s: %s\n", jsonl_fname, strerror(errno));
+  }
+  xml_flush_time=time(NULL);
+#ifdef HAVE_PTHREAD
+  xml_writer.pending=0;
+  xml_writer.quit=0;
+  pthread_mutex_init(&xml_writer.mutex, NULL);
+  pthread_cond_init(&xml_writer.cond, NULL);
+  xml_writer.thread_ok=(pthread_create(&xml_writer.thread, NULL, &xml_writer_thread, NULL)==0);
+  if(xml_writer.thread_ok!=0 && xml_atfork_done==0)
+  {
+    pthread_atfork(NULL, NULL, &xml_atfork_child);
+    xml_atfork_done=1;
+  }
+#endif
   return xml_handle;
 }
 
@@ -116,19 +345,44 @@ void xml_close()
 {
   if(xml_handle==NULL)
     return;
+  xml_flush_async();
+#ifdef HAVE_PTHREAD
+  if(xml_writer.thread_ok!=0)
+  {
+    pthread_mutex_lock(&xml_writer.mutex);
+    xml_writer.quit=1;
+    pthread_cond_broadcast(&xml_writer.cond);
+    pthread_mutex_unlock(&xml_writer.mutex);
+    pthread_join(xml_writer.thread, NULL);
+    xml_writer.thread_ok=0;
+  }
+  pthread_cond_destroy(&xml_writer.cond);
+  pthread_mutex_destroy(&xml_writer.mutex);
+  free(xml_writer.buf[0].data);
+  free(xml_writer.buf[1].data);
+  memset(&xml_writer.buf, 0, sizeof(xml_writer.buf));
+#endif
   fclose(xml_handle);
   xml_handle = NULL;
+  if(jsonl_handle!=NULL)
+  {
+    fclose(jsonl_handle);
+    jsonl_handle = NULL;
+  }
+  free(xml_buf.data);
+  free(jsonl_buf.data);
+  memset(&xml_buf, 0, sizeof(xml_buf));
+  memset(&jsonl_buf, 0, sizeof(jsonl_buf));
 }
 
 static void xml_spaces(void)
 {
-  int i;
+  const unsigned int len=xml_stack_depth * 2;
   if(xml_handle==NULL)
     return;
-  for(i = 0; i < xml_stack_depth * 2; i++)
-  {
-    fputc(' ', xml_handle);
-  }
+  xml_reserve(&xml_buf, len);
+  memset(&xml_buf.data[xml_buf.size], ' ', len);
+  xml_buf.size+=len;
 }
 
 static void xml_tagout(const char *tag,const char *attribute)
@@ -151,7 +405,7 @@ void xml_push(const char *tag,const char *attribute)
   if(xml_handle==NULL)
     return;
   xml_tagout(tag, attribute);
-  fputc('\n', xml_handle);
+  xml_putc(&xml_buf, '\n');
   xml_stack_depth++;
 }
 
@@ -161,7 +415,7 @@ void xml_pop(const char *tag)
     return;
   xml_stack_depth--;
   xml_ctagout(tag);
-  fputc('\n', xml_handle);
+  xml_putc(&xml_buf, '\n');
 }
 
 void xml_printf(const char *fmt,...)
@@ -171,29 +425,79 @@ void xml_printf(const char *fmt,...)
     return;
   va_start(ap, fmt);
   xml_spaces();
-  vfprintf(xml_handle, fmt, ap);
+  xml_vprintf(&xml_buf, fmt, ap);
   va_end(ap);
 }
 
-void xml_out2s(const char *tag, const char *value)
+static void xml_escape(xml_buffer_t *buffer, const char *value)
 {
-  if(xml_handle==NULL)
-    return;
-  xml_spaces();
-  fprintf(xml_handle, "<%s>", tag);
+  const char *start=value;
   for(;*value!='\0'; value++)
   {
     if(*value=='&')
-      fputs("&amp;", xml_handle);
-    else
-      putc(*value, xml_handle);
+    {
+      xml_write(buffer, start, value-start);
+      xml_puts(buffer, "&amp;");
+      start=value+1;
+    }
   }
-  fprintf(xml_handle, "</%s>\n", tag);
+  xml_write(buffer, start, value-start);
+}
+
+void xml_out2s(const char *tag, const char *value)
+{
+  if(xml_handle==NULL)
+    return;
+  xml_spaces();
+  xml_putc(&xml_buf, '<');
+  xml_puts(&xml_buf, tag);
+  xml_putc(&xml_buf, '>');
+  xml_escape(&xml_buf, value);
+  xml_puts(&xml_buf, "</");
+  xml_puts(&xml_buf, tag);
+  xml_puts(&xml_buf, ">\n");
 }
 
 void xml_out2i(const char *tag, const uint64_t value)
 {
-  xml_printf("<%s>%llu</%s>\n", tag, (long long unsigned)value, tag);
+  if(xml_handle==NULL)
+    return;
+  xml_spaces();
+  xml_putc(&xml_buf, '<');
+  xml_puts(&xml_buf, tag);
+  xml_putc(&xml_buf, '>');
+  xml_put_u64(&xml_buf, value);
+  xml_puts(&xml_buf, "</");
+  xml_puts(&xml_buf, tag);
+  xml_puts(&xml_buf, ">\n");
+}
+
+static void jsonl_string(const char *value)
+{
+  const char *start=value;
+  xml_putc(&jsonl_buf, '"');
+  for(;*value!='\0'; value++)
+  {
+    const unsigned char c=(const unsigned char)*value;
+    if(c=='"' || c=='\\' || c < 0x20)
+    {
+      xml_write(&jsonl_buf, start, value-start);
+      if(c=='"' || c=='\\')
+      {
+	xml_putc(&jsonl_buf, '\\');
+	xml_putc(&jsonl_buf, c);
+      }
+      else
+      {
+	char tmp[8];
+	snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+	xml_puts(&jsonl_buf, tmp);
+      }
+      start=value+1;
+    }
+  }
+  xml_write(&jsonl_buf, start, value-start);
+  xml_putc(&jsonl_buf, '"');
 }
 
 void xml_add_DFXML_creator(const char *package, const char *version)
@@ -270,7 +574,7 @@ void xml_setup(const disk_t *disk, const partition_t *partition)
 {
   if(xml_handle==NULL)
     return;
-  fputs(xml_header, xml_handle);
+  xml_puts(&xml_buf, xml_header);
   xml_push("dfxml", "xmloutputversion='1.0'");
   xml_push("metadata",
       "\n  xmlns='http://www.forensicswiki.org/wiki/Category:Digital_Forensics_XML' "
@@ -297,6 +601,26 @@ void xml_setup(const disk_t *disk, const partition_t *partition)
   xml_pop("source");
   xml_push("configuration", "");
   xml_pop("configuration");			// configuration
+  if(jsonl_handle!=NULL)
+  {
+    xml_puts(&jsonl_buf, "{\"source\":{\"image_filename\":");
+    jsonl_string(disk->device);
+    xml_puts(&jsonl_buf, ",\"sectorsize\":");
+    xml_put_u64(&jsonl_buf, disk->sector_size);
+    xml_puts(&jsonl_buf, ",\"image_size\":");
+    xml_put_u64(&jsonl_buf, disk->disk_real_size);
+    xml_puts(&jsonl_buf, ",\"img_offset\":");
+    xml_put_u64(&jsonl_buf, partition->part_offset);
+    xml_puts(&jsonl_buf, ",\"len\":");
+    xml_put_u64(&jsonl_buf, partition->part_size);
+    if(partition->blocksize > 0)
+    {
+      xml_puts(&jsonl_buf, ",\"block_size\":");
+      xml_put_u64(&jsonl_buf, partition->blocksize);
+    }
+    xml_puts(&jsonl_buf, "}}\n");
+  }
+  xml_flush();
 }
 
 void xml_shutdown(void)
@@ -321,30 +645,99 @@ static const char *relative_name(const char *fname)
 void xml_log_file_recovered(const file_recovery_t *file_recovery)
 {
   const struct td_list_head *tmp;
+  const phash_result_t *hash;
+  const char *filename;
   uint64_t file_size=0;
+  unsigned int nbr=0;
+  time_t now;
   if(xml_handle==NULL)
     return;
   if(file_recovery==NULL || file_recovery->filename[0]=='\0')
     return;
+  filename=relative_name(file_recovery->filename);
+  hash=phash_result(file_recovery);
   xml_push("fileobject", "");
-  xml_out2s("filename", relative_name(file_recovery->filename));
+  xml_out2s("filename", filename);
   xml_out2i("filesize", file_recovery->file_size);
   xml_push("byte_runs", "");
+  if(jsonl_handle!=NULL)
+  {
+    xml_puts(&jsonl_buf, "{\"filename\":");
+    jsonl_string(filename);
+    xml_puts(&jsonl_buf, ",\"filesize\":");
+    xml_put_u64(&jsonl_buf, file_recovery->file_size);
+    xml_puts(&jsonl_buf, ",\"byte_runs\":[");
+  }
   td_list_for_each(tmp, &file_recovery->location.list)
   {
     const alloc_list_t *element=td_list_entry_const(tmp, const alloc_list_t, list);
     if(element->data>0)
     {
       const uint64_t len=element->end - element->start + 1;
-      xml_printf( "<byte_run offset='%llu' img_offset='%llu' len='%llu'/>\n",
-	  (long long unsigned)file_size,
-	  (long long unsigned)element->start,
-	  (long long unsigned)len);
+      xml_spaces();
+      xml_puts(&xml_buf, "<byte_run offset='");
+      xml_put_u64(&xml_buf, file_size);
+      xml_puts(&xml_buf, "' img_offset='");
+      xml_put_u64(&xml_buf, element->start);
+      xml_puts(&xml_buf, "' len='");
+      xml_put_u64(&xml_buf, len);
+      xml_puts(&xml_buf, "'/>\n");
+      if(jsonl_handle!=NULL)
+      {
+	xml_puts(&jsonl_buf, (nbr>0 ? ",{\"offset\":" : "{\"offset\":"));
+	xml_put_u64(&jsonl_buf, file_size);
+	xml_puts(&jsonl_buf, ",\"img_offset\":");
+	xml_put_u64(&jsonl_buf, element->start);
+	xml_puts(&jsonl_buf, ",\"len\":");
+	xml_put_u64(&jsonl_buf, len);
+	xml_putc(&jsonl_buf, '}');
+      }
       file_size+=len;
+      nbr++;
     }
   }
   xml_pop("byte_runs");
+  if(jsonl_handle!=NULL)
+    xml_putc(&jsonl_buf, ']');
+  if(hash!=NULL)
+  {
+    xml_spaces();
+    xml_puts(&xml_buf, "<hashdigest type='md5'>");
+    xml_put_hex(&xml_buf, hash->md5, sizeof(hash->md5));
+    xml_puts(&xml_buf, "</hashdigest>\n");
+    xml_spaces();
+    xml_puts(&xml_buf, "<hashdigest type='sha256'>");
+    xml_put_hex(&xml_buf, hash->sha256, sizeof(hash->sha256));
+    xml_puts(&xml_buf, "</hashdigest>\n");
+    if(hash->duplicate_of!=NULL)
+      xml_out2s("duplicate_of", relative_name(hash->duplicate_of));
+    if(hash->known!=0)
+      xml_out2i("known_file", 1);
+    if(jsonl_handle!=NULL)
+    {
+      xml_puts(&jsonl_buf, ",\"md5\":\"");
+      xml_put_hex(&jsonl_buf, hash->md5, sizeof(hash->md5));
+      xml_puts(&jsonl_buf, "\",\"sha256\":\"");
+      xml_put_hex(&jsonl_buf, hash->sha256, sizeof(hash->sha256));
+      xml_putc(&jsonl_buf, '"');
+      if(hash->duplicate_of!=NULL)
+      {
+	xml_puts(&jsonl_buf, ",\"duplicate_of\":");
+	jsonl_string(relative_name(hash->duplicate_of));
+      }
+      if(hash->known!=0)
+	xml_puts(&jsonl_buf, ",\"known_file\":1");
+    }
+  }
+  if(jsonl_handle!=NULL)
+    xml_puts(&jsonl_buf, "}\n");
   xml_pop("fileobject");
-  fflush(xml_handle);
+  /* Write complete entries at least once per second for live readers */
+  now=time(NULL);
+  if(xml_buf.size >= XML_BUFFER_SIZE/2 || now!=xml_flush_time)
+  {
+    xml_flush_time=now;
+    xml_flush_async();
+  }
 }
 #endif
@@ -53,6 +53,11 @@ void xml_shutdown(void);
 void xml_log_file_recovered(const file_recovery_t *file_recovery);
 void xml_log_file_recovered2(const alloc_data_t *space, const file_recovery_t *file_recovery);
 void xml_printf(const char *__restrict __format,...) __attribute__((format(printf,1,2)));
+/* Also write each recovered file as one JSON object per line in report.jsonl,
+ * must be called before xml_open() */
+void xml_set_jsonl(const int enable);
+/* Write the pending entries, needed before fork() */
+void xml_flush(void);
 #endif
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
@@ -41,6 +41,15 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #if defined(__FRAMAC__)
 #include "__fc_builtin.h"
 #endif
@@ -49,12 +58,19 @@
 #include "intrf.h"
 #include "intrfn.h"
 #include "log.h"
+#include "mapfile.h"
+#include "ewf.h"
+#include "hdaccess.h"
+#include "srchash.h"
 #include "dimage.h"
 
 
 #define READ_SIZE 256*512
 /* Skip 10Mb when there is a read error */
 #define SKIP_SIZE 10*1024*1024
+/* Reads overlap the writes of the previous buffers */
+#define DIMAGE_BUFFERS	3
+#define MAPFILE_SAVE_DELAY	30
 
 #ifndef O_LARGEFILE
 #define O_LARGEFILE 0
@@ -63,212 +79,652 @@
 #define O_BINARY 0
 #endif
 
-static void disk_image_backward(int disk_dst, disk_t *disk, const uint64_t src_offset_start, const uint64_t src_offset_end, uint64_t dst_offset)
+typedef enum { DIMAGE_FREE=0, DIMAGE_QUEUED=1, DIMAGE_WRITTEN=2 } dimage_state_t;
+
+struct dimage_buffer
 {
-  uint64_t src_offset;
-  unsigned char *buffer=(unsigned char *)MALLOC(disk->sector_size);
-  for(src_offset=src_offset_end-disk->sector_size; src_offset > src_offset_start; src_offset-=disk->sector_size, dst_offset-=disk->sector_size)
+  unsigned char *data;
+  unsigned int size;
+  uint64_t pos;			/* offset in the image */
+  int status;			/* 0 if written */
+  dimage_state_t state;
+};
+
+struct dimage_ctx
+{
+  disk_t *disk;
+  const partition_t *partition;
+  int disk_dst;
+  fewf_writer_t *ewf;		/* NULL for a raw image */
+  srchash_t *srchash;
+  int sparse;			/* Zero blocks of a regular file become holes */
+  uint64_t dst_size;		/* Size of the destination file */
+  uint64_t sparse_end;		/* End of the holes left beyond dst_size */
+  uint64_t sparse_bytes;
+#ifdef HAVE_PWRITE
+  int use_pwrite;
+#endif
+  mapfile_t map;
+  char *mapfile_name;
+  time_t next_save;
+  int ind_stop;
+  uint64_t nbr_read_error;
+  uint64_t pos_next;
+  uint64_t pos_inc;
+  const char *pass_name;
+  struct dimage_buffer buffers[DIMAGE_BUFFERS];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int thread_ok;
+  int quit;
+#endif
+#ifdef HAVE_NCURSES
+  WINDOW *window;
+#endif
+};
+
+static int dimage_zero(const unsigned char *data, const unsigned int size)
+{
+  return (size > 0 && data[0]==0 && memcmp(data, data + 1, size - 1)==0);
+}
+
+/* A zero block isn't written beyond the end of the destination file,
+ * dimage_sparse_extend() sets the file size later. Inside the file, the
+ * old content is deallocated if possible */
+static int dimage_write_sparse(struct dimage_ctx *ctx, const struct dimage_buffer *buffer)
+{
+  const uint64_t end=buffer->pos + buffer->size;
+  if(ctx->sparse==0 || !dimage_zero(buffer->data, buffer->size))
+    return -1;
+  if(buffer->pos >= ctx->dst_size)
   {
-    const ssize_t pread_res=disk->pread(disk, buffer, disk->sector_size, src_offset);
-    if((unsigned)pread_res != disk->sector_size)
-    {
-      free(buffer);
-      return;
-    }
+    if(end > ctx->sparse_end)
+      ctx->sparse_end=end;
+    ctx->sparse_bytes+=buffer->size;
+    return 0;
+  }
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  if(end <= ctx->dst_size &&
+      fallocate(ctx->disk_dst, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, buffer->pos, buffer->size)==0)
+  {
+    ctx->sparse_bytes+=buffer->size;
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+static int dimage_write_aux(struct dimage_ctx *ctx, const struct dimage_buffer *buffer)
+{
 #if defined(HAVE_PWRITE)
-    if(pwrite(disk_dst, buffer, pread_res, src_offset)<0)
-    {
-      free(buffer);
-      return;
-    }
-#else
-    if(lseek(disk_dst, src_offset, SEEK_SET)<0)
+  if(ctx->use_pwrite>0)
+  {
+    if(pwrite(ctx->disk_dst, buffer->data, buffer->size, buffer->pos)==(ssize_t)buffer->size)
+      return 0;
+    ctx->use_pwrite=0;
+  }
+#endif
+  if(lseek(ctx->disk_dst, buffer->pos, SEEK_SET)<0)
+  {
+    log_critical("disk_image lseek() failed: %s\n",strerror(errno));
+    return -1;
+  }
+  if(write(ctx->disk_dst, buffer->data, buffer->size) != (ssize_t)buffer->size)
+  {
+    log_critical("disk_image write() failed: %s\n",strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int dimage_write(struct dimage_ctx *ctx, const struct dimage_buffer *buffer)
+{
+  if(dimage_write_sparse(ctx, buffer)==0)
+    return 0;
+  if(dimage_write_aux(ctx, buffer)<0)
+    return -1;
+  if(buffer->pos + buffer->size > ctx->dst_size)
+    ctx->dst_size=buffer->pos + buffer->size;
+  return 0;
+}
+
+/* Extend the destination file over the holes left at its end, called
+ * when no write is pending */
+static void dimage_sparse_extend(struct dimage_ctx *ctx)
+{
+#if defined(HAVE_FTRUNCATE)
+  if(ctx->sparse_end <= ctx->dst_size)
+    return ;
+  if(ftruncate(ctx->disk_dst, ctx->sparse_end)<0)
+  {
+    log_critical("disk_image ftruncate() failed: %s\n",strerror(errno));
+    ctx->ind_stop=2;
+    return ;
+  }
+  ctx->dst_size=ctx->sparse_end;
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+static void *dimage_writer(void *arg)
+{
+  struct dimage_ctx *ctx=(struct dimage_ctx *)arg;
+  pthread_mutex_lock(&ctx->mutex);
+  while(1)
+  {
+    struct dimage_buffer *buffer=NULL;
+    unsigned int i;
+    for(i=0; i<DIMAGE_BUFFERS && buffer==NULL; i++)
+      if(ctx->buffers[i].state==DIMAGE_QUEUED)
+	buffer=&ctx->buffers[i];
+    if(buffer==NULL)
     {
-      free(buffer);
-      return;
+      if(ctx->quit)
+	break;
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+      continue;
     }
-    if(write(disk_dst, buffer, pread_res) != pread_res)
+    pthread_mutex_unlock(&ctx->mutex);
+    buffer->status=dimage_write(ctx, buffer);
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->state=DIMAGE_WRITTEN;
+    pthread_cond_broadcast(&ctx->cond);
+  }
+  pthread_mutex_unlock(&ctx->mutex);
+  return NULL;
+}
+#endif
+
+/* Record a written buffer in the map, called with the lock held */
+static void dimage_written(struct dimage_ctx *ctx, struct dimage_buffer *buffer)
+{
+  if(buffer->status==0)
+    mapfile_set(&ctx->map, buffer->pos, buffer->size, MAPFILE_FINISHED);
+  else
+    ctx->ind_stop=2;
+  buffer->state=DIMAGE_FREE;
+}
+
+/* Return a buffer that can be filled */
+static struct dimage_buffer *dimage_get_buffer(struct dimage_ctx *ctx)
+{
+  struct dimage_buffer *buffer=NULL;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ctx->mutex);
+#endif
+  while(buffer==NULL)
+  {
+    unsigned int i;
+    for(i=0; i<DIMAGE_BUFFERS; i++)
     {
-      free(buffer);
-      return;
+      if(ctx->buffers[i].state==DIMAGE_WRITTEN)
+	dimage_written(ctx, &ctx->buffers[i]);
+      if(ctx->buffers[i].state==DIMAGE_FREE && buffer==NULL)
+	buffer=&ctx->buffers[i];
     }
+#ifdef HAVE_PTHREAD
+    if(buffer==NULL)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
 #endif
   }
-  free(buffer);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ctx->mutex);
+#endif
+  return buffer;
 }
 
-int disk_image(disk_t *disk, const partition_t *partition, const char *image_dd)
+static void dimage_submit(struct dimage_ctx *ctx, struct dimage_buffer *buffer, const unsigned int size, const uint64_t pos)
 {
-  int ind_stop=0;
-  uint64_t nbr_read_error=0;
-  uint64_t src_offset=partition->part_offset;
-  uint64_t src_offset_old;
-  uint64_t dst_offset=0;
-  const uint64_t src_offset_end=partition->part_offset+partition->part_size;
-  const uint64_t offset_inc=(src_offset_end-src_offset)/10000;
-  uint64_t src_offset_next=src_offset;
-  struct stat stat_buf;
-  unsigned char *buffer=(unsigned char *)MALLOC(READ_SIZE);
-  unsigned int readsize=READ_SIZE;
-  int disk_dst;
-#ifdef HAVE_PWRITE
-  int use_pwrite=1;
-#endif
-#ifdef HAVE_NCURSES
-  WINDOW *window;
+  buffer->size=size;
+  buffer->pos=pos;
+#ifdef HAVE_PTHREAD
+  if(ctx->thread_ok)
+  {
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->state=DIMAGE_QUEUED;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+    return ;
+  }
 #endif
-  assert(disk->sector_size > 0);
-  assert(disk->sector_size <= READ_SIZE);
-  if((disk_dst=open(image_dd, O_CREAT|O_LARGEFILE|O_RDWR|O_BINARY, 0644)) < 0)
+  buffer->status=dimage_write(ctx, buffer);
+  dimage_written(ctx, buffer);
+}
+
+/* Wait for the pending writes */
+static void dimage_flush(struct dimage_ctx *ctx)
+{
+  unsigned int i;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ctx->mutex);
+  for(i=0; i<DIMAGE_BUFFERS; i++)
   {
-    log_error("Can't create file %s.\n",image_dd);
-    display_message("Can't create file!\n");
-    free(buffer);
-    return -1;
+    while(ctx->buffers[i].state==DIMAGE_QUEUED)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+    if(ctx->buffers[i].state==DIMAGE_WRITTEN)
+      dimage_written(ctx, &ctx->buffers[i]);
   }
-#if !defined(DISABLED_FOR_FRAMAC)
-  if(fstat(disk_dst, &stat_buf)==0)
+  pthread_mutex_unlock(&ctx->mutex);
+#else
+  for(i=0; i<DIMAGE_BUFFERS; i++)
+    if(ctx->buffers[i].state==DIMAGE_WRITTEN)
+      dimage_written(ctx, &ctx->buffers[i]);
+#endif
+}
+
+static void dimage_save_map(struct dimage_ctx *ctx)
+{
+  dimage_flush(ctx);
+  dimage_sparse_extend(ctx);
+  mapfile_save(&ctx->map, ctx->mapfile_name);
+  ctx->next_save=time(NULL) + MAPFILE_SAVE_DELAY;
+}
+
+static void dimage_progress(struct dimage_ctx *ctx, const uint64_t pos, int update)
+{
+  ctx->map.current_pos=pos;
+  if(pos > ctx->pos_next)
   {
-    int res=1;
+    update=1;
+    ctx->pos_next=pos + ctx->pos_inc;
+  }
+  if(update==0 || ctx->ind_stop!=0)
+    return ;
+  if(time(NULL) >= ctx->next_save)
+    dimage_save_map(ctx);
 #ifdef HAVE_NCURSES
-    if(stat_buf.st_size > 0)
-      res=ask_confirmation("Append to existing file ? (Y/N)");
+  {
+    unsigned int i;
+    const float percent=pos*100.00/ctx->partition->part_size;
+    wmove(ctx->window,7,0);
+    wclrtoeol(ctx->window);
+    wprintw(ctx->window,"%3.2f %% ", percent);
+    for(i=0;i<percent*3/5;i++)
+      wprintw(ctx->window,"=");
+    wprintw(ctx->window,">");
+    wmove(ctx->window,8,0);
+    wclrtoeol(ctx->window);
+    wprintw(ctx->window,"%s, rescued %llu MB, %llu read errors",
+	ctx->pass_name,
+	(long long unsigned)(mapfile_size(&ctx->map, MAPFILE_FINISHED)/1000000),
+	(long long unsigned)ctx->nbr_read_error);
+    wrefresh(ctx->window);
+    ctx->ind_stop=check_enter_key_or_s(ctx->window);
+  }
 #endif
-    if(res>0)
+}
+
+/* Copy the ranges with this status by blocks of readsize bytes.
+ * Blocks that can't be read get bad_status. After a read error, skip
+ * bytes are left for a later pass. */
+static void dimage_copy(struct dimage_ctx *ctx, const char status, const unsigned int readsize, const char bad_status, const uint64_t skip)
+{
+  disk_t *disk=ctx->disk;
+  uint64_t pos=0;
+  uint64_t start;
+  uint64_t size;
+  ctx->map.current_status=status;
+  ctx->pos_next=0;
+  while(ctx->ind_stop==0 && mapfile_next(&ctx->map, pos, status, &start, &size)==0)
+  {
+    struct dimage_buffer *buffer=dimage_get_buffer(ctx);
+    const unsigned int count=(size < readsize ? size : readsize);
+    int update=0;
+    if(ctx->ind_stop!=0)
+      break;
+    if(disk->pread(disk, buffer->data, count, ctx->partition->part_offset + start) == (int)count)
     {
-      dst_offset=stat_buf.st_size;
-      src_offset+=dst_offset;
+      srchash_update(ctx->srchash, buffer->data, count, start);
+      dimage_submit(ctx, buffer, count, start);
+      pos=start + count;
     }
+    else
+    {
+      buffer->state=DIMAGE_FREE;
+      ctx->nbr_read_error++;
+      mapfile_set(&ctx->map, start, count, bad_status);
+      pos=start + count + skip;
+      update=1;
+    }
+    dimage_progress(ctx, pos, update);
   }
-#endif
-  src_offset_old=src_offset;
-#ifdef HAVE_NCURSES
-  window=newwin(LINES, COLS, 0, 0);	/* full screen */
-  aff_copy(window);
-  wmove(window,5,0);
-  wprintw(window,"%s\n",disk->description_short(disk));
-  wmove(window,6,0);
-  aff_part(window,AFF_PART_ORDER|AFF_PART_STATUS,disk,partition);
-  wmove(window,10,0);
-  waddstr(window, "Disk images are mainly used ");
-  wmove(window,11,0);
-  waddstr(window, "- for forensic purposes");
-  wmove(window,12,0);
-  waddstr(window, "- or to deal with media with bad sectors");
-#ifdef WIN32
-  wmove(window,14,0);
-  waddstr(window, "To use TestDisk or PhotoRec with this disk image, go in command line and run");
-  wmove(window,15,0);
-  waddstr(window, "   testdisk_win.exe image.dd");
-  wmove(window,16,0);
-  waddstr(window, "or photorec_win.exe image.dd");
-#else
-  wmove(window,14,0);
-  waddstr(window, "To use TestDisk or PhotoRec with this disk image, start a Terminal and run");
-  wmove(window,15,0);
-  waddstr(window, "   testdisk image.dd");
-  wmove(window,16,0);
-  waddstr(window, "or photorec image.dd");
-#endif
-  wmove(window,22,0);
-  wattrset(window, A_REVERSE);
-  waddstr(window,"  Stop  ");
-  wattroff(window, A_REVERSE);
-#endif
-  while(ind_stop==0 && src_offset < src_offset_end)
+}
+
+/* Read the non-trimmed ranges sector by sector from both ends until an
+ * error, the middle is left for the scraping pass */
+static void dimage_trim(struct dimage_ctx *ctx)
+{
+  disk_t *disk=ctx->disk;
+  const unsigned int sector_size=disk->sector_size;
+  uint64_t start;
+  uint64_t size;
+  ctx->map.current_status=MAPFILE_NON_TRIMMED;
+  ctx->pos_next=0;
+  while(ctx->ind_stop==0 && mapfile_next(&ctx->map, 0, MAPFILE_NON_TRIMMED, &start, &size)==0)
+  {
+    uint64_t first=start;
+    uint64_t last=start + size;
+    /* Forward */
+    while(ctx->ind_stop==0 && first < last)
+    {
+      struct dimage_buffer *buffer=dimage_get_buffer(ctx);
+      if(disk->pread(disk, buffer->data, sector_size, ctx->partition->part_offset + first) != (int)sector_size)
+      {
+	buffer->state=DIMAGE_FREE;
+	ctx->nbr_read_error++;
+	mapfile_set(&ctx->map, first, sector_size, MAPFILE_BAD_SECTOR);
+	first+=sector_size;
+	break;
+      }
+      srchash_update(ctx->srchash, buffer->data, sector_size, first);
+      dimage_submit(ctx, buffer, sector_size, first);
+      first+=sector_size;
+      dimage_progress(ctx, first, 0);
+    }
+    /* Backward */
+    while(ctx->ind_stop==0 && first < last)
+    {
+      struct dimage_buffer *buffer=dimage_get_buffer(ctx);
+      if(disk->pread(disk, buffer->data, sector_size, ctx->partition->part_offset + last - sector_size) != (int)sector_size)
+      {
+	buffer->state=DIMAGE_FREE;
+	ctx->nbr_read_error++;
+	mapfile_set(&ctx->map, last - sector_size, sector_size, MAPFILE_BAD_SECTOR);
+	last-=sector_size;
+	break;
+      }
+      dimage_submit(ctx, buffer, sector_size, last - sector_size);
+      last-=sector_size;
+    }
+    if(ctx->ind_stop!=0)
+      break;
+    dimage_flush(ctx);
+    if(first < last)
+      mapfile_set(&ctx->map, first, last - first, MAPFILE_NON_SCRAPED);
+    dimage_progress(ctx, last, 1);
+  }
+}
+
+/* An EWF image is written sequentially: a single pass, the sectors that
+ * can't be read are zero-filled and recorded as bad sectors */
+static void dimage_copy_ewf(struct dimage_ctx *ctx)
+{
+  disk_t *disk=ctx->disk;
+  const unsigned int sector_size=disk->sector_size;
+  const uint64_t part_offset=ctx->partition->part_offset;
+  unsigned char *buffer=ctx->buffers[0].data;
+  uint64_t pos=0;
+  ctx->map.current_status=MAPFILE_NON_TRIED;
+  ctx->pos_next=0;
+  while(ctx->ind_stop==0 && pos < ctx->partition->part_size)
   {
-    ssize_t pread_res;
+    const unsigned int count=(ctx->partition->part_size - pos < READ_SIZE ? ctx->partition->part_size - pos : READ_SIZE);
     int update=0;
-    if(src_offset_end-src_offset < readsize)
-      readsize=src_offset_end-src_offset;
-    pread_res=disk->pread(disk, buffer, readsize, src_offset);
-    if(pread_res > 0)
+    mapfile_set(&ctx->map, pos, count, MAPFILE_FINISHED);
+    if(disk->pread(disk, buffer, count, part_offset + pos) != (int)count)
     {
-#if defined(HAVE_PWRITE)
-      if(use_pwrite>0 && pwrite(disk_dst, buffer, pread_res, dst_offset)<0)
-#endif
+      unsigned int i;
+      for(i=0; i<count; i+=sector_size)
       {
-#ifdef HAVE_PWRITE
-	use_pwrite=0;
-#endif
-	if(lseek(disk_dst, dst_offset, SEEK_SET)<0)
+	if(disk->pread(disk, buffer + i, sector_size, part_offset + pos + i) != (int)sector_size)
 	{
-	  ind_stop=2;
-	  log_critical("disk_image lseek() failed: %s\n",strerror(errno));
-	}
-	else if(write(disk_dst, buffer, pread_res) != pread_res)
-	{
-	  log_critical("disk_image write() failed: %s\n",strerror(errno));
-	  ind_stop=2;
+	  memset(buffer + i, 0, sector_size);
+	  ctx->nbr_read_error++;
+	  mapfile_set(&ctx->map, pos + i, sector_size, MAPFILE_BAD_SECTOR);
 	}
       }
-      if(src_offset_old + SKIP_SIZE==src_offset)
-      {
-	disk_image_backward(disk_dst, disk, src_offset_old, src_offset, dst_offset);
-      }
+      update=1;
     }
-    src_offset_old=src_offset;
-    if((unsigned)pread_res == readsize)
+    srchash_update(ctx->srchash, buffer, count, pos);
+    if(fewf_writer_write(ctx->ewf, buffer, count) < 0)
     {
-      src_offset+=readsize;
-      dst_offset+=readsize;
-      readsize=READ_SIZE;
+      ctx->ind_stop=2;
+      break;
     }
-    else
+    pos+=count;
+    dimage_progress(ctx, pos, update);
+  }
+}
+
+static void dimage_pass(struct dimage_ctx *ctx, const char *pass_name)
+{
+  ctx->pass_name=pass_name;
+  log_info("disk_image: %s\n", pass_name);
+}
+
+static int disk_image_aux(disk_t *disk, const partition_t *partition, const char *image_dd, const int ewf)
+{
+  struct dimage_ctx ctx;
+  struct stat stat_buf;
+  int resume=0;
+  unsigned int i;
+  assert(disk->sector_size > 0);
+  assert(disk->sector_size <= READ_SIZE);
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.disk=disk;
+  ctx.partition=partition;
+  ctx.pos_inc=partition->part_size/10000;
+  ctx.disk_dst=-1;
+  if(ewf)
+  {
+    ctx.ewf=fewf_writer_open(image_dd, partition->part_size, disk->sector_size);
+    if(ctx.ewf==NULL)
     {
-      update=1;
-      nbr_read_error++;
-      readsize=disk->sector_size;
-      src_offset+=SKIP_SIZE;
-      dst_offset+=SKIP_SIZE;
+      log_error("Can't create file %s.E01.\n",image_dd);
+      display_message("Can't create file!\n");
+      return -1;
     }
-    if(src_offset>src_offset_next)
+  }
+  else if((ctx.disk_dst=open(image_dd, O_CREAT|O_LARGEFILE|O_RDWR|O_BINARY, 0644)) < 0)
+  {
+    log_error("Can't create file %s.\n",image_dd);
+    display_message("Can't create file!\n");
+    return -1;
+  }
+#ifdef HAVE_PWRITE
+  ctx.use_pwrite=1;
+#endif
+#if defined(HAVE_FTRUNCATE) && !defined(DISABLED_FOR_FRAMAC)
+  /* Don't skip the zero blocks when imaging to a device */
+  if(ewf==0 && fstat(ctx.disk_dst, &stat_buf)==0 && S_ISREG(stat_buf.st_mode))
+  {
+    ctx.sparse=1;
+    ctx.dst_size=stat_buf.st_size;
+  }
+#endif
+  ctx.mapfile_name=(char *)MALLOC(strlen(image_dd) + 9);
+  strcpy(ctx.mapfile_name, image_dd);
+  strcat(ctx.mapfile_name, (ewf ? ".E01.map" : ".map"));
+#if !defined(DISABLED_FOR_FRAMAC)
+  /* Resume an interrupted image, an EWF image can't be resumed */
+  if(ewf==0 && mapfile_load(&ctx.map, ctx.mapfile_name)==0)
+  {
+    if(ctx.map.nbr > 0 &&
+	ctx.map.ranges[ctx.map.nbr-1].pos + ctx.map.ranges[ctx.map.nbr-1].size == partition->part_size)
     {
-      update=1;
-      src_offset_next=src_offset+offset_inc;
+      resume=1;
+#ifdef HAVE_NCURSES
+      resume=ask_confirmation("Resume using %s ? (Y/N)", ctx.mapfile_name);
+#endif
     }
-    if(update && ind_stop==0)
+    if(resume==0)
+      mapfile_free(&ctx.map);
+  }
+#endif
+  if(resume==0)
+  {
+    mapfile_init(&ctx.map, partition->part_size);
+#if !defined(DISABLED_FOR_FRAMAC)
+    if(ewf==0 && fstat(ctx.disk_dst, &stat_buf)==0 && stat_buf.st_size > 0)
     {
+      int res=1;
 #ifdef HAVE_NCURSES
-      unsigned int i;
-      const float percent=(src_offset-partition->part_offset)*100.00/partition->part_size;
-      wmove(window,7,0);
-      wprintw(window,"%3.2f %% ", percent);
-      for(i=0;i<percent*3/5;i++)
-	wprintw(window,"=");
-      wprintw(window,">");
-      wrefresh(window);
-      ind_stop=check_enter_key_or_s(window);
+      res=ask_confirmation("Append to existing file ? (Y/N)");
 #endif
+      if(res>0)
+      {
+	const uint64_t dst_size=((uint64_t)stat_buf.st_size < partition->part_size ? (uint64_t)stat_buf.st_size : partition->part_size);
+	mapfile_set(&ctx.map, 0, dst_size, MAPFILE_FINISHED);
+      }
     }
+#endif
+  }
+  for(i=0; i<DIMAGE_BUFFERS; i++)
+  {
+    ctx.buffers[i].data=(unsigned char *)MALLOC(READ_SIZE);
+    ctx.buffers[i].state=DIMAGE_FREE;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&ctx.mutex, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+  ctx.thread_ok=(ewf==0 && pthread_create(&ctx.thread, NULL, &dimage_writer, &ctx)==0);
+#endif
+  /* The hash follows the reads, the areas read out of order are hashed
+   * from the image once complete */
+  if(srchash_enabled())
+    ctx.srchash=srchash_new(NULL, 0, partition->part_size);
+  ctx.next_save=time(NULL) + MAPFILE_SAVE_DELAY;
+#ifdef HAVE_NCURSES
+  ctx.window=newwin(LINES, COLS, 0, 0);	/* full screen */
+  aff_copy(ctx.window);
+  wmove(ctx.window,5,0);
+  wprintw(ctx.window,"%s\n",disk->description_short(disk));
+  wmove(ctx.window,6,0);
+  aff_part(ctx.window,AFF_PART_ORDER|AFF_PART_STATUS,disk,partition);
+  wmove(ctx.window,10,0);
+  waddstr(ctx.window, "Disk images are mainly used ");
+  wmove(ctx.window,11,0);
+  waddstr(ctx.window, "- for forensic purposes");
+  wmove(ctx.window,12,0);
+  waddstr(ctx.window, "- or to deal with media with bad sectors");
+#ifdef WIN32
+  wmove(ctx.window,14,0);
+  waddstr(ctx.window, "To use TestDisk or PhotoRec with this disk image, go in command line and run");
+  wmove(ctx.window,15,0);
+  waddstr(ctx.window, "   testdisk_win.exe image.dd");
+  wmove(ctx.window,16,0);
+  waddstr(ctx.window, "or photorec_win.exe image.dd");
+#else
+  wmove(ctx.window,14,0);
+  waddstr(ctx.window, "To use TestDisk or PhotoRec with this disk image, start a Terminal and run");
+  wmove(ctx.window,15,0);
+  waddstr(ctx.window, "   testdisk image.dd");
+  wmove(ctx.window,16,0);
+  waddstr(ctx.window, "or photorec image.dd");
+#endif
+  wmove(ctx.window,18,0);
+  waddstr(ctx.window, "Unreadable areas are recorded in the mapfile, PhotoRec skips them.");
+  wmove(ctx.window,22,0);
+  wattrset(ctx.window, A_REVERSE);
+  waddstr(ctx.window,"  Stop  ");
+  wattroff(ctx.window, A_REVERSE);
+#endif
+  if(ewf)
+  {
+    dimage_pass(&ctx, "Copying");
+    dimage_copy_ewf(&ctx);
+  }
+  else
+  {
+    /* Copy the easy areas first, skip after a read error */
+    dimage_pass(&ctx, "Copying");
+    dimage_copy(&ctx, MAPFILE_NON_TRIED, READ_SIZE, MAPFILE_NON_TRIMMED, SKIP_SIZE);
+    ctx.map.current_pass++;
+    /* Come back to the skipped areas */
+    dimage_pass(&ctx, "Copying skipped areas");
+    dimage_copy(&ctx, MAPFILE_NON_TRIED, READ_SIZE, MAPFILE_NON_TRIMMED, 0);
+    dimage_pass(&ctx, "Trimming");
+    dimage_trim(&ctx);
+    dimage_pass(&ctx, "Scraping");
+    dimage_copy(&ctx, MAPFILE_NON_SCRAPED, disk->sector_size, MAPFILE_BAD_SECTOR, 0);
+  }
+#ifdef HAVE_PTHREAD
+  if(ctx.thread_ok)
+  {
+    pthread_mutex_lock(&ctx.mutex);
+    ctx.quit=1;
+    pthread_cond_broadcast(&ctx.cond);
+    pthread_mutex_unlock(&ctx.mutex);
+    pthread_join(ctx.thread, NULL);
+  }
+#endif
+  dimage_flush(&ctx);
+  dimage_sparse_extend(&ctx);
+  if(ctx.ind_stop==0)
+  {
+    ctx.map.current_status=MAPFILE_FINISHED;
+    ctx.map.current_pos=0;
   }
-  close(disk_dst);
+  mapfile_save(&ctx.map, ctx.mapfile_name);
+  /* Bad sectors from a previous run are still missing */
+  if(mapfile_size(&ctx.map, MAPFILE_BAD_SECTOR) > 0 && ctx.nbr_read_error==0)
+    ctx.nbr_read_error=1;
+  log_info("disk_image: %llu bytes rescued, %llu bytes in bad sectors, %llu bytes not read\n",
+      (long long unsigned)mapfile_size(&ctx.map, MAPFILE_FINISHED),
+      (long long unsigned)mapfile_size(&ctx.map, MAPFILE_BAD_SECTOR),
+      (long long unsigned)(partition->part_size - mapfile_size(&ctx.map, MAPFILE_FINISHED) - mapfile_size(&ctx.map, MAPFILE_BAD_SECTOR)));
+  if(ctx.sparse_bytes > 0)
+    log_info("disk_image: %llu bytes of zeroes left as holes\n",
+	(long long unsigned)ctx.sparse_bytes);
+  if(ctx.ewf!=NULL)
+  {
+    if(fewf_writer_close(ctx.ewf) < 0 && ctx.ind_stop==0)
+      ctx.ind_stop=2;
+  }
+  else
+    close(ctx.disk_dst);
+  if(ctx.srchash!=NULL)
+  {
+    disk_t *image=NULL;
+    if(ctx.ind_stop==0 && ctx.ewf==NULL)
+      image=file_test_availability(image_dd, 0, TESTDISK_O_RDONLY);
+    srchash_finish(ctx.srchash, image, 0);
+    if(image!=NULL)
+      image->clean(image);
+  }
+#ifdef HAVE_PTHREAD
+  pthread_cond_destroy(&ctx.cond);
+  pthread_mutex_destroy(&ctx.mutex);
+#endif
+  for(i=0; i<DIMAGE_BUFFERS; i++)
+    free(ctx.buffers[i].data);
+  mapfile_free(&ctx.map);
+  free(ctx.mapfile_name);
 #ifdef HAVE_NCURSES
-  delwin(window);
+  delwin(ctx.window);
   (void) clearok(stdscr, TRUE);
 #ifdef HAVE_TOUCHWIN
   touchwin(stdscr);
 #endif
 #endif
-  if(ind_stop==2)
+  if(ctx.ind_stop==2)
   {
     display_message("No space left for the file image.\n");
-    free(buffer);
     return -2;
   }
-  if(ind_stop)
+  if(ctx.ind_stop)
   {
-    if(nbr_read_error==0)
+    if(ctx.nbr_read_error==0)
       display_message("Incomplete image created.\n");
     else
       display_message("Incomplete image created: read errors have occured.\n");
-    free(buffer);
     return 0;
   }
-  if(nbr_read_error==0)
+  if(ctx.nbr_read_error==0)
     display_message("Image created successfully.\n");
   else
     display_message("Image created successfully but read errors have occured.\n");
-  free(buffer);
   return 0;
 }
+
+int disk_image(disk_t *disk, const partition_t *partition, const char *image_dd)
+{
+  return disk_image_aux(disk, partition, image_dd, 0);
+}
+
+int disk_image_ewf(disk_t *disk, const partition_t *partition, const char *image_base)
+{
+  return disk_image_aux(disk, partition, image_base, 1);
+}
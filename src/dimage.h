@@ -34,6 +34,17 @@ extern "C" {
   @*/
 int disk_image(disk_t *disk_car, const partition_t *partition, const char *image_dd);
 
+/* Single pass to image_base.E01, unreadable sectors are zero-filled.
+ * The MD5 and SHA1 are stored in the image */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid_read(partition);
+  @ requires valid_read_string(image_base);
+  @ requires \separated(disk_car, partition, image_base);
+  @*/
+int disk_image_ewf(disk_t *disk_car, const partition_t *partition, const char *image_base);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
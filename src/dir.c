@@ -52,6 +52,8 @@
 #include "dir.h"
 #include "log.h"
 #include "log_part.h"
+#include "list_sort.h"
+#include "hdaccess.h"
 #define MAX_DIR_NBR 256
 
 const char *monstr[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
@@ -260,12 +262,93 @@ void log_list_file(const disk_t *disk, const partition_t *partition, const dir_d
 #endif
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* The files of a list and their names are allocated from chunks of at
+ * least FILE_INFO_ARENA_SIZE bytes */
+#define FILE_INFO_ARENA_SIZE	(256*1024)
+
+struct file_info_arena
+{
+  struct file_info_arena *next;
+  unsigned int used;
+  unsigned int size;
+};
+
+static void *file_info_alloc(file_info_t *list, unsigned int size)
+{
+  struct file_info_arena *arena=list->arena;
+  void *res;
+  /* Keep the files aligned */
+  size=(size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  if(arena==NULL || arena->used + size > arena->size)
+  {
+    const unsigned int arena_size=(size > FILE_INFO_ARENA_SIZE ? size : FILE_INFO_ARENA_SIZE);
+    arena=(struct file_info_arena *)MALLOC(sizeof(struct file_info_arena) + arena_size);
+    arena->next=list->arena;
+    arena->used=0;
+    arena->size=arena_size;
+    list->arena=arena;
+  }
+  res=(char *)(arena + 1) + arena->used;
+  arena->used+=size;
+  return res;
+}
+#endif
+
+void init_list_file(file_info_t *list)
+{
+  TD_INIT_LIST_HEAD(&list->list);
+  list->arena=NULL;
+}
+
+file_info_t *file_info_new(file_info_t *list, const char *name)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  file_info_t *new_file=(file_info_t *)file_info_alloc(list, sizeof(*new_file));
+  memset(new_file, 0, sizeof(*new_file));
+  if(name!=NULL)
+    new_file->name=file_info_strdup(list, name);
+#else
+  file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
+  memset(new_file, 0, sizeof(*new_file));
+  if(name!=NULL)
+    new_file->name=strdup(name);
+#endif
+  return new_file;
+}
+
+char *file_info_strdup(file_info_t *list, const char *name)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const unsigned int len=strlen(name) + 1;
+  char *res=(char *)file_info_alloc(list, len);
+  memcpy(res, name, len);
+  return res;
+#else
+  return strdup(name);
+#endif
+}
+
 unsigned int delete_list_file(file_info_t *file_info)
 {
   unsigned int nbr=0;
   struct td_list_head *file_walker = NULL;
   struct td_list_head *file_walker_next = NULL;
 #ifndef DISABLED_FOR_FRAMAC
+  if(file_info->arena!=NULL)
+  {
+    struct file_info_arena *arena=file_info->arena;
+    td_list_for_each(file_walker, &file_info->list)
+      nbr++;
+    while(arena!=NULL)
+    {
+      struct file_info_arena *next=arena->next;
+      free(arena);
+      arena=next;
+    }
+    init_list_file(file_info);
+    return nbr;
+  }
   td_list_for_each_safe(file_walker,file_walker_next, &file_info->list)
   {
     file_info_t *tmp;
@@ -279,6 +362,123 @@ unsigned int delete_list_file(file_info_t *file_info)
   return nbr;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+#define DIR_CACHE_BUCKETS 1024
+/* Forget everything once this many files are cached */
+#define DIR_CACHE_MAX_FILES 262144
+
+struct dir_cache_entry
+{
+  struct td_list_head list;
+  unsigned long int inode;
+  unsigned int param;
+  int res;
+  file_info_t files;
+};
+
+struct dir_cache
+{
+  struct td_list_head buckets[DIR_CACHE_BUCKETS];
+  unsigned int files_nbr;
+  int(*get_dir)(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t*list);
+  void (*close)(dir_data_t *dir_data);
+};
+
+static void dir_cache_copy(const file_info_t *src, file_info_t *dst)
+{
+  const struct td_list_head *file_walker = NULL;
+  td_list_for_each(file_walker, &src->list)
+  {
+    const file_info_t *file=td_list_entry_const(file_walker, const file_info_t, list);
+    file_info_t *new_file=file_info_new(dst, NULL);
+    memcpy(new_file, file, sizeof(*new_file));
+    new_file->name=file_info_strdup(dst, file->name);
+    td_list_add_tail(&new_file->list, &dst->list);
+  }
+}
+
+static void dir_cache_flush(struct dir_cache *cache)
+{
+  unsigned int i;
+  for(i=0; i<DIR_CACHE_BUCKETS; i++)
+  {
+    struct td_list_head *entry_walker = NULL;
+    struct td_list_head *entry_walker_next = NULL;
+    td_list_for_each_safe(entry_walker, entry_walker_next, &cache->buckets[i])
+    {
+      struct dir_cache_entry *entry=td_list_entry(entry_walker, struct dir_cache_entry, list);
+      delete_list_file(&entry->files);
+      td_list_del(entry_walker);
+      free(entry);
+    }
+  }
+  cache->files_nbr=0;
+}
+
+static int dir_cache_get_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *list)
+{
+  struct dir_cache *cache=dir_data->cache;
+  struct td_list_head *bucket=&cache->buckets[first_inode % DIR_CACHE_BUCKETS];
+  struct td_list_head *entry_walker = NULL;
+  struct dir_cache_entry *entry;
+  unsigned int files_nbr=0;
+  td_list_for_each(entry_walker, bucket)
+  {
+    entry=td_list_entry(entry_walker, struct dir_cache_entry, list);
+    /* The listing depends on the parameters, ie. deleted files */
+    if(entry->inode==first_inode && entry->param==dir_data->param)
+    {
+      dir_cache_copy(&entry->files, list);
+      return entry->res;
+    }
+  }
+  entry=(struct dir_cache_entry *)MALLOC(sizeof(*entry));
+  entry->inode=first_inode;
+  entry->param=dir_data->param;
+  init_list_file(&entry->files);
+  entry->res=cache->get_dir(disk, partition, dir_data, first_inode, &entry->files);
+  td_list_for_each(entry_walker, &entry->files.list)
+    files_nbr++;
+  if(cache->files_nbr + files_nbr > DIR_CACHE_MAX_FILES)
+    dir_cache_flush(cache);
+  cache->files_nbr+=files_nbr;
+  td_list_add(&entry->list, bucket);
+  dir_cache_copy(&entry->files, list);
+  return entry->res;
+}
+
+static void dir_cache_close(dir_data_t *dir_data)
+{
+  struct dir_cache *cache=dir_data->cache;
+  dir_cache_flush(cache);
+  dir_data->get_dir=cache->get_dir;
+  dir_data->close=cache->close;
+  dir_data->cache=NULL;
+  free(cache);
+  if(dir_data->close!=NULL)
+    dir_data->close(dir_data);
+}
+#endif
+
+void dir_cache_init(dir_data_t *dir_data)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct dir_cache *cache;
+  unsigned int i;
+  if(dir_data->get_dir==NULL)
+    return ;
+  cache=(struct dir_cache *)MALLOC(sizeof(*cache));
+  for(i=0; i<DIR_CACHE_BUCKETS; i++)
+    TD_INIT_LIST_HEAD(&cache->buckets[i]);
+  cache->files_nbr=0;
+  cache->get_dir=dir_data->get_dir;
+  cache->close=dir_data->close;
+  dir_data->cache=cache;
+  dir_data->get_dir=dir_cache_get_dir;
+  dir_data->close=dir_cache_close;
+#endif
+}
+
 /*@
   @ requires \valid_read(current_file);
   @ requires \valid_read(inode_known + (0 .. dir_nbr-1));
@@ -314,11 +514,11 @@ static int is_inode_valid(const file_info_t *current_file, const unsigned int di
 static int dir_whole_partition_log_aux(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int inode)
 {
   struct td_list_head *file_walker = NULL;
-  static unsigned int dir_nbr=0;
-  static unsigned long int inode_known[MAX_DIR_NBR];
+  static TD_THREAD_LOCAL unsigned int dir_nbr=0;
+  static TD_THREAD_LOCAL unsigned long int inode_known[MAX_DIR_NBR];
   const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
   file_info_t dir_list;
-  TD_INIT_LIST_HEAD(&dir_list.list);
+  init_list_file(&dir_list);
   if(dir_nbr==MAX_DIR_NBR)
     return 1;	/* subdirectories depth is too high => Back */
   if(dir_data->verbose>0)
@@ -353,67 +553,117 @@ int dir_whole_partition_log(disk_t *disk, const partition_t *partition, dir_data
   return dir_whole_partition_log_aux(disk, partition, dir_data, inode);
 }
 
-/*@
-  @ requires \valid(disk);
-  @ requires valid_disk(disk);
-  @ requires \valid_read(partition);
-  @ requires valid_partition(partition);
-  @ requires \valid(dir_data);
-  @ requires \valid(copy_ok);
-  @ requires \valid(copy_bad);
-  @ requires \separated(disk, partition, dir_data, copy_ok, copy_bad);
-  @ decreases 0;
-  @*/
-static int dir_whole_partition_copy_aux(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int inode, unsigned int *copy_ok, unsigned int *copy_bad)
+/* Files are copied by batches sorted by inode number, i.e. by first
+ * cluster or by inode table position, to limit the seeks */
+#define DIR_COPY_BATCH 4096
+
+struct dir_copy_dir
 {
-  struct td_list_head *file_walker = NULL;
-  static unsigned int dir_nbr=0;
-  static unsigned long int inode_known[MAX_DIR_NBR];
-  const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
-  file_info_t dir_list;
-  TD_INIT_LIST_HEAD(&dir_list.list);
-  if(dir_nbr==MAX_DIR_NBR)
-    return 1;	/* subdirectories depth is too high => Back */
-  dir_data->get_dir(disk, partition, dir_data, inode, &dir_list);
-  /* Not perfect for FAT32 root cluster */
-  inode_known[dir_nbr++]=inode;
-  td_list_for_each(file_walker, &dir_list.list)
+  struct td_list_head list;
+  unsigned long int inode;
+  unsigned int depth;
+  char *path;
+};
+
+struct dir_copy_file
+{
+  file_info_t *file;
+  char *path;
+};
+
+struct dir_copy_ctx
+{
+  struct td_list_head dirs;	/* directories to list, FIFO */
+  unsigned long int *known;	/* directories already queued, open addressing */
+  unsigned int known_nbr;
+  unsigned int known_size;
+  struct dir_copy_file *files;
+  unsigned int files_nbr;
+  unsigned int copy_ok;
+  unsigned int copy_bad;
+};
+
+/* Return 1 if the directory has already been queued, remember it otherwise */
+static int dir_copy_known(struct dir_copy_ctx *ctx, const unsigned long int inode)
+{
+  unsigned int i;
+  if(2 * (ctx->known_nbr + 1) > ctx->known_size)
   {
-    const file_info_t *current_file=td_list_entry_const(file_walker, const file_info_t, list);
-    if(strlen(dir_data->current_directory) + 1 + strlen(current_file->name) <
-	sizeof(dir_data->current_directory)-1)
+    unsigned long int *old=ctx->known;
+    const unsigned int old_size=ctx->known_size;
+    ctx->known_size=(old_size==0 ? 1024 : 2 * old_size);
+    ctx->known=(unsigned long int *)MALLOC(ctx->known_size * sizeof(unsigned long int));
+    memset(ctx->known, 0, ctx->known_size * sizeof(unsigned long int));
+    for(i=0; i<old_size; i++)
     {
-      if(strcmp(dir_data->current_directory,"/"))
-	strcat(dir_data->current_directory,"/");
-      strcat(dir_data->current_directory,current_file->name);
-      if(LINUX_S_ISDIR(current_file->st_mode)!=0)
-      {
-	if(is_inode_valid(current_file, dir_nbr, inode_known)>0)
-	{
-	  dir_whole_partition_copy_aux(disk, partition, dir_data, current_file->st_ino, copy_ok, copy_bad);
-	}
-      }
-      else if(LINUX_S_ISREG(current_file->st_mode)!=0)
+      if(old[i]!=0)
       {
-	if(dir_data->copy_file(disk, partition, dir_data, current_file) == 0)
-	  (*copy_ok)++;
-	else
-	  (*copy_bad)++;
+	unsigned int j;
+	for(j=(old[i] * 2654435761U) & (ctx->known_size - 1);
+	    ctx->known[j]!=0;
+	    j=(j + 1) & (ctx->known_size - 1));
+	ctx->known[j]=old[i];
       }
     }
-    /* restore current_directory name */
-    dir_data->current_directory[current_directory_namelength]='\0';
+    free(old);
   }
-  delete_list_file(&dir_list);
-  dir_nbr--;
+  for(i=(inode * 2654435761U) & (ctx->known_size - 1);
+      ctx->known[i]!=0;
+      i=(i + 1) & (ctx->known_size - 1))
+    if(ctx->known[i]==inode) /* Avoid loop */
+      return 1;
+  ctx->known[i]=inode;
+  ctx->known_nbr++;
   return 0;
 }
 
+static void dir_copy_queue(struct dir_copy_ctx *ctx, const unsigned long int inode, const unsigned int depth, const char *path)
+{
+  struct dir_copy_dir *dir=(struct dir_copy_dir *)MALLOC(sizeof(*dir));
+  dir->inode=inode;
+  dir->depth=depth;
+  dir->path=strdup(path);
+  td_list_add_tail(&dir->list, &ctx->dirs);
+}
+
+static int dir_copy_file_cmp(const void *a, const void *b)
+{
+  const struct dir_copy_file *file_a=(const struct dir_copy_file *)a;
+  const struct dir_copy_file *file_b=(const struct dir_copy_file *)b;
+  if(file_a->file->st_ino < file_b->file->st_ino)
+    return -1;
+  if(file_a->file->st_ino > file_b->file->st_ino)
+    return 1;
+  return strcmp(file_a->path, file_b->path);
+}
+
+static void dir_copy_flush(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, struct dir_copy_ctx *ctx)
+{
+  unsigned int i;
+  qsort(ctx->files, ctx->files_nbr, sizeof(struct dir_copy_file), dir_copy_file_cmp);
+  for(i=0; i<ctx->files_nbr; i++)
+  {
+    struct dir_copy_file *copy=&ctx->files[i];
+    strcpy(dir_data->current_directory, copy->path);
+    if(dir_data->copy_file(disk, partition, dir_data, copy->file) == 0)
+      ctx->copy_ok++;
+    else
+      ctx->copy_bad++;
+    free(copy->path);
+    free(copy->file->name);
+    free(copy->file);
+  }
+  ctx->files_nbr=0;
+}
+
 void dir_whole_partition_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int inode)
 {
-  unsigned int copy_ok=0;
-  unsigned int copy_bad=0;
-  char *dst_directory=(char *)MALLOC(4096);
+  struct dir_copy_ctx ctx;
+  char *root_directory;
+  char *dst_directory;
+  if(dir_data->copy_file==NULL)
+    return ;
+  dst_directory=(char *)MALLOC(4096);
   dst_directory[0]='.';
   dst_directory[1]='\0';
 #ifdef HAVE_GETCWD
@@ -424,8 +674,78 @@ void dir_whole_partition_copy(disk_t *disk, const partition_t *partition, dir_da
   }
 #endif
   dir_data->local_dir=dst_directory;
-  dir_whole_partition_copy_aux(disk, partition, dir_data, inode, &copy_ok, &copy_bad);
-  log_info("Copy done! %u ok, %u failed", copy_ok, copy_bad);
+  TD_INIT_LIST_HEAD(&ctx.dirs);
+  ctx.known=NULL;
+  ctx.known_nbr=0;
+  ctx.known_size=0;
+  ctx.files=(struct dir_copy_file *)MALLOC(DIR_COPY_BATCH * sizeof(struct dir_copy_file));
+  ctx.files_nbr=0;
+  ctx.copy_ok=0;
+  ctx.copy_bad=0;
+  root_directory=strdup(dir_data->current_directory);
+  /* Not perfect for FAT32 root cluster */
+  dir_copy_known(&ctx, inode);
+  dir_copy_queue(&ctx, inode, 0, root_directory);
+  /* The files, sorted by inode, are read whole */
+  disk_advise(disk, partition->part_offset, partition->part_size, TESTDISK_ADVISE_SEQUENTIAL);
+  /* Breadth-first walk, the files are copied once a batch is full */
+  while(!td_list_empty(&ctx.dirs))
+  {
+    struct td_list_head *file_walker = NULL;
+    struct td_list_head *file_walker_next = NULL;
+    struct dir_copy_dir *dir=td_list_first_entry(&ctx.dirs, struct dir_copy_dir, list);
+    unsigned int current_directory_namelength;
+    file_info_t dir_list;
+    td_list_del(&dir->list);
+    strcpy(dir_data->current_directory, dir->path);
+    current_directory_namelength=strlen(dir_data->current_directory);
+    init_list_file(&dir_list);
+    dir_data->get_dir(disk, partition, dir_data, dir->inode, &dir_list);
+    td_list_for_each_safe(file_walker, file_walker_next, &dir_list.list)
+    {
+      file_info_t *current_file=td_list_entry(file_walker, file_info_t, list);
+      if(strlen(dir_data->current_directory) + 1 + strlen(current_file->name) <
+	  sizeof(dir_data->current_directory)-1)
+      {
+	if(strcmp(dir_data->current_directory,"/"))
+	  strcat(dir_data->current_directory,"/");
+	strcat(dir_data->current_directory,current_file->name);
+	if(LINUX_S_ISDIR(current_file->st_mode)!=0)
+	{
+	  /* subdirectories depth is limited */
+	  if(dir->depth + 1 < MAX_DIR_NBR &&
+	      current_file->st_ino >= 2 &&
+	      strcmp(current_file->name, "..")!=0 &&
+	      dir_copy_known(&ctx, current_file->st_ino)==0)
+	    dir_copy_queue(&ctx, current_file->st_ino, dir->depth + 1, dir_data->current_directory);
+	}
+	else if(LINUX_S_ISREG(current_file->st_mode)!=0)
+	{
+	  /* The files of dir_list are freed at once */
+	  file_info_t *file=(file_info_t *)MALLOC(sizeof(*file));
+	  memcpy(file, current_file, sizeof(*file));
+	  file->name=strdup(current_file->name);
+	  ctx.files[ctx.files_nbr].file=file;
+	  ctx.files[ctx.files_nbr].path=strdup(dir_data->current_directory);
+	  ctx.files_nbr++;
+	  if(ctx.files_nbr==DIR_COPY_BATCH)
+	    dir_copy_flush(disk, partition, dir_data, &ctx);
+	}
+      }
+      /* restore current_directory name */
+      dir_data->current_directory[current_directory_namelength]='\0';
+    }
+    delete_list_file(&dir_list);
+    free(dir->path);
+    free(dir);
+  }
+  dir_copy_flush(disk, partition, dir_data, &ctx);
+  disk_advise(disk, partition->part_offset, partition->part_size, TESTDISK_ADVISE_NORMAL);
+  strcpy(dir_data->current_directory, root_directory);
+  free(root_directory);
+  free(ctx.files);
+  free(ctx.known);
+  log_info("Copy done! %u ok, %u failed", ctx.copy_ok, ctx.copy_bad);
 }
 
 int filesort(const struct td_list_head *a, const struct td_list_head *b)
@@ -455,6 +775,54 @@ int filesort(const struct td_list_head *a, const struct td_list_head *b)
   return strcmp(file_a->name, file_b->name);
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+struct file_info_sort
+{
+  file_info_t *file;
+  unsigned int pos;
+};
+
+/* Same order as td_list_sort(), equal files keep their order */
+static int file_info_sort_cmp(const void *a, const void *b)
+{
+  const struct file_info_sort *sort_a=(const struct file_info_sort *)a;
+  const struct file_info_sort *sort_b=(const struct file_info_sort *)b;
+  const int res=filesort(&sort_a->file->list, &sort_b->file->list);
+  if(res!=0)
+    return res;
+  return (sort_a->pos < sort_b->pos ? -1 : 1);
+}
+#endif
+
+void sort_list_file(file_info_t *list)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct td_list_head *file_walker = NULL;
+  struct file_info_sort *files;
+  unsigned int nbr=0;
+  unsigned int i;
+  td_list_for_each(file_walker, &list->list)
+    nbr++;
+  if(nbr < 2)
+    return ;
+  files=(struct file_info_sort *)MALLOC(nbr * sizeof(*files));
+  i=0;
+  td_list_for_each(file_walker, &list->list)
+  {
+    files[i].file=td_list_entry(file_walker, file_info_t, list);
+    files[i].pos=i;
+    i++;
+  }
+  qsort(files, nbr, sizeof(*files), file_info_sort_cmp);
+  TD_INIT_LIST_HEAD(&list->list);
+  for(i=0; i<nbr; i++)
+    td_list_add_tail(&files[i].file->list, &list->list);
+  free(files);
+#else
+  td_list_sort(&list->list, filesort);
+#endif
+}
+
 /*
  * The mode_xlate function translates a linux mode into a native-OS mode_t.
  */
@@ -48,11 +48,51 @@ int dir_aff_log(const dir_data_t *dir_data, const file_info_t*dir_list);
   @*/
 void log_list_file(const disk_t *disk_car, const partition_t *partition, const dir_data_t *dir_data, const file_info_t*list);
 
+/* Initialize an empty list of files */
+/*@
+  @ requires \valid(list);
+  @*/
+void init_list_file(file_info_t *list);
+
+/* Free the files of the list, the list is empty afterwards */
 /*@
   @ requires \valid(list);
   @*/
 unsigned int delete_list_file(file_info_t *list);
 
+/* New file for list, name is copied (it may be NULL). The file isn't
+ * added to list but it's allocated with the other files of list and
+ * they are all freed at once by delete_list_file(): a list whose files
+ * come from file_info_new() can't also have files allocated with
+ * malloc(), they are not freed individually. */
+/*@
+  @ requires \valid(list);
+  @ requires name == \null || valid_read_string(name);
+  @ ensures \valid(\result);
+  @*/
+file_info_t *file_info_new(file_info_t *list, const char *name);
+
+/* Copy of name freed with the files of list */
+/*@
+  @ requires \valid(list);
+  @ requires valid_read_string(name);
+  @ ensures valid_read_string(\result);
+  @*/
+char *file_info_strdup(file_info_t *list, const char *name);
+
+/* Sort the files like td_list_sort(&list->list, filesort) */
+/*@
+  @ requires \valid(list);
+  @*/
+void sort_list_file(file_info_t *list);
+
+/* Keep the directory listings in memory until dir_data->close() so
+ * browsing back to a directory or listing it again doesn't read the disk */
+/*@
+  @ requires \valid(dir_data);
+  @*/
+void dir_cache_init(dir_data_t *dir_data);
+
 /*@
   @ requires \valid_read(disk_car);
   @ requires valid_disk(disk_car);
@@ -42,10 +42,14 @@ extern "C" {
 typedef enum { CP_OK=0, CP_STAT_FAILED=-1, CP_OPEN_FAILED=-2, CP_READ_FAILED=-3, CP_CREATE_FAILED=-4, CP_NOSPACE=-5, CP_CLOSE_FAILED=-6, CP_NOMEM=-7} copy_file_t;
 typedef enum { DIR_PART_ENOIMP=-3, DIR_PART_ENOSYS=-2, DIR_PART_EIO=-1, DIR_PART_OK=0} dir_partition_t;
 typedef struct dir_data dir_data_t;
+struct dir_cache;
+struct file_info_arena;
 
 typedef struct
 {
   struct td_list_head list;
+  /* List head only: entries allocated by file_info_new() */
+  struct file_info_arena *arena;
   char *name;
   uint32_t st_ino;
   uint32_t st_mode;
@@ -71,11 +75,15 @@ struct dir_data
   void (*close)(dir_data_t *dir_data);
   char *local_dir;
   void *private_dir_data;
+  struct dir_cache *cache;
 };
 
 #define	FILE_STATUS_DELETED	1
 #define	FILE_STATUS_MARKED	2
 #define	FILE_STATUS_ADS		4
+/* The clusters of the file follow each other, the allocation table
+ * doesn't describe them */
+#define	FILE_STATUS_CONTIGUOUS	8
 
 #define LINUX_S_IFMT  00170000
 #define LINUX_S_IFSOCK 0140000
@@ -642,7 +642,7 @@ static int dir_partition_aux(disk_t *disk, const partition_t *partition, dir_dat
     const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
     long int new_inode;
     file_info_t dir_list;
-    TD_INIT_LIST_HEAD(&dir_list.list);
+    init_list_file(&dir_list);
     /* Not perfect for FAT32 root cluster */
     inode_known[depth]=inode;
     dir_data->get_dir(disk, partition, dir_data, inode, &dir_list);
@@ -677,6 +677,44 @@ int dir_partition_aff(disk_t *disk, const partition_t *partition, dir_data_t *di
   return dir_partition_aux(disk, partition, dir_data, inode, 0, current_cmd);
 }
 
+static int file_info_cmp_inode(const void *a, const void *b)
+{
+  const file_info_t *file_a=*(const file_info_t * const *)a;
+  const file_info_t *file_b=*(const file_info_t * const *)b;
+  if(file_a->st_ino < file_b->st_ino)
+    return -1;
+  if(file_a->st_ino > file_b->st_ino)
+    return 1;
+  return 0;
+}
+
+/* Copy the regular files by inode number, i.e. by first cluster for FAT
+ * or by inode table position for ext2, instead of directory order */
+static copy_dir_t copy_files_sorted(WINDOW *window, disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t **files, const unsigned int files_nbr, unsigned int *copy_ok, unsigned int *copy_bad)
+{
+  const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
+  unsigned int i;
+  qsort(files, files_nbr, sizeof(files[0]), file_info_cmp_inode);
+  for(i=0; i<files_nbr; i++)
+  {
+    copy_file_t res;
+    if(copy_progress(window, *copy_ok, *copy_bad))
+      return CD_STOPPED;
+    if(strcmp(dir_data->current_directory,"/"))
+      strcat(dir_data->current_directory,"/");
+    strcat(dir_data->current_directory,files[i]->name);
+    res=dir_data->copy_file(disk, partition, dir_data, files[i]);
+    dir_data->current_directory[current_directory_namelength]='\0';
+    if(res == CP_OK)
+      (*copy_ok)++;
+    else
+      (*copy_bad)++;
+    if(res==CP_NOSPACE)
+      return CD_NOSPACE;
+  }
+  return CD_FINISHED;
+}
+
 static copy_dir_t copy_dir(WINDOW *window, disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *dir, unsigned int *copy_ok, unsigned int *copy_bad)
 {
   static unsigned int dir_nbr=0;
@@ -685,45 +723,52 @@ static copy_dir_t copy_dir(WINDOW *window, disk_t *disk, const partition_t *part
   const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
   char *dir_name;
   struct td_list_head *file_walker = NULL;
-  TD_INIT_LIST_HEAD(&dir_list.list);
+  init_list_file(&dir_list);
   if(dir_data->get_dir==NULL || dir_data->copy_file==NULL)
     return CD_FINISHED;
   inode_known[dir_nbr++]=dir->st_ino;
   dir_name=mkdir_local(dir_data->local_dir, dir_data->current_directory);
   dir_data->get_dir(disk, partition, dir_data, (const unsigned long int)dir->st_ino, &dir_list);
+  {
+    const file_info_t **files;
+    unsigned int files_nbr=0;
+    copy_dir_t copy_stopped;
+    td_list_for_each(file_walker, &dir_list.list)
+      files_nbr++;
+    files=(const file_info_t **)MALLOC((files_nbr+1) * sizeof(file_info_t *));
+    files_nbr=0;
+    td_list_for_each(file_walker, &dir_list.list)
+    {
+      const file_info_t *current_file=td_list_entry_const(file_walker, const file_info_t, list);
+      if(LINUX_S_ISREG(current_file->st_mode)!=0 &&
+	  current_directory_namelength+1+strlen(current_file->name)<sizeof(dir_data->current_directory)-1)
+	files[files_nbr++]=current_file;
+    }
+    copy_stopped=copy_files_sorted(window, disk, partition, dir_data, files, files_nbr, copy_ok, copy_bad);
+    free(files);
+    if(copy_stopped != CD_FINISHED)
+    {
+      delete_list_file(&dir_list);
+      set_date(dir_name, dir->td_atime, dir->td_mtime);
+      free(dir_name);
+      dir_nbr--;
+      return copy_stopped;
+    }
+  }
   td_list_for_each(file_walker, &dir_list.list)
   {
     const file_info_t *current_file;
     current_file=td_list_entry(file_walker, file_info_t, list);
     dir_data->current_directory[current_directory_namelength]='\0';
-    if(current_directory_namelength+1+strlen(current_file->name)<sizeof(dir_data->current_directory)-1)
+    if(LINUX_S_ISDIR(current_file->st_mode)!=0 &&
+	current_directory_namelength+1+strlen(current_file->name)<sizeof(dir_data->current_directory)-1 &&
+	can_copy_dir(current_file, &inode_known[0], dir_nbr) > 0)
     {
-      copy_dir_t copy_stopped=CD_FINISHED;
+      copy_dir_t copy_stopped;
       if(strcmp(dir_data->current_directory,"/"))
 	strcat(dir_data->current_directory,"/");
       strcat(dir_data->current_directory,current_file->name);
-      if(LINUX_S_ISDIR(current_file->st_mode)!=0)
-      {
-	if(can_copy_dir(current_file, &inode_known[0], dir_nbr) > 0)
-	{
-	  copy_stopped=copy_dir(window, disk, partition, dir_data, current_file, copy_ok, copy_bad);
-	}
-      }
-      else if(LINUX_S_ISREG(current_file->st_mode)!=0)
-      {
-	if(copy_progress(window, *copy_ok, *copy_bad))
-	  copy_stopped=CD_STOPPED;
-	else
-	{
-	  const copy_file_t res=dir_data->copy_file(disk, partition, dir_data, current_file);
-	  if(res==CP_NOSPACE)
-	    copy_stopped=CD_NOSPACE;
-	  if(res==CP_OK)
-	    (*copy_ok)++;
-	  else
-	    (*copy_bad)++;
-	}
-      }
+      copy_stopped=copy_dir(window, disk, partition, dir_data, current_file, copy_ok, copy_bad);
       if(copy_stopped != CD_FINISHED)
       {
 	dir_data->current_directory[current_directory_namelength]='\0';
@@ -747,44 +792,49 @@ static copy_dir_t copy_selection(file_info_t*dir_list, WINDOW *window, disk_t *d
 {
   const unsigned int current_directory_namelength=strlen(dir_data->current_directory);
   struct td_list_head *tmpw=NULL;
+  const file_info_t **files;
+  unsigned int files_nbr=0;
+  copy_dir_t copy_stopped;
+  td_list_for_each(tmpw, &dir_list->list)
+    files_nbr++;
+  files=(const file_info_t **)MALLOC((files_nbr+1) * sizeof(file_info_t *));
+  files_nbr=0;
+  td_list_for_each(tmpw, &dir_list->list)
+  {
+    file_info_t *tmp=td_list_entry(tmpw, file_info_t, list);
+    if((tmp->status&FILE_STATUS_MARKED)!=0 &&
+	LINUX_S_ISREG(tmp->st_mode)!=0 &&
+	current_directory_namelength + 1 + strlen(tmp->name) <
+	sizeof(dir_data->current_directory)-1)
+    {
+      tmp->status&=~FILE_STATUS_MARKED;
+      files[files_nbr++]=tmp;
+    }
+  }
+  copy_stopped=copy_files_sorted(window, disk, partition, dir_data, files, files_nbr, copy_ok, copy_bad);
+  free(files);
+  if(copy_stopped!=CD_FINISHED)
+    return copy_stopped;
   td_list_for_each(tmpw, &dir_list->list)
   {
-    copy_dir_t copy_stopped=CD_FINISHED;
     file_info_t *tmp=td_list_entry(tmpw, file_info_t, list);
     if((tmp->status&FILE_STATUS_MARKED)!=0 &&
 	current_directory_namelength + 1 + strlen(tmp->name) <
 	sizeof(dir_data->current_directory)-1)
     {
       tmp->status&=~FILE_STATUS_MARKED;
-      if(strcmp(dir_data->current_directory,"/"))
-	strcat(dir_data->current_directory,"/");
-      if(strcmp(tmp->name,".")!=0)
-	strcat(dir_data->current_directory,tmp->name);
       if(LINUX_S_ISDIR(tmp->st_mode)!=0)
       {
+	if(strcmp(dir_data->current_directory,"/"))
+	  strcat(dir_data->current_directory,"/");
+	if(strcmp(tmp->name,".")!=0)
+	  strcat(dir_data->current_directory,tmp->name);
 	copy_stopped=copy_dir(window, disk, partition, dir_data, tmp, copy_ok, copy_bad);
+	dir_data->current_directory[current_directory_namelength]='\0';
 	if(copy_stopped!=CD_FINISHED)
-	{
-	  dir_data->current_directory[current_directory_namelength]='\0';
 	  return copy_stopped;
-	}
-      }
-      else if(LINUX_S_ISREG(tmp->st_mode)!=0)
-      {
-	copy_file_t res;
-	copy_progress(window, *copy_ok, *copy_bad);
-	res=dir_data->copy_file(disk, partition, dir_data, tmp);
-	if(res==CP_NOSPACE)
-	  copy_stopped=CD_NOSPACE;
-	if(res == CP_OK)
-	  (*copy_ok)++;
-	else
-	  (*copy_bad)++;
       }
     }
-    dir_data->current_directory[current_directory_namelength]='\0';
-    if(copy_stopped!=CD_FINISHED)
-      return copy_stopped;
   }
   return CD_FINISHED;
 }
@@ -42,7 +42,10 @@
 #include "exfat_dir.h"
 #include "ext2_dir.h"
 #include "fat_dir.h"
+#include "hfsp_dir.h"
+#include "iso_dir.h"
 #include "ntfs_dir.h"
+#include "ntfs_mft.h"
 #include "rfs_dir.h"
 #include "dirpart.h"
 #include "ntfs.h"
@@ -98,9 +101,21 @@ static dir_partition_t dir_partition_init(disk_t *disk, const partition_t *parti
     case UP_RFS3:
       return dir_partition_reiser_init(disk, partition, dir_data, verbose);
     case UP_NTFS:
-      return dir_partition_ntfs_init(disk, partition, dir_data, verbose, expert);
+      {
+	const dir_partition_t res=dir_partition_ntfs_init(disk, partition, dir_data, verbose, expert);
+	/* libntfs can't mount it, fall back to scanning the MFT records */
+	if(res!=DIR_PART_OK &&
+	    dir_partition_ntfs_mft_init(disk, partition, dir_data, verbose, expert)==DIR_PART_OK)
+	  return DIR_PART_OK;
+	return res;
+      }
     case UP_EXFAT:
       return dir_partition_exfat_init(disk, partition, dir_data, verbose);
+    case UP_HFSP:
+    case UP_HFSX:
+      return dir_partition_hfsp_init(disk, partition, dir_data, verbose);
+    case UP_ISO:
+      return dir_partition_iso_init(disk, partition, dir_data, verbose);
     default:
       return DIR_PART_ENOIMP;
   }
@@ -193,6 +208,7 @@ dir_partition_t dir_partition(disk_t *disk, const partition_t *partition, const
       {
 	int recursive=0;
 	int copy_files=0;
+	dir_cache_init(&dir_data);
 	if(current_cmd!=NULL && *current_cmd!=NULL)
 	{
 	  int do_continue;
@@ -231,7 +247,7 @@ dir_partition_t dir_partition(disk_t *disk, const partition_t *partition, const
 	  }
 	  {
 	    file_info_t dir_list;
-	    TD_INIT_LIST_HEAD(&dir_list.list);
+	    init_list_file(&dir_list);
 	    dir_data.get_dir(disk, partition, &dir_data, dir_data.current_inode, &dir_list);
 	    dir_aff_log(&dir_data, &dir_list);
 	    delete_list_file(&dir_list);
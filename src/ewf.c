@@ -25,6 +25,7 @@
 
 #if defined(DISABLED_FOR_FRAMAC)
 #undef HAVE_LIBEWF
+#undef HAVE_PTHREAD
 #endif
 
 #ifdef HAVE_STRING_H
@@ -73,8 +74,15 @@
 #include <glob.h>
 #endif
 
+#if defined( HAVE_LIBEWF_V2_API ) && defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
+
 #include "log.h"
 #include "hdaccess.h"
+#include "hdstats.h"
+#include "list.h"
+#include "pbkdf2.h"
 
 extern const arch_fnct_t arch_none;
 
@@ -85,6 +93,41 @@ static int fewf_pread(disk_t *disk, void *buffer, const unsigned int count, cons
 static int fewf_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset);
 static int fewf_pwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset);
 static int fewf_sync(disk_t *disk);
+#if defined( HAVE_LIBEWF_V2_API ) && defined(HAVE_PTHREAD)
+static void fewf_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint);
+#endif
+
+#if defined( HAVE_LIBEWF_V2_API )
+/* Read-only images keep the last decompressed chunks. When the image is
+ * read sequentially, the next chunks are decompressed ahead by worker
+ * threads, each with its own libewf handle. */
+#define FEWF_CACHE_CHUNKS	64
+#define FEWF_CHUNK_SIZE_MAX	(16*1024*1024)
+#define FEWF_READ_AHEAD		16
+#define FEWF_MAX_WORKERS	4
+
+typedef enum { FEWF_CHUNK_EMPTY=0, FEWF_CHUNK_LOADING=1, FEWF_CHUNK_READY=2 } fewf_chunk_state_t;
+
+struct fewf_chunk
+{
+  struct td_list_head list;	/* LRU, most recently used first */
+  uint64_t offset;
+  int status;			/* bytes available from offset */
+  fewf_chunk_state_t state;
+  unsigned char *buffer;
+};
+
+struct info_fewf_struct;
+
+#ifdef HAVE_PTHREAD
+struct fewf_worker
+{
+  struct info_fewf_struct *data;
+  libewf_handle_t *handle;
+  pthread_t thread;
+};
+#endif
+#endif
 
 struct info_fewf_struct
 {
@@ -98,8 +141,291 @@ struct info_fewf_struct
   int mode;
   void *buffer;
   unsigned int buffer_size;
+#if defined( HAVE_LIBEWF_V2_API )
+  uint64_t media_size;
+  unsigned int chunk_size;
+  struct fewf_chunk *chunks;	/* NULL if the cache is disabled */
+  struct td_list_head lru;
+  uint64_t next_offset;		/* expected offset of a sequential read */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct fewf_chunk *queue[FEWF_CACHE_CHUNKS];
+  unsigned int queue_first;
+  unsigned int queue_nbr;
+  int quit;
+  unsigned int nbr_workers;
+  struct fewf_worker workers[FEWF_MAX_WORKERS];
+#endif
+#endif
+  disk_stats_t *stats;
 };
 
+#if defined( HAVE_LIBEWF_V2_API )
+static int64_t fewf_read_handle(libewf_handle_t *handle, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#if defined( HAVE_LIBEWF_HANDLE_READ_BUFFER_AT_OFFSET )
+  return libewf_handle_read_buffer_at_offset(
+            handle,
+            buffer,
+            count,
+            offset,
+            NULL );
+#else
+  return libewf_handle_read_random(
+            handle,
+            buffer,
+            count,
+            offset,
+            NULL );
+#endif
+}
+
+static inline void fewf_lock(struct info_fewf_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+#endif
+}
+
+static inline void fewf_unlock(struct info_fewf_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->mutex);
+#endif
+}
+
+static unsigned int fewf_chunk_read_size(const struct info_fewf_struct *data, const uint64_t offset)
+{
+  return (offset + data->chunk_size > data->media_size ? data->media_size - offset : data->chunk_size);
+}
+
+static struct fewf_chunk *fewf_chunk_lookup(struct info_fewf_struct *data, const uint64_t offset)
+{
+  unsigned int i;
+  for(i=0; i<FEWF_CACHE_CHUNKS; i++)
+  {
+    struct fewf_chunk *chunk=&data->chunks[i];
+    if(chunk->state!=FEWF_CHUNK_EMPTY && chunk->offset==offset)
+      return chunk;
+  }
+  return NULL;
+}
+
+/* Least recently used chunk that is not being loaded */
+static struct fewf_chunk *fewf_chunk_victim(struct info_fewf_struct *data)
+{
+  struct td_list_head *walker;
+  td_list_for_each_prev(walker, &data->lru)
+  {
+    struct fewf_chunk *chunk=td_list_entry(walker, struct fewf_chunk, list);
+    if(chunk->state!=FEWF_CHUNK_LOADING)
+      return chunk;
+  }
+  return NULL;
+}
+
+#ifdef HAVE_PTHREAD
+static void *fewf_worker_thread(void *arg)
+{
+  struct fewf_worker *worker=(struct fewf_worker *)arg;
+  struct info_fewf_struct *data=worker->data;
+  pthread_mutex_lock(&data->mutex);
+  while(1)
+  {
+    struct fewf_chunk *chunk;
+    unsigned int size;
+    int64_t res;
+    while(data->queue_nbr==0 && data->quit==0)
+      pthread_cond_wait(&data->cond, &data->mutex);
+    if(data->quit!=0)
+      break;
+    chunk=data->queue[data->queue_first];
+    data->queue_first=(data->queue_first + 1) % FEWF_CACHE_CHUNKS;
+    data->queue_nbr--;
+    size=fewf_chunk_read_size(data, chunk->offset);
+    /* A chunk being loaded is never recycled */
+    pthread_mutex_unlock(&data->mutex);
+    res=fewf_read_handle(worker->handle, chunk->buffer, size, chunk->offset);
+    pthread_mutex_lock(&data->mutex);
+    chunk->status=(res < 0 ? -1 : (int)res);
+    chunk->state=FEWF_CHUNK_READY;
+    pthread_cond_broadcast(&data->cond);
+  }
+  pthread_mutex_unlock(&data->mutex);
+  return NULL;
+}
+
+/* Queue nbr chunks from first_offset for the worker threads,
+ * called with the lock held */
+static void fewf_queue_chunks(struct info_fewf_struct *data, const uint64_t first_offset, const unsigned int nbr)
+{
+  unsigned int i;
+  if(data->nbr_workers==0)
+    return ;
+  for(i=0; i<nbr && data->queue_nbr < FEWF_CACHE_CHUNKS; i++)
+  {
+    const uint64_t offset=first_offset + (uint64_t)i * data->chunk_size;
+    struct fewf_chunk *chunk;
+    if(offset >= data->media_size)
+      return ;
+    if(fewf_chunk_lookup(data, offset)!=NULL)
+      continue;
+    chunk=fewf_chunk_victim(data);
+    if(chunk==NULL)
+      return ;
+    chunk->offset=offset;
+    chunk->status=0;
+    chunk->state=FEWF_CHUNK_LOADING;
+    td_list_del(&chunk->list);
+    td_list_add(&chunk->list, &data->lru);
+    data->queue[(data->queue_first + data->queue_nbr) % FEWF_CACHE_CHUNKS]=chunk;
+    data->queue_nbr++;
+  }
+  pthread_cond_broadcast(&data->cond);
+}
+
+/* Queue the chunks following a sequential read, called with the lock held */
+static void fewf_read_ahead(struct info_fewf_struct *data, const uint64_t chunk_offset)
+{
+  fewf_queue_chunks(data, chunk_offset + data->chunk_size, FEWF_READ_AHEAD);
+}
+#endif
+
+/* Return the chunk at offset, loaded, called with the lock held */
+static struct fewf_chunk *fewf_chunk_get(struct info_fewf_struct *data, const uint64_t offset)
+{
+  struct fewf_chunk *chunk;
+  while(1)
+  {
+    chunk=fewf_chunk_lookup(data, offset);
+    if(chunk!=NULL)
+    {
+      if(chunk->state==FEWF_CHUNK_READY)
+	break;
+#ifdef HAVE_PTHREAD
+      pthread_cond_wait(&data->cond, &data->mutex);
+      continue;
+#endif
+    }
+    chunk=fewf_chunk_victim(data);
+    if(chunk==NULL)
+    {
+#ifdef HAVE_PTHREAD
+      pthread_cond_wait(&data->cond, &data->mutex);
+      continue;
+#else
+      return NULL;
+#endif
+    }
+    {
+      const unsigned int size=fewf_chunk_read_size(data, offset);
+      int64_t res;
+      chunk->offset=offset;
+      chunk->state=FEWF_CHUNK_LOADING;
+      fewf_unlock(data);
+      res=fewf_read_handle(data->handle, chunk->buffer, size, offset);
+      fewf_lock(data);
+      chunk->status=(res < 0 ? -1 : (int)res);
+      chunk->state=FEWF_CHUNK_READY;
+#ifdef HAVE_PTHREAD
+      pthread_cond_broadcast(&data->cond);
+#endif
+    }
+    break;
+  }
+  td_list_del(&chunk->list);
+  td_list_add(&chunk->list, &data->lru);
+  return chunk;
+}
+
+static void fewf_cache_init(struct info_fewf_struct *data, char **filenames, const int num_files)
+{
+#if defined( HAVE_LIBEWF_HANDLE_GET_SECTORS_PER_CHUNK )
+  uint32_t bytes_per_sector=0;
+  uint32_t sectors_per_chunk=0;
+  unsigned int i;
+  if(libewf_handle_get_bytes_per_sector(data->handle, &bytes_per_sector, NULL) != 1 ||
+      libewf_handle_get_sectors_per_chunk(data->handle, &sectors_per_chunk, NULL) != 1 ||
+      bytes_per_sector==0 || sectors_per_chunk==0 ||
+      (uint64_t)bytes_per_sector * sectors_per_chunk > FEWF_CHUNK_SIZE_MAX)
+    return ;
+  data->chunk_size=bytes_per_sector * sectors_per_chunk;
+  /* Writes go through libewf, the cache would be stale */
+  if((data->mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    return ;
+  data->chunks=(struct fewf_chunk *)MALLOC(FEWF_CACHE_CHUNKS * sizeof(struct fewf_chunk));
+  TD_INIT_LIST_HEAD(&data->lru);
+  for(i=0; i<FEWF_CACHE_CHUNKS; i++)
+  {
+    struct fewf_chunk *chunk=&data->chunks[i];
+    chunk->offset=0;
+    chunk->status=0;
+    chunk->state=FEWF_CHUNK_EMPTY;
+    chunk->buffer=(unsigned char *)MALLOC(data->chunk_size);
+    td_list_add_tail(&chunk->list, &data->lru);
+  }
+  data->next_offset=(uint64_t)-1;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond, NULL);
+  data->queue_first=0;
+  data->queue_nbr=0;
+  data->quit=0;
+  data->nbr_workers=0;
+  for(i=0; i<FEWF_MAX_WORKERS; i++)
+  {
+    struct fewf_worker *worker=&data->workers[data->nbr_workers];
+    worker->data=data;
+    worker->handle=NULL;
+    if(libewf_handle_initialize(&worker->handle, NULL) != 1)
+      break;
+    if(libewf_handle_open(worker->handle, filenames, num_files, LIBEWF_OPEN_READ, NULL) != 1)
+    {
+      libewf_handle_free(&worker->handle, NULL);
+      break;
+    }
+    if(pthread_create(&worker->thread, NULL, &fewf_worker_thread, worker)!=0)
+    {
+      libewf_handle_close(worker->handle, NULL);
+      libewf_handle_free(&worker->handle, NULL);
+      break;
+    }
+    data->nbr_workers++;
+  }
+  if(data->nbr_workers==0)
+    log_warning("%s: no read-ahead thread, EWF chunks are decompressed on demand\n", data->file_name);
+#endif
+#endif
+}
+
+static void fewf_cache_free(struct info_fewf_struct *data)
+{
+  unsigned int i;
+  if(data->chunks==NULL)
+    return ;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+  data->quit=1;
+  pthread_cond_broadcast(&data->cond);
+  pthread_mutex_unlock(&data->mutex);
+  for(i=0; i<data->nbr_workers; i++)
+  {
+    pthread_join(data->workers[i].thread, NULL);
+    libewf_handle_close(data->workers[i].handle, NULL);
+    libewf_handle_free(&data->workers[i].handle, NULL);
+  }
+  data->nbr_workers=0;
+  pthread_cond_destroy(&data->cond);
+  pthread_mutex_destroy(&data->mutex);
+#endif
+  for(i=0; i<FEWF_CACHE_CHUNKS; i++)
+    free(data->chunks[i].buffer);
+  free(data->chunks);
+  data->chunks=NULL;
+}
+#endif
+
 #if defined( HAVE_LIBEWF_V2_API )
 disk_t *fewf_init(const char *device, const int mode)
 {
@@ -257,6 +583,10 @@ disk_t *fewf_init(const char *device, const int mode)
   disk->sync=&fewf_sync;
   disk->access_mode=(data->mode&TESTDISK_O_RDWR);
   disk->clean=&fewf_clean;
+#ifdef HAVE_PTHREAD
+  disk->advise=&fewf_advise;
+#endif
+  data->stats=disk_stats_new("ewf", data->file_name);
   {
     uint32_t bytes_per_sector = 0;
     if( libewf_handle_get_bytes_per_sector(
@@ -290,6 +620,8 @@ disk_t *fewf_init(const char *device, const int mode)
     }
     disk->disk_real_size=media_size;
   }
+  data->media_size=disk->disk_real_size;
+  fewf_cache_init(data, filenames, num_files);
   update_disk_car_fields(disk);
   libewf_glob_free(
     filenames,
@@ -401,6 +733,7 @@ disk_t *fewf_init(const char *device, const int mode)
   disk->sync=&fewf_sync;
   disk->access_mode=(data->mode&TESTDISK_O_RDWR);
   disk->clean=&fewf_clean;
+  data->stats=disk_stats_new("ewf", data->file_name);
 #if defined( LIBEWF_GET_BYTES_PER_SECTOR_HAVE_TWO_ARGUMENTS )
   {
     uint32_t bytes_per_sector = 0;
@@ -477,6 +810,7 @@ static void fewf_clean(disk_t *disk)
   {
     struct info_fewf_struct *data=(struct info_fewf_struct *)disk->data;
 #if defined( HAVE_LIBEWF_V2_API )
+    fewf_cache_free(data);
     libewf_handle_close(
      data->handle,
      NULL);
@@ -492,6 +826,7 @@ static void fewf_clean(disk_t *disk)
     free(data->buffer);
     data->buffer=NULL;
 
+    disk_stats_free(data->stats);
     free(disk->data);
     disk->data=NULL;
   }
@@ -504,26 +839,12 @@ static int fewf_sync(disk_t *disk)
   return -1;
 }
 
-static int fewf_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+static int fewf_pread_direct(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
 {
   struct info_fewf_struct *data=(struct info_fewf_struct *)disk->data;
   int64_t taille;
 #if defined( HAVE_LIBEWF_V2_API )
-#if defined( HAVE_LIBEWF_HANDLE_READ_BUFFER_AT_OFFSET )
-  taille = libewf_handle_read_buffer_at_offset(
-            data->handle,
-            buffer,
-            count,
-            offset,
-            NULL );
-#else
-  taille = libewf_handle_read_random(
-            data->handle,
-            buffer,
-            count,
-            offset,
-            NULL );
-#endif
+  taille = fewf_read_handle(data->handle, buffer, count, offset);
 #else
   taille=libewf_read_random(data->handle, buffer, count, offset);
 #endif
@@ -544,6 +865,89 @@ static int fewf_pread(disk_t *disk, void *buffer, const unsigned int count, cons
   return taille;
 }
 
+static int fewf_pread_aux(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#if defined( HAVE_LIBEWF_V2_API )
+  struct info_fewf_struct *data=(struct info_fewf_struct *)disk->data;
+  unsigned int done=0;
+  if(data->chunks==NULL)
+    return fewf_pread_direct(disk, buffer, count, offset);
+  fewf_lock(data);
+  while(done < count)
+  {
+    const uint64_t pos=offset + done;
+    const uint64_t chunk_offset=pos / data->chunk_size * data->chunk_size;
+    const unsigned int in_chunk=pos - chunk_offset;
+    const unsigned int size=(data->chunk_size - in_chunk < count - done ? data->chunk_size - in_chunk : count - done);
+    const struct fewf_chunk *chunk=(pos < data->media_size ? fewf_chunk_get(data, chunk_offset) : NULL);
+    if(chunk==NULL || chunk->status < (signed)(in_chunk + size))
+    {
+      /* End of media or read error, let libewf report it */
+      int res;
+      fewf_unlock(data);
+      res=fewf_pread_direct(disk, (unsigned char *)buffer + done, count - done, pos);
+      if(res < (signed)(count - done))
+      {
+	if(done==0)
+	  return res;
+	return (res > 0 ? (signed)done + res : (signed)done);
+      }
+      return count;
+    }
+    memcpy((unsigned char *)buffer + done, chunk->buffer + in_chunk, size);
+    done+=size;
+  }
+#ifdef HAVE_PTHREAD
+  if(offset==data->next_offset)
+    fewf_read_ahead(data, (offset + count - 1) / data->chunk_size * data->chunk_size);
+#endif
+  data->next_offset=offset + count;
+  fewf_unlock(data);
+  return count;
+#else
+  return fewf_pread_direct(disk, buffer, count, offset);
+#endif
+}
+
+static int fewf_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  const struct info_fewf_struct *data=(const struct info_fewf_struct *)disk->data;
+  const uint64_t start=disk_stats_clock();
+  const int res=fewf_pread_aux(disk, buffer, count, offset);
+  disk_stats_read(data->stats, count, res, start);
+  return res;
+}
+
+#if defined( HAVE_LIBEWF_V2_API ) && defined(HAVE_PTHREAD)
+/* The chunks of a range that will be read are decompressed in advance,
+ * up to half of the cache so they don't evict each other */
+static void fewf_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct info_fewf_struct *data=(struct info_fewf_struct *)disk->data;
+  uint64_t first_offset;
+  uint64_t nbr;
+  if(hint!=TESTDISK_ADVISE_WILLNEED || data->chunks==NULL || offset >= data->media_size)
+    return ;
+  first_offset=offset / data->chunk_size * data->chunk_size;
+  nbr=(offset + length - first_offset + data->chunk_size - 1) / data->chunk_size;
+  fewf_lock(data);
+  fewf_queue_chunks(data, first_offset, (nbr < FEWF_CACHE_CHUNKS / 2 ? nbr : FEWF_CACHE_CHUNKS / 2));
+  fewf_unlock(data);
+}
+#endif
+
+unsigned int fewf_get_chunk_size(const disk_t *disk)
+{
+#if defined( HAVE_LIBEWF_V2_API )
+  if(disk->pread==&fewf_pread)
+  {
+    const struct info_fewf_struct *data=(const struct info_fewf_struct *)disk->data;
+    return data->chunk_size;
+  }
+#endif
+  return 0;
+}
+
 static int fewf_pwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
 {
   struct info_fewf_struct *data=(struct info_fewf_struct *)disk->data;
@@ -586,6 +990,391 @@ static int fewf_nopwrite(disk_t *disk, const void *buffer, const unsigned int co
   return -1;
 }
 
+#if defined( HAVE_LIBEWF_V2_API )
+/* EWF writer: the data is hashed as it comes, the chunks are compressed
+ * by worker threads and written in order by the caller. */
+#define FEWF_WRITE_SLOTS	32
+#define FEWF_WRITE_THREADS	8
+
+typedef enum { FEWF_SLOT_FREE=0, FEWF_SLOT_FILLED=1, FEWF_SLOT_PACKED=2 } fewf_slot_state_t;
+
+struct fewf_slot
+{
+  unsigned char *buffer;
+  unsigned int size;
+  uint64_t seq;
+  int status;			/* 0 if the chunk has been compressed */
+  fewf_slot_state_t state;
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+  libewf_data_chunk_t *data_chunk;
+#endif
+};
+
+struct fewf_writer
+{
+  libewf_handle_t *handle;
+  char *file_name;
+  unsigned int chunk_size;
+  unsigned int nbr_slots;	/* 0: libewf compresses the data itself */
+  struct fewf_slot slots[FEWF_WRITE_SLOTS];
+  struct fewf_slot *current;	/* slot being filled */
+  uint64_t seq_next;		/* next chunk to fill */
+  uint64_t seq_write;		/* next chunk to write */
+  uint64_t written;
+  int error;
+  hash_ctx_t md5;
+  hash_ctx_t sha1;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t threads[FEWF_WRITE_THREADS];
+  unsigned int nbr_threads;
+  int quit;
+#endif
+};
+
+static inline void fewf_writer_lock(fewf_writer_t *writer)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&writer->mutex);
+#endif
+}
+
+static inline void fewf_writer_unlock(fewf_writer_t *writer)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&writer->mutex);
+#endif
+}
+
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+static int fewf_slot_pack(struct fewf_slot *slot)
+{
+  return (libewf_data_chunk_write_buffer(slot->data_chunk, slot->buffer, slot->size, NULL) < 0 ? -1 : 0);
+}
+
+#ifdef HAVE_PTHREAD
+static void *fewf_writer_thread(void *arg)
+{
+  fewf_writer_t *writer=(fewf_writer_t *)arg;
+  pthread_mutex_lock(&writer->mutex);
+  while(1)
+  {
+    struct fewf_slot *slot=NULL;
+    unsigned int i;
+    int status;
+    /* Oldest chunk first, the caller waits for it */
+    for(i=0; i<writer->nbr_slots; i++)
+      if(writer->slots[i].state==FEWF_SLOT_FILLED &&
+	  (slot==NULL || writer->slots[i].seq < slot->seq))
+	slot=&writer->slots[i];
+    if(slot==NULL)
+    {
+      if(writer->quit!=0)
+	break;
+      pthread_cond_wait(&writer->cond, &writer->mutex);
+      continue;
+    }
+    /* A slot being compressed is neither FREE nor FILLED */
+    slot->state=FEWF_SLOT_PACKED;
+    slot->status=1;
+    pthread_mutex_unlock(&writer->mutex);
+    status=fewf_slot_pack(slot);
+    pthread_mutex_lock(&writer->mutex);
+    slot->status=status;
+    pthread_cond_broadcast(&writer->cond);
+  }
+  pthread_mutex_unlock(&writer->mutex);
+  return NULL;
+}
+#endif
+
+/* Write the compressed chunks that come next, called with the lock held */
+static void fewf_writer_output(fewf_writer_t *writer)
+{
+  int found=1;
+  while(found!=0)
+  {
+    unsigned int i;
+    found=0;
+    for(i=0; i<writer->nbr_slots; i++)
+    {
+      struct fewf_slot *slot=&writer->slots[i];
+      if(slot->state==FEWF_SLOT_PACKED && slot->status<=0 && slot->seq==writer->seq_write)
+      {
+	fewf_writer_unlock(writer);
+	if(slot->status < 0 ||
+	    libewf_handle_write_data_chunk(writer->handle, slot->data_chunk, NULL) < 0)
+	{
+	  log_error("%s: can't write the chunk at offset %llu\n", writer->file_name,
+	      (long long unsigned)(slot->seq * writer->chunk_size));
+	  writer->error=1;
+	}
+	fewf_writer_lock(writer);
+	writer->written+=slot->size;
+	slot->state=FEWF_SLOT_FREE;
+	writer->seq_write++;
+	found=1;
+      }
+    }
+  }
+}
+
+/* Return a free slot, the chunks already compressed are written */
+static struct fewf_slot *fewf_writer_slot(fewf_writer_t *writer)
+{
+  fewf_writer_lock(writer);
+  while(1)
+  {
+    unsigned int i;
+    fewf_writer_output(writer);
+    for(i=0; i<writer->nbr_slots; i++)
+    {
+      if(writer->slots[i].state==FEWF_SLOT_FREE)
+      {
+	fewf_writer_unlock(writer);
+	return &writer->slots[i];
+      }
+    }
+#ifdef HAVE_PTHREAD
+    pthread_cond_wait(&writer->cond, &writer->mutex);
+#endif
+  }
+}
+
+static void fewf_writer_submit(fewf_writer_t *writer, struct fewf_slot *slot)
+{
+  slot->seq=writer->seq_next++;
+#ifdef HAVE_PTHREAD
+  if(writer->nbr_threads > 0)
+  {
+    pthread_mutex_lock(&writer->mutex);
+    slot->state=FEWF_SLOT_FILLED;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    return ;
+  }
+#endif
+  slot->status=fewf_slot_pack(slot);
+  slot->state=FEWF_SLOT_PACKED;
+}
+
+/* Wait for every chunk to be written */
+static void fewf_writer_drain(fewf_writer_t *writer)
+{
+  fewf_writer_lock(writer);
+  fewf_writer_output(writer);
+  while(writer->seq_write < writer->seq_next)
+  {
+#ifdef HAVE_PTHREAD
+    pthread_cond_wait(&writer->cond, &writer->mutex);
+#endif
+    fewf_writer_output(writer);
+  }
+  fewf_writer_unlock(writer);
+}
+#endif
+
+static void fewf_writer_free(fewf_writer_t *writer)
+{
+  unsigned int i;
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK ) && defined(HAVE_PTHREAD)
+  if(writer->nbr_threads > 0)
+  {
+    pthread_mutex_lock(&writer->mutex);
+    writer->quit=1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+    for(i=0; i<writer->nbr_threads; i++)
+      pthread_join(writer->threads[i], NULL);
+  }
+#endif
+#ifdef HAVE_PTHREAD
+  pthread_cond_destroy(&writer->cond);
+  pthread_mutex_destroy(&writer->mutex);
+#endif
+  for(i=0; i<writer->nbr_slots; i++)
+  {
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+    libewf_data_chunk_free(&writer->slots[i].data_chunk, NULL);
+#endif
+    free(writer->slots[i].buffer);
+  }
+  libewf_handle_close(writer->handle, NULL);
+  libewf_handle_free(&writer->handle, NULL);
+  free(writer->file_name);
+  free(writer);
+}
+
+fewf_writer_t *fewf_writer_open(const char *basename, const uint64_t media_size, const unsigned int sector_size)
+{
+  fewf_writer_t *writer=(fewf_writer_t *)MALLOC(sizeof(*writer));
+  char *filenames[1];
+  uint32_t sectors_per_chunk=64;
+  memset(writer, 0, sizeof(*writer));
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->cond, NULL);
+#endif
+  writer->file_name=strdup(basename);
+  filenames[0]=writer->file_name;
+  if(writer->file_name==NULL ||
+      libewf_handle_initialize(&writer->handle, NULL) != 1)
+  {
+    log_error("libewf_handle_initialize failed\n");
+    free(writer->file_name);
+    free(writer);
+    return NULL;
+  }
+  if(libewf_handle_open(writer->handle, filenames, 1, LIBEWF_OPEN_WRITE, NULL) != 1 ||
+      libewf_handle_set_format(writer->handle, LIBEWF_FORMAT_ENCASE6, NULL) != 1 ||
+      libewf_handle_set_media_size(writer->handle, media_size, NULL) != 1 ||
+      libewf_handle_set_bytes_per_sector(writer->handle, sector_size, NULL) != 1 ||
+      libewf_handle_set_sectors_per_chunk(writer->handle, sectors_per_chunk, NULL) != 1 ||
+      libewf_handle_set_compression_values(writer->handle, LIBEWF_COMPRESSION_FAST,
+	LIBEWF_COMPRESS_FLAG_USE_EMPTY_BLOCK_COMPRESSION, NULL) != 1)
+  {
+    log_error("Can't create the EWF image %s\n", basename);
+    fewf_writer_free(writer);
+    return NULL;
+  }
+  writer->chunk_size=sector_size * sectors_per_chunk;
+  hash_init(&writer->md5, "md5");
+  hash_init(&writer->sha1, "sha1");
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+  {
+    unsigned int i;
+    for(i=0; i<FEWF_WRITE_SLOTS; i++)
+    {
+      struct fewf_slot *slot=&writer->slots[writer->nbr_slots];
+      slot->data_chunk=NULL;
+      if(libewf_handle_get_data_chunk(writer->handle, &slot->data_chunk, NULL) != 1)
+	break;
+      slot->buffer=(unsigned char *)MALLOC(writer->chunk_size);
+      slot->state=FEWF_SLOT_FREE;
+      writer->nbr_slots++;
+    }
+  }
+#ifdef HAVE_PTHREAD
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+  if(writer->nbr_slots > 1)
+  {
+    const long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned int nbr=(cpus > FEWF_WRITE_THREADS ? FEWF_WRITE_THREADS : (cpus > 1 ? cpus - 1 : 0));
+    while(writer->nbr_threads < nbr &&
+	pthread_create(&writer->threads[writer->nbr_threads], NULL, &fewf_writer_thread, writer)==0)
+      writer->nbr_threads++;
+  }
+#endif
+#endif
+#endif
+  log_info("%s: EWF image, %u bytes per chunk, %u compression threads\n", basename, writer->chunk_size,
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK ) && defined(HAVE_PTHREAD)
+      writer->nbr_threads
+#else
+      0
+#endif
+      );
+  return writer;
+}
+
+int fewf_writer_write(fewf_writer_t *writer, const void *buffer, const unsigned int size)
+{
+  const unsigned char *data=(const unsigned char *)buffer;
+  unsigned int done=0;
+  hash_update(&writer->md5, data, size);
+  hash_update(&writer->sha1, data, size);
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+  if(writer->nbr_slots > 0)
+  {
+    while(done < size && writer->error==0)
+    {
+      struct fewf_slot *slot;
+      unsigned int len;
+      if(writer->current==NULL)
+      {
+	writer->current=fewf_writer_slot(writer);
+	writer->current->size=0;
+      }
+      slot=writer->current;
+      len=writer->chunk_size - slot->size;
+      if(len > size - done)
+	len=size - done;
+      memcpy(slot->buffer + slot->size, data + done, len);
+      slot->size+=len;
+      done+=len;
+      if(slot->size==writer->chunk_size)
+      {
+	writer->current=NULL;
+	fewf_writer_submit(writer, slot);
+      }
+    }
+    return (writer->error==0 ? 0 : -1);
+  }
+#endif
+  if(libewf_handle_write_buffer(writer->handle, data, size, NULL) != (ssize_t)size)
+  {
+    log_error("%s: write error\n", writer->file_name);
+    writer->error=1;
+    return -1;
+  }
+  writer->written+=size;
+  return 0;
+}
+
+int fewf_writer_close(fewf_writer_t *writer)
+{
+  unsigned char md5[MD5_DIGEST_SIZE];
+  unsigned char sha1[20];
+  char hex[2*20+1];
+  unsigned int i;
+  int res=0;
+#if defined( HAVE_LIBEWF_HANDLE_WRITE_DATA_CHUNK )
+  if(writer->current!=NULL && writer->current->size > 0)
+  {
+    struct fewf_slot *slot=writer->current;
+    writer->current=NULL;
+    fewf_writer_submit(writer, slot);
+  }
+  fewf_writer_drain(writer);
+#endif
+  hash_final(&writer->md5, md5);
+  hash_final(&writer->sha1, sha1);
+  if(writer->error!=0 ||
+      libewf_handle_set_md5_hash(writer->handle, md5, sizeof(md5), NULL) != 1 ||
+      libewf_handle_set_sha1_hash(writer->handle, sha1, sizeof(sha1), NULL) != 1 ||
+      libewf_handle_write_finalize(writer->handle, NULL) < 0)
+  {
+    log_error("%s: the EWF image is incomplete\n", writer->file_name);
+    res=-1;
+  }
+  for(i=0; i<sizeof(md5); i++)
+    sprintf(&hex[2*i], "%02x", md5[i]);
+  log_info("%s: %llu bytes, MD5 %s\n", writer->file_name, (long long unsigned)writer->written, hex);
+  for(i=0; i<sizeof(sha1); i++)
+    sprintf(&hex[2*i], "%02x", sha1[i]);
+  log_info("%s: SHA1 %s\n", writer->file_name, hex);
+  fewf_writer_free(writer);
+  return res;
+}
+#else
+fewf_writer_t *fewf_writer_open(const char *basename, const uint64_t media_size, const unsigned int sector_size)
+{
+  log_error("Creating an EWF image needs libewf version 2\n");
+  return NULL;
+}
+
+int fewf_writer_write(fewf_writer_t *writer, const void *buffer, const unsigned int size)
+{
+  return -1;
+}
+
+int fewf_writer_close(fewf_writer_t *writer)
+{
+  return -1;
+}
+#endif
+
 const char*td_ewf_version(void)
 {
 #ifdef LIBEWF_VERSION_STRING
@@ -597,9 +1386,31 @@ const char*td_ewf_version(void)
 #endif
 }
 #else
+#include "types.h"
+#include "common.h"
 #include "ewf.h"
 const char*td_ewf_version(void)
 {
   return "none";
 }
+
+unsigned int fewf_get_chunk_size(const disk_t *disk)
+{
+  return 0;
+}
+
+fewf_writer_t *fewf_writer_open(const char *basename, const uint64_t media_size, const unsigned int sector_size)
+{
+  return NULL;
+}
+
+int fewf_writer_write(fewf_writer_t *writer, const void *buffer, const unsigned int size)
+{
+  return -1;
+}
+
+int fewf_writer_close(fewf_writer_t *writer)
+{
+  return -1;
+}
 #endif /* defined(HAVE_LIBEWF_H) && defined(HAVE_LIBEWF) */
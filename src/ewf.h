@@ -39,6 +39,38 @@ disk_t *fewf_init(const char *device, const int testdisk_mode);
 /*@ assigns \nothing; */
 const char*td_ewf_version(void);
 
+/* Size of the compressed chunks of an EWF image, 0 for any other disk.
+ * Reads aligned on chunks avoid decompressing a chunk twice. */
+/*@
+  @ requires \valid_read(disk);
+  @ assigns \nothing;
+  @*/
+unsigned int fewf_get_chunk_size(const disk_t *disk);
+
+/* Sequential EWF writer, basename.E01 is created. The MD5 and SHA1 of
+ * the data are computed while it is written and stored in the image.
+ * The chunks are compressed by worker threads when libewf gives access
+ * to its data chunks. NULL if libewf isn't available */
+typedef struct fewf_writer fewf_writer_t;
+
+/*@
+  @ requires valid_read_string(basename);
+  @*/
+fewf_writer_t *fewf_writer_open(const char *basename, const uint64_t media_size, const unsigned int sector_size);
+
+/* Append size bytes, return -1 on error */
+/*@
+  @ requires \valid(writer);
+  @ requires \valid_read((const char *)buffer + (0 .. size-1));
+  @*/
+int fewf_writer_write(fewf_writer_t *writer, const void *buffer, const unsigned int size);
+
+/* Finalize the image and free writer, return -1 if it's incomplete */
+/*@
+  @ requires \valid(writer);
+  @*/
+int fewf_writer_close(fewf_writer_t *writer);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -25,9 +25,6 @@
 #endif
 #include <stdio.h>
 #include <ctype.h>
-#ifdef HAVE_ICONV_H
-#include <iconv.h>
-#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -51,16 +48,27 @@
 #include "log.h"
 #include "setdate.h"
 #include "fat.h"
+#include "unicode.h"
 
 #define EXFAT_MKMODE(a,m) ((m & ((a & ATTR_RO) ? LINUX_S_IRUGO|LINUX_S_IXUGO : LINUX_S_IRWXUGO)) | ((a & ATTR_DIR) ? LINUX_S_IFDIR : LINUX_S_IFREG))
 struct exfat_dir_struct
 {
   struct exfat_super_block*boot_sector;
-#ifdef HAVE_ICONV
-  iconv_t cd;
-#endif
+  uint32_t *fat;		/* Copy of the first FAT, see exfat_dir_load_fat() */
+  unsigned int fat_clusters;	/* Number of entries in this copy */
+  int fat_loaded;
+  unsigned char *bitmap;	/* Allocation bitmap, see exfat_dir_load_bitmap() */
+  unsigned int bitmap_clusters;	/* Number of clusters it describes */
+  int bitmap_loaded;
 };
 
+/* Don't keep in memory a FAT larger than this, the entries will be read
+ * from the disk as needed */
+#define EXFAT_DIR_FAT_MAX	(64*1024*1024)
+#define EXFAT_DIR_READ_SIZE	(1024*1024)
+/* NoFatChain flag of the stream extension: the file is contiguous */
+#define EXFAT_FLAG_NOFATCHAIN	0x02
+
 
 static int exfat_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_cluster, file_info_t *dir_list);
 static copy_file_t exfat_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file);
@@ -76,104 +84,17 @@ static inline void exfat16_towchar(wchar_t *dst, const uint8_t *src, size_t len)
 }
 #endif
 
-#ifdef HAVE_ICONV
-static int exfat_ucstoutf8(iconv_t cd, const unsigned char *ins, const unsigned int ins_len, char **outs, const unsigned int outs_len)
-{
-  const char *inp;
-  char *outp;
-  size_t inb_left, outb_left;
-  if (cd == (iconv_t)(-1))
-    return -1;
-
-  outp = *outs;
-  inp = (const char *)ins;
-  inb_left = ins_len;
-  outb_left = outs_len - 1;   // reserve 1 byte for NUL
-
-  if (iconv(cd, (ICONV_CONST char **)&inp, &inb_left, &outp, &outb_left) == (size_t)(-1))
-  {
-    // Regardless of the value of errno
-    log_error("exfat_ucstoutf8: iconv failed %s\n", strerror(errno));
-    return -1;
-  }
-  *outp = '\0';
-  return 0;
-}
-#else
-/*
- *              Convert a UTF-16LE text to UTF-8
- *      Note : wcstombs() not used because on Linux it fails for characters
- *      not present in current locale
- *      Returns size or zero for invalid input
- */
-
-static unsigned int makeutf8(char *utf8, const char *utf16, int length)
-{
-        int i;
-        unsigned int size;
-        unsigned int rem;
-        enum { BASE, SURR, ERR } state;
-
-        size = 0;
-        rem = 0;
-        state = BASE;
-        for (i=0; i<2*length; i+=2) {
-                switch (state) {
-                case BASE :
-                        if (utf16[i+1] & 0xf8) {
-                                if ((utf16[i+1] & 0xf8) == 0xd8) {
-                                        if (utf16[i+1] & 4)
-                                                state = ERR;
-                                        else {
-                                                utf8[size++] = 0xf0 + (utf16[i+1] & 7)
-                                                                    + ((utf16[i] & 0xc0) == 0xc0);
-                                                utf8[size++] = 0x80 + (((utf16[i] + 64) >> 2) & 63);
-                                                rem = utf16[i] & 3;
-                                                state = SURR;
-                                        }
-                                } else {
-                                        utf8[size++] = 0xe0 + ((utf16[i+1] >> 4) & 15);
-                                        utf8[size++] = 0x80
-                                                + ((utf16[i+1] & 15) << 2)
-                                                + ((utf16[i] >> 6) & 3);
-                                        utf8[size++] = 0x80 + (utf16[i] & 63);
-                                }
-                        } else
-                                if ((utf16[i] & 0x80) || utf16[i+1]) {
-                                        utf8[size++] = 0xc0
-                                                + ((utf16[i+1] & 15) << 2)
-                                                + ((utf16[i] >> 6) & 3);
-                                        utf8[size++] = 0x80 + (utf16[i] & 63);
-                                } else
-                                        utf8[size++] = utf16[i];
-                        break;
-                case SURR :
-                        if ((utf16[i+1] & 0xfc) == 0xdc) {
-                                utf8[size++] = 0x80 + (rem << 4)
-                                                 + ((utf16[i+1] & 3) << 2)
-                                                 + ((utf16[i] >> 6) & 3);
-                                utf8[size++] = 0x80 + (utf16[i] & 63);
-                                state = BASE;
-                        } else
-                                state = ERR;
-                        break;
-                case ERR :
-                        break;
-                }
-        }
-        utf8[size] = 0;
-        if (state != BASE)
-                state = ERR;
-        return (state == ERR ? 0 : size);
-}
-#endif
-
 #define ATTR_RO      1  /* read-only */
 #define ATTR_HIDDEN  2  /* hidden */
 #define ATTR_SYS     4  /* system */
 #define ATTR_DIR     16 /* directory */
 #define ATTR_ARCH    32 /* archived */
 
+static int is_EOC(const unsigned int cluster)
+{
+  return(cluster==0xFFFFFFFF);
+}
+
 static unsigned int exfat_get_next_cluster(disk_t *disk_car,const partition_t *partition, const uint64_t offset, const unsigned int cluster)
 {
   unsigned char *buffer=(unsigned char*)MALLOC(disk_car->sector_size);
@@ -197,11 +118,113 @@ static unsigned int exfat_get_next_cluster(disk_t *disk_car,const partition_t *p
   return next_cluster;
 }
 
+static void exfat_dir_load_fat(disk_t *disk, const partition_t *partition, struct exfat_dir_struct *ls)
+{
+  const struct exfat_super_block *exfat_header=ls->boot_sector;
+  const uint64_t fat_size=((uint64_t)le32(exfat_header->total_clusters) + 2) * 4;
+  const uint64_t fat_offset=partition->part_offset + ((uint64_t)le32(exfat_header->fat_blocknr) << exfat_header->blocksize_bits);
+  uint64_t pos;
+  ls->fat_loaded=1;
+  if(fat_size > EXFAT_DIR_FAT_MAX)
+    return ;
+  ls->fat=(uint32_t *)MALLOC(fat_size);
+  /* A few large reads instead of one read per entry */
+  for(pos=0; pos < fat_size; pos+=EXFAT_DIR_READ_SIZE)
+  {
+    const unsigned int toread=(fat_size - pos > EXFAT_DIR_READ_SIZE ? EXFAT_DIR_READ_SIZE : fat_size - pos);
+    if((unsigned)disk->pread(disk, (unsigned char *)ls->fat + pos, toread, fat_offset + pos) != toread)
+    {
+      log_warning("exFAT: Can't read the FAT, reading it by sectors.\n");
+      free(ls->fat);
+      ls->fat=NULL;
+      return ;
+    }
+  }
+  ls->fat_clusters=fat_size / 4;
+}
+
+static unsigned int exfat_dir_next_cluster(disk_t *disk, const partition_t *partition, struct exfat_dir_struct *ls, const unsigned int cluster)
+{
+  if(ls->fat_loaded==0)
+    exfat_dir_load_fat(disk, partition, ls);
+  if(ls->fat==NULL || cluster >= ls->fat_clusters)
+    return exfat_get_next_cluster(disk, partition, (uint64_t)le32(ls->boot_sector->fat_blocknr) << ls->boot_sector->blocksize_bits, cluster);
+  return le32(ls->fat[cluster]);
+}
+
+/* Read the allocation bitmap listed in the first cluster of the root
+ * directory, one bit per cluster, set when the cluster is in use */
+static void exfat_dir_load_bitmap(disk_t *disk, const partition_t *partition, struct exfat_dir_struct *ls)
+{
+  const struct exfat_super_block *exfat_header=ls->boot_sector;
+  const unsigned int cluster_shift=exfat_header->block_per_clus_bits + exfat_header->blocksize_bits;
+  const unsigned int cluster_size=1U << cluster_shift;
+  const unsigned int total_clusters=le32(exfat_header->total_clusters);
+  unsigned char *buffer=(unsigned char *)MALLOC(cluster_size);
+  uint64_t bitmap_size=0;
+  uint64_t pos;
+  unsigned int cluster=0;
+  unsigned int offset;
+  ls->bitmap_loaded=1;
+  if(exfat_read_cluster(disk, partition, exfat_header, buffer, le32(exfat_header->rootdir_clusnr)) != (int)cluster_size)
+  {
+    free(buffer);
+    return ;
+  }
+  for(offset=0; offset<cluster_size && buffer[offset]!=0; offset+=0x20)
+  {
+    const struct exfat_alloc_bitmap_entry *entry=(const struct exfat_alloc_bitmap_entry *)&buffer[offset];
+    /* The second bitmap is only used by TexFAT */
+    if(entry->type==0x81 && (entry->bitmap_flags & 1)==0)
+    {
+      cluster=le32(entry->first_cluster);
+      bitmap_size=le64(entry->data_length);
+      break;
+    }
+  }
+  if(bitmap_size > ((uint64_t)total_clusters + 7) / 8)
+    bitmap_size=((uint64_t)total_clusters + 7) / 8;
+  if(cluster < 2 || bitmap_size==0 || bitmap_size > EXFAT_DIR_FAT_MAX)
+  {
+    free(buffer);
+    return ;
+  }
+  ls->bitmap=(unsigned char *)MALLOC(bitmap_size);
+  for(pos=0; pos < bitmap_size; pos+=cluster_size)
+  {
+    const unsigned int toread=(bitmap_size - pos > cluster_size ? cluster_size : bitmap_size - pos);
+    unsigned int next_cluster;
+    if(cluster < 2 || cluster > total_clusters + 1 ||
+	exfat_read_cluster(disk, partition, exfat_header, buffer, cluster) != (int)cluster_size)
+    {
+      log_warning("exFAT: Can't read the allocation bitmap.\n");
+      free(ls->bitmap);
+      ls->bitmap=NULL;
+      free(buffer);
+      return ;
+    }
+    memcpy(ls->bitmap + pos, buffer, toread);
+    next_cluster=exfat_dir_next_cluster(disk, partition, ls, cluster);
+    cluster=(next_cluster>=2 && !is_EOC(next_cluster) ? next_cluster : cluster + 1);
+  }
+  ls->bitmap_clusters=(bitmap_size * 8 < total_clusters ? bitmap_size * 8 : total_clusters);
+  free(buffer);
+}
+
+/* Return 1 if the cluster is free, according to the allocation bitmap or
+ * else to the FAT */
+static int exfat_dir_cluster_free(disk_t *disk, const partition_t *partition, struct exfat_dir_struct *ls, const unsigned int cluster)
+{
+  if(ls->bitmap_loaded==0)
+    exfat_dir_load_bitmap(disk, partition, ls);
+  if(ls->bitmap!=NULL && cluster >= 2 && cluster - 2 < ls->bitmap_clusters)
+    return ((ls->bitmap[(cluster - 2) / 8] >> ((cluster - 2) % 8)) & 1)==0;
+  /* A contiguous file has no FAT chain: this test is only a guess */
+  return exfat_dir_next_cluster(disk, partition, ls, cluster)==0;
+}
+
 static int dir_exfat_aux(const unsigned char*buffer, const unsigned int size, const dir_data_t *dir_data, file_info_t *dir_list)
 {
-#ifdef HAVE_ICONV
-  const struct exfat_dir_struct *ls=(const struct exfat_dir_struct*)dir_data->private_dir_data;
-#endif
   /*
    * 0x83 Volume label
    * 0x81 Allocation bitmap
@@ -215,6 +238,8 @@ static int dir_exfat_aux(const unsigned char*buffer, const unsigned int size, co
    *
    */
   file_info_t *current_file=NULL;
+  /* Name of current_file, built from its file name extensions */
+  char name[512];
   unsigned int offset=0;
   unsigned int sec_count=0;
   for(offset=0; offset<size; offset+=0x20)
@@ -225,10 +250,12 @@ static int dir_exfat_aux(const unsigned char*buffer, const unsigned int size, co
     if((buffer[offset]&0x7f)==0x05)
     { /* File directory entry */
       const struct exfat_file_entry *entry=(const struct exfat_file_entry *)&buffer[offset];
-      file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
+      file_info_t *new_file;
+      if(current_file!=NULL)
+	current_file->name=file_info_strdup(dir_list, name);
+      new_file=file_info_new(dir_list, NULL);
       sec_count=entry->sec_count;
-      new_file->name=(char *)MALLOC(512);
-      new_file->name[0]=0;
+      name[0]='\0';
       new_file->st_ino=0;
       new_file->st_mode = EXFAT_MKMODE(entry->attr,(LINUX_S_IRWXUGO & ~(LINUX_S_IWGRP|LINUX_S_IWOTH)));
       new_file->st_uid=0;
@@ -249,6 +276,8 @@ static int dir_exfat_aux(const unsigned char*buffer, const unsigned int size, co
 	const struct exfat_stream_ext_entry *entry=(const struct exfat_stream_ext_entry*)&buffer[offset];
 	current_file->st_size=le64(entry->data_length);
 	current_file->st_ino=le32(entry->first_cluster);
+	if((entry->sec_flags & EXFAT_FLAG_NOFATCHAIN)!=0)
+	  current_file->status|=FILE_STATUS_CONTIGUOUS;
 #if 0
 	if((entry->first_cluster&2)!=0)
 	  current_file->st_size=0;
@@ -260,41 +289,34 @@ static int dir_exfat_aux(const unsigned char*buffer, const unsigned int size, co
 	unsigned int i;
 	unsigned int j;
 	for(j=0;
-	    j<255 && current_file->name[j]!='\0';
+	    j<255 && name[j]!='\0';
 	    j++);
 	for(i=2;
 	    i<32 && (buffer[offset+i]!=0 || buffer[offset+i+1]!=0);
 	    i+=2);
 	i-=2;
-	outs=&current_file->name[j];
-#ifdef HAVE_ICONV
-	if(exfat_ucstoutf8(ls->cd, &buffer[offset+2], i, &outs, 512-j) < 0)
+	outs=&name[j];
+	if(UTF16le2utf8(outs, 512-j, &buffer[offset+2], i/2) < 0)
 	{
 	  for(i=2; i<32; i+=2)
-	    current_file->name[j++]=buffer[offset+i];
-	  current_file->name[j]='\0';
+	    name[j++]=buffer[offset+i];
+	  name[j]='\0';
 	}
-#else
-	makeutf8(outs, &buffer[offset+2], i);
-#endif
       }
       sec_count--;
     }
   }
+  if(current_file!=NULL)
+    current_file->name=file_info_strdup(dir_list, name);
   return 0;
 }
 
 typedef enum {exFAT_FOLLOW_CLUSTER, exFAT_NEXT_FREE_CLUSTER, exFAT_NEXT_CLUSTER} exfat_method_t;
 
-static int is_EOC(const unsigned int cluster)
-{
-  return(cluster==0xFFFFFFFF);
-}
-
 #define NBR_CLUSTER_MAX 30
 static int exfat_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_cluster, file_info_t *dir_list)
 {
-  const struct exfat_dir_struct *ls=(const struct exfat_dir_struct*)dir_data->private_dir_data;
+  struct exfat_dir_struct *ls=(struct exfat_dir_struct*)dir_data->private_dir_data;
   const struct exfat_super_block*exfat_header=ls->boot_sector;
   const unsigned int cluster_shift=exfat_header->block_per_clus_bits + exfat_header->blocksize_bits;
   unsigned int cluster;
@@ -303,7 +325,6 @@ static int exfat_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir
   const unsigned int total_clusters=le32(exfat_header->total_clusters);
   exfat_method_t exfat_meth=exFAT_FOLLOW_CLUSTER;
   int stop=0;
-  const uint64_t start_exfat1=(uint64_t)le32(exfat_header->fat_blocknr) << exfat_header->blocksize_bits;
   if(first_cluster<2)
     cluster=le32(exfat_header->rootdir_clusnr);
   else
@@ -321,7 +342,7 @@ static int exfat_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir
     {
       if(exfat_meth==exFAT_FOLLOW_CLUSTER)
       {
-	const unsigned int next_cluster=exfat_get_next_cluster(disk, partition, start_exfat1, cluster);
+	const unsigned int next_cluster=exfat_dir_next_cluster(disk, partition, ls, cluster);
 	if((next_cluster>=2 && next_cluster<=total_clusters) ||
 	    is_EOC(next_cluster))
 	  cluster=next_cluster;
@@ -346,7 +367,7 @@ static int exfat_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir
       {	/* Deleted directories are composed of "free" clusters */
 #if 0
 	while(++cluster<total_clusters &&
-	    exfat_get_next_cluster(disk, partition, start_exfat1, cluster)!=0);
+	    exfat_dir_next_cluster(disk, partition, ls, cluster)!=0);
 #endif
       }
       nbr_cluster++;
@@ -380,12 +401,12 @@ dir_partition_t dir_partition_exfat_init(disk_t *disk, const partition_t *partit
   }
   ls=(struct exfat_dir_struct *)MALLOC(sizeof(*ls));
   ls->boot_sector=exfat_header;
-#ifdef HAVE_ICONV
-  if ((ls->cd = iconv_open("UTF-8", "UTF-16LE")) == (iconv_t)(-1))
-  {
-    log_error("dir_partition_exfat_init: iconv_open failed\n");
-  }
-#endif
+  ls->fat=NULL;
+  ls->fat_clusters=0;
+  ls->fat_loaded=0;
+  ls->bitmap=NULL;
+  ls->bitmap_clusters=0;
+  ls->bitmap_loaded=0;
 #ifdef DEBUG_EXFAT
   log_info("start_sector=%llu\n", (long long unsigned)le64(exfat_header->start_sector));
   log_info("nr_sectors  =%llu\n", (long long unsigned)le64(exfat_header->nr_sectors));
@@ -419,10 +440,8 @@ static void dir_partition_exfat_close(dir_data_t *dir_data)
 {
   struct exfat_dir_struct *ls=(struct exfat_dir_struct*)dir_data->private_dir_data;
   free(ls->boot_sector);
-#ifdef HAVE_ICONV
-  if (ls->cd != (iconv_t)(-1))
-    iconv_close(ls->cd);
-#endif
+  free(ls->fat);
+  free(ls->bitmap);
   free(ls);
 }
 
@@ -430,14 +449,15 @@ static copy_file_t exfat_copy(disk_t *disk, const partition_t *partition, dir_da
 {
   char *new_file;	
   FILE *f_out;
-  const struct exfat_dir_struct *ls=(const struct exfat_dir_struct*)dir_data->private_dir_data;
+  struct exfat_dir_struct *ls=(struct exfat_dir_struct*)dir_data->private_dir_data;
   const struct exfat_super_block *exfat_header=ls->boot_sector;
   const unsigned int cluster_shift=exfat_header->block_per_clus_bits + exfat_header->blocksize_bits;
-  unsigned char *buffer_file=(unsigned char *)MALLOC(1<<cluster_shift);
+  /* Contiguous clusters are read together, up to EXFAT_DIR_READ_SIZE */
+  const unsigned int run_max=((1U<<cluster_shift) < EXFAT_DIR_READ_SIZE ? EXFAT_DIR_READ_SIZE >> cluster_shift : 1);
+  unsigned char *buffer_file=(unsigned char *)MALLOC((size_t)run_max << cluster_shift);
   unsigned int cluster;
   uint64_t file_size=file->st_size;
   exfat_method_t exfat_meth=exFAT_FOLLOW_CLUSTER;
-  uint64_t start_exfat1;
   unsigned long int clus_blocknr;
   unsigned long int total_clusters;
   f_out=fopen_local(&new_file, dir_data->local_dir, dir_data->current_directory);
@@ -449,23 +469,62 @@ static copy_file_t exfat_copy(disk_t *disk, const partition_t *partition, dir_da
     return CP_CREATE_FAILED;
   }
   cluster = file->st_ino;
-  start_exfat1=(uint64_t)le32(exfat_header->fat_blocknr) << exfat_header->blocksize_bits;
   clus_blocknr=le32(exfat_header->clus_blocknr);
   total_clusters=le32(exfat_header->total_clusters);
   log_trace("exfat_copy dst=%s first_cluster=%u (%llu) size=%lu\n", new_file,
       cluster,
       (long long unsigned)(((cluster-2) << exfat_header->block_per_clus_bits) + clus_blocknr),
       (long unsigned)file_size);
+  if((file->status&FILE_STATUS_CONTIGUOUS)!=0)
+  {
+    /* No FAT chain, the clusters follow the first one */
+    exfat_meth=exFAT_NEXT_CLUSTER;
+    if((file->status&FILE_STATUS_DELETED)!=0)
+    {
+      /* The data of a deleted file is intact while its clusters are free */
+      const uint64_t clusters=(file_size + (1U << cluster_shift) - 1) >> cluster_shift;
+      uint64_t i;
+      unsigned int used=0;
+      for(i=0; i<clusters && cluster+i<=total_clusters; i++)
+	if(exfat_dir_cluster_free(disk, partition, ls, cluster+i)==0)
+	  used++;
+      if(used>0)
+	log_warning("exfat_copy: %u clusters of %s are used by another file\n", used, new_file);
+    }
+  }
 
   while(cluster>=2 && cluster<=total_clusters && file_size>0)
   {
-    unsigned int toread = 1 << cluster_shift;
-    if (toread > file_size)
-      toread = file_size;
-    if((unsigned)exfat_read_cluster(disk, partition, exfat_header, buffer_file, cluster) < toread)
+    unsigned int nbr_cluster=1;
+    unsigned int next_cluster=0;
+    unsigned int toread;
+    if(exfat_meth==exFAT_FOLLOW_CLUSTER)
+    {
+      next_cluster=exfat_dir_next_cluster(disk, partition, ls, cluster);
+      while(next_cluster==cluster+nbr_cluster && next_cluster<=total_clusters &&
+	  nbr_cluster<run_max && ((uint64_t)nbr_cluster << cluster_shift) < file_size)
+      {
+	nbr_cluster++;
+	next_cluster=exfat_dir_next_cluster(disk, partition, ls, cluster+nbr_cluster-1);
+      }
+    }
+    else
+    {
+      /* The next clusters, only the free ones for a deleted file */
+      while(nbr_cluster<run_max && ((uint64_t)nbr_cluster << cluster_shift) < file_size &&
+	  cluster+nbr_cluster<=total_clusters &&
+	  (exfat_meth==exFAT_NEXT_CLUSTER ||
+	   exfat_dir_cluster_free(disk, partition, ls, cluster+nbr_cluster)!=0))
+	nbr_cluster++;
+    }
+    toread = (((uint64_t)nbr_cluster << cluster_shift) > file_size ? file_size : nbr_cluster << cluster_shift);
+    if((unsigned)disk->pread(disk, buffer_file, toread,
+	  partition->part_offset + exfat_cluster_to_offset(exfat_header, cluster)) != toread)
     {
       log_error("exfat_copy: Can't read cluster %u.\n", cluster);
     }
+    /* Last cluster read */
+    cluster+=nbr_cluster-1;
     if(fwrite(buffer_file, 1, toread, f_out) != toread)
     {
       log_error("exfat_copy: no space left on destination.\n");
@@ -480,7 +539,6 @@ static copy_file_t exfat_copy(disk_t *disk, const partition_t *partition, dir_da
     {
       if(exfat_meth==exFAT_FOLLOW_CLUSTER)
       {
-	const unsigned int next_cluster=exfat_get_next_cluster(disk, partition, start_exfat1, cluster);
 	if(next_cluster>=2 && next_cluster<=total_clusters)
 	  cluster=next_cluster;
 	else if(cluster==file->st_ino && next_cluster==0)
@@ -493,7 +551,7 @@ static copy_file_t exfat_copy(disk_t *disk, const partition_t *partition, dir_da
       else if(exfat_meth==exFAT_NEXT_FREE_CLUSTER)
       {	/* Deleted file are composed of "free" clusters */
 	while(++cluster<total_clusters &&
-	    exfat_get_next_cluster(disk, partition, start_exfat1, cluster)!=0);
+	    exfat_dir_cluster_free(disk, partition, ls, cluster)==0);
       }
     }
   }
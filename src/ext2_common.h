@@ -70,6 +70,7 @@ extern "C" {
 #define EXT2_FEATURE_COMPAT_RESIZE_INO		0x0010
 #define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 #define EXT2_FEATURE_COMPAT_LAZY_BG		0x0040
+#define EXT4_FEATURE_COMPAT_SPARSE_SUPER2	0x0200
 #define EXT2_FEATURE_COMPAT_ANY			0xffffffff
 
 
@@ -200,7 +201,8 @@ struct ext2_super_block {
 	uint32_t	s_usr_quota_inum;	/* inode number of user quota file */
 	uint32_t	s_grp_quota_inum;	/* inode number of group quota file */
 	uint32_t	s_overhead_blocks;	/* overhead blocks/clusters in fs */
-	uint32_t   	s_reserved[108];        /* Padding to the end of the block */
+	uint32_t	s_backup_bgs[2];	/* groups with sparse_super2 SBs */
+	uint32_t   	s_reserved[106];        /* Padding to the end of the block */
 	uint32_t	s_checksum;		/* crc32c(superblock) */
 };
 
@@ -52,6 +52,8 @@
 #include "ext2_inc.h"
 #include "log.h"
 #include "setdate.h"
+#include "fextent.h"
+#include "hdcache.h"
 
 #if defined(HAVE_LIBEXT2FS)
 #define DIRENT_DELETED_FILE	4
@@ -72,6 +74,9 @@ static errcode_t my_write_blk(io_channel channel, unsigned long block, int count
 static errcode_t my_flush(io_channel channel);
 static errcode_t my_read_blk64(io_channel channel, unsigned long long block, int count, void *buf);
 static errcode_t my_write_blk64(io_channel channel, unsigned long long block, int count, const void *buf);
+#ifdef HAVE_STRUCT_STRUCT_IO_MANAGER_CACHE_READAHEAD
+static errcode_t my_cache_readahead(io_channel channel, unsigned long long block, unsigned long long count);
+#endif
 
 static void dir_partition_ext2_close(dir_data_t *dir_data);
 static copy_file_t ext2_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file);
@@ -95,9 +100,14 @@ static struct struct_io_manager my_struct_manager = {
 #ifdef HAVE_STRUCT_STRUCT_IO_MANAGER_WRITE_BLK64
 	.write_blk64=&my_write_blk64,
 #endif
+#ifdef HAVE_STRUCT_STRUCT_IO_MANAGER_CACHE_READAHEAD
+	.cache_readahead=&my_cache_readahead,
+#endif
 };
 
 static io_channel shared_ioch=NULL;
+/* The bitmaps, inode tables and directories are read block by block */
+static diskcache_readahead_t shared_readahead;
 /*
  * Macro taken from unix_io.c
  * For checking structure magic numbers...
@@ -130,6 +140,7 @@ static io_channel alloc_io_channel(const disk_t *disk_car,my_data_t *my_data)
   ioch->block_size = 1024; /* The smallest ext2fs block size */
   ioch->read_error = 0;
   ioch->write_error = 0;
+  diskcache_readahead_init(&shared_readahead);
 #ifdef DEBUG_EXT2
   log_info("alloc_io_channel end\n");
 #endif
@@ -177,6 +188,7 @@ static errcode_t my_read_blk64(io_channel channel, unsigned long long block, int
       (long unsigned)size, (unsigned long)(block*channel->block_size),
       my_data->partition->fsname, block, count, buf);
 #endif
+  diskcache_readahead(my_data->disk_car, &shared_readahead, my_data->partition->part_offset + (uint64_t)block * channel->block_size, size);
   if(my_data->disk_car->pread(my_data->disk_car, buf, size, my_data->partition->part_offset + (uint64_t)block * channel->block_size) != size)
     return 1;
 #ifdef DEBUG_EXT2
@@ -195,7 +207,8 @@ static errcode_t my_write_blk64(io_channel channel, unsigned long long block, in
   EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
 #if 1
   {
-    const my_data_t *my_data=(const my_data_t*)channel;
+    const my_data_t *my_data=(const my_data_t*)channel->private_data;
+    diskcache_readahead_init(&shared_readahead);
     if(my_data->disk_car->pwrite(my_data->disk_car, buf, count * channel->block_size, my_data->partition->part_offset + (uint64_t)block * channel->block_size) != count * channel->block_size)
       return 1;
     return 0;
@@ -212,8 +225,28 @@ static errcode_t my_write_blk(io_channel channel, unsigned long block, int count
 
 static errcode_t my_flush(io_channel channel)
 {
+  const my_data_t *my_data=(const my_data_t*)channel->private_data;
+  EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+  diskcache_readahead_init(&shared_readahead);
+  if(my_data->disk_car->write_used==0)
+    return 0;
+  if(my_data->disk_car->sync(my_data->disk_car)<0)
+    return errno;
+  return 0;
+}
+
+#ifdef HAVE_STRUCT_STRUCT_IO_MANAGER_CACHE_READAHEAD
+/* Hint from libext2fs: it will read these blocks soon */
+static errcode_t my_cache_readahead(io_channel channel, unsigned long long block, unsigned long long count)
+{
+  const my_data_t *my_data=(const my_data_t*)channel->private_data;
+  const uint64_t size=(uint64_t)count * channel->block_size;
+  EXT2_CHECK_MAGIC(channel, EXT2_ET_MAGIC_IO_CHANNEL);
+  diskcache_prefetch(my_data->disk_car, my_data->partition->part_offset + (uint64_t)block * channel->block_size,
+      (size < 0x7fffffff ? size : 0x7fffffff));
   return 0;
 }
+#endif
 
 static int list_dir_proc2(ext2_ino_t dir,
 			 int    entry,
@@ -240,13 +273,13 @@ static int list_dir_proc2(ext2_ino_t dir,
   }
   if(inode.i_mode==0)
     return 0;
-  new_file=(file_info_t *)MALLOC(sizeof(*new_file));
   {
     const unsigned int thislen = ((dirent->name_len & 0xFF) < EXT2_NAME_LEN) ?
       (dirent->name_len & 0xFF) : EXT2_NAME_LEN;
-    new_file->name=(char *)MALLOC(thislen+1);
-    memcpy(new_file->name, dirent->name, thislen);
-    new_file->name[thislen] = '\0';
+    char name[EXT2_NAME_LEN+1];
+    memcpy(name, dirent->name, thislen);
+    name[thislen] = '\0';
+    new_file=file_info_new(ls->dir_list, name);
   }
   if(entry==DIRENT_DELETED_FILE)
     new_file->status=FILE_STATUS_DELETED;
@@ -289,6 +322,62 @@ static void dir_partition_ext2_close(dir_data_t *dir_data)
   free(ls);
 }
 
+/* Resolve where the data of a regular file is on the disk,
+ * return 0 on success */
+static int ext2_get_extents(ext2_filsys fs, const ext2_ino_t ino, struct ext2_inode *inode, const partition_t *partition, fextent_list_t *list)
+{
+  const uint64_t block_size=fs->blocksize;
+  if(!LINUX_S_ISREG(inode->i_mode))
+    return -1;
+#ifdef EXT4_INLINE_DATA_FL
+  if((inode->i_flags & EXT4_INLINE_DATA_FL)!=0)
+    return -1;
+#endif
+  if((inode->i_flags & EXT4_EXTENTS_FL)!=0)
+  {
+    ext2_extent_handle_t handle;
+    struct ext2fs_extent extent;
+    errcode_t retval;
+    if(ext2fs_extent_open2(fs, ino, inode, &handle)!=0)
+      return -1;
+    retval=ext2fs_extent_get(handle, EXT2_EXTENT_ROOT, &extent);
+    while(retval==0)
+    {
+      /* An uninitialized extent reads as zeroes */
+      if((extent.e_flags & EXT2_EXTENT_FLAGS_LEAF)!=0 &&
+	  (extent.e_flags & EXT2_EXTENT_FLAGS_UNINIT)==0)
+	fextent_add(list, (uint64_t)extent.e_lblk * block_size,
+	    partition->part_offset + (uint64_t)extent.e_pblk * block_size,
+	    (uint64_t)extent.e_len * block_size);
+      retval=ext2fs_extent_get(handle, EXT2_EXTENT_NEXT_LEAF, &extent);
+    }
+    ext2fs_extent_free(handle);
+    if(retval!=EXT2_ET_EXTENT_NO_NEXT)
+    {
+      fextent_free(list);
+      return -1;
+    }
+    return 0;
+  }
+  {
+    const blk64_t nbr=(EXT2_I_SIZE(inode) + block_size - 1) / block_size;
+    blk64_t lblk;
+    for(lblk=0; lblk<nbr; lblk++)
+    {
+      blk64_t pblk=0;
+      if(ext2fs_bmap2(fs, ino, inode, NULL, 0, lblk, NULL, &pblk)!=0)
+      {
+	fextent_free(list);
+	return -1;
+      }
+      if(pblk!=0)
+	fextent_add(list, (uint64_t)lblk * block_size,
+	    partition->part_offset + (uint64_t)pblk * block_size, block_size);
+    }
+  }
+  return 0;
+}
+
 static copy_file_t ext2_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file)
 {
   copy_file_t error=CP_OK;
@@ -307,6 +396,7 @@ static copy_file_t ext2_copy(disk_t *disk_car, const partition_t *partition, dir
     struct ext2_inode       inode;
     char            buffer[8192];
     ext2_file_t     e2_file;
+    fextent_list_t  extents;
 
     if (ext2fs_read_inode(ls->current_fs, file->st_ino, &inode)!=0)
     {
@@ -314,6 +404,28 @@ static copy_file_t ext2_copy(disk_t *disk_car, const partition_t *partition, dir
       fclose(f_out);
       return CP_STAT_FAILED;
     }
+    fextent_init(&extents);
+    if(ext2_get_extents(ls->current_fs, file->st_ino, &inode, partition, &extents)==0)
+    {
+      /* Read the blocks straight from the disk */
+      const int copy=fextent_copy(disk_car, &extents, EXT2_I_SIZE(&inode), f_out);
+      fextent_free(&extents);
+      if(copy == -1)
+      {
+	log_error("Error while reading ext2 file %s\n", dir_data->current_directory);
+	error = CP_READ_FAILED;
+      }
+      else if(copy < 0)
+      {
+	log_error("Error while writing file %s\n", new_file);
+	error = CP_NOSPACE;
+      }
+      fclose(f_out);
+      set_date(new_file, file->td_atime, file->td_mtime);
+      (void)set_mode(new_file, file->st_mode);
+      free(new_file);
+      return error;
+    }
 
     retval = ext2fs_file_open(ls->current_fs, file->st_ino, 0, &e2_file);
     if (retval) {
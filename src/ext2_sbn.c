@@ -37,6 +37,8 @@
 #include "ext2.h"
 #include "ext2_sbn.h"
 
+#define EXT2_SB_MAX_LOCATIONS	1024
+
 // blocksize=1024, 2048, 4096, 65536
 // blocks per blocksgroup=8*blocksize
 static const  uint64_t group_size[4]={
@@ -75,10 +77,81 @@ static uint64_t next_sb(const uint64_t hd_offset_old)
   return hd_offset;
 }
 
+static int ext2_sb_location_cmp(const void *a, const void *b)
+{
+  const uint64_t x=*(const uint64_t *)a;
+  const uint64_t y=*(const uint64_t *)b;
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static unsigned int ext2_sb_add_group(uint64_t *locations, unsigned int nbr, const struct ext2_super_block *sb, const uint64_t group)
+{
+  const unsigned int blocksize=EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size);
+  if(nbr < EXT2_SB_MAX_LOCATIONS)
+    locations[nbr++]=(group * le32(sb->s_blocks_per_group) + le32(sb->s_first_data_block)) * blocksize;
+  return nbr;
+}
+
+/* Once a superblock is known, the groups holding a backup are given by
+ * its geometry and features: every group, group 1 and the powers of 3, 5
+ * and 7 with sparse_super or the two groups listed with sparse_super2.
+ * Return the number of sorted offsets from the beginning of the
+ * filesystem, group 0 excluded */
+static unsigned int ext2_sb_predict(const struct ext2_super_block *sb, uint64_t *locations)
+{
+  const uint64_t blocks_per_group=le32(sb->s_blocks_per_group);
+  uint64_t groups;
+  unsigned int nbr=0;
+  if(blocks_per_group==0 || le32(sb->s_log_block_size) > 6)
+    return 0;
+  groups=(td_ext2fs_blocks_count(sb) - le32(sb->s_first_data_block) + blocks_per_group - 1) / blocks_per_group;
+  if(EXT2_HAS_COMPAT_FEATURE(sb, EXT4_FEATURE_COMPAT_SPARSE_SUPER2))
+  {
+    unsigned int i;
+    for(i=0; i<2; i++)
+      if(le32(sb->s_backup_bgs[i]) > 0 && le32(sb->s_backup_bgs[i]) < groups)
+	nbr=ext2_sb_add_group(locations, nbr, sb, le32(sb->s_backup_bgs[i]));
+  }
+  else if(EXT2_HAS_RO_COMPAT_FEATURE(sb, EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER))
+  {
+    unsigned int i;
+    if(groups > 1)
+      nbr=ext2_sb_add_group(locations, nbr, sb, 1);
+    for(i=0; i<3; i++)
+    {
+      uint64_t group;
+      for(group=factors[i]; group < groups; group*=factors[i])
+	nbr=ext2_sb_add_group(locations, nbr, sb, group);
+    }
+  }
+  else
+  {
+    uint64_t group;
+    for(group=1; group < groups; group++)
+      nbr=ext2_sb_add_group(locations, nbr, sb, group);
+  }
+  qsort(locations, nbr, sizeof(uint64_t), ext2_sb_location_cmp);
+  return nbr;
+}
+
+/* Next location to test: the predicted ones once a superblock is known */
+static uint64_t ext2_sb_next(const uint64_t hd_offset_old, const uint64_t *locations, const unsigned int nbr, const uint64_t part_size)
+{
+  unsigned int i;
+  if(nbr==0)
+    return next_sb(hd_offset_old);
+  for(i=0; i<nbr; i++)
+    if(locations[i] > hd_offset_old)
+      return locations[i];
+  return part_size;
+}
+
 list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const int verbose, const int dump_ind)
 {
   unsigned char *buffer=(unsigned char *)MALLOC(2*0x200);
+  uint64_t *locations=(uint64_t *)MALLOC(EXT2_SB_MAX_LOCATIONS*sizeof(uint64_t));
   uint64_t hd_offset;
+  unsigned int nbr_locations=0;
   int nbr_sb=0;
   list_part_t *list_part=NULL;
   int ind_stop=0;
@@ -100,9 +173,11 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
   waddstr(stdscr,"  Stop  ");
   wattroff(stdscr, A_REVERSE);
 #endif
+  /* Without a superblock, test the locations of all the block sizes
+   * until one is found, then only the backups it predicts */
   for(hd_offset=0;
-      hd_offset<partition->part_size && nbr_sb<10 && ind_stop==0;
-      hd_offset=next_sb(hd_offset))
+      hd_offset<partition->part_size && (nbr_sb<10 || nbr_locations>0) && ind_stop==0;
+      hd_offset=ext2_sb_next(hd_offset, locations, nbr_locations, partition->part_size))
   {
 #ifdef HAVE_NCURSES
     const unsigned long int percent=hd_offset*100/partition->part_size;
@@ -138,16 +213,32 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
 	    partition->sb_size     =new_partition->sb_size;
 	    partition->blocksize   =new_partition->blocksize;
 	  }
+	  if(nbr_locations==0)
+	  {
+	    const uint64_t fs_offset=(le16(sb->s_block_group_nr)==0 ? 0 :
+		hd_offset - ((uint64_t)le16(sb->s_block_group_nr) * le32(sb->s_blocks_per_group) +
+		  le32(sb->s_first_data_block)) * (EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size)));
+	    /* Only keep the predictions for the filesystem of this backup */
+	    if(fs_offset==0)
+	    {
+	      nbr_locations=ext2_sb_predict(sb, locations);
+	      if(nbr_locations>0)
+		log_info("%u ext2 superblock backups expected\n", nbr_locations);
+	    }
+	  }
 	  log_info("Ext2 superblock found at sector %llu (block=%llu, blocksize=%u)\n",
 	      (long long unsigned) hd_offset/DEFAULT_SECTOR_SIZE,
 	      (long long unsigned) hd_offset>>(EXT2_MIN_BLOCK_LOG_SIZE+le32(sb->s_log_block_size)),
 	      (unsigned int)EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size));
 #ifdef HAVE_NCURSES
-	  wmove(stdscr,10+nbr_sb,0);
-	  wprintw(stdscr,"Ext2 superblock found at sector %llu (block=%llu, blocksize=%u)        \n",
+	  if(nbr_sb<10)
+	  {
+	    wmove(stdscr,10+nbr_sb,0);
+	    wprintw(stdscr,"Ext2 superblock found at sector %llu (block=%llu, blocksize=%u)        \n",
 	      (long long unsigned) hd_offset/DEFAULT_SECTOR_SIZE,
 	      (long long unsigned) hd_offset>>(EXT2_MIN_BLOCK_LOG_SIZE+le32(sb->s_log_block_size)),
 	      EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size));
+	  }
 #endif
 	  list_part=insert_new_partition(list_part, new_partition, 1, &insert_error);
 	  new_partition=partition_new(disk_car->arch);
@@ -157,6 +248,7 @@ list_part_t *search_superblock(disk_t *disk_car, partition_t *partition, const i
     }
   }
   free(new_partition);
+  free(locations);
   free(buffer);
   return list_part;
 }
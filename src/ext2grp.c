@@ -26,12 +26,16 @@
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "list.h"
 #include "filegen.h"
 #include "dir.h"
 #include "ext2grp.h"
+#include "hdaccess.h"
 #include "ext2_common.h"
 #include "log.h"
 #include "photorec.h"
@@ -110,3 +114,296 @@ unsigned int ext2_fix_inode(alloc_data_t *list_search_space, disk_t *disk, const
   free(buffer);
   return blocksize;
 }
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Inode fields, see struct ext2_inode in e2fsprogs */
+#define EXT2_I_MODE		0x00
+#define EXT2_I_SIZE		0x04
+#define EXT2_I_DTIME		0x14
+#define EXT2_I_LINKS_COUNT	0x1a
+#define EXT2_I_FLAGS		0x20
+#define EXT2_I_BLOCK		0x28
+#define EXT2_I_SIZE_HIGH	0x6c
+#define EXT2_GOOD_OLD_INODE_SIZE	128
+#define EXT4_EXTENTS_FL		0x00080000
+#define EXT4_EXT_MAGIC		0xf30a
+#define EXT2_BG_INODE_UNINIT	0x0001
+#define EXT2_S_IFMT		0xf000
+#define EXT2_S_IFREG		0x8000
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM	0x0400
+#define EXT2_SWEEP_MAX_DEPTH	5
+
+struct ext2_sweep
+{
+  disk_t *disk;
+  const partition_t *partition;
+  unsigned int blocksize;
+  uint64_t blocks_count;
+  uint64_t blocks_max;		/* for the current inode, from its size */
+  uint64_t blocks_nbr;
+  uint64_t *extents;		/* start block, length pairs */
+  unsigned int extents_nbr;
+  unsigned int extents_allocated;
+};
+
+static void ext2_sweep_add(struct ext2_sweep *sweep, const uint64_t start, uint64_t len)
+{
+  if(start==0 || start >= sweep->blocks_count || len==0 ||
+      sweep->blocks_nbr >= sweep->blocks_max)
+    return ;
+  if(start + len > sweep->blocks_count)
+    len=sweep->blocks_count - start;
+  if(sweep->blocks_nbr + len > sweep->blocks_max)
+    len=sweep->blocks_max - sweep->blocks_nbr;
+  sweep->blocks_nbr+=len;
+  if(sweep->extents_nbr > 0 &&
+      sweep->extents[2*sweep->extents_nbr-2] + sweep->extents[2*sweep->extents_nbr-1]==start)
+  {
+    sweep->extents[2*sweep->extents_nbr-1]+=len;
+    return ;
+  }
+  if(sweep->extents_nbr==sweep->extents_allocated)
+  {
+    sweep->extents_allocated=(sweep->extents_allocated < 1024 ? 1024 : 2 * sweep->extents_allocated);
+    sweep->extents=(uint64_t *)realloc(sweep->extents, 2 * sweep->extents_allocated * sizeof(uint64_t));
+    if(sweep->extents==NULL)
+    {
+      log_critical("ext2_sweep_add: not enough memory\n");
+      exit(1);
+    }
+  }
+  sweep->extents[2*sweep->extents_nbr]=start;
+  sweep->extents[2*sweep->extents_nbr+1]=len;
+  sweep->extents_nbr++;
+}
+
+/* Block pointers of an ext2/ext3 indirect block, level 0 means a data block */
+static void ext2_sweep_indirect(struct ext2_sweep *sweep, const uint32_t block, const unsigned int level)
+{
+  unsigned char *buffer;
+  unsigned int i;
+  if(level==0)
+  {
+    ext2_sweep_add(sweep, block, 1);
+    return ;
+  }
+  if(block==0 || block >= sweep->blocks_count || sweep->blocks_nbr >= sweep->blocks_max)
+    return ;
+  buffer=(unsigned char *)MALLOC(sweep->blocksize);
+  if((unsigned)sweep->disk->pread(sweep->disk, buffer, sweep->blocksize,
+	sweep->partition->part_offset + (uint64_t)block * sweep->blocksize) == sweep->blocksize)
+  {
+    for(i=0; i < sweep->blocksize/4; i++)
+      ext2_sweep_indirect(sweep, le32(*(const uint32_t *)&buffer[4*i]), level-1);
+  }
+  free(buffer);
+}
+
+/* Walk an extent tree node, the root one lives in i_block */
+static void ext2_sweep_extents(struct ext2_sweep *sweep, const unsigned char *node, const unsigned int node_size, const unsigned int depth)
+{
+  const unsigned int magic=le16(*(const uint16_t *)&node[0]);
+  const unsigned int entries=le16(*(const uint16_t *)&node[2]);
+  const unsigned int max=le16(*(const uint16_t *)&node[4]);
+  const unsigned int node_depth=le16(*(const uint16_t *)&node[6]);
+  unsigned int i;
+  if(magic!=EXT4_EXT_MAGIC || node_depth > EXT2_SWEEP_MAX_DEPTH ||
+      depth > EXT2_SWEEP_MAX_DEPTH || 12 + 12 * max > node_size)
+    return ;
+  /* Removing the extents decreases eh_entries but the entries are often
+   * still there, check all of them */
+  for(i=0; i < max; i++)
+  {
+    const unsigned char *entry=&node[12 + 12 * i];
+    if(node_depth==0)
+    {
+      /* ext4_extent: ee_block, ee_len, ee_start_hi, ee_start_lo */
+      unsigned int len=le16(*(const uint16_t *)&entry[4]);
+      const uint64_t start=((uint64_t)le16(*(const uint16_t *)&entry[6])<<32) | le32(*(const uint32_t *)&entry[8]);
+      if(len > 32768)
+	len-=32768;	/* uninitialized extent */
+      if(i >= entries && start==0)
+	break;
+      ext2_sweep_add(sweep, start, len);
+    }
+    else
+    {
+      /* ext4_extent_idx: ei_block, ei_leaf_lo, ei_leaf_hi */
+      const uint64_t leaf=((uint64_t)le16(*(const uint16_t *)&entry[8])<<32) | le32(*(const uint32_t *)&entry[4]);
+      unsigned char *buffer;
+      if(leaf==0 || leaf >= sweep->blocks_count)
+      {
+	if(i >= entries)
+	  break;
+	continue;
+      }
+      buffer=(unsigned char *)MALLOC(sweep->blocksize);
+      if((unsigned)sweep->disk->pread(sweep->disk, buffer, sweep->blocksize,
+	    sweep->partition->part_offset + leaf * sweep->blocksize) == sweep->blocksize)
+	ext2_sweep_extents(sweep, buffer, sweep->blocksize, depth+1);
+      free(buffer);
+    }
+  }
+}
+
+static int ext2_sweep_extent_cmp(const void *a, const void *b)
+{
+  const uint64_t *extent_a=(const uint64_t *)a;
+  const uint64_t *extent_b=(const uint64_t *)b;
+  if(extent_a[0] != extent_b[0])
+    return (extent_a[0] < extent_b[0] ? -1 : 1);
+  return 0;
+}
+
+unsigned int ext2_deleted_space(alloc_data_t *list_search_space, disk_t *disk, const partition_t *partition)
+{
+  struct ext2_super_block *sb;
+  struct ext2_sweep sweep;
+  unsigned char *gdt;
+  unsigned char *table;
+  unsigned int desc_size;
+  unsigned int inode_size;
+  unsigned int inodes_per_group;
+  unsigned int groups_nbr;
+  unsigned int group;
+  unsigned int candidates=0;
+  unsigned int i;
+  uint64_t gdt_size;
+  if(partition->upart_type!=UP_EXT2 &&
+      partition->upart_type!=UP_EXT3 &&
+      partition->upart_type!=UP_EXT4)
+  {
+    log_error("Not a valid ext2/ext3/ext4 filesystem");
+    free_search_space(list_search_space);
+    return 0;
+  }
+  sb=(struct ext2_super_block *)MALLOC(EXT2_SUPERBLOCK_SIZE);
+  if(disk->pread(disk, sb, EXT2_SUPERBLOCK_SIZE, partition->part_offset + 0x400) != EXT2_SUPERBLOCK_SIZE ||
+      test_EXT2(sb, partition)!=0 ||
+      le32(sb->s_inodes_per_group)==0 || le32(sb->s_blocks_per_group)==0 ||
+      EXT2_HAS_INCOMPAT_FEATURE(sb, EXT2_FEATURE_INCOMPAT_META_BG))
+  {
+    free(sb);
+    return 0;
+  }
+  sweep.disk=disk;
+  sweep.partition=partition;
+  sweep.blocksize=EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size);
+  sweep.blocks_count=td_ext2fs_blocks_count(sb);
+  sweep.extents=NULL;
+  sweep.extents_nbr=0;
+  sweep.extents_allocated=0;
+  inodes_per_group=le32(sb->s_inodes_per_group);
+  inode_size=(le32(sb->s_rev_level)==0 ? EXT2_GOOD_OLD_INODE_SIZE : le16(sb->s_inode_size));
+  desc_size=(EXT2_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_64BIT) && le16(sb->s_desc_size) >= 64 ?
+      le16(sb->s_desc_size) : 32);
+  groups_nbr=(sweep.blocks_count - le32(sb->s_first_data_block) + le32(sb->s_blocks_per_group) - 1) /
+    le32(sb->s_blocks_per_group);
+  if(inode_size < EXT2_GOOD_OLD_INODE_SIZE || inode_size > sweep.blocksize)
+  {
+    free(sb);
+    return 0;
+  }
+  gdt_size=(uint64_t)groups_nbr * desc_size;
+  gdt=(unsigned char *)MALLOC(gdt_size);
+  if((uint64_t)disk->pread(disk, gdt, gdt_size,
+	partition->part_offset + (uint64_t)(le32(sb->s_first_data_block) + 1) * sweep.blocksize) != gdt_size)
+  {
+    free(gdt);
+    free(sb);
+    return 0;
+  }
+  /* One read per inode table */
+  table=(unsigned char *)MALLOC((size_t)inodes_per_group * inode_size);
+  for(group=0; group < groups_nbr; group++)
+  {
+    const unsigned char *desc=&gdt[(uint64_t)group * desc_size];
+    uint64_t inode_table=le32(*(const uint32_t *)&desc[8]);
+    unsigned int inodes_nbr=inodes_per_group;
+    if(desc_size >= 64)
+      inode_table|=(uint64_t)le32(*(const uint32_t *)&desc[0x28])<<32;
+    if(EXT2_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_GDT_CSUM|EXT4_FEATURE_RO_COMPAT_METADATA_CSUM))
+    {
+      /* uninit_bg or metadata_csum: skip the never used inodes */
+      const unsigned int unused=le16(*(const uint16_t *)&desc[0x1c]);
+      if((le16(*(const uint16_t *)&desc[0x12]) & EXT2_BG_INODE_UNINIT)!=0)
+	continue;
+      if(unused < inodes_nbr)
+	inodes_nbr-=unused;
+    }
+    if(inode_table==0 || inode_table >= sweep.blocks_count)
+      continue;
+    if(group + 1 < groups_nbr)
+    {
+      /* The next inode table is loaded while this one is parsed */
+      const unsigned char *next_desc=&gdt[(uint64_t)(group + 1) * desc_size];
+      uint64_t next_table=le32(*(const uint32_t *)&next_desc[8]);
+      if(desc_size >= 64)
+	next_table|=(uint64_t)le32(*(const uint32_t *)&next_desc[0x28])<<32;
+      if(next_table!=0 && next_table < sweep.blocks_count)
+	disk_advise(disk, partition->part_offset + next_table * sweep.blocksize,
+	    (uint64_t)inodes_per_group * inode_size, TESTDISK_ADVISE_WILLNEED);
+    }
+    if((unsigned)disk->pread(disk, table, inodes_nbr * inode_size,
+	  partition->part_offset + inode_table * sweep.blocksize) != inodes_nbr * inode_size)
+      continue;
+    for(i=0; i < inodes_nbr; i++)
+    {
+      const unsigned char *inode=&table[i * inode_size];
+      const unsigned int mode=le16(*(const uint16_t *)&inode[EXT2_I_MODE]);
+      const uint64_t size=le32(*(const uint32_t *)&inode[EXT2_I_SIZE]) |
+	((uint64_t)le32(*(const uint32_t *)&inode[EXT2_I_SIZE_HIGH])<<32);
+      const unsigned int extents_nbr=sweep.extents_nbr;
+      if(le32(*(const uint32_t *)&inode[EXT2_I_DTIME])==0 ||
+	  le16(*(const uint16_t *)&inode[EXT2_I_LINKS_COUNT])!=0 ||
+	  (mode & EXT2_S_IFMT)!=EXT2_S_IFREG || size==0)
+	continue;
+      sweep.blocks_max=(size + sweep.blocksize - 1) / sweep.blocksize;
+      sweep.blocks_nbr=0;
+      if((le32(*(const uint32_t *)&inode[EXT2_I_FLAGS]) & EXT4_EXTENTS_FL)!=0)
+	ext2_sweep_extents(&sweep, &inode[EXT2_I_BLOCK], 60, 0);
+      else
+      {
+	unsigned int j;
+	for(j=0; j<12; j++)
+	  ext2_sweep_indirect(&sweep, le32(*(const uint32_t *)&inode[EXT2_I_BLOCK + 4*j]), 0);
+	for(j=12; j<15; j++)
+	  ext2_sweep_indirect(&sweep, le32(*(const uint32_t *)&inode[EXT2_I_BLOCK + 4*j]), j-11);
+      }
+      if(sweep.extents_nbr > extents_nbr)
+      {
+	candidates++;
+	log_info("ext2_deleted: inode %llu, size %llu, %llu blocks from block %llu\n",
+	    (long long unsigned)group * inodes_per_group + i + 1,
+	    (long long unsigned)size,
+	    (long long unsigned)sweep.blocks_nbr,
+	    (long long unsigned)sweep.extents[2*extents_nbr]);
+      }
+    }
+  }
+  free(table);
+  free(gdt);
+  free(sb);
+  log_info("ext2_deleted: %u deleted inodes with their blocks\n", candidates);
+  /* Sort and merge the extents to build the search space */
+  qsort(sweep.extents, sweep.extents_nbr, 2 * sizeof(uint64_t), ext2_sweep_extent_cmp);
+  free_search_space(list_search_space);
+  for(i=0; i < sweep.extents_nbr; )
+  {
+    alloc_data_t *new_free_space;
+    uint64_t start=sweep.extents[2*i];
+    uint64_t end=start + sweep.extents[2*i+1];
+    for(i++; i < sweep.extents_nbr && sweep.extents[2*i] <= end; i++)
+      if(sweep.extents[2*i] + sweep.extents[2*i+1] > end)
+	end=sweep.extents[2*i] + sweep.extents[2*i+1];
+    new_free_space=alloc_data_new();
+    new_free_space->start=partition->part_offset + start * sweep.blocksize;
+    new_free_space->end=partition->part_offset + end * sweep.blocksize - 1;
+    new_free_space->file_stat=NULL;
+    new_free_space->data=1;
+    td_list_add_tail(&new_free_space->list, &list_search_space->list);
+  }
+  free(sweep.extents);
+  return sweep.blocksize;
+}
+#endif
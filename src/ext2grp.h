@@ -53,6 +53,20 @@ unsigned int ext2_fix_group(alloc_data_t *list_search_space, disk_t *disk, const
 // ensures  valid_partition(partition);
 unsigned int ext2_fix_inode(alloc_data_t *list_search_space, disk_t *disk, const partition_t *partition);
 
+/* Search space made of the blocks still referenced by deleted inodes,
+ * found by reading the inode tables of every group */
+/*@
+  @ requires valid_list_search_space(list_search_space);
+  @ requires valid_disk(disk);
+  @ requires valid_partition(partition);
+  @ requires \valid(disk);
+  @ requires \valid_read(partition);
+  @ requires \separated(list_search_space, disk, partition);
+  @ decreases 0;
+  @ ensures  valid_disk(disk);
+  @*/
+unsigned int ext2_deleted_space(alloc_data_t *list_search_space, disk_t *disk, const partition_t *partition);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -969,7 +969,7 @@ static int fat_has_EFI_entry(disk_t *disk, const partition_t *partition, const i
   const dir_partition_t res=dir_partition_fat_init(disk, partition, &dir_data, verbose);
   if(res!=DIR_PART_OK)
     return 0;
-  TD_INIT_LIST_HEAD(&dir_list.list);
+  init_list_file(&dir_list);
   dir_data.get_dir(disk, partition, &dir_data, 0, &dir_list);
   td_list_for_each(file_walker, &dir_list.list)
   {
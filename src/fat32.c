@@ -33,6 +33,7 @@
 #include <ctype.h>
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
 #include "lang.h"
 #include "intrf.h"
 #include "intrfn.h"
@@ -108,6 +109,7 @@ int fat32_boot_sector(disk_t *disk_car, partition_t *partition, const int verbos
       int opt_over=0;
       int opt_B=0;
       int opt_O=0;
+      disk_read_t reads[2];
 #ifdef HAVE_NCURSES
       aff_copy(stdscr);
       wmove(stdscr,4,0);
@@ -118,8 +120,16 @@ int fat32_boot_sector(disk_t *disk_car, partition_t *partition, const int verbos
 #endif
       log_info("\nfat32_boot_sector\n");
       log_partition(disk_car,partition);
+      /* The boot sector and its backup 6 sectors later */
+      reads[0].offset=partition->part_offset;
+      reads[0].count=3 * disk_car->sector_size;
+      reads[0].buffer=buffer_bs;
+      reads[1].offset=partition->part_offset + 6 * disk_car->sector_size;
+      reads[1].count=3 * disk_car->sector_size;
+      reads[1].buffer=buffer_backup_bs;
+      disk_pread_batch(disk_car, reads, 2);
       screen_buffer_add("Boot sector\n");
-      if((unsigned)disk_car->pread(disk_car, buffer_bs, 3 * disk_car->sector_size, partition->part_offset) != 3 * disk_car->sector_size)
+      if((unsigned)reads[0].res != 3 * disk_car->sector_size)
       {
 	screen_buffer_add("fat32_boot_sector: Can't read boot sector.\n");
 	memset(buffer_bs,0,3*disk_car->sector_size);
@@ -142,7 +152,7 @@ int fat32_boot_sector(disk_t *disk_car, partition_t *partition, const int verbos
         screen_buffer_add("Bad\n");
       }
       screen_buffer_add("\nBackup boot sector\n");
-      if((unsigned)disk_car->pread(disk_car, buffer_backup_bs, 3 * disk_car->sector_size, partition->part_offset + 6 * disk_car->sector_size) != 3 * disk_car->sector_size)
+      if((unsigned)reads[1].res != 3 * disk_car->sector_size)
       {
 	screen_buffer_add("fat32_boot_sector: Can't read backup boot sector.\n");
 	memset(buffer_backup_bs,0,3*disk_car->sector_size);
@@ -320,9 +320,11 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 #endif
     unsigned char *buffer;
     int ind_stop=0;
+    fat_scan_t scan;
     file_info_t rootdir_list;
-    TD_INIT_LIST_HEAD(&rootdir_list.list);
-    buffer=(unsigned char *)MALLOC(cluster_size);
+    init_list_file(&rootdir_list);
+    fat_scan_init(&scan, disk_car, partition->part_offset + start_data * disk_car->sector_size,
+	cluster_size, no_of_cluster);
 #ifdef HAVE_NCURSES
     wmove(stdscr,22,0);
     wattrset(stdscr, A_REVERSE);
@@ -342,9 +344,8 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
         ind_stop|=check_enter_key_or_s(stdscr);
       }
 #endif
-      if((unsigned)disk_car->pread(disk_car, buffer, cluster_size,
-	    partition->part_offset + (start_data + (uint64_t)(root_cluster - 2) * sectors_per_cluster) *
-	    disk_car->sector_size) == cluster_size)
+      buffer=fat_scan_read(&scan, root_cluster - 2);
+      if(buffer!=NULL)
       {
 	const struct msdos_dir_entry *entry1=(const struct msdos_dir_entry *)&buffer[0];
 	const struct msdos_dir_entry *entry2=(const struct msdos_dir_entry *)&buffer[0x20];
@@ -361,7 +362,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 	      buffer[0x40]!=0) /* First-level directory with files */
           {
 	    file_info_t dir_list;
-	    TD_INIT_LIST_HEAD(&dir_list.list);
+	    init_list_file(&dir_list);
             log_info("First-level directory found at cluster %lu\n",root_cluster);
             dir_fat_aux(buffer, cluster_size, 0, &dir_list);
             if(verbose>0)
@@ -370,10 +371,11 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
             }
             {
 	      const file_info_t *first_entry=td_list_first_entry(&dir_list.list, const file_info_t, list);
-              file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
+              file_info_t *new_file=file_info_new(&rootdir_list, NULL);
+	      char name[32];
               memcpy(new_file, first_entry, sizeof(*new_file));
-	      new_file->name=(char*)MALLOC(32);
-              snprintf(new_file->name, 32,"DIR%05u",++dir_nbr);
+              snprintf(name, sizeof(name),"DIR%05u",++dir_nbr);
+	      new_file->name=file_info_strdup(&rootdir_list, name);
 	      td_list_add_tail(&new_file->list, &rootdir_list.list);
             }
             delete_list_file(&dir_list);
@@ -449,14 +451,14 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 		  log_verbose("prev cluster(%lu)=>%lu\n",new_root_cluster,tmp);
 		if(tmp==0)
 		{
-		  free(buffer);
+		  fat_scan_free(&scan);
 		  return new_root_cluster;
 		}
 		/* Check cluster number */
 		if((tmp<2) || (tmp>=2+no_of_cluster))
 		{
 		  log_error("bad cluster number\n");
-		  free(buffer);
+		  fat_scan_free(&scan);
 		  return new_root_cluster;
 		}
 		/* Read the cluster */
@@ -464,7 +466,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 		      partition->part_offset + (start_data + (uint64_t)(tmp - 2) * sectors_per_cluster) * disk_car->sector_size) != cluster_size)
 		{
 		  log_critical("cluster can't be read\n");
-		  free(buffer);
+		  fat_scan_free(&scan);
 		  return new_root_cluster;
 		}
 		/* Check if this cluster is a directory structure. FAT can be damaged */
@@ -473,12 +475,12 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 		  if(check_FAT_dir_entry(&buffer[i*0x20],i)!=1)
 		  {
 		    log_error("cluster data is not a directory structure\n");
-		    free(buffer);
+		    fat_scan_free(&scan);
 		    return new_root_cluster;
 		  }
 		}
 	      }
-              free(buffer);
+              fat_scan_free(&scan);
               return new_root_cluster;
             }
             else
@@ -491,7 +493,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
             }
             {
 	      file_info_t dir_list;
-	      TD_INIT_LIST_HEAD(&dir_list.list);
+	      init_list_file(&dir_list);
               dir_fat_aux(buffer, cluster_size, 0, &dir_list);
               if(is_root_cluster_candidat(&dir_list))
               {
@@ -508,14 +510,14 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
                   {
                     case c_YES:
                       delete_list_file(&dir_list);
-                      free(buffer);
+                      fat_scan_free(&scan);
                       return root_cluster;
                     case 'A':
                       interactive=0;
                       break;
 		    case 'Q':
                       delete_list_file(&dir_list);
-                      free(buffer);
+                      fat_scan_free(&scan);
                       return 0;
                     default:
                       break;
@@ -554,7 +556,7 @@ static unsigned int fat32_find_root_cluster(disk_t *disk_car,const partition_t *
 #endif
       delete_list_file(&rootdir_list);
     }
-    free(buffer);
+    fat_scan_free(&scan);
   }
   return root_cluster;
 }
@@ -686,7 +688,7 @@ static int fat32_create_rootdir(disk_t *disk_car,const partition_t *partition, c
 #ifdef DEBUG
   {
     file_info_t dir_list;
-    TD_INIT_LIST_HEAD(&dir_list.list);
+    init_list_file(&dir_list);
     dir_fat_aux(buffer, cluster_size, 0, &dir_list);
     dir_aff_log(NULL, dir_list);
     delete_list_file(&dir_list);
@@ -814,7 +816,7 @@ static int analyse_dir_entries2(disk_t *disk_car,const partition_t *partition, c
   unsigned int root_dir_size;
   file_info_t dir_list;
   struct td_list_head *file_walker = NULL;
-  TD_INIT_LIST_HEAD(&dir_list.list);
+  init_list_file(&dir_list);
   if(root_size_max==0)
   {
     root_size_max=4096;
@@ -40,6 +40,52 @@
 #include "fat.h"
 #include "fat_common.h"
 
+void fat_scan_init(fat_scan_t *scan, disk_t *disk, const uint64_t offset, const unsigned int unit_size, const uint64_t end)
+{
+  scan->disk=disk;
+  scan->offset=offset;
+  scan->end=end;
+  scan->unit_size=unit_size;
+  scan->chunk_units=(unit_size < FAT_SCAN_CHUNK ? FAT_SCAN_CHUNK / unit_size : 1);
+  scan->chunk=(unsigned char *)MALLOC((size_t)scan->chunk_units * unit_size);
+  scan->first=0;
+  scan->nbr=0;
+  scan->single_end=0;
+}
+
+unsigned char *fat_scan_read(fat_scan_t *scan, const uint64_t unit)
+{
+  disk_t *disk=scan->disk;
+  if(unit >= scan->end)
+    return NULL;
+  if(unit >= scan->first && unit < scan->first + scan->nbr)
+    return &scan->chunk[(size_t)(unit - scan->first) * scan->unit_size];
+  scan->first=unit;
+  scan->nbr=0;
+  if(unit >= scan->single_end)
+  {
+    const unsigned int nbr=(scan->end - unit < scan->chunk_units ? scan->end - unit : scan->chunk_units);
+    const unsigned int size=nbr * scan->unit_size;
+    if((unsigned)disk->pread(disk, scan->chunk, size, scan->offset + unit * scan->unit_size) == size)
+    {
+      scan->nbr=nbr;
+      return scan->chunk;
+    }
+    scan->single_end=unit + nbr;
+  }
+  if((unsigned)disk->pread(disk, scan->chunk, scan->unit_size, scan->offset + unit * scan->unit_size) != scan->unit_size)
+    return NULL;
+  scan->nbr=1;
+  return scan->chunk;
+}
+
+void fat_scan_free(fat_scan_t *scan)
+{
+  free(scan->chunk);
+  scan->chunk=NULL;
+  scan->nbr=0;
+}
+
 /* Using a couple of inodes of "." directory entries, get the cluster size and where the first cluster begins.
  * */
 int find_sectors_per_cluster(disk_t *disk_car, const partition_t *partition, const int verbose, const int dump_ind, unsigned int *sectors_per_cluster, uint64_t *offset_org, const upart_type_t upart_type)
@@ -49,7 +95,7 @@ int find_sectors_per_cluster(disk_t *disk_car, const partition_t *partition, con
   uint64_t offset;
   uint64_t skip_offset;
   int ind_stop=0;
-  unsigned char *buffer=(unsigned char *)MALLOC(disk_car->sector_size);
+  fat_scan_t scan;
 #ifdef HAVE_NCURSES
   wmove(stdscr,22,0);
   wattrset(stdscr, A_REVERSE);
@@ -64,10 +110,13 @@ int find_sectors_per_cluster(disk_t *disk_car, const partition_t *partition, con
 	(unsigned long)(skip_offset/disk_car->sector_size),
 	(unsigned long)skip_offset);
   }
+  fat_scan_init(&scan, disk_car, partition->part_offset, disk_car->sector_size,
+      partition->part_size/disk_car->sector_size);
   for(offset=skip_offset;
       offset<partition->part_size && !ind_stop && nbr_subdir<10;
       offset+=disk_car->sector_size)
   {
+    const unsigned char *buffer;
 #ifdef HAVE_NCURSES
     if((offset&(1024*disk_car->sector_size-1))==0)
     {
@@ -78,7 +127,8 @@ int find_sectors_per_cluster(disk_t *disk_car, const partition_t *partition, con
       ind_stop|=check_enter_key_or_s(stdscr);
     }
 #endif
-    if((unsigned)disk_car->pread(disk_car, buffer, disk_car->sector_size, partition->part_offset + offset) == disk_car->sector_size)
+    buffer=fat_scan_read(&scan, offset/disk_car->sector_size);
+    if(buffer!=NULL)
     {
       if(buffer[0]=='.' && is_fat_directory(buffer))
       {
@@ -95,7 +145,7 @@ int find_sectors_per_cluster(disk_t *disk_car, const partition_t *partition, con
       }
     }
   }
-  free(buffer);
+  fat_scan_free(&scan);
   return find_sectors_per_cluster_aux(sector_cluster,nbr_subdir,sectors_per_cluster,offset_org,verbose,partition->part_size/disk_car->sector_size, upart_type);
 }
 
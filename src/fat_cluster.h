@@ -42,6 +42,44 @@ struct cluster_offset_struct
   unsigned int  first_sol;
 };
 
+/* Sequential scan of a FAT data area by units, sectors or clusters: the
+ * units are read by chunks of FAT_SCAN_CHUNK bytes, the units of a chunk
+ * that can't be read are read one by one */
+#define FAT_SCAN_CHUNK (4*1024*1024)
+
+typedef struct
+{
+  disk_t *disk;
+  uint64_t offset;		/* disk offset of unit 0 */
+  uint64_t end;			/* number of units */
+  unsigned int unit_size;
+  unsigned int chunk_units;
+  unsigned char *chunk;
+  uint64_t first;		/* first unit in chunk */
+  unsigned int nbr;		/* units read in chunk */
+  uint64_t single_end;		/* units read one by one up to there */
+} fat_scan_t;
+
+/*@
+  @ requires \valid(scan);
+  @ requires \valid(disk);
+  @ requires unit_size > 0;
+  @ requires \separated(scan, disk);
+  @*/
+void fat_scan_init(fat_scan_t *scan, disk_t *disk, const uint64_t offset, const unsigned int unit_size, const uint64_t end);
+
+/* The unit read from the disk, NULL if it can't be read. The data stays
+ * valid until the next call */
+/*@
+  @ requires \valid(scan);
+  @*/
+unsigned char *fat_scan_read(fat_scan_t *scan, const uint64_t unit);
+
+/*@
+  @ requires \valid(scan);
+  @*/
+void fat_scan_free(fat_scan_t *scan);
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
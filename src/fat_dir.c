@@ -48,13 +48,22 @@
 #include "fat_dir.h"
 #include "log.h"
 #include "setdate.h"
+#include "unicode.h"
 
 #define MSDOS_MKMODE(a,m) ((m & ((a & ATTR_RO) ? LINUX_S_IRUGO|LINUX_S_IXUGO : LINUX_S_IRWXUGO)) | ((a & ATTR_DIR) ? LINUX_S_IFDIR : LINUX_S_IFREG))
 struct fat_dir_struct
 {
   struct fat_boot_sector*boot_sector;
+  unsigned char *fat;		/* Copy of the first FAT, see fat_dir_load_fat() */
+  unsigned int fat_clusters;	/* Number of entries in this copy */
+  int fat_loaded;
 };
 
+/* Don't keep in memory a FAT larger than this, the entries will be read
+ * from the disk as needed */
+#define FAT_DIR_FAT_MAX		(64*1024*1024)
+#define FAT_DIR_READ_SIZE	(1024*1024)
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
@@ -108,11 +117,6 @@ int dir_fat_aux(const unsigned char*buffer, const unsigned int size, const unsig
   unsigned char long_slots;
   unsigned int status;
   unsigned int inode;
-  int utf8=1;
-#ifdef HAVE_WCTOMB
-  if(wctomb(NULL, 0) < 0)
-    utf8=0;
-#endif
 #ifndef DISABLED_FOR_FRAMAC
 GetNew:
   status=0;
@@ -290,30 +294,23 @@ RecEnd:
       return 0;
     if(unicode[0] != DELETED_FLAG)
     {
-      unsigned int i,o;
-      file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
-      new_file->name=(char*)MALLOC(DIR_NAME_LEN);
-      for(i=0,o=0; o<DIR_NAME_LEN-2 && unicode[i]!=0; i++)
+      unsigned int i;
+      unsigned char name16[2*sizeof(unicode)/sizeof(unicode[0])];
+      char name[DIR_NAME_LEN];
+      file_info_t *new_file;
+      for(i=0; i<sizeof(unicode)/sizeof(unicode[0]) && unicode[i]!=0; i++)
       {
-	if(utf8 && unicode[i]>0x7f)
-	{
-#ifdef HAVE_WCTOMB
-	  const int sizec=wctomb(&new_file->name[o], unicode[i]);
-#else
-	  const int sizec=unicode[i];
-#endif
-	  if(sizec <= 0)
-	  {
-	    new_file->name[o++]=unicode[i];
-	    utf8=0;
-	  }
-	  else
-	    o += sizec;
-	}
-	else
-	  new_file->name[o++]=unicode[i];
+	name16[2*i]=unicode[i] & 0xff;
+	name16[2*i+1]=(unicode[i]>>8) & 0xff;
+      }
+      if(UTF16le2utf8(name, DIR_NAME_LEN, name16, i) < 0)
+      {
+	/* Unpaired surrogate, keep the low byte of each character */
+	for(i=0; i<DIR_NAME_LEN-1 && i<sizeof(unicode)/sizeof(unicode[0]) && unicode[i]!=0; i++)
+	  name[i]=unicode[i];
+	name[i]='\0';
       }
-      new_file->name[o]='\0';
+      new_file=file_info_new(dir_list, name);
       new_file->st_ino=inode;
       new_file->st_mode = MSDOS_MKMODE(de->attr,(LINUX_S_IRWXUGO & ~(LINUX_S_IWGRP|LINUX_S_IWOTH)));
       new_file->st_uid=0;
@@ -350,6 +347,73 @@ static int is_EOC(const unsigned int cluster, const upart_type_t upart_type)
     return((cluster&0xffffff8)==(unsigned)FAT32_EOC);
 }
 
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid_read(partition);
+  @ requires \valid(ls);
+  @ requires \separated(disk, partition, ls);
+  @ decreases 0;
+  @*/
+static void fat_dir_load_fat(disk_t *disk, const partition_t *partition, struct fat_dir_struct *ls)
+{
+  const struct fat_boot_sector *fat_header=ls->boot_sector;
+  const unsigned long int fat_length=le16(fat_header->fat_length)>0?le16(fat_header->fat_length):le32(fat_header->fat32_length);
+  const uint64_t fat_size=(uint64_t)fat_length * disk->sector_size;
+  const uint64_t fat_offset=partition->part_offset + (uint64_t)le16(fat_header->reserved) * disk->sector_size;
+  uint64_t pos;
+  ls->fat_loaded=1;
+  if(fat_size==0 || fat_size > FAT_DIR_FAT_MAX)
+    return ;
+  ls->fat=(unsigned char *)MALLOC(fat_size);
+  /* A few large reads instead of one read per entry */
+  for(pos=0; pos < fat_size; pos+=FAT_DIR_READ_SIZE)
+  {
+    const unsigned int toread=(fat_size - pos > FAT_DIR_READ_SIZE ? FAT_DIR_READ_SIZE : fat_size - pos);
+    if((unsigned)disk->pread(disk, ls->fat + pos, toread, fat_offset + pos) != toread)
+    {
+#ifndef DISABLED_FOR_FRAMAC
+      log_warning("FAT: Can't read the FAT, reading it by sectors.\n");
+#endif
+      free(ls->fat);
+      ls->fat=NULL;
+      return ;
+    }
+  }
+  if(partition->upart_type==UP_FAT12)
+    ls->fat_clusters=(fat_size - 1) * 2 / 3;
+  else if(partition->upart_type==UP_FAT16)
+    ls->fat_clusters=fat_size / 2;
+  else
+    ls->fat_clusters=fat_size / 4;
+}
+
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid_read(partition);
+  @ requires valid_partition(partition);
+  @ requires \valid(ls);
+  @ requires \separated(disk, partition, ls);
+  @ decreases 0;
+  @*/
+static unsigned int fat_dir_next_cluster(disk_t *disk, const partition_t *partition, struct fat_dir_struct *ls, const unsigned int cluster)
+{
+  if(ls->fat_loaded==0)
+    fat_dir_load_fat(disk, partition, ls);
+  if(ls->fat==NULL || cluster >= ls->fat_clusters)
+    return get_next_cluster(disk, partition, partition->upart_type, le16(ls->boot_sector->reserved), cluster);
+  if(partition->upart_type==UP_FAT12)
+  {
+    const unsigned int offset=cluster+cluster/2;
+    const unsigned int next_cluster=ls->fat[offset] | (ls->fat[offset+1]<<8);
+    return ((cluster&1)!=0 ? next_cluster>>4 : next_cluster&0x0FFF);
+  }
+  if(partition->upart_type==UP_FAT16)
+    return le16(((const uint16_t *)ls->fat)[cluster]);
+  return le32(((const uint32_t *)ls->fat)[cluster])&0xFFFFFFF;
+}
+
 #define NBR_ENTRIES_MAX 65536
 
 /*@
@@ -364,7 +428,7 @@ static int is_EOC(const unsigned int cluster, const upart_type_t upart_type)
   @*/
 static int fat_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_cluster, file_info_t *dir_list)
 {
-  const struct fat_dir_struct *ls=(const struct fat_dir_struct*)dir_data->private_dir_data;
+  struct fat_dir_struct *ls=(struct fat_dir_struct*)dir_data->private_dir_data;
   const struct fat_boot_sector*fat_header=ls->boot_sector;
   unsigned int cluster=first_cluster;
   if(fat_header->sectors_per_cluster<1)
@@ -394,7 +458,7 @@ static int fat_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *d
     }
     cluster=le32(fat_header->root_cluster);
   }
-  if(get_next_cluster(disk_car, partition, partition->upart_type, le16(fat_header->reserved), cluster)==0)
+  if(fat_dir_next_cluster(disk_car, partition, ls, cluster)==0)
   {
 #ifndef DISABLED_FOR_FRAMAC
     log_warning("FAT: Directory entry is marked as free.\n");
@@ -442,7 +506,7 @@ static int fat_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *d
       {
 	if(fat_meth==FAT_FOLLOW_CLUSTER)
 	{
-	  const unsigned int next_cluster=get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster);
+	  const unsigned int next_cluster=fat_dir_next_cluster(disk_car, partition, ls, cluster);
 	  if((next_cluster>=2 && next_cluster<=no_of_cluster+2) ||
 	      is_EOC(next_cluster, partition->upart_type))
 	    cluster=next_cluster;
@@ -466,7 +530,7 @@ static int fat_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *d
 	else if(fat_meth==FAT_NEXT_FREE_CLUSTER)
 	{	/* Deleted directories are composed of "free" clusters */
 	  while(++cluster<no_of_cluster+2 &&
-	      get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster)!=0);
+	      fat_dir_next_cluster(disk_car, partition, ls, cluster)!=0);
 	}
 	nbr_cluster++;
       }
@@ -525,6 +589,9 @@ dir_partition_t dir_partition_fat_init(disk_t *disk_car, const partition_t *part
   set_secwest();
   ls=(struct fat_dir_struct *)MALLOC(sizeof(*ls));
   ls->boot_sector=(struct fat_boot_sector*)buffer;
+  ls->fat=NULL;
+  ls->fat_clusters=0;
+  ls->fat_loaded=0;
   strncpy(dir_data->current_directory,"/",sizeof(dir_data->current_directory));
   dir_data->current_inode=0;
   dir_data->param=FLAG_LIST_DELETED;
@@ -546,6 +613,7 @@ static void dir_partition_fat_close(dir_data_t *dir_data)
 {
   struct fat_dir_struct *ls=(struct fat_dir_struct*)dir_data->private_dir_data;
   free(ls->boot_sector);
+  free(ls->fat);
   free(ls);
 }
 
@@ -563,15 +631,17 @@ static copy_file_t fat_copy(disk_t *disk_car, const partition_t *partition, dir_
 {
   char *new_file;	
   FILE *f_out;
-  const struct fat_dir_struct *ls=(const struct fat_dir_struct*)dir_data->private_dir_data;
+  struct fat_dir_struct *ls=(struct fat_dir_struct*)dir_data->private_dir_data;
   const struct fat_boot_sector *fat_header=ls->boot_sector;
   const unsigned int sectors_per_cluster=fat_header->sectors_per_cluster;
   const unsigned int block_size=fat_sector_size(fat_header)*sectors_per_cluster;
-  unsigned char *buffer_file=(unsigned char *)MALLOC(block_size);
+  /* Contiguous clusters are read together, up to FAT_DIR_READ_SIZE */
+  const unsigned int run_max=(block_size < FAT_DIR_READ_SIZE ? FAT_DIR_READ_SIZE / block_size : 1);
+  unsigned char *buffer_file=(unsigned char *)MALLOC((size_t)block_size * run_max);
   unsigned int cluster;
   unsigned int file_size=file->st_size;
   fat_method_t fat_meth=FAT_FOLLOW_CLUSTER;
-  uint64_t start_fat1,start_data,part_size;
+  uint64_t start_data,part_size;
   unsigned long int no_of_cluster,fat_length;
   f_out=fopen_local(&new_file, dir_data->local_dir, dir_data->current_directory);
   if(!f_out)
@@ -586,8 +656,7 @@ static copy_file_t fat_copy(disk_t *disk_car, const partition_t *partition, dir_
   cluster = file->st_ino;
   fat_length=le16(fat_header->fat_length)>0?le16(fat_header->fat_length):le32(fat_header->fat32_length);
   part_size=(fat_sectors(fat_header)>0?fat_sectors(fat_header):le32(fat_header->total_sect));
-  start_fat1=le16(fat_header->reserved);
-  start_data=start_fat1+fat_header->fats*fat_length+(get_dir_entries(fat_header)*32+disk_car->sector_size-1)/disk_car->sector_size;
+  start_data=le16(fat_header->reserved)+fat_header->fats*fat_length+(get_dir_entries(fat_header)*32+disk_car->sector_size-1)/disk_car->sector_size;
   no_of_cluster=(part_size-start_data)/sectors_per_cluster;
 #ifndef DISABLED_FOR_FRAMAC
   log_trace("fat_copy dst=%s first_cluster=%u (%llu) size=%lu\n", new_file,
@@ -602,15 +671,28 @@ static copy_file_t fat_copy(disk_t *disk_car, const partition_t *partition, dir_
   while(cluster>=2 && cluster<=no_of_cluster+2 && file_size>0)
   {
     const uint64_t start=partition->part_offset+(uint64_t)(start_data+(cluster-2)*sectors_per_cluster)*fat_sector_size(fat_header);
-    unsigned int toread = block_size;
-    if (toread > file_size)
-      toread = file_size;
+    unsigned int nbr_cluster=1;
+    unsigned int next_cluster=0;
+    unsigned int toread;
+    if(fat_meth==FAT_FOLLOW_CLUSTER)
+    {
+      next_cluster=fat_dir_next_cluster(disk_car, partition, ls, cluster);
+      while(next_cluster==cluster+nbr_cluster && next_cluster<=no_of_cluster+2 &&
+	  nbr_cluster<run_max && (uint64_t)nbr_cluster*block_size < file_size)
+      {
+	nbr_cluster++;
+	next_cluster=fat_dir_next_cluster(disk_car, partition, ls, cluster+nbr_cluster-1);
+      }
+    }
+    toread = ((uint64_t)nbr_cluster*block_size > file_size ? file_size : nbr_cluster*block_size);
     if((unsigned)disk_car->pread(disk_car, buffer_file, toread, start) != toread)
     {
 #ifndef DISABLED_FOR_FRAMAC
       log_error("fat_copy: Can't read cluster %u.\n", cluster);
 #endif
     }
+    /* Last cluster read */
+    cluster+=nbr_cluster-1;
     if(fwrite(buffer_file, 1, toread, f_out) != toread)
     {
 #ifndef DISABLED_FOR_FRAMAC
@@ -627,7 +709,6 @@ static copy_file_t fat_copy(disk_t *disk_car, const partition_t *partition, dir_
     {
       if(fat_meth==FAT_FOLLOW_CLUSTER)
       {
-	const unsigned int next_cluster=get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster);
 	if(next_cluster>=2 && next_cluster<=no_of_cluster+2)
 	  cluster=next_cluster;
 	else if(cluster==file->st_ino && next_cluster==0)
@@ -640,7 +721,7 @@ static copy_file_t fat_copy(disk_t *disk_car, const partition_t *partition, dir_
       else if(fat_meth==FAT_NEXT_FREE_CLUSTER)
       {	/* Deleted file are composed of "free" clusters */
 	while(++cluster<no_of_cluster+2 &&
-	    get_next_cluster(disk_car, partition, partition->upart_type, start_fat1, cluster)!=0);
+	    fat_dir_next_cluster(disk_car, partition, ls, cluster)!=0);
       }
     }
   }
@@ -53,12 +53,14 @@
 #include "pnext.h"
 #include "setdate.h"
 #include "fat_common.h"
+#include "preader.h"
 #include <assert.h>
 
 #ifndef DISABLED_FOR_FRAMAC
 extern int need_to_stop;
 
 #define READ_SIZE 4*1024*1024
+#define FAT_COPY_READ_SIZE (1024*1024)
 static int pfind_sectors_per_cluster(disk_t *disk, const partition_t *partition, const int verbose, unsigned int *sectors_per_cluster, uint64_t *offset_org, alloc_data_t *list_search_space)
 {
   uint64_t offset=0;
@@ -70,6 +72,7 @@ static int pfind_sectors_per_cluster(disk_t *disk, const partition_t *partition,
   alloc_data_t *current_search_space;
   unsigned char *buffer_start=(unsigned char *)MALLOC(READ_SIZE);
   unsigned char *buffer=buffer_start;
+  preader_t *reader;
   assert(disk->sector_size!=0);
   current_search_space=td_list_first_entry(&list_search_space->list, alloc_data_t, list);
   if(current_search_space!=list_search_space)
@@ -82,7 +85,11 @@ static int pfind_sectors_per_cluster(disk_t *disk, const partition_t *partition,
   waddstr(stdscr,"  Stop  ");
   wattroff(stdscr, A_REVERSE);
 #endif
-  disk->pread(disk, buffer_start, READ_SIZE, offset);
+  /* The next READ_SIZE bytes are read in background while this chunk
+   * is checked */
+  reader=preader_new(disk, READ_SIZE);
+  preader_pread(reader, buffer_start, offset);
+  preader_prefetch(reader, offset + READ_SIZE);
   while(current_search_space!=list_search_space && nbr_subdir<10)
   {
     const uint64_t old_offset=offset;
@@ -126,7 +133,7 @@ static int pfind_sectors_per_cluster(disk_t *disk, const partition_t *partition,
 	    (unsigned long long)((offset-partition->part_offset)/disk->sector_size),
 	    (unsigned long long)((partition->part_size-1)/disk->sector_size));
       }
-      if(disk->pread(disk, buffer_start, READ_SIZE, offset) != READ_SIZE)
+      if(preader_pread(reader, buffer_start, offset) != READ_SIZE)
       {
 #ifdef HAVE_NCURSES
 	wmove(stdscr,11,0);
@@ -135,8 +142,10 @@ static int pfind_sectors_per_cluster(disk_t *disk, const partition_t *partition,
 	    (unsigned long)((offset - partition->part_offset) / disk->sector_size));
 #endif
       }
+      preader_prefetch(reader, offset + READ_SIZE);
     }
   } /* end while(current_search_space!=list_search_space) */
+  preader_free(reader);
   free(buffer_start);
   return find_sectors_per_cluster_aux(sector_cluster,nbr_subdir,sectors_per_cluster,offset_org,verbose,partition->part_size/disk->sector_size, UP_UNK);
 }
@@ -159,7 +168,9 @@ static copy_file_t fat_copy_file(disk_t *disk, const partition_t *partition, con
   unsigned int cluster;
   unsigned int file_size=file->st_size;
   const unsigned long int no_of_cluster=(partition->part_size - start_data) / cluster_size;
-  unsigned char *buffer_file=(unsigned char *)MALLOC(cluster_size);
+  /* The clusters are contiguous, read up to FAT_COPY_READ_SIZE at once */
+  const unsigned int run_max=(cluster_size < FAT_COPY_READ_SIZE ? FAT_COPY_READ_SIZE / cluster_size : 1);
+  unsigned char *buffer_file=(unsigned char *)MALLOC((size_t)cluster_size * run_max);
   cluster = file->st_ino;
   new_file=(char *)MALLOC(1024);
 #ifdef HAVE_MKDIR
@@ -193,9 +204,11 @@ static copy_file_t fat_copy_file(disk_t *disk, const partition_t *partition, con
   while(cluster>=2 && cluster<=no_of_cluster+2 && file_size>0)
   {
     const uint64_t start=start_data + (uint64_t)(cluster-2)*cluster_size;
-    unsigned int toread = cluster_size;
-    if (toread > file_size)
-      toread = file_size;
+    unsigned int nbr_cluster=run_max;
+    unsigned int toread;
+    if(nbr_cluster > no_of_cluster + 3 - cluster)
+      nbr_cluster=no_of_cluster + 3 - cluster;
+    toread = ((uint64_t)nbr_cluster * cluster_size > file_size ? file_size : nbr_cluster * cluster_size);
     if((unsigned)disk->pread(disk, buffer_file, toread, start) != toread)
     {
       log_error("fat_copy_file: Can't read cluster %u.\n", cluster);
@@ -210,7 +223,7 @@ static copy_file_t fat_copy_file(disk_t *disk, const partition_t *partition, con
       return CP_NOSPACE;
     }
     file_size -= toread;
-    cluster++;
+    cluster+=nbr_cluster;
   }
   fclose(f_out);
   set_date(new_file, file->td_atime, file->td_mtime);
@@ -230,6 +243,10 @@ static pstatus_t fat_unformat_aux(struct ph_param *params, const struct ph_optio
   time_t previous_time;
   const unsigned int cluster_size=params->blocksize;
   const unsigned int read_size=(cluster_size>65536?cluster_size:65536);
+  /* Distance between two reads: the last read_size bytes of a chunk are
+   * read again at the beginning of the next one */
+  const unsigned int read_step=((READ_SIZE - read_size) / cluster_size + 1) * cluster_size;
+  preader_t *reader;
   alloc_data_t *current_search_space;
   disk_t *disk=params->disk;
   const partition_t *partition=params->partition;
@@ -253,13 +270,15 @@ static pstatus_t fat_unformat_aux(struct ph_param *params, const struct ph_optio
     info_list_search_space(list_search_space, current_search_space, disk->sector_size, 0, options->verbose);
   buffer_start=(unsigned char *)MALLOC(READ_SIZE);
   buffer=buffer_start;
-  disk->pread(disk, buffer_start, READ_SIZE, offset);
+  reader=preader_new(disk, READ_SIZE);
+  preader_pread(reader, buffer_start, offset);
+  preader_prefetch(reader, offset + read_step);
   for(;offset < offset_end; offset+=cluster_size)
   {
     if(buffer[0]=='.' && is_fat_directory(buffer))
     {
       file_info_t dir_list;
-      TD_INIT_LIST_HEAD(&dir_list.list);
+      init_list_file(&dir_list);
       dir_fat_aux(buffer, read_size, 0, &dir_list);
       if(!td_list_empty(&dir_list.list))
       {
@@ -269,6 +288,8 @@ static pstatus_t fat_unformat_aux(struct ph_param *params, const struct ph_optio
 	int stop=0;
 	log_info("Sector %llu\n", (long long unsigned)offset/disk->sector_size);
 	dir_aff_log(NULL, &dir_list);
+	/* fat_copy_file() reads the disk directly */
+	preader_sync(reader);
 	del_search_space(list_search_space, offset, offset + cluster_size -1);
 	for(file_walker=dir_list.list.next, nbr=0;
 	    stop==0 && file_walker!=&dir_list.list;
@@ -332,22 +353,25 @@ static pstatus_t fat_unformat_aux(struct ph_param *params, const struct ph_optio
     buffer+=cluster_size;
     if(buffer+read_size>buffer_start+READ_SIZE)
     {
+      /* buffer matches the next cluster, offset+cluster_size */
+      const uint64_t offset_read=offset+cluster_size;
       buffer=buffer_start;
       if(options->verbose>1)
       {
         log_verbose("Reading sector %10llu/%llu\n",
-	    (unsigned long long)((offset-partition->part_offset)/disk->sector_size),
+	    (unsigned long long)((offset_read-partition->part_offset)/disk->sector_size),
 	    (unsigned long long)((partition->part_size-1)/disk->sector_size));
       }
-      if(disk->pread(disk, buffer_start, READ_SIZE, offset) != READ_SIZE)
+      if(preader_pread(reader, buffer_start, offset_read) != READ_SIZE)
       {
 #ifdef HAVE_NCURSES
 	wmove(stdscr,11,0);
 	wclrtoeol(stdscr);
 	wprintw(stdscr,"Error reading sector %10lu\n",
-	    (unsigned long)((offset-partition->part_offset)/disk->sector_size));
+	    (unsigned long)((offset_read-partition->part_offset)/disk->sector_size));
 #endif
       }
+      preader_prefetch(reader, offset_read + read_step);
 #ifdef HAVE_NCURSES
       {
         time_t current_time;
@@ -398,6 +422,7 @@ static pstatus_t fat_unformat_aux(struct ph_param *params, const struct ph_optio
       }
     }
   }
+  preader_free(reader);
   free(buffer_start);
   return ind_stop;
 }
@@ -0,0 +1,364 @@
+/*
+
+    File: fextent.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#include <string.h>
+#include <errno.h>
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "log.h"
+#include "fextent.h"
+#include "hdaccess.h"
+
+#define FEXTENT_READ_SIZE	(1024*1024)
+/* A buffer is read while the other one is written */
+#define FEXTENT_BUFFERS		2
+/* The start of the next extent is announced to the disk */
+#define FEXTENT_ADVISE_SIZE	(4*FEXTENT_READ_SIZE)
+
+typedef enum { FEXTENT_FREE=0, FEXTENT_QUEUED=1, FEXTENT_WRITTEN=2 } fextent_state_t;
+
+struct fextent_buffer
+{
+  unsigned char *data;
+  unsigned int size;
+  uint64_t pos;			/* offset in the file */
+  int status;			/* 0 if written */
+  fextent_state_t state;
+};
+
+struct fextent_ctx
+{
+  int fd;
+#ifdef HAVE_PWRITE
+  int use_pwrite;
+#endif
+  int write_error;
+  struct fextent_buffer buffers[FEXTENT_BUFFERS];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int thread_ok;
+  int quit;
+#endif
+};
+
+void fextent_init(fextent_list_t *list)
+{
+  list->extents=NULL;
+  list->nbr=0;
+  list->max=0;
+}
+
+void fextent_add(fextent_list_t *list, const uint64_t file_offset, const uint64_t disk_offset, const uint64_t size)
+{
+  if(size==0)
+    return ;
+  if(list->nbr > 0)
+  {
+    struct fextent *last=&list->extents[list->nbr-1];
+    if(last->file_offset + last->size == file_offset &&
+	last->disk_offset + last->size == disk_offset)
+    {
+      last->size+=size;
+      return ;
+    }
+  }
+  if(list->nbr==list->max)
+  {
+    list->max=(list->max==0 ? 16 : list->max * 2);
+    list->extents=(struct fextent *)realloc(list->extents, list->max * sizeof(struct fextent));
+    if(list->extents==NULL)
+    {
+      log_critical("fextent_add: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  list->extents[list->nbr].file_offset=file_offset;
+  list->extents[list->nbr].disk_offset=disk_offset;
+  list->extents[list->nbr].size=size;
+  list->nbr++;
+}
+
+void fextent_free(fextent_list_t *list)
+{
+  free(list->extents);
+  fextent_init(list);
+}
+
+static int fextent_write(struct fextent_ctx *ctx, const struct fextent_buffer *buffer)
+{
+#if defined(HAVE_PWRITE)
+  if(ctx->use_pwrite>0)
+  {
+    if(pwrite(ctx->fd, buffer->data, buffer->size, buffer->pos)==(ssize_t)buffer->size)
+      return 0;
+    ctx->use_pwrite=0;
+  }
+#endif
+  if(lseek(ctx->fd, buffer->pos, SEEK_SET)<0)
+  {
+    log_error("fextent_copy lseek() failed: %s\n", strerror(errno));
+    return -1;
+  }
+  if(write(ctx->fd, buffer->data, buffer->size) != (ssize_t)buffer->size)
+  {
+    log_error("fextent_copy write() failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *fextent_writer(void *arg)
+{
+  struct fextent_ctx *ctx=(struct fextent_ctx *)arg;
+  pthread_mutex_lock(&ctx->mutex);
+  while(1)
+  {
+    struct fextent_buffer *buffer=NULL;
+    unsigned int i;
+    for(i=0; i<FEXTENT_BUFFERS && buffer==NULL; i++)
+      if(ctx->buffers[i].state==FEXTENT_QUEUED)
+	buffer=&ctx->buffers[i];
+    if(buffer==NULL)
+    {
+      if(ctx->quit)
+	break;
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+    buffer->status=fextent_write(ctx, buffer);
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->state=FEXTENT_WRITTEN;
+    pthread_cond_broadcast(&ctx->cond);
+  }
+  pthread_mutex_unlock(&ctx->mutex);
+  return NULL;
+}
+#endif
+
+/* Called with the lock held */
+static void fextent_written(struct fextent_ctx *ctx, struct fextent_buffer *buffer)
+{
+  if(buffer->status!=0)
+    ctx->write_error=1;
+  buffer->state=FEXTENT_FREE;
+}
+
+static struct fextent_buffer *fextent_get_buffer(struct fextent_ctx *ctx)
+{
+  struct fextent_buffer *buffer=NULL;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ctx->mutex);
+#endif
+  while(buffer==NULL)
+  {
+    unsigned int i;
+    for(i=0; i<FEXTENT_BUFFERS; i++)
+    {
+      if(ctx->buffers[i].state==FEXTENT_WRITTEN)
+	fextent_written(ctx, &ctx->buffers[i]);
+      if(ctx->buffers[i].state==FEXTENT_FREE && buffer==NULL)
+	buffer=&ctx->buffers[i];
+    }
+#ifdef HAVE_PTHREAD
+    if(buffer==NULL)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+#endif
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&ctx->mutex);
+#endif
+  return buffer;
+}
+
+static void fextent_submit(struct fextent_ctx *ctx, struct fextent_buffer *buffer, const unsigned int size, const uint64_t pos)
+{
+  buffer->size=size;
+  buffer->pos=pos;
+#ifdef HAVE_PTHREAD
+  if(ctx->thread_ok)
+  {
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->state=FEXTENT_QUEUED;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+    return ;
+  }
+#endif
+  buffer->status=fextent_write(ctx, buffer);
+  fextent_written(ctx, buffer);
+}
+
+/* Wait for the pending writes */
+static void fextent_flush(struct fextent_ctx *ctx)
+{
+  unsigned int i;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&ctx->mutex);
+  for(i=0; i<FEXTENT_BUFFERS; i++)
+  {
+    while(ctx->buffers[i].state==FEXTENT_QUEUED)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+    if(ctx->buffers[i].state==FEXTENT_WRITTEN)
+      fextent_written(ctx, &ctx->buffers[i]);
+  }
+  pthread_mutex_unlock(&ctx->mutex);
+#else
+  for(i=0; i<FEXTENT_BUFFERS; i++)
+    if(ctx->buffers[i].state==FEXTENT_WRITTEN)
+      fextent_written(ctx, &ctx->buffers[i]);
+#endif
+}
+
+/* Announce the read of the extent, it's loaded while the previous one
+ * is copied */
+static void fextent_advise(disk_t *disk, const fextent_list_t *list, const unsigned int i, const uint64_t file_size)
+{
+  const struct fextent *extent;
+  uint64_t size;
+  if(i >= list->nbr || list->extents[i].file_offset >= file_size)
+    return ;
+  extent=&list->extents[i];
+  size=(extent->file_offset + extent->size < file_size ? extent->size : file_size - extent->file_offset);
+  disk_advise(disk, extent->disk_offset, (size < FEXTENT_ADVISE_SIZE ? size : FEXTENT_ADVISE_SIZE),
+      TESTDISK_ADVISE_WILLNEED);
+}
+
+/* Queue size bytes at pos, read from disk_offset or zeroes for a hole.
+ * Return -1 if the read has failed */
+static int fextent_queue(struct fextent_ctx *ctx, disk_t *disk, const uint64_t pos, const uint64_t disk_offset, const unsigned int size, const int hole)
+{
+  struct fextent_buffer *buffer=fextent_get_buffer(ctx);
+  int res=0;
+  if(hole)
+    memset(buffer->data, 0, size);
+  else
+  {
+    const int got=disk->pread(disk, buffer->data, size, disk_offset);
+    if(got < (signed)size)
+    {
+      log_error("fextent_copy: read error at %llu\n", (long long unsigned)(disk_offset + (got > 0 ? got : 0)));
+      memset(buffer->data + (got > 0 ? got : 0), 0, size - (got > 0 ? got : 0));
+      res=-1;
+    }
+  }
+  fextent_submit(ctx, buffer, size, pos);
+  return res;
+}
+
+int fextent_copy(disk_t *disk, const fextent_list_t *list, const uint64_t file_size, FILE *f_out)
+{
+  struct fextent_ctx ctx;
+  uint64_t pos=0;
+  unsigned int i;
+  int read_error=0;
+  if(fflush(f_out)!=0)
+    return -2;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.fd=fileno(f_out);
+#ifdef HAVE_PWRITE
+  ctx.use_pwrite=1;
+#endif
+  for(i=0; i<FEXTENT_BUFFERS; i++)
+  {
+    ctx.buffers[i].data=(unsigned char *)MALLOC(FEXTENT_READ_SIZE);
+    ctx.buffers[i].state=FEXTENT_FREE;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&ctx.mutex, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+  ctx.thread_ok=(pthread_create(&ctx.thread, NULL, &fextent_writer, &ctx)==0);
+#endif
+  fextent_advise(disk, list, 0, file_size);
+  for(i=0; i<=list->nbr && pos < file_size && ctx.write_error==0; i++)
+  {
+    /* The hole before the extent, then the extent */
+    const uint64_t start=(i < list->nbr && list->extents[i].file_offset < file_size ? list->extents[i].file_offset : file_size);
+    const uint64_t end=(i < list->nbr && list->extents[i].file_offset + list->extents[i].size < file_size ? list->extents[i].file_offset + list->extents[i].size : file_size);
+    fextent_advise(disk, list, i + 1, file_size);
+#if !defined(HAVE_FTRUNCATE)
+    while(pos < start && ctx.write_error==0)
+    {
+      const unsigned int size=(start - pos < FEXTENT_READ_SIZE ? start - pos : FEXTENT_READ_SIZE);
+      fextent_queue(&ctx, disk, pos, 0, size, 1);
+      pos+=size;
+    }
+#endif
+    if(pos < start)
+      pos=start;
+    while(pos < end && ctx.write_error==0)
+    {
+      const unsigned int size=(end - pos < FEXTENT_READ_SIZE ? end - pos : FEXTENT_READ_SIZE);
+      if(fextent_queue(&ctx, disk, pos, list->extents[i].disk_offset + (pos - list->extents[i].file_offset), size, 0) < 0)
+	read_error=1;
+      pos+=size;
+    }
+  }
+  fextent_flush(&ctx);
+#ifdef HAVE_PTHREAD
+  if(ctx.thread_ok)
+  {
+    pthread_mutex_lock(&ctx.mutex);
+    ctx.quit=1;
+    pthread_cond_broadcast(&ctx.cond);
+    pthread_mutex_unlock(&ctx.mutex);
+    pthread_join(ctx.thread, NULL);
+  }
+  pthread_cond_destroy(&ctx.cond);
+  pthread_mutex_destroy(&ctx.mutex);
+#endif
+  for(i=0; i<FEXTENT_BUFFERS; i++)
+    free(ctx.buffers[i].data);
+#if defined(HAVE_FTRUNCATE)
+  /* The holes at the end of the file */
+  if(ctx.write_error==0 && ftruncate(ctx.fd, file_size)<0)
+  {
+    log_error("fextent_copy ftruncate() failed: %s\n", strerror(errno));
+    ctx.write_error=1;
+  }
+#endif
+  if(ctx.write_error!=0)
+    return -2;
+  return (read_error!=0 ? -1 : 0);
+}
@@ -0,0 +1,79 @@
+/*
+
+    File: fextent.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _FEXTENT_H
+#define _FEXTENT_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Copy of a file from its extents: once the filesystem code has resolved
+ * where the data of the file is, the data is read straight from the disk
+ * by large sequential reads while the previous buffer is written.
+ * The parts of the file not covered by an extent are holes. */
+struct fextent
+{
+  uint64_t file_offset;
+  uint64_t disk_offset;		/* offset from the start of the disk */
+  uint64_t size;
+};
+
+typedef struct
+{
+  struct fextent *extents;
+  unsigned int nbr;
+  unsigned int max;
+} fextent_list_t;
+
+/*@
+  @ requires \valid(list);
+  @ assigns *list;
+  @*/
+void fextent_init(fextent_list_t *list);
+
+/* Extents must be added in file order, an extent contiguous with the
+ * previous one on the disk is merged */
+/*@
+  @ requires \valid(list);
+  @*/
+void fextent_add(fextent_list_t *list, const uint64_t file_offset, const uint64_t disk_offset, const uint64_t size);
+
+/*@
+  @ requires \valid(list);
+  @*/
+void fextent_free(fextent_list_t *list);
+
+/* Write the file_size bytes of the file to f_out, an empty file just
+ * created: the holes are left unwritten. The data beyond file_size is
+ * ignored. A range that can't be read is filled by zeroes.
+ * Return 0, -1 if a read has failed, -2 if a write has failed */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid_read(list);
+  @ requires \valid(f_out);
+  @*/
+int fextent_copy(disk_t *disk, const fextent_list_t *list, const uint64_t file_size, FILE *f_out);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -27,6 +27,9 @@
 #ifdef DISABLED_FOR_FRAMAC
 #undef HAVE_FTELLO
 #endif
+#if defined(DISABLED_FOR_FRAMAC) || defined(__AFL_COMPILER) || !defined(HAVE_SYS_WAIT_H)
+#undef HAVE_FORK
+#endif
 
 #include <stdio.h>
 #ifdef HAVE_STDLIB_H
@@ -48,6 +51,14 @@
 #include <unistd.h>
 #endif
 #include <dirent.h>
+#ifdef HAVE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+#include <errno.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
@@ -65,6 +76,8 @@ extern file_check_list_t file_check_list;
 #define READ_SIZE 1024*512
 #define OPT_CHECK 1
 #define OPT_TIME  2
+#define OPT_QUICK 4
+#define FID_RESULT_SIZE 512
 
 /*@
   @ requires file_recovery->data_check != &data_check_wrapper;
@@ -259,19 +272,41 @@ static data_check_t data_check(file_recovery_t *file_recovery, const unsigned in
   return res;
 }
 
+/*@
+  @ requires valid_read_string(result);
+  @ requires \valid(result + (0 .. result_size-1));
+  @ requires valid_read_string(str);
+  @ requires \separated(result + (..), str + (..));
+  @ assigns result[0 .. result_size-1];
+  @*/
+static void fid_strcat(char *result, const unsigned int result_size, const char *str)
+{
+  const size_t len=strlen(result);
+  if(len + 1 < result_size)
+    strncat(result, str, result_size - len - 1);
+}
+
+/* Identify filename and store its type, size and date in result.
+ * Returns -1 if the file can't be read. */
 /*@
   @ requires valid_read_string(filename);
-  @ requires \separated(filename + (..), &errno, &Frama_C_entropy_source, stdout);
+  @ requires result_size > 0;
+  @ requires \valid(result + (0 .. result_size-1));
+  @ requires \separated(filename + (..), result + (..), &errno, &Frama_C_entropy_source, stdout);
   @ terminates \false;
   @ decreases 0;
   @*/
-static int file_identify(const char *filename, const unsigned int options)
+static int file_identify(const char *filename, const unsigned int options, char *result, const unsigned int result_size)
 {
+  /* Header checks only look at the first block; unless --check needs the
+   * data, there is no point in reading more than two blocks */
+  const unsigned int read_size=((options&OPT_QUICK)!=0 ? 2*65536 : READ_SIZE);
   const unsigned int blocksize=65536;
   /*@ assert blocksize <= READ_SIZE; */
   const unsigned int buffer_size=blocksize + READ_SIZE;
   unsigned char *buffer_start;
   unsigned char *buffer;
+  int res=-1;
   buffer_start=(unsigned char *)MALLOC(buffer_size);
   buffer=buffer_start + blocksize;
 #ifdef __AFL_COMPILER
@@ -285,12 +320,16 @@ static int file_identify(const char *filename, const unsigned int options)
       free(buffer_start);
       return -1;
     }
-    if(fread(buffer, 1, READ_SIZE, file) >0)
+    result[0]='\0';
+    if(read_size < READ_SIZE)
+      memset(&buffer[read_size], 0, READ_SIZE - read_size);
+    if(fread(buffer, 1, read_size, file) >0)
     {
       const struct td_list_head *tmpl;
       file_recovery_t file_recovery_new;
       file_recovery_t file_recovery;
       off_t file_size=0;
+      res=0;
 #if defined(__FRAMAC__)
       Frama_C_make_unknown((char *)buffer, READ_SIZE);
 #endif
@@ -404,20 +443,24 @@ static int file_identify(const char *filename, const unsigned int options)
       }
       if(file_recovery_new.file_stat!=NULL && file_recovery_new.file_stat->file_hint!=NULL)
       {
-	printf("%s: %s", filename,
+	fid_strcat(result, result_size,
 	    ((file_recovery_new.extension!=NULL && file_recovery_new.extension[0]!='\0')?
 	     file_recovery_new.extension:file_recovery_new.file_stat->file_hint->description));
 	if((options&OPT_CHECK)!=0 && (file_recovery_new.file_check!=NULL || file_recovery_new.data_check!=NULL))
 	{
+	  char outstr[80];
 	  if(file_recovery_new.file_size == file_size)
-	    printf(" file_size=%llu", (long long unsigned)file_recovery_new.file_size);
+	    snprintf(outstr, sizeof(outstr), " file_size=%llu", (long long unsigned)file_recovery_new.file_size);
 	  else
-	    printf(" file_size=%llu (FIXME: original=%llu)", (long long unsigned)file_recovery_new.file_size, (long long unsigned)file_size);
+	    snprintf(outstr, sizeof(outstr), " file_size=%llu (FIXME: original=%llu)", (long long unsigned)file_recovery_new.file_size, (long long unsigned)file_size);
+	  fid_strcat(result, result_size, outstr);
 	}
 	if((options&OPT_TIME)!=0 && file_recovery_new.time!=0 && file_recovery_new.time!=(time_t)-1)
 #ifdef DISABLED_FOR_FRAMAC
 	{
-	  printf(" time=%lld", (long long)file_recovery_new.time);
+	  char outstr[40];
+	  snprintf(outstr, sizeof(outstr), " time=%lld", (long long)file_recovery_new.time);
+	  fid_strcat(result, result_size, outstr);
 	}
 #else
 	{
@@ -429,11 +472,10 @@ static int file_identify(const char *filename, const unsigned int options)
 	  const struct tm *tmp = localtime_r(&file_recovery_new.time,&tm_tmp);
 #endif
 	  if(tmp != NULL &&
-	      strftime(outstr, sizeof(outstr), "%Y-%m-%dT%H:%M:%S%z", tmp) != 0)
-	    printf(" time=%s", &outstr[0]);
+	      strftime(outstr, sizeof(outstr), " time=%Y-%m-%dT%H:%M:%S%z", tmp) != 0)
+	    fid_strcat(result, result_size, outstr);
 	}
 #endif
-	printf("\n");
 #ifdef __FRAMAC__
 	if(file_recovery_new.file_rename!=NULL && file_recovery_new.filename[0]!='\0')
 	{
@@ -443,15 +485,329 @@ static int file_identify(const char *filename, const unsigned int options)
       }
       else
       {
-	printf("%s: unknown\n", filename);
+	fid_strcat(result, result_size, "unknown");
       }
     }
     fclose(file);
   }
   free(buffer_start);
+  return res;
+}
+
+#ifdef HAVE_FORK
+#define FID_MAX_WORKERS	64
+/* Paths in flight per worker, it bounds the memory used by the queue and
+ * keeps the request pipe from filling up */
+#define FID_QUEUE_SIZE	8
+
+/* The header and data checks keep some state in static variables, so the
+ * files are identified by worker processes instead of threads. */
+typedef struct
+{
+  pid_t pid;
+  int fd_request;
+  int fd_result;
+  unsigned int first;
+  unsigned int pending;
+  char *path[FID_QUEUE_SIZE];
+} fid_worker_t;
+
+static fid_worker_t fid_workers[FID_MAX_WORKERS];
+static unsigned int fid_nbr_workers=0;
+static unsigned int fid_unordered=0;
+static uint64_t fid_submitted=0;
+static uint64_t fid_collected=0;
+
+static int fid_write(const int fd, const void *buf, size_t size)
+{
+  const char *ptr=(const char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=write(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
   return 0;
 }
 
+static int fid_read(const int fd, void *buf, size_t size)
+{
+  char *ptr=(char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=read(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
+  return 0;
+}
+
+static void fid_worker_loop(const int fd_request, const int fd_result, const unsigned int options)
+{
+  char result[FID_RESULT_SIZE];
+  uint32_t len;
+  while(fid_read(fd_request, &len, sizeof(len))==0)
+  {
+    char *filename=(char *)MALLOC(len+1);
+    int32_t status;
+    uint32_t result_len=0;
+    if(fid_read(fd_request, filename, len) < 0)
+    {
+      free(filename);
+      return;
+    }
+    filename[len]='\0';
+    status=file_identify(filename, options, result, sizeof(result));
+    free(filename);
+    if(status==0)
+      result_len=strlen(result);
+    if(fid_write(fd_result, &status, sizeof(status)) < 0 ||
+	fid_write(fd_result, &result_len, sizeof(result_len)) < 0 ||
+	fid_write(fd_result, result, result_len) < 0)
+      return;
+  }
+}
+
+static void fid_worker_stop(fid_worker_t *worker)
+{
+  int status;
+  if(worker->pid <= 0)
+    return;
+  close(worker->fd_request);
+  close(worker->fd_result);
+  while(waitpid(worker->pid, &status, 0) < 0 && errno==EINTR);
+  worker->pid=0;
+}
+
+static unsigned int fid_pool_start(const unsigned int workers, const unsigned int options)
+{
+  unsigned int i;
+  fflush(stdout);
+  log_flush();
+  for(i=0; i<workers && i<FID_MAX_WORKERS; i++)
+  {
+    fid_worker_t *worker=&fid_workers[i];
+    int fd_request[2];
+    int fd_result[2];
+    pid_t pid;
+    if(pipe(fd_request) < 0)
+      break;
+    if(pipe(fd_result) < 0)
+    {
+      close(fd_request[0]);
+      close(fd_request[1]);
+      break;
+    }
+    pid=fork();
+    if(pid < 0)
+    {
+      close(fd_request[0]);
+      close(fd_request[1]);
+      close(fd_result[0]);
+      close(fd_result[1]);
+      break;
+    }
+    if(pid==0)
+    {
+      unsigned int j;
+      for(j=0; j<i; j++)
+      {
+	close(fid_workers[j].fd_request);
+	close(fid_workers[j].fd_result);
+      }
+      close(fd_request[1]);
+      close(fd_result[0]);
+      fid_worker_loop(fd_request[0], fd_result[1], options);
+      log_flush();
+      _exit(0);
+    }
+    close(fd_request[0]);
+    close(fd_result[1]);
+    memset(worker, 0, sizeof(*worker));
+    worker->pid=pid;
+    worker->fd_request=fd_request[1];
+    worker->fd_result=fd_result[0];
+  }
+  if(i < workers)
+    log_warning("fidentify: %u worker(s) started instead of %u\n", i, workers);
+  fid_nbr_workers=i;
+  return i;
+}
+
+/* Print the result of the oldest path queued to this worker. If the worker
+ * is gone, the file it was working on is skipped and the remaining ones are
+ * identified by the main process. */
+static void fid_pool_collect(fid_worker_t *worker, const unsigned int options)
+{
+  char result[FID_RESULT_SIZE];
+  char *filename=worker->path[worker->first];
+  int32_t status=-1;
+  if(worker->pid > 0)
+  {
+    uint32_t len;
+    if(fid_read(worker->fd_result, &status, sizeof(status)) < 0 ||
+	fid_read(worker->fd_result, &len, sizeof(len)) < 0 ||
+	len >= FID_RESULT_SIZE ||
+	fid_read(worker->fd_result, result, len) < 0)
+    {
+      log_error("fidentify: worker %d stopped while identifying %s\n", (int)worker->pid, filename);
+      fid_worker_stop(worker);
+      status=-1;
+    }
+    else
+      result[len]='\0';
+  }
+  else
+    status=file_identify(filename, options, result, sizeof(result));
+  if(status==0)
+    printf("%s: %s\n", filename, result);
+  free(filename);
+  worker->path[worker->first]=NULL;
+  worker->first=(worker->first + 1) % FID_QUEUE_SIZE;
+  worker->pending--;
+  fid_collected++;
+}
+
+/* Print at least one result, whichever worker finishes first */
+static void fid_pool_wait(const unsigned int options)
+{
+  unsigned int i;
+  fid_worker_t *oldest=NULL;
+#ifdef HAVE_SYS_SELECT_H
+  fd_set rfds;
+  int fd_max=-1;
+  FD_ZERO(&rfds);
+#endif
+  for(i=0; i<fid_nbr_workers; i++)
+  {
+    fid_worker_t *worker=&fid_workers[i];
+    if(worker->pending==0)
+      continue;
+    if(worker->pid <= 0)
+    {
+      fid_pool_collect(worker, options);
+      return;
+    }
+    if(oldest==NULL)
+      oldest=worker;
+#ifdef HAVE_SYS_SELECT_H
+    FD_SET(worker->fd_result, &rfds);
+    if(fd_max < worker->fd_result)
+      fd_max=worker->fd_result;
+#endif
+  }
+  if(oldest==NULL)
+    return;
+#ifdef HAVE_SYS_SELECT_H
+  if(select(fd_max+1, &rfds, NULL, NULL, NULL) > 0)
+  {
+    for(i=0; i<fid_nbr_workers; i++)
+    {
+      fid_worker_t *worker=&fid_workers[i];
+      if(worker->pending > 0 && worker->pid > 0 && FD_ISSET(worker->fd_result, &rfds))
+	fid_pool_collect(worker, options);
+    }
+    return;
+  }
+#endif
+  fid_pool_collect(oldest, options);
+}
+
+static fid_worker_t *fid_pool_idle(void)
+{
+  unsigned int i;
+  fid_worker_t *best=NULL;
+  for(i=0; i<fid_nbr_workers; i++)
+  {
+    fid_worker_t *worker=&fid_workers[i];
+    if(worker->pid > 0 && worker->pending < FID_QUEUE_SIZE &&
+	(best==NULL || worker->pending < best->pending))
+      best=worker;
+  }
+  if(best==NULL && fid_workers[0].pid <= 0 && fid_workers[0].pending < FID_QUEUE_SIZE)
+    return &fid_workers[0];
+  return best;
+}
+
+/* In ordered mode, paths are dealt round-robin and the results are read back
+ * in the same order, so the output matches the serial one. */
+static void fid_pool_submit(const char *filename, const unsigned int options)
+{
+  fid_worker_t *worker;
+  const uint32_t len=strlen(filename);
+  char *path;
+  if(fid_unordered==0)
+  {
+    worker=&fid_workers[fid_submitted % fid_nbr_workers];
+    while(worker->pending >= FID_QUEUE_SIZE)
+      fid_pool_collect(&fid_workers[fid_collected % fid_nbr_workers], options);
+  }
+  else
+  {
+    while((worker=fid_pool_idle())==NULL)
+      fid_pool_wait(options);
+  }
+  path=(char *)MALLOC(len+1);
+  memcpy(path, filename, len+1);
+  worker->path[(worker->first + worker->pending) % FID_QUEUE_SIZE]=path;
+  worker->pending++;
+  fid_submitted++;
+  if(worker->pid > 0 &&
+      (fid_write(worker->fd_request, &len, sizeof(len)) < 0 ||
+       fid_write(worker->fd_request, filename, len) < 0))
+  {
+    log_error("fidentify: worker %d can't be reached\n", (int)worker->pid);
+    fid_worker_stop(worker);
+  }
+}
+
+static void fid_pool_stop(const unsigned int options)
+{
+  unsigned int i;
+  if(fid_unordered==0)
+  {
+    while(fid_collected < fid_submitted)
+      fid_pool_collect(&fid_workers[fid_collected % fid_nbr_workers], options);
+  }
+  else
+  {
+    while(fid_collected < fid_submitted)
+      fid_pool_wait(options);
+  }
+  for(i=0; i<fid_nbr_workers; i++)
+    fid_worker_stop(&fid_workers[i]);
+  fid_nbr_workers=0;
+}
+#endif
+
+/*@
+  @ requires valid_read_string(filename);
+  @ requires \separated(filename + (..), &errno, &Frama_C_entropy_source, stdout);
+  @ terminates \false;
+  @ decreases 0;
+  @*/
+static void file_identify_print(const char *filename, const unsigned int options)
+{
+  char result[FID_RESULT_SIZE];
+#ifdef HAVE_FORK
+  if(fid_nbr_workers > 0)
+  {
+    fid_pool_submit(filename, options);
+    return;
+  }
+#endif
+  if(file_identify(filename, options, result, sizeof(result))==0)
+    printf("%s: %s\n", filename, result);
+}
+
 #if !defined(__AFL_COMPILER) && !defined(DISABLED_FOR_FRAMAC)
 static void file_identify_dir(const char *current_dir, const unsigned int options)
 {
@@ -478,7 +834,7 @@ static void file_identify_dir(const char *current_dir, const unsigned int option
 	  if(S_ISDIR(buf_stat.st_mode))
 	    file_identify_dir(current_file, options);
 	  else if(S_ISREG(buf_stat.st_mode))
-	    file_identify(current_file, options);
+	    file_identify_print(current_file, options);
 	}
       free(current_file);
     }
@@ -489,11 +845,15 @@ static void file_identify_dir(const char *current_dir, const unsigned int option
 
 static void display_help(void)
 {
-  printf("\nUsage: fidentify [--check] [+file_format] [directory|file]\n"\
+  printf("\nUsage: fidentify [--check] [--time] [--quick] [--jobs N [--unordered]] [+file_format] [directory|file]\n"\
       "       fidentify --version\n" \
       "\n" \
       "fidentify determines the file type, the 'extension', by using the same database as PhotoRec.\n"
-      "By default, all known file formats are searched unless one is specifically enabled.");
+      "By default, all known file formats are searched unless one is specifically enabled.\n"
+      "\n" \
+      "--quick       only read the first 128 KiB of each file unless --check needs more\n" \
+      "--jobs N      identify the files using N worker processes\n" \
+      "--unordered   with --jobs, print the results as soon as they are available\n");
 }
 
 static void display_version(void)
@@ -529,6 +889,8 @@ int main(int argc, char **argv)
   int log_errno=0;
   int enable_all_formats=1;
   int scan_dir=1;
+  int jobs=1;
+  unsigned int unordered=0;
   file_stat_t *file_stats;
   log_set_levels(LOG_LEVEL_DEBUG|LOG_LEVEL_TRACE|LOG_LEVEL_QUIET|LOG_LEVEL_INFO|LOG_LEVEL_VERBOSE|LOG_LEVEL_PROGRESS|LOG_LEVEL_WARNING|LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL);
 #ifndef DISABLED_FOR_FRAMAC
@@ -542,6 +904,19 @@ int main(int argc, char **argv)
     {
       options|=OPT_TIME;
     }
+    else if( strcmp(argv[i], "/quick")==0 || strcmp(argv[i], "-quick")==0 || strcmp(argv[i], "--quick")==0)
+    {
+      options|=OPT_QUICK;
+    }
+    else if( strcmp(argv[i], "/unordered")==0 || strcmp(argv[i], "-unordered")==0 || strcmp(argv[i], "--unordered")==0)
+    {
+      unordered=1;
+    }
+    else if( i+1<argc &&
+	(strcmp(argv[i], "/jobs")==0 || strcmp(argv[i], "-jobs")==0 || strcmp(argv[i], "--jobs")==0))
+    {
+      jobs=atoi(argv[++i]);
+    }
     else if(strcmp(argv[i],"/help")==0 || strcmp(argv[i],"-help")==0 || strcmp(argv[i],"--help")==0 ||
       strcmp(argv[i],"/h")==0 || strcmp(argv[i],"-h")==0 ||
       strcmp(argv[i],"/?")==0 || strcmp(argv[i],"-?")==0)
@@ -595,14 +970,29 @@ int main(int argc, char **argv)
       file_enable->enable=1;
   }
   file_stats=init_file_stats(array_file_enable);
+#ifdef HAVE_FORK
+  fid_unordered=unordered;
+  if(jobs > 1)
+    fid_pool_start(jobs, options);
+#else
+  (void)jobs;
+  (void)unordered;
+#endif
 #ifndef DISABLED_FOR_FRAMAC
   for(i=1; i<argc; i++)
   {
     if(strcmp(argv[i], "/check")==0 || strcmp(argv[i], "-check")==0 || strcmp(argv[i], "--check")==0 ||
 	strcmp(argv[i], "/time")==0 || strcmp(argv[i], "-time")==0 || strcmp(argv[i], "--time")==0 ||
+	strcmp(argv[i], "/quick")==0 || strcmp(argv[i], "-quick")==0 || strcmp(argv[i], "--quick")==0 ||
+	strcmp(argv[i], "/unordered")==0 || strcmp(argv[i], "-unordered")==0 || strcmp(argv[i], "--unordered")==0 ||
 	argv[i][0]=='+')
     {
     }
+    else if(i+1<argc &&
+	(strcmp(argv[i], "/jobs")==0 || strcmp(argv[i], "-jobs")==0 || strcmp(argv[i], "--jobs")==0))
+    {
+      i++;
+    }
     else
     {
       struct stat buf_stat;
@@ -614,7 +1004,7 @@ int main(int argc, char **argv)
 #endif
 	{
 	  if(S_ISREG(buf_stat.st_mode))
-	    file_identify(argv[i], options);
+	    file_identify_print(argv[i], options);
 #ifndef __AFL_COMPILER
 	  else if(S_ISDIR(buf_stat.st_mode))
 	    file_identify_dir(argv[i], options);
@@ -627,7 +1017,11 @@ int main(int argc, char **argv)
     file_identify_dir(".", options);
 #endif
 #else
-  file_identify("demo", options);
+  file_identify_print("demo", options);
+#endif
+#ifdef HAVE_FORK
+  if(fid_nbr_workers > 0)
+    fid_pool_stop(options);
 #endif
   free_header_check();
   free(file_stats);
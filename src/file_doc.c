@@ -88,6 +88,67 @@ static const char *extension_xlr="xlr";
 static const char *extension_xls="xls";
 static const char *extension_wdb="wdb";
 
+#ifndef DISABLED_FOR_FRAMAC
+/* The FAT and directory sectors of the compound file being recovered are
+ * kept while the blocks are written: file_check_doc() and file_rename_doc()
+ * read them from memory instead of seeking in the recovered file. The
+ * other sectors are still read from the file. */
+#define OLE_CAPTURE_FAT	109
+#define OLE_CAPTURE_DIR	64
+#define OLE_CAPTURE_MAX	(OLE_CAPTURE_FAT+OLE_CAPTURE_DIR)
+
+typedef struct
+{
+  uint32_t block;
+  unsigned int filled;
+} ole_capture_slot_t;
+
+typedef struct
+{
+  char filename[2048];
+  int valid;
+  uint64_t file_size;
+  /* Only the sectors ending before limit are used */
+  uint64_t limit;
+  unsigned int uSectorShift;
+  unsigned int num_FAT_blocks;
+  uint32_t dif[OLE_CAPTURE_FAT];
+  uint32_t dir_next;
+  unsigned int dir_nbr;
+  unsigned int slots_nbr;
+  ole_capture_slot_t slots[OLE_CAPTURE_MAX];
+  unsigned char *data;
+  int checked;
+} ole_capture_t;
+
+static TD_THREAD_LOCAL ole_capture_t ole_capture;
+static TD_THREAD_LOCAL const ole_capture_t *ole_capture_active=NULL;
+
+/* Returns the slot holding block, -1 if the block isn't captured */
+static int ole_capture_slot(const ole_capture_t *cap, const uint32_t block)
+{
+  unsigned int i;
+  for(i=0; i<cap->slots_nbr; i++)
+    if(cap->slots[i].block==block)
+      return i;
+  return -1;
+}
+
+static int ole_capture_read(char *buf, const uint32_t block, const uint64_t offset)
+{
+  const ole_capture_t *cap=ole_capture_active;
+  const unsigned int size=1<<cap->uSectorShift;
+  int i;
+  if(offset!=0 || ((uint64_t)(2+block)<<cap->uSectorShift) > cap->limit)
+    return -1;
+  i=ole_capture_slot(cap, block);
+  if(i<0 || cap->slots[i].filled!=size)
+    return -1;
+  memcpy(buf, &cap->data[i<<cap->uSectorShift], size);
+  return 0;
+}
+#endif
+
 /*@
   @ requires \valid(IN);
   @ requires (9 == uSectorShift) || (12 == uSectorShift);
@@ -105,6 +166,11 @@ static int OLE_read_block(FILE *IN, char *buf, const unsigned int uSectorShift,
   /*@ assert size == 1<<uSectorShift; */
   if(block==0xFFFFFFFF || block==0xFFFFFFFE)
     return -1;
+#ifndef DISABLED_FOR_FRAMAC
+  if(ole_capture_active!=NULL && ole_capture_active->uSectorShift==uSectorShift &&
+      ole_capture_read(buf, block, offset)==0)
+    return 0;
+#endif
   if(my_fseek(IN, offset + ((uint64_t)(1+block)<<uSectorShift), SEEK_SET) < 0)
   {
     return -1;
@@ -414,6 +480,107 @@ const char WilcomDesignInformationDDD[56]=
   'D', '\0', 'D', '\0', 'D', '\0', '\0', '\0'
 };
 
+#ifndef DISABLED_FOR_FRAMAC
+static void ole_capture_add(ole_capture_t *cap, const uint32_t block)
+{
+  if(block >= 0xFFFFFFFA || cap->slots_nbr >= OLE_CAPTURE_MAX ||
+      ole_capture_slot(cap, block) >= 0)
+    return ;
+  cap->slots[cap->slots_nbr].block=block;
+  cap->slots[cap->slots_nbr].filled=0;
+  cap->slots_nbr++;
+}
+
+/* Next sector of the directory chain, guess the following sector if the
+ * FAT sector isn't available yet */
+static uint32_t ole_capture_next(const ole_capture_t *cap, const uint32_t block)
+{
+  const unsigned int entries=(1<<cap->uSectorShift)/4;
+  const unsigned int j=block/entries;
+  if(j < cap->num_FAT_blocks && j < OLE_CAPTURE_FAT)
+  {
+    const int i=ole_capture_slot(cap, cap->dif[j]);
+    if(i >= 0 && cap->slots[i].filled==(1U<<cap->uSectorShift))
+    {
+      const uint32_t *fat=(const uint32_t *)&cap->data[i<<cap->uSectorShift];
+      return le32(fat[block%entries]);
+    }
+  }
+  return block+1;
+}
+
+static data_check_t data_check_doc(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  ole_capture_t *cap=&ole_capture;
+  const unsigned int half=buffer_size/2;
+  uint64_t pos;
+  if(file_recovery->file_size==0)
+  {
+    /* First block of a new file, it begins with the header */
+    const struct OLE_HDR *header=(const struct OLE_HDR *)&buffer[half];
+    const uint32_t *dif=(const uint32_t *)(header+1);
+    unsigned int j;
+    strncpy(cap->filename, file_recovery->filename, sizeof(cap->filename)-1);
+    cap->filename[sizeof(cap->filename)-1]='\0';
+    cap->checked=0;
+    cap->uSectorShift=le16(header->uSectorShift);
+    cap->num_FAT_blocks=le32(header->num_FAT_blocks);
+    cap->dir_next=le32(header->root_start_block);
+    cap->dir_nbr=0;
+    cap->slots_nbr=0;
+    cap->valid=(cap->uSectorShift==9 || cap->uSectorShift==12);
+    if(cap->valid==0)
+      return DC_CONTINUE;
+    if(cap->data==NULL)
+      cap->data=(unsigned char *)MALLOC(OLE_CAPTURE_MAX<<12);
+    for(j=0; j<cap->num_FAT_blocks && j<OLE_CAPTURE_FAT; j++)
+    {
+      cap->dif[j]=le32(dif[j]);
+      ole_capture_add(cap, cap->dif[j]);
+    }
+  }
+  else if(cap->valid==0 ||
+      cap->file_size!=file_recovery->file_size ||
+      strcmp(cap->filename, file_recovery->filename)!=0)
+  {
+    /* The data are not written one block after the other, ie. brute force */
+    cap->valid=0;
+    return DC_CONTINUE;
+  }
+  cap->file_size=file_recovery->file_size + half;
+  for(pos=file_recovery->file_size; pos < cap->file_size; )
+  {
+    const unsigned int size=1<<cap->uSectorShift;
+    const uint64_t sector=pos>>cap->uSectorShift;
+    const unsigned int in_sector=pos & (size-1);
+    const unsigned int len=(cap->file_size - pos < size - in_sector ?
+	cap->file_size - pos : size - in_sector);
+    if(sector > 0 && sector-1 < 0xFFFFFFFA)
+    {
+      const uint32_t block=sector-1;
+      int i=ole_capture_slot(cap, block);
+      if(i < 0 && block==cap->dir_next && in_sector==0 &&
+	  cap->dir_nbr < OLE_CAPTURE_DIR)
+      {
+	ole_capture_add(cap, block);
+	i=ole_capture_slot(cap, block);
+	cap->dir_nbr++;
+      }
+      if(i >= 0 && cap->slots[i].filled==in_sector)
+      {
+	memcpy(&cap->data[(i<<cap->uSectorShift) + in_sector],
+	    &buffer[half + pos - file_recovery->file_size], len);
+	cap->slots[i].filled+=len;
+	if(cap->slots[i].filled==size && block==cap->dir_next)
+	  cap->dir_next=ole_capture_next(cap, block);
+      }
+    }
+    pos+=len;
+  }
+  return DC_CONTINUE;
+}
+#endif
+
 /*@
   @ requires file_recovery->file_check == &file_check_doc;
   @ requires valid_file_check_param(file_recovery);
@@ -421,7 +588,26 @@ const char WilcomDesignInformationDDD[56]=
   @*/
 static void file_check_doc(file_recovery_t *file_recovery)
 {
+#ifndef DISABLED_FOR_FRAMAC
+  ole_capture.checked=0;
+  if(ole_capture.valid!=0 &&
+      ole_capture.file_size==file_recovery->file_size &&
+      strcmp(ole_capture.filename, file_recovery->filename)==0)
+  {
+    ole_capture.limit=file_recovery->file_size;
+    ole_capture_active=&ole_capture;
+  }
+#endif
   file_check_doc_aux(file_recovery, 0);
+#ifndef DISABLED_FOR_FRAMAC
+  if(ole_capture_active!=NULL)
+  {
+    /* Keep the sectors for file_rename_doc(), the file is truncated */
+    ole_capture.limit=file_recovery->file_size;
+    ole_capture.checked=1;
+  }
+  ole_capture_active=NULL;
+#endif
 }
 
 /*@
@@ -1553,11 +1739,10 @@ static void OLE_parse_summary(FILE *file, const uint32_t *fat, const unsigned in
 }
 
 /*@
-  @ requires file_recovery->file_rename==&file_rename_doc;
   @ requires valid_file_rename_param(file_recovery);
   @ ensures  valid_file_rename_result(file_recovery);
   @*/
-static void file_rename_doc(file_recovery_t *file_recovery)
+static void file_rename_doc_aux(file_recovery_t *file_recovery)
 {
   const char *ext=NULL;
   char title[1024];
@@ -1805,6 +1990,25 @@ static void file_rename_doc(file_recovery_t *file_recovery)
     file_rename(file_recovery, NULL, 0, 0, ext, 1);
 }
 
+/*@
+  @ requires file_recovery->file_rename==&file_rename_doc;
+  @ requires valid_file_rename_param(file_recovery);
+  @ ensures  valid_file_rename_result(file_recovery);
+  @*/
+static void file_rename_doc(file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(ole_capture.checked!=0 &&
+      strcmp(ole_capture.filename, file_recovery->filename)==0)
+    ole_capture_active=&ole_capture;
+  ole_capture.checked=0;
+#endif
+  file_rename_doc_aux(file_recovery);
+#ifndef DISABLED_FOR_FRAMAC
+  ole_capture_active=NULL;
+#endif
+}
+
 /*@
   @ requires buffer_size >= sizeof(struct OLE_HDR);
   @ requires separation: \separated(&file_hint_doc, buffer, file_recovery, file_recovery_new);
@@ -1819,6 +2023,8 @@ static void file_rename_doc(file_recovery_t *file_recovery)
   @*/
 static int header_check_doc(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
+  static const char *const xls_names[4]={ "Worksheet", "Book", "Workbook", "Calc" };
+  static const unsigned int xls_names_len[4]={ 9, 4, 8, 4 };
   /*@ assert file_recovery->file_stat==\null || valid_read_string((char*)file_recovery->filename); */
   const struct OLE_HDR *header=(const struct OLE_HDR *)buffer;
   /* Check for Little Endian */
@@ -1854,6 +2060,9 @@ static int header_check_doc(const unsigned char *buffer, const unsigned int buff
   reset_file_recovery(file_recovery_new);
   file_recovery_new->file_check=&file_check_doc;
   file_recovery_new->file_rename=&file_rename_doc;
+#ifndef DISABLED_FOR_FRAMAC
+  file_recovery_new->data_check=&data_check_doc;
+#endif
   file_recovery_new->extension=ole_get_file_extension(header, buffer_size);
   if(file_recovery_new->extension!=NULL)
   {
@@ -1888,10 +2097,7 @@ static int header_check_doc(const unsigned char *buffer, const unsigned int buff
   {
     file_recovery_new->extension=extension_sdd;
   }
-  else if(td_memmem(buffer,buffer_size,"Worksheet",9)!=NULL ||
-      td_memmem(buffer,buffer_size,"Book",4)!=NULL ||
-      td_memmem(buffer,buffer_size,"Workbook",8)!=NULL ||
-      td_memmem(buffer,buffer_size,"Calc",4)!=NULL)
+  else if(td_memmem_multi(buffer, buffer_size, xls_names, xls_names_len, 4)!=NULL)
   {
     file_recovery_new->extension=extension_xls;
   }
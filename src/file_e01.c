@@ -35,7 +35,7 @@
 /*@ requires valid_register_header_check(file_stat); */
 static void register_header_check_e01(file_stat_t *file_stat);
 
-static char ext[10];
+static TD_THREAD_LOCAL char ext[10];
 
 const file_hint_t file_hint_e01= {
   .extension="e01",
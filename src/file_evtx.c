@@ -31,6 +31,7 @@
 #include "types.h"
 #include "filegen.h"
 #include "common.h"
+#include "crc.h"
 
 struct evtx_header
 {
@@ -48,6 +49,10 @@ struct evtx_header
   uint32_t Checksum;
 } __attribute__ ((gcc_struct, __packed__));
 
+/* A chunk of 64 KiB holds the event records, its header is 512 bytes */
+#define EVTX_CHUNK_SIZE		(64 * 1024)
+#define EVTX_CHUNK_HEADER_SIZE	0x200
+
 /*@ requires valid_register_header_check(file_stat); */
 static void register_header_check_evtx(file_stat_t *file_stat);
 
@@ -60,6 +65,50 @@ const file_hint_t file_hint_evtx= {
   .register_header_check=&register_header_check_evtx
 };
 
+static const unsigned char evtx_chunk_magic[8]= { 'E', 'l', 'f', 'C', 'h', 'n', 'k', 0x00 };
+
+/*@
+  @ requires \valid_read(header + (0 .. EVTX_CHUNK_HEADER_SIZE-1));
+  @ requires \valid_read(file_recovery);
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t evtx_chunk_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  /* The chunk count of the file header is kept in data_check_tmp */
+  const uint64_t end=(uint64_t)0x1000 + (uint64_t)file_recovery->data_check_tmp * EVTX_CHUNK_SIZE;
+  const uint32_t *checksum=(const uint32_t *)&header[0x7c];
+  uint32_t crc;
+  if(file_recovery->calculated_file_size >= end)
+    return 0;
+  /* The checksum covers the chunk header except the flags and itself */
+  crc=get_crc32(header, 0x78, 0xFFFFFFFF);
+  crc=get_crc32(&header[0x80], EVTX_CHUNK_HEADER_SIZE - 0x80, crc);
+  if((crc ^ 0xFFFFFFFF) != le32(*checksum))
+    return 0;
+  return EVTX_CHUNK_SIZE;
+}
+
+static const file_record_t evtx_chunk_record= {
+  .header_size=EVTX_CHUNK_HEADER_SIZE,
+  .sync=evtx_chunk_magic,
+  .sync_size=sizeof(evtx_chunk_magic),
+  .record_size=&evtx_chunk_size,
+  .invalid=DC_STOP
+};
+
+/*@
+  @ requires file_recovery->data_check==&data_check_evtx;
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @ assigns  file_recovery->calculated_file_size;
+  @*/
+static data_check_t data_check_evtx(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  /* The file ends after the last chunk or before the first corrupted one */
+  return data_check_records(&evtx_chunk_record, buffer, buffer_size, file_recovery);
+}
+
 /*@
   @ requires buffer_size >= sizeof(struct evtx_header);
   @ requires separation: \separated(&file_hint_evtx, buffer+(..), file_recovery, file_recovery_new);
@@ -77,9 +126,16 @@ static int header_check_evtx(const unsigned char *buffer, const unsigned int buf
     return 0;
   reset_file_recovery(file_recovery_new);
   file_recovery_new->extension=file_hint_evtx.extension;
-  file_recovery_new->calculated_file_size=(uint64_t)le16(hdr->HeaderSize) + (uint64_t)le16(hdr->ChunkCount) * 64 * 1024;
+  file_recovery_new->calculated_file_size=(uint64_t)le16(hdr->HeaderSize) + (uint64_t)le16(hdr->ChunkCount) * EVTX_CHUNK_SIZE;
   file_recovery_new->data_check=&data_check_size;
   file_recovery_new->file_check=&file_check_size;
+  if(file_recovery_new->blocksize >= EVTX_CHUNK_HEADER_SIZE)
+  {
+    /* Check the chunks one after the other */
+    file_recovery_new->calculated_file_size=le16(hdr->HeaderSize);
+    file_recovery_new->data_check_tmp=le16(hdr->ChunkCount);
+    file_recovery_new->data_check=&data_check_evtx;
+  }
   return 1;
 }
 
@@ -47,6 +47,36 @@ const file_hint_t file_hint_flac= {
 
 /* https://xiph.org/flac/format.html */
 
+/*@
+  @ requires \valid_read(header + (0 .. 3));
+  @ requires \valid(file_recovery);
+  @ terminates \true;
+  @ assigns  file_recovery->data_check;
+  @*/
+static uint64_t flac_metadata_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  const uint32_t *p32=(const uint32_t *)header;
+  const uint32_t size=be32(*p32)&0x00ffffff;
+#ifdef DEBUG_FLAC
+  log_info("data_check_flac_metadata calculated_file_size=0x%llx: 0x%02x\n",
+      (long long unsigned)file_recovery->calculated_file_size, header[0]);
+#endif
+  if((header[0]&0x7f)==0x7f)
+    return 0;
+  /* Last metadata block, the audio frames are not checked */
+  if((header[0]&0x80)==0x80)
+    file_recovery->data_check=NULL;
+  return (uint64_t)4+size;
+}
+
+static const file_record_t flac_metadata_record= {
+  .header_size=4,
+  .sync=NULL,
+  .sync_size=0,
+  .record_size=&flac_metadata_size,
+  .invalid=DC_ERROR
+};
+
 /*@
   @ requires file_recovery->data_check==&data_check_flac_metadata;
   @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
@@ -56,33 +86,7 @@ const file_hint_t file_hint_flac= {
   @*/
 static data_check_t data_check_flac_metadata(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
-  /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@
-    @ loop assigns file_recovery->calculated_file_size, file_recovery->data_check;
-    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + 4);
-    @*/
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size + 4 < file_recovery->file_size + buffer_size/2)
-  {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i < buffer_size - 4; */
-    const uint32_t *p32=(const uint32_t *)&buffer[i];
-    const uint32_t size=be32(*p32)&0x00ffffff;
-#ifdef DEBUG_FLAC
-    log_info("data_check_flac_metadata calculated_file_size=0x%llx: 0x%02x\n",
-	(long long unsigned)file_recovery->calculated_file_size, buffer[i]);
-#endif
-    if((buffer[i]&0x7f)==0x7f)
-	return DC_ERROR;
-    file_recovery->calculated_file_size+=(uint64_t)4+size;
-    if((buffer[i]&0x80)==0x80)
-    {
-      file_recovery->data_check=NULL;
-      return DC_CONTINUE;
-    }
-  }
-  return DC_CONTINUE;
+  return data_check_records(&flac_metadata_record, buffer, buffer_size, file_recovery);
 }
 
 /*@
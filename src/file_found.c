@@ -41,6 +41,7 @@
 #include "list.h"
 #include "lang.h"
 #include "filegen.h"
+#include "photorec.h"
 #include "file_found.h"
 
 alloc_data_t *file_found(alloc_data_t *current_search_space, const uint64_t offset, file_stat_t *file_stat)
@@ -49,20 +50,21 @@ alloc_data_t *file_found(alloc_data_t *current_search_space, const uint64_t offs
     return current_search_space;
   if(current_search_space->start == offset)
   {
-    current_search_space->file_stat=file_stat;
+    search_space_set_file_stat(current_search_space, file_stat);
     current_search_space->data=1;
     return current_search_space;
   }
   if(current_search_space->start < offset && offset <= current_search_space->end)
   {
     alloc_data_t *next_search_space;
-    next_search_space=(alloc_data_t*)MALLOC(sizeof(*next_search_space));
+    next_search_space=alloc_data_new();
     memcpy(next_search_space, current_search_space, sizeof(*next_search_space));
     current_search_space->end=offset-1;
     next_search_space->start=offset;
-    next_search_space->file_stat=file_stat;
+    next_search_space->file_stat=NULL;
     next_search_space->data=1;
     td_list_add(&next_search_space->list, &current_search_space->list);
+    search_space_set_file_stat(next_search_space, file_stat);
     return next_search_space;
   }
   return current_search_space;
@@ -37,6 +37,8 @@
 #include "file_gz.h"
 
 #ifdef HAVE_ZLIB_H
+/* inflate() reads the data of the file in place */
+#define ZLIB_CONST
 #include <zlib.h>
 #endif
 #if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_gz)
@@ -127,6 +129,108 @@ static void file_check_bgzf(file_recovery_t *file_recovery)
 {
 }
 
+/* With file_deep_check, the stream is inflated as the blocks are written,
+ * zlib checks the CRC-32 and the length of the gzip footer. The inflate
+ * state is allocated once and reset for each file. */
+typedef enum
+{
+  GZ_STREAM_INVALID=0,	/* The blocks haven't been seen one after the other */
+  GZ_STREAM_INFLATE,
+  GZ_STREAM_END
+} gz_stream_status_t;
+
+typedef struct
+{
+  char filename[2048];
+  uint64_t file_size;		/* file size expected by the next call */
+  gz_stream_status_t status;
+  int init;
+  z_stream strm;
+} gz_stream_t;
+
+static TD_THREAD_LOCAL gz_stream_t gz_stream;
+
+static data_check_t data_check_gz(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  gz_stream_t *gs=&gz_stream;
+  unsigned char out[32768];
+  if(file_recovery->file_size==0)
+  {
+    /* First block of a new file */
+    if(gs->init==0)
+    {
+      memset(&gs->strm, 0, sizeof(gs->strm));
+      if(inflateInit2(&gs->strm, 16+MAX_WBITS)!=Z_OK)
+      {
+	gs->status=GZ_STREAM_INVALID;
+	return DC_CONTINUE;
+      }
+      gs->init=1;
+    }
+    else if(inflateReset(&gs->strm)!=Z_OK)
+    {
+      gs->status=GZ_STREAM_INVALID;
+      return DC_CONTINUE;
+    }
+    strncpy(gs->filename, file_recovery->filename, sizeof(gs->filename)-1);
+    gs->filename[sizeof(gs->filename)-1]='\0';
+    gs->status=GZ_STREAM_INFLATE;
+  }
+  else if(gs->status!=GZ_STREAM_INFLATE ||
+      gs->file_size!=file_recovery->file_size ||
+      strcmp(gs->filename, file_recovery->filename)!=0)
+  {
+    /* The data are not written one block after the other, ie. brute force */
+    gs->status=GZ_STREAM_INVALID;
+    return DC_CONTINUE;
+  }
+  gs->file_size=file_recovery->file_size + buffer_size/2;
+  gs->strm.next_in=&buffer[buffer_size/2];
+  gs->strm.avail_in=buffer_size/2;
+  while(gs->strm.avail_in > 0)
+  {
+    int err;
+    gs->strm.next_out=out;
+    gs->strm.avail_out=sizeof(out);
+    err=inflate(&gs->strm, Z_NO_FLUSH);
+    if(err==Z_STREAM_END)
+    {
+      gs->status=GZ_STREAM_END;
+      file_recovery->calculated_file_size=gs->strm.total_in;
+      return DC_STOP;
+    }
+    if(err!=Z_OK)
+    {
+      gs->status=GZ_STREAM_INVALID;
+      file_recovery->offset_error=gs->strm.total_in;
+      return DC_ERROR;
+    }
+  }
+  return DC_CONTINUE;
+}
+
+static void file_check_gz(file_recovery_t *file_recovery)
+{
+  gz_stream_t *gs=&gz_stream;
+  if(gs->status==GZ_STREAM_INVALID ||
+      strcmp(gs->filename, file_recovery->filename)!=0)
+  {
+    /* Stream not checked, keep the checks done without file_deep_check */
+    if(file_recovery->calculated_file_size > 0)
+      file_check_size(file_recovery);
+    return ;
+  }
+  if(gs->status==GZ_STREAM_INFLATE)
+  {
+    /* The end of the stream hasn't been found */
+    gs->status=GZ_STREAM_INVALID;
+    file_recovery->file_size=0;
+    return ;
+  }
+  gs->status=GZ_STREAM_INVALID;
+  file_check_size(file_recovery);
+}
+
 /*@
   @ requires buffer_size >= sizeof(struct gzip_header);
   @ requires \valid_read(buffer+(0..buffer_size-1));
@@ -304,6 +408,11 @@ static int header_check_gz(const unsigned char *buffer, const unsigned int buffe
       file_recovery_new->data_check=&data_check_size;
       file_recovery_new->file_check=&file_check_size;
     }
+    if(file_deep_check > 0)
+    {
+      file_recovery_new->data_check=&data_check_gz;
+      file_recovery_new->file_check=&file_check_gz;
+    }
     if(memcmp(buffer_uncompr, "PVP ", 4)==0)
     {
       /* php Video Pro */
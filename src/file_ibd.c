@@ -70,6 +70,51 @@ struct innodb_fil_header
   uint32_t arch_log_no_or_space_id;
 } __attribute__ ((gcc_struct, __packed__));
 
+#define FSP_FLAGS_ZIP_SSIZE	0x1e		/* compressed pages */
+#define FSP_FLAGS_PAGE_SSIZE_SHIFT 6
+/* Flags of the tablespaces whose pages all start with an uncompressed
+ * FIL header: post-antelope, atomic blobs, page size, data directory,
+ * shared, temporary and SDI */
+#define FSP_FLAGS_PLAIN		(0x1 | 0x20 | 0x3c0 | 0x400 | 0x800 | 0x1000 | 0x4000)
+
+/*@
+  @ requires \valid_read(header + (0 .. sizeof(struct innodb_fil_header)-1));
+  @ requires \valid_read(file_recovery);
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t ibd_page_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  /* The page size is kept in data_check_tmp */
+  const struct innodb_fil_header *hdr=(const struct innodb_fil_header *)header;
+  const uint64_t page_no=file_recovery->calculated_file_size / file_recovery->data_check_tmp;
+  /* Each page records its own number, the pages never written are zeroed */
+  if(be32(hdr->offset)!=page_no &&
+      !(hdr->offset==0 && hdr->lsn==0 && hdr->type==0))
+    return 0;
+  return file_recovery->data_check_tmp;
+}
+
+static const file_record_t ibd_page_record= {
+  .header_size=sizeof(struct innodb_fil_header),
+  .sync=NULL,
+  .sync_size=0,
+  .record_size=&ibd_page_size,
+  .invalid=DC_STOP
+};
+
+/*@
+  @ requires file_recovery->data_check==&data_check_ibd;
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @ assigns  file_recovery->calculated_file_size;
+  @*/
+static data_check_t data_check_ibd(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  /* The file ends before the first page that is not its own */
+  return data_check_records(&ibd_page_record, buffer, buffer_size, file_recovery);
+}
+
 /*@
   @ requires buffer_size >= sizeof(struct innodb_fil_header);
   @ requires buffer_size >  FSP_HEADER_OFFSET + FSP_SPACE_FLAGS;
@@ -110,6 +155,19 @@ static int header_check_ibd(const unsigned char *buffer, const unsigned int buff
   reset_file_recovery(file_recovery_new);
   file_recovery_new->extension=file_hint_ibd.extension;
   file_recovery_new->min_filesize=0xc078;
+  if((flags & ~FSP_FLAGS_PLAIN)==0 && (flags & FSP_FLAGS_ZIP_SSIZE)==0)
+  {
+    const unsigned int ssize=(flags >> FSP_FLAGS_PAGE_SSIZE_SHIFT) & 0xf;
+    /* 16 KiB pages unless the page size is set */
+    const unsigned int page_size=(ssize==0 ? 16384 : 512U << ssize);
+    if(page_size >= 4096 && page_size <= 65536 && file_recovery_new->blocksize >= 512)
+    {
+      file_recovery_new->calculated_file_size=0;
+      file_recovery_new->data_check_tmp=page_size;
+      file_recovery_new->data_check=&data_check_ibd;
+      file_recovery_new->file_check=&file_check_size_max;
+    }
+  }
   return 1;
 }
 
@@ -1058,6 +1058,14 @@ static int header_check_jpg(const unsigned char *buffer, const unsigned int buff
   return 1;
 }
 
+/* Check the pictures at 1/8 scale first, see jpg_check_picture() */
+static unsigned int jpg_scaled_check=0;
+
+void jpg_set_scaled_check(const int enable)
+{
+  jpg_scaled_check=(enable>0 ? 1 : 0);
+}
+
 #if defined(HAVE_LIBJPEG) && defined(HAVE_JPEGLIB_H)
 struct my_error_mgr {
   struct jpeg_error_mgr pub;	/* "public" fields, must be the first field */
@@ -1403,9 +1411,9 @@ static void jpeg_session_start(struct jpeg_session_struct *jpeg_session)
 static uint64_t jpg_xy_to_offset(FILE *infile, const unsigned int x, const unsigned y,
     const uint64_t offset_rel1, const uint64_t offset_rel2, const uint64_t offset, const unsigned int blocksize)
 {
-  static struct my_error_mgr jerr;
-  static uint64_t file_size_max;
-  static struct jpeg_session_struct jpeg_session;
+  static TD_THREAD_LOCAL struct my_error_mgr jerr;
+  static TD_THREAD_LOCAL uint64_t file_size_max;
+  static TD_THREAD_LOCAL struct jpeg_session_struct jpeg_session;
   unsigned int checkpoint_status;
   int avoid_leak;
   jpeg_init_session(&jpeg_session);
@@ -1692,9 +1700,9 @@ static uint64_t jpg_find_error(struct jpeg_session_struct *jpeg_session, const u
 
 static uint64_t jpg_check_thumb(FILE *infile, const uint64_t offset, const unsigned int blocksize, const uint64_t checkpoint_offset, const unsigned int flags)
 {
-  static struct my_error_mgr jerr;
-  static unsigned int offsets[JPG_MAX_OFFSETS];
-  static struct jpeg_session_struct jpeg_session;
+  static TD_THREAD_LOCAL struct my_error_mgr jerr;
+  static TD_THREAD_LOCAL unsigned int offsets[JPG_MAX_OFFSETS];
+  static TD_THREAD_LOCAL struct jpeg_session_struct jpeg_session;
   jpeg_init_session(&jpeg_session);
   jpeg_session.flags=flags;
   jpeg_session.handle=infile;
@@ -1750,13 +1758,163 @@ static uint64_t jpg_check_thumb(FILE *infile, const uint64_t offset, const unsig
   return 0;
 }
 
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+/* Picture decoded by the previous jpg_check_picture() call.
+ * photorec_bf() only rewrites the file after checkpoint_offset between two
+ * candidates, the rows decoded from the data before it are kept and the
+ * decoder skips them instead of doing the IDCT and the color conversion
+ * again. */
+struct jpg_rows_cache
+{
+  unsigned char *frame;
+  FILE *handle;
+  uint64_t start;
+  unsigned int row_stride;
+  unsigned int output_height;
+  unsigned int groups;
+};
+
+static TD_THREAD_LOCAL struct jpg_rows_cache jpg_rows={ NULL, NULL, 0, 0, 0, 0 };
+/* bytes read from the file when the first 8*i rows have been decoded */
+static TD_THREAD_LOCAL uint64_t jpg_rows_read[JPG_MAX_OFFSETS];
+
+static void jpg_rows_free(void)
+{
+  free(jpg_rows.frame);
+  jpg_rows.frame=NULL;
+  jpg_rows.groups=0;
+}
+
+/* Give the frame back to jpg_check_picture() with the first rows already
+ * decoded, returns the number of rows to skip */
+static unsigned int jpg_rows_reuse(const file_recovery_t *file_recovery, struct jpeg_session_struct *jpeg_session, unsigned int *offsets)
+{
+  unsigned int group;
+  unsigned int rows;
+  if(jpg_rows.frame==NULL)
+    return 0;
+  if(file_recovery->checkpoint_offset==0 ||
+      jpg_rows.handle!=file_recovery->handle ||
+      jpg_rows.start!=file_recovery->location.start ||
+      jpg_rows.row_stride!=jpeg_session->row_stride ||
+      jpg_rows.output_height!=jpeg_session->output_height)
+  {
+    jpg_rows_free();
+    return 0;
+  }
+  for(group=jpg_rows.groups;
+      group>0 && jpg_rows_read[group] > file_recovery->checkpoint_offset;
+      group--);
+  rows=group*8;
+  if(rows==0 || rows >= jpeg_session->output_height)
+  {
+    jpg_rows_free();
+    return 0;
+  }
+  jpeg_session->frame=jpg_rows.frame;
+  jpg_rows.frame=NULL;
+  /* 0x100/2=0x80, medium value */
+  memset(jpeg_session->frame + rows * jpeg_session->row_stride, 0x80,
+      (jpeg_session->output_height + 1 - rows) * jpeg_session->row_stride);
+  memset(&offsets[group+1], 0, (JPG_MAX_OFFSETS - group - 1) * sizeof(offsets[0]));
+  jpg_rows.groups=group;
+  return rows;
+}
+
+/* Keep the frame of a corrupted picture for the next candidate */
+static void jpg_rows_keep(const file_recovery_t *file_recovery, struct jpeg_session_struct *jpeg_session)
+{
+  jpg_rows_free();
+  if(jpeg_session->flags==0 || jpeg_session->frame==NULL)
+    return ;
+  jpg_rows.frame=jpeg_session->frame;
+  jpg_rows.handle=file_recovery->handle;
+  jpg_rows.start=file_recovery->location.start;
+  jpg_rows.row_stride=jpeg_session->row_stride;
+  jpg_rows.output_height=jpeg_session->output_height;
+  jpg_rows.groups=jpeg_session->cinfo.output_scanline/8;
+  if(jpg_rows.groups >= JPG_MAX_OFFSETS)
+    jpg_rows.groups=JPG_MAX_OFFSETS-1;
+  jpeg_session->frame=NULL;
+}
+#endif
+
+/* Decode the picture at 1/8 scale: the entropy-coded data is read as
+ * for a full decode but the IDCT and the color conversion only produce
+ * one pixel per block, no frame is kept.
+ * Return the size of the picture, 0 if it is corrupted */
+static uint64_t jpg_check_picture_scaled(const file_recovery_t *file_recovery)
+{
+  static TD_THREAD_LOCAL struct my_error_mgr jerr;
+  static TD_THREAD_LOCAL struct jpeg_session_struct jpeg_session;
+  uint64_t jpeg_size;
+  jpeg_init_session(&jpeg_session);
+  jpeg_session.handle=file_recovery->handle;
+  jpeg_session.blocksize=file_recovery->blocksize;
+  jpeg_session.cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.output_message = &my_output_message;
+  jerr.pub.error_exit = &my_error_exit;
+  jerr.pub.emit_message= &my_emit_message;
+  if (setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_session_delete(&jpeg_session);
+    return 0;
+  }
+  if(my_fseek(jpeg_session.handle, 0, SEEK_SET) < 0)
+    return 0;
+  jpeg_create_decompress(&jpeg_session.cinfo);
+  jpeg_testdisk_src(&jpeg_session.cinfo, jpeg_session.handle, 0, jpeg_session.blocksize);
+  (void) jpeg_read_header(&jpeg_session.cinfo, TRUE);
+  jpeg_session.cinfo.scale_num = 1;
+  jpeg_session.cinfo.scale_denom = 8;
+  jpeg_session.cinfo.dct_method = JDCT_FASTEST;
+  jpeg_session.cinfo.do_block_smoothing = FALSE;
+  jpeg_session.cinfo.do_fancy_upsampling = FALSE;
+  {
+    my_source_mgr * src;
+    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    src->file_size_max=file_recovery->file_size;
+  }
+  (void) jpeg_start_decompress(&jpeg_session.cinfo);
+  jpeg_session.row_stride = jpeg_session.cinfo.output_width * jpeg_session.cinfo.output_components;
+  jpeg_session.frame = (unsigned char *)MALLOC(jpeg_session.row_stride);
+  while (jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height)
+  {
+    JSAMPROW row_pointer[1];
+    row_pointer[0] = jpeg_session.frame;
+    (void)jpeg_read_scanlines(&jpeg_session.cinfo, row_pointer, 1);
+  }
+  {
+    my_source_mgr * src;
+    src = (my_source_mgr *) jpeg_session.cinfo.src;
+    jpeg_size=src->file_size - src->pub.bytes_in_buffer;
+  }
+  (void) jpeg_finish_decompress(&jpeg_session.cinfo);
+  jpeg_session_delete(&jpeg_session);
+  return jpeg_size;
+}
+
+static void jpg_set_file_size(file_recovery_t *file_recovery, const uint64_t jpeg_size)
+{
+  if(jpeg_size<=0)
+    return;
+  if(file_recovery->calculated_file_size>0)
+    file_recovery->file_size=file_recovery->calculated_file_size;
+  else
+  {
+    static const unsigned char jpg_footer[2]= { 0xff,0xd9};
+    file_recovery->file_size=jpeg_size;
+    file_search_footer(file_recovery, jpg_footer, sizeof(jpg_footer), 0);
+  }
+}
+
 static void jpg_check_picture(file_recovery_t *file_recovery)
 {
-  static struct my_error_mgr jerr;
-  static unsigned int offsets[JPG_MAX_OFFSETS];
+  static TD_THREAD_LOCAL struct my_error_mgr jerr;
+  static TD_THREAD_LOCAL unsigned int offsets[JPG_MAX_OFFSETS];
   uint64_t jpeg_size=0;
-  static struct jpeg_session_struct jpeg_session;
-  static int jpeg_session_initialised=0;
+  static TD_THREAD_LOCAL struct jpeg_session_struct jpeg_session;
+  static TD_THREAD_LOCAL int jpeg_session_initialised=0;
   if(file_recovery->checkpoint_status==0)
   {
     if(jpeg_session_initialised==1)
@@ -1765,6 +1923,20 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
     jpeg_session.flags=file_recovery->flags;
     jpeg_session_initialised=1;
     jpeg_session.blocksize=file_recovery->blocksize;
+    if(jpg_scaled_check>0)
+    {
+      /* Only decode the whole picture to locate the corruption */
+      jpeg_size=jpg_check_picture_scaled(file_recovery);
+      if(jpeg_size>0)
+      {
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+	jpg_rows_free();
+#endif
+	jpeg_session_initialised=0;
+	jpg_set_file_size(file_recovery, jpeg_size);
+	return;
+      }
+    }
   }
   jpeg_session.handle=file_recovery->handle;
   jpeg_session.cinfo.err = jpeg_std_error(&jerr.pub);
@@ -1805,10 +1977,12 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
 	  (long long unsigned)file_recovery->offset_error);
 #endif
     }
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+    jpg_rows_keep(file_recovery, &jpeg_session);
+#endif
     jpeg_session_delete(&jpeg_session);
     return;
   }
-  memset(offsets, 0, sizeof(offsets));
   jpeg_session_start(&jpeg_session);
   {
     my_source_mgr * src;
@@ -1822,14 +1996,24 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
   /* 0x100/2=0x80, medium value */
   if(jpeg_session.flags==0)
   {
+    memset(offsets, 0, sizeof(offsets));
     jpeg_session.frame = (unsigned char *)MALLOC(jpeg_session.row_stride);
     memset(jpeg_session.frame, 0x80, jpeg_session.row_stride);
   }
   else
   {
-    /* FIXME out of bound read access in libjpeg-turbo */
-    jpeg_session.frame = (unsigned char *)MALLOC((jpeg_session.output_height+1) * jpeg_session.row_stride);
-    memset(jpeg_session.frame, 0x80, (jpeg_session.cinfo.output_height+1) * jpeg_session.row_stride);
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+    const unsigned int rows=jpg_rows_reuse(file_recovery, &jpeg_session, &offsets[0]);
+    if(rows > 0)
+      (void)jpeg_skip_scanlines(&jpeg_session.cinfo, rows);
+    else
+#endif
+    {
+      memset(offsets, 0, sizeof(offsets));
+      /* FIXME out of bound read access in libjpeg-turbo */
+      jpeg_session.frame = (unsigned char *)MALLOC((jpeg_session.output_height+1) * jpeg_session.row_stride);
+      memset(jpeg_session.frame, 0x80, (jpeg_session.cinfo.output_height+1) * jpeg_session.row_stride);
+    }
   }
   while (jpeg_session.cinfo.output_scanline < jpeg_session.cinfo.output_height)
   {
@@ -1840,6 +2024,9 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
     if(jpeg_session.cinfo.output_scanline/8 < JPG_MAX_OFFSETS && offsets[jpeg_session.cinfo.output_scanline/8]==0)
     {
       offsets[jpeg_session.cinfo.output_scanline/8]=src->file_size - src->pub.bytes_in_buffer;
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+      jpg_rows_read[jpeg_session.cinfo.output_scanline/8]=src->file_size;
+#endif
     }
   // Calculate where this line needs to go.
     if(jpeg_session.flags==0)
@@ -1855,18 +2042,12 @@ static void jpg_check_picture(file_recovery_t *file_recovery)
   }
   (void) jpeg_finish_decompress(&jpeg_session.cinfo);
   jpeg_session_delete(&jpeg_session);
+#ifdef HAVE_JPEG_SKIP_SCANLINES
+  jpg_rows_free();
+#endif
   jpeg_session_initialised=0;
   file_recovery->checkpoint_status=0;
-  if(jpeg_size<=0)
-    return;
-  if(file_recovery->calculated_file_size>0)
-    file_recovery->file_size=file_recovery->calculated_file_size;
-  else
-  {
-    static const unsigned char jpg_footer[2]= { 0xff,0xd9};
-    file_recovery->file_size=jpeg_size;
-    file_search_footer(file_recovery, jpg_footer, sizeof(jpg_footer), 0);
-  }
+  jpg_set_file_size(file_recovery, jpeg_size);
 }
 #endif
 
@@ -2442,7 +2623,7 @@ static uint64_t jpg_check_structure(file_recovery_t *file_recovery, const unsign
 static void file_check_jpg(file_recovery_t *file_recovery)
 {
   uint64_t thumb_offset;
-  static uint64_t thumb_error=0;
+  static TD_THREAD_LOCAL uint64_t thumb_error=0;
   if(file_recovery->calculated_file_size<=2)
     file_recovery->calculated_file_size=0;
   /* FIXME REMOVE ME */
@@ -2520,6 +2701,26 @@ static data_check_t data_check_continue(const unsigned char *buffer, const unsig
 }
 #endif
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Offset of the first 0xFF from i that is neither a stuffed 0xFF00 nor a
+ * RSTn marker, buffer_size - 1 or buffer_size if there is none */
+static unsigned int jpg_skip_entropy(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int i)
+{
+  const unsigned char *p=&buffer[i];
+  const unsigned char *end=&buffer[buffer_size - 1];
+  while(p < end)
+  {
+    p=(const unsigned char *)memchr(p, 0xFF, end - p);
+    if(p==NULL)
+      return buffer_size - 1;
+    if(p[1]!=0x00 && (p[1] < 0xd0 || p[1] > 0xd7))
+      break;
+    p+=2;
+  }
+  return p - buffer;
+}
+#endif
+
 /*@
   @ requires file_recovery->data_check == &data_check_jpg2;
   @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
@@ -2548,6 +2749,15 @@ static data_check_t data_check_jpg2(const unsigned char *buffer, const unsigned
     const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
     /*@ assert 0 <= i < buffer_size - 1; */
     /*@ assert file_recovery->data_check == &data_check_jpg2; */
+#ifndef DISABLED_FOR_FRAMAC
+    if(buffer[i]!=0xFF || buffer[i+1]==0x00 || (buffer[i+1] >= 0xd0 && buffer[i+1] <= 0xd7))
+    {
+      /* Skip the entropy-coded data, the stuffed 0xFF00 and the RSTn
+       * markers up to the next marker that must be checked */
+      file_recovery->calculated_file_size+=jpg_skip_entropy(buffer, buffer_size, i) - i;
+      continue;
+    }
+#endif
     if(buffer[i]==0xFF)
     {
       if(buffer[i+1]==0xd9)
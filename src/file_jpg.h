@@ -27,6 +27,13 @@ extern "C" {
 
 const char*td_jpeg_version(void);
 
+/* Validate the recovered pictures with a 1/8 scale decoding, the picture
+ * is only decoded fully to locate the corruption */
+/*@
+  @ assigns \nothing;
+  @*/
+void jpg_set_scaled_check(const int enable);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -68,22 +68,25 @@ static const unsigned char sdvs_header[4] = { 'S','D','V','S'};
   @*/
 static data_check_t data_check_ts_192(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
+  unsigned int i;
   /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
+  if(file_recovery->calculated_file_size + buffer_size/2 < file_recovery->file_size ||
+      file_recovery->calculated_file_size + 5 >= file_recovery->file_size + buffer_size/2)
+    return DC_CONTINUE;
+  /* Walk the packets of the window with a local index, the file size is
+   * updated once */
+  i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
+  /*@ assert 0 <= i < buffer_size - 5; */
   /*@
-    @ loop assigns file_recovery->calculated_file_size;
-    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + 5);
+    @ loop assigns i;
+    @ loop variant buffer_size - i;
     @*/
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size + 5 < file_recovery->file_size + buffer_size/2)
-  {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i < buffer_size - 5; */
+  for(; i + 5 < buffer_size; i+=192)
     if(buffer[i+4]!=0x47)	/* TS_SYNC_BYTE */
-      return DC_STOP;
-    file_recovery->calculated_file_size+=192;
-  }
-  return DC_CONTINUE;
+      break;
+  file_recovery->calculated_file_size=file_recovery->file_size + i - buffer_size/2;
+  return (i + 5 < buffer_size ? DC_STOP : DC_CONTINUE);
 }
 
 /*@
@@ -212,22 +215,23 @@ static int header_check_m2ts(const unsigned char *buffer, const unsigned int buf
   @*/
 static data_check_t data_check_ts_188(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
+  unsigned int i;
   /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
+  if(file_recovery->calculated_file_size + buffer_size/2 < file_recovery->file_size ||
+      file_recovery->calculated_file_size >= file_recovery->file_size + buffer_size/2)
+    return DC_CONTINUE;
+  i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
+  /*@ assert 0 <= i < buffer_size; */
   /*@
-    @ loop assigns file_recovery->calculated_file_size;
-    @ loop variant file_recovery->file_size + buffer_size/2 - file_recovery->calculated_file_size;
+    @ loop assigns i;
+    @ loop variant buffer_size - i;
     @*/
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size < file_recovery->file_size + buffer_size/2)
-  {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i < buffer_size; */
+  for(; i < buffer_size; i+=188)
     if(buffer[i]!=0x47)	/* TS_SYNC_BYTE */
-      return DC_STOP;
-    file_recovery->calculated_file_size+=188;
-  }
-  return DC_CONTINUE;
+      break;
+  file_recovery->calculated_file_size=file_recovery->file_size + i - buffer_size/2;
+  return (i < buffer_size ? DC_STOP : DC_CONTINUE);
 }
 
 /*@
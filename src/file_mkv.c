@@ -184,6 +184,26 @@ static int EBML_read_string(const unsigned char *p, const unsigned int p_size, u
 
 static const unsigned char EBML_header[4]= { 0x1a,0x45,0xdf,0xa3};
 
+/*@
+  @ requires file_recovery->data_check == &data_check_mkv;
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ terminates \true;
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @ ensures  \result == DC_STOP || \result == DC_CONTINUE;
+  @ assigns  \nothing;
+  @*/
+static data_check_t data_check_mkv(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  (void)buffer;
+  /* The whole segment belongs to the file */
+#ifndef DISABLED_FOR_FRAMAC
+  file_data_extent(file_recovery, file_recovery->calculated_file_size);
+#endif
+  if(file_recovery->file_size + buffer_size/2 >= file_recovery->calculated_file_size)
+    return DC_STOP;
+  return DC_CONTINUE;
+}
+
 /*@
   @ requires separation: \separated(&file_hint_mkv, buffer+(..), file_recovery, file_recovery_new);
   @ requires valid_header_check_param(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
@@ -192,6 +212,8 @@ static const unsigned char EBML_header[4]= { 0x1a,0x45,0xdf,0xa3};
   @*/
 static int header_check_mkv(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
+  (void)safe_header_only;
+  (void)file_recovery;
   if(memcmp(buffer,EBML_header,sizeof(EBML_header))!=0)
     return 0;
   {
@@ -266,7 +288,7 @@ static int header_check_mkv(const unsigned char *buffer, const unsigned int buff
 #ifdef DEBUG_MKV
       log_info("file size    %llu\n", (long long unsigned) file_recovery_new->calculated_file_size);
 #endif
-      file_recovery_new->data_check=&data_check_size;
+      file_recovery_new->data_check=&data_check_mkv;
       file_recovery_new->file_check=&file_check_size;
     }
   }
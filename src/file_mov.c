@@ -190,11 +190,8 @@ static data_check_t data_check_mov(const unsigned char *buffer, const unsigned i
     if(buffer[i+4]=='m' && buffer[i+5]=='d' && buffer[i+6]=='a' && buffer[i+7]=='t')
     {
       file_recovery->calculated_file_size+=atom_size;
-#if 0
-      if(i+8 == buffer_size)
-      {
-	return -((atom_size + buffer_size/2 - 1)/ (buffer_size/2));
-      }
+#ifndef DISABLED_FOR_FRAMAC
+      file_data_extent(file_recovery, file_recovery->calculated_file_size);
 #endif
     }
     else if(is_known_atom(&buffer[i+4]))
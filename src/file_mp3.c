@@ -32,6 +32,7 @@
 #include "common.h"
 #include "filegen.h"
 #include "log.h"
+#include "memmem.h"
 #if defined(__FRAMAC__)
 #include "__fc_builtin.h"
 #endif
@@ -114,6 +115,80 @@ static const unsigned int bit_rate_table[4][4][16]=
   },
 };
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Frame length indexed by the version and layer bits of the second byte of
+ * the header, and by the bitrate, sampling rate and padding bits of the
+ * third one. 0 for an invalid or a Layer I header. */
+static uint16_t frame_length_table[16][128];
+
+static void frame_length_table_init(void)
+{
+  unsigned int key1;
+  for(key1=0; key1<16; key1++)
+  {
+    const unsigned int mpeg_version=(key1>>2)&0x03;
+    const unsigned int mpeg_layer=key1&0x03;
+    unsigned int key2;
+    for(key2=0; key2<128; key2++)
+    {
+      const unsigned int bit_rate=bit_rate_table[mpeg_version][mpeg_layer][(key2>>3)&0x0F];
+      const unsigned int sample_rate=sample_rate_table[mpeg_version][(key2>>1)&0x03];
+      const unsigned int padding=key2&0x01;
+      unsigned int frameLengthInBytes=0;
+      if(sample_rate!=0 && bit_rate!=0 && mpeg_layer!=MPEG_L1)
+      {
+	if(mpeg_layer==MPEG_L3 && mpeg_version!=MPEG_V1)
+	  frameLengthInBytes = 72000 * bit_rate / sample_rate + padding;
+	else
+	  frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
+      }
+      frame_length_table[key1][key2]=(frameLengthInBytes<3 ? 0 : frameLengthInBytes);
+    }
+  }
+}
+#endif
+
+/* Returns the length of the frame whose header is at buffer, 0 if the
+ * header is invalid or is a Layer I one */
+/*@
+  @ requires \valid_read(buffer+(0..2));
+  @ ensures \result == 0 || 3 <= \result <= 8065;
+  @ assigns \nothing;
+  @*/
+static unsigned int frame_length(const unsigned char *buffer)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return frame_length_table[(buffer[1]>>1)&0x0F][(buffer[2]>>1)&0x7F];
+#else
+  const unsigned int mpeg_version	=(buffer[1]>>3)&0x03;
+  const unsigned int mpeg_layer	=(buffer[1]>>1)&0x03;
+  const unsigned int bit_rate_key	=(buffer[2]>>4)&0x0F;
+  const unsigned int sampling_rate_key=(buffer[2]>>2)&0x03;
+  const unsigned int padding	=(buffer[2]>>1)&0x01;
+  /*@ split mpeg_version; */
+  const unsigned int sample_rate	=sample_rate_table[mpeg_version][sampling_rate_key];
+  /*@ assert sample_rate == 0 || 8000 <= sample_rate <= 48000; */
+  const unsigned int bit_rate	=bit_rate_table[mpeg_version][mpeg_layer][bit_rate_key];
+  unsigned int frameLengthInBytes=0;
+  if(sample_rate==0 || bit_rate==0 || mpeg_layer==MPEG_L1)
+    return 0;
+  /*@ assert 8000 <= sample_rate <= 48000; */
+  /*@ assert 0 < bit_rate <= 448; */
+  if(mpeg_layer==MPEG_L3)
+  {
+    if(mpeg_version==MPEG_V1)
+      frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
+    else
+      frameLengthInBytes = 72000 * bit_rate / sample_rate + padding;
+  }
+  else
+    frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
+  if(frameLengthInBytes<3)
+    return 0;
+  return frameLengthInBytes;
+#endif
+}
+
 /*@
   @ requires needle_size > 0;
   @ requires haystack_size > 0;
@@ -124,10 +199,20 @@ static const unsigned int bit_rate_table[4][4][16]=
   @*/
 static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int haystack_size, const unsigned char *needle, const unsigned int needle_size)
 {
+#ifdef DISABLED_FOR_FRAMAC
   unsigned int i;
+#endif
   if(haystack_size < needle_size)
     return 0;
   /*@ assert haystack_size >= needle_size; */
+#ifndef DISABLED_FOR_FRAMAC
+  {
+    const unsigned char *pos=(const unsigned char *)td_memmem(haystack, haystack_size, needle, needle_size);
+    if(pos==NULL)
+      return 0;
+    return (pos - haystack) + needle_size;
+  }
+#else
   /*@
     @ loop assigns i;
     @ loop invariant 0 <= i <= haystack_size - needle_size + 1;
@@ -137,6 +222,7 @@ static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int
     if(memcmp(&haystack[i],needle,needle_size)==0)
       return (i+needle_size);
   return 0;
+#endif
 }
 
 /*@
@@ -297,32 +383,8 @@ static data_check_t data_check_mp3(const unsigned char *buffer, const unsigned i
 #endif
     if(buffer[i+0]==0xFF && ((buffer[i+1]&0xE0)==0xE0))
     {
-      const unsigned int mpeg_version	=(buffer[i+1]>>3)&0x03;
-      const unsigned int mpeg_layer	=(buffer[i+1]>>1)&0x03;
-      const unsigned int bit_rate_key	=(buffer[i+2]>>4)&0x0F;
-      const unsigned int sampling_rate_key=(buffer[i+2]>>2)&0x03;
-      const unsigned int padding	=(buffer[i+2]>>1)&0x01;
-      /*@ split mpeg_version; */
-      const unsigned int sample_rate	=sample_rate_table[mpeg_version][sampling_rate_key];
-      /*@ assert sample_rate == 0 || 8000 <= sample_rate <= 48000; */
-      const unsigned int bit_rate	=bit_rate_table[mpeg_version][mpeg_layer][bit_rate_key];
-      unsigned int frameLengthInBytes=0;
-      if(sample_rate==0 || bit_rate==0 || mpeg_layer==MPEG_L1)
-	return DC_STOP;
-      /*@ assert 8000 <= sample_rate <= 48000; */
-      /*@ assert 0 < bit_rate <= 448; */
-      if(mpeg_layer==MPEG_L3)
-      {
-	if(mpeg_version==MPEG_V1)
-	  frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
-	else
-	  frameLengthInBytes = 72000 * bit_rate / sample_rate + padding;
-      }
-      else if(mpeg_layer==MPEG_L2)
-	frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
-      else
-	frameLengthInBytes = (12000 * bit_rate / sample_rate + padding)*4;
-      if(frameLengthInBytes<3)
+      const unsigned int frameLengthInBytes=frame_length(&buffer[i]);
+      if(frameLengthInBytes==0)
 	return DC_STOP;
       /*@ assert 3 <= frameLengthInBytes <= 8065; */
       file_recovery->calculated_file_size+=frameLengthInBytes;
@@ -539,35 +601,11 @@ static int header_check_mp3(const unsigned char *buffer, const unsigned int buff
     if(buffer[potential_frame_offset+0]!=0xFF)
       return 0;
     {
-      const unsigned int mpeg_version	=(buffer[potential_frame_offset+1]>>3)&0x03;
-      const unsigned int mpeg_layer	=(buffer[potential_frame_offset+1]>>1)&0x03;
-      const unsigned int bit_rate_key	=(buffer[potential_frame_offset+2]>>4)&0x0F;
-      const unsigned int sampling_rate_key=(buffer[potential_frame_offset+2]>>2)&0x03;
-      const unsigned int padding	=(buffer[potential_frame_offset+2]>>1)&0x01;
-      /*@ split mpeg_version; */
-      const unsigned int bit_rate	=bit_rate_table[mpeg_version][mpeg_layer][bit_rate_key];
-      const unsigned int sample_rate	=sample_rate_table[mpeg_version][sampling_rate_key];
-      unsigned int frameLengthInBytes=0;
-      if(sample_rate==0 || bit_rate==0 || mpeg_layer==MPEG_L1)
-	return 0;
-      /*@ assert 8000 <= sample_rate <= 48000; */
-      /*@ assert 0 < bit_rate <= 448; */
-      if(mpeg_layer==MPEG_L3)
-      {
-	if(mpeg_version==MPEG_V1)
-	  frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
-	else
-	  frameLengthInBytes = 72000 * bit_rate / sample_rate + padding;
-      }
-      else if(mpeg_layer==MPEG_L2)
-	frameLengthInBytes = 144000 * bit_rate / sample_rate + padding;
-      else
-	frameLengthInBytes = (12000 * bit_rate / sample_rate + padding)*4;
+      const unsigned int frameLengthInBytes=frame_length(&buffer[potential_frame_offset]);
 #ifdef DEBUG_MP3
-      log_info("framesize: %u, layer: %u, bitrate: %u, padding: %u\n",
-	  frameLengthInBytes, 4-mpeg_layer, bit_rate, padding);
+      log_info("framesize: %u\n", frameLengthInBytes);
 #endif
-      if(frameLengthInBytes<3)
+      if(frameLengthInBytes==0)
 	return 0;
       /*@ assert 3 <= frameLengthInBytes <= 8065; */
       potential_frame_offset+=frameLengthInBytes;
@@ -630,6 +668,9 @@ static void register_header_check_mp3(file_stat_t *file_stat)
   static const unsigned char mpeg2_L3_header2[2]= {0xFF, 0xF3};
   static const unsigned char mpeg25_L3_header1[2]={0xFF, 0xE2};
   static const unsigned char mpeg25_L3_header2[2]={0xFF, 0xE3};
+#ifndef DISABLED_FOR_FRAMAC
+  frame_length_table_init();
+#endif
   register_header_check(0, "ID3", 3, &header_check_id3, file_stat);
   register_header_check(0, mpeg1_L3_header1, sizeof(mpeg1_L3_header1), &header_check_mp3, file_stat);
   register_header_check(0, mpeg1_L3_header2, sizeof(mpeg1_L3_header2), &header_check_mp3, file_stat);
@@ -48,6 +48,36 @@ const file_hint_t file_hint_ogg= {
 static const unsigned char ogg_header[5]= {'O','g','g','S', 0x00};
 
 /* http://www.ietf.org/rfc/rfc3533.txt */
+/*@
+  @ requires \valid_read(header + (0 .. 27+255-1));
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t ogg_page_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  const unsigned int number_page_segments=header[26];
+  unsigned int page_size=number_page_segments + 27;
+  unsigned int j;
+  (void)file_recovery;
+  /*@
+    @ loop invariant page_size <= 255 + 27 + j * 255;
+    @ loop assigns j, page_size;
+    @ loop variant number_page_segments - j;
+    @ */
+  for(j=0; j<number_page_segments; j++)
+    page_size+=header[27+j];
+  /* By definition, page_size<=27+255+255*255=65307 */
+  return page_size;
+}
+
+static const file_record_t ogg_record= {
+  .header_size=27+255,
+  .sync=ogg_header,
+  .sync_size=sizeof(ogg_header),
+  .record_size=&ogg_page_size,
+  .invalid=DC_STOP
+};
+
 /*@
   @ requires file_recovery->data_check==&data_check_ogg;
   @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
@@ -56,47 +86,7 @@ static const unsigned char ogg_header[5]= {'O','g','g','S', 0x00};
   @*/
 static data_check_t data_check_ogg(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
-  /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@
-    @ loop assigns file_recovery->calculated_file_size;
-    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + 27 +255);
-    @*/
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size + 27 +255 < file_recovery->file_size + buffer_size/2)
-  {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i < buffer_size - (27 + 255); */
-    if(memcmp(&buffer[i],ogg_header,sizeof(ogg_header))==0)
-    {
-      const unsigned int number_page_segments=buffer[i+26];
-      const unsigned int header_size = number_page_segments + 27;
-      unsigned int page_size;
-      unsigned int j;
-      page_size=header_size;
-      /*@
-        @ loop invariant page_size <= 255 + 27 + j * 255;
-        @ loop assigns j, page_size;
-	@ loop variant number_page_segments - j;
-	@ */
-      for(j=0; j<number_page_segments; j++)
-        page_size+=buffer[i+27+j];
-      if(page_size<27)
-      {
-        return DC_STOP;
-      }
-      /* By definition, page_size<=27+255+255*255=65307 */
-      file_recovery->calculated_file_size+=page_size;
-      /*
-      log_debug("+0x%x=0x%x\n",page_size,file_recovery->calculated_file_size);
-      */
-    }
-    else
-    {
-      return DC_STOP;
-    }
-  }
-  return DC_CONTINUE;
+  return data_check_records(&ogg_record, buffer, buffer_size, file_recovery);
 }
 
 /*@
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include "types.h"
 #include "filegen.h"
+#include "common.h"
 
 /*@ requires valid_register_header_check(file_stat); */
 static void register_header_check_pcap(file_stat_t *file_stat);
@@ -44,6 +45,43 @@ const file_hint_t file_hint_pcap= {
 };
 
 /*@
+  @ requires \valid_read(header + (0 .. 15));
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t pcap_record_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  /* ts_sec, ts_usec, incl_len, orig_len */
+  const uint32_t *p32=(const uint32_t *)header;
+  const uint32_t ts_usec=le32(p32[1]);
+  const uint32_t incl_len=le32(p32[2]);
+  /* The snapshot length is kept in data_check_tmp */
+  if(ts_usec >= 1000000 || incl_len==0 || incl_len > file_recovery->data_check_tmp)
+    return 0;
+  return (uint64_t)16 + incl_len;
+}
+
+static const file_record_t pcap_record= {
+  .header_size=16,
+  .sync=NULL,
+  .sync_size=0,
+  .record_size=&pcap_record_size,
+  .invalid=DC_STOP
+};
+
+/*@
+  @ requires file_recovery->data_check==&data_check_pcap;
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @ assigns  file_recovery->calculated_file_size;
+  @*/
+static data_check_t data_check_pcap(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  return data_check_records(&pcap_record, buffer, buffer_size, file_recovery);
+}
+
+/*@
+  @ requires buffer_size >= 24;
   @ requires separation: \separated(&file_hint_pcap, buffer+(..), file_recovery, file_recovery_new);
   @ requires valid_header_check_param(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
   @ ensures  valid_header_check_result(\result, file_recovery_new);
@@ -57,6 +95,16 @@ static int header_check_pcap(const unsigned char *buffer, const unsigned int buf
 #else
   file_recovery_new->extension=file_hint_pcap.extension;
 #endif
+  /* The snapshot length bounds the size of each packet record */
+  if(file_recovery_new->blocksize >= 16)
+  {
+    const uint32_t *p32=(const uint32_t *)buffer;
+    const uint32_t snaplen=le32(p32[4]);
+    file_recovery_new->data_check_tmp=(snaplen > 0 && snaplen <= 0x4000000 ? snaplen : 0x4000000);
+    file_recovery_new->calculated_file_size=24;
+    file_recovery_new->data_check=&data_check_pcap;
+    file_recovery_new->file_check=&file_check_size_max;
+  }
   return 1;
 }
 
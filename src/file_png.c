@@ -38,6 +38,7 @@
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
+#include "crc.h"
 
 extern const file_hint_t file_hint_doc;
 
@@ -108,6 +109,101 @@ static int png_check_ihdr(const struct png_ihdr *ihdr)
   return 1;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* The CRC of each chunk is computed while the blocks are written, a bad
+ * CRC of a critical chunk rejects the file as soon as it's found. When the
+ * whole file has been walked, file_check_png() doesn't read it again. */
+#define PNG_IHDR_OK		0
+#define PNG_IHDR_BAD		1
+#define PNG_IHDR_UNKNOWN	2
+
+typedef struct
+{
+  char filename[2048];
+  int active;
+  /* file_size of the next call */
+  uint64_t file_size;
+  int in_chunk;
+  int critical;
+  /* Next byte to add to the CRC, offset of the CRC of the chunk */
+  uint64_t pos;
+  uint64_t crc_offset;
+  uint32_t crc;
+  int ihdr;
+  /* Offset after IEND, 0 if not reached */
+  uint64_t end;
+} png_stream_t;
+
+static TD_THREAD_LOCAL png_stream_t png_stream;
+
+static png_stream_t *png_stream_begin(const file_recovery_t *file_recovery, const unsigned int buffer_size)
+{
+  png_stream_t *ps=&png_stream;
+  if(file_recovery->file_size==0)
+  {
+    /* First block of a new file */
+    strncpy(ps->filename, file_recovery->filename, sizeof(ps->filename)-1);
+    ps->filename[sizeof(ps->filename)-1]='\0';
+    ps->active=1;
+    ps->in_chunk=0;
+    ps->ihdr=PNG_IHDR_OK;
+    ps->end=0;
+  }
+  else if(ps->active==0 ||
+      ps->file_size!=file_recovery->file_size ||
+      strcmp(ps->filename, file_recovery->filename)!=0)
+  {
+    /* The data are not written one block after the other, ie. brute force */
+    ps->active=0;
+    return NULL;
+  }
+  ps->file_size=file_recovery->file_size + buffer_size/2;
+  return ps;
+}
+
+/* The chunk whose length is at offset in the file begins at buffer[i] */
+static void png_stream_chunk(png_stream_t *ps, const unsigned char *buffer, const unsigned int buffer_size, const unsigned int i, const uint64_t offset, const uint32_t length)
+{
+  ps->in_chunk=1;
+  ps->critical=isupper(buffer[i+4]);
+  ps->pos=offset + 4;
+  ps->crc_offset=offset + 8 + length;
+  ps->crc=0xFFFFFFFF;
+  if(memcmp(&buffer[i+4], "IHDR", 4)==0)
+  {
+    if(i + 8 + sizeof(struct png_ihdr) > buffer_size)
+      ps->ihdr=PNG_IHDR_UNKNOWN;
+    else if(png_check_ihdr((const struct png_ihdr *)&buffer[i+8])==0)
+      ps->ihdr=PNG_IHDR_BAD;
+  }
+}
+
+/* Add the bytes of the current chunk before upto to its CRC, check it
+ * once the CRC is available. Returns -1 if the CRC of a critical chunk
+ * doesn't match. buffer[buffer_size/2] is at file_size in the file. */
+static int png_stream_crc(png_stream_t *ps, const unsigned char *buffer, const unsigned int buffer_size, const uint64_t file_size, const uint64_t upto)
+{
+  const unsigned int half=buffer_size/2;
+  if(ps->in_chunk==0)
+    return 0;
+  if(ps->pos < ps->crc_offset && ps->pos < upto)
+  {
+    const uint64_t end=(upto < ps->crc_offset ? upto : ps->crc_offset);
+    ps->crc=get_crc32(&buffer[ps->pos + half - file_size], end - ps->pos, ps->crc);
+    ps->pos=end;
+  }
+  if(ps->pos==ps->crc_offset && ps->crc_offset + 4 <= upto)
+  {
+    const unsigned char *p=&buffer[ps->crc_offset + half - file_size];
+    const uint32_t crc=((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+    ps->in_chunk=0;
+    if((ps->crc ^ 0xFFFFFFFF)!=crc && ps->critical)
+      return -1;
+  }
+  return 0;
+}
+#endif
+
 /*@
   @ requires fr->file_check == &file_check_png;
   @ requires valid_file_check_param(fr);
@@ -122,6 +218,18 @@ static void file_check_png(file_recovery_t *fr)
     fr->file_size=0;
     return ;
   }
+#ifndef DISABLED_FOR_FRAMAC
+  if(png_stream.active!=0 && png_stream.end!=0 &&
+      png_stream.end==fr->calculated_file_size &&
+      png_stream.file_size==fr->file_size &&
+      png_stream.ihdr!=PNG_IHDR_UNKNOWN &&
+      strcmp(png_stream.filename, fr->filename)==0)
+  {
+    /* The chunks have already been walked by data_check_png() */
+    fr->file_size=(png_stream.ihdr==PNG_IHDR_OK ? fr->calculated_file_size : 0);
+    return ;
+  }
+#endif
   fr->file_size=8;
   /*@
     @ loop invariant valid_file_recovery(fr);
@@ -180,6 +288,9 @@ static void file_check_png(file_recovery_t *fr)
 static data_check_t data_check_mng(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
   static const unsigned char mng_footer[4]= {'M','E','N','D'};
+#ifndef DISABLED_FOR_FRAMAC
+  png_stream_t *ps=png_stream_begin(file_recovery, buffer_size);
+#endif
   /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@
@@ -193,9 +304,22 @@ static data_check_t data_check_mng(const unsigned char *buffer, const unsigned i
     /*@ assert 0 <= i <= buffer_size - 8 ; */
     const struct png_chunk *chunk=(const struct png_chunk *)&buffer[i];
     const uint32_t length=be32(chunk->length);
+#ifndef DISABLED_FOR_FRAMAC
+    /* The CRC of the previous chunk ends before this chunk */
+    if(ps!=NULL &&
+	png_stream_crc(ps, buffer, buffer_size, file_recovery->file_size, file_recovery->calculated_file_size) < 0)
+    {
+      file_recovery->offset_error=ps->crc_offset;
+      return DC_ERROR;
+    }
+#endif
     if(memcmp(&buffer[i+4], mng_footer, sizeof(mng_footer))==0)
     {
       file_recovery->calculated_file_size+=(uint64_t)12 + length;
+#ifndef DISABLED_FOR_FRAMAC
+      if(ps!=NULL)
+	ps->end=file_recovery->calculated_file_size;
+#endif
       return DC_STOP;
     }
     if( !((isupper(buffer[i+4]) || islower(buffer[i+4])) &&
@@ -206,9 +330,21 @@ static data_check_t data_check_mng(const unsigned char *buffer, const unsigned i
       file_recovery->offset_error=file_recovery->calculated_file_size+7;
       return DC_ERROR;
     }
+#ifndef DISABLED_FOR_FRAMAC
+    if(ps!=NULL)
+      png_stream_chunk(ps, buffer, buffer_size, i, file_recovery->calculated_file_size, length);
+#endif
     file_recovery->offset_ok=file_recovery->calculated_file_size+7;
     file_recovery->calculated_file_size+=(uint64_t)12 + length;
   }
+#ifndef DISABLED_FOR_FRAMAC
+  if(ps!=NULL &&
+      png_stream_crc(ps, buffer, buffer_size, file_recovery->file_size, file_recovery->file_size + buffer_size/2) < 0)
+  {
+    file_recovery->offset_error=ps->crc_offset;
+    return DC_ERROR;
+  }
+#endif
   return DC_CONTINUE;
 }
 
@@ -220,6 +356,9 @@ static data_check_t data_check_mng(const unsigned char *buffer, const unsigned i
   @*/
 static data_check_t data_check_png(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
+#ifndef DISABLED_FOR_FRAMAC
+  png_stream_t *ps=png_stream_begin(file_recovery, buffer_size);
+#endif
   /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
   /*@
@@ -233,9 +372,22 @@ static data_check_t data_check_png(const unsigned char *buffer, const unsigned i
     /*@ assert 0 <= i <= buffer_size - 8 ; */
     const struct png_chunk *chunk=(const struct png_chunk *)&buffer[i];
     const uint32_t length=be32(chunk->length);
+#ifndef DISABLED_FOR_FRAMAC
+    /* The CRC of the previous chunk ends before this chunk */
+    if(ps!=NULL &&
+	png_stream_crc(ps, buffer, buffer_size, file_recovery->file_size, file_recovery->calculated_file_size) < 0)
+    {
+      file_recovery->offset_error=ps->crc_offset;
+      return DC_ERROR;
+    }
+#endif
     if(memcmp(&buffer[i+4], "IEND", 4)==0)
     {
       file_recovery->calculated_file_size+=(uint64_t)12 + length;
+#ifndef DISABLED_FOR_FRAMAC
+      if(ps!=NULL)
+	ps->end=file_recovery->calculated_file_size;
+#endif
       return DC_STOP;
     }
 // PNG chunk code
@@ -249,9 +401,21 @@ static data_check_t data_check_png(const unsigned char *buffer, const unsigned i
       file_recovery->offset_error=file_recovery->calculated_file_size+7;
       return DC_ERROR;
     }
+#ifndef DISABLED_FOR_FRAMAC
+    if(ps!=NULL)
+      png_stream_chunk(ps, buffer, buffer_size, i, file_recovery->calculated_file_size, length);
+#endif
     file_recovery->offset_ok=file_recovery->calculated_file_size+7;
     file_recovery->calculated_file_size+=(uint64_t)12 + length;
   }
+#ifndef DISABLED_FOR_FRAMAC
+  if(ps!=NULL &&
+      png_stream_crc(ps, buffer, buffer_size, file_recovery->file_size, file_recovery->file_size + buffer_size/2) < 0)
+  {
+    file_recovery->offset_error=ps->crc_offset;
+    return DC_ERROR;
+  }
+#endif
   return DC_CONTINUE;
 }
 
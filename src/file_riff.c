@@ -240,6 +240,27 @@ static void file_check_avi(file_recovery_t *fr)
   }
 }
 
+/*@
+  @ requires \valid_read(header + (0 .. 11));
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t avi_riff_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  const riff_chunk_header *chunk_header=(const riff_chunk_header*)header;
+  if(memcmp(&header[8], "AVIX", 4)!=0)
+    return 0;
+  return (uint64_t)8 + le32(chunk_header->dwSize);
+}
+
+static const file_record_t avi_riff_record= {
+  .header_size=12,
+  .sync=(const unsigned char *)"RIFF",
+  .sync_size=4,
+  .record_size=&avi_riff_size,
+  .invalid=DC_STOP
+};
+
 /*@
   @ requires file_recovery->data_check==&data_check_avi;
   @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
@@ -248,53 +269,41 @@ static void file_check_avi(file_recovery_t *fr)
   @*/
 static data_check_t data_check_avi(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
 {
-  /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@
-    @ loop assigns file_recovery->calculated_file_size;
-    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + 12);
-    @*/
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size + 12 <= file_recovery->file_size + buffer_size/2)
-  {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i <= buffer_size - 12; */
-    const riff_chunk_header *chunk_header=(const riff_chunk_header*)&buffer[i];
-    if(memcmp(&buffer[i], "RIFF", 4)==0 && memcmp(&buffer[i+8], "AVIX", 4)==0)
-      file_recovery->calculated_file_size += (uint64_t)8 + le32(chunk_header->dwSize);
-    else
-      return DC_STOP;
-  }
-  return DC_CONTINUE;
+  return data_check_records(&avi_riff_record, buffer, buffer_size, file_recovery);
 }
 
-data_check_t data_check_avi_stream(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+/*@
+  @ requires \valid_read(header + (0 .. 7));
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t avi_stream_chunk_size(const unsigned char *header, file_recovery_t *file_recovery)
 {
-  /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
-  /*@
-    @ loop assigns file_recovery->calculated_file_size;
-    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + 8);
-    @ */
-  while(file_recovery->calculated_file_size + buffer_size/2  >= file_recovery->file_size &&
-      file_recovery->calculated_file_size + 8 <= file_recovery->file_size + buffer_size/2)
+  const riff_chunk_header *chunk_header=(const riff_chunk_header*)header;
+  if(header[2]!='d' || header[3]!='b')	/* Video Data Binary ?*/
   {
-    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
-    /*@ assert 0 <= i <= buffer_size - 8; */
-    const riff_chunk_header *chunk_header=(const riff_chunk_header*)&buffer[i];
-    if(buffer[i+2]!='d' || buffer[i+3]!='b')	/* Video Data Binary ?*/
-    {
 #ifdef DEBUG_RIFF
-      log_info("data_check_avi_stream stop\n");
+    log_info("data_check_avi_stream stop\n");
 #endif
-      return DC_STOP;
-    }
-    file_recovery->calculated_file_size += (uint64_t)8 + le32(chunk_header->dwSize);
+    return 0;
+  }
 #ifdef DEBUG_RIFF
-    log_info("data_check_avi_stream %llu\n", (long long unsigned)file_recovery->calculated_file_size);
+  log_info("data_check_avi_stream %llu\n", (long long unsigned)file_recovery->calculated_file_size);
 #endif
-  }
-  return DC_CONTINUE;
+  return (uint64_t)8 + le32(chunk_header->dwSize);
+}
+
+static const file_record_t avi_stream_record= {
+  .header_size=8,
+  .sync=NULL,
+  .sync_size=0,
+  .record_size=&avi_stream_chunk_size,
+  .invalid=DC_STOP
+};
+
+data_check_t data_check_avi_stream(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  return data_check_records(&avi_stream_record, buffer, buffer_size, file_recovery);
 }
 
 /*@
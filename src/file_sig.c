@@ -228,6 +228,203 @@ static void signature_insert(const char *ext, unsigned int offset, const void*si
 #endif
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Index of the signatures: the signatures of 8 bytes or more are hashed on
+ * their offset and their first 8 bytes, those of 4 to 7 bytes on their
+ * first 4 bytes, the shorter ones are tested one by one. The signatures
+ * keep their rank in the sorted list, the first one in this order that
+ * matches is the one reported. */
+#define SIG_NONE 0xffffffff
+
+typedef struct
+{
+  uint64_t key;
+  unsigned int offset;
+  unsigned int key_size;
+  unsigned int first;
+  unsigned int last;
+} sig_slot_t;
+
+static const signature_t **sig_ranked=NULL;
+static unsigned int *sig_next=NULL;
+static unsigned int sig_nbr=0;
+static sig_slot_t *sig_slots=NULL;
+static unsigned int sig_slots_mask=0;
+static unsigned int *sig_offsets=NULL;
+static unsigned int sig_offsets_nbr=0;
+static unsigned int *sig_short=NULL;
+static unsigned int sig_short_nbr=0;
+
+static uint64_t sig_key(const void *value, const unsigned int key_size)
+{
+  if(key_size==8)
+  {
+    uint64_t key;
+    memcpy(&key, value, sizeof(key));
+    return key;
+  }
+  else
+  {
+    uint32_t key;
+    memcpy(&key, value, sizeof(key));
+    return key;
+  }
+}
+
+static sig_slot_t *sig_slot(const unsigned int offset, const uint64_t key, const unsigned int key_size)
+{
+  uint64_t hash=(key ^ ((uint64_t)offset << 48) ^ key_size) * 0x9e3779b97f4a7c15ULL;
+  unsigned int i=(unsigned int)(hash >> 40) & sig_slots_mask;
+  while(sig_slots[i].first!=SIG_NONE &&
+      (sig_slots[i].offset!=offset || sig_slots[i].key!=key || sig_slots[i].key_size!=key_size))
+    i=(i + 1) & sig_slots_mask;
+  return &sig_slots[i];
+}
+
+static void signature_index(void)
+{
+  struct td_list_head *pos;
+  unsigned int slots_nbr=16;
+  unsigned int i=0;
+  td_list_for_each(pos, &signatures.list)
+    sig_nbr++;
+  while(slots_nbr < 2 * sig_nbr)
+    slots_nbr*=2;
+  sig_ranked=(const signature_t **)MALLOC((sig_nbr + 1) * sizeof(*sig_ranked));
+  sig_next=(unsigned int *)MALLOC((sig_nbr + 1) * sizeof(*sig_next));
+  sig_offsets=(unsigned int *)MALLOC((sig_nbr + 1) * sizeof(*sig_offsets));
+  sig_short=(unsigned int *)MALLOC((sig_nbr + 1) * sizeof(*sig_short));
+  sig_slots=(sig_slot_t *)MALLOC(slots_nbr * sizeof(*sig_slots));
+  sig_slots_mask=slots_nbr - 1;
+  for(i=0; i<slots_nbr; i++)
+    sig_slots[i].first=SIG_NONE;
+  i=0;
+  td_list_for_each(pos, &signatures.list)
+  {
+    const signature_t *sig=td_list_entry(pos, signature_t, list);
+    sig_ranked[i]=sig;
+    sig_next[i]=SIG_NONE;
+    if(sig->sig_size < 4)
+      sig_short[sig_short_nbr++]=i;
+    else
+    {
+      const unsigned int key_size=(sig->sig_size >= 8 ? 8 : 4);
+      const uint64_t key=sig_key(sig->sig, key_size);
+      sig_slot_t *slot=sig_slot(sig->offset, key, key_size);
+      if(slot->first==SIG_NONE)
+      {
+	slot->key=key;
+	slot->offset=sig->offset;
+	slot->key_size=key_size;
+	slot->first=i;
+      }
+      else
+	sig_next[slot->last]=i;
+      slot->last=i;
+      /* The list is sorted by offset */
+      if(sig_offsets_nbr==0 || sig_offsets[sig_offsets_nbr-1]!=sig->offset)
+	sig_offsets[sig_offsets_nbr++]=sig->offset;
+    }
+    i++;
+  }
+  log_info("%u custom signatures, %u offsets\n", sig_nbr, sig_offsets_nbr);
+}
+
+/* Rank of the first signature hashed with this key that matches, or best */
+static unsigned int sig_lookup(const unsigned char *buffer, const unsigned int offset, const unsigned int key_size, const unsigned int best)
+{
+  const sig_slot_t *slot=sig_slot(offset, sig_key(&buffer[offset], key_size), key_size);
+  unsigned int j;
+  for(j=slot->first; j!=SIG_NONE && j<best; j=sig_next[j])
+  {
+    const signature_t *sig=sig_ranked[j];
+    if(memcmp(&buffer[offset], sig->sig, sig->sig_size)==0)
+      return j;
+  }
+  return best;
+}
+
+static int header_check_sig(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+  unsigned int best=SIG_NONE;
+  unsigned int i;
+  for(i=0; i<sig_short_nbr; i++)
+  {
+    const signature_t *sig=sig_ranked[sig_short[i]];
+    if(memcmp(&buffer[sig->offset], sig->sig, sig->sig_size)==0)
+    {
+      best=sig_short[i];
+      break;
+    }
+  }
+  /* The matches at an offset rank before those at the next offsets */
+  for(i=0; i<sig_offsets_nbr && sig_offsets[i] + 4 <= buffer_size; i++)
+  {
+    const unsigned int offset=sig_offsets[i];
+    if(best!=SIG_NONE && offset > sig_ranked[best]->offset)
+      break;
+    if(offset + 8 <= buffer_size)
+      best=sig_lookup(buffer, offset, 8, best);
+    best=sig_lookup(buffer, offset, 4, best);
+  }
+  if(best==SIG_NONE)
+    return 0;
+  reset_file_recovery(file_recovery_new);
+  file_recovery_new->extension=sig_ranked[best]->extension;
+  return 1;
+}
+
+/* Number of distinct prefixes sharing an offset and a first byte above
+ * which a single check on the first byte is registered for all of them */
+#define SIG_PREFIXES_MAX 8
+
+/*@
+  @ requires \valid_read(a);
+  @ requires \valid_read(b);
+  @ assigns \nothing;
+  @*/
+static int sig_same_prefix(const signature_t *a, const signature_t *b)
+{
+  const unsigned int len_a=(a->sig_size < 4 ? a->sig_size : 4);
+  const unsigned int len_b=(b->sig_size < 4 ? b->sig_size : 4);
+  return (a->offset==b->offset && len_a==len_b && memcmp(a->sig, b->sig, len_a)==0);
+}
+
+/* Register a check on the first 4 bytes of the signatures, or a check on
+ * their first byte when there are too many of them at an offset: the
+ * number of checks to walk doesn't grow with the number of signatures,
+ * header_check_sig() tells the matching signature apart */
+/*@
+  @ requires valid_register_header_check(file_stat);
+  @*/
+static void register_header_check_sig_index(file_stat_t *file_stat)
+{
+  unsigned int start;
+  unsigned int end;
+  /* The list is sorted by offset, then by value: the signatures with the
+   * same offset and first byte are grouped, and inside a group those
+   * sharing their first 4 bytes */
+  for(start=0; start<sig_nbr; start=end)
+  {
+    const signature_t *sig=sig_ranked[start];
+    unsigned int prefixes=1;
+    unsigned int i;
+    for(end=start+1; end<sig_nbr &&
+	sig_ranked[end]->offset==sig->offset && sig_ranked[end]->sig[0]==sig->sig[0]; end++)
+      if(!sig_same_prefix(sig_ranked[end-1], sig_ranked[end]))
+	prefixes++;
+    if(prefixes > SIG_PREFIXES_MAX)
+    {
+      register_header_check(sig->offset, sig->sig, 1, &header_check_sig, file_stat);
+      continue;
+    }
+    for(i=start; i<end; i++)
+      if(i==start || !sig_same_prefix(sig_ranked[i-1], sig_ranked[i]))
+	register_header_check(sig_ranked[i]->offset, sig_ranked[i]->sig,
+	    (sig_ranked[i]->sig_size < 4 ? sig_ranked[i]->sig_size : 4), &header_check_sig, file_stat);
+  }
+}
+#else
 /*@
   @ requires separation: \separated(&file_hint_sig, buffer+(..), file_recovery, file_recovery_new);
   @ requires valid_header_check_param(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
@@ -258,6 +455,7 @@ static int header_check_sig(const unsigned char *buffer, const unsigned int buff
   }
   return 0;
 }
+#endif
 
 static FILE *open_signature_file(void)
 {
@@ -587,12 +785,10 @@ static unsigned int load_signature(char **ptr, unsigned char *tmp)
 }
 
 /*@
-  @ requires valid_register_header_check(file_stat);
-  @ requires valid_file_stat(file_stat);
   @ requires valid_string(pos);
   @ ensures  valid_string(\result);
   @*/
-static char *parse_signature_line(file_stat_t *file_stat, char *pos)
+static char *parse_signature_line(char *pos)
 {
   /* each line is composed of "extension sig_offset signature" */
   const char *sig_ext=pos;
@@ -658,25 +854,19 @@ static char *parse_signature_line(file_stat_t *file_stat, char *pos)
     /*@ assert \valid(signature + (0 .. sig_size - 1)); */
     memcpy(signature, sig_sig, sig_size);
     signature_insert(sig_ext, sig_offset, signature, sig_size);
-#ifndef DISABLED_FOR_FRAMAC
-    register_header_check(sig_offset, signature, sig_size, &header_check_sig, file_stat);
-#endif
   }
   free(sig_sig);
   return pos;
 }
 
 /*@
-  @ requires valid_register_header_check(file_stat);
-  @ requires valid_file_stat(file_stat);
   @ requires valid_string(pos);
   @ ensures  valid_string(\result);
   @*/
-static char *parse_signature_file(file_stat_t *file_stat, char *pos)
+static char *parse_signature_file(char *pos)
 {
 #ifndef DISABLED_FOR_FRAMAC
   /*@
-    @ loop invariant valid_file_stat(file_stat);
     @ loop invariant valid_string(pos);
     @*/
   while(*pos!='\0')
@@ -706,7 +896,7 @@ static char *parse_signature_file(file_stat_t *file_stat, char *pos)
       @*/
     while(*pos=='\n' || *pos=='\r')
       pos++;
-    pos=parse_signature_line(file_stat, pos);
+    pos=parse_signature_line(pos);
   }
   return pos;
 }
@@ -720,7 +910,13 @@ static void register_header_check_sig(file_stat_t *file_stat)
   FILE *handle;
 //  if(!td_list_empty(&signatures.list))
   if(buffer!=NULL)
+  {
+#ifndef DISABLED_FOR_FRAMAC
+    /* The checks are registered again after free_header_check() */
+    register_header_check_sig_index(file_stat);
+#endif
     return ;
+  }
   handle=open_signature_file();
   if(!handle)
     return;
@@ -747,13 +943,17 @@ static void register_header_check_sig(file_stat_t *file_stat)
 #endif
   buffer[buffer_size]='\0';
   pos=buffer;
-  pos=parse_signature_file(file_stat, pos);
+  pos=parse_signature_file(pos);
   if(*pos!='\0')
   {
 #ifndef DISABLED_FOR_FRAMAC
     log_warning("Can't parse signature: %s\n", pos);
 #endif
   }
+#ifndef DISABLED_FOR_FRAMAC
+  signature_index();
+  register_header_check_sig_index(file_stat);
+#endif
 //  free(buffer);
 }
 #endif
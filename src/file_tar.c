@@ -107,6 +107,92 @@ int is_valid_tar_header(const struct tar_posix_header *h)
   return 1;
 }
 
+/*@
+  @ requires \valid_read(h);
+  @ terminates \true;
+  @ assigns \nothing;
+  @*/
+static uint64_t tar_member_size(const struct tar_posix_header *h)
+{
+  const unsigned char *p=(const unsigned char *)h->size;
+  uint64_t size=0;
+  unsigned int i;
+  /* No data block for links, devices, directories and fifos */
+  if(h->typeflag >= '1' && h->typeflag <= '6')
+    return 0;
+  if((p[0]&0x80)!=0)
+  {
+    /* GNU base-256 encoding for the members of 8 GiB or more */
+    if((p[0]&0x7f)!=0 || p[1]!=0 || p[2]!=0 || p[3]!=0)
+      return PHOTOREC_MAX_FILE_SIZE;
+    /*@
+      @ loop assigns i,size;
+      @ loop variant 12 - i;
+      @*/
+    for(i = 4; i < 12; i++)
+      size=(size<<8) + p[i];
+    return size;
+  }
+  /*@
+    @ loop assigns i;
+    @ loop variant 12 - i;
+    @*/
+  for(i = 0; i < 12 && p[i]==' '; i++);
+  /*@
+    @ loop assigns i,size;
+    @ loop variant 12 - i;
+    @*/
+  for(; i < 12 && p[i] >= '0' && p[i] <= '7'; i++)
+    size=(size<<3) + (p[i] - '0');
+  return size;
+}
+
+/*@
+  @ requires \valid_read(header + (0 .. sizeof(struct tar_posix_header)-1));
+  @ requires \valid(file_recovery);
+  @ terminates \true;
+  @ assigns  file_recovery->data_check;
+  @*/
+static uint64_t tar_record_size(const unsigned char *header, file_recovery_t *file_recovery)
+{
+  const struct tar_posix_header *h=(const struct tar_posix_header *)header;
+  uint64_t size;
+  if(is_valid_tar_header(h)==0)
+  {
+    /* End of archive or fragmented tar, look for a header in every block as before */
+    file_recovery->data_check=NULL;
+    return 0;
+  }
+  size=tar_member_size(h);
+  if(size >= PHOTOREC_MAX_FILE_SIZE)
+  {
+    file_recovery->data_check=NULL;
+    return 0;
+  }
+  return 512 + (size + 511) / 512 * 512;
+}
+
+static const file_record_t tar_record= {
+  .header_size=sizeof(struct tar_posix_header),
+  .sync=NULL,
+  .sync_size=0,
+  .record_size=&tar_record_size,
+  .invalid=DC_CONTINUE
+};
+
+/*@
+  @ requires file_recovery->data_check == &data_check_tar;
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ terminates \true;
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @ assigns  file_recovery->calculated_file_size, file_recovery->data_check;
+  @*/
+static data_check_t data_check_tar(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  /* The payload of each member is appended without looking for a header */
+  return data_check_records(&tar_record, buffer, buffer_size, file_recovery);
+}
+
 /*@
   @ requires buffer_size >= sizeof(struct tar_posix_header);
   @ requires separation: \separated(&file_hint_tar, buffer+(..), file_recovery, file_recovery_new);
@@ -129,6 +215,11 @@ static int header_check_tar(const unsigned char *buffer, const unsigned int buff
   reset_file_recovery(file_recovery_new);
   file_recovery_new->extension = file_hint_tar.extension;
   file_recovery_new->min_filesize = 512;
+  if(file_recovery_new->blocksize >= 512)
+  {
+    file_recovery_new->calculated_file_size = 0;
+    file_recovery_new->data_check = &data_check_tar;
+  }
   /*@ assert valid_file_recovery(file_recovery_new); */
   return 1;
 }
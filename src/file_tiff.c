@@ -182,6 +182,284 @@ time_t get_date_from_tiff_header(const unsigned char *buffer, const unsigned int
   return tmp;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* The IFDs and the offset arrays they point to are copied from the data
+ * of the file being carved as they stream past data_check_tiff(), the
+ * file_check then reads them from memory instead of the recovered file */
+#define TIFF_STREAM_MAX		64
+/* Bytes read by file_check for an IFD */
+#define TIFF_STREAM_IFD_SIZE	8192
+
+#define TIFF_STREAM_HEADER	1
+#define TIFF_STREAM_IFD		2
+#define TIFF_STREAM_SUBIFD	3	/* array of IFD offsets */
+#define TIFF_STREAM_ARRAY	4	/* strip or tile offsets/bytecounts */
+
+typedef struct
+{
+  uint64_t offset;
+  unsigned int size;	/* an IFD is extended once its entry count is known */
+  unsigned int done;
+  unsigned int type;
+  unsigned int depth;
+  unsigned int count;
+  unsigned char *data;
+} tiff_range_t;
+
+static struct
+{
+  const FILE *handle;
+  uint64_t start;
+  uint64_t pos;		/* bytes of the file seen so far */
+  int valid;
+  int le;
+  unsigned int nbr;
+  tiff_range_t ranges[TIFF_STREAM_MAX];
+} tiff_stream;
+
+static unsigned int tiff_stream_get16(const unsigned char *p)
+{
+  return (tiff_stream.le ? p[0] | (p[1]<<8) : (p[0]<<8) | p[1]);
+}
+
+static uint32_t tiff_stream_get32(const unsigned char *p)
+{
+  return (tiff_stream.le ?
+      (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24) :
+      ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | (uint32_t)p[3]);
+}
+
+void tiff_stream_free(void)
+{
+  unsigned int i;
+  for(i=0; i<tiff_stream.nbr; i++)
+    free(tiff_stream.ranges[i].data);
+  tiff_stream.nbr=0;
+  tiff_stream.valid=0;
+}
+
+static int tiff_stream_match(const file_recovery_t *file_recovery)
+{
+  return (tiff_stream.valid!=0 && file_recovery->handle!=NULL &&
+      file_recovery->handle==tiff_stream.handle &&
+      file_recovery->location.start==tiff_stream.start);
+}
+
+/* Only the ranges starting in the block being streamed or after it can be
+ * captured, the others are read from the file */
+static void tiff_stream_add(const uint64_t offset, const unsigned int size, const unsigned int type, const unsigned int depth, const unsigned int count, const uint64_t block_offset)
+{
+  tiff_range_t *range;
+  unsigned int i;
+  if(offset < block_offset || tiff_stream.nbr >= TIFF_STREAM_MAX || size==0)
+    return ;
+  if(type==TIFF_STREAM_IFD &&
+      (depth > 4 || count > 16 || offset < sizeof(TIFFHeader)))
+    return ;
+  for(i=0; i<tiff_stream.nbr; i++)
+    if(tiff_stream.ranges[i].offset==offset && tiff_stream.ranges[i].type==type)
+      return ;
+  range=&tiff_stream.ranges[tiff_stream.nbr++];
+  range->offset=offset;
+  range->size=size;
+  range->done=0;
+  range->type=type;
+  range->depth=depth;
+  range->count=count;
+  range->data=(unsigned char *)MALLOC(type==TIFF_STREAM_IFD ? TIFF_STREAM_IFD_SIZE : size);
+}
+
+/* Same values as tiff_le_read()/tiff_be_read() */
+static unsigned int tiff_stream_value(const unsigned char *p, const unsigned int type)
+{
+  switch(type)
+  {
+    case 1:
+      return p[0];
+    case 3:
+      return tiff_stream_get16(p);
+    case 4:
+      return tiff_stream_get32(p);
+    default:
+      return 0;
+  }
+}
+
+/* Ask for everything file_check_tiff_le_aux()/file_check_tiff_be_aux()
+ * may read from this IFD */
+static void tiff_stream_ifd(const tiff_range_t *range, const uint64_t block_offset)
+{
+  const unsigned int n=tiff_stream_get16(range->data);
+  unsigned int i;
+  for(i=0; i < n && i < (range->size-2)/12; i++)
+  {
+    const unsigned char *entry=&range->data[2+12*i];
+    const unsigned int tdir_tag=tiff_stream_get16(entry);
+    const unsigned int tdir_type=tiff_stream_get16(entry+2);
+    const uint32_t tdir_count=tiff_stream_get32(entry+4);
+    const uint64_t val=(uint64_t)tdir_count * tiff_type2size(tdir_type);
+    if(tdir_count==1 && val<=4)
+    {
+      if(tdir_tag==TIFFTAG_EXIFIFD || tdir_tag==TIFFTAG_KODAKIFD || tdir_tag==TIFFTAG_SUBIFD)
+	tiff_stream_add(tiff_stream_value(entry+8, tdir_type), 2, TIFF_STREAM_IFD,
+	    range->depth+1, 0, block_offset);
+    }
+    else if(tdir_count > 1)
+    {
+      switch(tdir_tag)
+      {
+	case TIFFTAG_EXIFIFD:
+	case TIFFTAG_KODAKIFD:
+	case TIFFTAG_SUBIFD:
+	  if(tdir_type==4)
+	    tiff_stream_add(tiff_stream_get32(entry+8), (tdir_count<32?tdir_count:32)*4,
+		TIFF_STREAM_SUBIFD, range->depth+1, 0, block_offset);
+	  break;
+	case TIFFTAG_STRIPOFFSETS:
+	case TIFFTAG_STRIPBYTECOUNTS:
+	case TIFFTAG_TILEOFFSETS:
+	case TIFFTAG_TILEBYTECOUNTS:
+	  tiff_stream_add(tiff_stream_get32(entry+8), (tdir_count<2048?tdir_count:2048)*4,
+	      TIFF_STREAM_ARRAY, range->depth, 0, block_offset);
+	  break;
+      }
+    }
+  }
+  if(2+12*n+4 <= range->size)
+  {
+    const uint32_t next_diroff=tiff_stream_get32(&range->data[2+12*n]);
+    if(next_diroff!=0)
+      tiff_stream_add(next_diroff, 2, TIFF_STREAM_IFD, range->depth+1, range->count+1, block_offset);
+  }
+}
+
+static void tiff_stream_fill(tiff_range_t *range, const unsigned char *data, const unsigned int size, const uint64_t offset)
+{
+  const uint64_t from=range->offset + range->done;
+  unsigned int len;
+  if(from < offset || from >= offset + size)
+    return ;
+  len=range->size - range->done;
+  if(len > offset + size - from)
+    len=offset + size - from;
+  memcpy(&range->data[range->done], &data[from - offset], len);
+  range->done+=len;
+}
+
+static void tiff_stream_feed(const unsigned char *data, const unsigned int size, const uint64_t offset)
+{
+  unsigned int i;
+  /* The ranges added by a complete one are handled by the same loop */
+  for(i=0; i<tiff_stream.nbr; i++)
+  {
+    tiff_range_t *range=&tiff_stream.ranges[i];
+    if(range->done==range->size)
+      continue;
+    tiff_stream_fill(range, data, size, offset);
+    if(range->type==TIFF_STREAM_IFD && range->size==2 && range->done==2)
+    {
+      /* file_check only needs the entries and the next IFD offset */
+      const unsigned int n=tiff_stream_get16(range->data);
+      range->size=(n==0 ? 2 :
+	  2+12*n+4 < TIFF_STREAM_IFD_SIZE ? 2+12*n+4 : TIFF_STREAM_IFD_SIZE);
+      tiff_stream_fill(range, data, size, offset);
+    }
+    if(range->done < range->size)
+      continue;
+    switch(range->type)
+    {
+      case TIFF_STREAM_HEADER:
+	tiff_stream_add(tiff_stream_get32(&range->data[4]), 2, TIFF_STREAM_IFD, 0, 0, offset);
+	break;
+      case TIFF_STREAM_IFD:
+	tiff_stream_ifd(range, offset);
+	break;
+      case TIFF_STREAM_SUBIFD:
+	{
+	  unsigned int j;
+	  for(j=0; j<range->size/4; j++)
+	    tiff_stream_add(tiff_stream_get32(&range->data[4*j]), 2, TIFF_STREAM_IFD,
+		range->depth, 0, offset);
+	}
+	break;
+    }
+  }
+}
+
+data_check_t data_check_tiff(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  const unsigned int size=buffer_size/2;
+  if(file_recovery->file_size==0)
+  {
+    tiff_stream_free();
+    tiff_stream.handle=file_recovery->handle;
+    tiff_stream.start=file_recovery->location.start;
+    tiff_stream.pos=0;
+    tiff_stream.le=(buffer[size]=='I');
+    tiff_stream.valid=1;
+    tiff_stream_add(0, sizeof(TIFFHeader), TIFF_STREAM_HEADER, 0, 0, 0);
+  }
+  else if(!tiff_stream_match(file_recovery) || file_recovery->file_size!=tiff_stream.pos)
+  {
+    /* The data are not streamed in order, ie. brute force */
+    tiff_stream_free();
+    return DC_CONTINUE;
+  }
+  tiff_stream_feed(&buffer[size], size, file_recovery->file_size);
+  tiff_stream.pos+=size;
+  return DC_CONTINUE;
+}
+
+static const tiff_range_t *tiff_stream_find(const file_recovery_t *fr, const uint64_t offset, const int ifd)
+{
+  unsigned int i;
+  if(!tiff_stream_match(fr))
+    return NULL;
+  for(i=0; i<tiff_stream.nbr; i++)
+  {
+    const tiff_range_t *range=&tiff_stream.ranges[i];
+    if(range->offset==offset && range->done==range->size &&
+	(range->type==TIFF_STREAM_IFD)==ifd &&
+	range->offset + range->size <= fr->file_size)
+      return range;
+  }
+  return NULL;
+}
+#endif
+
+unsigned int tiff_read(file_recovery_t *fr, void *buffer, const uint64_t offset, const unsigned int count)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const tiff_range_t *range=tiff_stream_find(fr, offset, 0);
+  int res;
+  if(range!=NULL && range->size >= count)
+  {
+    memcpy(buffer, range->data, count);
+    return count;
+  }
+  res=file_tail_read(fr, (char *)buffer, offset, count);
+  if(res>=0)
+    return res;
+#endif
+  if(my_fseek(fr->handle, offset, SEEK_SET) < 0)
+    return 0;
+  return fread(buffer, 1, count, fr->handle);
+}
+
+unsigned int tiff_read_ifd(file_recovery_t *fr, void *buffer, const uint64_t offset, const unsigned int count)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  /* The bytes after the entries and the next IFD offset are not used */
+  const tiff_range_t *range=tiff_stream_find(fr, offset, 1);
+  if(range!=NULL && range->size <= count)
+  {
+    memcpy(buffer, range->data, range->size);
+    return range->size;
+  }
+#endif
+  return tiff_read(fr, buffer, offset, count);
+}
+
 static void register_header_check_tiff(file_stat_t *file_stat)
 {
   static const unsigned char tiff_header_be[4]= { 'M','M',0x00, 0x2a};
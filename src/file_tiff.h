@@ -159,6 +159,46 @@ int header_check_tiff_be(const unsigned char *buffer, const unsigned int buffer_
   @*/
 unsigned int tiff_type2size(const unsigned int type);
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Keep a copy of the header, the IFDs and the strip/tile offset arrays
+ * of the TIFF file being carved as its data stream past */
+/*@
+  @ requires buffer_size >= 2 && (buffer_size&1)==0;
+  @ requires \valid_read(buffer+(0..buffer_size-1));
+  @ requires \valid(file_recovery);
+  @ ensures \result == DC_CONTINUE;
+  @*/
+data_check_t data_check_tiff(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
+
+void tiff_stream_free(void);
+#endif
+
+/* Same result as fseek()+fread() of count bytes at offset in fr->handle,
+ * the data copied by data_check_tiff() or file_tail_read() are used
+ * when available */
+/*@
+  @ requires \valid(fr);
+  @ requires \valid(fr->handle);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires \separated(fr, fr->handle, (char *)buffer + (0 .. count-1));
+  @ ensures \result <= count;
+  @ assigns *fr->handle, errno, ((char *)buffer)[0 .. count-1];
+  @ assigns Frama_C_entropy_source;
+  @*/
+unsigned int tiff_read(file_recovery_t *fr, void *buffer, const uint64_t offset, const unsigned int count);
+
+/* Read an IFD: only the entries and the next IFD offset may be read */
+/*@
+  @ requires \valid(fr);
+  @ requires \valid(fr->handle);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires \separated(fr, fr->handle, (char *)buffer + (0 .. count-1));
+  @ ensures \result <= count;
+  @ assigns *fr->handle, errno, ((char *)buffer)[0 .. count-1];
+  @ assigns Frama_C_entropy_source;
+  @*/
+unsigned int tiff_read_ifd(file_recovery_t *fr, void *buffer, const uint64_t offset, const unsigned int count);
+
 #ifdef DEBUG_TIFF
 const char *tag_name(unsigned int tag);
 #endif
@@ -226,14 +226,15 @@ static uint64_t parse_strip_be_aux(const uint32_t *offsetp, const uint32_t *size
 }
 
 /*@
-  @ requires \valid(handle);
+  @ requires \valid(fr);
+  @ requires \valid(fr->handle);
   @ requires \valid_read(entry_strip_offsets);
   @ requires \valid_read(entry_strip_bytecounts);
-  @ requires \separated(handle, &errno, &Frama_C_entropy_source, &__fc_heap_status, \union(entry_strip_offsets, entry_strip_bytecounts));
-  @ assigns *handle, errno;
+  @ requires \separated(fr, fr->handle, &errno, &Frama_C_entropy_source, &__fc_heap_status, \union(entry_strip_offsets, entry_strip_bytecounts));
+  @ assigns *fr->handle, errno;
   @ assigns Frama_C_entropy_source;
   @*/
-static uint64_t parse_strip_be(FILE *handle, const TIFFDirEntry *entry_strip_offsets, const TIFFDirEntry *entry_strip_bytecounts)
+static uint64_t parse_strip_be(file_recovery_t *fr, const TIFFDirEntry *entry_strip_offsets, const TIFFDirEntry *entry_strip_bytecounts)
 {
   const unsigned int nbr=(be32(entry_strip_offsets->tdir_count)<2048?
       be32(entry_strip_offsets->tdir_count):
@@ -250,13 +251,11 @@ static uint64_t parse_strip_be(FILE *handle, const TIFFDirEntry *entry_strip_off
       be16(entry_strip_bytecounts->tdir_type)!=4)
     return TIFF_ERROR;
   /*@ assert 0 < nbr <= 2048; */
-  if(fseek(handle, be32(entry_strip_offsets->tdir_offset), SEEK_SET) < 0 ||
-      fread(&offsetp_buf, sizeof(uint32_t), nbr, handle) != nbr)
+  if(tiff_read(fr, &offsetp_buf, be32(entry_strip_offsets->tdir_offset), nbr*sizeof(uint32_t)) != nbr*sizeof(uint32_t))
   {
     return TIFF_ERROR;
   }
-  if(fseek(handle, be32(entry_strip_bytecounts->tdir_offset), SEEK_SET) < 0 ||
-      fread(&sizep_buf, sizeof(uint32_t), nbr, handle) != nbr)
+  if(tiff_read(fr, &sizep_buf, be32(entry_strip_bytecounts->tdir_offset), nbr*sizeof(uint32_t)) != nbr*sizeof(uint32_t))
   {
     return TIFF_ERROR;
   }
@@ -465,9 +464,7 @@ static uint64_t file_check_tiff_be_aux(file_recovery_t *fr, const uint32_t tiff_
   /*@ assert count <= 16; */
   if(tiff_diroff < sizeof(TIFFHeader))
     return TIFF_ERROR;
-  if(fseek(fr->handle, tiff_diroff, SEEK_SET) < 0)
-    return TIFF_ERROR;
-  data_read=fread(buffer, 1, sizeof(buffer), fr->handle);
+  data_read=tiff_read_ifd(fr, buffer, tiff_diroff, sizeof(buffer));
 #if defined(__FRAMAC__)
   data_read = Frama_C_interval(0, sizeof(buffer));
   /*@ assert 0 <= data_read <= sizeof(buffer); */
@@ -623,11 +620,7 @@ static uint64_t file_check_tiff_be_aux(file_recovery_t *fr, const uint32_t tiff_
 	    const uint32_t *subifd_offsetp=(const uint32_t *)&subifd_offsetp_buf;
 	    /*@ assert \valid_read(subifd_offsetp + (0 .. 31)); */
 	    unsigned int j;
-	    if(fseek(fr->handle, be32(entry->tdir_offset), SEEK_SET) < 0)
-	    {
-	      return TIFF_ERROR;
-	    }
-	    if(fread(&subifd_offsetp_buf, sizeof(uint32_t), nbr, fr->handle) != nbr)
+	    if(tiff_read(fr, &subifd_offsetp_buf, be32(entry->tdir_offset), nbr*sizeof(uint32_t)) != nbr*sizeof(uint32_t))
 	    {
 	      return TIFF_ERROR;
 	    }
@@ -689,7 +682,7 @@ static uint64_t file_check_tiff_be_aux(file_recovery_t *fr, const uint32_t tiff_
     max_offset = tile_offsets + tile_bytecounts;
   if(entry_strip_offsets != NULL && entry_strip_bytecounts != NULL)
   {
-    const uint64_t tmp=parse_strip_be(fr->handle, entry_strip_offsets, entry_strip_bytecounts);
+    const uint64_t tmp=parse_strip_be(fr, entry_strip_offsets, entry_strip_bytecounts);
     if(tmp==TIFF_ERROR)
       return TIFF_ERROR;
     if(max_offset < tmp)
@@ -697,7 +690,7 @@ static uint64_t file_check_tiff_be_aux(file_recovery_t *fr, const uint32_t tiff_
   }
   if(entry_tile_offsets != NULL && entry_tile_bytecounts != NULL)
   {
-    const uint64_t tmp=parse_strip_be(fr->handle, entry_tile_offsets, entry_tile_bytecounts);
+    const uint64_t tmp=parse_strip_be(fr, entry_tile_offsets, entry_tile_bytecounts);
     if(tmp==TIFF_ERROR)
       return TIFF_ERROR;
     if(max_offset < tmp)
@@ -751,9 +744,11 @@ static void file_check_tiff_be(file_recovery_t *fr)
   char buffer[sizeof(TIFFHeader)];
   const TIFFHeader *header=(const TIFFHeader *)&buffer;
   /*@ assert \valid_read(header); */
-  if(fseek(fr->handle, 0, SEEK_SET) < 0 ||
-      fread(&buffer, sizeof(TIFFHeader), 1, fr->handle) != 1)
+  if(tiff_read(fr, &buffer, 0, sizeof(TIFFHeader)) != sizeof(TIFFHeader))
   {
+#ifndef DISABLED_FOR_FRAMAC
+    tiff_stream_free();
+#endif
     fr->file_size=0;
     return;
   }
@@ -762,6 +757,9 @@ static void file_check_tiff_be(file_recovery_t *fr)
 #endif
   if(header->tiff_magic==TIFF_BIGENDIAN)
     calculated_file_size=file_check_tiff_be_aux(fr, be32(header->tiff_diroff), 0, 0);
+#ifndef DISABLED_FOR_FRAMAC
+  tiff_stream_free();
+#endif
   /*@ assert \valid(fr->handle); */
 #ifdef DEBUG_TIFF
   log_info("TIFF Current   %llu\n", (unsigned long long)fr->file_size);
@@ -833,6 +831,9 @@ int header_check_tiff_be(const unsigned char *buffer, const unsigned int buffer_
   }
   file_recovery_new->time=get_date_from_tiff_header(buffer, buffer_size);
   file_recovery_new->file_check=&file_check_tiff_be;
+#ifndef DISABLED_FOR_FRAMAC
+  file_recovery_new->data_check=&data_check_tiff;
+#endif
   return 1;
 }
 #endif
@@ -513,6 +513,27 @@ static double is_random(const unsigned char *buffer, const unsigned int buffer_s
     return 1;
 #ifndef DISABLED_FOR_FRAMAC
   memset(&stats, 0, sizeof(stats));
+  {
+    /* Four histograms, consecutive identical bytes don't wait for each
+     * other's increment */
+    unsigned int stats1[256];
+    unsigned int stats2[256];
+    unsigned int stats3[256];
+    memset(&stats1, 0, sizeof(stats1));
+    memset(&stats2, 0, sizeof(stats2));
+    memset(&stats3, 0, sizeof(stats3));
+    for(i=0; i+4<=buffer_size; i+=4)
+    {
+      stats[buffer[i]]++;
+      stats1[buffer[i+1]]++;
+      stats2[buffer[i+2]]++;
+      stats3[buffer[i+3]]++;
+    }
+    for(; i<buffer_size; i++)
+      stats[buffer[i]]++;
+    for(i=0; i<256; i++)
+      stats[i]+=stats1[i]+stats2[i]+stats3[i];
+  }
 #else
   /*@
     @ loop invariant \forall integer j; (0 <= j < i) ==> stats[j] == 0;
@@ -522,7 +543,6 @@ static double is_random(const unsigned char *buffer, const unsigned int buffer_s
     @ */
   for(i=0; i < 256; i++)
     stats[i] = 0;
-#endif
   /*@ assert initialization: \initialized(&stats[0 .. 255]); */
   /*@ assert \forall int j; (0 <= j <= 255) ==> (stats[j] == 0); */
   /*@
@@ -537,6 +557,7 @@ static double is_random(const unsigned char *buffer, const unsigned int buffer_s
     stats[buffer[i]]++;
     /*@ assert \forall int j; (0 <= j <= 255) ==> (stats[j] <= i+1); */
   }
+#endif
   /*@ assert \forall integer j; (0 <= j <= 255) ==> stats[j] <= buffer_size; */
   ind=0;
   /*@
@@ -1353,6 +1374,8 @@ static int header_check_mol2(const unsigned char *buffer, const unsigned int buf
   @*/
 static int header_check_perlm(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
+  static const char *const java_keywords[3]={ "class", "private static", "public interface" };
+  static const unsigned int java_keywords_len[3]={ 5, 14, 16 };
   unsigned int i;
   const unsigned int buffer_size_test=(buffer_size < 2048 ? buffer_size : 2048);
   if(buffer_size < 128)
@@ -1367,9 +1390,7 @@ static int header_check_perlm(const unsigned char *buffer, const unsigned int bu
   reset_file_recovery(file_recovery_new);
   file_recovery_new->data_check=&data_check_txt;
   file_recovery_new->file_check=&file_check_size;
-  if( td_memmem(buffer, buffer_size_test, "class", 5)!=NULL ||
-      td_memmem(buffer, buffer_size_test, "private static", 14)!=NULL ||
-      td_memmem(buffer, buffer_size_test, "public interface", 16)!=NULL)
+  if(td_memmem_multi(buffer, buffer_size_test, java_keywords, java_keywords_len, 3)!=NULL)
   {
     /* source code in java */
     file_recovery_new->extension=extension_java;
@@ -1635,6 +1656,108 @@ static const char*she_bang_to_ext(const unsigned char *haystack, const unsigned
   return NULL;
 }
 
+/* Keywords searched in the lowercase text by header_check_txt() */
+#define TXT_KW_AUTORUN		0x00001
+#define TXT_KW_PHP		0x00002
+#define TXT_KW_TEX		0x00004
+#define TXT_KW_INCLUDE		0x00008
+#define TXT_KW_JSP_DIRECTIVE	0x00010
+#define TXT_KW_JSP_EXPRESSION	0x00020
+#define TXT_KW_ASP		0x00040
+#define TXT_KW_HTML		0x00080
+#define TXT_KW_JAVA		0x00100
+#define TXT_KW_GO_IMPORT	0x00200
+#define TXT_KW_IMPORT		0x00400
+#define TXT_KW_CLASS		0x00800
+#define TXT_KW_LILYPOND		0x01000
+#define TXT_KW_COMMENT		0x02000
+#define TXT_KW_BR		0x04000
+#define TXT_KW_P		0x08000
+
+/* The keywords found in a single pass over the string: the character at
+ * each position selects the few keywords that can start there */
+/*@
+  @ requires valid_read_string(buffer_lower);
+  @ assigns \nothing;
+  @*/
+static unsigned int txt_keywords(const char *buffer_lower)
+{
+  unsigned int found=0;
+  const char *p;
+  /*@
+    @ loop invariant valid_read_string(p);
+    @ loop assigns p, found;
+    @ loop variant strlen(p);
+    @*/
+  for(p=buffer_lower; *p!='\0'; p++)
+  {
+    switch(*p)
+    {
+      case '[':
+	if(strncmp(p, "[autorun]", 9)==0)
+	  found|=TXT_KW_AUTORUN;
+	break;
+      case '<':
+	switch(p[1])
+	{
+	  case '?':
+	    if(strncmp(p, "<?php", 5)==0)
+	      found|=TXT_KW_PHP;
+	    break;
+	  case '%':
+	    if(p[2]=='@')
+	      found|=TXT_KW_JSP_DIRECTIVE;
+	    else if(p[2]=='=')
+	      found|=TXT_KW_JSP_EXPRESSION;
+	    else if(p[2]==' ')
+	      found|=TXT_KW_ASP;
+	    break;
+	  case 'h':
+	    if(strncmp(p, "<html", 5)==0)
+	      found|=TXT_KW_HTML;
+	    break;
+	  case 'b':
+	    if(strncmp(p, "<br>", 4)==0)
+	      found|=TXT_KW_BR;
+	    break;
+	  case 'p':
+	    if(p[2]=='>')
+	      found|=TXT_KW_P;
+	    break;
+	}
+	break;
+      case '\\':
+	if(strncmp(p, "\\begin{", 7)==0)
+	  found|=TXT_KW_TEX;
+	else if(strncmp(p, "\\score {", 8)==0)
+	  found|=TXT_KW_LILYPOND;
+	break;
+      case '#':
+	if(strncmp(p, "#include", 8)==0)
+	  found|=TXT_KW_INCLUDE;
+	break;
+      case 'p':
+	if(strncmp(p, "private static", 14)==0 ||
+	    strncmp(p, "public interface", 16)==0)
+	  found|=TXT_KW_JAVA;
+	break;
+      case '\n':
+	if(strncmp(p, "\nimport ", 8)==0)
+	  found|=(p[8]=='(' ? TXT_KW_GO_IMPORT : TXT_KW_IMPORT);
+	break;
+      case 'c':
+	if(strncmp(p, "class ", 6)==0)
+	  found|=TXT_KW_CLASS;
+	break;
+      case '/':
+	if(p[1]=='*')
+	  found|=TXT_KW_COMMENT;
+	break;
+    }
+  }
+  return found;
+}
+
 /*@
   @ requires separation: \separated(&file_hint_fasttxt, buffer+(..), file_recovery, file_recovery_new);
   @ requires valid_header_check_param(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
@@ -1648,8 +1771,8 @@ static const char*she_bang_to_ext(const unsigned char *haystack, const unsigned
   @*/
 static int header_check_txt(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
-  static char *buffer_lower=NULL;
-  static unsigned int buffer_lower_size=0;
+  static TD_THREAD_LOCAL char *buffer_lower=NULL;
+  static TD_THREAD_LOCAL unsigned int buffer_lower_size=0;
   unsigned int l;
   const unsigned int buffer_size_test=(buffer_size < 2048 ? buffer_size : 2048);
   if(buffer_size < 512)
@@ -1831,9 +1954,10 @@ static int header_check_txt(const unsigned char *buffer, const unsigned int buff
      * ind_random=~1: constant	*/
     double ind_random;
     const char *str;
+    const unsigned int kw=txt_keywords(buffer_lower);
     ind_random=is_random((const unsigned char *)buffer_lower, l);
     /* Windows Autorun */
-    if(strstr(buffer_lower, "[autorun]")!=NULL)
+    if((kw & TXT_KW_AUTORUN)!=0)
     {
       ext=extension_inf;
       log_info("ext=%s\n", ext);
@@ -1842,34 +1966,33 @@ static int header_check_txt(const unsigned char *buffer, const unsigned int buff
     else if(buffer[0]=='[' && l>50 && is_ini((const char *)buffer_lower))
       ext=extension_ini;
     /* php (Hypertext Preprocessor) script */
-    else if(strstr(buffer_lower, "<?php")!=NULL)
+    else if((kw & TXT_KW_PHP)!=0)
       ext=extension_php;
     /* Comma separated values */
     else if(is_csv(buffer_lower, l)!=0)
       ext=extension_csv;
     /* Detect LaTeX, C, PHP, JSP, ASP, HTML, C header */
-    else if(strstr(buffer_lower, "\\begin{")!=NULL)
+    else if((kw & TXT_KW_TEX)!=0)
       ext=extension_tex;
-    else if(strstr(buffer_lower, "#include")!=NULL)
+    else if((kw & TXT_KW_INCLUDE)!=0)
       ext=extension_c;
-    else if(l>20 && strstr(buffer_lower, "<%@")!=NULL)
+    else if(l>20 && (kw & TXT_KW_JSP_DIRECTIVE)!=0)
       ext=extension_jsp;
-    else if(l>20 && strstr(buffer_lower, "<%=")!=NULL)
+    else if(l>20 && (kw & TXT_KW_JSP_EXPRESSION)!=0)
       ext=extension_jsp;
-    else if(l>20 && strstr(buffer_lower, "<% ")!=NULL)
+    else if(l>20 && (kw & TXT_KW_ASP)!=0)
       ext=extension_asp;
-    else if(strstr(buffer_lower, "<html")!=NULL)
+    else if((kw & TXT_KW_HTML)!=0)
       ext=extension_html;
-    else if(strstr(buffer_lower, "private static")!=NULL ||
-	strstr(buffer_lower, "public interface")!=NULL)
+    else if((kw & TXT_KW_JAVA)!=0)
     {
       ext=extension_java;
     }
-    else if(strstr(buffer_lower, "\nimport (")!=NULL)
+    else if((kw & TXT_KW_GO_IMPORT)!=0)
     {
       ext=extension_go;
     }
-    else if((str=strstr(buffer_lower, "\nimport "))!=NULL)
+    else if((kw & TXT_KW_IMPORT)!=0 && (str=strstr(buffer_lower, "\nimport "))!=NULL)
     {
       /*@ assert valid_read_string(str); */
 #ifndef DISABLED_FOR_FRAMAC
@@ -1888,7 +2011,7 @@ static int header_check_txt(const unsigned char *buffer, const unsigned int buff
       else
 	ext=extension_py;
     }
-    else if(strstr(buffer_lower, "class ")!=NULL &&
+    else if((kw & TXT_KW_CLASS)!=0 &&
 	(l>=100 || file_recovery->file_stat==NULL))
     {
       ext=extension_java;
@@ -1897,17 +2020,17 @@ static int header_check_txt(const unsigned char *buffer, const unsigned int buff
     else if(ind_random<0.9 && is_fortran(buffer_lower)!=0)
       ext=extension_f;
     /* LilyPond http://lilypond.org*/
-    else if(strstr(buffer_lower, "\\score {")!=NULL)
+    else if((kw & TXT_KW_LILYPOND)!=0)
       ext=extension_ly;
     /* C header file */
-    else if(strstr(buffer_lower, "/*")!=NULL && l>50)
+    else if((kw & TXT_KW_COMMENT)!=0 && l>50)
       ext=extension_h;
     else if(l<100 || ind_random<0.03 || ind_random>0.90)
       ext=NULL;
     /* JavaScript Object Notation  */
     else if(memcmp(buffer_lower, "{\"", 2)==0)
       ext=extension_json;
-    else if(strstr(buffer_lower,"<br>")!=NULL || strstr(buffer_lower,"<p>")!=NULL)
+    else if((kw & (TXT_KW_BR | TXT_KW_P))!=0)
       ext=extension_html;
     else
       ext=file_hint_txt.extension;
@@ -2035,82 +2158,112 @@ static void header_check_xml_aux(const char *buf, const unsigned int buffer_size
     @*/
   while(*tmp!='\x00')
   {
-    if(strncasecmp(tmp, "<Grisbi>", 8)==0)
-    {
-      /* Grisbi - Personal Finance Manager XML data */
-      file_recovery_new->extension=extension_gsb;
-      return;
-    }
-    else if(strncasecmp(tmp, "<collection type=\"GC", 20)==0)
-    {
-      /* GCstart, personal collections manager, http://www.gcstar.org/ */
-      file_recovery_new->extension=extension_gcs;
-      return;
-    }
-    else if(strncasecmp(tmp, "<html", 5)==0)
-    {
-      file_recovery_new->data_check=&data_check_html;
-      file_recovery_new->extension=extension_html;
-      file_recovery_new->file_rename=&file_rename_html;
-      return;
-    }
-    else if(strncasecmp(tmp, "<Version>QBFSD", 14)==0)
-    {
-      /* QuickBook */
-      file_recovery_new->extension=extension_fst;
-      return;
-    }
-    else if(strncasecmp(tmp, "<svg", 4)==0)
-    {
-      /* Scalable Vector Graphics */
-      file_recovery_new->extension=extension_svg;
-      file_recovery_new->file_check=&file_check_svg;
-      return;
-    }
-    else if(strncasecmp(tmp, "<!DOCTYPE CDXML", 15)==0)
-    {
-      file_recovery_new->extension=extension_cdxml;
-      return;
-    }
-    else if(strncasecmp(tmp, "<!DOCTYPE plist ", 16)==0)
-    {
-      /* Mac OS X property list */
-      file_recovery_new->extension=extension_plist;
-      return;
-    }
-    else if(strncasecmp(tmp, "<gpx ", 5)==0)
-    {
-      /* GPS eXchange Format */
-      file_recovery_new->extension=extension_gpx;
-      file_recovery_new->file_check=&file_check_gpx;
-      return;
-    }
-    else if(strncasecmp(tmp, "<PremiereData Version=", 22)==0)
+    /* The first character of the element selects the roots to compare */
+    switch(tmp[1])
     {
-      /* Adobe Premiere project  */
-      file_recovery_new->data_check=NULL;
-      file_recovery_new->extension=extension_prproj;
-      return;
-    }
-    else if(strncasecmp(tmp, "<SCRIBUS", 8)==0)
-    {
-      /* Scribus XML file */
-      file_recovery_new->extension=extension_sla;
-      return;
-    }
-    else if(strncasecmp(tmp, "<FictionBook", 12)==0)
-    {
-      /* FictionBook, see http://www.fictionbook.org */
-      file_recovery_new->extension=extension_fb2;
-      return;
-    }
-    else if(strncasecmp(tmp, "<office:document", 16)==0)
-    {
-      /* OpenDocument Flat XML Spreadsheet */
-      file_recovery_new->extension=extension_fods;
-      file_recovery_new->data_check=NULL;
-      file_recovery_new->file_rename=&file_rename_fods;
-      return;
+      case 'G':
+      case 'g':
+	if(strncasecmp(tmp, "<Grisbi>", 8)==0)
+	{
+	  /* Grisbi - Personal Finance Manager XML data */
+	  file_recovery_new->extension=extension_gsb;
+	  return;
+	}
+	if(strncasecmp(tmp, "<gpx ", 5)==0)
+	{
+	  /* GPS eXchange Format */
+	  file_recovery_new->extension=extension_gpx;
+	  file_recovery_new->file_check=&file_check_gpx;
+	  return;
+	}
+	break;
+      case 'C':
+      case 'c':
+	if(strncasecmp(tmp, "<collection type=\"GC", 20)==0)
+	{
+	  /* GCstart, personal collections manager, http://www.gcstar.org/ */
+	  file_recovery_new->extension=extension_gcs;
+	  return;
+	}
+	break;
+      case 'H':
+      case 'h':
+	if(strncasecmp(tmp, "<html", 5)==0)
+	{
+	  file_recovery_new->data_check=&data_check_html;
+	  file_recovery_new->extension=extension_html;
+	  file_recovery_new->file_rename=&file_rename_html;
+	  return;
+	}
+	break;
+      case 'V':
+      case 'v':
+	if(strncasecmp(tmp, "<Version>QBFSD", 14)==0)
+	{
+	  /* QuickBook */
+	  file_recovery_new->extension=extension_fst;
+	  return;
+	}
+	break;
+      case 'S':
+      case 's':
+	if(strncasecmp(tmp, "<svg", 4)==0)
+	{
+	  /* Scalable Vector Graphics */
+	  file_recovery_new->extension=extension_svg;
+	  file_recovery_new->file_check=&file_check_svg;
+	  return;
+	}
+	if(strncasecmp(tmp, "<SCRIBUS", 8)==0)
+	{
+	  /* Scribus XML file */
+	  file_recovery_new->extension=extension_sla;
+	  return;
+	}
+	break;
+      case '!':
+	if(strncasecmp(tmp, "<!DOCTYPE CDXML", 15)==0)
+	{
+	  file_recovery_new->extension=extension_cdxml;
+	  return;
+	}
+	if(strncasecmp(tmp, "<!DOCTYPE plist ", 16)==0)
+	{
+	  /* Mac OS X property list */
+	  file_recovery_new->extension=extension_plist;
+	  return;
+	}
+	break;
+      case 'P':
+      case 'p':
+	if(strncasecmp(tmp, "<PremiereData Version=", 22)==0)
+	{
+	  /* Adobe Premiere project  */
+	  file_recovery_new->data_check=NULL;
+	  file_recovery_new->extension=extension_prproj;
+	  return;
+	}
+	break;
+      case 'F':
+      case 'f':
+	if(strncasecmp(tmp, "<FictionBook", 12)==0)
+	{
+	  /* FictionBook, see http://www.fictionbook.org */
+	  file_recovery_new->extension=extension_fb2;
+	  return;
+	}
+	break;
+      case 'O':
+      case 'o':
+	if(strncasecmp(tmp, "<office:document", 16)==0)
+	{
+	  /* OpenDocument Flat XML Spreadsheet */
+	  file_recovery_new->extension=extension_fods;
+	  file_recovery_new->data_check=NULL;
+	  file_recovery_new->file_rename=&file_rename_fods;
+	  return;
+	}
+	break;
     }
     tmp++;
 #ifndef DISABLED_FOR_FRAMAC
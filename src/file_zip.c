@@ -26,6 +26,10 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_LIBZ
+#undef HAVE_ZLIB_H
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -33,10 +37,17 @@
 #include <stdlib.h>
 #endif
 #include <stdio.h>
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+/* inflate() reads the data of the file in place */
+#define ZLIB_CONST
+#include <zlib.h>
+#endif
 #include "types.h"
 #include "filegen.h"
 #include "common.h"
 #include "log.h"
+#include "memmem.h"
+#include "crc.h"
 #if defined(__FRAMAC__)
 #include "__fc_builtin.h"
 #endif
@@ -48,11 +59,11 @@ extern const file_hint_t file_hint_doc;
 #endif
 static void register_header_check_zip(file_stat_t *file_stat);
 static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int haystack_size, const unsigned char *needle, const unsigned int needle_size);
-static char first_filename[256];
-static uint64_t expected_compressed_size=0;
-static int msoffice=0;
-static int sh3d=0;
-static const char *ext_msoffice=NULL;
+static TD_THREAD_LOCAL char first_filename[256];
+static TD_THREAD_LOCAL uint64_t expected_compressed_size=0;
+static TD_THREAD_LOCAL int msoffice=0;
+static TD_THREAD_LOCAL int sh3d=0;
+static TD_THREAD_LOCAL const char *ext_msoffice=NULL;
 
 const file_hint_t file_hint_zip= {
   .extension="zip",
@@ -311,6 +322,86 @@ static const char *zip_parse_parse_entry_mimetype(const char *mime, const unsign
   return extension_sxw;
 }
 
+/*@
+  @ requires valid_read_string(filename);
+  @ requires \valid(ext);
+  @ requires *ext == \null;
+  @ requires mime == \null || \valid_read(mime + (0 .. 127));
+  @ requires \separated(ext, &msoffice, &sh3d, &ext_msoffice);
+  @ assigns *ext, msoffice, sh3d, ext_msoffice;
+  @*/
+/* Set ext from the name of an entry, mime holds the first bytes of the
+ * data of a "mimetype" first entry */
+static void zip_parse_file_entry_name(const char *filename, const unsigned int len, const char **ext, const unsigned int file_nbr, const char *mime, const unsigned int mime_len)
+{
+  if(file_nbr==0)
+  {
+    msoffice=0;
+    sh3d=0;
+    ext_msoffice=NULL;
+  }
+  if(len==19 && memcmp(filename, "[Content_Types].xml", 19)==0)
+    msoffice=1;
+  else if(file_nbr==0)
+  {
+    if(len==8 && memcmp(filename, "mimetype", 8)==0)
+    {
+      if(mime!=NULL)
+	*ext=zip_parse_parse_entry_mimetype(mime, mime_len);
+    }
+    /* Zipped Keyhole Markup Language (KML) used by Google Earth */
+    else if(len==7 && memcmp(filename, "doc.kml", 7)==0)
+      *ext=extension_kmz;
+    else if(len==4 && memcmp(filename, "Home", 4)==0)
+      sh3d=1;
+    /* Celtx, Screenwriting & Media Pre-production file */
+    else if(len==9 && memcmp(filename, "local.rdf", 9)==0)
+      *ext=extension_celtx;
+    else if(len==12 && memcmp(filename, "Document.xml", 12)==0)
+      *ext=extension_fcstd;
+    else if(len==13 && memcmp(filename, "document.json", 13)==0)
+      *ext=extension_sketch;
+    else if(len > 16 && memcmp(filename,  "atlases/atlas_ID", 16)==0)
+      *ext=extension_bbdoc;
+  }
+  else if(file_nbr==1 && sh3d==1)
+  {
+    if(len==1 && filename[0]=='0')
+      *ext=extension_sh3d;
+  }
+  if(strncmp(filename, "word/", 5)==0)
+    ext_msoffice=extension_docx;
+  else if(strncmp(filename, "xl/", 3)==0)
+    ext_msoffice=extension_xlsx;
+  else if(strncmp(filename, "ppt/", 4)==0)
+    ext_msoffice=extension_pptx;
+  else if(strncmp(filename, "visio/", 6)==0)
+    ext_msoffice=extension_vsdx;
+  if(msoffice && ext_msoffice!=NULL)
+    *ext=ext_msoffice;
+  if(*ext!=NULL)
+    return ;
+  /* iWork */
+  if(len==23 && memcmp(filename, "QuickLook/Thumbnail.jpg", 23)==0)
+    *ext=extension_pages;
+  else if(len==20 && strncasecmp(filename, "META-INF/MANIFEST.MF", 20)==0)
+    *ext=extension_jar;
+  else if(len==15 && strncasecmp(filename, "chrome.manifest", 15)==0)
+    *ext=extension_xpi;
+  /* SMART Notebook */
+  else if(len==15 && memcmp(filename, "imsmanifest.xml", 15)==0)
+    *ext=extension_notebook;
+  /* Apple Numbers */
+  else if(len==18 && memcmp(filename, "Index/Document.iwa", 18)==0)
+    *ext=extension_numbers;
+  else if(len==19 && memcmp(filename, "AndroidManifest.xml", 19)==0)
+    *ext=extension_apk;
+  else if(len==21 && memcmp(filename, "mathcad/worksheet.xml", 21)==0)
+    *ext=extension_mctx;
+  else if(len==30 && memcmp(filename, "xsd/MindManagerApplication.xsd", 30)==0)
+    *ext=extension_mmap;
+}
+
 /*@
   @ requires \valid(fr);
   @ requires \valid(fr->handle);
@@ -428,101 +519,42 @@ static int zip_parse_file_entry_fn(file_recovery_t *fr, const char **ext, const
   }
   if(*ext!=NULL)
     return 0;
-  if(file_nbr==0)
+  if(file_nbr==0 && len==8 && memcmp(filename, "mimetype", 8)==0)
   {
-    msoffice=0;
-    sh3d=0;
-    ext_msoffice=NULL;
-  }
-  if(len==19 && memcmp(filename, "[Content_Types].xml", 19)==0)
-    msoffice=1;
-  else if(file_nbr==0)
-  {
-    if(len==8 && memcmp(filename, "mimetype", 8)==0)
+    char buffer[128];
+    /*@ assert \valid_read(file); */
+    const unsigned int compressed_size=le32(file->compressed_size);
+    const int to_read=(compressed_size < 128 ? compressed_size: 128);
+    const int extra_length=le16(file->extra_length);
+    if (my_fseek(fr->handle, extra_length, SEEK_CUR) < 0)
     {
-      char buffer[128];
-      /*@ assert \valid_read(file); */
-      const unsigned int compressed_size=le32(file->compressed_size);
-      const int to_read=(compressed_size < 128 ? compressed_size: 128);
-      const int extra_length=le16(file->extra_length);
-      if (my_fseek(fr->handle, extra_length, SEEK_CUR) < 0)
-      {
 #ifdef DEBUG_ZIP
-	log_info("fseek failed\n");
+      log_info("fseek failed\n");
 #endif
-	return -1;
-      }
-      if( fread(buffer, to_read, 1, fr->handle)!=1)
-      {
+      return -1;
+    }
+    if( fread(buffer, to_read, 1, fr->handle)!=1)
+    {
 #ifdef DEBUG_ZIP
-	log_trace("zip: Unexpected EOF in file_entry data: %u bytes expected\n",
-	    compressed_size);
+      log_trace("zip: Unexpected EOF in file_entry data: %u bytes expected\n",
+          compressed_size);
 #endif
-	return -1;
-      }
+      return -1;
+    }
 #if defined(__FRAMAC__)
-      Frama_C_make_unknown(buffer, 128);
+    Frama_C_make_unknown(buffer, 128);
 #endif
-      if (my_fseek(fr->handle, -(to_read+extra_length), SEEK_CUR) < 0)
-      {
+    if (my_fseek(fr->handle, -(to_read+extra_length), SEEK_CUR) < 0)
+    {
 #ifdef DEBUG_ZIP
-	log_info("fseek failed\n");
+      log_info("fseek failed\n");
 #endif
-	return -1;
-      }
-      *ext=zip_parse_parse_entry_mimetype((const char *)&buffer, compressed_size);
+      return -1;
     }
-    /* Zipped Keyhole Markup Language (KML) used by Google Earth */
-    else if(len==7 && memcmp(filename, "doc.kml", 7)==0)
-      *ext=extension_kmz;
-    else if(len==4 && memcmp(filename, "Home", 4)==0)
-      sh3d=1;
-    /* Celtx, Screenwriting & Media Pre-production file */
-    else if(len==9 && memcmp(filename, "local.rdf", 9)==0)
-      *ext=extension_celtx;
-    else if(len==12 && memcmp(filename, "Document.xml", 12)==0)
-      *ext=extension_fcstd;
-    else if(len==13 && memcmp(filename, "document.json", 13)==0)
-      *ext=extension_sketch;
-    else if(len > 16 && memcmp(filename,  "atlases/atlas_ID", 16)==0)
-      *ext=extension_bbdoc;
-  }
-  else if(file_nbr==1 && sh3d==1)
-  {
-    if(len==1 && filename[0]=='0')
-      *ext=extension_sh3d;
-  }
-  if(strncmp(filename, "word/", 5)==0)
-    ext_msoffice=extension_docx;
-  else if(strncmp(filename, "xl/", 3)==0)
-    ext_msoffice=extension_xlsx;
-  else if(strncmp(filename, "ppt/", 4)==0)
-    ext_msoffice=extension_pptx;
-  else if(strncmp(filename, "visio/", 6)==0)
-    ext_msoffice=extension_vsdx;
-  if(msoffice && ext_msoffice!=NULL)
-    *ext=ext_msoffice;
-  if(*ext!=NULL)
+    zip_parse_file_entry_name(filename, len, ext, file_nbr, (const char *)&buffer, compressed_size);
     return 0;
-  /* iWork */
-  if(len==23 && memcmp(filename, "QuickLook/Thumbnail.jpg", 23)==0)
-    *ext=extension_pages;
-  else if(len==20 && strncasecmp(filename, "META-INF/MANIFEST.MF", 20)==0)
-    *ext=extension_jar;
-  else if(len==15 && strncasecmp(filename, "chrome.manifest", 15)==0)
-    *ext=extension_xpi;
-  /* SMART Notebook */
-  else if(len==15 && memcmp(filename, "imsmanifest.xml", 15)==0)
-    *ext=extension_notebook;
-  /* Apple Numbers */
-  else if(len==18 && memcmp(filename, "Index/Document.iwa", 18)==0)
-    *ext=extension_numbers;
-  else if(len==19 && memcmp(filename, "AndroidManifest.xml", 19)==0)
-    *ext=extension_apk;
-  else if(len==21 && memcmp(filename, "mathcad/worksheet.xml", 21)==0)
-    *ext=extension_mctx;
-  else if(len==30 && memcmp(filename, "xsd/MindManagerApplication.xsd", 30)==0)
-    *ext=extension_mmap;
+  }
+  zip_parse_file_entry_name(filename, len, ext, file_nbr, NULL, 0);
   return 0;
 }
 
@@ -1036,6 +1068,494 @@ static int zip64_parse_end_central_dir_locator(file_recovery_t *fr)
   return 0;
 }
 
+/* The records are checked as the blocks are written by data_check_zip(),
+ * the state of the walk is saved after each record so file_check_zip()
+ * and file_rename_zip() only have to read the records that haven't been
+ * checked yet, usually the end of central directory record only. */
+typedef enum
+{
+  ZIP_STREAM_INVALID=0,	/* No checkpoint for this file */
+  ZIP_STREAM_RECORD,	/* Waiting for the record at cur.next */
+  ZIP_STREAM_DESC,	/* Searching the data descriptor from desc_pos */
+  ZIP_STREAM_EOCD,	/* checkpoint is the end of central directory */
+  ZIP_STREAM_FROZEN	/* checkpoint is kept, file_check_zip() does the rest */
+} zip_stream_status_t;
+
+/* With file_deep_check, the data of the members with a known size are
+ * checked against the CRC-32 and the size of their local file header */
+typedef enum
+{
+  ZIP_MEMBER_NONE=0,
+  ZIP_MEMBER_STORED,
+  ZIP_MEMBER_DEFLATE
+} zip_member_t;
+
+/* Variables of the walk in file_check_zip() at a record boundary */
+typedef struct
+{
+  uint64_t next;
+  uint64_t offset_ok;
+  uint64_t expected_compressed_size;
+  time_t time;
+  const char *ext;
+  const char *ext_msoffice;
+  unsigned int file_nbr;
+  int msoffice;
+  int sh3d;
+  char first_filename[256];
+} zip_walk_t;
+
+typedef struct
+{
+  char filename[2048];
+  uint64_t file_size;		/* file size expected by the next call */
+  uint64_t desc_start;
+  uint64_t desc_pos;
+  uint64_t eocd_end;
+  zip_stream_status_t status;
+  zip_walk_t cur;
+  zip_walk_t ckpt;
+  /* Member being checked */
+  zip_member_t member;
+  uint64_t member_start;	/* Offset of the local file header */
+  uint64_t member_pos;		/* Next byte to check */
+  uint64_t member_end;
+  uint64_t member_size;		/* Uncompressed size from the header */
+  uint64_t size;
+  uint32_t member_crc;
+  uint32_t crc;
+  int inflate_end;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  int inflate_init;
+  z_stream strm;
+#endif
+  /* Result of the last successful file_check_zip() for file_rename_zip() */
+  int checked;
+  const char *checked_ext;
+  char checked_filename[2048];
+  char checked_first_filename[256];
+} zip_stream_t;
+
+static TD_THREAD_LOCAL zip_stream_t zip_stream;
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Start the check of the member whose data are between data and end */
+static void zip_stream_member_start(zip_stream_t *zs, const zip_file_entry_t *file, const uint64_t start, const uint64_t data, const uint64_t end)
+{
+  const unsigned int compression=le16(file->compression);
+  zs->member=ZIP_MEMBER_NONE;
+  if(file->is_encrypted || file->has_descriptor ||
+      le32(file->compressed_size)==0xffffffff ||
+      le32(file->uncompressed_size)==0xffffffff ||
+      end - data != le32(file->compressed_size))
+    return ;
+  if(compression==0)
+    zs->member=ZIP_MEMBER_STORED;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  else if(compression==8)
+  {
+    /* The inflate state is allocated once and reset for each member */
+    if(zs->inflate_init==0)
+    {
+      memset(&zs->strm, 0, sizeof(zs->strm));
+      if(inflateInit2(&zs->strm, -MAX_WBITS)!=Z_OK)
+	return ;
+      zs->inflate_init=1;
+    }
+    else if(inflateReset(&zs->strm)!=Z_OK)
+      return ;
+    zs->member=ZIP_MEMBER_DEFLATE;
+  }
+#endif
+  else
+    return ;
+  zs->member_start=start;
+  zs->member_pos=data;
+  zs->member_end=end;
+  zs->member_size=le32(file->uncompressed_size);
+  zs->member_crc=le32(file->crc32);
+  zs->size=0;
+  zs->crc=0xFFFFFFFF;
+  zs->inflate_end=0;
+}
+
+/* Check the data of the member found in the buffer.
+ * Returns 1 if the member is valid or can't be checked, 0 if more data
+ * are needed, -1 if the member is damaged */
+static int zip_stream_member(zip_stream_t *zs, const unsigned char *buffer, const unsigned int buffer_size, const file_recovery_t *file_recovery)
+{
+  const uint64_t to=(zs->member_end < zs->file_size ? zs->member_end : zs->file_size);
+  if(zs->member_pos + buffer_size/2 < file_recovery->file_size)
+  {
+    /* Data no longer available */
+    zs->member=ZIP_MEMBER_NONE;
+    return 1;
+  }
+  if(to > zs->member_pos)
+  {
+    const unsigned char *p=&buffer[zs->member_pos + buffer_size/2 - file_recovery->file_size];
+    const unsigned int n=to - zs->member_pos;
+    zs->member_pos=to;
+    if(zs->member==ZIP_MEMBER_STORED)
+    {
+      zs->crc=get_crc32(p, n, zs->crc);
+      zs->size+=n;
+    }
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    else if(zs->inflate_end==0)
+    {
+      unsigned char out[32768];
+      zs->strm.next_in=p;
+      zs->strm.avail_in=n;
+      while(zs->strm.avail_in > 0)
+      {
+	int err;
+	unsigned int len;
+	zs->strm.next_out=out;
+	zs->strm.avail_out=sizeof(out);
+	err=inflate(&zs->strm, Z_NO_FLUSH);
+	len=sizeof(out) - zs->strm.avail_out;
+	zs->crc=get_crc32(out, len, zs->crc);
+	zs->size+=len;
+	if(err==Z_STREAM_END)
+	{
+	  zs->inflate_end=1;
+	  break;
+	}
+	if(err!=Z_OK)
+	{
+	  zs->member=ZIP_MEMBER_NONE;
+	  return -1;
+	}
+      }
+    }
+#endif
+  }
+  if(zs->member_pos < zs->member_end)
+    return 0;
+  if(zs->member==ZIP_MEMBER_DEFLATE && zs->inflate_end==0)
+  {
+    zs->member=ZIP_MEMBER_NONE;
+    return -1;
+  }
+  zs->member=ZIP_MEMBER_NONE;
+  if((zs->crc ^ 0xFFFFFFFF)!=zs->member_crc || zs->size!=zs->member_size)
+    return -1;
+  return 1;
+}
+#endif
+
+/*@
+  @ requires \valid(zs);
+  @ requires \valid_read(p + (0 .. avail-1));
+  @ requires avail >= 30;
+  @ requires \separated(zs, p + (..), &msoffice, &sh3d, &ext_msoffice);
+  @ ensures \result == -1 || \result == 0 || \result == 1;
+  @ assigns *zs, msoffice, sh3d, ext_msoffice;
+  @*/
+static int zip_stream_file_entry(zip_stream_t *zs, const unsigned char *p, const unsigned int avail)
+{
+  zip_walk_t *w=&zs->cur;
+  const zip_file_entry_t *file=(const zip_file_entry_t *)&p[4];
+  const unsigned int fn_len=le16(file->filename_length);
+  const unsigned int extra_len=le16(file->extra_length);
+  const unsigned int compressed_size=le32(file->compressed_size);
+  unsigned int need=30+fn_len;
+  unsigned int to_read=0;
+  int mimetype=0;
+  uint64_t len;
+  uint64_t end;
+  if(avail < need)
+    return 0;
+  if(fn_len==17 && memcmp(&p[30], "encrypted-package", 17)==0)
+    return -1;
+  if(w->ext==NULL && w->file_nbr==0 && fn_len==8 && memcmp(&p[30], "mimetype", 8)==0)
+  {
+    to_read=(compressed_size < 128 ? compressed_size: 128);
+    if(to_read==0)
+      return -1;
+    need=30+fn_len+extra_len+to_read;
+    mimetype=1;
+  }
+  if(compressed_size==0xffffffff && extra_len > 0 && need < 30+fn_len+sizeof(zip64_extra_entry_t))
+    need=30+fn_len+sizeof(zip64_extra_entry_t);
+  if(avail < need)
+    return 0;
+  /* Avoid Jan  1  1980 files */
+  if(le16(file->last_mod_time)!=0 || le16(file->last_mod_date)!=33)
+  {
+    const time_t tmp=date_dos2unix(le16(file->last_mod_time), le16(file->last_mod_date));
+    if(w->time < tmp)
+      w->time=tmp;
+  }
+  if(fn_len > 0)
+  {
+    char filename[256];
+    const unsigned int len_tmp=(fn_len<255?fn_len:255);
+    memcpy(filename, &p[30], len_tmp);
+    filename[len_tmp]='\0';
+    if(w->first_filename[0]=='\0')
+    {
+      strncpy(w->first_filename, filename, len_tmp);
+      w->first_filename[len_tmp]='\0';
+    }
+    if(w->ext==NULL)
+    {
+      msoffice=w->msoffice;
+      sh3d=w->sh3d;
+      ext_msoffice=w->ext_msoffice;
+      if(mimetype)
+      {
+	char mime[128];
+	memset(mime, 0, sizeof(mime));
+	memcpy(mime, &p[30+fn_len+extra_len], to_read);
+	zip_parse_file_entry_name(filename, fn_len, &w->ext, w->file_nbr, mime, compressed_size);
+      }
+      else
+	zip_parse_file_entry_name(filename, fn_len, &w->ext, w->file_nbr, NULL, 0);
+      w->msoffice=msoffice;
+      w->sh3d=sh3d;
+      w->ext_msoffice=ext_msoffice;
+    }
+  }
+  len=compressed_size;
+  if(len==0xffffffff && extra_len > 0)
+  {
+    const zip64_extra_entry_t *extra=(const zip64_extra_entry_t *)&p[30+fn_len];
+    if(le16(extra->tag)==1)
+    {
+      len=le64(extra->compressed_size);
+      if(len >= 0x8000000000000000)
+	return -1;
+    }
+  }
+  if(w->ext == extension_kra && len==0x5a495343 && le32(file->uncompressed_size) == 0x5a495355)
+    len=19;
+  end=w->next + 30 + fn_len + extra_len;
+  if(end + len >= 0x8000000000000000 - 4)
+    return -1;
+#ifndef DISABLED_FOR_FRAMAC
+  if(file_deep_check > 0 && w->ext!=extension_kra)
+    zip_stream_member_start(zs, file, w->next, end, end+len);
+#endif
+  w->offset_ok=w->next+4;
+  w->next=end+len;
+  w->expected_compressed_size=len;
+  w->file_nbr++;
+  if(w->file_nbr>=0xffffffff)
+    return -1;
+  if(file->has_descriptor && (le16(file->compression)==8 || le16(file->compression)==9))
+  {
+    zs->status=ZIP_STREAM_DESC;
+    zs->desc_start=w->next;
+    zs->desc_pos=w->next;
+  }
+  return 1;
+}
+
+/* Check the record at zs->cur.next, p points to its first byte.
+ * Returns 1 if the record has been parsed, 0 if more data are needed,
+ * -1 if the record isn't handled here */
+/*@
+  @ requires \valid(zs);
+  @ requires \valid_read(p + (0 .. avail-1));
+  @ requires \separated(zs, p + (..), &msoffice, &sh3d, &ext_msoffice);
+  @ ensures \result == -1 || \result == 0 || \result == 1;
+  @ assigns *zs, msoffice, sh3d, ext_msoffice;
+  @*/
+static int zip_stream_record(zip_stream_t *zs, const unsigned char *p, const unsigned int avail)
+{
+  zip_walk_t *w=&zs->cur;
+  uint64_t len;
+  if(avail < 4)
+    return 0;
+  switch(le32(*(const uint32_t *)p))
+  {
+    case ZIP_FILE_ENTRY:
+      if(avail < 30)
+	return 0;
+      return zip_stream_file_entry(zs, p, avail);
+    case ZIP_CENTRAL_DIR:
+      if(avail < 46)
+	return 0;
+      {
+	const zip_file_entry_t *file=(const zip_file_entry_t *)&p[6];
+	const struct zip_central_dir *dir=(const struct zip_central_dir *)&p[6+sizeof(zip_file_entry_t)];
+	len=46 + le16(file->extra_length) + le16(dir->comment_length) + le16(file->filename_length);
+      }
+      break;
+    case ZIP_CENTRAL_DIR64:
+      if(avail < 4+sizeof(struct zip64_end_central_dir))
+	return 0;
+      {
+	const struct zip64_end_central_dir *dir=(const struct zip64_end_central_dir *)&p[4];
+	const uint64_t end_size=le64(dir->end_size);
+	if(end_size >= 0x8000000000000000 - sizeof(struct zip64_end_central_dir) - 4)
+	  return -1;
+	len=4 + sizeof(struct zip64_end_central_dir) + end_size;
+      }
+      break;
+    case ZIP_END_CENTRAL_DIR:
+      if(avail < 4+sizeof(struct zip_end_central_dir))
+	return 0;
+      {
+	const struct zip_end_central_dir *dir=(const struct zip_end_central_dir *)&p[4];
+	zs->eocd_end=w->next + 4 + sizeof(struct zip_end_central_dir) + le16(dir->comment_length);
+      }
+      zs->status=ZIP_STREAM_EOCD;
+      return 1;
+    case ZIP_END_CENTRAL_DIR64:
+      if(avail < 4+sizeof(struct zip64_loc))
+	return 0;
+      len=4 + sizeof(struct zip64_loc);
+      break;
+    case ZIP_DATA_DESCRIPTOR:
+      if(avail < 4+sizeof(struct zip_desc))
+	return 0;
+      {
+	const struct zip_desc *desc=(const struct zip_desc *)&p[4];
+	if(le32(desc->compressed_size)!=w->expected_compressed_size)
+	  return -1;
+      }
+      len=4 + sizeof(struct zip_desc);
+      break;
+    case ZIP_SIGNATURE:
+      if(avail < 6)
+	return 0;
+      len=6 + le16(*(const uint16_t *)&p[4]);
+      break;
+    default:
+      return -1;
+  }
+  if(w->next + len >= 0x8000000000000000 - 4)
+    return -1;
+  w->offset_ok=w->next+4;
+  w->next+=len;
+  return 1;
+}
+
+/*@
+  @ requires buffer_size >= 2;
+  @ requires (buffer_size&1)==0;
+  @ requires \valid_read(buffer + (0 .. buffer_size-1));
+  @ requires \valid(file_recovery);
+  @ requires valid_string((char *)&file_recovery->filename);
+  @ requires \separated(buffer + (..), file_recovery, &zip_stream, &msoffice, &sh3d, &ext_msoffice);
+  @ ensures \result == DC_CONTINUE || \result == DC_ERROR;
+  @ assigns zip_stream, msoffice, sh3d, ext_msoffice;
+  @ assigns file_recovery->calculated_file_size, file_recovery->offset_error;
+  @*/
+static data_check_t data_check_zip(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  zip_stream_t *zs=&zip_stream;
+  if(file_recovery->calculated_file_size==0 && file_recovery->file_size==0)
+  {
+    /* First block of a new file */
+    strncpy(zs->filename, file_recovery->filename, sizeof(zs->filename)-1);
+    zs->filename[sizeof(zs->filename)-1]='\0';
+    memset(&zs->cur, 0, sizeof(zs->cur));
+    zs->ckpt=zs->cur;
+    zs->status=ZIP_STREAM_RECORD;
+    zs->member=ZIP_MEMBER_NONE;
+  }
+  else if(zs->status==ZIP_STREAM_INVALID ||
+      zs->file_size!=file_recovery->file_size ||
+      strcmp(zs->filename, file_recovery->filename)!=0)
+  {
+    /* The data are not written one block after the other, ie. brute force */
+    zs->status=ZIP_STREAM_INVALID;
+    return DC_CONTINUE;
+  }
+  zs->file_size=file_recovery->file_size + buffer_size/2;
+  /*@ loop assigns *zs, msoffice, sh3d, ext_msoffice; */
+  while(zs->status==ZIP_STREAM_RECORD || zs->status==ZIP_STREAM_DESC)
+  {
+    uint64_t pos;
+    unsigned int i;
+#ifndef DISABLED_FOR_FRAMAC
+    if(zs->member!=ZIP_MEMBER_NONE)
+    {
+      const int res=zip_stream_member(zs, buffer, buffer_size, file_recovery);
+      if(res < 0)
+      {
+	zs->status=ZIP_STREAM_INVALID;
+	file_recovery->offset_error=zs->member_start;
+	return DC_ERROR;
+      }
+      if(res==0)
+	break;
+    }
+#endif
+    pos=(zs->status==ZIP_STREAM_RECORD ? zs->cur.next : zs->desc_pos);
+    if(pos >= zs->file_size)
+      break;
+    if(pos + buffer_size/2 < file_recovery->file_size)
+    {
+      /* The record is larger than the buffer */
+      zs->status=ZIP_STREAM_FROZEN;
+      break;
+    }
+    i=pos + buffer_size/2 - file_recovery->file_size;
+    if(zs->status==ZIP_STREAM_DESC)
+    {
+      static const unsigned char zip_data_desc_header[4]= {0x50, 0x4B, 0x07, 0x08};
+      const unsigned char *desc=(buffer_size - i >= 4 ?
+	  (const unsigned char *)td_memmem(&buffer[i], buffer_size - i, zip_data_desc_header, 4) : NULL);
+      if(desc==NULL)
+      {
+	if(pos < zs->file_size - 3)
+	  zs->desc_pos=zs->file_size - 3;
+	break;
+      }
+      zs->cur.next=pos + (desc - &buffer[i]);
+      if(zs->cur.next > zs->desc_start)
+	zs->cur.expected_compressed_size=zs->cur.next - zs->desc_start;
+      zs->status=ZIP_STREAM_RECORD;
+    }
+    else
+    {
+      const int res=zip_stream_record(zs, &buffer[i], buffer_size - i);
+      if(res < 0)
+      {
+	zs->status=ZIP_STREAM_FROZEN;
+	break;
+      }
+      if(res==0)
+	break;
+    }
+    if(zs->status!=ZIP_STREAM_DESC)
+      zs->ckpt=zs->cur;
+  }
+  /* Keep the data until the next header even after the end of central
+   * directory: when the search resumes from the known headers, an archive
+   * that follows is only found this way. file_check_zip() truncates the
+   * file. */
+  file_recovery->calculated_file_size=(zs->status==ZIP_STREAM_EOCD ? zs->eocd_end : zs->cur.next);
+  return DC_CONTINUE;
+}
+
+/*@
+  @ requires \valid(file_recovery);
+  @ requires valid_read_string((char *)&file_recovery->filename);
+  @ requires valid_read_string(name);
+  @*/
+static void zip_rename_first_filename(file_recovery_t *file_recovery, const char *name)
+{
+  unsigned int len;
+  /*@
+    @ loop assigns len;
+    @ loop variant 32 - len;
+    @*/
+  for(len=0; len<32 &&
+      name[len]!='\0' &&
+      name[len]!='.' &&
+      name[len]!='/' &&
+      name[len]!='\\';
+      len++);
+  /*@ assert valid_read_string((char*)file_recovery->filename); */
+  file_rename(file_recovery, name, len, 0, "zip", 0);
+}
+
 /*@
   @ requires fr->file_check==&file_check_zip;
   @ requires valid_file_check_param(fr);
@@ -1045,6 +1565,7 @@ static int zip64_parse_end_central_dir_locator(file_recovery_t *fr)
   @ assigns Frama_C_entropy_source, errno;
   @ assigns first_filename[0 .. 255];
   @ assigns msoffice, sh3d, ext_msoffice, expected_compressed_size;
+  @ assigns zip_stream;
   @*/
 static void file_check_zip(file_recovery_t *fr)
 {
@@ -1057,8 +1578,29 @@ static void file_check_zip(file_recovery_t *fr)
   /* fr->time is already set to 0 but it helps frama-c */
   fr->time=0;
   first_filename[0]='\0';
-  if(my_fseek(fr->handle, 0, SEEK_SET) < 0)
+  zip_stream.checked=0;
+  if(zip_stream.status!=ZIP_STREAM_INVALID &&
+      zip_stream.file_size==original_file_size &&
+      strcmp(zip_stream.filename, fr->filename)==0)
+  {
+    /* Resume the walk after the records already checked by data_check_zip() */
+    const zip_walk_t *w=&zip_stream.ckpt;
+    ext=w->ext;
+    file_nbr=w->file_nbr;
+    fr->file_size=w->next;
+    fr->offset_ok=w->offset_ok;
+    fr->time=w->time;
+    memcpy(first_filename, w->first_filename, sizeof(first_filename));
+    msoffice=w->msoffice;
+    sh3d=w->sh3d;
+    ext_msoffice=w->ext_msoffice;
+    expected_compressed_size=w->expected_compressed_size;
+  }
+  if(my_fseek(fr->handle, fr->file_size, SEEK_SET) < 0)
+  {
+    fr->file_size=0;
     return ;
+  }
   /*@
     @ loop invariant valid_file_recovery(fr);
     @ loop invariant fr->file_size < 0x8000000000000000 - 4;
@@ -1155,7 +1697,14 @@ static void file_check_zip(file_recovery_t *fr)
     }
     /* Only end of central dir is end of archive, 64b version of it is before */
     if (header==ZIP_END_CENTRAL_DIR)
+    {
+      zip_stream.checked=1;
+      zip_stream.checked_ext=ext;
+      strncpy(zip_stream.checked_filename, fr->filename, sizeof(zip_stream.checked_filename)-1);
+      zip_stream.checked_filename[sizeof(zip_stream.checked_filename)-1]='\0';
+      memcpy(zip_stream.checked_first_filename, first_filename, sizeof(first_filename));
       return;
+    }
     fr->offset_ok=file_size_old;
     if(file_nbr>=0xffffffff || fr->file_size >= 0x8000000000000000 - 4)
     {
@@ -1177,6 +1726,17 @@ static void file_rename_zip(file_recovery_t *file_recovery)
   const char *ext=NULL;
   unsigned int file_nbr=0;
   file_recovery_t fr;
+  if(zip_stream.checked &&
+      strcmp(zip_stream.checked_filename, file_recovery->filename)==0)
+  {
+    /* file_check_zip() has already walked the whole archive */
+    zip_stream.checked=0;
+    if(zip_stream.checked_ext!=NULL)
+      file_rename(file_recovery, NULL, 0, 0, zip_stream.checked_ext, 1);
+    else
+      zip_rename_first_filename(file_recovery, zip_stream.checked_first_filename);
+    return;
+  }
   reset_file_recovery(&fr);
   /*@ assert valid_read_string((char*)file_recovery->filename); */
   if((fr.handle=fopen(file_recovery->filename, "rb"))==NULL)
@@ -1285,20 +1845,8 @@ static void file_rename_zip(file_recovery_t *file_recovery)
     /* Only end of central dir is end of archive, 64b version of it is before */
     if (header==ZIP_END_CENTRAL_DIR)
     {
-      unsigned int len;
       fclose(fr.handle);
-      /*@
-        @ loop assigns len;
-	@ loop variant 32 - len;
-	@*/
-      for(len=0; len<32 &&
-	  first_filename[len]!='\0' &&
-	  first_filename[len]!='.' &&
-	  first_filename[len]!='/' &&
-	  first_filename[len]!='\\';
-	  len++);
-      /*@ assert valid_read_string((char*)file_recovery->filename); */
-      file_rename(file_recovery, first_filename, len, 0, "zip", 0);
+      zip_rename_first_filename(file_recovery, first_filename);
       /*@ assert valid_read_string((char*)file_recovery->filename); */
       return;
     }
@@ -1321,7 +1869,7 @@ static void file_rename_zip(file_recovery_t *file_recovery)
   @ ensures (\result == 1) ==> (file_recovery_new->min_filesize == 30);
   @ ensures (\result == 1) ==> (file_recovery_new->calculated_file_size == 0);
   @ ensures (\result == 1) ==> (file_recovery_new->file_size == 0);
-  @ ensures (\result == 1) ==> (file_recovery_new->data_check == \null);
+  @ ensures (\result == 1) ==> (file_recovery_new->data_check == &data_check_zip);
   @ ensures (\result == 1) ==> file_recovery_new->file_check == &file_check_zip;
   @ ensures (\result == 1) ==> (file_recovery_new->file_rename == &file_rename_zip || file_recovery_new->file_rename == \null);
   @ ensures (\result == 1) ==> (file_recovery_new->extension == file_hint_zip.extension ||
@@ -1379,6 +1927,7 @@ static int header_check_zip(const unsigned char *buffer, const unsigned int buff
   }
   reset_file_recovery(file_recovery_new);
   file_recovery_new->min_filesize=30;	/* 4+sizeof(file) == 30 */
+  file_recovery_new->data_check=&data_check_zip;
   file_recovery_new->file_check=&file_check_zip;
   if(len==8 && memcmp(&buffer[30],"mimetype",8)==0 && le16(file->extra_length)==0)
   {
@@ -1427,6 +1976,10 @@ static int header_check_zip(const unsigned char *buffer, const unsigned int buff
   @*/
 static int header_check_winzip(const unsigned char *buffer, const unsigned int buffer_size, const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
 {
+  (void)buffer;
+  (void)buffer_size;
+  (void)safe_header_only;
+  (void)file_recovery;
   reset_file_recovery(file_recovery_new);
   file_recovery_new->file_check=&file_check_zip;
   file_recovery_new->extension=file_hint_zip.extension;
@@ -1444,9 +1997,19 @@ static int header_check_winzip(const unsigned char *buffer, const unsigned int b
   @*/
 static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int haystack_size, const unsigned char *needle, const unsigned int needle_size)
 {
+#ifdef DISABLED_FOR_FRAMAC
   unsigned int i;
+#endif
   if(haystack_size < needle_size)
     return 0;
+#ifndef DISABLED_FOR_FRAMAC
+  {
+    const unsigned char *pos=(const unsigned char *)td_memmem(haystack, haystack_size, needle, needle_size);
+    if(pos==NULL)
+      return 0;
+    return (pos - haystack) + needle_size;
+  }
+#else
   /*@
     @ loop invariant 0 <= i <= haystack_size - needle_size + 1;
     @ loop assigns i;
@@ -1456,6 +2019,7 @@ static unsigned int pos_in_mem(const unsigned char *haystack, const unsigned int
     if(memcmp(&haystack[i],needle,needle_size)==0)
       return (i+needle_size);
   return 0;
+#endif
 }
 
 /*@
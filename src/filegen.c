@@ -35,21 +35,48 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#include <stddef.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>	/* fallocate */
+#endif
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
 #include "log.h"
+#include "memmem.h"
+#include "unicode.h"
 
 static int file_check_cmp(const struct td_list_head *a, const struct td_list_head *b);
 
+unsigned int file_profile=0;
+unsigned int file_deep_check=0;
+
+uint64_t file_profile_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC) && !defined(__FRAMAC__)
+  struct timespec ts;
+  if(clock_gettime(CLOCK_MONOTONIC, &ts)==0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return (uint64_t)time(NULL) * 1000000000;
+}
+
 #ifndef __FRAMAC__
 #include "list_add_sorted.h"
+#include "list_sort.h"
 #else
 
 /*@
@@ -95,8 +122,8 @@ static inline void td_list_add_sorted_fcc(struct td_list_head *newe, struct td_l
 #endif
 
 
-uint64_t gpls_nbr=0;
-static uint64_t offset_skipped_header=0;
+TD_THREAD_LOCAL uint64_t gpls_nbr=0;
+static TD_THREAD_LOCAL uint64_t offset_skipped_header=0;
 
 static  file_check_t file_check_plist={
   .list = TD_LIST_HEAD_INIT(file_check_plist.list)
@@ -180,6 +207,8 @@ static void file_check_add_tail(file_check_t *file_check_new, file_check_list_t
   /*@ assert 0 <= tmp <= 255; */
   /*@ assert newe->file_checks[tmp].list.prev == &newe->file_checks[tmp].list; */
   /*@ assert newe->file_checks[tmp].list.next == &newe->file_checks[tmp].list; */
+  memset(newe->used, 0, sizeof(newe->used));
+  newe->used[tmp>>3]|=(1<<(tmp&7));
   td_list_add_tail(&file_check_new->list, &newe->file_checks[tmp].list);
   td_list_add_tail(&newe->list, &pos->list);
 }
@@ -218,7 +247,8 @@ void register_header_check(const unsigned int offset, const void *value, const u
 #ifdef __FRAMAC__
   td_list_add_sorted_fcc(&file_check_new->list, &file_check_plist.list);
 #else
-  td_list_add_sorted(&file_check_new->list, &file_check_plist.list, file_check_cmp);
+  /* Sorted once by index_header_check() */
+  td_list_add_tail(&file_check_new->list, &file_check_plist.list);
 #endif
 }
 
@@ -243,12 +273,14 @@ static void index_header_check_aux(file_check_t *file_check_new)
       if(pos->offset >= file_check_new->offset &&
 	  pos->offset < file_check_new->offset+file_check_new->length)
       {
+	const unsigned int c=((const unsigned char *)file_check_new->value)[pos->offset-file_check_new->offset];
+	pos->used[c>>3]|=(1<<(c&7));
 #ifdef __FRAMAC__
 	td_list_add_sorted_fcc(&file_check_new->list,
-	    &pos->file_checks[((const unsigned char *)file_check_new->value)[pos->offset-file_check_new->offset]].list);
+	    &pos->file_checks[c].list);
 #else
 	td_list_add_sorted(&file_check_new->list,
-	    &pos->file_checks[((const unsigned char *)file_check_new->value)[pos->offset-file_check_new->offset]].list,
+	    &pos->file_checks[c].list,
 	    file_check_cmp);
 #endif
 	return ;
@@ -263,11 +295,92 @@ static void index_header_check_aux(file_check_t *file_check_new)
   file_check_add_tail(file_check_new, &file_check_list);
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+const file_check_table_t *file_check_tables=NULL;
+unsigned int file_check_tables_nbr=0;
+static file_check_table_t *file_check_tables_rw=NULL;
+static file_check_packed_t *file_check_packed=NULL;
+
+static void file_check_unpack(void)
+{
+  free(file_check_tables_rw);
+  free(file_check_packed);
+  file_check_tables_rw=NULL;
+  file_check_tables=NULL;
+  file_check_tables_nbr=0;
+  file_check_packed=NULL;
+}
+
+/* Copy file_check_list in file_check_tables, in the same order */
+static void file_check_pack(void)
+{
+  const struct td_list_head *tmpl;
+  file_check_table_t *tables;
+  unsigned int nbr_tables=0;
+  unsigned int nbr_checks=0;
+  unsigned int k=0;
+  unsigned int t=0;
+  file_check_unpack();
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    unsigned int c;
+    nbr_tables++;
+    for(c=0; c<256; c++)
+    {
+      const struct td_list_head *tmp;
+      td_list_for_each(tmp, &pos->file_checks[c].list)
+	nbr_checks++;
+    }
+  }
+  if(nbr_tables==0)
+    return ;
+  tables=(file_check_table_t *)MALLOC(nbr_tables * sizeof(*tables));
+  file_check_packed=(file_check_packed_t *)MALLOC((nbr_checks > 0 ? nbr_checks : 1) * sizeof(*file_check_packed));
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    file_check_table_t *table=&tables[t++];
+    const unsigned int first=k;
+    unsigned int c;
+    table->offset=pos->offset;
+    memcpy(table->used, pos->used, sizeof(table->used));
+    table->checks=&file_check_packed[first];
+    for(c=0; c<256; c++)
+    {
+      const struct td_list_head *tmp;
+      table->start[c]=k - first;
+      td_list_for_each(tmp, &pos->file_checks[c].list)
+      {
+	const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+	file_check_packed_t *check=&file_check_packed[k++];
+	memset(check->prefix, 0, sizeof(check->prefix));
+	memcpy(check->prefix, file_check->value,
+	    (file_check->length < FILE_CHECK_PREFIX ? file_check->length : FILE_CHECK_PREFIX));
+	check->offset=file_check->offset;
+	check->length=file_check->length;
+	check->header_check=file_check->header_check;
+	check->file_stat=file_check->file_stat;
+	check->file_check=file_check;
+      }
+    }
+    table->start[256]=k - first;
+  }
+  file_check_tables_rw=tables;
+  file_check_tables=tables;
+  file_check_tables_nbr=nbr_tables;
+}
+#endif
+
 static unsigned int index_header_check(void)
 {
   struct td_list_head *tmp;
   struct td_list_head *next;
   unsigned int nbr=0;
+#ifndef __FRAMAC__
+  /* Stable, the checks with the same signature keep their registration order */
+  td_list_sort(&file_check_plist.list, file_check_cmp);
+#endif
   /* Initialize file_check_list from file_check_plist */
   /*@
     @ loop invariant \valid_read(tmp);
@@ -284,6 +397,9 @@ static unsigned int index_header_check(void)
     index_header_check_aux(current_check);
     nbr++;
   }
+#ifndef DISABLED_FOR_FRAMAC
+  file_check_pack();
+#endif
   return nbr;
 }
 
@@ -292,6 +408,7 @@ void free_header_check(void)
 #ifndef DISABLED_FOR_FRAMAC
   struct td_list_head *tmpl;
   struct td_list_head *nextl;
+  file_check_unpack();
   td_list_for_each_safe(tmpl, nextl, &file_check_list.list)
   {
     unsigned int i;
@@ -377,7 +494,393 @@ void file_allow_nl(file_recovery_t *file_recovery, const unsigned int nl_mode)
   /*@ assert valid_file_check_result(file_recovery); */
 }
 
-uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length)
+#ifndef DISABLED_FOR_FRAMAC
+/* Copy of the last bytes written to the file being carved, the footer
+ * search is done from memory instead of reading the file back */
+#define FILE_TAIL_SIZE (1024*1024)
+/* The footer searched by file_search_footer() is also looked for in the
+ * data as they are written, the last occurrence is kept */
+#define FILE_FOOTER_MAX 64
+static TD_THREAD_LOCAL struct
+{
+  const file_recovery_t *file_recovery;
+  const FILE *handle;
+  uint64_t start;
+  uint64_t size;
+  unsigned int footer_length;	/* 0: no footer tracked */
+  int footer_found;
+  uint64_t footer_pos;
+  unsigned char footer[FILE_FOOTER_MAX];
+  unsigned char *buffer;	/* FILE_TAIL_SIZE bytes, kept by the thread */
+} file_tail;
+
+/* Last footer searched for each file format, it's tracked for the next
+ * files of the same format */
+#define FILE_FOOTER_FORMATS 16
+static TD_THREAD_LOCAL struct
+{
+  const file_stat_t *file_stat;
+  unsigned int length;
+  unsigned char value[FILE_FOOTER_MAX];
+} file_footers[FILE_FOOTER_FORMATS];
+static TD_THREAD_LOCAL unsigned int file_footers_next=0;
+
+static void file_footer_learn(const file_stat_t *file_stat, const void *footer, const unsigned int footer_length)
+{
+  unsigned int i;
+  if(file_stat==NULL || footer_length > FILE_FOOTER_MAX)
+    return ;
+  for(i=0; i<FILE_FOOTER_FORMATS && file_footers[i].file_stat!=file_stat; i++);
+  if(i==FILE_FOOTER_FORMATS)
+  {
+    i=file_footers_next;
+    file_footers_next=(file_footers_next+1)%FILE_FOOTER_FORMATS;
+    file_footers[i].file_stat=file_stat;
+  }
+  file_footers[i].length=footer_length;
+  memcpy(file_footers[i].value, footer, footer_length);
+}
+
+static int file_tail_match(const file_recovery_t *file_recovery)
+{
+  return (file_recovery!=NULL && file_recovery==file_tail.file_recovery &&
+      file_recovery->handle!=NULL && file_recovery->handle==file_tail.handle &&
+      file_recovery->location.start==file_tail.start);
+}
+
+void file_tail_reset(const file_recovery_t *file_recovery)
+{
+  file_tail.file_recovery=file_recovery;
+  if(file_recovery==NULL)
+    return ;
+  if(file_tail.buffer==NULL)
+    file_tail.buffer=(unsigned char *)MALLOC(FILE_TAIL_SIZE);
+  file_tail.handle=file_recovery->handle;
+  file_tail.start=file_recovery->location.start;
+  file_tail.size=0;
+  file_tail.footer_length=0;
+  file_tail.footer_found=0;
+  if(file_recovery->file_stat!=NULL)
+  {
+    unsigned int i;
+    for(i=0; i<FILE_FOOTER_FORMATS; i++)
+    {
+      if(file_footers[i].file_stat==file_recovery->file_stat)
+      {
+	file_tail.footer_length=file_footers[i].length;
+	memcpy(file_tail.footer, file_footers[i].value, file_footers[i].length);
+      }
+    }
+  }
+}
+
+void file_tail_close(const file_recovery_t *file_recovery)
+{
+  if(file_tail.file_recovery==file_recovery)
+    file_tail.file_recovery=NULL;
+}
+
+void file_tail_free(void)
+{
+  file_tail.file_recovery=NULL;
+  free(file_tail.buffer);
+  file_tail.buffer=NULL;
+}
+
+#if defined(HAVE_FTRUNCATE)
+/* Zero blocks at the end of the file being carved, not written yet */
+static TD_THREAD_LOCAL struct
+{
+  const file_recovery_t *file_recovery;
+  const FILE *handle;
+  uint64_t start;
+  uint64_t size;	/* data appended, the hole included */
+  uint64_t hole;
+  int sparse;		/* -1: not known yet, 1: regular file */
+  int punch;
+} file_hole;
+
+static TD_THREAD_LOCAL uint64_t file_sparse_total=0;
+/* Set by /sparse, the zero blocks are written by default */
+static int file_sparse_enabled=0;
+
+static int file_block_zero(const unsigned char *buffer, const unsigned int size)
+{
+  return (buffer[0]==0 && buffer[size-1]==0 && memcmp(buffer, buffer+1, size-1)==0);
+}
+
+/* The blocks reserved by file_preallocate() under the hole are given back.
+ * A hole beyond the end of the file is ignored, the data after the hole
+ * must have been flushed first */
+static void file_hole_punch(const file_recovery_t *file_recovery, const uint64_t offset, const uint64_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+  if(file_hole.punch > 0 &&
+      (fflush(file_recovery->handle)!=0 ||
+       fallocate(fileno(file_recovery->handle), FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+	 offset, len) < 0))
+    file_hole.punch=0;
+#endif
+}
+#endif
+
+int file_write(const file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size, const unsigned int blocksize)
+{
+#if defined(HAVE_FTRUNCATE)
+  unsigned int done=0;
+  if(file_sparse_enabled==0)
+    return (fwrite(buffer, size, 1, file_recovery->handle)<1 ? -1 : 0);
+  if(file_recovery->file_size==0 || file_hole.file_recovery!=file_recovery ||
+      file_hole.handle!=file_recovery->handle ||
+      file_hole.start!=file_recovery->location.start)
+  {
+    /* First block of the file */
+    file_hole.file_recovery=file_recovery;
+    file_hole.handle=file_recovery->handle;
+    file_hole.start=file_recovery->location.start;
+    file_hole.size=file_recovery->file_size;
+    file_hole.hole=0;
+    file_hole.sparse=-1;
+    file_hole.punch=1;
+  }
+  if(blocksize==0 || size%blocksize!=0)
+  {
+    if(file_write_sync(file_recovery) < 0 ||
+	fwrite(buffer, size, 1, file_recovery->handle)<1)
+      return -1;
+    file_hole.size+=size;
+    return 0;
+  }
+  while(done < size)
+  {
+    unsigned int len=blocksize;
+    if(file_block_zero(&buffer[done], blocksize))
+    {
+      if(file_hole.sparse < 0)
+      {
+	struct stat stat_buf;
+	/* A hole can't be left in a pipe or a device */
+	file_hole.sparse=(fstat(fileno(file_recovery->handle), &stat_buf)==0 &&
+	    S_ISREG(stat_buf.st_mode) ? 1 : 0);
+      }
+      if(file_hole.sparse > 0)
+      {
+	file_hole.hole+=blocksize;
+	file_hole.size+=blocksize;
+	file_sparse_total+=blocksize;
+	done+=blocksize;
+	continue;
+      }
+    }
+    while(done + len < size && !file_block_zero(&buffer[done + len], blocksize))
+      len+=blocksize;
+    if(file_hole.hole > 0 &&
+	my_fseek(file_recovery->handle, file_hole.hole, SEEK_CUR) < 0)
+      return -1;
+    if(fwrite(&buffer[done], len, 1, file_recovery->handle)<1)
+      return -1;
+    if(file_hole.hole > 0)
+    {
+      file_hole_punch(file_recovery, file_hole.size - file_hole.hole, file_hole.hole);
+      file_hole.hole=0;
+    }
+    file_hole.size+=len;
+    done+=len;
+  }
+  return 0;
+#else
+  return (fwrite(buffer, size, 1, file_recovery->handle)<1 ? -1 : 0);
+#endif
+}
+
+int file_write_sync(const file_recovery_t *file_recovery)
+{
+#if defined(HAVE_FTRUNCATE)
+  if(file_hole.file_recovery!=file_recovery ||
+      file_hole.handle!=file_recovery->handle ||
+      file_hole.start!=file_recovery->location.start ||
+      file_hole.hole==0)
+    return 0;
+  if(fflush(file_recovery->handle)!=0 ||
+      ftruncate(fileno(file_recovery->handle), file_hole.size) < 0 ||
+      my_fseek(file_recovery->handle, file_hole.size, SEEK_SET) < 0)
+  {
+    log_critical("Cannot extend file %s to %llu bytes: %s\n", file_recovery->filename,
+	(long long unsigned)file_hole.size, strerror(errno));
+    return -1;
+  }
+  file_hole_punch(file_recovery, file_hole.size - file_hole.hole, file_hole.hole);
+  file_hole.hole=0;
+#endif
+  return 0;
+}
+
+void file_sparse_set(const int enable)
+{
+#if defined(HAVE_FTRUNCATE)
+  file_sparse_enabled=enable;
+#endif
+}
+
+uint64_t file_sparse_bytes(void)
+{
+#if defined(HAVE_FTRUNCATE)
+  return file_sparse_total;
+#else
+  return 0;
+#endif
+}
+
+static void file_tail_footer(const unsigned char *buffer, const unsigned int size, const uint64_t offset)
+{
+  const unsigned int footer_length=file_tail.footer_length;
+  const unsigned char *pos=(const unsigned char *)td_memrmem(buffer, size, file_tail.footer, footer_length);
+  if(pos!=NULL)
+  {
+    file_tail.footer_found=1;
+    file_tail.footer_pos=offset + (pos - buffer);
+    return ;
+  }
+  if(footer_length > 1 && offset > 0)
+  {
+    /* Footer across the previous data and this block */
+    unsigned char tmp[2*FILE_FOOTER_MAX];
+    const unsigned int before=(offset < footer_length-1 ? offset : footer_length-1);
+    const unsigned int after=(size < footer_length-1 ? size : footer_length-1);
+    unsigned int i;
+    for(i=0; i<before; i++)
+      tmp[i]=file_tail.buffer[(offset - before + i) % FILE_TAIL_SIZE];
+    memcpy(&tmp[before], buffer, after);
+    pos=(const unsigned char *)td_memrmem(tmp, before+after, file_tail.footer, footer_length);
+    if(pos!=NULL)
+    {
+      file_tail.footer_found=1;
+      file_tail.footer_pos=offset - before + (pos - tmp);
+    }
+  }
+}
+
+/* Same result as file_rsearch_aux(), or -1 if the footer has not been
+ * tracked for this file */
+static int file_tail_footer_search(const file_recovery_t *file_recovery, const uint64_t offset, const void *footer, const unsigned int footer_length, uint64_t *result)
+{
+  uint64_t start;
+  uint64_t end;
+  if(!file_tail_match(file_recovery) || file_tail.footer_length!=footer_length ||
+      memcmp(file_tail.footer, footer, footer_length)!=0)
+    return -1;
+  if(file_tail.footer_found==0)
+  {
+    *result=0;
+    return 0;
+  }
+  /* file_rsearch_aux() first reads the 4096 bytes block before offset */
+  if(offset <= 4096)
+    start=0;
+  else if(offset%4096==0)
+    start=offset-4096;
+  else
+    start=offset-(offset%4096);
+  end=(start + 4096 < file_tail.size ? start + 4096 : file_tail.size);
+  if(file_tail.footer_pos + footer_length > end)
+    return -1;
+  *result=file_tail.footer_pos;
+  return 0;
+}
+
+void file_tail_append(const file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size, const uint64_t offset)
+{
+  unsigned int skip=0;
+  if(!file_tail_match(file_recovery))
+    return ;
+  if(offset!=file_tail.size)
+  {
+    /* The file has been rewritten, stop tracking it */
+    file_tail.file_recovery=NULL;
+    return ;
+  }
+  if(file_tail.footer_length > 0)
+    file_tail_footer(buffer, size, offset);
+  if(size > FILE_TAIL_SIZE)
+    skip=size-FILE_TAIL_SIZE;
+  file_tail.size+=skip;
+  while(skip < size)
+  {
+    const unsigned int pos=file_tail.size % FILE_TAIL_SIZE;
+    const unsigned int len=(size - skip < FILE_TAIL_SIZE - pos ? size - skip : FILE_TAIL_SIZE - pos);
+    memcpy(&file_tail.buffer[pos], &buffer[skip], len);
+    file_tail.size+=len;
+    skip+=len;
+  }
+}
+
+static file_extent_t file_extent;
+
+void file_data_extent(const file_recovery_t *file_recovery, const uint64_t end)
+{
+  file_extent.file_recovery=file_recovery;
+  file_extent.start=file_recovery->location.start;
+  file_extent.end=end;
+}
+
+int file_data_extent_covers(const file_recovery_t *file_recovery, const unsigned int size)
+{
+  return (file_recovery!=NULL && file_recovery==file_extent.file_recovery &&
+      file_recovery->location.start==file_extent.start &&
+      file_recovery->file_size + size < file_extent.end);
+}
+
+uint64_t file_data_extent_left(const file_recovery_t *file_recovery)
+{
+  if(file_recovery==NULL || file_recovery!=file_extent.file_recovery ||
+      file_recovery->location.start!=file_extent.start ||
+      file_recovery->file_size >= file_extent.end)
+    return 0;
+  return file_extent.end - file_recovery->file_size;
+}
+
+void file_data_extent_save(file_extent_t *extent)
+{
+  *extent=file_extent;
+}
+
+void file_data_extent_restore(const file_extent_t *extent)
+{
+  file_extent=*extent;
+}
+
+int file_tail_read(const file_recovery_t *file_recovery, char *buffer, const uint64_t offset, const unsigned int count)
+{
+  unsigned int done;
+  unsigned int available;
+  if(!file_tail_match(file_recovery))
+    return -1;
+  if(offset >= file_tail.size)
+    return 0;
+  if(file_tail.size > FILE_TAIL_SIZE && offset < file_tail.size - FILE_TAIL_SIZE)
+    return -1;
+  available=(file_tail.size - offset < count ? file_tail.size - offset : count);
+  for(done=0; done < available; )
+  {
+    const unsigned int pos=(offset + done) % FILE_TAIL_SIZE;
+    const unsigned int len=(available - done < FILE_TAIL_SIZE - pos ? available - done : FILE_TAIL_SIZE - pos);
+    memcpy(&buffer[done], &file_tail.buffer[pos], len);
+    done+=len;
+  }
+  return available;
+}
+#endif
+
+/*@
+  @ requires \valid(handle);
+  @ requires offset < 0x8000000000000000;
+  @ requires 0 < footer_length <4096;
+  @ requires \valid_read((char *)footer+(0..footer_length-1));
+  @ requires \separated(handle, (char *)footer + (..), &errno, &Frama_C_entropy_source);
+  @ ensures \result < 0x8000000000000000;
+  @ assigns *handle, errno, Frama_C_entropy_source;
+  @*/
+static uint64_t file_rsearch_aux(FILE *handle, const file_recovery_t *file_recovery, uint64_t offset, const void*footer, const unsigned int footer_length)
 {
   /*
    * 4096+footer_length-1: required size
@@ -397,7 +900,9 @@ uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const un
     @*/
   do
   {
+#ifdef DISABLED_FOR_FRAMAC
     int i;
+#endif
     int taille;
     if(offset <= 4096)
       offset=0;
@@ -406,15 +911,30 @@ uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const un
     else
       offset=offset-(offset%4096);
     /*@ assert offset + 4096 <= 0x8000000000000000; */
-    if(my_fseek(handle,offset,SEEK_SET)<0)
-      return 0;
-    taille=fread(&buffer, 1, 4096, handle);
+#ifndef DISABLED_FOR_FRAMAC
+    taille=file_tail_read(file_recovery, buffer, offset, 4096);
+    if(taille < 0)
+#endif
+    {
+      if(my_fseek(handle,offset,SEEK_SET)<0)
+	return 0;
+      taille=fread(&buffer, 1, 4096, handle);
+    }
     if(taille <= 0)
       return 0;
     /*@ assert 0 < taille <= 4096; */
 #ifdef __FRAMAC__
     Frama_C_make_unknown(&buffer, 4096);
 #endif
+#ifndef DISABLED_FOR_FRAMAC
+    {
+      /* buffer[taille .. taille+footer_length-2] holds the start of the
+       * block read previously */
+      const char *pos=(const char *)td_memrmem(buffer, taille+footer_length-1, footer, footer_length);
+      if(pos!=NULL)
+	return offset + (pos - buffer);
+    }
+#else
     /*@
       @ loop invariant -1 <= i < taille;
       @ loop assigns i;
@@ -428,17 +948,34 @@ uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const un
         return offset + i;
       }
     }
+#endif
     memcpy(buffer+4096,buffer,footer_length-1);
   } while(offset>0);
   return 0;
 }
 
+uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length)
+{
+  return file_rsearch_aux(handle, NULL, offset, footer, footer_length);
+}
+
 void file_search_footer(file_recovery_t *file_recovery, const void*footer, const unsigned int footer_length, const unsigned int extra_length)
 {
   /*@ assert \valid(file_recovery); */
   if(footer_length==0 || file_recovery->file_size <= extra_length)
     return ;
-  file_recovery->file_size=file_rsearch(file_recovery->handle, file_recovery->file_size-extra_length, footer, footer_length);
+#ifndef DISABLED_FOR_FRAMAC
+  {
+    uint64_t pos;
+    if(file_tail_footer_search(file_recovery, file_recovery->file_size-extra_length, footer, footer_length, &pos)==0)
+      file_recovery->file_size=pos;
+    else
+      file_recovery->file_size=file_rsearch_aux(file_recovery->handle, file_recovery, file_recovery->file_size-extra_length, footer, footer_length);
+    file_footer_learn(file_recovery->file_stat, footer, footer_length);
+  }
+#else
+  file_recovery->file_size=file_rsearch_aux(file_recovery->handle, file_recovery, file_recovery->file_size-extra_length, footer, footer_length);
+#endif
   /*@ assert 0 < footer_length < 4096; */
   /*@ assert extra_length <= PHOTOREC_MAX_FILE_SIZE; */
   /*@ assert file_recovery->file_size < 0x8000000000000000; */
@@ -463,6 +1000,39 @@ data_check_t data_check_size(const unsigned char *buffer, const unsigned int buf
   return DC_CONTINUE;
 }
 
+data_check_t data_check_records(const file_record_t *record, const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+  data_check_t (*data_check)(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)=file_recovery->data_check;
+  /*@ assert file_recovery->calculated_file_size <= PHOTOREC_MAX_FILE_SIZE; */
+  /*@ assert file_recovery->file_size <= PHOTOREC_MAX_FILE_SIZE; */
+  /*@
+    @ loop assigns *file_recovery;
+    @ loop variant file_recovery->file_size + buffer_size/2 - (file_recovery->calculated_file_size + record->header_size);
+    @*/
+  while(file_recovery->calculated_file_size + buffer_size/2 >= file_recovery->file_size &&
+      file_recovery->calculated_file_size + record->header_size <= file_recovery->file_size + buffer_size/2)
+  {
+    const unsigned int i=file_recovery->calculated_file_size + buffer_size/2 - file_recovery->file_size;
+    /*@ assert 0 <= i <= buffer_size - record->header_size; */
+    uint64_t size;
+    if(record->sync_size > 0 && memcmp(&buffer[i], record->sync, record->sync_size)!=0)
+      return record->invalid;
+    size=record->record_size(&buffer[i], file_recovery);
+    if(size > PHOTOREC_MAX_FILE_SIZE - file_recovery->calculated_file_size)
+      return record->invalid;
+    file_recovery->calculated_file_size+=size;
+    if(file_recovery->data_check!=data_check)
+      break;
+    if(size==0)
+      return record->invalid;
+  }
+#ifndef DISABLED_FOR_FRAMAC
+  /* The following blocks of the current record belong to the file */
+  file_data_extent(file_recovery, file_recovery->calculated_file_size);
+#endif
+  return DC_CONTINUE;
+}
+
 void file_check_size(file_recovery_t *file_recovery)
 {
   /*@ assert \valid(file_recovery); */
@@ -515,6 +1085,18 @@ void reset_file_recovery(file_recovery_t *file_recovery)
   file_recovery->data_check_tmp=0;
 }
 
+void file_recovery_cpy(file_recovery_t *dst, const file_recovery_t *src)
+{
+  /* filename is 2 KiB, only copy the part in use */
+  unsigned int len;
+  for(len=0; len < sizeof(dst->filename)-1 && src->filename[len]!='\0'; len++);
+  memcpy(dst->filename, src->filename, len);
+  dst->filename[len]='\0';
+  memcpy(&dst->location, &src->location, sizeof(*dst) - offsetof(file_recovery_t, location));
+  dst->location.list.prev=&dst->location.list;
+  dst->location.list.next=&dst->location.list;
+}
+
 file_stat_t * init_file_stats(file_enable_t *files_enable)
 {
   file_stat_t *file_stats;
@@ -554,6 +1136,13 @@ file_stat_t * init_file_stats(file_enable_t *files_enable)
       file_stats[i].file_hint=file_enable->file_hint;
       file_stats[i].not_recovered=0;
       file_stats[i].recovered=0;
+      file_stats[i].header_calls=0;
+      file_stats[i].header_hits=0;
+      file_stats[i].false_positives=0;
+      file_stats[i].header_ns=0;
+      file_stats[i].data_ns=0;
+      file_stats[i].file_ns=0;
+      file_stats[i].pruned=0;
       /*@ assert \valid_function((file_enable->file_hint)->register_header_check); */
       file_enable->file_hint->register_header_check(&file_stats[i]);
       /*@ assert valid_file_stat(&file_stats[i]); */
@@ -896,13 +1485,19 @@ static int _file_rename_unicode(file_recovery_t *file_recovery, const void *buff
   /* Add original filename */
   {
     char *dst_old=dst;
-    int off;
+    const unsigned int utf16_len=(buffer_size-offset)/2;
+    const unsigned int utf8_size=3*utf16_len+1;
+    char *utf8=(char*)MALLOC(utf8_size);
     int ok=0;
     int bad=0;
     *dst++ = '_';
-    src=&((const char *)buffer)[offset];
-    for(off=offset; off<buffer_size && *src!='\0'; off+=2, src+=2)
+    if(UTF16le2utf8(utf8, utf8_size, &((const unsigned char *)buffer)[offset], utf16_len) < 0)
+      utf8[0]='\0';
+    /* Only the ASCII letters and digits are kept */
+    for(src=utf8; *src!='\0'; src++)
     {
+      if((*src & 0xc0)==0x80)
+	continue;
       switch(*src)
       {
 	case '/':
@@ -918,7 +1513,7 @@ static int _file_rename_unicode(file_recovery_t *file_recovery, const void *buff
 	  bad++;
 	  break;
 	default:
-	  if(isprint(*src) && !isspace(*src) && !ispunct(*src) && !iscntrl(*src))
+	  if((*src & 0x80)==0 && isprint(*src) && !isspace(*src) && !ispunct(*src) && !iscntrl(*src))
 	  {
 	    *dst++ = *src;
 	    ok++;
@@ -932,6 +1527,7 @@ static int _file_rename_unicode(file_recovery_t *file_recovery, const void *buff
 	  break;
       }
     }
+    free(utf8);
     if(ok <= bad)
       dst=dst_old;
     else
@@ -988,6 +1584,14 @@ void header_ignored_cond_reset(uint64_t start, uint64_t end)
     offset_skipped_header=0;
 }
 
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t header_ignored_offset(void)
+{
+  return offset_skipped_header;
+}
+
 /* 0: file_recovery_new->location.start has been taken into account, offset_skipped_header may have been updated
  * 1: file_recovery_new->location.start has been ignored */
 int header_ignored_adv(const file_recovery_t *file_recovery, const file_recovery_t *file_recovery_new)
@@ -1017,6 +1621,10 @@ int header_ignored_adv(const file_recovery_t *file_recovery, const file_recovery
     return 0;
   }
 
+#ifndef DISABLED_FOR_FRAMAC
+  /* The file is read back, the zero blocks at its end must be there */
+  file_write_sync(file_recovery);
+#endif
   memcpy(&fr_test, file_recovery, sizeof(fr_test));
 #if defined(HAVE_FTELLO)
   if((offset=ftello(file_recovery->handle)) < 0)
@@ -78,6 +78,15 @@ struct file_stat_struct
   unsigned int not_recovered;
   unsigned int recovered;
   const file_hint_t *file_hint;
+  /* Only updated when file_profile is set */
+  uint64_t header_calls;
+  uint64_t header_hits;
+  uint64_t false_positives;	/* headers whose file was rejected by file_check */
+  uint64_t header_ns;
+  uint64_t data_ns;
+  uint64_t file_ns;
+  /* Set by the adaptive pruning, see pprune.h */
+  unsigned int pruned;
 };
 
 struct file_recovery_struct
@@ -142,8 +151,45 @@ typedef struct
   file_check_t file_checks[256];
   struct td_list_head list;
   unsigned int offset;
+  /* bit n is set when file_checks[n] is not empty, lets the header search
+   * skip empty buckets without touching the 256 list heads */
+  unsigned char used[256/8];
 } file_check_list_t;
 
+#define file_check_list_used(pos, c) (((pos)->used[(c)>>3] & (1 << ((c)&7)))!=0)
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Read-only copy of file_check_list built by index_header_check(), for
+ * the header search: the tables of all the offsets are contiguous, the
+ * checks of a byte value follow each other in a single array with the
+ * first bytes of their signature. A miss only reads the bitmap of each
+ * offset, a hit doesn't follow any list node. */
+#define FILE_CHECK_PREFIX 8
+
+typedef struct
+{
+  unsigned char prefix[FILE_CHECK_PREFIX];	/* start of value */
+  unsigned int offset;
+  unsigned int length;
+  int (*header_check)(const unsigned char *buffer, const unsigned int buffer_size,
+      const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
+  file_stat_t *file_stat;
+  const file_check_t *file_check;
+} file_check_packed_t;
+
+typedef struct
+{
+  unsigned int offset;
+  unsigned char used[256/8];
+  const file_check_packed_t *checks;
+  unsigned int start[257];	/* checks[start[c] .. start[c+1]-1] for the byte c */
+} file_check_table_t;
+
+extern const file_check_table_t *file_check_tables;
+extern unsigned int file_check_tables_nbr;
+
+#endif
+
 #define NL_BARENL       (1 << 0)
 #define NL_CRLF         (1 << 1)
 #define NL_BARECR       (1 << 2)
@@ -260,6 +306,101 @@ void file_allow_nl(file_recovery_t *file_recovery, const unsigned int nl_mode);
   @*/
 uint64_t file_rsearch(FILE *handle, uint64_t offset, const void*footer, const unsigned int footer_length);
 
+#ifndef DISABLED_FOR_FRAMAC
+/*@
+  @ requires file_recovery == \null || \valid_read(file_recovery);
+  @*/
+void file_tail_reset(const file_recovery_t *file_recovery);
+
+/* Stop tracking the tail of this file, the tail of another file being
+ * carved is kept */
+void file_tail_close(const file_recovery_t *file_recovery);
+
+/* Free the copy of the tail kept by the thread, at the end of a pass */
+void file_tail_free(void);
+
+/* Write the data of the file being carved. With file_sparse_set(1), the
+ * zero blocks of a regular file aren't written: they are left as a hole
+ * once data follow them or once file_write_sync() is called. Return -1
+ * on error, errno is set */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid(file_recovery->handle);
+  @ requires \valid_read(buffer + (0 .. size-1));
+  @*/
+int file_write(const file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size, const unsigned int blocksize);
+
+/* Give the file its full size, the zero blocks at its end included,
+ * before it's read back */
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+int file_write_sync(const file_recovery_t *file_recovery);
+
+/* Leave the zero blocks of the recovered files as holes */
+void file_sparse_set(const int enable);
+
+/* Zero bytes left as holes in the recovered files by this thread */
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t file_sparse_bytes(void);
+
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(buffer + (0 .. size-1));
+  @*/
+void file_tail_append(const file_recovery_t *file_recovery, const unsigned char *buffer, const unsigned int size, const uint64_t offset);
+
+/* Called by data_check when the data up to end belong to the file whatever
+ * they are, ie. the payload of a mov mdat atom: the blocks before end are
+ * appended without looking for a header nor calling data_check */
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void file_data_extent(const file_recovery_t *file_recovery, const uint64_t end);
+
+/* Returns 1 if the next size bytes of the file are inside its extent */
+/*@
+  @ requires file_recovery == \null || \valid_read(file_recovery);
+  @*/
+int file_data_extent_covers(const file_recovery_t *file_recovery, const unsigned int size);
+
+/* Number of bytes between the current end of the file and the end of its
+ * extent, 0 if no extent is set */
+/*@
+  @ requires file_recovery == \null || \valid_read(file_recovery);
+  @*/
+uint64_t file_data_extent_left(const file_recovery_t *file_recovery);
+
+typedef struct
+{
+  const file_recovery_t *file_recovery;
+  uint64_t start;
+  uint64_t end;
+} file_extent_t;
+
+/* The extent of the file being carved is saved while the same blocks
+ * are checked for another file */
+/*@
+  @ requires \valid(extent);
+  @*/
+void file_data_extent_save(file_extent_t *extent);
+
+/*@
+  @ requires \valid_read(extent);
+  @*/
+void file_data_extent_restore(const file_extent_t *extent);
+
+/* Same result as fread() at offset in the file being carved, or -1 if
+ * the data is not in the copy of its last bytes */
+/*@
+  @ requires file_recovery == \null || \valid_read(file_recovery);
+  @ requires \valid(buffer + (0 .. count-1));
+  @*/
+int file_tail_read(const file_recovery_t *file_recovery, char *buffer, const uint64_t offset, const unsigned int count);
+#endif
+
 /*@
   @ requires 0 < footer_length < 4096;
   @ requires \valid_read((char *)footer+(0..footer_length-1));
@@ -284,6 +425,33 @@ void file_search_footer(file_recovery_t *file_recovery, const void*footer, const
   @*/
 data_check_t data_check_size(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
 
+/* A file made of records, each one starting with a header giving the size
+ * of the record: calculated_file_size is the offset of the next header */
+typedef struct
+{
+  /* Bytes of the header read by record_size */
+  unsigned int header_size;
+  /* Bytes expected at the start of each header, sync_size may be 0 */
+  const unsigned char *sync;
+  unsigned int sync_size;
+  /* Size of the record including its header, 0 if the header is invalid.
+   * After the last record, file_recovery->data_check can be set to NULL */
+  uint64_t (*record_size)(const unsigned char *header, file_recovery_t *file_recovery);
+  /* Result of the data check for an invalid header */
+  data_check_t invalid;
+} file_record_t;
+
+/* Walk the record headers of the window, the blocks inside the current
+ * record are then appended as an extent without being checked */
+/*@
+  @ requires \valid_read(record);
+  @ requires valid_data_check_param(buffer, buffer_size, file_recovery);
+  @ requires record->header_size > 0;
+  @ requires record->sync_size <= record->header_size;
+  @ ensures  valid_data_check_result(\result, file_recovery);
+  @*/
+data_check_t data_check_records(const file_record_t *record, const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery);
+
 /*@
   @ requires file_recovery->file_check == &file_check_size;
   @ requires valid_file_check_param(file_recovery);
@@ -362,6 +530,14 @@ void file_check_size_max(file_recovery_t *file_recovery);
 //  ensures valid_file_recovery(file_recovery);
 void reset_file_recovery(file_recovery_t *file_recovery);
 
+/* Copy a file_recovery, dst gets an empty location list */
+/*@
+  @ requires \valid(dst);
+  @ requires \valid_read(src);
+  @ requires \separated(dst, src);
+  @*/
+void file_recovery_cpy(file_recovery_t *dst, const file_recovery_t *src);
+
 /*@
   @ requires offset <= PHOTOREC_MAX_SIG_OFFSET;
   @ requires 0 < length <= PHOTOREC_MAX_SIG_SIZE;
@@ -418,6 +594,13 @@ void header_ignored_cond_reset(uint64_t start, uint64_t end);
   @*/
 void header_ignored(const file_recovery_t *file_recovery_new);
 
+/* Lowest header ignored since the last reset and not searched again
+ * by get_prev_location_smart(), 0 if none */
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t header_ignored_offset(void);
+
 /*@
   @ requires separation: \separated(file_recovery, file_recovery->handle, file_recovery_new, &errno);
   @ requires \valid_read(file_recovery);
@@ -476,6 +659,71 @@ time_t get_time_from_YYYYMMDD_HHMMSS(const char *date_asc);
   @*/
 void get_prev_location_smart(const alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const uint64_t prev_location);
 
+/* Set to count header_check calls and time the header_check, data_check
+ * and file_check functions of each file format */
+extern unsigned int file_profile;
+
+/* Set to decompress the gzip streams and the ZIP members as their blocks
+ * are written and check their CRC, a damaged file is rejected */
+extern unsigned int file_deep_check;
+
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t file_profile_clock(void);
+
+/*@
+  @ requires \valid_read(file_check);
+  @ requires \valid_function(file_check->header_check);
+  @ requires \valid(file_check->file_stat);
+  @ requires buffer_size > 0;
+  @ requires \valid_read(buffer+(0..buffer_size-1));
+  @ requires \valid_read(file_recovery);
+  @ requires \valid(file_recovery_new);
+  @ requires valid_file_recovery(file_recovery);
+  @ requires \separated(file_check, buffer+(..), file_recovery, file_recovery_new);
+  @*/
+static inline int file_header_check(const file_check_t *file_check, const unsigned char *buffer, const unsigned int buffer_size,
+    const unsigned int safe_header_only, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+#ifndef __FRAMAC__
+  if(file_profile > 0)
+  {
+    const uint64_t start=file_profile_clock();
+    const int res=file_check->header_check(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
+    file_check->file_stat->header_ns+=file_profile_clock() - start;
+    file_check->file_stat->header_calls++;
+    if(res!=0)
+      file_check->file_stat->header_hits++;
+    return res;
+  }
+#endif
+  return file_check->header_check(buffer, buffer_size, safe_header_only, file_recovery, file_recovery_new);
+}
+
+/*@
+  @ requires \valid(file_recovery);
+  @ requires valid_file_recovery(file_recovery);
+  @ requires \valid_function(file_recovery->data_check);
+  @ requires buffer_size > 0;
+  @ requires \valid_read(buffer+(0..buffer_size-1));
+  @ requires \separated(file_recovery, buffer+(..));
+  @*/
+static inline data_check_t file_data_check(const unsigned char *buffer, const unsigned int buffer_size, file_recovery_t *file_recovery)
+{
+#ifndef __FRAMAC__
+  if(file_profile > 0 && file_recovery->file_stat!=NULL)
+  {
+    file_stat_t *file_stat=file_recovery->file_stat;
+    const uint64_t start=file_profile_clock();
+    const data_check_t res=file_recovery->data_check(buffer, buffer_size, file_recovery);
+    file_stat->data_ns+=file_profile_clock() - start;
+    return res;
+  }
+#endif
+  return file_recovery->data_check(buffer, buffer_size, file_recovery);
+}
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -0,0 +1,642 @@
+/*
+
+    File: format_bench.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Per-format benchmark of the file format parsers.
+ * Like the MAIN_<fmt> harnesses, each format is driven through its own
+ * header_check, data_check and file_check, but for every registered format:
+ * - the sample files it recognizes give its speed in ns per byte,
+ * - pseudo-random data, scanned like a disk, and pseudo-random data with
+ *   the signature of the format planted in it give its false positives.
+ * Results are printed as key=value lines, one per format. With /baseline,
+ * they are compared with a previous run and the exit status is 1 when a
+ * format got slower, recognizes fewer samples or accepts more random data. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <dirent.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "log.h"
+
+extern file_enable_t array_file_enable[];
+extern file_check_list_t file_check_list;
+
+#define BENCH_HEADER_SIZE	65536
+#define BENCH_POOL_SIZE		(16*1024*1024)
+#define BENCH_DATA_BLOCKS	64
+#define BENCH_MAX_SAMPLES	4096
+#define BENCH_MAX_SAMPLE_SIZE	(64*1024*1024)
+#define BENCH_MAX_CORPUS_SIZE	(512*1024*1024)
+/* Timings shorter than that are too noisy to be compared */
+#define BENCH_MIN_COMPARE_NS	1000000
+
+typedef struct
+{
+  char *filename;
+  unsigned char *buffer;	/* blocksize zeroes, data, zero padding */
+  uint64_t size;
+} bench_sample_t;
+
+typedef struct
+{
+  const file_hint_t *file_hint;
+  unsigned int nbr_checks;
+  unsigned int samples;
+  uint64_t sample_bytes;
+  uint64_t sample_ns;
+  uint64_t header_calls;
+  uint64_t header_ns;
+  unsigned int fp_random;	/* headers accepted while scanning random data */
+  unsigned int trials;		/* planted signatures */
+  unsigned int fp_header;	/* planted signatures accepted by header_check */
+  unsigned int fp;		/* ... and kept by data_check and file_check */
+} bench_format_t;
+
+typedef struct
+{
+  unsigned int blocksize;
+  unsigned int trials;
+  unsigned int repeat;
+  unsigned int tolerance;	/* in percent */
+  uint64_t seed;
+} bench_options_t;
+
+static bench_sample_t bench_samples[BENCH_MAX_SAMPLES];
+static unsigned int bench_nbr_samples=0;
+static uint64_t bench_corpus_size=0;
+
+static uint64_t bench_random(uint64_t *state)
+{
+  /* xorshift64* */
+  *state^=*state >> 12;
+  *state^=*state << 25;
+  *state^=*state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int bench_load_sample(const char *filename, const unsigned int blocksize)
+{
+  bench_sample_t *sample;
+  struct stat st;
+  FILE *handle;
+  if(bench_nbr_samples >= BENCH_MAX_SAMPLES)
+    return -1;
+  if(stat(filename, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return -1;
+  if(st.st_size > BENCH_MAX_SAMPLE_SIZE ||
+      bench_corpus_size + st.st_size > BENCH_MAX_CORPUS_SIZE)
+  {
+    fprintf(stderr, "%s: skipped, too large\n", filename);
+    return -1;
+  }
+  handle=fopen(filename, "rb");
+  if(handle==NULL)
+    return -1;
+  sample=&bench_samples[bench_nbr_samples];
+  sample->size=st.st_size;
+  /* The header check may look at BENCH_HEADER_SIZE bytes, the data check
+   * at the block before and after the current one */
+  sample->buffer=(unsigned char *)MALLOC(blocksize + sample->size + BENCH_HEADER_SIZE + 2 * blocksize);
+  memset(sample->buffer, 0, blocksize + sample->size + BENCH_HEADER_SIZE + 2 * blocksize);
+  if(fread(sample->buffer + blocksize, 1, sample->size, handle)!=sample->size)
+  {
+    fclose(handle);
+    free(sample->buffer);
+    return -1;
+  }
+  fclose(handle);
+  sample->filename=strdup(filename);
+  bench_corpus_size+=sample->size;
+  bench_nbr_samples++;
+  return 0;
+}
+
+static void bench_load_dir(const char *dirname, const unsigned int blocksize)
+{
+  DIR *dir=opendir(dirname);
+  const struct dirent *entry;
+  if(dir==NULL)
+    return ;
+  while((entry=readdir(dir))!=NULL)
+  {
+    char *path;
+    struct stat st;
+    if(strcmp(entry->d_name, ".")==0 || strcmp(entry->d_name, "..")==0)
+      continue;
+    path=(char *)MALLOC(strlen(dirname) + strlen(entry->d_name) + 2);
+    sprintf(path, "%s/%s", dirname, entry->d_name);
+#ifdef HAVE_LSTAT
+    if(lstat(path, &st)==0)
+#else
+    if(stat(path, &st)==0)
+#endif
+    {
+      if(S_ISDIR(st.st_mode))
+	bench_load_dir(path, blocksize);
+      else if(S_ISREG(st.st_mode))
+	bench_load_sample(path, blocksize);
+    }
+    free(path);
+  }
+  closedir(dir);
+}
+
+/* Call header_check for the checks of the format whose signature is
+ * found in buffer, return the check that accepted it */
+static const file_check_t *bench_header(bench_format_t *stat, const unsigned char *buffer, const unsigned int buffer_size, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+  const struct td_list_head *tmpl;
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    const unsigned int c=buffer[pos->offset];
+    const struct td_list_head *tmp;
+    if(!file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if(file_check->file_stat->file_hint==stat->file_hint &&
+	  (file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0))
+      {
+	const uint64_t start=file_profile_clock();
+	const int res=file_check->header_check(buffer, buffer_size, 0, file_recovery, file_recovery_new);
+	stat->header_ns+=file_profile_clock() - start;
+	stat->header_calls++;
+	if(res!=0)
+	{
+	  file_recovery_new->file_stat=file_check->file_stat;
+	  return file_check;
+	}
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Feed the blocks of buffer to data_check, buffer - blocksize must be
+ * readable. As fidentify, stop at the first block that isn't DC_CONTINUE */
+static void bench_data_check(file_recovery_t *file_recovery, const unsigned char *buffer, const uint64_t size, const unsigned int blocksize)
+{
+  uint64_t offset;
+  data_check_t res=DC_CONTINUE;
+  for(offset=0; offset < size && file_recovery->data_check!=NULL; offset+=blocksize)
+  {
+    res=file_recovery->data_check(buffer + offset - blocksize, 2 * blocksize, file_recovery);
+    file_recovery->file_size+=blocksize;
+    if(res!=DC_CONTINUE)
+      break;
+  }
+  if(res==DC_ERROR)
+    file_recovery->file_size=0;
+  if(file_recovery->file_size > size)
+    file_recovery->file_size=size;
+}
+
+static void bench_file_recovery_init(file_recovery_t *file_recovery, file_recovery_t *file_recovery_new, const unsigned int blocksize)
+{
+  reset_file_recovery(file_recovery);
+  reset_file_recovery(file_recovery_new);
+  file_recovery->blocksize=blocksize;
+  file_recovery_new->blocksize=blocksize;
+  strcpy(file_recovery_new->filename, "recup_dir.1/f0000000");
+}
+
+/* Identify, check and size the sample, return 1 if it's of this format */
+static int bench_sample(bench_format_t *stat, const bench_sample_t *sample, const unsigned int blocksize, uint64_t *elapsed)
+{
+  const unsigned char *data=sample->buffer + blocksize;
+  const unsigned int header_size=(blocksize > BENCH_HEADER_SIZE ? blocksize : BENCH_HEADER_SIZE);
+  file_recovery_t file_recovery;
+  file_recovery_t file_recovery_new;
+  uint64_t start;
+  bench_file_recovery_init(&file_recovery, &file_recovery_new, blocksize);
+  start=file_profile_clock();
+  if(bench_header(stat, data, header_size, &file_recovery, &file_recovery_new)==NULL)
+    return 0;
+  if(file_recovery_new.data_check!=NULL)
+    bench_data_check(&file_recovery_new, data, sample->size, blocksize);
+  else
+  {
+    file_recovery_new.file_size=sample->size;
+    file_recovery_new.calculated_file_size=sample->size;
+  }
+  if(file_recovery_new.file_size > 0 && file_recovery_new.file_check!=NULL)
+  {
+    file_recovery_new.handle=fopen(sample->filename, "rb");
+    if(file_recovery_new.handle!=NULL)
+    {
+      file_recovery_new.file_check(&file_recovery_new);
+      fclose(file_recovery_new.handle);
+      file_recovery_new.handle=NULL;
+    }
+  }
+  *elapsed+=file_profile_clock() - start;
+  return 1;
+}
+
+/* A candidate found in random data is kept if data_check and file_check
+ * don't reject it */
+static int bench_candidate_kept(file_recovery_t *file_recovery_new, const unsigned char *data, const unsigned int blocksize)
+{
+  if(file_recovery_new->data_check!=NULL)
+    bench_data_check(file_recovery_new, data, (uint64_t)BENCH_DATA_BLOCKS * blocksize, blocksize);
+  else
+  {
+    file_recovery_new->file_size=(uint64_t)BENCH_DATA_BLOCKS * blocksize;
+    file_recovery_new->calculated_file_size=file_recovery_new->file_size;
+  }
+  if(file_recovery_new->file_size > 0 && file_recovery_new->file_check!=NULL)
+  {
+    FILE *handle=tmpfile();
+    if(handle!=NULL)
+    {
+      if(fwrite(data, 1, file_recovery_new->file_size, handle)==file_recovery_new->file_size)
+      {
+	file_recovery_new->handle=handle;
+	file_recovery_new->file_check(file_recovery_new);
+	file_recovery_new->handle=NULL;
+      }
+      fclose(handle);
+    }
+  }
+  return (file_recovery_new->file_size > 0 &&
+      file_recovery_new->file_size >= file_recovery_new->min_filesize);
+}
+
+/* Scan the random pool one block at a time, as photorec scans a disk */
+static void bench_random_scan(bench_format_t *stat, const unsigned char *pool, const unsigned int blocksize)
+{
+  const unsigned int header_size=(blocksize > BENCH_HEADER_SIZE ? blocksize : BENCH_HEADER_SIZE);
+  uint64_t offset;
+  for(offset=blocksize;
+      offset + header_size + (uint64_t)BENCH_DATA_BLOCKS * blocksize <= BENCH_POOL_SIZE;
+      offset+=blocksize)
+  {
+    file_recovery_t file_recovery;
+    file_recovery_t file_recovery_new;
+    bench_file_recovery_init(&file_recovery, &file_recovery_new, blocksize);
+    if(bench_header(stat, pool + offset, header_size, &file_recovery, &file_recovery_new)!=NULL)
+      stat->fp_random++;
+  }
+}
+
+/* Plant each signature of the format in random data */
+static void bench_planted(bench_format_t *stat, unsigned char *pool, const bench_options_t *options, uint64_t *state)
+{
+  const unsigned int blocksize=options->blocksize;
+  const unsigned int header_size=(blocksize > BENCH_HEADER_SIZE ? blocksize : BENCH_HEADER_SIZE);
+  const uint64_t nbr_positions=(BENCH_POOL_SIZE - header_size - (uint64_t)(BENCH_DATA_BLOCKS + 2) * blocksize) / blocksize;
+  const struct td_list_head *tmpl;
+  unsigned char saved[PHOTOREC_MAX_SIG_SIZE];
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    unsigned int c;
+    for(c=0; c<256; c++)
+    {
+      const struct td_list_head *tmp;
+      if(!file_check_list_used(pos, c))
+	continue;
+      td_list_for_each(tmp, &pos->file_checks[c].list)
+      {
+	const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+	unsigned int i;
+	if(file_check->file_stat->file_hint!=stat->file_hint || file_check->length==0 ||
+	    file_check->length > sizeof(saved))
+	  continue;
+	for(i=0; i<options->trials; i++)
+	{
+	  unsigned char *buffer=pool + (1 + bench_random(state) % nbr_positions) * blocksize;
+	  file_recovery_t file_recovery;
+	  file_recovery_t file_recovery_new;
+	  memcpy(saved, buffer + file_check->offset, file_check->length);
+	  memcpy(buffer + file_check->offset, file_check->value, file_check->length);
+	  bench_file_recovery_init(&file_recovery, &file_recovery_new, blocksize);
+	  stat->trials++;
+	  if(bench_header(stat, buffer, header_size, &file_recovery, &file_recovery_new)!=NULL)
+	  {
+	    stat->fp_header++;
+	    if(bench_candidate_kept(&file_recovery_new, buffer, blocksize))
+	      stat->fp++;
+	  }
+	  memcpy(buffer + file_check->offset, saved, file_check->length);
+	}
+      }
+    }
+  }
+}
+
+static double bench_ns_per_byte(const bench_format_t *stat)
+{
+  return (stat->sample_bytes > 0 ? (double)stat->sample_ns / stat->sample_bytes : 0.0);
+}
+
+static void bench_print(FILE *out, const bench_format_t *stat)
+{
+  fprintf(out, "format=%s samples=%u bytes=%llu ns=%llu ns_per_byte=%.3f header_calls=%llu ns_per_header=%.1f fp_random=%u fp_header=%u/%u fp=%u/%u\n",
+      stat->file_hint->extension, stat->samples,
+      (long long unsigned)stat->sample_bytes, (long long unsigned)stat->sample_ns,
+      bench_ns_per_byte(stat),
+      (long long unsigned)stat->header_calls,
+      (stat->header_calls > 0 ? (double)stat->header_ns / stat->header_calls : 0.0),
+      stat->fp_random, stat->fp_header, stat->trials, stat->fp, stat->trials);
+}
+
+/* Compare with a line of a previous run, return the number of regressions */
+static unsigned int bench_compare(const bench_format_t *stat, const char *line, const unsigned int tolerance)
+{
+  unsigned int samples, fp_random, fp, trials;
+  unsigned long long bytes, ns;
+  const char *s;
+  unsigned int regressions=0;
+  if(sscanf(line, "%*s samples=%u bytes=%llu ns=%llu", &samples, &bytes, &ns)!=3 ||
+      (s=strstr(line, " fp_random="))==NULL || sscanf(s, " fp_random=%u", &fp_random)!=1 ||
+      (s=strstr(line, " fp="))==NULL || sscanf(s, " fp=%u/%u", &fp, &trials)!=2)
+    return 0;
+  if(stat->samples < samples)
+  {
+    printf("regression: format=%s recognizes %u samples instead of %u\n",
+	stat->file_hint->extension, stat->samples, samples);
+    regressions++;
+  }
+  /* Speed is only compared on the same corpus */
+  if(stat->sample_bytes==bytes && ns >= BENCH_MIN_COMPARE_NS &&
+      stat->sample_ns > ns + ns * tolerance / 100)
+  {
+    printf("regression: format=%s %.3f ns/byte instead of %.3f\n",
+	stat->file_hint->extension, bench_ns_per_byte(stat), (double)ns / bytes);
+    regressions++;
+  }
+  if(stat->fp_random > fp_random)
+  {
+    printf("regression: format=%s %u false positives in random data instead of %u\n",
+	stat->file_hint->extension, stat->fp_random, fp_random);
+    regressions++;
+  }
+  if(stat->trials==trials && stat->fp > fp)
+  {
+    printf("regression: format=%s keeps %u/%u planted signatures instead of %u\n",
+	stat->file_hint->extension, stat->fp, stat->trials, fp);
+    regressions++;
+  }
+  return regressions;
+}
+
+static unsigned int bench_compare_baseline(const bench_format_t *stats, const unsigned int nbr_formats, const char *filename, const unsigned int tolerance)
+{
+  char line[1024];
+  unsigned int regressions=0;
+  char *compared;
+  FILE *handle=fopen(filename, "r");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't read the baseline %s\n", filename);
+    return 1;
+  }
+  /* A few formats share their extension, their lines are in the same order */
+  compared=(char *)MALLOC(nbr_formats + 1);
+  memset(compared, 0, nbr_formats + 1);
+  while(fgets(line, sizeof(line), handle)!=NULL)
+  {
+    char extension[64];
+    unsigned int i;
+    if(sscanf(line, "format=%63s", extension)!=1)
+      continue;
+    for(i=0; i<nbr_formats; i++)
+    {
+      if(compared[i]==0 && strcmp(stats[i].file_hint->extension, extension)==0)
+      {
+	compared[i]=1;
+	regressions+=bench_compare(&stats[i], line, tolerance);
+	break;
+      }
+    }
+  }
+  fclose(handle);
+  free(compared);
+  return regressions;
+}
+
+static void bench_format(bench_format_t *stat, unsigned char *pool, const bench_options_t *options)
+{
+  uint64_t state=options->seed;
+  unsigned int r;
+  for(r=0; r<options->repeat; r++)
+  {
+    unsigned int samples=0;
+    uint64_t bytes=0;
+    uint64_t elapsed=0;
+    unsigned int i;
+    for(i=0; i<bench_nbr_samples; i++)
+    {
+      if(bench_sample(stat, &bench_samples[i], options->blocksize, &elapsed))
+      {
+	samples++;
+	bytes+=bench_samples[i].size;
+      }
+    }
+    /* Keep the fastest run */
+    if(r==0 || elapsed < stat->sample_ns)
+      stat->sample_ns=elapsed;
+    stat->samples=samples;
+    stat->sample_bytes=bytes;
+  }
+  bench_random_scan(stat, pool, options->blocksize);
+  bench_planted(stat, pool, options, &state);
+}
+
+static void display_help(void)
+{
+  printf("\nUsage: format_bench [/blocksize N] [/trials N] [/repeat N] [/seed N]\n"
+      "                    [/baseline file] [/tolerance percent] [/save file]\n"
+      "                    [+file_format]... [sample_file|sample_dir]...\n"
+      "\n"
+      "Benchmark the header, data and file checks of each file format on the\n"
+      "samples, count the false positives on random data.\n"
+      "/baseline compares the results with a previous /save and exits with the\n"
+      "status 1 when a format is slower by more than the tolerance (25%% by\n"
+      "default), recognizes fewer samples or accepts more random data.\n");
+}
+
+int main(int argc, char **argv)
+{
+  bench_options_t options;
+  const char *baseline=NULL;
+  const char *save=NULL;
+  int enable_all_formats=1;
+  unsigned char *pool;
+  bench_format_t *stats;
+  unsigned int nbr_formats=0;
+  unsigned int regressions=0;
+  file_enable_t *file_enable;
+  uint64_t state;
+  unsigned int i;
+  int j;
+  options.blocksize=4096;
+  options.trials=256;
+  options.repeat=3;
+  options.tolerance=25;
+  options.seed=0x5eed;
+  for(j=1; j<argc; j++)
+  {
+    const char *arg=argv[j];
+    if(arg[0]=='-' && arg[1]=='-')
+      arg++;
+    if(j+1<argc && (strcmp(arg, "/blocksize")==0 || strcmp(arg, "-blocksize")==0))
+      options.blocksize=atoi(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/trials")==0 || strcmp(arg, "-trials")==0))
+      options.trials=atoi(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/repeat")==0 || strcmp(arg, "-repeat")==0))
+      options.repeat=atoi(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/tolerance")==0 || strcmp(arg, "-tolerance")==0))
+      options.tolerance=atoi(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/seed")==0 || strcmp(arg, "-seed")==0))
+      options.seed=strtoull(argv[++j], NULL, 0);
+    else if(j+1<argc && (strcmp(arg, "/baseline")==0 || strcmp(arg, "-baseline")==0))
+      baseline=argv[++j];
+    else if(j+1<argc && (strcmp(arg, "/save")==0 || strcmp(arg, "-save")==0))
+      save=argv[++j];
+    else if(strcmp(arg, "/help")==0 || strcmp(arg, "-help")==0 || strcmp(arg, "-h")==0)
+    {
+      display_help();
+      return 0;
+    }
+    else if(arg[0]=='+')
+    {
+      for(file_enable=array_file_enable; file_enable->file_hint!=NULL; file_enable++)
+	if(file_enable->file_hint->extension!=NULL &&
+	    strcmp(file_enable->file_hint->extension, &arg[1])==0)
+	{
+	  file_enable->enable=1;
+	  enable_all_formats=0;
+	}
+    }
+  }
+  if(options.blocksize < 512 || options.blocksize > 1024*1024 ||
+      (options.blocksize & (options.blocksize - 1))!=0 || options.repeat==0)
+  {
+    display_help();
+    return 1;
+  }
+  for(j=1; j<argc; j++)
+  {
+    const char *arg=argv[j];
+    struct stat st;
+    if(arg[0]=='-' && arg[1]=='-')
+      arg++;
+    if(strcmp(arg, "/blocksize")==0 || strcmp(arg, "-blocksize")==0 ||
+	strcmp(arg, "/trials")==0 || strcmp(arg, "-trials")==0 ||
+	strcmp(arg, "/repeat")==0 || strcmp(arg, "-repeat")==0 ||
+	strcmp(arg, "/tolerance")==0 || strcmp(arg, "-tolerance")==0 ||
+	strcmp(arg, "/seed")==0 || strcmp(arg, "-seed")==0 ||
+	strcmp(arg, "/baseline")==0 || strcmp(arg, "-baseline")==0 ||
+	strcmp(arg, "/save")==0 || strcmp(arg, "-save")==0)
+      j++;
+    else if(arg[0]=='+')
+      continue;
+    else if(stat(argv[j], &st)==0)
+    {
+      if(S_ISDIR(st.st_mode))
+	bench_load_dir(argv[j], options.blocksize);
+      else
+	bench_load_sample(argv[j], options.blocksize);
+    }
+    else
+      fprintf(stderr, "%s: not found\n", argv[j]);
+  }
+  for(file_enable=array_file_enable; file_enable->file_hint!=NULL; file_enable++)
+  {
+    if(enable_all_formats)
+      file_enable->enable=1;
+    if(file_enable->enable)
+      nbr_formats++;
+  }
+  init_file_stats(array_file_enable);
+  stats=(bench_format_t *)MALLOC((nbr_formats > 0 ? nbr_formats : 1) * sizeof(bench_format_t));
+  memset(stats, 0, (nbr_formats > 0 ? nbr_formats : 1) * sizeof(bench_format_t));
+  nbr_formats=0;
+  for(file_enable=array_file_enable; file_enable->file_hint!=NULL; file_enable++)
+    if(file_enable->enable && file_enable->file_hint->extension!=NULL)
+      stats[nbr_formats++].file_hint=file_enable->file_hint;
+  pool=(unsigned char *)MALLOC(BENCH_POOL_SIZE);
+  state=options.seed;
+  for(i=0; i<BENCH_POOL_SIZE; i+=8)
+  {
+    const uint64_t r=bench_random(&state);
+    memcpy(&pool[i], &r, 8);
+  }
+  printf("samples=%u bytes=%llu blocksize=%u trials=%u seed=0x%llx\n",
+      bench_nbr_samples, (long long unsigned)bench_corpus_size, options.blocksize,
+      options.trials, (long long unsigned)options.seed);
+  for(i=0; i<nbr_formats; i++)
+  {
+    bench_format(&stats[i], pool, &options);
+    bench_print(stdout, &stats[i]);
+    fflush(stdout);
+  }
+  if(save!=NULL)
+  {
+    FILE *handle=fopen(save, "w");
+    if(handle==NULL)
+      fprintf(stderr, "Can't write %s\n", save);
+    else
+    {
+      for(i=0; i<nbr_formats; i++)
+	bench_print(handle, &stats[i]);
+      fclose(handle);
+    }
+  }
+  if(baseline!=NULL)
+  {
+    regressions=bench_compare_baseline(stats, nbr_formats, baseline, options.tolerance);
+    printf("%u regression(s) against %s\n", regressions, baseline);
+  }
+  free_header_check();
+  free(pool);
+  free(stats);
+  for(i=0; i<bench_nbr_samples; i++)
+  {
+    free(bench_samples[i].filename);
+    free(bench_samples[i].buffer);
+  }
+  return (regressions > 0 ? 1 : 0);
+}
@@ -0,0 +1,271 @@
+/*
+
+    File: fuzzerperf.cpp
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Performance companion of fuzzerfidentify.
+ * Each input is handed to the header_check of every format whose signature
+ * matches, then to its data_check and file_check, and each call is timed.
+ * A call taking more than FUZZ_PERF_MS_PER_KB ms (default 1) per started
+ * KB of input is reported on stderr and the input is saved in FUZZ_PERF_SLOW_DIR (default slow-inputs) as
+ * slow-<extension>-<hash>. With FUZZ_PERF_ABORT=1, the fuzzer stops on the
+ * first slow input so that libFuzzer keeps it as a crash.
+ * Built with -DFUZZER_PERF_MAIN, the program replays the files given on the
+ * command line without libFuzzer, e.g. to check a slow-input corpus. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+extern file_enable_t array_file_enable[];
+extern file_check_list_t file_check_list;
+
+#define PERF_BLOCKSIZE		65536
+#define PERF_MAX_SIZE		(16*1024*1024)
+
+static double perf_ms_per_kb=1.0;
+static const char *perf_slow_dir="slow-inputs";
+static int perf_abort=0;
+static unsigned int perf_nbr_slow=0;
+
+/* FNV-1a, to name the saved inputs */
+static uint64_t perf_hash(const uint8_t *data, const size_t size)
+{
+  uint64_t hash=0xcbf29ce484222325ULL;
+  size_t i;
+  for(i=0; i<size; i++)
+  {
+    hash^=data[i];
+    hash*=0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void perf_save(const file_hint_t *file_hint, const uint8_t *data, const size_t size)
+{
+  char filename[4096];
+  FILE *out;
+  if(perf_slow_dir[0]=='\0')
+    return ;
+#ifdef HAVE_MKDIR
+#ifdef __MINGW32__
+  if(mkdir(perf_slow_dir)<0 && errno!=EEXIST)
+#else
+  if(mkdir(perf_slow_dir, 0775)<0 && errno!=EEXIST)
+#endif
+  {
+    fprintf(stderr, "fuzzerperf: can't create %s: %s\n", perf_slow_dir, strerror(errno));
+    return ;
+  }
+#endif
+  snprintf(filename, sizeof(filename), "%s/slow-%s-%016llx", perf_slow_dir,
+      (file_hint->extension!=NULL ? file_hint->extension : "none"),
+      (long long unsigned)perf_hash(data, size));
+  out=fopen(filename, "wb");
+  if(out==NULL)
+    return ;
+  if(fwrite(data, size, 1, out)!=1)
+    fprintf(stderr, "fuzzerperf: can't write %s\n", filename);
+  fclose(out);
+}
+
+/* Report a call that took too long for the size of the input */
+static void perf_check(const file_hint_t *file_hint, const char *function, const uint64_t elapsed, const uint8_t *data, const size_t size)
+{
+  const size_t kb=(size + 1023) / 1024;
+  const double ms=(double)elapsed / 1000000;
+  if(ms <= perf_ms_per_kb * kb)
+    return ;
+  perf_nbr_slow++;
+  fprintf(stderr, "fuzzerperf: slow %s %s: %.3f ms for %lu bytes, %.3f ms/KB\n",
+      (file_hint->extension!=NULL ? file_hint->extension : "none"), function,
+      ms, (long unsigned)size, ms / kb);
+  perf_save(file_hint, data, size);
+  if(perf_abort)
+    abort();
+}
+
+/* Feed the blocks to data_check as photorec does,
+ * buffer - PERF_BLOCKSIZE must be readable */
+static void perf_data_check(file_recovery_t *file_recovery, const unsigned char *buffer, const size_t size)
+{
+  uint64_t offset;
+  data_check_t res=DC_CONTINUE;
+  for(offset=0; offset < size && file_recovery->data_check!=NULL; offset+=PERF_BLOCKSIZE)
+  {
+    res=file_recovery->data_check(buffer + offset - PERF_BLOCKSIZE, 2 * PERF_BLOCKSIZE, file_recovery);
+    file_recovery->file_size+=PERF_BLOCKSIZE;
+    if(res!=DC_CONTINUE)
+      break;
+  }
+  if(res==DC_ERROR)
+    file_recovery->file_size=0;
+  if(file_recovery->file_size > size)
+    file_recovery->file_size=size;
+}
+
+static void perf_candidate(const file_check_t *file_check, const unsigned char *buffer, const uint8_t *data, const size_t size)
+{
+  const file_hint_t *file_hint=file_check->file_stat->file_hint;
+  file_recovery_t file_recovery;
+  file_recovery_t file_recovery_new;
+  uint64_t start;
+  int res;
+  reset_file_recovery(&file_recovery);
+  reset_file_recovery(&file_recovery_new);
+  file_recovery.blocksize=PERF_BLOCKSIZE;
+  file_recovery_new.blocksize=PERF_BLOCKSIZE;
+  strcpy(file_recovery_new.filename, "recup_dir.1/f0000000");
+  start=file_profile_clock();
+  res=file_check->header_check(buffer, PERF_BLOCKSIZE, 0, &file_recovery, &file_recovery_new);
+  perf_check(file_hint, "header_check", file_profile_clock() - start, data, size);
+  if(res==0)
+    return ;
+  file_recovery_new.file_stat=file_check->file_stat;
+  if(file_recovery_new.data_check!=NULL)
+  {
+    start=file_profile_clock();
+    perf_data_check(&file_recovery_new, buffer, size);
+    perf_check(file_hint, "data_check", file_profile_clock() - start, data, size);
+  }
+  else
+  {
+    file_recovery_new.file_size=size;
+    file_recovery_new.calculated_file_size=size;
+  }
+  if(file_recovery_new.file_size > 0 && file_recovery_new.file_check!=NULL)
+  {
+    FILE *handle=tmpfile();
+    if(handle==NULL)
+      return ;
+    if(fwrite(data, 1, file_recovery_new.file_size, handle)==file_recovery_new.file_size)
+    {
+      file_recovery_new.handle=handle;
+      start=file_profile_clock();
+      file_recovery_new.file_check(&file_recovery_new);
+      perf_check(file_hint, "file_check", file_profile_clock() - start, data, size);
+      file_recovery_new.handle=NULL;
+    }
+    fclose(handle);
+  }
+}
+
+static void perf_init(void)
+{
+  const char *env;
+  file_enable_t *file_enable;
+  env=getenv("FUZZ_PERF_MS_PER_KB");
+  if(env!=NULL && atof(env) > 0)
+    perf_ms_per_kb=atof(env);
+  env=getenv("FUZZ_PERF_SLOW_DIR");
+  if(env!=NULL)
+    perf_slow_dir=env;
+  env=getenv("FUZZ_PERF_ABORT");
+  if(env!=NULL)
+    perf_abort=atoi(env);
+  /* Enable all file formats */
+  for(file_enable=array_file_enable;file_enable->file_hint!=NULL;file_enable++)
+    file_enable->enable=1;
+  init_file_stats(array_file_enable);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size)
+{
+  static unsigned char *buffer_start=NULL;
+  const size_t size=(Size < PERF_MAX_SIZE ? Size : PERF_MAX_SIZE);
+  const size_t padded_size=(size + PERF_BLOCKSIZE - 1) / PERF_BLOCKSIZE * PERF_BLOCKSIZE + PERF_BLOCKSIZE;
+  unsigned char *buffer;
+  const struct td_list_head *tmpl;
+  if(Size == 0)
+    return 0;
+  if(buffer_start==NULL)
+  {
+    perf_init();
+    /* A zeroed block before the data, the data and zero padding
+     * up to the next block and one more block for data_check */
+    buffer_start=(unsigned char *)MALLOC(PERF_MAX_SIZE + 3 * PERF_BLOCKSIZE);
+    memset(buffer_start, 0, PERF_BLOCKSIZE);
+  }
+  buffer=buffer_start + PERF_BLOCKSIZE;
+  memcpy(buffer, Data, size);
+  memset(buffer + size, 0, padded_size - size);
+  /* Unlike photorec, try every matching signature: a slow header_check
+   * shouldn't be hidden by another format accepting the input first */
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    const unsigned int c=buffer[pos->offset];
+    const struct td_list_head *tmp;
+    if(pos->offset >= PERF_BLOCKSIZE || !file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if(file_check->length==0 ||
+	  memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0)
+	perf_candidate(file_check, buffer, Data, size);
+    }
+  }
+  return 0;  // Non-zero return values are reserved for future use.
+}
+
+#ifdef FUZZER_PERF_MAIN
+int main(int argc, char **argv)
+{
+  int i;
+  uint8_t *data=(uint8_t *)MALLOC(PERF_MAX_SIZE);
+  for(i=1; i<argc; i++)
+  {
+    FILE *in=fopen(argv[i], "rb");
+    size_t size;
+    if(in==NULL)
+    {
+      fprintf(stderr, "fuzzerperf: can't open %s\n", argv[i]);
+      continue;
+    }
+    size=fread(data, 1, PERF_MAX_SIZE, in);
+    fclose(in);
+    LLVMFuzzerTestOneInput(data, size);
+  }
+  free(data);
+  printf("fuzzerperf: %u slow calls\n", perf_nbr_slow);
+  return (perf_nbr_slow > 0 ? 1 : 0);
+}
+#endif
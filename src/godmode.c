@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #endif
 #include <assert.h>
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "fnctdsk.h"
@@ -49,10 +52,17 @@
 #include "thfs.h"
 #include "partgpt.h"
 #include "partmacn.h"
+#include "hdcache.h"
+#include "hdstats.h"
+#include "hdaccess.h"
+#include "analyse_cache.h"
+#include "pscore.h"
 
 #define RO 1
 #define RW 0
 #define MAX_SEARCH_LOCATION 1024
+/* Read-ahead unit during deep search */
+#define SEARCH_PREFETCH_SIZE (4*1024*1024)
 extern const arch_fnct_t arch_none;
 extern const arch_fnct_t arch_gpt;
 extern const arch_fnct_t arch_humax;
@@ -493,32 +503,87 @@ static void warning_geometry_ncurses(disk_t *disk_car, const unsigned int recomm
 }
 #endif
 
+/* Sorted circular buffer of search offset hints, the hints already reached
+ * are dropped from the head without moving the others */
+typedef struct
+{
+  uint64_t tab[MAX_SEARCH_LOCATION];
+  unsigned int first;
+  unsigned int nbr;
+} hint_list_t;
+
 /**
- * @brief Inserts a hint offset into a sorted array
+ * @brief Returns the i-th smallest hint
+ */
+static inline uint64_t hint_get(const hint_list_t *hints, const unsigned int i)
+{
+  return hints->tab[(hints->first + i) % MAX_SEARCH_LOCATION];
+}
+
+/**
+ * @brief Inserts a hint offset into a sorted list
  * 
- * Inserts a new offset hint into a sorted array of offsets. The function
- * maintains the array in ascending order and avoids duplicates. If the
- * array is full, the new hint is ignored.
+ * Inserts a new offset hint into the sorted circular buffer. The function
+ * maintains the hints in ascending order and avoids duplicates. If the
+ * buffer is full, the new hint is ignored.
  * 
- * @param tab Array of offset hints (sorted in ascending order)
+ * @param hints Sorted list of offset hints
  * @param offset The new offset hint to insert
- * @param tab_nbr Pointer to the number of elements currently in the array
  */
-static void hint_insert(uint64_t *tab, const uint64_t offset, unsigned int *tab_nbr)
+static void hint_insert(hint_list_t *hints, const uint64_t offset)
 {
-  if(*tab_nbr<MAX_SEARCH_LOCATION-1)
+  if(hints->nbr<MAX_SEARCH_LOCATION-1)
   {
-    unsigned int i,j;
-    for(i=0;i<*tab_nbr && tab[i]<offset;i++);
-    if(i<*tab_nbr && tab[i]==offset)
+    unsigned int i=0;
+    unsigned int j;
+    unsigned int hi=hints->nbr;
+    while(i<hi)
+    {
+      const unsigned int mid=(i+hi)/2;
+      if(hint_get(hints, mid)<offset)
+	i=mid+1;
+      else
+	hi=mid;
+    }
+    if(i<hints->nbr && hint_get(hints, i)==offset)
       return;
-    (*tab_nbr)++;
-    for(j=*tab_nbr;j>i;j--)
-      tab[j]=tab[j-1];
-    tab[i]=offset;
+    /* Move the smallest side of the buffer */
+    if(i < hints->nbr/2)
+    {
+      hints->first=(hints->first + MAX_SEARCH_LOCATION - 1) % MAX_SEARCH_LOCATION;
+      for(j=0;j<i;j++)
+	hints->tab[(hints->first + j) % MAX_SEARCH_LOCATION]=hint_get(hints, j+1);
+    }
+    else
+    {
+      for(j=hints->nbr;j>i;j--)
+	hints->tab[(hints->first + j) % MAX_SEARCH_LOCATION]=hint_get(hints, j-1);
+    }
+    hints->tab[(hints->first + i) % MAX_SEARCH_LOCATION]=offset;
+    hints->nbr++;
   }
 }
 
+/**
+ * @brief Drops the hints up to the current search location
+ * 
+ * @param hints Sorted list of offset hints
+ * @param offset Current search location
+ * @return 1 if offset was one of the hints, 0 otherwise
+ */
+static int hint_skip(hint_list_t *hints, const uint64_t offset)
+{
+  int found=0;
+  while(hints->nbr>0 && hints->tab[hints->first]<=offset)
+  {
+    if(hints->tab[hints->first]==offset)
+      found=1;
+    hints->first=(hints->first + 1) % MAX_SEARCH_LOCATION;
+    hints->nbr--;
+  }
+  return found;
+}
+
 /**
  * @brief Adds search hints based on disk architecture
  * 
@@ -528,36 +593,35 @@ static void hint_insert(uint64_t *tab, const uint64_t offset, unsigned int *tab_
  * partition discovery efficiency.
  * 
  * @param disk Pointer to the disk structure containing architecture information
- * @param try_offset Array to store the search offset hints
- * @param try_offset_nbr Pointer to the number of hints in the array
+ * @param try_offset Sorted list to store the search offset hints
  */
-static void search_add_hints(const disk_t *disk, uint64_t *try_offset, unsigned int *try_offset_nbr)
+static void search_add_hints(const disk_t *disk, hint_list_t *try_offset)
 {
   if(disk->arch==&arch_i386)
   {
     /* sometimes users choose Intel instead of GPT */
-    hint_insert(try_offset, 2*disk->sector_size+16384, try_offset_nbr);
+    hint_insert(try_offset, 2*disk->sector_size+16384);
     /* sometimes users don't choose Vista by mistake */
-    hint_insert(try_offset, 2048*512, try_offset_nbr);
+    hint_insert(try_offset, 2048*512);
     /* try to deal with incorrect geometry */
     /* 0/1/1 */
-    hint_insert(try_offset, 32 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, 63 * disk->sector_size, try_offset_nbr);
+    hint_insert(try_offset, 32 * disk->sector_size);
+    hint_insert(try_offset, 63 * disk->sector_size);
     /* 1/[01]/1 CHS x  16 63 */
-    hint_insert(try_offset, 16 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, 17 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)16 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)17 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
+    hint_insert(try_offset, 16 * 63 * disk->sector_size);
+    hint_insert(try_offset, 17 * 63 * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)16 * disk->geom.sectors_per_head * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)17 * disk->geom.sectors_per_head * disk->sector_size);
     /* 1/[01]/1 CHS x 240 63 */
-    hint_insert(try_offset, 240 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, 241 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)240 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)241 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
+    hint_insert(try_offset, 240 * 63 * disk->sector_size);
+    hint_insert(try_offset, 241 * 63 * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)240 * disk->geom.sectors_per_head * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)241 * disk->geom.sectors_per_head * disk->sector_size);
     /* 1/[01]/1 CHS x 255 63 */
-    hint_insert(try_offset, 255 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, 256 * 63 * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)255 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
-    hint_insert(try_offset, (uint64_t)256 * disk->geom.sectors_per_head * disk->sector_size, try_offset_nbr);
+    hint_insert(try_offset, 255 * 63 * disk->sector_size);
+    hint_insert(try_offset, 256 * 63 * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)255 * disk->geom.sectors_per_head * disk->sector_size);
+    hint_insert(try_offset, (uint64_t)256 * disk->geom.sectors_per_head * disk->sector_size);
     /* Hints for NTFS backup */
     if(disk->geom.cylinders>1)
     {
@@ -565,14 +629,14 @@ static void search_add_hints(const disk_t *disk, uint64_t *try_offset, unsigned
       start.cylinder=disk->geom.cylinders-1;
       start.head=disk->geom.heads_per_cylinder-1;
       start.sector=disk->geom.sectors_per_head;
-      hint_insert(try_offset, CHS2offset_inline(disk, &start), try_offset_nbr);
+      hint_insert(try_offset, CHS2offset_inline(disk, &start));
       if(disk->geom.cylinders>2)
       {
 	start.cylinder--;
-	hint_insert(try_offset, CHS2offset_inline(disk, &start), try_offset_nbr);
+	hint_insert(try_offset, CHS2offset_inline(disk, &start));
       }
     }
-    hint_insert(try_offset, (disk->disk_size-disk->sector_size)/(2048*512)*(2048*512)-disk->sector_size, try_offset_nbr);
+    hint_insert(try_offset, (disk->disk_size-disk->sector_size)/(2048*512)*(2048*512)-disk->sector_size);
   }
   else if(disk->arch==&arch_gpt)
   {
@@ -580,12 +644,12 @@ static void search_add_hints(const disk_t *disk, uint64_t *try_offset, unsigned
     const unsigned int gpt_entries_size=128*sizeof(struct gpt_ent);
     const uint64_t hdr_lba_end=le64((disk->disk_size-1 - gpt_entries_size)/disk->sector_size - 1);
     const uint64_t ntfs_backup_offset=(hdr_lba_end-1)*disk->sector_size/(2048*512)*(2048*512)-disk->sector_size;
-    hint_insert(try_offset, ntfs_backup_offset, try_offset_nbr);
+    hint_insert(try_offset, ntfs_backup_offset);
   }
   else if(disk->arch==&arch_mac)
   {
     /* sometime users choose Mac instead of GPT for i386 Mac */
-    hint_insert(try_offset, 2*disk->sector_size+16384, try_offset_nbr);
+    hint_insert(try_offset, 2*disk->sector_size+16384);
   }
 }
 
@@ -707,6 +771,152 @@ static void search_NTFS_from_backup(disk_t *disk_car, list_part_t *list_part, co
   free(buffer_disk);
 }
 
+/**
+ * @brief Adds the backup boot sector locations of a supposed partition
+ *
+ * FAT32 and exFAT keep their backup after the boot sector, NTFS in the
+ * last sector of the volume and HFS/HFS+ 1024 bytes before its end.
+ * The volume may be smaller than a partition entry rounded to a cylinder
+ * or to 1 MiB, the rounded ends are added too.
+ *
+ * @param disk Pointer to the disk structure
+ * @param hints Sorted list of the backup locations
+ * @param part_offset Supposed partition beginning
+ * @param part_end Supposed partition end, the first byte after it
+ */
+static void backup_hints_insert(const disk_t *disk, hint_list_t *hints, const uint64_t part_offset, const uint64_t part_end)
+{
+  const uint64_t cylinder_size=(uint64_t)disk->geom.heads_per_cylinder * disk->geom.sectors_per_head * disk->sector_size;
+  uint64_t ends[3];
+  unsigned int i;
+  hint_insert(hints, part_offset + 6 * 512);
+  hint_insert(hints, part_offset + 12 * disk->sector_size);
+  ends[0]=part_end;
+  ends[1]=(cylinder_size > 0 ? part_end / cylinder_size * cylinder_size : part_end);
+  ends[2]=part_end / (2048 * 512) * (2048 * 512);
+  for(i=0; i<3; i++)
+  {
+    if(ends[i] > part_offset + 2 * disk->sector_size)
+    {
+      hint_insert(hints, ends[i] - disk->sector_size);
+      hint_insert(hints, ends[i] - 0x400);
+    }
+  }
+}
+
+/**
+ * @brief Tests the backup boot sectors of the known partitions
+ *
+ * The scan only tests the backup boot sectors at the locations expected
+ * for an aligned partition. The locations derived from the partitions of
+ * the current partition table are sorted and their data is read in large
+ * chunks before the FAT32, exFAT, NTFS and HFS backups are tested.
+ *
+ * @param disk_car Pointer to the disk structure
+ * @param list_part_org Partitions of the partition table, give the locations
+ * @param list_part List of the partitions found
+ * @param verbose Verbosity level for logging
+ * @param dump_ind Dump index for detailed output
+ * @param min_location Minimum location where partitions can be found
+ * @param search_location_max Maximum location to search for partitions
+ * @return the new list of the partitions found
+ */
+static list_part_t *search_backup_sectors(disk_t *disk_car, const list_part_t *list_part_org, list_part_t *list_part, const int verbose, const int dump_ind, const uint64_t min_location, const uint64_t search_location_max)
+{
+  unsigned char *buffer_disk;
+  const list_part_t *element;
+  partition_t *partition;
+  hint_list_t locations;
+  uint64_t prefetch_end=0;
+  unsigned int i;
+  locations.first=0;
+  locations.nbr=0;
+  for(element=list_part_org; element!=NULL; element=element->next)
+  {
+    if(element->part->part_size > 0)
+      backup_hints_insert(disk_car, &locations, element->part->part_offset,
+	  element->part->part_offset + element->part->part_size);
+  }
+  if(locations.nbr==0)
+    return list_part;
+  log_info("search_backup_sectors: %u locations\n", locations.nbr);
+  buffer_disk=(unsigned char*)MALLOC(16*DEFAULT_SECTOR_SIZE);
+  partition=partition_new(disk_car->arch);
+  for(i=0; i<locations.nbr; i++)
+  {
+    const uint64_t location=hint_get(&locations, i);
+    unsigned int test_nbr;
+    if(location < min_location || location >= search_location_max)
+      continue;
+#ifndef DISABLED_FOR_FRAMAC
+    /* One read for the locations close to each other */
+    if(location >= prefetch_end)
+    {
+      unsigned int j;
+      for(j=i+1; j<locations.nbr && hint_get(&locations, j) < location + SEARCH_PREFETCH_SIZE; j++);
+      prefetch_end=hint_get(&locations, j-1) + 2 * DEFAULT_SECTOR_SIZE;
+      diskcache_prefetch(disk_car, location, prefetch_end - location);
+      /* The next group of locations is loaded meanwhile */
+      if(j<locations.nbr)
+      {
+	const uint64_t next=hint_get(&locations, j);
+	unsigned int k;
+	for(k=j+1; k<locations.nbr && hint_get(&locations, k) < next + SEARCH_PREFETCH_SIZE; k++);
+	disk_advise(disk_car, next, hint_get(&locations, k-1) + 2 * DEFAULT_SECTOR_SIZE - next, TESTDISK_ADVISE_WILLNEED);
+      }
+    }
+#endif
+    for(test_nbr=0; test_nbr<4; test_nbr++)
+    {
+      int res;
+      partition_reset(partition, disk_car->arch);
+      partition->part_size=(uint64_t)0;
+      partition->part_offset=location;
+      switch(test_nbr)
+      {
+	case 0:
+	  res=search_FAT_backup(buffer_disk, disk_car, partition, verbose, dump_ind);
+	  break;
+	case 1:
+	  res=search_exFAT_backup(buffer_disk, disk_car, partition);
+	  break;
+	case 2:
+	  res=search_NTFS_backup(buffer_disk, disk_car, partition, verbose, dump_ind);
+	  break;
+	default:
+	  res=search_HFS_backup(buffer_disk, disk_car, partition, verbose, dump_ind);
+	  break;
+      }
+      if(res<0)
+	break;
+      if(res>0)
+      {
+	partition->status=STATUS_DELETED;
+	if(disk_car->arch->is_part_known(partition)!=0 && partition->part_size>1 &&
+	    partition->part_offset >= min_location &&
+	    partition->part_offset+partition->part_size-1 <= search_location_max)
+	{
+	  int insert_error=0;
+	  partition_t *new_partition=partition_new(NULL);
+	  dup_partition_t(new_partition,partition);
+	  list_part=insert_new_partition(list_part, new_partition, 0, &insert_error);
+	  if(insert_error>0)
+	    free(new_partition);
+	  else
+	  {
+	    log_partition(disk_car,partition);
+	    aff_part_buffer(AFF_PART_BASE, disk_car,partition);
+	  }
+	}
+	break;
+      }
+    }
+  }
+  free(partition);
+  free(buffer_disk);
+  return list_part;
+}
+
 typedef enum { INDSTOP_CONTINUE=0, INDSTOP_STOP=1, INDSTOP_SKIP=2, INDSTOP_QUIT=3, INDSTOP_PLUS=4 } indstop_t;
 
 /**
@@ -751,25 +961,210 @@ typedef enum { INDSTOP_CONTINUE=0, INDSTOP_STOP=1, INDSTOP_SKIP=2, INDSTOP_QUIT=
  * @note The function can be interrupted by user input during interactive mode
  * @note Discovered partitions are marked as STATUS_DELETED initially
  */
+/**
+ * @brief Records a partition found by search_part()
+ *
+ * Adds the partition to the partitions found, or to the partitions ending
+ * after the disk limits, and adds the places where the next partitions may
+ * start to the hints.
+ *
+ * @param search_location Location being probed, may be moved to the end
+ * of the partition
+ * @return 1 if *search_location has been moved, 0 otherwise
+ */
+static int search_part_found(disk_t *disk_car, partition_t *partition, list_part_t **list_part, list_part_t **list_part_bad, hint_list_t *try_offset, hint_list_t *try_offset_raid, uint64_t *search_location, const uint64_t min_location, const uint64_t search_location_max, const indstop_t ind_stop, const int fast_mode, const int verbose)
+{
+  partition->status=STATUS_DELETED;
+  log_partition(disk_car,partition);
+  aff_part_buffer(AFF_PART_BASE, disk_car,partition);
+#ifdef HAVE_NCURSES
+  screen_buffer_to_interface();
+#endif
+  if(disk_car->arch->is_part_known(partition)!=0 &&
+      partition->part_size>1 &&
+      partition->part_offset>=min_location)
+  {
+    const uint64_t pos_fin=partition->part_offset+partition->part_size-1;
+    if(partition->upart_type!=UP_MD && partition->upart_type!=UP_MD1 &&
+      ind_stop==INDSTOP_CONTINUE)
+    { /* Detect Linux md 0.9 software raid */
+      unsigned int disk_factor;
+      for(disk_factor=6; disk_factor>=1;disk_factor--)
+      { /* disk_factor=1, detect Raid 0/1 */
+        /* disk_factor>1, detect Raid 5 */
+	unsigned int help_factor;
+        for(help_factor=0; help_factor<=MD_MAX_CHUNK_SIZE/MD_RESERVED_BYTES+3; help_factor++)
+        {
+          const uint64_t offset=(uint64_t)MD_NEW_SIZE_SECTORS((partition->part_size/disk_factor+help_factor*MD_RESERVED_BYTES-1)/MD_RESERVED_BYTES*MD_RESERVED_BYTES/512)*512;
+          hint_insert(try_offset_raid, partition->part_offset+offset);
+        }
+      }
+      /* TODO: Detect Linux md 1.0 software raid */
+    }
+    /* */
+    if(pos_fin <= search_location_max)
+    {
+      {
+        int insert_error=0;
+        partition_t *new_partition=partition_new(NULL);
+        dup_partition_t(new_partition,partition);
+        *list_part=insert_new_partition(*list_part, new_partition, 0, &insert_error);
+        if(insert_error>0)
+          free(new_partition);
+      }
+      {
+        const uint64_t next_part_offset=partition->part_offset+partition->part_size-1+1;
+        const uint64_t head_size=(uint64_t)disk_car->geom.sectors_per_head * disk_car->sector_size;
+        hint_insert(try_offset, next_part_offset);
+        hint_insert(try_offset, next_part_offset+head_size);
+        if(next_part_offset%head_size!=0)
+        {
+          hint_insert(try_offset, (next_part_offset+head_size-1)/head_size*head_size);
+          hint_insert(try_offset, (next_part_offset+head_size-1)/head_size*head_size+head_size);
+        }
+      }
+      if((fast_mode==0) && (partition->part_offset+partition->part_size-disk_car->sector_size > *search_location))
+      {
+        *search_location=partition->part_offset+partition->part_size-disk_car->sector_size;
+        return 1;
+      }
+    }
+    else
+    {
+      {
+        int insert_error=0;
+        partition_t *new_partition=partition_new(NULL);
+        dup_partition_t(new_partition,partition);
+        *list_part_bad=insert_new_partition(*list_part_bad, new_partition, 0, &insert_error);
+        if(insert_error>0)
+          free(new_partition);
+      }
+      if(verbose>0)
+        log_warning("This partition ends after the disk limits. (start=%llu, size=%llu, end=%llu, disk end=%llu)\n",
+            (unsigned long long)(partition->part_offset/disk_car->sector_size),
+            (unsigned long long)(partition->part_size/disk_car->sector_size),
+            (unsigned long long)(pos_fin/disk_car->sector_size),
+            (unsigned long long)(disk_car->disk_size/disk_car->sector_size));
+      else
+        log_warning("This partition ends after the disk limits.\n");
+    }
+  }
+  else
+  {
+    if(verbose>0)
+    {
+      log_warning("Partition not added.\n");
+    }
+  }
+  return 0;
+}
+
+/* Locations examined by the last search_part(), for benchmarks */
+static uint64_t search_part_nbr_locations=0;
+
+/* Progress published by the probe loop, read by the display ticks and
+ * by the other threads of a program using the API */
+static struct
+{
+  volatile uint64_t location;
+  volatile uint64_t location_max;
+  volatile int running;
+  volatile int stop;
+} search_part_state;
+
+/* The display is updated every SEARCH_PART_TICK ns, the clock is read
+ * every SEARCH_PART_TICK_PROBES probes */
+#define SEARCH_PART_TICK	100000000ULL
+#define SEARCH_PART_TICK_PROBES	16
+
+/**
+ * @brief Returns the number of locations examined by the last search_part()
+ *
+ * The locations in regions replayed from the analyse cache are counted too.
+ */
+uint64_t search_part_locations(void)
+{
+  return search_part_nbr_locations;
+}
+
+/**
+ * @brief Reads the progress of the running search_part()
+ * @param location Set to the location being probed
+ * @param location_max Set to the end of the search
+ * @return 1 while a search is running, 0 otherwise
+ *
+ * Can be called from another thread, the values may be a little behind.
+ */
+int search_part_progress(uint64_t *location, uint64_t *location_max)
+{
+  *location=search_part_state.location;
+  *location_max=search_part_state.location_max;
+  return search_part_state.running;
+}
+
+/**
+ * @brief Asks the running search_part() to stop
+ *
+ * Can be called from another thread or a signal handler. The search
+ * stops at the next location and keeps the partitions already found,
+ * as when the user stops it.
+ */
+void search_part_stop(void)
+{
+  search_part_state.stop=1;
+}
+
+#ifdef HAVE_NCURSES
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void search_part_display(const disk_t *disk_car, const uint64_t search_location)
+{
+  CHS_t start;
+  offset2CHS_inline(disk_car, search_location, &start);
+  wmove(stdscr,ANALYSE_Y,ANALYSE_X);
+  wclrtoeol(stdscr);
+  if(disk_car->geom.heads_per_cylinder>1)
+    wprintw(stdscr, "Analyse cylinder %5lu/%lu: %02u%%",
+	start.cylinder, disk_car->geom.cylinders-1,
+	(unsigned int)(search_location*100/disk_car->disk_size));
+  else
+    wprintw(stdscr,"Analyse sector %11llu/%llu: %02u%%",
+	(long long unsigned)(search_location / disk_car->sector_size),
+	(long long unsigned)((disk_car->disk_size-1)/disk_car->sector_size),
+	(unsigned int)(search_location*100/disk_car->disk_size));
+  wrefresh(stdscr);
+}
+#endif
+
 list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, const int verbose, const int dump_ind, const int fast_mode, char **current_cmd)
 {
   unsigned char *buffer_disk;
   unsigned char *buffer_disk0;
-  /* TODO use circular buffer for try_offset and try_offset_raid */
-  uint64_t try_offset[MAX_SEARCH_LOCATION];
-  uint64_t try_offset_raid[MAX_SEARCH_LOCATION];
+  hint_list_t try_offset;
+  hint_list_t try_offset_raid;
   const uint64_t min_location=get_min_location(disk_car);
   uint64_t search_location;
-  unsigned int try_offset_nbr=0;
-  unsigned int try_offset_raid_nbr=0;
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t prefetch_end=0;
+#endif
 #ifdef HAVE_NCURSES
-  unsigned int old_cylinder=0;
+  uint64_t next_tick=0;
+  unsigned int tick_probes=SEARCH_PART_TICK_PROBES-1;
 #endif
   const unsigned int location_boundary=get_location_boundary(disk_car);
   indstop_t ind_stop=INDSTOP_CONTINUE;
   list_part_t *list_part=NULL;
   list_part_t *list_part_bad=NULL;
   partition_t *partition;
+  analyse_cache_t *cache=NULL;
+  /* Every location before cache_start has been probed since the last interruption */
+  uint64_t cache_start=0;
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int cache_probes=0;
+  time_t cache_next_save;
+#endif
   /* It's not a problem to read a little bit more than necessary */
   const uint64_t search_location_max=td_max((disk_car->disk_size /
       ((uint64_t) disk_car->geom.heads_per_cylinder * disk_car->geom.sectors_per_head * disk_car->sector_size) + 1 ) *
@@ -779,12 +1174,16 @@ list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, con
   partition=partition_new(disk_car->arch);
   buffer_disk=(unsigned char*)MALLOC(16*DEFAULT_SECTOR_SIZE);
   buffer_disk0=(unsigned char*)MALLOC(16*DEFAULT_SECTOR_SIZE);
+  try_offset.first=0;
+  try_offset.nbr=0;
+  try_offset_raid.first=0;
+  try_offset_raid.nbr=0;
   {
     /* Will search for partition at current known partition location */
     const list_part_t *element;
     for(element=list_part_org;element!=NULL;element=element->next)
     {
-      hint_insert(try_offset, element->part->part_offset, &try_offset_nbr);
+      hint_insert(&try_offset, element->part->part_offset);
     }
   }
 
@@ -798,60 +1197,72 @@ list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, con
   log_info("\nsearch_part()\n");
   log_info("%s\n",disk_car->description(disk_car));
   search_location=min_location;
-  search_add_hints(disk_car, try_offset, &try_offset_nbr);
+  search_add_hints(disk_car, &try_offset);
+#ifndef DISABLED_FOR_FRAMAC
+  cache=analyse_cache_get(disk_car, location_boundary, fast_mode);
+  {
+    unsigned int i;
+    for(i=0; i<try_offset.nbr; i++)
+      analyse_cache_add_hint(cache, hint_get(&try_offset, i));
+  }
+  cache_next_save=time(NULL)+30;
+#endif
   /* Not every sector will be examined */
   search_location_init(disk_car, location_boundary, fast_mode);
+  search_part_nbr_locations=0;
+  search_part_state.location=search_location;
+  search_part_state.location_max=search_location_max;
+  search_part_state.stop=0;
+  search_part_state.running=1;
   /* Scan the disk */
   while(ind_stop!=INDSTOP_QUIT && search_location < search_location_max)
   {
     CHS_t start;
-    int ask=0;
+    const int region_done=analyse_cache_is_done(cache, search_location);
+    search_part_nbr_locations++;
     offset2CHS_inline(disk_car,search_location,&start);
+    search_part_state.location=search_location;
+    if(search_part_state.stop!=0 && ind_stop==INDSTOP_CONTINUE)
+      ind_stop=INDSTOP_STOP;
 #ifdef HAVE_NCURSES
-    if(disk_car->geom.heads_per_cylinder>1)
+    /* Neither the display nor the keyboard is polled for each probe */
+    if(++tick_probes >= SEARCH_PART_TICK_PROBES)
     {
-      if(old_cylinder!=start.cylinder)
+      const uint64_t now=disk_stats_clock();
+      tick_probes=0;
+      if(now >= next_tick)
       {
-	old_cylinder=start.cylinder;
-	wmove(stdscr,ANALYSE_Y,ANALYSE_X);
-	wclrtoeol(stdscr);
-	wprintw(stdscr, "Analyse cylinder %5lu/%lu: %02u%%",
-	    start.cylinder, disk_car->geom.cylinders-1,
-	    (unsigned int)(search_location*100/disk_car->disk_size));
-	ask=1;
+	next_tick=now + SEARCH_PART_TICK;
+	search_part_display(disk_car, search_location);
+	switch(check_enter_key_or_s(stdscr))
+	{
+	  case 1:
+	    if(ask_confirmation("Stop searching for more partitions ? (Y/N)")!=0)
+	      ind_stop=INDSTOP_STOP;
+	    else
+	    {
+	      screen_buffer_to_interface();
+	    }
+	    break;
+	  case 2:
+	    ind_stop=INDSTOP_SKIP;
+	    break;
+	  case 3:
+	    ind_stop=INDSTOP_PLUS;
+	    break;
+	}
       }
     }
-    else if((start.cylinder & 0x7FFF)==0)
-    {
-      wmove(stdscr,ANALYSE_Y,ANALYSE_X);
-      wclrtoeol(stdscr);
-      wprintw(stdscr,"Analyse sector %11llu/%llu: %02u%%",
-	  (long long unsigned)(search_location / disk_car->sector_size),
-	  (long long unsigned)((disk_car->disk_size-1)/disk_car->sector_size),
-	    (unsigned int)(search_location*100/disk_car->disk_size));
-      wrefresh(stdscr);
-      ask=1;
-    }
-    if(ask!=0)
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+    /* Deeper search probes several locations per MiB, read the disk by
+     * large chunks instead of seeking for each probe */
+    if(fast_mode>0 && search_location >= prefetch_end && region_done==0)
     {
-      wrefresh(stdscr);
-      switch(check_enter_key_or_s(stdscr))
-      {
-	case 1:
-	  if(ask_confirmation("Stop searching for more partitions ? (Y/N)")!=0)
-	    ind_stop=INDSTOP_STOP;
-	  else
-	  {
-	    screen_buffer_to_interface();
-	  }
-	  break;
-	case 2:
-	  ind_stop=INDSTOP_SKIP;
-	  break;
-	case 3:
-	  ind_stop=INDSTOP_PLUS;
-	  break;
-      }
+      const uint64_t prefetch_start=search_location / SEARCH_PREFETCH_SIZE * SEARCH_PREFETCH_SIZE;
+      diskcache_prefetch(disk_car, prefetch_start, SEARCH_PREFETCH_SIZE);
+      prefetch_end=prefetch_start + SEARCH_PREFETCH_SIZE;
+      disk_advise(disk_car, prefetch_end, SEARCH_PREFETCH_SIZE, TESTDISK_ADVISE_WILLNEED);
     }
 #endif
     {
@@ -859,15 +1270,7 @@ list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, con
       int test_nbr=0;
       int search_now=0;
       int search_now_raid=0;
-      while(try_offset_nbr>0 && try_offset[0]<=search_location)
-      {
-        unsigned int j;
-        if(try_offset[0]==search_location)
-          search_now=1;
-        for(j=0;j<try_offset_nbr-1;j++)
-          try_offset[j]=try_offset[j+1];
-        try_offset_nbr--;
-      }
+      search_now=hint_skip(&try_offset, search_location);
       /* PC x/0/1 x/1/1 x/2/1 */
       /* PC Vista 2048 sectors unit */
       if(disk_car->arch==&arch_i386)
@@ -876,16 +1279,27 @@ list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, con
           search_location%(2048*512)==0;
       else
         search_now|= (search_location%location_boundary==0);
-      while(try_offset_raid_nbr>0 && try_offset_raid[0]<=search_location)
+      search_now_raid=hint_skip(&try_offset_raid, search_location);
+      if(region_done!=0)
       {
-        unsigned int j;
-        if(try_offset_raid[0]==search_location)
-          search_now_raid=1;
-        for(j=0;j<try_offset_raid_nbr-1;j++)
-          try_offset_raid[j]=try_offset_raid[j+1];
-        try_offset_raid_nbr--;
+	if(analyse_cache_is_new_hint(cache, search_location))
+	  analyse_cache_reprobe(cache, search_location);
+	else
+	{
+	  /* Already probed, replay the partitions found */
+	  unsigned int first;
+	  unsigned int i;
+	  const unsigned int nbr=analyse_cache_find(cache, search_location, &first);
+	  for(i=0; i<nbr && sector_inc==0; i++)
+	  {
+	    dup_partition_t(partition, analyse_cache_part(cache, first+i));
+	    sector_inc=search_part_found(disk_car, partition, &list_part, &list_part_bad, &try_offset, &try_offset_raid, &search_location, min_location, search_location_max, ind_stop, fast_mode, verbose);
+	    partition_reset(partition, disk_car->arch);
+	  }
+	  sector_inc=1;
+	}
       }
-      do
+      while(sector_inc==0)
       {
         int res=0;
         partition->part_size=(uint64_t)0;
@@ -1065,131 +1479,80 @@ list_part_t *search_part(disk_t *disk_car, const list_part_t *list_part_org, con
 	  wclrtoeol(stdscr);
 	  wprintw(stdscr, "Read error at %lu/%u/%u (lba=%lu)\n", start.cylinder,start.head,start.sector,(unsigned long)(partition->part_offset/disk_car->sector_size));
 #endif
+	  analyse_cache_set_done(cache, cache_start, search_location);
+	  cache_start=search_location+1;
 	  /* Stop reading after the end of the disk */
 	  if(search_location >= disk_car->disk_real_size)
 	    search_location = search_location_max;
         }
         else if(res>0)
         {
-          partition->status=STATUS_DELETED;
-          log_partition(disk_car,partition);
-          aff_part_buffer(AFF_PART_BASE, disk_car,partition);
-#ifdef HAVE_NCURSES
-	  screen_buffer_to_interface();
-#endif
-          if(disk_car->arch->is_part_known(partition)!=0 &&
-              partition->part_size>1 &&
-              partition->part_offset>=min_location)
+          analyse_cache_add_part(cache, search_location, partition);
+          if(search_part_found(disk_car, partition, &list_part, &list_part_bad, &try_offset, &try_offset_raid, &search_location, min_location, search_location_max, ind_stop, fast_mode, verbose))
           {
-            const uint64_t pos_fin=partition->part_offset+partition->part_size-1;
-            if(partition->upart_type!=UP_MD && partition->upart_type!=UP_MD1 &&
-	      ind_stop==INDSTOP_CONTINUE)
-            { /* Detect Linux md 0.9 software raid */
-              unsigned int disk_factor;
-              for(disk_factor=6; disk_factor>=1;disk_factor--)
-              { /* disk_factor=1, detect Raid 0/1 */
-                /* disk_factor>1, detect Raid 5 */
-		unsigned int help_factor;
-                for(help_factor=0; help_factor<=MD_MAX_CHUNK_SIZE/MD_RESERVED_BYTES+3; help_factor++)
-                {
-                  const uint64_t offset=(uint64_t)MD_NEW_SIZE_SECTORS((partition->part_size/disk_factor+help_factor*MD_RESERVED_BYTES-1)/MD_RESERVED_BYTES*MD_RESERVED_BYTES/512)*512;
-                  hint_insert(try_offset_raid, partition->part_offset+offset, &try_offset_raid_nbr);
-                }
-              }
-              /* TODO: Detect Linux md 1.0 software raid */
-            }
-            /* */
-            if(pos_fin <= search_location_max)
-            {
-              {
-                int insert_error=0;
-                partition_t *new_partition=partition_new(NULL);
-                dup_partition_t(new_partition,partition);
-                list_part=insert_new_partition(list_part, new_partition, 0, &insert_error);
-                if(insert_error>0)
-                  free(new_partition);
-              }
-              {
-                const uint64_t next_part_offset=partition->part_offset+partition->part_size-1+1;
-                const uint64_t head_size=(uint64_t)disk_car->geom.sectors_per_head * disk_car->sector_size;
-                hint_insert(try_offset, next_part_offset, &try_offset_nbr);
-                hint_insert(try_offset, next_part_offset+head_size, &try_offset_nbr);
-                if(next_part_offset%head_size!=0)
-                {
-                  hint_insert(try_offset, (next_part_offset+head_size-1)/head_size*head_size, &try_offset_nbr);
-                  hint_insert(try_offset, (next_part_offset+head_size-1)/head_size*head_size+head_size, &try_offset_nbr);
-                }
-              }
-              if((fast_mode==0) && (partition->part_offset+partition->part_size-disk_car->sector_size > search_location))
-              {
-                search_location=partition->part_offset+partition->part_size-disk_car->sector_size;
-                test_nbr=0;
-                sector_inc=1;
-              }
-            }
-            else
-            {
-              {
-                int insert_error=0;
-                partition_t *new_partition=partition_new(NULL);
-                dup_partition_t(new_partition,partition);
-                list_part_bad=insert_new_partition(list_part_bad, new_partition, 0, &insert_error);
-                if(insert_error>0)
-                  free(new_partition);
-              }
-              if(verbose>0)
-                log_warning("This partition ends after the disk limits. (start=%llu, size=%llu, end=%llu, disk end=%llu)\n",
-                    (unsigned long long)(partition->part_offset/disk_car->sector_size),
-                    (unsigned long long)(partition->part_size/disk_car->sector_size),
-                    (unsigned long long)(pos_fin/disk_car->sector_size),
-                    (unsigned long long)(disk_car->disk_size/disk_car->sector_size));
-              else
-                log_warning("This partition ends after the disk limits.\n");
-            }
-          }
-          else
-          {
-            if(verbose>0)
-            {
-              log_warning("Partition not added.\n");
-            }
+            test_nbr=0;
+            sector_inc=1;
           }
           partition_reset(partition, disk_car->arch);
         }
       }
-      while(sector_inc==0);
     }
     if(ind_stop==INDSTOP_SKIP)
     {
       ind_stop=INDSTOP_CONTINUE;
-      if(try_offset_nbr>0 && search_location < try_offset[0])
-	search_location=try_offset[0];
+      if(try_offset.nbr>0 && search_location < hint_get(&try_offset, 0))
+      {
+	analyse_cache_set_done(cache, cache_start, search_location+disk_car->sector_size);
+	search_location=hint_get(&try_offset, 0);
+	cache_start=search_location;
+      }
     }
     else if(ind_stop==INDSTOP_PLUS)
     {
       ind_stop=INDSTOP_CONTINUE;
+      analyse_cache_set_done(cache, cache_start, search_location+disk_car->sector_size);
       search_location += search_location_max / 20 / (1024 * 1024) * (1024 * 1014);
+      cache_start=search_location;
     }
     else if(ind_stop==INDSTOP_STOP)
     {
-      if(try_offset_nbr>0 && search_location < try_offset[0])
-	search_location=try_offset[0];
+      if(try_offset.nbr>0 && search_location < hint_get(&try_offset, 0))
+      {
+	analyse_cache_set_done(cache, cache_start, search_location+disk_car->sector_size);
+	search_location=hint_get(&try_offset, 0);
+	cache_start=search_location;
+      }
       else
 	ind_stop=INDSTOP_QUIT;
     }
     else
     { /* Optimized "search_location+=disk_car->sector_size;" */
       uint64_t min=search_location_update(search_location);
-      if(try_offset_nbr>0 && min>try_offset[0])
-        min=try_offset[0];
-      if(try_offset_raid_nbr>0 && min>try_offset_raid[0])
-        min=try_offset_raid[0];
+      if(try_offset.nbr>0 && min>hint_get(&try_offset, 0))
+        min=hint_get(&try_offset, 0);
+      if(try_offset_raid.nbr>0 && min>hint_get(&try_offset_raid, 0))
+        min=hint_get(&try_offset_raid, 0);
       if(min==(uint64_t)-1 || min<=search_location)
         search_location+=disk_car->sector_size;
       else
         search_location=min;
     }
+#ifndef DISABLED_FOR_FRAMAC
+    /* Save the progress from time to time, a crash doesn't lose it */
+    if((++cache_probes & 0xffff)==0 && time(NULL) >= cache_next_save)
+    {
+      analyse_cache_set_done(cache, cache_start, search_location);
+      analyse_cache_save(cache);
+      cache_next_save=time(NULL)+30;
+    }
+#endif
   }
+  search_part_state.running=0;
+  analyse_cache_set_done(cache, cache_start, search_location+disk_car->sector_size);
+  analyse_cache_save(cache);
+  /* Backup boot sectors of the partitions of the current partition table */
+  if(fast_mode>0 && ind_stop!=INDSTOP_QUIT)
+    list_part=search_backup_sectors(disk_car, list_part_org, list_part, verbose, dump_ind, min_location, search_location_max);
   /* Search for NTFS partition near the supposed partition beginning
      given by the NTFS backup boot sector */
   if(fast_mode>0)
@@ -1897,6 +2260,8 @@ int interface_recovery(disk_t *disk_car, const list_part_t *list_part_org, const
     align_structure(list_part, disk_car, align);
 
     disk_car->arch->init_structure(disk_car,list_part,verbose);
+    /* Rank the candidates by a quick check of their metadata */
+    partition_score_list(disk_car, list_part);
     if(verbose>0)
     {
 #ifdef TARGET_LINUX
@@ -41,6 +41,24 @@ int interface_recovery(disk_t *disk_car, const list_part_t *list_part_org, const
   @*/
 void only_one_bootable( list_part_t *list_part, const list_part_t *part_boot);
 
+/* Number of locations examined by the last search_part() */
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t search_part_locations(void);
+
+/* Progress of the running search_part(), can be called from another
+ * thread. Return 1 while a search is running */
+/*@
+  @ requires \valid(location);
+  @ requires \valid(location_max);
+  @*/
+int search_part_progress(uint64_t *location, uint64_t *location_max);
+
+/* Ask the running search_part() to stop, can be called from another
+ * thread or a signal handler */
+void search_part_stop(void);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -29,6 +29,8 @@
 #undef HAVE_LIBEWF
 #undef HAVE_LINUX_HDREG_H
 #undef HAVE_LINUX_TYPES_H
+#undef HAVE_MMAP
+#undef HAVE_POSIX_FADVISE
 #undef HAVE_PREAD
 #undef HAVE_PWRITE
 #undef HAVE_SCSI_SCSI_H
@@ -37,6 +39,7 @@
 #undef HAVE_SYS_MOUNT_H
 #undef HAVE_SYS_PARAM_H
 #undef HAVE_SYS_SYSMACROS_H
+#undef HAVE_PTHREAD
 #endif
  
 #ifdef HAVE_SYS_STAT_H
@@ -112,6 +115,12 @@
 #ifdef HAVE_LIBGEN_H
 #include <libgen.h>
 #endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#if defined(TARGET_LINUX) && defined(HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 
 #if defined(__CYGWIN__) || defined(__MINGW32__)
 #include "win32.h"
@@ -129,12 +138,32 @@
 #if defined(__FRAMAC__)
 #include "__fc_builtin.h"
 #endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(__CYGWIN__) && !defined(__MINGW32__)
+#include <sys/mman.h>
+#else
+#undef HAVE_MMAP
+#endif
 #include "fnctdsk.h"
 #include "ewf.h"
+#include "qcow2.h"
+#include "vdisk.h"
+#include "vdi.h"
+#include "vhdx.h"
+#include "vmdk.h"
+#include "mdvol.h"
+#include "splitimg.h"
+#include "usbms.h"
+#include "nbd.h"
+#include "luksvol.h"
+#include "nandvol.h"
+#include "overlay.h"
+#include "hdpipe.h"
 #include "log.h"
 #include "hdaccess.h"
+#include "hdstats.h"
 #include "alignio.h"
 #include "hpa_dco.h"
+#include "pprobe.h"
 
 #if defined(HAVE_PREAD) && defined(TARGET_LINUX)
 //#define HDCLONE 1
@@ -166,6 +195,16 @@ struct tdewf_file_header
 } __attribute__ ((gcc_struct, __packed__));
 
 
+/* Sequential reads keep FILE_READAHEAD_NBR chunks of read-ahead queued */
+#define FILE_READAHEAD_NBR	8
+#define FILE_READAHEAD_CHUNK	(1024*1024)
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED) && !defined(__CYGWIN__) && !defined(__MINGW32__)
+#define FILE_READAHEAD_HINT 1
+#elif defined(__APPLE__) && defined(F_RDADVISE)
+#define FILE_READAHEAD_HINT 1
+#endif
+/* #define DEBUG_READAHEAD */
+
 struct info_file_struct
 {
   int handle;
@@ -174,8 +213,29 @@ struct info_file_struct
 #endif
   char file_name[DISKNAME_MAX];
   int mode;
+  unsigned int readahead_size;
+  uint64_t readahead_last;
+  uint64_t readahead_end;
+#ifdef HAVE_MMAP
+  unsigned char *map;
+  uint64_t map_size;
+#endif
+#if !defined(DISABLED_FOR_FRAMAC)
+  disk_stats_t *stats;
+#endif
+  /* FILE_PASSTHROUGH_SCSI or FILE_PASSTHROUGH_NVME: the reads are sent
+   * to the device with a timeout and without retries */
+  int passthrough;
+  unsigned int passthrough_max;
+  unsigned int nsid;
 };
 
+#define FILE_PASSTHROUGH_NONE	0
+#define FILE_PASSTHROUGH_SCSI	1
+#define FILE_PASSTHROUGH_NVME	2
+/* Largest passthrough request when the device limit is unknown */
+#define FILE_PASSTHROUGH_MAX	(128*1024)
+
 struct dosemu_image_header {
   char sig[7];          /* always set to "DOSEMU", null-terminated or to "\x0eDEXE" */
   uint32_t heads;
@@ -242,7 +302,7 @@ static list_disk_t *insert_new_disk_nodup(list_disk_t *list_disk, disk_t *disk_c
 }
 #endif
 
-#if defined(HAVE_GLOB_H)
+#if defined(HAVE_GLOB_H) && !defined(TARGET_LINUX)
 /*@
   @ requires valid_read_string(device_pattern);
   @ requires \valid(list_disk);
@@ -266,6 +326,227 @@ static list_disk_t *hd_glob_parse(const char *device_pattern, list_disk_t *list_
 }
 #endif
 
+#if defined(TARGET_LINUX) && !defined(DISABLED_FOR_FRAMAC)
+/* The devices are probed by up to HD_PROBE_THREADS threads; a probe that
+ * hasn't returned after HD_PROBE_TIMEOUT seconds, ie. a failing disk
+ * waiting for its command timeouts, is abandoned and the device skipped.
+ * The disks are inserted in the order of the device names. */
+#define HD_PROBE_THREADS	16
+#define HD_PROBE_TIMEOUT	30
+
+typedef enum { HD_PROBE_WAITING=0, HD_PROBE_RUNNING, HD_PROBE_DONE, HD_PROBE_ABANDONED } hd_probe_status_t;
+
+struct hd_probe_struct
+{
+  char **device;
+  disk_t **disk;
+  hd_probe_status_t *status;
+  time_t *start;
+  unsigned int nbr;
+  unsigned int size;
+  unsigned int next;
+  int verbose;
+  int testdisk_mode;
+#ifdef HAVE_PTHREAD
+  unsigned int refs;
+  unsigned int active;		/* Threads not waiting for an abandoned device */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+};
+typedef struct hd_probe_struct hd_probe_t;
+
+static void hd_probe_add(hd_probe_t *probe, const char *device)
+{
+  char *name;
+  if(access(device, F_OK)!=0)
+    return ;
+  name=strdup(device);
+  if(name==NULL)
+    return ;
+  if(probe->nbr==probe->size)
+  {
+    const unsigned int size=(probe->size==0 ? 64 : 2*probe->size);
+    char **tmp=(char **)realloc(probe->device, size * sizeof(char *));
+    if(tmp==NULL)
+    {
+      free(name);
+      return ;
+    }
+    probe->device=tmp;
+    probe->size=size;
+  }
+  probe->device[probe->nbr++]=name;
+}
+
+#if defined(HAVE_GLOB_H)
+static void hd_glob_probe(const char *device_pattern, hd_probe_t *probe)
+{
+  glob_t globbuf;
+  unsigned int i;
+  globbuf.gl_offs = 0;
+  glob(device_pattern, GLOB_DOOFFS, NULL, &globbuf);
+  for (i=0; i<globbuf.gl_pathc; i++)
+    hd_probe_add(probe, globbuf.gl_pathv[i]);
+  globfree(&globbuf);
+}
+#endif
+
+static void hd_probe_free(hd_probe_t *probe)
+{
+  unsigned int i;
+  for(i=0; i<probe->nbr; i++)
+    free(probe->device[i]);
+  free(probe->device);
+  free(probe->disk);
+  free(probe->status);
+  free(probe->start);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&probe->mutex);
+  pthread_cond_destroy(&probe->cond);
+#endif
+  free(probe);
+}
+
+#ifdef HAVE_PTHREAD
+/* The last of hd_probe_run() and the probe threads frees the probe */
+static void hd_probe_release(hd_probe_t *probe)
+{
+  unsigned int refs;
+  pthread_mutex_lock(&probe->mutex);
+  refs=--probe->refs;
+  pthread_mutex_unlock(&probe->mutex);
+  if(refs==0)
+    hd_probe_free(probe);
+}
+
+static void *hd_probe_thread(void *arg)
+{
+  hd_probe_t *probe=(hd_probe_t *)arg;
+  pthread_mutex_lock(&probe->mutex);
+  while(probe->next < probe->nbr)
+  {
+    const unsigned int i=probe->next++;
+    disk_t *disk;
+    probe->status[i]=HD_PROBE_RUNNING;
+    probe->start[i]=time(NULL);
+    pthread_mutex_unlock(&probe->mutex);
+    disk=file_test_availability(probe->device[i], probe->verbose, probe->testdisk_mode);
+    pthread_mutex_lock(&probe->mutex);
+    if(probe->status[i]==HD_PROBE_ABANDONED)
+    {
+      /* hd_probe_run() has already returned or started another thread */
+      pthread_mutex_unlock(&probe->mutex);
+      if(disk!=NULL)
+	disk->clean(disk);
+      hd_probe_release(probe);
+      return NULL;
+    }
+    probe->disk[i]=disk;
+    probe->status[i]=HD_PROBE_DONE;
+    pthread_cond_broadcast(&probe->cond);
+  }
+  probe->active--;
+  pthread_cond_broadcast(&probe->cond);
+  pthread_mutex_unlock(&probe->mutex);
+  hd_probe_release(probe);
+  return NULL;
+}
+
+/* Start a detached probe thread, returns 0 on failure */
+static int hd_probe_start_thread(hd_probe_t *probe)
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int res;
+  if(pthread_attr_init(&attr)!=0)
+    return 0;
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  probe->refs++;
+  probe->active++;
+  res=pthread_create(&thread, &attr, &hd_probe_thread, probe);
+  pthread_attr_destroy(&attr);
+  if(res!=0)
+  {
+    probe->refs--;
+    probe->active--;
+    return 0;
+  }
+  return 1;
+}
+#endif
+
+static list_disk_t *hd_probe_run(hd_probe_t *probe, list_disk_t *list_disk)
+{
+  unsigned int i;
+  if(probe->nbr > 0)
+  {
+    probe->disk=(disk_t **)MALLOC(probe->nbr * sizeof(disk_t *));
+    probe->status=(hd_probe_status_t *)MALLOC(probe->nbr * sizeof(hd_probe_status_t));
+    probe->start=(time_t *)MALLOC(probe->nbr * sizeof(time_t));
+    for(i=0; i<probe->nbr; i++)
+    {
+      probe->disk[i]=NULL;
+      probe->status[i]=HD_PROBE_WAITING;
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&probe->mutex, NULL);
+  pthread_cond_init(&probe->cond, NULL);
+  probe->refs=1;
+  pthread_mutex_lock(&probe->mutex);
+  for(i=0; i<HD_PROBE_THREADS && i<probe->nbr; i++)
+    hd_probe_start_thread(probe);
+  while(probe->active > 0)
+  {
+    struct timespec ts;
+    const time_t now=time(NULL);
+    for(i=0; i<probe->nbr; i++)
+    {
+      if(probe->status[i]==HD_PROBE_RUNNING && now - probe->start[i] >= HD_PROBE_TIMEOUT)
+      {
+	log_warning("%s hasn't answered in %u seconds, skipped\n",
+	    probe->device[i], HD_PROBE_TIMEOUT);
+	probe->status[i]=HD_PROBE_ABANDONED;
+	/* Replace the thread waiting for this device */
+	probe->active--;
+	if(probe->next < probe->nbr)
+	  hd_probe_start_thread(probe);
+      }
+    }
+    if(probe->active==0)
+      break;
+    ts.tv_sec=now + 1;
+    ts.tv_nsec=0;
+    pthread_cond_timedwait(&probe->cond, &probe->mutex, &ts);
+  }
+  /* Probe the remaining devices here if the threads can't be started */
+  while(probe->next < probe->nbr)
+  {
+    const unsigned int n=probe->next++;
+    probe->status[n]=HD_PROBE_RUNNING;
+    pthread_mutex_unlock(&probe->mutex);
+    probe->disk[n]=file_test_availability(probe->device[n], probe->verbose, probe->testdisk_mode);
+    pthread_mutex_lock(&probe->mutex);
+    probe->status[n]=HD_PROBE_DONE;
+  }
+  for(i=0; i<probe->nbr; i++)
+  {
+    if(probe->status[i]==HD_PROBE_DONE)
+      list_disk=insert_new_disk(list_disk, probe->disk[i]);
+    else
+      probe->status[i]=HD_PROBE_ABANDONED;
+  }
+  pthread_mutex_unlock(&probe->mutex);
+  hd_probe_release(probe);
+#else
+  for(i=0; i<probe->nbr; i++)
+    list_disk=insert_new_disk(list_disk, file_test_availability(probe->device[i], probe->verbose, probe->testdisk_mode));
+  hd_probe_free(probe);
+#endif
+  return list_disk;
+}
+#endif
 
 list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testdisk_mode)
 {
@@ -307,17 +588,12 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
 #elif defined(__APPLE__)
   {
     char device[100];
-    /* Disk */
+    /* Disk, file_test_availability() opens /dev/rdiskN when allowed */
     for(i=0;i<20;i++)
     {
       snprintf(device, sizeof(device), "/dev/disk%u", i);
       list_disk=insert_new_disk(list_disk, file_test_availability(device, verbose, testdisk_mode));
     }
-    for(i=0;i<20;i++)
-    {
-      snprintf(device, sizeof(device), "/dev/rdisk%u", i);
-      list_disk=insert_new_disk(list_disk, file_test_availability(device, verbose, testdisk_mode));
-    }
   }
 #elif defined(DISABLED_FOR_FRAMAC)
 #elif defined(TARGET_LINUX)
@@ -330,6 +606,10 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     char device_p_ide[]="/dev/pda";
     char device_i2o_hd[]="/dev/i2o/hda";
     char device_mmc[]="/dev/mmcblk0";
+    hd_probe_t *probe=(hd_probe_t *)MALLOC(sizeof(*probe));
+    memset(probe, 0, sizeof(*probe));
+    probe->verbose=verbose;
+    probe->testdisk_mode=testdisk_mode;
     /* Disk IDE */
     /*@
       @ loop invariant valid_list_disk(list_disk);
@@ -339,7 +619,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<8;i++)
     {
       device_ide[strlen(device_ide)-1]='a'+i;
-      list_disk=insert_new_disk(list_disk, file_test_availability(device_ide, verbose, testdisk_mode));
+      hd_probe_add(probe, device_ide);
     }
     /* Device RAID Compaq */
     /*@
@@ -358,7 +638,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
       for(i=0;i<8;i++)
       {
 	device_ida[strlen(device_ida)-1]='0'+i;
-	list_disk=insert_new_disk(list_disk, file_test_availability(device_ida, verbose, testdisk_mode));
+	hd_probe_add(probe, device_ida);
       }
     }
     /*@
@@ -369,7 +649,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<8;i++)
     {
       device_cciss[strlen(device_cciss)-1]='0'+i;
-      list_disk=insert_new_disk(list_disk, file_test_availability(device_cciss, verbose, testdisk_mode));
+      hd_probe_add(probe, device_cciss);
     }
     /* Device RAID */
     /*@
@@ -380,7 +660,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<10;i++)
     {
       snprintf(device,sizeof(device),"/dev/rd/c0d%u",i);
-      list_disk=insert_new_disk(list_disk, file_test_availability(device, verbose, testdisk_mode));
+      hd_probe_add(probe, device);
     }
     /* Device RAID IDE */
     /*@
@@ -391,7 +671,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<15;i++)
     {
       snprintf(device,sizeof(device),"/dev/ataraid/d%u",i);
-      list_disk=insert_new_disk(list_disk, file_test_availability(device, verbose, testdisk_mode));
+      hd_probe_add(probe, device);
     }
     /* Parallel port IDE disk */
     /*@
@@ -402,7 +682,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<4;i++)
     {
       device_p_ide[strlen(device_p_ide)-1]='a'+i;
-      list_disk=insert_new_disk(list_disk, file_test_availability(device_p_ide, verbose, testdisk_mode));
+      hd_probe_add(probe, device_p_ide);
     }
     /* I2O hard disk */
     /*@
@@ -413,7 +693,7 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<26;i++)
     {
       device_i2o_hd[strlen(device_i2o_hd)-1]='a'+i;
-      list_disk=insert_new_disk(list_disk, file_test_availability(device_i2o_hd, verbose, testdisk_mode));
+      hd_probe_add(probe, device_i2o_hd);
     }
     /* Memory card */
     /*@
@@ -424,27 +704,28 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
     for(i=0;i<10;i++)
     {
       device_mmc[strlen(device_mmc)-1]='0'+i;
-      list_disk=insert_new_disk(list_disk, file_test_availability(device_mmc, verbose, testdisk_mode));
+      hd_probe_add(probe, device_mmc);
     }
 #if defined(HAVE_GLOB_H)
     /* Disk SCSI */
-    list_disk=hd_glob_parse("/dev/sd[a-z]", list_disk, verbose, testdisk_mode);
-    list_disk=hd_glob_parse("/dev/sd[a-z][a-z]", list_disk, verbose, testdisk_mode);
-    list_disk=hd_glob_parse("/dev/mapper/*", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/sd[a-z]", probe);
+    hd_glob_probe("/dev/sd[a-z][a-z]", probe);
+    hd_glob_probe("/dev/mapper/*", probe);
     /* Software Raid (partition level) */
-    list_disk=hd_glob_parse("/dev/md*", list_disk, verbose, testdisk_mode);
-    list_disk=hd_glob_parse("/dev/sr?", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/md*", probe);
+    hd_glob_probe("/dev/sr?", probe);
     /* Software (ATA)Raid configured (disk level) via dmraid */
-    list_disk=hd_glob_parse("/dev/dm-*", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/dm-*", probe);
     /* VirtIO block devices */
-    list_disk=hd_glob_parse("/dev/vd[a-z]", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/vd[a-z]", probe);
     /* Xen virtual disks */
-    list_disk=hd_glob_parse("/dev/xvd?", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/xvd?", probe);
     /* Loop devices */
-    list_disk=hd_glob_parse("/dev/loop[0-9]*", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/loop[0-9]*", probe);
     /* NVME */
-    list_disk=hd_glob_parse("/dev/nvme[0-9]n[0-9]", list_disk, verbose, testdisk_mode);
+    hd_glob_probe("/dev/nvme[0-9]n[0-9]", probe);
 #endif
+    list_disk=hd_probe_run(probe, list_disk);
   }
 #elif defined(TARGET_SOLARIS)
   {
@@ -1051,6 +1332,9 @@ static int read_device_sysfs_file (char *buf, const disk_t *disk_car, const char
 #ifdef HAVE_SCSI_SG_H
 #include <scsi/sg.h>
 #endif
+#ifdef HAVE_LINUX_NVME_IOCTL_H
+#include <linux/nvme_ioctl.h>
+#endif
 #endif
 
 #if defined(TARGET_LINUX) && defined(INQUIRY) && defined(SG_GET_VERSION_NUM)
@@ -1132,6 +1416,156 @@ static int scsi_query_product_info (const int sg_fd, char **vendor, char **produ
 }
 #endif
 
+/* Timeout of a passthrough read in ms, 0 to read through the block layer */
+static unsigned int file_passthrough_timeout=0;
+
+void file_set_passthrough(const unsigned int timeout_ms)
+{
+  file_passthrough_timeout=timeout_ms;
+}
+
+#if defined(TARGET_LINUX) && defined(SG_IO)
+/* The block layer retries a failed read several times, a bad sector can
+ * take minutes. A command sent with SG_IO or the NVMe passthrough is
+ * only tried once and is aborted after file_passthrough_timeout ms.
+ * SATA disks behind libata and USB bridges translate READ(16) to an ATA
+ * read. */
+static void file_passthrough_setup(struct info_file_struct *data, const char *device, const unsigned int sector_size)
+{
+  int k;
+#if defined(BLKSECTGET)
+  unsigned short max_sectors=0;
+#endif
+  data->passthrough=FILE_PASSTHROUGH_NONE;
+  if(file_passthrough_timeout==0)
+    return ;
+#if defined(HAVE_LINUX_NVME_IOCTL_H) && defined(NVME_IOCTL_ID) && defined(NVME_IOCTL_IO_CMD)
+  {
+    const int nsid=ioctl(data->handle, NVME_IOCTL_ID);
+    if(nsid > 0)
+    {
+      data->passthrough=FILE_PASSTHROUGH_NVME;
+      data->nsid=nsid;
+    }
+  }
+#endif
+  if(data->passthrough==FILE_PASSTHROUGH_NONE &&
+      ioctl(data->handle, SG_GET_VERSION_NUM, &k) >= 0 && k >= 30000)
+    data->passthrough=FILE_PASSTHROUGH_SCSI;
+  if(data->passthrough==FILE_PASSTHROUGH_NONE)
+  {
+    log_info("%s: no passthrough reads\n", device);
+    return ;
+  }
+  data->passthrough_max=FILE_PASSTHROUGH_MAX;
+#if defined(BLKSECTGET)
+  if(ioctl(data->handle, BLKSECTGET, &max_sectors) >= 0 && max_sectors > 0)
+    data->passthrough_max=(unsigned int)max_sectors * 512;
+#endif
+  data->passthrough_max=data->passthrough_max / sector_size * sector_size;
+  if(data->passthrough_max==0)
+    data->passthrough_max=sector_size;
+  log_info("%s: %s passthrough reads of up to %u KiB, %u ms timeout\n", device,
+      (data->passthrough==FILE_PASSTHROUGH_NVME ? "NVMe" : "SCSI"),
+      data->passthrough_max / 1024, file_passthrough_timeout);
+}
+
+/* Return 0 on success, -1 on a read error, -2 if the command isn't
+ * supported */
+static int file_passthrough_read(const struct info_file_struct *data, void *buf, const unsigned int count, const uint64_t offset, const unsigned int sector_size)
+{
+#if defined(HAVE_LINUX_NVME_IOCTL_H) && defined(NVME_IOCTL_IO_CMD)
+  if(data->passthrough==FILE_PASSTHROUGH_NVME)
+  {
+    struct nvme_passthru_cmd cmd;
+    const uint64_t lba=offset / sector_size;
+    int res;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode=0x02;	/* Read */
+    cmd.nsid=data->nsid;
+    cmd.addr=(uint64_t)(size_t)buf;
+    cmd.data_len=count;
+    cmd.cdw10=(uint32_t)lba;
+    cmd.cdw11=(uint32_t)(lba >> 32);
+    /* Limited Retry, number of blocks minus one */
+    cmd.cdw12=(1U << 31) | (count / sector_size - 1);
+    cmd.timeout_ms=file_passthrough_timeout;
+    res=ioctl(data->handle, NVME_IOCTL_IO_CMD, &cmd);
+    if(res < 0)
+      return (errno==ENOTTY || errno==EINVAL || errno==EPERM || errno==EACCES ? -2 : -1);
+    if(res > 0)
+    {
+      log_error("file_pread(%u,%lu) NVMe status 0x%x\n",
+	  count / sector_size, (long unsigned)lba, (unsigned)res);
+      return -1;
+    }
+    return 0;
+  }
+#endif
+  {
+    unsigned char cmd[16];
+    unsigned char sense_buffer[32];
+    sg_io_hdr_t io_hdr;
+    const uint64_t lba=offset / sector_size;
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0]=0x88;	/* READ(16) */
+    *(uint64_t *)&cmd[2]=be64(lba);
+    *(uint32_t *)&cmd[10]=be32(count / sector_size);
+    memset(&io_hdr, 0, sizeof(io_hdr));
+    io_hdr.interface_id='S';
+    io_hdr.cmd_len=sizeof(cmd);
+    io_hdr.mx_sb_len=sizeof(sense_buffer);
+    io_hdr.dxfer_direction=SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len=count;
+    io_hdr.dxferp=buf;
+    io_hdr.cmdp=cmd;
+    io_hdr.sbp=sense_buffer;
+    io_hdr.timeout=file_passthrough_timeout;
+    if(ioctl(data->handle, SG_IO, &io_hdr) < 0)
+      return (errno==ENOTTY || errno==EINVAL || errno==EPERM || errno==EACCES ? -2 : -1);
+    if((io_hdr.info & SG_INFO_OK_MASK)!=SG_INFO_OK || io_hdr.resid!=0)
+    {
+      /* Sense key, ASC and ASCQ of the fixed format sense data */
+      log_error("file_pread(%u,%lu) SCSI status 0x%x host 0x%x driver 0x%x sense %x/%02x/%02x\n",
+	  count / sector_size, (long unsigned)lba,
+	  io_hdr.status, io_hdr.host_status, io_hdr.driver_status,
+	  (io_hdr.sb_len_wr > 2 ? sense_buffer[2] & 0x0f : 0),
+	  (io_hdr.sb_len_wr > 12 ? sense_buffer[12] : 0),
+	  (io_hdr.sb_len_wr > 13 ? sense_buffer[13] : 0));
+      return -1;
+    }
+    return 0;
+  }
+}
+
+/* Read with passthrough commands, return -2 to go through the block layer */
+static int file_passthrough_pread(const disk_t *disk, void *buf, const unsigned int count, const uint64_t offset)
+{
+  struct info_file_struct *data=(struct info_file_struct *)disk->data;
+  unsigned int done;
+  if(offset % disk->sector_size != 0 || count % disk->sector_size != 0 ||
+      offset + count > disk->offset + disk->disk_real_size)
+    return -2;
+  for(done=0; done < count; done+=data->passthrough_max)
+  {
+    const unsigned int size=(count - done < data->passthrough_max ? count - done : data->passthrough_max);
+    const int res=file_passthrough_read(data, (unsigned char *)buf + done, size, offset + done, disk->sector_size);
+    if(res==-2)
+    {
+      log_warning("%s: passthrough read not supported: %s\n", data->file_name, strerror(errno));
+      data->passthrough=FILE_PASSTHROUGH_NONE;
+      return (done==0 ? -2 : (int)done);
+    }
+    if(res < 0)
+    {
+      memset((unsigned char *)buf + done, 0, count - done);
+      return (done==0 ? -1 : (int)done);
+    }
+  }
+  return count;
+}
+#endif
+
 #ifndef DJGPP
 /*@
   @ requires \valid(dev);
@@ -1406,9 +1840,20 @@ static void file_clean(disk_t *disk)
       close(data->handle_clone);
       data->handle_clone=0;
     }
+#endif
+#ifdef HAVE_MMAP
+    if(data->map!=NULL)
+    {
+      munmap(data->map, (size_t)data->map_size);
+      data->map=NULL;
+    }
 #endif
     close(data->handle);
     data->handle=0;
+#if !defined(DISABLED_FOR_FRAMAC)
+    disk_stats_free(data->stats);
+    data->stats=NULL;
+#endif
   }
   generic_clean(disk);
 }
@@ -1477,6 +1922,14 @@ static int file_pread_aux(const disk_t *disk, void *buf, const unsigned int coun
   }
   ret=read(fd, buf, count);
 #else
+#if defined(TARGET_LINUX) && defined(SG_IO)
+  if(((const struct info_file_struct *)disk->data)->passthrough!=FILE_PASSTHROUGH_NONE)
+  {
+    const int res=file_passthrough_pread(disk, buf, count, offset);
+    if(res!=-2)
+      return res;
+  }
+#endif
 #if defined(HAVE_PREAD)
   ret=pread(fd,buf,count,offset);
   if(ret<0 && errno == ENOSYS)
@@ -1534,6 +1987,67 @@ static int file_pread_aux(const disk_t *disk, void *buf, const unsigned int coun
   return ret;
 }
 
+#ifdef FILE_READAHEAD_HINT
+static unsigned int file_readahead_nbr=FILE_READAHEAD_NBR;
+#endif
+
+void file_set_readahead_depth(const unsigned int nbr)
+{
+#ifdef FILE_READAHEAD_HINT
+  file_readahead_nbr=nbr;
+#endif
+}
+
+#ifdef FILE_READAHEAD_HINT
+/* Keep up to file_readahead_nbr chunks of asynchronous kernel read-ahead
+ * in flight while the disk is read sequentially, so the device always has
+ * several large requests queued instead of a single synchronous one.
+ * readahead_size==0 disables the read-ahead of this disk. */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid((struct info_file_struct *)disk->data);
+  @*/
+static void file_readahead(disk_t *disk, const unsigned int count, const uint64_t offset)
+{
+  struct info_file_struct *data=(struct info_file_struct *)disk->data;
+  const uint64_t end=offset+count;
+  const uint64_t window=(uint64_t)file_readahead_nbr * FILE_READAHEAD_CHUNK;
+  if(data->readahead_size==0)
+    return ;
+  if(offset < data->readahead_last || offset > data->readahead_last + FILE_READAHEAD_CHUNK)
+  {
+    /* Random access, restart the sequential detection */
+    data->readahead_last=end;
+    data->readahead_end=end;
+    return ;
+  }
+  data->readahead_last=end;
+  if(data->readahead_end < end)
+    data->readahead_end=end;
+  if(data->readahead_end + FILE_READAHEAD_CHUNK > end + window)
+    return ;
+  while(data->readahead_end < end + window &&
+      data->readahead_end < disk->disk_real_size)
+  {
+#ifdef DEBUG_READAHEAD
+    log_trace("file_readahead offset=%llu\n", (long long unsigned)data->readahead_end);
+#endif
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(data->handle, disk->offset + data->readahead_end, FILE_READAHEAD_CHUNK, POSIX_FADV_WILLNEED);
+#else
+    {
+      struct radvisory ra;
+      ra.ra_offset=disk->offset + data->readahead_end;
+      ra.ra_count=FILE_READAHEAD_CHUNK;
+      (void)fcntl(data->handle, F_RDADVISE, &ra);
+    }
+#endif
+    data->readahead_end+=FILE_READAHEAD_CHUNK;
+  }
+}
+#endif
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
@@ -1545,9 +2059,83 @@ static int file_pread_aux(const disk_t *disk, void *buf, const unsigned int coun
   @*/
 static int file_pread(disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
 {
+#if !defined(DISABLED_FOR_FRAMAC)
+  const uint64_t start=disk_stats_clock();
+  int res;
+#endif
+#ifdef FILE_READAHEAD_HINT
+  file_readahead(disk_car, count, offset);
+#endif
+#if !defined(DISABLED_FOR_FRAMAC)
+  PHOTOREC_PROBE2(read_start, offset, count);
+  res=align_pread(&file_pread_aux, disk_car, buf, count, offset);
+  PHOTOREC_PROBE3(read_done, offset, count, res);
+  disk_stats_read(((struct info_file_struct *)disk_car->data)->stats, count, res, start);
+  return res;
+#else
   return align_pread(&file_pread_aux, disk_car, buf, count, offset);
+#endif
 }
 
+#ifdef HAVE_MMAP
+/* Image mapped in memory: no alignment constraint, one copy from the
+ * page cache and no read() system call */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid((char *)buf + (0 .. count-1));
+  @*/
+static int file_mmap_pread(disk_t *disk, void *buf, const unsigned int count, const uint64_t offset)
+{
+  const struct info_file_struct *data=(const struct info_file_struct *)disk->data;
+  const uint64_t pos=disk->offset + offset;
+  const uint64_t start=disk_stats_clock();
+  unsigned int size;
+#ifdef FILE_READAHEAD_HINT
+  file_readahead(disk, count, offset);
+#endif
+  if(pos >= data->map_size)
+  {
+    memset(buf, 0, count);
+    disk_stats_read(data->stats, count, -1, start);
+    return -1;
+  }
+  size=(pos + count > data->map_size ? data->map_size - pos : count);
+  memcpy(buf, data->map + pos, size);
+  if(size < count)
+    memset((char*)buf+size, 0, count-size);
+  disk_stats_read(data->stats, count, size, start);
+  return size;
+}
+
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid((struct info_file_struct *)disk->data);
+  @*/
+static void file_mmap(disk_t *disk)
+{
+  struct info_file_struct *data=(struct info_file_struct *)disk->data;
+  const uint64_t size=disk->offset + disk->disk_real_size;
+  void *map;
+  if((uint64_t)(size_t)size != size)
+    return ;
+  map=mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, data->handle, 0);
+  if(map==MAP_FAILED)
+  {
+    log_info("%s: mmap failed, %s\n", disk->device, strerror(errno));
+    return ;
+  }
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+  madvise(map, (size_t)size, MADV_SEQUENTIAL);
+#endif
+  data->map=(unsigned char *)map;
+  data->map_size=size;
+  disk->pread=&file_mmap_pread;
+  disk->access_mode|=TESTDISK_O_MMAP;
+}
+#endif
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
@@ -1641,6 +2229,55 @@ static int file_sync(disk_t *disk_car)
 #endif
 }
 
+#if (defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED) && !defined(__CYGWIN__) && !defined(__MINGW32__)) || \
+  (defined(__APPLE__) && defined(F_RDADVISE)) || \
+  (defined(HAVE_MMAP) && defined(HAVE_MADVISE) && defined(MADV_WILLNEED))
+#define FILE_ADVISE 1
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid((struct info_file_struct *)disk->data);
+  @*/
+static void file_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct info_file_struct *data=(struct info_file_struct *)disk->data;
+  if(length==0 || offset >= disk->disk_real_size)
+    return ;
+#if defined(HAVE_MMAP) && defined(HAVE_MADVISE) && defined(MADV_WILLNEED)
+  if(data->map!=NULL)
+  {
+    /* madvise() wants a page aligned address */
+    const uint64_t page_mask=~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    const uint64_t start=(disk->offset + offset) & page_mask;
+    const uint64_t end=(disk->offset + offset + length < data->map_size ? disk->offset + offset + length : data->map_size);
+    const int advice=(hint==TESTDISK_ADVISE_SEQUENTIAL ? MADV_SEQUENTIAL :
+	hint==TESTDISK_ADVISE_WILLNEED ? MADV_WILLNEED :
+	hint==TESTDISK_ADVISE_DONTNEED ? MADV_DONTNEED : MADV_NORMAL);
+    if(start < end)
+      madvise(data->map + start, (size_t)(end - start), advice);
+    return ;
+  }
+#endif
+  /* The page cache isn't used */
+  if((disk->access_mode&TESTDISK_O_DIRECT)!=0)
+    return ;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED) && !defined(__CYGWIN__) && !defined(__MINGW32__)
+  posix_fadvise(data->handle, disk->offset + offset, length,
+      (hint==TESTDISK_ADVISE_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL :
+       hint==TESTDISK_ADVISE_WILLNEED ? POSIX_FADV_WILLNEED :
+       hint==TESTDISK_ADVISE_DONTNEED ? POSIX_FADV_DONTNEED : POSIX_FADV_NORMAL));
+#elif defined(__APPLE__) && defined(F_RDADVISE)
+  if(hint==TESTDISK_ADVISE_WILLNEED)
+  {
+    struct radvisory ra;
+    ra.ra_offset=disk->offset + offset;
+    ra.ra_count=(length < 0x40000000 ? (int)length : 0x40000000);
+    (void)fcntl(data->handle, F_RDADVISE, &ra);
+  }
+#endif
+}
+#endif
+
 /*@
   @ requires \valid(disk);
   @ requires valid_disk(disk);
@@ -1720,6 +2357,145 @@ static int is_dosemu_image(const struct dosemu_image_header *hdr)
   return 0;
 }
 
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Holes of a sparse image: SEEK_DATA/SEEK_HOLE */
+static int file_find_holes(const disk_t *disk, const int fd, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  uint64_t pos=start;
+  int nbr=0;
+  while(pos <= end)
+  {
+    const off_t data_pos=lseek(fd, disk->offset + pos, SEEK_DATA);
+    uint64_t hole_end;
+    off_t hole_pos;
+    if(data_pos < 0)
+    {
+      if(errno!=ENXIO)
+	return (nbr > 0 ? nbr : -1);
+      /* No data up to the end of the file */
+      hole_end=end;
+    }
+    else
+      hole_end=((uint64_t)data_pos - disk->offset) - 1;
+    if(hole_end > end)
+      hole_end=end;
+    if(data_pos < 0 || (uint64_t)data_pos - disk->offset > pos)
+    {
+      fnct(pos, hole_end, arg);
+      nbr++;
+    }
+    if(data_pos < 0 || hole_end==end)
+      return nbr;
+    hole_pos=lseek(fd, data_pos, SEEK_HOLE);
+    if(hole_pos < 0)
+      return nbr;
+    pos=(uint64_t)hole_pos - disk->offset;
+  }
+  return nbr;
+#else
+  errno=EINVAL;
+  return -1;
+#endif
+}
+
+#if defined(TARGET_LINUX) && defined(SG_IO)
+/* Deallocated and anchored ranges of a thin provisioned or TRIMmed
+ * device: SCSI GET LBA STATUS, also translated for NVMe and ATA disks
+ * by the kernel or the USB bridge when they support it */
+#define LBA_STATUS_REPLY_LEN	(8 + 16 * 256)
+static int scsi_find_unmapped(const disk_t *disk, const int fd, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg)
+{
+  unsigned char *reply;
+  uint64_t lba=start / disk->sector_size;
+  const uint64_t last_lba=end / disk->sector_size;
+  int nbr=0;
+  int k;
+  if(ioctl(fd, SG_GET_VERSION_NUM, &k) < 0 || k < 30000)
+    return -1;
+  reply=(unsigned char *)MALLOC(LBA_STATUS_REPLY_LEN);
+  while(lba <= last_lba)
+  {
+    unsigned char cmd[16];
+    unsigned char sense_buffer[32];
+    sg_io_hdr_t io_hdr;
+    unsigned int len;
+    unsigned int i;
+    uint64_t next_lba=lba;
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0]=0x9e;	/* SERVICE ACTION IN (16) */
+    cmd[1]=0x12;	/* GET LBA STATUS */
+    *(uint64_t *)&cmd[2]=be64(lba);
+    *(uint32_t *)&cmd[10]=be32(LBA_STATUS_REPLY_LEN);
+    memset(&io_hdr, 0, sizeof(io_hdr));
+    io_hdr.interface_id='S';
+    io_hdr.cmd_len=sizeof(cmd);
+    io_hdr.mx_sb_len=sizeof(sense_buffer);
+    io_hdr.dxfer_direction=SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len=LBA_STATUS_REPLY_LEN;
+    io_hdr.dxferp=reply;
+    io_hdr.cmdp=cmd;
+    io_hdr.sbp=sense_buffer;
+    io_hdr.timeout=20000;
+    if(ioctl(fd, SG_IO, &io_hdr) < 0 || (io_hdr.info & SG_INFO_OK_MASK)!=SG_INFO_OK)
+      break;
+    len=be32(*(const uint32_t *)reply);
+    if(len > LBA_STATUS_REPLY_LEN - 4)
+      len=LBA_STATUS_REPLY_LEN - 4;
+    for(i=8; i + 16 <= len + 4; i+=16)
+    {
+      const uint64_t desc_lba=be64(*(const uint64_t *)&reply[i]);
+      const uint32_t desc_nbr=be32(*(const uint32_t *)&reply[i+8]);
+      const unsigned int status=reply[i+12] & 0x0f;
+      uint64_t range_end;
+      if(desc_nbr==0 || desc_lba + desc_nbr <= next_lba)
+	continue;
+      range_end=desc_lba + desc_nbr - 1;
+      if(range_end > last_lba)
+	range_end=last_lba;
+      /* 1: deallocated, 2: anchored */
+      if(status==1 || status==2)
+      {
+	const uint64_t range_start=(desc_lba > lba ? desc_lba : lba);
+	fnct(range_start * disk->sector_size, (range_end + 1) * disk->sector_size - 1, arg);
+	nbr++;
+      }
+      next_lba=range_end + 1;
+    }
+    if(next_lba==lba)
+      break;
+    lba=next_lba;
+  }
+  free(reply);
+  return (nbr > 0 || lba > start / disk->sector_size ? nbr : -1);
+}
+#endif
+
+int disk_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg)
+{
+  const struct info_file_struct *data;
+  struct stat stat_rec;
+  if(disk->clean!=&file_clean || disk->data==NULL)
+  {
+    const int res=vdisk_find_unmapped(disk, start, end, fnct, arg);
+    if(res >= 0 || errno!=EINVAL)
+      return res;
+    return fqcow2_find_unmapped(disk, start, end, fnct, arg);
+  }
+  data=(const struct info_file_struct *)disk->data;
+  if(fstat(data->handle, &stat_rec) < 0)
+    return -1;
+  if(S_ISREG(stat_rec.st_mode))
+    return file_find_holes(disk, data->handle, start, end, fnct, arg);
+#if defined(TARGET_LINUX) && defined(SG_IO)
+  if(S_ISBLK(stat_rec.st_mode) || S_ISCHR(stat_rec.st_mode))
+    return scsi_find_unmapped(disk, data->handle, start, end, fnct, arg);
+#endif
+  errno=EINVAL;
+  return -1;
+}
+#endif
+
 disk_t *file_test_availability(const char *device, const int verbose, int testdisk_mode)
 {
   /*@ assert valid_read_string(device); */
@@ -1731,6 +2507,48 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
   int hd_h=-1;
   int try_readonly=1;
   int mode_basic=0;
+#if !defined(DISABLED_FOR_FRAMAC)
+  /* md:member1,member2,... to assemble a Linux software RAID */
+  if(strncmp(device, MDVOL_PREFIX, strlen(MDVOL_PREFIX))==0)
+    return fmdvol_init(device, verbose, testdisk_mode);
+  /* luks:keyfile,device to decrypt a LUKS volume */
+  if(strncmp(device, LUKSVOL_PREFIX, strlen(LUKSVOL_PREFIX))==0)
+    return fluksvol_init(device, verbose, testdisk_mode);
+  /* nand:page+spare[/chunk][,xor=key][,map=pages],dump for a chip-off dump */
+  if(strncmp(device, NANDVOL_PREFIX, strlen(NANDVOL_PREFIX))==0)
+    return fnandvol_init(device, verbose, testdisk_mode);
+  /* overlay:sidefile,device to keep the writes in a side file */
+  if(strncmp(device, OVERLAY_PREFIX, strlen(OVERLAY_PREFIX))==0)
+    return foverlay_init(device, verbose, testdisk_mode);
+  /* pipe:size[,window],file to carve a stream read only once */
+  if(strncmp(device, PIPE_PREFIX, strlen(PIPE_PREFIX))==0)
+    return fpipe_init(device, verbose, testdisk_mode);
+  /* nbd://host[:port][/exportname] for a remote block export */
+  if(strncmp(device, NBD_PREFIX, strlen(NBD_PREFIX))==0)
+    return fnbd_init(device, verbose, testdisk_mode);
+#if defined(HAVE_LIBUSB)
+  /* usb:vid:pid or usb:fd=N for a USB mass storage device */
+  if(strncmp(device, USBMS_PREFIX, strlen(USBMS_PREFIX))==0)
+    return fusbms_init(device, verbose, testdisk_mode);
+#endif
+  /* image.001, image.002... raw image split in segments */
+  disk_car=fsplit_init(device, verbose, testdisk_mode);
+  if(disk_car!=NULL)
+    return disk_car;
+#endif
+#if defined(__APPLE__)
+  /* /dev/diskN goes through the buffer cache, /dev/rdiskN is the raw
+   * device: much faster for large sequential reads */
+  if(strncmp(device, "/dev/disk", 9)==0)
+  {
+    char device_raw[DISKNAME_MAX];
+    disk_t *disk_raw;
+    snprintf(device_raw, sizeof(device_raw), "/dev/r%s", &device[5]);
+    disk_raw=file_test_availability(device_raw, verbose, testdisk_mode);
+    if(disk_raw!=NULL)
+      return disk_raw;
+  }
+#endif
 #ifdef O_BINARY
     mode_basic|=O_BINARY;
 #endif
@@ -1871,17 +2689,49 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
   data=(struct info_file_struct *)MALLOC(sizeof(*data));
   data->handle=hd_h;
   data->mode=mode;
+  data->readahead_size=0;
+  data->readahead_last=0;
+  data->readahead_end=0;
+  data->passthrough=FILE_PASSTHROUGH_NONE;
+#ifdef HAVE_MMAP
+  data->map=NULL;
+  data->map_size=0;
+#endif
+#if !defined(DISABLED_FOR_FRAMAC)
+  data->stats=NULL;
+#endif
+#ifdef O_DIRECT
+  /* O_DIRECT bypasses the page cache, read-ahead hints are useless */
+  if((testdisk_mode&TESTDISK_O_READAHEAD_32K)!=0 && (mode&O_DIRECT)!=O_DIRECT)
+#else
+  if((testdisk_mode&TESTDISK_O_READAHEAD_32K)!=0)
+#endif
+    data->readahead_size=FILE_READAHEAD_NBR * FILE_READAHEAD_CHUNK;
   disk_car->data=data;
   disk_car->description=&file_description;
   disk_car->description_short=&file_description_short;
   disk_car->pread=&file_pread;
   disk_car->pwrite=((mode&O_RDWR)==O_RDWR?&file_pwrite:&file_nopwrite);
   disk_car->sync=&file_sync;
+#ifdef FILE_ADVISE
+  disk_car->advise=&file_advise;
+#endif
   disk_car->access_mode=((mode&O_RDWR)==O_RDWR?TESTDISK_O_RDWR:TESTDISK_O_RDONLY);
   disk_car->model=NULL;
 #ifdef O_DIRECT
   if((mode&O_DIRECT)==O_DIRECT)
     disk_car->access_mode|=TESTDISK_O_DIRECT;
+#endif
+#if defined(__APPLE__) && defined(F_NOCACHE)
+  /* No O_DIRECT on macOS, F_NOCACHE keeps the scan of a device out of
+   * the unified buffer cache. The requests are already aligned on the
+   * DKIOCGETBLOCKSIZE block size by alignio.h */
+  if(((testdisk_mode&TESTDISK_O_DIRECT)==TESTDISK_O_DIRECT || strncmp(device, "/dev/", 5)==0) &&
+      fcntl(hd_h, F_NOCACHE, 1)==0)
+  {
+    disk_car->access_mode|=TESTDISK_O_DIRECT;
+    data->readahead_size=0;
+  }
 #endif
   disk_car->clean=&file_clean;
 #if !defined(DISABLED_FOR_FRAMAC)
@@ -1902,6 +2752,9 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
     disk_car->sector_size=disk_get_sector_size(hd_h, device, verbose);
     disk_get_geometry(&disk_car->geom, hd_h, device, verbose);
     disk_car->disk_real_size=disk_get_size(hd_h, device, verbose, disk_car->sector_size);
+#if defined(TARGET_LINUX) && defined(SG_IO)
+    file_passthrough_setup(data, device, disk_car->sector_size);
+#endif
 #ifdef BLKFLSBUF
     /* Little trick from Linux fdisk */
     /* Blocks are visible in more than one way:
@@ -1928,9 +2781,11 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
     disk_car->sector_size=DEFAULT_SECTOR_SIZE;
     buffer=(unsigned char*)MALLOC(DEFAULT_SECTOR_SIZE);
     ewf=(const struct tdewf_file_header *)buffer;
-    if(read(hd_h,buffer,DEFAULT_SECTOR_SIZE) != DEFAULT_SECTOR_SIZE)
     {
-      memset(buffer,0,DEFAULT_SECTOR_SIZE);
+      /* A VMDK descriptor file may be smaller than a sector */
+      const int res=read(hd_h,buffer,DEFAULT_SECTOR_SIZE);
+      if(res != DEFAULT_SECTOR_SIZE)
+	memset(buffer + (res > 0 ? res : 0), 0, DEFAULT_SECTOR_SIZE - (res > 0 ? res : 0));
     }
 #ifdef __FRAMAC__
     Frama_C_make_unknown((char *)buffer, DEFAULT_SECTOR_SIZE);
@@ -1965,6 +2820,52 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
       return NULL;
 #endif
     }
+    else if(be32(*(const uint32_t *)buffer)==QCOW2_MAGIC)
+    {
+      free(buffer);
+      free(data);
+      free(disk_car->device);
+      free(disk_car->model);
+      free(disk_car);
+      close(hd_h);
+      log_info("QCOW2 format detected.\n");
+      return fqcow2_init(device, testdisk_mode);
+    }
+    else if(le32(*(const uint32_t *)buffer)==VMDK4_MAGIC ||
+	le32(*(const uint32_t *)buffer)==VMDK3_MAGIC ||
+	memcmp(buffer, VMDK_DESCRIPTOR_SIGNATURE, strlen(VMDK_DESCRIPTOR_SIGNATURE))==0)
+    {
+      free(buffer);
+      free(data);
+      free(disk_car->device);
+      free(disk_car->model);
+      free(disk_car);
+      close(hd_h);
+      log_info("VMDK format detected.\n");
+      return fvmdk_init(device, verbose, testdisk_mode);
+    }
+    else if(memcmp(buffer, VHDX_FILE_SIGNATURE, 8)==0)
+    {
+      free(buffer);
+      free(data);
+      free(disk_car->device);
+      free(disk_car->model);
+      free(disk_car);
+      close(hd_h);
+      log_info("VHDX format detected.\n");
+      return fvhdx_init(device, testdisk_mode);
+    }
+    else if(le32(*(const uint32_t *)&buffer[VDI_SIGNATURE_OFFSET])==VDI_SIGNATURE)
+    {
+      free(buffer);
+      free(data);
+      free(disk_car->device);
+      free(disk_car->model);
+      free(disk_car);
+      close(hd_h);
+      log_info("VDI format detected.\n");
+      return fvdi_init(device, testdisk_mode);
+    }
     else
 #endif
     {
@@ -1996,6 +2897,12 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
     free(buffer);
   }
   update_disk_car_fields(disk_car);
+#ifdef HAVE_MMAP
+  /* Read-only image file */
+  if(device_is_a_file>0 && disk_car->disk_real_size!=0 &&
+      disk_car->access_mode==TESTDISK_O_RDONLY)
+    file_mmap(disk_car);
+#endif
   if(disk_car->disk_real_size!=0)
   {
 #ifdef HDCLONE
@@ -2016,6 +2923,9 @@ disk_t *file_test_availability(const char *device, const int verbose, int testdi
     /*@ assert 0 < disk_car->geom.sectors_per_head <= 63; */
     /*@ assert valid_read_string(disk_car->device); */
     /*@ assert valid_disk(disk_car); */
+#if !defined(DISABLED_FOR_FRAMAC)
+    data->stats=disk_stats_new("file", device);
+#endif
     return disk_car;
   }
   /*@ assert disk_car->description == &file_description; */
@@ -2097,4 +3007,111 @@ void init_disk(disk_t *disk)
   disk->write_used=0;
   disk->description_txt[0]='\0';
   disk->unit=UNIT_CHS;
+  disk->advise=NULL;
+}
+
+void disk_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint)
+{
+  if(disk->advise==NULL || length==0)
+    return ;
+  disk->advise(disk, offset, length, hint);
+}
+
+/* Reads closer than DISK_BATCH_GAP are merged, up to DISK_BATCH_MAX bytes */
+#define DISK_BATCH_GAP	(64*1024)
+#define DISK_BATCH_MAX	(1024*1024)
+#define DISK_BATCH_NBR	64
+
+static int disk_read_cmp(const void *a, const void *b)
+{
+  const disk_read_t *read_a=*(const disk_read_t * const *)a;
+  const disk_read_t *read_b=*(const disk_read_t * const *)b;
+  if(read_a->offset != read_b->offset)
+    return (read_a->offset < read_b->offset ? -1 : 1);
+  return 0;
+}
+
+/* Return the end of the group of sorted reads starting at first, the
+ * end of the range read is stored in *end */
+static unsigned int disk_batch_group(disk_read_t * const *sorted, const unsigned int first, const unsigned int nbr, uint64_t *end)
+{
+  unsigned int i;
+  *end=sorted[first]->offset + sorted[first]->count;
+  for(i=first+1; i<nbr && sorted[i]->offset <= *end + DISK_BATCH_GAP; i++)
+  {
+    const uint64_t read_end=sorted[i]->offset + sorted[i]->count;
+    if(read_end > *end)
+    {
+      if(read_end - sorted[first]->offset > DISK_BATCH_MAX)
+	break;
+      *end=read_end;
+    }
+  }
+  return i;
+}
+
+/* Read the sorted reads first..last-1 by a single read of the range */
+static void disk_pread_group(disk_t *disk, disk_read_t * const *sorted, const unsigned int first, const unsigned int last, const uint64_t end)
+{
+  const uint64_t start=sorted[first]->offset;
+  const unsigned int size=end - start;
+  unsigned char *buffer;
+  unsigned int i;
+  int res;
+  if(last==first+1)
+  {
+    sorted[first]->res=disk->pread(disk, sorted[first]->buffer, sorted[first]->count, start);
+    return ;
+  }
+  buffer=(unsigned char *)MALLOC(size);
+  res=disk->pread(disk, buffer, size, start);
+  for(i=first; i<last; i++)
+  {
+    disk_read_t *rd=sorted[i];
+    if(res==(signed)size)
+    {
+      memcpy(rd->buffer, buffer + (rd->offset - start), rd->count);
+      rd->res=rd->count;
+    }
+    else
+    {
+      /* An unreadable sector must only fail the reads containing it */
+      rd->res=disk->pread(disk, rd->buffer, rd->count, rd->offset);
+    }
+  }
+  free(buffer);
+}
+
+int disk_pread_batch(disk_t *disk, disk_read_t *reads, const unsigned int nbr)
+{
+  disk_read_t *sorted_tmp[DISK_BATCH_NBR];
+  disk_read_t **sorted;
+  unsigned int i;
+  unsigned int first;
+  unsigned int last;
+  uint64_t end;
+  int res=0;
+  if(nbr==0)
+    return 0;
+  sorted=(nbr <= DISK_BATCH_NBR ? sorted_tmp : (disk_read_t **)MALLOC(nbr * sizeof(disk_read_t *)));
+  for(i=0; i<nbr; i++)
+    sorted[i]=&reads[i];
+  qsort(sorted, nbr, sizeof(disk_read_t *), disk_read_cmp);
+  /* Announce all the groups, then read them in order */
+  for(first=0; first<nbr; first=last)
+  {
+    last=disk_batch_group(sorted, first, nbr, &end);
+    disk_advise(disk, sorted[first]->offset, end - sorted[first]->offset, TESTDISK_ADVISE_WILLNEED);
+  }
+  for(first=0; first<nbr; first=last)
+  {
+    last=disk_batch_group(sorted, first, nbr, &end);
+    disk_pread_group(disk, sorted, first, last, end);
+  }
+  for(i=0; i<nbr; i++)
+    if(reads[i].res != (signed)reads[i].count)
+      res=-1;
+  if(sorted!=sorted_tmp)
+    free(sorted);
+  return res;
 }
@@ -55,6 +55,32 @@ list_disk_t *hd_parse(list_disk_t *list_disk, const int verbose, const int testd
   @*/
 disk_t *file_test_availability(const char *device, const int verbose, const int testdisk_mode);
 
+/* Number of 1 MiB chunks of read-ahead queued on the sequential reads of
+ * the disks opened with TESTDISK_O_READAHEAD_32K, 8 by default */
+/*@
+  @ assigns \nothing;
+  @*/
+void file_set_readahead_depth(const unsigned int nbr);
+
+/* Read the devices opened afterwards with SCSI or NVMe passthrough
+ * commands that are aborted after timeout_ms ms and not retried, instead
+ * of the block layer. 0 by default: through the block layer */
+/*@
+  @ assigns \nothing;
+  @*/
+void file_set_passthrough(const unsigned int timeout_ms);
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Call fnct for each range between start and end that holds no data: a
+ * hole of a sparse image file or, for a device, the blocks reported as
+ * deallocated. Return the number of ranges, -1 if the disk can't tell */
+/*@
+  @ requires \valid_read(disk);
+  @ requires valid_disk(disk);
+  @*/
+int disk_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg);
+#endif
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
@@ -85,13 +111,43 @@ void update_disk_car_fields(disk_t *disk_car);
   @ ensures disk->write_used == 0;
   @ ensures disk->description_txt[0] == '\0';
   @ ensures disk->unit == UNIT_CHS;
+  @ ensures disk->advise == \null;
   @ assigns disk->autodetect, disk->disk_size, disk->user_max, disk->native_max, disk->dco, disk->offset;
   @ assigns disk->rbuffer, disk->wbuffer, disk->rbuffer_size, disk->wbuffer_size;
   @ assigns disk->model, disk->serial_no, disk->fw_rev, disk->write_used;
-  @ assigns disk->description_txt[0], disk->unit;
+  @ assigns disk->description_txt[0], disk->unit, disk->advise;
   @*/
 void init_disk(disk_t *disk);
 
+/* Tell the disk how the length bytes at offset will be read, the
+ * TESTDISK_ADVISE_* hint is passed down to the page cache, the EWF
+ * decompression threads... Only a hint, the data may not be loaded. */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @*/
+void disk_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint);
+
+/* One of the reads of disk_pread_batch(), res is set as by pread() */
+typedef struct
+{
+  uint64_t offset;
+  unsigned int count;
+  void *buffer;
+  int res;
+} disk_read_t;
+
+/* Read a set of small independent ranges: they are all announced to the
+ * disk first, so a remote or asynchronous disk loads them concurrently,
+ * then the close ones are merged into a single read.
+ * Return 0 if every read is complete, -1 otherwise */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid(reads + (0 .. nbr-1));
+  @*/
+int disk_pread_batch(disk_t *disk, disk_read_t *reads, const unsigned int nbr);
+
 /*@
   @ requires \valid(disk);
   @ requires valid_disk(disk);
@@ -30,151 +30,408 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* unlink */
+#endif
+#include <errno.h>
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
+#include "list.h"
 #include "hdcache.h"
+#include "hdshare.h"
+#include "hdstats.h"
+#include "hdtee.h"
+#include "hdtrace.h"
 #include "log.h"
+#include "mapfile.h"
+#include "pprobe.h"
+#ifndef DISABLED_FOR_FRAMAC
+#include "ewf.h"
+#endif
 
-#define CACHE_BUFFER_NBR 16
-#define CACHE_DEFAULT_SIZE 64*512
+/* Default memory budget of the block cache */
+#define CACHE_SIZE_DEFAULT	(16*1024*1024)
+#define CACHE_BLOCK_SIZE_MIN	512
+/* With O_DIRECT, the large reads go straight to the caller buffer */
+#define CACHE_DIRECT_MIN	(128*1024)
+/* A read error that takes at least 1s is slow, the drive has retried */
+#define CACHE_SLOW_ERROR	1000000000ULL
+#define CACHE_SLOW_ERRORS_DEFAULT	8
+#define CACHE_READAHEAD_MIN	(64*1024)
+#define CACHE_READAHEAD_MAX	(1024*1024)
 //#define DEBUG_CACHE 1
 
-struct cache_buffer_struct
+/* The disk is cached by aligned blocks of block_size bytes, indexed by a
+ * hash table on the block number. Blocks are kept in LRU order and the
+ * least recently used one is recycled once the memory budget is used. */
+struct cache_block_struct
 {
+  struct td_list_head list;	/* LRU, most recently used first */
+  struct cache_block_struct *hash_next;
+  uint64_t	offset;
+  int		status;		/* bytes available from offset */
   unsigned char *buffer;
-  unsigned int	buffer_size;
-  unsigned int	cache_size;
-  uint64_t 	cache_offset;
-  int		cache_status;
 };
 
 struct cache_struct
 {
   disk_t *disk_car;
-  struct cache_buffer_struct cache[CACHE_BUFFER_NBR];
-#ifdef DEBUG_CACHE
-  uint64_t 	nbr_fnct_sect;
-  uint64_t 	nbr_pread_sect;
-  unsigned int 	nbr_fnct_call;
-  unsigned int 	nbr_pread_call;
-#endif
-  unsigned int  cache_buffer_nbr;
-  unsigned int  cache_size_min;
+  struct cache_block_struct **hash;
+  struct td_list_head lru;
+  unsigned int  hash_mask;
+  unsigned int  block_size;
+  unsigned int  nbr_blocks;
+  unsigned int  max_blocks;
+  unsigned char *io_buffer;
+  unsigned int  io_buffer_size;
+  disk_stats_t	*stats;
   unsigned int  last_io_error_nbr;
+  mapfile_t	bad;		/* sectors known to be unreadable */
+  diskshare_t	*share;		/* blocks read by the other processes */
 };
 
+/* Slow read errors before the rest of a failed read is marked bad
+ * without reading it, 0 to read every sector */
+static unsigned int cache_slow_errors_max=CACHE_SLOW_ERRORS_DEFAULT;
+
+void diskcache_set_slow_errors(const unsigned int nbr)
+{
+  cache_slow_errors_max=nbr;
+}
+
+static struct cache_block_struct **cache_hash_slot(const struct cache_struct *data, const uint64_t offset)
+{
+  return &data->hash[(offset / data->block_size) & data->hash_mask];
+}
+
+static struct cache_block_struct *cache_lookup(struct cache_struct *data, const uint64_t offset)
+{
+  struct cache_block_struct *block;
+  for(block=*cache_hash_slot(data, offset); block!=NULL; block=block->hash_next)
+  {
+    if(block->offset==offset)
+    {
+      td_list_del(&block->list);
+      td_list_add(&block->list, &data->lru);
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static void cache_unhash(struct cache_struct *data, const struct cache_block_struct *block)
+{
+  struct cache_block_struct **slot;
+  for(slot=cache_hash_slot(data, block->offset); *slot!=NULL; slot=&(*slot)->hash_next)
+  {
+    if(*slot==block)
+    {
+      *slot=block->hash_next;
+      return ;
+    }
+  }
+}
+
+/* Get a free block, recycle the least recently used one if needed */
+static struct cache_block_struct *cache_block_get(struct cache_struct *data)
+{
+  struct cache_block_struct *block;
+  if(data->nbr_blocks < data->max_blocks || td_list_empty(&data->lru))
+  {
+    block=(struct cache_block_struct *)MALLOC(sizeof(*block));
+    block->buffer=(unsigned char *)MALLOC(data->block_size);
+    data->nbr_blocks++;
+  }
+  else
+  {
+    block=td_list_last_entry(&data->lru, struct cache_block_struct, list);
+    td_list_del(&block->list);
+    cache_unhash(data, block);
+  }
+  return block;
+}
+
+static void cache_block_insert(struct cache_struct *data, struct cache_block_struct *block, const uint64_t offset, const int status)
+{
+  struct cache_block_struct **slot=cache_hash_slot(data, offset);
+  block->offset=offset;
+  block->status=status;
+  block->hash_next=*slot;
+  *slot=block;
+  td_list_add(&block->list, &data->lru);
+}
+
+static void cache_block_drop(struct cache_struct *data, struct cache_block_struct *block)
+{
+  td_list_del(&block->list);
+  cache_unhash(data, block);
+  free(block->buffer);
+  free(block);
+  data->nbr_blocks--;
+}
+
+/* Number of bytes that can be read from offset before a sector known to
+ * be unreadable */
+static unsigned int cache_readable(const struct cache_struct *data, const uint64_t offset, const unsigned int count)
+{
+  uint64_t pos;
+  uint64_t size;
+  if(mapfile_next(&data->bad, offset, MAPFILE_BAD_SECTOR, &pos, &size) < 0 ||
+      pos >= offset + count)
+    return count;
+  return pos - offset;
+}
+
+/* [offset, offset+count) has failed to read: read each half again to
+ * isolate the unreadable sectors and mark them bad, the readable parts are
+ * kept in buffer. Once *slow errors have been slow, the halves still to
+ * check are read once and marked bad as a whole if they fail */
+static void cache_bisect(struct cache_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset, const unsigned int sector_size, unsigned int *slow)
+{
+  unsigned int half;
+  unsigned int i;
+  if(count <= sector_size)
+  {
+    mapfile_set(&data->bad, offset, sector_size, MAPFILE_BAD_SECTOR);
+    return ;
+  }
+  half=(count / 2 + sector_size - 1) / sector_size * sector_size;
+  for(i=0; i<2; i++)
+  {
+    const uint64_t pos=(i==0 ? offset : offset + half);
+    const unsigned int size=(i==0 ? half : count - half);
+    const int give_up=(cache_slow_errors_max > 0 && *slow >= cache_slow_errors_max);
+    uint64_t start;
+    int res;
+    disk_stats_retry(data->stats);
+    start=disk_stats_clock();
+    res=data->disk_car->pread(data->disk_car, &buffer[pos - offset], size, pos);
+    if(res >= (signed)size)
+      continue;
+    if(disk_stats_clock() - start >= CACHE_SLOW_ERROR)
+      (*slow)++;
+    if(give_up)
+    {
+      memset(&buffer[pos - offset], 0, size);
+      mapfile_set(&data->bad, pos, (size + sector_size - 1) / sector_size * sector_size, MAPFILE_BAD_SECTOR);
+      continue;
+    }
+    /* The sectors before a short read are fine */
+    res=(res > 0 ? (unsigned int)res / sector_size * sector_size : 0);
+    memset(&buffer[pos - offset + res], 0, size - res);
+    cache_bisect(data, &buffer[pos - offset + res], size - res, pos + res, sector_size, slow);
+  }
+}
+
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
   @ requires \valid((char *)buffer + (0 .. count-1));
   @ requires separation: \separated(disk_car, (char *)buffer + (0 .. count-1));
   @*/
-static int cache_pread_aux(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset, const unsigned int read_ahead)
+static int cache_pread_direct(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
 {
   struct cache_struct *data=(struct cache_struct *)disk_car->data;
-#ifdef DEBUG_CACHE
-  log_info("cache_pread(buffer, count=%u, offset=%llu, read_ahead=%u)\n", count,(long long unsigned)offset, read_ahead);
-  data->nbr_fnct_call++;
-#endif
+  const unsigned int readable=cache_readable(data, offset, count);
+  int res;
+  if(readable < count)
   {
-    unsigned int i;
-    unsigned int cache_buffer_nbr;
-    /* Data is probably in the last buffers */
-    for(i=0, cache_buffer_nbr=data->cache_buffer_nbr;
-	i<CACHE_BUFFER_NBR;
-	i++, cache_buffer_nbr=(cache_buffer_nbr+CACHE_BUFFER_NBR-1)%CACHE_BUFFER_NBR)
+    /* Don't wait again for a sector that has already failed */
+    memset(buffer, 0, count);
+    if(readable==0)
     {
-      const struct cache_buffer_struct *cache=&data->cache[cache_buffer_nbr];
-      if(cache->cache_offset <= offset &&
-	  offset < cache->cache_offset +cache->cache_size &&
-	  cache->buffer!=NULL && cache->cache_size>0)
+      errno=EIO;
+      return -1;
+    }
+    res=cache_pread_direct(disk_car, buffer, readable, offset);
+    return (res < (signed)readable ? res : (signed)readable);
+  }
+  res=data->disk_car->pread(data->disk_car, buffer, count, offset);
+  if(res >= (signed)count)
+  {
+    data->last_io_error_nbr=0;
+    return count;
+  }
+  /* Read failure */
+  data->last_io_error_nbr++;
+  if(count<=disk_car->sector_size && offset % disk_car->sector_size == 0)
+    mapfile_set(&data->bad, offset, disk_car->sector_size, MAPFILE_BAD_SECTOR);
+  if(count<=disk_car->sector_size || disk_car->sector_size<=0 || data->last_io_error_nbr>1)
+    return res;
+  /* isolate the unreadable sectors by bisection */
+  {
+    unsigned int slow=0;
+    const uint64_t bad_before=mapfile_size(&data->bad, MAPFILE_BAD_SECTOR);
+    memset(buffer, 0, count);
+    cache_bisect(data, (unsigned char *)buffer, count, offset, disk_car->sector_size, &slow);
+    if(cache_slow_errors_max > 0 && slow >= cache_slow_errors_max)
+      log_warning("%s: %u slow read errors from sector %llu, %llu bytes marked unreadable\n",
+	  data->disk_car->description_short(data->disk_car), slow,
+	  (long long unsigned)(offset / disk_car->sector_size),
+	  (long long unsigned)(mapfile_size(&data->bad, MAPFILE_BAD_SECTOR) - bad_before));
+    return cache_readable(data, offset, count);
+  }
+}
+
+static void cache_io_buffer(struct cache_struct *data, const unsigned int size)
+{
+  if(data->io_buffer_size < size)
+  {
+    free(data->io_buffer);
+    data->io_buffer_size=size;
+    data->io_buffer=(unsigned char *)MALLOC_IO(data->io_buffer_size);
+  }
+}
+
+/* Copy the block at offset from the shared cache, NULL if one of its
+ * units is missing */
+static struct cache_block_struct *cache_share_get(struct cache_struct *data, const uint64_t offset)
+{
+  const uint64_t disk_size=data->disk_car->disk_real_size;
+  const unsigned int size=(offset + data->block_size > disk_size ? disk_size - offset : data->block_size);
+  struct cache_block_struct *block;
+  unsigned int done;
+  cache_io_buffer(data, data->block_size);
+  for(done=0; done < size; done+=DISKSHARE_UNIT)
+  {
+    const int res=diskshare_get(data->share, offset + done, data->io_buffer + done);
+    if(res < (signed)(size - done < DISKSHARE_UNIT ? size - done : DISKSHARE_UNIT))
+      return NULL;
+  }
+  block=cache_block_get(data);
+  memcpy(block->buffer, data->io_buffer, size);
+  cache_block_insert(data, block, offset, size);
+  return block;
+}
+
+/* Read the nbr blocks starting at offset with a single request */
+static struct cache_block_struct *cache_fill(struct cache_struct *data, const uint64_t offset, unsigned int nbr)
+{
+  const uint64_t disk_size=data->disk_car->disk_real_size;
+  struct cache_block_struct *first=NULL;
+  unsigned int size;
+  unsigned int i;
+  int res;
+  if(offset >= disk_size)
+    return NULL;
+  if(data->last_io_error_nbr>0)
+    nbr=1;
+  if(data->share!=NULL)
+  {
+    first=cache_share_get(data, offset);
+    if(first!=NULL)
+      return first;
+    /* Stop before the next block another process has read */
+    for(i=1; i<nbr; i++)
+    {
+      if(diskshare_has(data->share, offset + (uint64_t)i*data->block_size))
       {
-	const unsigned int data_available= cache->cache_size + cache->cache_offset - offset;
-	const int res=cache->cache_status + cache->cache_offset - offset;
-	if(count<=data_available)
-	{
-#ifdef DEBUG_CACHE
-	  log_info("cache use %5u count=%u, coffset=%llu, cstatus=%d\n",
-	      cache_buffer_nbr, cache->cache_size, (long long unsigned)cache->cache_offset,
-	      cache->cache_status);
-	  data->nbr_fnct_sect+=count;
-#endif
-	  memcpy(buffer, cache->buffer + offset - cache->cache_offset, count);
-	  return (res < (signed)count ?  res : (signed)count );
-	}
-	else
-	{
-#ifdef DEBUG_CACHE
-	  log_info("cache USE %5u count=%u, coffset=%llu, ctstatus=%d, call again cache_pread_aux\n",
-	      cache_buffer_nbr, cache->cache_size, (long long unsigned)cache->cache_offset,
-	      cache->cache_status);
-	  data->nbr_fnct_sect+=data_available;
-#endif
-	  memcpy(buffer, cache->buffer + offset - cache->cache_offset, data_available);
-	  return res + cache_pread_aux(disk_car, (unsigned char*)buffer+data_available,
-		count-data_available, offset+data_available, read_ahead);
-	}
+	nbr=i;
+	break;
       }
     }
   }
+  size=(offset + (uint64_t)nbr*data->block_size > disk_size ? disk_size - offset : nbr*data->block_size);
+  /* Stop before the known bad sectors */
+  size=cache_readable(data, offset, size);
+  if(size==0)
+    return NULL;
+  cache_io_buffer(data, size);
+  res=data->disk_car->pread(data->disk_car, data->io_buffer, size, offset);
+#ifdef DEBUG_CACHE
+  log_info("cache PREAD(count=%u, offset=%llu, status=%d)\n", size, (long long unsigned)offset, res);
+#endif
+  if(res < (signed)size)
   {
-    struct cache_buffer_struct *cache;
-    const unsigned int count_new=(read_ahead!=0 && count<data->cache_size_min && (offset+data->cache_size_min<data->disk_car->disk_real_size)?data->cache_size_min:count);
-    data->cache_buffer_nbr=(data->cache_buffer_nbr+1)%CACHE_BUFFER_NBR;
-    cache=&data->cache[data->cache_buffer_nbr];
-    if(cache->buffer_size < count_new)
-    {	/* Buffer is too small, drop it */
-      free(cache->buffer);
-      cache->buffer=NULL;
-    }
-    if(cache->buffer==NULL)
-    {	/* Allocate buffer */
-      cache->buffer_size=(count_new<CACHE_DEFAULT_SIZE?CACHE_DEFAULT_SIZE:count_new);
-      cache->buffer=(unsigned char *)MALLOC(cache->buffer_size);
-    }
-    cache->cache_size=count_new;
-    cache->cache_offset=offset;
-    cache->cache_status=data->disk_car->pread(data->disk_car, cache->buffer, count_new, offset);
+    /* cache_pread_direct() will retry and count the error */
+    return NULL;
+  }
+  data->last_io_error_nbr=0;
+  if(data->share!=NULL)
+  {
+    unsigned int done;
+    for(done=0; done < size; done+=DISKSHARE_UNIT)
+      diskshare_put(data->share, offset + done, data->io_buffer + done,
+	  (size - done < DISKSHARE_UNIT ? size - done : DISKSHARE_UNIT));
+  }
+  for(i=0; i*data->block_size < size; i++)
+  {
+    struct cache_block_struct *block=cache_block_get(data);
+    const unsigned int block_status=(size - i*data->block_size < data->block_size ? size - i*data->block_size : data->block_size);
+    memcpy(block->buffer, data->io_buffer + i*data->block_size, block_status);
+    cache_block_insert(data, block, offset + (uint64_t)i*data->block_size, block_status);
+    if(i==0)
+      first=block;
+  }
+  /* Keep the first block ahead of the others */
+  td_list_del(&first->list);
+  td_list_add(&first->list, &data->lru);
+  return first;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (char *)buffer + (0 .. count-1));
+  @*/
+static int cache_pread_aux(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct cache_struct *data=(struct cache_struct *)disk_car->data;
+  unsigned int done=0;
 #ifdef DEBUG_CACHE
-    data->nbr_fnct_sect+=count;
-    data->nbr_pread_call++;
-    data->nbr_pread_sect+=count_new;
-    log_info("cache PREAD(buffer[%u], count=%u, count_new=%u, offset=%llu, cstatus=%d)\n",
-	data->cache_buffer_nbr, count, count_new, (long long unsigned)offset,
-	cache->cache_status);
+  log_info("cache_pread(buffer, count=%u, offset=%llu)\n", count,(long long unsigned)offset);
 #endif
-    if(cache->cache_status >= (signed)count)
-    {
-      data->last_io_error_nbr=0;
-      memcpy(buffer, cache->buffer, count);
-      return count;
-    }
-    /* Read failure */
-    data->last_io_error_nbr++;
-    if(count_new<=disk_car->sector_size || disk_car->sector_size<=0 || data->last_io_error_nbr>1)
+  /* Sequential scan with O_DIRECT: no copy through the cache blocks, the
+   * data would only evict the small metadata reads. The cache is never
+   * dirty, the disk has the same data */
+  if((data->disk_car->access_mode&TESTDISK_O_DIRECT)!=0 && count >= CACHE_DIRECT_MIN &&
+      disk_car->sector_size > 0 && offset % disk_car->sector_size == 0 &&
+      count % disk_car->sector_size == 0 &&
+      offset + count <= data->disk_car->disk_real_size &&
+      ((size_t)buffer & (disk_car->sector_size-1))==0)
+  {
+    disk_stats_miss(data->stats);
+    return cache_pread_direct(disk_car, buffer, count, offset);
+  }
+  while(done < count)
+  {
+    const uint64_t pos=offset + done;
+    const uint64_t block_offset=pos / data->block_size * data->block_size;
+    const unsigned int in_block=pos - block_offset;
+    const unsigned int size=(data->block_size - in_block < count - done ? data->block_size - in_block : count - done);
+    struct cache_block_struct *block=cache_lookup(data, block_offset);
+    if(block!=NULL)
+      disk_stats_hit(data->stats);
+    else
     {
-      memcpy(buffer, cache->buffer, count);
-      return cache->cache_status;
+      /* Read all the missing blocks up to the next cached one at once */
+      const uint64_t last_offset=(offset + count - 1) / data->block_size * data->block_size;
+      unsigned int nbr=1;
+      disk_stats_miss(data->stats);
+      while(block_offset + (uint64_t)nbr*data->block_size <= last_offset &&
+	  nbr < data->max_blocks &&
+	  cache_lookup(data, block_offset + (uint64_t)nbr*data->block_size)==NULL)
+	nbr++;
+      block=cache_fill(data, block_offset, nbr);
     }
-    /* Free the existing cache */
-    cache->cache_size=0;
-    /* split the read sector by sector */
+    if(block==NULL || block->status < (signed)(in_block + size))
     {
-      unsigned int off;
-      memset(buffer, 0, count);
-      for(off=0; off<count; off+=disk_car->sector_size)
+      /* End of disk or read error, the remaining data is not cached */
+      const int res=cache_pread_direct(disk_car, (unsigned char *)buffer + done, count - done, pos);
+      if(res < (signed)(count - done))
       {
-	if(cache_pread_aux(disk_car, 
-	    (unsigned char*)buffer+off,
-	    (disk_car->sector_size < count - off ? disk_car->sector_size : count - off),
-	    offset+off, 0) <= 0)
-	{
-	  return off;
-	}
+	if(done==0)
+	  return res;
+	return (res > 0 ? (signed)done + res : (signed)done);
       }
       return count;
     }
+    memcpy((unsigned char *)buffer + done, block->buffer + in_block, size);
+    done+=size;
   }
+  return count;
 }
 
 /*@
@@ -185,8 +442,12 @@ static int cache_pread_aux(disk_t *disk_car, void *buffer, const unsigned int co
   @*/
 static int cache_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
 {
-  const struct cache_struct *data=(const struct cache_struct *)disk_car->data;
-  return cache_pread_aux(disk_car, buffer, count, offset, (data->last_io_error_nbr==0));
+  const uint64_t start=disk_stats_clock();
+  int res;
+  PHOTOREC_PROBE2(cache_read, offset, count);
+  res=cache_pread_aux(disk_car, buffer, count, offset);
+  disk_stats_read(((struct cache_struct *)disk_car->data)->stats, count, res, start);
+  return res;
 }
 
 /*@
@@ -199,16 +460,18 @@ static int cache_pread(disk_t *disk_car, void *buffer, const unsigned int count,
 static int cache_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset)
 {
   struct cache_struct *data=(struct cache_struct *)disk_car->data;
-  unsigned int i;
-  for(i=0;i<CACHE_BUFFER_NBR;i++)
+  uint64_t block_offset;
+  /* Discard the cache */
+  for(block_offset=offset / data->block_size * data->block_size;
+      block_offset < offset + count;
+      block_offset+=data->block_size)
   {
-    struct cache_buffer_struct *cache=&data->cache[i];
-    if(!(cache->cache_offset+cache->cache_size-1 < offset || offset+count-1 < cache->cache_offset))
-    {
-      /* Discard the cache */
-      cache->cache_size=0;
-    }
+    struct cache_block_struct *block=cache_lookup(data, block_offset);
+    if(block!=NULL)
+      cache_block_drop(data, block);
   }
+  if(data->share!=NULL)
+    diskshare_invalidate(data->share, offset, count);
   disk_car->write_used=1;
   return data->disk_car->pwrite(data->disk_car, buffer, count, offset);
 }
@@ -223,19 +486,19 @@ static void cache_clean(disk_t *disk_car)
   if(disk_car->data)
   {
     struct cache_struct *data=(struct cache_struct *)disk_car->data;
-    unsigned int i;
-#ifdef DEBUG_CACHE
-    log_info("%s\ncache_pread total_call=%u, total_count=%llu\n      read total_call=%u, total_count=%llu\n",
-	data->disk_car->description(data->disk_car),
-	data->nbr_fnct_call, (long long unsigned)data->nbr_fnct_sect,
-	data->nbr_pread_call, (long long unsigned)data->nbr_pread_sect);
-#endif
+    if(data->bad.nbr > 0)
+      log_info("%s: %llu bytes in unreadable sectors\n",
+	  data->disk_car->description_short(data->disk_car),
+	  (long long unsigned)mapfile_size(&data->bad, MAPFILE_BAD_SECTOR));
     data->disk_car->clean(data->disk_car);
-    for(i=0;i<CACHE_BUFFER_NBR;i++)
-    {
-      struct cache_buffer_struct *cache=&data->cache[i];
-      free(cache->buffer);
-    }
+    while(!td_list_empty(&data->lru))
+      cache_block_drop(data, td_list_first_entry(&data->lru, struct cache_block_struct, list));
+    free(data->hash);
+    free(data->io_buffer);
+    mapfile_free(&data->bad);
+    if(data->share!=NULL)
+      diskshare_close(data->share);
+    disk_stats_free(data->stats);
     free(disk_car->data);
     disk_car->data=NULL;
   }
@@ -252,6 +515,30 @@ static int cache_sync(disk_t *disk_car)
   return data->disk_car->sync(data->disk_car);
 }
 
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ decreases 0;
+  @*/
+static void cache_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct cache_struct *data=(struct cache_struct *)disk_car->data;
+  if(hint==TESTDISK_ADVISE_DONTNEED)
+  {
+    /* The data won't be read again, free the blocks inside the range */
+    struct td_list_head *walker;
+    struct td_list_head *walker_next;
+    td_list_for_each_safe(walker, walker_next, &data->lru)
+    {
+      struct cache_block_struct *block=td_list_entry(walker, struct cache_block_struct, list);
+      if(block->offset >= offset && block->offset + data->block_size <= offset + length)
+	cache_block_drop(data, block);
+    }
+  }
+  /* Let the disk below load the data asynchronously */
+  disk_advise(data->disk_car, offset, length, hint);
+}
+
 /*@
   @ requires \valid_read(CHS_source);
   @ requires \valid(CHS_dst);
@@ -302,27 +589,186 @@ static const char *cache_description_short(disk_t *disk_car)
   return tmp;
 }
 
-disk_t *new_diskcache(disk_t *disk_car, const unsigned int testdisk_mode)
+/* Resize the hash table and the memory budget */
+static void cache_set_size(struct cache_struct *data, const uint64_t cache_size)
 {
+  unsigned int hash_size=1;
+  data->max_blocks=(cache_size / data->block_size > 0x100000 ? 0x100000 :
+      (cache_size / data->block_size > 0 ? cache_size / data->block_size : 1));
+  while(hash_size < data->max_blocks)
+    hash_size*=2;
+  /* Recycle the least recently used blocks over the budget */
+  while(data->nbr_blocks > data->max_blocks)
+    cache_block_drop(data, td_list_last_entry(&data->lru, struct cache_block_struct, list));
+  if(data->hash==NULL || data->hash_mask+1 != hash_size)
+  {
+    struct td_list_head *walker;
+    free(data->hash);
+    data->hash=(struct cache_block_struct **)MALLOC(hash_size*sizeof(struct cache_block_struct *));
+    memset(data->hash, 0, hash_size*sizeof(struct cache_block_struct *));
+    data->hash_mask=hash_size-1;
+    td_list_for_each(walker, &data->lru)
+    {
+      struct cache_block_struct *block=td_list_entry(walker, struct cache_block_struct, list);
+      struct cache_block_struct **slot=cache_hash_slot(data, block->offset);
+      block->hash_next=*slot;
+      *slot=block;
+    }
+  }
+}
+
+void diskcache_set_size(disk_t *disk_car, const uint64_t cache_size)
+{
+  if(disk_car->pread!=&cache_pread)
+    return ;
+  cache_set_size((struct cache_struct *)disk_car->data, cache_size);
+}
+
+void diskcache_prefetch(disk_t *disk_car, const uint64_t offset, const unsigned int count)
+{
+  struct cache_struct *data;
+  uint64_t block_offset;
+  uint64_t end;
+  if(disk_car->pread!=&cache_pread)
+    return ;
+  data=(struct cache_struct *)disk_car->data;
+  /* Don't let the prefetched data evict itself */
+  end=offset + (count / data->block_size < data->max_blocks / 2 ? count : (uint64_t)data->max_blocks / 2 * data->block_size);
+  block_offset=offset / data->block_size * data->block_size;
+  while(block_offset < end)
+  {
+    unsigned int nbr=0;
+    if(cache_lookup(data, block_offset)!=NULL)
+    {
+      block_offset+=data->block_size;
+      continue;
+    }
+    while(block_offset + (uint64_t)nbr*data->block_size < end &&
+	cache_lookup(data, block_offset + (uint64_t)nbr*data->block_size)==NULL)
+      nbr++;
+    /* On error, let the reads that follow deal with it sector by sector */
+    if(cache_fill(data, block_offset, nbr)==NULL)
+      return ;
+    /* A block from the shared cache is copied alone */
+    block_offset+=(data->share!=NULL ? data->block_size : (uint64_t)nbr*data->block_size);
+  }
+}
+
+void diskcache_readahead_init(diskcache_readahead_t *ra)
+{
+  ra->next=0;
+  ra->ahead=0;
+  ra->window=0;
+}
+
+void diskcache_readahead(disk_t *disk_car, diskcache_readahead_t *ra, const uint64_t offset, const unsigned int count)
+{
+  const uint64_t end=offset + count;
+  if(disk_car->pread!=&cache_pread)
+    return ;
+  if(offset!=ra->next || count==0)
+  {
+    ra->next=end;
+    ra->ahead=0;
+    ra->window=0;
+    return ;
+  }
+  ra->next=end;
+  if(ra->window==0)
+    ra->window=CACHE_READAHEAD_MIN;
+  /* The current read is part of the next window */
+  if(ra->ahead < offset)
+    ra->ahead=offset;
+  /* Prefetch the next window once half of the previous one is used */
+  if(ra->ahead >= end + ra->window / 2)
+    return ;
+  diskcache_prefetch(disk_car, ra->ahead, ra->window);
+  ra->ahead+=ra->window;
+  if(ra->window < CACHE_READAHEAD_MAX)
+    ra->window*=2;
+}
+
+const disk_t *diskcache_disk(const disk_t *disk_car)
+{
+  if(disk_car->pread!=&cache_pread)
+    return disktrace_disk(disktee_disk(disk_car));
+  return disktrace_disk(disktee_disk(((const struct cache_struct *)disk_car->data)->disk_car));
+}
+
+int diskcache_save_bad_sectors(const disk_t *disk_car, const char *filename)
+{
+  const struct cache_struct *data;
+  if(disk_car->pread!=&cache_pread)
+    return 0;
+  data=(const struct cache_struct *)disk_car->data;
+  if(data->bad.nbr==0)
+  {
+    unlink(filename);
+    return 0;
+  }
+  return mapfile_save(&data->bad, filename);
+}
+
+int diskcache_load_bad_sectors(disk_t *disk_car, const char *filename)
+{
+  struct cache_struct *data;
+  mapfile_t map;
   unsigned int i;
-  struct cache_struct*data=(struct cache_struct*)MALLOC(sizeof(*data));
-  disk_t *new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
+  if(disk_car->pread!=&cache_pread)
+    return 0;
+  data=(struct cache_struct *)disk_car->data;
+  if(mapfile_load(&map, filename) < 0)
+    return -1;
+  for(i=0; i<map.nbr; i++)
+    if(map.ranges[i].status==MAPFILE_BAD_SECTOR)
+      mapfile_set(&data->bad, map.ranges[i].pos, map.ranges[i].size, MAPFILE_BAD_SECTOR);
+  log_info("%s: %llu bytes in unreadable sectors won't be read again\n",
+      filename, (long long unsigned)mapfile_size(&data->bad, MAPFILE_BAD_SECTOR));
+  mapfile_free(&map);
+  return 0;
+}
+
+disk_t *new_diskcache(disk_t *disk_car, const unsigned int testdisk_mode)
+{
+  struct cache_struct*data;
+  disk_t *new_disk_car;
+  /* A memory-mapped image is already a cache, don't copy the data twice */
+  if((disk_car->access_mode&TESTDISK_O_MMAP)!=0)
+    return disk_car;
+  data=(struct cache_struct*)MALLOC(sizeof(*data));
+  new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
   memcpy(new_disk_car,disk_car,sizeof(*new_disk_car));
   data->disk_car=disk_car;
-#ifdef DEBUG_CACHE
-  data->nbr_fnct_sect=0;
-  data->nbr_pread_sect=0;
-  data->nbr_fnct_call=0;
-  data->nbr_pread_call=0;
-#endif
-  data->cache_buffer_nbr=0;
+  data->stats=disk_stats_new("cache", disk_car->device);
   data->last_io_error_nbr=0;
   if(testdisk_mode&TESTDISK_O_READAHEAD_8K)
-    data->cache_size_min=16*512;
+    data->block_size=16*512;
   else if(testdisk_mode&TESTDISK_O_READAHEAD_32K)
-    data->cache_size_min=64*512;
+    data->block_size=64*512;
   else
-    data->cache_size_min=0;
+    data->block_size=CACHE_BLOCK_SIZE_MIN;
+  /* Blocks must be made of whole sectors */
+  if(disk_car->sector_size > 0 && data->block_size % disk_car->sector_size != 0)
+    data->block_size=(data->block_size + disk_car->sector_size - 1) / disk_car->sector_size * disk_car->sector_size;
+#ifndef DISABLED_FOR_FRAMAC
+  {
+    /* Cache whole EWF chunks, each chunk is then decompressed once */
+    const unsigned int chunk_size=fewf_get_chunk_size(disktrace_disk(disk_car));
+    if(chunk_size > data->block_size && chunk_size <= 1024*1024 &&
+	(disk_car->sector_size==0 || chunk_size % disk_car->sector_size == 0))
+      data->block_size=chunk_size;
+  }
+#endif
+  TD_INIT_LIST_HEAD(&data->lru);
+  data->hash=NULL;
+  data->hash_mask=0;
+  data->nbr_blocks=0;
+  data->io_buffer=NULL;
+  data->io_buffer_size=0;
+  mapfile_init(&data->bad, 0);
+  /* The units of the shared cache are shared by blocks of any size */
+  data->share=(data->block_size % DISKSHARE_UNIT == 0 ? diskshare_open(disk_car) : NULL);
+  cache_set_size(data, CACHE_SIZE_DEFAULT);
   dup_geometry(&new_disk_car->geom,&disk_car->geom);
   new_disk_car->disk_size=disk_car->disk_size;
   new_disk_car->disk_real_size=disk_car->disk_real_size;
@@ -332,17 +778,13 @@ disk_t *new_diskcache(disk_t *disk_car, const unsigned int testdisk_mode)
   new_disk_car->pwrite=&cache_pwrite;
   new_disk_car->sync=&cache_sync;
   new_disk_car->clean=&cache_clean;
+  new_disk_car->advise=&cache_advise;
   new_disk_car->description=&cache_description;
   new_disk_car->description_short=&cache_description_short;
   new_disk_car->rbuffer=NULL;
   new_disk_car->wbuffer=NULL;
   new_disk_car->rbuffer_size=0;
   new_disk_car->wbuffer_size=0;
-  for(i=0;i<CACHE_BUFFER_NBR;i++)
-  {
-    data->cache[i].buffer=NULL;
-    data->cache[i].buffer_size=0;
-  }
   return new_disk_car;
 }
 #endif
@@ -33,6 +33,74 @@ extern "C" {
   @*/
 disk_t *new_diskcache(disk_t *disk_car, const unsigned int cache_size_min);
 
+/* Change the memory budget of a disk returned by new_diskcache() */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+void diskcache_set_size(disk_t *disk_car, const uint64_t cache_size);
+
+/* Load count bytes from offset into the cache with large reads, so the
+ * small reads that follow don't seek. No-op for an uncached disk. */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+void diskcache_prefetch(disk_t *disk_car, const uint64_t offset, const unsigned int count);
+
+/* Read-ahead for the small reads of a filesystem library: once two
+ * reads follow each other, the data after them is prefetched by windows
+ * growing from 64 KiB to 1 MiB. Any other read resets the window. */
+typedef struct
+{
+  uint64_t next;		/* offset following the last read */
+  uint64_t ahead;		/* end of the data prefetched */
+  unsigned int window;		/* 0 until the access is sequential */
+} diskcache_readahead_t;
+
+/*@
+  @ requires \valid(ra);
+  @ assigns *ra;
+  @*/
+void diskcache_readahead_init(diskcache_readahead_t *ra);
+
+/* Called before the read of count bytes at offset */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid(ra);
+  @*/
+void diskcache_readahead(disk_t *disk_car, diskcache_readahead_t *ra, const uint64_t offset, const unsigned int count);
+
+/* A large read that fails is read again by halves to find the unreadable
+ * sectors. After nbr read errors of at least 1s, the rest of the read is
+ * marked unreadable without waiting for the drive. 0 to read every
+ * sector, 8 by default */
+void diskcache_set_slow_errors(const unsigned int nbr);
+
+/* The disk read by the cache, the disk itself if it isn't cached.
+ * An I/O trace between them is skipped */
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures  valid_disk(\result);
+  @*/
+const disk_t *diskcache_disk(const disk_t *disk_car);
+
+/* The sectors that fail to read are never read again by the cache, the
+ * list can be saved and reloaded to be kept across runs */
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_read_string(filename);
+  @*/
+int diskcache_save_bad_sectors(const disk_t *disk_car, const char *filename);
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_read_string(filename);
+  @*/
+int diskcache_load_bad_sectors(disk_t *disk_car, const char *filename);
+
 #endif
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
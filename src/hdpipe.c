@@ -0,0 +1,353 @@
+/*
+
+    File: hdpipe.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "hdcache.h"
+#include "log.h"
+#include "hdpipe.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Backtrack window by default, in MiB */
+#define PIPE_WINDOW_DEFAULT	1024
+#define PIPE_WINDOW_MIN		16
+/* The stream is read by chunks of at most PIPE_READ_SIZE bytes */
+#define PIPE_READ_SIZE		(1024*1024)
+
+/* The data of [end - window_size, end) is kept in a ring buffer, the
+ * byte at offset is at window[offset % window_size] */
+struct info_pipe_struct
+{
+  char *file_name;
+  int fd;
+  int eof;
+  unsigned char *window;
+  uint64_t window_size;
+  /* Bytes read from the stream */
+  uint64_t end;
+  /* Bytes asked for but no longer in the window */
+  uint64_t missed;
+  /* Reads refused because they were too far ahead */
+  unsigned int far_reads;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+#endif
+};
+
+extern const arch_fnct_t arch_none;
+
+/* Split pipe:size[,window],file, the window is in MiB */
+static const char *pipe_parse_name(const char *device, uint64_t *size, uint64_t *window_size)
+{
+  const char *name=device + strlen(PIPE_PREFIX);
+  char *sep;
+  *size=strtoull(name, &sep, 10);
+  *window_size=(uint64_t)PIPE_WINDOW_DEFAULT << 20;
+  if(sep==name || *sep!=',' || *size==0)
+  {
+    log_error("%s: the stream must be given as pipe:size[,window],file\n", device);
+    return NULL;
+  }
+  name=sep + 1;
+  if(*name>='0' && *name<='9')
+  {
+    const uint64_t window=strtoull(name, &sep, 10);
+    if(*sep==',')
+    {
+      if(window < PIPE_WINDOW_MIN)
+      {
+	log_error("%s: the backtrack window must be at least %u MiB\n", device, PIPE_WINDOW_MIN);
+	return NULL;
+      }
+      *window_size=window << 20;
+      name=sep + 1;
+    }
+  }
+  if(*name=='\0')
+  {
+    log_error("%s: the stream must be given as pipe:size[,window],file\n", device);
+    return NULL;
+  }
+  return name;
+}
+
+/* The keyboard must not be read from the stream: the standard input is
+ * replaced by the terminal */
+static int pipe_open_stdin(void)
+{
+  const int fd=dup(STDIN_FILENO);
+#ifdef HAVE_DUP2
+  if(fd >= 0)
+  {
+    int tty=open("/dev/tty", O_RDONLY);
+    if(tty < 0)
+      tty=open("/dev/null", O_RDONLY);
+    if(tty >= 0)
+    {
+      dup2(tty, STDIN_FILENO);
+      close(tty);
+    }
+  }
+#endif
+  return fd;
+}
+
+/* Read the stream up to upto, called with the mutex held */
+static void pipe_fill(struct info_pipe_struct *data, const uint64_t upto)
+{
+  while(data->end < upto && data->eof==0)
+  {
+    const unsigned int pos=data->end % data->window_size;
+    uint64_t size=upto - data->end;
+    ssize_t res;
+    if(size > data->window_size - pos)
+      size=data->window_size - pos;
+    if(size > PIPE_READ_SIZE)
+      size=PIPE_READ_SIZE;
+    res=read(data->fd, &data->window[pos], size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+    {
+      if(res < 0)
+	log_error("%s: read error at %llu: %s\n", data->file_name,
+	    (long long unsigned)data->end, strerror(errno));
+      else
+	log_warning("%s: end of the stream at %llu\n", data->file_name,
+	    (long long unsigned)data->end);
+      data->eof=1;
+      return ;
+    }
+    data->end+=res;
+  }
+}
+
+/* Called with the mutex held */
+static int pipe_pread_aux(struct info_pipe_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const uint64_t start=(data->end > data->window_size ? data->end - data->window_size : 0);
+  const uint64_t stop=offset + count;
+  uint64_t cur;
+  if(offset > data->end + data->window_size)
+  {
+    /* Reading the stream up to there would lose the whole window */
+    if(data->far_reads==0)
+      log_warning("%s: read at %llu refused, the stream is at %llu\n", data->file_name,
+	  (long long unsigned)offset, (long long unsigned)data->end);
+    data->far_reads++;
+    memset(buffer, 0, count);
+    return -1;
+  }
+  pipe_fill(data, stop);
+  if(offset < start)
+  {
+    /* Older than the window: zeroes */
+    const unsigned int size=(stop < start ? stop : start) - offset;
+    memset(buffer, 0, size);
+    if(data->missed==0)
+      log_warning("%s: read at %llu, the backtrack window starts at %llu\n", data->file_name,
+	  (long long unsigned)offset, (long long unsigned)start);
+    data->missed+=size;
+    cur=offset + size;
+  }
+  else
+    cur=offset;
+  while(cur < stop && cur < data->end)
+  {
+    const unsigned int pos=cur % data->window_size;
+    uint64_t size=(stop < data->end ? stop : data->end) - cur;
+    if(size > data->window_size - pos)
+      size=data->window_size - pos;
+    memcpy(&buffer[cur - offset], &data->window[pos], size);
+    cur+=size;
+  }
+  if(cur < stop)
+    memset(&buffer[cur - offset], 0, stop - cur);
+  if(offset < start)
+    return -1;
+  return cur - offset;
+}
+
+static int fpipe_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_pipe_struct *data=(struct info_pipe_struct *)disk->data;
+  unsigned int size=count;
+  int res;
+  if(offset >= disk->disk_real_size)
+    return 0;
+  if(size > disk->disk_real_size - offset)
+    size=disk->disk_real_size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+#endif
+  res=pipe_pread_aux(data, (unsigned char *)buffer, size, offset);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->mutex);
+#endif
+  if(res < 0)
+    errno=EIO;
+  return res;
+}
+
+static int fpipe_pwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  errno=EROFS;
+  return -1;
+}
+
+static int fpipe_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fpipe_description(disk_t *disk)
+{
+  const struct info_pipe_struct *data=(const struct info_pipe_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"Stream %s - %s - CHS %lu %u %u (RO)",
+      data->file_name, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *fpipe_description_short(disk_t *disk)
+{
+  const struct info_pipe_struct *data=(const struct info_pipe_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"Stream %s - %s (RO)",
+      data->file_name, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void fpipe_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    struct info_pipe_struct *data=(struct info_pipe_struct *)disk->data;
+    log_info("%s: %llu bytes read from the stream, %llu bytes no longer in the backtrack window, %u reads too far ahead\n",
+	data->file_name, (long long unsigned)data->end,
+	(long long unsigned)data->missed, data->far_reads);
+    close(data->fd);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&data->mutex);
+#endif
+    free(data->window);
+    free(data->file_name);
+    free(data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+disk_t *fpipe_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_pipe_struct *data;
+  disk_t *disk;
+  uint64_t size;
+  uint64_t window_size;
+  const char *file_name=pipe_parse_name(device, &size, &window_size);
+  if(file_name==NULL)
+  {
+    errno=EINVAL;
+    return NULL;
+  }
+  data=(struct info_pipe_struct *)MALLOC(sizeof(*data));
+  /* Not from MALLOC(): the pages are only used once the stream is read */
+  data->window=(unsigned char *)malloc(window_size);
+  if(data->window==NULL)
+  {
+    log_error("%s: can't allocate a backtrack window of %llu MiB\n", device,
+	(long long unsigned)(window_size >> 20));
+    free(data);
+    errno=ENOMEM;
+    return NULL;
+  }
+  data->fd=(strcmp(file_name, "-")==0 ? pipe_open_stdin() : open(file_name, O_RDONLY|O_BINARY));
+  if(data->fd < 0)
+  {
+    free(data->window);
+    free(data);
+    return NULL;
+  }
+  data->file_name=strdup(strcmp(file_name, "-")==0 ? "stdin" : file_name);
+  data->window_size=window_size;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->mutex, NULL);
+#endif
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  disk->data=data;
+  disk->description=&fpipe_description;
+  disk->description_short=&fpipe_description_short;
+  disk->pread=&fpipe_pread;
+  disk->pwrite=&fpipe_pwrite;
+  disk->sync=&fpipe_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fpipe_clean;
+  disk->sector_size=DEFAULT_SECTOR_SIZE;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=(size + disk->sector_size - 1) / disk->sector_size * disk->sector_size;
+  update_disk_car_fields(disk);
+  log_info("%s: %llu bytes, backtrack window of %llu MiB\n", device,
+      (long long unsigned)size, (long long unsigned)(window_size >> 20));
+  return disk;
+}
+
+int disk_is_pipe(const disk_t *disk)
+{
+  return (diskcache_disk(disk)->pread==&fpipe_pread ? 1 : 0);
+}
+#endif
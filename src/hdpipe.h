@@ -0,0 +1,56 @@
+/*
+
+    File: hdpipe.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDPIPE_H
+#define _HDPIPE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a stream read sequentially, - for the standard input:
+ * pipe:size[,window],file with size in bytes and the backtrack window
+ * in MiB */
+#define PIPE_PREFIX "pipe:"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* The stream is read only once, the last window of data is kept in
+ * memory. A read before the window gets zeroes and fails, a read more
+ * than a window ahead fails without reading the stream */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fpipe_init(const char *device, const int verbose, const int testdisk_mode);
+
+/* 1 if the disk, or the disk below the cache, is a stream: it must be
+ * scanned in a single sequential pass */
+/*@
+  @ requires \valid_read(disk);
+  @ requires valid_disk(disk);
+  @ assigns \nothing;
+  @*/
+int disk_is_pipe(const disk_t *disk);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
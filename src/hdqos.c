@@ -0,0 +1,299 @@
+/*
+
+    File: hdqos.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* sleep */
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#if defined(__MINGW32__)
+#include <windows.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "hdstats.h"
+#include "hdqos.h"
+#include "log.h"
+
+#define QOS_CHUNK_MIN	(64*1024)
+#define QOS_CHUNK_START	(256*1024)
+#define QOS_CHUNK_MAX	(4*1024*1024)
+/* Pause between two chunks, in ns */
+#define QOS_PAUSE_MIN	1000000
+#define QOS_PAUSE_MAX	1000000000
+/* Weight of the last chunk in the moving average: 1/QOS_EWMA */
+#define QOS_EWMA	8
+
+static unsigned int qos_target_us=0;
+
+struct qos_struct
+{
+  disk_t *disk_car;
+  disk_stats_t *stats;
+  unsigned int chunk;
+  unsigned int chunk_low;	/* smallest chunk size used */
+  uint64_t pause;
+  uint64_t latency;		/* moving average, in ns */
+  uint64_t nbr_chunks;
+  uint64_t nbr_backoffs;
+  uint64_t paused;		/* total of the pauses, in ns */
+};
+
+void diskqos_set_target(const unsigned int target_us)
+{
+  qos_target_us=target_us;
+}
+
+unsigned int diskqos_target(void)
+{
+  return qos_target_us;
+}
+
+static void qos_sleep(const uint64_t ns)
+{
+#if defined(__MINGW32__)
+  Sleep(ns / 1000000);
+#elif defined(HAVE_NANOSLEEP)
+  struct timespec ts;
+  ts.tv_sec=ns / 1000000000;
+  ts.tv_nsec=ns % 1000000000;
+  while(nanosleep(&ts, &ts) < 0 && errno==EINTR);
+#elif defined(HAVE_SLEEP)
+  if(ns >= 1000000000)
+    sleep(ns / 1000000000);
+#endif
+}
+
+static void qos_update(struct qos_struct *data, const uint64_t latency, const uint64_t target)
+{
+  /* A burst of foreground I/O doesn't wait for the average */
+  if(latency >= 4 * target)
+    data->latency=latency;
+  else
+    data->latency=(data->latency * (QOS_EWMA - 1) + latency) / QOS_EWMA;
+  if(data->latency > target)
+  {
+    data->chunk=(data->chunk / 2 > QOS_CHUNK_MIN ? data->chunk / 2 : QOS_CHUNK_MIN);
+    if(data->chunk_low > data->chunk)
+      data->chunk_low=data->chunk;
+    data->pause=(data->pause * 2 < QOS_PAUSE_MIN ? QOS_PAUSE_MIN :
+	data->pause * 2 > QOS_PAUSE_MAX ? QOS_PAUSE_MAX : data->pause * 2);
+    data->nbr_backoffs++;
+    /* The next decision is made on new chunks */
+    data->latency=target;
+  }
+  else if(data->latency < target / 2)
+  {
+    /* The pause goes first, then the chunk size */
+    data->pause/=2;
+    if(data->pause < QOS_PAUSE_MIN)
+      data->pause=0;
+    if(data->pause==0 && data->chunk < QOS_CHUNK_MAX)
+    {
+      const unsigned int step=(data->chunk / 4 > QOS_CHUNK_MIN ? data->chunk / 4 / QOS_CHUNK_MIN * QOS_CHUNK_MIN : QOS_CHUNK_MIN);
+      data->chunk=(data->chunk + step < QOS_CHUNK_MAX ? data->chunk + step : QOS_CHUNK_MAX);
+    }
+  }
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (char *)buffer + (0 .. count-1));
+  @*/
+static int qos_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct qos_struct *data=(struct qos_struct *)disk_car->data;
+  const uint64_t target=(uint64_t)qos_target_us * 1000;
+  unsigned int done=0;
+  if(target==0)
+    return data->disk_car->pread(data->disk_car, buffer, count, offset);
+  while(done < count)
+  {
+    const unsigned int size=(count - done < data->chunk ? count - done : data->chunk);
+    uint64_t start;
+    int res;
+    int saved_errno;
+    if(data->pause > 0)
+    {
+      qos_sleep(data->pause);
+      data->paused+=data->pause;
+    }
+    start=disk_stats_clock();
+    res=data->disk_car->pread(data->disk_car, (char *)buffer + done, size, offset + done);
+    saved_errno=errno;
+    disk_stats_read(data->stats, size, res, start);
+    qos_update(data, disk_stats_clock() - start, target);
+    data->nbr_chunks++;
+    if(res <= 0)
+    {
+      errno=saved_errno;
+      return (done > 0 ? (int)done : res);
+    }
+    done+=res;
+    if((unsigned int)res < size)
+      break;
+  }
+  return done;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid_read((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (const char *)buffer + (0 .. count-1));
+  @*/
+static int qos_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct qos_struct *data=(struct qos_struct *)disk_car->data;
+  disk_car->write_used=1;
+  return data->disk_car->pwrite(data->disk_car, buffer, count, offset);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @*/
+static int qos_sync(disk_t *disk_car)
+{
+  struct qos_struct *data=(struct qos_struct *)disk_car->data;
+  return data->disk_car->sync(data->disk_car);
+}
+
+/* While throttled, the read-ahead would load the data behind the back
+ * of the throttling: it's not asked for */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void qos_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct qos_struct *data=(struct qos_struct *)disk_car->data;
+  if(hint==TESTDISK_ADVISE_WILLNEED && qos_target_us > 0 && data->pause > 0)
+    return ;
+  disk_advise(data->disk_car, offset, length, hint);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void qos_clean(disk_t *disk_car)
+{
+  if(disk_car->data)
+  {
+    struct qos_struct *data=(struct qos_struct *)disk_car->data;
+    if(data->nbr_chunks > 0)
+      log_info("%s: %llu throttled reads, %llu back-offs, %llu ms of pauses, reads down to %u KiB\n",
+	  data->disk_car->description_short(data->disk_car),
+	  (long long unsigned)data->nbr_chunks, (long long unsigned)data->nbr_backoffs,
+	  (long long unsigned)(data->paused / 1000000), data->chunk_low / 1024);
+    data->disk_car->clean(data->disk_car);
+    disk_stats_free(data->stats);
+    free(disk_car->data);
+    disk_car->data=NULL;
+  }
+  free(disk_car);
+}
+
+static void qos_sync_description(disk_t *disk_car)
+{
+  const struct qos_struct *data=(const struct qos_struct *)disk_car->data;
+  data->disk_car->geom.cylinders=disk_car->geom.cylinders;
+  data->disk_car->geom.heads_per_cylinder=disk_car->geom.heads_per_cylinder;
+  data->disk_car->geom.sectors_per_head=disk_car->geom.sectors_per_head;
+  data->disk_car->disk_size=disk_car->disk_size;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *qos_description(disk_t *disk_car)
+{
+  const struct qos_struct *data=(const struct qos_struct *)disk_car->data;
+  qos_sync_description(disk_car);
+  return data->disk_car->description(data->disk_car);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *qos_description_short(disk_t *disk_car)
+{
+  const struct qos_struct *data=(const struct qos_struct *)disk_car->data;
+  qos_sync_description(disk_car);
+  return data->disk_car->description_short(data->disk_car);
+}
+
+disk_t *new_diskqos(disk_t *disk_car)
+{
+  struct qos_struct *data;
+  disk_t *new_disk_car;
+  if(disk_car->pread==&qos_pread)
+    return disk_car;
+  data=(struct qos_struct *)MALLOC(sizeof(*data));
+  data->disk_car=disk_car;
+  data->stats=disk_stats_new("qos", disk_car->device);
+  data->chunk=QOS_CHUNK_START;
+  data->chunk_low=QOS_CHUNK_START;
+  data->pause=0;
+  data->latency=0;
+  data->nbr_chunks=0;
+  data->nbr_backoffs=0;
+  data->paused=0;
+  new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
+  memcpy(new_disk_car, disk_car, sizeof(*new_disk_car));
+  new_disk_car->write_used=0;
+  new_disk_car->data=data;
+  new_disk_car->pread=&qos_pread;
+  new_disk_car->pwrite=&qos_pwrite;
+  new_disk_car->sync=&qos_sync;
+  new_disk_car->clean=&qos_clean;
+  new_disk_car->advise=&qos_advise;
+  new_disk_car->description=&qos_description;
+  new_disk_car->description_short=&qos_description_short;
+  new_disk_car->rbuffer=NULL;
+  new_disk_car->wbuffer=NULL;
+  new_disk_car->rbuffer_size=0;
+  new_disk_car->wbuffer_size=0;
+  log_info("%s: reads throttled to a latency of %u us\n",
+      disk_car->description_short(disk_car), qos_target_us);
+  return new_disk_car;
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+
+    File: hdqos.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDQOS_H
+#define _HDQOS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Reads throttled to keep the latency of the device under a target, for
+ * a disk still in use: each read is split in chunks, the moving average
+ * of the chunk latency drives the chunk size and a pause between the
+ * chunks. Above the target, the chunk size is halved and the pause
+ * doubled; below half the target, the pause is halved and the chunk size
+ * grows again, an idle disk is read at full speed. A single chunk four
+ * times slower than the target, a burst of foreground I/O, is enough to
+ * back off. The chunk latencies are accounted in the "qos" layer of
+ * the I/O statistics.
+ * Stack it below new_diskcache(), the cached data isn't throttled */
+
+/* Latency target in microseconds for every throttled disk, 0 to read at
+ * full speed. It can be changed while reading */
+void diskqos_set_target(const unsigned int target_us);
+
+unsigned int diskqos_target(void);
+
+/* Return the disk itself if it's already throttled */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures \valid(\result);
+  @*/
+disk_t *new_diskqos(disk_t *disk_car);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,466 @@
+/*
+
+    File: hdshare.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_FILE_H
+#include <sys/file.h>	/* flock */
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "log.h"
+#include "hdshare.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_FTRUNCATE) && \
+  defined(HAVE_FLOCK) && defined(HAVE_SYS_FILE_H) && defined(HAVE_SYS_STAT_H) && \
+  defined(HAVE_FCNTL_H) && defined(__ATOMIC_ACQUIRE) && \
+  !defined(__CYGWIN__) && !defined(__MINGW32__)
+#define DISKSHARE_ENABLED
+#endif
+
+static uint64_t share_size=0;
+
+void diskshare_set_size(const uint64_t size)
+{
+  share_size=size;
+}
+
+uint64_t diskshare_size(void)
+{
+  return share_size;
+}
+
+#ifdef DISKSHARE_ENABLED
+#define DISKSHARE_MAGIC	0x53445448	/* "HTDS" */
+#define DISKSHARE_DIR	"/dev/shm"
+
+struct diskshare_header
+{
+  uint32_t magic;
+  uint32_t unit;
+  uint64_t nbr_slots;
+  uint64_t disk_size;
+};
+
+/* seq is odd while the slot is written, key is the unit number plus 1 */
+struct diskshare_slot
+{
+  uint64_t seq;
+  uint64_t key;
+  uint32_t status;
+  uint32_t reserved;
+};
+
+struct diskshare_struct
+{
+  char *path;
+  int handle;
+  unsigned char *map;
+  size_t map_size;
+  struct diskshare_slot *slots;
+  unsigned char *units;
+  uint64_t nbr_slots;
+  uint64_t hits;
+  uint64_t puts;
+};
+
+/* The slots are followed by the units, page-aligned */
+static size_t share_units_offset(const uint64_t nbr_slots)
+{
+  const size_t size=sizeof(struct diskshare_header) + nbr_slots * sizeof(struct diskshare_slot);
+  return (size + 4095) / 4096 * 4096;
+}
+
+/* The segment is named after the source, not after the path used to
+ * open it: two names of the same device share their data */
+static int share_path(const disk_t *disk_car, char *path, const unsigned int path_size)
+{
+  struct stat stat_buf;
+  const char *dir=DISKSHARE_DIR;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t mtime;
+  if(stat(disk_car->device, &stat_buf) < 0)
+    return -1;
+  if(S_ISBLK(stat_buf.st_mode) || S_ISCHR(stat_buf.st_mode))
+  {
+    dev=stat_buf.st_rdev;
+    ino=0;
+    mtime=0;
+  }
+  else if(S_ISREG(stat_buf.st_mode))
+  {
+    /* An image modified since the segment was filled is another source */
+    dev=stat_buf.st_dev;
+    ino=stat_buf.st_ino;
+    mtime=stat_buf.st_mtime;
+  }
+  else
+    return -1;
+  if(stat(dir, &stat_buf) < 0 || !S_ISDIR(stat_buf.st_mode))
+  {
+    dir=getenv("TMPDIR");
+    if(dir==NULL || dir[0]=='\0')
+      dir="/tmp";
+  }
+  if(snprintf(path, path_size, "%s/testdisk-cache-%lu-%llx-%llx-%llx-%llx", dir,
+#ifdef HAVE_GETEUID
+	(unsigned long)geteuid(),
+#else
+	0UL,
+#endif
+	(long long unsigned)dev, (long long unsigned)ino,
+	(long long unsigned)mtime, (long long unsigned)disk_car->disk_real_size) >= (int)path_size)
+    return -1;
+  return 0;
+}
+
+static int share_map(diskshare_t *share, const size_t size)
+{
+  void *map=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, share->handle, 0);
+  if(map==MAP_FAILED)
+    return -1;
+  share->map=(unsigned char *)map;
+  share->map_size=size;
+  return 0;
+}
+
+static void share_set_layout(diskshare_t *share, const uint64_t nbr_slots)
+{
+  share->nbr_slots=nbr_slots;
+  share->slots=(struct diskshare_slot *)(share->map + sizeof(struct diskshare_header));
+  share->units=share->map + share_units_offset(nbr_slots);
+}
+
+/* Create the segment under a name of its own then link it in place, a
+ * process never sees a segment not initialized yet */
+static diskshare_t *share_create(const disk_t *disk_car, const char *path)
+{
+  char tmp[4096];
+  diskshare_t *share;
+  struct diskshare_header *header;
+  uint64_t nbr_slots=share_size / DISKSHARE_UNIT;
+  size_t size;
+  if(nbr_slots==0)
+    nbr_slots=1;
+  size=share_units_offset(nbr_slots) + nbr_slots * DISKSHARE_UNIT;
+  if(snprintf(tmp, sizeof(tmp), "%s.%lu", path, (unsigned long)getpid()) >= (int)sizeof(tmp))
+    return NULL;
+  share=(diskshare_t *)MALLOC(sizeof(*share));
+  memset(share, 0, sizeof(*share));
+  share->handle=open(tmp, O_RDWR|O_CREAT|O_EXCL, 0600);
+  if(share->handle < 0)
+  {
+    free(share);
+    return NULL;
+  }
+  if(flock(share->handle, LOCK_SH|LOCK_NB) < 0 ||
+      ftruncate(share->handle, size) < 0 ||
+      share_map(share, size) < 0)
+  {
+    log_warning("%s: cannot create the shared cache, %s\n", tmp, strerror(errno));
+    close(share->handle);
+    unlink(tmp);
+    free(share);
+    return NULL;
+  }
+  header=(struct diskshare_header *)share->map;
+  header->unit=DISKSHARE_UNIT;
+  header->nbr_slots=nbr_slots;
+  header->disk_size=disk_car->disk_real_size;
+  header->magic=DISKSHARE_MAGIC;
+  share_set_layout(share, nbr_slots);
+  if(link(tmp, path) < 0)
+  {
+    /* Another process has been faster */
+    munmap(share->map, share->map_size);
+    close(share->handle);
+    unlink(tmp);
+    free(share);
+    errno=EEXIST;
+    return NULL;
+  }
+  unlink(tmp);
+  share->path=strdup(path);
+  log_info("%s: shared cache of %llu KiB created\n", path,
+      (long long unsigned)(nbr_slots * DISKSHARE_UNIT / 1024));
+  return share;
+}
+
+static diskshare_t *share_attach(const disk_t *disk_car, const char *path, const int handle)
+{
+  diskshare_t *share;
+  const struct diskshare_header *header;
+  struct stat stat_buf;
+  if(fstat(handle, &stat_buf) < 0 ||
+      (uint64_t)stat_buf.st_size < share_units_offset(1) + DISKSHARE_UNIT)
+    return NULL;
+  share=(diskshare_t *)MALLOC(sizeof(*share));
+  memset(share, 0, sizeof(*share));
+  share->handle=handle;
+  if(share_map(share, stat_buf.st_size) < 0)
+  {
+    free(share);
+    return NULL;
+  }
+  /* The size of the segment is the one chosen by its creator */
+  header=(const struct diskshare_header *)share->map;
+  if(header->magic!=DISKSHARE_MAGIC || header->unit!=DISKSHARE_UNIT ||
+      header->disk_size!=disk_car->disk_real_size || header->nbr_slots==0 ||
+      share_units_offset(header->nbr_slots) + header->nbr_slots * DISKSHARE_UNIT != (uint64_t)stat_buf.st_size)
+  {
+    log_warning("%s: not a shared cache for %s\n", path, disk_car->device);
+    munmap(share->map, share->map_size);
+    free(share);
+    return NULL;
+  }
+  share_set_layout(share, header->nbr_slots);
+  share->path=strdup(path);
+  log_info("%s: shared cache of %llu KiB used\n", path,
+      (long long unsigned)(share->nbr_slots * DISKSHARE_UNIT / 1024));
+  return share;
+}
+
+diskshare_t *diskshare_open(const disk_t *disk_car)
+{
+  char path[4096];
+  unsigned int i;
+  if(share_size==0 || disk_car->disk_real_size==0 ||
+      share_path(disk_car, path, sizeof(path)) < 0)
+    return NULL;
+  for(i=0; i<8; i++)
+  {
+    const int handle=open(path, O_RDWR);
+    if(handle >= 0)
+    {
+      diskshare_t *share;
+      /* Every process using the segment holds a shared lock */
+      if(flock(handle, LOCK_EX|LOCK_NB)==0)
+      {
+	/* Left by a process that has crashed or being removed */
+	unlink(path);
+	close(handle);
+	continue;
+      }
+      if(flock(handle, LOCK_SH|LOCK_NB) < 0)
+      {
+	close(handle);
+	continue;
+      }
+      share=share_attach(disk_car, path, handle);
+      if(share==NULL)
+	close(handle);
+      return share;
+    }
+    if(errno!=ENOENT)
+      return NULL;
+    {
+      diskshare_t *share=share_create(disk_car, path);
+      if(share!=NULL || errno!=EEXIST)
+	return share;
+    }
+  }
+  return NULL;
+}
+
+static struct diskshare_slot *share_slot(const diskshare_t *share, const uint64_t key)
+{
+  return &share->slots[(key - 1) % share->nbr_slots];
+}
+
+static unsigned char *share_unit(const diskshare_t *share, const struct diskshare_slot *slot)
+{
+  return share->units + (size_t)(slot - share->slots) * DISKSHARE_UNIT;
+}
+
+int diskshare_get(diskshare_t *share, const uint64_t offset, unsigned char *buffer)
+{
+  const uint64_t key=offset / DISKSHARE_UNIT + 1;
+  struct diskshare_slot *slot=share_slot(share, key);
+  const uint64_t seq=__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  unsigned int status;
+  if((seq&1)!=0 || __atomic_load_n(&slot->key, __ATOMIC_RELAXED)!=key)
+    return -1;
+  status=__atomic_load_n(&slot->status, __ATOMIC_RELAXED);
+  if(status > DISKSHARE_UNIT)
+    return -1;
+  memcpy(buffer, share_unit(share, slot), status);
+  /* The unit may have been replaced while it was copied */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED)!=seq)
+    return -1;
+  share->hits++;
+  return status;
+}
+
+int diskshare_has(const diskshare_t *share, const uint64_t offset)
+{
+  const uint64_t key=offset / DISKSHARE_UNIT + 1;
+  const struct diskshare_slot *slot=share_slot(share, key);
+  return (__atomic_load_n(&slot->key, __ATOMIC_RELAXED)==key);
+}
+
+/* Return 0 if another process is writing the slot */
+static int share_slot_lock(struct diskshare_slot *slot, uint64_t *seq)
+{
+  *seq=__atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+  if((*seq&1)!=0)
+    return 0;
+  return __atomic_compare_exchange_n(&slot->seq, seq, *seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void diskshare_put(diskshare_t *share, const uint64_t offset, const unsigned char *buffer, const unsigned int size)
+{
+  const uint64_t key=offset / DISKSHARE_UNIT + 1;
+  struct diskshare_slot *slot=share_slot(share, key);
+  uint64_t seq;
+  if(size==0 || size > DISKSHARE_UNIT)
+    return ;
+  /* Already there, read by another process */
+  if(__atomic_load_n(&slot->key, __ATOMIC_RELAXED)==key &&
+      __atomic_load_n(&slot->status, __ATOMIC_RELAXED) >= size)
+    return ;
+  if(share_slot_lock(slot, &seq)==0)
+    return ;
+  __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->status, size, __ATOMIC_RELAXED);
+  memcpy(share_unit(share, slot), buffer, size);
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  share->puts++;
+}
+
+void diskshare_invalidate(diskshare_t *share, const uint64_t offset, const uint64_t count)
+{
+  uint64_t key;
+  for(key=offset / DISKSHARE_UNIT + 1;
+      key <= (offset + count + DISKSHARE_UNIT - 1) / DISKSHARE_UNIT && key - (offset / DISKSHARE_UNIT + 1) < share->nbr_slots;
+      key++)
+  {
+    struct diskshare_slot *slot=share_slot(share, key);
+    uint64_t seq;
+    unsigned int tries;
+    if(__atomic_load_n(&slot->key, __ATOMIC_RELAXED)!=key)
+      continue;
+    /* Wait for the process writing the slot, it may write this unit.
+     * A slot left odd by a process that has crashed is never read */
+    for(tries=0; tries<1000 && share_slot_lock(slot, &seq)==0; tries++)
+    {
+#ifdef HAVE_NANOSLEEP
+      struct timespec ts;
+      ts.tv_sec=0;
+      ts.tv_nsec=1000;
+      nanosleep(&ts, NULL);
+#endif
+    }
+    if(tries==1000)
+      continue;
+    __atomic_store_n(&slot->key, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+  }
+}
+
+void diskshare_close(diskshare_t *share)
+{
+  log_info("shared cache: %llu units read, %llu units added\n",
+      (long long unsigned)share->hits, (long long unsigned)share->puts);
+  munmap(share->map, share->map_size);
+  /* The last process removes the segment. The name may already be used
+   * by a new segment, only remove the one that was used */
+  if(flock(share->handle, LOCK_EX|LOCK_NB)==0)
+  {
+    struct stat stat_fd;
+    struct stat stat_path;
+    if(fstat(share->handle, &stat_fd)==0 && stat(share->path, &stat_path)==0 &&
+	stat_fd.st_dev==stat_path.st_dev && stat_fd.st_ino==stat_path.st_ino)
+      unlink(share->path);
+  }
+  close(share->handle);
+  free(share->path);
+  free(share);
+}
+#else
+diskshare_t *diskshare_open(const disk_t *disk_car)
+{
+  (void)disk_car;
+  return NULL;
+}
+
+int diskshare_get(diskshare_t *share, const uint64_t offset, unsigned char *buffer)
+{
+  (void)share;
+  (void)offset;
+  (void)buffer;
+  return -1;
+}
+
+int diskshare_has(const diskshare_t *share, const uint64_t offset)
+{
+  (void)share;
+  (void)offset;
+  return 0;
+}
+
+void diskshare_put(diskshare_t *share, const uint64_t offset, const unsigned char *buffer, const unsigned int size)
+{
+  (void)share;
+  (void)offset;
+  (void)buffer;
+  (void)size;
+}
+
+void diskshare_invalidate(diskshare_t *share, const uint64_t offset, const uint64_t count)
+{
+  (void)share;
+  (void)offset;
+  (void)count;
+}
+
+void diskshare_close(diskshare_t *share)
+{
+  (void)share;
+}
+#endif
+#endif
@@ -0,0 +1,91 @@
+/*
+
+    File: hdshare.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDSHARE_H
+#define _HDSHARE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Block cache shared by the processes reading the same device or image:
+ * a segment in /dev/shm named after the identity of the source, the
+ * device number or the inode and modification time of an image, holds
+ * 8 KiB units indexed by their offset. Each slot is protected by a
+ * sequence counter, a reader copies the unit and checks the counter
+ * didn't change, no lock is taken. The segment is removed by the last
+ * process using it; one left by a process that has crashed is recreated.
+ * new_diskcache() looks up the units there before reading the disk and
+ * adds the ones it reads. */
+#define DISKSHARE_UNIT	8192
+
+typedef struct diskshare_struct diskshare_t;
+
+/* Size of the segment, 0 to disable it (default) */
+void diskshare_set_size(const uint64_t size);
+
+uint64_t diskshare_size(void);
+
+/* NULL if sharing is disabled or not possible for this disk */
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+diskshare_t *diskshare_open(const disk_t *disk_car);
+
+/* Copy the unit at offset, return the number of bytes available in it
+ * or -1 if it isn't in the segment.
+ * offset must be a multiple of DISKSHARE_UNIT */
+/*@
+  @ requires \valid(share);
+  @ requires \valid(buffer + (0 .. DISKSHARE_UNIT-1));
+  @*/
+int diskshare_get(diskshare_t *share, const uint64_t offset, unsigned char *buffer);
+
+/* Test if the unit at offset is in the segment, without copying it */
+/*@
+  @ requires \valid_read(share);
+  @*/
+int diskshare_has(const diskshare_t *share, const uint64_t offset);
+
+/* size bytes read from offset, up to DISKSHARE_UNIT */
+/*@
+  @ requires \valid(share);
+  @ requires \valid_read(buffer + (0 .. size-1));
+  @*/
+void diskshare_put(diskshare_t *share, const uint64_t offset, const unsigned char *buffer, const unsigned int size);
+
+/* The data from offset has been written, forget it */
+/*@
+  @ requires \valid(share);
+  @*/
+void diskshare_invalidate(diskshare_t *share, const uint64_t offset, const uint64_t count);
+
+/*@
+  @ requires \valid(share);
+  @*/
+void diskshare_close(diskshare_t *share);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,334 @@
+/*
+
+    File: hdstats.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stddef.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* unlink */
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "hdstats.h"
+#include "log.h"
+
+/* 8 buckets per power of two, 12.5% precision */
+#define DISK_STATS_SUB_BITS	3
+#define DISK_STATS_BUCKETS	((64 - DISK_STATS_SUB_BITS + 1) << DISK_STATS_SUB_BITS)
+
+struct disk_stats_struct
+{
+  struct td_list_head list;
+  char layer[16];
+  char device[DISKNAME_MAX];
+  uint64_t nbr_reads;
+  uint64_t bytes;
+  uint64_t nbr_errors;
+  uint64_t nbr_retries;
+  uint64_t nbr_hits;
+  uint64_t nbr_misses;
+  uint64_t latency_total;
+  uint64_t latency_max;
+  uint64_t histogram[DISK_STATS_BUCKETS];
+};
+
+static TD_LIST_HEAD(disk_stats_list);
+static char *prometheus_filename=NULL;
+static uint64_t prometheus_interval=0;
+static uint64_t prometheus_next=0;
+
+uint64_t disk_stats_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if(clock_gettime(CLOCK_MONOTONIC, &ts)==0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return (uint64_t)time(NULL) * 1000000000;
+}
+
+/* Log-linear buckets: the power of two, then DISK_STATS_SUB_BITS bits */
+static unsigned int stats_bucket(const uint64_t value)
+{
+  unsigned int e=DISK_STATS_SUB_BITS;
+  if(value < (1 << DISK_STATS_SUB_BITS))
+    return value;
+  while(e < 63 && (value >> (e + 1))!=0)
+    e++;
+  return ((e - DISK_STATS_SUB_BITS + 1) << DISK_STATS_SUB_BITS) +
+    ((value >> (e - DISK_STATS_SUB_BITS)) & ((1 << DISK_STATS_SUB_BITS) - 1));
+}
+
+/* Highest value of a bucket */
+static uint64_t stats_bucket_max(const unsigned int bucket)
+{
+  const unsigned int sub=bucket & ((1 << DISK_STATS_SUB_BITS) - 1);
+  unsigned int shift;
+  if(bucket < (1 << DISK_STATS_SUB_BITS))
+    return bucket;
+  shift=(bucket >> DISK_STATS_SUB_BITS) - 1;
+  return ((((uint64_t)1 << DISK_STATS_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+static uint64_t stats_percentile(const disk_stats_t *stats, const unsigned int percent)
+{
+  const uint64_t rank=(stats->nbr_reads * percent + 99) / 100;
+  uint64_t nbr=0;
+  unsigned int i;
+  if(stats->nbr_reads==0)
+    return 0;
+  for(i=0; i<DISK_STATS_BUCKETS; i++)
+  {
+    nbr+=stats->histogram[i];
+    if(nbr >= rank)
+    {
+      const uint64_t value=stats_bucket_max(i);
+      return (value < stats->latency_max ? value : stats->latency_max);
+    }
+  }
+  return stats->latency_max;
+}
+
+disk_stats_t *disk_stats_new(const char *layer, const char *device)
+{
+  disk_stats_t *stats=(disk_stats_t *)MALLOC(sizeof(*stats));
+  memset(stats, 0, sizeof(*stats));
+  strncpy(stats->layer, layer, sizeof(stats->layer) - 1);
+  strncpy(stats->device, device, sizeof(stats->device) - 1);
+  td_list_add_tail(&stats->list, &disk_stats_list);
+  return stats;
+}
+
+void disk_stats_free(disk_stats_t *stats)
+{
+  if(stats==NULL)
+    return ;
+  td_list_del(&stats->list);
+  free(stats);
+}
+
+void disk_stats_read(disk_stats_t *stats, const unsigned int count, const int res, const uint64_t start)
+{
+  uint64_t now;
+  uint64_t latency;
+  if(stats==NULL)
+    return ;
+  now=disk_stats_clock();
+  latency=now - start;
+  stats->nbr_reads++;
+  if(res > 0)
+    stats->bytes+=res;
+  if(res < 0 || (unsigned int)res < count)
+    stats->nbr_errors++;
+  stats->latency_total+=latency;
+  if(stats->latency_max < latency)
+    stats->latency_max=latency;
+  stats->histogram[stats_bucket(latency)]++;
+  if(prometheus_filename!=NULL && now >= prometheus_next)
+  {
+    prometheus_next=now + prometheus_interval;
+    disk_stats_save_prometheus(prometheus_filename);
+  }
+}
+
+void disk_stats_hit(disk_stats_t *stats)
+{
+  stats->nbr_hits++;
+}
+
+void disk_stats_miss(disk_stats_t *stats)
+{
+  stats->nbr_misses++;
+}
+
+void disk_stats_retry(disk_stats_t *stats)
+{
+  stats->nbr_retries++;
+}
+
+static void stats_summary(disk_stats_summary_t *summary, const disk_stats_t *stats)
+{
+  summary->layer=stats->layer;
+  summary->device=stats->device;
+  summary->nbr_reads=stats->nbr_reads;
+  summary->bytes=stats->bytes;
+  summary->nbr_errors=stats->nbr_errors;
+  summary->nbr_retries=stats->nbr_retries;
+  summary->nbr_hits=stats->nbr_hits;
+  summary->nbr_misses=stats->nbr_misses;
+  summary->latency_total=stats->latency_total;
+  summary->latency_p50=stats_percentile(stats, 50);
+  summary->latency_p90=stats_percentile(stats, 90);
+  summary->latency_p99=stats_percentile(stats, 99);
+  summary->latency_max=stats->latency_max;
+}
+
+unsigned int disk_stats_get(disk_stats_summary_t *summaries, const unsigned int max)
+{
+  const struct td_list_head *walker;
+  unsigned int nbr=0;
+  td_list_for_each(walker, &disk_stats_list)
+  {
+    const disk_stats_t *stats=td_list_entry_const(walker, const disk_stats_t, list);
+    if(nbr < max)
+      stats_summary(&summaries[nbr], stats);
+    nbr++;
+  }
+  return nbr;
+}
+
+void disk_stats_log_all(void)
+{
+  const struct td_list_head *walker;
+  td_list_for_each(walker, &disk_stats_list)
+  {
+    const disk_stats_t *stats=td_list_entry_const(walker, const disk_stats_t, list);
+    disk_stats_summary_t summary;
+    if(stats->nbr_reads==0)
+      continue;
+    stats_summary(&summary, stats);
+    log_info("I/O %s %s: %llu reads, %llu bytes, %llu errors, %llu retries, latency p50 %lluus p90 %lluus p99 %lluus max %lluus, %.1f MB/s",
+	summary.layer, summary.device,
+	(long long unsigned)summary.nbr_reads, (long long unsigned)summary.bytes,
+	(long long unsigned)summary.nbr_errors, (long long unsigned)summary.nbr_retries,
+	(long long unsigned)(summary.latency_p50 / 1000), (long long unsigned)(summary.latency_p90 / 1000),
+	(long long unsigned)(summary.latency_p99 / 1000), (long long unsigned)(summary.latency_max / 1000),
+	(summary.latency_total > 0 ? (double)summary.bytes * 1000 / summary.latency_total : 0.0));
+    if(summary.nbr_hits + summary.nbr_misses > 0)
+      log_info(", %llu block hits, %llu misses, %.1f%% hit ratio",
+	  (long long unsigned)summary.nbr_hits, (long long unsigned)summary.nbr_misses,
+	  (double)summary.nbr_hits * 100 / (summary.nbr_hits + summary.nbr_misses));
+    log_info("\n");
+  }
+}
+
+static void prometheus_labels(FILE *handle, const disk_stats_t *stats, const char *le)
+{
+  const char *s;
+  fprintf(handle, "{layer=\"%s\",device=\"", stats->layer);
+  for(s=stats->device; *s!='\0'; s++)
+  {
+    if(*s=='\\' || *s=='"')
+      fprintf(handle, "\\%c", *s);
+    else if(*s=='\n')
+      fprintf(handle, "\\n");
+    else
+      fputc(*s, handle);
+  }
+  if(le!=NULL)
+    fprintf(handle, "\",le=\"%s\"}", le);
+  else
+    fprintf(handle, "\"}");
+}
+
+static void prometheus_counter(FILE *handle, const char *name, const char *help, const size_t field)
+{
+  const struct td_list_head *walker;
+  fprintf(handle, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  td_list_for_each(walker, &disk_stats_list)
+  {
+    const disk_stats_t *stats=td_list_entry_const(walker, const disk_stats_t, list);
+    fprintf(handle, "%s", name);
+    prometheus_labels(handle, stats, NULL);
+    fprintf(handle, " %llu\n", (long long unsigned)*(const uint64_t *)((const char *)stats + field));
+  }
+}
+
+int disk_stats_save_prometheus(const char *filename)
+{
+  static const double le[]={ 1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1, 10 };
+  const struct td_list_head *walker;
+  char *tmp=(char *)MALLOC(strlen(filename) + 5);
+  FILE *handle;
+  sprintf(tmp, "%s.tmp", filename);
+  handle=fopen(tmp, "w");
+  if(handle==NULL)
+  {
+    free(tmp);
+    return -1;
+  }
+  prometheus_counter(handle, "testdisk_disk_reads_total", "Reads of the disk layer", offsetof(disk_stats_t, nbr_reads));
+  prometheus_counter(handle, "testdisk_disk_read_bytes_total", "Bytes read from the disk layer", offsetof(disk_stats_t, bytes));
+  prometheus_counter(handle, "testdisk_disk_read_errors_total", "Reads returning less than requested", offsetof(disk_stats_t, nbr_errors));
+  prometheus_counter(handle, "testdisk_disk_read_retries_total", "Sector reads after a failed read", offsetof(disk_stats_t, nbr_retries));
+  prometheus_counter(handle, "testdisk_disk_cache_hits_total", "Blocks found in the cache", offsetof(disk_stats_t, nbr_hits));
+  prometheus_counter(handle, "testdisk_disk_cache_misses_total", "Blocks missing from the cache", offsetof(disk_stats_t, nbr_misses));
+  fprintf(handle, "# HELP testdisk_disk_read_latency_seconds Latency of the reads of the disk layer\n"
+      "# TYPE testdisk_disk_read_latency_seconds histogram\n");
+  td_list_for_each(walker, &disk_stats_list)
+  {
+    const disk_stats_t *stats=td_list_entry_const(walker, const disk_stats_t, list);
+    uint64_t nbr=0;
+    unsigned int bucket=0;
+    unsigned int i;
+    for(i=0; i<sizeof(le)/sizeof(le[0]); i++)
+    {
+      const uint64_t le_ns=le[i] * 1000000000;
+      char le_txt[16];
+      for(; bucket<DISK_STATS_BUCKETS && stats_bucket_max(bucket) <= le_ns; bucket++)
+	nbr+=stats->histogram[bucket];
+      snprintf(le_txt, sizeof(le_txt), "%g", le[i]);
+      fprintf(handle, "testdisk_disk_read_latency_seconds_bucket");
+      prometheus_labels(handle, stats, le_txt);
+      fprintf(handle, " %llu\n", (long long unsigned)nbr);
+    }
+    fprintf(handle, "testdisk_disk_read_latency_seconds_bucket");
+    prometheus_labels(handle, stats, "+Inf");
+    fprintf(handle, " %llu\n", (long long unsigned)stats->nbr_reads);
+    fprintf(handle, "testdisk_disk_read_latency_seconds_sum");
+    prometheus_labels(handle, stats, NULL);
+    fprintf(handle, " %.9f\n", (double)stats->latency_total / 1000000000);
+    fprintf(handle, "testdisk_disk_read_latency_seconds_count");
+    prometheus_labels(handle, stats, NULL);
+    fprintf(handle, " %llu\n", (long long unsigned)stats->nbr_reads);
+  }
+  if(fclose(handle)!=0 || rename(tmp, filename)!=0)
+  {
+    unlink(tmp);
+    free(tmp);
+    return -1;
+  }
+  free(tmp);
+  return 0;
+}
+
+void disk_stats_set_prometheus(const char *filename, const unsigned int interval)
+{
+  free(prometheus_filename);
+  prometheus_filename=(filename!=NULL ? strdup(filename) : NULL);
+  prometheus_interval=(uint64_t)interval * 1000000000;
+  prometheus_next=0;
+}
+#endif
@@ -0,0 +1,113 @@
+/*
+
+    File: hdstats.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDSTATS_H
+#define _HDSTATS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Summary of the I/O of a disk layer, also in testdisk_api.h */
+typedef struct
+{
+  const char *layer;		/* "file", "cache", "ewf", "io_redir" */
+  const char *device;
+  uint64_t nbr_reads;
+  uint64_t bytes;
+  uint64_t nbr_errors;		/* reads returning less than requested */
+  uint64_t nbr_retries;		/* reads split sector by sector after an error */
+  uint64_t nbr_hits;		/* cache only, in blocks */
+  uint64_t nbr_misses;
+  uint64_t latency_total;	/* in ns */
+  uint64_t latency_p50;
+  uint64_t latency_p90;
+  uint64_t latency_p99;
+  uint64_t latency_max;
+} disk_stats_summary_t;
+
+#if !defined(DISABLED_FOR_FRAMAC)
+typedef struct disk_stats_struct disk_stats_t;
+
+/* Monotonic clock in ns */
+uint64_t disk_stats_clock(void);
+
+/* Counters of a disk layer, until disk_stats_free() */
+/*@
+  @ requires valid_read_string(layer);
+  @ requires valid_read_string(device);
+  @ ensures  \valid(\result);
+  @*/
+disk_stats_t *disk_stats_new(const char *layer, const char *device);
+
+/*@
+  @ requires stats==\null || \valid(stats);
+  @*/
+void disk_stats_free(disk_stats_t *stats);
+
+/* Account a read of count bytes that started at start, disk_stats_clock() */
+/*@
+  @ requires stats==\null || \valid(stats);
+  @*/
+void disk_stats_read(disk_stats_t *stats, const unsigned int count, const int res, const uint64_t start);
+
+/* Cache block found or missing, sector read again after a failed read */
+/*@
+  @ requires \valid(stats);
+  @*/
+void disk_stats_hit(disk_stats_t *stats);
+
+/*@
+  @ requires \valid(stats);
+  @*/
+void disk_stats_miss(disk_stats_t *stats);
+
+/*@
+  @ requires \valid(stats);
+  @*/
+void disk_stats_retry(disk_stats_t *stats);
+
+/* Copy the summaries of up to max layers, return the number of layers */
+/*@
+  @ requires \valid(summaries + (0 .. max-1));
+  @*/
+unsigned int disk_stats_get(disk_stats_summary_t *summaries, const unsigned int max);
+
+/* One line per layer in the log */
+void disk_stats_log_all(void);
+
+/* Write the counters in the Prometheus text format, for the textfile
+ * collector of node_exporter. The file is replaced atomically */
+/*@
+  @ requires valid_read_string(filename);
+  @*/
+int disk_stats_save_prometheus(const char *filename);
+
+/* Also rewrite filename every interval seconds while reading */
+/*@
+  @ requires filename==\null || valid_read_string(filename);
+  @*/
+void disk_stats_set_prometheus(const char *filename, const unsigned int interval);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
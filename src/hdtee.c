@@ -0,0 +1,415 @@
+/*
+
+    File: hdtee.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "hdtee.h"
+#include "log.h"
+#include "mapfile.h"
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define DISKTEE_MAPFILE_SAVE_DELAY	30
+
+#if defined(HAVE_PREAD) && defined(HAVE_PWRITE) && defined(HAVE_FTRUNCATE)
+struct tee_struct
+{
+  disk_t *disk_car;
+  int handle;
+  char *filename;
+  char *mapfile_name;
+  mapfile_t map;
+  time_t map_saved;
+  uint64_t disk_read;
+  uint64_t image_read;
+  int error;
+};
+
+static void tee_save_map(struct tee_struct *data)
+{
+  data->map_saved=time(NULL);
+  if(mapfile_save(&data->map, data->mapfile_name) < 0)
+    log_error("%s: can't save the mapfile\n", data->mapfile_name);
+}
+
+/* Stop imaging, the disk is read as if there were no image */
+static void tee_write_error(struct tee_struct *data)
+{
+  log_error("%s: write error, %s, the disk is no more imaged\n", data->filename, strerror(errno));
+  data->error=1;
+  tee_save_map(data);
+}
+
+/* The zeroed sectors are left as holes of the sparse image */
+static int tee_write_image(struct tee_struct *data, const unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const unsigned int sector_size=(data->disk_car->sector_size > 0 ? data->disk_car->sector_size : 512);
+  unsigned int start=0;
+  while(start < count)
+  {
+    unsigned int end;
+    unsigned int i;
+    /* Skip the zeroed sectors */
+    for(; start < count; start+=sector_size)
+    {
+      const unsigned int size=(sector_size < count - start ? sector_size : count - start);
+      for(i=0; i<size && buffer[start+i]==0; i++);
+      if(i<size)
+	break;
+    }
+    /* Then write the following sectors with data */
+    for(end=start; end < count; end+=sector_size)
+    {
+      const unsigned int size=(sector_size < count - end ? sector_size : count - end);
+      for(i=0; i<size && buffer[end+i]==0; i++);
+      if(i==size)
+	break;
+    }
+    if(start < end)
+    {
+      const unsigned int size=(end < count ? end : count) - start;
+      if(pwrite(data->handle, &buffer[start], size, offset + start)!=(ssize_t)size)
+	return -1;
+    }
+    start=end;
+  }
+  return 0;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (char *)buffer + (0 .. count-1));
+  @*/
+static int tee_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct tee_struct *data=(struct tee_struct *)disk_car->data;
+  const uint64_t disk_size=data->disk_car->disk_real_size;
+  /* Like the disk, the data after its end reads as zeroes */
+  const unsigned int size_max=(offset >= disk_size ? 0 :
+      (disk_size - offset < count ? disk_size - offset : count));
+  const uint64_t end=offset + size_max;
+  int res;
+  int saved_errno;
+  if(data->error==0 && size_max > 0 &&
+      mapfile_first(&data->map, offset, size_max, MAPFILE_NON_TRIED)==end &&
+      mapfile_first(&data->map, offset, size_max, MAPFILE_NON_TRIMMED)==end)
+  {
+    /* Already read, the image has the data or holes for the bad sectors */
+    const uint64_t bad=mapfile_first(&data->map, offset, size_max, MAPFILE_BAD_SECTOR);
+    if(pread(data->handle, buffer, size_max, offset)==(ssize_t)size_max)
+    {
+      data->image_read+=size_max;
+      if(size_max < count)
+	memset((char *)buffer + size_max, 0, count - size_max);
+      if(bad==end)
+	return size_max;
+      memset((char *)buffer + (bad - offset), 0, end - bad);
+      if(bad==offset)
+      {
+	errno=EIO;
+	return -1;
+      }
+      return bad - offset;
+    }
+  }
+  res=data->disk_car->pread(data->disk_car, buffer, count, offset);
+  saved_errno=errno;
+  if(data->error==0)
+  {
+    const unsigned int size=(res <= 0 ? 0 : ((unsigned int)res < size_max ? (unsigned int)res : size_max));
+    if(size > 0)
+    {
+      data->disk_read+=size;
+      if(tee_write_image(data, (const unsigned char *)buffer, size, offset) < 0)
+	tee_write_error(data);
+      else
+	mapfile_set(&data->map, offset, size, MAPFILE_FINISHED);
+    }
+    if(data->error==0 && size < size_max)
+    {
+      /* A larger read may fail for a single sector, the cache reads it
+       * again sector by sector */
+      mapfile_set(&data->map, offset + size, size_max - size,
+	  (count <= data->disk_car->sector_size ? MAPFILE_BAD_SECTOR : MAPFILE_NON_TRIMMED));
+    }
+    if(data->error==0 && time(NULL) >= data->map_saved + DISKTEE_MAPFILE_SAVE_DELAY)
+      tee_save_map(data);
+  }
+  errno=saved_errno;
+  return res;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid_read((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (const char *)buffer + (0 .. count-1));
+  @*/
+static int tee_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct tee_struct *data=(struct tee_struct *)disk_car->data;
+  int res;
+  int saved_errno;
+  disk_car->write_used=1;
+  res=data->disk_car->pwrite(data->disk_car, buffer, count, offset);
+  saved_errno=errno;
+  if(data->error==0 && count > 0)
+  {
+    if(res==(int)count)
+    {
+      if(pwrite(data->handle, buffer, count, offset)!=(ssize_t)count)
+	tee_write_error(data);
+      else
+	mapfile_set(&data->map, offset, count, MAPFILE_FINISHED);
+    }
+    else
+    {
+      /* The disk has to be read again */
+      mapfile_set(&data->map, offset, count, MAPFILE_NON_TRIED);
+    }
+  }
+  errno=saved_errno;
+  return res;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @*/
+static int tee_sync(disk_t *disk_car)
+{
+  struct tee_struct *data=(struct tee_struct *)disk_car->data;
+  if(data->error==0)
+    tee_save_map(data);
+  return data->disk_car->sync(data->disk_car);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void tee_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct tee_struct *data=(struct tee_struct *)disk_car->data;
+  disk_advise(data->disk_car, offset, length, hint);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void tee_clean(disk_t *disk_car)
+{
+  if(disk_car->data)
+  {
+    struct tee_struct *data=(struct tee_struct *)disk_car->data;
+    if(data->error==0)
+      tee_save_map(data);
+    if(close(data->handle)!=0 && data->error==0)
+      log_error("%s: write error, the image is incomplete\n", data->filename);
+    log_info("%s: image %s, %llu bytes read from the disk, %llu bytes from the image, %llu bytes in unreadable sectors\n",
+	data->disk_car->description_short(data->disk_car), data->filename,
+	(long long unsigned)data->disk_read,
+	(long long unsigned)data->image_read,
+	(long long unsigned)mapfile_size(&data->map, MAPFILE_BAD_SECTOR));
+    data->disk_car->clean(data->disk_car);
+    mapfile_free(&data->map);
+    free(data->filename);
+    free(data->mapfile_name);
+    free(disk_car->data);
+    disk_car->data=NULL;
+  }
+  free(disk_car);
+}
+
+static void tee_sync_description(disk_t *disk_car)
+{
+  const struct tee_struct *data=(const struct tee_struct *)disk_car->data;
+  data->disk_car->geom.cylinders=disk_car->geom.cylinders;
+  data->disk_car->geom.heads_per_cylinder=disk_car->geom.heads_per_cylinder;
+  data->disk_car->geom.sectors_per_head=disk_car->geom.sectors_per_head;
+  data->disk_car->disk_size=disk_car->disk_size;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *tee_description(disk_t *disk_car)
+{
+  const struct tee_struct *data=(const struct tee_struct *)disk_car->data;
+  tee_sync_description(disk_car);
+  return data->disk_car->description(data->disk_car);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *tee_description_short(disk_t *disk_car)
+{
+  const struct tee_struct *data=(const struct tee_struct *)disk_car->data;
+  tee_sync_description(disk_car);
+  return data->disk_car->description_short(data->disk_car);
+}
+
+/* The mapfile of an interrupted image must describe the whole disk */
+static int tee_map_valid(const mapfile_t *map, const uint64_t disk_size)
+{
+  uint64_t pos=0;
+  unsigned int i;
+  for(i=0; i < map->nbr; i++)
+  {
+    if(map->ranges[i].pos!=pos)
+      return 0;
+    pos+=map->ranges[i].size;
+  }
+  return (pos==disk_size);
+}
+#endif
+
+const disk_t *disktee_disk(const disk_t *disk_car)
+{
+#if defined(HAVE_PREAD) && defined(HAVE_PWRITE) && defined(HAVE_FTRUNCATE)
+  if(disk_car->pread!=&tee_pread)
+    return disk_car;
+  return ((const struct tee_struct *)disk_car->data)->disk_car;
+#else
+  return disk_car;
+#endif
+}
+
+disk_t *new_disktee(disk_t *disk_car, const char *filename)
+{
+#if defined(HAVE_PREAD) && defined(HAVE_PWRITE) && defined(HAVE_FTRUNCATE)
+  struct tee_struct *data;
+  struct stat stat_buf;
+  disk_t *new_disk_car;
+  const uint64_t disk_size=disk_car->disk_real_size;
+  int resume=0;
+  int handle;
+  char *mapfile_name=(char *)MALLOC(strlen(filename) + 5);
+  mapfile_t map;
+  strcpy(mapfile_name, filename);
+  strcat(mapfile_name, ".map");
+  /* Continue an interrupted image */
+  if(mapfile_load(&map, mapfile_name)==0)
+  {
+    if(tee_map_valid(&map, disk_size))
+      resume=1;
+    else
+    {
+      log_warning("%s doesn't describe %s, the image is created again\n",
+	  mapfile_name, disk_car->description_short(disk_car));
+      mapfile_free(&map);
+    }
+  }
+  if(resume==0)
+    mapfile_init(&map, disk_size);
+  handle=open(filename, O_CREAT|O_LARGEFILE|O_RDWR|O_BINARY|(resume>0 ? 0 : O_TRUNC), 0644);
+  if(handle < 0)
+  {
+    log_error("Can't create the image %s: %s\n", filename, strerror(errno));
+    mapfile_free(&map);
+    free(mapfile_name);
+    return disk_car;
+  }
+  if(fstat(handle, &stat_buf) < 0 ||
+      ((uint64_t)stat_buf.st_size < disk_size && ftruncate(handle, disk_size) < 0))
+  {
+    log_error("Can't create the image %s: %s\n", filename, strerror(errno));
+    close(handle);
+    mapfile_free(&map);
+    free(mapfile_name);
+    return disk_car;
+  }
+  data=(struct tee_struct *)MALLOC(sizeof(*data));
+  data->disk_car=disk_car;
+  data->handle=handle;
+  data->filename=strdup(filename);
+  data->mapfile_name=mapfile_name;
+  memcpy(&data->map, &map, sizeof(map));
+  data->map_saved=0;
+  data->disk_read=0;
+  data->image_read=0;
+  data->error=0;
+  tee_save_map(data);
+  new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
+  memcpy(new_disk_car, disk_car, sizeof(*new_disk_car));
+  new_disk_car->write_used=0;
+  new_disk_car->data=data;
+  new_disk_car->pread=&tee_pread;
+  new_disk_car->pwrite=&tee_pwrite;
+  new_disk_car->sync=&tee_sync;
+  new_disk_car->clean=&tee_clean;
+  new_disk_car->advise=&tee_advise;
+  new_disk_car->description=&tee_description;
+  new_disk_car->description_short=&tee_description_short;
+  new_disk_car->rbuffer=NULL;
+  new_disk_car->wbuffer=NULL;
+  new_disk_car->rbuffer_size=0;
+  new_disk_car->wbuffer_size=0;
+  log_info("%s: image in %s, %llu bytes already read\n",
+      disk_car->description_short(disk_car), filename,
+      (long long unsigned)(disk_size - mapfile_size(&data->map, MAPFILE_NON_TRIED) - mapfile_size(&data->map, MAPFILE_NON_TRIMMED)));
+  return new_disk_car;
+#else
+  log_error("Can't create the image %s: not supported\n", filename);
+  return disk_car;
+#endif
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+
+    File: hdtee.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDTEE_H
+#define _HDTEE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Image the disk while it is read: each block read from the disk is also
+ * written to the sparse image filename, filename.map is a ddrescue
+ * mapfile of the areas already read and of the unreadable sectors.
+ * The areas already read are then read from the image, the disk is read
+ * only once. An interrupted image is continued with its mapfile.
+ * Return the disk itself if the image can't be created. Stack it below
+ * new_diskcache(), the cache splits the failed reads sector by sector */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires valid_read_string(filename);
+  @ ensures \valid(\result);
+  @*/
+disk_t *new_disktee(disk_t *disk_car, const char *filename);
+
+/* The disk imaged, the disk itself if it isn't imaged */
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures  valid_disk(\result);
+  @*/
+const disk_t *disktee_disk(const disk_t *disk_car);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
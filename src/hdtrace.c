@@ -0,0 +1,239 @@
+/*
+
+    File: hdtrace.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "hdstats.h"
+#include "hdtrace.h"
+#include "log.h"
+
+#define DISKTRACE_BUFFER_SIZE	(1024*1024)
+
+struct trace_struct
+{
+  disk_t *disk_car;
+  FILE *handle;
+  char *filename;
+  uint64_t nbr_records;
+  int error;
+};
+
+static void trace_record(struct trace_struct *data, const uint8_t op, const uint64_t offset, const unsigned int count, const int res, const uint64_t latency)
+{
+  struct disktrace_record record;
+  if(data->error)
+    return ;
+  memset(&record, 0, sizeof(record));
+  record.offset=le64(offset);
+  record.latency=le64(latency);
+  record.count=le32(count);
+  record.result=le32(res);
+  record.op=op;
+  if(fwrite(&record, sizeof(record), 1, data->handle)!=1)
+  {
+    /* Keep going without the trace, like without a log file */
+    log_error("%s: write error, the I/O trace is incomplete\n", data->filename);
+    data->error=1;
+    return ;
+  }
+  data->nbr_records++;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (char *)buffer + (0 .. count-1));
+  @*/
+static int trace_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct trace_struct *data=(struct trace_struct *)disk_car->data;
+  const uint64_t start=disk_stats_clock();
+  const int res=data->disk_car->pread(data->disk_car, buffer, count, offset);
+  const int saved_errno=errno;
+  trace_record(data, DISKTRACE_OP_READ, offset, count, res, disk_stats_clock() - start);
+  errno=saved_errno;
+  return res;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires \valid_read((char *)buffer + (0 .. count-1));
+  @ requires separation: \separated(disk_car, (const char *)buffer + (0 .. count-1));
+  @*/
+static int trace_pwrite(disk_t *disk_car, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct trace_struct *data=(struct trace_struct *)disk_car->data;
+  const uint64_t start=disk_stats_clock();
+  int res;
+  int saved_errno;
+  disk_car->write_used=1;
+  res=data->disk_car->pwrite(data->disk_car, buffer, count, offset);
+  saved_errno=errno;
+  trace_record(data, DISKTRACE_OP_WRITE, offset, count, res, disk_stats_clock() - start);
+  errno=saved_errno;
+  return res;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @*/
+static int trace_sync(disk_t *disk_car)
+{
+  struct trace_struct *data=(struct trace_struct *)disk_car->data;
+  return data->disk_car->sync(data->disk_car);
+}
+
+/* The hints aren't recorded, a replay reads the same data */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void trace_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct trace_struct *data=(struct trace_struct *)disk_car->data;
+  disk_advise(data->disk_car, offset, length, hint);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @*/
+static void trace_clean(disk_t *disk_car)
+{
+  if(disk_car->data)
+  {
+    struct trace_struct *data=(struct trace_struct *)disk_car->data;
+    if(fclose(data->handle)!=0 && data->error==0)
+      log_error("%s: write error, the I/O trace is incomplete\n", data->filename);
+    log_info("%s: %llu requests in the I/O trace %s\n",
+	data->disk_car->description_short(data->disk_car),
+	(long long unsigned)data->nbr_records, data->filename);
+    data->disk_car->clean(data->disk_car);
+    free(data->filename);
+    free(disk_car->data);
+    disk_car->data=NULL;
+  }
+  free(disk_car);
+}
+
+static void trace_sync_description(disk_t *disk_car)
+{
+  const struct trace_struct *data=(const struct trace_struct *)disk_car->data;
+  data->disk_car->geom.cylinders=disk_car->geom.cylinders;
+  data->disk_car->geom.heads_per_cylinder=disk_car->geom.heads_per_cylinder;
+  data->disk_car->geom.sectors_per_head=disk_car->geom.sectors_per_head;
+  data->disk_car->disk_size=disk_car->disk_size;
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *trace_description(disk_t *disk_car)
+{
+  const struct trace_struct *data=(const struct trace_struct *)disk_car->data;
+  trace_sync_description(disk_car);
+  return data->disk_car->description(data->disk_car);
+}
+
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures valid_read_string(\result);
+  @*/
+static const char *trace_description_short(disk_t *disk_car)
+{
+  const struct trace_struct *data=(const struct trace_struct *)disk_car->data;
+  trace_sync_description(disk_car);
+  return data->disk_car->description_short(data->disk_car);
+}
+
+const disk_t *disktrace_disk(const disk_t *disk_car)
+{
+  if(disk_car->pread!=&trace_pread)
+    return disk_car;
+  return ((const struct trace_struct *)disk_car->data)->disk_car;
+}
+
+disk_t *new_disktrace(disk_t *disk_car, const char *filename)
+{
+  struct trace_struct *data;
+  struct disktrace_header header;
+  disk_t *new_disk_car;
+  FILE *handle=fopen(filename, "wb");
+  if(handle==NULL)
+  {
+    log_error("Can't create the I/O trace %s: %s\n", filename, strerror(errno));
+    return disk_car;
+  }
+  setvbuf(handle, NULL, _IOFBF, DISKTRACE_BUFFER_SIZE);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DISKTRACE_MAGIC, sizeof(header.magic));
+  header.version=le32(DISKTRACE_VERSION);
+  header.sector_size=le32(disk_car->sector_size);
+  header.disk_size=le64(disk_car->disk_real_size);
+  if(fwrite(&header, sizeof(header), 1, handle)!=1)
+  {
+    log_error("Can't create the I/O trace %s: %s\n", filename, strerror(errno));
+    fclose(handle);
+    return disk_car;
+  }
+  data=(struct trace_struct *)MALLOC(sizeof(*data));
+  data->disk_car=disk_car;
+  data->handle=handle;
+  data->filename=strdup(filename);
+  data->nbr_records=0;
+  data->error=0;
+  new_disk_car=(disk_t *)MALLOC(sizeof(*new_disk_car));
+  memcpy(new_disk_car, disk_car, sizeof(*new_disk_car));
+  new_disk_car->write_used=0;
+  new_disk_car->data=data;
+  new_disk_car->pread=&trace_pread;
+  new_disk_car->pwrite=&trace_pwrite;
+  new_disk_car->sync=&trace_sync;
+  new_disk_car->clean=&trace_clean;
+  new_disk_car->advise=&trace_advise;
+  new_disk_car->description=&trace_description;
+  new_disk_car->description_short=&trace_description_short;
+  new_disk_car->rbuffer=NULL;
+  new_disk_car->wbuffer=NULL;
+  new_disk_car->rbuffer_size=0;
+  new_disk_car->wbuffer_size=0;
+  log_info("%s: I/O trace in %s\n", disk_car->description_short(disk_car), filename);
+  return new_disk_car;
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+
+    File: hdtrace.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _HDTRACE_H
+#define _HDTRACE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISKTRACE_MAGIC		"TDTRACE1"
+#define DISKTRACE_VERSION	1
+#define DISKTRACE_OP_READ	'r'
+#define DISKTRACE_OP_WRITE	'w'
+
+/* I/O trace file: a header, then one record per request, little-endian */
+struct disktrace_header
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t sector_size;
+  uint64_t disk_size;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct disktrace_record
+{
+  uint64_t offset;
+  uint64_t latency;		/* in ns */
+  uint32_t count;
+  int32_t  result;		/* returned by pread/pwrite */
+  uint8_t  op;			/* DISKTRACE_OP_READ or DISKTRACE_OP_WRITE */
+  uint8_t  reserved[7];
+} __attribute__ ((gcc_struct, __packed__));
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Record every read and write of the disk in the trace filename, see
+ * trace_replay to replay it. Return the disk itself if the trace can't be
+ * created. Stack it below new_diskcache() to trace the device requests */
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ requires valid_read_string(filename);
+  @ ensures \valid(\result);
+  @*/
+disk_t *new_disktrace(disk_t *disk_car, const char *filename);
+
+/* The disk traced, the disk itself if it isn't traced */
+/*@
+  @ requires \valid_read(disk_car);
+  @ requires valid_disk(disk_car);
+  @ ensures  valid_disk(\result);
+  @*/
+const disk_t *disktrace_disk(const disk_t *disk_car);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,715 @@
+/*
+
+    File: hfsp_dir.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "hfsp.h"
+#include "dir.h"
+#include "hfsp_dir.h"
+#include "log.h"
+#include "setdate.h"
+#include "unicode.h"
+
+#define HFSP_DIR_READ_SIZE	(1024*1024)
+#define HFSP_ROOT_FOLDER_ID	2
+#define HFSP_EXTENTS_FILE_ID	3
+#define HFSP_CATALOG_FILE_ID	4
+#define HFSP_FOLDER_RECORD	1
+#define HFSP_FILE_RECORD	2
+#define HFSP_NODE_LEAF		0xFF	/* -1 */
+#define HFSP_NODE_MAP		2
+#define HFSP_NODE_DESC_SIZE	14
+/* Seconds from 1904-01-01 to 1970-01-01 */
+#define HFSP_UNIX_EPOCH		2082844800U
+/* File type and creator of a file hard link */
+#define HFSP_HLNK_TYPE		0x686C6E6B	/* 'hlnk' */
+#define HFSP_HLNK_CREATOR	0x6866732B	/* 'hfs+' */
+
+typedef struct
+{
+  uint32_t start_block;
+  uint32_t block_count;
+} hfsp_dir_extent_t;
+
+/* A data fork extent record of the extents overflow B-tree */
+typedef struct
+{
+  uint32_t file_id;
+  uint32_t start_block;		/* First block of the fork it describes */
+  hfsp_dir_extent_t extents[8];
+} hfsp_dir_overflow_t;
+
+typedef struct
+{
+  char *name;
+  uint32_t cnid;
+  uint32_t parent;
+  uint32_t data_id;		/* File whose data fork is read, see hard links */
+  uint32_t link;		/* iNode number of a file hard link */
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t atime;
+  uint32_t mtime;
+  uint32_t ctime;
+  uint64_t size;
+  hfsp_dir_extent_t extents[8];
+  unsigned int deleted;
+} hfsp_dir_entry_t;
+
+typedef struct
+{
+  uint32_t cnid;
+  unsigned int index;		/* In entries */
+} hfsp_dir_cnid_t;
+
+/* The extents of a fork, in the order of its blocks */
+typedef struct
+{
+  uint64_t size;
+  hfsp_dir_extent_t *extents;
+  unsigned int extents_nbr;
+} hfsp_dir_fork_t;
+
+struct hfsp_dir_struct
+{
+  uint32_t blocksize;
+  hfsp_dir_overflow_t *overflow;	/* Sorted by file_id, start_block */
+  unsigned int overflow_nbr;
+  unsigned int overflow_alloc;
+  hfsp_dir_entry_t *entries;		/* Sorted by parent, name */
+  unsigned int entries_nbr;
+  unsigned int entries_alloc;
+  hfsp_dir_cnid_t *by_cnid;		/* The entries sorted by cnid */
+  uint32_t private_dir;			/* "HFS+ Private Data" holding the hard linked files */
+};
+
+typedef void (*hfsp_dir_leaf_t)(struct hfsp_dir_struct *ls, const unsigned char *node, const unsigned int node_size, const unsigned int deleted);
+
+static int hfsp_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *dir_list);
+static copy_file_t hfsp_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file);
+static void dir_partition_hfsp_close(dir_data_t *dir_data);
+
+static uint16_t hfsp_get16(const unsigned char *p)
+{
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return be16(v);
+}
+
+static uint32_t hfsp_get32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return be32(v);
+}
+
+static uint64_t hfsp_get64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return be64(v);
+}
+
+static void hfsp_get_extents(hfsp_dir_extent_t *extents, const unsigned char *p)
+{
+  unsigned int i;
+  for(i=0; i<8; i++)
+  {
+    extents[i].start_block=hfsp_get32(&p[8*i]);
+    extents[i].block_count=hfsp_get32(&p[8*i+4]);
+  }
+}
+
+static time_t hfsp_time(const uint32_t date)
+{
+  return (date > HFSP_UNIX_EPOCH ? (time_t)(date - HFSP_UNIX_EPOCH) : 0);
+}
+
+static int hfsp_overflow_cmp(const void *a, const void *b)
+{
+  const hfsp_dir_overflow_t *oa=(const hfsp_dir_overflow_t *)a;
+  const hfsp_dir_overflow_t *ob=(const hfsp_dir_overflow_t *)b;
+  if(oa->file_id!=ob->file_id)
+    return (oa->file_id < ob->file_id ? -1 : 1);
+  if(oa->start_block!=ob->start_block)
+    return (oa->start_block < ob->start_block ? -1 : 1);
+  return 0;
+}
+
+/* Data fork of file_id: its first 8 extents, then the overflow ones */
+static void hfsp_fork_init(const struct hfsp_dir_struct *ls, hfsp_dir_fork_t *fork, const uint32_t file_id, const hfsp_dir_extent_t *first, const uint64_t size)
+{
+  unsigned int low=0;
+  unsigned int high=ls->overflow_nbr;
+  unsigned int i;
+  fork->size=size;
+  fork->extents_nbr=0;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(ls->overflow[mid].file_id < file_id)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  for(high=low; high < ls->overflow_nbr && ls->overflow[high].file_id==file_id; high++);
+  fork->extents=(hfsp_dir_extent_t *)MALLOC((8 + 8 * (high - low)) * sizeof(hfsp_dir_extent_t));
+  for(i=0; i<8 && first[i].block_count > 0; i++)
+    fork->extents[fork->extents_nbr++]=first[i];
+  /* Only once the 8 first extents are used */
+  if(i==8)
+  {
+    for(; low < high; low++)
+      for(i=0; i<8 && ls->overflow[low].extents[i].block_count > 0; i++)
+	fork->extents[fork->extents_nbr++]=ls->overflow[low].extents[i];
+  }
+}
+
+/* Read size bytes of the fork from offset, return the number of bytes read */
+static unsigned int hfsp_fork_pread(disk_t *disk, const partition_t *partition, const struct hfsp_dir_struct *ls, const hfsp_dir_fork_t *fork, unsigned char *buffer, const unsigned int size, const uint64_t offset)
+{
+  uint64_t extent_offset=0;
+  unsigned int done=0;
+  unsigned int i;
+  for(i=0; i<fork->extents_nbr && done < size; i++)
+  {
+    const uint64_t extent_size=(uint64_t)fork->extents[i].block_count * ls->blocksize;
+    const uint64_t pos=offset + done;
+    if(pos < extent_offset + extent_size)
+    {
+      const uint64_t in_extent=pos - extent_offset;
+      const unsigned int toread=(extent_size - in_extent < size - done ? extent_size - in_extent : size - done);
+      if((unsigned)disk->pread(disk, buffer + done, toread,
+	    partition->part_offset + (uint64_t)fork->extents[i].start_block * ls->blocksize + in_extent) != toread)
+	return done;
+      done+=toread;
+    }
+    extent_offset+=extent_size;
+  }
+  return done;
+}
+
+/* Offset of the record rec of the node, 0 if it's invalid */
+static unsigned int hfsp_record(const unsigned char *node, const unsigned int node_size, const unsigned int rec)
+{
+  const unsigned int offset=hfsp_get16(&node[node_size - 2 * (rec + 1)]);
+  if(offset < HFSP_NODE_DESC_SIZE || offset >= node_size - 2 * (rec + 1))
+    return 0;
+  return offset;
+}
+
+/* Read the nodes of the B-tree stored in fork in disk order, call leaf for
+ * each leaf node. The free nodes are only given if free_nodes is set. */
+static int hfsp_btree_stream(disk_t *disk, const partition_t *partition, struct hfsp_dir_struct *ls, const hfsp_dir_fork_t *fork, hfsp_dir_leaf_t leaf, const int free_nodes)
+{
+  unsigned char header[512];
+  unsigned char *map;
+  unsigned char *buffer;
+  unsigned int node_size;
+  unsigned int total_nodes;
+  unsigned int map_size;
+  unsigned int map_offset;
+  unsigned int chunk_nodes;
+  uint32_t map_node;
+  unsigned int node;
+  if(hfsp_fork_pread(disk, partition, ls, fork, header, sizeof(header), 0)!=sizeof(header))
+    return -1;
+  node_size=hfsp_get16(&header[HFSP_NODE_DESC_SIZE + 18]);
+  total_nodes=hfsp_get32(&header[HFSP_NODE_DESC_SIZE + 22]);
+  if(node_size < 512 || node_size > 32768 || (node_size & (node_size - 1))!=0 ||
+      (uint64_t)total_nodes * node_size > fork->size)
+  {
+    log_error("HFS+: invalid B-tree header\n");
+    return -1;
+  }
+  /* Allocation map of the nodes, one bit per node */
+  map_size=(total_nodes + 7) / 8;
+  map=(unsigned char *)MALLOC(map_size);
+  memset(map, 0xff, map_size);
+  buffer=(unsigned char *)MALLOC(node_size);
+  map_offset=0;
+  map_node=0;
+  do
+  {
+    unsigned int start;
+    unsigned int end;
+    if(hfsp_fork_pread(disk, partition, ls, fork, buffer, node_size, (uint64_t)map_node * node_size)!=node_size)
+      break;
+    /* The map is the third record of the header node, the first one
+     * of the map nodes */
+    start=hfsp_record(buffer, node_size, (map_node==0 ? 2 : 0));
+    end=hfsp_record(buffer, node_size, (map_node==0 ? 3 : 1));
+    if(start==0 || end <= start)
+      break;
+    if(end - start > map_size - map_offset)
+      end=start + map_size - map_offset;
+    memcpy(map + map_offset, buffer + start, end - start);
+    map_offset+=end - start;
+    map_node=hfsp_get32(buffer);
+  } while(map_node!=0 && map_node < total_nodes && map_offset < map_size);
+  free(buffer);
+  chunk_nodes=(HFSP_DIR_READ_SIZE > node_size ? HFSP_DIR_READ_SIZE / node_size : 1);
+  buffer=(unsigned char *)MALLOC((size_t)chunk_nodes * node_size);
+  for(node=0; node < total_nodes; node+=chunk_nodes)
+  {
+    const unsigned int nodes=(total_nodes - node < chunk_nodes ? total_nodes - node : chunk_nodes);
+    const unsigned int read=hfsp_fork_pread(disk, partition, ls, fork, buffer, nodes * node_size, (uint64_t)node * node_size);
+    unsigned int i;
+    for(i=0; i < read / node_size; i++)
+    {
+      const unsigned char *current=&buffer[i * node_size];
+      const unsigned int n=node + i;
+      const unsigned int deleted=((map[n / 8] & (0x80 >> (n % 8)))==0 ? 1 : 0);
+      if(current[8]==HFSP_NODE_LEAF && (deleted==0 || free_nodes!=0))
+	leaf(ls, current, node_size, deleted);
+    }
+    if(read < nodes * node_size)
+      log_error("HFS+: can't read B-tree node %u\n", node + read / node_size);
+  }
+  free(buffer);
+  free(map);
+  return 0;
+}
+
+static void hfsp_extents_leaf(struct hfsp_dir_struct *ls, const unsigned char *node, const unsigned int node_size, const unsigned int deleted)
+{
+  const unsigned int records=hfsp_get16(&node[10]);
+  unsigned int rec;
+  (void)deleted;
+  for(rec=0; rec < records && HFSP_NODE_DESC_SIZE + 2 * (rec + 1) < node_size; rec++)
+  {
+    const unsigned int offset=hfsp_record(node, node_size, rec);
+    hfsp_dir_overflow_t *overflow;
+    unsigned int key_length;
+    if(offset==0 || offset + 12 > node_size)
+      continue;
+    key_length=hfsp_get16(&node[offset]);
+    /* Only the data forks */
+    if(key_length < 10 || offset + 2 + key_length + 64 > node_size || node[offset+2]!=0)
+      continue;
+    if(ls->overflow_nbr==ls->overflow_alloc)
+    {
+      ls->overflow_alloc=(ls->overflow_alloc==0 ? 256 : 2 * ls->overflow_alloc);
+      ls->overflow=(hfsp_dir_overflow_t *)realloc(ls->overflow, ls->overflow_alloc * sizeof(hfsp_dir_overflow_t));
+      if(ls->overflow==NULL)
+      {
+	log_critical("hfsp_extents_leaf: not enough memory\n");
+	exit(1);
+      }
+    }
+    overflow=&ls->overflow[ls->overflow_nbr++];
+    overflow->file_id=hfsp_get32(&node[offset+4]);
+    overflow->start_block=hfsp_get32(&node[offset+8]);
+    hfsp_get_extents(overflow->extents, &node[offset + 2 + key_length]);
+  }
+}
+
+/* Convert the big endian UTF-16 name to UTF-8, '/' is shown as ':' as
+ * Mac OS X does and the NUL characters are dropped */
+static void hfsp_name(char *name, const unsigned int name_size, const unsigned char *unicode, const unsigned int len)
+{
+  unsigned char le[2*255];
+  unsigned int i;
+  unsigned int j=0;
+  for(i=0; i<len && i<255; i++)
+  {
+    if(unicode[2*i]==0 && unicode[2*i+1]==0)
+      continue;
+    le[2*j]=unicode[2*i+1];
+    le[2*j+1]=unicode[2*i];
+    if(le[2*j+1]==0 && le[2*j]=='/')
+      le[2*j]=':';
+    j++;
+  }
+  if(UTF16le2utf8(name, name_size, le, j) < 0)
+  {
+    for(i=0; i<j && i<name_size-1; i++)
+      name[i]=(le[2*i+1]==0 ? le[2*i] : '_');
+    name[i]='\0';
+  }
+}
+
+static void hfsp_catalog_leaf(struct hfsp_dir_struct *ls, const unsigned char *node, const unsigned int node_size, const unsigned int deleted)
+{
+  const unsigned int records=hfsp_get16(&node[10]);
+  unsigned int rec;
+  for(rec=0; rec < records && HFSP_NODE_DESC_SIZE + 2 * (rec + 1) < node_size; rec++)
+  {
+    const unsigned int offset=hfsp_record(node, node_size, rec);
+    const unsigned char *data;
+    hfsp_dir_entry_t *entry;
+    unsigned int key_length;
+    unsigned int name_length;
+    unsigned int type;
+    char name[1024];
+    if(offset==0 || offset + 8 > node_size)
+      continue;
+    key_length=hfsp_get16(&node[offset]);
+    name_length=hfsp_get16(&node[offset+6]);
+    if(key_length < 6 || 6 + 2 * name_length > key_length ||
+	offset + 2 + key_length + 2 > node_size)
+      continue;
+    data=&node[offset + 2 + key_length];
+    type=hfsp_get16(data);
+    if(!(type==HFSP_FOLDER_RECORD && offset + 2 + key_length + 88 <= node_size) &&
+	!(type==HFSP_FILE_RECORD && offset + 2 + key_length + 248 <= node_size))
+      continue;
+    if(ls->entries_nbr==ls->entries_alloc)
+    {
+      ls->entries_alloc=(ls->entries_alloc==0 ? 1024 : 2 * ls->entries_alloc);
+      ls->entries=(hfsp_dir_entry_t *)realloc(ls->entries, ls->entries_alloc * sizeof(hfsp_dir_entry_t));
+      if(ls->entries==NULL)
+      {
+	log_critical("hfsp_catalog_leaf: not enough memory\n");
+	exit(1);
+      }
+    }
+    entry=&ls->entries[ls->entries_nbr];
+    memset(entry, 0, sizeof(*entry));
+    entry->parent=hfsp_get32(&node[offset+2]);
+    entry->cnid=hfsp_get32(&data[8]);
+    entry->data_id=entry->cnid;
+    entry->ctime=hfsp_get32(&data[12]);
+    entry->mtime=hfsp_get32(&data[16]);
+    entry->atime=hfsp_get32(&data[24]);
+    entry->uid=hfsp_get32(&data[32]);
+    entry->gid=hfsp_get32(&data[36]);
+    entry->mode=hfsp_get16(&data[42]) & ~LINUX_S_IFMT;
+    entry->deleted=deleted;
+    if(entry->cnid < HFSP_ROOT_FOLDER_ID)
+      continue;
+    if(type==HFSP_FOLDER_RECORD)
+    {
+      entry->mode|=LINUX_S_IFDIR;
+      if((entry->mode & ~LINUX_S_IFMT)==0)
+	entry->mode|=LINUX_S_IRWXU|LINUX_S_IRGRP|LINUX_S_IXGRP|LINUX_S_IROTH|LINUX_S_IXOTH;
+    }
+    else
+    {
+      const uint32_t file_mode=hfsp_get16(&data[42]);
+      entry->mode|=((file_mode & LINUX_S_IFMT)==LINUX_S_IFLNK ? LINUX_S_IFLNK : LINUX_S_IFREG);
+      if((entry->mode & ~LINUX_S_IFMT)==0)
+	entry->mode|=LINUX_S_IRUSR|LINUX_S_IWUSR|LINUX_S_IRGRP|LINUX_S_IROTH;
+      if(hfsp_get32(&data[48])==HFSP_HLNK_TYPE && hfsp_get32(&data[52])==HFSP_HLNK_CREATOR)
+	entry->link=hfsp_get32(&data[44]);
+      entry->size=hfsp_get64(&data[88]);
+      hfsp_get_extents(entry->extents, &data[88+16]);
+    }
+    hfsp_name(name, sizeof(name), &node[offset+8], name_length);
+    entry->name=strdup(name);
+    if(entry->name==NULL)
+      continue;
+    if(type==HFSP_FOLDER_RECORD && deleted==0 && entry->parent==HFSP_ROOT_FOLDER_ID &&
+	strcmp(name, "HFS+ Private Data")==0)
+      ls->private_dir=entry->cnid;
+    ls->entries_nbr++;
+  }
+}
+
+static int hfsp_entry_cmp(const void *a, const void *b)
+{
+  const hfsp_dir_entry_t *ea=(const hfsp_dir_entry_t *)a;
+  const hfsp_dir_entry_t *eb=(const hfsp_dir_entry_t *)b;
+  if(ea->parent!=eb->parent)
+    return (ea->parent < eb->parent ? -1 : 1);
+  return strcmp(ea->name, eb->name);
+}
+
+static int hfsp_cnid_cmp(const void *a, const void *b)
+{
+  const hfsp_dir_entry_t *ea=(const hfsp_dir_entry_t *)a;
+  const hfsp_dir_entry_t *eb=(const hfsp_dir_entry_t *)b;
+  if(ea->cnid!=eb->cnid)
+    return (ea->cnid < eb->cnid ? -1 : 1);
+  /* The live record first */
+  if(ea->deleted!=eb->deleted)
+    return (ea->deleted < eb->deleted ? -1 : 1);
+  return 0;
+}
+
+static int hfsp_index_cmp(const void *a, const void *b)
+{
+  const hfsp_dir_cnid_t *ia=(const hfsp_dir_cnid_t *)a;
+  const hfsp_dir_cnid_t *ib=(const hfsp_dir_cnid_t *)b;
+  if(ia->cnid!=ib->cnid)
+    return (ia->cnid < ib->cnid ? -1 : 1);
+  return 0;
+}
+
+static const hfsp_dir_entry_t *hfsp_find_cnid(const struct hfsp_dir_struct *ls, const uint32_t cnid)
+{
+  unsigned int low=0;
+  unsigned int high=ls->entries_nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(ls->by_cnid[mid].cnid==cnid)
+      return &ls->entries[ls->by_cnid[mid].index];
+    if(ls->by_cnid[mid].cnid < cnid)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return NULL;
+}
+
+/* First entry of the folder parent */
+static unsigned int hfsp_find_parent(const struct hfsp_dir_struct *ls, const uint32_t parent)
+{
+  unsigned int low=0;
+  unsigned int high=ls->entries_nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(ls->entries[mid].parent < parent)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return low;
+}
+
+/* A record per catalog node ID: a deleted one only when the ID isn't
+ * used anymore. Then the entries are sorted by folder. */
+static void hfsp_entries_index(struct hfsp_dir_struct *ls)
+{
+  unsigned int i;
+  unsigned int j=0;
+  qsort(ls->entries, ls->entries_nbr, sizeof(hfsp_dir_entry_t), hfsp_cnid_cmp);
+  for(i=0; i<ls->entries_nbr; i++)
+  {
+    if(j > 0 && ls->entries[j-1].cnid==ls->entries[i].cnid)
+    {
+      free(ls->entries[i].name);
+      continue;
+    }
+    ls->entries[j++]=ls->entries[i];
+  }
+  ls->entries_nbr=j;
+  qsort(ls->entries, ls->entries_nbr, sizeof(hfsp_dir_entry_t), hfsp_entry_cmp);
+  ls->by_cnid=(hfsp_dir_cnid_t *)MALLOC((ls->entries_nbr + 1) * sizeof(hfsp_dir_cnid_t));
+  for(i=0; i<ls->entries_nbr; i++)
+  {
+    ls->by_cnid[i].cnid=ls->entries[i].cnid;
+    ls->by_cnid[i].index=i;
+  }
+  qsort(ls->by_cnid, ls->entries_nbr, sizeof(hfsp_dir_cnid_t), hfsp_index_cmp);
+  /* A hard link gets the data of the iNode<link> file of the private folder */
+  if(ls->private_dir==0)
+    return ;
+  for(i=0; i<ls->entries_nbr; i++)
+  {
+    hfsp_dir_entry_t *entry=&ls->entries[i];
+    const hfsp_dir_entry_t *target;
+    hfsp_dir_entry_t key;
+    char name[32];
+    if(entry->link==0)
+      continue;
+    snprintf(name, sizeof(name), "iNode%u", entry->link);
+    key.parent=ls->private_dir;
+    key.name=name;
+    target=(const hfsp_dir_entry_t *)bsearch(&key, ls->entries, ls->entries_nbr, sizeof(hfsp_dir_entry_t), hfsp_entry_cmp);
+    if(target!=NULL)
+    {
+      entry->data_id=target->cnid;
+      entry->size=target->size;
+      memcpy(entry->extents, target->extents, sizeof(entry->extents));
+    }
+  }
+}
+
+static void hfsp_add_file(file_info_t *dir_list, const hfsp_dir_entry_t *entry, const char *name, const uint32_t cnid)
+{
+  file_info_t *new_file=file_info_new(dir_list, name);
+  new_file->st_ino=cnid;
+  new_file->st_mode=entry->mode;
+  new_file->st_uid=entry->uid;
+  new_file->st_gid=entry->gid;
+  new_file->st_size=(LINUX_S_ISDIR(entry->mode) ? 0 : entry->size);
+  new_file->td_atime=hfsp_time(entry->atime);
+  new_file->td_mtime=hfsp_time(entry->mtime);
+  new_file->td_ctime=hfsp_time(entry->ctime);
+  new_file->status=(entry->deleted!=0 ? FILE_STATUS_DELETED : 0);
+  td_list_add_tail(&new_file->list, &dir_list->list);
+}
+
+static int hfsp_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *dir_list)
+{
+  const struct hfsp_dir_struct *ls=(const struct hfsp_dir_struct *)dir_data->private_dir_data;
+  const uint32_t folder=(first_inode < HFSP_ROOT_FOLDER_ID ? HFSP_ROOT_FOLDER_ID : first_inode);
+  unsigned int i;
+  (void)disk;
+  (void)partition;
+  if(folder!=HFSP_ROOT_FOLDER_ID)
+  {
+    const hfsp_dir_entry_t *entry=hfsp_find_cnid(ls, folder);
+    if(entry!=NULL)
+    {
+      hfsp_add_file(dir_list, entry, ".", entry->cnid);
+      hfsp_add_file(dir_list, entry, "..", entry->parent);
+    }
+  }
+  for(i=hfsp_find_parent(ls, folder); i<ls->entries_nbr && ls->entries[i].parent==folder; i++)
+  {
+    const hfsp_dir_entry_t *entry=&ls->entries[i];
+    if(entry->deleted!=0 && (dir_data->param & FLAG_LIST_DELETED)!=FLAG_LIST_DELETED)
+      continue;
+    hfsp_add_file(dir_list, entry, entry->name, entry->cnid);
+  }
+  return 0;
+}
+
+dir_partition_t dir_partition_hfsp_init(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const int verbose)
+{
+  struct hfsp_dir_struct *ls;
+  struct hfsp_vh *vh;
+  hfsp_dir_extent_t first[8];
+  hfsp_dir_fork_t fork;
+  int res;
+  vh=(struct hfsp_vh *)MALLOC(HFSP_BOOT_SECTOR_SIZE);
+  if(disk->pread(disk, vh, HFSP_BOOT_SECTOR_SIZE, partition->part_offset + 0x400) != HFSP_BOOT_SECTOR_SIZE)
+  {
+    log_error("Can't read HFS+ volume header.\n");
+    free(vh);
+    return DIR_PART_EIO;
+  }
+  if(test_HFSP(disk, vh, partition, 0, 0)!=0)
+  {
+    log_error("Not an HFS+ volume header.\n");
+    free(vh);
+    return DIR_PART_EIO;
+  }
+  ls=(struct hfsp_dir_struct *)MALLOC(sizeof(*ls));
+  memset(ls, 0, sizeof(*ls));
+  ls->blocksize=be32(vh->blocksize);
+  /* The extents overflow file has no overflow extents */
+  hfsp_get_extents(first, (const unsigned char *)&vh->ext_file.extents);
+  hfsp_fork_init(ls, &fork, HFSP_EXTENTS_FILE_ID, first, be64(vh->ext_file.total_size));
+  if(fork.size > 0)
+    hfsp_btree_stream(disk, partition, ls, &fork, &hfsp_extents_leaf, 0);
+  free(fork.extents);
+  qsort(ls->overflow, ls->overflow_nbr, sizeof(hfsp_dir_overflow_t), hfsp_overflow_cmp);
+  hfsp_get_extents(first, (const unsigned char *)&vh->cat_file.extents);
+  hfsp_fork_init(ls, &fork, HFSP_CATALOG_FILE_ID, first, be64(vh->cat_file.total_size));
+  res=hfsp_btree_stream(disk, partition, ls, &fork, &hfsp_catalog_leaf, 1);
+  free(fork.extents);
+  free(vh);
+  if(res < 0)
+  {
+    log_error("Can't read the HFS+ catalog.\n");
+    free(ls->overflow);
+    free(ls->entries);
+    free(ls);
+    return DIR_PART_EIO;
+  }
+  hfsp_entries_index(ls);
+  if(verbose > 0)
+    log_info("HFS+ catalog: %u records, %u overflow extent records\n",
+	ls->entries_nbr, ls->overflow_nbr);
+  strncpy(dir_data->current_directory,"/",sizeof(dir_data->current_directory));
+  dir_data->current_inode=HFSP_ROOT_FOLDER_ID;
+  dir_data->param=FLAG_LIST_DELETED;
+  dir_data->verbose=verbose;
+  dir_data->capabilities=CAPA_LIST_DELETED;
+  dir_data->copy_file=&hfsp_copy;
+  dir_data->close=&dir_partition_hfsp_close;
+  dir_data->local_dir=NULL;
+  dir_data->private_dir_data=ls;
+  dir_data->get_dir=&hfsp_dir;
+  return DIR_PART_OK;
+}
+
+static void dir_partition_hfsp_close(dir_data_t *dir_data)
+{
+  struct hfsp_dir_struct *ls=(struct hfsp_dir_struct*)dir_data->private_dir_data;
+  unsigned int i;
+  for(i=0; i<ls->entries_nbr; i++)
+    free(ls->entries[i].name);
+  free(ls->entries);
+  free(ls->by_cnid);
+  free(ls->overflow);
+  free(ls);
+}
+
+static copy_file_t hfsp_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file)
+{
+  const struct hfsp_dir_struct *ls=(const struct hfsp_dir_struct *)dir_data->private_dir_data;
+  const hfsp_dir_entry_t *entry=hfsp_find_cnid(ls, file->st_ino);
+  hfsp_dir_fork_t fork;
+  unsigned char *buffer;
+  char *new_file;
+  FILE *f_out;
+  uint64_t offset;
+  if(entry==NULL)
+    return CP_STAT_FAILED;
+  f_out=fopen_local(&new_file, dir_data->local_dir, dir_data->current_directory);
+  if(!f_out)
+  {
+    log_critical("Can't create file %s: \n",new_file);
+    free(new_file);
+    return CP_CREATE_FAILED;
+  }
+  hfsp_fork_init(ls, &fork, entry->data_id, entry->extents, entry->size);
+  log_trace("hfsp_copy dst=%s cnid=%u size=%llu extents=%u\n", new_file,
+      entry->cnid, (long long unsigned)entry->size, fork.extents_nbr);
+  buffer=(unsigned char *)MALLOC(HFSP_DIR_READ_SIZE);
+  for(offset=0; offset < fork.size; offset+=HFSP_DIR_READ_SIZE)
+  {
+    const unsigned int toread=(fork.size - offset > HFSP_DIR_READ_SIZE ? HFSP_DIR_READ_SIZE : fork.size - offset);
+    const unsigned int read=hfsp_fork_pread(disk, partition, ls, &fork, buffer, toread, offset);
+    if(read < toread)
+    {
+      log_error("hfsp_copy: Can't read %s at offset %llu.\n", new_file, (long long unsigned)(offset + read));
+      memset(buffer + read, 0, toread - read);
+    }
+    if(fwrite(buffer, 1, toread, f_out) != toread)
+    {
+      log_error("hfsp_copy: no space left on destination.\n");
+      fclose(f_out);
+      set_date(new_file, file->td_atime, file->td_mtime);
+      free(new_file);
+      free(buffer);
+      free(fork.extents);
+      return CP_NOSPACE;
+    }
+  }
+  fclose(f_out);
+  set_date(new_file, file->td_atime, file->td_mtime);
+  free(new_file);
+  free(buffer);
+  free(fork.extents);
+  return CP_OK;
+}
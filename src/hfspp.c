@@ -0,0 +1,122 @@
+/*
+
+    File: hfspp.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+  
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+  
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+  
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "hfsp.h"
+#include "hfspp.h"
+#include "log.h"
+
+#define HFSP_BITMAP_READ_SIZE	(256*512)
+
+unsigned int hfsp_remove_used_space(disk_t *disk, const partition_t *partition, alloc_data_t *list_search_space)
+{
+  struct hfsp_vh *vh;
+  unsigned char *buffer;
+  unsigned int blocksize;
+  uint32_t total_blocks;
+  uint32_t block=0;
+  uint64_t start_used=0;
+  uint64_t end_used=0;
+  unsigned int i;
+  vh=(struct hfsp_vh *)MALLOC(HFSP_BOOT_SECTOR_SIZE);
+  if(disk->pread(disk, vh, HFSP_BOOT_SECTOR_SIZE, partition->part_offset + 0x400) != HFSP_BOOT_SECTOR_SIZE ||
+      test_HFSP(disk, vh, NULL, 0, 0)!=0)
+  {
+    log_error("Can't read HFS+ volume header.\n");
+    free(vh);
+    return 0;
+  }
+  blocksize=be32(vh->blocksize);
+  total_blocks=be32(vh->total_blocks);
+  log_trace("hfsp_remove_used_space\n");
+  buffer=(unsigned char *)MALLOC(HFSP_BITMAP_READ_SIZE);
+  /* The allocation file is a bitmap, most significant bit first.
+   * Only its first 8 extents are used, the others are in the extents
+   * overflow file. */
+  for(i=0; i<8 && block<total_blocks; i++)
+  {
+    const uint64_t extent_start=(uint64_t)be32(vh->alloc_file.extents[i].start_block) * blocksize;
+    const uint64_t extent_size=(uint64_t)be32(vh->alloc_file.extents[i].block_count) * blocksize;
+    uint64_t pos;
+    if(extent_size==0)
+      break;
+    for(pos=0; pos<extent_size && block<total_blocks; pos+=HFSP_BITMAP_READ_SIZE)
+    {
+      const unsigned int read_size=(extent_size - pos < HFSP_BITMAP_READ_SIZE ? extent_size - pos : HFSP_BITMAP_READ_SIZE);
+      unsigned int j;
+      if(disk->pread(disk, buffer, read_size, partition->part_offset + extent_start + pos) != (int)read_size)
+      {
+	log_error("HFS+: Can't read allocation file.\n");
+	free(buffer);
+	free(vh);
+	if(start_used != end_used)
+	  del_search_space(list_search_space, start_used, end_used);
+	return blocksize;
+      }
+      for(j=0; j<read_size && block<total_blocks; j++)
+      {
+	unsigned int bit;
+	if(buffer[j]==0)
+	{
+	  block+=8;
+	  continue;
+	}
+	for(bit=0; bit<8 && block<total_blocks; bit++, block++)
+	{
+	  if(((buffer[j]<<bit)&0x80) != 0)
+	  {
+	    /* Not free */
+	    const uint64_t offset=partition->part_offset + (uint64_t)block * blocksize;
+	    if(end_used+1==offset)
+	      end_used+=blocksize;
+	    else
+	    {
+	      if(start_used != end_used)
+		del_search_space(list_search_space, start_used, end_used);
+	      start_used=offset;
+	      end_used=offset + blocksize - 1;
+	    }
+	  }
+	}
+      }
+    }
+  }
+  if(block<total_blocks)
+    log_warning("HFS+: allocation file is fragmented, blocks %lu-%lu are considered free.\n",
+	(long unsigned)block, (long unsigned)(total_blocks-1));
+  if(start_used != end_used)
+    del_search_space(list_search_space, start_used, end_used);
+  free(buffer);
+  free(vh);
+  return blocksize;
+}
@@ -33,26 +33,31 @@
 #include <errno.h>
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
 #include "io_redir.h"
+#include "hdstats.h"
 #include "log.h"
 
 //#define DEBUG_IO_REDIR 1
 
-typedef struct struclist_redir_t list_redir_t;
-struct struclist_redir_t
+typedef struct
 {
   uint64_t org_offset;
   uint64_t new_offset;
   unsigned int size;
   const void *mem;
-  list_redir_t *prev;
-  list_redir_t *next;
-};
+} redir_t;
 
+/* Redirections sorted by org_offset, they never overlap */
 struct info_io_redir
 {
   disk_t *disk_car;
-  list_redir_t *list_redir;
+  redir_t *redirs;
+  unsigned int nbr;
+  unsigned int size;
+#if !defined(DISABLED_FOR_FRAMAC)
+  disk_stats_t *stats;
+#endif
 };
 
 /*@
@@ -71,6 +76,40 @@ static int io_redir_pread(disk_t *disk_car, void *buffer, const unsigned int cou
   @*/
 static void io_redir_clean(disk_t *disk_car);
 
+/*@
+  @ requires \valid(disk_car);
+  @ requires valid_disk(disk_car);
+  @ decreases 0;
+  @*/
+static void io_redir_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint);
+
+/**
+ * @brief Finds the first redirection ending after offset.
+ *
+ * @param data Redirection data.
+ * @param offset Offset on the disk.
+ * @return Index of the first redirection whose end is after offset, data->nbr if none.
+ */
+/*@
+  @ requires \valid_read(data);
+  @ assigns \nothing;
+  @*/
+static unsigned int io_redir_find(const struct info_io_redir *data, const uint64_t offset)
+{
+  unsigned int low=0;
+  unsigned int high=data->nbr;
+  /* The redirections don't overlap, their ends are sorted too */
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(data->redirs[mid].org_offset + data->redirs[mid].size <= offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return low;
+}
+
 /**
  * @brief Adds a redirection for disk I/O operations.
  *
@@ -100,41 +139,49 @@ int io_redir_add_redir(disk_t *disk_car, const uint64_t org_offset, const unsign
 #endif
     memcpy(old_disk_car,disk_car,sizeof(*old_disk_car));
     data->disk_car=old_disk_car;
-    data->list_redir=NULL;
+    data->redirs=NULL;
+    data->nbr=0;
+    data->size=0;
+#if !defined(DISABLED_FOR_FRAMAC)
+    data->stats=disk_stats_new("io_redir", disk_car->device);
+#endif
     disk_car->write_used=0;
     disk_car->data=data;
     disk_car->description=old_disk_car->description;
     disk_car->pwrite=old_disk_car->pwrite;
     disk_car->pread=&io_redir_pread;
     disk_car->clean=&io_redir_clean;
+    disk_car->advise=&io_redir_advise;
   }
   {
     struct info_io_redir *data=(struct info_io_redir *)disk_car->data;
-    list_redir_t *prev_redir=NULL;
-    list_redir_t *current_redir;
-    for(current_redir=data->list_redir;(current_redir!=NULL) && org_offset<current_redir->org_offset+current_redir->size;current_redir=current_redir->next)
-      prev_redir=current_redir;
-    if(current_redir!=NULL && org_offset>=current_redir->org_offset)
+    const unsigned int pos=io_redir_find(data, org_offset);
+    redir_t *new_redir;
+    if(pos < data->nbr && data->redirs[pos].org_offset < org_offset + size)
     {
       log_critical("io_redir_add_redir failed: already redirected\n");
       return 1;
     }
-    {
-      list_redir_t *new_redir;
 #ifdef DEBUG_IO_REDIR
-      log_trace("io_redir_add_redir: add redirection\n");
+    log_trace("io_redir_add_redir: add redirection\n");
 #endif
-      new_redir=(list_redir_t*)MALLOC(sizeof(*new_redir));
-      new_redir->org_offset=org_offset;
-      new_redir->size=size;
-      new_redir->new_offset=new_offset;
-      new_redir->mem=mem;
-      new_redir->next=current_redir;
-      if(prev_redir!=NULL)
-	prev_redir->next=new_redir;
-      else
-	data->list_redir=new_redir;
+    if(data->nbr==data->size)
+    {
+      redir_t *redirs;
+      data->size=(data->size==0 ? 16 : 2 * data->size);
+      redirs=(redir_t *)MALLOC(data->size * sizeof(*redirs));
+      if(data->nbr > 0)
+	memcpy(redirs, data->redirs, data->nbr * sizeof(*redirs));
+      free(data->redirs);
+      data->redirs=redirs;
     }
+    memmove(&data->redirs[pos+1], &data->redirs[pos], (data->nbr - pos) * sizeof(*new_redir));
+    data->nbr++;
+    new_redir=&data->redirs[pos];
+    new_redir->org_offset=org_offset;
+    new_redir->size=size;
+    new_redir->new_offset=new_offset;
+    new_redir->mem=mem;
   }
   return 0;
 }
@@ -158,27 +205,25 @@ int io_redir_del_redir(disk_t *disk_car, uint64_t org_offset)
   }
   {
     struct info_io_redir *data=(struct info_io_redir *)disk_car->data;
-    list_redir_t *current_redir;
-    for(current_redir=data->list_redir;(current_redir!=NULL) && org_offset!=current_redir->org_offset;current_redir=current_redir->next);
-    if(current_redir!=NULL)
+    const unsigned int pos=io_redir_find(data, org_offset);
+    if(pos < data->nbr && data->redirs[pos].org_offset==org_offset)
     {
 #ifdef DEBUG_IO_REDIR
       log_trace("io_redir_del_redir: remove redirection\n");
 #endif
-      if(current_redir->prev!=NULL)
-	current_redir->prev->next=current_redir->next;
-      if(current_redir->next!=NULL)
-	current_redir->next->prev=current_redir->prev;
-      if(data->list_redir==current_redir)
-	data->list_redir=current_redir->next;
-      free(current_redir);
-      if(data->list_redir==NULL)
+      data->nbr--;
+      memmove(&data->redirs[pos], &data->redirs[pos+1], (data->nbr - pos) * sizeof(data->redirs[0]));
+      if(data->nbr==0)
       {
 #ifdef DEBUG_IO_REDIR
 	log_trace("io_redir_del_redir: uninstall functions\n");
 #endif
 	memcpy(disk_car,data->disk_car,sizeof(*disk_car));
+#if !defined(DISABLED_FOR_FRAMAC)
+	disk_stats_free(data->stats);
+#endif
 	free(data->disk_car);
+	free(data->redirs);
 	free(data);
       }
       return 0;
@@ -193,6 +238,7 @@ int io_redir_del_redir(disk_t *disk_car, uint64_t org_offset)
  *
  * Reads data from the disk, handling any installed redirections. If the requested region
  * falls within a redirected region, reads from the new offset or memory buffer as appropriate.
+ * A read that doesn't intersect any redirection goes straight to the disk.
  *
  * @param disk_car Pointer to the disk structure.
  * @param buffer Pointer to the buffer to read data into.
@@ -200,24 +246,24 @@ int io_redir_del_redir(disk_t *disk_car, uint64_t org_offset)
  * @param offset Offset to read from.
  * @return Number of bytes read, or a negative value on error.
  */
-static int io_redir_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+static int io_redir_pread_aux(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
 {
-  struct info_io_redir *data=(struct info_io_redir *)disk_car->data;
+  const struct info_io_redir *data=(const struct info_io_redir *)disk_car->data;
   uint64_t current_offset=offset;
   unsigned int current_count=count;
-  list_redir_t *current_redir;
+  unsigned int pos=io_redir_find(data, offset);
 #ifdef DEBUG_IO_REDIR
   log_trace("io_redir_pread: count=%u offset=%llu\n", count, (long long unsigned) offset);
 #endif
+  if(pos==data->nbr || data->redirs[pos].org_offset >= offset + count)
+    return data->disk_car->pread(data->disk_car, buffer, count, offset);
   while(current_count!=0)
   {
     unsigned int read_size;
-    int res=0;
-    for(current_redir=data->list_redir;(current_redir!=NULL) && 
-      !(current_redir->org_offset<=offset && offset<current_redir->org_offset+current_redir->size);
-      current_redir=current_redir->next);
-    if(current_redir!=NULL)
+    int res;
+    if(pos < data->nbr && data->redirs[pos].org_offset < current_offset + current_count)
     {
+      const redir_t *current_redir=&data->redirs[pos];
       if(current_redir->org_offset>current_offset)
       {
 	/* Read data before redirection */
@@ -226,27 +272,30 @@ static int io_redir_pread(disk_t *disk_car, void *buffer, const unsigned int cou
 	log_trace("io_redir_pread: read %u bytes before redirection\n",read_size);
 #endif
 	res=data->disk_car->pread(data->disk_car, buffer, read_size, current_offset);
-	current_count-=read_size;
-	current_offset+=read_size;
-	buffer=(unsigned char*)buffer+read_size;
       }
-      /* Redirection */
-      read_size=(current_count>current_redir->size?current_redir->size:current_count);
-      if(current_redir->mem!=NULL)
+      else
       {
+	/* Redirection */
+	const unsigned int skip=current_offset - current_redir->org_offset;
+	read_size=current_redir->size - skip;
+	if(read_size > current_count)
+	  read_size=current_count;
+	if(current_redir->mem!=NULL)
+	{
 #ifdef DEBUG_IO_REDIR
-	log_trace("io_redir_pread: copy %u bytes from memory\n",read_size);
+	  log_trace("io_redir_pread: copy %u bytes from memory\n",read_size);
 #endif
-	memcpy(buffer, (const unsigned char*)current_redir->mem + current_offset - current_redir->org_offset, read_size);
-	res=read_size;
-      }
-      else
-      {
+	  memcpy(buffer, (const unsigned char*)current_redir->mem + skip, read_size);
+	  res=read_size;
+	}
+	else
+	{
 #ifdef DEBUG_IO_REDIR
-	log_trace("io_redir_pread: read %u from another position\n",read_size);
+	  log_trace("io_redir_pread: read %u from another position\n",read_size);
 #endif
-	res=data->disk_car->pread(data->disk_car, buffer, read_size, current_redir->new_offset + current_offset - current_redir->org_offset);
-	    ;
+	  res=data->disk_car->pread(data->disk_car, buffer, read_size, current_redir->new_offset + skip);
+	}
+	pos++;
       }
     }
     else
@@ -266,6 +315,36 @@ static int io_redir_pread(disk_t *disk_car, void *buffer, const unsigned int cou
   return count;
 }
 
+/* Account the reads, redirected or not, in the io_redir layer statistics */
+static int io_redir_pread(disk_t *disk_car, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#if !defined(DISABLED_FOR_FRAMAC)
+  const struct info_io_redir *data=(const struct info_io_redir *)disk_car->data;
+  const uint64_t start=disk_stats_clock();
+  const int res=io_redir_pread_aux(disk_car, buffer, count, offset);
+  disk_stats_read(data->stats, count, res, start);
+  return res;
+#else
+  return io_redir_pread_aux(disk_car, buffer, count, offset);
+#endif
+}
+
+/**
+ * @brief Passes the hint down to the original disk.
+ *
+ * The redirected regions are small, the hint is given for the whole range.
+ *
+ * @param disk_car Pointer to the disk structure.
+ * @param offset Start of the range.
+ * @param length Size of the range.
+ * @param hint TESTDISK_ADVISE_* hint.
+ */
+static void io_redir_advise(disk_t *disk_car, const uint64_t offset, const uint64_t length, const int hint)
+{
+  const struct info_io_redir *data=(const struct info_io_redir *)disk_car->data;
+  disk_advise(data->disk_car, offset, length, hint);
+}
+
 /**
  * @brief Cleans up and removes all installed I/O redirections for the disk.
  *
@@ -279,7 +358,11 @@ static void io_redir_clean(disk_t *disk_car)
   {
     struct info_io_redir *data=(struct info_io_redir *)disk_car->data;
     data->disk_car->clean(data->disk_car);
+#if !defined(DISABLED_FOR_FRAMAC)
+    disk_stats_free(data->stats);
+#endif
     free(data->disk_car);
+    free(data->redirs);
     free(disk_car->data);
     disk_car->data=NULL;
   }
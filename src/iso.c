@@ -57,6 +57,31 @@ static int test_ISO(const struct iso_primary_descriptor *iso)
   return 0;
 }
 
+/* A UDF volume without ISO9660 file system starts its volume recognition
+ * sequence with a BEA01 descriptor */
+/*@
+  @ requires \valid_read(iso);
+  @ assigns  \nothing;
+  @*/
+static int test_UDF(const struct iso_primary_descriptor *iso)
+{
+  static const unsigned char bea_header[7]= { 0x00, 'B', 'E', 'A', '0', '1', 0x01};
+  if(memcmp(iso, bea_header, sizeof(bea_header))!=0)
+    return 1;
+  return 0;
+}
+
+/*@
+  @ requires \valid(partition);
+  @ requires valid_partition(partition);
+  @ assigns  partition->upart_type, partition->info[0 .. sizeof(partition->info)-1];
+  @*/
+static void set_UDF_info(partition_t *partition)
+{
+  partition->upart_type=UP_ISO;
+  snprintf(partition->info, sizeof(partition->info), "UDF");
+}
+
 int check_ISO(disk_t *disk_car, partition_t *partition)
 {
   unsigned char *buffer=(unsigned char*)MALLOC(ISO_PD_SIZE);
@@ -68,8 +93,11 @@ int check_ISO(disk_t *disk_car, partition_t *partition)
   }
   if(test_ISO((struct iso_primary_descriptor*)buffer)!=0)
   {
+    const int res=test_UDF((struct iso_primary_descriptor*)buffer);
+    if(res==0)
+      set_UDF_info(partition);
     free(buffer);
-    return 1;
+    return res;
   }
   set_ISO_info((struct iso_primary_descriptor*)buffer, partition);
   free(buffer);
@@ -97,7 +125,13 @@ static void set_ISO_info(const struct iso_primary_descriptor *iso, partition_t *
 int recover_ISO(const struct iso_primary_descriptor *iso, partition_t *partition)
 {
   if(test_ISO(iso)!=0)
-    return 1;
+  {
+    /* The size is in the UDF descriptors */
+    if(test_UDF(iso)!=0)
+      return 1;
+    set_UDF_info(partition);
+    return 0;
+  }
   set_ISO_info(iso, partition);
   /*@ assert \valid_read(iso); */
   /*@ assert \valid(partition); */
@@ -0,0 +1,1411 @@
+/*
+
+    File: iso_dir.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "dir.h"
+#include "iso_dir.h"
+#include "log.h"
+#include "setdate.h"
+#include "unicode.h"
+
+#define ISO_DIR_READ_SIZE	(4*1024*1024)
+/* Larger directories are assumed to be corrupted */
+#define ISO_DIR_MAX_DIR_SIZE	(64*1024*1024)
+#define ISO_DIR_ROOT_INODE	2
+#define ISO_VRS_OFFSET		32768
+#define ISO_VRS_SIZE		2048
+#define ISO_VRS_MAX		64
+/* Directory record */
+#define ISO_DR_DIRECTORY	0x02
+#define ISO_DR_MULTI_EXTENT	0x80
+#define ISO_DR_SIZE		33
+/* Continuation areas of a System Use field */
+#define ISO_SUSP_MAX_CE		8
+/* UDF descriptor tags */
+#define UDF_TAG_AVDP		2
+#define UDF_TAG_PD		5
+#define UDF_TAG_LVD		6
+#define UDF_TAG_TD		8
+#define UDF_TAG_FSD		256
+#define UDF_TAG_FID		257
+#define UDF_TAG_AED		258
+#define UDF_TAG_IE		259
+#define UDF_TAG_FE		261
+#define UDF_TAG_EFE		266
+#define UDF_AVDP_LOCATION	256
+#define UDF_MAX_MAPS		4
+#define UDF_MAX_VDS		64
+/* Allocation extent descriptors and indirect entries followed */
+#define UDF_MAX_HOPS		1024
+#define UDF_FILE_DIRECTORY	4
+#define UDF_FILE_SYMLINK	12
+#define UDF_FID_DIRECTORY	0x02
+#define UDF_FID_DELETED		0x04
+#define UDF_FID_PARENT		0x08
+
+typedef struct
+{
+  uint64_t offset;		/* In bytes, from the start of the partition */
+  uint64_t size;
+  unsigned int sparse;		/* Not recorded, read as zeroes */
+} iso_dir_extent_t;
+
+typedef struct
+{
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t size;
+  time_t atime;
+  time_t mtime;
+  time_t ctime;
+} iso_dir_stat_t;
+
+/* A directory or a file already listed: the inode is its index + 2 */
+typedef struct
+{
+  uint64_t key;			/* ISO9660: offset of the data, UDF: ICB location */
+  uint32_t parent;
+  iso_dir_stat_t st;
+  iso_dir_extent_t *extents;	/* ISO9660 only, UDF reads the ICB again */
+  unsigned int extents_nbr;
+} iso_dir_node_t;
+
+/* The metadata file of a metadata partition, lbn to lbn + count - 1 are
+ * the blocks block to block + count - 1 of the volume */
+typedef struct
+{
+  uint32_t lbn;
+  uint32_t count;
+  uint64_t block;
+} udf_dir_run_t;
+
+typedef struct
+{
+  unsigned int metadata;
+  uint32_t start;
+  uint32_t length;
+  udf_dir_run_t *runs;
+  unsigned int runs_nbr;
+} udf_dir_map_t;
+
+typedef struct
+{
+  uint32_t number;
+  uint32_t start;
+  uint32_t length;
+} udf_dir_pd_t;
+
+/* The data of a UDF file entry */
+typedef struct
+{
+  unsigned int file_type;
+  iso_dir_stat_t st;
+  iso_dir_extent_t *extents;
+  unsigned int extents_nbr;
+  unsigned int extents_alloc;
+} udf_dir_icb_t;
+
+/* What the Rock Ridge entries of a directory record give */
+typedef struct
+{
+  char name[DIR_NAME_LEN];
+  unsigned int name_len;
+  unsigned int has_name;
+  unsigned int has_mode;
+  unsigned int has_mtime;
+  uint32_t child;		/* CL: the directory has been relocated there */
+  unsigned int relocated;	/* RE: listed from its CL entry only */
+  iso_dir_stat_t st;
+} iso_dir_rr_t;
+
+struct iso_dir_struct
+{
+  unsigned int udf;
+  unsigned int block_size;
+  unsigned int joliet;
+  unsigned int rock_ridge;
+  unsigned int susp_skip;
+  iso_dir_node_t *nodes;
+  unsigned int nodes_nbr;
+  unsigned int nodes_alloc;
+  uint32_t *hash;		/* index + 1 of the nodes, by key */
+  unsigned int hash_size;
+  udf_dir_map_t maps[UDF_MAX_MAPS];
+  unsigned int maps_nbr;
+};
+
+static int iso_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *dir_list);
+static copy_file_t iso_dir_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file);
+static void dir_partition_iso_close(dir_data_t *dir_data);
+
+static uint16_t iso_get16(const unsigned char *p)
+{
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return le16(v);
+}
+
+static uint32_t iso_get32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return le32(v);
+}
+
+static uint64_t iso_get64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return le64(v);
+}
+
+/* UTC date to time_t, tz is the offset from UTC in minutes */
+static time_t iso_dir_time(const int year, const unsigned int month, const unsigned int day,
+    const unsigned int hour, const unsigned int minute, const unsigned int second, const int tz)
+{
+  unsigned int y;
+  unsigned int doy;
+  unsigned int doe;
+  long t;
+  if(year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 ||
+      hour > 23 || minute > 59 || second > 60)
+    return 0;
+  /* Days from 1970-01-01 of the year starting on March 1st */
+  y=year - (month <= 2 ? 1 : 0);
+  doy=(153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  doe=(y % 400) * 365 + (y % 400) / 4 - (y % 400) / 100 + doy;
+  t=((long)(y / 400) * 146097 + doe - 719468) * 86400 +
+    hour * 3600 + minute * 60 + second - (long)tz * 60;
+  return (t < 0 ? 0 : (time_t)t);
+}
+
+/* The 7 bytes date of a directory record or of a short Rock Ridge TF */
+static time_t iso9660_time7(const unsigned char *p)
+{
+  return iso_dir_time(1900 + p[0], p[1], p[2], p[3], p[4], p[5], 15 * (signed char)p[6]);
+}
+
+/* The 17 bytes date "YYYYMMDDHHMMSScc" and the offset from UTC */
+static time_t iso9660_time17(const unsigned char *p)
+{
+  unsigned int v[6];
+  static const unsigned int digits[6]={ 4, 2, 2, 2, 2, 2 };
+  unsigned int i;
+  unsigned int pos=0;
+  for(i=0; i<6; i++)
+  {
+    unsigned int j;
+    v[i]=0;
+    for(j=0; j<digits[i]; j++, pos++)
+    {
+      if(p[pos] < '0' || p[pos] > '9')
+	return 0;
+      v[i]=v[i] * 10 + p[pos] - '0';
+    }
+  }
+  return iso_dir_time(v[0], v[1], v[2], v[3], v[4], v[5], 15 * (signed char)p[16]);
+}
+
+/* ECMA-167 timestamp */
+static time_t udf_time(const unsigned char *p)
+{
+  const unsigned int type_tz=iso_get16(p);
+  int tz=0;
+  if((type_tz >> 12)==1 && (type_tz & 0xfff)!=0x801)
+  {
+    tz=type_tz & 0xfff;
+    if(tz >= 0x800)
+      tz-=0x1000;
+  }
+  return iso_dir_time((int16_t)iso_get16(&p[2]), p[4], p[5], p[6], p[7], p[8], tz);
+}
+
+static int iso_dir_pread(disk_t *disk, const partition_t *partition, void *buffer, const unsigned int size, const uint64_t offset)
+{
+  return ((unsigned)disk->pread(disk, buffer, size, partition->part_offset + offset)==size ? 0 : -1);
+}
+
+/* Read size bytes of the data described by extents from offset, return
+ * the number of bytes read */
+static unsigned int iso_dir_extents_pread(disk_t *disk, const partition_t *partition, const iso_dir_extent_t *extents, const unsigned int extents_nbr, unsigned char *buffer, const unsigned int size, const uint64_t offset)
+{
+  uint64_t extent_offset=0;
+  unsigned int done=0;
+  unsigned int i;
+  for(i=0; i<extents_nbr && done < size; i++)
+  {
+    const uint64_t pos=offset + done;
+    if(pos < extent_offset + extents[i].size)
+    {
+      const uint64_t in_extent=pos - extent_offset;
+      const unsigned int toread=(extents[i].size - in_extent < size - done ? extents[i].size - in_extent : size - done);
+      if(extents[i].sparse!=0)
+	memset(buffer + done, 0, toread);
+      else if(iso_dir_pread(disk, partition, buffer + done, toread, extents[i].offset + in_extent) < 0)
+	return done;
+      done+=toread;
+    }
+    extent_offset+=extents[i].size;
+  }
+  return done;
+}
+
+static void iso_dir_extent_add(iso_dir_extent_t **extents, unsigned int *extents_nbr, unsigned int *extents_alloc, const uint64_t offset, const uint64_t size, const unsigned int sparse)
+{
+  if(*extents_nbr==*extents_alloc)
+  {
+    *extents_alloc=(*extents_alloc==0 ? 4 : 2 * *extents_alloc);
+    *extents=(iso_dir_extent_t *)realloc(*extents, *extents_alloc * sizeof(iso_dir_extent_t));
+    if(*extents==NULL)
+    {
+      log_critical("iso_dir_extent_add: not enough memory\n");
+      exit(1);
+    }
+  }
+  (*extents)[*extents_nbr].offset=offset;
+  (*extents)[*extents_nbr].size=size;
+  (*extents)[*extents_nbr].sparse=sparse;
+  (*extents_nbr)++;
+}
+
+/* Read the first size bytes of the data, NULL if it can't be read */
+static unsigned char *iso_dir_extents_read(disk_t *disk, const partition_t *partition, const iso_dir_extent_t *extents, const unsigned int extents_nbr, const uint64_t size)
+{
+  unsigned char *buffer;
+  if(size==0 || size > ISO_DIR_MAX_DIR_SIZE)
+    return NULL;
+  buffer=(unsigned char *)MALLOC(size);
+  if(iso_dir_extents_pread(disk, partition, extents, extents_nbr, buffer, size, 0)!=size)
+  {
+    free(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+static unsigned int iso_dir_hash(const struct iso_dir_struct *ls, const uint64_t key, const uint64_t size)
+{
+  return (unsigned int)(((key ^ (size << 17)) * 0x9E3779B97F4A7C15ULL) >> 32) & (ls->hash_size - 1);
+}
+
+static void iso_dir_hash_insert(struct iso_dir_struct *ls, const unsigned int index)
+{
+  unsigned int h=iso_dir_hash(ls, ls->nodes[index].key, ls->nodes[index].st.size);
+  while(ls->hash[h]!=0)
+    h=(h + 1) & (ls->hash_size - 1);
+  ls->hash[h]=index + 1;
+}
+
+/* Inode of the node for key and size, the node is added with parent, st
+ * and extents if it isn't known yet; else extents is freed */
+static uint32_t iso_dir_node_add(struct iso_dir_struct *ls, const uint64_t key, const uint32_t parent, const iso_dir_stat_t *st, iso_dir_extent_t *extents, const unsigned int extents_nbr)
+{
+  iso_dir_node_t *node;
+  unsigned int h;
+  if(ls->hash_size > 0)
+  {
+    for(h=iso_dir_hash(ls, key, st->size); ls->hash[h]!=0; h=(h + 1) & (ls->hash_size - 1))
+    {
+      const unsigned int index=ls->hash[h] - 1;
+      if(ls->nodes[index].key==key && ls->nodes[index].st.size==st->size)
+      {
+	free(extents);
+	return index + ISO_DIR_ROOT_INODE;
+      }
+    }
+  }
+  if(ls->nodes_nbr==ls->nodes_alloc)
+  {
+    ls->nodes_alloc=(ls->nodes_alloc==0 ? 1024 : 2 * ls->nodes_alloc);
+    ls->nodes=(iso_dir_node_t *)realloc(ls->nodes, ls->nodes_alloc * sizeof(iso_dir_node_t));
+    if(ls->nodes==NULL)
+    {
+      log_critical("iso_dir_node_add: not enough memory\n");
+      exit(1);
+    }
+  }
+  node=&ls->nodes[ls->nodes_nbr++];
+  node->key=key;
+  node->parent=parent;
+  node->st=*st;
+  node->extents=extents;
+  node->extents_nbr=extents_nbr;
+  /* Half empty at most */
+  if(2 * ls->nodes_nbr > ls->hash_size)
+  {
+    unsigned int i;
+    free(ls->hash);
+    ls->hash_size=(ls->hash_size==0 ? 2048 : 2 * ls->hash_size);
+    ls->hash=(uint32_t *)MALLOC(ls->hash_size * sizeof(uint32_t));
+    memset(ls->hash, 0, ls->hash_size * sizeof(uint32_t));
+    for(i=0; i<ls->nodes_nbr; i++)
+      iso_dir_hash_insert(ls, i);
+  }
+  else
+    iso_dir_hash_insert(ls, ls->nodes_nbr - 1);
+  return ls->nodes_nbr - 1 + ISO_DIR_ROOT_INODE;
+}
+
+static const iso_dir_node_t *iso_dir_node(const struct iso_dir_struct *ls, const unsigned long int inode)
+{
+  if(inode < ISO_DIR_ROOT_INODE || inode - ISO_DIR_ROOT_INODE >= ls->nodes_nbr)
+    return NULL;
+  return &ls->nodes[inode - ISO_DIR_ROOT_INODE];
+}
+
+static void iso_dir_add_file(file_info_t *dir_list, const char *name, const uint32_t inode, const iso_dir_stat_t *st, const unsigned int status)
+{
+  file_info_t *new_file=file_info_new(dir_list, name);
+  new_file->st_ino=inode;
+  new_file->st_mode=st->mode;
+  new_file->st_uid=st->uid;
+  new_file->st_gid=st->gid;
+  new_file->st_size=(LINUX_S_ISDIR(st->mode) ? 0 : st->size);
+  new_file->td_atime=st->atime;
+  new_file->td_mtime=st->mtime;
+  new_file->td_ctime=st->ctime;
+  new_file->status=status;
+  td_list_add_tail(&new_file->list, &dir_list->list);
+}
+
+/* Convert len UTF-16 characters, big endian if be is set, to UTF-8; '/'
+ * is shown as '_' and the NUL characters are dropped */
+static void iso_dir_name_utf16(char *name, const unsigned int name_size, const unsigned char *unicode, const unsigned int len, const unsigned int be)
+{
+  unsigned char le[2*255];
+  unsigned int i;
+  unsigned int j=0;
+  for(i=0; i<len && i<255; i++)
+  {
+    le[2*j]=unicode[2*i + (be!=0 ? 1 : 0)];
+    le[2*j+1]=unicode[2*i + (be!=0 ? 0 : 1)];
+    if(le[2*j]==0 && le[2*j+1]==0)
+      continue;
+    if(le[2*j+1]==0 && le[2*j]=='/')
+      le[2*j]='_';
+    j++;
+  }
+  if(j==0)
+  {
+    name[0]='\0';
+    return ;
+  }
+  if(UTF16le2utf8(name, name_size, le, j) < 0)
+  {
+    for(i=0; i<j && i<name_size-1; i++)
+      name[i]=(le[2*i+1]==0 && le[2*i] < 0x80 ? le[2*i] : '_');
+    name[i]='\0';
+  }
+}
+
+/* Without the ";1" version and the '.' of a name without extension */
+static void iso9660_name_chomp(char *name)
+{
+  char *version=strrchr(name, ';');
+  size_t len;
+  if(version!=NULL && version!=name)
+    *version='\0';
+  len=strlen(name);
+  if(len > 1 && name[len-1]=='.')
+    name[len-1]='\0';
+}
+
+static void iso9660_name(const struct iso_dir_struct *ls, char *name, const unsigned int name_size, const unsigned char *id, const unsigned int len)
+{
+  if(ls->joliet!=0)
+    iso_dir_name_utf16(name, name_size, id, len / 2, 1);
+  else
+  {
+    unsigned int i;
+    for(i=0; i<len && i<name_size-1; i++)
+      name[i]=(id[i]=='/' || id[i]==0 ? '_' : (char)id[i]);
+    name[i]='\0';
+  }
+  iso9660_name_chomp(name);
+}
+
+/* Parse the System Use Sharing Protocol entries of su and of its
+ * continuation areas */
+static void iso9660_susp(disk_t *disk, const partition_t *partition, const struct iso_dir_struct *ls, const unsigned char *su, unsigned int su_len, iso_dir_rr_t *rr)
+{
+  unsigned char *ce_buffer=NULL;
+  unsigned int hops=0;
+  while(1)
+  {
+    uint32_t ce_block=0;
+    uint32_t ce_offset=0;
+    uint32_t ce_len=0;
+    unsigned int pos=0;
+    while(pos + 4 <= su_len)
+    {
+      const unsigned char *e=&su[pos];
+      const unsigned int len=e[2];
+      if(len < 4 || pos + len > su_len)
+	break;
+      if(e[0]=='S' && e[1]=='T')
+	break;
+      if(e[0]=='C' && e[1]=='E' && len >= 28)
+      {
+	ce_block=iso_get32(&e[4]);
+	ce_offset=iso_get32(&e[12]);
+	ce_len=iso_get32(&e[20]);
+      }
+      else if(e[0]=='P' && e[1]=='X' && len >= 36)
+      {
+	rr->st.mode=iso_get32(&e[4]);
+	rr->st.uid=iso_get32(&e[20]);
+	rr->st.gid=iso_get32(&e[28]);
+	rr->has_mode=1;
+      }
+      else if(e[0]=='N' && e[1]=='M' && len >= 5)
+      {
+	/* CURRENT and PARENT names aren't used */
+	if((e[4] & 0x06)==0)
+	{
+	  const unsigned int n=(len - 5 < sizeof(rr->name) - 1 - rr->name_len ?
+	      len - 5 : sizeof(rr->name) - 1 - rr->name_len);
+	  memcpy(&rr->name[rr->name_len], &e[5], n);
+	  rr->name_len+=n;
+	  rr->name[rr->name_len]='\0';
+	  rr->has_name=1;
+	}
+      }
+      else if(e[0]=='T' && e[1]=='F' && len >= 5)
+      {
+	const unsigned int flags=e[4];
+	const unsigned int stamp=((flags & 0x80)!=0 ? 17 : 7);
+	unsigned int bit;
+	unsigned int p=5;
+	for(bit=0; bit<4 && p + stamp <= len; bit++)
+	{
+	  time_t t;
+	  if((flags & (1<<bit))==0)
+	    continue;
+	  t=(stamp==17 ? iso9660_time17(&e[p]) : iso9660_time7(&e[p]));
+	  p+=stamp;
+	  if(bit==0 || bit==3)
+	    rr->st.ctime=t;
+	  else if(bit==1)
+	  {
+	    rr->st.mtime=t;
+	    rr->has_mtime=1;
+	  }
+	  else
+	    rr->st.atime=t;
+	}
+      }
+      else if(e[0]=='C' && e[1]=='L' && len >= 12)
+	rr->child=iso_get32(&e[4]);
+      else if(e[0]=='R' && e[1]=='E')
+	rr->relocated=1;
+      pos+=len;
+    }
+    if(ce_len==0 || ce_offset >= ls->block_size || ++hops > ISO_SUSP_MAX_CE)
+      break;
+    if(ce_len > ls->block_size - ce_offset)
+      ce_len=ls->block_size - ce_offset;
+    if(ce_buffer==NULL)
+      ce_buffer=(unsigned char *)MALLOC(ls->block_size);
+    if(iso_dir_pread(disk, partition, ce_buffer, ce_len, (uint64_t)ce_block * ls->block_size + ce_offset) < 0)
+      break;
+    su=ce_buffer;
+    su_len=ce_len;
+  }
+  free(ce_buffer);
+}
+
+/* Offset of the System Use field of the directory record */
+static unsigned int iso9660_su_offset(const unsigned char *record)
+{
+  const unsigned int name_len=record[32];
+  return ISO_DR_SIZE + name_len + ((name_len & 1)==0 ? 1 : 0);
+}
+
+static void iso9660_stat(iso_dir_stat_t *st, const unsigned char *record, const uint64_t size)
+{
+  memset(st, 0, sizeof(*st));
+  st->mode=((record[25] & ISO_DR_DIRECTORY)!=0 ?
+      LINUX_S_IFDIR|LINUX_S_IRUGO|LINUX_S_IXUGO : LINUX_S_IFREG|LINUX_S_IRUGO);
+  st->size=size;
+  st->mtime=iso9660_time7(&record[18]);
+  st->atime=st->mtime;
+  st->ctime=st->mtime;
+}
+
+/* Size of the directory starting at block, from its "." record */
+static uint32_t iso9660_dir_size(disk_t *disk, const partition_t *partition, const struct iso_dir_struct *ls, const uint32_t block)
+{
+  unsigned char record[ISO_DR_SIZE + 1];
+  if(iso_dir_pread(disk, partition, record, sizeof(record), (uint64_t)block * ls->block_size) < 0 ||
+      record[0] < ISO_DR_SIZE + 1 || record[32]!=1 || record[33]!=0 ||
+      (record[25] & ISO_DR_DIRECTORY)==0)
+    return 0;
+  return iso_get32(&record[10]);
+}
+
+static int iso9660_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const iso_dir_node_t *dir, const uint32_t inode, file_info_t *dir_list)
+{
+  struct iso_dir_struct *ls=(struct iso_dir_struct *)dir_data->private_dir_data;
+  const uint64_t size=dir->st.size;
+  unsigned char *buffer=iso_dir_extents_read(disk, partition, dir->extents, dir->extents_nbr, size);
+  iso_dir_extent_t *pending=NULL;
+  unsigned int pending_nbr=0;
+  unsigned int pending_alloc=0;
+  uint64_t pending_size=0;
+  unsigned int pos=0;
+  if(buffer==NULL)
+  {
+    log_error("ISO9660: can't read the directory at offset %llu\n",
+	(long long unsigned)(dir->extents_nbr > 0 ? dir->extents[0].offset : 0));
+    return -1;
+  }
+  while(pos < size)
+  {
+    const unsigned char *record=&buffer[pos];
+    const unsigned int len=record[0];
+    unsigned int name_len;
+    unsigned int su;
+    uint32_t block;
+    uint32_t data_len;
+    iso_dir_rr_t rr;
+    iso_dir_stat_t st;
+    /* The records don't cross the block boundaries */
+    if(len==0)
+    {
+      pos=(pos / ls->block_size + 1) * ls->block_size;
+      continue;
+    }
+    if(len < ISO_DR_SIZE + 1 || pos + len > size)
+      break;
+    pos+=len;
+    name_len=record[32];
+    if(ISO_DR_SIZE + name_len > len)
+      continue;
+    if(name_len==1 && (record[33]==0 || record[33]==1))
+      continue;
+    memset(&rr, 0, sizeof(rr));
+    su=iso9660_su_offset(record) + ls->susp_skip;
+    if(ls->rock_ridge!=0 && su < len)
+      iso9660_susp(disk, partition, ls, &record[su], len - su, &rr);
+    if(rr.relocated!=0)
+      continue;
+    block=iso_get32(&record[2]) + record[1];
+    data_len=iso_get32(&record[10]);
+    if((record[25] & ISO_DR_MULTI_EXTENT)!=0)
+    {
+      iso_dir_extent_add(&pending, &pending_nbr, &pending_alloc, (uint64_t)block * ls->block_size, data_len, 0);
+      pending_size+=data_len;
+      continue;
+    }
+    if(rr.child!=0)
+    {
+      block=rr.child;
+      data_len=iso9660_dir_size(disk, partition, ls, block);
+      if(data_len==0)
+      {
+	log_error("ISO9660: can't read the relocated directory at block %lu\n", (long unsigned)block);
+	continue;
+      }
+    }
+    iso_dir_extent_add(&pending, &pending_nbr, &pending_alloc, (uint64_t)block * ls->block_size, data_len, 0);
+    pending_size+=data_len;
+    iso9660_stat(&st, record, pending_size);
+    if(rr.child!=0)
+      st.mode=(st.mode & ~LINUX_S_IFMT) | LINUX_S_IFDIR;
+    if(rr.has_mode!=0)
+    {
+      st.mode=(rr.child!=0 || (record[25] & ISO_DR_DIRECTORY)!=0 ?
+	  (rr.st.mode & ~LINUX_S_IFMT) | LINUX_S_IFDIR : rr.st.mode);
+      st.uid=rr.st.uid;
+      st.gid=rr.st.gid;
+    }
+    if(rr.has_mtime!=0)
+    {
+      st.mtime=rr.st.mtime;
+      st.atime=(rr.st.atime!=0 ? rr.st.atime : rr.st.mtime);
+      st.ctime=(rr.st.ctime!=0 ? rr.st.ctime : rr.st.mtime);
+    }
+    if(rr.has_name!=0)
+    {
+      unsigned int i;
+      for(i=0; i<rr.name_len; i++)
+	if(rr.name[i]=='/')
+	  rr.name[i]='_';
+    }
+    else
+      iso9660_name(ls, rr.name, sizeof(rr.name), &record[33], name_len);
+    {
+      /* The extents are kept by the node */
+      const uint32_t child=iso_dir_node_add(ls, pending[0].offset, inode, &st, pending, pending_nbr);
+      iso_dir_add_file(dir_list, rr.name, child, &st, 0);
+    }
+    pending=NULL;
+    pending_nbr=0;
+    pending_alloc=0;
+    pending_size=0;
+  }
+  free(pending);
+  free(buffer);
+  return 0;
+}
+
+/* Identifier and checksum of the descriptor tag */
+static int udf_tag_check(const unsigned char *tag, const unsigned int id)
+{
+  unsigned int sum=0;
+  unsigned int i;
+  if(iso_get16(tag)!=id)
+    return -1;
+  for(i=0; i<16; i++)
+    if(i!=4)
+      sum+=tag[i];
+  return ((sum & 0xff)==tag[4] ? 0 : -1);
+}
+
+/* Block of the volume for the block lbn of the partition partref, count
+ * is the number of the following blocks that are contiguous */
+static int udf_block(const struct iso_dir_struct *ls, const unsigned int partref, const uint32_t lbn, uint64_t *block, uint32_t *count)
+{
+  const udf_dir_map_t *map;
+  unsigned int i;
+  if(partref >= ls->maps_nbr)
+    return -1;
+  map=&ls->maps[partref];
+  if(map->metadata==0)
+  {
+    if(lbn >= map->length)
+      return -1;
+    *block=(uint64_t)map->start + lbn;
+    *count=map->length - lbn;
+    return 0;
+  }
+  for(i=0; i<map->runs_nbr; i++)
+  {
+    const udf_dir_run_t *run=&map->runs[i];
+    if(lbn >= run->lbn && lbn - run->lbn < run->count)
+    {
+      *block=run->block + (lbn - run->lbn);
+      *count=run->count - (lbn - run->lbn);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int udf_read_block(disk_t *disk, const partition_t *partition, const struct iso_dir_struct *ls, const unsigned int partref, const uint32_t lbn, unsigned char *buffer, uint64_t *block)
+{
+  uint32_t count;
+  if(udf_block(ls, partref, lbn, block, &count) < 0)
+    return -1;
+  return iso_dir_pread(disk, partition, buffer, ls->block_size, *block * ls->block_size);
+}
+
+/* Add the extent of size bytes from the block lbn of the partition,
+ * split where the blocks aren't contiguous on the volume */
+static int udf_extent_add(const struct iso_dir_struct *ls, udf_dir_icb_t *icb, const unsigned int partref, uint32_t lbn, uint64_t size, const unsigned int sparse)
+{
+  if(sparse!=0)
+  {
+    iso_dir_extent_add(&icb->extents, &icb->extents_nbr, &icb->extents_alloc, 0, size, 1);
+    return 0;
+  }
+  while(size > 0)
+  {
+    uint64_t block;
+    uint32_t count;
+    uint64_t len;
+    if(udf_block(ls, partref, lbn, &block, &count) < 0)
+      return -1;
+    len=(uint64_t)count * ls->block_size;
+    if(len > size)
+      len=size;
+    iso_dir_extent_add(&icb->extents, &icb->extents_nbr, &icb->extents_alloc, block * ls->block_size, len, 0);
+    size-=len;
+    lbn+=count;
+  }
+  return 0;
+}
+
+static uint32_t udf_mode(const uint32_t permissions, const unsigned int file_type)
+{
+  /* Execute, write and read bits of other, group and owner */
+  uint32_t mode=(permissions & 7) | (((permissions >> 5) & 7) << 3) | (((permissions >> 10) & 7) << 6);
+  switch(file_type)
+  {
+    case UDF_FILE_DIRECTORY:
+      return mode | LINUX_S_IFDIR;
+    case UDF_FILE_SYMLINK:
+      return mode | LINUX_S_IFLNK;
+    case 6:
+      return mode | LINUX_S_IFBLK;
+    case 7:
+      return mode | LINUX_S_IFCHR;
+    case 9:
+      return mode | LINUX_S_IFIFO;
+    case 10:
+      return mode | LINUX_S_IFSOCK;
+    default:
+      return mode | LINUX_S_IFREG;
+  }
+}
+
+/* Read the (extended) file entry at lbn of the partition partref */
+static int udf_icb_read(disk_t *disk, const partition_t *partition, const struct iso_dir_struct *ls, unsigned int partref, uint32_t lbn, udf_dir_icb_t *icb)
+{
+  const unsigned int bs=ls->block_size;
+  unsigned char *buffer=(unsigned char *)MALLOC(bs);
+  unsigned char *aed=NULL;
+  const unsigned char *ads;
+  unsigned int ads_len;
+  unsigned int base;
+  unsigned int l_ea;
+  unsigned int ad_type;
+  unsigned int ad_size;
+  unsigned int hops;
+  unsigned int pos;
+  uint64_t block;
+  memset(icb, 0, sizeof(*icb));
+  for(hops=0; ; hops++)
+  {
+    if(hops >= UDF_MAX_HOPS || udf_read_block(disk, partition, ls, partref, lbn, buffer, &block) < 0)
+    {
+      free(buffer);
+      return -1;
+    }
+    /* Strategy 4096: follow the indirect entry */
+    if(udf_tag_check(buffer, UDF_TAG_IE)!=0)
+      break;
+    lbn=iso_get32(&buffer[40]);
+    partref=iso_get16(&buffer[44]);
+  }
+  if(udf_tag_check(buffer, UDF_TAG_FE)==0)
+  {
+    icb->st.size=iso_get64(&buffer[56]);
+    icb->st.atime=udf_time(&buffer[72]);
+    icb->st.mtime=udf_time(&buffer[84]);
+    icb->st.ctime=udf_time(&buffer[96]);
+    l_ea=iso_get32(&buffer[168]);
+    ads_len=iso_get32(&buffer[172]);
+    base=176;
+  }
+  else if(udf_tag_check(buffer, UDF_TAG_EFE)==0)
+  {
+    icb->st.size=iso_get64(&buffer[56]);
+    icb->st.atime=udf_time(&buffer[80]);
+    icb->st.mtime=udf_time(&buffer[92]);
+    icb->st.ctime=udf_time(&buffer[116]);
+    l_ea=iso_get32(&buffer[208]);
+    ads_len=iso_get32(&buffer[212]);
+    base=216;
+  }
+  else
+  {
+    free(buffer);
+    return -1;
+  }
+  if(l_ea > bs - base || ads_len > bs - base - l_ea)
+  {
+    free(buffer);
+    return -1;
+  }
+  icb->file_type=buffer[27];
+  icb->st.uid=iso_get32(&buffer[36]);
+  icb->st.gid=iso_get32(&buffer[40]);
+  icb->st.mode=udf_mode(iso_get32(&buffer[44]), icb->file_type);
+  ad_type=iso_get16(&buffer[34]) & 7;
+  if(ad_type==3)
+  {
+    /* The data is in the ICB */
+    iso_dir_extent_add(&icb->extents, &icb->extents_nbr, &icb->extents_alloc,
+	block * bs + base + l_ea, (icb->st.size < ads_len ? icb->st.size : ads_len), 0);
+    free(buffer);
+    return 0;
+  }
+  ad_size=(ad_type==0 ? 8 : (ad_type==1 ? 16 : 20));
+  if(ad_type > 2)
+  {
+    free(buffer);
+    return -1;
+  }
+  ads=&buffer[base + l_ea];
+  hops=0;
+  pos=0;
+  while(pos + ad_size <= ads_len)
+  {
+    const unsigned char *ad=&ads[pos];
+    const uint32_t len=iso_get32(ad) & 0x3fffffff;
+    const unsigned int type=iso_get32(ad) >> 30;
+    const uint32_t ad_lbn=iso_get32(&ad[ad_size==20 ? 12 : 4]);
+    const unsigned int ad_partref=(ad_size==8 ? partref : iso_get16(&ad[ad_size==20 ? 16 : 8]));
+    if(len==0)
+      break;
+    if(type==3)
+    {
+      /* The next allocation descriptors are in an allocation extent */
+      if(aed==NULL)
+	aed=(unsigned char *)MALLOC(bs);
+      if(++hops > UDF_MAX_HOPS ||
+	  udf_read_block(disk, partition, ls, ad_partref, ad_lbn, aed, &block) < 0 ||
+	  udf_tag_check(aed, UDF_TAG_AED)!=0)
+	break;
+      ads=&aed[24];
+      ads_len=iso_get32(&aed[20]);
+      if(ads_len > bs - 24)
+	ads_len=bs - 24;
+      pos=0;
+      continue;
+    }
+    if(udf_extent_add(ls, icb, ad_partref, ad_lbn, len, (type!=0 ? 1 : 0)) < 0)
+      break;
+    pos+=ad_size;
+  }
+  free(aed);
+  free(buffer);
+  return 0;
+}
+
+/* UDF name in the OSTA compressed unicode */
+static void udf_name(char *name, const unsigned int name_size, const unsigned char *cs0, const unsigned int len)
+{
+  unsigned char utf16[2*255];
+  unsigned int i;
+  unsigned int n=0;
+  if(len < 2)
+  {
+    name[0]='\0';
+    return ;
+  }
+  if(cs0[0]==16 || cs0[0]==255)
+  {
+    iso_dir_name_utf16(name, name_size, &cs0[1], (len - 1) / 2, 1);
+    return ;
+  }
+  for(i=1; i<len && n<255; i++, n++)
+  {
+    utf16[2*n]=cs0[i];
+    utf16[2*n+1]=0;
+  }
+  iso_dir_name_utf16(name, name_size, utf16, n, 0);
+}
+
+static int udf_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const iso_dir_node_t *dir, const uint32_t inode, file_info_t *dir_list)
+{
+  struct iso_dir_struct *ls=(struct iso_dir_struct *)dir_data->private_dir_data;
+  udf_dir_icb_t icb;
+  unsigned char *buffer;
+  unsigned int pos=0;
+  if(udf_icb_read(disk, partition, ls, dir->key >> 32, dir->key & 0xffffffff, &icb) < 0)
+  {
+    log_error("UDF: can't read the directory ICB %lu:%lu\n",
+	(long unsigned)(dir->key >> 32), (long unsigned)(dir->key & 0xffffffff));
+    return -1;
+  }
+  buffer=iso_dir_extents_read(disk, partition, icb.extents, icb.extents_nbr, icb.st.size);
+  if(buffer==NULL)
+  {
+    if(icb.st.size > 0)
+      log_error("UDF: can't read the directory %lu:%lu\n",
+	  (long unsigned)(dir->key >> 32), (long unsigned)(dir->key & 0xffffffff));
+    free(icb.extents);
+    return (icb.st.size > 0 ? -1 : 0);
+  }
+  while(pos + 38 <= icb.st.size)
+  {
+    const unsigned char *fid=&buffer[pos];
+    const unsigned int characteristics=fid[18];
+    const unsigned int l_fi=fid[19];
+    const uint32_t lbn=iso_get32(&fid[24]);
+    const unsigned int partref=iso_get16(&fid[28]);
+    const unsigned int l_iu=iso_get16(&fid[36]);
+    udf_dir_icb_t child;
+    char name[DIR_NAME_LEN];
+    unsigned int status=0;
+    uint32_t child_inode;
+    if(udf_tag_check(fid, UDF_TAG_FID)!=0 || pos + 38 + l_iu + l_fi > icb.st.size)
+      break;
+    pos+=(38 + l_iu + l_fi + 3) & ~3;
+    if((characteristics & UDF_FID_PARENT)!=0 || l_fi==0)
+      continue;
+    if((characteristics & UDF_FID_DELETED)!=0)
+    {
+      if((dir_data->param & FLAG_LIST_DELETED)!=FLAG_LIST_DELETED)
+	continue;
+      status=FILE_STATUS_DELETED;
+    }
+    udf_name(name, sizeof(name), &fid[38 + l_iu], l_fi);
+    if(name[0]=='\0')
+      continue;
+    if(udf_icb_read(disk, partition, ls, partref, lbn, &child) < 0)
+    {
+      if(status==0)
+	log_error("UDF: can't read the ICB %u:%lu of %s\n", partref, (long unsigned)lbn, name);
+      memset(&child, 0, sizeof(child));
+      child.st.mode=((characteristics & UDF_FID_DIRECTORY)!=0 ?
+	  LINUX_S_IFDIR|LINUX_S_IRUGO|LINUX_S_IXUGO : LINUX_S_IFREG|LINUX_S_IRUGO);
+    }
+    free(child.extents);
+    child_inode=iso_dir_node_add(ls, ((uint64_t)partref << 32) | lbn, inode, &child.st, NULL, 0);
+    iso_dir_add_file(dir_list, name, child_inode, &child.st, status);
+  }
+  free(buffer);
+  free(icb.extents);
+  return 0;
+}
+
+static int iso_dir(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *dir_list)
+{
+  const struct iso_dir_struct *ls=(const struct iso_dir_struct *)dir_data->private_dir_data;
+  const uint32_t inode=(first_inode < ISO_DIR_ROOT_INODE ? ISO_DIR_ROOT_INODE : first_inode);
+  const iso_dir_node_t *dir=iso_dir_node(ls, inode);
+  iso_dir_node_t current;
+  if(dir==NULL || !LINUX_S_ISDIR(dir->st.mode))
+    return -1;
+  if(inode!=ISO_DIR_ROOT_INODE)
+  {
+    const iso_dir_node_t *parent=iso_dir_node(ls, dir->parent);
+    iso_dir_add_file(dir_list, ".", inode, &dir->st, 0);
+    if(parent!=NULL)
+      iso_dir_add_file(dir_list, "..", dir->parent, &parent->st, 0);
+  }
+  /* The nodes may be reallocated while the directory is listed */
+  current=*dir;
+  if(ls->udf!=0)
+    return udf_dir(disk, partition, dir_data, &current, inode, dir_list);
+  return iso9660_dir(disk, partition, dir_data, &current, inode, dir_list);
+}
+
+/* Rock Ridge is used when the "." record of the root directory has a SP
+ * entry */
+static void iso9660_rock_ridge(disk_t *disk, const partition_t *partition, struct iso_dir_struct *ls, const uint32_t block)
+{
+  unsigned char *buffer=(unsigned char *)MALLOC(ls->block_size);
+  if(iso_dir_pread(disk, partition, buffer, ls->block_size, (uint64_t)block * ls->block_size)==0 &&
+      buffer[0] >= ISO_DR_SIZE + 1 && buffer[32]==1 && buffer[33]==0)
+  {
+    const unsigned int su=iso9660_su_offset(buffer);
+    const unsigned char *sp=&buffer[su];
+    if(su + 7 <= buffer[0] && sp[0]=='S' && sp[1]=='P' && sp[2] >= 7 &&
+	sp[4]==0xBE && sp[5]==0xEF)
+    {
+      ls->rock_ridge=1;
+      ls->susp_skip=sp[6];
+    }
+  }
+  free(buffer);
+}
+
+/* Root directory of the primary or of the Joliet volume descriptor */
+static int iso9660_init(disk_t *disk, const partition_t *partition, struct iso_dir_struct *ls, const unsigned char *pvd, const unsigned char *svd)
+{
+  const unsigned char *vd=pvd;
+  const unsigned char *root;
+  iso_dir_extent_t *extent;
+  iso_dir_stat_t st;
+  uint32_t block;
+  ls->block_size=iso_get16(&pvd[128]);
+  if(ls->block_size < 512 || ls->block_size > 8192 || (ls->block_size & (ls->block_size - 1))!=0)
+  {
+    log_error("ISO9660: invalid logical block size %u\n", ls->block_size);
+    return -1;
+  }
+  block=iso_get32(&pvd[156 + 2]);
+  iso9660_rock_ridge(disk, partition, ls, block);
+  if(ls->rock_ridge==0 && svd!=NULL && iso_get16(&svd[128])==ls->block_size)
+  {
+    vd=svd;
+    ls->joliet=1;
+  }
+  root=&vd[156];
+  block=iso_get32(&root[2]) + root[1];
+  extent=(iso_dir_extent_t *)MALLOC(sizeof(*extent));
+  extent->offset=(uint64_t)block * ls->block_size;
+  extent->size=iso_get32(&root[10]);
+  extent->sparse=0;
+  iso9660_stat(&st, root, extent->size);
+  st.mode=LINUX_S_IFDIR|LINUX_S_IRUGO|LINUX_S_IXUGO;
+  iso_dir_node_add(ls, extent->offset, ISO_DIR_ROOT_INODE, &st, extent, 1);
+  return 0;
+}
+
+/* Main or reserve volume descriptor sequence */
+static int udf_vds(disk_t *disk, const partition_t *partition, struct iso_dir_struct *ls, const uint32_t location, const uint32_t length, udf_dir_pd_t *pds, unsigned int *pds_nbr, unsigned char *lvd)
+{
+  const unsigned int bs=ls->block_size;
+  unsigned char *buffer=(unsigned char *)MALLOC(bs);
+  unsigned int found=0;
+  unsigned int i;
+  for(i=0; i < length / bs && i < UDF_MAX_VDS; i++)
+  {
+    if(iso_dir_pread(disk, partition, buffer, bs, (uint64_t)(location + i) * bs) < 0)
+      break;
+    if(udf_tag_check(buffer, UDF_TAG_TD)==0)
+      break;
+    if(udf_tag_check(buffer, UDF_TAG_PD)==0 && *pds_nbr < UDF_MAX_MAPS)
+    {
+      pds[*pds_nbr].number=iso_get16(&buffer[22]);
+      pds[*pds_nbr].start=iso_get32(&buffer[188]);
+      pds[*pds_nbr].length=iso_get32(&buffer[192]);
+      (*pds_nbr)++;
+    }
+    else if(udf_tag_check(buffer, UDF_TAG_LVD)==0 && found==0)
+    {
+      memcpy(lvd, buffer, bs);
+      found=1;
+    }
+  }
+  free(buffer);
+  return (found!=0 && *pds_nbr > 0 ? 0 : -1);
+}
+
+static const udf_dir_pd_t *udf_pd(const udf_dir_pd_t *pds, const unsigned int pds_nbr, const uint32_t number)
+{
+  unsigned int i;
+  for(i=0; i<pds_nbr; i++)
+    if(pds[i].number==number)
+      return &pds[i];
+  return NULL;
+}
+
+/* The blocks of the metadata partition are the ones of its metadata
+ * file, or of the mirror file if it can't be read */
+static int udf_metadata(disk_t *disk, const partition_t *partition, struct iso_dir_struct *ls, const unsigned int partref, const udf_dir_pd_t *pd, const uint32_t *files)
+{
+  udf_dir_map_t *map=&ls->maps[partref];
+  unsigned int f;
+  for(f=0; f<2; f++)
+  {
+    udf_dir_icb_t icb;
+    uint64_t lbn=0;
+    unsigned int i;
+    map->metadata=0;
+    map->start=pd->start;
+    map->length=pd->length;
+    if(udf_icb_read(disk, partition, ls, partref, files[f], &icb) < 0)
+      continue;
+    map->runs=(udf_dir_run_t *)MALLOC((icb.extents_nbr + 1) * sizeof(udf_dir_run_t));
+    map->runs_nbr=0;
+    for(i=0; i<icb.extents_nbr; i++)
+    {
+      const iso_dir_extent_t *extent=&icb.extents[i];
+      if(extent->sparse==0)
+      {
+	udf_dir_run_t *run=&map->runs[map->runs_nbr++];
+	run->lbn=lbn;
+	run->count=extent->size / ls->block_size;
+	run->block=extent->offset / ls->block_size;
+      }
+      lbn+=extent->size / ls->block_size;
+    }
+    free(icb.extents);
+    map->metadata=1;
+    return 0;
+  }
+  log_error("UDF: can't read the metadata file\n");
+  return -1;
+}
+
+static int udf_init(disk_t *disk, const partition_t *partition, struct iso_dir_struct *ls)
+{
+  static const unsigned int block_sizes[3]={ 2048, 512, 4096 };
+  udf_dir_pd_t pds[UDF_MAX_MAPS];
+  unsigned int pds_nbr=0;
+  unsigned char *buffer=NULL;
+  unsigned char *lvd;
+  unsigned int map_table_length;
+  unsigned int maps_nbr;
+  unsigned int pos;
+  unsigned int i;
+  uint64_t block;
+  iso_dir_stat_t st;
+  udf_dir_icb_t root;
+  for(i=0; i<3; i++)
+  {
+    free(buffer);
+    ls->block_size=block_sizes[i];
+    buffer=(unsigned char *)MALLOC(ls->block_size);
+    if(iso_dir_pread(disk, partition, buffer, ls->block_size, (uint64_t)UDF_AVDP_LOCATION * ls->block_size)==0 &&
+	udf_tag_check(buffer, UDF_TAG_AVDP)==0 && iso_get32(&buffer[12])==UDF_AVDP_LOCATION)
+      break;
+  }
+  if(i==3)
+  {
+    log_error("UDF: anchor volume descriptor pointer not found\n");
+    free(buffer);
+    return -1;
+  }
+  lvd=(unsigned char *)MALLOC(ls->block_size);
+  if(udf_vds(disk, partition, ls, iso_get32(&buffer[20]), iso_get32(&buffer[16]), pds, &pds_nbr, lvd) < 0 &&
+      udf_vds(disk, partition, ls, iso_get32(&buffer[28]), iso_get32(&buffer[24]), pds, &pds_nbr, lvd) < 0)
+  {
+    log_error("UDF: no volume descriptor sequence\n");
+    free(lvd);
+    free(buffer);
+    return -1;
+  }
+  if(iso_get32(&lvd[212])!=ls->block_size)
+  {
+    log_error("UDF: logical block size %lu isn't supported\n", (long unsigned)iso_get32(&lvd[212]));
+    free(lvd);
+    free(buffer);
+    return -1;
+  }
+  map_table_length=iso_get32(&lvd[264]);
+  maps_nbr=iso_get32(&lvd[268]);
+  if(map_table_length > ls->block_size - 440)
+    map_table_length=ls->block_size - 440;
+  for(pos=0, i=0; i<maps_nbr && i<UDF_MAX_MAPS && pos + 2 <= map_table_length; i++)
+  {
+    const unsigned char *m=&lvd[440 + pos];
+    const udf_dir_pd_t *pd=NULL;
+    if(m[1] < 6 || pos + m[1] > map_table_length)
+      break;
+    if(m[0]==1)
+      pd=udf_pd(pds, pds_nbr, iso_get16(&m[4]));
+    else if(m[0]==2 && m[1] >= 64 &&
+	(memcmp(&m[5], "*UDF Metadata Partition", 23)==0 ||
+	 memcmp(&m[5], "*UDF Sparable Partition", 23)==0))
+      pd=udf_pd(pds, pds_nbr, iso_get16(&m[38]));
+    else if(m[0]==2 && memcmp(&m[5], "*UDF Virtual Partition", 22)==0)
+      log_error("UDF: virtual partitions aren't supported\n");
+    if(pd==NULL)
+      break;
+    ls->maps[i].start=pd->start;
+    ls->maps[i].length=pd->length;
+    ls->maps_nbr=i + 1;
+    if(m[0]==2 && memcmp(&m[5], "*UDF Metadata Partition", 23)==0)
+    {
+      uint32_t files[2];
+      files[0]=iso_get32(&m[40]);
+      files[1]=iso_get32(&m[44]);
+      if(udf_metadata(disk, partition, ls, i, pd, files) < 0)
+	break;
+    }
+    pos+=m[1];
+  }
+  if(i==0 || ls->maps_nbr!=i || i<maps_nbr)
+  {
+    log_error("UDF: unsupported partition maps\n");
+    free(lvd);
+    free(buffer);
+    return -1;
+  }
+  /* File set descriptor */
+  if(udf_read_block(disk, partition, ls, iso_get16(&lvd[256]), iso_get32(&lvd[252]), buffer, &block) < 0 ||
+      udf_tag_check(buffer, UDF_TAG_FSD)!=0)
+  {
+    log_error("UDF: file set descriptor not found\n");
+    free(lvd);
+    free(buffer);
+    return -1;
+  }
+  if(udf_icb_read(disk, partition, ls, iso_get16(&buffer[408]), iso_get32(&buffer[404]), &root) < 0 ||
+      root.file_type!=UDF_FILE_DIRECTORY)
+  {
+    log_error("UDF: can't read the root directory\n");
+    free(lvd);
+    free(buffer);
+    return -1;
+  }
+  free(root.extents);
+  st=root.st;
+  iso_dir_node_add(ls, ((uint64_t)iso_get16(&buffer[408]) << 32) | iso_get32(&buffer[404]),
+      ISO_DIR_ROOT_INODE, &st, NULL, 0);
+  free(lvd);
+  free(buffer);
+  return 0;
+}
+
+static void iso_dir_free(struct iso_dir_struct *ls)
+{
+  unsigned int i;
+  for(i=0; i<ls->nodes_nbr; i++)
+    free(ls->nodes[i].extents);
+  for(i=0; i<UDF_MAX_MAPS; i++)
+    free(ls->maps[i].runs);
+  free(ls->nodes);
+  free(ls->hash);
+  free(ls);
+}
+
+dir_partition_t dir_partition_iso_init(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const int verbose)
+{
+  static const unsigned char joliet_escapes[3]={ '@', 'C', 'E' };
+  struct iso_dir_struct *ls;
+  unsigned char *pvd=NULL;
+  unsigned char *svd=NULL;
+  unsigned char *buffer;
+  unsigned int nsr=0;
+  unsigned int i;
+  int res=-1;
+  /* Volume recognition sequence */
+  buffer=(unsigned char *)MALLOC(ISO_VRS_SIZE);
+  for(i=0; i<ISO_VRS_MAX; i++)
+  {
+    if(iso_dir_pread(disk, partition, buffer, ISO_VRS_SIZE, ISO_VRS_OFFSET + (uint64_t)i * ISO_VRS_SIZE) < 0)
+      break;
+    if(memcmp(&buffer[1], "CD001", 5)==0)
+    {
+      if(buffer[0]==1 && pvd==NULL)
+      {
+	pvd=(unsigned char *)MALLOC(ISO_VRS_SIZE);
+	memcpy(pvd, buffer, ISO_VRS_SIZE);
+      }
+      else if(buffer[0]==2 && svd==NULL && buffer[88]=='%' && buffer[89]=='/' &&
+	  memchr(joliet_escapes, buffer[90], sizeof(joliet_escapes))!=NULL)
+      {
+	svd=(unsigned char *)MALLOC(ISO_VRS_SIZE);
+	memcpy(svd, buffer, ISO_VRS_SIZE);
+      }
+    }
+    else if(memcmp(&buffer[1], "NSR02", 5)==0 || memcmp(&buffer[1], "NSR03", 5)==0)
+      nsr=1;
+    else if(memcmp(&buffer[1], "BEA01", 5)!=0 && memcmp(&buffer[1], "BOOT2", 5)!=0 &&
+	memcmp(&buffer[1], "CDW02", 5)!=0)
+      break;
+  }
+  free(buffer);
+  ls=(struct iso_dir_struct *)MALLOC(sizeof(*ls));
+  memset(ls, 0, sizeof(*ls));
+  if(nsr!=0)
+  {
+    ls->udf=1;
+    res=udf_init(disk, partition, ls);
+    if(res < 0)
+    {
+      iso_dir_free(ls);
+      ls=(struct iso_dir_struct *)MALLOC(sizeof(*ls));
+      memset(ls, 0, sizeof(*ls));
+    }
+  }
+  if(res < 0 && pvd!=NULL)
+    res=iso9660_init(disk, partition, ls, pvd, svd);
+  free(pvd);
+  free(svd);
+  if(res < 0)
+  {
+    log_error("No ISO9660 or UDF file system found.\n");
+    iso_dir_free(ls);
+    return DIR_PART_EIO;
+  }
+  if(verbose > 0)
+    log_info("%s blocksize=%u%s%s\n", (ls->udf!=0 ? "UDF" : "ISO9660"), ls->block_size,
+	(ls->rock_ridge!=0 ? " Rock Ridge" : ""), (ls->joliet!=0 ? " Joliet" : ""));
+  strncpy(dir_data->current_directory,"/",sizeof(dir_data->current_directory));
+  dir_data->current_inode=ISO_DIR_ROOT_INODE;
+  dir_data->param=(ls->udf!=0 ? FLAG_LIST_DELETED : 0);
+  dir_data->verbose=verbose;
+  dir_data->capabilities=(ls->udf!=0 ? CAPA_LIST_DELETED : 0);
+  dir_data->copy_file=&iso_dir_copy;
+  dir_data->close=&dir_partition_iso_close;
+  dir_data->local_dir=NULL;
+  dir_data->private_dir_data=ls;
+  dir_data->get_dir=&iso_dir;
+  return DIR_PART_OK;
+}
+
+static void dir_partition_iso_close(dir_data_t *dir_data)
+{
+  iso_dir_free((struct iso_dir_struct*)dir_data->private_dir_data);
+}
+
+static copy_file_t iso_dir_copy(disk_t *disk, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file)
+{
+  const struct iso_dir_struct *ls=(const struct iso_dir_struct *)dir_data->private_dir_data;
+  const iso_dir_node_t *node=iso_dir_node(ls, file->st_ino);
+  udf_dir_icb_t icb;
+  const iso_dir_extent_t *extents;
+  unsigned int extents_nbr;
+  uint64_t size;
+  unsigned char *buffer;
+  char *new_file;
+  FILE *f_out;
+  uint64_t offset;
+  memset(&icb, 0, sizeof(icb));
+  if(node==NULL)
+    return CP_STAT_FAILED;
+  if(ls->udf!=0)
+  {
+    if(udf_icb_read(disk, partition, ls, node->key >> 32, node->key & 0xffffffff, &icb) < 0)
+      return CP_STAT_FAILED;
+    extents=icb.extents;
+    extents_nbr=icb.extents_nbr;
+    size=icb.st.size;
+  }
+  else
+  {
+    extents=node->extents;
+    extents_nbr=node->extents_nbr;
+    size=node->st.size;
+  }
+  f_out=fopen_local(&new_file, dir_data->local_dir, dir_data->current_directory);
+  if(!f_out)
+  {
+    log_critical("Can't create file %s: \n",new_file);
+    free(new_file);
+    free(icb.extents);
+    return CP_CREATE_FAILED;
+  }
+  log_trace("iso_dir_copy dst=%s size=%llu extents=%u\n", new_file,
+      (long long unsigned)size, extents_nbr);
+  buffer=(unsigned char *)MALLOC(ISO_DIR_READ_SIZE);
+  for(offset=0; offset < size; offset+=ISO_DIR_READ_SIZE)
+  {
+    const unsigned int toread=(size - offset > ISO_DIR_READ_SIZE ? ISO_DIR_READ_SIZE : size - offset);
+    const unsigned int read=iso_dir_extents_pread(disk, partition, extents, extents_nbr, buffer, toread, offset);
+    if(read < toread)
+    {
+      log_error("iso_dir_copy: Can't read %s at offset %llu.\n", new_file, (long long unsigned)(offset + read));
+      memset(buffer + read, 0, toread - read);
+    }
+    if(fwrite(buffer, 1, toread, f_out) != toread)
+    {
+      log_error("iso_dir_copy: no space left on destination.\n");
+      fclose(f_out);
+      set_date(new_file, file->td_atime, file->td_mtime);
+      free(new_file);
+      free(buffer);
+      free(icb.extents);
+      return CP_NOSPACE;
+    }
+  }
+  fclose(f_out);
+  set_date(new_file, file->td_atime, file->td_mtime);
+  free(new_file);
+  free(buffer);
+  free(icb.extents);
+  return CP_OK;
+}
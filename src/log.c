@@ -51,23 +51,31 @@
 #undef HAVE_DUP2
 #endif
 
+/* The log file gets a few large writes instead of one per BUFSIZ */
+#define LOG_BUFFER_SIZE (64*1024)
+
 static FILE *log_handle=NULL;
 static int f_status=0;
+/* Name of the opened log file, other files are written next to it */
+static char log_filename[4096]="";
 
 /* static unsigned int log_levels=LOG_LEVEL_DEBUG|LOG_LEVEL_TRACE|LOG_LEVEL_QUIET|LOG_LEVEL_INFO|LOG_LEVEL_VERBOSE|LOG_LEVEL_PROGRESS|LOG_LEVEL_WARNING|LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL; */
 static unsigned int log_levels=LOG_LEVEL_TRACE|LOG_LEVEL_QUIET|LOG_LEVEL_INFO|LOG_LEVEL_VERBOSE|LOG_LEVEL_PROGRESS|LOG_LEVEL_WARNING|LOG_LEVEL_ERROR|LOG_LEVEL_PERROR|LOG_LEVEL_CRITICAL;
+/* log_levels, or 0 when there is no log file */
+unsigned int log_active_levels=0;
 
-/*@ assigns log_levels; */
+/*@ assigns log_levels, log_active_levels; */
 unsigned int log_set_levels(const unsigned int levels)
 {
   const unsigned int old_levels=log_levels;
   log_levels=levels;
+  log_active_levels=(log_handle!=NULL?log_levels:0);
   return old_levels;
 }
 
 /*@
   @ requires separation: \separated(default_filename, errsv, log_handle, &errno);
-  @ assigns log_handle;
+  @ assigns log_handle, log_active_levels;
   @ assigns \result,errno,*errsv;
   @*/
 int log_open(const char*default_filename, const int mode, int *errsv)
@@ -88,9 +96,15 @@ int log_open(const char*default_filename, const int mode, int *errsv)
 #endif
   if(log_handle==NULL)
     return 0;
+  strncpy(log_filename, default_filename, sizeof(log_filename)-1);
+  log_filename[sizeof(log_filename)-1]='\0';
+#ifndef DISABLED_FOR_FRAMAC
+  setvbuf(log_handle, NULL, _IOFBF, LOG_BUFFER_SIZE);
+#endif
 #if defined(HAVE_DUP2)
   dup2(fileno(log_handle),2);
 #endif
+  log_active_levels=log_levels;
   return 1;
 }
 
@@ -151,6 +165,16 @@ int log_open_default(const char*default_filename, const int mode, int *errsv)
 }
 #endif
 
+/*@
+  @ assigns \nothing;
+  @*/
+const char *log_get_filename(void)
+{
+  if(log_handle==NULL)
+    return NULL;
+  return log_filename;
+}
+
 /*@
   @ requires log_handle==\null || \valid(log_handle);
   @*/
@@ -189,10 +213,11 @@ static int log_handler(const char *_format, va_list ap)
 /*@
   @ requires log_handle == \null || \valid(log_handle);
   @ assigns \result,errno,log_handle;
-  @ assigns f_status;
+  @ assigns f_status, log_active_levels;
   @*/
 int log_close(void)
 {
+  log_active_levels=0;
   if(log_handle!=NULL)
   {
     if(fclose(log_handle))
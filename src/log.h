@@ -25,6 +25,10 @@
 extern "C" {
 #endif
 
+/* Levels written to the log file, 0 when it isn't open. The log_*()
+ * macros test it before evaluating their arguments. */
+extern unsigned int log_active_levels;
+
 unsigned int log_set_levels(const unsigned int levels);
 
 /*@
@@ -41,6 +45,13 @@ int log_open(const char*default_filename, const int mode, int *errsv);
   @*/
 int log_open_default(const char*default_filename, const int mode, int *errsv);
 
+/* Name of the log file, NULL if it isn't opened */
+/*@
+  @ assigns \nothing;
+  @ ensures \result == \null || valid_read_string(\result);
+  @*/
+const char *log_get_filename(void);
+
 int log_flush(void);
 int log_close(void);
 
@@ -78,16 +89,16 @@ void dump2_log(const void *dump_1, const void *dump_2,const unsigned int lng);
 #define LOG_LEVEL_PERROR   (1 <<  8) /* Message : standard error description */
 #define LOG_LEVEL_CRITICAL (1 <<  9) /* Operation failed,damage may have occurred */
 
-#define log_debug(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_DEBUG,FORMAT,##ARGS)
-#define log_trace(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_TRACE,FORMAT,##ARGS)
-#define log_quiet(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_QUIET,FORMAT,##ARGS)
-#define log_info(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_INFO,FORMAT,##ARGS)
-#define log_verbose(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_VERBOSE,FORMAT,##ARGS)
-#define log_progress(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_PROGRESS,FORMAT,##ARGS)
-#define log_warning(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_WARNING,FORMAT,##ARGS)
-#define log_error(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_ERROR,FORMAT,##ARGS)
-#define log_perror(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_PERROR,FORMAT,##ARGS)
-#define log_critical(FORMAT, ARGS...)	log_redirect(LOG_LEVEL_CRITICAL,FORMAT,##ARGS)
+#define log_debug(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_DEBUG)==0 ? 0 : log_redirect(LOG_LEVEL_DEBUG,FORMAT,##ARGS))
+#define log_trace(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_TRACE)==0 ? 0 : log_redirect(LOG_LEVEL_TRACE,FORMAT,##ARGS))
+#define log_quiet(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_QUIET)==0 ? 0 : log_redirect(LOG_LEVEL_QUIET,FORMAT,##ARGS))
+#define log_info(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_INFO)==0 ? 0 : log_redirect(LOG_LEVEL_INFO,FORMAT,##ARGS))
+#define log_verbose(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_VERBOSE)==0 ? 0 : log_redirect(LOG_LEVEL_VERBOSE,FORMAT,##ARGS))
+#define log_progress(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_PROGRESS)==0 ? 0 : log_redirect(LOG_LEVEL_PROGRESS,FORMAT,##ARGS))
+#define log_warning(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_WARNING)==0 ? 0 : log_redirect(LOG_LEVEL_WARNING,FORMAT,##ARGS))
+#define log_error(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_ERROR)==0 ? 0 : log_redirect(LOG_LEVEL_ERROR,FORMAT,##ARGS))
+#define log_perror(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_PERROR)==0 ? 0 : log_redirect(LOG_LEVEL_PERROR,FORMAT,##ARGS))
+#define log_critical(FORMAT, ARGS...)	((log_active_levels & LOG_LEVEL_CRITICAL)==0 ? 0 : log_redirect(LOG_LEVEL_CRITICAL,FORMAT,##ARGS))
 
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
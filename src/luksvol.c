@@ -0,0 +1,807 @@
+/*
+
+    File: luksvol.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <ctype.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "luks_struct.h"
+#include "aes.h"
+#include "pbkdf2.h"
+#include "luksvol.h"
+
+/* LUKS1 and LUKS2 volumes decrypted with the volume key, as dumped by
+ * "cryptsetup luksDump --dump-volume-key": the volume is read from the
+ * underlying disk and decrypted sector by sector, so no dm-crypt
+ * mapping is needed. The key is checked against the digest stored in
+ * the header. Large reads are decrypted by a pool of threads. */
+#define LUKSVOL_MAX_KEY		64
+#define LUKSVOL_MAX_THREADS	16
+/* Smaller reads are decrypted by the calling thread */
+#define LUKSVOL_PARALLEL_MIN	(64*1024)
+#define LUKS2_HDR_BIN_SIZE	4096
+#define LUKS2_MAX_HDR_SIZE	(4*1024*1024)
+
+#define LUKSVOL_XTS		0
+#define LUKSVOL_CBC_ESSIV	1
+#define LUKSVOL_CBC_PLAIN	2
+
+extern const arch_fnct_t arch_none;
+
+#ifdef HAVE_PTHREAD
+struct luksvol_worker;
+#endif
+
+struct info_luksvol_struct
+{
+  disk_t *disk;
+  char *name;
+  unsigned int version;
+  char cipher[64];
+  uint64_t offset;		/* start of the encrypted data on disk */
+  uint64_t size;
+  unsigned int unit;		/* encryption sector size */
+  uint64_t iv_tweak;
+  unsigned int mode;
+  int iv_32bits;		/* "plain" IV instead of "plain64" */
+  aes_key_t key1;
+  aes_key_t key2;		/* XTS tweak key or ESSIV key */
+  unsigned char *bounce;
+  unsigned int bounce_size;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t pread_mutex;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_start;
+  pthread_cond_t cond_done;
+  unsigned int generation;
+  unsigned int pending;
+  unsigned int nbr_threads;
+  int quit;
+  pthread_t threads[LUKSVOL_MAX_THREADS];
+  struct luksvol_worker *workers;
+  /* current parallel decryption */
+  unsigned char *job_buffer;
+  unsigned int job_units;
+  uint64_t job_sector;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+struct luksvol_worker
+{
+  struct info_luksvol_struct *data;
+  unsigned int index;
+  unsigned int generation;
+};
+#endif
+
+/* Decrypt units sectors, sector is the IV of the first one in 512-byte
+ * sectors */
+static void luksvol_decrypt(const struct info_luksvol_struct *data, unsigned char *buffer, const unsigned int units, const uint64_t sector)
+{
+  unsigned int i;
+  for(i=0; i<units; i++)
+  {
+    unsigned char *p=&buffer[(size_t)i * data->unit];
+    uint64_t iv_sector=sector + (uint64_t)i * (data->unit / 512) + data->iv_tweak;
+    unsigned char iv[AES_BLOCK_SIZE];
+    unsigned int j;
+    if(data->iv_32bits)
+      iv_sector&=0xffffffff;
+    if(data->mode==LUKSVOL_XTS)
+    {
+      aes_xts_decrypt(&data->key1, &data->key2, p, data->unit, iv_sector);
+      continue;
+    }
+    memset(iv, 0, sizeof(iv));
+    for(j=0; j<8; j++)
+      iv[j]=iv_sector >> (8*j);
+    if(data->mode==LUKSVOL_CBC_ESSIV)
+      aes_encrypt_block(&data->key2, iv, iv);
+    aes_cbc_decrypt(&data->key1, p, data->unit, iv);
+  }
+}
+
+#ifdef HAVE_PTHREAD
+/* Share of the current job for the participant index, the calling
+ * thread being the last one */
+static void luksvol_job_part(struct info_luksvol_struct *data, const unsigned int index)
+{
+  const unsigned int nbr=data->nbr_threads + 1;
+  const unsigned int first=(unsigned int)((uint64_t)data->job_units * index / nbr);
+  const unsigned int last=(unsigned int)((uint64_t)data->job_units * (index + 1) / nbr);
+  luksvol_decrypt(data, data->job_buffer + (size_t)first * data->unit, last - first,
+      data->job_sector + (uint64_t)first * (data->unit / 512));
+}
+
+static void *luksvol_thread(void *arg)
+{
+  struct luksvol_worker *worker=(struct luksvol_worker *)arg;
+  struct info_luksvol_struct *data=worker->data;
+  pthread_mutex_lock(&data->mutex);
+  while(1)
+  {
+    while(data->quit==0 && worker->generation==data->generation)
+      pthread_cond_wait(&data->cond_start, &data->mutex);
+    if(data->quit!=0)
+      break;
+    worker->generation=data->generation;
+    pthread_mutex_unlock(&data->mutex);
+    luksvol_job_part(data, worker->index);
+    pthread_mutex_lock(&data->mutex);
+    if(--data->pending==0)
+      pthread_cond_signal(&data->cond_done);
+  }
+  pthread_mutex_unlock(&data->mutex);
+  return NULL;
+}
+#endif
+
+static void luksvol_decrypt_all(struct info_luksvol_struct *data, unsigned char *buffer, const unsigned int units, const uint64_t sector)
+{
+#ifdef HAVE_PTHREAD
+  if(data->nbr_threads > 0 && (uint64_t)units * data->unit >= LUKSVOL_PARALLEL_MIN)
+  {
+    pthread_mutex_lock(&data->mutex);
+    data->job_buffer=buffer;
+    data->job_units=units;
+    data->job_sector=sector;
+    data->pending=data->nbr_threads;
+    data->generation++;
+    pthread_cond_broadcast(&data->cond_start);
+    pthread_mutex_unlock(&data->mutex);
+    luksvol_job_part(data, data->nbr_threads);
+    pthread_mutex_lock(&data->mutex);
+    while(data->pending > 0)
+      pthread_cond_wait(&data->cond_done, &data->mutex);
+    pthread_mutex_unlock(&data->mutex);
+    return;
+  }
+#endif
+  luksvol_decrypt(data, buffer, units, sector);
+}
+
+static int fluksvol_pread_aux(struct info_luksvol_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const uint64_t start=offset / data->unit * data->unit;
+  const uint64_t end=(offset + count + data->unit - 1) / data->unit * data->unit;
+  const unsigned int size=end - start;
+  unsigned char *p=buffer;
+  unsigned int units;
+  int res;
+  if(start!=offset || size!=count)
+  {
+    if(size > data->bounce_size)
+    {
+      free(data->bounce);
+      data->bounce_size=size;
+      data->bounce=(unsigned char *)MALLOC(data->bounce_size);
+    }
+    p=data->bounce;
+  }
+  res=data->disk->pread(data->disk, p, size, data->offset + start);
+  units=(res > 0 ? (unsigned int)res / data->unit : 0);
+  if(units==0)
+    return (res < 0 ? res : -1);
+  luksvol_decrypt_all(data, p, units, start / 512);
+  if(p!=buffer)
+  {
+    const uint64_t read_end=start + (uint64_t)units * data->unit;
+    unsigned int avail;
+    if(read_end <= offset)
+      return -1;
+    avail=(read_end > offset + count ? count : (unsigned int)(read_end - offset));
+    memcpy(buffer, p + (offset - start), avail);
+    return avail;
+  }
+  return units * data->unit;
+}
+
+static int fluksvol_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_luksvol_struct *data=(struct info_luksvol_struct *)disk->data;
+  unsigned int size=count;
+  int res;
+  if(offset >= data->size)
+    return 0;
+  if(size > data->size - offset)
+    size=data->size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->pread_mutex);
+#endif
+  res=fluksvol_pread_aux(data, (unsigned char *)buffer, size, offset);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->pread_mutex);
+#endif
+  if(res < 0)
+    log_error("fluksvol_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read error\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return res;
+}
+
+static int fluksvol_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fluksvol_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fluksvol_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fluksvol_description(disk_t *disk)
+{
+  const struct info_luksvol_struct *data=(const struct info_luksvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  /* With a long cipher or device name, only the device is described */
+  if(snprintf(disk->description_txt, sizeof(disk->description_txt),"LUKS%u %s %s - %s - CHS %lu %u %u (RO)",
+	data->version, data->cipher, data->disk->device, buffer_disk_size,
+	disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head) >= (int)sizeof(disk->description_txt))
+    snprintf(disk->description_txt, sizeof(disk->description_txt),"LUKS%u %s - %s (RO)",
+	data->version, data->disk->device, buffer_disk_size);
+  return disk->description_txt;
+}
+
+static const char *fluksvol_description_short(disk_t *disk)
+{
+  const struct info_luksvol_struct *data=(const struct info_luksvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_short_txt),"LUKS%u %s - %s (RO)",
+      data->version, data->disk->device, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void luksvol_free(struct info_luksvol_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  unsigned int i;
+  pthread_mutex_lock(&data->mutex);
+  data->quit=1;
+  pthread_cond_broadcast(&data->cond_start);
+  pthread_mutex_unlock(&data->mutex);
+  for(i=0; i<data->nbr_threads; i++)
+    pthread_join(data->threads[i], NULL);
+  pthread_cond_destroy(&data->cond_done);
+  pthread_cond_destroy(&data->cond_start);
+  pthread_mutex_destroy(&data->mutex);
+  pthread_mutex_destroy(&data->pread_mutex);
+  free(data->workers);
+#endif
+  if(data->disk!=NULL)
+    data->disk->clean(data->disk);
+  /* Don't leave the keys in memory */
+  memset(&data->key1, 0, sizeof(data->key1));
+  memset(&data->key2, 0, sizeof(data->key2));
+  free(data->bounce);
+  free(data->name);
+  free(data);
+}
+
+static void fluksvol_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    luksvol_free((struct info_luksvol_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+/* Read the volume key, raw or as hexadecimal digits */
+static unsigned int luksvol_read_key(const char *filename, unsigned char *key)
+{
+  unsigned char buffer[4*LUKSVOL_MAX_KEY];
+  unsigned int size;
+  unsigned int digits=0;
+  unsigned int i;
+  int hex=1;
+  FILE *handle=fopen(filename, "rb");
+  if(handle==NULL)
+  {
+    log_error("luks: can't open the key file %s: %s\n", filename, strerror(errno));
+    return 0;
+  }
+  size=fread(buffer, 1, sizeof(buffer), handle);
+  fclose(handle);
+  for(i=0; i<size && hex!=0; i++)
+  {
+    if(isxdigit(buffer[i]))
+      digits++;
+    else if(!isspace(buffer[i]))
+      hex=0;
+  }
+  if(hex!=0 && digits%2==0 && digits >= 32 && digits <= 2*LUKSVOL_MAX_KEY)
+  {
+    unsigned int n=0;
+    for(i=0; i<size; i++)
+    {
+      if(isxdigit(buffer[i]))
+      {
+	const unsigned int v=(isdigit(buffer[i]) ? buffer[i] - '0' : (tolower(buffer[i]) - 'a' + 10));
+	if(n%2==0)
+	  key[n/2]=v << 4;
+	else
+	  key[n/2]|=v;
+	n++;
+      }
+    }
+    size=digits / 2;
+  }
+  else if(size > LUKSVOL_MAX_KEY)
+  {
+    log_error("luks: %s doesn't hold a volume key\n", filename);
+    size=0;
+  }
+  else
+    memcpy(key, buffer, size);
+  memset(buffer, 0, sizeof(buffer));
+  return size;
+}
+
+/* aes with xts-plain64, xts-plain, cbc-essiv:sha256, cbc-plain64 or
+ * cbc-plain */
+static int luksvol_set_cipher(struct info_luksvol_struct *data, const char *cipher_name, const char *cipher_mode, const unsigned char *key, const unsigned int key_len)
+{
+  int res;
+  snprintf(data->cipher, sizeof(data->cipher), "%s-%s", cipher_name, cipher_mode);
+  if(strcmp(cipher_name, "aes")!=0)
+  {
+    log_error("%s: cipher %s is not supported\n", data->name, data->cipher);
+    return -1;
+  }
+  if(strcmp(cipher_mode, "xts-plain64")==0 || strcmp(cipher_mode, "xts-plain")==0)
+  {
+    data->mode=LUKSVOL_XTS;
+    data->iv_32bits=(strcmp(cipher_mode, "xts-plain")==0);
+    res=aes_set_key(&data->key1, key, key_len/2);
+    if(res==0)
+      res=aes_set_key(&data->key2, key + key_len/2, key_len/2);
+  }
+  else if(strcmp(cipher_mode, "cbc-essiv:sha256")==0)
+  {
+    unsigned char salt[SHA256_DIGEST_SIZE];
+    data->mode=LUKSVOL_CBC_ESSIV;
+    sha256(key, key_len, salt);
+    res=aes_set_key(&data->key1, key, key_len);
+    if(res==0)
+      res=aes_set_key(&data->key2, salt, sizeof(salt));
+    memset(salt, 0, sizeof(salt));
+  }
+  else if(strcmp(cipher_mode, "cbc-plain64")==0 || strcmp(cipher_mode, "cbc-plain")==0)
+  {
+    data->mode=LUKSVOL_CBC_PLAIN;
+    data->iv_32bits=(strcmp(cipher_mode, "cbc-plain")==0);
+    res=aes_set_key(&data->key1, key, key_len);
+  }
+  else
+  {
+    log_error("%s: cipher %s is not supported\n", data->name, data->cipher);
+    return -1;
+  }
+  if(res < 0)
+    log_error("%s: a %u-byte key can't be used with %s\n", data->name, key_len, data->cipher);
+  return res;
+}
+
+static int luksvol_check_digest(const struct info_luksvol_struct *data, const char *hash, const unsigned char *key, const unsigned int key_len, const unsigned char *salt, const unsigned int salt_len, const unsigned int iterations, const unsigned char *digest, const unsigned int digest_len)
+{
+  unsigned char res[64];
+  if(digest_len > sizeof(res) || pbkdf2_hmac(hash, key, key_len, salt, salt_len, iterations, res, digest_len) < 0)
+  {
+    log_warning("%s: the volume key can't be checked (%s digest)\n", data->name, hash);
+    return 0;
+  }
+  if(memcmp(res, digest, digest_len)!=0)
+  {
+    log_error("%s: the key doesn't match the volume key digest\n", data->name);
+    return -1;
+  }
+  return 0;
+}
+
+/* Copy a NUL terminated string from a fixed size header field */
+static void luksvol_copy_field(char *dst, const uint8_t *src, const unsigned int size)
+{
+  memcpy(dst, src, size);
+  dst[size]='\0';
+}
+
+static int luks1_setup(struct info_luksvol_struct *data, const unsigned char *buffer, const unsigned char *key, const unsigned int key_len)
+{
+  const struct luks_phdr *hdr=(const struct luks_phdr *)buffer;
+  char cipher_name[LUKS_CIPHERNAME_L+1];
+  char cipher_mode[LUKS_CIPHERMODE_L+1];
+  char hash[LUKS_HASHSPEC_L+1];
+  luksvol_copy_field(cipher_name, hdr->cipherName, LUKS_CIPHERNAME_L);
+  luksvol_copy_field(cipher_mode, hdr->cipherMode, LUKS_CIPHERMODE_L);
+  luksvol_copy_field(hash, hdr->hashSpec, LUKS_HASHSPEC_L);
+  if(be32(hdr->keyBytes)!=key_len)
+  {
+    log_error("%s: the key file holds %u bytes, the volume key has %u bytes\n", data->name,
+	key_len, (unsigned int)be32(hdr->keyBytes));
+    return -1;
+  }
+  if(luksvol_check_digest(data, hash, key, key_len, hdr->mkDigestSalt, LUKS_SALTSIZE,
+	be32(hdr->mkDigestIterations), hdr->mkDigest, LUKS_DIGESTSIZE) < 0)
+    return -1;
+  data->offset=(uint64_t)be32(hdr->payloadOffset) * 512;
+  data->unit=512;
+  if(data->offset >= data->disk->disk_real_size)
+    return -1;
+  data->size=data->disk->disk_real_size - data->offset;
+  return luksvol_set_cipher(data, cipher_name, cipher_mode, key, key_len);
+}
+
+/* Skip a JSON string or a nested object/array, return the end */
+static const char *json_skip(const char *p, const char *end)
+{
+  unsigned int depth=0;
+  int in_string=0;
+  for(; p < end; p++)
+  {
+    if(in_string)
+    {
+      if(*p=='\\')
+	p++;
+      else if(*p=='"')
+      {
+	in_string=0;
+	if(depth==0)
+	  return p + 1;
+      }
+    }
+    else if(*p=='"')
+      in_string=1;
+    else if(*p=='{' || *p=='[')
+      depth++;
+    else if(*p=='}' || *p==']')
+    {
+      if(depth <= 1)
+	return p + 1;
+      depth--;
+    }
+  }
+  return end;
+}
+
+/* Find the value of key in the object [p, end), only the members of
+ * this object are checked */
+static const char *json_member(const char *p, const char *end, const char *key)
+{
+  const size_t len=strlen(key);
+  if(p >= end || *p!='{')
+    return NULL;
+  p++;
+  while(p < end)
+  {
+    const char *name;
+    while(p < end && (isspace(*p) || *p==','))
+      p++;
+    if(p >= end || *p!='"')
+      return NULL;
+    name=p + 1;
+    p=json_skip(p, end);
+    while(p < end && (isspace(*p) || *p==':'))
+      p++;
+    if(p - name >= 1 && (size_t)(p - name) > len && memcmp(name, key, len)==0 && name[len]=='"')
+      return p;
+    if(p < end && (*p=='"' || *p=='{' || *p=='['))
+      p=json_skip(p, end);
+    else
+      while(p < end && *p!=',' && *p!='}')
+	p++;
+    if(p < end && *p=='}')
+      return NULL;
+  }
+  return NULL;
+}
+
+/* First entry of the object [p, end), the segment or digest "0" */
+static const char *json_first_entry(const char *p, const char *end)
+{
+  if(p==NULL || p >= end || *p!='{')
+    return NULL;
+  p++;
+  while(p < end && isspace(*p))
+    p++;
+  if(p >= end || *p!='"')
+    return NULL;
+  p=json_skip(p, end);
+  while(p < end && (isspace(*p) || *p==':'))
+    p++;
+  return (p < end && *p=='{' ? p : NULL);
+}
+
+/* Copy a string or number value */
+static int json_value(const char *p, const char *end, char *dst, const unsigned int size)
+{
+  unsigned int i=0;
+  if(p==NULL)
+    return -1;
+  if(*p=='"')
+  {
+    for(p++; p < end && *p!='"' && i+1 < size; p++)
+      dst[i++]=*p;
+  }
+  else
+  {
+    for(; p < end && (isdigit(*p) || *p=='-') && i+1 < size; p++)
+      dst[i++]=*p;
+  }
+  dst[i]='\0';
+  return (i > 0 ? 0 : -1);
+}
+
+static unsigned int base64_decode(const char *src, unsigned char *dst, const unsigned int size)
+{
+  unsigned int bits=0;
+  unsigned int nbr_bits=0;
+  unsigned int len=0;
+  for(; *src!='\0' && *src!='='; src++)
+  {
+    const char *pos;
+    static const char base64[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    if(*src=='\\')
+      continue;
+    pos=strchr(base64, *src);
+    if(pos==NULL)
+      return 0;
+    bits=(bits << 6) | (unsigned int)(pos - base64);
+    nbr_bits+=6;
+    if(nbr_bits >= 8)
+    {
+      nbr_bits-=8;
+      if(len >= size)
+	return 0;
+      dst[len++]=bits >> nbr_bits;
+    }
+  }
+  return len;
+}
+
+static int luks2_setup(struct info_luksvol_struct *data, const unsigned char *buffer, const unsigned char *key, const unsigned int key_len)
+{
+  const uint64_t hdr_size=be64(*(const uint64_t *)&buffer[8]);
+  char *json;
+  const char *end;
+  const char *segment;
+  const char *digest;
+  char value[256];
+  char mode[64];
+  unsigned char salt[64];
+  unsigned char key_digest[64];
+  unsigned int salt_len;
+  unsigned int digest_len;
+  unsigned int iterations;
+  int res=-1;
+  if(hdr_size <= LUKS2_HDR_BIN_SIZE || hdr_size > LUKS2_MAX_HDR_SIZE)
+    return -1;
+  json=(char *)MALLOC(hdr_size - LUKS2_HDR_BIN_SIZE + 1);
+  if(data->disk->pread(data->disk, json, hdr_size - LUKS2_HDR_BIN_SIZE, LUKS2_HDR_BIN_SIZE) != (int)(hdr_size - LUKS2_HDR_BIN_SIZE))
+  {
+    free(json);
+    return -1;
+  }
+  json[hdr_size - LUKS2_HDR_BIN_SIZE]='\0';
+  end=json + strlen(json);
+  segment=json_first_entry(json_member(json, end, "segments"), end);
+  digest=json_first_entry(json_member(json, end, "digests"), end);
+  if(segment==NULL || digest==NULL)
+  {
+    log_error("%s: no segment or digest in the LUKS2 metadata\n", data->name);
+    free(json);
+    return -1;
+  }
+  if(json_value(json_member(segment, end, "type"), end, value, sizeof(value)) < 0 || strcmp(value, "crypt")!=0)
+    log_error("%s: segment type %s is not supported\n", data->name, value);
+  else if(json_value(json_member(digest, end, "type"), end, value, sizeof(value)) < 0 || strcmp(value, "pbkdf2")!=0)
+    log_error("%s: digest type %s is not supported\n", data->name, value);
+  else if(json_value(json_member(digest, end, "salt"), end, value, sizeof(value)) < 0 ||
+      (salt_len=base64_decode(value, salt, sizeof(salt)))==0 ||
+      json_value(json_member(digest, end, "digest"), end, value, sizeof(value)) < 0 ||
+      (digest_len=base64_decode(value, key_digest, sizeof(key_digest)))==0 ||
+      json_value(json_member(digest, end, "iterations"), end, value, sizeof(value)) < 0 ||
+      (iterations=strtoul(value, NULL, 10))==0 ||
+      json_value(json_member(digest, end, "hash"), end, value, sizeof(value)) < 0)
+    log_error("%s: invalid LUKS2 digest\n", data->name);
+  else if(luksvol_check_digest(data, value, key, key_len, salt, salt_len, iterations, key_digest, digest_len)==0)
+  {
+    char *sep;
+    data->iv_tweak=0;
+    if(json_value(json_member(segment, end, "iv_tweak"), end, value, sizeof(value))==0)
+      data->iv_tweak=strtoull(value, NULL, 10);
+    data->unit=512;
+    if(json_value(json_member(segment, end, "sector_size"), end, value, sizeof(value))==0)
+      data->unit=strtoul(value, NULL, 10);
+    if(json_value(json_member(segment, end, "offset"), end, value, sizeof(value))==0)
+      data->offset=strtoull(value, NULL, 10);
+    if(data->unit < 512 || data->unit > 4096 || (data->unit & (data->unit - 1))!=0 ||
+	data->offset==0 || data->offset >= data->disk->disk_real_size)
+      log_error("%s: invalid LUKS2 segment\n", data->name);
+    else if(json_value(json_member(segment, end, "encryption"), end, mode, sizeof(mode)) < 0 ||
+	(sep=strchr(mode, '-'))==NULL)
+      log_error("%s: invalid LUKS2 encryption\n", data->name);
+    else
+    {
+      data->size=data->disk->disk_real_size - data->offset;
+      if(json_value(json_member(segment, end, "size"), end, value, sizeof(value))==0 &&
+	  strcmp(value, "dynamic")!=0 && strtoull(value, NULL, 10) < data->size)
+	data->size=strtoull(value, NULL, 10);
+      data->size=data->size / data->unit * data->unit;
+      *sep='\0';
+      res=luksvol_set_cipher(data, mode, sep + 1, key, key_len);
+    }
+  }
+  free(json);
+  return res;
+}
+
+#ifdef HAVE_PTHREAD
+static void luksvol_start_threads(struct info_luksvol_struct *data, const unsigned int nbr)
+{
+  struct luksvol_worker *workers=(struct luksvol_worker *)MALLOC(nbr * sizeof(struct luksvol_worker));
+  unsigned int i;
+  data->workers=workers;
+  for(i=0; i<nbr; i++)
+  {
+    workers[i].data=data;
+    workers[i].index=i;
+    workers[i].generation=0;
+    if(pthread_create(&data->threads[i], NULL, &luksvol_thread, &workers[i])!=0)
+      break;
+    data->nbr_threads++;
+  }
+}
+#endif
+
+disk_t *fluksvol_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  static const uint8_t LUKS_MAGIC[LUKS_MAGIC_L] = {'L','U','K','S', 0xba, 0xbe};
+  struct info_luksvol_struct *data;
+  unsigned char key[LUKSVOL_MAX_KEY];
+  unsigned char *buffer;
+  unsigned int key_len;
+  char *key_file;
+  const char *sep;
+  disk_t *disk;
+  int res=-1;
+  if(strncmp(device, LUKSVOL_PREFIX, strlen(LUKSVOL_PREFIX))!=0)
+    return NULL;
+  sep=strchr(device + strlen(LUKSVOL_PREFIX), ',');
+  if(sep==NULL)
+  {
+    log_error("%s: the key file and the device must be given as luks:keyfile,device\n", device);
+    return NULL;
+  }
+  key_file=(char *)MALLOC(sep - device - strlen(LUKSVOL_PREFIX) + 1);
+  memcpy(key_file, device + strlen(LUKSVOL_PREFIX), sep - device - strlen(LUKSVOL_PREFIX));
+  key_file[sep - device - strlen(LUKSVOL_PREFIX)]='\0';
+  key_len=luksvol_read_key(key_file, key);
+  free(key_file);
+  if(key_len==0)
+    return NULL;
+  data=(struct info_luksvol_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->name=strdup(device);
+  data->disk=file_test_availability(sep + 1, verbose, testdisk_mode & ~(TESTDISK_O_RDWR|TESTDISK_O_DIRECT));
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->pread_mutex, NULL);
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond_start, NULL);
+  pthread_cond_init(&data->cond_done, NULL);
+#endif
+  buffer=(unsigned char *)MALLOC(LUKS2_HDR_BIN_SIZE);
+  if(data->name==NULL || data->disk==NULL)
+    log_error("%s: can't open %s\n", device, sep + 1);
+  else if(data->disk->pread(data->disk, buffer, LUKS2_HDR_BIN_SIZE, 0) != LUKS2_HDR_BIN_SIZE ||
+      memcmp(buffer, LUKS_MAGIC, LUKS_MAGIC_L)!=0)
+    log_error("%s: no LUKS header on %s\n", device, sep + 1);
+  else
+  {
+    data->version=be16(*(const uint16_t *)&buffer[LUKS_MAGIC_L]);
+    if(data->version==1)
+      res=luks1_setup(data, buffer, key, key_len);
+    else if(data->version==2)
+      res=luks2_setup(data, buffer, key, key_len);
+    else
+      log_error("%s: LUKS version %u is not supported\n", device, data->version);
+  }
+  free(buffer);
+  memset(key, 0, sizeof(key));
+  if(res < 0 || data->size==0)
+  {
+    luksvol_free(data);
+    return NULL;
+  }
+#ifdef HAVE_PTHREAD
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+  {
+    const long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    const unsigned int nbr=(cpus > LUKSVOL_MAX_THREADS ? LUKSVOL_MAX_THREADS : (cpus > 1 ? cpus - 1 : 0));
+    if(nbr > 0)
+      luksvol_start_threads(data, nbr);
+  }
+#endif
+#endif
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    luksvol_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&fluksvol_description;
+  disk->description_short=&fluksvol_description_short;
+  disk->pread=&fluksvol_pread;
+  disk->pwrite=&fluksvol_nopwrite;
+  disk->sync=&fluksvol_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fluksvol_clean;
+  disk->sector_size=data->unit;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  log_info("%s: LUKS%u %s, data offset %llu, sector size %u, %s, %u decryption threads\n", device,
+      data->version, data->cipher, (long long unsigned)data->offset, data->unit, aes_implementation(),
+#ifdef HAVE_PTHREAD
+      data->nbr_threads + 1
+#else
+      1
+#endif
+      );
+  return disk;
+}
+#endif
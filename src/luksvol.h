@@ -0,0 +1,46 @@
+/*
+
+    File: luksvol.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _LUKSVOL_H
+#define _LUKSVOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a LUKS volume decrypted with its volume key:
+ * luks:keyfile,device */
+#define LUKSVOL_PREFIX "luks:"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open read-only the LUKS1 or LUKS2 volume named in device, the key
+ * file holds the volume key, raw or in hexadecimal.
+ * NULL if the key doesn't match or the cipher isn't supported */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fluksvol_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
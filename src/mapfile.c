@@ -0,0 +1,302 @@
+/*
+
+    File: mapfile.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "log.h"
+#include "mapfile.h"
+
+void mapfile_init(mapfile_t *map, const uint64_t size)
+{
+  map->ranges=NULL;
+  map->nbr=0;
+  map->allocated=0;
+  map->current_pos=0;
+  map->current_status=MAPFILE_NON_TRIED;
+  map->current_pass=1;
+  mapfile_set(map, 0, size, MAPFILE_NON_TRIED);
+}
+
+void mapfile_free(mapfile_t *map)
+{
+  free(map->ranges);
+  map->ranges=NULL;
+  map->nbr=0;
+  map->allocated=0;
+}
+
+/* Index of the first range ending after pos */
+static unsigned int mapfile_find(const mapfile_t *map, const uint64_t pos)
+{
+  unsigned int low=0;
+  unsigned int high=map->nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(map->ranges[mid].pos + map->ranges[mid].size <= pos)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return low;
+}
+
+void mapfile_set(mapfile_t *map, const uint64_t pos, const uint64_t size, const char status)
+{
+  mapfile_range_t tmp[3];
+  unsigned int nbr_tmp=0;
+  unsigned int first;
+  unsigned int last;
+  unsigned int i;
+  const uint64_t end=pos + size;
+  if(size==0)
+    return ;
+  first=mapfile_find(map, pos);
+  for(last=first; last < map->nbr && map->ranges[last].pos < end; last++);
+  /* ranges[first..last[ overlap [pos, end[ */
+  if(first < last && map->ranges[first].pos < pos)
+  {
+    tmp[nbr_tmp].pos=map->ranges[first].pos;
+    tmp[nbr_tmp].size=pos - map->ranges[first].pos;
+    tmp[nbr_tmp].status=map->ranges[first].status;
+    nbr_tmp++;
+  }
+  tmp[nbr_tmp].pos=pos;
+  tmp[nbr_tmp].size=size;
+  tmp[nbr_tmp].status=status;
+  nbr_tmp++;
+  if(first < last && map->ranges[last-1].pos + map->ranges[last-1].size > end)
+  {
+    tmp[nbr_tmp].pos=end;
+    tmp[nbr_tmp].size=map->ranges[last-1].pos + map->ranges[last-1].size - end;
+    tmp[nbr_tmp].status=map->ranges[last-1].status;
+    nbr_tmp++;
+  }
+  /* Merge with the neighbours */
+  if(first > 0 && map->ranges[first-1].status==tmp[0].status &&
+      map->ranges[first-1].pos + map->ranges[first-1].size==tmp[0].pos)
+  {
+    first--;
+    tmp[0].pos=map->ranges[first].pos;
+    tmp[0].size+=map->ranges[first].size;
+  }
+  if(last < map->nbr && map->ranges[last].status==tmp[nbr_tmp-1].status &&
+      tmp[nbr_tmp-1].pos + tmp[nbr_tmp-1].size==map->ranges[last].pos)
+  {
+    tmp[nbr_tmp-1].size+=map->ranges[last].size;
+    last++;
+  }
+  for(i=1; i < nbr_tmp; )
+  {
+    if(tmp[i-1].status==tmp[i].status)
+    {
+      tmp[i-1].size+=tmp[i].size;
+      nbr_tmp--;
+      if(i < nbr_tmp)
+	memmove(&tmp[i], &tmp[i+1], (nbr_tmp - i) * sizeof(tmp[0]));
+    }
+    else
+      i++;
+  }
+  if(map->nbr - (last - first) + nbr_tmp > map->allocated)
+  {
+    map->allocated=(map->allocated < 16 ? 16 : map->allocated * 2);
+    map->ranges=(mapfile_range_t *)realloc(map->ranges, map->allocated * sizeof(mapfile_range_t));
+    if(map->ranges==NULL)
+    {
+      log_critical("mapfile_set: not enough memory\n");
+      exit(1);
+    }
+  }
+  memmove(&map->ranges[first + nbr_tmp], &map->ranges[last], (map->nbr - last) * sizeof(mapfile_range_t));
+  memcpy(&map->ranges[first], tmp, nbr_tmp * sizeof(mapfile_range_t));
+  map->nbr=map->nbr - (last - first) + nbr_tmp;
+}
+
+int mapfile_next(const mapfile_t *map, const uint64_t from, const char status, uint64_t *pos, uint64_t *size)
+{
+  unsigned int i;
+  for(i=mapfile_find(map, from); i < map->nbr; i++)
+  {
+    const mapfile_range_t *range=&map->ranges[i];
+    if(range->status==status)
+    {
+      *pos=(range->pos > from ? range->pos : from);
+      *size=range->pos + range->size - *pos;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+uint64_t mapfile_first(const mapfile_t *map, const uint64_t pos, const uint64_t size, const char status)
+{
+  const uint64_t end=pos + size;
+  unsigned int i;
+  for(i=mapfile_find(map, pos); i < map->nbr && map->ranges[i].pos < end; i++)
+  {
+    if(map->ranges[i].status==status)
+      return (map->ranges[i].pos > pos ? map->ranges[i].pos : pos);
+  }
+  return end;
+}
+
+uint64_t mapfile_size(const mapfile_t *map, const char status)
+{
+  uint64_t size=0;
+  unsigned int i;
+  for(i=0; i < map->nbr; i++)
+    if(map->ranges[i].status==status)
+      size+=map->ranges[i].size;
+  return size;
+}
+
+#if !defined(DISABLED_FOR_FRAMAC)
+static int mapfile_valid_status(const char status)
+{
+  return (status==MAPFILE_NON_TRIED || status==MAPFILE_NON_TRIMMED ||
+      status==MAPFILE_NON_SCRAPED || status==MAPFILE_BAD_SECTOR ||
+      status==MAPFILE_FINISHED);
+}
+
+int mapfile_load(mapfile_t *map, const char *filename)
+{
+  char line[256];
+  int status_line=1;
+  unsigned int line_nbr=0;
+  FILE *handle=fopen(filename, "r");
+  if(handle==NULL)
+    return -1;
+  mapfile_init(map, 0);
+  while(fgets(line, sizeof(line), handle)!=NULL)
+  {
+    char *ptr=line;
+    char *next;
+    line_nbr++;
+    while(*ptr==' ' || *ptr=='\t')
+      ptr++;
+    if(*ptr=='#' || *ptr=='\n' || *ptr=='\r' || *ptr=='\0')
+      continue;
+    if(status_line)
+    {
+      /* current_pos  current_status  [current_pass] */
+      status_line=0;
+      map->current_pos=strtoull(ptr, &next, 0);
+      if(next==ptr)
+	break;
+      ptr=next;
+      while(*ptr==' ' || *ptr=='\t')
+	ptr++;
+      map->current_status=*ptr;
+      if(*ptr!='\0')
+	ptr++;
+      map->current_pass=strtoul(ptr, &next, 0);
+      if(map->current_pass==0)
+	map->current_pass=1;
+    }
+    else
+    {
+      uint64_t pos;
+      uint64_t size;
+      pos=strtoull(ptr, &next, 0);
+      if(next==ptr)
+	break;
+      ptr=next;
+      size=strtoull(ptr, &next, 0);
+      if(next==ptr)
+	break;
+      ptr=next;
+      while(*ptr==' ' || *ptr=='\t')
+	ptr++;
+      if(!mapfile_valid_status(*ptr))
+	break;
+      mapfile_set(map, pos, size, *ptr);
+      continue;
+    }
+  }
+  if(!feof(handle))
+  {
+    log_error("%s: invalid mapfile line %u\n", filename, line_nbr);
+    fclose(handle);
+    mapfile_free(map);
+    return -1;
+  }
+  fclose(handle);
+  return 0;
+}
+
+int mapfile_save(const mapfile_t *map, const char *filename)
+{
+  char *filename_tmp;
+  FILE *handle;
+  unsigned int i;
+  int res=0;
+  filename_tmp=(char *)MALLOC(strlen(filename) + 5);
+  strcpy(filename_tmp, filename);
+  strcat(filename_tmp, ".tmp");
+  handle=fopen(filename_tmp, "w");
+  if(handle==NULL)
+  {
+    log_error("Can't create mapfile %s: %s\n", filename_tmp, strerror(errno));
+    free(filename_tmp);
+    return -1;
+  }
+  fprintf(handle, "# Mapfile. Created by TestDisk version %s\n", VERSION);
+  fprintf(handle, "# current_pos  current_status  current_pass\n");
+  fprintf(handle, "0x%08llX     %c               %u\n",
+      (long long unsigned)map->current_pos, map->current_status, map->current_pass);
+  fprintf(handle, "#      pos        size  status\n");
+  for(i=0; i < map->nbr; i++)
+    fprintf(handle, "0x%08llX  0x%08llX  %c\n",
+	(long long unsigned)map->ranges[i].pos,
+	(long long unsigned)map->ranges[i].size,
+	map->ranges[i].status);
+  if(fclose(handle)!=0)
+    res=-1;
+  if(res==0 && rename(filename_tmp, filename)!=0)
+  {
+    /* rename() doesn't replace an existing file on Windows */
+    remove(filename);
+    if(rename(filename_tmp, filename)!=0)
+      res=-1;
+  }
+  if(res<0)
+  {
+    log_error("Can't write mapfile %s: %s\n", filename, strerror(errno));
+    remove(filename_tmp);
+  }
+  free(filename_tmp);
+  return res;
+}
+#endif
@@ -0,0 +1,113 @@
+/*
+
+    File: mapfile.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _MAPFILE_H
+#define _MAPFILE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Block status, the GNU ddrescue mapfile ones */
+#define MAPFILE_NON_TRIED	'?'
+#define MAPFILE_NON_TRIMMED	'*'
+#define MAPFILE_NON_SCRAPED	'/'
+#define MAPFILE_BAD_SECTOR	'-'
+#define MAPFILE_FINISHED	'+'
+
+typedef struct
+{
+  uint64_t pos;
+  uint64_t size;
+  char status;
+} mapfile_range_t;
+
+/* Sorted ranges, two adjacent ranges never have the same status */
+typedef struct
+{
+  mapfile_range_t *ranges;
+  unsigned int nbr;
+  unsigned int allocated;
+  uint64_t current_pos;
+  char current_status;
+  unsigned int current_pass;
+} mapfile_t;
+
+/*@
+  @ requires \valid(map);
+  @*/
+void mapfile_init(mapfile_t *map, const uint64_t size);
+
+/*@
+  @ requires \valid(map);
+  @*/
+void mapfile_free(mapfile_t *map);
+
+/* Change the status of [pos, pos+size[ */
+/*@
+  @ requires \valid(map);
+  @*/
+void mapfile_set(mapfile_t *map, const uint64_t pos, const uint64_t size, const char status);
+
+/* Find the first part of a range with this status at or after from,
+ * return -1 if there is none */
+/*@
+  @ requires \valid_read(map);
+  @ requires \valid(pos);
+  @ requires \valid(size);
+  @ assigns *pos, *size;
+  @*/
+int mapfile_next(const mapfile_t *map, const uint64_t from, const char status, uint64_t *pos, uint64_t *size);
+
+/* First position of [pos, pos+size[ with this status, pos+size if there
+ * is none */
+/*@
+  @ requires \valid_read(map);
+  @ assigns \nothing;
+  @*/
+uint64_t mapfile_first(const mapfile_t *map, const uint64_t pos, const uint64_t size, const char status);
+
+/* Total size of the ranges with this status */
+/*@
+  @ requires \valid_read(map);
+  @ assigns \nothing;
+  @*/
+uint64_t mapfile_size(const mapfile_t *map, const char status);
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Read a ddrescue compatible mapfile, return -1 if it can't be read */
+/*@
+  @ requires \valid(map);
+  @ requires valid_read_string(filename);
+  @*/
+int mapfile_load(mapfile_t *map, const char *filename);
+
+/* Write the mapfile atomically, return -1 on failure */
+/*@
+  @ requires \valid_read(map);
+  @ requires valid_read_string(filename);
+  @*/
+int mapfile_save(const mapfile_t *map, const char *filename);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,1650 @@
+/*
+
+    File: mdvol.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__GNUC__)
+#include <arm_neon.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "md.h"
+#include "mdvol.h"
+
+/* Linux software RAID assembled from its members: the level, the layout
+ * and the chunk size come from the MD superblocks (0.90 and 1.x, little
+ * endian), the role of each member from its own superblock. A read is
+ * split into chunks; the chunks of each member are read by a thread per
+ * member, so a large read runs at the aggregate speed of the members.
+ * A missing or stale member of a RAID4/5/6 array is rebuilt from the
+ * parity of its stripe. */
+#define MDVOL_MAX_DISKS		64
+/* RAID1 reads are spread over the mirrors by pieces of this size */
+#define MDVOL_RAID1_PIECE	(64*1024)
+#define MDVOL_NO_SCRATCH	((size_t)-1)
+
+#define MDVOL_LEFT_ASYMMETRIC	0
+#define MDVOL_RIGHT_ASYMMETRIC	1
+#define MDVOL_LEFT_SYMMETRIC	2
+#define MDVOL_RIGHT_SYMMETRIC	3
+#define MDVOL_PARITY_0		4
+#define MDVOL_PARITY_N		5
+
+extern const arch_fnct_t arch_none;
+
+/* Information read from the superblock of a member */
+struct mdvol_sb
+{
+  uint8_t uuid[16];
+  int level;
+  unsigned int layout;
+  unsigned int chunk_size;	/* bytes */
+  unsigned int raid_disks;
+  int role;			/* -1 for a spare or a faulty disk */
+  uint64_t data_offset;		/* bytes */
+  uint64_t size;		/* bytes of data on the member */
+  uint64_t events;
+  unsigned int version;
+};
+
+struct mdvol_io
+{
+  uint64_t offset;		/* offset on the member disk */
+  unsigned char *buffer;
+  size_t scratch;		/* offset in scratch, MDVOL_NO_SCRATCH if buffer is used */
+  unsigned int size;
+};
+
+/* A chunk of a missing member, the xor of nbr sources stored one after
+ * the other in scratch */
+struct mdvol_rebuild
+{
+  unsigned char *buffer;
+  size_t scratch;
+  unsigned int nbr;
+  unsigned int size;
+};
+
+struct info_mdvol_struct;
+
+struct mdvol_member
+{
+  disk_t *disk;			/* NULL if the member is missing */
+  uint64_t data_offset;
+  uint64_t start;		/* linear: offset of the member in the volume */
+  uint64_t size;
+  struct mdvol_io *io;
+  unsigned int io_nbr;
+  unsigned int io_size;
+  int error;
+  struct info_mdvol_struct *data;
+#ifdef HAVE_PTHREAD
+  unsigned int generation;
+  int thread_ok;
+  pthread_t thread;
+#endif
+};
+
+struct info_mdvol_struct
+{
+  char *name;
+  int level;
+  unsigned int layout;
+  unsigned int raid_disks;
+  unsigned int chunk_size;
+  unsigned int near_copies;
+  uint64_t size;
+  unsigned int missing;
+  struct mdvol_member member[MDVOL_MAX_DISKS];
+  struct mdvol_rebuild *rebuild;
+  unsigned int rebuild_nbr;
+  unsigned int rebuild_size;
+  unsigned char *scratch;
+  size_t scratch_size;
+  size_t scratch_used;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t pread_mutex;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_start;
+  pthread_cond_t cond_done;
+  unsigned int generation;
+  unsigned int pending;
+  unsigned int nbr_threads;
+  int quit;
+#endif
+};
+
+static const char *mdvol_level_name(const int level)
+{
+  switch(level)
+  {
+    case -1:	return "Linear";
+    case 0:	return "RAID0";
+    case 1:	return "RAID1";
+    case 4:	return "RAID4";
+    case 5:	return "RAID5";
+    case 6:	return "RAID6";
+    case 10:	return "RAID10";
+  }
+  return "RAID";
+}
+
+static void mdvol_xor(unsigned char *dst, const unsigned char *src, const unsigned int size)
+{
+  unsigned int i=0;
+#if defined(__SSE2__) && defined(__GNUC__)
+  for(; i + 64 <= size; i+=64)
+  {
+    const __m128i a=_mm_xor_si128(_mm_loadu_si128((const __m128i *)&dst[i]), _mm_loadu_si128((const __m128i *)&src[i]));
+    const __m128i b=_mm_xor_si128(_mm_loadu_si128((const __m128i *)&dst[i+16]), _mm_loadu_si128((const __m128i *)&src[i+16]));
+    const __m128i c=_mm_xor_si128(_mm_loadu_si128((const __m128i *)&dst[i+32]), _mm_loadu_si128((const __m128i *)&src[i+32]));
+    const __m128i d=_mm_xor_si128(_mm_loadu_si128((const __m128i *)&dst[i+48]), _mm_loadu_si128((const __m128i *)&src[i+48]));
+    _mm_storeu_si128((__m128i *)&dst[i], a);
+    _mm_storeu_si128((__m128i *)&dst[i+16], b);
+    _mm_storeu_si128((__m128i *)&dst[i+32], c);
+    _mm_storeu_si128((__m128i *)&dst[i+48], d);
+  }
+#elif defined(__ARM_NEON) && defined(__GNUC__)
+  for(; i + 64 <= size; i+=64)
+  {
+    const uint8x16_t a=veorq_u8(vld1q_u8(&dst[i]), vld1q_u8(&src[i]));
+    const uint8x16_t b=veorq_u8(vld1q_u8(&dst[i+16]), vld1q_u8(&src[i+16]));
+    const uint8x16_t c=veorq_u8(vld1q_u8(&dst[i+32]), vld1q_u8(&src[i+32]));
+    const uint8x16_t d=veorq_u8(vld1q_u8(&dst[i+48]), vld1q_u8(&src[i+48]));
+    vst1q_u8(&dst[i], a);
+    vst1q_u8(&dst[i+16], b);
+    vst1q_u8(&dst[i+32], c);
+    vst1q_u8(&dst[i+48], d);
+  }
+#endif
+  for(; i + 8 <= size; i+=8)
+  {
+    uint64_t a, b;
+    memcpy(&a, &dst[i], sizeof(a));
+    memcpy(&b, &src[i], sizeof(b));
+    a^=b;
+    memcpy(&dst[i], &a, sizeof(a));
+  }
+  for(; i < size; i++)
+    dst[i]^=src[i];
+}
+
+/* Return 0 if a 1.x superblock has been found at offset */
+static int mdvol_sb1(disk_t *disk, const uint64_t offset, unsigned char *buffer, struct mdvol_sb *sb)
+{
+  const struct mdp_superblock_1 *sb1=(const struct mdp_superblock_1 *)buffer;
+  unsigned int dev_number;
+  unsigned int max_dev;
+  if(disk->pread(disk, buffer, MD_SB_BYTES, offset) != MD_SB_BYTES)
+    return -1;
+  if(le32(sb1->md_magic)!=(unsigned int)MD_SB_MAGIC || le32(sb1->major_version)!=1 ||
+      le64(sb1->super_offset)*512!=offset)
+    return -1;
+  memcpy(sb->uuid, sb1->set_uuid, sizeof(sb->uuid));
+  sb->version=1;
+  sb->level=(int32_t)le32(sb1->level);
+  sb->layout=le32(sb1->layout);
+  sb->chunk_size=le32(sb1->chunksize)*512;
+  sb->raid_disks=le32(sb1->raid_disks);
+  sb->data_offset=le64(sb1->data_offset)*512;
+  sb->size=(le64(sb1->size)!=0 ? le64(sb1->size) : le64(sb1->data_size))*512;
+  sb->events=le64(sb1->events);
+  dev_number=le32(sb1->dev_number);
+  max_dev=le32(sb1->max_dev);
+  sb->role=-1;
+  if(dev_number < max_dev && sizeof(*sb1) + 2 * max_dev <= MD_SB_BYTES)
+  {
+    const uint16_t *dev_roles=(const uint16_t *)&buffer[sizeof(*sb1)];
+    const unsigned int role=le16(dev_roles[dev_number]);
+    if(role < 0xfffe)
+      sb->role=role;
+  }
+  return 0;
+}
+
+/* Return 0 if a 0.90 superblock has been found at the end of the disk */
+static int mdvol_sb0(disk_t *disk, unsigned char *buffer, struct mdvol_sb *sb)
+{
+  const struct mdp_superblock_s *sb0=(const struct mdp_superblock_s *)buffer;
+  const uint64_t offset=(uint64_t)MD_NEW_SIZE_SECTORS(disk->disk_real_size/512)*512;
+  if(disk->pread(disk, buffer, MD_SB_BYTES, offset) != MD_SB_BYTES)
+    return -1;
+  if(le32(sb0->md_magic)!=(unsigned int)MD_SB_MAGIC || le32(sb0->major_version)!=0)
+    return -1;
+  memcpy(&sb->uuid[0], &sb0->set_uuid0, 4);
+  memcpy(&sb->uuid[4], &sb0->set_uuid1, 4);
+  memcpy(&sb->uuid[8], &sb0->set_uuid2, 4);
+  memcpy(&sb->uuid[12], &sb0->set_uuid3, 4);
+  sb->version=0;
+  sb->level=(int32_t)le32(sb0->level);
+  sb->layout=le32(sb0->layout);
+  sb->chunk_size=le32(sb0->chunk_size);
+  sb->raid_disks=le32(sb0->raid_disks);
+  sb->data_offset=0;
+  sb->size=(le32(sb0->size)!=0 ? (uint64_t)le32(sb0->size)*1024 : offset);
+  sb->events=((uint64_t)le32(sb0->events_hi)<<32) | le32(sb0->events_lo);
+  sb->role=le32(sb0->this_disk.raid_disk);
+  if((le32(sb0->this_disk.state) & (1<<MD_DISK_FAULTY))!=0 || (unsigned int)sb->role >= sb->raid_disks)
+    sb->role=-1;
+  return 0;
+}
+
+static int mdvol_read_sb(disk_t *disk, struct mdvol_sb *sb)
+{
+  unsigned char *buffer;
+  int res=-1;
+  if(disk->disk_real_size < 2*MD_RESERVED_BYTES)
+    return -1;
+  buffer=(unsigned char *)MALLOC(MD_SB_BYTES);
+  /* 1.2, 1.1, 1.0 and 0.90 superblocks */
+  if(mdvol_sb1(disk, 8*512, buffer, sb)==0 ||
+      mdvol_sb1(disk, 0, buffer, sb)==0 ||
+      mdvol_sb1(disk, (((disk->disk_real_size>>9) - 8*2) & ~(uint64_t)(4*2-1))*512, buffer, sb)==0 ||
+      mdvol_sb0(disk, buffer, sb)==0)
+    res=0;
+  free(buffer);
+  return res;
+}
+
+static void mdvol_add_io(struct info_mdvol_struct *data, const unsigned int m, const uint64_t offset, unsigned char *buffer, const size_t scratch, const unsigned int size)
+{
+  struct mdvol_member *member=&data->member[m];
+  struct mdvol_io *io;
+  if(member->io_nbr==member->io_size)
+  {
+    member->io_size=(member->io_size==0 ? 64 : 2 * member->io_size);
+    member->io=(struct mdvol_io *)realloc(member->io, member->io_size * sizeof(struct mdvol_io));
+    if(member->io==NULL)
+    {
+      log_critical("mdvol: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  io=&member->io[member->io_nbr++];
+  io->offset=member->data_offset + offset;
+  io->buffer=buffer;
+  io->scratch=scratch;
+  io->size=size;
+}
+
+/* Read a chunk of a missing member: read the other chunks of the stripe
+ * but Q, the xor is done by mdvol_rebuild() */
+static int mdvol_add_rebuild(struct info_mdvol_struct *data, const unsigned int m, const unsigned int qd, const uint64_t offset, unsigned char *buffer, const unsigned int size)
+{
+  struct mdvol_rebuild *rebuild;
+  unsigned int j;
+  if(data->rebuild_nbr==data->rebuild_size)
+  {
+    data->rebuild_size=(data->rebuild_size==0 ? 64 : 2 * data->rebuild_size);
+    data->rebuild=(struct mdvol_rebuild *)realloc(data->rebuild, data->rebuild_size * sizeof(struct mdvol_rebuild));
+    if(data->rebuild==NULL)
+    {
+      log_critical("mdvol: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  rebuild=&data->rebuild[data->rebuild_nbr];
+  rebuild->buffer=buffer;
+  rebuild->scratch=data->scratch_used;
+  rebuild->nbr=0;
+  rebuild->size=size;
+  for(j=0; j<data->raid_disks; j++)
+  {
+    if(j==m || j==qd)
+      continue;
+    if(data->member[j].disk==NULL)
+      return -1;
+    mdvol_add_io(data, j, offset, NULL, data->scratch_used, size);
+    data->scratch_used+=size;
+    rebuild->nbr++;
+  }
+  data->rebuild_nbr++;
+  return 0;
+}
+
+/* Member disk and stripe of the data chunk dd of a RAID4/5/6 stripe */
+static unsigned int mdvol_parity_map(const int level, const unsigned int layout, const unsigned int n, const uint64_t stripe, const unsigned int dd, unsigned int *qd)
+{
+  const unsigned int r=stripe % n;
+  unsigned int pd;
+  if(level==4)
+  {
+    *qd=n;
+    return dd;
+  }
+  if(level==5)
+  {
+    *qd=n;
+    switch(layout)
+    {
+      case MDVOL_LEFT_ASYMMETRIC:
+	pd=n - 1 - r;
+	return (dd >= pd ? dd + 1 : dd);
+      case MDVOL_RIGHT_ASYMMETRIC:
+	pd=r;
+	return (dd >= pd ? dd + 1 : dd);
+      case MDVOL_LEFT_SYMMETRIC:
+	pd=n - 1 - r;
+	return (pd + 1 + dd) % n;
+      case MDVOL_RIGHT_SYMMETRIC:
+	pd=r;
+	return (pd + 1 + dd) % n;
+      case MDVOL_PARITY_0:
+	return dd + 1;
+      default:
+	return dd;
+    }
+  }
+  /* RAID6 */
+  switch(layout)
+  {
+    case MDVOL_LEFT_ASYMMETRIC:
+    case MDVOL_RIGHT_ASYMMETRIC:
+      pd=(layout==MDVOL_LEFT_ASYMMETRIC ? n - 1 - r : r);
+      if(pd==n-1)
+      {
+	*qd=0;
+	return dd + 1;
+      }
+      *qd=pd + 1;
+      return (dd >= pd ? dd + 2 : dd);
+    case MDVOL_LEFT_SYMMETRIC:
+    case MDVOL_RIGHT_SYMMETRIC:
+      pd=(layout==MDVOL_LEFT_SYMMETRIC ? n - 1 - r : r);
+      *qd=(pd + 1) % n;
+      return (pd + 2 + dd) % n;
+    case MDVOL_PARITY_0:
+      *qd=1;
+      return dd + 2;
+    default:
+      *qd=n - 1;
+      return dd;
+  }
+}
+
+/* Split a read in member reads, return -1 if some data can't be read */
+static int mdvol_plan(struct info_mdvol_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const unsigned int n=data->raid_disks;
+  unsigned int done=0;
+  while(done < count)
+  {
+    const uint64_t pos=offset + done;
+    unsigned int size=count - done;
+    unsigned int m;
+    if(data->level==-1)
+    {
+      for(m=0; m<n-1 && pos >= data->member[m].start + data->member[m].size; m++);
+      if(size > data->member[m].start + data->member[m].size - pos)
+	size=data->member[m].start + data->member[m].size - pos;
+      if(data->member[m].disk==NULL)
+	return -1;
+      mdvol_add_io(data, m, pos - data->member[m].start, buffer + done, MDVOL_NO_SCRATCH, size);
+    }
+    else if(data->level==1)
+    {
+      const uint64_t piece=pos / MDVOL_RAID1_PIECE;
+      const unsigned int in_piece=pos % MDVOL_RAID1_PIECE;
+      unsigned int k;
+      if(size > MDVOL_RAID1_PIECE - in_piece)
+	size=MDVOL_RAID1_PIECE - in_piece;
+      /* Use the mirrors in turn */
+      m=piece % n;
+      for(k=0; k<n && data->member[m].disk==NULL; k++)
+	m=(m + 1) % n;
+      mdvol_add_io(data, m, pos, buffer + done, MDVOL_NO_SCRATCH, size);
+    }
+    else
+    {
+      const uint64_t chunk=pos / data->chunk_size;
+      const unsigned int in_chunk=pos % data->chunk_size;
+      uint64_t row;
+      if(size > data->chunk_size - in_chunk)
+	size=data->chunk_size - in_chunk;
+      if(data->level==0)
+      {
+	m=chunk % n;
+	row=chunk / n;
+      }
+      else if(data->level==10)
+      {
+	const unsigned int nc=data->near_copies;
+	unsigned int k;
+	uint64_t slot=chunk * nc;
+	for(k=0; k<nc; k++)
+	{
+	  slot=chunk * nc + (chunk + k) % nc;
+	  if(data->member[slot % n].disk!=NULL)
+	    break;
+	}
+	if(k==nc)
+	  return -1;
+	m=slot % n;
+	row=slot / n;
+      }
+      else
+      {
+	const unsigned int data_disks=n - (data->level==6 ? 2 : 1);
+	unsigned int qd;
+	row=chunk / data_disks;
+	m=mdvol_parity_map(data->level, data->layout, n, row, chunk % data_disks, &qd);
+	if(data->member[m].disk==NULL)
+	{
+	  if(mdvol_add_rebuild(data, m, qd, row * data->chunk_size + in_chunk, buffer + done, size) < 0)
+	    return -1;
+	  done+=size;
+	  continue;
+	}
+      }
+      if(data->member[m].disk==NULL)
+	return -1;
+      mdvol_add_io(data, m, row * data->chunk_size + in_chunk, buffer + done, MDVOL_NO_SCRATCH, size);
+    }
+    done+=size;
+  }
+  return 0;
+}
+
+static void mdvol_member_io(struct mdvol_member *member)
+{
+  const struct info_mdvol_struct *data=member->data;
+  unsigned int i;
+  for(i=0; i<member->io_nbr; i++)
+  {
+    const struct mdvol_io *io=&member->io[i];
+    unsigned char *buffer=(io->scratch==MDVOL_NO_SCRATCH ? io->buffer : data->scratch + io->scratch);
+    const int res=member->disk->pread(member->disk, buffer, io->size, io->offset);
+    if(res != (int)io->size)
+    {
+      log_error("%s: read error on %s at %llu\n", data->name, member->disk->device,
+	  (long long unsigned)io->offset);
+      member->error=1;
+    }
+  }
+}
+
+#ifdef HAVE_PTHREAD
+static void *mdvol_thread(void *arg)
+{
+  struct mdvol_member *member=(struct mdvol_member *)arg;
+  struct info_mdvol_struct *data=member->data;
+  pthread_mutex_lock(&data->mutex);
+  while(1)
+  {
+    while(data->quit==0 && member->generation==data->generation)
+      pthread_cond_wait(&data->cond_start, &data->mutex);
+    if(data->quit!=0)
+      break;
+    member->generation=data->generation;
+    pthread_mutex_unlock(&data->mutex);
+    mdvol_member_io(member);
+    pthread_mutex_lock(&data->mutex);
+    if(--data->pending==0)
+      pthread_cond_signal(&data->cond_done);
+  }
+  pthread_mutex_unlock(&data->mutex);
+  return NULL;
+}
+#endif
+
+/* Run the member reads, in parallel when the threads are available */
+static void mdvol_run(struct info_mdvol_struct *data)
+{
+  unsigned int m;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+  data->pending=data->nbr_threads;
+  data->generation++;
+  pthread_cond_broadcast(&data->cond_start);
+  pthread_mutex_unlock(&data->mutex);
+  for(m=0; m<data->raid_disks; m++)
+    if(data->member[m].disk!=NULL && data->member[m].thread_ok==0)
+      mdvol_member_io(&data->member[m]);
+  pthread_mutex_lock(&data->mutex);
+  while(data->pending > 0)
+    pthread_cond_wait(&data->cond_done, &data->mutex);
+  pthread_mutex_unlock(&data->mutex);
+#else
+  for(m=0; m<data->raid_disks; m++)
+    if(data->member[m].disk!=NULL)
+      mdvol_member_io(&data->member[m]);
+#endif
+}
+
+static int fmdvol_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_mdvol_struct *data=(struct info_mdvol_struct *)disk->data;
+  unsigned int size=count;
+  unsigned int m;
+  unsigned int i;
+  int res;
+  if(offset >= data->size)
+    return 0;
+  if(size > data->size - offset)
+    size=data->size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->pread_mutex);
+#endif
+  for(m=0; m<data->raid_disks; m++)
+  {
+    data->member[m].io_nbr=0;
+    data->member[m].error=0;
+  }
+  data->rebuild_nbr=0;
+  data->scratch_used=0;
+  res=mdvol_plan(data, (unsigned char *)buffer, size, offset);
+  if(res==0)
+  {
+    if(data->scratch_used > data->scratch_size)
+    {
+      free(data->scratch);
+      data->scratch_size=data->scratch_used;
+      data->scratch=(unsigned char *)MALLOC(data->scratch_size);
+    }
+    mdvol_run(data);
+    for(m=0; m<data->raid_disks; m++)
+      if(data->member[m].error!=0)
+	res=-1;
+    for(i=0; i<data->rebuild_nbr; i++)
+    {
+      const struct mdvol_rebuild *rebuild=&data->rebuild[i];
+      unsigned int k;
+      memcpy(rebuild->buffer, data->scratch + rebuild->scratch, rebuild->size);
+      for(k=1; k<rebuild->nbr; k++)
+	mdvol_xor(rebuild->buffer, data->scratch + rebuild->scratch + (size_t)k * rebuild->size, rebuild->size);
+    }
+  }
+  else
+  {
+    log_error("fmdvol_pread(xxx,%u,buffer,%lu(%u/%u/%u)) too many members are missing\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->pread_mutex);
+#endif
+  if(res < 0)
+    return -1;
+  return size;
+}
+
+static int fmdvol_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fmdvol_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fmdvol_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fmdvol_description(disk_t *disk)
+{
+  const struct info_mdvol_struct *data=(const struct info_mdvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"%s %s - %s - CHS %lu %u %u (RO)",
+      mdvol_level_name(data->level), data->name, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *fmdvol_description_short(disk_t *disk)
+{
+  const struct info_mdvol_struct *data=(const struct info_mdvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"%s %s - %s (RO)",
+      mdvol_level_name(data->level), data->name, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void mdvol_free(struct info_mdvol_struct *data)
+{
+  unsigned int m;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+  data->quit=1;
+  pthread_cond_broadcast(&data->cond_start);
+  pthread_mutex_unlock(&data->mutex);
+  for(m=0; m<MDVOL_MAX_DISKS; m++)
+    if(data->member[m].thread_ok!=0)
+      pthread_join(data->member[m].thread, NULL);
+  pthread_cond_destroy(&data->cond_done);
+  pthread_cond_destroy(&data->cond_start);
+  pthread_mutex_destroy(&data->mutex);
+  pthread_mutex_destroy(&data->pread_mutex);
+#endif
+  for(m=0; m<MDVOL_MAX_DISKS; m++)
+  {
+    disk_t *member=data->member[m].disk;
+    if(member!=NULL)
+      member->clean(member);
+    free(data->member[m].io);
+  }
+  free(data->rebuild);
+  free(data->scratch);
+  free(data->name);
+  free(data);
+}
+
+static void fmdvol_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    mdvol_free((struct info_mdvol_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+/* Check the superblock of the freshest member, set the geometry of the
+ * volume. Return -1 if the volume can't be assembled */
+static int mdvol_setup(struct info_mdvol_struct *data, const struct mdvol_sb *sb)
+{
+  const unsigned int n=sb->raid_disks;
+  uint64_t member_size=0;
+  unsigned int m;
+  data->level=sb->level;
+  data->layout=sb->layout;
+  data->raid_disks=n;
+  data->chunk_size=sb->chunk_size;
+  data->near_copies=1;
+  if(n==0 || n > MDVOL_MAX_DISKS)
+  {
+    log_error("%s: %u members are not supported\n", data->name, n);
+    return -1;
+  }
+  switch(data->level)
+  {
+    case -1:
+    case 1:
+      break;
+    case 0:
+    case 4:
+    case 5:
+    case 6:
+    case 10:
+      if(data->chunk_size==0 || data->chunk_size%512!=0)
+      {
+	log_error("%s: invalid chunk size %u\n", data->name, data->chunk_size);
+	return -1;
+      }
+      break;
+    default:
+      log_error("%s: RAID level %d is not supported\n", data->name, data->level);
+      return -1;
+  }
+  if((data->level==5 || data->level==6) && data->layout > MDVOL_PARITY_N)
+  {
+    log_error("%s: RAID%d layout %u is not supported\n", data->name, data->level, data->layout);
+    return -1;
+  }
+  if(data->level==10)
+  {
+    /* near copies only, the far and offset layouts are not handled */
+    data->near_copies=data->layout & 0xff;
+    if(data->near_copies==0 || data->near_copies > n || ((data->layout>>8) & 0xff)!=1 ||
+	(data->layout & 0x10000)!=0)
+    {
+      log_error("%s: RAID10 layout 0x%x is not supported\n", data->name, data->layout);
+      return -1;
+    }
+  }
+  if((data->level==-1 || data->level==0) && data->missing > 0)
+  {
+    log_error("%s: %u members are missing\n", data->name, data->missing);
+    return -1;
+  }
+  if((data->level==1 && data->missing >= n) ||
+      ((data->level==4 || data->level==5 || data->level==6) && data->missing > 1))
+  {
+    log_error("%s: %u members are missing, can't rebuild the data\n", data->name, data->missing);
+    return -1;
+  }
+  for(m=0; m<n; m++)
+  {
+    const struct mdvol_member *member=&data->member[m];
+    if(member->disk!=NULL && (member_size==0 || member->size < member_size))
+      member_size=member->size;
+  }
+  if(data->level==-1)
+  {
+    uint64_t start=0;
+    for(m=0; m<n; m++)
+    {
+      data->member[m].start=start;
+      start+=data->member[m].size;
+    }
+    data->size=start;
+    return 0;
+  }
+  if(data->level==0)
+  {
+    for(m=0; m<n; m++)
+      if(data->member[m].size!=member_size)
+	log_warning("%s: members of different sizes, only the first zone is available\n", data->name);
+  }
+  if(data->chunk_size > 0)
+    member_size=member_size / data->chunk_size * data->chunk_size;
+  switch(data->level)
+  {
+    case 0:
+      data->size=member_size * n;
+      break;
+    case 1:
+      data->size=member_size;
+      break;
+    case 4:
+    case 5:
+      data->size=member_size * (n - 1);
+      break;
+    case 6:
+      data->size=member_size * (n - 2);
+      break;
+    default:
+      data->size=member_size / data->chunk_size * n / data->near_copies * data->chunk_size;
+      break;
+  }
+  return 0;
+}
+
+/* Open the members listed after the prefix, keep the freshest ones */
+static int mdvol_open_members(struct info_mdvol_struct *data, const char *list, const int verbose, const int testdisk_mode, struct mdvol_sb *ref)
+{
+  disk_t *disks[MDVOL_MAX_DISKS];
+  struct mdvol_sb sbs[MDVOL_MAX_DISKS];
+  unsigned int nbr=0;
+  unsigned int i;
+  const char *name=list;
+  int found=0;
+  while(*name!='\0')
+  {
+    const char *end=strchr(name, ',');
+    const size_t len=(end!=NULL ? (size_t)(end - name) : strlen(name));
+    if(len > 0)
+    {
+      char *member_name;
+      disk_t *disk;
+      if(nbr==MDVOL_MAX_DISKS)
+      {
+	log_error("%s: too many members\n", data->name);
+	break;
+      }
+      member_name=(char *)MALLOC(len + 1);
+      memcpy(member_name, name, len);
+      member_name[len]='\0';
+      disk=file_test_availability(member_name, verbose, testdisk_mode & ~(TESTDISK_O_RDWR|TESTDISK_O_DIRECT));
+      if(disk==NULL)
+	log_error("%s: can't open %s\n", data->name, member_name);
+      else if(mdvol_read_sb(disk, &sbs[nbr]) < 0)
+      {
+	log_error("%s: no MD superblock on %s\n", data->name, member_name);
+	disk->clean(disk);
+      }
+      else
+      {
+	if(found==0 || sbs[nbr].events > ref->events)
+	  *ref=sbs[nbr];
+	found=1;
+	disks[nbr++]=disk;
+      }
+      free(member_name);
+    }
+    if(end==NULL)
+      break;
+    name=end + 1;
+  }
+  if(found==0)
+    return -1;
+  for(i=0; i<nbr; i++)
+  {
+    const struct mdvol_sb *sb=&sbs[i];
+    disk_t *disk=disks[i];
+    if(memcmp(sb->uuid, ref->uuid, sizeof(sb->uuid))!=0)
+      log_warning("%s: %s belongs to another array, ignored\n", data->name, disk->device);
+    else if(sb->events < ref->events)
+      log_warning("%s: %s is not up to date (events %llu < %llu), ignored\n", data->name, disk->device,
+	  (long long unsigned)sb->events, (long long unsigned)ref->events);
+    else if(sb->role < 0 || (unsigned int)sb->role >= ref->raid_disks || sb->role >= MDVOL_MAX_DISKS)
+      log_info("%s: %s is a spare or a faulty member, ignored\n", data->name, disk->device);
+    else if(data->member[sb->role].disk!=NULL)
+      log_warning("%s: %s has the same role as %s, ignored\n", data->name, disk->device,
+	  data->member[sb->role].disk->device);
+    else
+    {
+      struct mdvol_member *member=&data->member[sb->role];
+      member->disk=disk;
+      member->data_offset=sb->data_offset;
+      member->size=sb->size;
+      if(member->size > disk->disk_real_size - sb->data_offset)
+	member->size=disk->disk_real_size - sb->data_offset;
+      log_info("%s: %s is member %d, md %u superblock, data offset %llu\n", data->name, disk->device,
+	  sb->role, sb->version, (long long unsigned)sb->data_offset);
+      disk=NULL;
+    }
+    if(disk!=NULL)
+      disk->clean(disk);
+  }
+  return 0;
+}
+
+/* Parameters given before the members, for members without superblock */
+struct mdvol_options
+{
+  int manual;
+  int detect;
+  int level_set;
+  int level;
+  unsigned int chunk_size;
+  int layout_set;
+  unsigned int layout;
+  uint64_t data_offset;
+};
+
+static const char *mdvol_layout_names[MDVOL_PARITY_N + 1]=
+{
+  "left-asymmetric", "right-asymmetric", "left-symmetric", "right-symmetric",
+  "parity-first", "parity-last"
+};
+
+static uint64_t mdvol_parse_size(const char *p, const char **end)
+{
+  char *e;
+  uint64_t value=strtoull(p, &e, 0);
+  if(*e=='k' || *e=='K')
+  {
+    value*=1024;
+    e++;
+  }
+  else if(*e=='m' || *e=='M')
+  {
+    value*=1024*1024;
+    e++;
+  }
+  *end=(e==p ? NULL : e);
+  return value;
+}
+
+/* level=, chunk=, layout=, offset= and detect before the members, return
+ * the start of the members or NULL if a parameter is invalid */
+static const char *mdvol_parse_options(const char *name, const char *list, struct mdvol_options *opt)
+{
+  const char *p=list;
+  memset(opt, 0, sizeof(*opt));
+  while(1)
+  {
+    const char *end=NULL;
+    if(strncmp(p, "detect", 6)==0 && (p[6]==',' || p[6]=='\0'))
+    {
+      opt->detect=1;
+      end=p + 6;
+    }
+    else if(strncmp(p, "level=", 6)==0)
+    {
+      char *e;
+      opt->level_set=1;
+      if(strncmp(p + 6, "linear", 6)==0)
+      {
+	opt->level=-1;
+	end=p + 12;
+      }
+      else
+      {
+	opt->level=strtol(p + 6, &e, 10);
+	end=(e==p + 6 ? NULL : e);
+      }
+    }
+    else if(strncmp(p, "chunk=", 6)==0)
+      opt->chunk_size=mdvol_parse_size(p + 6, &end);
+    else if(strncmp(p, "layout=", 7)==0)
+    {
+      unsigned int i;
+      opt->layout_set=1;
+      for(i=0; i<=MDVOL_PARITY_N && end==NULL; i++)
+      {
+	const size_t len=strlen(mdvol_layout_names[i]);
+	if(strncmp(p + 7, mdvol_layout_names[i], len)==0)
+	{
+	  opt->layout=i;
+	  end=p + 7 + len;
+	}
+      }
+      if(end==NULL)
+	opt->layout=mdvol_parse_size(p + 7, &end);
+    }
+    else if(strncmp(p, "offset=", 7)==0)
+      opt->data_offset=mdvol_parse_size(p + 7, &end);
+    else
+      return p;
+    if(end==NULL || (*end!=',' && *end!='\0'))
+    {
+      log_error("%s: invalid parameter %s\n", name, p);
+      return NULL;
+    }
+    opt->manual=1;
+    p=(*end==',' ? end + 1 : end);
+  }
+}
+
+/* Open the members in the order of their roles, "missing" for a member
+ * that isn't there. Return the number of members */
+static int mdvol_open_list(struct info_mdvol_struct *data, const char *list, const int verbose, const int testdisk_mode, const uint64_t data_offset)
+{
+  unsigned int nbr=0;
+  const char *name=list;
+  while(*name!='\0')
+  {
+    const char *end=strchr(name, ',');
+    const size_t len=(end!=NULL ? (size_t)(end - name) : strlen(name));
+    if(len > 0)
+    {
+      struct mdvol_member *member;
+      char *member_name;
+      if(nbr==MDVOL_MAX_DISKS)
+      {
+	log_error("%s: too many members\n", data->name);
+	return -1;
+      }
+      member=&data->member[nbr++];
+      member_name=(char *)MALLOC(len + 1);
+      memcpy(member_name, name, len);
+      member_name[len]='\0';
+      if(strcmp(member_name, "missing")!=0)
+      {
+	member->disk=file_test_availability(member_name, verbose, testdisk_mode & ~(TESTDISK_O_RDWR|TESTDISK_O_DIRECT));
+	if(member->disk==NULL)
+	  log_error("%s: can't open %s\n", data->name, member_name);
+	else if(data_offset >= member->disk->disk_real_size)
+	{
+	  log_error("%s: %s is smaller than the data offset\n", data->name, member_name);
+	  member->disk->clean(member->disk);
+	  member->disk=NULL;
+	}
+	else
+	{
+	  member->data_offset=data_offset;
+	  member->size=member->disk->disk_real_size - data_offset;
+	}
+      }
+      free(member_name);
+    }
+    if(end==NULL)
+      break;
+    name=end + 1;
+  }
+  return nbr;
+}
+
+/* Geometry of members without superblock: windows at the same offset
+ * of every member are sampled. The sectors of a mirror are the same on
+ * every member, the xor of the sectors of a RAID4/5 stripe is null, for
+ * RAID6 it's equal to the Q sector. Data changes more often at the start
+ * of a chunk than elsewhere, this gives the chunk size; the order of the
+ * members and the parity rotation are the ones for which the end of each
+ * chunk looks the most like the start of the next one. */
+#define MDVOL_DETECT_WINDOWS	16
+#define MDVOL_DETECT_WINDOW	(2*1024*1024)
+#define MDVOL_DETECT_MIN_CHUNK	4096
+#define MDVOL_DETECT_MAX_CHUNK	(512*1024)
+/* Every order is tried up to this number of members */
+#define MDVOL_DETECT_MAX_ORDER	8
+#define MDVOL_DETECT_STEPS	32
+
+/* Summary of a sector: null bytes, text bytes and distinct values */
+struct mdvol_feature
+{
+  uint8_t zero;
+  uint8_t text;
+  uint8_t distinct;
+};
+
+struct mdvol_detect
+{
+  unsigned int windows;
+  unsigned int sectors;		/* sectors per window */
+  uint64_t start[MDVOL_DETECT_WINDOWS];
+  struct mdvol_feature *feature;	/* by member, window and sector */
+  uint64_t nonzero;
+  uint64_t mirror;
+  uint64_t parity;
+  uint64_t parity_q;
+  int boot;			/* member starting with a boot sector, -1 if none */
+  /* distance between consecutive sectors, by number of trailing zero
+   * bits of the sector index */
+  uint64_t step_sum[MDVOL_DETECT_STEPS];
+  uint64_t step_nbr[MDVOL_DETECT_STEPS];
+};
+
+struct mdvol_detect_io
+{
+  disk_t *disk;
+  uint64_t offset;
+  unsigned char *buffer;
+  unsigned int size;
+};
+
+struct mdvol_candidate
+{
+  int level;
+  unsigned int layout;
+};
+
+static void *mdvol_detect_io_run(void *arg)
+{
+  struct mdvol_detect_io *io=(struct mdvol_detect_io *)arg;
+  if(io->disk->pread(io->disk, io->buffer, io->size, io->offset) != (int)io->size)
+    memset(io->buffer, 0, io->size);
+  return NULL;
+}
+
+/* Read the same window of every member, in parallel */
+static void mdvol_detect_read(const struct info_mdvol_struct *data, unsigned char **buffers, const uint64_t offset, const unsigned int size)
+{
+  struct mdvol_detect_io io[MDVOL_MAX_DISKS];
+#ifdef HAVE_PTHREAD
+  pthread_t threads[MDVOL_MAX_DISKS];
+  int started[MDVOL_MAX_DISKS];
+#endif
+  unsigned int m;
+  for(m=0; m<data->raid_disks; m++)
+  {
+    io[m].disk=data->member[m].disk;
+    io[m].offset=data->member[m].data_offset + offset;
+    io[m].buffer=buffers[m];
+    io[m].size=size;
+#ifdef HAVE_PTHREAD
+    started[m]=(pthread_create(&threads[m], NULL, &mdvol_detect_io_run, &io[m])==0);
+    if(started[m]==0)
+#endif
+      mdvol_detect_io_run(&io[m]);
+  }
+#ifdef HAVE_PTHREAD
+  for(m=0; m<data->raid_disks; m++)
+    if(started[m]!=0)
+      pthread_join(threads[m], NULL);
+#endif
+}
+
+/* Return the number of null bytes */
+static unsigned int mdvol_feature(const unsigned char *sector, struct mdvol_feature *feature)
+{
+  uint64_t seen[4]={0, 0, 0, 0};
+  unsigned int zero=0;
+  unsigned int text=0;
+  unsigned int distinct=0;
+  unsigned int i;
+  for(i=0; i<512; i++)
+  {
+    const unsigned int c=sector[i];
+    if(c==0)
+      zero++;
+    else if((c >= 0x20 && c < 0x7f) || c=='\n' || c=='\r' || c=='\t')
+      text++;
+    if((seen[c>>6] & ((uint64_t)1 << (c&63)))==0)
+    {
+      seen[c>>6]|=(uint64_t)1 << (c&63);
+      distinct++;
+    }
+  }
+  feature->zero=(zero > 510 ? 255 : zero / 2);
+  feature->text=(text > 510 ? 255 : text / 2);
+  feature->distinct=distinct - 1;
+  return zero;
+}
+
+static unsigned int mdvol_feature_dist(const struct mdvol_feature *a, const struct mdvol_feature *b)
+{
+  return (a->zero > b->zero ? a->zero - b->zero : b->zero - a->zero) +
+    (a->text > b->text ? a->text - b->text : b->text - a->text) +
+    (a->distinct > b->distinct ? a->distinct - b->distinct : b->distinct - a->distinct);
+}
+
+static const struct mdvol_feature *mdvol_detect_feature(const struct mdvol_detect *det, const unsigned int m, const unsigned int w, const unsigned int s)
+{
+  return &det->feature[((size_t)m * det->windows + w) * det->sectors + s];
+}
+
+/* Compare the sectors of the members at the same offset */
+static void mdvol_detect_stripe(struct mdvol_detect *det, const unsigned int n, unsigned char **buffers, const size_t offset, unsigned char *x, const unsigned int w, const unsigned int s)
+{
+  unsigned int nonzero=0;
+  unsigned int uniform=0;
+  int same=1;
+  unsigned int m;
+  memset(x, 0, 512);
+  for(m=0; m<n; m++)
+  {
+    struct mdvol_feature *feature=&det->feature[((size_t)m * det->windows + w) * det->sectors + s];
+    if(mdvol_feature(buffers[m] + offset, feature) < 512)
+      nonzero++;
+    if(feature->distinct==0)
+      uniform++;
+    if(m > 0 && same!=0 && memcmp(buffers[m] + offset, buffers[0] + offset, 512)!=0)
+      same=0;
+    mdvol_xor(x, buffers[m] + offset, 512);
+  }
+  /* Sectors filled with a single value match any layout */
+  if(nonzero==0 || uniform==n)
+    return;
+  det->nonzero++;
+  if(same!=0)
+    det->mirror++;
+  for(m=0; m<512 && x[m]==0; m++);
+  if(m==512)
+    det->parity++;
+  else if(nonzero >= 3)
+  {
+    for(m=0; m<n; m++)
+    {
+      if(memcmp(buffers[m] + offset, x, 512)==0)
+      {
+	det->parity_q++;
+	break;
+      }
+    }
+  }
+}
+
+static int mdvol_detect_sample(const struct info_mdvol_struct *data, struct mdvol_detect *det, const uint64_t member_size)
+{
+  const unsigned int n=data->raid_disks;
+  unsigned char *buffers[MDVOL_MAX_DISKS];
+  unsigned char *x;
+  unsigned int window=MDVOL_DETECT_WINDOW;
+  unsigned int boot_nbr=0;
+  unsigned int m;
+  unsigned int w;
+  if(member_size < window)
+    window=member_size / MDVOL_DETECT_MIN_CHUNK * MDVOL_DETECT_MIN_CHUNK;
+  if(window < 4 * MDVOL_DETECT_MIN_CHUNK)
+    return -1;
+  det->windows=member_size / window;
+  if(det->windows > MDVOL_DETECT_WINDOWS)
+    det->windows=MDVOL_DETECT_WINDOWS;
+  det->sectors=window / 512;
+  det->boot=-1;
+  det->feature=(struct mdvol_feature *)MALLOC((size_t)n * det->windows * det->sectors * sizeof(struct mdvol_feature));
+  for(m=0; m<n; m++)
+    buffers[m]=(unsigned char *)MALLOC(window);
+  x=(unsigned char *)MALLOC(512);
+  for(w=0; w<det->windows; w++)
+  {
+    unsigned int s;
+    const uint64_t start=(det->windows > 1 ?
+	(member_size - window) / (det->windows - 1) * w / MDVOL_DETECT_MAX_CHUNK * MDVOL_DETECT_MAX_CHUNK : 0);
+    det->start[w]=start;
+    mdvol_detect_read(data, buffers, start, window);
+    if(start==0)
+    {
+      for(m=0; m<n; m++)
+      {
+	if(buffers[m][0x1fe]==0x55 && buffers[m][0x1ff]==0xaa)
+	{
+	  det->boot=m;
+	  boot_nbr++;
+	}
+      }
+    }
+    for(s=0; s<det->sectors; s++)
+      mdvol_detect_stripe(det, n, buffers, (size_t)s * 512, x, w, s);
+    for(m=0; m<n; m++)
+    {
+      for(s=1; s<det->sectors; s++)
+      {
+	unsigned int k;
+	for(k=0; k < MDVOL_DETECT_STEPS - 1 && ((s >> k) & 1)==0; k++);
+	det->step_sum[k]+=mdvol_feature_dist(mdvol_detect_feature(det, m, w, s - 1), mdvol_detect_feature(det, m, w, s));
+	det->step_nbr[k]++;
+      }
+    }
+  }
+  if(boot_nbr!=1)
+    det->boot=-1;
+  free(x);
+  for(m=0; m<n; m++)
+    free(buffers[m]);
+  return 0;
+}
+
+/* The smallest power of two whose boundaries stand out as much as the
+ * larger ones */
+static unsigned int mdvol_detect_chunk(const struct info_mdvol_struct *data, const struct mdvol_detect *det)
+{
+  double ratio[MDVOL_DETECT_STEPS];
+  double best=0.0;
+  uint64_t sum=0;
+  uint64_t nbr=0;
+  unsigned int kmin;
+  unsigned int kmax;
+  unsigned int k;
+  for(k=0; k<MDVOL_DETECT_STEPS; k++)
+  {
+    sum+=det->step_sum[k];
+    nbr+=det->step_nbr[k];
+  }
+  for(kmin=0; (512U << kmin) < MDVOL_DETECT_MIN_CHUNK; kmin++);
+  for(kmax=kmin; (512U << (kmax + 1)) <= MDVOL_DETECT_MAX_CHUNK && (2U << (kmax + 1)) <= det->sectors; kmax++);
+  if(sum==0)
+  {
+    log_warning("%s: no chunk boundary found, 64 KiB chunks assumed\n", data->name);
+    return 65536;
+  }
+  for(k=kmin; k<=kmax; k++)
+  {
+    uint64_t k_sum=0;
+    uint64_t k_nbr=0;
+    unsigned int j;
+    for(j=k; j<MDVOL_DETECT_STEPS; j++)
+    {
+      k_sum+=det->step_sum[j];
+      k_nbr+=det->step_nbr[j];
+    }
+    ratio[k]=(k_nbr > 0 ? ((double)k_sum / k_nbr) / ((double)sum / nbr) : 0.0);
+    if(ratio[k] > best)
+      best=ratio[k];
+  }
+  for(k=kmin; k<kmax && ratio[k] < 0.8 * best; k++);
+  if(best < 1.2)
+    log_warning("%s: no clear chunk boundary, chunk size %u is a guess\n", data->name, 512U << k);
+  log_info("%s: chunk size %u, boundary ratio %.2f\n", data->name, 512U << k, ratio[k]);
+  return 512U << k;
+}
+
+/* Mean distance between the end of each chunk and the start of the next
+ * one, order gives the member for each role, map the role of each data
+ * chunk for each row modulo n */
+static double mdvol_detect_cost(const struct mdvol_detect *det, const unsigned int n, const unsigned int data_disks, const unsigned int chunk_size, const unsigned int *order, const unsigned int *map)
+{
+  const unsigned int cs=chunk_size / 512;
+  uint64_t sum=0;
+  uint64_t nbr=0;
+  unsigned int w;
+  for(w=0; w<det->windows; w++)
+  {
+    const uint64_t start=det->start[w];
+    const uint64_t first_row=(start + chunk_size - 1) / chunk_size;
+    const uint64_t end_row=(start + (uint64_t)det->sectors * 512) / chunk_size;
+    uint64_t r;
+    for(r=first_row; r<end_row; r++)
+    {
+      const unsigned int s=(r * chunk_size - start) / 512;
+      unsigned int dd;
+      for(dd=0; dd<data_disks; dd++)
+      {
+	const unsigned int a=order[map[(r % n) * n + dd]];
+	unsigned int b;
+	unsigned int next;
+	if(dd + 1 < data_disks)
+	{
+	  b=order[map[(r % n) * n + dd + 1]];
+	  next=s;
+	}
+	else if(r + 1 < end_row)
+	{
+	  b=order[map[((r + 1) % n) * n]];
+	  next=s + cs;
+	}
+	else
+	  continue;
+	sum+=mdvol_feature_dist(mdvol_detect_feature(det, a, w, s + cs - 1), mdvol_detect_feature(det, b, w, next));
+	nbr++;
+      }
+    }
+  }
+  return (nbr > 0 ? (double)sum / nbr : 0.0);
+}
+
+static int mdvol_next_order(unsigned int *order, const unsigned int n)
+{
+  unsigned int i;
+  unsigned int j;
+  unsigned int tmp;
+  for(i=n - 1; i > 0 && order[i - 1] >= order[i]; i--);
+  if(i==0)
+    return 0;
+  for(j=n - 1; order[j] <= order[i - 1]; j--);
+  tmp=order[i - 1];
+  order[i - 1]=order[j];
+  order[j]=tmp;
+  for(j=n - 1; i < j; i++, j--)
+  {
+    tmp=order[i];
+    order[i]=order[j];
+    order[j]=tmp;
+  }
+  return 1;
+}
+
+/* Find the order of the members and the layout, order[role] is the
+ * member for this role */
+static void mdvol_detect_order(const struct info_mdvol_struct *data, const struct mdvol_detect *det, struct mdvol_sb *ref, const struct mdvol_options *opt, unsigned int *order)
+{
+  const unsigned int n=ref->raid_disks;
+  struct mdvol_candidate candidates[5];
+  unsigned int nbr_candidates=0;
+  unsigned int *map=(unsigned int *)MALLOC(n * n * sizeof(unsigned int));
+  unsigned int best_order[MDVOL_MAX_DISKS];
+  double best=-1.0;
+  double second=-1.0;
+  unsigned int c;
+  unsigned int m;
+  if(ref->level==0 || opt->layout_set!=0 || ref->level==4)
+  {
+    candidates[0].level=ref->level;
+    candidates[0].layout=ref->layout;
+    nbr_candidates=1;
+  }
+  else
+  {
+    for(c=MDVOL_LEFT_ASYMMETRIC; c<=MDVOL_RIGHT_SYMMETRIC; c++)
+    {
+      candidates[nbr_candidates].level=ref->level;
+      candidates[nbr_candidates++].layout=c;
+    }
+    if(ref->level==5 && opt->level_set==0)
+    {
+      candidates[nbr_candidates].level=4;
+      candidates[nbr_candidates++].layout=MDVOL_PARITY_N;
+    }
+  }
+  for(m=0; m<n; m++)
+    best_order[m]=m;
+  for(c=0; c<nbr_candidates; c++)
+  {
+    const int level=candidates[c].level;
+    const unsigned int data_disks=n - (level==6 ? 2 : (level==0 ? 0 : 1));
+    unsigned int r;
+    for(r=0; r<n; r++)
+    {
+      unsigned int dd;
+      for(dd=0; dd<data_disks; dd++)
+      {
+	unsigned int qd;
+	map[r * n + dd]=(level==0 ? dd : mdvol_parity_map(level, candidates[c].layout, n, r, dd, &qd));
+      }
+    }
+    for(m=0; m<n; m++)
+      order[m]=m;
+    do
+    {
+      double cost;
+      /* The boot sector is the start of the volume */
+      if(det->boot >= 0 && order[map[0]]!=(unsigned int)det->boot)
+	continue;
+      cost=mdvol_detect_cost(det, n, data_disks, ref->chunk_size, order, map);
+      if(best < 0.0 || cost < best)
+      {
+	second=best;
+	best=cost;
+	ref->level=level;
+	ref->layout=candidates[c].layout;
+	memcpy(best_order, order, n * sizeof(unsigned int));
+      }
+      else if(second < 0.0 || cost < second)
+	second=cost;
+    } while(n <= MDVOL_DETECT_MAX_ORDER && mdvol_next_order(order, n));
+  }
+  free(map);
+  memcpy(order, best_order, n * sizeof(unsigned int));
+  if(n > MDVOL_DETECT_MAX_ORDER)
+    log_warning("%s: more than %u members, the order of the members is kept\n", data->name,
+	MDVOL_DETECT_MAX_ORDER);
+  log_info("%s: %s layout %s, continuity %.2f, next best %.2f\n", data->name,
+      mdvol_level_name(ref->level), (ref->level==0 ? "-" : mdvol_layout_names[ref->layout]), best, second);
+}
+
+/* Set the level, the chunk size, the layout and the order of the members
+ * from their content */
+static int mdvol_detect(struct info_mdvol_struct *data, struct mdvol_sb *ref, const struct mdvol_options *opt)
+{
+  const unsigned int n=ref->raid_disks;
+  struct mdvol_detect det;
+  struct mdvol_member members[MDVOL_MAX_DISKS];
+  unsigned int order[MDVOL_MAX_DISKS];
+  uint64_t member_size=0;
+  unsigned int m;
+  if(n < 2)
+  {
+    log_error("%s: at least two members are needed to detect the layout\n", data->name);
+    return -1;
+  }
+  for(m=0; m<n; m++)
+  {
+    if(data->member[m].disk==NULL)
+    {
+      log_error("%s: every member is needed to detect the layout\n", data->name);
+      return -1;
+    }
+    if(member_size==0 || data->member[m].size < member_size)
+      member_size=data->member[m].size;
+  }
+  memset(&det, 0, sizeof(det));
+  if(mdvol_detect_sample(data, &det, member_size) < 0)
+  {
+    log_error("%s: the members are too small to detect the layout\n", data->name);
+    return -1;
+  }
+  if(det.nonzero==0)
+  {
+    log_error("%s: no data in the sampled areas\n", data->name);
+    free(det.feature);
+    return -1;
+  }
+  log_info("%s: %llu sampled sectors, %u%% mirrored, %u%% with a null xor, %u%% with a Q syndrome\n",
+      data->name, (long long unsigned)det.nonzero,
+      (unsigned int)(det.mirror * 100 / det.nonzero), (unsigned int)(det.parity * 100 / det.nonzero),
+      (unsigned int)(det.parity_q * 100 / det.nonzero));
+  if(opt->level_set==0)
+  {
+    if(det.mirror * 10 >= det.nonzero * 9)
+      ref->level=1;
+    else if(n >= 3 && det.parity * 10 >= det.nonzero * 8)
+      ref->level=5;
+    else if(n >= 4 && det.parity_q * 10 >= det.nonzero * 8)
+      ref->level=6;
+    else
+      ref->level=0;
+  }
+  if(ref->level==0 || ref->level==4 || ref->level==5 || ref->level==6 || ref->level==10)
+  {
+    if(ref->chunk_size==0)
+      ref->chunk_size=mdvol_detect_chunk(data, &det);
+    if(ref->level!=10 && ref->chunk_size%512==0 && (uint64_t)2 * ref->chunk_size <= (uint64_t)det.sectors * 512)
+      mdvol_detect_order(data, &det, ref, opt, order);
+    else
+    {
+      for(m=0; m<n; m++)
+	order[m]=m;
+    }
+    memcpy(members, data->member, n * sizeof(struct mdvol_member));
+    for(m=0; m<n; m++)
+      data->member[m]=members[order[m]];
+  }
+  free(det.feature);
+  return 0;
+}
+
+/* Log the detected parameters as the name of the device */
+static void mdvol_log_detected(const struct info_mdvol_struct *data, const struct mdvol_sb *ref, const uint64_t data_offset)
+{
+  size_t size=256;
+  size_t len;
+  char *name;
+  unsigned int m;
+  for(m=0; m<ref->raid_disks; m++)
+    size+=strlen(data->member[m].disk->device) + 1;
+  name=(char *)MALLOC(size);
+  len=snprintf(name, size, "%slevel=%d", MDVOL_PREFIX, ref->level);
+  if(ref->level!=-1 && ref->level!=1)
+    len+=snprintf(name + len, size - len, ",chunk=%u", ref->chunk_size);
+  if(ref->level==5 || ref->level==6)
+    len+=snprintf(name + len, size - len, ",layout=%s", mdvol_layout_names[ref->layout]);
+  if(data_offset > 0)
+    len+=snprintf(name + len, size - len, ",offset=%llu", (long long unsigned)data_offset);
+  for(m=0; m<ref->raid_disks; m++)
+    len+=snprintf(name + len, size - len, ",%s", data->member[m].disk->device);
+  log_info("%s: detected as %s\n", data->name, name);
+  free(name);
+}
+
+disk_t *fmdvol_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_mdvol_struct *data;
+  struct mdvol_sb ref;
+  struct mdvol_options opt;
+  const char *list;
+  disk_t *disk;
+  unsigned int m;
+  if(strncmp(device, MDVOL_PREFIX, strlen(MDVOL_PREFIX))!=0)
+    return NULL;
+  data=(struct info_mdvol_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->name=strdup(device);
+  if(data->name==NULL)
+  {
+    free(data);
+    return NULL;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->pread_mutex, NULL);
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond_start, NULL);
+  pthread_cond_init(&data->cond_done, NULL);
+#endif
+  memset(&ref, 0, sizeof(ref));
+  list=mdvol_parse_options(device, device + strlen(MDVOL_PREFIX), &opt);
+  if(list==NULL)
+  {
+    mdvol_free(data);
+    return NULL;
+  }
+  if(opt.manual==0)
+  {
+    if(mdvol_open_members(data, list, verbose, testdisk_mode, &ref) < 0)
+    {
+      mdvol_free(data);
+      return NULL;
+    }
+  }
+  else
+  {
+    /* No superblock, the members are given in the order of their roles */
+    const int nbr=mdvol_open_list(data, list, verbose, testdisk_mode, opt.data_offset);
+    if(nbr <= 0 || (opt.level_set==0 && opt.detect==0))
+    {
+      if(nbr > 0)
+	log_error("%s: level= or detect is needed for members without superblock\n", device);
+      mdvol_free(data);
+      return NULL;
+    }
+    ref.raid_disks=nbr;
+    data->raid_disks=nbr;
+    ref.level=opt.level;
+    ref.chunk_size=opt.chunk_size;
+    ref.layout=(opt.layout_set!=0 ? opt.layout : (opt.level==10 ? 0x102 : MDVOL_LEFT_SYMMETRIC));
+    if(opt.detect!=0)
+    {
+      if(mdvol_detect(data, &ref, &opt) < 0)
+      {
+	mdvol_free(data);
+	return NULL;
+      }
+      mdvol_log_detected(data, &ref, opt.data_offset);
+    }
+  }
+  for(m=0; m<ref.raid_disks && m<MDVOL_MAX_DISKS; m++)
+    if(data->member[m].disk==NULL)
+      data->missing++;
+  if(mdvol_setup(data, &ref) < 0 || data->size==0)
+  {
+    mdvol_free(data);
+    return NULL;
+  }
+  for(m=0; m<data->raid_disks; m++)
+  {
+    struct mdvol_member *member=&data->member[m];
+    member->data=data;
+    if(member->disk==NULL)
+      log_warning("%s: member %u is missing\n", data->name, m);
+#ifdef HAVE_PTHREAD
+    else if(pthread_create(&member->thread, NULL, &mdvol_thread, member)==0)
+    {
+      member->thread_ok=1;
+      data->nbr_threads++;
+    }
+#endif
+  }
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    mdvol_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&fmdvol_description;
+  disk->description_short=&fmdvol_description_short;
+  disk->pread=&fmdvol_pread;
+  disk->pwrite=&fmdvol_nopwrite;
+  disk->sync=&fmdvol_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fmdvol_clean;
+  disk->sector_size=DEFAULT_SECTOR_SIZE;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: assembled RAID volumes are opened read-only\n", device);
+  log_info("%s: %s, %u members (%u missing), chunk size %u, layout %u\n", device,
+      mdvol_level_name(data->level), data->raid_disks, data->missing, data->chunk_size, data->layout);
+  return disk;
+}
+#endif
@@ -0,0 +1,45 @@
+/*
+
+    File: mdvol.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _MDVOL_H
+#define _MDVOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of an assembled Linux software RAID:
+ * md:member1,member2,... the members are listed in any order */
+#define MDVOL_PREFIX "md:"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Assemble the MD RAID members listed in device, read-only.
+ * NULL if the members can't be assembled */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fmdvol_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
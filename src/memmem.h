@@ -48,6 +48,27 @@ static inline const void *td_memmem(const void *haystack, const unsigned int hay
   if (haystack_len < needle_len)
     return NULL;
 
+#ifndef DISABLED_FOR_FRAMAC
+  /* memchr() is vectorized by the C library: use it to find the first
+   * byte, then check the last one before comparing the whole needle. */
+  {
+    const char first = ((const char *) needle)[0];
+    const char last = ((const char *) needle)[needle_len - 1];
+    begin = (const char *) haystack;
+    while (begin <= last_possible)
+    {
+      begin = (const char *) memchr (begin, first, last_possible - begin + 1);
+      if (begin == NULL)
+        return NULL;
+      if (begin[needle_len - 1] == last &&
+          !memcmp ((const void *) &begin[1],
+                   (const void *) ((const char *) needle + 1),
+                   needle_len - 1))
+        return (const void *) begin;
+      begin++;
+    }
+  }
+#else
   /*@
     @ loop invariant \valid_read(begin);
     @ loop invariant \subset(begin, (char *)haystack+(0..haystack_len-needle_len+1));
@@ -65,6 +86,110 @@ static inline const void *td_memmem(const void *haystack, const unsigned int hay
       return (const void *) begin;
     }
   }
+#endif
+  return NULL;
+}
+
+/* Like td_memmem() but return the last occurrence of needle */
+/*@
+  @ requires needle_len > 0;
+  @ requires \valid_read((const char *)haystack+(0..haystack_len-1));
+  @ requires \valid_read((const char *)needle+(0..needle_len-1));
+  @ assigns  \nothing;
+  @ ensures result_null_or_in_haystack:
+  @   \result == \null
+  @   || (\subset((char *)\result, (char *)haystack+(0..haystack_len-needle_len)) && \valid_read((char *)\result));
+  @*/
+static inline const void *td_memrmem(const void *haystack, const unsigned int haystack_len, const void *needle, const unsigned int needle_len)
+{
+  const unsigned char *h = (const unsigned char *) haystack;
+  const unsigned char first = ((const unsigned char *) needle)[0];
+  /* number of possible starting positions left to test */
+  unsigned int n;
+  if (haystack_len < needle_len)
+    return NULL;
+  n = haystack_len - needle_len + 1;
+  /*@
+    @ loop invariant 0 <= n <= haystack_len - needle_len + 1;
+    @ loop assigns n;
+    @ loop variant n;
+    @*/
+  while (n > 0)
+  {
+#ifndef DISABLED_FOR_FRAMAC
+    /* Skip 8 bytes at a time while none of them can start the needle */
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t pattern = ones * first;
+    while (n >= 8)
+    {
+      uint64_t x;
+      memcpy (&x, &h[n - 8], 8);
+      x ^= pattern;
+      if (((x - ones) & ~x & (ones << 7)) != 0)
+        break;
+      n -= 8;
+    }
+    if (n == 0)
+      break;
+#endif
+    n--;
+    if (h[n] == first &&
+        !memcmp ((const void *) &h[n + 1],
+                 (const void *) ((const unsigned char *) needle + 1),
+                 needle_len - 1))
+      return (const void *) &h[n];
+  }
+  return NULL;
+}
+
+/* Return the first position in haystack where one of the needles starts,
+ * the needle listed first wins if several start at the same position.
+ * nbr_needles is small, the needles are only compared when the haystack
+ * byte can start one of them. */
+/*@
+  @ requires nbr_needles > 0;
+  @ requires \valid_read((const char *)haystack+(0..haystack_len-1));
+  @ requires \valid_read(needles+(0..nbr_needles-1));
+  @ requires \valid_read(needles_len+(0..nbr_needles-1));
+  @ assigns  \nothing;
+  @*/
+static inline const void *td_memmem_multi(const void *haystack, const unsigned int haystack_len, const char *const *needles, const unsigned int *needles_len, const unsigned int nbr_needles)
+{
+  const unsigned char *h = (const unsigned char *) haystack;
+  unsigned char first_bytes[256];
+  unsigned int i;
+  memset (first_bytes, 0, sizeof(first_bytes));
+  /*@
+    @ loop assigns i, first_bytes[0 .. 255];
+    @ loop variant nbr_needles - i;
+    @*/
+  for (i = 0; i < nbr_needles; i++)
+  {
+    if (needles_len[i] == 0)
+      return haystack;
+    first_bytes[(const unsigned char) needles[i][0]] = 1;
+  }
+  /*@
+    @ loop assigns i;
+    @ loop variant haystack_len - i;
+    @*/
+  for (i = 0; i < haystack_len; i++)
+  {
+    if (first_bytes[h[i]])
+    {
+      unsigned int j;
+      /*@
+        @ loop assigns j;
+        @ loop variant nbr_needles - j;
+        @*/
+      for (j = 0; j < nbr_needles; j++)
+      {
+        if (needles_len[j] <= haystack_len - i &&
+            memcmp (&h[i], needles[j], needles_len[j]) == 0)
+          return (const void *) &h[i];
+      }
+    }
+  }
   return NULL;
 }
 #endif
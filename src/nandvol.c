@@ -0,0 +1,473 @@
+/*
+
+    File: nandvol.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <ctype.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "nandvol.h"
+
+/* Flash chip-off dumps: the raw pages are read from the dump, the
+ * scrambler key is XORed with them and the data bytes are copied out,
+ * so the image is carved without writing a cleaned copy first. */
+#define NANDVOL_MAX_PAGE	65536
+#define NANDVOL_MAX_KEY		(64*1024*1024)
+/* Raw pages read at once */
+#define NANDVOL_BATCH		256
+#define NANDVOL_UNMAPPED	0xffffffff
+
+extern const arch_fnct_t arch_none;
+
+struct info_nandvol_struct
+{
+  disk_t *disk;
+  char *name;
+  unsigned int page;		/* data bytes per page */
+  unsigned int spare;		/* spare bytes per page */
+  unsigned int chunk;		/* data bytes before each part of the spare area */
+  unsigned int raw_page;
+  uint64_t nbr_pages;
+  uint64_t size;
+  unsigned char *key;
+  unsigned int key_len;
+  uint32_t *map;		/* raw page of each page, NULL for the identity */
+  unsigned char *bounce;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t pread_mutex;
+#endif
+};
+
+/* Word by word so the compiler can use the vector registers */
+static void nandvol_xor_block(unsigned char *buffer, const unsigned char *key, unsigned int size)
+{
+  for(; size >= 8; size-=8, buffer+=8, key+=8)
+  {
+    uint64_t v;
+    uint64_t k;
+    memcpy(&v, buffer, 8);
+    memcpy(&k, key, 8);
+    v^=k;
+    memcpy(buffer, &v, 8);
+  }
+  for(; size > 0; size--)
+    *buffer++^=*key++;
+}
+
+/* The key is repeated over the raw dump from its start */
+static void nandvol_descramble(const struct info_nandvol_struct *data, unsigned char *buffer, unsigned int size, const uint64_t raw_offset)
+{
+  unsigned int pos=raw_offset % data->key_len;
+  while(size > 0)
+  {
+    const unsigned int n=(size < data->key_len - pos ? size : data->key_len - pos);
+    nandvol_xor_block(buffer, data->key + pos, n);
+    buffer+=n;
+    size-=n;
+    pos=0;
+  }
+}
+
+/* Move the data of the raw pages to the start of the buffer */
+static void nandvol_strip(const struct info_nandvol_struct *data, unsigned char *buffer, const unsigned int pages)
+{
+  const unsigned int spare_chunk=data->spare / (data->page / data->chunk);
+  const unsigned char *src=buffer;
+  unsigned char *dst=buffer;
+  unsigned int i;
+  for(i=0; i < pages * (data->page / data->chunk); i++)
+  {
+    if(dst!=src)
+      memmove(dst, src, data->chunk);
+    dst+=data->chunk;
+    src+=data->chunk + spare_chunk;
+  }
+}
+
+static uint64_t nandvol_raw(const struct info_nandvol_struct *data, const uint64_t page)
+{
+  return (data->map==NULL ? page : data->map[page]);
+}
+
+static int fnandvol_pread_aux(struct info_nandvol_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  unsigned int done=0;
+  while(done < count)
+  {
+    const uint64_t page=(offset + done) / data->page;
+    const unsigned int skip=(offset + done) % data->page;
+    const uint64_t raw=nandvol_raw(data, page);
+    unsigned int avail;
+    unsigned int want;
+    unsigned int n;
+    int res;
+    if(raw==NANDVOL_UNMAPPED)
+    {
+      avail=(data->page - skip < count - done ? data->page - skip : count - done);
+      memset(buffer + done, 0, avail);
+      done+=avail;
+      continue;
+    }
+    /* Consecutive raw pages are read at once */
+    for(want=1;
+	want < NANDVOL_BATCH && (page + want) * data->page < offset + count &&
+	nandvol_raw(data, page + want)==raw + want;
+	want++);
+    res=data->disk->pread(data->disk, data->bounce, want * data->raw_page, raw * data->raw_page);
+    n=(res > 0 ? (unsigned int)res / data->raw_page : 0);
+    if(n==0)
+      return (done > 0 ? (int)done : (res < 0 ? res : -1));
+    if(data->key!=NULL)
+      nandvol_descramble(data, data->bounce, n * data->raw_page, raw * data->raw_page);
+    nandvol_strip(data, data->bounce, n);
+    avail=n * data->page - skip;
+    if(avail > count - done)
+      avail=count - done;
+    memcpy(buffer + done, data->bounce + skip, avail);
+    done+=avail;
+    if(n < want)
+      break;
+  }
+  return done;
+}
+
+static int fnandvol_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_nandvol_struct *data=(struct info_nandvol_struct *)disk->data;
+  unsigned int size=count;
+  int res;
+  if(offset >= data->size)
+    return 0;
+  if(size > data->size - offset)
+    size=data->size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->pread_mutex);
+#endif
+  res=fnandvol_pread_aux(data, (unsigned char *)buffer, size, offset);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->pread_mutex);
+#endif
+  if(res < 0)
+    log_error("fnandvol_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read error\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return res;
+}
+
+static int fnandvol_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fnandvol_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fnandvol_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fnandvol_description(disk_t *disk)
+{
+  const struct info_nandvol_struct *data=(const struct info_nandvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  /* With a long device name, the geometry is left out */
+  if(snprintf(disk->description_txt, sizeof(disk->description_txt),"NAND %u+%u %s - %s - CHS %lu %u %u (RO)",
+	data->page, data->spare, data->disk->device, buffer_disk_size,
+	disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head) >= (int)sizeof(disk->description_txt))
+    snprintf(disk->description_txt, sizeof(disk->description_txt),"NAND %u+%u %s - %s (RO)",
+	data->page, data->spare, data->disk->device, buffer_disk_size);
+  return disk->description_txt;
+}
+
+static const char *fnandvol_description_short(disk_t *disk)
+{
+  const struct info_nandvol_struct *data=(const struct info_nandvol_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_short_txt),"NAND %s - %s (RO)",
+      data->disk->device, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void nandvol_free(struct info_nandvol_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&data->pread_mutex);
+#endif
+  if(data->disk!=NULL)
+    data->disk->clean(data->disk);
+  free(data->bounce);
+  free(data->map);
+  free(data->key);
+  free(data->name);
+  free(data);
+}
+
+static void fnandvol_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    nandvol_free((struct info_nandvol_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+static int nandvol_read_key(struct info_nandvol_struct *data, const char *filename)
+{
+  long size;
+  FILE *handle=fopen(filename, "rb");
+  if(handle==NULL)
+  {
+    log_error("nand: can't open the key file %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  if(fseek(handle, 0, SEEK_END) < 0 || (size=ftell(handle)) <= 0 || size > NANDVOL_MAX_KEY ||
+      fseek(handle, 0, SEEK_SET) < 0)
+  {
+    log_error("nand: %s can't be used as a key\n", filename);
+    fclose(handle);
+    return -1;
+  }
+  data->key=(unsigned char *)MALLOC(size);
+  data->key_len=size;
+  if(fread(data->key, 1, data->key_len, handle)!=data->key_len)
+  {
+    log_error("nand: can't read the key file %s\n", filename);
+    fclose(handle);
+    return -1;
+  }
+  fclose(handle);
+  return 0;
+}
+
+/* One raw page number per line, - if the page is missing */
+static int nandvol_read_map(struct info_nandvol_struct *data, const char *filename)
+{
+  char line[64];
+  uint64_t alloc=0;
+  FILE *handle=fopen(filename, "r");
+  if(handle==NULL)
+  {
+    log_error("nand: can't open the page file %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  data->nbr_pages=0;
+  while(fgets(line, sizeof(line), handle)!=NULL)
+  {
+    const char *p=line;
+    char *end;
+    uint64_t raw;
+    while(isspace(*p))
+      p++;
+    if(*p=='\0' || *p=='#')
+      continue;
+    if(*p=='-')
+      raw=NANDVOL_UNMAPPED;
+    else
+    {
+      raw=strtoull(p, &end, 0);
+      if(end==p || raw >= NANDVOL_UNMAPPED)
+      {
+	log_error("nand: invalid page %s in %s\n", p, filename);
+	fclose(handle);
+	return -1;
+      }
+    }
+    if(data->nbr_pages==alloc)
+    {
+      alloc=(alloc==0 ? 4096 : alloc * 2);
+      data->map=(uint32_t *)realloc(data->map, alloc * sizeof(uint32_t));
+      if(data->map==NULL)
+      {
+	fclose(handle);
+	return -1;
+      }
+    }
+    data->map[data->nbr_pages++]=raw;
+  }
+  fclose(handle);
+  if(data->nbr_pages==0)
+  {
+    log_error("nand: no page in %s\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+/* page+spare[/chunk] */
+static int nandvol_set_layout(struct info_nandvol_struct *data, const char *p)
+{
+  char *end;
+  data->page=strtoul(p, &end, 10);
+  if(end==p || *end!='+')
+    return -1;
+  p=end + 1;
+  data->spare=strtoul(p, &end, 10);
+  if(end==p)
+    return -1;
+  data->chunk=data->page;
+  if(*end=='/')
+  {
+    p=end + 1;
+    data->chunk=strtoul(p, &end, 10);
+    if(end==p)
+      return -1;
+  }
+  if(*end!=',')
+    return -1;
+  if(data->page < 512 || data->page > NANDVOL_MAX_PAGE || data->page % 512!=0 ||
+      data->spare > data->page ||
+      data->chunk==0 || data->page % data->chunk!=0 || data->spare % (data->page / data->chunk)!=0)
+    return -1;
+  data->raw_page=data->page + data->spare;
+  return 0;
+}
+
+disk_t *fnandvol_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_nandvol_struct *data;
+  const char *p;
+  disk_t *disk;
+  int res=0;
+  if(strncmp(device, NANDVOL_PREFIX, strlen(NANDVOL_PREFIX))!=0)
+    return NULL;
+  data=(struct info_nandvol_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->pread_mutex, NULL);
+#endif
+  data->name=strdup(device);
+  p=device + strlen(NANDVOL_PREFIX);
+  if(data->name==NULL || nandvol_set_layout(data, p) < 0)
+  {
+    log_error("%s: the layout must be given as nand:page+spare[/chunk],dump\n", device);
+    nandvol_free(data);
+    return NULL;
+  }
+  p=strchr(p, ',') + 1;
+  /* xor=keyfile and map=pagefile, the dump comes last */
+  while(res==0 && (strncmp(p, "xor=", 4)==0 || strncmp(p, "map=", 4)==0))
+  {
+    const char *sep=strchr(p, ',');
+    char *filename;
+    if(sep==NULL)
+    {
+      res=-1;
+      break;
+    }
+    filename=(char *)MALLOC(sep - p - 4 + 1);
+    memcpy(filename, p + 4, sep - p - 4);
+    filename[sep - p - 4]='\0';
+    if(p[0]=='x')
+      res=nandvol_read_key(data, filename);
+    else
+      res=nandvol_read_map(data, filename);
+    free(filename);
+    p=sep + 1;
+  }
+  if(res < 0 || *p=='\0')
+  {
+    nandvol_free(data);
+    return NULL;
+  }
+  data->disk=file_test_availability(p, verbose, testdisk_mode & ~(TESTDISK_O_RDWR|TESTDISK_O_DIRECT));
+  if(data->disk==NULL)
+  {
+    log_error("%s: can't open %s\n", device, p);
+    nandvol_free(data);
+    return NULL;
+  }
+  if(data->map==NULL)
+    data->nbr_pages=data->disk->disk_real_size / data->raw_page;
+  else
+  {
+    const uint64_t raw_pages=data->disk->disk_real_size / data->raw_page;
+    uint64_t i;
+    for(i=0; i < data->nbr_pages; i++)
+    {
+      if(data->map[i]!=NANDVOL_UNMAPPED && data->map[i] >= raw_pages)
+      {
+	log_warning("%s: raw page %lu is beyond the end of %s\n", device,
+	    (long unsigned)data->map[i], p);
+	data->map[i]=NANDVOL_UNMAPPED;
+      }
+    }
+  }
+  data->size=data->nbr_pages * data->page;
+  if(data->size==0)
+  {
+    log_error("%s: %s is smaller than a page\n", device, p);
+    nandvol_free(data);
+    return NULL;
+  }
+  data->bounce=(unsigned char *)MALLOC(NANDVOL_BATCH * data->raw_page);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    nandvol_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&fnandvol_description;
+  disk->description_short=&fnandvol_description_short;
+  disk->pread=&fnandvol_pread;
+  disk->pwrite=&fnandvol_nopwrite;
+  disk->sync=&fnandvol_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fnandvol_clean;
+  disk->sector_size=512;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  log_info("%s: %u data bytes and %u spare bytes per page in %u-byte chunks, %llu pages%s%s\n", device,
+      data->page, data->spare, data->chunk, (long long unsigned)data->nbr_pages,
+      (data->key!=NULL ? ", descrambled" : ""), (data->map!=NULL ? ", reordered" : ""));
+  return disk;
+}
+#endif
@@ -0,0 +1,49 @@
+/*
+
+    File: nandvol.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _NANDVOL_H
+#define _NANDVOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a flash chip-off dump read without its spare area:
+ * nand:page+spare[/chunk][,xor=keyfile][,map=pagefile],dump */
+#define NANDVOL_PREFIX "nand:"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open read-only the dump named in device, each raw page holds page
+ * data bytes followed by spare bytes, or page/chunk chunks of data each
+ * followed by its share of the spare area. The key file, XORed with the
+ * raw dump, removes a scrambler; the page file lists the raw page of each
+ * page of the image, one number per line, - for a page that isn't there.
+ * NULL if the layout is invalid */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fnandvol_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
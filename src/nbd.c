@@ -0,0 +1,900 @@
+/*
+
+    File: nbd.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Read-only client of the Network Block Device protocol.
+ * The reads are split in chunks of up to 1 MiB, the requests for all the
+ * chunks of a read and, when the reads are sequential, for the next
+ * chunks are sent before waiting for the first reply, so the latency of
+ * the network is paid once per window instead of once per read.
+ * The export is negotiated with NBD_OPT_GO, NBD_OPT_EXPORT_NAME for the
+ * older servers, or with the oldstyle handshake. Only simple replies are
+ * used. After a fork, or if the connection is lost, the next read opens a
+ * new connection. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_NETDB_H) && defined(HAVE_GETADDRINFO)
+#define NBD_SUPPORTED 1
+#include <sys/socket.h>
+#include <netdb.h>
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "hdstats.h"
+#include "log.h"
+#include "nbd.h"
+
+#ifdef NBD_SUPPORTED
+extern const arch_fnct_t arch_none;
+
+#define NBD_DEFAULT_PORT	"10809"
+#define NBD_CHUNK_SIZE		(1024*1024)
+/* Chunks kept or requested, the read-ahead uses up to NBD_READ_AHEAD */
+#define NBD_SLOTS		16
+#define NBD_READ_AHEAD		8
+/* A server silent for that long is considered gone */
+#define NBD_TIMEOUT		60
+
+#define NBD_MAGIC		0x4e42444d41474943ULL	/* "NBDMAGIC" */
+#define NBD_OPTS_MAGIC		0x49484156454F5054ULL	/* "IHAVEOPT" */
+#define NBD_CLISERV_MAGIC	0x0000420281861253ULL	/* oldstyle */
+#define NBD_REP_MAGIC		0x0003e889045565a9ULL
+#define NBD_REQUEST_MAGIC	0x25609513
+#define NBD_SIMPLE_REPLY_MAGIC	0x67446698
+
+#define NBD_FLAG_FIXED_NEWSTYLE	(1 << 0)
+#define NBD_FLAG_NO_ZEROES	(1 << 1)
+#define NBD_FLAG_C_FIXED_NEWSTYLE	(1 << 0)
+#define NBD_FLAG_C_NO_ZEROES	(1 << 1)
+
+#define NBD_OPT_EXPORT_NAME	1
+#define NBD_OPT_GO		7
+#define NBD_REP_ACK		1
+#define NBD_REP_INFO		3
+#define NBD_REP_FLAG_ERROR	(1U << 31)
+#define NBD_REP_ERR_UNSUP	(NBD_REP_FLAG_ERROR | 1)
+#define NBD_INFO_EXPORT		0
+#define NBD_INFO_BLOCK_SIZE	3
+
+#define NBD_CMD_READ		0
+#define NBD_CMD_DISC		2
+
+#define NBD_FLAG_READ_ONLY	(1 << 1)
+
+struct nbd_option
+{
+  uint64_t magic;
+  uint32_t option;
+  uint32_t length;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct nbd_option_reply
+{
+  uint64_t magic;
+  uint32_t option;
+  uint32_t type;
+  uint32_t length;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct nbd_request
+{
+  uint32_t magic;
+  uint16_t flags;
+  uint16_t type;
+  uint64_t cookie;
+  uint64_t offset;
+  uint32_t length;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct nbd_simple_reply
+{
+  uint32_t magic;
+  uint32_t error;
+  uint64_t cookie;
+} __attribute__ ((gcc_struct, __packed__));
+
+typedef enum { NBD_SLOT_FREE=0, NBD_SLOT_PENDING=1, NBD_SLOT_DONE=2, NBD_SLOT_ERROR=3 } nbd_slot_state_t;
+
+struct nbd_slot
+{
+  nbd_slot_state_t state;
+  uint64_t offset;
+  unsigned int size;
+  uint64_t cookie;
+  unsigned int tick;		/* last use, for the LRU */
+  uint32_t error;		/* NBD error, errno values */
+  unsigned char *buffer;
+};
+
+struct info_nbd_struct
+{
+  char *host;
+  char *port;
+  char *export_name;
+  int sock;
+  pid_t pid;			/* process owning the connection */
+  uint64_t size;
+  uint16_t transmission_flags;
+  unsigned int chunk_size;
+  uint64_t cookie;
+  unsigned int tick;
+  uint64_t next_offset;		/* expected offset of a sequential read */
+  struct nbd_slot slots[NBD_SLOTS];
+  disk_stats_t *stats;
+};
+
+static int nbd_send_all(const int sock, const void *buffer, const size_t size)
+{
+  size_t done=0;
+  while(done < size)
+  {
+#ifdef MSG_NOSIGNAL
+    const ssize_t res=send(sock, (const char *)buffer + done, size - done, MSG_NOSIGNAL);
+#else
+    const ssize_t res=send(sock, (const char *)buffer + done, size - done, 0);
+#endif
+    if(res < 0)
+    {
+      if(errno==EINTR)
+	continue;
+      return -1;
+    }
+    done+=res;
+  }
+  return 0;
+}
+
+static int nbd_recv_all(const int sock, void *buffer, const size_t size)
+{
+  size_t done=0;
+  while(done < size)
+  {
+    const ssize_t res=recv(sock, (char *)buffer + done, size - done, 0);
+    if(res < 0)
+    {
+      if(errno==EINTR)
+	continue;
+      return -1;
+    }
+    if(res==0)
+    {
+      errno=ECONNRESET;
+      return -1;
+    }
+    done+=res;
+  }
+  return 0;
+}
+
+static int nbd_skip(const int sock, uint32_t size)
+{
+  char buffer[512];
+  while(size > 0)
+  {
+    const unsigned int len=(size < sizeof(buffer) ? size : sizeof(buffer));
+    if(nbd_recv_all(sock, buffer, len) < 0)
+      return -1;
+    size-=len;
+  }
+  return 0;
+}
+
+/* nbd://host[:port][/exportname], host may be an [IPv6] address */
+static int nbd_parse_uri(struct info_nbd_struct *data, const char *device)
+{
+  const char *host=device + strlen(NBD_PREFIX);
+  const char *host_end;
+  const char *port=NULL;
+  const char *port_end=NULL;
+  const char *path;
+  if(*host=='[')
+  {
+    host++;
+    host_end=strchr(host, ']');
+    if(host_end==NULL)
+      return -1;
+    path=host_end + 1;
+  }
+  else
+  {
+    for(host_end=host; *host_end!='\0' && *host_end!=':' && *host_end!='/'; host_end++);
+    path=host_end;
+  }
+  if(*path==':')
+  {
+    port=path + 1;
+    for(port_end=port; *port_end!='\0' && *port_end!='/'; port_end++);
+    path=port_end;
+  }
+  if(host_end==host || (*path!='\0' && *path!='/') || (port!=NULL && port_end==port))
+    return -1;
+  data->host=(char *)MALLOC(host_end - host + 1);
+  memcpy(data->host, host, host_end - host);
+  data->host[host_end - host]='\0';
+  if(port!=NULL)
+  {
+    data->port=(char *)MALLOC(port_end - port + 1);
+    memcpy(data->port, port, port_end - port);
+    data->port[port_end - port]='\0';
+  }
+  else
+    data->port=strdup(NBD_DEFAULT_PORT);
+  data->export_name=strdup(*path=='/' ? path + 1 : "");
+  if(data->port==NULL || data->export_name==NULL)
+    return -1;
+  return 0;
+}
+
+static int nbd_open_socket(const struct info_nbd_struct *data)
+{
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  int sock=-1;
+  int err;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family=AF_UNSPEC;
+  hints.ai_socktype=SOCK_STREAM;
+  err=getaddrinfo(data->host, data->port, &hints, &res);
+  if(err!=0)
+  {
+    log_error("nbd: %s: %s\n", data->host, gai_strerror(err));
+    return -1;
+  }
+  for(ai=res; ai!=NULL; ai=ai->ai_next)
+  {
+    sock=socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(sock < 0)
+      continue;
+    if(connect(sock, ai->ai_addr, ai->ai_addrlen)==0)
+      break;
+    close(sock);
+    sock=-1;
+  }
+  freeaddrinfo(res);
+  if(sock < 0)
+  {
+    log_error("nbd: can't connect to %s port %s: %s\n", data->host, data->port, strerror(errno));
+    return -1;
+  }
+  {
+    struct timeval timeout;
+    const int rcvbuf=NBD_SLOTS * NBD_CHUNK_SIZE / 4;
+#ifdef TCP_NODELAY
+    const int one=1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf));
+    timeout.tv_sec=NBD_TIMEOUT;
+    timeout.tv_usec=0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+  }
+  return sock;
+}
+
+static int nbd_send_option(const int sock, const uint32_t option, const void *payload, const uint32_t length)
+{
+  struct nbd_option opt;
+  opt.magic=be64(NBD_OPTS_MAGIC);
+  opt.option=be32(option);
+  opt.length=be32(length);
+  if(nbd_send_all(sock, &opt, sizeof(opt)) < 0)
+    return -1;
+  if(length > 0 && nbd_send_all(sock, payload, length) < 0)
+    return -1;
+  return 0;
+}
+
+/* NBD_OPT_GO, return 0 on success, 1 if the server doesn't know it */
+static int nbd_opt_go(struct info_nbd_struct *data, const int sock, unsigned int *max_block)
+{
+  const uint32_t name_len=strlen(data->export_name);
+  const uint32_t length=4 + name_len + 2 + 2;
+  unsigned char *payload=(unsigned char *)MALLOC(length);
+  uint32_t tmp32;
+  uint16_t tmp16;
+  int res;
+  tmp32=be32(name_len);
+  memcpy(payload, &tmp32, 4);
+  memcpy(payload + 4, data->export_name, name_len);
+  /* Ask for the block size constraints */
+  tmp16=be16(1);
+  memcpy(payload + 4 + name_len, &tmp16, 2);
+  tmp16=be16(NBD_INFO_BLOCK_SIZE);
+  memcpy(payload + 4 + name_len + 2, &tmp16, 2);
+  res=nbd_send_option(sock, NBD_OPT_GO, payload, length);
+  free(payload);
+  if(res < 0)
+    return -1;
+  while(1)
+  {
+    struct nbd_option_reply reply;
+    uint32_t type;
+    uint32_t len;
+    if(nbd_recv_all(sock, &reply, sizeof(reply)) < 0)
+      return -1;
+    type=be32(reply.type);
+    len=be32(reply.length);
+    if(be64(reply.magic)!=NBD_REP_MAGIC)
+    {
+      log_error("nbd: %s: bad option reply\n", data->host);
+      return -1;
+    }
+    if(type==NBD_REP_ACK)
+      return 0;
+    if(type==NBD_REP_ERR_UNSUP)
+    {
+      if(nbd_skip(sock, len) < 0)
+	return -1;
+      return 1;
+    }
+    if((type & NBD_REP_FLAG_ERROR)!=0)
+    {
+      char msg[256];
+      const unsigned int msg_len=(len < sizeof(msg) - 1 ? len : sizeof(msg) - 1);
+      if(nbd_recv_all(sock, msg, msg_len) < 0 || nbd_skip(sock, len - msg_len) < 0)
+	return -1;
+      msg[msg_len]='\0';
+      log_error("nbd: %s: export \"%s\" refused, error 0x%x %s\n", data->host, data->export_name,
+	  (unsigned int)type, msg);
+      return -1;
+    }
+    if(type==NBD_REP_INFO && len >= 2 && len <= 256)
+    {
+      unsigned char info[256];
+      if(nbd_recv_all(sock, info, len) < 0)
+	return -1;
+      memcpy(&tmp16, info, 2);
+      if(be16(tmp16)==NBD_INFO_EXPORT && len >= 12)
+      {
+	uint64_t tmp64;
+	memcpy(&tmp64, info + 2, 8);
+	data->size=be64(tmp64);
+	memcpy(&tmp16, info + 10, 2);
+	data->transmission_flags=be16(tmp16);
+      }
+      else if(be16(tmp16)==NBD_INFO_BLOCK_SIZE && len >= 14)
+      {
+	memcpy(&tmp32, info + 10, 4);
+	*max_block=be32(tmp32);
+      }
+    }
+    else if(nbd_skip(sock, len) < 0)
+      return -1;
+  }
+}
+
+static int nbd_opt_export_name(struct info_nbd_struct *data, const int sock, const int no_zeroes)
+{
+  unsigned char reply[8 + 2 + 124];
+  uint64_t tmp64;
+  uint16_t tmp16;
+  if(nbd_send_option(sock, NBD_OPT_EXPORT_NAME, data->export_name, strlen(data->export_name)) < 0)
+    return -1;
+  if(nbd_recv_all(sock, reply, (no_zeroes ? 10 : sizeof(reply))) < 0)
+  {
+    log_error("nbd: %s: export \"%s\" refused\n", data->host, data->export_name);
+    return -1;
+  }
+  memcpy(&tmp64, reply, 8);
+  data->size=be64(tmp64);
+  memcpy(&tmp16, reply + 8, 2);
+  data->transmission_flags=be16(tmp16);
+  return 0;
+}
+
+static int nbd_handshake(struct info_nbd_struct *data, const int sock, unsigned int *max_block)
+{
+  uint64_t magic;
+  uint16_t handshake_flags;
+  uint32_t client_flags=0;
+  int res;
+  if(nbd_recv_all(sock, &magic, 8) < 0 || be64(magic)!=NBD_MAGIC ||
+      nbd_recv_all(sock, &magic, 8) < 0)
+  {
+    log_error("nbd: %s port %s isn't an NBD server\n", data->host, data->port);
+    return -1;
+  }
+  if(be64(magic)==NBD_CLISERV_MAGIC)
+  {
+    /* oldstyle: size, flags and 124 zeroes, a single export */
+    unsigned char reply[8 + 4 + 124];
+    uint64_t tmp64;
+    uint32_t tmp32;
+    if(nbd_recv_all(sock, reply, sizeof(reply)) < 0)
+      return -1;
+    memcpy(&tmp64, reply, 8);
+    data->size=be64(tmp64);
+    memcpy(&tmp32, reply + 8, 4);
+    data->transmission_flags=be32(tmp32) & 0xffff;
+    return 0;
+  }
+  if(be64(magic)!=NBD_OPTS_MAGIC || nbd_recv_all(sock, &handshake_flags, 2) < 0)
+  {
+    log_error("nbd: %s: unknown handshake\n", data->host);
+    return -1;
+  }
+  handshake_flags=be16(handshake_flags);
+  if((handshake_flags & NBD_FLAG_FIXED_NEWSTYLE)!=0)
+    client_flags|=NBD_FLAG_C_FIXED_NEWSTYLE;
+  if((handshake_flags & NBD_FLAG_NO_ZEROES)!=0)
+    client_flags|=NBD_FLAG_C_NO_ZEROES;
+  client_flags=be32(client_flags);
+  if(nbd_send_all(sock, &client_flags, 4) < 0)
+    return -1;
+  if((handshake_flags & NBD_FLAG_FIXED_NEWSTYLE)!=0)
+  {
+    res=nbd_opt_go(data, sock, max_block);
+    if(res<=0)
+      return res;
+  }
+  return nbd_opt_export_name(data, sock, (handshake_flags & NBD_FLAG_NO_ZEROES)!=0);
+}
+
+static void nbd_disconnect(struct info_nbd_struct *data)
+{
+  unsigned int i;
+  if(data->sock >= 0)
+    close(data->sock);
+  data->sock=-1;
+  /* The replies of the pending requests are lost */
+  for(i=0; i<NBD_SLOTS; i++)
+    if(data->slots[i].state==NBD_SLOT_PENDING)
+      data->slots[i].state=NBD_SLOT_FREE;
+}
+
+static int nbd_connect(struct info_nbd_struct *data)
+{
+  const uint64_t old_size=data->size;
+  unsigned int max_block=0;
+  const int sock=nbd_open_socket(data);
+  if(sock < 0)
+    return -1;
+  if(nbd_handshake(data, sock, &max_block) < 0)
+  {
+    close(sock);
+    return -1;
+  }
+  if(old_size!=0 && data->size!=old_size)
+  {
+    log_error("nbd: %s: the size of the export has changed\n", data->host);
+    close(sock);
+    data->size=old_size;
+    return -1;
+  }
+  if(data->chunk_size==0)
+  {
+    data->chunk_size=NBD_CHUNK_SIZE;
+    if(max_block >= 4096 && max_block < data->chunk_size)
+      data->chunk_size=max_block / 4096 * 4096;
+  }
+  data->sock=sock;
+  data->pid=getpid();
+  return 0;
+}
+
+static int nbd_slot_find(const struct info_nbd_struct *data, const uint64_t offset)
+{
+  unsigned int i;
+  for(i=0; i<NBD_SLOTS; i++)
+    if(data->slots[i].state!=NBD_SLOT_FREE && data->slots[i].offset==offset)
+      return i;
+  return -1;
+}
+
+static int nbd_slot_send(struct info_nbd_struct *data, struct nbd_slot *slot, const uint64_t offset, const unsigned int size)
+{
+  struct nbd_request req;
+  slot->state=NBD_SLOT_PENDING;
+  slot->offset=offset;
+  slot->size=size;
+  slot->cookie=++data->cookie;
+  slot->tick=++data->tick;
+  req.magic=be32(NBD_REQUEST_MAGIC);
+  req.flags=0;
+  req.type=be16(NBD_CMD_READ);
+  req.cookie=be64(slot->cookie);
+  req.offset=be64(offset);
+  req.length=be32(size);
+  if(nbd_send_all(data->sock, &req, sizeof(req)) < 0)
+  {
+    log_error("nbd: %s: %s\n", data->host, strerror(errno));
+    nbd_disconnect(data);
+    return -1;
+  }
+  return 0;
+}
+
+/* Send a read request for the chunk at offset, the chunks between start
+ * and end are kept. Return the slot, -1 if all the slots are busy */
+static int nbd_slot_request(struct info_nbd_struct *data, const uint64_t offset, const uint64_t start, const uint64_t end)
+{
+  struct nbd_slot *slot=NULL;
+  unsigned int i;
+  for(i=0; i<NBD_SLOTS; i++)
+  {
+    struct nbd_slot *s=&data->slots[i];
+    if(s->state==NBD_SLOT_FREE)
+    {
+      slot=s;
+      break;
+    }
+    if(s->state!=NBD_SLOT_PENDING && (s->offset < start || s->offset >= end) &&
+	(slot==NULL || s->tick < slot->tick))
+      slot=s;
+  }
+  if(slot==NULL)
+    return -1;
+  if(nbd_slot_send(data, slot, offset,
+	(data->size - offset < data->chunk_size ? data->size - offset : data->chunk_size)) < 0)
+    return -1;
+  return slot - data->slots;
+}
+
+static unsigned int nbd_nbr_pending(const struct info_nbd_struct *data)
+{
+  unsigned int nbr=0;
+  unsigned int i;
+  for(i=0; i<NBD_SLOTS; i++)
+    if(data->slots[i].state==NBD_SLOT_PENDING)
+      nbr++;
+  return nbr;
+}
+
+/* Receive one reply, in any order */
+static int nbd_receive(struct info_nbd_struct *data)
+{
+  struct nbd_simple_reply reply;
+  uint64_t cookie;
+  unsigned int i;
+  if(nbd_recv_all(data->sock, &reply, sizeof(reply)) < 0)
+  {
+    log_error("nbd: %s: %s\n", data->host, strerror(errno));
+    nbd_disconnect(data);
+    return -1;
+  }
+  cookie=be64(reply.cookie);
+  for(i=0; i<NBD_SLOTS; i++)
+  {
+    struct nbd_slot *slot=&data->slots[i];
+    if(slot->state==NBD_SLOT_PENDING && slot->cookie==cookie)
+    {
+      slot->error=be32(reply.error);
+      if(slot->error!=0)
+      {
+	slot->state=NBD_SLOT_ERROR;
+	return 0;
+      }
+      if(nbd_recv_all(data->sock, slot->buffer, slot->size) < 0)
+      {
+	log_error("nbd: %s: %s\n", data->host, strerror(errno));
+	nbd_disconnect(data);
+	return -1;
+      }
+      slot->state=NBD_SLOT_DONE;
+      return 0;
+    }
+  }
+  if(be32(reply.magic)!=NBD_SIMPLE_REPLY_MAGIC)
+    log_error("nbd: %s: bad reply magic 0x%08x\n", data->host, (unsigned int)be32(reply.magic));
+  else
+    log_error("nbd: %s: reply to an unknown request\n", data->host);
+  nbd_disconnect(data);
+  return -1;
+}
+
+static int fnbd_pread_aux(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_nbd_struct *data=(struct info_nbd_struct *)disk->data;
+  unsigned int size=count;
+  unsigned int done=0;
+  uint64_t chunk;
+  uint64_t ahead_end;
+  if(offset >= data->size)
+    return 0;
+  if(size > data->size - offset)
+    size=data->size - offset;
+  /* Forked: the connection belongs to the parent */
+  if(data->sock >= 0 && data->pid!=getpid())
+    nbd_disconnect(data);
+  if(data->sock < 0 && nbd_connect(data) < 0)
+    return -1;
+  /* Pipeline the requests of this read and of the read-ahead */
+  ahead_end=(offset + size + data->chunk_size - 1) / data->chunk_size * data->chunk_size;
+  if(offset==data->next_offset)
+    ahead_end+=(uint64_t)NBD_READ_AHEAD * data->chunk_size;
+  if(ahead_end > data->size)
+    ahead_end=data->size;
+  for(chunk=offset / data->chunk_size * data->chunk_size; chunk < ahead_end; chunk+=data->chunk_size)
+  {
+    if(nbd_slot_find(data, chunk) < 0 &&
+	nbd_slot_request(data, chunk, offset / data->chunk_size * data->chunk_size, ahead_end) < 0)
+      break;
+  }
+  while(done < size)
+  {
+    const uint64_t pos=offset + done;
+    const uint64_t chunk_offset=pos / data->chunk_size * data->chunk_size;
+    const unsigned int in_chunk=pos - chunk_offset;
+    struct nbd_slot *slot;
+    unsigned int len;
+    int i=nbd_slot_find(data, chunk_offset);
+    while(i < 0)
+    {
+      if(data->sock < 0)
+	return (done > 0 ? (int)done : -1);
+      i=nbd_slot_request(data, chunk_offset, chunk_offset, offset + size);
+      if(i < 0 && data->sock >= 0)
+      {
+	/* Wait for a slot, or take one holding a later chunk */
+	if(nbd_nbr_pending(data) > 0)
+	{
+	  if(nbd_receive(data) < 0)
+	    return (done > 0 ? (int)done : -1);
+	}
+	else
+	  i=nbd_slot_request(data, chunk_offset, 0, 0);
+      }
+    }
+    slot=&data->slots[i];
+    len=(slot->size - in_chunk < size - done ? slot->size - in_chunk : size - done);
+    while(slot->state==NBD_SLOT_PENDING)
+    {
+      if(nbd_receive(data) < 0)
+	return (done > 0 ? (int)done : -1);
+    }
+    if(slot->state==NBD_SLOT_ERROR && (in_chunk!=0 || len!=slot->size))
+    {
+      /* Only ask for the sectors read, a bad sector shouldn't make the
+       * whole chunk unreadable */
+      if(nbd_slot_send(data, slot, pos, len) < 0)
+	return (done > 0 ? (int)done : -1);
+      while(slot->state==NBD_SLOT_PENDING)
+      {
+	if(nbd_receive(data) < 0)
+	  return (done > 0 ? (int)done : -1);
+      }
+      if(slot->state==NBD_SLOT_DONE)
+      {
+	memcpy((unsigned char *)buffer + done, slot->buffer, len);
+	slot->state=NBD_SLOT_FREE;
+	done+=len;
+	continue;
+      }
+    }
+    if(slot->state!=NBD_SLOT_DONE)
+    {
+      log_error("fnbd_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read err: %s\n",
+	  (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	  offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset),
+	  (slot->state==NBD_SLOT_ERROR ? strerror(slot->error) : "connection lost"));
+      /* Ask again next time */
+      slot->state=NBD_SLOT_FREE;
+      return (done > 0 ? (int)done : -1);
+    }
+    slot->tick=++data->tick;
+    memcpy((unsigned char *)buffer + done, slot->buffer + in_chunk, len);
+    done+=len;
+  }
+  data->next_offset=offset + size;
+  return size;
+}
+
+static int fnbd_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  const struct info_nbd_struct *data=(const struct info_nbd_struct *)disk->data;
+  const uint64_t start=disk_stats_clock();
+  const int res=fnbd_pread_aux(disk, buffer, count, offset);
+  disk_stats_read(data->stats, count, res, start);
+  return res;
+}
+
+/* Send the requests of the chunks that will be read without waiting for
+ * the replies, a batch of small reads then costs a single round trip */
+static void fnbd_advise(disk_t *disk, const uint64_t offset, const uint64_t length, const int hint)
+{
+  struct info_nbd_struct *data=(struct info_nbd_struct *)disk->data;
+  uint64_t start;
+  uint64_t end;
+  uint64_t chunk;
+  unsigned int nbr;
+  if(hint!=TESTDISK_ADVISE_WILLNEED || offset >= data->size)
+    return ;
+  if(data->sock >= 0 && data->pid!=getpid())
+    nbd_disconnect(data);
+  if(data->sock < 0)
+    return ;
+  start=offset / data->chunk_size * data->chunk_size;
+  end=(offset + length < data->size ? offset + length : data->size);
+  /* Keep some slots for the reads */
+  for(chunk=start, nbr=0; chunk < end && nbr < NBD_SLOTS / 2; chunk+=data->chunk_size, nbr++)
+  {
+    if(nbd_slot_find(data, chunk) < 0 &&
+	nbd_slot_request(data, chunk, start, end) < 0)
+      return ;
+  }
+}
+
+static int fnbd_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fnbd_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fnbd_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fnbd_description(disk_t *disk)
+{
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"NBD %s - %s - CHS %lu %u %u (RO)",
+      disk->device, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *fnbd_description_short(disk_t *disk)
+{
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"NBD %s - %s (RO)",
+      disk->device, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void nbd_free(struct info_nbd_struct *data)
+{
+  unsigned int i;
+  if(data->sock >= 0 && data->pid==getpid())
+  {
+    struct nbd_request req;
+    memset(&req, 0, sizeof(req));
+    req.magic=be32(NBD_REQUEST_MAGIC);
+    req.type=be16(NBD_CMD_DISC);
+    nbd_send_all(data->sock, &req, sizeof(req));
+    close(data->sock);
+  }
+  for(i=0; i<NBD_SLOTS; i++)
+    free(data->slots[i].buffer);
+  disk_stats_free(data->stats);
+  free(data->host);
+  free(data->port);
+  free(data->export_name);
+  free(data);
+}
+
+static void fnbd_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    nbd_free((struct info_nbd_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+disk_t *fnbd_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_nbd_struct *data;
+  disk_t *disk;
+  unsigned int i;
+  data=(struct info_nbd_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->sock=-1;
+  data->next_offset=(uint64_t)-1;
+  if(nbd_parse_uri(data, device) < 0)
+  {
+    log_error("%s: invalid NBD URI, expected nbd://host[:port][/exportname]\n", device);
+    nbd_free(data);
+    return NULL;
+  }
+  if(nbd_connect(data) < 0)
+  {
+    nbd_free(data);
+    return NULL;
+  }
+  if(data->size==0)
+  {
+    log_error("%s: empty export\n", device);
+    nbd_free(data);
+    return NULL;
+  }
+  for(i=0; i<NBD_SLOTS; i++)
+    data->slots[i].buffer=(unsigned char *)MALLOC(data->chunk_size);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    nbd_free(data);
+    return NULL;
+  }
+  data->stats=disk_stats_new("nbd", device);
+  disk->data=data;
+  disk->description=&fnbd_description;
+  disk->description_short=&fnbd_description_short;
+  disk->pread=&fnbd_pread;
+  disk->pwrite=&fnbd_nopwrite;
+  disk->sync=&fnbd_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fnbd_clean;
+  disk->advise=&fnbd_advise;
+  disk->sector_size=DEFAULT_SECTOR_SIZE;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: NBD exports are opened read-only\n", device);
+  log_info("%s: NBD export of %llu bytes, %u KiB requests, %u in flight\n", device,
+      (long long unsigned)data->size, data->chunk_size / 1024, NBD_SLOTS);
+  if(verbose > 0 && (data->transmission_flags & NBD_FLAG_READ_ONLY)!=0)
+    log_verbose("%s: read-only export\n", device);
+  return disk;
+}
+#else
+disk_t *fnbd_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  log_error("%s: NBD isn't supported on this system\n", device);
+  return NULL;
+}
+#endif
+#endif
@@ -0,0 +1,45 @@
+/*
+
+    File: nbd.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _NBD_H
+#define _NBD_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a remote block export:
+ * nbd://host[:port][/exportname], the default port is 10809 */
+#define NBD_PREFIX "nbd://"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Connect read-only to the NBD server, NULL if the export can't be
+ * opened or if the network functions are missing */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fnbd_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -254,12 +254,10 @@ const ntfs_attribheader* ntfs_findattribute(const ntfs_recordheader* record, uin
   return ntfs_searchattribute(attrib, attrType, end, 0);
 }
 
-#if 0
-static const ntfs_attribheader* ntfs_nextattribute(const ntfs_attribheader* attrib, uint32_t attrType, const char* end)
+const ntfs_attribheader* ntfs_nextattribute(const ntfs_attribheader* attrib, uint32_t attrType, const char* end)
 {
   return ntfs_searchattribute(attrib, attrType, end, 1);
 }
-#endif
 
 const char* ntfs_getattributedata(const ntfs_attribresident* attrib, const char* end)
 {
@@ -85,6 +85,13 @@ unsigned int ntfs_sector_size(const struct ntfs_boot_sector *ntfs_header);
   @*/
 const ntfs_attribheader* ntfs_findattribute(const ntfs_recordheader* record, uint32_t attrType, const char* end);
 
+/* Next attribute of this type after attrib */
+/*@
+  @ requires \valid_read(attrib);
+  @ assigns  \nothing;
+  @*/
+const ntfs_attribheader* ntfs_nextattribute(const ntfs_attribheader* attrib, uint32_t attrType, const char* end);
+
 /*@
   @ requires \valid_read(attrib);
   @ assigns  \nothing;
@@ -24,6 +24,9 @@
 #endif
  
 #include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -54,6 +57,18 @@ struct s_info_mft
   uint64_t mftmirr_lcn;
 };
 
+#define NTFS_SCAN_CHUNK (4*1024*1024)
+
+typedef struct
+{
+  disk_t *disk;
+  const partition_t *partition;
+  char *chunk;
+  uint64_t first;		/* first sector in chunk */
+  uint64_t end;			/* sectors with a whole record in chunk */
+  uint64_t single_end;		/* sectors read one by one up to there */
+} ntfs_scan_t;
+
 static int testdisk_ffs(int x);
 
 #ifdef HAVE_NCURSES
@@ -430,6 +445,54 @@ static int read_mft_info(disk_t *disk_car, const partition_t *partition, const u
   return 3;
 }
 
+/* Sequential search of the MFT records: NTFS_SCAN_CHUNK bytes are read at
+ * once, with a record size beyond to test the record at each sector of the
+ * chunk. The sectors of a chunk that can't be read are tested one by one */
+static void ntfs_scan_init(ntfs_scan_t *scan, disk_t *disk_car, const partition_t *partition)
+{
+  scan->disk=disk_car;
+  scan->partition=partition;
+  scan->chunk=(char *)MALLOC(NTFS_SCAN_CHUNK + 0x400);
+  scan->first=0;
+  scan->end=0;
+  scan->single_end=0;
+}
+
+static const char *ntfs_scan_read(ntfs_scan_t *scan, const uint64_t sector)
+{
+  disk_t *disk_car=scan->disk;
+  const partition_t *partition=scan->partition;
+  const unsigned int sector_size=disk_car->sector_size;
+  if(sector >= scan->first && sector < scan->end)
+    return &scan->chunk[(sector - scan->first) * sector_size];
+  scan->first=0;
+  scan->end=0;
+  if(sector >= scan->single_end)
+  {
+    const uint64_t part_sectors=partition->part_size / sector_size;
+    uint64_t size=NTFS_SCAN_CHUNK + 0x400;
+    if(sector < part_sectors && size > (part_sectors - sector) * sector_size)
+      size=(part_sectors - sector) * sector_size;
+    if(size >= 0x400 &&
+	(uint64_t)disk_car->pread(disk_car, scan->chunk, size, partition->part_offset + sector * (uint64_t)sector_size) == size)
+    {
+      scan->first=sector;
+      scan->end=sector + (size - 0x400) / sector_size + 1;
+      return scan->chunk;
+    }
+    scan->single_end=sector + NTFS_SCAN_CHUNK / sector_size;
+  }
+  if(disk_car->pread(disk_car, scan->chunk, 0x400, partition->part_offset + sector * (uint64_t)sector_size) != 0x400)
+    return NULL;
+  return scan->chunk;
+}
+
+static void ntfs_scan_free(ntfs_scan_t *scan)
+{
+  free(scan->chunk);
+  scan->chunk=NULL;
+}
+
 int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose, const unsigned int expert, char **current_cmd)
 {
   uint64_t sector;
@@ -441,6 +504,8 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
   unsigned int mft_record_size=1024;
   info_mft_t info_mft[MAX_INFO_MFT];
   unsigned int nbr_mft=0;
+  ntfs_scan_t scan;
+  const char *rec;
   log_info("rebuild_NTFS_BS\n");
 #ifdef HAVE_NCURSES
   aff_copy(stdscr);
@@ -511,6 +576,7 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
       }
     }
   }
+  ntfs_scan_init(&scan, disk_car, partition);
   for(sector=1;(sector<partition->part_size/disk_car->sector_size)&&(ind_stop==0);sector++)
   {
 #ifdef HAVE_NCURSES
@@ -529,23 +595,24 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
       }
     }
 #endif
-    if(disk_car->pread(disk_car, &buffer, 0x400, partition->part_offset + sector * (uint64_t)disk_car->sector_size) == 0x400)
+    rec=ntfs_scan_read(&scan, sector);
+    if(rec!=NULL)
     {
-      const struct ntfs_mft_record *record=(const struct ntfs_mft_record *)&buffer;
-      if(memcmp(buffer,"FILE",4)==0 &&
+      const struct ntfs_mft_record *record=(const struct ntfs_mft_record *)rec;
+      if(memcmp(rec,"FILE",4)==0 &&
 	  le16(record->attrs_offset)%8==0 &&
 	  le16(record->attrs_offset)>=42 &&
 	  le16(record->flags)==1)	/* MFT_RECORD_IN_USE */
       {
 	const ntfs_attribheader *attr30;
 	int res=0;
-	attr30=ntfs_findattribute(record, 0x30, buffer+0x400);
+	attr30=ntfs_findattribute(record, 0x30, rec+0x400);
 	if(attr30 && attr30->bNonResident==0)
 	{
-	  const TD_FILE_NAME_ATTR *file_name_attr=(const TD_FILE_NAME_ATTR *)ntfs_getattributedata((const ntfs_attribresident *)attr30, buffer+0x400);
+	  const TD_FILE_NAME_ATTR *file_name_attr=(const TD_FILE_NAME_ATTR *)ntfs_getattributedata((const ntfs_attribresident *)attr30, rec+0x400);
 	  if(file_name_attr!=NULL &&
 	      file_name_attr->file_name_length==4 &&
-	      (const char*)&file_name_attr->file_name[0]+8 <= buffer+0x400 &&
+	      (const char*)&file_name_attr->file_name[0]+8 <= rec+0x400 &&
 	      memcmp(file_name_attr->file_name,"$\0M\0F\0T\0", 8)==0)
 	    res=1;
 	}
@@ -579,6 +646,7 @@ int rebuild_NTFS_BS(disk_t *disk_car, partition_t *partition, const int verbose,
       }
     }
   }
+  ntfs_scan_free(&scan);
   /* Find partition location using MFT information */
   {
     unsigned int i;
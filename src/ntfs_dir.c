@@ -55,9 +55,6 @@
 #ifdef HAVE_MACHINE_ENDIAN_H
 #include <machine/endian.h>
 #endif
-#ifdef HAVE_ICONV_H
-#include <iconv.h>
-#endif
 #include <ctype.h>      /* isalpha */
 #include <stdarg.h>
 #include "types.h"
@@ -77,13 +74,14 @@
 #include "common.h"
 #include "intrf.h"
 #include "list.h"
-#include "list_sort.h"
 #include "dir.h"
 #include "ntfs_dir.h"
 #include "ntfs_utl.h"
 #include "ntfs_inc.h"
 #include "log.h"
 #include "setdate.h"
+#include "unicode.h"
+#include "fextent.h"
 
 #if defined(HAVE_LIBNTFS) || defined(HAVE_LIBNTFS3G)
 #define MAX_PATH    1024
@@ -138,32 +136,6 @@ static int index_get_size(ntfs_inode *inode)
 	return iroot->index_block_size;
 }
 
-#ifdef HAVE_ICONV
-static int ntfs_ucstoutf8(iconv_t cd, char *ins, const int ins_len, char **outs, const int outs_len)
-{
-    char *inp;
-    char *outp;
-    size_t inb_left, outb_left;
-    if (cd == (iconv_t)(-1))
-      return -1;
-
-    outp = *outs;
-    inp = (char *) ins;
-    inb_left = ins_len << 1;    // ntfschar is 16-bit
-    outb_left = outs_len - 1;   // reserve 1 byte for NUL
-
-    *outp = '\0';
-    if (iconv(cd, (ICONV_CONST char**)&inp, &inb_left, &outp, &outb_left) == (size_t)(-1))
-    {
-      // Regardless of the value of errno
-      log_error("ntfs_ucstoutf8: iconv failed\n");
-      return -1;
-    }
-    *outp = '\0';
-    return 0;
-}
-#endif
-
 /**
  * ntfs_td_list_entry
  * FIXME: Should we print errors as we go along? (AIA)
@@ -176,7 +148,8 @@ static int ntfs_td_list_entry(  struct ntfs_dir_struct *ls, ntfschar *name,
   char *filename;
   ntfs_inode *ni;
   ntfs_attr_search_ctx *ctx_si = NULL;
-  file_info_t *new_file=NULL;
+  /* Shared by the entries of the directory and of each data stream */
+  file_info_t info;
   /* Keep FILE_NAME_WIN32 and FILE_NAME_POSIX */
   if ((name_type & FILE_NAME_WIN32_AND_DOS) == FILE_NAME_DOS)
     return 0;
@@ -188,18 +161,11 @@ static int ntfs_td_list_entry(  struct ntfs_dir_struct *ls, ntfschar *name,
     return -1;
   }
 
-#ifdef HAVE_ICONV
-  if (ntfs_ucstoutf8(ls->cd, (char *)name, name_len, &filename, MAX_PATH) < 0 &&
+  if (UTF16le2utf8(filename, MAX_PATH, (const unsigned char *)name, name_len) < 0 &&
       ntfs_ucstombs (name, name_len, &filename, MAX_PATH) < 0) {
     log_error("Cannot represent filename in current locale.\n");
     goto freefn;
   }
-#else
-  if (ntfs_ucstombs (name, name_len, &filename, MAX_PATH) < 0) {
-    log_error("Cannot represent filename in current locale.\n");
-    goto freefn;
-  }
-#endif
 
   result = 0;					/* These are successful */
   if ((ls->dir_data->param & FLAG_LIST_SYSTEM)!=FLAG_LIST_SYSTEM &&
@@ -210,11 +176,8 @@ static int ntfs_td_list_entry(  struct ntfs_dir_struct *ls, ntfschar *name,
   ni = ntfs_inode_open(ls->vol, mref);
   if (!ni)
     goto freefn;
-  new_file=(file_info_t*)MALLOC(sizeof(*new_file));
-  new_file->status=0;
-  new_file->st_ino=MREF(mref);
-  new_file->st_uid=0;
-  new_file->st_gid=0;
+  memset(&info, 0, sizeof(info));
+  info.st_ino=MREF(mref);
 
   ctx_si = ntfs_attr_get_search_ctx(ni, ni->mrec);
   if (ctx_si)
@@ -226,24 +189,24 @@ static int ntfs_td_list_entry(  struct ntfs_dir_struct *ls, ntfschar *name,
 	  le16_to_cpu(attr->value_offset));
       if(si)
       {
-	new_file->td_atime=td_ntfs2utc(sle64_to_cpu(si->last_access_time));
-	new_file->td_mtime=td_ntfs2utc(sle64_to_cpu(si->last_data_change_time));
-	new_file->td_ctime=td_ntfs2utc(sle64_to_cpu(si->creation_time));
+	info.td_atime=td_ntfs2utc(sle64_to_cpu(si->last_access_time));
+	info.td_mtime=td_ntfs2utc(sle64_to_cpu(si->last_data_change_time));
+	info.td_ctime=td_ntfs2utc(sle64_to_cpu(si->creation_time));
       }
     }
     ntfs_attr_put_search_ctx(ctx_si);
   }
   {
     ATTR_RECORD *rec;
-    int first=1;
     ntfs_attr_search_ctx *ctx = NULL;
     if (dt_type == NTFS_DT_DIR)
     {
-      new_file->name=strdup(filename);
+      file_info_t *new_file=file_info_new(ls->dir_list, NULL);
+      memcpy(new_file, &info, sizeof(*new_file));
+      new_file->name=file_info_strdup(ls->dir_list, filename);
       new_file->st_mode = LINUX_S_IFDIR| LINUX_S_IRUGO | LINUX_S_IXUGO;
       new_file->st_size=0;
       td_list_add_tail(&new_file->list, &ls->dir_list->list);
-      first=0;
     }
     ctx = ntfs_attr_get_search_ctx(ni, ni->mrec);
     /* A file has always an unnamed date stream and
@@ -251,46 +214,39 @@ static int ntfs_td_list_entry(  struct ntfs_dir_struct *ls, ntfschar *name,
     while((rec = find_attribute(AT_DATA, ctx)))
     {
       const s64 filesize = ntfs_get_attribute_value_length(ctx->attr);
+      file_info_t *new_file;
       if(rec->name_length &&
 	  (ls->dir_data->param & FLAG_LIST_ADS)!=FLAG_LIST_ADS)
 	continue;
-      if(first==0)
-      {
-	const file_info_t *old_file=new_file;
-	new_file=(file_info_t *)MALLOC(sizeof(*new_file));
-	memcpy(new_file, old_file, sizeof(*new_file));
-      }
+      new_file=file_info_new(ls->dir_list, NULL);
+      memcpy(new_file, &info, sizeof(*new_file));
       new_file->st_mode = LINUX_S_IFREG | LINUX_S_IRUGO;
       new_file->st_size=filesize;
       if (rec->name_length)
       {
 	char *stream_name=NULL;
+	char ads_name[MAX_PATH];
 	new_file->status=FILE_STATUS_ADS;
-	new_file->name = (char *)MALLOC(MAX_PATH);
 	if (ntfs_ucstombs((ntfschar *) ((char *) rec + le16_to_cpu(rec->name_offset)),
 	      rec->name_length, &stream_name, 0) < 0)
 	{
 	  log_error("ERROR: Cannot translate name into current locale.\n");
-	  snprintf(new_file->name, MAX_PATH, "%s:???", filename);
+	  snprintf(ads_name, MAX_PATH, "%s:???", filename);
 	}
 	else
 	{
-	  snprintf(new_file->name, MAX_PATH, "%s:%s", filename, stream_name);
+	  snprintf(ads_name, MAX_PATH, "%s:%s", filename, stream_name);
 	}
 	free(stream_name);
+	new_file->name=file_info_strdup(ls->dir_list, ads_name);
       }
       else
       {
-	new_file->name=strdup(filename);
+	new_file->name=file_info_strdup(ls->dir_list, filename);
       }
       td_list_add_tail(&new_file->list, &ls->dir_list->list);
-      first=0;
     }
     ntfs_attr_put_search_ctx(ctx);
-    if(first)
-    {
-      free(new_file);
-    }
   }
 
   result = 0;
@@ -330,12 +286,42 @@ static int ntfs_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *
     log_critical("ntfs_readdir BUG not MFT_RECORD_IS_DIRECTORY\n");
   /* Finished with the inode; release it. */
   ntfs_inode_close(inode);
-  td_list_sort(&dir_list->list, filesort);
+  sort_list_file(dir_list);
   return 0;
 }
 
 enum { bufsize = 4096 };
 
+/* Resolve where the data of a plain non-resident attribute is on the
+ * disk, return 0 on success */
+static int ntfs_get_extents(const ntfs_volume *vol, ntfs_attr *attr, const partition_t *partition, fextent_list_t *list)
+{
+  const runlist_element *rl;
+  if(!NAttrNonResident(attr) || NAttrCompressed(attr) || NAttrEncrypted(attr))
+    return -1;
+  if(ntfs_attr_map_whole_runlist(attr) < 0)
+    return -1;
+  for(rl=attr->rl; rl!=NULL && rl->length > 0; rl++)
+  {
+    const uint64_t file_offset=(uint64_t)rl->vcn * vol->cluster_size;
+    uint64_t size=(uint64_t)rl->length * vol->cluster_size;
+    if(rl->lcn == LCN_HOLE)
+      continue;
+    if(rl->lcn < 0)
+    {
+      fextent_free(list);
+      return -1;
+    }
+    /* Beyond the initialized size, the data reads as zeroes */
+    if(file_offset >= (uint64_t)attr->initialized_size)
+      break;
+    if(file_offset + size > (uint64_t)attr->initialized_size)
+      size=attr->initialized_size - file_offset;
+    fextent_add(list, file_offset, partition->part_offset + (uint64_t)rl->lcn * vol->cluster_size, size);
+  }
+  return 0;
+}
+
 static copy_file_t ntfs_copy(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const file_info_t *file)
 {
   const unsigned long int first_inode=file->st_ino;
@@ -355,6 +341,7 @@ static copy_file_t ntfs_copy(disk_t *disk_car, const partition_t *partition, dir
     char *stream_name;
     s64 offset;
     u32 block_size;
+    fextent_list_t extents;
     buffer = (char *)MALLOC(bufsize);
     if (!buffer)
     {
@@ -415,35 +402,55 @@ static copy_file_t ntfs_copy(disk_t *disk_car, const partition_t *partition, dir
       ntfs_inode_close(inode);
       return CP_CREATE_FAILED;
     }
-    offset = 0;
-    for (;;)
+    fextent_init(&extents);
+    if(block_size == 0 && ntfs_get_extents(ls->vol, attr, partition, &extents) == 0)
     {
-      s64 bytes_read, written;
-      if (block_size > 0) {
-	// These types have fixup
-	bytes_read = ntfs_attr_mst_pread(attr, offset, 1, block_size, buffer);
-	bytes_read *= block_size;
-      } else {
-	bytes_read = ntfs_attr_pread(attr, offset, bufsize, buffer);
-      }
-      //ntfs_log_info("read %lld bytes\n", bytes_read);
-      if (bytes_read < 0) {
+      /* Read the clusters straight from the disk */
+      const int copy=fextent_copy(disk_car, &extents, attr->data_size, f_out);
+      if(copy == -1)
+      {
 	log_error("ERROR: Couldn't read file");
 	res=CP_READ_FAILED;
-	break;
       }
-      if (!bytes_read)
-	break;
-
-      written = fwrite(buffer, 1, bytes_read, f_out);
-      if (written != bytes_read)
+      else if(copy < 0)
       {
 	log_error("ERROR: Couldn't output all data!");
 	res=CP_NOSPACE;
-	break;
       }
-      offset += bytes_read;
     }
+    else
+    {
+      offset = 0;
+      for (;;)
+      {
+	s64 bytes_read, written;
+	if (block_size > 0) {
+	  // These types have fixup
+	  bytes_read = ntfs_attr_mst_pread(attr, offset, 1, block_size, buffer);
+	  bytes_read *= block_size;
+	} else {
+	  bytes_read = ntfs_attr_pread(attr, offset, bufsize, buffer);
+	}
+	//ntfs_log_info("read %lld bytes\n", bytes_read);
+	if (bytes_read < 0) {
+	  log_error("ERROR: Couldn't read file");
+	  res=CP_READ_FAILED;
+	  break;
+	}
+	if (!bytes_read)
+	  break;
+
+	written = fwrite(buffer, 1, bytes_read, f_out);
+	if (written != bytes_read)
+	{
+	  log_error("ERROR: Couldn't output all data!");
+	  res=CP_NOSPACE;
+	  break;
+	}
+	offset += bytes_read;
+      }
+    }
+    fextent_free(&extents);
     fclose(f_out);
     set_date(new_file, file->td_atime, file->td_mtime);
     free(new_file);
@@ -461,10 +468,6 @@ static void dir_partition_ntfs_close(dir_data_t *dir_data)
   /* ntfs_umount() will invoke ntfs_device_free() for us. */
   ntfs_umount(ls->vol, FALSE);
   free(ls->my_data);
-#ifdef HAVE_ICONV
-  if (ls->cd != (iconv_t)(-1))
-    iconv_close(ls->cd);
-#endif
   free(ls);
 }
 #endif
@@ -522,12 +525,6 @@ dir_partition_t dir_partition_ntfs_init(disk_t *disk_car, const partition_t *par
     ls->vol=vol;
     ls->my_data=my_data;
     ls->dir_data=dir_data;
-#ifdef HAVE_ICONV
-    if ((ls->cd = iconv_open("UTF-8", "UTF-16LE")) == (iconv_t)(-1))
-    {
-      log_error("ntfs_ucstoutf8: iconv_open failed\n");
-    }
-#endif
     strncpy(dir_data->current_directory,"/",sizeof(dir_data->current_directory));
     dir_data->current_inode=FILE_root;
     dir_data->param=FLAG_LIST_ADS;
@@ -181,7 +181,7 @@ int repair_MFT(disk_t *disk_car, partition_t *partition, const int verbose, cons
     if(res1==DIR_PART_OK)
     {
       file_info_t dir_list;
-      TD_INIT_LIST_HEAD(&dir_list.list);
+      init_list_file(&dir_list);
       dir_data.get_dir(disk_car,partition,&dir_data,dir_data.current_inode, &dir_list);
       if(!td_list_empty(&dir_list.list))
       {
@@ -199,7 +199,7 @@ int repair_MFT(disk_t *disk_car, partition_t *partition, const int verbose, cons
     if(res2==DIR_PART_OK)
     {
       file_info_t dir_list;
-      TD_INIT_LIST_HEAD(&dir_list.list);
+      init_list_file(&dir_list);
       dir_data.get_dir(disk_car,partition,&dir_data,dir_data.current_inode, &dir_list);
       if(!td_list_empty(&dir_list.list))
       {
@@ -32,9 +32,6 @@ struct ntfs_dir_struct {
 	my_data_t *my_data;
 	dir_data_t *dir_data;
 	unsigned long int inode;
-#ifdef HAVE_ICONV
-        iconv_t cd;
-#endif
 };
 #endif
 
@@ -59,12 +59,16 @@
 #include <stdio.h>
 #include "types.h"
 #include "common.h"
+#include "hdcache.h"
 #include "log.h"
 
 #if defined(linux) && defined(_IO) && !defined(BLKGETSIZE)
 #	define BLKGETSIZE _IO(0x12,96) /* Get device size in 512byte blocks. */
 #endif
 
+/* The MFT records, index blocks and bitmaps are read one by one */
+static diskcache_readahead_t ntfs_readahead;
+
 static int ntfs_device_testdisk_io_open(struct ntfs_device *dev, int flags)
 {
 	if (NDevOpen(dev)) {
@@ -76,6 +80,7 @@ static int ntfs_device_testdisk_io_open(struct ntfs_device *dev, int flags)
 		NDevSetReadOnly(dev);
 	/* Set our open flag. */
 	NDevSetOpen(dev);
+	diskcache_readahead_init(&ntfs_readahead);
 	return 0;
 }
 
@@ -112,6 +117,7 @@ static s64 ntfs_device_testdisk_io_read(struct ntfs_device *dev, void *buf,
 		s64 count)
 {
   my_data_t *my_data=(my_data_t*)dev->d_private;
+  diskcache_readahead(my_data->disk_car, &ntfs_readahead, my_data->partition->part_offset + my_data->offset, count);
   if(my_data->disk_car->pread(my_data->disk_car, buf, count, my_data->partition->part_offset + my_data->offset) != count)
     return 0;
   my_data->offset+=count;
@@ -122,6 +128,7 @@ static s64 ntfs_device_testdisk_io_write(struct ntfs_device *dev, const void *bu
 		s64 count)
 {
   my_data_t *my_data=(my_data_t*)dev->d_private;
+  diskcache_readahead_init(&ntfs_readahead);
   if(my_data->disk_car->pwrite(my_data->disk_car, buf, count, my_data->partition->part_offset + my_data->offset) != count)
     return 0;
   my_data->offset+=count;
@@ -132,6 +139,7 @@ static s64 ntfs_device_testdisk_io_pread(struct ntfs_device *dev, void *buf,
     s64 count, s64 offset)
 {
   my_data_t *my_data=(my_data_t*)dev->d_private;
+  diskcache_readahead(my_data->disk_car, &ntfs_readahead, my_data->partition->part_offset + offset, count);
   return my_data->disk_car->pread(my_data->disk_car, buf, count,
       my_data->partition->part_offset + offset);
 }
@@ -140,6 +148,7 @@ static s64 ntfs_device_testdisk_io_pwrite(struct ntfs_device *dev, const void *b
                 s64 count, s64 offset)
 {
   my_data_t *my_data=(my_data_t*)dev->d_private;
+  diskcache_readahead_init(&ntfs_readahead);
   return my_data->disk_car->pwrite(my_data->disk_car, buf, count,
       my_data->partition->part_offset + offset);
 }
@@ -147,6 +156,7 @@ static s64 ntfs_device_testdisk_io_pwrite(struct ntfs_device *dev, const void *b
 static int ntfs_device_testdisk_io_sync(struct ntfs_device *dev)
 {
   my_data_t *my_data=(my_data_t*)dev->d_private;
+  diskcache_readahead_init(&ntfs_readahead);
   return my_data->disk_car->sync(my_data->disk_car);
 }
 
@@ -0,0 +1,395 @@
+/*
+
+    File: ntfs_mft.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "ntfs_struct.h"
+#include "ntfs.h"
+#include "dir.h"
+#include "ntfs_mft.h"
+#include "log.h"
+
+#define NTFS_MFT_ROOT		5
+#define NTFS_MFT_FIRST_USER	16
+#define NTFS_MFT_RECORD_MAX	4096
+#define NTFS_MFT_READ_SIZE	(1024*1024)
+#define NTFS_MFT_IN_USE		1
+#define NTFS_MFT_IS_DIRECTORY	2
+#define NTFS_FILE_NAME_DOS	2
+
+#ifndef DISABLED_FOR_FRAMAC
+struct ntfs_mft_entry
+{
+  uint32_t record;
+  uint32_t parent;
+  uint64_t lsn;
+  uint64_t size;
+  time_t mtime;
+  unsigned int status;
+  unsigned int directory;
+  char *name;
+};
+
+struct ntfs_mft_dir_struct
+{
+  struct ntfs_mft_entry *entries;	/* sorted by record number */
+  unsigned int nbr;
+  unsigned int allocated;
+  unsigned int *children;		/* entries sorted by parent and name */
+};
+
+/* Convert a UTF-16LE name to UTF-8, dst must hold 3*len+1 bytes */
+static void ntfs_mft_name(char *dst, const unsigned char *src, const unsigned int len)
+{
+  unsigned int i;
+  for(i=0; i<len; i++)
+  {
+    unsigned int c=src[2*i] | (src[2*i+1]<<8);
+    if(c>=0xd800 && c<0xdc00 && i+1<len)
+    {
+      const unsigned int c2=src[2*i+2] | (src[2*i+3]<<8);
+      if(c2>=0xdc00 && c2<0xe000)
+      {
+	c=0x10000 + ((c-0xd800)<<10) + (c2-0xdc00);
+	i++;
+	*dst++=0xf0 | (c>>18);
+	*dst++=0x80 | ((c>>12) & 0x3f);
+	*dst++=0x80 | ((c>>6) & 0x3f);
+	*dst++=0x80 | (c & 0x3f);
+	continue;
+      }
+    }
+    if(c==0 || c=='/')
+      *dst++='_';
+    else if(c<0x80)
+      *dst++=c;
+    else if(c<0x800)
+    {
+      *dst++=0xc0 | (c>>6);
+      *dst++=0x80 | (c & 0x3f);
+    }
+    else
+    {
+      *dst++=0xe0 | (c>>12);
+      *dst++=0x80 | ((c>>6) & 0x3f);
+      *dst++=0x80 | (c & 0x3f);
+    }
+  }
+  *dst='\0';
+}
+
+/* Check the record header and apply the update sequence array in place,
+ * return the record size or 0 if it isn't a valid base MFT record */
+static unsigned int ntfs_mft_fixup(unsigned char *record, const unsigned int max_size)
+{
+  const struct ntfs_mft_record *mft_rec=(const struct ntfs_mft_record *)record;
+  const unsigned int usa_ofs=le16(mft_rec->usa_ofs);
+  const unsigned int usa_count=le16(mft_rec->usa_count);
+  const unsigned int attrs_offset=le16(mft_rec->attrs_offset);
+  const unsigned int bytes_in_use=le32(mft_rec->bytes_in_use);
+  const unsigned int bytes_allocated=le32(mft_rec->bytes_allocated);
+  unsigned int i;
+  /* Only NTFS 3.1+ records store their own record number */
+  if(usa_ofs < 0x30 || usa_ofs%2!=0 ||
+      usa_ofs + 2*usa_count > attrs_offset ||
+      attrs_offset%8!=0 || attrs_offset >= bytes_in_use ||
+      bytes_in_use > bytes_allocated ||
+      (bytes_allocated!=1024 && bytes_allocated!=2048 && bytes_allocated!=4096) ||
+      bytes_allocated > max_size ||
+      usa_count != bytes_allocated/512 + 1 ||
+      le64(mft_rec->base_mft_record)!=0)
+    return 0;
+  for(i=1; i<usa_count; i++)
+  {
+    unsigned char *end=&record[i*512-2];
+    if(end[0]!=record[usa_ofs] || end[1]!=record[usa_ofs+1])
+      return 0;	/* torn write */
+    end[0]=record[usa_ofs+2*i];
+    end[1]=record[usa_ofs+2*i+1];
+  }
+  return bytes_allocated;
+}
+
+static void ntfs_mft_parse(struct ntfs_mft_dir_struct *ls, const unsigned char *record, const unsigned int record_size)
+{
+  const struct ntfs_mft_record *mft_rec=(const struct ntfs_mft_record *)record;
+  const char *end=(const char *)record + le32(mft_rec->bytes_in_use);
+  const ntfs_attribheader *attrib;
+  const TD_FILE_NAME_ATTR *file_name=NULL;
+  struct ntfs_mft_entry *entry;
+  if((const unsigned char *)end > record + record_size)
+    return;
+  for(attrib=ntfs_findattribute((const ntfs_recordheader*)record, 0x30, end);
+      attrib!=NULL;
+      attrib=ntfs_nextattribute(attrib, 0x30, end))
+  {
+    const TD_FILE_NAME_ATTR *tmp;
+    if(attrib->bNonResident!=0)
+      continue;
+    tmp=(const TD_FILE_NAME_ATTR *)ntfs_getattributedata((const ntfs_attribresident *)attrib, end);
+    if(tmp==NULL ||
+	(const char *)tmp + sizeof(TD_FILE_NAME_ATTR) + 2*tmp->file_name_length > end)
+      continue;
+    /* Prefer the long name to the DOS 8.3 one */
+    if(file_name==NULL || file_name->file_name_type==NTFS_FILE_NAME_DOS)
+      file_name=tmp;
+  }
+  if(file_name==NULL || file_name->file_name_length==0)
+    return;
+  if(ls->nbr==ls->allocated)
+  {
+    ls->allocated=(ls->allocated < 1024 ? 1024 : 2 * ls->allocated);
+    ls->entries=(struct ntfs_mft_entry *)realloc(ls->entries, ls->allocated * sizeof(struct ntfs_mft_entry));
+    if(ls->entries==NULL)
+    {
+      log_critical("ntfs_mft_parse: not enough memory\n");
+      exit(1);
+    }
+  }
+  entry=&ls->entries[ls->nbr++];
+  entry->record=le32(mft_rec->mft_record_number);
+  entry->parent=le64(file_name->parent_directory) & 0xffffffff;
+  entry->lsn=le64(mft_rec->lsn);
+  entry->size=le64(file_name->data_size);
+  entry->mtime=td_ntfs2utc(le64(file_name->last_data_change_time));
+  entry->status=((le16(mft_rec->flags) & NTFS_MFT_IN_USE)!=0 ? 0 : FILE_STATUS_DELETED);
+  entry->directory=((le16(mft_rec->flags) & NTFS_MFT_IS_DIRECTORY)!=0);
+  entry->name=(char *)MALLOC(3 * file_name->file_name_length + 1);
+  ntfs_mft_name(entry->name, (const unsigned char *)file_name + sizeof(TD_FILE_NAME_ATTR), file_name->file_name_length);
+  /* $FILE_NAME sizes are only updated on rename, prefer the $DATA one */
+  attrib=ntfs_findattribute((const ntfs_recordheader*)record, 0x80, end);
+  if(attrib!=NULL && attrib->cName==0)
+  {
+    if(attrib->bNonResident==0)
+      entry->size=le32(((const ntfs_attribresident *)attrib)->cbAttribData);
+    else if(le64(((const ntfs_attribnonresident *)attrib)->startVCN)==0)
+      entry->size=le64(((const ntfs_attribnonresident *)attrib)->cbAttribData);
+  }
+  attrib=ntfs_findattribute((const ntfs_recordheader*)record, 0x10, end);
+  if(attrib!=NULL && attrib->bNonResident==0)
+  {
+    const char *si=ntfs_getattributedata((const ntfs_attribresident *)attrib, end);
+    if(si!=NULL && si + 16 <= end)
+      entry->mtime=td_ntfs2utc(NTFS_GETU64(si + 8));
+  }
+}
+
+/* Same record found several times (old copies, $MFTMirr...): keep the
+ * record in use, then the most recent one */
+static int ntfs_mft_record_cmp(const void *a, const void *b)
+{
+  const struct ntfs_mft_entry *entry_a=(const struct ntfs_mft_entry *)a;
+  const struct ntfs_mft_entry *entry_b=(const struct ntfs_mft_entry *)b;
+  if(entry_a->record != entry_b->record)
+    return (entry_a->record < entry_b->record ? -1 : 1);
+  if(entry_a->status != entry_b->status)
+    return (entry_a->status < entry_b->status ? -1 : 1);
+  if(entry_a->lsn != entry_b->lsn)
+    return (entry_a->lsn > entry_b->lsn ? -1 : 1);
+  return 0;
+}
+
+static const struct ntfs_mft_entry *ntfs_mft_children_base;
+
+static int ntfs_mft_children_cmp(const void *a, const void *b)
+{
+  const struct ntfs_mft_entry *entry_a=&ntfs_mft_children_base[*(const unsigned int *)a];
+  const struct ntfs_mft_entry *entry_b=&ntfs_mft_children_base[*(const unsigned int *)b];
+  if(entry_a->parent != entry_b->parent)
+    return (entry_a->parent < entry_b->parent ? -1 : 1);
+  return strcmp(entry_a->name, entry_b->name);
+}
+
+static const struct ntfs_mft_entry *ntfs_mft_find(const struct ntfs_mft_dir_struct *ls, const uint32_t record)
+{
+  unsigned int low=0;
+  unsigned int high=ls->nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(ls->entries[mid].record < record)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  if(low < ls->nbr && ls->entries[low].record==record)
+    return &ls->entries[low];
+  return NULL;
+}
+
+static void ntfs_mft_build_tree(struct ntfs_mft_dir_struct *ls)
+{
+  unsigned int i;
+  unsigned int j;
+  qsort(ls->entries, ls->nbr, sizeof(struct ntfs_mft_entry), ntfs_mft_record_cmp);
+  for(i=0, j=0; i<ls->nbr; i++)
+  {
+    if(j>0 && ls->entries[j-1].record==ls->entries[i].record)
+      free(ls->entries[i].name);
+    else
+      ls->entries[j++]=ls->entries[i];
+  }
+  ls->nbr=j;
+  /* Files whose parent directory is lost go to the root directory */
+  for(i=0; i<ls->nbr; i++)
+  {
+    struct ntfs_mft_entry *entry=&ls->entries[i];
+    const struct ntfs_mft_entry *parent=ntfs_mft_find(ls, entry->parent);
+    if(entry->record==NTFS_MFT_ROOT)
+      entry->parent=NTFS_MFT_ROOT;
+    else if(parent==NULL || parent->directory==0 || entry->parent==entry->record)
+      entry->parent=NTFS_MFT_ROOT;
+  }
+  ls->children=(unsigned int *)MALLOC((ls->nbr + 1) * sizeof(unsigned int));
+  for(i=0; i<ls->nbr; i++)
+    ls->children[i]=i;
+  ntfs_mft_children_base=ls->entries;
+  qsort(ls->children, ls->nbr, sizeof(unsigned int), ntfs_mft_children_cmp);
+}
+
+static int ntfs_mft_get_dir(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const unsigned long int first_inode, file_info_t *dir_list)
+{
+  const struct ntfs_mft_dir_struct *ls=(const struct ntfs_mft_dir_struct *)dir_data->private_dir_data;
+  unsigned int low=0;
+  unsigned int high=ls->nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(ls->entries[ls->children[mid]].parent < first_inode)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  for(; low < ls->nbr && ls->entries[ls->children[low]].parent==first_inode; low++)
+  {
+    const struct ntfs_mft_entry *entry=&ls->entries[ls->children[low]];
+    file_info_t *new_file;
+    if(entry->record==first_inode)
+      continue;
+    if(entry->status!=0 && (dir_data->param & FLAG_LIST_DELETED)==0)
+      continue;
+    if(entry->record < NTFS_MFT_FIRST_USER && (dir_data->param & FLAG_LIST_SYSTEM)==0)
+      continue;
+    new_file=file_info_new(dir_list, entry->name);
+    new_file->st_ino=entry->record;
+    new_file->st_mode=(entry->directory!=0 ?
+	LINUX_S_IFDIR | LINUX_S_IRUGO | LINUX_S_IXUGO :
+	LINUX_S_IFREG | LINUX_S_IRUGO);
+    new_file->st_uid=0;
+    new_file->st_gid=0;
+    new_file->st_size=entry->size;
+    new_file->td_atime=new_file->td_ctime=new_file->td_mtime=entry->mtime;
+    new_file->status=entry->status;
+    td_list_add_tail(&new_file->list, &dir_list->list);
+  }
+  sort_list_file(dir_list);
+  return 0;
+}
+
+static void dir_partition_ntfs_mft_close(dir_data_t *dir_data)
+{
+  struct ntfs_mft_dir_struct *ls=(struct ntfs_mft_dir_struct *)dir_data->private_dir_data;
+  unsigned int i;
+  for(i=0; i<ls->nbr; i++)
+    free(ls->entries[i].name);
+  free(ls->entries);
+  free(ls->children);
+  free(ls);
+}
+#endif
+
+dir_partition_t dir_partition_ntfs_mft_init(disk_t *disk_car, const partition_t *partition, dir_data_t *dir_data, const int verbose, const int expert)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct ntfs_mft_dir_struct *ls;
+  unsigned char *buffer;
+  uint64_t offset;
+  const unsigned int stride=(disk_car->sector_size >= 512 ? disk_car->sector_size : 512);
+  ls=(struct ntfs_mft_dir_struct *)MALLOC(sizeof(*ls));
+  ls->entries=NULL;
+  ls->nbr=0;
+  ls->allocated=0;
+  ls->children=NULL;
+  /* Overlap the reads so a record crossing a boundary is seen entirely */
+  buffer=(unsigned char *)MALLOC(NTFS_MFT_READ_SIZE + NTFS_MFT_RECORD_MAX);
+  for(offset=0; offset < partition->part_size; offset+=NTFS_MFT_READ_SIZE)
+  {
+    unsigned char record[NTFS_MFT_RECORD_MAX];
+    unsigned int i;
+    unsigned int read_size=NTFS_MFT_READ_SIZE + NTFS_MFT_RECORD_MAX;
+    if(offset + read_size > partition->part_size)
+      read_size=partition->part_size - offset;
+    if((unsigned)disk_car->pread(disk_car, buffer, read_size, partition->part_offset + offset) != read_size)
+      continue;
+    for(i=0; i < NTFS_MFT_READ_SIZE && i + 1024 <= read_size; i+=stride)
+    {
+      unsigned int record_size;
+      if(NTFS_GETU32(&buffer[i])!=NTFS_Magic)
+	continue;
+      record_size=(read_size - i < NTFS_MFT_RECORD_MAX ? read_size - i : NTFS_MFT_RECORD_MAX);
+      memcpy(record, &buffer[i], record_size);
+      record_size=ntfs_mft_fixup(record, record_size);
+      if(record_size>0)
+	ntfs_mft_parse(ls, record, record_size);
+    }
+  }
+  free(buffer);
+  if(ls->nbr==0)
+  {
+    free(ls->entries);
+    free(ls);
+    return DIR_PART_EIO;
+  }
+  ntfs_mft_build_tree(ls);
+  log_info("NTFS: %u MFT records found by scanning the partition\n", ls->nbr);
+  strncpy(dir_data->current_directory,"/",sizeof(dir_data->current_directory));
+  dir_data->current_inode=NTFS_MFT_ROOT;
+  dir_data->param=FLAG_LIST_DELETED;
+  if(expert!=0)
+    dir_data->param|=FLAG_LIST_SYSTEM;
+  dir_data->verbose=verbose;
+  dir_data->capabilities=CAPA_LIST_DELETED;
+  dir_data->get_dir=&ntfs_mft_get_dir;
+  dir_data->copy_file=NULL;
+  dir_data->close=&dir_partition_ntfs_mft_close;
+  dir_data->local_dir=NULL;
+  dir_data->private_dir_data=ls;
+  return DIR_PART_OK;
+#else
+  return DIR_PART_ENOSYS;
+#endif
+}
@@ -72,7 +72,6 @@
 #endif
 
 #include "list.h"
-#include "list_sort.h"
 #include "log.h"
 #include "log_part.h"
 #include "ntfs_udl.h"
@@ -112,6 +111,7 @@
 #include "ntfs_inc.h"
 #include "ntfs_dir.h"
 #include "ntfs_utl.h"
+#include "hdaccess.h"
 #include "askloc.h"
 #include "setdate.h"
 
@@ -166,6 +166,16 @@ struct ufile {
 	MFT_RECORD	*mft;		/* Raw MFT record */
 };
 
+/* Clusters read at once when undeleting a file */
+#define NTFS_UDL_READ_CLUSTERS 64
+/* MFT records read at once when scanning the MFT */
+#define NTFS_UDL_MFT_BATCH 256
+
+struct ntfs_copy {
+	file_info_t	*file_info;
+	uint64_t	 lcn;		/* First cluster of the data */
+};
+
 static const char *UNKNOWN   = "unknown";
 static struct options opts;
 
@@ -514,53 +524,30 @@ static int get_data(struct ufile *file, const ntfs_volume *vol)
 }
 
 /**
- * read_record - Read an MFT record into memory
+ * parse_record - Gather the information of an MFT record
  * @vol:     An ntfs volume obtained from ntfs_mount
- * @record:  The record number to read
- *
- * Read the specified MFT record and gather as much information about it as
- * possible.
+ * @record:  The record number
+ * @mft:     The raw MFT record, the returned object takes ownership of it
  *
  * Return:  Pointer  A ufile object containing the results
  *	    NULL     Error
  */
-static struct ufile * read_record(ntfs_volume *vol, uint64_t record)
+static struct ufile * parse_record(ntfs_volume *vol, uint64_t record, MFT_RECORD *mft)
 {
 	ATTR_RECORD *attr10, *attr20, *attr90;
 	struct ufile *file;
-	ntfs_attr *mft;
-
-	if (!vol)
-		return NULL;
 
 	file = (struct ufile *)calloc(1, sizeof(*file));
 	if (!file) {
-		log_error("ERROR: Couldn't allocate memory in read_record()\n");
+		log_error("ERROR: Couldn't allocate memory in parse_record()\n");
+		free(mft);
 		return NULL;
 	}
 
 	TD_INIT_LIST_HEAD(&file->name);
 	TD_INIT_LIST_HEAD(&file->data);
 	file->inode = record;
-
-	file->mft = (MFT_RECORD *)MALLOC(vol->mft_record_size);
-
-	mft = ntfs_attr_open(vol->mft_ni, AT_DATA, AT_UNNAMED, 0);
-	if (!mft) {
-		log_error("ERROR: Couldn't open $MFT/$DATA\n");
-		free_file(file);
-		return NULL;
-	}
-
-	if (ntfs_attr_mst_pread(mft, vol->mft_record_size * record, 1, vol->mft_record_size, file->mft) < 1) {
-		log_error("ERROR: Couldn't read MFT Record %llu.\n", (long long unsigned)record);
-		ntfs_attr_close(mft);
-		free_file(file);
-		return NULL;
-	}
-
-	ntfs_attr_close(mft);
-	mft = NULL;
+	file->mft = mft;
 
 	attr10 = find_first_attribute(AT_STANDARD_INFORMATION,	file->mft);
 	attr20 = find_first_attribute(AT_ATTRIBUTE_LIST,	file->mft);
@@ -590,6 +577,113 @@ static struct ufile * read_record(ntfs_volume *vol, uint64_t record)
 	return file;
 }
 
+/**
+ * read_record - Read an MFT record into memory
+ * @vol:     An ntfs volume obtained from ntfs_mount
+ * @record:  The record number to read
+ *
+ * Read the specified MFT record and gather as much information about it as
+ * possible.
+ *
+ * Return:  Pointer  A ufile object containing the results
+ *	    NULL     Error
+ */
+static struct ufile * read_record(ntfs_volume *vol, uint64_t record)
+{
+	MFT_RECORD *raw;
+	ntfs_attr *mft;
+
+	if (!vol)
+		return NULL;
+
+	raw = (MFT_RECORD *)MALLOC(vol->mft_record_size);
+
+	mft = ntfs_attr_open(vol->mft_ni, AT_DATA, AT_UNNAMED, 0);
+	if (!mft) {
+		log_error("ERROR: Couldn't open $MFT/$DATA\n");
+		free(raw);
+		return NULL;
+	}
+
+	if (ntfs_attr_mst_pread(mft, vol->mft_record_size * record, 1, vol->mft_record_size, raw) < 1) {
+		log_error("ERROR: Couldn't read MFT Record %llu.\n", (long long unsigned)record);
+		ntfs_attr_close(mft);
+		free(raw);
+		return NULL;
+	}
+
+	ntfs_attr_close(mft);
+	return parse_record(vol, record, raw);
+}
+
+/**
+ * mft_advise_batch - Announce the read of a batch of MFT records
+ * @vol:     An ntfs volume obtained from ntfs_mount
+ * @mft:     $MFT/$DATA, its runlist already mapped by the reads
+ * @record:  The first record of the batch
+ * @disk:    The disk of the volume
+ * @partition:  The partition of the volume
+ *
+ * The runs of $MFT holding the batch are given to disk_advise().
+ */
+static void mft_advise_batch(const ntfs_volume *vol, const ntfs_attr *mft, const uint64_t record, disk_t *disk, const partition_t *partition)
+{
+	const uint64_t start = record * vol->mft_record_size;
+	const uint64_t end = start + (uint64_t)NTFS_UDL_MFT_BATCH * vol->mft_record_size;
+	const runlist_element *rl;
+	for (rl = mft->rl; rl != NULL && rl->length > 0; rl++) {
+		const uint64_t run_start = (uint64_t)rl->vcn * vol->cluster_size;
+		const uint64_t run_end = run_start + (uint64_t)rl->length * vol->cluster_size;
+		uint64_t from;
+		uint64_t to;
+		if (rl->lcn < 0 || run_end <= start)
+			continue;
+		if (run_start >= end)
+			break;
+		from = (start > run_start ? start : run_start);
+		to = (end < run_end ? end : run_end);
+		disk_advise(disk, partition->part_offset + (uint64_t)rl->lcn * vol->cluster_size + (from - run_start),
+				to - from, TESTDISK_ADVISE_WILLNEED);
+	}
+}
+
+/**
+ * read_record_cached - Read an MFT record through a cache of records
+ * @vol:     An ntfs volume obtained from ntfs_mount
+ * @mft:     $MFT/$DATA, opened by the caller
+ * @cache:   Room for NTFS_UDL_MFT_BATCH records
+ * @cache_first:  First record in the cache
+ * @cache_nbr:    Number of records in the cache
+ * @record:  The record number to read
+ * @disk:    The disk of the volume
+ * @partition:  The partition of the volume
+ *
+ * When scanning the whole MFT, reading the records one by one costs an
+ * attribute lookup and a small read each. Instead, read the records by
+ * batches of NTFS_UDL_MFT_BATCH and parse them from memory. The disk is
+ * told to load the next batch while the current one is parsed.
+ *
+ * Return:  Pointer  A ufile object containing the results
+ *	    NULL     Error
+ */
+static struct ufile * read_record_cached(ntfs_volume *vol, ntfs_attr *mft, char *cache, uint64_t *cache_first, uint64_t *cache_nbr, uint64_t record, disk_t *disk, const partition_t *partition)
+{
+	MFT_RECORD *raw;
+	if (record < *cache_first || record >= *cache_first + *cache_nbr) {
+		int64_t nbr;
+		*cache_first = record;
+		nbr = ntfs_attr_mst_pread(mft, vol->mft_record_size * record,
+				NTFS_UDL_MFT_BATCH, vol->mft_record_size, cache);
+		*cache_nbr = (nbr < 0 ? 0 : nbr);
+		if (*cache_nbr == 0)
+			return read_record(vol, record);
+		mft_advise_batch(vol, mft, record + *cache_nbr, disk, partition);
+	}
+	raw = (MFT_RECORD *)MALLOC(vol->mft_record_size);
+	memcpy(raw, cache + (record - *cache_first) * vol->mft_record_size, vol->mft_record_size);
+	return parse_record(vol, record, raw);
+}
+
 /**
  * calc_percentage - Calculate how much of the file is recoverable
  * @file:  The file object to work with
@@ -868,7 +962,7 @@ static int undelete_file(ntfs_volume *vol, uint64_t inode)
 
 
   bufsize = vol->cluster_size;
-  buffer = (char *)MALLOC(bufsize);
+  buffer = (char *)MALLOC(bufsize * NTFS_UDL_READ_CLUSTERS);
 
   /* calc_percentage() must be called before 
    * list_record(). Otherwise, when undeleting, a file will always be
@@ -1002,35 +1096,23 @@ static int undelete_file(ntfs_volume *vol, uint64_t inode)
 	start = rl[i].lcn;
 	end   = rl[i].lcn + rl[i].length;
 
-	for (j = start; j < end; j++)
+	/* Don't check if clusters are in used or not,
+	 * read the run by chunks of NTFS_UDL_READ_CLUSTERS clusters */
+	for (j = start; j < end; )
 	{
-	  /* Don't check if clusters are in used or not */
-#if 0
-	  if (utils_cluster_in_use(vol, j) && !opts.optimistic)
-	  {
-	    memset(buffer, 0, bufsize);
-	    if (write_data(fd, buffer, bufsize) < bufsize)
-	    {
-	      log_error("Write failed\n");
-	      close(fd);
-	      goto free;
-	    }
+	  const uint64_t count = (end - j < NTFS_UDL_READ_CLUSTERS ? end - j : NTFS_UDL_READ_CLUSTERS);
+	  if (ntfs_cluster_read(vol, j, count, buffer) < (s64)count) {
+	    log_error("Read failed\n");
+	    close(fd);
+	    goto free;
 	  }
-	  else
-#endif
-	  {
-	    if (ntfs_cluster_read(vol, j, 1, buffer) < 1) {
-	      log_error("Read failed\n");
-	      close(fd);
-	      goto free;
-	    }
-	    if (write_data(fd, buffer, bufsize) < bufsize) {
-	      log_error("Write failed\n");
-	      close(fd);
-	      goto free;
-	    }
-	    cluster_count++;
+	  if (write_data(fd, buffer, count * bufsize) < count * bufsize) {
+	    log_error("Write failed\n");
+	    close(fd);
+	    goto free;
 	  }
+	  cluster_count += count;
+	  j += count;
 	}
       }
 
@@ -1073,21 +1155,104 @@ free:
   return -2;
 }
 
-static file_info_t *ufile_to_file_data(const struct ufile *file, const struct data *d)
+/**
+ * file_first_lcn - Locate the data of a deleted file
+ * @vol:    An ntfs volume obtained from ntfs_mount
+ * @inode:  The MFT record number
+ *
+ * Return:  The first cluster of the first non-resident data stream,
+ *	    the $MFT one if the data is resident or can't be located
+ */
+static uint64_t file_first_lcn(ntfs_volume *vol, uint64_t inode)
 {
-  file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
+  struct ufile *file;
+  struct td_list_head *item;
+  uint64_t lcn = vol->mft_lcn;
+  file = read_record(vol, inode);
+  if (!file)
+    return lcn;
+  td_list_for_each(item, &file->data) {
+    const struct data *d = td_list_entry(item, struct data, list);
+    int i;
+    if (d->resident || !d->runlist)
+      continue;
+    for (i = 0; d->runlist[i].length > 0; i++) {
+      if (d->runlist[i].lcn >= 0) {
+	lcn = d->runlist[i].lcn;
+	free_file(file);
+	return lcn;
+      }
+    }
+  }
+  free_file(file);
+  return lcn;
+}
+
+static int ntfs_copy_cmp(const void *a, const void *b)
+{
+  const struct ntfs_copy *copy_a = (const struct ntfs_copy *)a;
+  const struct ntfs_copy *copy_b = (const struct ntfs_copy *)b;
+  if (copy_a->lcn != copy_b->lcn)
+    return (copy_a->lcn < copy_b->lcn ? -1 : 1);
+  if (copy_a->file_info->st_ino != copy_b->file_info->st_ino)
+    return (copy_a->file_info->st_ino < copy_b->file_info->st_ino ? -1 : 1);
+  return 0;
+}
+
+/**
+ * ntfs_copy_schedule - Order the files to undelete by disk location
+ * @vol:       An ntfs volume obtained from ntfs_mount
+ * @dir_list:  The deleted files
+ * @marked:    Only keep the files with FILE_STATUS_MARKED if non-zero
+ * @nbr:       Store the number of files here
+ *
+ * Locate the data of every file up front and sort the files by their first
+ * cluster, the copy then reads the disk in ascending order instead of
+ * seeking back and forth in MFT order.
+ *
+ * Return:  An array of @nbr entries to free()
+ */
+static struct ntfs_copy *ntfs_copy_schedule(ntfs_volume *vol, file_info_t *dir_list, const int marked, unsigned int *nbr)
+{
+  struct td_list_head *file_walker = NULL;
+  struct ntfs_copy *copies;
+  unsigned int copies_nbr = 0;
+  td_list_for_each(file_walker, &dir_list->list)
+    copies_nbr++;
+  copies = (struct ntfs_copy *)MALLOC((copies_nbr + 1) * sizeof(struct ntfs_copy));
+  copies_nbr = 0;
+  td_list_for_each(file_walker, &dir_list->list)
+  {
+    file_info_t *file_info = td_list_entry(file_walker, file_info_t, list);
+    if (marked == 0 || (file_info->status&FILE_STATUS_MARKED)!=0)
+    {
+      copies[copies_nbr].file_info = file_info;
+      copies[copies_nbr].lcn = file_first_lcn(vol, file_info->st_ino);
+      copies_nbr++;
+    }
+  }
+  qsort(copies, copies_nbr, sizeof(struct ntfs_copy), ntfs_copy_cmp);
+  *nbr = copies_nbr;
+  return copies;
+}
+
+static file_info_t *ufile_to_file_data(file_info_t *dir_list, const struct ufile *file, const struct data *d)
+{
+  file_info_t *new_file=file_info_new(dir_list, NULL);
   char inode_name[32];
   const unsigned int len=(file->pref_pname==NULL?0:strlen(file->pref_pname)) +
     (file->pref_name==NULL?sizeof(inode_name):strlen(file->pref_name) + 1) +
     (d->name==NULL?0:strlen(d->name) + 1) + 1;
+  char *name=(char *)MALLOC(len);
   sprintf(inode_name, "inode_%llu", (long long unsigned)file->inode);
-  new_file->name=(char *)MALLOC(len);
-  sprintf(new_file->name, "%s%s%s%s%s",
+  sprintf(name, "%s%s%s%s%s",
       (file->pref_pname?file->pref_pname:""),
       (file->pref_pname?"/":""),
       (file->pref_name?file->pref_name:inode_name),
       (d->name?":":""),
       (d->name?d->name:""));
+  new_file->name=file_info_strdup(dir_list, name);
+  free(name);
   new_file->st_ino=file->inode;
   new_file->st_mode = (file->directory ?LINUX_S_IFDIR| LINUX_S_IRUGO | LINUX_S_IXUGO:LINUX_S_IFREG | LINUX_S_IRUGO);
   new_file->st_uid=0;
@@ -1101,6 +1266,8 @@ static file_info_t *ufile_to_file_data(const struct ufile *file, const struct da
 
 /**
  * scan_disk - Search an NTFS volume for files that could be undeleted
+ * @disk:  The disk of the volume
+ * @partition:  The partition of the volume
  * @vol:  An ntfs volume obtained from ntfs_mount
  *
  * Read through all the MFT entries looking for deleted files.  For each one
@@ -1109,7 +1276,7 @@ static file_info_t *ufile_to_file_data(const struct ufile *file, const struct da
  * The list can be filtered by name, size and date, using command line options.
  *
  */
-static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
+static void scan_disk(disk_t *disk, const partition_t *partition, ntfs_volume *vol, file_info_t *dir_list)
 {
   uint64_t nr_mft_records;
   const unsigned int BUFSIZE = 8192;
@@ -1119,6 +1286,10 @@ static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
   uint64_t bmpsize;
   uint64_t i;
   struct ufile *file;
+  ntfs_attr *mft;
+  char *cache;
+  uint64_t cache_first = 0;
+  uint64_t cache_nbr = 0;
   if (!vol)
     return;
 #ifdef NTFS_LOG_LEVEL_VERBOSE
@@ -1133,8 +1304,16 @@ static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
     return;
   }
   bmpsize = attr->initialized_size;
+  mft = ntfs_attr_open(vol->mft_ni, AT_DATA, AT_UNNAMED, 0);
+  if (!mft)
+  {
+    log_error("ERROR: Couldn't open $MFT/$DATA\n");
+    ntfs_attr_close(attr);
+    return;
+  }
 
   buffer = (char *) MALLOC(BUFSIZE);
+  cache = (char *) MALLOC(NTFS_UDL_MFT_BATCH * vol->mft_record_size);
 
   nr_mft_records = vol->mft_na->initialized_size >>
     vol->mft_record_size_bits;
@@ -1158,7 +1337,7 @@ static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
 	  goto done;
 	if (b & 1)
 	  continue;
-	file = read_record(vol, (i+j)*8+k);
+	file = read_record_cached(vol, mft, cache, &cache_first, &cache_nbr, (i+j)*8+k, disk, partition);
 	if (!file) {
 	  log_error("Couldn't read MFT Record %llu.\n", (long long unsigned)(i+j)*8+k);
 	  continue;
@@ -1172,7 +1351,7 @@ static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
 	  {
 	    const struct data *d = td_list_entry_const(item, const struct data, list);
 	    file_info_t *new_file;
-	    new_file=ufile_to_file_data(file, d);
+	    new_file=ufile_to_file_data(dir_list, file, d);
 	    if(new_file!=NULL)
 	    {
 	      td_list_add_tail(&new_file->list, &dir_list->list);
@@ -1186,9 +1365,11 @@ static void scan_disk(ntfs_volume *vol, file_info_t *dir_list)
   }
 done:
   log_info("\nFiles with potentially recoverable content: %u\n", results);
+  free(cache);
   free(buffer);
+  ntfs_attr_close(mft);
   ntfs_attr_close(attr);
-  td_list_sort(&dir_list->list, filesort);
+  sort_list_file(dir_list);
 }
 
 #ifdef HAVE_NCURSES
@@ -1548,12 +1729,13 @@ static void ntfs_undelete_menu_ncurses(const disk_t *disk_car, const partition_t
 	    wclrtoeol(window);
 	    wprintw(window,"Copying, please wait...");
 	    wrefresh(window);
-	    td_list_for_each(file_walker,&dir_list->list)
 	    {
-	      file_info_t *file_info;
-	      file_info=td_list_entry(file_walker, file_info_t, list);
-	      if((file_info->status&FILE_STATUS_MARKED)!=0)
+	      unsigned int i;
+	      unsigned int copies_nbr;
+	      struct ntfs_copy *copies=ntfs_copy_schedule(ls->vol, dir_list, 1, &copies_nbr);
+	      for(i=0; i<copies_nbr; i++)
 	      {
+		file_info_t *file_info=copies[i].file_info;
 		if(undelete_file(ls->vol, file_info->st_ino) < 0)
 		  file_bad++;
 		else
@@ -1566,6 +1748,7 @@ static void ntfs_undelete_menu_ncurses(const disk_t *disk_car, const partition_t
 		  wrefresh(window);
 		}
 	      }
+	      free(copies);
 	    }
 	    if(has_colors())
 	      wbkgdset(window,' ' | COLOR_PAIR(0));
@@ -1597,24 +1780,27 @@ static void ntfs_undelete_menu_ncurses(const disk_t *disk_car, const partition_t
 }
 #endif
 
-static void ntfs_undelete_cli(dir_data_t *dir_data, const file_info_t *dir_list)
+static void ntfs_undelete_cli(dir_data_t *dir_data, file_info_t *dir_list)
 {
   unsigned int file_ok=0;
   unsigned int file_bad=0;
-  const struct td_list_head *file_walker = NULL;
+  unsigned int i;
+  unsigned int copies_nbr;
+  struct ntfs_copy *copies;
   const struct ntfs_dir_struct *ls=(const struct ntfs_dir_struct *)dir_data->private_dir_data;
   char *dst_path;
   dst_path=get_default_location();
   dir_data->local_dir=dst_path;
   opts.dest=dst_path;
-  td_list_for_each(file_walker,&dir_list->list)
+  copies=ntfs_copy_schedule(ls->vol, dir_list, 0, &copies_nbr);
+  for(i=0; i<copies_nbr; i++)
   {
-    const file_info_t *file_info=td_list_entry_const(file_walker, const file_info_t, list);
-    if(undelete_file(ls->vol, file_info->st_ino) < 0)
+    if(undelete_file(ls->vol, copies[i].file_info->st_ino) < 0)
       file_bad++;
     else
       file_ok++;
   }
+  free(copies);
   log_info("NTFS undelete done (%u/%u)\n", file_ok, (file_ok+file_bad));
   free(dst_path);
   dir_data->local_dir=NULL;
@@ -1693,8 +1879,8 @@ int ntfs_undelete_part(disk_t *disk_car, const partition_t *partition, const int
       {
 	struct ntfs_dir_struct *ls=(struct ntfs_dir_struct *)dir_data.private_dir_data;
 	file_info_t dir_list;
-	TD_INIT_LIST_HEAD(&dir_list.list);
-	scan_disk(ls->vol, &dir_list);
+	init_list_file(&dir_list);
+	scan_disk(disk_car, partition, ls->vol, &dir_list);
 	ntfs_undelete_menu(disk_car, partition, &dir_data, &dir_list, current_cmd);
 	delete_list_file(&dir_list);
 	dir_data.close(&dir_data);
@@ -0,0 +1,574 @@
+/*
+
+    File: overlay.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "overlay.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Copy-on-write layer: the device is only read, a written sector is
+ * appended to the side file the first time and rewritten in place the
+ * next times. The side file keeps the sectors across runs, so a repair
+ * can be checked before being committed to the device or discarded.
+ *
+ * Side file: a header, then records made of a record header followed by
+ * a sector of data, in the order they were first written. */
+#define OVERLAY_MAGIC		"TestDisk overlay"
+#define OVERLAY_VERSION		1
+#define OVERLAY_HEADER_SIZE	512
+#define OVERLAY_RECORD_MAGIC	0x4b4c424f	/* OBLK */
+
+struct overlay_header
+{
+  char magic[16];
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t disk_size;
+};
+
+struct overlay_record
+{
+  uint64_t offset;
+  uint32_t magic;
+  uint32_t reserved;
+};
+
+/* Sorted by offset */
+struct overlay_block
+{
+  uint64_t offset;	/* on the device */
+  uint64_t pos;		/* of the data in the side file */
+};
+
+struct info_overlay_struct
+{
+  disk_t *disk;
+  char *side_file;
+  int fd;
+  unsigned int block_size;
+  struct overlay_block *blocks;
+  unsigned int nbr;
+  unsigned int size;
+  /* End of the last complete record */
+  uint64_t end;
+  unsigned char *bounce;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+#endif
+};
+
+extern const arch_fnct_t arch_none;
+
+static int overlay_read_at(const int fd, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#ifdef HAVE_PREAD
+  return pread(fd, buffer, count, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return read(fd, buffer, count);
+#endif
+}
+
+static int overlay_write_at(const int fd, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+#ifdef HAVE_PWRITE
+  return pwrite(fd, buffer, count, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return write(fd, buffer, count);
+#endif
+}
+
+/* Index of the first block at or after offset, data->nbr if none */
+static unsigned int overlay_find(const struct info_overlay_struct *data, const uint64_t offset)
+{
+  unsigned int low=0;
+  unsigned int high=data->nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(data->blocks[mid].offset < offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return low;
+}
+
+static void overlay_set_block(struct info_overlay_struct *data, const uint64_t offset, const uint64_t pos)
+{
+  const unsigned int i=overlay_find(data, offset);
+  if(i < data->nbr && data->blocks[i].offset==offset)
+  {
+    data->blocks[i].pos=pos;
+    return ;
+  }
+  if(data->nbr==data->size)
+  {
+    struct overlay_block *blocks;
+    data->size=(data->size==0 ? 64 : 2 * data->size);
+    blocks=(struct overlay_block *)MALLOC(data->size * sizeof(*blocks));
+    if(data->nbr > 0)
+      memcpy(blocks, data->blocks, data->nbr * sizeof(*blocks));
+    free(data->blocks);
+    data->blocks=blocks;
+  }
+  memmove(&data->blocks[i+1], &data->blocks[i], (data->nbr - i) * sizeof(*data->blocks));
+  data->blocks[i].offset=offset;
+  data->blocks[i].pos=pos;
+  data->nbr++;
+}
+
+/* Split overlay:sidefile,device, the side file name is allocated */
+static const char *overlay_parse_name(const char *device, char **side_file)
+{
+  const char *name=device + strlen(OVERLAY_PREFIX);
+  const char *sep;
+  if(strncmp(device, OVERLAY_PREFIX, strlen(OVERLAY_PREFIX))!=0)
+    return NULL;
+  sep=strchr(name, ',');
+  if(sep==NULL || sep==name || sep[1]=='\0')
+  {
+    log_error("%s: the side file and the device must be given as overlay:sidefile,device\n", device);
+    return NULL;
+  }
+  *side_file=(char *)MALLOC(sep - name + 1);
+  memcpy(*side_file, name, sep - name);
+  (*side_file)[sep - name]='\0';
+  return sep + 1;
+}
+
+/* Open the side file and load its index, create it if needed */
+static int overlay_open_side(struct info_overlay_struct *data, const int create)
+{
+  struct overlay_header header;
+  struct stat stat_rec;
+  uint64_t pos;
+  data->fd=open(data->side_file, O_RDWR|O_BINARY|(create!=0 ? O_CREAT : 0), 0600);
+  if(data->fd < 0 || fstat(data->fd, &stat_rec) < 0)
+  {
+    log_error("overlay: can't open %s: %s\n", data->side_file, strerror(errno));
+    return -1;
+  }
+  if(stat_rec.st_size==0 && create!=0)
+  {
+    unsigned char *buffer=(unsigned char *)MALLOC(OVERLAY_HEADER_SIZE);
+    struct overlay_header *new_header=(struct overlay_header *)buffer;
+    int res;
+    memset(buffer, 0, OVERLAY_HEADER_SIZE);
+    memcpy(new_header->magic, OVERLAY_MAGIC, sizeof(new_header->magic));
+    new_header->version=le32(OVERLAY_VERSION);
+    new_header->block_size=le32(data->block_size);
+    new_header->disk_size=le64(data->disk->disk_real_size);
+    res=overlay_write_at(data->fd, buffer, OVERLAY_HEADER_SIZE, 0);
+    free(buffer);
+    if(res!=OVERLAY_HEADER_SIZE)
+    {
+      log_error("overlay: can't write %s: %s\n", data->side_file, strerror(errno));
+      return -1;
+    }
+    data->end=OVERLAY_HEADER_SIZE;
+    return 0;
+  }
+  if(overlay_read_at(data->fd, &header, sizeof(header), 0)!=sizeof(header) ||
+      memcmp(header.magic, OVERLAY_MAGIC, sizeof(header.magic))!=0 ||
+      le32(header.version)!=OVERLAY_VERSION)
+  {
+    log_error("overlay: %s is not an overlay file\n", data->side_file);
+    return -1;
+  }
+  if(le32(header.block_size)!=data->block_size ||
+      le64(header.disk_size)!=data->disk->disk_real_size)
+  {
+    log_error("overlay: %s was created for another device (%u bytes per sector, %llu bytes)\n",
+	data->side_file, (unsigned)le32(header.block_size), (long long unsigned)le64(header.disk_size));
+    return -1;
+  }
+  /* An incomplete record left by a crash is ignored and overwritten */
+  for(pos=OVERLAY_HEADER_SIZE;
+      pos + sizeof(struct overlay_record) + data->block_size <= (uint64_t)stat_rec.st_size;
+      pos+=sizeof(struct overlay_record) + data->block_size)
+  {
+    struct overlay_record record;
+    uint64_t offset;
+    if(overlay_read_at(data->fd, &record, sizeof(record), pos)!=sizeof(record))
+      break;
+    offset=le64(record.offset);
+    if(le32(record.magic)!=OVERLAY_RECORD_MAGIC || offset % data->block_size!=0 ||
+	offset + data->block_size > data->disk->disk_real_size)
+    {
+      log_error("overlay: %s: bad record at %llu, the following records are ignored\n",
+	  data->side_file, (long long unsigned)pos);
+      break;
+    }
+    overlay_set_block(data, offset, pos + sizeof(record));
+  }
+  data->end=pos;
+  return 0;
+}
+
+static void overlay_free(struct info_overlay_struct *data)
+{
+  if(data->fd >= 0)
+    close(data->fd);
+  if(data->disk!=NULL)
+    data->disk->clean(data->disk);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&data->mutex);
+#endif
+  free(data->blocks);
+  free(data->bounce);
+  free(data->side_file);
+  free(data);
+}
+
+static struct info_overlay_struct *overlay_new(const char *device, const int verbose, const int testdisk_mode, const int create)
+{
+  struct info_overlay_struct *data;
+  char *side_file=NULL;
+  const char *base=overlay_parse_name(device, &side_file);
+  if(base==NULL)
+    return NULL;
+  data=(struct info_overlay_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->fd=-1;
+  data->side_file=side_file;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->mutex, NULL);
+#endif
+  data->disk=file_test_availability(base, verbose, testdisk_mode);
+  if(data->disk==NULL)
+  {
+    log_error("%s: can't open %s\n", device, base);
+    overlay_free(data);
+    return NULL;
+  }
+  data->block_size=data->disk->sector_size;
+  data->bounce=(unsigned char *)MALLOC(data->block_size);
+  if(overlay_open_side(data, create) < 0)
+  {
+    overlay_free(data);
+    return NULL;
+  }
+  return data;
+}
+
+/* Called with the mutex held */
+static int overlay_pread_aux(struct info_overlay_struct *data, unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const uint64_t end=offset + count;
+  uint64_t cur=offset;
+  unsigned int i=overlay_find(data, offset - offset % data->block_size);
+  while(cur < end)
+  {
+    const uint64_t block=cur - cur % data->block_size;
+    if(i < data->nbr && data->blocks[i].offset==block)
+    {
+      const unsigned int size=(end < block + data->block_size ? end : block + data->block_size) - cur;
+      if(overlay_read_at(data->fd, &buffer[cur - offset], size, data->blocks[i].pos + cur - block)!=(int)size)
+	return -1;
+      cur+=size;
+      i++;
+    }
+    else
+    {
+      /* Up to the next block of the side file in one read */
+      const uint64_t next=(i < data->nbr && data->blocks[i].offset < end ? data->blocks[i].offset : end);
+      const unsigned int size=next - cur;
+      const int res=data->disk->pread(data->disk, &buffer[cur - offset], size, cur);
+      if(res < 0)
+	return -1;
+      if((unsigned int)res < size)
+	return cur - offset + res;
+      cur=next;
+    }
+  }
+  return count;
+}
+
+static int foverlay_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_overlay_struct *data=(struct info_overlay_struct *)disk->data;
+  unsigned int size=count;
+  int res;
+  if(offset >= disk->disk_real_size)
+    return 0;
+  if(size > disk->disk_real_size - offset)
+    size=disk->disk_real_size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+#endif
+  res=overlay_pread_aux(data, (unsigned char *)buffer, size, offset);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->mutex);
+#endif
+  if(res < 0)
+    log_error("foverlay_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read error\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return res;
+}
+
+/* Called with the mutex held */
+static int overlay_pwrite_aux(struct info_overlay_struct *data, const unsigned char *buffer, const unsigned int count, const uint64_t offset)
+{
+  const uint64_t end=offset + count;
+  uint64_t cur=offset;
+  while(cur < end)
+  {
+    const uint64_t block=cur - cur % data->block_size;
+    const unsigned int size=(end < block + data->block_size ? end : block + data->block_size) - cur;
+    const unsigned int i=overlay_find(data, block);
+    const int found=(i < data->nbr && data->blocks[i].offset==block);
+    const unsigned char *src=&buffer[cur - offset];
+    if(size!=data->block_size)
+    {
+      /* Partial sector: merge with its current content */
+      if(overlay_pread_aux(data, data->bounce, data->block_size, block)!=(int)data->block_size)
+	return -1;
+      memcpy(&data->bounce[cur - block], src, size);
+      src=data->bounce;
+    }
+    if(found)
+    {
+      if(overlay_write_at(data->fd, src, data->block_size, data->blocks[i].pos)!=(int)data->block_size)
+	return -1;
+    }
+    else
+    {
+      struct overlay_record record;
+      record.offset=le64(block);
+      record.magic=le32(OVERLAY_RECORD_MAGIC);
+      record.reserved=0;
+      if(overlay_write_at(data->fd, &record, sizeof(record), data->end)!=sizeof(record) ||
+	  overlay_write_at(data->fd, src, data->block_size, data->end + sizeof(record))!=(int)data->block_size)
+	return -1;
+      overlay_set_block(data, block, data->end + sizeof(record));
+      data->end+=sizeof(record) + data->block_size;
+    }
+    cur+=size;
+  }
+  return count;
+}
+
+static int foverlay_pwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_overlay_struct *data=(struct info_overlay_struct *)disk->data;
+  int res;
+  if(offset + count > disk->disk_real_size)
+    res=-1;
+  else
+  {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&data->mutex);
+#endif
+    res=overlay_pwrite_aux(data, (const unsigned char *)buffer, count, offset);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&data->mutex);
+#endif
+  }
+  if(res < 0)
+    log_error("foverlay_pwrite(xxx,%u,buffer,%lu(%u/%u/%u)) write error\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return res;
+}
+
+static int foverlay_sync(disk_t *disk)
+{
+#if defined(HAVE_FSYNC)
+  const struct info_overlay_struct *data=(const struct info_overlay_struct *)disk->data;
+  return fsync(data->fd);
+#else
+  errno=EINVAL;
+  return -1;
+#endif
+}
+
+static const char *foverlay_description(disk_t *disk)
+{
+  const struct info_overlay_struct *data=(const struct info_overlay_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"Overlay %s %s - %s - CHS %lu %u %u",
+      data->side_file, data->disk->device, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *foverlay_description_short(disk_t *disk)
+{
+  const struct info_overlay_struct *data=(const struct info_overlay_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"Overlay %s - %s",
+      data->disk->device, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void foverlay_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    overlay_free((struct info_overlay_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+disk_t *foverlay_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_overlay_struct *data;
+  disk_t *disk;
+  data=overlay_new(device, verbose, testdisk_mode & ~(TESTDISK_O_RDWR|TESTDISK_O_DIRECT), 1);
+  if(data==NULL)
+    return NULL;
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    overlay_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&foverlay_description;
+  disk->description_short=&foverlay_description_short;
+  disk->pread=&foverlay_pread;
+  disk->pwrite=&foverlay_pwrite;
+  disk->sync=&foverlay_sync;
+  /* The writes only reach the side file */
+  disk->access_mode=TESTDISK_O_RDWR;
+  disk->clean=&foverlay_clean;
+  disk->sector_size=data->disk->sector_size;
+  disk->geom=data->disk->geom;
+  disk->disk_real_size=data->disk->disk_real_size;
+  update_disk_car_fields(disk);
+  log_info("%s: %u sectors of %u bytes already written in %s\n", device,
+      data->nbr, data->block_size, data->side_file);
+  return disk;
+}
+
+int overlay_commit(const char *device, const int verbose)
+{
+  struct info_overlay_struct *data;
+  unsigned int i;
+  int res=0;
+  data=overlay_new(device, verbose, TESTDISK_O_RDWR, 0);
+  if(data==NULL)
+    return -1;
+  if((data->disk->access_mode&TESTDISK_O_RDWR)!=TESTDISK_O_RDWR)
+  {
+    log_error("%s: %s can't be opened for writing\n", device, data->disk->device);
+    overlay_free(data);
+    return -1;
+  }
+  /* In the order of the device */
+  for(i=0; i<data->nbr && res==0; i++)
+  {
+    if(overlay_read_at(data->fd, data->bounce, data->block_size, data->blocks[i].pos)!=(int)data->block_size ||
+	data->disk->pwrite(data->disk, data->bounce, data->block_size, data->blocks[i].offset)!=(int)data->block_size)
+    {
+      log_error("%s: can't copy the sector at %llu\n", device, (long long unsigned)data->blocks[i].offset);
+      res=-1;
+    }
+  }
+  if(res==0 && data->nbr > 0 && data->disk->sync(data->disk) < 0 && errno!=EINVAL)
+    res=-1;
+  /* The side file is kept until the device has all its sectors */
+#ifdef HAVE_FTRUNCATE
+  if(res==0 && ftruncate(data->fd, OVERLAY_HEADER_SIZE) < 0)
+    res=-1;
+#endif
+  if(res==0)
+  {
+    log_info("%s: %u sectors written to %s\n", device, data->nbr, data->disk->device);
+    res=data->nbr;
+  }
+  overlay_free(data);
+  return res;
+}
+
+int overlay_discard(const char *device)
+{
+  struct overlay_header header;
+  char *side_file=NULL;
+  int fd;
+  int res=-1;
+  if(overlay_parse_name(device, &side_file)==NULL)
+    return -1;
+  fd=open(side_file, O_RDWR|O_BINARY);
+  if(fd < 0)
+    log_error("overlay: can't open %s: %s\n", side_file, strerror(errno));
+  else if(overlay_read_at(fd, &header, sizeof(header), 0)!=sizeof(header) ||
+      memcmp(header.magic, OVERLAY_MAGIC, sizeof(header.magic))!=0)
+    log_error("overlay: %s is not an overlay file\n", side_file);
+  else
+  {
+#ifdef HAVE_FTRUNCATE
+    res=ftruncate(fd, OVERLAY_HEADER_SIZE);
+#else
+    errno=EINVAL;
+#endif
+    if(res < 0)
+      log_error("overlay: can't empty %s: %s\n", side_file, strerror(errno));
+  }
+  if(fd >= 0)
+    close(fd);
+  free(side_file);
+  return res;
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+
+    File: overlay.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _OVERLAY_H
+#define _OVERLAY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a disk whose writes are kept in a side file:
+ * overlay:sidefile,device */
+#define OVERLAY_PREFIX "overlay:"
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open the device read-only, the writes are stored in the side file,
+ * created if needed, and the reads see them */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *foverlay_init(const char *device, const int verbose, const int testdisk_mode);
+
+/* Write the blocks of the side file to the device and empty the side
+ * file. Return the number of blocks written, -1 on error */
+/*@
+  @ requires valid_read_string(device);
+  @*/
+int overlay_commit(const char *device, const int verbose);
+
+/* Forget the blocks stored in the side file. Return -1 on error */
+/*@
+  @ requires valid_read_string(device);
+  @*/
+int overlay_discard(const char *device);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
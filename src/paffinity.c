@@ -0,0 +1,317 @@
+/*
+
+    File: paffinity.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
+#endif
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "paffinity.h"
+
+#if !defined(DISABLED_FOR_FRAMAC) && defined(__linux__) && defined(HAVE_SCHED_SETAFFINITY) && defined(CPU_SET) && defined(HAVE_REALPATH)
+#define PAFFINITY_LINUX
+#endif
+
+#ifdef PAFFINITY_LINUX
+#define PAFFINITY_MAX_CPUS	1024
+#define PAFFINITY_MAX_NODES	1024
+/* From linux/mempolicy.h */
+#define PAFFINITY_MPOL_PREFERRED	1
+#define PAFFINITY_MPOL_MF_MOVE		(1<<1)
+
+typedef struct
+{
+  unsigned int nbr;
+  unsigned short cpu[PAFFINITY_MAX_CPUS];
+} paffinity_cpus_t;
+
+/* Set by paffinity_set_cpus() */
+static paffinity_cpus_t paffinity_user;
+/* Cores of the node of the disk and of the node of the recovery directory */
+static paffinity_cpus_t paffinity_disk;
+static paffinity_cpus_t paffinity_output;
+static int paffinity_numa=0;
+/* Set by paffinity_setup(), -2 before */
+static int paffinity_disk_node=-2;
+static int paffinity_output_node=-2;
+static int paffinity_saved=0;
+static cpu_set_t paffinity_orig;
+
+/* Parse a list like "0-7,16-23\n" */
+static void paffinity_parse(paffinity_cpus_t *cpus, const char *list)
+{
+  const char *p=list;
+  cpus->nbr=0;
+  while(*p!='\0')
+  {
+    char *end;
+    unsigned long first;
+    unsigned long last;
+    unsigned long i;
+    first=strtoul(p, &end, 10);
+    if(end==p)
+      return ;
+    last=first;
+    p=end;
+    if(*p=='-')
+    {
+      last=strtoul(p+1, &end, 10);
+      if(end==p+1)
+	return ;
+      p=end;
+    }
+    for(i=first; i<=last && i<PAFFINITY_MAX_CPUS && cpus->nbr<PAFFINITY_MAX_CPUS; i++)
+      cpus->cpu[cpus->nbr++]=i;
+    if(*p!=',')
+      return ;
+    p++;
+  }
+}
+
+/* Walk up the sysfs path of the block device until its controller
+ * gives its NUMA node */
+static int paffinity_node_of_dev(const dev_t dev)
+{
+  char path[PATH_MAX + 32];
+  char real[PATH_MAX];
+  snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+  if(realpath(path, real)==NULL)
+    return -1;
+  while(strlen(real) > strlen("/sys/devices"))
+  {
+    FILE *f;
+    char *sep;
+    snprintf(path, sizeof(path), "%s/numa_node", real);
+    f=fopen(path, "r");
+    if(f!=NULL)
+    {
+      int node=-1;
+      if(fscanf(f, "%d", &node)!=1)
+	node=-1;
+      fclose(f);
+      return node;
+    }
+    sep=strrchr(real, '/');
+    if(sep==NULL)
+      return -1;
+    *sep='\0';
+  }
+  return -1;
+}
+
+/* Node of a disk or of the filesystem holding a file */
+static int paffinity_node_of_file(const char *filename)
+{
+  struct stat st;
+  if(stat(filename, &st)!=0)
+    return -1;
+  return paffinity_node_of_dev(S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev);
+}
+
+/* recup_dir is a base name, recup_dir.N may not exist yet */
+static int paffinity_node_of_recup_dir(const char *recup_dir)
+{
+  char dirname[2048];
+  char *sep;
+  strncpy(dirname, recup_dir, sizeof(dirname)-1);
+  dirname[sizeof(dirname)-1]='\0';
+  sep=strrchr(dirname, '/');
+  if(sep==NULL)
+    return paffinity_node_of_file(".");
+  sep[1]='\0';
+  return paffinity_node_of_file(dirname);
+}
+
+static void paffinity_node_cpus(paffinity_cpus_t *cpus, const int node)
+{
+  char path[64];
+  char list[4096];
+  FILE *f;
+  cpus->nbr=0;
+  if(node < 0)
+    return ;
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  f=fopen(path, "r");
+  if(f==NULL)
+    return ;
+  if(fgets(list, sizeof(list), f)!=NULL)
+    paffinity_parse(cpus, list);
+  fclose(f);
+}
+
+/* Pin the calling thread to nbr cores from cpus->cpu[first] */
+static void paffinity_pin(const paffinity_cpus_t *cpus, const unsigned int first, const unsigned int nbr)
+{
+  cpu_set_t set;
+  unsigned int i;
+  CPU_ZERO(&set);
+  for(i=0; i<nbr; i++)
+    CPU_SET(cpus->cpu[(first + i) % cpus->nbr], &set);
+  if(sched_setaffinity(0, sizeof(set), &set)!=0)
+    log_warning("Cannot set the CPU affinity: %s\n", strerror(errno));
+}
+#endif
+
+void paffinity_set_cpus(const char *cpus)
+{
+#ifdef PAFFINITY_LINUX
+  if(cpus==NULL)
+    paffinity_user.nbr=0;
+  else
+    paffinity_parse(&paffinity_user, cpus);
+#else
+  (void)cpus;
+#endif
+}
+
+void paffinity_set_numa(const int enable)
+{
+#ifdef PAFFINITY_LINUX
+  paffinity_numa=enable;
+#else
+  (void)enable;
+#endif
+}
+
+void paffinity_setup(const struct ph_param *params)
+{
+#ifdef PAFFINITY_LINUX
+  int disk_node;
+  int output_node;
+  if(paffinity_numa==0)
+    return ;
+  disk_node=(params->disk!=NULL ? paffinity_node_of_file(params->disk->device) : -1);
+  output_node=paffinity_node_of_recup_dir(params->recup_dir);
+  if(disk_node==paffinity_disk_node && output_node==paffinity_output_node)
+    return ;
+  paffinity_disk_node=disk_node;
+  paffinity_output_node=output_node;
+  paffinity_node_cpus(&paffinity_disk, disk_node);
+  paffinity_node_cpus(&paffinity_output, output_node);
+  log_info("NUMA placement: disk on node %d (%u cores), %s on node %d (%u cores)\n",
+      disk_node, paffinity_disk.nbr, params->recup_dir, output_node, paffinity_output.nbr);
+#else
+  (void)params;
+#endif
+}
+
+void paffinity_worker(const unsigned int worker)
+{
+#ifdef PAFFINITY_LINUX
+  const paffinity_cpus_t *cpus=(paffinity_user.nbr > 0 ? &paffinity_user :
+      (paffinity_numa > 0 ? &paffinity_disk : NULL));
+  if(cpus==NULL || cpus->nbr==0)
+    return ;
+  if(paffinity_saved==0)
+  {
+    if(sched_getaffinity(0, sizeof(paffinity_orig), &paffinity_orig)!=0)
+      return ;
+    paffinity_saved=1;
+  }
+  paffinity_pin(cpus, worker, 1);
+#else
+  (void)worker;
+#endif
+}
+
+void paffinity_restore(void)
+{
+#ifdef PAFFINITY_LINUX
+  if(paffinity_saved==0)
+    return ;
+  sched_setaffinity(0, sizeof(paffinity_orig), &paffinity_orig);
+  paffinity_saved=0;
+#endif
+}
+
+void paffinity_reader(void)
+{
+#ifdef PAFFINITY_LINUX
+  if(paffinity_numa > 0 && paffinity_disk.nbr > 0)
+    paffinity_pin(&paffinity_disk, 0, paffinity_disk.nbr);
+#endif
+}
+
+void paffinity_writer(void)
+{
+#ifdef PAFFINITY_LINUX
+  if(paffinity_numa > 0 && paffinity_output.nbr > 0)
+    paffinity_pin(&paffinity_output, 0, paffinity_output.nbr);
+#endif
+}
+
+void paffinity_bind_buffer(void *buffer, const size_t size)
+{
+#if defined(PAFFINITY_LINUX) && defined(SYS_mbind)
+  unsigned long nodemask[PAFFINITY_MAX_NODES / (8 * sizeof(unsigned long))];
+  const uintptr_t page=sysconf(_SC_PAGESIZE);
+  const uintptr_t start=((uintptr_t)buffer + page - 1) & ~(page - 1);
+  const uintptr_t end=((uintptr_t)buffer + size) & ~(page - 1);
+  const unsigned int bits=8 * sizeof(unsigned long);
+  if(paffinity_numa==0 || paffinity_disk_node < 0 ||
+      paffinity_disk_node >= PAFFINITY_MAX_NODES || end <= start)
+    return ;
+  memset(nodemask, 0, sizeof(nodemask));
+  nodemask[paffinity_disk_node / bits]|=1UL << (paffinity_disk_node % bits);
+  /* The pages are already touched, move them */
+  if(syscall(SYS_mbind, (void *)start, (unsigned long)(end - start),
+	PAFFINITY_MPOL_PREFERRED, nodemask, (unsigned long)PAFFINITY_MAX_NODES + 1,
+	PAFFINITY_MPOL_MF_MOVE)!=0)
+    log_debug("mbind to node %d failed: %s\n", paffinity_disk_node, strerror(errno));
+#else
+  (void)buffer;
+  (void)size;
+#endif
+}
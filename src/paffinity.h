@@ -0,0 +1,79 @@
+/*
+
+    File: paffinity.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PAFFINITY_H
+#define _PAFFINITY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Placement of the scan on the NUMA hosts (Linux only).
+ * When NUMA placement is enabled, the node of the controller of the disk
+ * and the node of the controller of the recovery directory are found in
+ * sysfs:
+ * - the read buffers are bound to the node of the disk,
+ * - the reader threads run on the cores of the node of the disk,
+ * - the session and report writer threads run on the cores of the node
+ *   of the recovery directory.
+ * The worker processes of photorec_shard() are each pinned to one core,
+ * in turn, of the list given with paffinity_set_cpus() or else of the
+ * node of the disk. */
+
+/* cpus is a list like "0-7,16-23", NULL or "" to not pin the workers */
+/*@
+  @ requires cpus == \null || valid_read_string(cpus);
+  @*/
+void paffinity_set_cpus(const char *cpus);
+
+/*@
+  @ assigns \nothing;
+  @*/
+void paffinity_set_numa(const int enable);
+
+/* Find the nodes of the disk and of params->recup_dir */
+/*@
+  @ requires \valid_read(params);
+  @ requires valid_read_string(params->recup_dir);
+  @*/
+void paffinity_setup(const struct ph_param *params);
+
+/* Pin the calling process, the workers are numbered from 0 */
+void paffinity_worker(const unsigned int worker);
+
+/* Undo paffinity_worker() in the calling process */
+void paffinity_restore(void);
+
+/* Called by the reader threads */
+void paffinity_reader(void);
+
+/* Called by the writer threads */
+void paffinity_writer(void);
+
+/* Move the pages of a read buffer to the node of the disk */
+/*@
+  @ requires \valid((char *)buffer + (0 .. size-1));
+  @*/
+void paffinity_bind_buffer(void *buffer, const size_t size);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -49,6 +49,7 @@
 #endif
 #include <assert.h>
 #include "common.h"
+#include "hdaccess.h"
 #include "fnctdsk.h"
 #include "lang.h"
 #include "intrf.h"
@@ -209,28 +210,21 @@ arch_fnct_t arch_gpt=
 /*@
   @ requires \valid(disk_car);
   @ requires valid_disk(disk_car);
+  @ requires \valid(gpt);
   @*/
 // ensures  valid_list_part(\result);
-static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const int saveheader, const uint64_t hdr_lba)
+/* gpt is the header read at hdr_lba */
+static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const int saveheader, const uint64_t hdr_lba, struct gpt_hdr *gpt)
 {
-  struct gpt_hdr *gpt;
   struct gpt_ent* gpt_entries;
   list_part_t *new_list_part=NULL;
   unsigned int i;
   uint32_t gpt_entries_size;
   uint64_t gpt_entries_offset;
 
-  gpt=(struct gpt_hdr*)MALLOC(disk_car->sector_size);
-  if((unsigned)disk_car->pread(disk_car, gpt, disk_car->sector_size,
-	hdr_lba * disk_car->sector_size) != disk_car->sector_size)
-  {
-    free(gpt);
-    return NULL;
-  }
   if(memcmp(gpt->hdr_sig, GPT_HDR_SIG, 8)!=0)
   {
     screen_buffer_add("Bad GPT partition, invalid signature.\n");
-    free(gpt);
     return NULL;
   }
   if(verbose>0)
@@ -253,7 +247,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
   if(le32(gpt->hdr_size)<92 || le32(gpt->hdr_size) > disk_car->sector_size)
   {
     screen_buffer_add("GPT: invalid header size.\n");
-    free(gpt);
     return NULL;
   }
   { /* CRC check */
@@ -265,7 +258,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
     if(crc!=origcrc)
     {
       screen_buffer_add("Bad GPT partition, invalid header checksum.\n");
-      free(gpt);
       return NULL;
     }
     gpt->hdr_crc_self=le32(origcrc);
@@ -273,13 +265,11 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
   if(le64(gpt->hdr_lba_self)!=hdr_lba)
   {
     screen_buffer_add("Bad GPT partition, invalid LBA self location.\n");
-    free(gpt);
     return NULL;
   }
   if(le64(gpt->hdr_lba_start) >= le64(gpt->hdr_lba_end))
   {
     screen_buffer_add("Bad GPT partition, invalid LBA start/end location.\n");
-    free(gpt);
     return NULL;
   }
   if(le32(gpt->hdr_revision)!=GPT_HDR_REVISION)
@@ -294,14 +284,12 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
   {
     screen_buffer_add("GPT: invalid number (%u) of partition entries.\n",
         (unsigned int)le32(gpt->hdr_entries));
-    free(gpt);
     return NULL;
   }
   /* le32(gpt->hdr_entsz)==128 */
   if(le32(gpt->hdr_entsz)%8!=0 || le32(gpt->hdr_entsz)<128 || le32(gpt->hdr_entsz)>4096)
   {
     screen_buffer_add("GPT: invalid partition entry size.\n");
-    free(gpt);
     return NULL;
   }
 
@@ -309,7 +297,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
   if(gpt_entries_size<16384)
   {
     screen_buffer_add("GPT: A minimum of 16,384 bytes of space must be reserved for the GUID Partition Entry array.\n");
-    free(gpt);
     return NULL;
   }
   gpt_entries_offset=(uint64_t)le64(gpt->hdr_lba_table) * disk_car->sector_size;
@@ -319,7 +306,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
 	gpt_entries_offset >= le64(gpt->hdr_lba_start) * disk_car->sector_size)
     {
       screen_buffer_add( "GPT: The primary GUID Partition Entry array must be located after the primary GUID Partition Table Header and end before the FirstUsableLBA.\n");
-      free(gpt);
       return NULL;
     }
   }
@@ -328,7 +314,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
   if((unsigned)disk_car->pread(disk_car, gpt_entries, gpt_entries_size, gpt_entries_offset) != gpt_entries_size)
   {
     free(gpt_entries);
-    free(gpt);
     return new_list_part;
   }
   { /* CRC check */
@@ -338,7 +323,6 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
     {
       screen_buffer_add("Bad GPT partition entries, invalid checksum.\n");
       free(gpt_entries);
-      free(gpt);
       return NULL;
     }
   }
@@ -371,20 +355,34 @@ static list_part_t *read_part_gpt_aux(disk_t *disk_car, const int verbose, const
      located after the LastUsableLBA and end before the backup GUID Partition Table Header.
    */
   free(gpt_entries);
-  free(gpt);
   return new_list_part;
 }
 
 list_part_t *read_part_gpt(disk_t *disk, const int verbose, const int saveheader)
 {
-  list_part_t *list_part;
+  list_part_t *list_part=NULL;
+  const uint64_t alt_lba=(disk->disk_size-1)/disk->sector_size;
+  disk_read_t reads[2];
   screen_buffer_reset();
-  if((list_part=read_part_gpt_aux(disk, verbose, saveheader, 1))!=NULL)
-    return list_part;
-  screen_buffer_add( "Trying alternate GPT\n");
-  list_part=read_part_gpt_aux(disk, verbose, saveheader, 
-      (disk->disk_size-1)/disk->sector_size);
-  screen_buffer_to_log();
+  /* The primary header and the backup one at the end of the disk */
+  reads[0].offset=disk->sector_size;
+  reads[0].count=disk->sector_size;
+  reads[0].buffer=MALLOC(disk->sector_size);
+  reads[1].offset=alt_lba * disk->sector_size;
+  reads[1].count=disk->sector_size;
+  reads[1].buffer=MALLOC(disk->sector_size);
+  disk_pread_batch(disk, reads, 2);
+  if(reads[0].res==(signed)disk->sector_size)
+    list_part=read_part_gpt_aux(disk, verbose, saveheader, 1, (struct gpt_hdr *)reads[0].buffer);
+  if(list_part==NULL)
+  {
+    screen_buffer_add( "Trying alternate GPT\n");
+    if(reads[1].res==(signed)disk->sector_size)
+      list_part=read_part_gpt_aux(disk, verbose, saveheader, alt_lba, (struct gpt_hdr *)reads[1].buffer);
+    screen_buffer_to_log();
+  }
+  free(reads[0].buffer);
+  free(reads[1].buffer);
   return list_part;
 }
 
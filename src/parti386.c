@@ -61,8 +61,13 @@
 #include "parti386.h"
 #include "partgpt.h"
 #include "partxbox.h"
+#include "hdcache.h"
 
 #define TAB_PART 0x1BE
+/* Window read at once from an EBR, it grows while the next EBR of the chain
+ * is found inside it, e.g. with many small logical partitions */
+#define EBR_PREFETCH_MIN	(64*1024)
+#define EBR_PREFETCH_MAX	(4*1024*1024)
 
 /*@
   @ assigns \nothing;
@@ -665,6 +670,12 @@ static list_part_t *get_ext_data_i386(disk_t *disk_car, list_part_t *list_part,
   partition_t *partition_next_ext;
   unsigned int order=5;
   unsigned int nbr_part=0;
+#if !defined(DISABLED_FOR_FRAMAC)
+  uint64_t prefetch_start=0;
+  uint64_t prefetch_end=0;
+  unsigned int prefetch_size=EBR_PREFETCH_MIN;
+  unsigned int prefetch_hits=0;
+#endif
   if((partition_main_ext=get_ext_partition_i386(list_part))==NULL)
     return list_part;
   for(partition_ext=partition_main_ext;
@@ -677,6 +688,24 @@ static list_part_t *get_ext_data_i386(disk_t *disk_car, list_part_t *list_part,
     partition_next_ext=NULL;
     if(partition_ext->part_offset==0)
       return list_part;
+#if !defined(DISABLED_FOR_FRAMAC)
+    if(partition_ext->part_offset >= prefetch_start &&
+	partition_ext->part_offset + sizeof(buffer) <= prefetch_end)
+      prefetch_hits++;
+    else
+    {
+      const uint64_t ext_end=partition_main_ext->part_offset + partition_main_ext->part_size;
+      if(prefetch_hits==0)
+	prefetch_size=EBR_PREFETCH_MIN;
+      else if(prefetch_size < EBR_PREFETCH_MAX)
+	prefetch_size*=2;
+      prefetch_hits=0;
+      prefetch_start=partition_ext->part_offset;
+      prefetch_end=td_min(prefetch_start + prefetch_size, ext_end);
+      if(prefetch_end > prefetch_start)
+	diskcache_prefetch(disk_car, prefetch_start, prefetch_end - prefetch_start);
+    }
+#endif
     if(disk_car->pread(disk_car, &buffer, sizeof(buffer), partition_ext->part_offset) != sizeof(buffer))
       return list_part;
     if((buffer[0x1FE]!=(unsigned char)0x55)||(buffer[0x1FF]!=(unsigned char)0xAA))
@@ -0,0 +1,484 @@
+/*
+
+    File: pbkdf2.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(DISABLED_FOR_FRAMAC)
+#include <cpuid.h>
+#if defined(bit_SHA) && defined(bit_SSE4_1)
+#include <immintrin.h>
+#define SHA_NI
+#endif
+#endif
+#include "types.h"
+#include "pbkdf2.h"
+
+/* MD5 (RFC 1321), SHA-1 and SHA-256 (FIPS 180-4): used to check a volume
+ * key against the digest stored in a LUKS header, for ESSIV and to hash
+ * the recovered files and the source media. SHA-1 and SHA-256 use the
+ * SHA extensions of the CPU when available */
+
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t get_be32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(unsigned char *p, const uint32_t v)
+{
+  p[0]=v >> 24;
+  p[1]=v >> 16;
+  p[2]=v >> 8;
+  p[3]=v;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+  return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static void put_le32(unsigned char *p, const uint32_t v)
+{
+  p[0]=v;
+  p[1]=v >> 8;
+  p[2]=v >> 16;
+  p[3]=v >> 24;
+}
+
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5_compress(uint32_t *state, const unsigned char *block)
+{
+  uint32_t w[16];
+  uint32_t a=state[0], b=state[1], c=state[2], d=state[3];
+  unsigned int i;
+  for(i=0; i<16; i++)
+    w[i]=get_le32(&block[4*i]);
+  for(i=0; i<64; i++)
+  {
+    uint32_t f, t;
+    unsigned int g;
+    if(i < 16)
+    {
+      f=(b & c) | (~b & d);
+      g=i;
+    }
+    else if(i < 32)
+    {
+      f=(d & b) | (~d & c);
+      g=(5*i + 1) % 16;
+    }
+    else if(i < 48)
+    {
+      f=b ^ c ^ d;
+      g=(3*i + 5) % 16;
+    }
+    else
+    {
+      f=c ^ (b | ~d);
+      g=(7*i) % 16;
+    }
+    t=d;
+    d=c;
+    c=b;
+    b=b + ROTL32(a + f + md5_k[i] + w[g], md5_r[i]);
+    a=t;
+  }
+  state[0]+=a;
+  state[1]+=b;
+  state[2]+=c;
+  state[3]+=d;
+}
+
+static void sha1_compress(uint32_t *state, const unsigned char *block)
+{
+  uint32_t w[80];
+  uint32_t a=state[0], b=state[1], c=state[2], d=state[3], e=state[4];
+  unsigned int i;
+  for(i=0; i<16; i++)
+    w[i]=get_be32(&block[4*i]);
+  for(; i<80; i++)
+    w[i]=ROTL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+  for(i=0; i<80; i++)
+  {
+    uint32_t f, k, t;
+    if(i < 20)
+    {
+      f=(b & c) | (~b & d);
+      k=0x5a827999;
+    }
+    else if(i < 40)
+    {
+      f=b ^ c ^ d;
+      k=0x6ed9eba1;
+    }
+    else if(i < 60)
+    {
+      f=(b & c) | (b & d) | (c & d);
+      k=0x8f1bbcdc;
+    }
+    else
+    {
+      f=b ^ c ^ d;
+      k=0xca62c1d6;
+    }
+    t=ROTL32(a, 5) + f + e + k + w[i];
+    e=d;
+    d=c;
+    c=ROTL32(b, 30);
+    b=a;
+    a=t;
+  }
+  state[0]+=a;
+  state[1]+=b;
+  state[2]+=c;
+  state[3]+=d;
+  state[4]+=e;
+}
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_compress(uint32_t *state, const unsigned char *block)
+{
+  uint32_t w[64];
+  uint32_t s[8];
+  unsigned int i;
+  for(i=0; i<16; i++)
+    w[i]=get_be32(&block[4*i]);
+  for(; i<64; i++)
+  {
+    const uint32_t s0=ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+    const uint32_t s1=ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i]=w[i-16] + s0 + w[i-7] + s1;
+  }
+  memcpy(s, state, sizeof(s));
+  for(i=0; i<64; i++)
+  {
+    const uint32_t S1=ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25);
+    const uint32_t ch=(s[4] & s[5]) ^ (~s[4] & s[6]);
+    const uint32_t t1=s[7] + S1 + ch + sha256_k[i] + w[i];
+    const uint32_t S0=ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22);
+    const uint32_t maj=(s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+    const uint32_t t2=S0 + maj;
+    s[7]=s[6];
+    s[6]=s[5];
+    s[5]=s[4];
+    s[4]=s[3] + t1;
+    s[3]=s[2];
+    s[2]=s[1];
+    s[1]=s[0];
+    s[0]=t1 + t2;
+  }
+  for(i=0; i<8; i++)
+    state[i]+=s[i];
+}
+
+#ifdef SHA_NI
+static int sha_has_shani(void)
+{
+  static int has_shani=-1;
+  if(has_shani < 0)
+  {
+    unsigned int eax, ebx, ecx, edx;
+    has_shani=0;
+    if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1)!=0 &&
+	__get_cpuid_max(0, NULL) >= 7)
+    {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      has_shani=((ebx & bit_SHA)!=0);
+    }
+  }
+  return has_shani;
+}
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_compress_shani(uint32_t *state, const unsigned char *block)
+{
+  const __m128i mask=_mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd=_mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+  const __m128i abcd_save=abcd;
+  const __m128i e_save=_mm_set_epi32(state[4], 0, 0, 0);
+  __m128i e=e_save;
+  __m128i msg[4];
+  unsigned int i;
+  /* 4 rounds by iteration, msg[i%4] holds the words 4*i to 4*i+3 */
+  for(i=0; i<20; i++)
+  {
+    const __m128i abcd_prev=abcd;
+    if(i < 4)
+      msg[i]=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[16*i]), mask);
+    else
+      msg[i&3]=_mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(msg[i&3], msg[(i+1)&3]), msg[(i+2)&3]), msg[(i+3)&3]);
+    e=(i==0 ? _mm_add_epi32(e, msg[0]) : _mm_sha1nexte_epu32(e, msg[i&3]));
+    switch(i/5)
+    {
+      case 0:	abcd=_mm_sha1rnds4_epu32(abcd, e, 0); break;
+      case 1:	abcd=_mm_sha1rnds4_epu32(abcd, e, 1); break;
+      case 2:	abcd=_mm_sha1rnds4_epu32(abcd, e, 2); break;
+      default:	abcd=_mm_sha1rnds4_epu32(abcd, e, 3); break;
+    }
+    e=abcd_prev;
+  }
+  e=_mm_sha1nexte_epu32(e, e_save);
+  abcd=_mm_shuffle_epi32(_mm_add_epi32(abcd, abcd_save), 0x1b);
+  _mm_storeu_si128((__m128i *)state, abcd);
+  state[4]=_mm_extract_epi32(e, 3);
+}
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32_t *state, const unsigned char *block)
+{
+  const __m128i mask=_mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  const __m128i cdab=_mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+  const __m128i efgh=_mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+  __m128i abef=_mm_alignr_epi8(cdab, efgh, 8);
+  __m128i cdgh=_mm_blend_epi16(efgh, cdab, 0xf0);
+  const __m128i abef_save=abef;
+  const __m128i cdgh_save=cdgh;
+  __m128i msg[4];
+  __m128i tmp;
+  unsigned int i;
+  /* 4 rounds by iteration, msg[i%4] holds the words 4*i to 4*i+3 */
+  for(i=0; i<16; i++)
+  {
+    __m128i wk;
+    if(i < 4)
+      msg[i]=_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&block[16*i]), mask);
+    else
+      msg[i&3]=_mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(msg[i&3], msg[(i+1)&3]),
+	    _mm_alignr_epi8(msg[(i+3)&3], msg[(i+2)&3], 4)), msg[(i+3)&3]);
+    wk=_mm_add_epi32(msg[i&3], _mm_loadu_si128((const __m128i *)&sha256_k[4*i]));
+    cdgh=_mm_sha256rnds2_epu32(cdgh, abef, wk);
+    abef=_mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+  }
+  abef=_mm_add_epi32(abef, abef_save);
+  cdgh=_mm_add_epi32(cdgh, cdgh_save);
+  tmp=_mm_shuffle_epi32(abef, 0x1b);
+  cdgh=_mm_shuffle_epi32(cdgh, 0xb1);
+  _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xf0));
+  _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif
+
+int hash_init(hash_ctx_t *ctx, const char *hash)
+{
+  static const uint32_t md5_iv[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+  };
+  static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memset(ctx, 0, sizeof(*ctx));
+  if(strcmp(hash, "md5")==0)
+  {
+    memcpy(ctx->state, md5_iv, sizeof(md5_iv));
+    ctx->digest_size=MD5_DIGEST_SIZE;
+    ctx->little_endian=1;
+    ctx->compress=&md5_compress;
+    return 0;
+  }
+  if(strcmp(hash, "sha1")==0)
+  {
+    memcpy(ctx->state, sha1_iv, sizeof(sha1_iv));
+    ctx->digest_size=20;
+    ctx->compress=&sha1_compress;
+#ifdef SHA_NI
+    if(sha_has_shani())
+      ctx->compress=&sha1_compress_shani;
+#endif
+    return 0;
+  }
+  if(strcmp(hash, "sha256")==0)
+  {
+    memcpy(ctx->state, sha256_iv, sizeof(sha256_iv));
+    ctx->digest_size=SHA256_DIGEST_SIZE;
+    ctx->compress=&sha256_compress;
+#ifdef SHA_NI
+    if(sha_has_shani())
+      ctx->compress=&sha256_compress_shani;
+#endif
+    return 0;
+  }
+  return -1;
+}
+
+void hash_update(hash_ctx_t *ctx, const unsigned char *data, unsigned int len)
+{
+  ctx->len+=len;
+  while(len > 0)
+  {
+    if(ctx->used==0 && len >= HASH_BLOCK_SIZE)
+    {
+      /* Whole blocks are hashed in place */
+      ctx->compress(ctx->state, data);
+      data+=HASH_BLOCK_SIZE;
+      len-=HASH_BLOCK_SIZE;
+    }
+    else
+    {
+      unsigned int size=HASH_BLOCK_SIZE - ctx->used;
+      if(size > len)
+	size=len;
+      memcpy(&ctx->block[ctx->used], data, size);
+      ctx->used+=size;
+      data+=size;
+      len-=size;
+      if(ctx->used==HASH_BLOCK_SIZE)
+      {
+	ctx->compress(ctx->state, ctx->block);
+	ctx->used=0;
+      }
+    }
+  }
+}
+
+void hash_final(hash_ctx_t *ctx, unsigned char *digest)
+{
+  const uint64_t bits=ctx->len * 8;
+  unsigned int i;
+  ctx->block[ctx->used++]=0x80;
+  if(ctx->used > HASH_BLOCK_SIZE - 8)
+  {
+    memset(&ctx->block[ctx->used], 0, HASH_BLOCK_SIZE - ctx->used);
+    ctx->compress(ctx->state, ctx->block);
+    ctx->used=0;
+  }
+  memset(&ctx->block[ctx->used], 0, HASH_BLOCK_SIZE - 8 - ctx->used);
+  if(ctx->little_endian)
+  {
+    put_le32(&ctx->block[HASH_BLOCK_SIZE - 8], bits);
+    put_le32(&ctx->block[HASH_BLOCK_SIZE - 4], bits >> 32);
+    ctx->compress(ctx->state, ctx->block);
+    for(i=0; i<ctx->digest_size/4; i++)
+      put_le32(&digest[4*i], ctx->state[i]);
+    return ;
+  }
+  put_be32(&ctx->block[HASH_BLOCK_SIZE - 8], bits >> 32);
+  put_be32(&ctx->block[HASH_BLOCK_SIZE - 4], bits);
+  ctx->compress(ctx->state, ctx->block);
+  for(i=0; i<ctx->digest_size/4; i++)
+    put_be32(&digest[4*i], ctx->state[i]);
+}
+
+void sha256(const void *data, const unsigned int len, unsigned char *digest)
+{
+  hash_ctx_t ctx;
+  hash_init(&ctx, "sha256");
+  hash_update(&ctx, (const unsigned char *)data, len);
+  hash_final(&ctx, digest);
+}
+
+int pbkdf2_hmac(const char *hash, const unsigned char *password, const unsigned int password_len, const unsigned char *salt, const unsigned int salt_len, const unsigned int iterations, unsigned char *out, const unsigned int out_len)
+{
+  hash_ctx_t inner;
+  hash_ctx_t outer;
+  unsigned char key[HASH_BLOCK_SIZE];
+  unsigned int block_nbr;
+  unsigned int done;
+  unsigned int i;
+  if(hash_init(&inner, hash) < 0)
+    return -1;
+  /* The inner and outer states after the padded key are computed once */
+  memset(key, 0, sizeof(key));
+  if(password_len > HASH_BLOCK_SIZE)
+  {
+    hash_update(&inner, password, password_len);
+    hash_final(&inner, key);
+    hash_init(&inner, hash);
+  }
+  else
+    memcpy(key, password, password_len);
+  outer=inner;
+  for(i=0; i<HASH_BLOCK_SIZE; i++)
+    key[i]^=0x36;
+  hash_update(&inner, key, HASH_BLOCK_SIZE);
+  for(i=0; i<HASH_BLOCK_SIZE; i++)
+    key[i]^=0x36 ^ 0x5c;
+  hash_update(&outer, key, HASH_BLOCK_SIZE);
+  for(block_nbr=1, done=0; done < out_len; block_nbr++)
+  {
+    unsigned char u[HASH_MAX_DIGEST];
+    unsigned char t[HASH_MAX_DIGEST];
+    unsigned char be_nbr[4];
+    unsigned int size;
+    unsigned int j;
+    hash_ctx_t ctx;
+    put_be32(be_nbr, block_nbr);
+    ctx=inner;
+    hash_update(&ctx, salt, salt_len);
+    hash_update(&ctx, be_nbr, sizeof(be_nbr));
+    hash_final(&ctx, u);
+    ctx=outer;
+    hash_update(&ctx, u, inner.digest_size);
+    hash_final(&ctx, u);
+    memcpy(t, u, inner.digest_size);
+    for(j=1; j<iterations; j++)
+    {
+      unsigned int k;
+      ctx=inner;
+      hash_update(&ctx, u, inner.digest_size);
+      hash_final(&ctx, u);
+      ctx=outer;
+      hash_update(&ctx, u, inner.digest_size);
+      hash_final(&ctx, u);
+      for(k=0; k<inner.digest_size; k++)
+	t[k]^=u[k];
+    }
+    size=(out_len - done < inner.digest_size ? out_len - done : inner.digest_size);
+    memcpy(&out[done], t, size);
+    done+=size;
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+
+    File: pbkdf2.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PBKDF2_H
+#define _PBKDF2_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD5_DIGEST_SIZE		16
+#define SHA256_DIGEST_SIZE	32
+#define HASH_BLOCK_SIZE		64
+#define HASH_MAX_DIGEST		32
+
+typedef struct
+{
+  uint32_t state[8];
+  unsigned char block[HASH_BLOCK_SIZE];
+  uint64_t len;
+  unsigned int used;
+  unsigned int digest_size;
+  int little_endian;
+  void (*compress)(uint32_t *state, const unsigned char *block);
+} hash_ctx_t;
+
+/* Incremental hash, hash is "md5", "sha1" or "sha256".
+ * Return -1 if the hash is not supported */
+/*@
+  @ requires \valid(ctx);
+  @ requires valid_read_string(hash);
+  @*/
+int hash_init(hash_ctx_t *ctx, const char *hash);
+
+/*@
+  @ requires \valid(ctx);
+  @ requires \valid_read(data + (0 .. len-1));
+  @*/
+void hash_update(hash_ctx_t *ctx, const unsigned char *data, unsigned int len);
+
+/* The context must be initialized again before being reused */
+/*@
+  @ requires \valid(ctx);
+  @ requires \valid(digest + (0 .. ctx->digest_size-1));
+  @*/
+void hash_final(hash_ctx_t *ctx, unsigned char *digest);
+
+/*@
+  @ requires \valid_read((const unsigned char *)data + (0 .. len-1));
+  @ requires \valid(digest + (0 .. SHA256_DIGEST_SIZE-1));
+  @ assigns digest[0 .. SHA256_DIGEST_SIZE-1];
+  @*/
+void sha256(const void *data, const unsigned int len, unsigned char *digest);
+
+/* PBKDF2 (RFC 8018) with HMAC-hash, hash is "sha1" or "sha256".
+ * Return -1 if the hash is not supported */
+/*@
+  @ requires valid_read_string(hash);
+  @ requires \valid_read(password + (0 .. password_len-1));
+  @ requires \valid_read(salt + (0 .. salt_len-1));
+  @ requires \valid(out + (0 .. out_len-1));
+  @*/
+int pbkdf2_hmac(const char *hash, const unsigned char *password, const unsigned int password_len, const unsigned char *salt, const unsigned int salt_len, const unsigned int iterations, unsigned char *out, const unsigned int out_len);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,404 @@
+/*
+
+    File: pblockmap.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pblockmap.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+typedef struct
+{
+  uint64_t start;
+  uint64_t len;
+  uint32_t file_id;
+  uint16_t format;
+  uint8_t state;
+} bmap_run_t;
+
+typedef struct
+{
+  bmap_run_t *runs;
+  uint64_t nbr;
+  uint64_t alloc;
+} bmap_list_t;
+
+static char *pblockmap_filename=NULL;
+/* Classes of the blocks read, in the order of the scan */
+static bmap_list_t bmap_scan={ NULL, 0, 0 };
+/* Byte runs of the recovered files */
+static bmap_list_t bmap_files={ NULL, 0, 0 };
+static char **bmap_formats=NULL;
+static unsigned int bmap_formats_nbr=0;
+static unsigned int bmap_formats_alloc=0;
+static uint32_t bmap_files_nbr=0;
+static unsigned int bmap_blocksize=0;
+static unsigned int bmap_high_distinct=0;
+
+static void bmap_list_free(bmap_list_t *list)
+{
+  free(list->runs);
+  list->runs=NULL;
+  list->nbr=0;
+  list->alloc=0;
+}
+
+static void pblockmap_free(void)
+{
+  unsigned int i;
+  bmap_list_free(&bmap_scan);
+  bmap_list_free(&bmap_files);
+  for(i=0; i<bmap_formats_nbr; i++)
+    free(bmap_formats[i]);
+  free(bmap_formats);
+  bmap_formats=NULL;
+  bmap_formats_nbr=0;
+  bmap_formats_alloc=0;
+  bmap_files_nbr=0;
+  bmap_blocksize=0;
+}
+
+static int bmap_same(const bmap_run_t *a, const bmap_run_t *b)
+{
+  return (a->state==b->state && a->file_id==b->file_id && a->format==b->format);
+}
+
+/* Extend the last run when run follows it with the same labels */
+static void bmap_list_append(bmap_list_t *list, const bmap_run_t *run)
+{
+  if(list->nbr > 0)
+  {
+    bmap_run_t *last=&list->runs[list->nbr-1];
+    if(last->start + last->len==run->start && bmap_same(last, run))
+    {
+      last->len+=run->len;
+      return ;
+    }
+  }
+  if(list->nbr==list->alloc)
+  {
+    list->alloc=(list->alloc==0 ? 4096 : 2 * list->alloc);
+    list->runs=(bmap_run_t *)realloc(list->runs, list->alloc * sizeof(bmap_run_t));
+    if(list->runs==NULL)
+    {
+      log_critical("Block map: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  list->runs[list->nbr++]=*run;
+}
+
+static int bmap_run_cmp(const void *p1, const void *p2)
+{
+  const bmap_run_t *r1=(const bmap_run_t *)p1;
+  const bmap_run_t *r2=(const bmap_run_t *)p2;
+  if(r1->start < r2->start)
+    return -1;
+  if(r1->start > r2->start)
+    return 1;
+  return 0;
+}
+
+/* Sort the runs, drop what an earlier run already covers and merge the
+ * neighbours. A block read again by the next pass has the same class */
+static void bmap_list_compact(bmap_list_t *list)
+{
+  uint64_t i;
+  uint64_t nbr=0;
+  if(list->nbr==0)
+    return ;
+  qsort(list->runs, list->nbr, sizeof(bmap_run_t), bmap_run_cmp);
+  for(i=0; i<list->nbr; i++)
+  {
+    bmap_run_t run=list->runs[i];
+    if(nbr > 0)
+    {
+      bmap_run_t *last=&list->runs[nbr-1];
+      const uint64_t last_end=last->start + last->len;
+      if(run.start + run.len <= last_end)
+	continue;
+      if(run.start < last_end)
+      {
+	run.len-=last_end - run.start;
+	run.start=last_end;
+      }
+      if(run.start==last_end && bmap_same(last, &run))
+      {
+	last->len+=run.len;
+	continue;
+      }
+    }
+    list->runs[nbr++]=run;
+  }
+  list->nbr=nbr;
+}
+
+static uint16_t bmap_format(const char *extension)
+{
+  unsigned int i;
+  for(i=0; i<bmap_formats_nbr; i++)
+    if(strcmp(bmap_formats[i], extension)==0)
+      return i+1;
+  if(bmap_formats_nbr==65535)
+    return 0;
+  if(bmap_formats_nbr==bmap_formats_alloc)
+  {
+    bmap_formats_alloc=(bmap_formats_alloc==0 ? 64 : 2 * bmap_formats_alloc);
+    bmap_formats=(char **)realloc(bmap_formats, bmap_formats_alloc * sizeof(char *));
+    if(bmap_formats==NULL)
+    {
+      log_critical("Block map: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  bmap_formats[bmap_formats_nbr]=strdup(extension);
+  return ++bmap_formats_nbr;
+}
+#endif
+
+void pblockmap_set(const char *filename)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  free(pblockmap_filename);
+  pblockmap_filename=(filename==NULL ? NULL : strdup(filename));
+  pblockmap_free();
+#endif
+}
+
+int pblockmap_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (pblockmap_filename!=NULL ? 1 : 0);
+#else
+  return 0;
+#endif
+}
+
+void pblockmap_scan(const struct ph_param *params, const unsigned char *buffer, const uint64_t offset)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const unsigned int blocksize=params->blocksize;
+  bmap_run_t run;
+  if(pblockmap_filename==NULL || blocksize==0)
+    return ;
+  if(blocksize!=bmap_blocksize)
+  {
+    /* Distinct byte values expected in a block of random data, as for
+     * the scan index */
+    double not_seen=1.0;
+    unsigned int i;
+    for(i=0; i<blocksize && i<65536; i++)
+      not_seen*=255.0/256.0;
+    bmap_high_distinct=(unsigned int)(256.0 * (1.0 - not_seen) * 0.85);
+    bmap_blocksize=blocksize;
+  }
+  run.start=offset;
+  run.len=blocksize;
+  run.file_id=0;
+  run.format=0;
+  if(memcmp(buffer, buffer+1, blocksize-1)==0)
+    run.state=(buffer[0]==0 ? PBLOCKMAP_ZERO : PBLOCKMAP_UNIFORM);
+  else
+  {
+    unsigned char seen[256];
+    unsigned int distinct=0;
+    unsigned int i;
+    memset(seen, 0, sizeof(seen));
+    for(i=0; i<blocksize && distinct < bmap_high_distinct; i++)
+    {
+      if(seen[buffer[i]]==0)
+      {
+	seen[buffer[i]]=1;
+	distinct++;
+      }
+    }
+    run.state=(distinct >= bmap_high_distinct ? PBLOCKMAP_HIGH_ENTROPY : PBLOCKMAP_UNCLAIMED);
+  }
+  bmap_list_append(&bmap_scan, &run);
+#endif
+}
+
+void pblockmap_file(const file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const struct td_list_head *tmp;
+  bmap_run_t run;
+  if(pblockmap_filename==NULL || file_recovery->file_size==0 ||
+      file_recovery->file_stat==NULL || file_recovery->file_stat->file_hint==NULL)
+    return ;
+  run.file_id=++bmap_files_nbr;
+  run.format=bmap_format(file_recovery->extension!=NULL && file_recovery->extension[0]!='\0' ?
+      file_recovery->extension : file_recovery->file_stat->file_hint->extension);
+  run.state=PBLOCKMAP_FILE;
+  td_list_for_each(tmp, &file_recovery->location.list)
+  {
+    const alloc_list_t *element=td_list_entry_const(tmp, const alloc_list_t, list);
+    if(element->data>0)
+    {
+      run.start=element->start;
+      run.len=element->end - element->start + 1;
+      bmap_list_append(&bmap_files, &run);
+    }
+  }
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+typedef struct
+{
+  FILE *handle;
+  bmap_run_t pending;
+  uint64_t nbr;
+  int error;
+} bmap_writer_t;
+
+static void bmap_writer_flush(bmap_writer_t *writer)
+{
+  struct pblockmap_run out;
+  if(writer->pending.len==0)
+    return ;
+  memset(&out, 0, sizeof(out));
+  out.start=le64(writer->pending.start);
+  out.len=le64(writer->pending.len);
+  out.file_id=le32(writer->pending.file_id);
+  out.format=le16(writer->pending.format);
+  out.state=writer->pending.state;
+  if(fwrite(&out, sizeof(out), 1, writer->handle)!=1)
+    writer->error=1;
+  writer->nbr++;
+  writer->pending.len=0;
+}
+
+static void bmap_writer_emit(bmap_writer_t *writer, const bmap_run_t *run, const uint64_t start, const uint64_t end)
+{
+  if(start >= end)
+    return ;
+  if(writer->pending.len > 0 &&
+      writer->pending.start + writer->pending.len==start &&
+      bmap_same(&writer->pending, run))
+  {
+    writer->pending.len+=end - start;
+    return ;
+  }
+  bmap_writer_flush(writer);
+  writer->pending=*run;
+  writer->pending.start=start;
+  writer->pending.len=end - start;
+}
+
+/* The file runs, and the scan runs clipped to the gaps between them */
+static void bmap_write_runs(bmap_writer_t *writer)
+{
+  uint64_t prev_end=0;
+  uint64_t i;
+  uint64_t j=0;
+  for(i=0; i<=bmap_files.nbr; i++)
+  {
+    const bmap_run_t *file=(i<bmap_files.nbr ? &bmap_files.runs[i] : NULL);
+    const uint64_t gap_end=(file!=NULL ? file->start : (uint64_t)-1);
+    while(j<bmap_scan.nbr && bmap_scan.runs[j].start < gap_end)
+    {
+      const bmap_run_t *scan=&bmap_scan.runs[j];
+      const uint64_t scan_end=scan->start + scan->len;
+      bmap_writer_emit(writer, scan, (scan->start > prev_end ? scan->start : prev_end),
+	  (scan_end < gap_end ? scan_end : gap_end));
+      if(scan_end > gap_end)
+	break;
+      j++;
+    }
+    if(file!=NULL)
+    {
+      bmap_writer_emit(writer, file, file->start, file->start + file->len);
+      prev_end=file->start + file->len;
+    }
+  }
+  bmap_writer_flush(writer);
+}
+#endif
+
+void pblockmap_write(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct pblockmap_header hdr;
+  bmap_writer_t writer;
+  unsigned int i;
+  if(pblockmap_filename==NULL)
+    return ;
+  bmap_list_compact(&bmap_scan);
+  bmap_list_compact(&bmap_files);
+  writer.handle=fopen(pblockmap_filename, "wb");
+  if(writer.handle==NULL)
+  {
+    log_error("Block map: can't create %s: %s\n", pblockmap_filename, strerror(errno));
+    return ;
+  }
+  writer.pending.len=0;
+  writer.nbr=0;
+  writer.error=0;
+  memset(&hdr, 0, sizeof(hdr));
+  if(fwrite(&hdr, sizeof(hdr), 1, writer.handle)!=1)
+    writer.error=1;
+  bmap_write_runs(&writer);
+  for(i=0; i<bmap_formats_nbr; i++)
+  {
+    char name[PBLOCKMAP_FORMAT_SIZE];
+    memset(name, 0, sizeof(name));
+    strncpy(name, bmap_formats[i], sizeof(name)-1);
+    if(fwrite(name, sizeof(name), 1, writer.handle)!=1)
+      writer.error=1;
+  }
+  memcpy(hdr.magic, PBLOCKMAP_MAGIC, sizeof(hdr.magic));
+  hdr.blocksize=le32(params->blocksize);
+  hdr.formats_nbr=le32(bmap_formats_nbr);
+  hdr.disk_size=le64(params->disk->disk_size);
+  hdr.part_offset=le64(params->partition->part_offset);
+  hdr.part_size=le64(params->partition->part_size);
+  hdr.files_nbr=le64(bmap_files_nbr);
+  hdr.runs_nbr=le64(writer.nbr);
+  hdr.runs_offset=le64(sizeof(hdr));
+  hdr.formats_offset=le64(sizeof(hdr) + writer.nbr * sizeof(struct pblockmap_run));
+  if(fseek(writer.handle, 0, SEEK_SET)!=0 ||
+      fwrite(&hdr, sizeof(hdr), 1, writer.handle)!=1)
+    writer.error=1;
+  if(fclose(writer.handle)!=0)
+    writer.error=1;
+  if(writer.error!=0)
+    log_error("Block map: failed to write %s\n", pblockmap_filename);
+  else
+    log_info("Block map: %s written, %llu runs, %u files, %u formats\n", pblockmap_filename,
+	(long long unsigned)writer.nbr, (unsigned int)bmap_files_nbr, bmap_formats_nbr);
+#endif
+}
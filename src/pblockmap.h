@@ -0,0 +1,102 @@
+/*
+
+    File: pblockmap.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PBLOCKMAP_H
+#define _PBLOCKMAP_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Block map: the disk ranges read by the scan, sorted and run-length
+ * encoded, each with the recovered file and format that claimed it or the
+ * class of its blocks. The file is meant to be mapped in memory; integers
+ * are little-endian:
+ * header, runs_nbr struct pblockmap_run from runs_offset, formats_nbr
+ * extensions of PBLOCKMAP_FORMAT_SIZE bytes (NUL padded) from
+ * formats_offset. Format 0 and file 0 mean none, the ranges never read
+ * have no run. */
+#define PBLOCKMAP_MAGIC		"PHBMAP01"
+#define PBLOCKMAP_FORMAT_SIZE	16
+
+#define PBLOCKMAP_FILE		1	/* part of a recovered file */
+#define PBLOCKMAP_ZERO		2	/* blocks filled with zeroes */
+#define PBLOCKMAP_UNIFORM	3	/* blocks filled with another byte value */
+#define PBLOCKMAP_HIGH_ENTROPY	4	/* as many distinct byte values as random data */
+#define PBLOCKMAP_UNCLAIMED	5	/* any other data */
+
+struct pblockmap_header
+{
+  char		magic[8];
+  uint32_t	blocksize;
+  uint32_t	formats_nbr;
+  uint64_t	disk_size;
+  uint64_t	part_offset;
+  uint64_t	part_size;
+  uint64_t	files_nbr;
+  uint64_t	runs_nbr;
+  uint64_t	runs_offset;
+  uint64_t	formats_offset;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct pblockmap_run
+{
+  uint64_t	start;		/* disk offset */
+  uint64_t	len;
+  uint32_t	file_id;	/* recovery order, from 1 */
+  uint16_t	format;		/* index in the extension table, from 1 */
+  uint8_t	state;
+  uint8_t	reserved;
+} __attribute__ ((gcc_struct, __packed__));
+
+/* filename==NULL disables the block map */
+/*@
+  @ requires filename == \null || valid_read_string(filename);
+  @*/
+void pblockmap_set(const char *filename);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pblockmap_enabled(void);
+
+/* Record the class of the block at offset */
+/*@
+  @ requires \valid_read(params);
+  @ requires \valid_read(buffer + (0 .. params->blocksize-1));
+  @*/
+void pblockmap_scan(const struct ph_param *params, const unsigned char *buffer, const uint64_t offset);
+
+/* Record the byte runs of a recovered file */
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void pblockmap_file(const file_recovery_t *file_recovery);
+
+/* Write the block map file, called at the end of each pass */
+/*@
+  @ requires \valid_read(params);
+  @*/
+void pblockmap_write(const struct ph_param *params);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,397 @@
+/*
+
+    File: pcheck.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_FORK
+#endif
+#if !defined(HAVE_SYS_WAIT_H)
+#undef HAVE_FORK
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_FORK
+#include <sys/wait.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "dfxml.h"
+#include "phash.h"
+#include "pstream.h"
+#include "preader.h"
+#include "sessionp.h"
+#include "pcheck.h"
+
+/* The check of a smaller file costs less than a process */
+#define PCHECK_MIN_SIZE		(256*1024)
+#define PCHECK_MAX_WORKERS	16
+
+static unsigned int pcheck_max=0;
+
+#ifdef HAVE_FORK
+typedef struct
+{
+  uint64_t file_size;
+  uint64_t ns;
+  time_t time;
+  const char *extension;
+  void (*file_rename)(file_recovery_t *file_recovery);
+} pcheck_result_t;
+
+typedef struct
+{
+  file_recovery_t file_recovery;
+  pid_t pid;
+  int fd;
+} pcheck_job_t;
+
+/* Files in the order they have been submitted */
+static pcheck_job_t pcheck_jobs[PCHECK_MAX_WORKERS];
+static unsigned int pcheck_first=0;
+static unsigned int pcheck_nbr=0;
+/* Lowest block given back by a check, PH_INVALID_OFFSET if none */
+static uint64_t pcheck_rollback=PH_INVALID_OFFSET;
+static uint64_t pcheck_nbr_async=0;
+static uint64_t pcheck_nbr_rollbacks=0;
+/* Headers of the files rejected by a check during this pass */
+static uint64_t *pcheck_rejected=NULL;
+static unsigned int pcheck_nbr_rejected=0;
+static unsigned int pcheck_alloc_rejected=0;
+#endif
+
+void pcheck_set(const unsigned int workers)
+{
+  pcheck_max=(workers < PCHECK_MAX_WORKERS ? workers : PCHECK_MAX_WORKERS);
+}
+
+unsigned int pcheck_workers(void)
+{
+  return pcheck_max;
+}
+
+#ifdef HAVE_FORK
+static int pcheck_read(const int fd, void *buf, const unsigned int size)
+{
+  unsigned int done=0;
+  while(done < size)
+  {
+    const ssize_t res=read(fd, (char *)buf + done, size - done);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    done+=res;
+  }
+  return 0;
+}
+
+static void pcheck_write(const int fd, const void *buf, const unsigned int size)
+{
+  unsigned int done=0;
+  while(done < size)
+  {
+    const ssize_t res=write(fd, (const char *)buf + done, size - done);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return ;
+    done+=res;
+  }
+}
+
+/* The blocks of src now belong to dst, src is reset */
+static void pcheck_move_file_recovery(file_recovery_t *dst, file_recovery_t *src)
+{
+  file_recovery_cpy(dst, src);
+  if(!td_list_empty(&src->location.list))
+  {
+    dst->location.list.next=src->location.list.next;
+    dst->location.list.prev=src->location.list.prev;
+    dst->location.list.next->prev=&dst->location.list;
+    dst->location.list.prev->next=&dst->location.list;
+  }
+  reset_file_recovery(src);
+}
+
+/* A file rejected after the scan has gone on gives its header back, the
+ * scan may come back to it: this time, the file is checked in the scan
+ * itself, as it would have been without asynchronous checks */
+static int pcheck_is_rejected(const uint64_t start)
+{
+  unsigned int i;
+  for(i=0; i<pcheck_nbr_rejected; i++)
+    if(pcheck_rejected[i]==start)
+      return 1;
+  return 0;
+}
+
+static void pcheck_add_rejected(const uint64_t start)
+{
+  if(pcheck_nbr_rejected==pcheck_alloc_rejected)
+  {
+    pcheck_alloc_rejected=(pcheck_alloc_rejected < 64 ? 64 : 2 * pcheck_alloc_rejected);
+    pcheck_rejected=(uint64_t *)realloc(pcheck_rejected, pcheck_alloc_rejected * sizeof(uint64_t));
+    if(pcheck_rejected==NULL)
+    {
+      log_critical("pcheck_add_rejected: not enough memory\n");
+      exit(1);
+    }
+  }
+  pcheck_rejected[pcheck_nbr_rejected++]=start;
+}
+
+/* First block given back if the file is truncated to its new size */
+static uint64_t pcheck_kept_end(const file_recovery_t *file_recovery, const unsigned int blocksize)
+{
+  const struct td_list_head *tmp;
+  uint64_t size=0;
+  td_list_for_each(tmp, &file_recovery->location.list)
+  {
+    const alloc_list_t *element=td_list_entry_const(tmp, const alloc_list_t, list);
+    if(size >= file_recovery->file_size)
+      return element->start;
+    if(element->data>0)
+    {
+      if(size + element->end - element->start + 1 > file_recovery->file_size)
+	return element->start + (file_recovery->file_size - size + blocksize - 1) / blocksize * blocksize;
+      size+=element->end - element->start + 1;
+    }
+  }
+  return PH_INVALID_OFFSET;
+}
+
+static void pcheck_child(const int fd, file_recovery_t *file_recovery)
+{
+  pcheck_result_t result;
+  uint64_t start=0;
+  memset(&result, 0, sizeof(result));
+  if(file_profile > 0)
+    start=file_profile_clock();
+  file_recovery->file_check(file_recovery);
+  if(file_profile > 0)
+    result.ns=file_profile_clock() - start;
+  result.file_size=file_recovery->file_size;
+  result.time=file_recovery->time;
+  result.extension=file_recovery->extension;
+  result.file_rename=file_recovery->file_rename;
+  fflush(file_recovery->handle);
+  log_flush();
+  pcheck_write(fd, &result, sizeof(result));
+}
+
+/* Finish the oldest file once its check is over */
+static int pcheck_finish_first(struct ph_param *params, alloc_data_t *list_search_space, const int wait)
+{
+  pcheck_job_t *job=&pcheck_jobs[pcheck_first];
+  file_recovery_t *file_recovery=&job->file_recovery;
+  pcheck_result_t result;
+  int status;
+  pid_t res;
+  while((res=waitpid(job->pid, &status, (wait>0 ? 0 : WNOHANG))) < 0 && errno==EINTR);
+  if(res==0)
+    return -1;
+  if(pcheck_read(job->fd, &result, sizeof(result)) < 0)
+  {
+    /* The state of the check is gone with the process */
+    log_error("%s: the check of the file has failed, reject it\n", file_recovery->filename);
+    result.file_size=0;
+    result.ns=0;
+    result.time=file_recovery->time;
+    result.extension=file_recovery->extension;
+    result.file_rename=file_recovery->file_rename;
+  }
+  close(job->fd);
+  pcheck_first=(pcheck_first + 1) % PCHECK_MAX_WORKERS;
+  pcheck_nbr--;
+  file_recovery->file_size=result.file_size;
+  file_recovery->time=result.time;
+  file_recovery->extension=result.extension;
+  file_recovery->file_rename=result.file_rename;
+  if(file_profile > 0)
+  {
+    file_recovery->file_stat->file_ns+=result.ns;
+    if(file_recovery->file_size==0)
+      file_recovery->file_stat->false_positives++;
+  }
+  {
+    /* A rejected file gives its blocks back for the next passes, as
+     * the scan doesn't go back for it */
+    const uint64_t kept_end=(file_recovery->file_size > 0 ?
+	pcheck_kept_end(file_recovery, params->blocksize) : PH_INVALID_OFFSET);
+    const uint64_t start=file_recovery->location.start;
+    const pfstatus_t file_recovered=file_finish_checked(file_recovery, params, list_search_space);
+    if(file_recovered==PFSTATUS_BAD)
+      pcheck_add_rejected(start);
+    else if(file_recovered==PFSTATUS_OK_TRUNCATED)
+    {
+      if(kept_end < pcheck_rollback)
+	pcheck_rollback=kept_end;
+      pcheck_nbr_rollbacks++;
+    }
+  }
+  return 0;
+}
+
+static int pcheck_submit(file_recovery_t *file_recovery, struct ph_param *params, alloc_data_t *list_search_space, preader_t *reader)
+{
+  pcheck_job_t *job;
+  int pipe_fds[2];
+  pid_t pid;
+  if(pcheck_nbr >= pcheck_max)
+    pcheck_finish_first(params, list_search_space, 1);
+  if(file_write_sync(file_recovery) < 0)
+    return -1;
+  /* Only the calling thread exists in the child: the other threads of
+   * the scan mustn't hold a lock the check needs. The read-ahead, the
+   * checkpoint and the DFXML writers are idle when fork() is called */
+  preader_sync(reader);
+  session_wait();
+  fflush(file_recovery->handle);
+  log_flush();
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  fflush(NULL);
+  if(pipe(pipe_fds) < 0)
+    return -1;
+  pid=fork();
+  if(pid < 0)
+  {
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return -1;
+  }
+  if(pid==0)
+  {
+    close(pipe_fds[0]);
+    pcheck_child(pipe_fds[1], file_recovery);
+    close(pipe_fds[1]);
+    _exit(0);
+  }
+  close(pipe_fds[1]);
+  job=&pcheck_jobs[(pcheck_first + pcheck_nbr) % PCHECK_MAX_WORKERS];
+  job->pid=pid;
+  job->fd=pipe_fds[0];
+  pcheck_move_file_recovery(&job->file_recovery, file_recovery);
+  pcheck_nbr++;
+  pcheck_nbr_async++;
+  return 0;
+}
+
+/* Move the scan back to target, the blocks in between that are still
+ * in the search space are searched again */
+static void pcheck_move_back(alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const uint64_t target, const unsigned int blocksize)
+{
+  alloc_data_t *sp=*current_search_space;
+  if(sp!=list_search_space && target >= *offset)
+    return ;
+  /* First extent ending after target */
+  while(td_list_prev_entry(sp, list)!=list_search_space &&
+      td_list_prev_entry(sp, list)->end >= target)
+    sp=td_list_prev_entry(sp, list);
+  if(sp==list_search_space)
+    return ;
+  *current_search_space=sp;
+  if(sp->start < target && (target - sp->start) % blocksize == 0)
+    *offset=target;
+  else
+    *offset=sp->start;
+}
+#endif
+
+pfstatus_t pcheck_file_finish(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, preader_t *reader)
+{
+#ifdef HAVE_FORK
+  if(pcheck_max > 0 && options->paranoid > 0 && options->lowmem==0 &&
+      file_recovery->file_stat!=NULL && file_recovery->handle!=NULL &&
+      file_recovery->file_check!=NULL &&
+      file_recovery->file_check!=&file_check_size &&
+      file_recovery->file_check!=&file_check_size_min &&
+      file_recovery->file_check!=&file_check_size_max &&
+      file_recovery->file_size >= PCHECK_MIN_SIZE &&
+      params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
+      params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING &&
+      phash_enabled()==0 && pstream_enabled()==0 &&
+      pcheck_is_rejected(file_recovery->location.start)==0 &&
+      pcheck_submit(file_recovery, params, list_search_space, reader)==0)
+    return PFSTATUS_OK;
+#else
+  (void)reader;
+#endif
+  return file_finish2(file_recovery, params, options->paranoid, list_search_space);
+}
+
+void pcheck_collect(struct ph_param *params, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const int wait)
+{
+#ifdef HAVE_FORK
+  while(pcheck_nbr > 0 && pcheck_finish_first(params, list_search_space, wait)==0);
+  if(pcheck_rollback==PH_INVALID_OFFSET)
+    return ;
+  pcheck_move_back(list_search_space, current_search_space, offset, pcheck_rollback, params->blocksize);
+  pcheck_rollback=PH_INVALID_OFFSET;
+#endif
+}
+
+void pcheck_flush(struct ph_param *params, alloc_data_t *list_search_space)
+{
+#ifdef HAVE_FORK
+  while(pcheck_nbr > 0)
+    pcheck_finish_first(params, list_search_space, 1);
+#endif
+}
+
+void pcheck_finish(struct ph_param *params, alloc_data_t *list_search_space)
+{
+#ifdef HAVE_FORK
+  pcheck_flush(params, list_search_space);
+  pcheck_rollback=PH_INVALID_OFFSET;
+  if(pcheck_nbr_async > 0)
+    log_info("Asynchronous checks: %llu files, %llu truncated\n",
+	(long long unsigned)pcheck_nbr_async, (long long unsigned)pcheck_nbr_rollbacks);
+  pcheck_nbr_async=0;
+  pcheck_nbr_rollbacks=0;
+  free(pcheck_rejected);
+  pcheck_rejected=NULL;
+  pcheck_nbr_rejected=0;
+  pcheck_alloc_rejected=0;
+#endif
+}
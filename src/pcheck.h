@@ -0,0 +1,98 @@
+/*
+
+    File: pcheck.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PCHECK_H
+#define _PCHECK_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Asynchronous file checks: the file_check of a large file ended by its
+ * data_check runs in a forked process while the scan goes on. The blocks
+ * of the file stay claimed as if it was recovered whole. When the check
+ * is over, in the order the files have been submitted, the file is
+ * finished by file_finish_checked(): a truncated file gives its last
+ * blocks back to the search space and the scan goes back to them once
+ * no file is being carved, a rejected file gives all its blocks back
+ * for the next passes, as file_finish2() does. If the scan comes back to
+ * the header of a rejected file, that file is checked in the scan itself.
+ * The process inherits the state left by the data_check of the file,
+ * the checks don't need to be thread-safe. */
+
+/* Number of checks running at the same time, 0 to check the files in
+ * the scan itself (default) */
+void pcheck_set(const unsigned int workers);
+
+/*@
+  @ assigns \nothing;
+  @*/
+unsigned int pcheck_workers(void);
+
+/* Replaces file_finish2() at the end of a file found by the scan:
+ * return PFSTATUS_OK when the check has been queued. reader is the
+ * read-ahead of the scan, it's idle when the check is forked */
+/*@
+  @ requires \valid(file_recovery);
+  @ requires valid_file_recovery(file_recovery);
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires valid_list_search_space(list_search_space);
+  @ requires \valid(reader);
+  @ requires \separated(file_recovery, params, options, list_search_space);
+  @*/
+pfstatus_t pcheck_file_finish(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, preader_t *reader);
+
+/* Finish the files whose check is over, all of them if wait is set.
+ * If some blocks have been given back before the current location,
+ * the scan is moved back to them */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires valid_list_search_space(list_search_space);
+  @ requires \valid(current_search_space);
+  @ requires \valid(offset);
+  @ requires \separated(params, list_search_space, current_search_space, offset);
+  @*/
+void pcheck_collect(struct ph_param *params, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const int wait);
+
+/* Wait for every check and finish the files before the search space is
+ * saved, the scan goes back to the blocks given back later */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires valid_list_search_space(list_search_space);
+  @*/
+void pcheck_flush(struct ph_param *params, alloc_data_t *list_search_space);
+
+/* Same at the end of the scan, the blocks given back are left to the
+ * next passes */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires valid_list_search_space(list_search_space);
+  @*/
+void pcheck_finish(struct ph_param *params, alloc_data_t *list_search_space);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
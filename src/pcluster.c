@@ -0,0 +1,1095 @@
+/*
+
+    File: pcluster.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_FORK
+#endif
+#if !defined(HAVE_SYS_WAIT_H) || !defined(HAVE_DIRENT_H)
+#undef HAVE_FORK
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_FORK
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "hdpipe.h"
+#include "pblockmap.h"
+#include "log.h"
+#include "psearchn.h"
+#include "pshard.h"
+#include "pcluster.h"
+#include "sessionp.h"
+#include "dfxml.h"
+#include "ppack.h"
+
+extern int need_to_stop;
+
+#define PCLUSTER_VERSION	1
+/* Smaller jobs are not worth a dispatch */
+#define PCLUSTER_MIN_SIZE	(64*1024*1024)
+#define PCLUSTER_MAX_JOBS	4096
+#define PCLUSTER_MAX_LOCAL	64
+/* A worker reports every minute, it's considered lost after 20 minutes */
+#define PCLUSTER_TIMEOUT	(20*60)
+
+#ifdef HAVE_FORK
+typedef struct
+{
+  char id[64];
+  uint64_t disk_size;
+  unsigned int sector_size;
+  uint64_t part_offset;
+  uint64_t part_size;
+  unsigned int status;
+  unsigned int pass;
+  unsigned int blocksize;
+  unsigned int file_nbr;
+  int paranoid;
+  int keep_corrupted_file;
+  unsigned int mode_ext2;
+  unsigned int nbr_stats;
+  uint64_t formats;
+  unsigned int nbr_jobs;
+  unsigned int nbr_extents;
+  shard_extent_t *extents;
+} cluster_plan_t;
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  unsigned int dir_num;
+  unsigned int attempt;
+} cluster_job_t;
+
+/* State of the job carved by this worker, used by cluster_progress() */
+static struct
+{
+  const char *cluster_dir;
+  const char *node;
+  const char *id;
+  unsigned int k;
+  unsigned int file_nbr;
+  int cancelled;
+} cluster_current;
+
+static void cluster_path(char *path, const size_t size, const char *cluster_dir, const char *name, const unsigned int k)
+{
+  snprintf(path, size, "%s/%s.%u", cluster_dir, name, k);
+}
+
+static int cluster_exists(const char *path)
+{
+  struct stat st;
+  return (stat(path, &st)==0 ? 1 : 0);
+}
+
+/* Write path.tmp then rename it: the readers never see a partial file */
+static FILE *cluster_create(const char *path, char *tmp, const size_t size)
+{
+  snprintf(tmp, size, "%s.tmp.%d", path, (int)getpid());
+  return fopen(tmp, "w");
+}
+
+static int cluster_commit(FILE *handle, const char *tmp, const char *path)
+{
+  const int err=ferror(handle);
+  if(fclose(handle)!=0 || err!=0 || rename(tmp, path)!=0)
+  {
+    log_error("Cluster: can't write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+/* The workers must have the same file formats in the same order, the
+ * index in file_stats identifies the format of a header across nodes */
+static uint64_t cluster_formats_hash(const file_stat_t *file_stats, const unsigned int nbr_stats)
+{
+  uint64_t hash=0xcbf29ce484222325ULL;
+  unsigned int i;
+  for(i=0; i<nbr_stats; i++)
+  {
+    const char *ext=file_stats[i].file_hint->extension;
+    if(ext==NULL)
+      ext="";
+    for(; *ext!='\0'; ext++)
+    {
+      hash^=(unsigned char)*ext;
+      hash*=0x100000001b3ULL;
+    }
+    hash^='/';
+    hash*=0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static void cluster_write_extents(FILE *handle, const shard_extent_t *extents, const unsigned int nbr, const file_stat_t *file_stats, const unsigned int nbr_stats)
+{
+  unsigned int i;
+  fprintf(handle, "extents %u\n", nbr);
+  for(i=0; i<nbr; i++)
+  {
+    const file_stat_t *file_stat=extents[i].file_stat;
+    const int idx=(file_stat!=NULL && file_stat >= file_stats && file_stat < file_stats + nbr_stats ?
+	(int)(file_stat - file_stats) : -1);
+    fprintf(handle, "%llu %llu %d %u\n",
+	(long long unsigned)extents[i].start, (long long unsigned)extents[i].end,
+	idx, extents[i].data);
+  }
+}
+
+static shard_extent_t *cluster_read_extents(FILE *handle, unsigned int *nbr, file_stat_t *file_stats, const unsigned int nbr_stats)
+{
+  shard_extent_t *extents;
+  unsigned int i;
+  if(fscanf(handle, " extents %u", nbr)!=1)
+    return NULL;
+  extents=(shard_extent_t *)MALLOC((*nbr+1)*sizeof(shard_extent_t));
+  for(i=0; i<*nbr; i++)
+  {
+    long long unsigned start;
+    long long unsigned end;
+    int idx;
+    if(fscanf(handle, "%llu %llu %d %u", &start, &end, &idx, &extents[i].data)!=4 ||
+	start > end || (i>0 && start <= extents[i-1].end))
+    {
+      free(extents);
+      return NULL;
+    }
+    extents[i].start=start;
+    extents[i].end=end;
+    extents[i].file_stat=(idx>=0 && (unsigned int)idx < nbr_stats ? &file_stats[idx] : NULL);
+  }
+  return extents;
+}
+
+static int cluster_write_plan(const char *cluster_dir, const cluster_plan_t *plan, const file_stat_t *file_stats)
+{
+  char path[4096];
+  char tmp[4096];
+  FILE *handle;
+  snprintf(path, sizeof(path), "%s/plan", cluster_dir);
+  handle=cluster_create(path, tmp, sizeof(tmp));
+  if(handle==NULL)
+    return -1;
+  fprintf(handle, "photorec-cluster %u\n", PCLUSTER_VERSION);
+  fprintf(handle, "id %s\n", plan->id);
+  fprintf(handle, "disk %llu %u\n", (long long unsigned)plan->disk_size, plan->sector_size);
+  fprintf(handle, "partition %llu %llu\n",
+      (long long unsigned)plan->part_offset, (long long unsigned)plan->part_size);
+  fprintf(handle, "status %u pass %u blocksize %u file_nbr %u\n",
+      plan->status, plan->pass, plan->blocksize, plan->file_nbr);
+  fprintf(handle, "options %d %d %u\n", plan->paranoid, plan->keep_corrupted_file, plan->mode_ext2);
+  fprintf(handle, "formats %u %016llx\n", plan->nbr_stats, (long long unsigned)plan->formats);
+  fprintf(handle, "jobs %u\n", plan->nbr_jobs);
+  cluster_write_extents(handle, plan->extents, plan->nbr_extents, file_stats, plan->nbr_stats);
+  return cluster_commit(handle, tmp, path);
+}
+
+/* Read the plan, only its id if file_stats is NULL */
+static int cluster_read_plan(const char *cluster_dir, cluster_plan_t *plan, file_stat_t *file_stats)
+{
+  char path[4096];
+  FILE *handle;
+  unsigned int version=0;
+  long long unsigned disk_size;
+  long long unsigned part_offset;
+  long long unsigned part_size;
+  long long unsigned formats;
+  int res=-1;
+  memset(plan, 0, sizeof(*plan));
+  snprintf(path, sizeof(path), "%s/plan", cluster_dir);
+  handle=fopen(path, "r");
+  if(handle==NULL)
+    return -1;
+  if(fscanf(handle, "photorec-cluster %u id %63s", &version, plan->id)==2 &&
+      version==PCLUSTER_VERSION)
+  {
+    if(file_stats==NULL)
+      res=0;
+    else if(fscanf(handle, " disk %llu %u partition %llu %llu",
+	  &disk_size, &plan->sector_size, &part_offset, &part_size)==4 &&
+	fscanf(handle, " status %u pass %u blocksize %u file_nbr %u",
+	  &plan->status, &plan->pass, &plan->blocksize, &plan->file_nbr)==4 &&
+	fscanf(handle, " options %d %d %u",
+	  &plan->paranoid, &plan->keep_corrupted_file, &plan->mode_ext2)==3 &&
+	fscanf(handle, " formats %u %llx jobs %u",
+	  &plan->nbr_stats, &formats, &plan->nbr_jobs)==3 &&
+	plan->nbr_jobs <= PCLUSTER_MAX_JOBS && plan->blocksize > 0)
+    {
+      plan->disk_size=disk_size;
+      plan->part_offset=part_offset;
+      plan->part_size=part_size;
+      plan->formats=formats;
+      plan->extents=cluster_read_extents(handle, &plan->nbr_extents, file_stats, plan->nbr_stats);
+      if(plan->extents!=NULL)
+	res=0;
+    }
+  }
+  fclose(handle);
+  return res;
+}
+
+static int cluster_write_job(const char *cluster_dir, const unsigned int k, const cluster_job_t *job)
+{
+  char path[4096];
+  char tmp[4096];
+  FILE *handle;
+  cluster_path(path, sizeof(path), cluster_dir, "job", k);
+  handle=cluster_create(path, tmp, sizeof(tmp));
+  if(handle==NULL)
+    return -1;
+  fprintf(handle, "%llu %llu %u %u\n", (long long unsigned)job->start,
+      (long long unsigned)job->end, job->dir_num, job->attempt);
+  return cluster_commit(handle, tmp, path);
+}
+
+static int cluster_read_job(const char *path, cluster_job_t *job)
+{
+  FILE *handle=fopen(path, "r");
+  long long unsigned start;
+  long long unsigned end;
+  int res=-1;
+  if(handle==NULL)
+    return -1;
+  if(fscanf(handle, "%llu %llu %u %u", &start, &end, &job->dir_num, &job->attempt)==4)
+  {
+    job->start=start;
+    job->end=end;
+    res=0;
+  }
+  fclose(handle);
+  return res;
+}
+
+/* Remove the files of a previous plan, done.<id> and files.<id> are kept */
+static void cluster_cleanup(const char *cluster_dir, const int all)
+{
+  DIR *dir=opendir(cluster_dir);
+  struct dirent *entry;
+  if(dir==NULL)
+    return ;
+  while((entry=readdir(dir))!=NULL)
+  {
+    if(strncmp(entry->d_name, "job.", 4)==0 ||
+	strncmp(entry->d_name, "run.", 4)==0 ||
+	strncmp(entry->d_name, "progress.", 9)==0 ||
+	strncmp(entry->d_name, "manifest.", 9)==0 ||
+	strcmp(entry->d_name, "plan")==0 ||
+	(all>0 && strcmp(entry->d_name, "quit")==0) ||
+	(all>0 && strncmp(entry->d_name, "done.", 5)==0))
+    {
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s", cluster_dir, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+static int cluster_touch(const char *cluster_dir, const char *name, const char *id)
+{
+  char path[4096];
+  FILE *handle;
+  if(id!=NULL)
+    snprintf(path, sizeof(path), "%s/%s.%s", cluster_dir, name, id);
+  else
+    snprintf(path, sizeof(path), "%s/%s", cluster_dir, name);
+  handle=fopen(path, "w");
+  if(handle==NULL)
+  {
+    log_error("Cluster: can't create %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  fclose(handle);
+  return 0;
+}
+
+static int cluster_plan_done(const char *cluster_dir, const char *id)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/done.%s", cluster_dir, id);
+  return cluster_exists(path);
+}
+
+/* Called every minute by regular_session_save() during a job */
+static void cluster_progress(const struct ph_param *params)
+{
+  char path[4096];
+  char tmp[4096];
+  FILE *handle;
+  if(cluster_plan_done(cluster_current.cluster_dir, cluster_current.id))
+  {
+    /* The coordinator has given up on this plan, or has given the job
+     * to another worker and got its result */
+    cluster_current.cancelled=1;
+    need_to_stop=1;
+    return ;
+  }
+  cluster_path(path, sizeof(path), cluster_current.cluster_dir, "progress", cluster_current.k);
+  handle=cluster_create(path, tmp, sizeof(tmp));
+  if(handle==NULL)
+    return ;
+  fprintf(handle, "%s pid %d offset %llu files %u\n", cluster_current.node, (int)getpid(),
+      (long long unsigned)params->offset, params->file_nbr - cluster_current.file_nbr);
+  cluster_commit(handle, tmp, path);
+}
+
+/* List the files of the job, they are named after their first sector */
+static unsigned int cluster_write_files(FILE *handle, const struct ph_param *params, const cluster_job_t *job, const unsigned int dir_first)
+{
+  const char prefix=(params->status==STATUS_EXT2_ON_SAVE_EVERYTHING ||
+      params->status==STATUS_EXT2_OFF_SAVE_EVERYTHING ? 'b' : 'f');
+  unsigned int dir_num;
+  unsigned int nbr=0;
+  for(dir_num=dir_first; dir_num<=params->dir_num; dir_num++)
+  {
+    char dirname[2048];
+    DIR *dir;
+    struct dirent *entry;
+    snprintf(dirname, sizeof(dirname)-1, "%s.%u", params->recup_dir, dir_num);
+    dir=opendir(dirname);
+    if(dir==NULL)
+      continue;
+    while((entry=readdir(dir))!=NULL)
+    {
+      uint64_t offset;
+      if(entry->d_name[0]!=prefix || entry->d_name[1]<'0' || entry->d_name[1]>'9')
+	continue;
+      offset=params->partition->part_offset +
+	(uint64_t)strtoull(&entry->d_name[1], NULL, 10) * params->disk->sector_size;
+      /* Other jobs may have overflowed in the directories in between */
+      if(offset < job->start || offset > job->end)
+	continue;
+      fprintf(handle, "file %u %s\n", dir_num, entry->d_name);
+      nbr++;
+    }
+    closedir(dir);
+  }
+  return nbr;
+}
+
+static int cluster_write_manifest(const char *cluster_dir, const unsigned int k, const cluster_job_t *job, const struct ph_param *params, const alloc_data_t *list_search_space, const file_stat_t *base_stats, const unsigned int nbr_stats, const pstatus_t ind_stop, const char *node)
+{
+  char path[4096];
+  char tmp[4096];
+  FILE *handle;
+  shard_extent_t *extents;
+  unsigned int nbr;
+  unsigned int i;
+  /* A worker considered as lost must not replace the manifest of the
+   * next attempt */
+  snprintf(path, sizeof(path), "%s/manifest.%u.%u", cluster_dir, k, job->attempt);
+  handle=cluster_create(path, tmp, sizeof(tmp));
+  if(handle==NULL)
+    return -1;
+  fprintf(handle, "result %u %d %llu %u %u %s\n", job->attempt, (int)ind_stop,
+      (long long unsigned)params->offset, params->file_nbr - cluster_current.file_nbr,
+      params->dir_num, node);
+  fprintf(handle, "stats %u\n", nbr_stats);
+  for(i=0; i<nbr_stats; i++)
+  {
+    const file_stat_t *file_stat=&params->file_stats[i];
+    fprintf(handle, "%u %llu %llu %llu %llu %llu %llu\n",
+	file_stat->recovered - base_stats[i].recovered,
+	(long long unsigned)(file_stat->header_calls - base_stats[i].header_calls),
+	(long long unsigned)(file_stat->header_hits - base_stats[i].header_hits),
+	(long long unsigned)(file_stat->false_positives - base_stats[i].false_positives),
+	(long long unsigned)(file_stat->header_ns - base_stats[i].header_ns),
+	(long long unsigned)(file_stat->data_ns - base_stats[i].data_ns),
+	(long long unsigned)(file_stat->file_ns - base_stats[i].file_ns));
+  }
+  cluster_write_files(handle, params, job, job->dir_num);
+  fprintf(handle, "end-files\n");
+  nbr=shard_search_space_to_array(list_search_space, &extents);
+  cluster_write_extents(handle, extents, nbr, params->file_stats, nbr_stats);
+  free(extents);
+  return cluster_commit(handle, tmp, path);
+}
+
+static void cluster_run_job(struct ph_param *params, const struct ph_options *options, const char *cluster_dir, const char *node, const cluster_plan_t *plan, const unsigned int k, const cluster_job_t *job)
+{
+  alloc_data_t list_search_space;
+  file_stat_t *base_stats;
+  char path[4096];
+  pstatus_t ind_stop;
+  TD_INIT_LIST_HEAD(&list_search_space.list);
+  shard_rebuild_search_space(&list_search_space, plan->extents, plan->nbr_extents);
+  base_stats=(file_stat_t *)MALLOC((plan->nbr_stats+1)*sizeof(file_stat_t));
+  memcpy(base_stats, params->file_stats, plan->nbr_stats*sizeof(file_stat_t));
+  params->offset=job->start;
+  params->offset_end=job->end;
+  params->dir_num=job->dir_num;
+  params->file_nbr=plan->file_nbr;
+  cluster_current.cluster_dir=cluster_dir;
+  cluster_current.node=node;
+  cluster_current.id=plan->id;
+  cluster_current.k=k;
+  cluster_current.file_nbr=params->file_nbr;
+  cluster_current.cancelled=0;
+  log_info("Cluster: node %s carves job %u (%llu-%llu), attempt %u\n", node, k,
+      (long long unsigned)job->start, (long long unsigned)job->end, job->attempt);
+  /* The coordinator saves the session once the manifests are merged */
+  session_disable();
+  session_set_progress(&cluster_progress);
+  cluster_progress(params);
+  shard_forget_headers(&list_search_space, job->start);
+  ind_stop=photorec_aux(params, options, &list_search_space);
+  session_set_progress(NULL);
+  /* The files must have their final names before being listed */
+  file_rename_deferred();
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  if(cluster_current.cancelled>0)
+  {
+    log_info("Cluster: job %u is no more needed\n", k);
+    need_to_stop=0;
+  }
+  else if(cluster_write_manifest(cluster_dir, k, job, params, &list_search_space, base_stats, plan->nbr_stats, ind_stop, node)==0)
+  {
+    cluster_path(path, sizeof(path), cluster_dir, "run", k);
+    unlink(path);
+  }
+  cluster_path(path, sizeof(path), cluster_dir, "progress", k);
+  unlink(path);
+  free_search_space(&list_search_space);
+  free(base_stats);
+  log_flush();
+}
+
+static int cluster_check_plan(const struct ph_param *params, const struct ph_options *options, const cluster_plan_t *plan, const unsigned int nbr_stats)
+{
+  if(plan->disk_size!=params->disk->disk_size || plan->sector_size!=params->disk->sector_size)
+  {
+    log_error("Cluster: plan %s is for a disk of %llu bytes, not %llu\n", plan->id,
+	(long long unsigned)plan->disk_size, (long long unsigned)params->disk->disk_size);
+    return -1;
+  }
+  if(plan->part_offset!=params->partition->part_offset || plan->part_size!=params->partition->part_size)
+  {
+    log_error("Cluster: plan %s is for another partition\n", plan->id);
+    return -1;
+  }
+  if(plan->nbr_stats!=nbr_stats || plan->formats!=cluster_formats_hash(params->file_stats, nbr_stats))
+  {
+    log_error("Cluster: plan %s has other file formats enabled\n", plan->id);
+    return -1;
+  }
+  if(plan->paranoid!=options->paranoid || plan->keep_corrupted_file!=options->keep_corrupted_file ||
+      plan->mode_ext2!=options->mode_ext2)
+  {
+    log_error("Cluster: plan %s uses other options\n", plan->id);
+    return -1;
+  }
+  return 0;
+}
+
+/* Claim and carve the jobs of the plan until the coordinator is done */
+static int cluster_serve(struct ph_param *params, const struct ph_options *options, const char *cluster_dir, const char *node)
+{
+  cluster_plan_t plan;
+  unsigned int nbr_stats;
+  const unsigned int blocksize=params->blocksize;
+  const photorec_status_t status=params->status;
+  const unsigned int pass=params->pass;
+  for(nbr_stats=0; params->file_stats[nbr_stats].file_hint!=NULL; nbr_stats++);
+  if(cluster_read_plan(cluster_dir, &plan, params->file_stats)<0)
+    return -1;
+  if(cluster_check_plan(params, options, &plan, nbr_stats)<0)
+  {
+    free(plan.extents);
+    return -1;
+  }
+  params->blocksize=plan.blocksize;
+  params->status=(photorec_status_t)plan.status;
+  params->pass=plan.pass;
+  while(need_to_stop==0 && cluster_plan_done(cluster_dir, plan.id)==0)
+  {
+    cluster_plan_t current;
+    unsigned int k;
+    for(k=0; k<plan.nbr_jobs && need_to_stop==0; k++)
+    {
+      char job_path[4096];
+      char run_path[4096];
+      cluster_job_t job;
+      cluster_path(job_path, sizeof(job_path), cluster_dir, "job", k);
+      cluster_path(run_path, sizeof(run_path), cluster_dir, "run", k);
+      /* rename() is atomic, only one worker gets the job */
+      if(rename(job_path, run_path)==0 && cluster_read_job(run_path, &job)==0)
+	cluster_run_job(params, options, cluster_dir, node, &plan, k, &job);
+    }
+    /* The coordinator may dispatch again the job of a lost worker */
+#ifdef HAVE_SLEEP
+    sleep(1);
+#endif
+    if(cluster_read_plan(cluster_dir, &current, NULL)<0 || strcmp(current.id, plan.id)!=0)
+      break;
+  }
+  free(plan.extents);
+  params->blocksize=blocksize;
+  params->status=status;
+  params->pass=pass;
+  return 0;
+}
+
+/* Read the result of a job, the statistics are the counts of the job */
+static int cluster_read_manifest(const char *path, shard_t *shard, unsigned int *attempt, file_stat_t *stats, const unsigned int nbr_stats, file_stat_t *file_stats, char **files, char *node, const size_t node_size)
+{
+  FILE *handle=fopen(path, "r");
+  char line[4096];
+  size_t files_size=0;
+  size_t files_len=0;
+  unsigned int nbr;
+  unsigned int i;
+  int ind_stop;
+  long long unsigned offset;
+  char node_tmp[256];
+  int res=-1;
+  *files=NULL;
+  if(handle==NULL)
+    return -1;
+  if(fscanf(handle, "result %u %d %llu %u %u %255s", attempt, &ind_stop, &offset,
+	&shard->report.file_nbr, &shard->report.dir_num, node_tmp)!=6 ||
+      fscanf(handle, " stats %u", &nbr)!=1 || nbr!=nbr_stats)
+  {
+    fclose(handle);
+    return -1;
+  }
+  snprintf(node, node_size, "%s", node_tmp);
+  shard->report.ind_stop=ind_stop;
+  shard->report.offset=offset;
+  memset(stats, 0, nbr_stats*sizeof(file_stat_t));
+  for(i=0; i<nbr_stats; i++)
+  {
+    long long unsigned v[6];
+    if(fscanf(handle, "%u %llu %llu %llu %llu %llu %llu", &stats[i].recovered,
+	  &v[0], &v[1], &v[2], &v[3], &v[4], &v[5])!=7)
+    {
+      fclose(handle);
+      return -1;
+    }
+    stats[i].header_calls=v[0];
+    stats[i].header_hits=v[1];
+    stats[i].false_positives=v[2];
+    stats[i].header_ns=v[3];
+    stats[i].data_ns=v[4];
+    stats[i].file_ns=v[5];
+  }
+  /* Skip the end of the stats line */
+  if(fgets(line, sizeof(line), handle)==NULL)
+  {
+    fclose(handle);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), handle)!=NULL && strncmp(line, "file ", 5)==0)
+  {
+    const size_t len=strlen(line+5);
+    if(files_len + len + 1 > files_size)
+    {
+      char *tmp;
+      files_size=(files_size + len + 1) * 2;
+      tmp=(char *)MALLOC(files_size);
+      if(*files!=NULL)
+      {
+	memcpy(tmp, *files, files_len);
+	free(*files);
+      }
+      *files=tmp;
+    }
+    memcpy(*files + files_len, line+5, len);
+    files_len+=len;
+    (*files)[files_len]='\0';
+  }
+  if(strncmp(line, "end-files", 9)==0)
+  {
+    shard->extents=cluster_read_extents(handle, &shard->report.nbr, file_stats, nbr_stats);
+    if(shard->extents!=NULL)
+      res=0;
+  }
+  fclose(handle);
+  if(res<0)
+  {
+    free(*files);
+    *files=NULL;
+  }
+  return res;
+}
+
+static void cluster_write_file_list(const char *cluster_dir, const char *id, const struct ph_param *params, char **files, char **nodes, const unsigned int nbr_jobs)
+{
+  char path[4096];
+  char tmp[4096];
+  FILE *handle;
+  unsigned int k;
+  snprintf(path, sizeof(path), "%s/files.%s", cluster_dir, id);
+  handle=cluster_create(path, tmp, sizeof(tmp));
+  if(handle==NULL)
+    return ;
+  for(k=0; k<nbr_jobs; k++)
+  {
+    const char *pos;
+    for(pos=files[k]; pos!=NULL && *pos!='\0'; )
+    {
+      const char *eol=strchr(pos, '\n');
+      char name[2048];
+      unsigned int dir_num;
+      const size_t len=(eol!=NULL ? (size_t)(eol - pos) : strlen(pos));
+      char filename[4096];
+      if(len < sizeof(name) && sscanf(pos, "%u %2047s", &dir_num, name)==2)
+      {
+	snprintf(filename, sizeof(filename), "%s.%u/%s", params->recup_dir, dir_num, name);
+	/* Duplicates found inside the file of a previous job are gone */
+	if(cluster_exists(filename))
+	  fprintf(handle, "%u %s %s\n", k, (nodes[k]!=NULL ? nodes[k] : "-"), filename);
+      }
+      pos+=len;
+      if(*pos=='\n')
+	pos++;
+    }
+  }
+  cluster_commit(handle, tmp, path);
+}
+#endif
+
+pstatus_t photorec_cluster(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const char *cluster_dir, const unsigned int nbr_jobs_max, const unsigned int local_workers)
+{
+#ifdef HAVE_FORK
+  struct td_list_head *search_walker = NULL;
+  cluster_plan_t plan;
+  shard_t *shards;
+  cluster_job_t *jobs;
+  time_t *last_change;
+  char **progress;
+  char **files;
+  char **nodes;
+  int *done;
+  pid_t locals[PCLUSTER_MAX_LOCAL];
+  shard_extent_t *orig;
+  shard_extent_t *merged;
+  file_stat_t *stats;
+  file_stat_t *zero_stats;
+  const unsigned int dir_first=params->dir_num;
+  unsigned int nbr_locals=0;
+  unsigned int nbr_orig;
+  unsigned int nbr_merged;
+  unsigned int nbr_jobs=(nbr_jobs_max > PCLUSTER_MAX_JOBS ? PCLUSTER_MAX_JOBS : nbr_jobs_max);
+  unsigned int nbr_stats;
+  unsigned int remaining;
+  unsigned int k;
+  uint64_t total=0;
+  uint64_t job_size;
+  pstatus_t ind_stop;
+  if(nbr_jobs==0 || params->offset!=PH_INVALID_OFFSET || td_list_empty(&list_search_space->list) ||
+      disk_is_pipe(params->disk) > 0 || pblockmap_enabled() > 0)
+    return photorec_shard(params, options, list_search_space, local_workers);
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    total+=current_search_space->end - current_search_space->start + 1;
+  }
+  if(total / nbr_jobs < PCLUSTER_MIN_SIZE)
+    nbr_jobs=total / PCLUSTER_MIN_SIZE;
+  if(nbr_jobs==0)
+    nbr_jobs=1;
+#ifdef __MINGW32__
+  if(mkdir(cluster_dir)<0 && errno!=EEXIST)
+#else
+  if(mkdir(cluster_dir, 0775)<0 && errno!=EEXIST)
+#endif
+  {
+    log_error("Cluster: can't create %s: %s, local scan\n", cluster_dir, strerror(errno));
+    return photorec_shard(params, options, list_search_space, local_workers);
+  }
+  cluster_cleanup(cluster_dir, 1);
+  job_size=(total + nbr_jobs - 1) / nbr_jobs;
+  job_size=(job_size + params->blocksize - 1) / params->blocksize * params->blocksize;
+  shards=(shard_t *)MALLOC(nbr_jobs*sizeof(shard_t));
+  jobs=(cluster_job_t *)MALLOC(nbr_jobs*sizeof(cluster_job_t));
+  last_change=(time_t *)MALLOC(nbr_jobs*sizeof(time_t));
+  progress=(char **)MALLOC(nbr_jobs*sizeof(char *));
+  files=(char **)MALLOC(nbr_jobs*sizeof(char *));
+  nodes=(char **)MALLOC(nbr_jobs*sizeof(char *));
+  done=(int *)MALLOC(nbr_jobs*sizeof(int));
+  memset(shards, 0, nbr_jobs*sizeof(shard_t));
+  shard_split(list_search_space, shards, nbr_jobs, job_size);
+  for(nbr_stats=0; params->file_stats[nbr_stats].file_hint!=NULL; nbr_stats++);
+  stats=(file_stat_t *)MALLOC((nbr_stats+1)*sizeof(file_stat_t));
+  zero_stats=(file_stat_t *)MALLOC((nbr_stats+1)*sizeof(file_stat_t));
+  memset(zero_stats, 0, (nbr_stats+1)*sizeof(file_stat_t));
+  nbr_orig=shard_search_space_to_array(list_search_space, &orig);
+  memset(&plan, 0, sizeof(plan));
+  snprintf(plan.id, sizeof(plan.id), "%lu-%d-%u", (unsigned long)time(NULL), (int)getpid(), params->pass);
+  plan.disk_size=params->disk->disk_size;
+  plan.sector_size=params->disk->sector_size;
+  plan.part_offset=params->partition->part_offset;
+  plan.part_size=params->partition->part_size;
+  plan.status=params->status;
+  plan.pass=params->pass;
+  plan.blocksize=params->blocksize;
+  plan.file_nbr=params->file_nbr;
+  plan.paranoid=options->paranoid;
+  plan.keep_corrupted_file=options->keep_corrupted_file;
+  plan.mode_ext2=options->mode_ext2;
+  plan.nbr_stats=nbr_stats;
+  plan.formats=cluster_formats_hash(params->file_stats, nbr_stats);
+  plan.nbr_jobs=nbr_jobs;
+  plan.nbr_extents=nbr_orig;
+  plan.extents=orig;
+  /* Each job writes to its own directory, see photorec_shard() */
+  for(k=0; k<nbr_jobs; k++)
+  {
+    shards[k].dir_num=(k==0 ? params->dir_num : photorec_mkdir(params->recup_dir, shards[k-1].dir_num+1));
+    shards[k].ok=0;
+    jobs[k].start=shards[k].start;
+    jobs[k].end=shards[k].end;
+    jobs[k].dir_num=shards[k].dir_num;
+    jobs[k].attempt=0;
+    last_change[k]=0;
+    progress[k]=NULL;
+    files[k]=NULL;
+    nodes[k]=NULL;
+    done[k]=0;
+    cluster_write_job(cluster_dir, k, &jobs[k]);
+  }
+  /* The workers look for the plan once the jobs are there */
+  if(cluster_write_plan(cluster_dir, &plan, params->file_stats)<0)
+  {
+    log_error("Cluster: can't write the plan in %s, local scan\n", cluster_dir);
+    cluster_cleanup(cluster_dir, 1);
+    free(shards);
+    free(jobs);
+    free(last_change);
+    free(progress);
+    free(files);
+    free(nodes);
+    free(done);
+    free(stats);
+    free(zero_stats);
+    free(orig);
+    return photorec_shard(params, options, list_search_space, local_workers);
+  }
+  log_info("Cluster: plan %s in %s, %u jobs of %llu bytes\n", plan.id, cluster_dir,
+      nbr_jobs, (long long unsigned)job_size);
+  /* See photorec_shard() */
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  file_rename_deferred();
+  ppack_close();
+  log_flush();
+  fflush(NULL);
+  for(nbr_locals=0; nbr_locals<local_workers && nbr_locals<nbr_jobs && nbr_locals<PCLUSTER_MAX_LOCAL; nbr_locals++)
+  {
+    locals[nbr_locals]=fork();
+    if(locals[nbr_locals] < 0)
+      break;
+    if(locals[nbr_locals]==0)
+    {
+      char node[64];
+      snprintf(node, sizeof(node), "local.%u", nbr_locals);
+      cluster_serve(params, options, cluster_dir, node);
+#ifdef ENABLE_DFXML
+      xml_flush();
+#endif
+      ppack_close();
+      log_flush();
+      fflush(NULL);
+      _exit(0);
+    }
+  }
+  merged=orig;
+  nbr_merged=nbr_orig;
+  remaining=nbr_jobs;
+  while(remaining>0 && need_to_stop==0)
+  {
+    const time_t now=time(NULL);
+    int changed=0;
+    for(k=0; k<nbr_jobs && need_to_stop==0; k++)
+    {
+      char path[4096];
+      if(done[k]>0)
+	continue;
+      snprintf(path, sizeof(path), "%s/manifest.%u.%u", cluster_dir, k, jobs[k].attempt);
+      if(cluster_exists(path))
+      {
+	shard_t result;
+	unsigned int attempt=0;
+	unsigned int i;
+	char *job_files;
+	char node[256];
+	memset(&result, 0, sizeof(result));
+	changed=1;
+	if(cluster_read_manifest(path, &result, &attempt, stats, nbr_stats, params->file_stats, &job_files, node, sizeof(node))<0)
+	{
+	  log_error("Cluster: invalid manifest for job %u, its data is kept in the search space\n", k);
+	  unlink(path);
+	  done[k]=1;
+	  remaining--;
+	  continue;
+	}
+	unlink(path);
+	if(attempt!=jobs[k].attempt)
+	{
+	  /* Result of a worker considered as lost */
+	  free(job_files);
+	  free(result.extents);
+	  continue;
+	}
+	params->file_nbr+=result.report.file_nbr;
+	if(params->dir_num < result.report.dir_num)
+	  params->dir_num=result.report.dir_num;
+	for(i=0; i<nbr_stats; i++)
+	  shard_merge_stats(&params->file_stats[i], &stats[i], &zero_stats[i]);
+	/* Keep the files and the consumed data of the previous attempts */
+	if(files[k]==NULL)
+	  files[k]=job_files;
+	else if(job_files!=NULL)
+	{
+	  char *tmp=(char *)MALLOC(strlen(files[k]) + strlen(job_files) + 1);
+	  strcpy(tmp, files[k]);
+	  strcat(tmp, job_files);
+	  free(files[k]);
+	  free(job_files);
+	  files[k]=tmp;
+	}
+	free(nodes[k]);
+	nodes[k]=strdup(node);
+	if(shards[k].extents==NULL)
+	{
+	  shards[k].extents=result.extents;
+	  shards[k].report.nbr=result.report.nbr;
+	}
+	else
+	{
+	  shard_extent_t *tmp;
+	  shards[k].report.nbr=shard_extents_intersect(shards[k].extents, shards[k].report.nbr,
+	      result.extents, result.report.nbr, &tmp);
+	  free(shards[k].extents);
+	  free(result.extents);
+	  shards[k].extents=tmp;
+	}
+	{
+	  shard_extent_t *tmp;
+	  const unsigned int nbr_tmp=shard_extents_intersect(merged, nbr_merged, shards[k].extents, shards[k].report.nbr, &tmp);
+	  if(merged!=orig)
+	    free(merged);
+	  merged=tmp;
+	  nbr_merged=nbr_tmp;
+	}
+	shards[k].report.ind_stop=result.report.ind_stop;
+	shards[k].report.offset=result.report.offset;
+	shards[k].report.dir_num=result.report.dir_num;
+	shards[k].ok=1;
+	log_info("Cluster: job %u done by %s, %u files\n", k, node, result.report.file_nbr);
+	if(result.report.ind_stop==PSTATUS_STOP && result.report.offset!=PH_INVALID_OFFSET &&
+	    result.report.offset > jobs[k].start && result.report.offset <= jobs[k].end)
+	{
+	  /* The worker has been interrupted, dispatch the rest of the job */
+	  jobs[k].start=result.report.offset;
+	  jobs[k].dir_num=result.report.dir_num;
+	  jobs[k].attempt++;
+	  last_change[k]=0;
+	  log_info("Cluster: job %u stopped at %llu, the rest is dispatched again\n",
+	      k, (long long unsigned)jobs[k].start);
+	  cluster_write_job(cluster_dir, k, &jobs[k]);
+	}
+	else
+	{
+	  done[k]=1;
+	  remaining--;
+	}
+	/* The coordinator session has the progress of all the workers */
+	shard_rebuild_search_space(list_search_space, merged, nbr_merged);
+	session_save(list_search_space, params, options);
+	continue;
+      }
+      cluster_path(path, sizeof(path), cluster_dir, "run", k);
+      if(cluster_exists(path))
+      {
+	char line[512];
+	FILE *handle;
+	cluster_path(path, sizeof(path), cluster_dir, "progress", k);
+	handle=fopen(path, "r");
+	line[0]='\0';
+	if(handle!=NULL)
+	{
+	  if(fgets(line, sizeof(line), handle)==NULL)
+	    line[0]='\0';
+	  fclose(handle);
+	}
+	if(last_change[k]==0 || (line[0]!='\0' && (progress[k]==NULL || strcmp(progress[k], line)!=0)))
+	{
+	  if(line[0]!='\0')
+	  {
+	    free(progress[k]);
+	    progress[k]=strdup(line);
+	    log_info("Cluster: job %u: %s", k, line);
+	  }
+	  last_change[k]=now;
+	}
+	else if(now > last_change[k] + PCLUSTER_TIMEOUT)
+	{
+	  char job_path[4096];
+	  cluster_path(job_path, sizeof(job_path), cluster_dir, "job", k);
+	  cluster_path(path, sizeof(path), cluster_dir, "run", k);
+	  log_warning("Cluster: no news from the worker of job %u, dispatched again\n", k);
+	  jobs[k].attempt++;
+	  last_change[k]=0;
+	  unlink(path);
+	  cluster_path(path, sizeof(path), cluster_dir, "progress", k);
+	  unlink(path);
+	  cluster_write_job(cluster_dir, k, &jobs[k]);
+	  changed=1;
+	}
+      }
+    }
+    if(changed==0)
+    {
+#ifdef HAVE_SLEEP
+      sleep(1);
+#endif
+    }
+  }
+  if(remaining>0)
+    log_info("Cluster: plan %s stopped, %u jobs left\n", plan.id, remaining);
+  /* The workers stop their current job and wait for the next plan */
+  cluster_touch(cluster_dir, "done", plan.id);
+  for(k=0; k<nbr_locals; k++)
+  {
+    int status=0;
+    while(waitpid(locals[k], &status, 0) < 0 && errno==EINTR);
+  }
+  shard_remove_duplicates(params, shards, nbr_jobs, nbr_stats, orig, nbr_orig, dir_first);
+  cluster_write_file_list(cluster_dir, plan.id, params, files, nodes, nbr_jobs);
+  shard_rebuild_search_space(list_search_space, merged, nbr_merged);
+  if(merged!=orig)
+    free(merged);
+  cluster_cleanup(cluster_dir, 0);
+  params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
+  ind_stop=(remaining>0 ? PSTATUS_STOP : PSTATUS_OK);
+  for(k=0; k<nbr_jobs; k++)
+  {
+    if(ind_stop==PSTATUS_OK && shards[k].ok>0 && shards[k].report.ind_stop!=PSTATUS_OK)
+    {
+      ind_stop=(pstatus_t)shards[k].report.ind_stop;
+      params->offset=shards[k].report.offset;
+    }
+    free(shards[k].extents);
+    free(progress[k]);
+    free(files[k]);
+    free(nodes[k]);
+  }
+  free(shards);
+  free(jobs);
+  free(last_change);
+  free(progress);
+  free(files);
+  free(nodes);
+  free(done);
+  free(stats);
+  free(zero_stats);
+  free(orig);
+  return ind_stop;
+#else
+  (void)cluster_dir;
+  (void)nbr_jobs_max;
+  return photorec_shard(params, options, list_search_space, local_workers);
+#endif
+}
+
+int photorec_cluster_worker(struct ph_param *params, const struct ph_options *options, const char *cluster_dir, const char *node)
+{
+#ifdef HAVE_FORK
+  char last_id[64];
+  last_id[0]='\0';
+  log_info("Cluster: node %s waits for jobs in %s\n", node, cluster_dir);
+  while(need_to_stop==0)
+  {
+    char path[4096];
+    cluster_plan_t plan;
+    snprintf(path, sizeof(path), "%s/quit", cluster_dir);
+    if(cluster_exists(path))
+      break;
+    if(cluster_read_plan(cluster_dir, &plan, NULL)==0 && strcmp(plan.id, last_id)!=0 &&
+	cluster_plan_done(cluster_dir, plan.id)==0)
+    {
+      log_info("Cluster: node %s joins plan %s\n", node, plan.id);
+      if(cluster_serve(params, options, cluster_dir, node)<0)
+	log_error("Cluster: node %s can't carve plan %s\n", node, plan.id);
+      snprintf(last_id, sizeof(last_id), "%s", plan.id);
+      log_flush();
+    }
+#ifdef HAVE_SLEEP
+    sleep(1);
+#endif
+  }
+  log_info("Cluster: node %s exits\n", node);
+  return 0;
+#else
+  (void)params;
+  (void)options;
+  (void)cluster_dir;
+  (void)node;
+  return -1;
+#endif
+}
+
+int photorec_cluster_quit(const char *cluster_dir)
+{
+#ifdef HAVE_FORK
+  return cluster_touch(cluster_dir, "quit", NULL);
+#else
+  (void)cluster_dir;
+  return -1;
+#endif
+}
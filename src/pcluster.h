@@ -0,0 +1,75 @@
+/*
+
+    File: pcluster.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PCLUSTER_H
+#define _PCLUSTER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Distributed scan: a coordinator splits the search space into jobs
+ * written in a directory shared by all the nodes, e.g. over NFS.
+ * The workers claim a job by renaming job.<k> to run.<k>, carve it with
+ * photorec_aux() like a photorec_shard() worker, report their progress in
+ * progress.<k> and their result in manifest.<k>: the remaining search space,
+ * the statistics and the recovered files. The coordinator merges each
+ * manifest in its session as soon as it arrives, dispatches again the jobs
+ * stopped before their end or whose worker is silent for too long, removes
+ * the files found inside data consumed across a job boundary and writes the
+ * list of the recovered files in files.<plan id>.
+ * The recovery directories must be on a storage shared by the nodes too. */
+
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @ requires valid_read_string(cluster_dir);
+  @ requires \separated(params, options, list_search_space);
+  @ decreases 0;
+  @ ensures  valid_ph_param(params);
+  @*/
+pstatus_t photorec_cluster(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const char *cluster_dir, const unsigned int nbr_jobs, const unsigned int local_workers);
+
+/* Carve the jobs of the successive plans found in cluster_dir until a quit
+ * marker is written or need_to_stop is set. params must describe the same
+ * disk, partition and file formats as the coordinator.
+ * Return 0, -1 if fork() or the directory functions are unavailable */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires valid_read_string(cluster_dir);
+  @ requires valid_read_string(node);
+  @ decreases 0;
+  @*/
+int photorec_cluster_worker(struct ph_param *params, const struct ph_options *options, const char *cluster_dir, const char *node);
+
+/* Write the quit marker, the workers exit once their current plan is done */
+/*@
+  @ requires valid_read_string(cluster_dir);
+  @*/
+int photorec_cluster_quit(const char *cluster_dir);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,478 @@
+/*
+
+    File: pcontrol.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#if !defined(DISABLED_FOR_FRAMAC)
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <errno.h>
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H) && defined(HAVE_FCNTL_H)
+#define PCONTROL_SUPPORTED
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "hdstats.h"
+#include "log.h"
+#include "pcontrol.h"
+
+extern int need_to_stop;
+
+#ifdef PCONTROL_SUPPORTED
+#define PCONTROL_MAX_CLIENTS	8
+#define PCONTROL_LINE_SIZE	256
+#define PCONTROL_MAX_LAYERS	16
+
+struct pcontrol_client
+{
+  int fd;
+  int watch;
+  unsigned int len;
+  char line[PCONTROL_LINE_SIZE];
+};
+
+struct pcontrol_buf
+{
+  char data[65536];
+  unsigned int len;
+};
+
+static int pcontrol_fd=-1;
+static char *pcontrol_path=NULL;
+static struct pcontrol_client pcontrol_clients[PCONTROL_MAX_CLIENTS];
+static struct pcontrol_buf pcontrol_reply;
+static int pcontrol_paused=0;
+static int pcontrol_checkpoint=0;
+static uint64_t pcontrol_prev_offset=0;
+static uint64_t pcontrol_prev_clock=0;
+static uint64_t pcontrol_bytes_per_second=0;
+
+static void pcontrol_puts(struct pcontrol_buf *buf, const char *str)
+{
+  const size_t size=strlen(str);
+  if(buf->len + size >= sizeof(buf->data))
+    return ;
+  memcpy(&buf->data[buf->len], str, size);
+  buf->len+=size;
+}
+
+static void pcontrol_put_u64(struct pcontrol_buf *buf, const char *name, const uint64_t value)
+{
+  char tmp[64];
+  snprintf(tmp, sizeof(tmp), ",\"%s\":%llu", name, (long long unsigned)value);
+  pcontrol_puts(buf, tmp);
+}
+
+static void pcontrol_put_string(struct pcontrol_buf *buf, const char *value)
+{
+  char tmp[8];
+  pcontrol_puts(buf, "\"");
+  for(;*value!='\0'; value++)
+  {
+    const unsigned char c=(const unsigned char)*value;
+    if(c=='"' || c=='\\')
+    {
+      tmp[0]='\\';
+      tmp[1]=c;
+      tmp[2]='\0';
+    }
+    else if(c < 0x20)
+      snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+    else
+    {
+      tmp[0]=c;
+      tmp[1]='\0';
+    }
+    pcontrol_puts(buf, tmp);
+  }
+  pcontrol_puts(buf, "\"");
+}
+
+static void pcontrol_client_close(struct pcontrol_client *client)
+{
+  close(client->fd);
+  client->fd=-1;
+  client->watch=0;
+  client->len=0;
+}
+
+/* A client that doesn't read its replies is dropped, the scan never
+ * waits for it */
+static void pcontrol_send(struct pcontrol_client *client, const struct pcontrol_buf *buf)
+{
+  ssize_t res;
+#ifdef MSG_NOSIGNAL
+  res=send(client->fd, buf->data, buf->len, MSG_NOSIGNAL);
+#else
+  res=send(client->fd, buf->data, buf->len, 0);
+#endif
+  if(res < 0 || (size_t)res != buf->len)
+    pcontrol_client_close(client);
+}
+
+static void pcontrol_status(struct pcontrol_buf *buf, const struct ph_param *params, const uint64_t offset)
+{
+  disk_stats_summary_t summaries[PCONTROL_MAX_LAYERS];
+  unsigned int nbr_layers;
+  unsigned int i;
+  int first=1;
+  buf->len=0;
+  pcontrol_puts(buf, "{\"phase\":");
+  pcontrol_put_string(buf, status_to_name(params->status));
+  pcontrol_puts(buf, pcontrol_paused!=0 ? ",\"paused\":true" : ",\"paused\":false");
+  pcontrol_put_u64(buf, "pass", params->pass);
+  pcontrol_put_u64(buf, "offset", offset);
+  if(params->partition!=NULL)
+    pcontrol_put_u64(buf, "size", params->partition->part_size);
+  pcontrol_put_u64(buf, "elapsed", time(NULL) - params->real_start_time);
+  pcontrol_put_u64(buf, "bytes_per_second", pcontrol_bytes_per_second);
+  pcontrol_put_u64(buf, "files", params->file_nbr);
+  pcontrol_puts(buf, ",\"formats\":{");
+  if(params->file_stats!=NULL)
+  {
+    const file_stat_t *file_stat;
+    for(file_stat=params->file_stats; file_stat->file_hint!=NULL; file_stat++)
+    {
+      char tmp[64];
+      if(file_stat->recovered==0 && file_stat->not_recovered==0)
+	continue;
+      if(first==0)
+	pcontrol_puts(buf, ",");
+      first=0;
+      pcontrol_put_string(buf, file_stat->file_hint->extension!=NULL ? file_stat->file_hint->extension : "");
+      snprintf(tmp, sizeof(tmp), ":{\"recovered\":%u,\"not_recovered\":%u}",
+	  file_stat->recovered, file_stat->not_recovered);
+      pcontrol_puts(buf, tmp);
+    }
+  }
+  pcontrol_puts(buf, "},\"io\":[");
+  nbr_layers=disk_stats_get(summaries, PCONTROL_MAX_LAYERS);
+  for(i=0; i<nbr_layers; i++)
+  {
+    const disk_stats_summary_t *s=&summaries[i];
+    pcontrol_puts(buf, i==0 ? "{\"layer\":" : ",{\"layer\":");
+    pcontrol_put_string(buf, s->layer);
+    pcontrol_puts(buf, ",\"device\":");
+    pcontrol_put_string(buf, s->device);
+    pcontrol_put_u64(buf, "reads", s->nbr_reads);
+    pcontrol_put_u64(buf, "bytes", s->bytes);
+    pcontrol_put_u64(buf, "errors", s->nbr_errors);
+    pcontrol_put_u64(buf, "retries", s->nbr_retries);
+    pcontrol_put_u64(buf, "hits", s->nbr_hits);
+    pcontrol_put_u64(buf, "misses", s->nbr_misses);
+    pcontrol_put_u64(buf, "latency_p50_ns", s->latency_p50);
+    pcontrol_put_u64(buf, "latency_p99_ns", s->latency_p99);
+    pcontrol_put_u64(buf, "latency_max_ns", s->latency_max);
+    pcontrol_puts(buf, "}");
+  }
+  pcontrol_puts(buf, "]");
+  pcontrol_put_u64(buf, "pid", getpid());
+  pcontrol_puts(buf, "}\n");
+}
+
+static void pcontrol_reply_ok(struct pcontrol_client *client, const int ok, const char *command)
+{
+  pcontrol_reply.len=0;
+  pcontrol_puts(&pcontrol_reply, ok!=0 ? "{\"ok\":true,\"command\":" : "{\"ok\":false,\"command\":");
+  pcontrol_put_string(&pcontrol_reply, command);
+  pcontrol_puts(&pcontrol_reply, "}\n");
+  pcontrol_send(client, &pcontrol_reply);
+}
+
+static void pcontrol_command(struct pcontrol_client *client, const char *command, const struct ph_param *params, const uint64_t offset)
+{
+  if(strcmp(command, "watch")==0)
+  {
+    /* The status is sent by pcontrol_serve() from now on */
+    client->watch=1;
+    return ;
+  }
+  if(strcmp(command, "status")==0)
+  {
+    pcontrol_status(&pcontrol_reply, params, offset);
+    pcontrol_send(client, &pcontrol_reply);
+    return ;
+  }
+  if(strcmp(command, "pause")==0)
+  {
+    if(pcontrol_paused==0)
+      log_info("Control socket: pause\n");
+    pcontrol_paused=1;
+  }
+  else if(strcmp(command, "resume")==0)
+  {
+    if(pcontrol_paused!=0)
+      log_info("Control socket: resume\n");
+    pcontrol_paused=0;
+  }
+  else if(strcmp(command, "stop")==0)
+  {
+    log_info("Control socket: stop\n");
+    need_to_stop=1;
+  }
+  else if(strcmp(command, "checkpoint")==0)
+    pcontrol_checkpoint=1;
+  else
+  {
+    pcontrol_reply_ok(client, 0, command);
+    return ;
+  }
+  pcontrol_reply_ok(client, 1, command);
+}
+
+static void pcontrol_accept(void)
+{
+  int fd;
+  while((fd=accept(pcontrol_fd, NULL, NULL)) >= 0)
+  {
+    unsigned int i;
+    for(i=0; i<PCONTROL_MAX_CLIENTS && pcontrol_clients[i].fd>=0; i++);
+    if(i>=PCONTROL_MAX_CLIENTS)
+    {
+      close(fd);
+      continue;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    {
+      const int on=1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    pcontrol_clients[i].fd=fd;
+    pcontrol_clients[i].watch=0;
+    pcontrol_clients[i].len=0;
+  }
+}
+
+static void pcontrol_read(struct pcontrol_client *client, const struct ph_param *params, const uint64_t offset)
+{
+  while(client->fd>=0)
+  {
+    char *eol;
+    const ssize_t res=recv(client->fd, &client->line[client->len], sizeof(client->line) - 1 - client->len, 0);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res < 0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+      return ;
+    if(res <= 0)
+    {
+      pcontrol_client_close(client);
+      return ;
+    }
+    client->len+=res;
+    client->line[client->len]='\0';
+    while(client->fd>=0 && (eol=strchr(client->line, '\n'))!=NULL)
+    {
+      const unsigned int size=eol - client->line + 1;
+      *eol='\0';
+      if(eol > client->line && *(eol-1)=='\r')
+	*(eol-1)='\0';
+      if(client->line[0]!='\0')
+	pcontrol_command(client, client->line, params, offset);
+      if(client->fd>=0)
+      {
+	client->len-=size;
+	memmove(client->line, &client->line[size], client->len + 1);
+      }
+    }
+    if(client->fd>=0 && client->len >= sizeof(client->line) - 1)
+      pcontrol_client_close(client);
+  }
+}
+
+static void pcontrol_serve(const struct ph_param *params, const uint64_t offset)
+{
+  unsigned int i;
+  int status_done=0;
+  pcontrol_accept();
+  for(i=0; i<PCONTROL_MAX_CLIENTS; i++)
+    if(pcontrol_clients[i].fd>=0)
+      pcontrol_read(&pcontrol_clients[i], params, offset);
+  for(i=0; i<PCONTROL_MAX_CLIENTS; i++)
+  {
+    struct pcontrol_client *client=&pcontrol_clients[i];
+    if(client->fd>=0 && client->watch!=0)
+    {
+      if(status_done==0)
+	pcontrol_status(&pcontrol_reply, params, offset);
+      status_done=1;
+      pcontrol_send(client, &pcontrol_reply);
+    }
+  }
+}
+
+int pcontrol_open(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t old_umask;
+  unsigned int i;
+  if(pcontrol_fd>=0)
+    pcontrol_close();
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    log_error("Control socket: %s, path too long\n", path);
+    return -1;
+  }
+  /* Only replace a socket left by a previous run */
+  if(lstat(path, &st)==0)
+  {
+    if(!S_ISSOCK(st.st_mode))
+    {
+      log_error("Control socket: %s already exists\n", path);
+      return -1;
+    }
+    unlink(path);
+  }
+  pcontrol_fd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if(pcontrol_fd<0)
+  {
+    log_error("Control socket: socket failed: %s\n", strerror(errno));
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path, path);
+  old_umask=umask(077);
+  if(bind(pcontrol_fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(pcontrol_fd, PCONTROL_MAX_CLIENTS) < 0)
+  {
+    umask(old_umask);
+    log_error("Control socket: %s: %s\n", path, strerror(errno));
+    close(pcontrol_fd);
+    pcontrol_fd=-1;
+    return -1;
+  }
+  umask(old_umask);
+  fcntl(pcontrol_fd, F_SETFL, fcntl(pcontrol_fd, F_GETFL) | O_NONBLOCK);
+  for(i=0; i<PCONTROL_MAX_CLIENTS; i++)
+    pcontrol_clients[i].fd=-1;
+  pcontrol_path=strdup(path);
+  pcontrol_paused=0;
+  pcontrol_checkpoint=0;
+  pcontrol_prev_clock=0;
+  pcontrol_bytes_per_second=0;
+  log_info("Control socket: %s\n", path);
+  return 0;
+}
+
+int pcontrol_enabled(void)
+{
+  return (pcontrol_fd>=0);
+}
+
+void pcontrol_close(void)
+{
+  unsigned int i;
+  if(pcontrol_fd<0)
+    return ;
+  for(i=0; i<PCONTROL_MAX_CLIENTS; i++)
+    if(pcontrol_clients[i].fd>=0)
+      pcontrol_client_close(&pcontrol_clients[i]);
+  close(pcontrol_fd);
+  pcontrol_fd=-1;
+  if(pcontrol_path!=NULL)
+  {
+    unlink(pcontrol_path);
+    free(pcontrol_path);
+    pcontrol_path=NULL;
+  }
+}
+
+int pcontrol_poll(const struct ph_param *params, const uint64_t offset)
+{
+  const uint64_t now=disk_stats_clock();
+  if(pcontrol_fd<0)
+    return 0;
+  /* The brute force and the backward searches go down */
+  if(pcontrol_prev_clock!=0 && now > pcontrol_prev_clock)
+  {
+    const uint64_t delta=(offset >= pcontrol_prev_offset ?
+	offset - pcontrol_prev_offset : pcontrol_prev_offset - offset);
+    pcontrol_bytes_per_second=delta * 1000000000 / (now - pcontrol_prev_clock);
+  }
+  pcontrol_prev_clock=now;
+  pcontrol_prev_offset=offset;
+  pcontrol_serve(params, offset);
+  while(pcontrol_paused!=0 && need_to_stop==0 && pcontrol_fd>=0)
+  {
+    sleep(1);
+    pcontrol_serve(params, offset);
+  }
+  /* Don't count the pause in the throughput */
+  pcontrol_prev_clock=disk_stats_clock();
+  if(pcontrol_checkpoint!=0)
+  {
+    pcontrol_checkpoint=0;
+    return 1;
+  }
+  return 0;
+}
+
+#else
+int pcontrol_open(const char *path)
+{
+  log_error("Control socket: %s, not supported\n", path);
+  return -1;
+}
+
+int pcontrol_enabled(void)
+{
+  return 0;
+}
+
+void pcontrol_close(void)
+{
+}
+
+int pcontrol_poll(const struct ph_param *params, const uint64_t offset)
+{
+  return 0;
+}
+#endif
+#endif
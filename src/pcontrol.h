@@ -0,0 +1,66 @@
+/*
+
+    File: pcontrol.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PCONTROL_H
+#define _PCONTROL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Control socket.
+ * A Unix domain socket where the clients send one command per line and
+ * get one JSON object per line:
+ *   status      the phase, the pass, the offset and the size of the
+ *               partition, the throughput, the files recovered per
+ *               format and the I/O counters of each disk layer
+ *   watch       a status every second until the client disconnects
+ *   pause       stop reading until resume or stop
+ *   resume
+ *   stop        as SIGINT, the session can be resumed
+ *   checkpoint  save the session now
+ * The socket is only served by the scan, once per second, a command is
+ * answered at the next progress update. */
+
+/* Listen on the socket path, return 0 on success */
+/*@
+  @ requires valid_read_string(path);
+  @*/
+int pcontrol_open(const char *path);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pcontrol_enabled(void);
+
+/* Disconnect the clients, remove the socket */
+void pcontrol_close(void);
+
+/* Called by the scan once per second: serve the clients, wait while
+ * the scan is paused. Return 1 when a checkpoint has been requested */
+/*@
+  @ requires \valid_read(params);
+  @*/
+int pcontrol_poll(const struct ph_param *params, const uint64_t offset);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,115 @@
+/*
+
+    File: pdepth.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "file_jpg.h"
+#include "log.h"
+#include "pdepth.h"
+
+/* Time between two evaluations, in ns */
+#define PDEPTH_WINDOW		2000000000ULL
+/* Share of the time waiting for the reader, in percent */
+#define PDEPTH_RAISE		30
+#define PDEPTH_LOWER		10
+
+#ifndef DISABLED_FOR_FRAMAC
+static int pdepth_enable=0;
+/* 1: full depth, 0: structure */
+static int pdepth_level=1;
+static uint64_t pdepth_window_start=0;
+static uint64_t pdepth_window_stall=0;
+
+static void pdepth_apply(const int level)
+{
+  pdepth_level=level;
+  file_deep_check=(level > 0 ? 1 : 0);
+  jpg_set_scaled_check(level > 0 ? 0 : 1);
+}
+#endif
+
+void pdepth_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pdepth_enable=(enable > 0 ? 1 : 0);
+  if(pdepth_enable > 0)
+    pdepth_apply(1);
+#endif
+}
+
+int pdepth_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pdepth_enable;
+#else
+  return 0;
+#endif
+}
+
+void pdepth_start(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pdepth_window_start=file_profile_clock();
+  pdepth_window_stall=0;
+#endif
+}
+
+void pdepth_update(const uint64_t stall_ns)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t now;
+  unsigned int share;
+  if(pdepth_enable==0)
+    return ;
+  now=file_profile_clock();
+  if(now < pdepth_window_start + PDEPTH_WINDOW)
+    return ;
+  share=(stall_ns - pdepth_window_stall) * 100 / (now - pdepth_window_start);
+  pdepth_window_start=now;
+  pdepth_window_stall=stall_ns;
+  if(pdepth_level==0 && share >= PDEPTH_RAISE)
+  {
+    pdepth_apply(1);
+    log_info("Validation depth: waiting for the disk %u%% of the time, full checks\n", share);
+  }
+  else if(pdepth_level > 0 && share < PDEPTH_LOWER)
+  {
+    pdepth_apply(0);
+    log_info("Validation depth: waiting for the disk %u%% of the time, structural checks\n", share);
+  }
+#endif
+}
+
+const char *pdepth_name(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (pdepth_level > 0 ? "full" : "structure");
+#else
+  return "full";
+#endif
+}
@@ -0,0 +1,67 @@
+/*
+
+    File: pdepth.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PDEPTH_H
+#define _PDEPTH_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Adaptive validation depth.
+ * Every PDEPTH_WINDOW of the main scan, the time the scan has waited for
+ * the reader is compared to the time elapsed. When the scan waits for
+ * the disk at least 30% of the time, the CPU is spare and the files are
+ * checked at the full depth: the JPEG are fully decoded and the gzip and
+ * zip data are inflated to check their CRC, as with /deepcheck. When it
+ * waits less than 10% of the time, the CPU is the bottleneck and the
+ * checks go back to the structure: the JPEG are decoded at 1/8 scale,
+ * as with /jpgscaled, and nothing is inflated.
+ * The scan starts at the full depth. Each change and the depth used to
+ * check each file are logged. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void pdepth_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pdepth_enabled(void);
+
+/* Start of a scan, the time waited for the reader starts from 0 */
+void pdepth_start(void);
+
+/* Called after each read of the scan with the total time the scan has
+ * waited for the reader, in ns */
+void pdepth_update(const uint64_t stall_ns);
+
+/* Name of the current depth, for the log */
+/*@
+  @ ensures valid_read_string(\result);
+  @ assigns \nothing;
+  @*/
+const char *pdepth_name(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,276 @@
+/*
+
+    File: pdest.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_STATVFS_H
+#include <sys/statvfs.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pdest.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PDEST_MAX	16
+/* Files placed before the free space is measured again */
+#define PDEST_REFRESH	256
+
+typedef struct
+{
+  char *recup_dir;		/* NULL for params->recup_dir */
+  unsigned int dir_num;		/* recup_dir.dir_num exists */
+  int full;
+  uint64_t weight;		/* Free space in MiB */
+  int64_t current;
+} pdest_t;
+
+/* pdests[0] is params->recup_dir */
+static pdest_t pdests[PDEST_MAX];
+static unsigned int pdests_nbr=1;
+static char *pdest_primary=NULL;
+static unsigned int pdest_next=0;
+static int pdest_weighted=0;
+static unsigned int pdest_selected=0;
+
+static const char *pdest_name(const pdest_t *dest, const struct ph_param *params)
+{
+  return (dest->recup_dir!=NULL ? dest->recup_dir : params->recup_dir);
+}
+
+/* The user may have chosen a new destination for params->recup_dir */
+static void pdest_check_primary(const struct ph_param *params)
+{
+  if(pdest_primary!=NULL && strcmp(pdest_primary, params->recup_dir)==0)
+    return ;
+  free(pdest_primary);
+  pdest_primary=strdup(params->recup_dir);
+  pdests[0].full=0;
+  pdests[0].weight=0;
+  pdest_selected=0;
+}
+
+static void pdest_refresh(const struct ph_param *params)
+{
+  unsigned int i;
+  for(i=0; i<pdests_nbr; i++)
+  {
+    pdest_t *dest=&pdests[i];
+#if defined(HAVE_STATVFS) && defined(HAVE_SYS_STATVFS_H)
+    char dirname[2048];
+    struct statvfs buf;
+    int res;
+    snprintf(dirname, sizeof(dirname)-1, "%s.%u", pdest_name(dest, params), params->dir_num);
+    dirname[sizeof(dirname)-1]='\0';
+    res=statvfs(dirname, &buf);
+    if(res!=0)
+    {
+      /* recup_dir.dir_num isn't created yet, use its parent */
+      char *sep=strrchr(dirname, '/');
+      if(sep!=NULL)
+      {
+	sep[1]='\0';
+	res=statvfs(dirname, &buf);
+      }
+      else
+	res=statvfs(".", &buf);
+    }
+    if(res==0)
+      dest->weight=((uint64_t)buf.f_bavail * buf.f_frsize) >> 20;
+    else
+#endif
+      dest->weight=1;
+    /* Still chosen from time to time */
+    if(dest->weight==0)
+      dest->weight=1;
+  }
+}
+
+/* Smooth weighted round-robin: each destination gets its share of the
+ * files, evenly interleaved */
+static pdest_t *pdest_select_weighted(const struct ph_param *params)
+{
+  pdest_t *best=NULL;
+  int64_t total=0;
+  unsigned int i;
+  if(pdest_selected++ % PDEST_REFRESH==0)
+    pdest_refresh(params);
+  for(i=0; i<pdests_nbr; i++)
+  {
+    pdest_t *dest=&pdests[i];
+    if(dest->full==0)
+    {
+      dest->current+=dest->weight;
+      total+=dest->weight;
+      if(best==NULL || dest->current > best->current)
+	best=dest;
+    }
+  }
+  if(best!=NULL)
+    best->current-=total;
+  return best;
+}
+
+static pdest_t *pdest_select_next(void)
+{
+  unsigned int i;
+  for(i=0; i<pdests_nbr; i++)
+  {
+    pdest_t *dest=&pdests[pdest_next];
+    pdest_next=(pdest_next+1) % pdests_nbr;
+    if(dest->full==0)
+      return dest;
+  }
+  return NULL;
+}
+#endif
+
+void pdest_add(const char *recup_dir)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pdests_nbr==PDEST_MAX)
+  {
+    log_error("Too many destinations, %s is ignored\n", recup_dir);
+    return ;
+  }
+  memset(&pdests[pdests_nbr], 0, sizeof(pdest_t));
+  pdests[pdests_nbr].recup_dir=strdup(recup_dir);
+  if(pdests[pdests_nbr].recup_dir!=NULL)
+    pdests_nbr++;
+#endif
+}
+
+void pdest_set_weighted(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pdest_weighted=enable;
+#endif
+}
+
+const char *pdest_select(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pdest_t *dest;
+  const char *recup_dir;
+  if(pdests_nbr==1)
+    return params->recup_dir;
+  pdest_check_primary(params);
+  dest=(pdest_weighted!=0 ? pdest_select_weighted(params) : pdest_select_next());
+  /* All full: the write fails and photorec asks for a new destination */
+  if(dest==NULL)
+    return params->recup_dir;
+  recup_dir=pdest_name(dest, params);
+  if(dest!=&pdests[0] && dest->dir_num!=params->dir_num)
+  {
+    char dirname[2048];
+    snprintf(dirname, sizeof(dirname)-1, "%s.%u", recup_dir, params->dir_num);
+    dirname[sizeof(dirname)-1]='\0';
+#ifdef __MINGW32__
+    if(mkdir(dirname)!=0 && errno!=EEXIST)
+#else
+    if(mkdir(dirname, 0775)!=0 && errno!=EEXIST)
+#endif
+    {
+      log_error("Cannot create directory %s: %s\n", dirname, strerror(errno));
+      dest->full=1;
+      return pdest_select(params);
+    }
+    dest->dir_num=params->dir_num;
+  }
+  return recup_dir;
+#else
+  return params->recup_dir;
+#endif
+}
+
+int pdest_full(const struct ph_param *params, const char *filename)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  if(pdests_nbr==1)
+    return 0;
+  pdest_check_primary(params);
+  for(i=0; i<pdests_nbr; i++)
+  {
+    const char *recup_dir=pdest_name(&pdests[i], params);
+    const unsigned int len=strlen(recup_dir);
+    if(strncmp(filename, recup_dir, len)==0 && filename[len]=='.' &&
+	strchr(&filename[len+1], '/')!=NULL &&
+	strchr(strchr(&filename[len+1], '/')+1, '/')==NULL)
+    {
+      pdests[i].full=1;
+      log_warning("Destination %s is full\n", recup_dir);
+    }
+  }
+  return pdest_available(params);
+#else
+  return 0;
+#endif
+}
+
+int pdest_available(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  if(pdests_nbr==1)
+    return 0;
+  if(pdest_primary==NULL || strcmp(pdest_primary, params->recup_dir)!=0)
+    return 1;
+  for(i=0; i<pdests_nbr; i++)
+    if(pdests[i].full==0)
+      return 1;
+#endif
+  return 0;
+}
+
+void pdest_reset(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  for(i=1; i<pdests_nbr; i++)
+    free(pdests[i].recup_dir);
+  memset(pdests, 0, sizeof(pdests));
+  pdests_nbr=1;
+  free(pdest_primary);
+  pdest_primary=NULL;
+  pdest_next=0;
+  pdest_selected=0;
+#endif
+}
@@ -0,0 +1,77 @@
+/*
+
+    File: pdest.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PDEST_H
+#define _PDEST_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Striped output: the recovered files are spread over params->recup_dir
+ * and the destinations added with pdest_add(), each one on its own disk,
+ * so the kernel writes them back in parallel. Each destination gets its
+ * own recup_dir.N directories, numbered like params->recup_dir.
+ * The files are placed in turn or, when weighted, in proportion to the
+ * free space of each destination. A destination is left out once a
+ * write fails with ENOSPC, photorec only asks for a new destination
+ * when they are all full. */
+
+/* recup_dir is a base name like params->recup_dir */
+/*@
+  @ requires valid_read_string(recup_dir);
+  @*/
+void pdest_add(const char *recup_dir);
+
+/* Place the files in proportion to the free space of the destinations */
+/*@
+  @ assigns \nothing;
+  @*/
+void pdest_set_weighted(const int enable);
+
+/* Base name of the destination of the next recovered file, its
+ * directory recup_dir.dir_num is created if needed */
+/*@
+  @ requires \valid_read(params);
+  @ requires valid_read_string(params->recup_dir);
+  @ ensures valid_read_string(\result);
+  @*/
+const char *pdest_select(const struct ph_param *params);
+
+/* Writing filename has failed with ENOSPC, its destination is full.
+ * Return 1 if another destination is still available */
+/*@
+  @ requires \valid_read(params);
+  @ requires valid_read_string(filename);
+  @*/
+int pdest_full(const struct ph_param *params, const char *filename);
+
+/*@
+  @ requires \valid_read(params);
+  @ assigns \nothing;
+  @*/
+int pdest_available(const struct ph_param *params);
+
+void pdest_reset(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
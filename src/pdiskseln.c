@@ -246,6 +246,7 @@ int do_curses_photorec(struct ph_param *params, struct ph_options *options, cons
     .list = TD_LIST_HEAD_INIT(list_search_space.list)
   };
   const int resume_session=(params->cmd_device!=NULL && strcmp(params->cmd_device,"resume")==0);
+  int resumed=0;
 #ifndef DISABLED_FOR_FRAMAC
   if(params->cmd_device==NULL || resume_session!=0)
   {
@@ -273,13 +274,14 @@ int do_curses_photorec(struct ph_param *params, struct ph_options *options, cons
 #endif
       params->cmd_run=saved_cmd;
       params->cmd_device=saved_device;
+      resumed=1;
     }
     else
     {
       free(saved_device);
       free(saved_cmd);
       free_list_search_space(&list_search_space);
-      rename("photorec.ses", "photorec.se2");
+      session_backup();
     }
   }
 #endif
@@ -288,6 +290,10 @@ int do_curses_photorec(struct ph_param *params, struct ph_options *options, cons
     /*@ assert valid_read_string(params->cmd_run); */
     params->disk=photorec_disk_selection_cli(params->cmd_device, list_disk, &list_search_space);
     /*@ assert params->disk == \null || valid_disk(params->disk); */
+#ifndef DISABLED_FOR_FRAMAC
+    if(params->disk!=NULL && resumed!=0)
+      session_load_bad_sectors(params->disk);
+#endif
 #if defined(HAVE_NCURSES)
     if(params->disk==NULL)
     {
@@ -0,0 +1,293 @@
+/*
+
+    File: pfilter.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "log.h"
+#include "pfilter.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PFILTER_EXT_MAX		32
+#define PFILTER_EXT_SIZE	16
+#define PFILTER_DAY		(24*60*60)
+
+typedef struct
+{
+  int on;
+  int known;
+  uint64_t size_min;
+  uint64_t size_max;		/* 0: no maximum */
+  time_t date_min;
+  time_t date_max;		/* first second after the dates kept, 0: no maximum */
+  char ext[PFILTER_EXT_MAX][PFILTER_EXT_SIZE];
+  unsigned int ext_nbr;
+} pfilter_t;
+
+static pfilter_t pfilter;
+static unsigned long pfilter_nbr_checked=0;
+static unsigned long pfilter_nbr_rejected=0;
+
+/* Comparison operator at the start of str, the number of characters used,
+ * 0 if there is none */
+static unsigned int pfilter_op(const char *str, const char **op)
+{
+  if(strncmp(str, ">=", 2)==0 || strncmp(str, "<=", 2)==0)
+  {
+    *op=str;
+    return 2;
+  }
+  if(str[0]=='>' || str[0]=='<' || str[0]=='=')
+  {
+    *op=str;
+    return 1;
+  }
+  return 0;
+}
+
+static int pfilter_parse_size(const char *str, const char *end, uint64_t *size)
+{
+  char *sep;
+  uint64_t value=strtoull(str, &sep, 10);
+  if(sep==str)
+    return -1;
+  if(sep < end)
+  {
+    switch(*sep)
+    {
+      case 'k': case 'K':	value<<=10;	break;
+      case 'm': case 'M':	value<<=20;	break;
+      case 'g': case 'G':	value<<=30;	break;
+      case 't': case 'T':	value<<=40;	break;
+      default:			return -1;
+    }
+    sep++;
+  }
+  if(sep!=end)
+    return -1;
+  *size=value;
+  return 0;
+}
+
+/* Start of the day YYYY-MM-DD in local time, as the dates of the headers */
+static int pfilter_parse_date(const char *str, const char *end, time_t *date)
+{
+  struct tm tm_date;
+  int year, month, day;
+  char tmp[16];
+  char extra;
+  if(end - str >= (int)sizeof(tmp))
+    return -1;
+  memcpy(tmp, str, end - str);
+  tmp[end - str]='\0';
+  if(sscanf(tmp, "%d-%d-%d%c", &year, &month, &day, &extra)!=3 ||
+      year < 1970 || month < 1 || month > 12 || day < 1 || day > 31)
+    return -1;
+  memset(&tm_date, 0, sizeof(tm_date));
+  tm_date.tm_year=year - 1900;
+  tm_date.tm_mon=month - 1;
+  tm_date.tm_mday=day;
+  tm_date.tm_isdst=-1;
+  *date=mktime(&tm_date);
+  return (*date==(time_t)-1 ? -1 : 0);
+}
+
+static int pfilter_term(pfilter_t *filter, const char *str, const char *end)
+{
+  const char *op=NULL;
+  const unsigned int len=end - str;
+  if(len==5 && strncmp(str, "known", 5)==0)
+  {
+    filter->known=1;
+    return 0;
+  }
+  if(len > 4 && strncmp(str, "ext=", 4)==0)
+  {
+    if(filter->ext_nbr >= PFILTER_EXT_MAX || len - 4 >= PFILTER_EXT_SIZE)
+      return -1;
+    memcpy(filter->ext[filter->ext_nbr], str + 4, len - 4);
+    filter->ext[filter->ext_nbr][len - 4]='\0';
+    filter->ext_nbr++;
+    return 0;
+  }
+  if(len > 4 && strncmp(str, "size", 4)==0)
+  {
+    const unsigned int op_len=pfilter_op(str + 4, &op);
+    uint64_t size;
+    if(op_len==0 || pfilter_parse_size(str + 4 + op_len, end, &size) < 0)
+      return -1;
+    if(op[0]=='>')
+      size+=(op_len==1 ? 1 : 0);
+    else if(op[0]=='<' && op_len==1)
+    {
+      if(size==0)
+	return -1;
+      size--;
+    }
+    if(op[0]!='<' && size > filter->size_min)
+      filter->size_min=size;
+    if(op[0]!='>' && (filter->size_max==0 || size < filter->size_max))
+      filter->size_max=size;
+    return 0;
+  }
+  if(len > 4 && strncmp(str, "date", 4)==0)
+  {
+    const unsigned int op_len=pfilter_op(str + 4, &op);
+    time_t date;
+    time_t date_min;
+    time_t date_max;
+    if(op_len==0 || pfilter_parse_date(str + 4 + op_len, end, &date) < 0)
+      return -1;
+    /* From the start of the day, to the start of the next one */
+    date_min=(op[0]=='>' && op_len==1 ? date + PFILTER_DAY : date);
+    date_max=(op[0]=='<' && op_len==1 ? date : date + PFILTER_DAY);
+    if(op[0]!='<' && date_min > filter->date_min)
+      filter->date_min=date_min;
+    if(op[0]!='>' && (filter->date_max==0 || date_max < filter->date_max))
+      filter->date_max=date_max;
+    return 0;
+  }
+  return -1;
+}
+
+/* The size of the file given by its header, 0 if unknown, see pinventory */
+static uint64_t pfilter_size(const file_recovery_t *file_recovery)
+{
+  if(file_recovery->data_check!=NULL && file_recovery->data_check!=&data_check_size)
+    return 0;
+  return file_recovery->calculated_file_size;
+}
+
+static int pfilter_ext_match(const file_recovery_t *file_recovery)
+{
+  const char *extension=(file_recovery->extension!=NULL ? file_recovery->extension :
+      file_recovery->file_stat->file_hint->extension);
+  unsigned int i;
+  if(extension==NULL)
+    return 0;
+  for(i=0; i<pfilter.ext_nbr; i++)
+    if(strlen(extension)==strlen(pfilter.ext[i]) &&
+	strncasecmp(extension, pfilter.ext[i], PFILTER_EXT_SIZE)==0)
+      return 1;
+  return 0;
+}
+#endif
+
+int pfilter_set(const char *expr)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pfilter_t filter;
+  const char *str;
+  if(expr==NULL)
+  {
+    memset(&pfilter, 0, sizeof(pfilter));
+    return 0;
+  }
+  memcpy(&filter, &pfilter, sizeof(filter));
+  for(str=expr; *str!='\0'; )
+  {
+    const char *end;
+    for(end=str; *end!='\0' && *end!=','; end++);
+    if(end > str && pfilter_term(&filter, str, end) < 0)
+    {
+      log_error("Invalid filter \"%.*s\"\n", (int)(end - str), str);
+      return -1;
+    }
+    str=(*end==',' ? end + 1 : end);
+  }
+  if(filter.size_max!=0 && filter.size_max < filter.size_min)
+  {
+    log_error("Invalid filter \"%s\": no size can match\n", expr);
+    return -1;
+  }
+  filter.on=1;
+  memcpy(&pfilter, &filter, sizeof(pfilter));
+#endif
+  return 0;
+}
+
+int pfilter_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pfilter.on;
+#else
+  return 0;
+#endif
+}
+
+int pfilter_match(const file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pfilter.on==0)
+    return 1;
+  pfilter_nbr_checked++;
+  if(pfilter.ext_nbr > 0 && pfilter_ext_match(file_recovery)==0)
+  {
+    pfilter_nbr_rejected++;
+    return 0;
+  }
+  if(pfilter.size_min > 0 || pfilter.size_max > 0)
+  {
+    const uint64_t size=pfilter_size(file_recovery);
+    if(size==0 ? pfilter.known > 0 :
+	(size < pfilter.size_min || (pfilter.size_max > 0 && size > pfilter.size_max)))
+    {
+      pfilter_nbr_rejected++;
+      return 0;
+    }
+  }
+  if(pfilter.date_min!=0 || pfilter.date_max!=0)
+  {
+    const time_t date=file_recovery->time;
+    if(date==0 || date==(time_t)-1 ? pfilter.known > 0 :
+	(date < pfilter.date_min || (pfilter.date_max!=0 && date >= pfilter.date_max)))
+    {
+      pfilter_nbr_rejected++;
+      return 0;
+    }
+  }
+#endif
+  return 1;
+}
+
+void pfilter_log(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pfilter.on==0)
+    return ;
+  log_info("Filters: %lu files found, %lu not written\n",
+      pfilter_nbr_checked, pfilter_nbr_rejected);
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+
+    File: pfilter.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PFILTER_H
+#define _PFILTER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Filters on the files found, checked when their header is found.
+ * A rejected file is still carved, so its blocks aren't searched again
+ * for other files, but it has no name and no output file.
+ * The filter is a comma separated list of terms, all of them must match:
+ *   ext=jpg		extension, several ext terms match any of them
+ *   size>=1M		size from the header: <, <=, >, >=, =, suffix k, M, G
+ *   date>=2025-03-01	time from the header: <, <=, >, >=, = a day
+ *   known		reject a file whose size or date filtered isn't known
+ * Without known, a file whose header doesn't give the size or the date
+ * filtered is recovered. */
+
+/* Add the terms of expr to the filters, NULL removes every filter.
+ * Return 0, -1 if expr is invalid: the filters are left unchanged */
+/*@
+  @ requires expr == \null || valid_read_string(expr);
+  @*/
+int pfilter_set(const char *expr);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pfilter_enabled(void);
+
+/* Return 1 if the file starting by this header must be written */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires valid_file_recovery(file_recovery);
+  @*/
+int pfilter_match(const file_recovery_t *file_recovery);
+
+void pfilter_log(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
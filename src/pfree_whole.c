@@ -67,6 +67,18 @@ int ask_mode_ext2(const disk_t *disk_car, const partition_t *partition, unsigned
     {'W',"Whole","Extract files from whole partition"},
     {0,NULL,NULL}
   };
+  static const struct MenuItem menuHFSP[]=
+  {
+    {'F',"Free", "Scan for file from HFS+ unallocated space only"},
+    {'W',"Whole","Extract files from whole partition"},
+    {0,NULL,NULL}
+  };
+  static const struct MenuItem menuXFS[]=
+  {
+    {'F',"Free", "Scan for file from XFS unallocated space only"},
+    {'W',"Whole","Extract files from whole partition"},
+    {0,NULL,NULL}
+  };
 #if defined(HAVE_LIBNTFS) || defined(HAVE_LIBNTFS3G)
   static const struct MenuItem menuNTFS[]=
   {
@@ -128,6 +140,14 @@ int ask_mode_ext2(const disk_t *disk_car, const partition_t *partition, unsigned
     else if(partition->upart_type==UP_FAT32)
       command = wmenuSelect_ext(window, 23, 8, 0, menuFAT32, 11,
 	  options, MENU_VERT | MENU_VERT_WARN | MENU_BUTTON, &menu,NULL);
+    else if(partition->upart_type==UP_HFSP || partition->upart_type==UP_HFSX)
+      command = wmenuSelect_ext(window, 23, 8, 0, menuHFSP, 11,
+	  options, MENU_VERT | MENU_VERT_WARN | MENU_BUTTON, &menu,NULL);
+    else if(partition->upart_type==UP_XFS || partition->upart_type==UP_XFS2 ||
+	partition->upart_type==UP_XFS3 || partition->upart_type==UP_XFS4 ||
+	partition->upart_type==UP_XFS5)
+      command = wmenuSelect_ext(window, 23, 8, 0, menuXFS, 11,
+	  options, MENU_VERT | MENU_VERT_WARN | MENU_BUTTON, &menu,NULL);
 #if defined(HAVE_LIBNTFS) || defined(HAVE_LIBNTFS3G)
     else if(partition->upart_type==UP_NTFS)
       command = wmenuSelect_ext(window, 23, 8, 0, menuNTFS, 11,
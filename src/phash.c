@@ -0,0 +1,493 @@
+/*
+
+    File: phash.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "log.h"
+#include "pbkdf2.h"
+#include "phash.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Hash states saved before the last writes */
+#define PHASH_CHECKPOINTS	16
+/* file_check() may rewrite the end of the file, ie. the JPEG footer */
+#define PHASH_REREAD		4096
+
+typedef struct
+{
+  uint64_t pos;
+  hash_ctx_t md5;
+  hash_ctx_t sha256;
+} phash_state_t;
+
+typedef struct
+{
+  uint64_t file_size;
+  unsigned char sha256[SHA256_DIGEST_SIZE];
+  char *filename;
+} phash_entry_t;
+
+static int phash_enable=0;
+static int phash_dedup=0;
+
+/* File being written */
+static const file_recovery_t *phash_file=NULL;
+static const FILE *phash_handle=NULL;
+static uint64_t phash_start=0;
+static int phash_in_order=0;
+static phash_state_t phash_cur;
+static phash_state_t phash_checkpoints[PHASH_CHECKPOINTS];
+static unsigned int phash_checkpoints_nbr=0;
+static unsigned int phash_checkpoints_next=0;
+
+/* Last file finished */
+static const file_recovery_t *phash_last_file=NULL;
+static uint64_t phash_last_start=0;
+static uint64_t phash_last_size=0;
+static phash_result_t phash_last;
+
+/* Files recovered, open addressing on the first bytes of the SHA-256 */
+static phash_entry_t *phash_entries=NULL;
+static unsigned int phash_entries_nbr=0;
+static unsigned int phash_entries_alloc=0;
+static uint64_t phash_duplicates=0;
+static uint64_t phash_duplicates_size=0;
+
+/* Known files: sorted first 8 bytes of their MD5 or SHA-256 */
+static const char *phash_known_filename=NULL;
+static int phash_known_loaded=0;
+static uint64_t *phash_known=NULL;
+static uint64_t phash_known_nbr=0;
+static uint64_t phash_known_skipped=0;
+static uint64_t phash_known_skipped_size=0;
+
+static unsigned char phash_buffer[65536];
+#endif
+
+void phash_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  phash_enable=enable;
+#endif
+}
+
+void phash_set_dedup(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  phash_dedup=enable;
+  if(enable!=0)
+    phash_enable=1;
+#endif
+}
+
+void phash_set_known(const char *filename)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  phash_known_filename=filename;
+  phash_known_loaded=0;
+  if(filename!=NULL)
+    phash_enable=1;
+#endif
+}
+
+int phash_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return phash_enable;
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static void phash_state_init(phash_state_t *state)
+{
+  state->pos=0;
+  hash_init(&state->md5, "md5");
+  hash_init(&state->sha256, "sha256");
+}
+
+static void phash_state_update(phash_state_t *state, const unsigned char *data, const unsigned int len)
+{
+  hash_update(&state->md5, data, len);
+  hash_update(&state->sha256, data, len);
+  state->pos+=len;
+}
+
+static int phash_file_match(const file_recovery_t *file_recovery)
+{
+  return (file_recovery==phash_file && file_recovery->handle==phash_handle &&
+      file_recovery->location.start==phash_start);
+}
+
+static uint64_t phash_key(const unsigned char *sha256)
+{
+  uint64_t key;
+  memcpy(&key, sha256, sizeof(key));
+  return key;
+}
+
+static phash_entry_t *phash_find(const uint64_t file_size, const unsigned char *sha256)
+{
+  unsigned int i;
+  if(phash_entries_alloc==0)
+    return NULL;
+  for(i=phash_key(sha256) & (phash_entries_alloc-1);
+      phash_entries[i].filename!=NULL;
+      i=(i+1) & (phash_entries_alloc-1))
+  {
+    if(phash_entries[i].file_size==file_size &&
+	memcmp(phash_entries[i].sha256, sha256, SHA256_DIGEST_SIZE)==0)
+      return &phash_entries[i];
+  }
+  return NULL;
+}
+
+static void phash_insert(phash_entry_t *entries, const unsigned int alloc, const phash_entry_t *entry)
+{
+  unsigned int i;
+  for(i=phash_key(entry->sha256) & (alloc-1);
+      entries[i].filename!=NULL;
+      i=(i+1) & (alloc-1));
+  entries[i]=*entry;
+}
+
+static void phash_add(const uint64_t file_size, const unsigned char *sha256, const char *filename)
+{
+  phash_entry_t entry;
+  if(2 * (phash_entries_nbr + 1) > phash_entries_alloc)
+  {
+    /* Keep the table half empty */
+    const unsigned int alloc=(phash_entries_alloc==0 ? 4096 : 2 * phash_entries_alloc);
+    phash_entry_t *entries=(phash_entry_t *)MALLOC(alloc * sizeof(phash_entry_t));
+    unsigned int i;
+    memset(entries, 0, alloc * sizeof(phash_entry_t));
+    for(i=0; i<phash_entries_alloc; i++)
+      if(phash_entries[i].filename!=NULL)
+	phash_insert(entries, alloc, &phash_entries[i]);
+    free(phash_entries);
+    phash_entries=entries;
+    phash_entries_alloc=alloc;
+  }
+  entry.file_size=file_size;
+  memcpy(entry.sha256, sha256, SHA256_DIGEST_SIZE);
+  entry.filename=strdup(filename);
+  if(entry.filename==NULL)
+    return ;
+  phash_insert(phash_entries, phash_entries_alloc, &entry);
+  phash_entries_nbr++;
+}
+
+static uint64_t phash_known_key(const unsigned char *digest)
+{
+  uint64_t key=0;
+  unsigned int i;
+  for(i=0; i<8; i++)
+    key=(key << 8) | digest[i];
+  return key;
+}
+
+static int phash_hex(const int c)
+{
+  if(c>='0' && c<='9')
+    return c-'0';
+  if(c>='a' && c<='f')
+    return c-'a'+10;
+  if(c>='A' && c<='F')
+    return c-'A'+10;
+  return -1;
+}
+
+static int phash_known_cmp(const void *a, const void *b)
+{
+  const uint64_t x=*(const uint64_t *)a;
+  const uint64_t y=*(const uint64_t *)b;
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Every MD5 or SHA-256 of the file is kept: a run of exactly 32 or 64
+ * hex digits, so one digest per line or the NSRL CSV files both work,
+ * their SHA-1 and CRC32 are ignored */
+static void phash_known_load(void)
+{
+  FILE *handle;
+  char line[4096];
+  uint64_t alloc=0;
+  uint64_t i;
+  uint64_t j;
+  int full=0;
+  phash_known_loaded=1;
+  handle=fopen(phash_known_filename, "rb");
+  if(handle==NULL)
+  {
+    log_error("Can't read the known hashes %s: %s\n", phash_known_filename, strerror(errno));
+    return ;
+  }
+  while(full==0 && fgets(line, sizeof(line), handle)!=NULL)
+  {
+    const char *ptr=line;
+    while(full==0 && *ptr!='\0')
+    {
+      const char *start=ptr;
+      uint64_t key=0;
+      for(; phash_hex(*ptr)>=0; ptr++)
+	if(ptr - start < 16)
+	  key=(key << 4) | phash_hex(*ptr);
+      if(ptr==start)
+	ptr++;
+      else if(ptr - start==32 || ptr - start==64)
+      {
+	if(phash_known_nbr==alloc)
+	{
+	  uint64_t *tmp;
+	  alloc=(alloc==0 ? 65536 : 2 * alloc);
+	  tmp=(uint64_t *)realloc(phash_known, alloc * sizeof(uint64_t));
+	  if(tmp==NULL)
+	  {
+	    log_error("Known hashes: not enough memory, only %llu hashes loaded\n",
+		(long long unsigned)phash_known_nbr);
+	    full=1;
+	    continue;
+	  }
+	  phash_known=tmp;
+	}
+	phash_known[phash_known_nbr++]=key;
+      }
+    }
+  }
+  fclose(handle);
+  if(phash_known_nbr==0)
+  {
+    log_warning("No MD5 or SHA-256 found in %s\n", phash_known_filename);
+    return ;
+  }
+  qsort(phash_known, phash_known_nbr, sizeof(uint64_t), phash_known_cmp);
+  for(i=1, j=1; i<phash_known_nbr; i++)
+    if(phash_known[i]!=phash_known[j-1])
+      phash_known[j++]=phash_known[i];
+  phash_known_nbr=j;
+  log_info("Known hashes: %llu loaded from %s\n", (long long unsigned)phash_known_nbr, phash_known_filename);
+}
+
+static int phash_is_known(const unsigned char *digest)
+{
+  const uint64_t key=phash_known_key(digest);
+  uint64_t low=0;
+  uint64_t high=phash_known_nbr;
+  while(low < high)
+  {
+    const uint64_t mid=low + (high - low) / 2;
+    if(phash_known[mid] < key)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return (low < phash_known_nbr && phash_known[low]==key ? 1 : 0);
+}
+#endif
+
+void phash_file_start(const file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(phash_enable==0)
+    return ;
+  phash_file=file_recovery;
+  phash_handle=file_recovery->handle;
+  phash_start=file_recovery->location.start;
+  phash_in_order=1;
+  phash_checkpoints_nbr=0;
+  phash_checkpoints_next=0;
+  phash_state_init(&phash_cur);
+#endif
+}
+
+void phash_block(const file_recovery_t *file_recovery, const unsigned char *data, const unsigned int len, const uint64_t offset)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(phash_enable==0 || phash_in_order==0 || !phash_file_match(file_recovery))
+    return ;
+  if(offset!=phash_cur.pos)
+  {
+    /* The file will be read back */
+    phash_in_order=0;
+    return ;
+  }
+  phash_checkpoints[phash_checkpoints_next]=phash_cur;
+  phash_checkpoints_next=(phash_checkpoints_next+1) % PHASH_CHECKPOINTS;
+  if(phash_checkpoints_nbr < PHASH_CHECKPOINTS)
+    phash_checkpoints_nbr++;
+  phash_state_update(&phash_cur, data, len);
+#endif
+}
+
+int phash_file_finish(file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const uint64_t file_size=file_recovery->file_size;
+  phash_state_t state;
+  const phash_entry_t *entry;
+  int found=0;
+  phash_last_file=NULL;
+  if(phash_enable==0)
+    return 0;
+  if(phash_in_order!=0 && phash_file_match(file_recovery) && file_size > PHASH_REREAD)
+  {
+    /* Last state saved before the data that may have been rewritten */
+    if(phash_cur.pos <= file_size - PHASH_REREAD)
+    {
+      state=phash_cur;
+      found=1;
+    }
+    else
+    {
+      unsigned int i;
+      for(i=1; i<=phash_checkpoints_nbr && found==0; i++)
+      {
+	const phash_state_t *checkpoint=&phash_checkpoints[(phash_checkpoints_next + PHASH_CHECKPOINTS - i) % PHASH_CHECKPOINTS];
+	if(checkpoint->pos <= file_size - PHASH_REREAD)
+	{
+	  state=*checkpoint;
+	  found=1;
+	}
+      }
+    }
+  }
+  phash_file=NULL;
+  if(found==0)
+    phash_state_init(&state);
+  if(state.pos < file_size)
+  {
+    fflush(file_recovery->handle);
+    if(my_fseek(file_recovery->handle, state.pos, SEEK_SET) < 0)
+    {
+      log_error("%s: cannot read the file to hash it\n", file_recovery->filename);
+      return 0;
+    }
+    while(state.pos < file_size)
+    {
+      const unsigned int size=(file_size - state.pos < sizeof(phash_buffer) ?
+	  file_size - state.pos : sizeof(phash_buffer));
+      if(fread(phash_buffer, size, 1, file_recovery->handle)!=1)
+      {
+	log_error("%s: cannot read the file to hash it: %s\n", file_recovery->filename, strerror(errno));
+	return 0;
+      }
+      phash_state_update(&state, phash_buffer, size);
+    }
+  }
+  hash_final(&state.md5, phash_last.md5);
+  hash_final(&state.sha256, phash_last.sha256);
+  phash_last.duplicate_of=NULL;
+  phash_last.known=0;
+  phash_last_file=file_recovery;
+  phash_last_start=file_recovery->location.start;
+  phash_last_size=file_size;
+  if(phash_known_filename!=NULL && phash_known_loaded==0)
+    phash_known_load();
+  if(phash_known_nbr > 0 &&
+      (phash_is_known(phash_last.md5) || phash_is_known(phash_last.sha256)))
+  {
+    phash_last.known=1;
+    phash_known_skipped++;
+    phash_known_skipped_size+=file_size;
+    log_info("%s is a known file, %llu known files skipped (%llu bytes)\n",
+	file_recovery->filename,
+	(long long unsigned)phash_known_skipped, (long long unsigned)phash_known_skipped_size);
+    return 1;
+  }
+  if(phash_dedup==0)
+    return 0;
+  entry=phash_find(file_size, phash_last.sha256);
+  if(entry==NULL)
+    return 0;
+  phash_last.duplicate_of=entry->filename;
+  phash_duplicates++;
+  phash_duplicates_size+=file_size;
+  log_info("%s is a duplicate of %s, %llu duplicates skipped (%llu bytes)\n",
+      file_recovery->filename, entry->filename,
+      (long long unsigned)phash_duplicates, (long long unsigned)phash_duplicates_size);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void phash_file_recovered(const file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(phash_dedup==0 || phash_result(file_recovery)==NULL ||
+      phash_last.duplicate_of!=NULL)
+    return ;
+  phash_add(phash_last_size, phash_last.sha256, file_recovery->filename);
+#endif
+}
+
+const phash_result_t *phash_result(const file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(file_recovery==phash_last_file && file_recovery->location.start==phash_last_start &&
+      file_recovery->file_size==phash_last_size)
+    return &phash_last;
+#endif
+  return NULL;
+}
+
+int phash_removed(const file_recovery_t *file_recovery)
+{
+  const phash_result_t *result=phash_result(file_recovery);
+  return (result!=NULL && (result->duplicate_of!=NULL || result->known!=0) ? 1 : 0);
+}
+
+void phash_reset(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  for(i=0; i<phash_entries_alloc; i++)
+    free(phash_entries[i].filename);
+  free(phash_entries);
+  phash_entries=NULL;
+  phash_entries_nbr=0;
+  phash_entries_alloc=0;
+  phash_duplicates=0;
+  phash_duplicates_size=0;
+  phash_file=NULL;
+  phash_last_file=NULL;
+  free(phash_known);
+  phash_known=NULL;
+  phash_known_nbr=0;
+  phash_known_loaded=0;
+  phash_known_skipped=0;
+  phash_known_skipped_size=0;
+#endif
+}
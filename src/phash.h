@@ -0,0 +1,125 @@
+/*
+
+    File: phash.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PHASH_H
+#define _PHASH_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MD5 and SHA-256 of the recovered files, reported in DFXML.
+ * The blocks are hashed when they are written to the file. The hash state
+ * is saved before each write: once file_check() has set the final size,
+ * only the data after the last saved state before the last 4 KiB, that
+ * file_check() may have rewritten, are read back. A file written out of order,
+ * ie. by the brute-force pass, is read back completely.
+ * With dedup, a file identical to a file already recovered is removed
+ * and reported as a duplicate of this file. Its blocks still belong to
+ * a file, they aren't searched again. The known files are removed the
+ * same way. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void phash_set(const int enable);
+
+/* dedup implies hashing */
+/*@
+  @ assigns \nothing;
+  @*/
+void phash_set_dedup(const int enable);
+
+/* Known files, ie. the NSRL: the files whose MD5 or SHA-256 is listed in
+ * filename are removed. The hashes are loaded when the first file is
+ * finished, only the first 8 bytes of each digest are kept in a sorted
+ * array. filename must stay valid */
+/*@
+  @ requires filename == \null || valid_read_string(filename);
+  @ assigns \nothing;
+  @*/
+void phash_set_known(const char *filename);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int phash_enabled(void);
+
+/* file_recovery->handle has just been created */
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void phash_file_start(const file_recovery_t *file_recovery);
+
+/* len bytes have been written at offset in the file */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(data + (0 .. len-1));
+  @*/
+void phash_block(const file_recovery_t *file_recovery, const unsigned char *data, const unsigned int len, const uint64_t offset);
+
+/* Compute the digests of the first file_size bytes of the file, the file
+ * must still be open. Return 1 if it's a known file or if dedup is enabled
+ * and an identical file has already been recovered */
+/*@
+  @ requires \valid(file_recovery);
+  @ requires \valid(file_recovery->handle);
+  @*/
+int phash_file_finish(file_recovery_t *file_recovery);
+
+/* The file has been kept with its final name, the next identical files
+ * are duplicates of it */
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void phash_file_recovered(const file_recovery_t *file_recovery);
+
+typedef struct
+{
+  unsigned char md5[16];
+  unsigned char sha256[32];
+  /* Name of the identical file already recovered, NULL if none */
+  const char *duplicate_of;
+  /* The digest is in the known hashes */
+  int known;
+} phash_result_t;
+
+/* Digests of file_recovery if it's the last file finished, NULL otherwise */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ assigns \nothing;
+  @*/
+const phash_result_t *phash_result(const file_recovery_t *file_recovery);
+
+/* Return 1 if file_recovery is the last file finished and it has been
+ * removed: a duplicate or a known file */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ assigns \nothing;
+  @*/
+int phash_removed(const file_recovery_t *file_recovery);
+
+/* Forget the files recovered */
+void phash_reset(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
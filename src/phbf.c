@@ -41,6 +41,11 @@
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#if defined(HAVE_FORK) && defined(HAVE_PREAD) && defined(HAVE_SYS_WAIT_H)
+#include <sys/types.h>
+#include <sys/wait.h>
+#define PHBF_FORK
+#endif
 #include "types.h"
 #include "common.h"
 #include "intrf.h"
@@ -70,27 +75,39 @@
 #include "pblocksize.h"
 #include "pnext.h"
 #include "phbf.h"
+#include "phits.h"
+#include "pdest.h"
 #include "phnc.h"
+#include "pcontrol.h"
+#ifdef ENABLE_DFXML
+#include "dfxml.h"
+#endif
 
 //#define DEBUG_BF
 //#define DEBUG_BF2
 #define READ_SIZE 1024*512
 extern file_check_list_t file_check_list;
-extern uint64_t free_list_allocation_end;
+extern TD_THREAD_LOCAL uint64_t free_list_allocation_end;
 extern int need_to_stop;
 
 typedef enum { BF_OK=0, BF_STOP=1, BF_EACCES=2, BF_ENOSPC=3, BF_FRAG_FOUND=4, BF_EOF=5, BF_ENOENT=6, BF_ERANGE=7} bf_status_t;
 
+/* Set by the control socket, the session is saved before the next file */
+static int bf_checkpoint=0;
+
+/* Number of processes testing the brute force candidates */
+static unsigned int bf_workers=1;
+/* Set in the worker processes: a candidate that validates is reported, not saved */
+static int bf_dry_run=0;
+/* Progress written with the session checkpoints */
+static session_bf_t bf_progress;
+/* Candidate of the resumed session, tested again first */
+static session_bf_t bf_resume;
+static int bf_resume_valid=0;
+
 static pstatus_t photorec_bf_aux(struct ph_param *params, file_recovery_t *file_recovery, alloc_data_t *list_search_space, const int phase);
 static bf_status_t photorec_bf_frag(struct ph_param *params, file_recovery_t *file_recovery, alloc_data_t *list_search_space, alloc_data_t *start_search_space, const int phase, alloc_data_t **current_search_space, uint64_t *offset, unsigned char *buffer, unsigned char *block_buffer, const unsigned int frag);
 
-static inline void file_recovery_cpy(file_recovery_t *dst, const file_recovery_t *src)
-{
-  memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
-}
-
 static struct td_list_head *next_file(struct td_list_head *search_walker, const alloc_data_t *list_search_space)
 {
   struct td_list_head *tmp_walker;
@@ -121,7 +138,22 @@ static uint64_t get_offset_next_file(const struct td_list_head *search_walker, c
   return 0;
 }
 
-pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+/* The extent of the file brute forced when the session was saved */
+static struct td_list_head *bf_resume_walker(const alloc_data_t *list_search_space, const uint64_t file_start)
+{
+  struct td_list_head *search_walker;
+  for(search_walker=list_search_space->list.prev;
+      search_walker!=&list_search_space->list;
+      search_walker=search_walker->prev)
+  {
+    const alloc_data_t *tmp=td_list_entry_const(search_walker, const alloc_data_t, list);
+    if(tmp->start <= file_start)
+      return search_walker;
+  }
+  return search_walker;
+}
+
+pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const unsigned int workers)
 {
   struct td_list_head *search_walker = NULL;
   struct td_list_head *p= NULL;
@@ -132,12 +164,28 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
   pstatus_t ind_stop=PSTATUS_OK;
   int pass2=params->pass;
   int phase;
+  int resume=0;
+  time_t next_checkpoint;
   buffer_size=blocksize+READ_SIZE;
   buffer_start=(unsigned char *)MALLOC(buffer_size);
-  for(phase=0; phase<2; phase++)
+  bf_workers=(workers>0?workers:1);
+  if(session_get_bf(&bf_resume)==0 && bf_resume.phase < 2)
+  {
+    log_info("Resume the brute force, phase %u, file at sector %llu, offset %llu, skip %d\n",
+	bf_resume.phase,
+	(long long unsigned)(bf_resume.file_start / params->disk->sector_size),
+	(long long unsigned)bf_resume.file_offset,
+	bf_resume.blocs_to_skip);
+    resume=1;
+    bf_resume_valid=(bf_resume.file_offset > 0 ? 1 : 0);
+  }
+  memset(&bf_progress, 0, sizeof(bf_progress));
+  next_checkpoint=regular_session_start(time(NULL));
+  phits_start(params);
+  for(phase=(resume!=0 ? (int)bf_resume.phase : 0); phase<2; phase++)
   {
     const unsigned int file_nbr_phase_old=params->file_nbr;
-    for(search_walker=list_search_space->list.prev, p=search_walker->prev;
+    for(search_walker=(resume!=0 ? bf_resume_walker(list_search_space, bf_resume.file_start) : list_search_space->list.prev), p=search_walker->prev;
 	search_walker!=&list_search_space->list && ind_stop==PSTATUS_OK;
 	p=search_walker->prev)
     {
@@ -153,6 +201,20 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
       file_recovery.blocksize=blocksize;
       current_search_space=td_list_entry(search_walker, alloc_data_t, list);
       offset=current_search_space->start;
+      resume=0;
+      /* Between two files, the search space is complete */
+      bf_progress.phase=phase;
+      bf_progress.file_start=offset;
+      bf_progress.file_offset=0;
+      {
+	const time_t current_time=time(NULL);
+	if(current_time >= next_checkpoint || bf_checkpoint!=0)
+	{
+	  bf_checkpoint=0;
+	  session_set_bf(&bf_progress);
+	  next_checkpoint=regular_session_save(list_search_space, params, options, current_time);
+	}
+      }
       buffer_olddata=buffer_start;
       buffer=buffer_olddata + blocksize;
       memset(buffer_olddata, 0, blocksize);
@@ -174,23 +236,26 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
 	  file_recovery_new.blocksize=blocksize;
 	  file_recovery_new.location.start=offset;
 	  file_recovery_new.file_stat=NULL;
-	  td_list_for_each(tmpl, &file_check_list.list)
+	  if(phits_header_check(offset, buffer, read_size, &file_recovery, &file_recovery_new) < 0)
 	  {
-	    const struct td_list_head *tmp;
-	    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
-	    td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
+	    td_list_for_each(tmpl, &file_check_list.list)
 	    {
-	      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
-	      /*@ assert valid_file_check_node(file_check); */
-	      if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-		  file_check->header_check(buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
+	      const struct td_list_head *tmp;
+	      const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+	      td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
 	      {
-		file_recovery_new.file_stat=file_check->file_stat;
-		break;
+		const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+		/*@ assert valid_file_check_node(file_check); */
+		if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+		    file_header_check(file_check, buffer, read_size, 0, &file_recovery, &file_recovery_new)!=0)
+		{
+		  file_recovery_new.file_stat=file_check->file_stat;
+		  break;
+		}
 	      }
+	      if(file_recovery_new.file_stat!=NULL)
+		break;
 	    }
-	    if(file_recovery_new.file_stat!=NULL)
-	      break;
 	  }
 	  if(file_recovery_new.file_stat!=NULL)
 	  {
@@ -232,6 +297,7 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
 	  if(fwrite(buffer,blocksize,1,file_recovery.handle)<1)
 	  { 
 	    log_critical("Cannot write to file %s: %s\n", file_recovery.filename, strerror(errno));
+	    pdest_full(params, file_recovery.filename);
 	    ind_stop=PSTATUS_ENOSPC;
 	  }
 	  {
@@ -239,7 +305,7 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
 	    //	  log_info("add sector %llu\n", (long long unsigned)(offset/512));
 	    file_block_append(&file_recovery, list_search_space, &current_search_space, &offset, blocksize, 1);
 	    if(file_recovery.data_check!=NULL)
-	      res=file_recovery.data_check(buffer_olddata, 2*blocksize, &file_recovery);
+	      res=file_data_check(buffer_olddata, 2*blocksize, &file_recovery);
 	    file_recovery.file_size+=blocksize;
 	    if(res==DC_STOP || res==DC_ERROR)
 	    { /* EOF found */
@@ -297,7 +363,7 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
       }
       if(file_recovery.handle!=NULL)
       {
-	fclose(file_recovery.handle);
+	photorec_fclose(file_recovery.handle);
 	file_recovery.handle=NULL;
 	unlink(file_recovery.filename);
       }
@@ -312,6 +378,18 @@ pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options,
     }
     log_info("phase=%d +%u\n", phase, params->file_nbr - file_nbr_phase_old);
   }
+  bf_resume_valid=0;
+  /* Once stopped, the file being brute forced is tested again from its
+   * last candidate when the session is resumed */
+  if(ind_stop==PSTATUS_OK)
+    session_set_bf(NULL);
+  else
+  {
+    if(ind_stop!=PSTATUS_STOP)
+      bf_progress.file_offset=0;
+    session_set_bf(&bf_progress);
+  }
+  phits_finish();
   free(buffer_start);
 #ifdef HAVE_NCURSES
   photorec_info(stdscr, params->file_stats);
@@ -348,14 +426,15 @@ static bf_status_t photorec_bf_pad(struct ph_param *params, file_recovery_t *fil
 	      (*current_search_space)->file_stat->file_hint==NULL)
 	  {
 	    params->disk->pread(params->disk, block_buffer, blocksize, *offset);
-	    if(file_recovery->data_check(buffer, 2*blocksize, file_recovery)!=DC_CONTINUE)
+	    if(file_data_check(buffer, 2*blocksize, file_recovery)!=DC_CONTINUE)
 	    {
 	      stop=1;
 	    }
 	    if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
 	    {
 	      log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
-	      fclose(file_recovery->handle);
+	      pdest_full(params, file_recovery->filename);
+	      photorec_fclose(file_recovery->handle);
 	      file_recovery->handle=NULL;
 	      return BF_ENOSPC;
 	    }
@@ -382,7 +461,8 @@ static bf_status_t photorec_bf_pad(struct ph_param *params, file_recovery_t *fil
 	    if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
 	    {
 	      log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
-	      fclose(file_recovery->handle);
+	      pdest_full(params, file_recovery->filename);
+	      photorec_fclose(file_recovery->handle);
 	      file_recovery->handle=NULL;
 	      return BF_ENOSPC;
 	    }
@@ -422,6 +502,8 @@ static bf_status_t photorec_bf_pad(struct ph_param *params, file_recovery_t *fil
 #endif
   if(file_recovery->offset_error==0)
   { /* Recover the file */
+    if(bf_dry_run!=0)
+      return BF_OK;
 #ifdef DEBUG_BF
     log_info("photorec_bf_aux, call file_finish\n");
 #endif
@@ -445,6 +527,278 @@ static bf_status_t photorec_bf_pad(struct ph_param *params, file_recovery_t *fil
   return BF_ENOENT;
 }
 
+/* The brute force loop in photorec_bf_frag() stops once this is false */
+static int bf_skip_continue(const int phase, const int blocs_to_skip, const uint64_t offset_error, const uint64_t file_offset, const unsigned int blocksize)
+{
+  /* FIXME 16 100 250 */
+  return (blocs_to_skip<5000 &&
+	(offset_error==0 ||
+	 (phase==0 && (offset_error >= file_offset || blocs_to_skip<16)) ||
+	 (phase==1 && (offset_error + blocksize >= file_offset || blocs_to_skip<100)) ||
+	 (phase==2 && blocs_to_skip<10)
+	));
+}
+
+/* Try one candidate: skip blocs_to_skip blocks after the extra block and
+ * add the following data to the file. BF_ENOENT means that the next
+ * candidate has to be tested, BF_EOF that the search space is exhausted. */
+static bf_status_t photorec_bf_try(struct ph_param *params, file_recovery_t *file_recovery, const file_recovery_t *file_recovery_backup, alloc_data_t *list_search_space, const int phase, const uint64_t file_offset, alloc_data_t *extractblock_search_space, const uint64_t extrablock_offset, const int blocs_to_skip, alloc_data_t **current_search_space, uint64_t *offset, unsigned char *buffer, unsigned char *block_buffer, const int testbf)
+{
+  const unsigned int blocksize=params->blocksize;
+  memcpy(file_recovery, file_recovery_backup, sizeof(*file_recovery));
+  *current_search_space=extractblock_search_space;
+  *offset=extrablock_offset;
+#ifdef DEBUG_BF
+  log_info("photorec_bf_aux %s split file at %llu, skip=%u\n",
+      file_recovery->filename,
+      (long long unsigned)file_offset, blocs_to_skip);
+#endif
+
+  file_block_truncate_and_move(file_recovery, list_search_space, blocksize,
+      current_search_space, offset, buffer);
+  if(bf_dry_run==0)
+  {
+    static time_t previous_time=0;
+    time_t current_time;
+    current_time=time(NULL);
+    if(current_time>previous_time)
+    {
+      pstatus_t ind_stop=PSTATUS_OK;
+      previous_time=current_time;
+#ifdef HAVE_NCURSES
+      ind_stop=photorec_progressbar(stdscr, testbf, params,
+	  file_recovery->location.start, current_time);
+#endif
+      if(pcontrol_poll(params, file_recovery->location.start)!=0)
+	bf_checkpoint=1;
+      if(need_to_stop!=0)
+	ind_stop=PSTATUS_STOP;
+      if(ind_stop!=PSTATUS_OK)
+      {
+	/* Give the blocks back to the search space, the file is brute
+	 * forced again when the session is resumed */
+	file_recovery->flags=0;
+	file_recovery->file_check=NULL;
+	file_recovery->file_size=0;
+	file_recovery->offset_error=0;
+	file_finish_bf(file_recovery, params, list_search_space);
+	log_info("photorec_bf_aux, user choose to stop\n");
+	return BF_STOP;
+      }
+    }
+  }
+  /* Skip extra blocs */
+#ifdef DEBUG_BF
+  log_debug("Skip %u extra blocs\n", blocs_to_skip);
+#endif
+  //	log_info("%s Skip %u extra blocs\n", file_recovery->filename, blocs_to_skip);
+  if(blocs_to_skip < 0)
+  {
+    int i;
+    for(i=0; i< 2+blocs_to_skip; i++)
+    {
+      get_next_header(list_search_space, current_search_space, offset);
+    }
+  }
+  else
+  {
+    int i;
+    for(i=0; i<blocs_to_skip; i++)
+    {
+      get_next_sector(list_search_space, current_search_space, offset, blocksize);
+      if(*current_search_space==list_search_space)
+	return BF_EOF;
+    }
+  }
+
+  return photorec_bf_pad(params, file_recovery, list_search_space, phase, file_offset, current_search_space, offset, buffer, block_buffer);
+}
+
+#ifdef PHBF_FORK
+/* Candidates tested by each worker process per batch */
+#define PHBF_BATCH 8
+#define PHBF_MAX_WORKERS 64
+
+typedef struct
+{
+  int res;			/* -1 if unknown */
+  uint64_t offset_error;
+} bf_result_t;
+
+typedef struct
+{
+  int blocs_to_skip;
+  int res;
+  uint64_t offset_error;
+} bf_msg_t;
+
+typedef struct
+{
+  int start;
+  unsigned int nbr;
+  bf_result_t result[PHBF_MAX_WORKERS*PHBF_BATCH];
+} bf_batch_t;
+
+static const bf_result_t *bf_batch_get(const bf_batch_t *batch, const int blocs_to_skip)
+{
+  const bf_result_t *result;
+  if(blocs_to_skip < batch->start || blocs_to_skip >= batch->start + (int)batch->nbr)
+    return NULL;
+  result=&batch->result[blocs_to_skip - batch->start];
+  return (result->res < 0 ? NULL : result);
+}
+
+static int bf_write(const int fd, const void *buf, size_t size)
+{
+  const char *ptr=(const char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=write(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
+  return 0;
+}
+
+static int bf_read(const int fd, void *buf, size_t size)
+{
+  char *ptr=(char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=read(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
+  return 0;
+}
+
+/* Worker process: test the candidates first, first+step, first+2*step...
+ * on a private copy of the file, stop at the first one ending the search */
+static void photorec_bf_worker(const int fd, struct ph_param *params, file_recovery_t *file_recovery, const file_recovery_t *file_recovery_backup, alloc_data_t *list_search_space, const int phase, const uint64_t file_offset, alloc_data_t *extractblock_search_space, const uint64_t extrablock_offset, const int first, const unsigned int step, const unsigned int worker)
+{
+  const unsigned int blocksize=params->blocksize;
+  file_recovery_t file_recovery_worker;
+  alloc_data_t *current_search_space;
+  uint64_t offset;
+  unsigned char *buffer;
+  char filename[sizeof(file_recovery->filename)+16];
+  FILE *handle;
+  unsigned int j;
+  bf_dry_run=1;
+  log_set_levels(0);
+  snprintf(filename, sizeof(filename), "%s.bf%u", file_recovery_backup->filename, worker);
+  handle=fopen(filename, "w+b");
+  if(handle==NULL)
+    return ;
+  unlink(filename);
+  {
+    /* The file checks read back the data already recovered */
+    const unsigned int copy_size=65536;
+    unsigned char *copy_buffer=(unsigned char *)MALLOC(copy_size);
+    off_t pos=0;
+    ssize_t res;
+    while((res=pread(fileno(file_recovery_backup->handle), copy_buffer, copy_size, pos)) > 0)
+    {
+      if(fwrite(copy_buffer, res, 1, handle)!=1)
+      {
+	free(copy_buffer);
+	fclose(handle);
+	return ;
+      }
+      pos+=res;
+    }
+    free(copy_buffer);
+  }
+  memcpy(&file_recovery_worker, file_recovery_backup, sizeof(file_recovery_worker));
+  file_recovery_worker.handle=handle;
+  buffer=(unsigned char *)MALLOC(2*blocksize);
+  for(j=0; j<PHBF_BATCH; j++)
+  {
+    bf_msg_t msg;
+    msg.blocs_to_skip=first + worker + j * step;
+    if(msg.blocs_to_skip >= 5000)
+      break;
+    msg.res=photorec_bf_try(params, file_recovery, &file_recovery_worker, list_search_space, phase, file_offset, extractblock_search_space, extrablock_offset, msg.blocs_to_skip, &current_search_space, &offset, buffer, &buffer[blocksize], 0);
+    msg.offset_error=file_recovery->offset_error;
+    if(bf_write(fd, &msg, sizeof(msg))<0 || msg.res!=BF_ENOENT)
+      break;
+  }
+  free(buffer);
+  if(file_recovery->handle==handle)
+    fclose(handle);
+}
+
+/* Test the next candidates in bf_workers processes */
+static void photorec_bf_batch(bf_batch_t *batch, struct ph_param *params, file_recovery_t *file_recovery, const file_recovery_t *file_recovery_backup, alloc_data_t *list_search_space, const int phase, const uint64_t file_offset, alloc_data_t *extractblock_search_space, const uint64_t extrablock_offset, const int first)
+{
+  const unsigned int workers=(bf_workers < PHBF_MAX_WORKERS ? bf_workers : PHBF_MAX_WORKERS);
+  pid_t pids[PHBF_MAX_WORKERS];
+  int fds[PHBF_MAX_WORKERS];
+  unsigned int k;
+  unsigned int started;
+  batch->start=first;
+  batch->nbr=workers * PHBF_BATCH;
+  for(k=0; k<batch->nbr; k++)
+    batch->result[k].res=-1;
+  if(file_recovery_backup->handle==NULL)
+    return ;
+  fflush(file_recovery_backup->handle);
+  log_flush();
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  fflush(NULL);
+  for(started=0; started<workers; started++)
+  {
+    int pipe_fds[2];
+    if(pipe(pipe_fds) < 0)
+      break;
+    pids[started]=fork();
+    if(pids[started] < 0)
+    {
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      break;
+    }
+    if(pids[started]==0)
+    {
+      for(k=0; k<started; k++)
+	close(fds[k]);
+      close(pipe_fds[0]);
+      photorec_bf_worker(pipe_fds[1], params, file_recovery, file_recovery_backup, list_search_space, phase, file_offset, extractblock_search_space, extrablock_offset, first, workers, started);
+      close(pipe_fds[1]);
+      _exit(0);
+    }
+    close(pipe_fds[1]);
+    fds[started]=pipe_fds[0];
+  }
+  /* The candidates of the workers that couldn't be started stay unknown,
+   * they are tested by this process */
+  for(k=0; k<started; k++)
+  {
+    bf_msg_t msg;
+    while(bf_read(fds[k], &msg, sizeof(msg))==0)
+    {
+      if(msg.blocs_to_skip >= batch->start && msg.blocs_to_skip < batch->start + (int)batch->nbr)
+      {
+	batch->result[msg.blocs_to_skip - batch->start].res=msg.res;
+	batch->result[msg.blocs_to_skip - batch->start].offset_error=msg.offset_error;
+      }
+    }
+    close(fds[k]);
+    while(waitpid(pids[k], NULL, 0) < 0 && errno==EINTR);
+  }
+}
+#endif
+
 static bf_status_t photorec_bf_frag_fast(struct ph_param *params, file_recovery_t *file_recovery, alloc_data_t *list_search_space, alloc_data_t *start_search_space, const int phase, alloc_data_t **current_search_space, uint64_t *offset, unsigned char *buffer, unsigned char *block_buffer, const unsigned int frag)
 {
   const unsigned int blocksize=params->blocksize;
@@ -494,14 +848,15 @@ static bf_status_t photorec_bf_frag_fast(struct ph_param *params, file_recovery_
     for(k=original_offset_ok/blocksize+1; k<original_offset_error/blocksize; k++)
     {
       params->disk->pread(params->disk, block_buffer, blocksize, *offset);
-      if(file_recovery->data_check(buffer, 2*blocksize, file_recovery)!=DC_CONTINUE)
+      if(file_data_check(buffer, 2*blocksize, file_recovery)!=DC_CONTINUE)
       {
 	/* TODO handle this problem */
       }
       if(fwrite(block_buffer, blocksize, 1, file_recovery->handle)<1)
       {
 	log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
-	fclose(file_recovery->handle);
+	pdest_full(params, file_recovery->filename);
+	photorec_fclose(file_recovery->handle);
 	file_recovery->handle=NULL;
 	return BF_ENOSPC;
       }
@@ -543,8 +898,16 @@ static bf_status_t photorec_bf_frag(struct ph_param *params, file_recovery_t *fi
   const uint64_t original_offset_error=file_recovery->offset_error;
   const unsigned int blocksize=params->blocksize;
   int testbf=0;
+  /* The candidates before the one saved with the session were tested */
+  const int resume=(frag==0 && bf_resume_valid!=0 &&
+      bf_resume.file_start==file_recovery->location.start);
+#ifdef PHBF_FORK
+  bf_batch_t batch;
+#endif
+  if(frag==0)
+    bf_resume_valid=0;
 #if 1
-  if(file_recovery->extra > 0 &&
+  if(resume==0 && file_recovery->extra > 0 &&
       file_recovery->offset_error / blocksize > file_recovery->offset_ok / blocksize &&
       file_recovery->offset_ok > 0)
   {
@@ -574,6 +937,8 @@ static bf_status_t photorec_bf_frag(struct ph_param *params, file_recovery_t *fi
     int blocs_to_skip;
     file_recovery_t file_recovery_backup;
 //    memset(&file_recovery_backup, 0, sizeof(file_recovery_t));
+    if(resume!=0 && file_offset > bf_resume.file_offset)
+      continue;
     file_recovery->checkpoint_status=0;
     file_recovery->checkpoint_offset = file_offset;
     file_recovery->file_size=file_offset;
@@ -612,76 +977,45 @@ static bf_status_t photorec_bf_frag(struct ph_param *params, file_recovery_t *fi
     log_info("extrablock_offset=%llu sectors\n", (long long unsigned)(extrablock_offset/512));
 #endif
     memcpy(&file_recovery_backup, file_recovery, sizeof(file_recovery_backup));
-    /* FIXME 16 100 250 */
-    for(blocs_to_skip=-2;
-	blocs_to_skip<5000 &&
-	(file_recovery->offset_error==0 ||
-	 (phase==0 && (file_recovery->offset_error >= file_offset || blocs_to_skip<16)) ||
-	 (phase==1 && (file_recovery->offset_error + blocksize >= file_offset || blocs_to_skip<100)) ||
-	 (phase==2 && blocs_to_skip<10)
-	);
+#ifdef PHBF_FORK
+    batch.start=0;
+    batch.nbr=0;
+#endif
+    blocs_to_skip=-2;
+    if(resume!=0 && file_offset==bf_resume.file_offset)
+    {
+      blocs_to_skip=bf_resume.blocs_to_skip;
+      file_recovery->offset_error=bf_resume.offset_error;
+    }
+    for(;
+	bf_skip_continue(phase, blocs_to_skip, file_recovery->offset_error, file_offset, blocksize);
 	blocs_to_skip++,testbf++)
     {
       bf_status_t res;
-      memcpy(file_recovery, &file_recovery_backup, sizeof(file_recovery_backup));
-      *current_search_space=extractblock_search_space;
-      *offset=extrablock_offset;
-#ifdef DEBUG_BF
-      log_info("photorec_bf_aux %s split file at %llu, skip=%u\n",
-	  file_recovery->filename,
-	  (long long unsigned)file_offset, blocs_to_skip);
-#endif
-
-      file_block_truncate_and_move(file_recovery, list_search_space, blocksize,
-	  current_search_space, offset, buffer);
+      if(frag==0)
       {
-	static time_t previous_time=0;
-	time_t current_time;
-	current_time=time(NULL);
-	if(current_time>previous_time)
-	{
-	  pstatus_t ind_stop=PSTATUS_OK;
-	  previous_time=current_time;
-#ifdef HAVE_NCURSES
-	  ind_stop=photorec_progressbar(stdscr, testbf, params,
-	      file_recovery->location.start, current_time);
-#endif
-	  if(need_to_stop!=0)
-	    ind_stop=PSTATUS_STOP;
-	  if(ind_stop!=PSTATUS_OK)
-	  {
-	    file_recovery->flags=0;
-	    file_finish_bf(file_recovery, params, list_search_space);
-	    log_info("photorec_bf_aux, user choose to stop\n");
-	    return BF_STOP;
-	  }
-	}
-      }
-      /* Skip extra blocs */
-#ifdef DEBUG_BF
-      log_debug("Skip %u extra blocs\n", blocs_to_skip);
-#endif
-      //	log_info("%s Skip %u extra blocs\n", file_recovery->filename, blocs_to_skip);
-      if(blocs_to_skip < 0)
-      {
-	int i;
-	for(i=0; i< 2+blocs_to_skip; i++)
-	{
-	  get_next_header(list_search_space, current_search_space, offset);
-	}
+	bf_progress.file_offset=file_offset;
+	bf_progress.blocs_to_skip=blocs_to_skip;
+	bf_progress.offset_error=file_recovery->offset_error;
       }
-      else
+#ifdef PHBF_FORK
+      if(bf_workers>1 && need_to_stop==0)
       {
-	int i;
-	for(i=0; i<blocs_to_skip; i++)
+	const bf_result_t *result;
+	if(blocs_to_skip < batch.start || blocs_to_skip >= batch.start + (int)batch.nbr)
+	  photorec_bf_batch(&batch, params, file_recovery, &file_recovery_backup, list_search_space, phase, file_offset, extractblock_search_space, extrablock_offset, blocs_to_skip);
+	result=bf_batch_get(&batch, blocs_to_skip);
+	/* A candidate that doesn't end the search is only needed for its
+	 * offset_error, unless it's the last one before the loop stops */
+	if(result!=NULL && result->res==BF_ENOENT &&
+	    bf_skip_continue(phase, blocs_to_skip+1, result->offset_error, file_offset, blocksize))
 	{
-	  get_next_sector(list_search_space, current_search_space, offset, blocksize);
-	  if(*current_search_space==list_search_space)
-	    return BF_ENOENT;
+	  file_recovery->offset_error=result->offset_error;
+	  continue;
 	}
       }
-
-      res=photorec_bf_pad(params, file_recovery, list_search_space, phase, file_offset, current_search_space, offset, buffer, block_buffer);
+#endif
+      res=photorec_bf_try(params, file_recovery, &file_recovery_backup, list_search_space, phase, file_offset, extractblock_search_space, extrablock_offset, blocs_to_skip, current_search_space, offset, buffer, block_buffer, testbf);
       if(res==BF_FRAG_FOUND)
       {
 	if(frag>5)
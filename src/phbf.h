@@ -26,7 +26,9 @@ extern "C" {
 #endif
 #if !defined(DISABLED_FOR_FRAMAC)
 
-pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space);
+/* When workers>1, the brute force candidates are tested in parallel by
+ * forked processes, the result is the same as with a single process. */
+pstatus_t photorec_bf(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const unsigned int workers);
 
 #endif
 #ifdef __cplusplus
@@ -37,6 +37,12 @@
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "intrf.h"
@@ -54,6 +60,14 @@
 #include "file_found.h"
 
 #define READ_SIZE 1024*512
+/* Search spaces of at least PHBS_WINDOWS windows are sampled */
+#define PHBS_WINDOWS		256
+#define PHBS_WINDOW_SIZE	(1024*1024)
+/* Windows read ahead of the header checks */
+#define PHBS_BUFFERS		4
+/* Headers aligned like all the previous ones needed to trust the estimate */
+#define PHBS_CONFIDENCE		10
+#define PHBS_MIN_FILES		10
 
 #if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_tar)
 extern const file_hint_t file_hint_tar;
@@ -61,19 +75,73 @@ extern const file_hint_t file_hint_tar;
 extern file_check_list_t file_check_list;
 extern int need_to_stop;
 
-/*@
-  @ requires \valid(dst);
-  @ requires \valid_read(src);
-  @ requires \separated(src, dst);
-  @*/
-static inline void file_recovery_cpy(file_recovery_t *dst, const file_recovery_t *src)
+#ifndef DISABLED_FOR_FRAMAC
+file_stat_t *phbs_check(const unsigned char *buffer, const unsigned int read_size, const unsigned int blocksize, const uint64_t offset, file_recovery_t *file_recovery)
 {
-  memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
+  file_stat_t *file_stat=NULL;
+  {
+    file_recovery_t file_recovery_new;
+    file_recovery_new.blocksize=blocksize;
+    file_recovery_new.location.start=offset;
+#if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_tar)
+    if(file_recovery->file_stat!=NULL && file_recovery->file_stat->file_hint==&file_hint_tar &&
+	is_valid_tar_header((const struct tar_posix_header *)(buffer-0x200)))
+    { /* Currently saving a tar, do not check the data for know header */
+    }
+    else
+#endif
+    {
+      const struct td_list_head *tmpl;
+      file_recovery_new.file_stat=NULL;
+      td_list_for_each(tmpl, &file_check_list.list)
+      {
+	const struct td_list_head *tmp;
+	const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+	td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
+	{
+	  const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+	  /*@ assert valid_file_check_node(file_check); */
+	  if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+	      file_check->header_check(buffer, read_size, 1, file_recovery, &file_recovery_new)!=0)
+	  {
+	    file_recovery_new.file_stat=file_check->file_stat;
+	    break;
+	  }
+	}
+	if(file_recovery_new.file_stat!=NULL)
+	  break;
+      }
+      if(file_recovery_new.file_stat!=NULL && file_recovery_new.file_stat->file_hint!=NULL)
+      {
+	/* A new file begins */
+	file_stat=file_recovery_new.file_stat;
+	file_recovery_cpy(file_recovery, &file_recovery_new);
+      }
+    }
+  }
+  /* Check for data EOF */
+  if(file_recovery->file_stat!=NULL)
+  {
+    data_check_t res=DC_CONTINUE;
+    if(file_recovery->data_check!=NULL)
+      res=file_recovery->data_check(buffer - blocksize, 2*blocksize, file_recovery);
+    file_recovery->file_size+=blocksize;
+    if(res==DC_STOP || res==DC_ERROR)
+    {
+      /* EOF found */
+      reset_file_recovery(file_recovery);
+    }
+  }
+  /* Check for maximum filesize */
+  if(file_recovery->file_stat!=NULL && file_recovery->file_stat->file_hint->max_filesize>0 && file_recovery->file_size>=file_recovery->file_stat->file_hint->max_filesize)
+  {
+    reset_file_recovery(file_recovery);
+  }
+  return file_stat;
 }
 
-pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+/* Scan the search space from its beginning until PHBS_MIN_FILES files are found */
+static void photorec_find_blocksize_seq(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
 {
   uint64_t offset=0;
   unsigned char *buffer_start;
@@ -87,7 +155,6 @@ pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_optio
   /*@ assert read_size >= 65536; */
   alloc_data_t *current_search_space;
   file_recovery_t file_recovery;
-#ifndef DISABLED_FOR_FRAMAC
   params->file_nbr=0;
   reset_file_recovery(&file_recovery);
   file_recovery.blocksize=blocksize;
@@ -108,66 +175,15 @@ pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_optio
   {
     const uint64_t old_offset=offset;
     {
-      file_recovery_t file_recovery_new;
-      file_recovery_new.blocksize=blocksize;
-      file_recovery_new.location.start=offset;
-#if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_tar)
-      if(file_recovery.file_stat!=NULL && file_recovery.file_stat->file_hint==&file_hint_tar &&
-          is_valid_tar_header((const struct tar_posix_header *)(buffer-0x200)))
-      { /* Currently saving a tar, do not check the data for know header */
-      }
-      else
-#endif
+      file_stat_t *file_stat=phbs_check(buffer, read_size, blocksize, offset, &file_recovery);
+      if(file_stat!=NULL)
       {
-	const struct td_list_head *tmpl;
-        file_recovery_new.file_stat=NULL;
-	td_list_for_each(tmpl, &file_check_list.list)
-	{
-	  const struct td_list_head *tmp;
-	  const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
-	  td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
-	  {
-	    const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
-	    /*@ assert valid_file_check_node(file_check); */
-	    if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-		file_check->header_check(buffer, read_size, 1, &file_recovery, &file_recovery_new)!=0)
-	    {
-	      file_recovery_new.file_stat=file_check->file_stat;
-	      break;
-	    }
-	  }
-	  if(file_recovery_new.file_stat!=NULL)
-	    break;
-	}
-        if(file_recovery_new.file_stat!=NULL && file_recovery_new.file_stat->file_hint!=NULL)
-	{
-	  /* A new file begins, backup file offset */
-	  current_search_space=file_found(current_search_space, offset, file_recovery_new.file_stat);
-	  params->file_nbr++;
-	  file_recovery_cpy(&file_recovery, &file_recovery_new);
-	}
-      }
-    }
-    /* Check for data EOF */
-    if(file_recovery.file_stat!=NULL)
-    {
-      data_check_t res=DC_CONTINUE;
-      if(file_recovery.data_check!=NULL)
-	res=file_recovery.data_check(buffer_olddata, 2*blocksize, &file_recovery);
-      file_recovery.file_size+=blocksize;
-      if(res==DC_STOP || res==DC_ERROR)
-      {
-	/* EOF found */
-	reset_file_recovery(&file_recovery);
+	/* A new file begins, backup file offset */
+	current_search_space=file_found(current_search_space, offset, file_stat);
+	params->file_nbr++;
       }
     }
-    /* Check for maximum filesize */
-    if(file_recovery.file_stat!=NULL && file_recovery.file_stat->file_hint->max_filesize>0 && file_recovery.file_size>=file_recovery.file_stat->file_hint->max_filesize)
-    {
-      reset_file_recovery(&file_recovery);
-    }
-
-    if(params->file_nbr >= 10)
+    if(params->file_nbr >= PHBS_MIN_FILES)
     {
       current_search_space=list_search_space;
     }
@@ -224,6 +240,319 @@ pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_optio
     }
   } /* end while(current_search_space!=list_search_space) */
   free(buffer_start);
+}
+
+/* A window of the search space, in a single search space element */
+struct phbs_window
+{
+  uint64_t start;
+  unsigned int size;
+};
+
+struct phbs_buffer
+{
+  unsigned char *data;		/* blocksize zeros, the window, read_size zeros */
+  int ready;
+};
+
+struct phbs_ctx
+{
+  disk_t *disk;
+  const struct phbs_window *windows;
+  unsigned int nbr_windows;
+  unsigned int blocksize;
+  unsigned int read_size;
+  struct phbs_buffer buffers[PHBS_BUFFERS];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int thread_ok;
+  int quit;
+#endif
+};
+
+static void phbs_read(struct phbs_ctx *ctx, struct phbs_buffer *buffer, const unsigned int i)
+{
+  const struct phbs_window *window=&ctx->windows[i];
+  unsigned char *data=buffer->data + ctx->blocksize;
+  int res=0;
+  if(window->size > 0)
+    res=ctx->disk->pread(ctx->disk, data, window->size, window->start);
+  if(res < 0)
+    res=0;
+  memset(data + res, 0, window->size - res + ctx->read_size);
+}
+
+#ifdef HAVE_PTHREAD
+/* Read the windows ahead of the header checks */
+static void *phbs_reader(void *arg)
+{
+  struct phbs_ctx *ctx=(struct phbs_ctx *)arg;
+  unsigned int i;
+  for(i=0; i<ctx->nbr_windows; i++)
+  {
+    struct phbs_buffer *buffer=&ctx->buffers[i%PHBS_BUFFERS];
+    pthread_mutex_lock(&ctx->mutex);
+    while(buffer->ready!=0 && ctx->quit==0)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+    if(ctx->quit!=0)
+    {
+      pthread_mutex_unlock(&ctx->mutex);
+      break;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+    phbs_read(ctx, buffer, i);
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->ready=1;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+  }
+  return NULL;
+}
+#endif
+
+static struct phbs_buffer *phbs_get_buffer(struct phbs_ctx *ctx, const unsigned int i)
+{
+  struct phbs_buffer *buffer=&ctx->buffers[i%PHBS_BUFFERS];
+#ifdef HAVE_PTHREAD
+  if(ctx->thread_ok)
+  {
+    pthread_mutex_lock(&ctx->mutex);
+    while(buffer->ready==0)
+      pthread_cond_wait(&ctx->cond, &ctx->mutex);
+    pthread_mutex_unlock(&ctx->mutex);
+    return buffer;
+  }
+#endif
+  phbs_read(ctx, buffer, i);
+  return buffer;
+}
+
+static void phbs_release_buffer(struct phbs_ctx *ctx, struct phbs_buffer *buffer)
+{
+#ifdef HAVE_PTHREAD
+  if(ctx->thread_ok)
+  {
+    pthread_mutex_lock(&ctx->mutex);
+    buffer->ready=0;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+  }
+#endif
+}
+
+static unsigned int phbs_bitrev(unsigned int value)
+{
+  unsigned int res=0;
+  unsigned int i;
+  for(i=1; i<PHBS_WINDOWS; i<<=1)
+  {
+    res=(res<<1) | (value&1);
+    value>>=1;
+  }
+  return res;
+}
+
+/* Pick a window at a random place in each of the PHBS_WINDOWS strata of
+ * the search space. They are stored in bit-reversed order so that the
+ * first windows are spread over the whole search space. */
+static void phbs_set_windows(const alloc_data_t *list_search_space, const uint64_t total, const unsigned int blocksize, struct phbs_window *windows)
+{
+  const uint64_t stratum=total / PHBS_WINDOWS;
+  const struct td_list_head *search_walker=list_search_space->list.next;
+  uint64_t base=0;
+  uint64_t seed=1;
+  unsigned int i;
+  for(i=0; i<PHBS_WINDOWS; i++)
+  {
+    struct phbs_window *window=&windows[phbs_bitrev(i)];
+    uint64_t target=i * stratum;
+    const alloc_data_t *element;
+    seed=seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    if(stratum > PHBS_WINDOW_SIZE)
+      target+=(seed>>33) % (stratum - PHBS_WINDOW_SIZE);
+    element=td_list_entry_const(search_walker, const alloc_data_t, list);
+    while(base + element->end - element->start + 1 <= target)
+    {
+      base+=element->end - element->start + 1;
+      search_walker=search_walker->next;
+      element=td_list_entry_const(search_walker, const alloc_data_t, list);
+    }
+    window->start=element->start + (target - base) / blocksize * blocksize;
+    if(element->end + 1 - window->start >= PHBS_WINDOW_SIZE)
+      window->size=PHBS_WINDOW_SIZE;
+    else
+      window->size=(element->end + 1 - window->start) / blocksize * blocksize;
+  }
+}
+
+/* Same estimate as find_blocksize() over the header offsets found so far,
+ * offset starts as the reference of the first search space element */
+static void phbs_estimate(const uint64_t *headers, const unsigned int nbr_headers, const unsigned int default_blocksize, unsigned int *blocksize, uint64_t *offset)
+{
+  int run_again;
+  do
+  {
+    unsigned int i;
+    run_again=0;
+    for(i=0; i<nbr_headers; i++)
+    {
+      if(headers[i] % *blocksize != *offset && *blocksize > default_blocksize)
+      {
+	*blocksize=*blocksize >> 1;
+	*offset=headers[i] % *blocksize;
+	run_again=1;
+      }
+    }
+  } while(run_again>0);
+}
+
+/* Check stratified random windows for file headers until their alignment
+ * is known with enough confidence, return 1 if it is */
+static int photorec_find_blocksize_sample(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const uint64_t total)
+{
+  struct phbs_ctx ctx;
+  struct phbs_window *windows;
+  const unsigned int blocksize=params->blocksize;
+  const unsigned int sector_size=params->disk->sector_size;
+  unsigned int est_blocksize=128*512;
+  uint64_t est_offset;
+  uint64_t *headers=NULL;
+  unsigned int nbr_headers=0;
+  unsigned int allocated_headers=0;
+  unsigned int agree=0;
+  int done=0;
+  unsigned int i;
+  time_t previous_time=time(NULL);
+  windows=(struct phbs_window *)MALLOC(PHBS_WINDOWS * sizeof(struct phbs_window));
+  phbs_set_windows(list_search_space, total, blocksize, windows);
+  /* Same reference as find_blocksize() */
+  est_offset=td_list_first_entry(&list_search_space->list, alloc_data_t, list)->start % est_blocksize;
+  if(options->verbose>0)
+    log_verbose("photorec_find_blocksize: sampling %u windows of %u bytes\n",
+	PHBS_WINDOWS, PHBS_WINDOW_SIZE);
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.disk=params->disk;
+  ctx.windows=windows;
+  ctx.nbr_windows=PHBS_WINDOWS;
+  ctx.blocksize=blocksize;
+  ctx.read_size=(blocksize>65536?blocksize:65536);
+  for(i=0; i<PHBS_BUFFERS; i++)
+  {
+    ctx.buffers[i].data=(unsigned char *)MALLOC(blocksize + PHBS_WINDOW_SIZE + ctx.read_size);
+    memset(ctx.buffers[i].data, 0, blocksize);
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&ctx.mutex, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+  ctx.thread_ok=(pthread_create(&ctx.thread, NULL, &phbs_reader, &ctx)==0);
+#endif
+  params->file_nbr=0;
+  for(i=0; i<PHBS_WINDOWS && done==0; i++)
+  {
+    const struct phbs_window *window=&windows[i];
+    struct phbs_buffer *buffer=phbs_get_buffer(&ctx, i);
+    alloc_data_t *current_search_space;
+    file_recovery_t file_recovery;
+    unsigned int pos;
+    reset_file_recovery(&file_recovery);
+    file_recovery.blocksize=blocksize;
+    current_search_space=td_list_first_entry(&list_search_space->list, alloc_data_t, list);
+    while(current_search_space->end < window->start)
+      current_search_space=td_list_next_entry(current_search_space, list);
+    for(pos=0; pos<window->size && done==0; pos+=blocksize)
+    {
+      const uint64_t offset=window->start + pos;
+      file_stat_t *file_stat=phbs_check(buffer->data + blocksize + pos, ctx.read_size, blocksize, offset, &file_recovery);
+      if(file_stat==NULL)
+	continue;
+      current_search_space=file_found(current_search_space, offset, file_stat);
+      params->file_nbr++;
+      if(nbr_headers==allocated_headers)
+      {
+	allocated_headers=(allocated_headers==0 ? 64 : allocated_headers*2);
+	headers=(uint64_t *)realloc(headers, allocated_headers * sizeof(uint64_t));
+	if(headers==NULL)
+	{
+	  log_critical("photorec_find_blocksize: not enough memory\n");
+	  exit(1);
+	}
+      }
+      headers[nbr_headers++]=offset;
+      {
+	const unsigned int old_blocksize=est_blocksize;
+	const uint64_t old_offset=est_offset;
+	phbs_estimate(headers, nbr_headers, sector_size, &est_blocksize, &est_offset);
+	if(est_blocksize==old_blocksize && est_offset==old_offset)
+	  agree++;
+	else
+	  agree=0;
+      }
+      /* A coarser alignment matching every header by chance has
+       * a 2^-agree probability */
+      if(agree >= PHBS_CONFIDENCE || est_blocksize <= sector_size)
+	done=1;
+    }
+    phbs_release_buffer(&ctx, buffer);
+#ifdef HAVE_NCURSES
+    {
+      const time_t current_time=time(NULL);
+      if(current_time>previous_time)
+      {
+	previous_time=current_time;
+	if(photorec_progressbar(stdscr, 0, params, window->start, current_time))
+	{
+	  log_info("PhotoRec has been stopped\n");
+	  need_to_stop=1;
+	}
+      }
+    }
+#endif
+    if(need_to_stop!=0)
+      break;
+  }
+#ifdef HAVE_PTHREAD
+  if(ctx.thread_ok)
+  {
+    pthread_mutex_lock(&ctx.mutex);
+    ctx.quit=1;
+    pthread_cond_broadcast(&ctx.cond);
+    pthread_mutex_unlock(&ctx.mutex);
+    pthread_join(ctx.thread, NULL);
+  }
+  pthread_cond_destroy(&ctx.cond);
+  pthread_mutex_destroy(&ctx.mutex);
+#endif
+  for(i=0; i<PHBS_BUFFERS; i++)
+    free(ctx.buffers[i].data);
+  free(headers);
+  free(windows);
+  log_info("photorec_find_blocksize: %u headers found in sampled windows, blocksize %u%s\n",
+      params->file_nbr, est_blocksize, (done!=0 ? "" : " (not confirmed)"));
+  return done;
+}
+
+#endif
+
+pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t total=0;
+  const struct td_list_head *search_walker;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *tmp=td_list_entry_const(search_walker, const alloc_data_t, list);
+    total+=tmp->end - tmp->start + 1;
+  }
+  /* Sample large search spaces instead of reading them until enough files are found */
+  if(total >= (uint64_t)PHBS_WINDOWS * PHBS_WINDOW_SIZE && params->blocksize <= PHBS_WINDOW_SIZE)
+  {
+    if(photorec_find_blocksize_sample(params, options, list_search_space, total)!=0 ||
+	params->file_nbr >= PHBS_MIN_FILES || need_to_stop!=0)
+      return PSTATUS_OK;
+  }
+  photorec_find_blocksize_seq(params, options, list_search_space);
 #endif
   return PSTATUS_OK;
 }
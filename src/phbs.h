@@ -33,6 +33,18 @@ extern "C" {
   @*/
 pstatus_t photorec_find_blocksize(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space);
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Check the block at buffer for a new file header like the sampled
+ * block size estimate, buffer-blocksize must hold the previous block.
+ * file_recovery is the file in progress, reset it before the first
+ * block of a window. Return the file type of a new file. */
+/*@
+  @ requires \valid_read(buffer - blocksize + (0 .. blocksize + read_size - 1));
+  @ requires \valid(file_recovery);
+  @*/
+file_stat_t *phbs_check(const unsigned char *buffer, const unsigned int read_size, const unsigned int blocksize, const uint64_t offset, file_recovery_t *file_recovery);
+#endif
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
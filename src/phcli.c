@@ -44,7 +44,7 @@ extern int need_to_stop;
 #include "phcli.h"
 #include "list_add_sorted_uniq.h"
 
-typedef enum { INIT_SPACE_WHOLE, INIT_SPACE_PREINIT, INIT_SPACE_EXT2_GROUP, INIT_SPACE_EXT2_INODE } init_mode_t;
+typedef enum { INIT_SPACE_WHOLE, INIT_SPACE_PREINIT, INIT_SPACE_EXT2_GROUP, INIT_SPACE_EXT2_INODE, INIT_SPACE_EXT2_DELETED } init_mode_t;
 
 /*@
   @ requires \valid_read(a);
@@ -146,6 +146,7 @@ static int file_select_cli(file_enable_t *files_enable, char**current_cmd)
 int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph_options *options, alloc_data_t*list_search_space)
 {
   unsigned int user_blocksize=0;
+  int all_partitions=0;
   init_mode_t mode_init_space=(td_list_empty(&list_search_space->list)?INIT_SPACE_WHOLE:INIT_SPACE_PREINIT);
   params->partition=(list_part->next!=NULL ? list_part->next->part : list_part->part);
   /*@ assert valid_partition(params->partition); */
@@ -165,6 +166,17 @@ int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph
     if(check_command(&params->cmd_run,"search",6)==0)
     {
 #ifndef DISABLED_FOR_FRAMAC
+      if(all_partitions>0)
+      {
+	/* Each partition gets its own search space */
+	if(mode_init_space!=INIT_SPACE_WHOLE)
+	{
+	  log_error("allpartitions can't be used with a preset or ext2 search space\n");
+	  return -1;
+	}
+	params->blocksize=user_blocksize;
+	return 2;
+      }
       if(mode_init_space==INIT_SPACE_EXT2_GROUP)
       {
 	params->blocksize=ext2_fix_group(list_search_space, params->disk, params->partition);
@@ -183,6 +195,17 @@ int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph
 	  return -1;
 	}
       }
+      else if(mode_init_space==INIT_SPACE_EXT2_DELETED)
+      {
+	params->blocksize=ext2_deleted_space(list_search_space, params->disk, params->partition);
+	if(params->blocksize==0)
+	{
+	  log_error("Not a valid ext2/ext3/ext4 filesystem");
+	  return -1;
+	}
+	if(td_list_empty(&list_search_space->list))
+	  log_info("No block found from the deleted inodes, searching the whole partition\n");
+      }
 #endif
       if(td_list_empty(&list_search_space->list))
       {
@@ -229,6 +252,10 @@ int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph
     {
       params->carve_free_space_only=1;
     }
+    else if(check_command(&params->cmd_run,"allpartitions",13)==0)
+    {
+      all_partitions=1;
+    }
     else if(check_command(&params->cmd_run,"ext2_group,",11)==0)
     {
       unsigned int groupnr;
@@ -239,14 +266,14 @@ int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph
       if(mode_init_space==INIT_SPACE_EXT2_GROUP)
       {
 	alloc_data_t *new_free_space;
-	new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+	new_free_space=alloc_data_new();
 	/* Temporary storage, values need to be multiplied by group size and aligned */
 	new_free_space->start=groupnr;
 	new_free_space->end=groupnr;
 	new_free_space->file_stat=NULL;
 	new_free_space->data=1;
 	if(td_list_add_sorted_uniq(&new_free_space->list, &list_search_space->list, spacerange_cmp))
-	  free(new_free_space);
+	  alloc_data_free(new_free_space);
       }
     }
     else if(check_command(&params->cmd_run,"ext2_inode,",11)==0)
@@ -259,16 +286,23 @@ int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph
       if(mode_init_space==INIT_SPACE_EXT2_INODE)
       {
 	alloc_data_t *new_free_space;
-	new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+	new_free_space=alloc_data_new();
 	/* Temporary storage, values need to be multiplied by group size and aligned */
 	new_free_space->start=inodenr;
 	new_free_space->end=inodenr;
 	new_free_space->file_stat=NULL;
 	new_free_space->data=1;
 	if(td_list_add_sorted_uniq(&new_free_space->list, &list_search_space->list, spacerange_cmp))
-	  free(new_free_space);
+	  alloc_data_free(new_free_space);
       }
     }
+    else if(check_command(&params->cmd_run,"ext2_deleted",12)==0)
+    {
+      /* Only search the blocks still listed by the deleted inodes */
+      options->mode_ext2=1;
+      if(mode_init_space==INIT_SPACE_WHOLE)
+	mode_init_space=INIT_SPACE_EXT2_DELETED;
+    }
     else if(isdigit(params->cmd_run[0]))
     {
       list_part_t *element;
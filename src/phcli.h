@@ -40,6 +40,8 @@ extern "C" {
   @ requires \separated(&need_to_stop, list_part, params, options, list_search_space);
   @*/
 // ensures  valid_list_search_space(list_search_space);
+/* Returns 1 to search params->partition, 2 to search each partition
+ * (allpartitions), 0 or -1 otherwise */
 int menu_photorec_cli(list_part_t *list_part, struct ph_param *params, struct ph_options *options, alloc_data_t*list_search_space);
 
 #ifdef __cplusplus
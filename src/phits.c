@@ -0,0 +1,259 @@
+/*
+
+    File: phits.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "phits.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+/* 17 bytes per hit, stop recording beyond 272 MB */
+#define PHITS_MAX	(16*1024*1024)
+
+static TD_THREAD_LOCAL unsigned int hits_blocksize=0;
+static TD_THREAD_LOCAL uint64_t hits_part_offset=0;
+static TD_THREAD_LOCAL uint64_t hits_part_size=0;
+/* Sorted, non-overlapping [start, end) ranges of the blocks recorded */
+static TD_THREAD_LOCAL uint64_t *hits_ranges=NULL;
+static TD_THREAD_LOCAL uint64_t hits_ranges_nbr=0;
+static TD_THREAD_LOCAL uint64_t hits_ranges_alloc=0;
+/* The hits, sorted by offset */
+static TD_THREAD_LOCAL uint64_t *hits_offset=NULL;
+static TD_THREAD_LOCAL const file_check_t **hits_check=NULL;
+static TD_THREAD_LOCAL unsigned char *hits_accepted=NULL;
+static TD_THREAD_LOCAL uint64_t hits_nbr=0;
+static TD_THREAD_LOCAL uint64_t hits_alloc=0;
+/* Offset following the last block recorded */
+static TD_THREAD_LOCAL uint64_t hits_next_offset=0;
+static TD_THREAD_LOCAL int hits_full=0;
+static TD_THREAD_LOCAL uint64_t hits_replayed=0;
+static TD_THREAD_LOCAL uint64_t hits_rescanned=0;
+#endif
+
+void phits_reset(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  free(hits_ranges);
+  free(hits_offset);
+  free(hits_check);
+  free(hits_accepted);
+  hits_blocksize=0;
+  hits_ranges=NULL;
+  hits_ranges_nbr=0;
+  hits_ranges_alloc=0;
+  hits_offset=NULL;
+  hits_check=NULL;
+  hits_accepted=NULL;
+  hits_nbr=0;
+  hits_alloc=0;
+  hits_next_offset=0;
+  hits_full=0;
+#endif
+}
+
+void phits_start(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(hits_blocksize!=params->blocksize ||
+      hits_part_offset!=params->partition->part_offset ||
+      hits_part_size!=params->partition->part_size)
+  {
+    phits_reset();
+    hits_blocksize=params->blocksize;
+    hits_part_offset=params->partition->part_offset;
+    hits_part_size=params->partition->part_size;
+  }
+  hits_replayed=0;
+  hits_rescanned=0;
+#endif
+}
+
+int phits_record(const uint64_t offset, const unsigned int blocksize)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(hits_full!=0 || blocksize!=hits_blocksize || offset < hits_next_offset)
+    return 0;
+  hits_next_offset=offset + blocksize;
+  if(hits_ranges_nbr > 0 && hits_ranges[2*hits_ranges_nbr-1]==offset)
+  {
+    hits_ranges[2*hits_ranges_nbr-1]=offset + blocksize;
+    return 1;
+  }
+  if(hits_ranges_nbr==hits_ranges_alloc)
+  {
+    uint64_t *tmp;
+    hits_ranges_alloc=(hits_ranges_alloc < 1024 ? 1024 : 2 * hits_ranges_alloc);
+    tmp=(uint64_t *)realloc(hits_ranges, 2 * hits_ranges_alloc * sizeof(uint64_t));
+    if(tmp==NULL)
+    {
+      log_error("Header hits: not enough memory, stop recording\n");
+      hits_full=1;
+      return 0;
+    }
+    hits_ranges=tmp;
+  }
+  hits_ranges[2*hits_ranges_nbr]=offset;
+  hits_ranges[2*hits_ranges_nbr+1]=offset + blocksize;
+  hits_ranges_nbr++;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Stop recording at the block holding offset, it can't be recorded
+ * completely: the blocks before it keep their hits */
+static void phits_stop(const uint64_t offset)
+{
+  hits_full=1;
+  while(hits_nbr > 0 && hits_offset[hits_nbr-1]==offset)
+    hits_nbr--;
+  if(hits_ranges_nbr > 0 && hits_ranges[2*hits_ranges_nbr-1] > offset)
+  {
+    if(hits_ranges[2*hits_ranges_nbr-2] < offset)
+      hits_ranges[2*hits_ranges_nbr-1]=offset;
+    else
+      hits_ranges_nbr--;
+  }
+  log_info("Header hits: %llu hits recorded, stop recording\n", (long long unsigned)hits_nbr);
+}
+#endif
+
+void phits_add(const uint64_t offset, const file_check_t *file_check, const int accepted)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(hits_full!=0)
+    return ;
+  if(hits_nbr==hits_alloc)
+  {
+    uint64_t *tmp_offset;
+    const file_check_t **tmp_check;
+    unsigned char *tmp_accepted;
+    if(hits_alloc >= PHITS_MAX)
+    {
+      phits_stop(offset);
+      return ;
+    }
+    hits_alloc=(hits_alloc < 1024 ? 1024 : 2 * hits_alloc);
+    tmp_offset=(uint64_t *)realloc(hits_offset, hits_alloc * sizeof(uint64_t));
+    if(tmp_offset!=NULL)
+      hits_offset=tmp_offset;
+    tmp_check=(const file_check_t **)realloc(hits_check, hits_alloc * sizeof(const file_check_t *));
+    if(tmp_check!=NULL)
+      hits_check=tmp_check;
+    tmp_accepted=(unsigned char *)realloc(hits_accepted, hits_alloc);
+    if(tmp_accepted!=NULL)
+      hits_accepted=tmp_accepted;
+    if(tmp_offset==NULL || tmp_check==NULL || tmp_accepted==NULL)
+    {
+      phits_stop(offset);
+      return ;
+    }
+  }
+  hits_offset[hits_nbr]=offset;
+  hits_check[hits_nbr]=file_check;
+  hits_accepted[hits_nbr]=(accepted!=0 ? 1 : 0);
+  hits_nbr++;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static int phits_is_recorded(const uint64_t offset)
+{
+  uint64_t low=0;
+  uint64_t high=hits_ranges_nbr;
+  /* Last range starting at or before offset */
+  while(low < high)
+  {
+    const uint64_t mid=low + (high - low) / 2;
+    if(hits_ranges[2*mid] <= offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  return (low > 0 && offset < hits_ranges[2*(low-1)+1] ? 1 : 0);
+}
+#endif
+
+int phits_header_check(const uint64_t offset, const unsigned char *buffer, const unsigned int buffer_size, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t low=0;
+  uint64_t high=hits_nbr;
+  int last_accepted=0;
+  if(phits_is_recorded(offset)==0)
+    return -1;
+  while(low < high)
+  {
+    const uint64_t mid=low + (high - low) / 2;
+    if(hits_offset[mid] < offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  for(; low < hits_nbr && hits_offset[low]==offset; low++)
+  {
+    const file_check_t *file_check=hits_check[low];
+    if(file_header_check(file_check, buffer, buffer_size, 0, file_recovery, file_recovery_new)!=0)
+    {
+      file_recovery_new->file_stat=file_check->file_stat;
+      hits_replayed++;
+      return 1;
+    }
+    last_accepted=hits_accepted[low];
+  }
+  if(last_accepted!=0)
+  {
+    hits_rescanned++;
+    return -1;
+  }
+  hits_replayed++;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void phits_finish(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(hits_replayed==0 && hits_rescanned==0)
+    return ;
+  log_info("Header hits: %llu blocks tested from %llu hits, %llu blocks tested again\n",
+      (long long unsigned)hits_replayed, (long long unsigned)hits_nbr,
+      (long long unsigned)hits_rescanned);
+#endif
+}
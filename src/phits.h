@@ -0,0 +1,73 @@
+/*
+
+    File: phits.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PHITS_H
+#define _PHITS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Header hits: the first time a block is tested for a header, the
+ * signatures matching it are recorded in the order they are tested, with
+ * the result of their header_check: accepted or rejected. The test stops
+ * at the first accepted header, so a block whose last hit is accepted may
+ * hold more signatures. The data and the signatures don't change between
+ * two passes, the next passes and the brute-force pass only run the
+ * header_check of the recorded hits instead of matching the block against
+ * every signature again. */
+
+/* Forget every hit, the signatures are about to be freed */
+void phits_reset(void);
+
+/* Keep the hits recorded for the same partition and blocksize */
+/*@
+  @ requires \valid_read(params);
+  @*/
+void phits_start(const struct ph_param *params);
+
+/* Return 1 if the block at offset has never been tested: its hits must be
+ * recorded with phits_add(), in the order they are tested */
+int phits_record(const uint64_t offset, const unsigned int blocksize);
+
+/*@
+  @ requires \valid_read(file_check);
+  @*/
+void phits_add(const uint64_t offset, const file_check_t *file_check, const int accepted);
+
+/* Run the header_check of the hits recorded for the block at offset.
+ * Return 1 and set file_recovery_new->file_stat if a header is accepted,
+ * 0 if there is no header, -1 if the block isn't known or if it may hold
+ * a signature that hasn't been recorded: the block must be tested against
+ * every signature */
+/*@
+  @ requires \valid_read(buffer+(0..buffer_size-1));
+  @ requires \valid_read(file_recovery);
+  @ requires \valid(file_recovery_new);
+  @*/
+int phits_header_check(const uint64_t offset, const unsigned char *buffer, const unsigned int buffer_size, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new);
+
+/* Log the usage of the hits for the current pass */
+void phits_finish(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
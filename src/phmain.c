@@ -77,6 +77,12 @@
 #include "filegen.h"
 #include "photorec.h"
 #include "hdcache.h"
+#include "hdtee.h"
+#include "hdqos.h"
+#include "hdshare.h"
+#include "hdtrace.h"
+#include "hdstats.h"
+#include "pcontrol.h"
 #include "ewf.h"
 #include "log.h"
 #include "hdaccess.h"
@@ -89,12 +95,31 @@
 #include "ntfs_dir.h"
 #include "pdiskseln.h"
 #include "dfxml.h"
+#include "ppack.h"
+#include "pstream.h"
+#include "phash.h"
+#include "srchash.h"
+#include "pdest.h"
+#include "ptune.h"
+#include "ppriority.h"
+#include "ptriage.h"
+#include "pinventory.h"
+#include "pprune.h"
+#include "pdepth.h"
+#include "preader.h"
+#include "pcheck.h"
+#include "pfilter.h"
+#include "pspec.h"
+#include "paffinity.h"
+#include "pindex.h"
+#include "pmanifest.h"
+#include "pblockmap.h"
 
 int need_to_stop=0;
 extern file_enable_t array_file_enable[];
 #ifndef DISABLED_FOR_FRAMAC
-extern uint64_t gpfh_nbr;
-extern uint64_t gpls_nbr;
+extern TD_THREAD_LOCAL uint64_t gpfh_nbr;
+extern TD_THREAD_LOCAL uint64_t gpls_nbr;
 #endif
 
 #ifdef HAVE_SIGACTION
@@ -127,7 +152,51 @@ static void display_help(void)
       "       photorec /version\n" \
       "\n" \
       "/log          : create a photorec.log file\n" \
-      "/debug        : add debug information\n" \
+      "/debug        : add debug information\n"
+      "/profile      : log the time spent in each file format parser\n"
+      "/mapfile file : only search the areas that the ddrescue mapfile lists as rescued\n"
+      "/skip_unmapped: don't search the holes of a sparse image or the trimmed blocks\n"
+      "/pack         : store the recovered files in recup_dir.pack.N.tar archives\n"
+      "/deferrename  : set the dates and rename the recovered files in batches\n"
+      "/deepcheck    : decompress the gzip and zip files to check their CRC\n"
+      "/sparse       : leave the zero blocks of the recovered files as holes\n"
+      "/jpgscaled    : check the JPEG at 1/8 scale, only decode them fully when corrupted\n"
+      "/hash         : compute the MD5 and SHA-256 of the recovered files\n"
+      "/srchash      : compute the MD5, SHA-1 and SHA-256 of the source while it is searched\n"
+      "/dedup        : also remove the files identical to a file already recovered\n"
+      "/knownhash file: remove the files whose MD5 or SHA-256 is listed in file, ie. NSRL\n"
+      "/stripe dir   : also write the recovered files to dir, in turn with recup_dir\n"
+      "/stripefree   : spread the files according to the free space of the destinations\n"
+      "/readsize N   : read the disk by N KiB, measured on the device by default\n"
+      "/readahead N  : keep N MiB of read-ahead queued, measured on the device by default\n"
+      "/passthrough N: read the devices with SCSI/NVMe commands aborted after N ms, not retried\n"
+      "/slowerrors N : mark the rest of a bad area unreadable after N slow read errors, 0 to read it all\n"
+      "/sharedcache N: share N MiB of the data read with the other processes reading the same source\n"
+      "/priority     : search first the areas with the most file signatures\n"
+      "/triage N     : estimate the file formats and data volume in N minutes\n"
+      "/triagesize N : stop the triage once N MiB have been read\n"
+      "/triagerecover: carve the files found by the triage\n"
+      "/inventory    : only run the header checks and list the files found in inventory.txt\n"
+      "/prune        : check the costly file formats not found so far on fewer blocks\n"
+      "/asynccheck N : check up to N large files in other processes while the scan goes on\n"
+      "/adaptivecheck: check the files deeper while the scan waits for the disk\n"
+      "/filter list  : only write the files matching ext=jpg,size>=1M,date>=2025-03-01,known\n"
+      "/speculate    : check the blocks of a file again for a header it hides, instead of going back\n"
+      "/cpus list    : run the scan on the first core of list, ie. 0-7,16-23\n"
+      "/numa         : keep the read buffers and threads on the NUMA node of the disk\n"
+      "/nohugepages  : don't back the read buffers with huge pages\n"
+      "/index file   : create a scan index or use it to only read the candidate blocks\n"
+      "/manifest file: don't search again the files listed in the report.xml or report.jsonl of a previous run\n"
+      "/blockmap file: write the format, file or class of each range read in a binary map\n"
+      "/trace file   : record the disk reads in an I/O trace, see trace_replay\n"
+      "/tee file     : image the disk to file while it is read, the disk is read only once\n"
+      "/qos N        : throttle the reads to keep the latency of the disk under N ms\n"
+      "/metrics file : write the I/O counters and latencies in the Prometheus text format\n"
+      "/control path : listen on a Unix socket for status, watch, pause, resume, stop or checkpoint\n"
+#if defined(ENABLE_DFXML)
+      "/jsonl        : also write report.jsonl, one JSON line per recovered file\n"
+      "/nowrite      : only list the recovered files in report.jsonl, see photorecfs\n"
+#endif
       "\n" \
       "PhotoRec searches for various file formats (JPEG, Office...). It stores files\n" \
       "in the recup_dir directory.\n");
@@ -170,6 +239,13 @@ int main( int argc, char **argv )
   int testdisk_mode=TESTDISK_O_RDONLY|TESTDISK_O_READAHEAD_32K;
   list_disk_t *element_disk;
   const char *logfile="photorec.log";
+  const char *trace_filename=NULL;
+  const char *tee_filename=NULL;
+  const char *metrics_filename=NULL;
+  const char *control_path=NULL;
+  unsigned int triage_seconds=0;
+  uint64_t triage_bytes=0;
+  int triage_recover=0;
   int log_opened=0;
   int log_errno=0;
   struct ph_options options={
@@ -189,6 +265,7 @@ int main( int argc, char **argv )
   params.cmd_device=NULL;
   params.cmd_run=NULL;
   params.carve_free_space_only=0;
+  params.file_stats=NULL;
   params.disk=NULL;
   /*@ assert valid_ph_param(&params); */
   /* random (weak is ok) is needed for GPT */
@@ -298,6 +375,125 @@ int main( int argc, char **argv )
     }
     else if((strcmp(argv[i],"/nosetlocale")==0) || (strcmp(argv[i],"-nosetlocale")==0))
       run_setlocale=0;
+    else if((strcmp(argv[i],"/profile")==0) || (strcmp(argv[i],"-profile")==0))
+      file_profile=1;
+    else if(i+1<argc && ((strcmp(argv[i],"/mapfile")==0) || (strcmp(argv[i],"-mapfile")==0)))
+      set_search_mapfile(argv[++i]);
+    else if((strcmp(argv[i],"/skip_unmapped")==0) || (strcmp(argv[i],"-skip_unmapped")==0))
+      set_search_skip_unmapped(1);
+    else if((strcmp(argv[i],"/pack")==0) || (strcmp(argv[i],"-pack")==0))
+      ppack_set(1);
+    else if((strcmp(argv[i],"/deferrename")==0) || (strcmp(argv[i],"-deferrename")==0))
+      file_rename_set_deferred(1);
+    else if((strcmp(argv[i],"/deepcheck")==0) || (strcmp(argv[i],"-deepcheck")==0))
+      file_deep_check=1;
+    else if((strcmp(argv[i],"/sparse")==0) || (strcmp(argv[i],"-sparse")==0))
+      file_sparse_set(1);
+    else if((strcmp(argv[i],"/jpgscaled")==0) || (strcmp(argv[i],"-jpgscaled")==0))
+      jpg_set_scaled_check(1);
+    else if((strcmp(argv[i],"/hash")==0) || (strcmp(argv[i],"-hash")==0))
+      phash_set(1);
+    else if((strcmp(argv[i],"/srchash")==0) || (strcmp(argv[i],"-srchash")==0))
+      srchash_set(1);
+    else if((strcmp(argv[i],"/dedup")==0) || (strcmp(argv[i],"-dedup")==0))
+      phash_set_dedup(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/knownhash")==0) || (strcmp(argv[i],"-knownhash")==0)))
+      phash_set_known(argv[++i]);
+    else if(i+1<argc && ((strcmp(argv[i],"/stripe")==0) || (strcmp(argv[i],"-stripe")==0)))
+    {
+      const char *dir=argv[++i];
+      const int len=strlen(dir);
+      if(len > 0 && (dir[len-1]=='\\' || dir[len-1]=='/'))
+      {
+	char *recup_dir=(char *)MALLOC(len + strlen(DEFAULT_RECUP_DIR) + 1);
+	strcpy(recup_dir, dir);
+	strcat(recup_dir, DEFAULT_RECUP_DIR);
+	pdest_add(recup_dir);
+	free(recup_dir);
+      }
+      else
+	pdest_add(dir);
+    }
+    else if((strcmp(argv[i],"/stripefree")==0) || (strcmp(argv[i],"-stripefree")==0))
+      pdest_set_weighted(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/readsize")==0) || (strcmp(argv[i],"-readsize")==0)))
+    {
+      const unsigned long size=strtoul(argv[++i], NULL, 10);
+      ptune_set_read_size(size <= 64*1024 ? size * 1024 : 64*1024*1024);
+    }
+    else if(i+1<argc && ((strcmp(argv[i],"/readahead")==0) || (strcmp(argv[i],"-readahead")==0)))
+    {
+      const unsigned long depth=strtoul(argv[++i], NULL, 10);
+      ptune_set_depth(depth <= 256 ? depth : 256);
+    }
+    else if(i+1<argc && ((strcmp(argv[i],"/passthrough")==0) || (strcmp(argv[i],"-passthrough")==0)))
+      file_set_passthrough(strtoul(argv[++i], NULL, 10));
+    else if(i+1<argc && ((strcmp(argv[i],"/slowerrors")==0) || (strcmp(argv[i],"-slowerrors")==0)))
+      diskcache_set_slow_errors(strtoul(argv[++i], NULL, 10));
+    else if(i+1<argc && ((strcmp(argv[i],"/sharedcache")==0) || (strcmp(argv[i],"-sharedcache")==0)))
+      diskshare_set_size((uint64_t)strtoul(argv[++i], NULL, 10) << 20);
+    else if((strcmp(argv[i],"/priority")==0) || (strcmp(argv[i],"-priority")==0))
+      ppriority_set(1);
+    else if((strcmp(argv[i],"/speculate")==0) || (strcmp(argv[i],"-speculate")==0))
+      pspec_set(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/triage")==0) || (strcmp(argv[i],"-triage")==0)))
+      triage_seconds=strtoul(argv[++i], NULL, 10) * 60;
+    else if(i+1<argc && ((strcmp(argv[i],"/triagesize")==0) || (strcmp(argv[i],"-triagesize")==0)))
+      triage_bytes=(uint64_t)strtoul(argv[++i], NULL, 10) << 20;
+    else if((strcmp(argv[i],"/triagerecover")==0) || (strcmp(argv[i],"-triagerecover")==0))
+      triage_recover=1;
+    else if((strcmp(argv[i],"/inventory")==0) || (strcmp(argv[i],"-inventory")==0))
+      pinventory_set(1);
+    else if((strcmp(argv[i],"/prune")==0) || (strcmp(argv[i],"-prune")==0))
+      pprune_set(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/asynccheck")==0) || (strcmp(argv[i],"-asynccheck")==0)))
+      pcheck_set(atoi(argv[++i]));
+    else if((strcmp(argv[i],"/adaptivecheck")==0) || (strcmp(argv[i],"-adaptivecheck")==0))
+      pdepth_set(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/filter")==0) || (strcmp(argv[i],"-filter")==0)))
+    {
+      if(pfilter_set(argv[++i]) < 0)
+      {
+	printf("\nInvalid filter %s\n", argv[i]);
+	free(params.recup_dir);
+	return 1;
+      }
+    }
+    else if(i+1<argc && ((strcmp(argv[i],"/cpus")==0) || (strcmp(argv[i],"-cpus")==0)))
+    {
+      paffinity_set_cpus(argv[++i]);
+      /* A single process carves the disk */
+      paffinity_worker(0);
+    }
+    else if((strcmp(argv[i],"/numa")==0) || (strcmp(argv[i],"-numa")==0))
+      paffinity_set_numa(1);
+    else if((strcmp(argv[i],"/nohugepages")==0) || (strcmp(argv[i],"-nohugepages")==0))
+      set_io_hugepages(0);
+    else if(i+1<argc && ((strcmp(argv[i],"/index")==0) || (strcmp(argv[i],"-index")==0)))
+      pindex_set(argv[++i]);
+    else if(i+1<argc && ((strcmp(argv[i],"/manifest")==0) || (strcmp(argv[i],"-manifest")==0)))
+      pmanifest_set(argv[++i]);
+    else if(i+1<argc && ((strcmp(argv[i],"/blockmap")==0) || (strcmp(argv[i],"-blockmap")==0)))
+      pblockmap_set(argv[++i]);
+    else if(i+1<argc && ((strcmp(argv[i],"/trace")==0) || (strcmp(argv[i],"-trace")==0)))
+      trace_filename=argv[++i];
+    else if(i+1<argc && ((strcmp(argv[i],"/tee")==0) || (strcmp(argv[i],"-tee")==0)))
+      tee_filename=argv[++i];
+    else if(i+1<argc && ((strcmp(argv[i],"/qos")==0) || (strcmp(argv[i],"-qos")==0)))
+      diskqos_set_target(atoi(argv[++i]) > 0 ? atoi(argv[i]) * 1000 : 0);
+    else if(i+1<argc && ((strcmp(argv[i],"/metrics")==0) || (strcmp(argv[i],"-metrics")==0)))
+      metrics_filename=argv[++i];
+    else if(i+1<argc && ((strcmp(argv[i],"/control")==0) || (strcmp(argv[i],"-control")==0)))
+      control_path=argv[++i];
+#if defined(ENABLE_DFXML)
+    else if((strcmp(argv[i],"/jsonl")==0) || (strcmp(argv[i],"-jsonl")==0))
+      xml_set_jsonl(1);
+    else if((strcmp(argv[i],"/nowrite")==0) || (strcmp(argv[i],"-nowrite")==0))
+    {
+      xml_set_jsonl(1);
+      pstream_set_files(0);
+    }
+#endif
     else
 #endif
     if(strcmp(argv[i],"/cmd")==0)
@@ -322,7 +518,9 @@ int main( int argc, char **argv )
         params.cmd_device="disk.dd";
 #endif
         params.cmd_run=argv[++i];
-        /* There is no log currently */
+        /* Open the log first, the setup of the device is logged */
+        if(create_log!=TD_LOG_NONE && log_opened==0)
+          log_opened=log_open(logfile, create_log, &log_errno);
         disk_car=file_test_availability(params.cmd_device, options.verbose, testdisk_mode);
 	/*@ assert disk_car == \null || valid_disk(disk_car); */
         if(disk_car==NULL)
@@ -356,12 +554,13 @@ int main( int argc, char **argv )
     }
 #endif
   }
+  ptriage_set(triage_seconds, triage_bytes, triage_recover);
   /*@ assert valid_ph_param(&params); */
 #if defined(ENABLE_DFXML)
   xml_set_command_line(argc, argv);
 #endif
   /*@ assert valid_read_string(logfile); */
-  if(create_log!=TD_LOG_NONE)
+  if(create_log!=TD_LOG_NONE && log_opened==0)
     log_opened=log_open(logfile, create_log, &log_errno);
 #ifdef HAVE_SETLOCALE
   if(run_setlocale>0)
@@ -432,9 +631,38 @@ int main( int argc, char **argv )
   if(list_disk==NULL)
     list_disk=hd_parse(list_disk, options.verbose, testdisk_mode);
   hd_update_all_geometry(list_disk, options.verbose);
+  if(metrics_filename!=NULL)
+    disk_stats_set_prometheus(metrics_filename, 10);
+  if(control_path!=NULL)
+    pcontrol_open(control_path);
   /* Activate the cache, even if photorec has its own */
-  for(element_disk=list_disk;element_disk!=NULL;element_disk=element_disk->next)
+  for(element_disk=list_disk, i=0; element_disk!=NULL; element_disk=element_disk->next, i++)
   {
+    /* Trace the device reads, below the cache */
+    if(trace_filename!=NULL)
+    {
+      char *filename=(char *)MALLOC(strlen(trace_filename) + 12);
+      if(i==0)
+	strcpy(filename, trace_filename);
+      else
+	sprintf(filename, "%s.%d", trace_filename, i);
+      element_disk->disk=new_disktrace(element_disk->disk, filename);
+      free(filename);
+    }
+    /* Image the device, the failed reads are split by the cache */
+    if(tee_filename!=NULL)
+    {
+      char *filename=(char *)MALLOC(strlen(tee_filename) + 12);
+      if(i==0)
+	strcpy(filename, tee_filename);
+      else
+	sprintf(filename, "%s.%d", tee_filename, i);
+      element_disk->disk=new_disktee(element_disk->disk, filename);
+      free(filename);
+    }
+    /* Keep the disk usable by its other users, the cached data is free */
+    if(diskqos_target() > 0)
+      element_disk->disk=new_diskqos(element_disk->disk);
     element_disk->disk=new_diskcache(element_disk->disk, testdisk_mode);
   }
   log_disk_list(list_disk);
@@ -459,6 +687,10 @@ int main( int argc, char **argv )
   {
     log_info("perf: get_prev_file_header: %lu, get_prev_location_smart: %lu\n", (long unsigned)gpfh_nbr, (long unsigned)gpls_nbr);
   }
+  disk_stats_log_all();
+  if(metrics_filename!=NULL)
+    disk_stats_save_prometheus(metrics_filename);
+  pcontrol_close();
   log_info("PhotoRec exited normally.\n");
 #endif
   if(log_close()!=0)
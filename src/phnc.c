@@ -49,6 +49,7 @@ void photorec_info(WINDOW *window, const file_stat_t *file_stats)
   unsigned int i;
   unsigned int nbr;
   unsigned int others=0;
+  unsigned int others_found=0;
   file_stat_t *new_file_stats;
   for(i=0;file_stats[i].file_hint!=NULL;i++);
   nbr=i;
@@ -61,24 +62,36 @@ void photorec_info(WINDOW *window, const file_stat_t *file_stats)
   {
     wmove(window,12+i,0);
     wclrtoeol(window);
-    wprintw(window, "%s: %u recovered\n",
+    wprintw(window, "%s: %u/%u recovered\n",
 	(new_file_stats[i].file_hint->extension!=NULL?
 	 new_file_stats[i].file_hint->extension:""),
-	new_file_stats[i].recovered);
+	new_file_stats[i].recovered,
+	new_file_stats[i].recovered+new_file_stats[i].not_recovered);
   }
   for(;i<nbr && new_file_stats[i].recovered>0;i++)
+  {
     others+=new_file_stats[i].recovered;
+    others_found+=new_file_stats[i].recovered+new_file_stats[i].not_recovered;
+  }
   if(others>0)
   {
     wmove(window,12+9,0);
     wclrtoeol(window);
-    wprintw(window, "others: %u recovered\n", others);
+    wprintw(window, "others: %u/%u recovered\n", others, others_found);
   }
   free(new_file_stats);
 }
 
 pstatus_t photorec_progressbar(WINDOW *window, const unsigned int pass, const struct ph_param *params, const uint64_t offset, const time_t current_time)
 {
+  /* The file stats only change when a file is recovered or a header is
+   * found or dropped, the screen is cleared at the start of each pass */
+  static unsigned int stats_file_nbr=0;
+  static unsigned int stats_not_recovered=0;
+  static unsigned int stats_pass=0;
+  static const file_stat_t *stats_file_stats=NULL;
+  unsigned int not_recovered=0;
+  unsigned int i;
   const partition_t *partition=params->partition;
   const unsigned int sector_size=params->disk->sector_size;
   if(params->status!=STATUS_FIND_OFFSET)
@@ -124,7 +137,17 @@ pstatus_t photorec_progressbar(WINDOW *window, const unsigned int pass, const st
 	  (unsigned)(eta%60));
     }
   }
-  photorec_info(window, params->file_stats);
+  for(i=0; params->file_stats[i].file_hint!=NULL; i++)
+    not_recovered+=params->file_stats[i].not_recovered;
+  if(params->file_nbr!=stats_file_nbr || pass!=stats_pass ||
+      params->file_stats!=stats_file_stats || not_recovered!=stats_not_recovered)
+  {
+    stats_file_nbr=params->file_nbr;
+    stats_not_recovered=not_recovered;
+    stats_pass=pass;
+    stats_file_stats=params->file_stats;
+    photorec_info(window, params->file_stats);
+  }
   wrefresh(window);
   return(check_enter_key_or_s(window)==0?PSTATUS_OK:PSTATUS_STOP);
 }
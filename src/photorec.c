@@ -30,6 +30,7 @@
 #undef HAVE_LIBNTFS
 #undef HAVE_LIBNTFS3G
 #undef ENABLE_DFXML
+#undef HAVE_PTHREAD
 #endif
 
 #include <stdio.h>
@@ -43,6 +44,9 @@
 #include <string.h>
 #endif
 #include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>	/* fallocate */
+#endif
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
@@ -53,6 +57,9 @@
 #include "__fc_builtin.h"
 #endif
 #include <limits.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "types.h"
 #include "common.h"
 #include "fnctdsk.h"
@@ -60,17 +67,190 @@
 #include "filegen.h"
 #include "photorec.h"
 #include "exfatp.h"
+#include "hfspp.h"
+#include "xfsp.h"
 #include "ext2p.h"
 #include "fatp.h"
 #include "ntfsp.h"
 #include "log.h"
 #include "setdate.h"
 #include "dfxml.h"
+#include "mapfile.h"
+#include "hdaccess.h"
+#include "hdcache.h"
+#include "hdpipe.h"
+#include "ppack.h"
+#include "pstream.h"
+#include "pblockmap.h"
+#include "pmanifest.h"
+#include "pdepth.h"
+#include "pspace.h"
+#include "pprobe.h"
+#include "phash.h"
+#include "pdest.h"
 
 /* #define DEBUG_FILE_FINISH */
 /* #define DEBUG_UPDATE_SEARCH_SPACE */
 /* #define DEBUG_FREE */
-uint64_t gpfh_nbr=0;
+TD_THREAD_LOCAL uint64_t gpfh_nbr=0;
+
+/* Search space and file block nodes are carved from slabs of
+ * NODE_POOL_SLAB nodes and recycled through a free list. The slabs are
+ * given back once no node is in use, see free_search_space().
+ * The pools are shared by the process: QPhotoRec creates the search
+ * space in its GUI thread and carves it in a worker thread. */
+#define NODE_POOL_SLAB 1024
+
+typedef union node_slab_u node_slab_t;
+union node_slab_u
+{
+  node_slab_t *next;
+  uint64_t align;
+};
+
+typedef struct
+{
+  const size_t node_size;
+  void *free_nodes;
+  node_slab_t *slabs;
+  unsigned int live;
+  unsigned int peak;
+} node_pool_t;
+
+static node_pool_t alloc_data_pool={ sizeof(alloc_data_t), NULL, NULL, 0, 0 };
+static node_pool_t alloc_list_pool={ sizeof(alloc_list_t), NULL, NULL, 0, 0 };
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t node_pool_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#ifndef DISABLED_FOR_FRAMAC
+static void *node_pool_alloc(node_pool_t *pool)
+{
+  void *node;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&node_pool_mutex);
+#endif
+  if(pool->free_nodes==NULL)
+  {
+    node_slab_t *slab=(node_slab_t *)MALLOC(sizeof(node_slab_t) + NODE_POOL_SLAB * pool->node_size);
+    char *nodes=(char *)(slab + 1);
+    unsigned int i;
+    slab->next=pool->slabs;
+    pool->slabs=slab;
+    for(i=0; i < NODE_POOL_SLAB; i++)
+    {
+      void *n=&nodes[i * pool->node_size];
+      *(void **)n=pool->free_nodes;
+      pool->free_nodes=n;
+    }
+  }
+  node=pool->free_nodes;
+  pool->free_nodes=*(void **)node;
+  pool->live++;
+  if(pool->peak < pool->live)
+    pool->peak=pool->live;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&node_pool_mutex);
+#endif
+  return node;
+}
+
+static void node_pool_free(node_pool_t *pool, void *node)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&node_pool_mutex);
+#endif
+  *(void **)node=pool->free_nodes;
+  pool->free_nodes=node;
+  pool->live--;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&node_pool_mutex);
+#endif
+}
+
+static void node_pool_release(node_pool_t *pool, const char *name)
+{
+  unsigned int peak;
+  node_slab_t *slabs;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&node_pool_mutex);
+#endif
+  peak=pool->peak;
+  slabs=NULL;
+  if(pool->live==0)
+  {
+    slabs=pool->slabs;
+    pool->slabs=NULL;
+    pool->free_nodes=NULL;
+    pool->peak=0;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&node_pool_mutex);
+#endif
+  if(slabs==NULL)
+    return ;
+  log_info("%s: %u nodes in use at peak\n", name, peak);
+  while(slabs!=NULL)
+  {
+    node_slab_t *next=slabs->next;
+    free(slabs);
+    slabs=next;
+  }
+}
+#endif
+
+alloc_data_t *alloc_data_new(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (alloc_data_t *)node_pool_alloc(&alloc_data_pool);
+#else
+  return (alloc_data_t *)MALLOC(sizeof(alloc_data_t));
+#endif
+}
+
+void alloc_data_free(alloc_data_t *node)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  node_pool_free(&alloc_data_pool, node);
+#else
+  free(node);
+#endif
+}
+
+void search_space_set_file_stat(alloc_data_t *extent, file_stat_t *file_stat)
+{
+  if(extent->file_stat!=NULL)
+    extent->file_stat->not_recovered--;
+  if(file_stat!=NULL)
+    file_stat->not_recovered++;
+  extent->file_stat=file_stat;
+}
+
+void search_space_del(alloc_data_t *extent)
+{
+  if(extent->file_stat!=NULL)
+    extent->file_stat->not_recovered--;
+  td_list_del(&extent->list);
+  alloc_data_free(extent);
+}
+
+alloc_list_t *alloc_list_new(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (alloc_list_t *)node_pool_alloc(&alloc_list_pool);
+#else
+  return (alloc_list_t *)MALLOC(sizeof(alloc_list_t));
+#endif
+}
+
+void alloc_list_free(alloc_list_t *node)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  node_pool_free(&alloc_list_pool, node);
+#else
+  free(node);
+#endif
+}
 
 static void update_search_space_aux(alloc_data_t *list_search_space, uint64_t start, uint64_t end, alloc_data_t **new_current_search_space, uint64_t *offset);
 
@@ -112,6 +292,35 @@ void del_search_space(alloc_data_t *list_search_space, const uint64_t start, con
   update_search_space_aux(list_search_space, start, end, NULL, NULL);
 }
 
+/*@
+  @ requires \valid(list_search_space);
+  @ requires hint == \null || \valid(hint);
+  @ ensures  \valid(\result);
+  @ assigns  \nothing;
+  @*/
+/* Return the first extent starting after offset, or list_search_space if
+ * there is none. The search space is sorted, so the walk starts from hint,
+ * an extent known to be near offset, or from the tail of the list. */
+static alloc_data_t *search_space_next(alloc_data_t *list_search_space, alloc_data_t *hint, const uint64_t offset)
+{
+  struct td_list_head *search_walker=(hint==NULL || hint==list_search_space ?
+      list_search_space->list.prev : &hint->list);
+  if(search_walker!=&list_search_space->list &&
+      td_list_entry(search_walker, alloc_data_t, list)->start > offset)
+  {
+    /*@ loop invariant \valid(search_walker); */
+    while(search_walker->prev!=&list_search_space->list &&
+	td_list_entry(search_walker->prev, alloc_data_t, list)->start > offset)
+      search_walker=search_walker->prev;
+    return td_list_entry(search_walker, alloc_data_t, list);
+  }
+  /*@ loop invariant \valid(search_walker); */
+  while(search_walker!=&list_search_space->list &&
+      td_list_entry(search_walker, alloc_data_t, list)->start <= offset)
+    search_walker=search_walker->next;
+  return td_list_entry(search_walker, alloc_data_t, list);
+}
+
 /*@
   @ requires \valid(list_search_space);
   @ requires new_current_search_space == \null || (\valid(new_current_search_space) && \valid(*new_current_search_space));
@@ -129,15 +338,16 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
 #endif
   if(start > end)
     return ;
-  /*@
-    @ loop invariant \valid(list_search_space);
-    @ loop invariant new_current_search_space == \null || (\valid(new_current_search_space) && \valid(*new_current_search_space));
-    @ loop invariant offset == \null || \valid(offset);
-    @*/
-  td_list_for_each_prev(search_walker, &list_search_space->list)
+  /* Only the last extent overlapping [start-end] needs to be updated,
+   * the recursive calls handle the remaining parts */
+  search_walker=search_space_next(list_search_space,
+      (new_current_search_space==NULL ? NULL : *new_current_search_space), end)->list.prev;
+  if(search_walker!=&list_search_space->list)
   {
     alloc_data_t *current_search_space;
     current_search_space=td_list_entry(search_walker, alloc_data_t, list);
+    if(current_search_space->end < start)
+      return ;
     /*@ assert \valid(current_search_space); */
 #ifdef DEBUG_UPDATE_SEARCH_SPACE
     log_trace("update_search_space_aux offset=%llu remove [%llu-%llu] in [%llu-%llu]\n",
@@ -160,7 +370,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
           *offset=end+1;
         }
         current_search_space->start=end+1;
-        current_search_space->file_stat=NULL;
+        search_space_set_file_stat(current_search_space, NULL);
         return ;
       }
       /* current_search_space->start==start current_search_space->end<=end */
@@ -171,8 +381,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
 	/*@ assert \valid(*new_current_search_space); */
         *offset=(*new_current_search_space)->start;
       }
-      td_list_del(search_walker);
-      free(current_search_space);
+      search_space_del(current_search_space);
       update_search_space_aux(list_search_space, pivot, end, new_current_search_space, offset);
       return ;
     }
@@ -202,8 +411,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
 	/*@ assert \valid(*new_current_search_space); */
         *offset=(*new_current_search_space)->start;
       }
-      td_list_del(search_walker);
-      free(current_search_space);
+      search_space_del(current_search_space);
       update_search_space_aux(list_search_space, start, pivot, new_current_search_space, offset);
       return ;
     }
@@ -224,7 +432,7 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
     if(current_search_space->start < start && end < current_search_space->end)
     {
       alloc_data_t *new_free_space;
-      new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+      new_free_space=alloc_data_new();
       /*@ assert \valid(new_free_space); */
       new_free_space->start=start;
       new_free_space->end=current_search_space->end;
@@ -243,10 +451,99 @@ static void update_search_space_aux(alloc_data_t *list_search_space, const uint6
   }
 }
 
+#if !defined(DISABLED_FOR_FRAMAC)
+static const char *search_mapfile=NULL;
+
+void set_search_mapfile(const char *filename)
+{
+  search_mapfile=filename;
+}
+
+/* Areas that were not read while imaging contain no data, don't search
+ * them. The mapfile is the one given with /mapfile or image.dd.map. */
+static void search_space_apply_mapfile(alloc_data_t *list_search_space, const disk_t *disk_car)
+{
+  mapfile_t map;
+  char *filename;
+  uint64_t skipped=0;
+  unsigned int i;
+  if(search_mapfile!=NULL)
+    filename=strdup(search_mapfile);
+  else
+  {
+    filename=(char *)MALLOC(strlen(disk_car->device) + 5);
+    strcpy(filename, disk_car->device);
+    strcat(filename, ".map");
+  }
+  if(filename==NULL)
+    return ;
+  if(mapfile_load(&map, filename) < 0)
+  {
+    if(search_mapfile!=NULL)
+      log_error("Can't read mapfile %s\n", filename);
+    free(filename);
+    return ;
+  }
+  for(i=0; i<map.nbr; i++)
+  {
+    const mapfile_range_t *range=&map.ranges[i];
+    if(range->status!=MAPFILE_FINISHED)
+    {
+      del_search_space(list_search_space, range->pos, range->pos + range->size - 1);
+      skipped+=range->size;
+    }
+  }
+  log_info("%s: skip %llu bytes that were not rescued\n", filename, (long long unsigned)skipped);
+  mapfile_free(&map);
+  free(filename);
+}
+
+static int search_skip_unmapped=0;
+
+void set_search_skip_unmapped(const int skip)
+{
+  search_skip_unmapped=skip;
+}
+
+struct unmapped_struct
+{
+  alloc_data_t *list_search_space;
+  uint64_t skipped;
+};
+
+static void search_space_del_unmapped(const uint64_t start, const uint64_t end, void *arg)
+{
+  struct unmapped_struct *u=(struct unmapped_struct *)arg;
+  del_search_space(u->list_search_space, start, end);
+  u->skipped+=end - start + 1;
+}
+
+/* The holes of a sparse image and the trimmed blocks of a device read
+ * as zeroes, no file can be found there */
+static void search_space_apply_unmapped(alloc_data_t *list_search_space, const disk_t *disk_car, const partition_t *partition)
+{
+  struct unmapped_struct u;
+  const disk_t *disk=diskcache_disk(disk_car);
+  uint64_t end=partition->part_offset + partition->part_size - 1;
+  if(search_skip_unmapped==0)
+    return ;
+  if(end > disk_car->disk_size - 1)
+    end=disk_car->disk_size - 1;
+  u.list_search_space=list_search_space;
+  u.skipped=0;
+  if(disk_find_unmapped(disk, partition->part_offset, end, &search_space_del_unmapped, &u) < 0)
+  {
+    log_info("%s: can't get the unmapped areas\n", disk_car->device);
+    return ;
+  }
+  log_info("%s: skip %llu bytes that are unmapped\n", disk_car->device, (long long unsigned)u.skipped);
+}
+#endif
+
 void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car, const partition_t *partition)
 {
   alloc_data_t *new_sp;
-  new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
+  new_sp=alloc_data_new();
   /*@ assert \valid(new_sp); */
   new_sp->start=partition->part_offset;
   new_sp->end=partition->part_offset+partition->part_size-1;
@@ -259,6 +556,11 @@ void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car,
   new_sp->list.prev=&new_sp->list;
   new_sp->list.next=&new_sp->list;
   td_list_add_tail(&new_sp->list, &list_search_space->list);
+#if !defined(DISABLED_FOR_FRAMAC)
+  search_space_apply_mapfile(list_search_space, disk_car);
+  search_space_apply_unmapped(list_search_space, disk_car, partition);
+  pmanifest_apply(list_search_space, disk_car);
+#endif
 }
 
 void free_list_search_space(alloc_data_t *list_search_space)
@@ -276,7 +578,7 @@ void free_list_search_space(alloc_data_t *list_search_space)
     current_search_space=td_list_entry(search_walker, alloc_data_t, list);
     /*@ assert \valid(current_search_space); */
     td_list_del(search_walker);
-    free(current_search_space);
+    alloc_data_free(current_search_space);
     /*@ assert \valid(search_walker); */
   }
 }
@@ -370,13 +672,144 @@ int get_prev_file_header(const alloc_data_t *list_search_space, alloc_data_t **c
   return -1;
 }
 
-void forget(const alloc_data_t *list_search_space, alloc_data_t *current_search_space)
+#ifndef DISABLED_FOR_FRAMAC
+/* lowmem: the extents far behind the scan cursor are moved to a
+ * temporary file, in disk order, so the memory used by the search space
+ * stays bounded; forget_restore() puts them back at the end of the pass.
+ * Otherwise, once the search space has too many extents, they are packed
+ * in memory by search_space_pack() */
+#define FORGET_HOT_NODES 10000
+#define SEARCH_SPACE_PACK_NODES 1000000
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  file_stat_t *file_stat;
+  uint64_t data;
+} forget_record_t;
+
+static TD_THREAD_LOCAL FILE *forget_handle=NULL;
+static TD_THREAD_LOCAL uint64_t forget_nbr=0;
+/* Extents in use after the last search_space_pack() */
+static TD_THREAD_LOCAL unsigned int search_space_pack_live=0;
+
+static int forget_spill(const alloc_data_t *extent, const int packed)
+{
+  forget_record_t record;
+  if(packed > 0)
+  {
+    pspace_add(extent);
+    return 0;
+  }
+  if(forget_handle==NULL)
+  {
+    forget_handle=tmpfile();
+    if(forget_handle==NULL)
+    {
+      log_error("lowmem: can't create a temporary file, %s\n", strerror(errno));
+      return -1;
+    }
+  }
+  record.start=extent->start;
+  record.end=extent->end;
+  record.file_stat=extent->file_stat;
+  record.data=extent->data;
+  if(fwrite(&record, sizeof(record), 1, forget_handle)!=1)
+  {
+    log_error("lowmem: can't save the search space, %s\n", strerror(errno));
+    return -1;
+  }
+  forget_nbr++;
+  return 0;
+}
+
+int forget_walk(void (*fnct)(const alloc_data_t *extent, void *arg), void *arg)
+{
+  uint64_t i;
+  int res=0;
+  pspace_walk(fnct, arg);
+  if(forget_nbr==0)
+    return 0;
+  if(fflush(forget_handle)!=0 || fseek(forget_handle, 0, SEEK_SET)!=0)
+    return -1;
+  for(i=0; i<forget_nbr; i++)
+  {
+    forget_record_t record;
+    alloc_data_t extent;
+    if(fread(&record, sizeof(record), 1, forget_handle)!=1)
+    {
+      log_error("lowmem: can't read the search space\n");
+      res=-1;
+      break;
+    }
+    extent.start=record.start;
+    extent.end=record.end;
+    extent.file_stat=record.file_stat;
+    extent.data=record.data;
+    fnct(&extent, arg);
+  }
+  /* Further extents are appended */
+  if(fseek(forget_handle, 0, SEEK_END)!=0)
+    res=-1;
+  return res;
+}
+
+struct forget_restore_struct
+{
+  const alloc_data_t *list_search_space;
+  struct td_list_head *next;
+};
+
+/* The extents come in disk order, so the list is walked only once */
+static void forget_restore_extent(const alloc_data_t *extent, void *arg)
+{
+  struct forget_restore_struct *restore=(struct forget_restore_struct *)arg;
+  alloc_data_t *new_extent;
+  while(restore->next!=&restore->list_search_space->list &&
+      td_list_entry(restore->next, alloc_data_t, list)->start < extent->start)
+    restore->next=restore->next->next;
+  new_extent=alloc_data_new();
+  new_extent->start=extent->start;
+  new_extent->end=extent->end;
+  new_extent->file_stat=extent->file_stat;
+  new_extent->data=extent->data;
+  td_list_add_tail(&new_extent->list, restore->next);
+}
+#endif
+
+/*@
+  @ requires \valid_read(list_search_space);
+  @ requires \valid(current_search_space);
+  @*/
+static void forget_aux(const alloc_data_t *list_search_space, alloc_data_t *current_search_space, const int packed)
 {
   struct td_list_head *search_walker = NULL;
   struct td_list_head *prev= NULL;
   int nbr=0;
   if(current_search_space==list_search_space)
     return ;
+#ifndef DISABLED_FOR_FRAMAC
+  /* Find the oldest extent kept in memory */
+  for(search_walker=&current_search_space->list;
+      search_walker!=&list_search_space->list && nbr<FORGET_HOT_NODES;
+      search_walker=search_walker->prev)
+    nbr++;
+  if(search_walker==&list_search_space->list)
+    return ;
+  /* The older ones are saved in disk order */
+  while(list_search_space->list.next!=search_walker)
+  {
+    alloc_data_t *tmp=td_list_first_entry(&list_search_space->list, alloc_data_t, list);
+    if(forget_spill(tmp, packed) < 0)
+      break;
+    td_list_del(&tmp->list);
+    alloc_data_free(tmp);
+  }
+  if(list_search_space->list.next==search_walker)
+    return ;
+  nbr=0;
+#endif
   /*@
     @ loop invariant \valid(search_walker);
     @*/
@@ -385,19 +818,60 @@ void forget(const alloc_data_t *list_search_space, alloc_data_t *current_search_
       search_walker=prev)
   {
     prev=search_walker->prev;
-    if(nbr>10000)
+    if(nbr>FORGET_HOT_NODES)
     {
       alloc_data_t *tmp;
       tmp=td_list_entry(search_walker, alloc_data_t, list);
       /*@ assert \valid(tmp); */
-      td_list_del(&tmp->list);
-      free(tmp);
+      search_space_del(tmp);
     }
     else
       nbr++;
   }
 }
 
+void forget(const alloc_data_t *list_search_space, alloc_data_t *current_search_space)
+{
+  forget_aux(list_search_space, current_search_space, 0);
+}
+
+void search_space_pack(const alloc_data_t *list_search_space, alloc_data_t *current_search_space)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  /* Only when the search space has grown since the last time */
+  if(alloc_data_pool.live < SEARCH_SPACE_PACK_NODES ||
+      alloc_data_pool.live < search_space_pack_live + FORGET_HOT_NODES)
+    return ;
+  forget_aux(list_search_space, current_search_space, 1);
+  search_space_pack_live=alloc_data_pool.live;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+void forget_restore(alloc_data_t *list_search_space)
+{
+  struct forget_restore_struct restore;
+  if(pspace_extents() > 0)
+  {
+    log_info("Search space: %llu extents packed in %llu bytes\n",
+	(long long unsigned)pspace_extents(), (long long unsigned)pspace_size());
+    restore.list_search_space=list_search_space;
+    restore.next=list_search_space->list.next;
+    pspace_walk(&forget_restore_extent, &restore);
+    pspace_free();
+  }
+  search_space_pack_live=0;
+  if(forget_handle==NULL)
+    return ;
+  restore.list_search_space=list_search_space;
+  restore.next=list_search_space->list.next;
+  forget_walk(&forget_restore_extent, &restore);
+  fclose(forget_handle);
+  forget_handle=NULL;
+  forget_nbr=0;
+}
+#endif
+
 unsigned int remove_used_space(disk_t *disk_car, const partition_t *partition, alloc_data_t *list_search_space)
 {
 #ifndef DISABLED_FOR_FRAMAC
@@ -407,6 +881,12 @@ unsigned int remove_used_space(disk_t *disk_car, const partition_t *partition, a
     return fat_remove_used_space(disk_car, partition, list_search_space);
   else if(partition->upart_type==UP_EXFAT)
     return exfat_remove_used_space(disk_car, partition, list_search_space);
+  else if(partition->upart_type==UP_HFSP || partition->upart_type==UP_HFSX)
+    return hfsp_remove_used_space(disk_car, partition, list_search_space);
+  else if(partition->upart_type==UP_XFS || partition->upart_type==UP_XFS2 ||
+      partition->upart_type==UP_XFS3 || partition->upart_type==UP_XFS4 ||
+      partition->upart_type==UP_XFS5)
+    return xfs_remove_used_space(disk_car, partition, list_search_space);
 #if defined(HAVE_LIBNTFS) || defined(HAVE_LIBNTFS3G)
   else if(partition->upart_type==UP_NTFS)
     return ntfs_remove_used_space(disk_car, partition, list_search_space);
@@ -447,6 +927,22 @@ void update_stats(file_stat_t *file_stats, alloc_data_t *list_search_space)
 #endif
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* most expensive first */
+static int sort_file_stat_profile(const void *p1, const void *p2)
+{
+  const file_stat_t *f1=(const file_stat_t *)p1;
+  const file_stat_t *f2=(const file_stat_t *)p2;
+  const uint64_t t1=f1->header_ns + f1->data_ns + f1->file_ns;
+  const uint64_t t2=f2->header_ns + f2->data_ns + f2->file_ns;
+  if(t1 < t2)
+    return 1;
+  if(t1 > t2)
+    return -1;
+  return 0;
+}
+#endif
+
 void write_stats_log(const file_stat_t *file_stats)
 {
 #ifndef DISABLED_FOR_FRAMAC
@@ -476,7 +972,31 @@ void write_stats_log(const file_stat_t *file_stats)
           new_file_stats[i].recovered, new_file_stats[i].recovered+new_file_stats[i].not_recovered);
     }
   }
+  if(file_profile > 0)
+  {
+    qsort(new_file_stats, nbr, sizeof(file_stat_t), sort_file_stat_profile);
+    log_info("Time spent per file format (header_check / data_check / file_check):\n");
+    for(i=0;i<nbr;i++)
+    {
+      const file_stat_t *file_stat=&new_file_stats[i];
+      if(file_stat->header_calls==0 && file_stat->data_ns==0 && file_stat->file_ns==0)
+	continue;
+      log_info("%s: %llu/%llu/%llu us, %llu header_check calls, %llu hits, %llu rejected by file_check\n",
+	  (file_stat->file_hint->extension!=NULL?file_stat->file_hint->extension:""),
+	  (long long unsigned)(file_stat->header_ns/1000),
+	  (long long unsigned)(file_stat->data_ns/1000),
+	  (long long unsigned)(file_stat->file_ns/1000),
+	  (long long unsigned)file_stat->header_calls,
+	  (long long unsigned)file_stat->header_hits,
+	  (long long unsigned)file_stat->false_positives);
+    }
+  }
   free(new_file_stats);
+#ifndef DISABLED_FOR_FRAMAC
+  if(file_sparse_bytes() > 0)
+    log_info("%llu zero bytes left as holes in the recovered files\n",
+	(long long unsigned)file_sparse_bytes());
+#endif
   if(file_nbr!=1)
   {
     log_info("Total: %u files found\n\n",file_nbr);
@@ -588,18 +1108,16 @@ void update_blocksize(const unsigned int blocksize, alloc_data_t *list_search_sp
       {
 	/* merge with previous block */
 	prev_search_space->end = current_search_space->end;
-	td_list_del(search_walker);
-	free(current_search_space);
+	search_space_del(current_search_space);
       }
       else
       {
 	current_search_space->start=aligned_start;
-	current_search_space->file_stat=NULL;
+	search_space_set_file_stat(current_search_space, NULL);
 	if(current_search_space->start>=current_search_space->end)
 	{
 	  /* block too small - delete it */
-	  td_list_del(search_walker);
-	  free(current_search_space);
+	  search_space_del(current_search_space);
 	}
       }
     }
@@ -613,14 +1131,156 @@ void update_blocksize(const unsigned int blocksize, alloc_data_t *list_search_sp
     if(current_search_space->start>=current_search_space->end)
     {
       /* block too small - delete it */
+      search_space_del(current_search_space);
+    }
+  }
+#endif
+}
+
+void compact_search_space(alloc_data_t *list_search_space, const unsigned int blocksize, const unsigned int sector_size)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct td_list_head *search_walker;
+  struct td_list_head *search_walker_next;
+  alloc_data_t *prev_search_space=NULL;
+  unsigned int nbr=0;
+  unsigned int merged=0;
+  unsigned int dropped=0;
+  uint64_t dropped_size=0;
+  uint64_t size=0;
+  uint64_t largest=0;
+  td_list_for_each_safe(search_walker, search_walker_next, &list_search_space->list)
+  {
+    alloc_data_t *current_search_space=td_list_entry(search_walker, alloc_data_t, list);
+    /* An extent starting with a file header found earlier is kept, the
+     * brute force and update_stats() rely on it */
+    if(prev_search_space!=NULL &&
+	prev_search_space->end + 1 == current_search_space->start &&
+	current_search_space->file_stat == NULL &&
+	prev_search_space->data == current_search_space->data)
+    {
+      prev_search_space->end=current_search_space->end;
       td_list_del(search_walker);
-      free(current_search_space);
+      alloc_data_free(current_search_space);
+      merged++;
+      continue;
+    }
+    if(prev_search_space!=NULL &&
+	prev_search_space->file_stat==NULL &&
+	prev_search_space->end - prev_search_space->start + 1 < blocksize)
+    {
+      /* block too small - delete it */
+      dropped++;
+      dropped_size+=prev_search_space->end - prev_search_space->start + 1;
+      td_list_del(&prev_search_space->list);
+      alloc_data_free(prev_search_space);
     }
+    prev_search_space=current_search_space;
   }
+  if(prev_search_space!=NULL &&
+      prev_search_space->file_stat==NULL &&
+      prev_search_space->end - prev_search_space->start + 1 < blocksize)
+  {
+    dropped++;
+    dropped_size+=prev_search_space->end - prev_search_space->start + 1;
+    td_list_del(&prev_search_space->list);
+    alloc_data_free(prev_search_space);
+  }
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    const uint64_t extent_size=current_search_space->end - current_search_space->start + 1;
+    nbr++;
+    size+=extent_size;
+    if(largest < extent_size)
+      largest=extent_size;
+  }
+  log_info("Search space: %u extents, %llu sectors, largest %llu sectors, average %llu sectors; %u merged, %u smaller than a block dropped (%llu bytes)\n",
+      nbr, (long long unsigned)(size/sector_size),
+      (long long unsigned)(largest/sector_size),
+      (long long unsigned)(nbr>0 ? size/nbr/sector_size : 0),
+      merged, dropped, (long long unsigned)dropped_size);
 #endif
 }
 
-uint64_t free_list_allocation_end=0;
+TD_THREAD_LOCAL uint64_t free_list_allocation_end=0;
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Recovered files are written one block at a time; their stream gets a
+ * large buffer so the destination receives a few big writes per file.
+ * A buffer belongs to one stream until photorec_fclose(), every open
+ * recovered file has its own. */
+#define PHOTOREC_WRITE_BUFFER_SIZE (1024*1024)
+#define PHOTOREC_WRITE_BUFFERS 32
+
+static struct
+{
+  FILE *handle;		/* NULL: the buffer is free */
+  char *buffer;
+} write_buffers[PHOTOREC_WRITE_BUFFERS];
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t write_buffers_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+
+void photorec_setvbuf(FILE *handle)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  char *buffer=NULL;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&write_buffers_mutex);
+#endif
+  /* Reuse a free buffer first */
+  for(i=0; i<PHOTOREC_WRITE_BUFFERS &&
+      (write_buffers[i].handle!=NULL || write_buffers[i].buffer==NULL); i++);
+  if(i==PHOTOREC_WRITE_BUFFERS)
+    for(i=0; i<PHOTOREC_WRITE_BUFFERS && write_buffers[i].handle!=NULL; i++);
+  if(i<PHOTOREC_WRITE_BUFFERS)
+  {
+    if(write_buffers[i].buffer==NULL)
+      write_buffers[i].buffer=(char *)MALLOC(PHOTOREC_WRITE_BUFFER_SIZE);
+    write_buffers[i].handle=handle;
+    buffer=write_buffers[i].buffer;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&write_buffers_mutex);
+#endif
+  /* Too many files open at once, keep the default buffer */
+  if(buffer!=NULL)
+    setvbuf(handle, buffer, _IOFBF, PHOTOREC_WRITE_BUFFER_SIZE);
+#endif
+}
+
+int photorec_fclose(FILE *handle)
+{
+  const int res=fclose(handle);
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  unsigned int nbr_free=0;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&write_buffers_mutex);
+#endif
+  for(i=0; i<PHOTOREC_WRITE_BUFFERS; i++)
+    if(write_buffers[i].handle==NULL && write_buffers[i].buffer!=NULL)
+      nbr_free++;
+  for(i=0; i<PHOTOREC_WRITE_BUFFERS && write_buffers[i].handle!=handle; i++);
+  if(i<PHOTOREC_WRITE_BUFFERS)
+  {
+    write_buffers[i].handle=NULL;
+    /* One free buffer is kept for the next file */
+    if(nbr_free > 0)
+    {
+      free(write_buffers[i].buffer);
+      write_buffers[i].buffer=NULL;
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&write_buffers_mutex);
+#endif
+#endif
+  return res;
+}
 
 /*@
   @ requires \valid(list_allocation);
@@ -638,11 +1298,102 @@ static void file_block_free(alloc_list_t *list_allocation)
     header_ignored_cond_reset(allocated_space->start, allocated_space->end);
     free_list_allocation_end=allocated_space->end;
     td_list_del(tmp);
-    free(allocated_space);
+    alloc_list_free(allocated_space);
   }
 #endif
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Deferred rename: set_date() and the file_rename callbacks reopen the
+ * recovered file, they are queued and run in batches instead of between
+ * two reads of the scan. */
+#define DEFERRED_RENAME_MAX 65536
+typedef struct
+{
+  char *filename;
+  time_t time;
+  void (*file_rename)(file_recovery_t *file_recovery);
+} deferred_rename_t;
+
+static int deferred_rename=0;
+static deferred_rename_t *deferred_renames=NULL;
+static unsigned int deferred_renames_nbr=0;
+
+void file_rename_set_deferred(const int enable)
+{
+  deferred_rename=enable;
+}
+
+void file_rename_deferred(void)
+{
+  file_recovery_t *file_recovery;
+  unsigned int i;
+  if(deferred_renames_nbr==0)
+    return ;
+  file_recovery=(file_recovery_t *)MALLOC(sizeof(*file_recovery));
+  reset_file_recovery(file_recovery);
+  for(i=0; i<deferred_renames_nbr; i++)
+  {
+    deferred_rename_t *entry=&deferred_renames[i];
+    strncpy(file_recovery->filename, entry->filename, sizeof(file_recovery->filename)-1);
+    file_recovery->filename[sizeof(file_recovery->filename)-1]='\0';
+    if(entry->time!=0 && entry->time!=(time_t)-1)
+      set_date(file_recovery->filename, entry->time, entry->time);
+    if(entry->file_rename!=NULL)
+      entry->file_rename(file_recovery);
+    free(entry->filename);
+  }
+  free(file_recovery);
+  deferred_renames_nbr=0;
+}
+
+static int file_rename_defer(const file_recovery_t *file_recovery)
+{
+  deferred_rename_t *entry;
+  char *filename;
+  if((file_recovery->time==0 || file_recovery->time==(time_t)-1) &&
+      file_recovery->file_rename==NULL)
+    return 0;
+  filename=strdup(file_recovery->filename);
+  if(filename==NULL)
+    return -1;
+  if(deferred_renames==NULL)
+    deferred_renames=(deferred_rename_t *)MALLOC(DEFERRED_RENAME_MAX * sizeof(deferred_rename_t));
+  entry=&deferred_renames[deferred_renames_nbr++];
+  entry->filename=filename;
+  entry->time=file_recovery->time;
+  entry->file_rename=file_recovery->file_rename;
+  if(deferred_renames_nbr==DEFERRED_RENAME_MAX)
+    file_rename_deferred();
+  return 0;
+}
+#endif
+
+#define PREALLOC_MIN (1024*1024)
+
+void file_preallocate(const file_recovery_t *file_recovery, const struct ph_param *params)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE) && !defined(DISABLED_FOR_FRAMAC)
+  const uint64_t part_end=params->partition->part_offset + params->partition->part_size;
+  uint64_t size=file_recovery->calculated_file_size;
+  if(file_recovery->handle==NULL || pstream_files()==0)
+    return ;
+  /* Only the header of a fixed size file tells the final size */
+  if(file_recovery->data_check!=&data_check_size &&
+      file_recovery->file_check!=&file_check_size)
+    return ;
+  if(file_recovery->location.start >= part_end)
+    return ;
+  if(size > part_end - file_recovery->location.start)
+    size=part_end - file_recovery->location.start;
+  if(size < PREALLOC_MIN)
+    return ;
+  /* The file size is unchanged, file_finish_aux() frees the blocks beyond
+   * the recovered size. A failure is harmless, the file grows as written */
+  fallocate(fileno(file_recovery->handle), FALLOC_FL_KEEP_SIZE, 0, size);
+#endif
+}
+
 /*@
   @ requires \valid(file_recovery);
   @ requires \valid(params);
@@ -652,19 +1403,48 @@ static void file_block_free(alloc_list_t *list_allocation)
   @ requires \separated(file_recovery, params, file_recovery->handle);
   @ decreases 0;
   @*/
-static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid)
+static void file_finish_check(file_recovery_t *file_recovery, const struct ph_param *params, const int paranoid)
 {
 #ifndef DISABLED_FOR_FRAMAC
   /*@ assert valid_file_recovery(file_recovery); */
   /*@ assert file_recovery->file_check == \null || \valid_function(file_recovery->file_check); */
+  file_write_sync(file_recovery);
   if(params->status!=STATUS_EXT2_ON_SAVE_EVERYTHING &&
       params->status!=STATUS_EXT2_OFF_SAVE_EVERYTHING &&
       file_recovery->file_stat!=NULL && file_recovery->file_check!=NULL && paranoid>0)
     { /* Check if recovered file is valid */
       /*@ assert file_recovery->file_check != \null; */
       /*@ assert \valid_function(file_recovery->file_check); */
-      file_recovery->file_check(file_recovery);
+      if(file_profile > 0)
+      {
+	file_stat_t *file_stat=file_recovery->file_stat;
+	const uint64_t start=file_profile_clock();
+	file_recovery->file_check(file_recovery);
+	file_stat->file_ns+=file_profile_clock() - start;
+	/* Brute force checks every candidate, count the header only once */
+	if(file_recovery->file_size==0 && paranoid < 2)
+	  file_stat->false_positives++;
+      }
+      else
+	file_recovery->file_check(file_recovery);
+      if(pdepth_enabled() > 0)
+	log_info("%s: %s checks\n", file_recovery->filename, pdepth_name());
     }
+#endif
+}
+
+/*@
+  @ requires \valid(file_recovery);
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid(file_recovery->handle);
+  @ requires valid_file_recovery(file_recovery);
+  @ requires \separated(file_recovery, params, file_recovery->handle);
+  @ decreases 0;
+  @*/
+static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid)
+{
+#ifndef DISABLED_FOR_FRAMAC
   /* FIXME: need to adapt read_size to volume size to avoid this */
   if(file_recovery->file_size > params->disk->disk_size)
     file_recovery->file_size = params->disk->disk_size;
@@ -685,11 +1465,35 @@ static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *par
   {
     if(paranoid==2)
       return ;
-    fclose(file_recovery->handle);
+    photorec_fclose(file_recovery->handle);
     file_recovery->handle=NULL;
+    file_tail_close(file_recovery);
     /* File is zero-length; erase it */
     /*@ assert valid_read_string((const char *)file_recovery->filename); */
+    if(pstream_files()>0)
+      unlink(file_recovery->filename);
+    return;
+  }
+  if(fflush(file_recovery->handle)!=0)
+  {
+    /* The end of the file is still in the write buffer */
+    log_critical("Cannot write to file %s: %s\n", file_recovery->filename, strerror(errno));
+    pdest_full(params, file_recovery->filename);
+    photorec_fclose(file_recovery->handle);
+    file_recovery->handle=NULL;
+    file_tail_close(file_recovery);
     unlink(file_recovery->filename);
+    file_recovery->file_size=0;
+    return;
+  }
+  if(phash_file_finish(file_recovery)>0)
+  {
+    /* Known file or identical to a file already recovered */
+    photorec_fclose(file_recovery->handle);
+    file_recovery->handle=NULL;
+    file_tail_close(file_recovery);
+    if(pstream_files()>0)
+      unlink(file_recovery->filename);
     return;
   }
 #if defined(HAVE_FTRUNCATE)
@@ -699,17 +1503,28 @@ static void file_finish_aux(file_recovery_t *file_recovery, struct ph_param *par
     log_critical("ftruncate failed.\n");
   }
 #endif
-  fclose(file_recovery->handle);
+  photorec_fclose(file_recovery->handle);
   file_recovery->handle=NULL;
-  if(file_recovery->time!=0 && file_recovery->time!=(time_t)-1)
-    set_date(file_recovery->filename, file_recovery->time, file_recovery->time);
-  /*@ assert valid_file_recovery(file_recovery); */
-  if(file_recovery->file_rename!=NULL)
+  file_tail_close(file_recovery);
+  /* The pack needs the final name and date */
+  if(pstream_files()==0)
   {
-    /*@ assert file_recovery->file_rename != \null; */
-    /*@ assert \valid_function(file_recovery->file_rename); */
-    file_recovery->file_rename(file_recovery);
+    /* Nothing left on disk to date or rename */
   }
+  else if(deferred_rename==0 || ppack_enabled()>0 ||
+      file_rename_defer(file_recovery)<0)
+  {
+    if(file_recovery->time!=0 && file_recovery->time!=(time_t)-1)
+      set_date(file_recovery->filename, file_recovery->time, file_recovery->time);
+    /*@ assert valid_file_recovery(file_recovery); */
+    if(file_recovery->file_rename!=NULL)
+    {
+      /*@ assert file_recovery->file_rename != \null; */
+      /*@ assert \valid_function(file_recovery->file_rename); */
+      file_recovery->file_rename(file_recovery);
+    }
+  }
+  phash_file_recovered(file_recovery);
   if((++params->file_nbr)%MAX_FILES_PER_DIR==0)
   {
     params->dir_num=photorec_mkdir(params->recup_dir, params->dir_num+1);
@@ -738,15 +1553,21 @@ int file_finish_bf(file_recovery_t *file_recovery, struct ph_param *params,
   if(file_recovery->file_stat==NULL)
     return 0;
   if(file_recovery->handle)
+  {
+    file_finish_check(file_recovery, params, 2);
     file_finish_aux(file_recovery, params, 2);
+  }
   if(file_recovery->file_size==0)
   {
     if(file_recovery->offset_error!=0)
       return -1;
+#ifndef DISABLED_FOR_FRAMAC
+    pstream_file_finished(file_recovery, PFSTATUS_BAD);
+#endif
     file_block_truncate_zero(file_recovery, list_search_space);
     if(file_recovery->handle!=NULL)
     {
-      fclose(file_recovery->handle);
+      photorec_fclose(file_recovery->handle);
       unlink(file_recovery->filename);
     }
     reset_file_recovery(file_recovery);
@@ -756,6 +1577,12 @@ int file_finish_bf(file_recovery_t *file_recovery, struct ph_param *params,
   file_block_log(file_recovery, params->disk->sector_size);
 #ifdef ENABLE_DFXML
   xml_log_file_recovered(file_recovery);
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+  pblockmap_file(file_recovery);
+  pstream_file_finished(file_recovery, PFSTATUS_OK);
+  if(phash_removed(file_recovery)==0)
+    ppack_add(file_recovery, params);
 #endif
   file_block_free(&file_recovery->location);
   return 1;
@@ -768,25 +1595,47 @@ void file_recovery_aborted(file_recovery_t *file_recovery, struct ph_param *para
   params->offset=file_recovery->location.start;
   if(file_recovery->handle)
   {
-    fclose(file_recovery->handle);
+    photorec_fclose(file_recovery->handle);
     file_recovery->handle=NULL;
+#ifndef DISABLED_FOR_FRAMAC
+    file_tail_reset(NULL);
+#endif
     /*@ assert valid_file_recovery(file_recovery); */
     /* File is zero-length; erase it */
-    unlink(file_recovery->filename);
+#ifndef DISABLED_FOR_FRAMAC
+    if(pstream_files()>0)
+#endif
+      unlink(file_recovery->filename);
   }
+#ifndef DISABLED_FOR_FRAMAC
+  pstream_file_finished(file_recovery, PFSTATUS_BAD);
+#endif
   file_block_truncate_zero(file_recovery, list_search_space);
   reset_file_recovery(file_recovery);
 }
 
 pfstatus_t file_finish2(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid, alloc_data_t *list_search_space)
+{
+  if(file_recovery->file_stat==NULL)
+    return PFSTATUS_BAD;
+  if(file_recovery->handle)
+    file_finish_check(file_recovery, params, (paranoid==0?0:1));
+  return file_finish_checked(file_recovery, params, list_search_space);
+}
+
+pfstatus_t file_finish_checked(file_recovery_t *file_recovery, struct ph_param *params, alloc_data_t *list_search_space)
 {
   int file_truncated;
   if(file_recovery->file_stat==NULL)
     return PFSTATUS_BAD;
   if(file_recovery->handle)
-    file_finish_aux(file_recovery, params, (paranoid==0?0:1));
+    file_finish_aux(file_recovery, params, 1);
+  PHOTOREC_PROBE2(file_finish, file_recovery->filename, file_recovery->file_size);
   if(file_recovery->file_size==0)
   {
+#ifndef DISABLED_FOR_FRAMAC
+    pstream_file_finished(file_recovery, PFSTATUS_BAD);
+#endif
     file_block_truncate_zero(file_recovery, list_search_space);
     reset_file_recovery(file_recovery);
     return PFSTATUS_BAD;
@@ -795,6 +1644,12 @@ pfstatus_t file_finish2(file_recovery_t *file_recovery, struct ph_param *params,
   file_block_log(file_recovery, params->disk->sector_size);
 #ifdef ENABLE_DFXML
   xml_log_file_recovered(file_recovery);
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+  pblockmap_file(file_recovery);
+  pstream_file_finished(file_recovery, (file_truncated>0?PFSTATUS_OK_TRUNCATED:PFSTATUS_OK));
+  if(phash_removed(file_recovery)==0)
+    ppack_add(file_recovery, params);
 #endif
   file_block_free(&file_recovery->location);
   reset_file_recovery(file_recovery);
@@ -813,10 +1668,7 @@ void info_list_search_space(const alloc_data_t *list_search_space, const alloc_d
     tmp=td_list_entry(search_walker, alloc_data_t, list);
     /*@ assert \valid(tmp); */
     if(tmp->file_stat!=NULL)
-    {
       nbr_headers++;
-      tmp->file_stat->not_recovered++;
-    }
     sectors_with_unknown_data+=(tmp->end-tmp->start+sector_size-1)/sector_size;
     if(verbose>0)
     {
@@ -846,25 +1698,34 @@ void free_search_space(alloc_data_t *list_search_space)
     current_search_space=td_list_entry(search_walker, alloc_data_t, list);
     /*@ assert \valid(current_search_space); */
     td_list_del(search_walker);
-    free(current_search_space);
+    alloc_data_free(current_search_space);
   }
+#ifndef DISABLED_FOR_FRAMAC
+  node_pool_release(&alloc_data_pool, "search space");
+  node_pool_release(&alloc_list_pool, "file blocks");
+#endif
 }
 
 void set_filename(file_recovery_t *file_recovery, struct ph_param *params)
 {
   const int broken=(params->status==STATUS_EXT2_ON_SAVE_EVERYTHING ||
       params->status==STATUS_EXT2_OFF_SAVE_EVERYTHING);
+#ifndef DISABLED_FOR_FRAMAC
+  const char *recup_dir=pdest_select(params);
+#else
+  const char *recup_dir=params->recup_dir;
+#endif
   if(file_recovery->extension==NULL || file_recovery->extension[0]=='\0')
   {
     snprintf(file_recovery->filename,sizeof(file_recovery->filename)-1,
-	"%s.%u/%c%07lu", params->recup_dir,
+	"%s.%u/%c%07lu", recup_dir,
 	params->dir_num, (broken?'b':'f'),
 	(unsigned long int)((file_recovery->location.start - params->partition->part_offset)/ params->disk->sector_size));
   }
   else
   {
     snprintf(file_recovery->filename,sizeof(file_recovery->filename)-1,
-	"%s.%u/%c%07lu.%s", params->recup_dir,
+	"%s.%u/%c%07lu.%s", recup_dir,
 	params->dir_num, (broken?'b':'f'),
 	(unsigned long int)((file_recovery->location.start - params->partition->part_offset) / params->disk->sector_size), file_recovery->extension);
   }
@@ -879,6 +1740,39 @@ void set_filename(file_recovery_t *file_recovery, struct ph_param *params)
 static void set_search_start_aux(alloc_data_t **new_current_search_space, alloc_data_t *list_search_space, const uint64_t offset)
 {
   struct td_list_head *search_walker = NULL;
+  if(td_list_empty(&list_search_space->list))
+  {
+    *new_current_search_space=list_search_space;
+    return;
+  }
+  /* The search space is sorted: a resumed session usually stops in its
+   * second half, walk from the end */
+  if(offset >= td_list_first_entry(&list_search_space->list, alloc_data_t, list)->start &&
+      offset - td_list_first_entry(&list_search_space->list, alloc_data_t, list)->start >
+      td_list_last_entry(&list_search_space->list, alloc_data_t, list)->end - offset &&
+      offset <= td_list_last_entry(&list_search_space->list, alloc_data_t, list)->end)
+  {
+    /*@
+      @ loop invariant \valid(list_search_space);
+      @ loop invariant \valid(search_walker);
+      @ loop assigns search_walker, *new_current_search_space;
+      @*/
+    td_list_for_each_prev(search_walker, &list_search_space->list)
+    {
+      alloc_data_t *current_search_space;
+      current_search_space=td_list_entry(search_walker, alloc_data_t, list);
+      if(current_search_space->end < offset)
+	break;
+      if(current_search_space->start<=offset)
+      {
+	*new_current_search_space=current_search_space;
+	return;
+      }
+    }
+    search_walker=list_search_space->list.next;
+    *new_current_search_space=td_list_entry(search_walker, alloc_data_t, list);
+    return;
+  }
   /*@
     @ loop invariant \valid(list_search_space);
     @ loop invariant \valid(search_walker);
@@ -940,12 +1834,14 @@ uint64_t set_search_start(struct ph_param *params, alloc_data_t **new_current_se
   @ assigns params->real_start_time;
   @ assigns params->dir_num;
   @ assigns params->offset;
+  @ assigns params->offset_end;
   @ assigns params->blocksize;
   @ ensures  valid_ph_param(params);
   @ ensures  params->file_nbr == 0;
   @ ensures  params->status == STATUS_FIND_OFFSET;
   @ ensures  params->dir_num == 1;
   @ ensures  params->offset == PH_INVALID_OFFSET;
+  @ ensures  params->offset_end == PH_INVALID_OFFSET;
   @ ensures  params->blocksize > 0;
   @ ensures  valid_read_string(params->recup_dir);
   @*/
@@ -956,6 +1852,7 @@ static void params_reset_aux(struct ph_param *params)
   params->real_start_time=time(NULL);
   params->dir_num=1;
   params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
   if(params->blocksize==0)
     params->blocksize=params->disk->sector_size;
   /*@ assert params->blocksize > 0; */
@@ -972,6 +1869,11 @@ void params_reset(struct ph_param *params, const struct ph_options *options)
   params->file_stats=init_file_stats(options->list_file_format);
   /*@ assert valid_ph_param(params); */
   params_reset_aux(params);
+#ifndef DISABLED_FOR_FRAMAC
+  /* A stream is read once, no pass to find the block size */
+  if(disk_is_pipe(params->disk))
+    params->status=(options->mode_ext2>0?STATUS_EXT2_ON:STATUS_EXT2_OFF);
+#endif
 }
 
 const char *status_to_name(const photorec_status_t status)
@@ -1003,6 +1905,21 @@ const char *status_to_name(const photorec_status_t status)
 void status_inc(struct ph_param *params, const struct ph_options *options)
 {
   params->offset=PH_INVALID_OFFSET;
+#ifndef DISABLED_FOR_FRAMAC
+  /* A stream is scanned in a single pass */
+  if(disk_is_pipe(params->disk))
+  {
+    if(params->status==STATUS_UNFORMAT || params->status==STATUS_FIND_OFFSET)
+    {
+      params->status=(options->mode_ext2>0?STATUS_EXT2_ON:STATUS_EXT2_OFF);
+      params->file_nbr=0;
+    }
+    else
+      params->status=STATUS_QUIT;
+    PHOTOREC_PROBE2(phase, params->pass, params->status);
+    return ;
+  }
+#endif
   switch(params->status)
   {
     case STATUS_UNFORMAT:
@@ -1044,6 +1961,7 @@ void status_inc(struct ph_param *params, const struct ph_options *options)
       params->status=STATUS_QUIT;
       break;
   }
+  PHOTOREC_PROBE2(phase, params->pass, params->status);
 }
 
 list_part_t *init_list_part(disk_t *disk, const struct ph_options *options)
@@ -1077,14 +1995,13 @@ static inline void file_block_remove_from_sp_aux(alloc_data_t *tmp, alloc_data_t
   {
     tmp->start+=blocksize;
     *offset += blocksize;
-    tmp->file_stat=NULL;
+    search_space_set_file_stat(tmp, NULL);
     if(tmp->start <= tmp->end)
       return ;
     *new_current_search_space=td_list_next_entry(tmp, list);
     /*@ assert \valid(*new_current_search_space); */
     *offset=(*new_current_search_space)->start;
-    td_list_del(&tmp->list);
-    free(tmp);
+    search_space_del(tmp);
     return ;
   }
   if(*offset + blocksize == tmp->end + 1)
@@ -1096,7 +2013,7 @@ static inline void file_block_remove_from_sp_aux(alloc_data_t *tmp, alloc_data_t
   }
   {
     alloc_data_t *new_sp;
-    new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
+    new_sp=alloc_data_new();
     /*@ assert \valid(new_sp); */
     new_sp->start=*offset + blocksize;
     new_sp->end=tmp->end;
@@ -1166,7 +2083,7 @@ static inline void file_block_add_to_file(alloc_list_t *list, const uint64_t off
     }
   }
   {
-    alloc_list_t *new_list=(alloc_list_t *)MALLOC(sizeof(*new_list));
+    alloc_list_t *new_list=alloc_list_new();
     /*@ assert \valid(new_list); */
     new_list->start=offset;
     new_list->end=offset+blocksize-1;
@@ -1184,55 +2101,42 @@ void file_block_append(file_recovery_t *file_recovery, alloc_data_t *list_search
 
 /*@
   @ requires \valid(list_search_space);
+  @ requires hint == \null || \valid(hint);
   @*/
-static void file_block_truncate_aux(const uint64_t start, const uint64_t end, alloc_data_t *list_search_space)
+static alloc_data_t *file_block_truncate_aux(const uint64_t start, const uint64_t end, alloc_data_t *list_search_space, alloc_data_t *hint)
 {
-  struct td_list_head *search_walker = NULL;
+  alloc_data_t *next;
+  alloc_data_t *new_sp;
   if(start >= end)
-    return ;
+    return hint;
 #ifndef DISABLED_FOR_FRAMAC
-  td_list_for_each(search_walker, &list_search_space->list)
+  next=search_space_next(list_search_space, hint, end);
+  if(next->list.prev!=&list_search_space->list)
   {
-    alloc_data_t *tmp;
-    tmp=td_list_entry(search_walker, alloc_data_t, list);
-    /*@ assert \valid(tmp); */
-    if(tmp->start == end + 1 && tmp->file_stat==NULL)
-    {
-      tmp->start=start;
-      return;
-    }
-    if(tmp->end + 1 == start)
+    alloc_data_t *prev=td_list_entry(next->list.prev, alloc_data_t, list);
+    if(prev->end + 1 == start)
     {
-      tmp->end=end;
-      return;
-    }
-    if(end < tmp->start)
-    {
-      alloc_data_t *new_sp;
-      new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
-      /*@ assert \valid(new_sp); */
-      new_sp->start=start;
-      new_sp->end=end;
-      new_sp->file_stat=NULL;
-      new_sp->data=1;
-      new_sp->list.prev=&new_sp->list;
-      new_sp->list.next=&new_sp->list;
-      td_list_add(&new_sp->list, tmp->list.prev);
-      return;
+      prev->end=end;
+      return prev;
     }
   }
+  if(next!=list_search_space && next->start == end + 1 && next->file_stat==NULL)
   {
-    alloc_data_t *new_sp;
-    new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
-    /*@ assert \valid(new_sp); */
-    new_sp->start=start;
-    new_sp->end=end;
-    new_sp->file_stat=NULL;
-    new_sp->data=1;
-    new_sp->list.prev=&new_sp->list;
-    new_sp->list.next=&new_sp->list;
-    td_list_add_tail(&new_sp->list, &list_search_space->list);
+    next->start=start;
+    return next;
   }
+  new_sp=alloc_data_new();
+  /*@ assert \valid(new_sp); */
+  new_sp->start=start;
+  new_sp->end=end;
+  new_sp->file_stat=NULL;
+  new_sp->data=1;
+  new_sp->list.prev=&new_sp->list;
+  new_sp->list.next=&new_sp->list;
+  td_list_add(&new_sp->list, next->list.prev);
+  return new_sp;
+#else
+  return hint;
 #endif
 }
 
@@ -1241,50 +2145,33 @@ static void file_block_truncate_aux(const uint64_t start, const uint64_t end, al
   @ requires \valid(file_stat);
   @ requires \separated(list_search_space, file_stat);
   @*/
-static void file_block_truncate_zero_aux(const uint64_t start, const uint64_t end, alloc_data_t *list_search_space, file_stat_t *file_stat)
+static alloc_data_t *file_block_truncate_zero_aux(const uint64_t start, const uint64_t end, alloc_data_t *list_search_space, file_stat_t *file_stat)
 {
-  struct td_list_head *search_walker = NULL;
+  alloc_data_t *next;
+  alloc_data_t *new_sp;
   if(start >= end)
-    return ;
+    return NULL;
 #ifndef DISABLED_FOR_FRAMAC
-  td_list_for_each(search_walker, &list_search_space->list)
+  next=search_space_next(list_search_space, NULL, end);
+  if(next!=list_search_space && next->start == end + 1 && next->file_stat==NULL)
   {
-    alloc_data_t *tmp;
-    tmp=td_list_entry(search_walker, alloc_data_t, list);
-    /*@ assert \valid(tmp); */
-    if(tmp->start == end + 1 && tmp->file_stat==NULL)
-    {
-      tmp->start=start;
-      tmp->file_stat=file_stat;
-      return;
-    }
-    if(end < tmp->start)
-    {
-      alloc_data_t *new_sp;
-      new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
-      /*@ assert \valid(new_sp); */
-      new_sp->start=start;
-      new_sp->end=end;
-      new_sp->file_stat=file_stat;
-      new_sp->data=1;
-      new_sp->list.prev=&new_sp->list;
-      new_sp->list.next=&new_sp->list;
-      td_list_add(&new_sp->list, tmp->list.prev);
-      return;
-    }
-  }
-  {
-    alloc_data_t *new_sp;
-    new_sp=(alloc_data_t*)MALLOC(sizeof(*new_sp));
-    /*@ assert \valid(new_sp); */
-    new_sp->start=start;
-    new_sp->end=end;
-    new_sp->file_stat=file_stat;
-    new_sp->data=1;
-    new_sp->list.prev=&new_sp->list;
-    new_sp->list.next=&new_sp->list;
-    td_list_add_tail(&new_sp->list, &list_search_space->list);
+    next->start=start;
+    search_space_set_file_stat(next, file_stat);
+    return next;
   }
+  new_sp=alloc_data_new();
+  /*@ assert \valid(new_sp); */
+  new_sp->start=start;
+  new_sp->end=end;
+  new_sp->file_stat=NULL;
+  new_sp->data=1;
+  new_sp->list.prev=&new_sp->list;
+  new_sp->list.next=&new_sp->list;
+  td_list_add(&new_sp->list, next->list.prev);
+  search_space_set_file_stat(new_sp, file_stat);
+  return new_sp;
+#else
+  return NULL;
 #endif
 }
 
@@ -1293,19 +2180,22 @@ static void file_block_truncate_zero(const file_recovery_t *file_recovery, alloc
 #ifndef DISABLED_FOR_FRAMAC
   struct td_list_head *tmp;
   struct td_list_head *next;
+  alloc_data_t *hint=NULL;
   int first=1;
+  /* Fragments are sorted, the last updated extent is a good starting point
+   * to locate the next one */
   td_list_for_each_safe(tmp, next, &file_recovery->location.list)
   {
     alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
     if(first)
     {
-      file_block_truncate_zero_aux(element->start, element->end, list_search_space, file_recovery->file_stat);
+      hint=file_block_truncate_zero_aux(element->start, element->end, list_search_space, file_recovery->file_stat);
       first=0;
     }
     else
-      file_block_truncate_aux(element->start, element->end, list_search_space);
+      hint=file_block_truncate_aux(element->start, element->end, list_search_space, hint);
     td_list_del(tmp);
-    free(element);
+    alloc_list_free(element);
   }
 #endif
 }
@@ -1314,6 +2204,7 @@ static int file_block_truncate(const file_recovery_t *file_recovery, alloc_data_
 {
   struct td_list_head *tmp;
   struct td_list_head *next;
+  alloc_data_t *hint=NULL;
   uint64_t size=0;
   int file_truncated=0;
 #ifndef DISABLED_FOR_FRAMAC
@@ -1322,9 +2213,9 @@ static int file_block_truncate(const file_recovery_t *file_recovery, alloc_data_
     alloc_list_t *element=td_list_entry(tmp, alloc_list_t, list);
     if(size >= file_recovery->file_size)
     {
-      file_block_truncate_aux(element->start, element->end, list_search_space);
+      hint=file_block_truncate_aux(element->start, element->end, list_search_space, hint);
       td_list_del(tmp);
-      free(element);
+      alloc_list_free(element);
       file_truncated=1;
     }
     else if(element->data>0)
@@ -1332,7 +2223,7 @@ static int file_block_truncate(const file_recovery_t *file_recovery, alloc_data_
       if(size + element->end - element->start + 1 > file_recovery->file_size)
       {
 	const uint64_t diff=(file_recovery->file_size - size + blocksize - 1) / blocksize * blocksize;
-	file_block_truncate_aux(element->start + diff, element->end, list_search_space);
+	hint=file_block_truncate_aux(element->start + diff, element->end, list_search_space, hint);
 	element->end-=element->end - element->start + 1 - diff;
 	size=file_recovery->file_size;
       }
@@ -1370,19 +2261,10 @@ static void file_block_move(const file_recovery_t *file_recovery, alloc_data_t *
 {
 #ifndef DISABLED_FOR_FRAMAC
   const uint64_t end=file_offset_end(file_recovery);
-  struct td_list_head *tmp;
-  /*@ loop assigns tmp; */
-  td_list_for_each(tmp, &list_search_space->list)
-  {
-    alloc_data_t *element=td_list_entry(tmp, alloc_data_t, list);
-    if(element->start > end)
-    {
-      *new_current_search_space=element;
-      *offset=element->start;
-      return;
-    }
-  }
-  *new_current_search_space=list_search_space;
+  alloc_data_t *element=search_space_next(list_search_space, *new_current_search_space, end);
+  *new_current_search_space=element;
+  if(element!=list_search_space)
+    *offset=element->start;
 #endif
 }
 
@@ -1407,7 +2289,7 @@ void file_block_truncate_and_move(file_recovery_t *file_recovery, alloc_data_t *
     {
       if(fread(block_buffer, blocksize, 1, file_recovery->handle) != 1)
 	return ;
-      file_recovery->data_check(buffer, 2*blocksize, file_recovery);
+      file_data_check(buffer, 2*blocksize, file_recovery);
       if(file_recovery->data_check==NULL)
 	return ;
       memcpy(buffer, block_buffer, blocksize);
@@ -62,6 +62,7 @@ struct ph_param
   unsigned int file_nbr;
   file_stat_t *file_stats;
   uint64_t offset;
+  uint64_t offset_end;
 };
 
 /*@
@@ -117,6 +118,40 @@ void file_recovery_aborted(file_recovery_t *file_recovery, struct ph_param *para
 // ensures  valid_file_recovery(file_recovery);
 pfstatus_t file_finish2(file_recovery_t *file_recovery, struct ph_param *params, const int paranoid, alloc_data_t *list_search_space);
 
+/* Give the stream of a new recovered file its own write buffer */
+/*@
+  @ requires \valid(handle);
+  @*/
+void photorec_setvbuf(FILE *handle);
+
+/* Close a recovered file and give its write buffer back */
+/*@
+  @ requires \valid(handle);
+  @*/
+int photorec_fclose(FILE *handle);
+
+/* Same as file_finish2() once file_check has been run, see pcheck.h */
+/*@
+  @ requires \valid(file_recovery);
+  @ requires valid_file_recovery(file_recovery);
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires valid_list_search_space(list_search_space);
+  @ requires \separated(file_recovery, params, list_search_space);
+  @ requires valid_disk(params->disk);
+  @ ensures  \result == PFSTATUS_BAD || \result == PFSTATUS_OK || \result == PFSTATUS_OK_TRUNCATED;
+  @*/
+pfstatus_t file_finish_checked(file_recovery_t *file_recovery, struct ph_param *params, alloc_data_t *list_search_space);
+
+/* When enabled, file_finish2() queues set_date() and the file_rename
+ * callback of the recovered files instead of running them, the report
+ * and the log keep the names given during the scan */
+void file_rename_set_deferred(const int enable);
+
+/* Run the queued set_date() and file_rename callbacks, needed before
+ * fork() and at the end of the recovery */
+void file_rename_deferred(void);
+
 /*@
   @ requires \valid_read(file_stats);
   @*/
@@ -128,6 +163,9 @@ void write_stats_log(const file_stat_t *file_stats);
   @ requires \separated(file_stats, list_search_space);
   @*/
 //ensures  valid_list_search_space(list_search_space);
+/* Count again the not_recovered files of each format, the counters are
+ * otherwise kept up to date by search_space_set_file_stat() and
+ * search_space_del() */
 void update_stats(file_stat_t *file_stats, alloc_data_t *list_search_space);
 /*@
   @ requires \valid_read(disk_car);
@@ -151,6 +189,15 @@ unsigned int find_blocksize(const alloc_data_t *list_file, const unsigned int de
   @*/
 void update_blocksize(const unsigned int blocksize, alloc_data_t *list_search_space, const uint64_t offset);
 
+/* Merge the adjacent extents and drop the ones smaller than a block,
+ * the fragmentation of the search space is logged */
+/*@
+  @ requires blocksize > 0;
+  @ requires sector_size > 0;
+  @ requires valid_list_search_space(list_search_space);
+  @*/
+void compact_search_space(alloc_data_t *list_search_space, const unsigned int blocksize, const unsigned int sector_size);
+
 /*@
   @ requires valid_list_search_space(list_search_space);
   @ requires current_search_space==\null || valid_list_search_space(current_search_space);
@@ -158,6 +205,28 @@ void update_blocksize(const unsigned int blocksize, alloc_data_t *list_search_sp
 // ensures  current_search_space==\null || valid_list_search_space(current_search_space);
 void forget(const alloc_data_t *list_search_space, alloc_data_t *current_search_space);
 
+/* Without lowmem: once the search space has more than a million extents,
+ * pack the ones far behind the scan cursor in memory like forget() */
+/*@
+  @ requires valid_list_search_space(list_search_space);
+  @ requires current_search_space==\null || valid_list_search_space(current_search_space);
+  @*/
+void search_space_pack(const alloc_data_t *list_search_space, alloc_data_t *current_search_space);
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Call fnct for each extent moved out of memory by forget() or
+ * search_space_pack(), in disk order. Return -1 if the extents can't be
+ * read back */
+int forget_walk(void (*fnct)(const alloc_data_t *extent, void *arg), void *arg);
+
+/* Put back in the search space the extents moved out of memory by forget()
+ * or search_space_pack() */
+/*@
+  @ requires valid_list_search_space(list_search_space);
+  @*/
+void forget_restore(alloc_data_t *list_search_space);
+#endif
+
 /*@
   @ requires valid_list_search_space(list_search_space);
   @ requires \valid_read(disk_car);
@@ -169,6 +238,19 @@ void forget(const alloc_data_t *list_search_space, alloc_data_t *current_search_
   @*/
 void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car, const partition_t *partition);
 
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Skip the areas that a mapfile doesn't list as rescued, by default
+ * image.dd.map is used when it exists */
+/*@
+  @ requires filename==\null || valid_read_string(filename);
+  @*/
+void set_search_mapfile(const char *filename);
+
+/* Don't search the holes of a sparse image or the blocks that the
+ * device reports as deallocated */
+void set_search_skip_unmapped(const int skip);
+#endif
+
 /*@
   @ requires valid_disk(disk_car);
   @ requires valid_list_search_space(list_search_space);
@@ -179,6 +261,43 @@ void init_search_space(alloc_data_t *list_search_space, const disk_t *disk_car,
   @*/
 unsigned int remove_used_space(disk_t *disk_car, const partition_t *partition, alloc_data_t *list_search_space);
 
+/* Search space extents and file blocks are allocated from pools, they
+ * must be released with alloc_data_free() and alloc_list_free() */
+/*@
+  @ ensures \valid(\result);
+  @*/
+alloc_data_t *alloc_data_new(void);
+
+/*@
+  @ requires \valid(node);
+  @*/
+void alloc_data_free(alloc_data_t *node);
+
+/*@
+  @ ensures \valid(\result);
+  @*/
+alloc_list_t *alloc_list_new(void);
+
+/*@
+  @ requires \valid(node);
+  @*/
+void alloc_list_free(alloc_list_t *node);
+
+/* An extent of the search space starting with the header of a file that
+ * has not been recovered counts in the not_recovered field of its format:
+ * the file_stat of an extent in the search space is changed with
+ * search_space_set_file_stat() and the extent is removed with
+ * search_space_del(). Freeing the whole search space keeps the counters. */
+/*@
+  @ requires \valid(extent);
+  @*/
+void search_space_set_file_stat(alloc_data_t *extent, file_stat_t *file_stat);
+
+/*@
+  @ requires \valid(extent);
+  @*/
+void search_space_del(alloc_data_t *extent);
+
 /*@
   @ requires valid_list_search_space(list_search_space);
   @*/
@@ -221,6 +340,15 @@ void free_search_space(alloc_data_t *list_search_space);
 // ensures  valid_file_recovery(file_recovery);
 void set_filename(file_recovery_t *file_recovery, struct ph_param *params);
 
+/* Reserve the disk space of a file whose size is given by its header:
+ * large files are written without fragmenting the destination */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(params);
+  @ requires valid_ph_param(params);
+  @*/
+void file_preallocate(const file_recovery_t *file_recovery, const struct ph_param *params);
+
 /*@
   @ requires \valid(params);
   @ requires valid_ph_param(params);
@@ -247,6 +375,7 @@ uint64_t set_search_start(struct ph_param *params, alloc_data_t **new_current_se
   @ ensures  params->status == STATUS_FIND_OFFSET;
   @ ensures  params->dir_num == 1;
   @ ensures  params->offset == PH_INVALID_OFFSET;
+  @ ensures  params->offset_end == PH_INVALID_OFFSET;
   @ ensures  params->blocksize > 0;
   @ ensures  valid_read_string(params->recup_dir);
   @*/
@@ -295,6 +424,9 @@ void file_block_log(const file_recovery_t *file_recovery, const unsigned int sec
 // ensures  new_current_search_space==\null || (\valid(*new_current_search_space) && valid_list_search_space(*new_current_search_space));
 // ensures  valid_file_recovery(file_recovery);
 // ensures  valid_list_search_space(list_search_space);
+/* Move the block at *offset from the search space to the file.
+ * Contiguous blocks extend the last extent of the file and shrink the
+ * current search space element in place, nothing is allocated. */
 void file_block_append(file_recovery_t *file_recovery, alloc_data_t *list_search_space, alloc_data_t **new_current_search_space, uint64_t *offset, const unsigned int blocksize, const unsigned int data);
 
 /*@
@@ -0,0 +1,662 @@
+/*
+
+    File: photorec_bench.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Carving throughput benchmark built on top of libtestdisk.
+ * The sample files given on the command line are written at known sector
+ * aligned offsets in an image filled with pseudo-random data, the image is
+ * carved through the library API and the recovered files are compared with
+ * the samples. Results are printed as key=value lines, one per run.
+ * The samples can be split in fragments separated by random data or by the
+ * fragments of the other samples, to measure the brute force passes. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#include <time.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
+#include <dirent.h>
+#include "testdisk_api.h"
+
+#define BENCH_SECTOR_SIZE	512
+#define BENCH_MAX_SAMPLES	256
+#define BENCH_BUFFER_SIZE	(1024*1024)
+
+typedef struct
+{
+  const char *filename;
+  unsigned char *data;
+  uint64_t size;
+} bench_sample_t;
+
+typedef struct
+{
+  uint64_t offset;		/* first fragment */
+  unsigned int sample;
+  unsigned int fragments;
+} bench_placement_t;
+
+typedef struct
+{
+  unsigned int placed;
+  unsigned int found;
+  unsigned int exact;
+  unsigned int fragmented;	/* exact files written in several fragments */
+  unsigned int fragments_resolved;	/* gaps between the fragments of these files */
+} bench_recall_t;
+
+/* How the samples are split in the synthetic image */
+typedef struct
+{
+  unsigned int fragments;	/* maximum number of fragments of a sample */
+  unsigned int gap_max;		/* maximum gap before a fragment, in sectors */
+  unsigned int interleave;	/* samples whose fragments are interleaved */
+} bench_layout_t;
+
+typedef struct
+{
+  double cpu;
+  bench_recall_t recall;
+} bench_result_t;
+
+static bench_sample_t samples[BENCH_MAX_SAMPLES];
+static unsigned int nbr_samples=0;
+static bench_placement_t *placements=NULL;
+static unsigned int nbr_placements=0;
+
+static void display_help(void)
+{
+  printf("\nUsage: photorec_bench [options] [sample_file ...]\n"\
+      "\n" \
+      "  -d <dir>        work directory (default: photorec_bench.d)\n" \
+      "  -i <image>      benchmark an existing image instead of a synthetic one\n" \
+      "  -s <MiB>        size of the synthetic image (default: 64)\n" \
+      "  -n <copies>     copies of each sample in the synthetic image (default: 4)\n" \
+      "  -F <fragments>  split each sample in up to this number of fragments (default: 1)\n" \
+      "  -g <sectors>    maximum gap before each fragment (default: 64)\n" \
+      "  -I <samples>    interleave the fragments of this number of samples (default: 1)\n" \
+      "  -w <workers>    number of scan workers (default: 1)\n" \
+      "  -p <paranoid>   paranoid level, 2 adds the brute force pass (default: 1)\n" \
+      "  -f <ext,...>    time each file format on its own\n" \
+      "  -b              carve once more without the brute force pass and report\n" \
+      "                  the cost of the brute force passes (needs -p 2)\n" \
+      "  -k              keep the recovered files\n" \
+      "\n" \
+      "Without -i, the sample files are written at sector aligned offsets in\n" \
+      "pseudo-random data and the recall is measured against them.\n");
+}
+
+static double bench_time(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* CPU time of this process and of the workers that have exited */
+static double bench_cpu_time(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+  struct rusage self;
+  struct rusage children;
+  if(getrusage(RUSAGE_SELF, &self)==0 && getrusage(RUSAGE_CHILDREN, &children)==0)
+    return (double)(self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+	children.ru_utime.tv_sec + children.ru_stime.tv_sec) +
+      (double)(self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+	  children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1000000.0;
+#endif
+  {
+    const clock_t ticks=clock();
+    return (double)ticks / CLOCKS_PER_SEC;
+  }
+}
+
+static int sample_load(const char *filename)
+{
+  bench_sample_t *sample;
+  FILE *handle;
+  long size;
+  if(nbr_samples >= BENCH_MAX_SAMPLES)
+  {
+    fprintf(stderr, "Too many sample files\n");
+    return -1;
+  }
+  handle=fopen(filename, "rb");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't open %s\n", filename);
+    return -1;
+  }
+  if(fseek(handle, 0, SEEK_END) < 0 || (size=ftell(handle)) <= 0 ||
+      fseek(handle, 0, SEEK_SET) < 0)
+  {
+    fprintf(stderr, "Can't get the size of %s\n", filename);
+    fclose(handle);
+    return -1;
+  }
+  sample=&samples[nbr_samples];
+  sample->filename=filename;
+  sample->size=size;
+  sample->data=(unsigned char *)malloc(size);
+  if(sample->data==NULL || fread(sample->data, size, 1, handle)!=1)
+  {
+    fprintf(stderr, "Can't read %s\n", filename);
+    free(sample->data);
+    fclose(handle);
+    return -1;
+  }
+  fclose(handle);
+  nbr_samples++;
+  return 0;
+}
+
+/* xorshift64, the image content must be the same for every run */
+static uint64_t bench_random(uint64_t *state)
+{
+  uint64_t x=*state;
+  x^=x << 13;
+  x^=x >> 7;
+  x^=x << 17;
+  *state=x;
+  return x;
+}
+
+static void fill_random(unsigned char *buffer, const unsigned int size, uint64_t *state)
+{
+  unsigned int i;
+  for(i=0; i + 8 <= size; i+=8)
+  {
+    const uint64_t r=bench_random(state);
+    memcpy(&buffer[i], &r, 8);
+  }
+}
+
+/* Write random data up to end */
+static int write_gap(FILE *handle, unsigned char *buffer, uint64_t *offset, const uint64_t end, uint64_t *state)
+{
+  while(*offset < end)
+  {
+    const unsigned int len=(end - *offset < BENCH_BUFFER_SIZE ? end - *offset : BENCH_BUFFER_SIZE);
+    fill_random(buffer, len, state);
+    if(fwrite(buffer, len, 1, handle)!=1)
+      return -1;
+    *offset+=len;
+  }
+  return 0;
+}
+
+/* Fragment k of sample: the fragments are whole sectors, the last one
+ * gets the remaining bytes */
+static void sample_fragment(const bench_sample_t *sample, const unsigned int fragments, const unsigned int k, uint64_t *start, uint64_t *len)
+{
+  const uint64_t sectors=(sample->size + BENCH_SECTOR_SIZE - 1) / BENCH_SECTOR_SIZE;
+  const uint64_t frag_size=sectors / fragments * BENCH_SECTOR_SIZE;
+  *start=k * frag_size;
+  *len=(k + 1 < fragments ? frag_size : sample->size - *start);
+}
+
+/* Write the samples round-robin, each fragment starting on a sector
+ * boundary after a random gap, until the image is full or all copies are
+ * placed. The fragments of layout->interleave consecutive samples are
+ * written in turn: A1 B1 A2 B2... */
+static int image_create(const char *image, const uint64_t image_size, const unsigned int copies, const bench_layout_t *layout)
+{
+  unsigned char *buffer;
+  uint64_t state=0x9e3779b97f4a7c15ULL;
+  uint64_t offset=0;
+  unsigned int i;
+  FILE *handle;
+  placements=(bench_placement_t *)malloc((nbr_samples * copies + 1) * sizeof(bench_placement_t));
+  buffer=(unsigned char *)malloc(BENCH_BUFFER_SIZE);
+  if(placements==NULL || buffer==NULL)
+  {
+    free(buffer);
+    return -1;
+  }
+  handle=fopen(image, "wb");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't create %s\n", image);
+    free(buffer);
+    return -1;
+  }
+  for(i=0; i < nbr_samples * copies; )
+  {
+    const unsigned int group=(nbr_samples * copies - i < layout->interleave ? nbr_samples * copies - i : layout->interleave);
+    unsigned int max_fragments=0;
+    uint64_t bound=offset;
+    unsigned int m;
+    unsigned int k;
+    for(m=0; m < group; m++)
+    {
+      bench_placement_t *placement=&placements[nbr_placements + m];
+      const bench_sample_t *sample=&samples[(i + m) % nbr_samples];
+      const uint64_t sectors=(sample->size + BENCH_SECTOR_SIZE - 1) / BENCH_SECTOR_SIZE;
+      placement->sample=(i + m) % nbr_samples;
+      placement->fragments=(sectors < layout->fragments ? sectors : layout->fragments);
+      if(max_fragments < placement->fragments)
+	max_fragments=placement->fragments;
+      bound+=sectors * BENCH_SECTOR_SIZE + (uint64_t)placement->fragments * layout->gap_max * BENCH_SECTOR_SIZE;
+    }
+    if(bound > image_size)
+      break;
+    for(k=0; k < max_fragments; k++)
+    {
+      for(m=0; m < group; m++)
+      {
+	bench_placement_t *placement=&placements[nbr_placements + m];
+	const bench_sample_t *sample=&samples[placement->sample];
+	const uint64_t gap=(1 + bench_random(&state) % layout->gap_max) * BENCH_SECTOR_SIZE;
+	uint64_t start;
+	uint64_t len;
+	uint64_t end;
+	if(k >= placement->fragments)
+	  continue;
+	/* random data in the gap */
+	if(write_gap(handle, buffer, &offset, offset + gap, &state) < 0)
+	  goto write_error;
+	if(k==0)
+	  placement->offset=offset;
+	sample_fragment(sample, placement->fragments, k, &start, &len);
+	if(fwrite(sample->data + start, len, 1, handle)!=1)
+	  goto write_error;
+	offset+=len;
+	/* zeroes in the slack of the last sector */
+	end=(offset + BENCH_SECTOR_SIZE - 1) / BENCH_SECTOR_SIZE * BENCH_SECTOR_SIZE;
+	if(offset < end)
+	{
+	  memset(buffer, 0, end - offset);
+	  if(fwrite(buffer, end - offset, 1, handle)!=1)
+	    goto write_error;
+	  offset=end;
+	}
+      }
+    }
+    nbr_placements+=group;
+    i+=group;
+  }
+  if(write_gap(handle, buffer, &offset, image_size, &state) < 0)
+    goto write_error;
+  free(buffer);
+  if(fclose(handle)!=0)
+  {
+    fprintf(stderr, "Can't write %s\n", image);
+    return -1;
+  }
+  return 0;
+write_error:
+  fprintf(stderr, "Can't write %s\n", image);
+  free(buffer);
+  fclose(handle);
+  return -1;
+}
+
+/* ext==NULL matches every sample, otherwise the sample file extension */
+static int sample_match(const bench_sample_t *sample, const char *ext)
+{
+  const char *dot;
+  if(ext==NULL)
+    return 1;
+  dot=strrchr(sample->filename, '.');
+  return (dot!=NULL && strcasecmp(dot + 1, ext)==0);
+}
+
+static int file_same_content(const char *filename, const bench_sample_t *sample)
+{
+  unsigned char *buffer;
+  FILE *handle;
+  int res=0;
+  handle=fopen(filename, "rb");
+  if(handle==NULL)
+    return 0;
+  buffer=(unsigned char *)malloc(sample->size + 1);
+  if(buffer!=NULL &&
+      fread(buffer, 1, sample->size + 1, handle)==sample->size &&
+      memcmp(buffer, sample->data, sample->size)==0)
+    res=1;
+  free(buffer);
+  fclose(handle);
+  return res;
+}
+
+/* Recovered files are named f<sector>[_name].<ext>, the sector being
+ * relative to the partition, ie the whole image here. */
+static void recall_check_file(const char *dirname, const char *name, const char *ext, bench_recall_t *recall, const int keep)
+{
+  char filename[4096];
+  unsigned long long sector;
+  unsigned int i;
+  if((unsigned)snprintf(filename, sizeof(filename), "%s/%s", dirname, name) >= sizeof(filename))
+    return ;
+  if(name[0]=='f' && name[1]>='0' && name[1]<='9')
+  {
+    sector=strtoull(&name[1], NULL, 10);
+    for(i=0; i < nbr_placements; i++)
+    {
+      if(placements[i].offset / BENCH_SECTOR_SIZE == sector &&
+	  sample_match(&samples[placements[i].sample], ext))
+      {
+	recall->found++;
+	if(file_same_content(filename, &samples[placements[i].sample]))
+	{
+	  recall->exact++;
+	  if(placements[i].fragments > 1)
+	  {
+	    recall->fragmented++;
+	    recall->fragments_resolved+=placements[i].fragments - 1;
+	  }
+	}
+	break;
+      }
+    }
+  }
+  if(keep==0)
+    unlink(filename);
+}
+
+/* Walk the recup_dir.N directories of one run */
+static void recall_check(const char *run_dir, const char *ext, bench_recall_t *recall, const int keep)
+{
+  DIR *dir;
+  struct dirent *entry;
+  unsigned int i;
+  recall->placed=0;
+  for(i=0; i < nbr_placements; i++)
+    if(sample_match(&samples[placements[i].sample], ext))
+      recall->placed++;
+  recall->found=0;
+  recall->exact=0;
+  recall->fragmented=0;
+  recall->fragments_resolved=0;
+  dir=opendir(run_dir);
+  if(dir==NULL)
+    return;
+  while((entry=readdir(dir))!=NULL)
+  {
+    char dirname[4096];
+    DIR *sub;
+    struct dirent *sub_entry;
+    if(strncmp(entry->d_name, "recup_dir.", 10)!=0 ||
+	(unsigned)snprintf(dirname, sizeof(dirname), "%s/%s", run_dir, entry->d_name) >= sizeof(dirname))
+      continue;
+    sub=opendir(dirname);
+    if(sub==NULL)
+      continue;
+    while((sub_entry=readdir(sub))!=NULL)
+    {
+      if(sub_entry->d_name[0]!='.')
+	recall_check_file(dirname, sub_entry->d_name, ext, recall, keep);
+    }
+    closedir(sub);
+    if(keep==0)
+      rmdir(dirname);
+  }
+  closedir(dir);
+  if(keep==0)
+    rmdir(run_dir);
+}
+
+static void print_formats(const testdisk_cli_context_t *ctx)
+{
+  const file_stat_t *file_stat;
+  if(ctx->params.file_stats==NULL)
+    return;
+  for(file_stat=ctx->params.file_stats; file_stat->file_hint!=NULL; file_stat++)
+  {
+    if(file_stat->recovered > 0 || file_stat->not_recovered > 0)
+      printf("format ext=%s recovered=%u not_recovered=%u\n",
+	  file_stat->file_hint->extension,
+	  file_stat->recovered, file_stat->not_recovered);
+  }
+}
+
+/* Carve the image once, ext!=NULL restricts the scan to a single format */
+static int bench_run(const char *work_dir, const char *image, char *ext,
+    const unsigned int workers, const int paranoid, const int keep,
+    bench_result_t *result)
+{
+  static unsigned int run_nbr=0;
+  char run_dir[4096];
+  char recup_dir[4096];
+  char arch_none[]="none";
+  testdisk_cli_context_t *ctx;
+  bench_recall_t recall;
+  double start;
+  double elapsed;
+  double cpu_start;
+  double cpu;
+  uint64_t scanned;
+  if((unsigned)snprintf(run_dir, sizeof(run_dir), "%s/run.%u", work_dir, ++run_nbr) >= sizeof(run_dir) ||
+      (unsigned)snprintf(recup_dir, sizeof(recup_dir), "%s/recup_dir", run_dir) >= sizeof(recup_dir) ||
+      mkdir(run_dir, 0775) < 0)
+  {
+    fprintf(stderr, "Can't create %s\n", run_dir);
+    return -1;
+  }
+  ctx=init_testdisk(0, NULL, 0, NULL);
+  if(ctx==NULL)
+    return -1;
+  if(add_image(ctx, image)==NULL || change_disk(ctx, image)==NULL)
+  {
+    fprintf(stderr, "Can't open %s\n", image);
+    finish_testdisk(ctx);
+    return -1;
+  }
+  change_arch(ctx, arch_none);
+  if(ctx->list_part==NULL || change_part(ctx, ctx->list_part->part->order, 0, 0)==NULL)
+  {
+    fprintf(stderr, "No partition found in %s\n", image);
+    finish_testdisk(ctx);
+    return -1;
+  }
+  change_recup_dir(ctx, recup_dir);
+  change_options(ctx, paranoid, 0, 0, 0, 0, 0);
+  change_workers(ctx, workers);
+  /* The samples are sector aligned, don't let the block size detection
+   * pick a larger block size from the first headers found */
+  if(nbr_placements > 0)
+    change_blocksize(ctx, BENCH_SECTOR_SIZE);
+  if(ext!=NULL)
+  {
+    change_all_fileopt(ctx, 0);
+    change_fileopt(ctx, &ext, 1, NULL, 0);
+  }
+  scanned=ctx->params.partition->part_size;
+  start=bench_time();
+  cpu_start=bench_cpu_time();
+  run_testdisk(ctx);
+  elapsed=bench_time() - start;
+  cpu=bench_cpu_time() - cpu_start;
+  if(elapsed <= 0.0)
+    elapsed=0.000001;
+  if(cpu <= 0.0)
+    cpu=0.000001;
+  recall_check(run_dir, ext, &recall, keep);
+  printf("run format=%s image=%s bytes=%llu workers=%u paranoid=%d seconds=%.3f cpu_seconds=%.3f mb_s=%.2f blocks_s=%.0f files=%u files_cpu_hour=%.0f",
+      (ext!=NULL ? ext : "all"), image, (unsigned long long)scanned,
+      workers, paranoid, elapsed, cpu,
+      (double)scanned / 1024 / 1024 / elapsed,
+      (double)scanned / (ctx->params.blocksize > 0 ? ctx->params.blocksize : BENCH_SECTOR_SIZE) / elapsed,
+      ctx->params.file_nbr, (double)ctx->params.file_nbr * 3600 / cpu);
+  if(recall.placed > 0)
+    printf(" placed=%u found=%u exact=%u recall=%.3f fragmented=%u fragments_resolved=%u",
+	recall.placed, recall.found, recall.exact,
+	(double)recall.exact / recall.placed,
+	recall.fragmented, recall.fragments_resolved);
+  printf("\n");
+  print_formats(ctx);
+  finish_testdisk(ctx);
+  if(result!=NULL)
+  {
+    result->cpu=cpu;
+    result->recall=recall;
+  }
+  return 0;
+}
+
+/* Carve with and without the brute force pass, the difference is the
+ * cost of the brute force passes */
+static int bench_bf(const char *work_dir, const char *image, char *ext,
+    const unsigned int workers, const int paranoid, const int keep)
+{
+  bench_result_t with_bf;
+  bench_result_t without_bf;
+  unsigned int files;
+  unsigned int fragments;
+  double cpu;
+  if(bench_run(work_dir, image, ext, workers, 1, keep, &without_bf) < 0 ||
+      bench_run(work_dir, image, ext, workers, paranoid, keep, &with_bf) < 0)
+    return -1;
+  files=(with_bf.recall.exact > without_bf.recall.exact ?
+      with_bf.recall.exact - without_bf.recall.exact : 0);
+  fragments=(with_bf.recall.fragments_resolved > without_bf.recall.fragments_resolved ?
+      with_bf.recall.fragments_resolved - without_bf.recall.fragments_resolved : 0);
+  cpu=with_bf.cpu - without_bf.cpu;
+  if(cpu <= 0.0)
+    cpu=0.000001;
+  printf("bf format=%s workers=%u paranoid=%d cpu_seconds=%.3f files=%u fragments_resolved=%u files_cpu_hour=%.0f",
+      (ext!=NULL ? ext : "all"), workers, paranoid, cpu, files, fragments,
+      (double)files * 3600 / cpu);
+  if(fragments > 0)
+    printf(" seconds_per_fragment=%.6f", cpu / fragments);
+  printf("\n");
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *work_dir="photorec_bench.d";
+  const char *image=NULL;
+  char *formats=NULL;
+  char synthetic[4096];
+  uint64_t image_size=64;
+  unsigned int copies=4;
+  unsigned int workers=1;
+  bench_layout_t layout;
+  int paranoid=1;
+  int bf=0;
+  int keep=0;
+  int res=0;
+  int i;
+  layout.fragments=1;
+  layout.gap_max=64;
+  layout.interleave=1;
+  for(i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "-d")==0 && i+1<argc)
+      work_dir=argv[++i];
+    else if(strcmp(argv[i], "-i")==0 && i+1<argc)
+      image=argv[++i];
+    else if(strcmp(argv[i], "-s")==0 && i+1<argc)
+      image_size=strtoull(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-n")==0 && i+1<argc)
+      copies=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-F")==0 && i+1<argc)
+      layout.fragments=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-g")==0 && i+1<argc)
+      layout.gap_max=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-I")==0 && i+1<argc)
+      layout.interleave=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-w")==0 && i+1<argc)
+      workers=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-p")==0 && i+1<argc)
+      paranoid=atoi(argv[++i]);
+    else if(strcmp(argv[i], "-f")==0 && i+1<argc)
+      formats=argv[++i];
+    else if(strcmp(argv[i], "-b")==0)
+      bf=1;
+    else if(strcmp(argv[i], "-k")==0)
+      keep=1;
+    else if(strcmp(argv[i], "-h")==0 || strcmp(argv[i], "--help")==0)
+    {
+      display_help();
+      return 0;
+    }
+    else if(argv[i][0]=='-')
+    {
+      display_help();
+      return 1;
+    }
+    else if(sample_load(argv[i]) < 0)
+      return 1;
+  }
+  if((image==NULL && nbr_samples==0) || layout.fragments==0 ||
+      layout.gap_max==0 || layout.interleave==0 || (bf>0 && paranoid < 2))
+  {
+    display_help();
+    return 1;
+  }
+  if(mkdir(work_dir, 0775) < 0)
+  {
+    struct stat st;
+    if(stat(work_dir, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+      fprintf(stderr, "Can't create %s\n", work_dir);
+      return 1;
+    }
+  }
+  if(image==NULL)
+  {
+    snprintf(synthetic, sizeof(synthetic), "%s/bench.dd", work_dir);
+    if(image_create(synthetic, image_size * 1024 * 1024, copies, &layout) < 0)
+      return 1;
+    image=synthetic;
+  }
+  if(formats==NULL)
+    res=(bf>0 ? bench_bf(work_dir, image, NULL, workers, paranoid, keep) :
+	bench_run(work_dir, image, NULL, workers, paranoid, keep, NULL));
+  else
+  {
+    char *ext;
+    for(ext=strtok(formats, ","); ext!=NULL && res==0; ext=strtok(NULL, ","))
+      res=(bf>0 ? bench_bf(work_dir, image, ext, workers, paranoid, keep) :
+	  bench_run(work_dir, image, ext, workers, paranoid, keep, NULL));
+  }
+  for(i=0; (unsigned)i < nbr_samples; i++)
+    free(samples[i].data);
+  free(placements);
+  return (res < 0 ? 1 : 0);
+}
@@ -71,7 +71,7 @@ static FILE *fopen_with_retry(const char *path, const char *mode)
 static void photorec_dir_fat(const unsigned char *buffer, const unsigned int read_size, const unsigned long long sector)
 {
   file_info_t dir_list;
-  TD_INIT_LIST_HEAD(&dir_list.list);
+  init_list_file(&dir_list);
   dir_fat_aux(buffer, read_size, 0, &dir_list);
   if(!td_list_empty(&dir_list.list))
   {
@@ -115,6 +115,9 @@ static pstatus_t photorec_header_found(const file_recovery_t *file_recovery_new,
       return PSTATUS_OK;
   }
   file_recovery_cpy(file_recovery, file_recovery_new);
+#ifndef DISABLED_FOR_FRAMAC
+  file_data_extent(file_recovery, 0);
+#endif
 #ifndef __FRAMAC__
   if(options->verbose > 1)
   {
@@ -133,10 +136,22 @@ static pstatus_t photorec_header_found(const file_recovery_t *file_recovery_new,
     const unsigned int read_size=(blocksize>65536?blocksize:65536);
     photorec_dir_fat(buffer, read_size, file_recovery->location.start/params->disk->sector_size);
   }
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+  if(pfilter_match(file_recovery)==0)
+  { /* Carved to keep its blocks out of the other files, but without name
+     * or output file */
+    return PSTATUS_OK;
+  }
 #endif
   set_filename(file_recovery, params);
   if(file_recovery->file_stat->file_hint->recover==1)
   {
+#ifndef DISABLED_FOR_FRAMAC
+    if(pstream_files()==0)
+      file_recovery->handle=tmpfile();
+    else
+#endif
 #if defined(__CYGWIN__) || defined(__MINGW32__)
     file_recovery->handle=fopen_with_retry(file_recovery->filename,"w+b");
 #else
@@ -150,10 +165,117 @@ static pstatus_t photorec_header_found(const file_recovery_t *file_recovery_new,
       params->offset=offset;
       return PSTATUS_EACCES;
     }
+#ifndef __FRAMAC__
+    photorec_setvbuf(file_recovery->handle);
+    file_tail_reset(file_recovery);
+    pstream_file_start(file_recovery);
+    phash_file_start(file_recovery);
+    file_preallocate(file_recovery, params);
+    PHOTOREC_PROBE2(file_start, file_recovery->location.start, file_recovery->filename);
+#endif
   }
   return PSTATUS_OK;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/*@
+  @ requires \valid_read(check);
+  @ requires \valid_read(buffer + (0 .. check->offset + check->length - 1));
+  @ assigns \nothing;
+  @*/
+static inline int file_check_packed_match(const file_check_packed_t *check, const unsigned char *buffer)
+{
+  if(check->length <= FILE_CHECK_PREFIX)
+    return (check->length==0 || memcmp(buffer + check->offset, check->prefix, check->length)==0);
+  return (memcmp(buffer + check->offset, check->prefix, FILE_CHECK_PREFIX)==0 &&
+      memcmp(buffer + check->offset + FILE_CHECK_PREFIX,
+	(const unsigned char *)check->file_check->value + FILE_CHECK_PREFIX,
+	check->length - FILE_CHECK_PREFIX)==0);
+}
+
+/* Header matching on a block filled with a single byte value, as found
+ * in wiped or trimmed areas: only the signatures that can match such a
+ * block are kept, in the order of file_check_list. A NULL check stands
+ * for a signature list located after the block, it is tested as usual. */
+typedef struct
+{
+  const file_check_list_t *pos;
+  const file_check_t *check;
+} uniform_check_t;
+
+static TD_THREAD_LOCAL uniform_check_t *uniform_checks=NULL;
+static TD_THREAD_LOCAL unsigned int uniform_checks_nbr=0;
+static TD_THREAD_LOCAL unsigned int uniform_checks_blocksize=0;
+static TD_THREAD_LOCAL unsigned int uniform_checks_value=0;
+
+/* The signatures may change between two passes */
+static void photorec_check_header_reset(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  file_tail_free();
+#endif
+  free(uniform_checks);
+  uniform_checks=NULL;
+  uniform_checks_nbr=0;
+  uniform_checks_blocksize=0;
+}
+
+static int check_is_uniform(const file_check_t *file_check, const unsigned int value)
+{
+  const unsigned char *p=(const unsigned char *)file_check->value;
+  unsigned int i;
+  for(i=0; i<file_check->length; i++)
+    if(p[i]!=value)
+      return 0;
+  return 1;
+}
+
+static void uniform_checks_add(const file_check_list_t *pos, const file_check_t *check, unsigned int *size)
+{
+  if(uniform_checks_nbr==*size)
+  {
+    uniform_check_t *tmp;
+    *size=(*size==0 ? 16 : 2 * *size);
+    tmp=(uniform_check_t *)MALLOC(*size * sizeof(*tmp));
+    if(uniform_checks_nbr > 0)
+      memcpy(tmp, uniform_checks, uniform_checks_nbr * sizeof(*tmp));
+    free(uniform_checks);
+    uniform_checks=tmp;
+  }
+  uniform_checks[uniform_checks_nbr].pos=pos;
+  uniform_checks[uniform_checks_nbr].check=check;
+  uniform_checks_nbr++;
+}
+
+static void uniform_checks_build(const unsigned int blocksize, const unsigned int value)
+{
+  const struct td_list_head *tmpl;
+  unsigned int size=0;
+  photorec_check_header_reset();
+  uniform_checks_blocksize=blocksize;
+  uniform_checks_value=value;
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const struct td_list_head *tmp;
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    if(pos->offset >= blocksize)
+    {
+      uniform_checks_add(pos, NULL, &size);
+      continue;
+    }
+    if(!file_check_list_used(pos, value))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[value].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if(file_check->offset + file_check->length > blocksize ||
+	  check_is_uniform(file_check, value))
+	uniform_checks_add(pos, file_check, &size);
+    }
+  }
+}
+#endif
+
 /*@
   @ requires \valid(file_recovery);
   @ requires valid_file_recovery(file_recovery);
@@ -170,10 +292,15 @@ static pstatus_t photorec_header_found(const file_recovery_t *file_recovery_new,
 // ensures  valid_list_search_space(list_search_space);
 inline static pstatus_t photorec_check_header(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const unsigned char *buffer, pfstatus_t *file_recovered, const uint64_t offset)
 {
+#ifdef DISABLED_FOR_FRAMAC
   const struct td_list_head *tmpl;
+#endif
   const unsigned int blocksize=params->blocksize;
   const unsigned int read_size=(blocksize>65536?blocksize:65536);
   file_recovery_t file_recovery_new;
+#ifndef DISABLED_FOR_FRAMAC
+  int record;
+#endif
   /*@ assert valid_file_recovery(file_recovery); */
   file_recovery_new.blocksize=blocksize;
   file_recovery_new.location.start=offset;
@@ -194,25 +321,140 @@ inline static pstatus_t photorec_check_header(file_recovery_t *file_recovery, st
 #endif
   file_recovery_new.file_stat=NULL;
   file_recovery_new.location.start=offset;
+#ifndef DISABLED_FOR_FRAMAC
+  switch(phits_header_check(offset, buffer, read_size, file_recovery, &file_recovery_new))
+  {
+    case 1:
+      return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+    case 0:
+      return PSTATUS_OK;
+  }
+  record=phits_record(offset, blocksize);
+  if(buffer[0]==buffer[blocksize-1] && memcmp(buffer, buffer+1, blocksize-1)==0)
+  {
+    unsigned int i;
+    if(uniform_checks_blocksize!=blocksize || uniform_checks_value!=buffer[0])
+      uniform_checks_build(blocksize, buffer[0]);
+    for(i=0; i<uniform_checks_nbr; i++)
+    {
+      const file_check_list_t *pos=uniform_checks[i].pos;
+      const struct td_list_head *tmp;
+      if(uniform_checks[i].check!=NULL)
+      {
+	const file_check_t *file_check=uniform_checks[i].check;
+	if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+	    pprune_check(file_check->file_stat, offset))
+	{
+	  const int accepted=file_header_check(file_check, buffer, read_size, 0, file_recovery, &file_recovery_new);
+	  PHOTOREC_PROBE3(header_check, offset, file_check->file_stat->file_hint->extension, accepted);
+	  if(record!=0)
+	    phits_add(offset, file_check, accepted);
+	  if(accepted!=0)
+	  {
+	    if(file_check->file_stat->pruned!=0)
+	      pprune_hit(file_check->file_stat);
+	    file_recovery_new.file_stat=file_check->file_stat;
+	    return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+	  }
+	}
+	continue;
+      }
+      if(!file_check_list_used(pos, buffer[pos->offset]))
+	continue;
+      td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
+      {
+	const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+	if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+	    pprune_check(file_check->file_stat, offset))
+	{
+	  const int accepted=file_header_check(file_check, buffer, read_size, 0, file_recovery, &file_recovery_new);
+	  PHOTOREC_PROBE3(header_check, offset, file_check->file_stat->file_hint->extension, accepted);
+	  if(record!=0)
+	    phits_add(offset, file_check, accepted);
+	  if(accepted!=0)
+	  {
+	    if(file_check->file_stat->pruned!=0)
+	      pprune_hit(file_check->file_stat);
+	    file_recovery_new.file_stat=file_check->file_stat;
+	    return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+	  }
+	}
+      }
+    }
+    return PSTATUS_OK;
+  }
+#endif
+  /* Only the start of each block is tested: for a READ_SIZE buffer of
+   * 4 KiB blocks, that's 128 bitmap lookups and a few short memcmp.
+   * Sending the buffer to a GPU would cost more than this match, most of
+   * the time is spent in the header_check and data_check callbacks. */
+#ifndef DISABLED_FOR_FRAMAC
+  {
+    unsigned int t;
+    for(t=0; t<file_check_tables_nbr; t++)
+    {
+      const file_check_table_t *table=&file_check_tables[t];
+      const unsigned int c=buffer[table->offset];
+      unsigned int i;
+      if(!file_check_list_used(table, c))
+	continue;
+      for(i=table->start[c]; i<table->start[c+1]; i++)
+      {
+	const file_check_packed_t *check=&table->checks[i];
+	if(file_check_packed_match(check, buffer) &&
+	    pprune_check(check->file_stat, offset))
+	{
+	  const file_check_t *file_check=check->file_check;
+	  const int accepted=file_header_check(file_check, buffer, read_size, 0, file_recovery, &file_recovery_new);
+	  PHOTOREC_PROBE3(header_check, offset, check->file_stat->file_hint->extension, accepted);
+	  if(record!=0)
+	    phits_add(offset, file_check, accepted);
+	  if(accepted!=0)
+	  {
+	    if(check->file_stat->pruned!=0)
+	      pprune_hit(check->file_stat);
+	    file_recovery_new.file_stat=check->file_stat;
+	    return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+	  }
+	}
+      }
+    }
+  }
+#else
   /*@ loop invariant valid_file_recovery(file_recovery); */
   td_list_for_each(tmpl, &file_check_list.list)
   {
     const struct td_list_head *tmp;
     const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
-    td_list_for_each(tmp, &pos->file_checks[buffer[pos->offset]].list)
+    const unsigned int c=buffer[pos->offset];
+    if(!file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
     {
       const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
       /*@ assert \valid_function(file_check->header_check); */
       /*@ assert valid_file_check_node(file_check); */
       if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
-	  file_check->header_check(buffer, read_size, 0, file_recovery, &file_recovery_new)!=0)
+	  pprune_check(file_check->file_stat, offset))
       {
-	file_recovery_new.file_stat=file_check->file_stat;
-	/*@ assert valid_file_recovery(&file_recovery_new); */
-	return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+	const int accepted=file_header_check(file_check, buffer, read_size, 0, file_recovery, &file_recovery_new);
+	PHOTOREC_PROBE3(header_check, offset, file_check->file_stat->file_hint->extension, accepted);
+#ifndef DISABLED_FOR_FRAMAC
+	if(record!=0)
+	  phits_add(offset, file_check, accepted);
+#endif
+	if(accepted!=0)
+	{
+	  if(file_check->file_stat->pruned!=0)
+	    pprune_hit(file_check->file_stat);
+	  file_recovery_new.file_stat=file_check->file_stat;
+	  /*@ assert valid_file_recovery(&file_recovery_new); */
+	  return photorec_header_found(&file_recovery_new, file_recovery, params, options, list_search_space, buffer, file_recovered, offset);
+	}
       }
     }
   }
+#endif
   /*@ assert valid_file_recovery(file_recovery); */
   return PSTATUS_OK;
 }
@@ -0,0 +1,557 @@
+/*
+
+    File: photorecfs.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Mount the files listed in a report.jsonl, ie. written by photorec
+ * /nowrite, as a read-only FUSE filesystem. Nothing is copied: the
+ * reads of a file are served from its byte runs on the disk, through the
+ * disk cache. The files appear in a single directory under their
+ * filename, without the recup_dir part; cp copies them out later. */
+
+#define FUSE_USE_VERSION 26
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <fuse.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "hdcache.h"
+#include "log.h"
+
+typedef struct
+{
+  uint64_t offset;		/* in the file */
+  uint64_t img_offset;		/* on the disk */
+  uint64_t len;
+} pfs_run_t;
+
+typedef struct
+{
+  char *name;
+  unsigned int order;		/* line in the report */
+  uint64_t size;
+  unsigned int nbr_runs;
+  pfs_run_t *runs;
+} pfs_file_t;
+
+static pfs_file_t *pfs_files=NULL;
+static unsigned int pfs_nbr=0;
+static char *pfs_device=NULL;
+static disk_t *pfs_disk=NULL;
+static time_t pfs_time=0;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t pfs_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void display_help(void)
+{
+  printf("\nUsage: photorecfs [/d device] report.jsonl mountpoint [FUSE options]\n"\
+      "\n"\
+      "/d device : read the files from device instead of the image_filename of the report\n"\
+      "\n"\
+      "Mount the files listed in report.jsonl, ie. by photorec /nowrite, read-only.\n"\
+      "Their content is read from the disk when they are opened, nothing is copied.\n");
+}
+
+/* The text after "key": in line, NULL if missing. An escaped key can't
+ * match, the quotes inside a JSON string are preceded by a backslash */
+static const char *json_key(const char *line, const char *key)
+{
+  const size_t len=strlen(key);
+  const char *p;
+  for(p=strchr(line, '"'); p!=NULL; p=strchr(p+1, '"'))
+  {
+    if(strncmp(p+1, key, len)==0 && p[len+1]=='"' && p[len+2]==':')
+      return p+len+3;
+  }
+  return NULL;
+}
+
+/* Decode the JSON string at p, as written by jsonl_string() */
+static char *json_string(const char *p)
+{
+  char *res;
+  unsigned int i=0;
+  if(p==NULL || *p!='"')
+    return NULL;
+  p++;
+  res=(char *)MALLOC(strlen(p)+1);
+  while(*p!='\0' && *p!='"')
+  {
+    if(*p!='\\')
+    {
+      res[i++]=*p++;
+      continue;
+    }
+    p++;
+    switch(*p)
+    {
+      case 'u':
+	if(p[1]=='\0' || p[2]=='\0' || p[3]=='\0' || p[4]=='\0')
+	{
+	  free(res);
+	  return NULL;
+	}
+	{
+	  char hex[5];
+	  unsigned long c;
+	  memcpy(hex, p+1, 4);
+	  hex[4]='\0';
+	  c=strtoul(hex, NULL, 16);
+	  res[i++]=(c < 0x80 && c > 0 ? (char)c : '_');
+	}
+	p+=5;
+	break;
+      case 'n':	res[i++]='\n'; p++; break;
+      case 't':	res[i++]='\t'; p++; break;
+      case '\0':
+	free(res);
+	return NULL;
+      default:
+	res[i++]=*p++;
+	break;
+    }
+  }
+  if(*p!='"')
+  {
+    free(res);
+    return NULL;
+  }
+  res[i]='\0';
+  return res;
+}
+
+static int json_u64(const char *line, const char *key, uint64_t *value)
+{
+  const char *p=json_key(line, key);
+  char *end;
+  if(p==NULL)
+    return -1;
+  *value=strtoull(p, &end, 10);
+  return (end==p ? -1 : 0);
+}
+
+/* Read a whole line, the byte runs of a fragmented file make it long */
+static char *read_line(FILE *handle, char **buffer, size_t *size)
+{
+  size_t len=0;
+  if(*buffer==NULL)
+  {
+    *size=4096;
+    *buffer=(char *)MALLOC(*size);
+  }
+  while(fgets(*buffer+len, *size-len, handle)!=NULL)
+  {
+    len+=strlen(*buffer+len);
+    if(len>0 && (*buffer)[len-1]=='\n')
+      return *buffer;
+    if(len+1 < *size)
+      return *buffer;
+    *size*=2;
+    *buffer=(char *)realloc(*buffer, *size);
+    if(*buffer==NULL)
+    {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return (len>0 ? *buffer : NULL);
+}
+
+static int pfs_parse_runs(pfs_file_t *file, const char *line)
+{
+  const char *p=json_key(line, "byte_runs");
+  unsigned int max=16;
+  uint64_t offset=0;
+  if(p==NULL || *p!='[')
+    return -1;
+  file->runs=(pfs_run_t *)MALLOC(max*sizeof(pfs_run_t));
+  file->nbr_runs=0;
+  p++;
+  while(*p=='{')
+  {
+    const char *end=strchr(p, '}');
+    pfs_run_t *run;
+    if(end==NULL)
+      return -1;
+    if(file->nbr_runs==max)
+    {
+      max*=2;
+      file->runs=(pfs_run_t *)realloc(file->runs, max*sizeof(pfs_run_t));
+      if(file->runs==NULL)
+      {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+      }
+    }
+    run=&file->runs[file->nbr_runs];
+    if(json_u64(p, "offset", &run->offset)<0 ||
+	json_u64(p, "img_offset", &run->img_offset)<0 ||
+	json_u64(p, "len", &run->len)<0 ||
+	run->offset!=offset || run->len==0)
+      return -1;
+    offset+=run->len;
+    file->nbr_runs++;
+    p=end+1;
+    if(*p==',')
+      p++;
+  }
+  if(*p!=']')
+    return -1;
+  /* The runs are whole blocks, the last one goes beyond the end */
+  if(offset < file->size)
+    file->size=offset;
+  return 0;
+}
+
+static int pfs_name_cmp(const void *key, const void *p)
+{
+  const pfs_file_t *file=(const pfs_file_t *)p;
+  return strcmp((const char *)key, file->name);
+}
+
+static int pfs_file_order_cmp(const void *p1, const void *p2)
+{
+  const pfs_file_t *f1=(const pfs_file_t *)p1;
+  const pfs_file_t *f2=(const pfs_file_t *)p2;
+  const int res=strcmp(f1->name, f2->name);
+  if(res!=0)
+    return res;
+  return (f1->order < f2->order ? -1 : (f1->order > f2->order ? 1 : 0));
+}
+
+static void pfs_file_free(pfs_file_t *file)
+{
+  free(file->name);
+  free(file->runs);
+  file->name=NULL;
+  file->runs=NULL;
+}
+
+static int pfs_load(const char *filename)
+{
+  FILE *handle;
+  char *buffer=NULL;
+  size_t size=0;
+  unsigned int max=1024;
+  unsigned int line_nbr=0;
+  unsigned int errors=0;
+  unsigned int duplicates=0;
+  unsigned int i;
+  struct stat st;
+  handle=fopen(filename, "r");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  if(fstat(fileno(handle), &st)==0)
+    pfs_time=st.st_mtime;
+  pfs_files=(pfs_file_t *)MALLOC(max*sizeof(pfs_file_t));
+  while(read_line(handle, &buffer, &size)!=NULL)
+  {
+    pfs_file_t *file;
+    const char *name;
+    char *filename_json;
+    line_nbr++;
+    if(json_key(buffer, "source")!=NULL)
+    {
+      if(pfs_device==NULL)
+	pfs_device=json_string(json_key(buffer, "image_filename"));
+      continue;
+    }
+    filename_json=json_string(json_key(buffer, "filename"));
+    if(filename_json==NULL)
+    {
+      errors++;
+      continue;
+    }
+    if(pfs_nbr==max)
+    {
+      max*=2;
+      pfs_files=(pfs_file_t *)realloc(pfs_files, max*sizeof(pfs_file_t));
+      if(pfs_files==NULL)
+      {
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+      }
+    }
+    file=&pfs_files[pfs_nbr];
+    name=strrchr(filename_json, '/');
+    file->name=strdup(name!=NULL ? name+1 : filename_json);
+    file->order=line_nbr;
+    file->runs=NULL;
+    free(filename_json);
+    if(file->name==NULL || file->name[0]=='\0' ||
+	json_u64(buffer, "filesize", &file->size)<0 ||
+	pfs_parse_runs(file, buffer)<0)
+    {
+      fprintf(stderr, "%s:%u: invalid file entry\n", filename, line_nbr);
+      pfs_file_free(file);
+      errors++;
+      continue;
+    }
+    pfs_nbr++;
+  }
+  free(buffer);
+  fclose(handle);
+  if(pfs_nbr==0)
+  {
+    fprintf(stderr, "No file listed in %s\n", filename);
+    return -1;
+  }
+  /* Keep the file listed first on duplicate names */
+  qsort(pfs_files, pfs_nbr, sizeof(pfs_file_t), pfs_file_order_cmp);
+  {
+    unsigned int j=0;
+    for(i=0; i<pfs_nbr; i++)
+    {
+      if(j>0 && strcmp(pfs_files[j-1].name, pfs_files[i].name)==0)
+      {
+	pfs_file_free(&pfs_files[i]);
+	duplicates++;
+      }
+      else
+	pfs_files[j++]=pfs_files[i];
+    }
+    pfs_nbr=j;
+  }
+  if(errors>0 || duplicates>0)
+    fprintf(stderr, "%s: %u invalid entries, %u duplicate names skipped\n",
+	filename, errors, duplicates);
+  return 0;
+}
+
+static const pfs_file_t *pfs_lookup(const char *path)
+{
+  if(path[0]!='/' || strchr(path+1, '/')!=NULL)
+    return NULL;
+  return (const pfs_file_t *)bsearch(path+1, pfs_files, pfs_nbr, sizeof(pfs_file_t), pfs_name_cmp);
+}
+
+static disk_t *pfs_open_disk(void)
+{
+  disk_t *disk=file_test_availability(pfs_device, 0, TESTDISK_O_RDONLY);
+  if(disk==NULL)
+    return NULL;
+  return new_diskcache(disk, TESTDISK_O_RDONLY);
+}
+
+/* Open the disk once FUSE runs in the background, the threads of the
+ * disk layers don't survive the fork */
+static void *pfs_init(struct fuse_conn_info *conn)
+{
+  pfs_disk=pfs_open_disk();
+  return NULL;
+}
+
+static void pfs_destroy(void *private_data)
+{
+  if(pfs_disk!=NULL)
+    pfs_disk->clean(pfs_disk);
+  pfs_disk=NULL;
+}
+
+static int pfs_getattr(const char *path, struct stat *st)
+{
+  const pfs_file_t *file;
+  memset(st, 0, sizeof(*st));
+  st->st_mtime=pfs_time;
+  st->st_ctime=pfs_time;
+  st->st_atime=pfs_time;
+  if(strcmp(path, "/")==0)
+  {
+    st->st_mode=S_IFDIR | 0555;
+    st->st_nlink=2;
+    return 0;
+  }
+  file=pfs_lookup(path);
+  if(file==NULL)
+    return -ENOENT;
+  st->st_mode=S_IFREG | 0444;
+  st->st_nlink=1;
+  st->st_size=file->size;
+  st->st_blocks=(file->size+511)/512;
+  return 0;
+}
+
+static int pfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    off_t offset, struct fuse_file_info *fi)
+{
+  unsigned int i;
+  if(strcmp(path, "/")!=0)
+    return -ENOENT;
+  filler(buf, ".", NULL, 0);
+  filler(buf, "..", NULL, 0);
+  for(i=0; i<pfs_nbr; i++)
+    if(filler(buf, pfs_files[i].name, NULL, 0)!=0)
+      break;
+  return 0;
+}
+
+static int pfs_open(const char *path, struct fuse_file_info *fi)
+{
+  const pfs_file_t *file=pfs_lookup(path);
+  if(file==NULL)
+    return -ENOENT;
+  if((fi->flags & O_ACCMODE)!=O_RDONLY)
+    return -EACCES;
+  fi->fh=file - pfs_files;
+  fi->keep_cache=1;
+  return 0;
+}
+
+static int pfs_read(const char *path, char *buf, size_t size, off_t offset,
+    struct fuse_file_info *fi)
+{
+  const pfs_file_t *file=&pfs_files[fi->fh];
+  unsigned int lo=0;
+  unsigned int hi;
+  size_t done=0;
+  if(pfs_disk==NULL)
+    return -EIO;
+  if(offset < 0 || (uint64_t)offset >= file->size)
+    return 0;
+  if(size > file->size - offset)
+    size=file->size - offset;
+  /* Last run starting at or before offset */
+  hi=file->nbr_runs;
+  while(hi - lo > 1)
+  {
+    const unsigned int mid=(lo+hi)/2;
+    if(file->runs[mid].offset <= (uint64_t)offset)
+      lo=mid;
+    else
+      hi=mid;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&pfs_mutex);
+#endif
+  while(done < size && lo < file->nbr_runs)
+  {
+    const pfs_run_t *run=&file->runs[lo];
+    const uint64_t skip=offset + done - run->offset;
+    const size_t len=(size - done < run->len - skip ? size - done : run->len - skip);
+    if(pfs_disk->pread(pfs_disk, buf + done, len, run->img_offset + skip)!=(int)len)
+      break;
+    done+=len;
+    lo++;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&pfs_mutex);
+#endif
+  if(done < size)
+    return -EIO;
+  return size;
+}
+
+static struct fuse_operations pfs_operations;
+static char pfs_opt[]="-o";
+static char pfs_opt_ro[]="ro";
+
+int main(int argc, char **argv)
+{
+  const char *report=NULL;
+  char **fuse_argv;
+  int fuse_argc=0;
+  int i;
+  disk_t *disk;
+  int res;
+  fuse_argv=(char **)MALLOC((argc+3)*sizeof(char *));
+  fuse_argv[fuse_argc++]=argv[0];
+  for(i=1; i<argc; i++)
+  {
+    if(report==NULL && i+1<argc && (strcmp(argv[i], "/d")==0 || strcmp(argv[i], "-d")==0))
+      pfs_device=strdup(argv[++i]);
+    else if(report==NULL && (strcmp(argv[i], "/help")==0 || strcmp(argv[i], "-help")==0 ||
+	  strcmp(argv[i], "--help")==0 || strcmp(argv[i], "-h")==0))
+    {
+      display_help();
+      free(fuse_argv);
+      return 0;
+    }
+    else if(report==NULL)
+      report=argv[i];
+    else
+      fuse_argv[fuse_argc++]=argv[i];
+  }
+  if(report==NULL || fuse_argc < 2)
+  {
+    display_help();
+    free(fuse_argv);
+    return 1;
+  }
+  if(pfs_load(report)<0)
+  {
+    free(fuse_argv);
+    return 1;
+  }
+  if(pfs_device==NULL)
+  {
+    fprintf(stderr, "%s doesn't name the disk, use /d device\n", report);
+    free(fuse_argv);
+    return 1;
+  }
+  /* Check the disk before going in the background */
+  disk=pfs_open_disk();
+  if(disk==NULL)
+  {
+    fprintf(stderr, "Can't open %s\n", pfs_device);
+    free(fuse_argv);
+    return 1;
+  }
+  disk->clean(disk);
+  fuse_argv[fuse_argc++]=pfs_opt;
+  fuse_argv[fuse_argc++]=pfs_opt_ro;
+  fuse_argv[fuse_argc]=NULL;
+  pfs_operations.init=&pfs_init;
+  pfs_operations.destroy=&pfs_destroy;
+  pfs_operations.getattr=&pfs_getattr;
+  pfs_operations.readdir=&pfs_readdir;
+  pfs_operations.open=&pfs_open;
+  pfs_operations.read=&pfs_read;
+  res=fuse_main(fuse_argc, fuse_argv, &pfs_operations, NULL);
+  for(i=0; (unsigned int)i<pfs_nbr; i++)
+    pfs_file_free(&pfs_files[i]);
+  free(pfs_files);
+  free(pfs_device);
+  free(fuse_argv);
+  return res;
+}
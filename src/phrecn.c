@@ -67,6 +67,7 @@
 #include "lang.h"
 #include "filegen.h"
 #include "photorec.h"
+#include "hdpipe.h"
 #include "sessionp.h"
 #include "phrecn.h"
 #include "log.h"
@@ -82,8 +83,15 @@
 #include "phbs.h"
 #include "file_found.h"
 #include "dfxml.h"
+#include "ppack.h"
+#include "phits.h"
+#include "pdest.h"
+#include "pblockmap.h"
 #include "poptions.h"
 #include "psearchn.h"
+#include "ppriority.h"
+#include "ptriage.h"
+#include "pinventory.h"
 
 /* #define DEBUG */
 /* #define DEBUG_BF */
@@ -186,6 +194,19 @@ static int interface_cannot_create_file(void)
 }
 #endif
 
+#ifndef DISABLED_FOR_FRAMAC
+/* CPU time used by the process, in ns */
+static uint64_t photorec_cpu_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_PROCESS_CPUTIME_ID)
+  struct timespec ts;
+  if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)==0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+}
+#endif
+
 #ifdef HAVE_NCURSES
 /*@
   @ requires valid_read_string(filename);
@@ -303,6 +324,8 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
   {
     const unsigned int old_file_nbr=params->file_nbr;
 #ifndef DISABLED_FOR_FRAMAC
+    const uint64_t pass_wall=file_profile_clock();
+    const uint64_t pass_cpu=photorec_cpu_clock();
     log_info("Pass %u (blocksize=%u) ", params->pass, params->blocksize);
     log_info("%s\n", status_to_name(params->status));
 #endif
@@ -356,11 +379,16 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
       case STATUS_EXT2_ON_BF:
       case STATUS_EXT2_OFF_BF:
 #ifndef DISABLED_FOR_FRAMAC
-	ind_stop=photorec_bf(params, options, list_search_space);
+	ind_stop=photorec_bf(params, options, list_search_space, 1);
 #endif
 	break;
       default:
-	ind_stop=photorec_aux(params, options, list_search_space);
+	if(pinventory_enabled() > 0)
+	  ind_stop=photorec_inventory(params, options, list_search_space);
+	else if(ptriage_enabled() > 0 && disk_is_pipe(params->disk)==0)
+	  ind_stop=photorec_triage(params, options, list_search_space);
+	else
+	  ind_stop=photorec_priority(params, options, list_search_space);
 	break;
     }
     session_save(list_search_space, params, options);
@@ -369,6 +397,11 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
     switch(ind_stop)
     {
       case PSTATUS_ENOSPC:
+	if(pdest_available(params)>0)
+	{
+	  /* Go on with the other destinations */
+	  break;
+	}
 	{ /* no more space */
 #ifdef HAVE_NCURSES
 	  char dst_directory[4096];
@@ -422,7 +455,11 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
       case PSTATUS_OK:
 	status_inc(params, options);
 	if(params->status==STATUS_QUIT)
-	  unlink("photorec.ses");
+	  session_remove();
+#ifndef DISABLED_FOR_FRAMAC
+	else if(params->status!=STATUS_FIND_OFFSET && params->blocksize>0)
+	  compact_search_space(list_search_space, params->blocksize, params->disk->sector_size);
+#endif
 	break;
     }
 #ifndef DISABLED_FOR_FRAMAC
@@ -432,12 +469,15 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
           (unsigned)((current_time-params->real_start_time)/60/60),
           (unsigned)((current_time-params->real_start_time)/60%60),
           (unsigned)((current_time-params->real_start_time)%60));
+      log_info("Pass %u time: %llu ms wall, %llu ms CPU\n", params->pass,
+	  (long long unsigned)((file_profile_clock() - pass_wall) / 1000000),
+	  (long long unsigned)((photorec_cpu_clock() - pass_cpu) / 1000000));
     }
-    update_stats(params->file_stats, list_search_space);
     if(params->pass>0)
     {
       log_info("Pass %u +%u file%s\n",params->pass,params->file_nbr-old_file_nbr,(params->file_nbr-old_file_nbr<=1?"":"s"));
       write_stats_log(params->file_stats);
+      pblockmap_write(params);
     }
     log_flush();
 #endif
@@ -490,7 +530,12 @@ int photorec(struct ph_param *params, const struct ph_options *options, alloc_da
 #endif
   free(params->file_stats);
   params->file_stats=NULL;
+  phits_reset();
   free_header_check();
+#ifndef DISABLED_FOR_FRAMAC
+  file_rename_deferred();
+  ppack_close();
+#endif
 #ifdef ENABLE_DFXML
   xml_shutdown();
   xml_close();
@@ -0,0 +1,643 @@
+/*
+
+    File: pindex.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pnext.h"
+#include "pindex.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+/* File layout, integers are little-endian:
+ * header, the extensions of the file formats (16-bit length + name),
+ * the scanned ranges (start, end), the candidate offsets, the candidate
+ * formats (16-bit index in the extension table), one byte per region. */
+#define PINDEX_MAGIC	"PHIDX001"
+
+extern file_check_list_t file_check_list;
+
+struct pindex_header
+{
+  char		magic[8];
+  uint32_t	blocksize;
+  uint32_t	region_size;
+  uint64_t	disk_size;
+  uint64_t	part_offset;
+  uint64_t	part_size;
+  uint32_t	formats_nbr;
+  uint32_t	reserved;
+  uint64_t	ranges_nbr;
+  uint64_t	candidates_nbr;
+  uint64_t	regions_nbr;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct pindex_region
+{
+  unsigned int blocks;
+  unsigned int zero;
+  unsigned int uniform;
+  unsigned int cls[3];
+};
+
+typedef enum { PINDEX_OFF=0, PINDEX_BUILD=1, PINDEX_USE=2 } pindex_mode_t;
+
+static char *pindex_filename=NULL;
+static pindex_mode_t pindex_mode=PINDEX_OFF;
+static unsigned int idx_blocksize=0;
+static uint64_t idx_disk_size=0;
+static uint64_t idx_part_offset=0;
+static uint64_t idx_part_size=0;
+static char **idx_formats=NULL;
+static unsigned int idx_formats_nbr=0;
+static unsigned char *idx_format_enabled=NULL;
+/* Sorted, non-overlapping [start, end) ranges of block offsets */
+static uint64_t *idx_ranges=NULL;
+static uint64_t idx_ranges_nbr=0;
+static uint64_t idx_ranges_alloc=0;
+static uint64_t *idx_cand_offset=NULL;
+static uint16_t *idx_cand_format=NULL;
+static uint64_t idx_cand_nbr=0;
+static uint64_t idx_cand_alloc=0;
+static struct pindex_region *idx_region_stats=NULL;
+static unsigned char *idx_regions=NULL;
+static uint64_t idx_regions_nbr=0;
+/* Build mode: offset following the last block recorded */
+static uint64_t idx_next_offset=0;
+static unsigned int idx_high_distinct=0;
+static uint64_t idx_skipped=0;
+
+static void pindex_free(void)
+{
+  unsigned int i;
+  for(i=0; i<idx_formats_nbr; i++)
+    free(idx_formats[i]);
+  free(idx_formats);
+  free(idx_format_enabled);
+  free(idx_ranges);
+  free(idx_cand_offset);
+  free(idx_cand_format);
+  free(idx_region_stats);
+  free(idx_regions);
+  idx_formats=NULL;
+  idx_formats_nbr=0;
+  idx_format_enabled=NULL;
+  idx_ranges=NULL;
+  idx_ranges_nbr=0;
+  idx_ranges_alloc=0;
+  idx_cand_offset=NULL;
+  idx_cand_format=NULL;
+  idx_cand_nbr=0;
+  idx_cand_alloc=0;
+  idx_region_stats=NULL;
+  idx_regions=NULL;
+  idx_regions_nbr=0;
+  idx_next_offset=0;
+  idx_skipped=0;
+  pindex_mode=PINDEX_OFF;
+}
+#endif
+
+void pindex_set(const char *filename)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pindex_free();
+  free(pindex_filename);
+  pindex_filename=(filename==NULL ? NULL : strdup(filename));
+#endif
+}
+
+int pindex_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (pindex_filename!=NULL ? 1 : 0);
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static int pindex_match(const struct ph_param *params)
+{
+  return (idx_blocksize==params->blocksize &&
+      idx_disk_size==params->disk->disk_size &&
+      idx_part_offset==params->partition->part_offset &&
+      idx_part_size==params->partition->part_size);
+}
+
+/* Every enabled file format must be in the index, the formats now
+ * disabled are ignored */
+static int pindex_set_formats(const struct ph_param *params)
+{
+  const file_stat_t *file_stat;
+  unsigned int i;
+  free(idx_format_enabled);
+  idx_format_enabled=(unsigned char *)MALLOC(idx_formats_nbr + 1);
+  memset(idx_format_enabled, 0, idx_formats_nbr + 1);
+  for(file_stat=params->file_stats; file_stat->file_hint!=NULL; file_stat++)
+  {
+    int found=0;
+    for(i=0; i<idx_formats_nbr; i++)
+    {
+      if(strcmp(idx_formats[i], file_stat->file_hint->extension)==0)
+      {
+	idx_format_enabled[i]=1;
+	found=1;
+      }
+    }
+    if(found==0)
+    {
+      log_info("Scan index: %s is not in the index\n", file_stat->file_hint->extension);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int pindex_read_u64(FILE *handle, uint64_t *array, const uint64_t nbr)
+{
+  uint64_t i;
+  if(nbr>0 && fread(array, sizeof(uint64_t), nbr, handle)!=nbr)
+    return -1;
+  for(i=0; i<nbr; i++)
+    array[i]=le64(array[i]);
+  return 0;
+}
+
+static int pindex_load(const struct ph_param *params)
+{
+  struct pindex_header hdr;
+  FILE *handle;
+  uint64_t i;
+  handle=fopen(pindex_filename, "rb");
+  if(handle==NULL)
+    return -1;
+  if(fread(&hdr, sizeof(hdr), 1, handle)!=1 ||
+      memcmp(hdr.magic, PINDEX_MAGIC, sizeof(hdr.magic))!=0 ||
+      le32(hdr.region_size)!=PINDEX_REGION_SIZE ||
+      le32(hdr.formats_nbr) > 65535)
+  {
+    log_error("Scan index: %s is not a scan index\n", pindex_filename);
+    fclose(handle);
+    return -1;
+  }
+  idx_blocksize=le32(hdr.blocksize);
+  idx_disk_size=le64(hdr.disk_size);
+  idx_part_offset=le64(hdr.part_offset);
+  idx_part_size=le64(hdr.part_size);
+  if(pindex_match(params)==0)
+  {
+    log_info("Scan index: %s has been made for another partition or blocksize\n", pindex_filename);
+    fclose(handle);
+    return -1;
+  }
+  idx_formats_nbr=le32(hdr.formats_nbr);
+  idx_ranges_nbr=le64(hdr.ranges_nbr);
+  idx_cand_nbr=le64(hdr.candidates_nbr);
+  idx_regions_nbr=le64(hdr.regions_nbr);
+  if(idx_regions_nbr != (idx_part_size + PINDEX_REGION_SIZE - 1) / PINDEX_REGION_SIZE ||
+      idx_cand_nbr > idx_part_size / idx_blocksize * 65536 ||
+      idx_ranges_nbr > idx_part_size / idx_blocksize + 1)
+  {
+    log_error("Scan index: %s is corrupted\n", pindex_filename);
+    idx_formats_nbr=0;
+    fclose(handle);
+    return -1;
+  }
+  idx_formats=(char **)MALLOC((idx_formats_nbr + 1) * sizeof(char *));
+  for(i=0; i<idx_formats_nbr; i++)
+  {
+    uint16_t len;
+    idx_formats[i]=NULL;
+    if(fread(&len, sizeof(len), 1, handle)!=1)
+      break;
+    len=le16(len);
+    idx_formats[i]=(char *)MALLOC(len + 1);
+    if(len>0 && fread(idx_formats[i], len, 1, handle)!=1)
+      break;
+    idx_formats[i][len]='\0';
+  }
+  if(i<idx_formats_nbr)
+  {
+    idx_formats_nbr=i + (idx_formats[i]!=NULL ? 1 : 0);
+    log_error("Scan index: %s is truncated\n", pindex_filename);
+    fclose(handle);
+    return -1;
+  }
+  idx_ranges_alloc=idx_ranges_nbr;
+  idx_cand_alloc=idx_cand_nbr;
+  idx_ranges=(uint64_t *)MALLOC((2 * idx_ranges_nbr + 1) * sizeof(uint64_t));
+  idx_cand_offset=(uint64_t *)MALLOC((idx_cand_nbr + 1) * sizeof(uint64_t));
+  idx_cand_format=(uint16_t *)MALLOC((idx_cand_nbr + 1) * sizeof(uint16_t));
+  idx_regions=(unsigned char *)MALLOC(idx_regions_nbr + 1);
+  if(pindex_read_u64(handle, idx_ranges, 2 * idx_ranges_nbr) < 0 ||
+      pindex_read_u64(handle, idx_cand_offset, idx_cand_nbr) < 0 ||
+      (idx_cand_nbr > 0 && fread(idx_cand_format, sizeof(uint16_t), idx_cand_nbr, handle)!=idx_cand_nbr) ||
+      (idx_regions_nbr > 0 && fread(idx_regions, 1, idx_regions_nbr, handle)!=idx_regions_nbr))
+  {
+    log_error("Scan index: %s is truncated\n", pindex_filename);
+    fclose(handle);
+    return -1;
+  }
+  fclose(handle);
+  for(i=0; i<idx_cand_nbr; i++)
+  {
+    idx_cand_format[i]=le16(idx_cand_format[i]);
+    if(idx_cand_format[i] >= idx_formats_nbr)
+    {
+      log_error("Scan index: %s is corrupted\n", pindex_filename);
+      return -1;
+    }
+  }
+  if(pindex_set_formats(params) < 0)
+    return -1;
+  return 0;
+}
+
+static void pindex_new(const struct ph_param *params)
+{
+  const file_stat_t *file_stat;
+  double not_seen=1.0;
+  unsigned int i;
+  idx_blocksize=params->blocksize;
+  idx_disk_size=params->disk->disk_size;
+  idx_part_offset=params->partition->part_offset;
+  idx_part_size=params->partition->part_size;
+  for(file_stat=params->file_stats; file_stat->file_hint!=NULL; file_stat++)
+    idx_formats_nbr++;
+  idx_formats=(char **)MALLOC((idx_formats_nbr + 1) * sizeof(char *));
+  for(i=0; i<idx_formats_nbr; i++)
+    idx_formats[i]=strdup(params->file_stats[i].file_hint->extension);
+  idx_regions_nbr=(idx_part_size + PINDEX_REGION_SIZE - 1) / PINDEX_REGION_SIZE;
+  idx_region_stats=(struct pindex_region *)MALLOC((idx_regions_nbr + 1) * sizeof(struct pindex_region));
+  memset(idx_region_stats, 0, (idx_regions_nbr + 1) * sizeof(struct pindex_region));
+  /* Distinct byte values expected in a block of random data */
+  for(i=0; i<idx_blocksize && i<65536; i++)
+    not_seen*=255.0/256.0;
+  idx_high_distinct=(unsigned int)(256.0 * (1.0 - not_seen) * 0.85);
+  pindex_mode=PINDEX_BUILD;
+}
+#endif
+
+void pindex_start(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pindex_filename==NULL)
+    return ;
+  if(pindex_mode==PINDEX_USE && pindex_match(params)!=0 && pindex_set_formats(params)==0)
+  {
+    idx_skipped=0;
+    return ;
+  }
+  pindex_free();
+  if(pindex_load(params)==0)
+  {
+    pindex_mode=PINDEX_USE;
+    log_info("Scan index: %s loaded, %llu candidates\n", pindex_filename,
+	(long long unsigned)idx_cand_nbr);
+    return ;
+  }
+  pindex_free();
+  pindex_new(params);
+  log_info("Scan index: creating %s\n", pindex_filename);
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static void pindex_add_candidate(const uint64_t offset, const unsigned int format)
+{
+  if(idx_cand_nbr > 0 && idx_cand_offset[idx_cand_nbr-1]==offset &&
+      idx_cand_format[idx_cand_nbr-1]==format)
+    return ;
+  if(idx_cand_nbr==idx_cand_alloc)
+  {
+    idx_cand_alloc=(idx_cand_alloc < 1024 ? 1024 : 2 * idx_cand_alloc);
+    idx_cand_offset=(uint64_t *)realloc(idx_cand_offset, idx_cand_alloc * sizeof(uint64_t));
+    idx_cand_format=(uint16_t *)realloc(idx_cand_format, idx_cand_alloc * sizeof(uint16_t));
+    if(idx_cand_offset==NULL || idx_cand_format==NULL)
+    {
+      log_critical("pindex_add_candidate: not enough memory\n");
+      exit(1);
+    }
+  }
+  idx_cand_offset[idx_cand_nbr]=offset;
+  idx_cand_format[idx_cand_nbr]=format;
+  idx_cand_nbr++;
+}
+
+static void pindex_add_range(const uint64_t offset, const unsigned int blocksize)
+{
+  if(idx_ranges_nbr > 0 && idx_ranges[2*idx_ranges_nbr-1]==offset)
+  {
+    idx_ranges[2*idx_ranges_nbr-1]=offset+blocksize;
+    return ;
+  }
+  if(idx_ranges_nbr==idx_ranges_alloc)
+  {
+    idx_ranges_alloc=(idx_ranges_alloc < 1024 ? 1024 : 2 * idx_ranges_alloc);
+    idx_ranges=(uint64_t *)realloc(idx_ranges, 2 * idx_ranges_alloc * sizeof(uint64_t));
+    if(idx_ranges==NULL)
+    {
+      log_critical("pindex_add_range: not enough memory\n");
+      exit(1);
+    }
+  }
+  idx_ranges[2*idx_ranges_nbr]=offset;
+  idx_ranges[2*idx_ranges_nbr+1]=offset+blocksize;
+  idx_ranges_nbr++;
+}
+
+static void pindex_add_block_class(const unsigned char *buffer, const unsigned int blocksize, const uint64_t offset)
+{
+  unsigned char seen[256];
+  unsigned int distinct=0;
+  unsigned int i;
+  struct pindex_region *region;
+  if(offset < idx_part_offset || offset - idx_part_offset >= idx_part_size)
+    return ;
+  region=&idx_region_stats[(offset - idx_part_offset) / PINDEX_REGION_SIZE];
+  region->blocks++;
+  memset(seen, 0, sizeof(seen));
+  for(i=0; i<blocksize; i++)
+  {
+    if(seen[buffer[i]]==0)
+    {
+      seen[buffer[i]]=1;
+      distinct++;
+    }
+  }
+  if(distinct==1)
+  {
+    region->uniform++;
+    if(buffer[0]==0)
+      region->zero++;
+  }
+  if(distinct >= idx_high_distinct)
+    region->cls[PINDEX_CLASS_HIGH]++;
+  else if(distinct > 64)
+    region->cls[PINDEX_CLASS_MID]++;
+  else
+    region->cls[PINDEX_CLASS_LOW]++;
+}
+#endif
+
+void pindex_scan(const struct ph_param *params, const unsigned char *buffer, const uint64_t offset)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const struct td_list_head *tmpl;
+  if(pindex_mode!=PINDEX_BUILD || offset < idx_next_offset)
+    return ;
+  pindex_add_range(offset, params->blocksize);
+  idx_next_offset=offset + params->blocksize;
+  pindex_add_block_class(buffer, params->blocksize, offset);
+  /* Same signature match as photorec_check_header(), without the
+   * header_check() that depends on the file being recovered */
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const struct td_list_head *tmp;
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    const unsigned int c=buffer[pos->offset];
+    if(!file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if(file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0)
+	pindex_add_candidate(offset, file_check->file_stat - params->file_stats);
+    }
+  }
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+/* First block at or after offset that is either not in the index or a
+ * candidate of an enabled file format */
+static uint64_t pindex_next(const uint64_t offset)
+{
+  uint64_t low=0;
+  uint64_t high=idx_ranges_nbr;
+  uint64_t range_end;
+  /* Last range starting at or before offset */
+  while(low < high)
+  {
+    const uint64_t mid=low + (high - low) / 2;
+    if(idx_ranges[2*mid] <= offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  if(low==0 || offset >= idx_ranges[2*(low-1)+1])
+    return offset;
+  range_end=idx_ranges[2*(low-1)+1];
+  low=0;
+  high=idx_cand_nbr;
+  while(low < high)
+  {
+    const uint64_t mid=low + (high - low) / 2;
+    if(idx_cand_offset[mid] < offset)
+      low=mid + 1;
+    else
+      high=mid;
+  }
+  for(; low < idx_cand_nbr && idx_cand_offset[low] < range_end; low++)
+    if(idx_format_enabled[idx_cand_format[low]]!=0)
+      return idx_cand_offset[low];
+  return range_end;
+}
+#endif
+
+void pindex_next_sector(const alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const unsigned int blocksize)
+{
+  get_next_sector(list_search_space, current_search_space, offset, blocksize);
+#ifndef DISABLED_FOR_FRAMAC
+  if(pindex_mode!=PINDEX_USE || idx_blocksize!=blocksize)
+    return ;
+  while(*current_search_space != list_search_space)
+  {
+    const uint64_t target=pindex_next(*offset);
+    if(target==*offset)
+      return ;
+    if(target <= (*current_search_space)->end)
+    {
+      /* Keep the block alignment of the search space */
+      if((target - (*current_search_space)->start) % blocksize == 0)
+      {
+	idx_skipped+=target - *offset;
+	*offset=target;
+      }
+      return ;
+    }
+    idx_skipped+=(*current_search_space)->end + 1 - *offset;
+    get_next_header(list_search_space, current_search_space, offset);
+  }
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static int pindex_write_u64(FILE *handle, const uint64_t *array, const uint64_t nbr)
+{
+  uint64_t i;
+  for(i=0; i<nbr; i++)
+  {
+    const uint64_t tmp=le64(array[i]);
+    if(fwrite(&tmp, sizeof(tmp), 1, handle)!=1)
+      return -1;
+  }
+  return 0;
+}
+
+static void pindex_regions_finish(void)
+{
+  uint64_t i;
+  uint64_t zero=0;
+  uint64_t uniform=0;
+  uint64_t high=0;
+  idx_regions=(unsigned char *)MALLOC(idx_regions_nbr + 1);
+  for(i=0; i<idx_regions_nbr; i++)
+  {
+    const struct pindex_region *region=&idx_region_stats[i];
+    unsigned char flags=0;
+    unsigned int cls=PINDEX_CLASS_LOW;
+    if(region->cls[PINDEX_CLASS_MID] > region->cls[cls])
+      cls=PINDEX_CLASS_MID;
+    if(region->cls[PINDEX_CLASS_HIGH] > region->cls[cls])
+      cls=PINDEX_CLASS_HIGH;
+    if(region->blocks > 0 && region->zero==region->blocks)
+    {
+      flags|=PINDEX_REGION_ZERO;
+      zero++;
+    }
+    if(region->blocks > 0 && region->uniform==region->blocks)
+    {
+      flags|=PINDEX_REGION_UNIFORM;
+      uniform++;
+    }
+    if(cls==PINDEX_CLASS_HIGH)
+      high++;
+    idx_regions[i]=flags | (cls<<2);
+  }
+  log_info("Scan index: %llu regions, %llu zero, %llu uniform, %llu high entropy\n",
+      (long long unsigned)idx_regions_nbr, (long long unsigned)zero,
+      (long long unsigned)uniform, (long long unsigned)high);
+}
+
+static int pindex_write(void)
+{
+  struct pindex_header hdr;
+  FILE *handle;
+  uint64_t i;
+  handle=fopen(pindex_filename, "wb");
+  if(handle==NULL)
+  {
+    log_error("Scan index: can't create %s: %s\n", pindex_filename, strerror(errno));
+    return -1;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, PINDEX_MAGIC, sizeof(hdr.magic));
+  hdr.blocksize=le32(idx_blocksize);
+  hdr.region_size=le32(PINDEX_REGION_SIZE);
+  hdr.disk_size=le64(idx_disk_size);
+  hdr.part_offset=le64(idx_part_offset);
+  hdr.part_size=le64(idx_part_size);
+  hdr.formats_nbr=le32(idx_formats_nbr);
+  hdr.ranges_nbr=le64(idx_ranges_nbr);
+  hdr.candidates_nbr=le64(idx_cand_nbr);
+  hdr.regions_nbr=le64(idx_regions_nbr);
+  if(fwrite(&hdr, sizeof(hdr), 1, handle)!=1)
+  {
+    fclose(handle);
+    return -1;
+  }
+  for(i=0; i<idx_formats_nbr; i++)
+  {
+    const uint16_t len=le16(strlen(idx_formats[i]));
+    if(fwrite(&len, sizeof(len), 1, handle)!=1 ||
+	fwrite(idx_formats[i], strlen(idx_formats[i]), 1, handle)!=1)
+    {
+      fclose(handle);
+      return -1;
+    }
+  }
+  if(pindex_write_u64(handle, idx_ranges, 2 * idx_ranges_nbr) < 0 ||
+      pindex_write_u64(handle, idx_cand_offset, idx_cand_nbr) < 0)
+  {
+    fclose(handle);
+    return -1;
+  }
+  for(i=0; i<idx_cand_nbr; i++)
+  {
+    const uint16_t tmp=le16(idx_cand_format[i]);
+    if(fwrite(&tmp, sizeof(tmp), 1, handle)!=1)
+    {
+      fclose(handle);
+      return -1;
+    }
+  }
+  if(idx_regions_nbr > 0 && fwrite(idx_regions, 1, idx_regions_nbr, handle)!=idx_regions_nbr)
+  {
+    fclose(handle);
+    return -1;
+  }
+  return (fclose(handle)==0 ? 0 : -1);
+}
+#endif
+
+void pindex_finish(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  if(pindex_mode==PINDEX_USE)
+  {
+    log_info("Scan index: %llu bytes skipped\n", (long long unsigned)idx_skipped);
+    return ;
+  }
+  if(pindex_mode!=PINDEX_BUILD)
+    return ;
+  pindex_regions_finish();
+  if(pindex_write() < 0)
+    log_error("Scan index: failed to write %s\n", pindex_filename);
+  else
+    log_info("Scan index: %s written, %llu candidates, %llu ranges\n", pindex_filename,
+	(long long unsigned)idx_cand_nbr, (long long unsigned)idx_ranges_nbr);
+  free(idx_region_stats);
+  idx_region_stats=NULL;
+  /* The next passes use the index */
+  idx_format_enabled=(unsigned char *)MALLOC(idx_formats_nbr + 1);
+  for(i=0; i<idx_formats_nbr; i++)
+    idx_format_enabled[i]=(params->file_stats[i].file_hint!=NULL ? 1 : 0);
+  idx_skipped=0;
+  pindex_mode=PINDEX_USE;
+#endif
+}
@@ -0,0 +1,89 @@
+/*
+
+    File: pindex.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PINDEX_H
+#define _PINDEX_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Scan index: the first scan of a partition records the blocks where
+ * the signature of an enabled file format matches, the ranges that have
+ * been scanned and a class (zero, uniform, low/mid/high entropy) per
+ * PINDEX_REGION_SIZE region. When the index file already matches the
+ * partition and the blocksize, and lists every enabled file format, the
+ * scan jumps from one candidate block to the next while no file is being
+ * recovered instead of reading every block. */
+#define PINDEX_REGION_SIZE	(1024*1024)
+
+#define PINDEX_REGION_ZERO	1
+#define PINDEX_REGION_UNIFORM	2
+#define PINDEX_REGION_CLASS(x)	(((x)>>2)&3)
+#define PINDEX_CLASS_LOW	0
+#define PINDEX_CLASS_MID	1
+#define PINDEX_CLASS_HIGH	2
+
+/* filename==NULL disables the index */
+/*@
+  @ requires filename == \null || valid_read_string(filename);
+  @*/
+void pindex_set(const char *filename);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pindex_enabled(void);
+
+/* Load the index file, or prepare a new index if it doesn't match the
+ * partition, the blocksize or the enabled file formats */
+/*@
+  @ requires \valid_read(params);
+  @*/
+void pindex_start(const struct ph_param *params);
+
+/* Build mode: record the signatures found in the block at offset,
+ * buffer holds the block and the read-ahead data */
+/*@
+  @ requires \valid_read(params);
+  @ requires \valid_read(buffer + (0 .. params->blocksize-1));
+  @*/
+void pindex_scan(const struct ph_param *params, const unsigned char *buffer, const uint64_t offset);
+
+/* Like get_next_sector(), but in use mode the blocks without candidate
+ * and already scanned by the index are skipped */
+/*@
+  @ requires \valid_read(list_search_space);
+  @ requires \valid(current_search_space);
+  @ requires \valid(offset);
+  @ requires \separated(list_search_space, current_search_space, offset);
+  @*/
+void pindex_next_sector(const alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const unsigned int blocksize);
+
+/* Build mode: write the index file, the index is used by the next passes */
+/*@
+  @ requires \valid_read(params);
+  @*/
+void pindex_finish(const struct ph_param *params);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
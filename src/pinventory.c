@@ -0,0 +1,327 @@
+/*
+
+    File: pinventory.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "intrf.h"
+#ifdef HAVE_NCURSES
+#include "intrfn.h"
+#endif
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "phnc.h"
+#include "pinventory.h"
+
+extern int need_to_stop;
+extern file_check_list_t file_check_list;
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PINVENTORY_CHUNK_SIZE	(4*1024*1024)
+
+typedef struct
+{
+  uint64_t files;
+  uint64_t sized;		/* Candidates whose size is known */
+  uint64_t bytes;
+} pinventory_count_t;
+
+static int pinventory_enable=0;
+#endif
+
+void pinventory_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pinventory_enable=(enable > 0 ? 1 : 0);
+#endif
+}
+
+int pinventory_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pinventory_enable;
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Run the header checks on the block at buffer, file_recovery is the
+ * candidate in progress. Return 1 if a new file begins, its header is
+ * in file_recovery_new */
+static int pinventory_check(const unsigned char *buffer, const unsigned int read_size, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+  const struct td_list_head *tmpl;
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const struct td_list_head *tmp;
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    const unsigned int c=buffer[pos->offset];
+    if(!file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+	  file_header_check(file_check, buffer, read_size, 1, file_recovery, file_recovery_new)!=0)
+      {
+	file_recovery_new->file_stat=file_check->file_stat;
+	return (file_check->file_stat->file_hint!=NULL ? 1 : 0);
+      }
+    }
+  }
+  return 0;
+}
+
+/* The size of the file given by its header, 0 if unknown. With another
+ * data_check, calculated_file_size is only where the parsing of the
+ * file stopped */
+static uint64_t pinventory_size(const file_recovery_t *file_recovery)
+{
+  if(file_recovery->data_check!=NULL && file_recovery->data_check!=&data_check_size)
+    return 0;
+  return file_recovery->calculated_file_size;
+}
+
+static void pinventory_line(FILE *out, const struct ph_param *params, const file_recovery_t *file_recovery, const uint64_t file_size)
+{
+  const char *extension=(file_recovery->extension!=NULL ? file_recovery->extension :
+      file_recovery->file_stat->file_hint->extension);
+  char size[32];
+  char outstr[200];
+  if(out==NULL)
+    return ;
+  if(file_size > 0)
+    snprintf(size, sizeof(size), "%llu", (long long unsigned)file_size);
+  else
+    strcpy(size, "-");
+  strcpy(outstr, "-");
+  if(file_recovery->time!=0 && file_recovery->time!=(time_t)-1)
+  {
+#if defined(__MINGW32__)
+    const struct  tm *tmp = localtime(&file_recovery->time);
+#else
+    struct tm tm_tmp;
+    const struct tm *tmp = localtime_r(&file_recovery->time,&tm_tmp);
+#endif
+    if(tmp == NULL ||
+	strftime(outstr, sizeof(outstr), "%Y-%m-%dT%H:%M:%S%z", tmp) == 0)
+      strcpy(outstr, "-");
+  }
+  fprintf(out, "%llu\t%s\t%s\t%s\n",
+      (long long unsigned)((file_recovery->location.start - params->partition->part_offset) / params->disk->sector_size),
+      (extension!=NULL ? extension : ""), size, outstr);
+}
+
+static void pinventory_report(FILE *out, const struct ph_param *params, const pinventory_count_t *counts, const unsigned int nbr_formats, const uint64_t bytes_read, const time_t elapsed)
+{
+  uint64_t files=0;
+  uint64_t bytes=0;
+  unsigned int f;
+  log_info("Inventory: %llu bytes read in %lus\n",
+      (long long unsigned)bytes_read, (long unsigned)elapsed);
+  if(out!=NULL)
+    fprintf(out, "\n# format\tfiles\tsized\tbytes\n");
+  log_info("Format      Files      Sized  Known size (MiB)\n");
+  for(f=0; f<nbr_formats; f++)
+  {
+    const pinventory_count_t *count=&counts[f];
+    if(count->files==0)
+      continue;
+    files+=count->files;
+    bytes+=count->bytes;
+    log_info("%-8s %8llu   %8llu  %llu\n", params->file_stats[f].file_hint->extension,
+	(long long unsigned)count->files, (long long unsigned)count->sized,
+	(long long unsigned)(count->bytes >> 20));
+    if(out!=NULL)
+      fprintf(out, "# %s\t%llu\t%llu\t%llu\n", params->file_stats[f].file_hint->extension,
+	  (long long unsigned)count->files, (long long unsigned)count->sized,
+	  (long long unsigned)count->bytes);
+  }
+  log_info("Inventory: %llu candidates, %llu MiB of known size\n",
+      (long long unsigned)files, (long long unsigned)(bytes >> 20));
+  if(out!=NULL)
+    fprintf(out, "# total\t%llu\t-\t%llu\n", (long long unsigned)files, (long long unsigned)bytes);
+}
+#endif
+
+pstatus_t photorec_inventory(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const unsigned int blocksize=params->blocksize;
+  const unsigned int read_size=(blocksize > 65536 ? blocksize : 65536);
+  const time_t start_time=time(NULL);
+  time_t previous_time=start_time;
+  struct td_list_head *search_walker = NULL;
+  pinventory_count_t *counts;
+  unsigned int nbr_formats;
+  unsigned int chunk_size;
+  unsigned char *buffer;
+  uint64_t bytes_read=0;
+  uint64_t blocks=0;
+  char filename[2048];
+  FILE *out;
+  params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
+  if(td_list_empty(&list_search_space->list))
+  {
+    params->status=STATUS_QUIT;
+    return PSTATUS_OK;
+  }
+  for(nbr_formats=0; params->file_stats[nbr_formats].file_hint!=NULL; nbr_formats++);
+  counts=(pinventory_count_t *)MALLOC((nbr_formats + 1) * sizeof(pinventory_count_t));
+  memset(counts, 0, (nbr_formats + 1) * sizeof(pinventory_count_t));
+  chunk_size=PINVENTORY_CHUNK_SIZE / blocksize * blocksize;
+  if(chunk_size < 2 * read_size)
+    chunk_size=2 * read_size;
+  buffer=(unsigned char *)MALLOC_IO(chunk_size + read_size);
+  snprintf(filename, sizeof(filename), "%s.%u/inventory.txt", params->recup_dir, params->dir_num);
+  out=fopen(filename, "w");
+  if(out==NULL)
+    log_error("Cannot create %s\n", filename);
+  else
+    fprintf(out, "# sector\textension\tsize\ttime\n");
+  log_info("Inventory scan\n");
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    const uint64_t end=current_search_space->end + 1;
+    file_recovery_t file_recovery;
+    /* Next disk offset to read, offset of buffer[0] */
+    uint64_t pos=current_search_space->start;
+    uint64_t buffer_offset=pos;
+    unsigned int avail=0;
+    unsigned int i=0;
+    if(need_to_stop!=0)
+      break;
+    reset_file_recovery(&file_recovery);
+    file_recovery.blocksize=blocksize;
+    while(need_to_stop==0)
+    {
+      if(avail - i < read_size && pos < end)
+      {
+	/* Keep the blocks not checked yet and read the next chunk */
+	unsigned int size;
+	int res;
+	memmove(buffer, buffer + i, avail - i);
+	avail-=i;
+	buffer_offset+=i;
+	i=0;
+	size=chunk_size - avail;
+	if(size > end - pos)
+	  size=(end - pos) / blocksize * blocksize;
+	if(size==0)
+	  pos=end;
+	else
+	{
+	  res=params->disk->pread(params->disk, buffer + avail, size, pos);
+	  if(res < (signed)size)
+	    memset(buffer + avail + (res > 0 ? res : 0), 0, size - (res > 0 ? res : 0));
+	  avail+=size;
+	  pos+=size;
+	  bytes_read+=size;
+	}
+	memset(buffer + avail, 0, read_size);
+      }
+      if(avail - i < blocksize)
+	break;
+      {
+	const uint64_t offset=buffer_offset + i;
+	file_recovery_t file_recovery_new;
+	if(file_recovery.file_stat!=NULL &&
+	    offset >= file_recovery.location.start + pinventory_size(&file_recovery))
+	{
+	  reset_file_recovery(&file_recovery);
+	  file_recovery.blocksize=blocksize;
+	}
+	if(file_recovery.file_stat!=NULL)
+	  file_recovery.file_size=offset - file_recovery.location.start;
+	file_recovery_new.blocksize=blocksize;
+	file_recovery_new.location.start=offset;
+	file_recovery_new.file_stat=NULL;
+	if(pinventory_check(buffer + i, read_size, &file_recovery, &file_recovery_new)!=0)
+	{
+	  pinventory_count_t *count=&counts[file_recovery_new.file_stat - params->file_stats];
+	  const uint64_t file_size=pinventory_size(&file_recovery_new);
+	  file_recovery_new.location.start=offset;
+	  count->files++;
+	  if(file_size > 0)
+	  {
+	    count->sized++;
+	    count->bytes+=file_size;
+	  }
+	  pinventory_line(out, params, &file_recovery_new, file_size);
+	  file_recovery_cpy(&file_recovery, &file_recovery_new);
+	}
+	i+=blocksize;
+	blocks++;
+#ifdef HAVE_NCURSES
+	if((blocks & 0xfff)==0)
+	{
+	  const time_t current_time=time(NULL);
+	  if(current_time>previous_time)
+	  {
+	    previous_time=current_time;
+	    if(photorec_progressbar(stdscr, params->pass, params, offset, current_time))
+	    {
+	      log_info("PhotoRec has been stopped\n");
+	      need_to_stop=1;
+	    }
+	  }
+	}
+#else
+	(void)previous_time;
+#endif
+      }
+    }
+  }
+  if(options->verbose > 0)
+    log_verbose("Inventory: %llu bytes read by %u bytes\n",
+	(long long unsigned)bytes_read, chunk_size);
+  pinventory_report(out, params, counts, nbr_formats, bytes_read, time(NULL) - start_time);
+  if(out!=NULL)
+    fclose(out);
+  free(buffer);
+  free(counts);
+  params->offset=PH_INVALID_OFFSET;
+  if(need_to_stop!=0)
+    return PSTATUS_STOP;
+  params->status=STATUS_QUIT;
+  return PSTATUS_OK;
+#else
+  return photorec_aux(params, options, list_search_space);
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+
+    File: pinventory.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PINVENTORY_H
+#define _PINVENTORY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Inventory scan: the search space is read sequentially by 4 MiB and
+ * every block only goes through the header checks, with safe_header_only
+ * set. There is no data_check, no file_check and nothing is written but
+ * the manifest: one line per candidate with its sector, its extension,
+ * the file size and the time given by the header when known, followed by
+ * the number of candidates and the known size of each file format.
+ * The manifest is written to recup_dir.N/inventory.txt, the summary is
+ * also logged.
+ * A candidate whose size is known hides the headers found inside it, as
+ * a file being carved would. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void pinventory_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pinventory_enabled(void);
+
+/* A single pass: params->status is set to STATUS_QUIT once done */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @ requires \separated(params, options, list_search_space);
+  @ decreases 0;
+  @ ensures  valid_ph_param(params);
+  @*/
+pstatus_t photorec_inventory(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,261 @@
+/*
+
+    File: pmanifest.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pmanifest.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+} pmanifest_run_t;
+
+typedef struct
+{
+  pmanifest_run_t *runs;
+  uint64_t nbr;
+  uint64_t alloc;
+  uint64_t files;
+  uint64_t image_size;
+  int image_size_known;
+} pmanifest_t;
+
+static char *pmanifest_filename=NULL;
+
+static void pmanifest_add_run(pmanifest_t *manifest, const uint64_t img_offset, const uint64_t len)
+{
+  if(len==0 || img_offset + len < img_offset)
+    return ;
+  if(manifest->nbr==manifest->alloc)
+  {
+    manifest->alloc=(manifest->alloc < 1024 ? 1024 : 2 * manifest->alloc);
+    manifest->runs=(pmanifest_run_t *)realloc(manifest->runs, manifest->alloc * sizeof(pmanifest_run_t));
+    if(manifest->runs==NULL)
+    {
+      log_critical("pmanifest_add_run: not enough memory\n");
+      exit(1);
+    }
+  }
+  manifest->runs[manifest->nbr].start=img_offset;
+  manifest->runs[manifest->nbr].end=img_offset + len - 1;
+  manifest->nbr++;
+}
+
+/* Value following key in str, NULL if key isn't found */
+static const char *pmanifest_get_u64(const char *str, const char *key, uint64_t *value)
+{
+  const char *pos=strstr(str, key);
+  char *end;
+  if(pos==NULL)
+    return NULL;
+  pos+=strlen(key);
+  *value=strtoull(pos, &end, 10);
+  if(end==pos)
+    return NULL;
+  return end;
+}
+
+/* <byte_run offset='0' img_offset='N' len='M'/> inside a <fileobject>,
+ * the byte runs of <source> are the partition */
+static void pmanifest_parse_xml(pmanifest_t *manifest, const char *line, int *in_file)
+{
+  uint64_t img_offset;
+  uint64_t len;
+  if(strstr(line, "<fileobject")!=NULL)
+  {
+    *in_file=1;
+    manifest->files++;
+  }
+  else if(strstr(line, "</fileobject>")!=NULL)
+    *in_file=0;
+  else if(*in_file==0)
+  {
+    if(pmanifest_get_u64(line, "<image_size>", &manifest->image_size)!=NULL)
+      manifest->image_size_known=1;
+  }
+  else if(strstr(line, "<byte_run")!=NULL &&
+      pmanifest_get_u64(line, "img_offset='", &img_offset)!=NULL &&
+      pmanifest_get_u64(line, "len='", &len)!=NULL)
+    pmanifest_add_run(manifest, img_offset, len);
+}
+
+/* One JSON object per line, the byte runs of a file follow "byte_runs" */
+static void pmanifest_parse_jsonl(pmanifest_t *manifest, const char *line)
+{
+  const char *pos;
+  uint64_t img_offset;
+  uint64_t len;
+  if(strncmp(line, "{\"source\":", 10)==0)
+  {
+    if(pmanifest_get_u64(line, "\"image_size\":", &manifest->image_size)!=NULL)
+      manifest->image_size_known=1;
+    return ;
+  }
+  pos=strstr(line, "\"byte_runs\":[");
+  if(pos==NULL)
+    return ;
+  manifest->files++;
+  while((pos=pmanifest_get_u64(pos, "\"img_offset\":", &img_offset))!=NULL &&
+      (pos=pmanifest_get_u64(pos, "\"len\":", &len))!=NULL)
+    pmanifest_add_run(manifest, img_offset, len);
+}
+
+/* Read a whole line, the lines of report.jsonl can be long */
+static int pmanifest_getline(FILE *handle, char **buffer, unsigned int *size)
+{
+  unsigned int len=0;
+  if(*buffer==NULL)
+  {
+    *size=4096;
+    *buffer=(char *)MALLOC(*size);
+  }
+  while(fgets(*buffer + len, *size - len, handle)!=NULL)
+  {
+    len+=strlen(*buffer + len);
+    if(len > 0 && (*buffer)[len-1]=='\n')
+      return 0;
+    if(len + 1 < *size)
+      return 0;
+    *size*=2;
+    *buffer=(char *)realloc(*buffer, *size);
+    if(*buffer==NULL)
+    {
+      log_critical("pmanifest_getline: not enough memory\n");
+      exit(1);
+    }
+  }
+  return (len > 0 ? 0 : -1);
+}
+
+static int pmanifest_load(pmanifest_t *manifest)
+{
+  FILE *handle;
+  char *line=NULL;
+  unsigned int size=0;
+  int jsonl=-1;
+  int in_file=0;
+  handle=fopen(pmanifest_filename, "r");
+  if(handle==NULL)
+  {
+    log_error("Manifest: can't open %s: %s\n", pmanifest_filename, strerror(errno));
+    return -1;
+  }
+  while(pmanifest_getline(handle, &line, &size)==0)
+  {
+    const char *str=line;
+    while(*str==' ' || *str=='\t')
+      str++;
+    if(jsonl < 0 && *str!='\0' && *str!='\n' && *str!='\r')
+      jsonl=(*str=='{' ? 1 : 0);
+    if(jsonl > 0)
+      pmanifest_parse_jsonl(manifest, str);
+    else if(jsonl==0)
+      pmanifest_parse_xml(manifest, str, &in_file);
+  }
+  free(line);
+  fclose(handle);
+  return 0;
+}
+
+static int pmanifest_run_cmp(const void *a, const void *b)
+{
+  const pmanifest_run_t *run_a=(const pmanifest_run_t *)a;
+  const pmanifest_run_t *run_b=(const pmanifest_run_t *)b;
+  if(run_a->start < run_b->start)
+    return -1;
+  if(run_a->start > run_b->start)
+    return 1;
+  return 0;
+}
+#endif
+
+void pmanifest_set(const char *filename)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  free(pmanifest_filename);
+  pmanifest_filename=(filename==NULL ? NULL : strdup(filename));
+#endif
+}
+
+int pmanifest_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (pmanifest_filename!=NULL ? 1 : 0);
+#else
+  return 0;
+#endif
+}
+
+void pmanifest_apply(alloc_data_t *list_search_space, const disk_t *disk_car)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pmanifest_t manifest;
+  uint64_t claimed=0;
+  uint64_t i;
+  if(pmanifest_filename==NULL)
+    return ;
+  memset(&manifest, 0, sizeof(manifest));
+  if(pmanifest_load(&manifest) < 0)
+    return ;
+  if(manifest.image_size_known > 0 && manifest.image_size!=disk_car->disk_real_size)
+  {
+    log_error("Manifest: %s has been written for another image, %llu bytes instead of %llu\n",
+	pmanifest_filename, (long long unsigned)manifest.image_size,
+	(long long unsigned)disk_car->disk_real_size);
+    free(manifest.runs);
+    return ;
+  }
+  /* In increasing order, the extent to split is always the last one */
+  if(manifest.nbr > 0)
+    qsort(manifest.runs, manifest.nbr, sizeof(pmanifest_run_t), pmanifest_run_cmp);
+  for(i=0; i<manifest.nbr; )
+  {
+    const uint64_t start=manifest.runs[i].start;
+    uint64_t end=manifest.runs[i].end;
+    for(i++; i<manifest.nbr && manifest.runs[i].start <= end + 1; i++)
+      if(manifest.runs[i].end > end)
+	end=manifest.runs[i].end;
+    del_search_space(list_search_space, start, end);
+    claimed+=end - start + 1;
+  }
+  log_info("Manifest: %s, %llu files already recovered, %llu bytes not searched again\n",
+      pmanifest_filename, (long long unsigned)manifest.files, (long long unsigned)claimed);
+  free(manifest.runs);
+#endif
+}
@@ -0,0 +1,56 @@
+/*
+
+    File: pmanifest.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PMANIFEST_H
+#define _PMANIFEST_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Manifest of a previous run: the report.xml (DFXML) or report.jsonl
+ * written by PhotoRec. The byte runs of the files it lists are removed
+ * from the search space, a second pass with more file formats enabled
+ * neither writes these files again nor reads their blocks.
+ * The manifest is ignored if it has been written for another image
+ * size. */
+
+/* filename==NULL doesn't use any manifest */
+/*@
+  @ requires filename == \null || valid_read_string(filename);
+  @*/
+void pmanifest_set(const char *filename);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pmanifest_enabled(void);
+
+/* Remove the byte runs of the files of the manifest from the search space */
+/*@
+  @ requires \valid(list_search_space);
+  @ requires \valid_read(disk_car);
+  @*/
+void pmanifest_apply(alloc_data_t *list_search_space, const disk_t *disk_car);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
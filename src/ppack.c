@@ -0,0 +1,274 @@
+/*
+
+    File: ppack.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>	/* unlink */
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "file_tar.h"
+#include "log.h"
+#include "ppack.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* A new pack is started once this size is reached, so a pack can be
+ * stored on FAT32 */
+#define PPACK_MAX_SIZE		((uint64_t)1024*1024*1024)
+#define PPACK_BUFFER_SIZE	(1024*1024)
+#define PPACK_BLOCK		512
+
+static int ppack_enable=0;
+static FILE *ppack_handle=NULL;
+static FILE *ppack_index=NULL;
+static uint64_t ppack_offset=0;
+static unsigned char *ppack_buffer=NULL;
+
+void ppack_set(const int enable)
+{
+  ppack_enable=enable;
+}
+
+int ppack_enabled(void)
+{
+  return ppack_enable;
+}
+
+/* Octal field terminated by a NUL, base-256 when the value is too large */
+static void ppack_octal(char *dst, const unsigned int size, uint64_t value)
+{
+  unsigned int i;
+  if(size < 12 || value < ((uint64_t)1 << (3 * (size - 1))))
+  {
+    dst[size-1]='\0';
+    for(i=size-1; i>0; i--)
+    {
+      dst[i-1]='0' + (value & 7);
+      value>>=3;
+    }
+    return ;
+  }
+  for(i=size; i>0; i--)
+  {
+    dst[i-1]=value & 0xff;
+    value>>=8;
+  }
+  dst[0]|=0x80;
+}
+
+static int ppack_header(const char *name, const uint64_t size, const time_t mtime, const char typeflag)
+{
+  unsigned char block[PPACK_BLOCK];
+  struct tar_posix_header *h=(struct tar_posix_header *)&block;
+  unsigned int sum=0;
+  unsigned int i;
+  memset(block, 0, sizeof(block));
+  strncpy(h->name, name, sizeof(h->name));
+  ppack_octal(h->mode, sizeof(h->mode), 0644);
+  ppack_octal(h->uid, sizeof(h->uid), 0);
+  ppack_octal(h->gid, sizeof(h->gid), 0);
+  ppack_octal(h->size, sizeof(h->size), size);
+  ppack_octal(h->mtime, sizeof(h->mtime), (uint64_t)mtime);
+  memset(h->chksum, ' ', sizeof(h->chksum));
+  h->typeflag=typeflag;
+  memcpy(h->magic, "ustar", 6);
+  memcpy(h->version, "00", 2);
+  for(i=0; i<sizeof(block); i++)
+    sum+=block[i];
+  ppack_octal(h->chksum, 7, sum);
+  if(fwrite(block, sizeof(block), 1, ppack_handle)!=1)
+    return -1;
+  ppack_offset+=sizeof(block);
+  return 0;
+}
+
+static int ppack_pad(const uint64_t size)
+{
+  static const unsigned char zero[PPACK_BLOCK]={ 0 };
+  const unsigned int pad=(PPACK_BLOCK - size % PPACK_BLOCK) % PPACK_BLOCK;
+  if(pad > 0 && fwrite(zero, pad, 1, ppack_handle)!=1)
+    return -1;
+  ppack_offset+=pad;
+  return 0;
+}
+
+static int ppack_open(const char *recup_dir)
+{
+  const unsigned int fname_size=strlen(recup_dir) + 32;
+  char *fname=(char *)MALLOC(fname_size);
+  unsigned int pack_nbr;
+  int fd=-1;
+  /* Each worker gets its own pack */
+  for(pack_nbr=1; fd<0; pack_nbr++)
+  {
+    snprintf(fname, fname_size, "%s.pack.%u.tar", recup_dir, pack_nbr);
+    fd=open(fname, O_WRONLY|O_CREAT|O_EXCL|O_BINARY, 0644);
+    if(fd<0 && errno!=EEXIST)
+    {
+      log_critical("Cannot create pack %s: %s\n", fname, strerror(errno));
+      free(fname);
+      return -1;
+    }
+  }
+  ppack_handle=fdopen(fd, "wb");
+  if(ppack_handle==NULL)
+  {
+    close(fd);
+    free(fname);
+    return -1;
+  }
+  log_info("Recovered files are stored in %s\n", fname);
+  snprintf(fname, fname_size, "%s.pack.%u.idx", recup_dir, pack_nbr-1);
+  ppack_index=fopen(fname, "w");
+  if(ppack_index==NULL)
+    log_error("Cannot create pack index %s: %s\n", fname, strerror(errno));
+  free(fname);
+  ppack_offset=0;
+  if(ppack_buffer==NULL)
+    ppack_buffer=(unsigned char *)MALLOC(PPACK_BUFFER_SIZE);
+  return 0;
+}
+
+void ppack_close(void)
+{
+  static const unsigned char zero[2*PPACK_BLOCK]={ 0 };
+  if(ppack_handle==NULL)
+    return ;
+  /* End of archive: two empty blocks */
+  if(fwrite(zero, sizeof(zero), 1, ppack_handle)!=1 || fclose(ppack_handle)!=0)
+    log_critical("Cannot write the pack: %s\n", strerror(errno));
+  ppack_handle=NULL;
+  if(ppack_index!=NULL)
+    fclose(ppack_index);
+  ppack_index=NULL;
+  free(ppack_buffer);
+  ppack_buffer=NULL;
+}
+
+void ppack_add(const file_recovery_t *file_recovery, const struct ph_param *params)
+{
+  const char *member=file_recovery->filename;
+  const char *ptr;
+  const uint64_t size=file_recovery->file_size;
+  uint64_t data_offset;
+  uint64_t copied;
+  FILE *handle;
+  int res=0;
+  if(ppack_enable==0 || file_recovery->filename[0]=='\0')
+    return ;
+  /* Keep recup_dir.N/name */
+  for(ptr=file_recovery->filename; *ptr!='\0'; ptr++)
+    if(*ptr=='/' && ptr[1]!='\0')
+    {
+      const char *next;
+      for(next=ptr+1; *next!='\0' && *next!='/'; next++);
+      if(*next=='/')
+	member=ptr+1;
+    }
+  if(ppack_handle==NULL && ppack_open(params->recup_dir)<0)
+    return ;
+  handle=fopen(file_recovery->filename, "rb");
+  if(handle==NULL)
+  {
+    log_error("Cannot read %s to pack it: %s\n", file_recovery->filename, strerror(errno));
+    return ;
+  }
+  if(strlen(member) > sizeof(((struct tar_posix_header *)NULL)->name))
+  {
+    /* GNU long name */
+    const unsigned int len=strlen(member)+1;
+    res|=ppack_header("././@LongLink", len, 0, 'L');
+    if(fwrite(member, len, 1, ppack_handle)!=1)
+      res=-1;
+    ppack_offset+=len;
+    res|=ppack_pad(len);
+  }
+  res|=ppack_header(member, size,
+      (file_recovery->time!=0 && file_recovery->time!=(time_t)-1 ? file_recovery->time : time(NULL)), '0');
+  data_offset=ppack_offset;
+  for(copied=0; copied < size && res==0; )
+  {
+    const unsigned int toread=(size - copied > PPACK_BUFFER_SIZE ? PPACK_BUFFER_SIZE : size - copied);
+    const size_t nbr=fread(ppack_buffer, 1, toread, handle);
+    if(nbr < toread)
+    {
+      /* Keep the archive consistent with the header */
+      log_error("Cannot read %s to pack it\n", file_recovery->filename);
+      memset(ppack_buffer + nbr, 0, toread - nbr);
+      res=-1;
+    }
+    if(fwrite(ppack_buffer, toread, 1, ppack_handle)!=1)
+      res=-1;
+    ppack_offset+=toread;
+    copied+=toread;
+  }
+  fclose(handle);
+  res|=ppack_pad(size);
+  if(res<0)
+  {
+    log_critical("Cannot pack %s: %s\n", file_recovery->filename, strerror(errno));
+    return ;
+  }
+  if(ppack_index!=NULL)
+  {
+    const struct td_list_head *tmp;
+    unsigned int nbr_runs=0;
+    fprintf(ppack_index, "%llu %llu ", (long long unsigned)data_offset, (long long unsigned)size);
+    td_list_for_each(tmp, &file_recovery->location.list)
+    {
+      const alloc_list_t *element=td_list_entry_const(tmp, const alloc_list_t, list);
+      if(element->data>0)
+	fprintf(ppack_index, "%s%llu-%llu", (nbr_runs++ > 0 ? "," : ""),
+	    (long long unsigned)element->start, (long long unsigned)element->end);
+    }
+    fprintf(ppack_index, " %s\n", member);
+  }
+  unlink(file_recovery->filename);
+  if(ppack_offset >= PPACK_MAX_SIZE)
+    ppack_close();
+}
@@ -0,0 +1,60 @@
+/*
+
+    File: ppack.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PPACK_H
+#define _PPACK_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pack output: each recovered file is appended to recup_dir.pack.N.tar
+ * once it's complete, and the file itself is removed. Only one
+ * directory entry per pack is left on the destination instead of one
+ * per file. recup_dir.pack.N.idx lists, for each file, its data offset
+ * in the pack, its size, the byte runs it came from and its name. Any
+ * tar extracts the files with the usual recup_dir.N/ layout. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void ppack_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int ppack_enabled(void);
+
+/* Move the recovered file to the current pack, location must still
+ * hold its data blocks */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(params);
+  @*/
+void ppack_add(const file_recovery_t *file_recovery, const struct ph_param *params);
+
+/* Terminate and close the current pack, needed before fork(): the next
+ * ppack_add() creates a new pack */
+void ppack_close(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -68,6 +68,61 @@ extern const arch_fnct_t arch_none;
 #define INTER_SELECT	(LINES-2-7-1)
 #endif
 
+#ifndef DISABLED_FOR_FRAMAC
+/*@
+  @ requires \valid_read(list_part);
+  @ requires \valid_read(partition);
+  @ assigns \nothing;
+  @*/
+static int partition_contains_other(const list_part_t *list_part, const partition_t *partition)
+{
+  const list_part_t *element;
+  const uint64_t end=partition->part_offset + partition->part_size;
+  for(element=list_part; element!=NULL; element=element->next)
+  {
+    const partition_t *other=element->part;
+    if(other!=partition && other->part_size < partition->part_size &&
+	other->part_offset >= partition->part_offset &&
+	other->part_offset + other->part_size <= end)
+      return 1;
+  }
+  return 0;
+}
+
+/* Carve each partition that doesn't contain another one, so the whole
+ * disk and the extended partitions are skipped, in the order of the disk
+ * offsets. Each one gets its own search space and blocksize; the disk and
+ * its cache are shared so the disk is read forward once. */
+/*@
+  @ requires \valid_read(list_part);
+  @ requires \valid(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @*/
+static void photorec_all_partitions(const list_part_t *list_part, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+  const list_part_t *element;
+  const unsigned int user_blocksize=params->blocksize;
+  char *cmd_search=params->cmd_run;
+  for(element=list_part; element!=NULL && need_to_stop==0; element=element->next)
+  {
+    partition_t *partition=element->part;
+    if(partition_contains_other(list_part, partition))
+      continue;
+    params->partition=partition;
+    params->cmd_run=cmd_search;
+    free_search_space(list_search_space);
+    init_search_space(list_search_space, params->disk, partition);
+    params->blocksize=0;
+    if(params->carve_free_space_only>0)
+      params->blocksize=remove_used_space(params->disk, partition, list_search_space);
+    if(user_blocksize > 0)
+      params->blocksize=user_blocksize;
+    photorec(params, options, list_search_space);
+  }
+}
+#endif
+
 void menu_photorec(struct ph_param *params, struct ph_options *options, alloc_data_t*list_search_space)
 {
   list_part_t *list_part;
@@ -97,7 +152,8 @@ void menu_photorec(struct ph_param *params, struct ph_options *options, alloc_da
   if(params->cmd_run!=NULL)
   {
     /*@ assert valid_read_string(params->cmd_run); */
-    if(menu_photorec_cli(list_part, params, options, list_search_space) > 0)
+    const int res=menu_photorec_cli(list_part, params, options, list_search_space);
+    if(res > 0)
     {
       if(params->recup_dir==NULL)
       {
@@ -120,7 +176,12 @@ void menu_photorec(struct ph_param *params, struct ph_options *options, alloc_da
       if(params->recup_dir!=NULL)
       {
 	/*@ assert valid_read_string(params->recup_dir); */
-	photorec(params, options, list_search_space);
+#ifndef DISABLED_FOR_FRAMAC
+	if(res==2)
+	  photorec_all_partitions(list_part, params, options, list_search_space);
+	else
+#endif
+	  photorec(params, options, list_search_space);
       }
     }
   }
@@ -0,0 +1,324 @@
+/*
+
+    File: ppriority.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pindex.h"
+#include "pstream.h"
+#include "hdpipe.h"
+#include "psearchn.h"
+#include "ppriority.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PPRIORITY_REGIONS	256
+#define PPRIORITY_MIN_SIZE	(64*1024*1024)
+/* Reads in each region */
+#define PPRIORITY_SAMPLES	16
+#define PPRIORITY_SAMPLE_SIZE	(64*1024)
+/* One or two byte signatures match random data too often */
+#define PPRIORITY_SIG_MIN	3
+
+extern file_check_list_t file_check_list;
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  unsigned int hits;		/* Blocks starting with a file signature */
+  unsigned int data;		/* Blocks not filled with a single byte */
+  unsigned int blocks;
+} pregion_t;
+
+static int ppriority=0;
+#endif
+
+void ppriority_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  ppriority=enable;
+#endif
+}
+
+int ppriority_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return ppriority;
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Regions of region_size bytes of the search space, the last one ends
+ * with the search space */
+static unsigned int ppriority_split(const alloc_data_t *list_search_space, pregion_t *regions, const unsigned int nbr_max, const uint64_t region_size)
+{
+  struct td_list_head *search_walker = NULL;
+  uint64_t done=0;
+  unsigned int k=0;
+  memset(regions, 0, nbr_max*sizeof(pregion_t));
+  regions[0].start=td_list_first_entry(&list_search_space->list, alloc_data_t, list)->start;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    const uint64_t len=current_search_space->end - current_search_space->start + 1;
+    while(k+1 < nbr_max && done + len > (k+1)*region_size)
+    {
+      const uint64_t boundary=current_search_space->start + (k+1)*region_size - done;
+      regions[k].end=boundary-1;
+      k++;
+      regions[k].start=boundary;
+    }
+    done+=len;
+  }
+  regions[k].end=PH_INVALID_OFFSET;
+  return k+1;
+}
+
+static void ppriority_count(pregion_t *region, const unsigned char *buffer, const unsigned int size, const unsigned int blocksize)
+{
+  unsigned int i;
+  for(i=0; i+blocksize<=size; i+=blocksize)
+  {
+    const unsigned char *block=&buffer[i];
+    const struct td_list_head *tmpl;
+    int found=0;
+    region->blocks++;
+    /* Wiped or never written, nothing to recover */
+    if(block[0]==block[blocksize-1] && memcmp(block, block+1, blocksize-1)==0)
+      continue;
+    region->data++;
+    td_list_for_each(tmpl, &file_check_list.list)
+    {
+      const struct td_list_head *tmp;
+      const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+      const unsigned int c=block[pos->offset];
+      if(!file_check_list_used(pos, c))
+	continue;
+      td_list_for_each(tmp, &pos->file_checks[c].list)
+      {
+	const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+	if(file_check->length >= PPRIORITY_SIG_MIN &&
+	    memcmp(block + file_check->offset, file_check->value, file_check->length)==0)
+	{
+	  found=1;
+	  break;
+	}
+      }
+      if(found!=0)
+	break;
+    }
+    if(found!=0)
+      region->hits++;
+  }
+}
+
+/* Read PPRIORITY_SAMPLES blocks evenly spread in each region, in disk order */
+static void ppriority_sample(struct ph_param *params, const alloc_data_t *list_search_space, pregion_t *regions, const unsigned int nbr, const uint64_t region_size, const uint64_t total)
+{
+  struct td_list_head *search_walker = NULL;
+  const unsigned int blocksize=params->blocksize;
+  const unsigned int sample_size=(blocksize > PPRIORITY_SAMPLE_SIZE ? blocksize : PPRIORITY_SAMPLE_SIZE / blocksize * blocksize);
+  /* A signature may be located up to PHOTOREC_MAX_SIG_OFFSET after the block start */
+  const unsigned int read_size=sample_size + PHOTOREC_MAX_SIG_OFFSET + 1;
+  unsigned char *buffer=(unsigned char *)MALLOC(read_size);
+  uint64_t done=0;
+  unsigned int t=0;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    const uint64_t len=current_search_space->end - current_search_space->start + 1;
+    while(t < nbr*PPRIORITY_SAMPLES)
+    {
+      const unsigned int k=t / PPRIORITY_SAMPLES;
+      const uint64_t point=(uint64_t)k*region_size +
+	(2*(t % PPRIORITY_SAMPLES)+1) * region_size / (2*PPRIORITY_SAMPLES);
+      uint64_t offset;
+      int res;
+      if(point >= total)
+	t=nbr*PPRIORITY_SAMPLES;
+      if(point >= total || point >= done + len)
+	break;
+      t++;
+      offset=current_search_space->start + (point - done) / blocksize * blocksize;
+      res=params->disk->pread(params->disk, buffer, read_size, offset);
+      if(res < (signed)sample_size)
+	continue;
+      if(res < (signed)read_size)
+	memset(&buffer[res], 0, read_size - res);
+      ppriority_count(&regions[k], buffer, sample_size, blocksize);
+    }
+    done+=len;
+  }
+  free(buffer);
+}
+
+/* Highest density of signatures first, then of data, then in disk order.
+ * A region whose samples can't be read comes last */
+static int ppriority_cmp(const void *a, const void *b)
+{
+  const pregion_t *ra=(const pregion_t *)a;
+  const pregion_t *rb=(const pregion_t *)b;
+  const uint64_t ha=(ra->blocks > 0 ? (uint64_t)ra->hits * 1000000 / ra->blocks : 0);
+  const uint64_t hb=(rb->blocks > 0 ? (uint64_t)rb->hits * 1000000 / rb->blocks : 0);
+  const uint64_t da=(ra->blocks > 0 ? (uint64_t)ra->data * 1000000 / ra->blocks : 0);
+  const uint64_t db=(rb->blocks > 0 ? (uint64_t)rb->data * 1000000 / rb->blocks : 0);
+  if(ha!=hb)
+    return (ha > hb ? -1 : 1);
+  if(da!=db)
+    return (da > db ? -1 : 1);
+  if(ra->start!=rb->start)
+    return (ra->start < rb->start ? -1 : 1);
+  return 0;
+}
+
+/* First block of the search space in the region, the data consumed by
+ * the files of the neighbouring regions is no longer in the search space.
+ * Return -1 if nothing is left in the region */
+static int ppriority_region_start(const alloc_data_t *list_search_space, const pregion_t *region, const unsigned int blocksize, uint64_t *offset)
+{
+  struct td_list_head *search_walker = NULL;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    uint64_t start=current_search_space->start;
+    if(current_search_space->end < region->start)
+      continue;
+    if(start > region->end)
+      return -1;
+    if(start < region->start)
+      start+=(region->start - start + blocksize - 1) / blocksize * blocksize;
+    if(start <= current_search_space->end && start <= region->end)
+    {
+      *offset=start;
+      return 0;
+    }
+  }
+  return -1;
+}
+#endif
+
+pstatus_t photorec_priority(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  struct td_list_head *search_walker = NULL;
+  pregion_t *regions;
+  uint64_t total=0;
+  uint64_t region_size;
+  unsigned int nbr;
+  unsigned int with_hits=0;
+  unsigned int with_data=0;
+  uint64_t skipped_last=0;
+  unsigned int i;
+  pstatus_t ind_stop=PSTATUS_OK;
+  /* The scan index, the stream output and a stream input need a single
+   * scan in disk order */
+  if(ppriority==0 || params->offset!=PH_INVALID_OFFSET || td_list_empty(&list_search_space->list) ||
+      pindex_enabled() > 0 || pstream_enabled() > 0 || disk_is_pipe(params->disk) > 0)
+    return photorec_aux(params, options, list_search_space);
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    total+=current_search_space->end - current_search_space->start + 1;
+  }
+  nbr=(total / PPRIORITY_MIN_SIZE > PPRIORITY_REGIONS ? PPRIORITY_REGIONS : total / PPRIORITY_MIN_SIZE);
+  if(nbr <= 1)
+    return photorec_aux(params, options, list_search_space);
+  region_size=(total + nbr - 1) / nbr;
+  region_size=(region_size + params->blocksize - 1) / params->blocksize * params->blocksize;
+  regions=(pregion_t *)MALLOC(nbr*sizeof(pregion_t));
+  nbr=ppriority_split(list_search_space, regions, nbr, region_size);
+  ppriority_sample(params, list_search_space, regions, nbr, region_size, total);
+  qsort(regions, nbr, sizeof(pregion_t), ppriority_cmp);
+  for(i=0; i<nbr; i++)
+  {
+    if(regions[i].hits > 0)
+      with_hits++;
+    if(regions[i].data > 0)
+      with_data++;
+  }
+  log_info("Priority scan: %u regions of %llu bytes, %u with file signatures, %u with data\n",
+      nbr, (long long unsigned)region_size, with_hits, with_data);
+  for(i=0; i<nbr && ind_stop==PSTATUS_OK; i++)
+  {
+    uint64_t offset;
+    if(ppriority_region_start(list_search_space, &regions[i], params->blocksize, &offset) < 0)
+      continue;
+    if(options->verbose > 0)
+      log_verbose("Priority scan: sector %llu, %u signatures and %u data blocks in %u blocks\n",
+	  (long long unsigned)((offset - params->partition->part_offset) / params->disk->sector_size),
+	  regions[i].hits, regions[i].data, regions[i].blocks);
+    params->offset=offset;
+    params->offset_end=regions[i].end;
+    ind_stop=photorec_aux(params, options, list_search_space);
+    /* A sequential scan goes back to the headers ignored inside a file
+     * when a following file fails, they may be far behind. Search them
+     * again before leaving the region */
+    while(ind_stop==PSTATUS_OK)
+    {
+      pregion_t rest;
+      const uint64_t skipped=header_ignored_offset();
+      if(skipped==0 || skipped < regions[i].start || skipped > regions[i].end ||
+	  (skipped_last!=0 && skipped <= skipped_last))
+	break;
+      skipped_last=skipped;
+      rest.start=skipped;
+      rest.end=regions[i].end;
+      if(ppriority_region_start(list_search_space, &rest, params->blocksize, &offset) < 0)
+	break;
+      params->offset=offset;
+      params->offset_end=regions[i].end;
+      ind_stop=photorec_aux(params, options, list_search_space);
+    }
+    skipped_last=0;
+  }
+  if(ind_stop!=PSTATUS_OK)
+  {
+    /* Resume from the first data not carved yet */
+    unsigned int j;
+    for(j=i; j<nbr; j++)
+      if(regions[j].start < params->offset)
+	params->offset=regions[j].start;
+  }
+  else
+    params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
+  free(regions);
+  return ind_stop;
+#else
+  return photorec_aux(params, options, list_search_space);
+#endif
+}
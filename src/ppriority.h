@@ -0,0 +1,66 @@
+/*
+
+    File: ppriority.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PPRIORITY_H
+#define _PPRIORITY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Priority scan: the search space is split into up to 256 regions of at
+ * least 64 MiB. 1 MiB of each region is sampled, the regions are carved
+ * with photorec_aux() by decreasing density of blocks starting with a
+ * file signature, then of blocks not filled with a single byte, then in
+ * disk order.
+ * Each region is carved once, a file in progress is finished past the
+ * end of its region like a shard of photorec_shard().
+ * When stopped, params->offset is set to the first region not carved
+ * yet: the session resumes with a plain scan from there, the regions
+ * already carved are read again but the data of the files recovered
+ * is no longer in the search space. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void ppriority_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int ppriority_enabled(void);
+
+/* Falls back to photorec_aux() when disabled, when resuming a scan
+ * (params->offset is set) or when the search space is too small */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @ requires \separated(params, options, list_search_space);
+  @ decreases 0;
+  @ ensures  valid_ph_param(params);
+  @*/
+pstatus_t photorec_priority(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
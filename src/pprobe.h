@@ -0,0 +1,43 @@
+/*
+
+    File: pprobe.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PPROBE_H
+#define _PPROBE_H
+
+/* Static trace points of the "photorec" provider, built with
+ * ./configure --enable-sdt. Each one is a nop until a tracer attaches:
+ *   bpftrace -e 'usdt:./photorec:photorec:header_check /arg2/ { @[str(arg1)]=count(); }'
+ * read_start(offset, count), read_done(offset, count, res): device reads
+ * cache_read(offset, count): reads served by the disk cache layer
+ * header_check(offset, extension, accepted): a signature has matched
+ * file_start(offset, filename), file_finish(filename, file_size)
+ * backtrack(offset, back): the scan goes back to a previous header
+ * phase(pass, status): status_inc() has chosen the next phase */
+#if defined(ENABLE_SDT) && defined(HAVE_SYS_SDT_H) && !defined(DISABLED_FOR_FRAMAC)
+#include <sys/sdt.h>
+#define PHOTOREC_PROBE2(name, a, b)	DTRACE_PROBE2(photorec, name, a, b)
+#define PHOTOREC_PROBE3(name, a, b, c)	DTRACE_PROBE3(photorec, name, a, b, c)
+#else
+#define PHOTOREC_PROBE2(name, a, b)	do { } while(0)
+#define PHOTOREC_PROBE3(name, a, b, c)	do { } while(0)
+#endif
+
+#endif
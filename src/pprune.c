@@ -0,0 +1,124 @@
+/*
+
+    File: pprune.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "pprune.h"
+
+/* Bytes scanned between two evaluations */
+#define PPRUNE_WINDOW		(64*1024*1024)
+/* Minimum number of header_check calls before pruning a file format */
+#define PPRUNE_MIN_CALLS	1024
+#define PPRUNE_COST_SHARE	20
+#define PPRUNE_STRIDE		8
+
+#ifndef DISABLED_FOR_FRAMAC
+static int pprune_enable=0;
+static uint64_t pprune_part_offset=0;
+static unsigned int pprune_align=512;
+static uint64_t pprune_scanned=0;
+static uint64_t pprune_start_ns=0;
+#endif
+
+void pprune_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pprune_enable=(enable > 0 ? 1 : 0);
+  if(pprune_enable > 0)
+    file_profile=1;
+#endif
+}
+
+int pprune_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pprune_enable;
+#else
+  return 0;
+#endif
+}
+
+void pprune_start(const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pprune_part_offset=params->partition->part_offset;
+  pprune_align=params->blocksize * PPRUNE_STRIDE;
+  pprune_scanned=0;
+  pprune_start_ns=file_profile_clock();
+#endif
+}
+
+void pprune_update(struct ph_param *params, const unsigned int size)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  file_stat_t *file_stat;
+  uint64_t elapsed_ns;
+  if(pprune_enable==0)
+    return ;
+  pprune_scanned+=size;
+  if(pprune_scanned < PPRUNE_WINDOW)
+    return ;
+  pprune_scanned=0;
+  elapsed_ns=file_profile_clock() - pprune_start_ns;
+  for(file_stat=params->file_stats; file_stat->file_hint!=NULL; file_stat++)
+  {
+    if(file_stat->pruned==0 &&
+	file_stat->header_hits==0 &&
+	file_stat->header_calls >= PPRUNE_MIN_CALLS &&
+	file_stat->header_ns * PPRUNE_COST_SHARE >= elapsed_ns)
+    {
+      file_stat->pruned=1;
+      log_info("Pruning %s: %llu header_check calls, %llu ms, no header found, now only checked every %u bytes\n",
+	  (file_stat->file_hint->extension!=NULL ? file_stat->file_hint->extension : ""),
+	  (long long unsigned)file_stat->header_calls,
+	  (long long unsigned)(file_stat->header_ns / 1000000),
+	  pprune_align);
+    }
+  }
+#endif
+}
+
+int pprune_aligned(const uint64_t offset)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return ((offset - pprune_part_offset) % pprune_align == 0 ? 1 : 0);
+#else
+  return 1;
+#endif
+}
+
+void pprune_hit(file_stat_t *file_stat)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  file_stat->pruned=0;
+  log_info("Pruning %s: header found, checked on every block again\n",
+      (file_stat->file_hint->extension!=NULL ? file_stat->file_hint->extension : ""));
+#endif
+}
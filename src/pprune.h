@@ -0,0 +1,81 @@
+/*
+
+    File: pprune.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PPRUNE_H
+#define _PPRUNE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Adaptive pruning of the file formats.
+ * By default (strict mode) every header_check runs on every block.
+ * In adaptive mode, the profiling counters are enabled and, after each
+ * sampling window of the main scan, a file format without any header
+ * hit whose header_check has taken more than 1/PPRUNE_COST_SHARE of the
+ * time elapsed since the start of the scan is pruned: its header_check
+ * only runs on the blocks aligned to PPRUNE_STRIDE blocks. With 512-byte blocks,
+ * that's every 4 KiB, where most filesystems start their files.
+ * The first header found restores the file format.
+ * Every decision is logged. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void pprune_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pprune_enabled(void);
+
+/* Start of a scan of the partition by blocks of params->blocksize */
+/*@
+  @ requires \valid_read(params);
+  @ requires valid_ph_param(params);
+  @*/
+void pprune_start(const struct ph_param *params);
+
+/* Called after each read of the scan, size is the number of bytes read */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @*/
+void pprune_update(struct ph_param *params, const unsigned int size);
+
+/* Return 1 if the header_check of a pruned file format must run at offset */
+/*@
+  @ assigns \nothing;
+  @*/
+int pprune_aligned(const uint64_t offset);
+
+/* A header of the pruned file format has been found */
+/*@
+  @ requires \valid(file_stat);
+  @ requires valid_file_stat(file_stat);
+  @*/
+void pprune_hit(file_stat_t *file_stat);
+
+#define pprune_check(file_stat, offset) ((file_stat)->pruned==0 || pprune_aligned(offset)!=0)
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,330 @@
+/*
+
+    File: preader.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "paffinity.h"
+#include "preader.h"
+
+/* #define DEBUG_PREADER */
+
+typedef enum { PREADER_IDLE=0, PREADER_PENDING=1, PREADER_DONE=2, PREADER_QUIT=3 } preader_status_t;
+
+/* Windows kept after use: after a file or a backtrack, the carving loop
+ * often reads again data it has just read */
+#define PREADER_HISTORY 4
+
+typedef struct
+{
+  unsigned char *buffer;
+  uint64_t offset;
+  /* Number of bytes read successfully, 0 for an unused window */
+  unsigned int valid;
+} preader_window_t;
+
+struct preader_struct
+{
+  disk_t *disk;
+  unsigned int size;
+  /* All the windows, swapped instead of copied */
+  unsigned char *pool;
+  preader_window_t history[PREADER_HISTORY];
+  unsigned int history_next;
+  /* Time spent waiting for the disk in preader_pread(), in ns */
+  uint64_t stall;
+#ifdef HAVE_PTHREAD
+  unsigned char *buffer;
+  uint64_t offset;
+  int res;
+  preader_status_t status;
+  int thread_ok;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+static void *preader_thread(void *arg)
+{
+  preader_t *reader=(preader_t *)arg;
+  paffinity_reader();
+  pthread_mutex_lock(&reader->mutex);
+  while(1)
+  {
+    while(reader->status!=PREADER_PENDING && reader->status!=PREADER_QUIT)
+      pthread_cond_wait(&reader->cond, &reader->mutex);
+    if(reader->status==PREADER_QUIT)
+      break;
+    {
+      const uint64_t offset=reader->offset;
+      int res;
+      /* The scan thread never touches the disk while a read is pending */
+      pthread_mutex_unlock(&reader->mutex);
+      res=reader->disk->pread(reader->disk, reader->buffer, reader->size, offset);
+      pthread_mutex_lock(&reader->mutex);
+      reader->res=res;
+      reader->status=PREADER_DONE;
+      pthread_cond_broadcast(&reader->cond);
+    }
+  }
+  pthread_mutex_unlock(&reader->mutex);
+  return NULL;
+}
+#endif
+
+/* Copy the data available in memory from offset, return the number of
+ * bytes copied */
+static unsigned int preader_history_get(const preader_t *reader, unsigned char *buffer, const uint64_t offset, const unsigned int size)
+{
+  unsigned int done=0;
+  while(done < size)
+  {
+    const uint64_t pos=offset + done;
+    unsigned int i;
+    for(i=0; i<PREADER_HISTORY; i++)
+    {
+      const preader_window_t *window=&reader->history[i];
+      if(window->valid > 0 && window->offset <= pos && pos < window->offset + window->valid)
+	break;
+    }
+    if(i==PREADER_HISTORY)
+      return done;
+    {
+      const preader_window_t *window=&reader->history[i];
+      const unsigned int in_window=pos - window->offset;
+      const unsigned int len=(window->valid - in_window < size - done ? window->valid - in_window : size - done);
+      if(buffer!=NULL)
+	memcpy(buffer + done, window->buffer + in_window, len);
+      done+=len;
+    }
+  }
+  return done;
+}
+
+static void preader_history_add(preader_t *reader, const unsigned char *buffer, const uint64_t offset, const int res)
+{
+  preader_window_t *window;
+  unsigned int i;
+  if(res<=0)
+    return ;
+  /* Same data already kept */
+  for(i=0; i<PREADER_HISTORY; i++)
+    if(reader->history[i].offset==offset && reader->history[i].valid >= (unsigned int)res)
+      return ;
+  window=&reader->history[reader->history_next];
+  reader->history_next=(reader->history_next + 1) % PREADER_HISTORY;
+  memcpy(window->buffer, buffer, res);
+  window->offset=offset;
+  window->valid=res;
+}
+
+#ifdef HAVE_PTHREAD
+/* Keep the window read by the thread, the thread gets the buffer of the
+ * oldest window in exchange */
+static void preader_history_swap(preader_t *reader)
+{
+  preader_window_t *window;
+  unsigned char *tmp;
+  unsigned int i;
+  if(reader->res<=0)
+    return ;
+  for(i=0; i<PREADER_HISTORY; i++)
+    if(reader->history[i].offset==reader->offset && reader->history[i].valid >= (unsigned int)reader->res)
+      return ;
+  window=&reader->history[reader->history_next];
+  reader->history_next=(reader->history_next + 1) % PREADER_HISTORY;
+  tmp=window->buffer;
+  window->buffer=reader->buffer;
+  reader->buffer=tmp;
+  window->offset=reader->offset;
+  window->valid=reader->res;
+}
+#endif
+
+preader_t *preader_new(disk_t *disk, const unsigned int size)
+{
+  preader_t *reader=(preader_t *)MALLOC(sizeof(*reader));
+  unsigned int i;
+  reader->disk=disk;
+  reader->size=size;
+  /* One huge-page backed block for all the windows */
+  reader->pool=(unsigned char *)MALLOC_IO((size_t)(PREADER_HISTORY + 1) * size);
+  paffinity_bind_buffer(reader->pool, (size_t)(PREADER_HISTORY + 1) * size);
+  for(i=0; i<PREADER_HISTORY; i++)
+  {
+    reader->history[i].buffer=reader->pool + (size_t)i * size;
+    reader->history[i].offset=0;
+    reader->history[i].valid=0;
+  }
+  reader->history_next=0;
+  reader->stall=0;
+#ifdef HAVE_PTHREAD
+  reader->buffer=reader->pool + (size_t)PREADER_HISTORY * size;
+  reader->offset=0;
+  reader->res=0;
+  reader->status=PREADER_IDLE;
+  pthread_mutex_init(&reader->mutex, NULL);
+  pthread_cond_init(&reader->cond, NULL);
+  reader->thread_ok=(pthread_create(&reader->thread, NULL, &preader_thread, reader)==0);
+  if(reader->thread_ok==0)
+    log_warning("preader: cannot create reader thread, reading synchronously\n");
+#endif
+  return reader;
+}
+
+void preader_prefetch(preader_t *reader, const uint64_t offset)
+{
+#ifdef HAVE_PTHREAD
+  if(reader->thread_ok==0)
+    return ;
+  if(offset >= reader->disk->disk_real_size)
+    return ;
+  /* Nothing to read */
+  if(preader_history_get(reader, NULL, offset, reader->size)==reader->size)
+    return ;
+  pthread_mutex_lock(&reader->mutex);
+  if(reader->status==PREADER_IDLE || reader->status==PREADER_DONE)
+  {
+#ifdef DEBUG_PREADER
+    log_trace("preader_prefetch(offset=%llu)\n", (long long unsigned)offset);
+#endif
+    reader->offset=offset;
+    reader->status=PREADER_PENDING;
+    pthread_cond_broadcast(&reader->cond);
+  }
+  pthread_mutex_unlock(&reader->mutex);
+#endif
+}
+
+int preader_pread(preader_t *reader, unsigned char *buffer, const uint64_t offset)
+{
+  unsigned int done;
+  int res;
+#ifdef HAVE_PTHREAD
+  if(reader->thread_ok!=0)
+  {
+    int hit=0;
+    res=0;
+    pthread_mutex_lock(&reader->mutex);
+    if(reader->status==PREADER_PENDING)
+    {
+      const uint64_t start=file_profile_clock();
+      while(reader->status==PREADER_PENDING)
+	pthread_cond_wait(&reader->cond, &reader->mutex);
+      reader->stall+=file_profile_clock() - start;
+    }
+    if(reader->status==PREADER_DONE)
+    {
+      if(reader->offset==offset)
+      {
+	memcpy(buffer, reader->buffer, reader->size);
+	res=reader->res;
+	hit=1;
+      }
+      /* Not the expected window, it may be used later */
+      preader_history_swap(reader);
+      reader->status=PREADER_IDLE;
+    }
+    pthread_mutex_unlock(&reader->mutex);
+#ifdef DEBUG_PREADER
+    log_trace("preader_pread(offset=%llu) %s\n", (long long unsigned)offset, (hit>0?"hit":"miss"));
+#endif
+    if(hit>0)
+      return res;
+  }
+#endif
+  /* Backtrack or restart inside data already read: only read the missing tail */
+  done=preader_history_get(reader, buffer, offset, reader->size);
+  if(done==reader->size)
+    return reader->size;
+  {
+    const uint64_t start=file_profile_clock();
+    res=reader->disk->pread(reader->disk, buffer + done, reader->size - done, offset + done);
+    reader->stall+=file_profile_clock() - start;
+  }
+  if(done > 0)
+    res=(res > 0 ? (int)done + res : (int)done);
+  preader_history_add(reader, buffer, offset, res);
+  return res;
+}
+
+uint64_t preader_stall(const preader_t *reader)
+{
+  return reader->stall;
+}
+
+void preader_sync(preader_t *reader)
+{
+#ifdef HAVE_PTHREAD
+  if(reader->thread_ok==0)
+    return ;
+  pthread_mutex_lock(&reader->mutex);
+  while(reader->status==PREADER_PENDING)
+    pthread_cond_wait(&reader->cond, &reader->mutex);
+  pthread_mutex_unlock(&reader->mutex);
+#endif
+}
+
+void preader_free(preader_t *reader)
+{
+  if(reader==NULL)
+    return ;
+#ifdef HAVE_PTHREAD
+  if(reader->thread_ok!=0)
+  {
+    pthread_mutex_lock(&reader->mutex);
+    while(reader->status==PREADER_PENDING)
+      pthread_cond_wait(&reader->cond, &reader->mutex);
+    reader->status=PREADER_QUIT;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->mutex);
+    pthread_join(reader->thread, NULL);
+  }
+  pthread_cond_destroy(&reader->cond);
+  pthread_mutex_destroy(&reader->mutex);
+#endif
+  free(reader->pool);
+  free(reader);
+}
@@ -0,0 +1,77 @@
+/*
+
+    File: preader.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PREADER_H
+#define _PREADER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reader stage of the carving loop: while the current window is checked
+ * for known headers, the next window is read by a background thread.
+ * The last windows read are kept, a read inside them after a backtrack
+ * only gets the missing tail from the disk.
+ * Without thread support, the next window isn't read in advance. */
+typedef struct preader_struct preader_t;
+
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires size > 0;
+  @ ensures  \valid(\result);
+  @*/
+preader_t *preader_new(disk_t *disk, const unsigned int size);
+
+/*@
+  @ requires \valid(reader);
+  @*/
+void preader_prefetch(preader_t *reader, const uint64_t offset);
+
+/*@
+  @ requires \valid(reader);
+  @ requires \valid(buffer);
+  @ requires \separated(reader, buffer);
+  @*/
+int preader_pread(preader_t *reader, unsigned char *buffer, const uint64_t offset);
+
+/* Time the scan has waited for the disk in preader_pread(), in ns */
+/*@
+  @ requires \valid_read(reader);
+  @ assigns \nothing;
+  @*/
+uint64_t preader_stall(const preader_t *reader);
+
+/* Wait for the background read to complete: the disk can then be used
+ * directly, the data read is still returned by the next preader_pread() */
+/*@
+  @ requires \valid(reader);
+  @*/
+void preader_sync(preader_t *reader);
+
+/*@
+  @ requires reader == \null || \valid(reader);
+  @*/
+void preader_free(preader_t *reader);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
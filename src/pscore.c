@@ -0,0 +1,516 @@
+/*
+
+    File: pscore.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "ext2_common.h"
+#include "fat_common.h"
+#include "ntfs.h"
+#include "xfs.h"
+#include "log.h"
+#include "log_part.h"
+#include "pscore.h"
+
+/* Reads of metadata for a partition, all of the same size */
+#define PSCORE_NBR		16
+#define PSCORE_SIZE_MAX		(64*1024)
+#define PSCORE_NTFS_RECORDS	16
+
+#ifndef EXT4_FEATURE_INCOMPAT_FLEX_BG
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG	0x0200
+#endif
+#define PSCORE_EXT2_OLD_INODE_SIZE	128
+
+#ifndef XFS_AGI_MAGIC
+#define XFS_AGI_MAGIC		0x58414749	/* 'XAGI' */
+#endif
+
+typedef struct
+{
+  const partition_t *partition;
+  unsigned char *header;	/* boot sector or superblock */
+  unsigned char *meta;		/* nbr reads of size bytes */
+  uint64_t offset[PSCORE_NBR];
+  unsigned int nbr;
+  unsigned int size;
+  unsigned int items;		/* structures checked */
+  int score;
+} pscore_t;
+
+/* Location of the boot sector or superblock, 0 if the filesystem isn't handled */
+static unsigned int pscore_header(const partition_t *partition, uint64_t *offset)
+{
+  switch(partition->upart_type)
+  {
+    case UP_EXT2:
+    case UP_EXT3:
+    case UP_EXT4:
+      *offset=partition->part_offset + (partition->sb_offset==0 ? 0x400 : partition->sb_offset);
+      return EXT2_SUPERBLOCK_SIZE;
+    case UP_FAT12:
+    case UP_FAT16:
+    case UP_FAT32:
+    case UP_NTFS:
+    case UP_XFS:
+    case UP_XFS2:
+    case UP_XFS3:
+    case UP_XFS4:
+    case UP_XFS5:
+      *offset=partition->part_offset + partition->sb_offset;
+      return DEFAULT_SECTOR_SIZE;
+    default:
+      return 0;
+  }
+}
+
+static int pscore_plan_ntfs(pscore_t *p)
+{
+  const struct ntfs_boot_sector *ntfs_header=(const struct ntfs_boot_sector *)p->header;
+  const unsigned int sector_size=ntfs_sector_size(ntfs_header);
+  const unsigned int spc=ntfs_header->sectors_per_cluster;
+  uint64_t cluster_size;
+  uint64_t record_size;
+  if(memcmp(ntfs_header->system_id, "NTFS    ", 8)!=0 ||
+      sector_size < 256 || sector_size > 4096 || (sector_size & (sector_size-1))!=0 ||
+      spc==0)
+    return -1;
+  cluster_size=(uint64_t)sector_size * (spc <= 0x80 ? spc : (1U << ((256 - spc) & 0x1f)));
+  if(ntfs_header->clusters_per_mft_record > 0)
+    record_size=cluster_size * ntfs_header->clusters_per_mft_record;
+  else
+    record_size=(uint64_t)1 << ((-ntfs_header->clusters_per_mft_record) & 0x3f);
+  if(record_size < 512 || record_size * PSCORE_NTFS_RECORDS > PSCORE_SIZE_MAX ||
+      (record_size & (record_size-1))!=0)
+    return -1;
+  p->offset[0]=p->partition->part_offset + le64(ntfs_header->mft_lcn) * cluster_size;
+  p->nbr=1;
+  p->size=record_size * PSCORE_NTFS_RECORDS;
+  p->items=PSCORE_NTFS_RECORDS;
+  return 0;
+}
+
+/* MFT record: magic, update sequence array (fixup) and record number */
+static unsigned int pscore_check_ntfs(const pscore_t *p)
+{
+  const unsigned int record_size=p->size / PSCORE_NTFS_RECORDS;
+  unsigned int valid=0;
+  unsigned int i;
+  for(i=0; i<PSCORE_NTFS_RECORDS; i++)
+  {
+    const unsigned char *record=&p->meta[i * record_size];
+    const unsigned int usa_ofs=le16(*(const uint16_t *)&record[4]);
+    const unsigned int usa_count=le16(*(const uint16_t *)&record[6]);
+    unsigned int j;
+    if(memcmp(record, "FILE", 4)!=0 ||
+	usa_count != record_size / 512 + 1 ||
+	usa_ofs < 0x28 || usa_ofs + 2 * usa_count > record_size)
+      continue;
+    for(j=1; j<usa_count && memcmp(&record[j * 512 - 2], &record[usa_ofs], 2)==0; j++);
+    if(j<usa_count)
+      continue;
+    /* NTFS 3.1 stores the record number */
+    if(usa_ofs >= 0x30 && le32(*(const uint32_t *)&record[0x2C])!=i)
+      continue;
+    valid++;
+  }
+  return valid;
+}
+
+static int pscore_plan_ext2(pscore_t *p)
+{
+  const struct ext2_super_block *sb=(const struct ext2_super_block *)p->header;
+  unsigned int blocksize;
+  unsigned int desc_size;
+  uint64_t groups_nbr;
+  uint64_t sb_block;
+  if(le16(sb->s_magic)!=EXT2_SUPER_MAGIC || le32(sb->s_log_block_size) > 6 ||
+      le32(sb->s_blocks_per_group)==0 || le32(sb->s_inodes_per_group)==0)
+    return -1;
+  blocksize=EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size);
+  desc_size=(EXT2_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_64BIT) && le16(sb->s_desc_size) >= 64 ?
+      le16(sb->s_desc_size) : 32);
+  if(desc_size > blocksize || td_ext2fs_blocks_count(sb) <= le32(sb->s_first_data_block))
+    return -1;
+  groups_nbr=(td_ext2fs_blocks_count(sb) - le32(sb->s_first_data_block) + le32(sb->s_blocks_per_group) - 1) /
+    le32(sb->s_blocks_per_group);
+  /* The group descriptors follow the primary or the backup superblock */
+  sb_block=(p->partition->sb_offset==0 ? le32(sb->s_first_data_block) : p->partition->sb_offset / blocksize);
+  p->items=(groups_nbr < PSCORE_NBR ? groups_nbr : PSCORE_NBR);
+  if(p->items > blocksize / desc_size)
+    p->items=blocksize / desc_size;
+  p->offset[0]=p->partition->part_offset + (sb_block + 1) * blocksize;
+  p->nbr=1;
+  p->size=p->items * desc_size;
+  return 0;
+}
+
+/* Group descriptor: bitmaps and inode table inside the filesystem,
+ * inside the group itself without flex_bg, and sane free counts */
+static unsigned int pscore_check_ext2(const pscore_t *p)
+{
+  const struct ext2_super_block *sb=(const struct ext2_super_block *)p->header;
+  const unsigned int blocksize=EXT2_MIN_BLOCK_SIZE<<le32(sb->s_log_block_size);
+  const unsigned int desc_size=p->size / p->items;
+  const uint64_t blocks_count=td_ext2fs_blocks_count(sb);
+  const uint64_t first=le32(sb->s_first_data_block);
+  const uint64_t blocks_per_group=le32(sb->s_blocks_per_group);
+  const unsigned int inodes_per_group=le32(sb->s_inodes_per_group);
+  const unsigned int inode_size=(le32(sb->s_rev_level)==0 ? PSCORE_EXT2_OLD_INODE_SIZE : le16(sb->s_inode_size));
+  const uint64_t table_blocks=((uint64_t)inodes_per_group * inode_size + blocksize - 1) / blocksize;
+  const int flex_bg=EXT2_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_FLEX_BG);
+  unsigned int valid=0;
+  unsigned int i;
+  for(i=0; i<p->items; i++)
+  {
+    const unsigned char *desc=&p->meta[i * desc_size];
+    uint64_t block_bitmap=le32(*(const uint32_t *)&desc[0]);
+    uint64_t inode_bitmap=le32(*(const uint32_t *)&desc[4]);
+    uint64_t inode_table=le32(*(const uint32_t *)&desc[8]);
+    if(desc_size >= 64)
+    {
+      block_bitmap|=(uint64_t)le32(*(const uint32_t *)&desc[0x20])<<32;
+      inode_bitmap|=(uint64_t)le32(*(const uint32_t *)&desc[0x24])<<32;
+      inode_table|=(uint64_t)le32(*(const uint32_t *)&desc[0x28])<<32;
+    }
+    if(block_bitmap <= first || block_bitmap >= blocks_count ||
+	inode_bitmap <= first || inode_bitmap >= blocks_count ||
+	inode_table <= first || inode_table + table_blocks > blocks_count ||
+	le16(*(const uint16_t *)&desc[0x0C]) > blocks_per_group ||
+	le16(*(const uint16_t *)&desc[0x0E]) > inodes_per_group)
+      continue;
+    if(flex_bg==0)
+    {
+      const uint64_t start=first + i * blocks_per_group;
+      if(block_bitmap < start || block_bitmap >= start + blocks_per_group ||
+	  inode_bitmap < start || inode_bitmap >= start + blocks_per_group ||
+	  inode_table < start || inode_table >= start + blocks_per_group)
+	continue;
+    }
+    valid++;
+  }
+  return valid;
+}
+
+/* Allocation groups spread over the filesystem */
+static unsigned int pscore_xfs_ag(const pscore_t *p, const unsigned int i)
+{
+  const struct xfs_sb *sb=(const struct xfs_sb *)p->header;
+  return (uint64_t)i * be32(sb->sb_agcount) / p->nbr;
+}
+
+static int pscore_plan_xfs(pscore_t *p)
+{
+  const struct xfs_sb *sb=(const struct xfs_sb *)p->header;
+  const unsigned int blocksize=be32(sb->sb_blocksize);
+  const unsigned int sectsize=be16(sb->sb_sectsize);
+  const unsigned int agcount=be32(sb->sb_agcount);
+  unsigned int i;
+  if(be32(sb->sb_magicnum)!=XFS_SB_MAGIC ||
+      blocksize < 512 || blocksize > 65536 ||
+      sectsize < 512 || 3 * sectsize > PSCORE_SIZE_MAX ||
+      agcount==0 || be32(sb->sb_agblocks)==0)
+    return -1;
+  p->nbr=(agcount < PSCORE_NBR ? agcount : PSCORE_NBR);
+  p->size=3 * sectsize;
+  p->items=3 * p->nbr;
+  for(i=0; i<p->nbr; i++)
+    p->offset[i]=p->partition->part_offset +
+      (uint64_t)pscore_xfs_ag(p, i) * be32(sb->sb_agblocks) * blocksize;
+  return 0;
+}
+
+/* Superblock, free space and inode headers of each allocation group */
+static unsigned int pscore_check_xfs(const pscore_t *p)
+{
+  const struct xfs_sb *sb=(const struct xfs_sb *)p->header;
+  const unsigned int sectsize=p->size / 3;
+  unsigned int valid=0;
+  unsigned int i;
+  for(i=0; i<p->nbr; i++)
+  {
+    const unsigned char *ag=&p->meta[i * p->size];
+    const struct xfs_sb *ag_sb=(const struct xfs_sb *)ag;
+    const uint32_t *agf=(const uint32_t *)&ag[sectsize];
+    const uint32_t *agi=(const uint32_t *)&ag[2 * sectsize];
+    const unsigned int agno=pscore_xfs_ag(p, i);
+    if(be32(ag_sb->sb_magicnum)==XFS_SB_MAGIC && ag_sb->sb_agblocks==sb->sb_agblocks &&
+	ag_sb->sb_blocksize==sb->sb_blocksize)
+      valid++;
+    if(be32(agf[0])==XFS_AGF_MAGIC && be32(agf[2])==agno)
+      valid++;
+    if(be32(agi[0])==XFS_AGI_MAGIC && be32(agi[2])==agno)
+      valid++;
+  }
+  return valid;
+}
+
+static int pscore_plan_fat(pscore_t *p)
+{
+  const struct fat_boot_sector *fat_header=(const struct fat_boot_sector *)p->header;
+  const unsigned int sector_size=fat_sector_size(fat_header);
+  const uint64_t fat_length=(p->partition->upart_type==UP_FAT32 ?
+      le32(fat_header->fat32_length) : le16(fat_header->fat_length));
+  uint64_t root;
+  if(sector_size < 512 || sector_size > 4096 || (sector_size & (sector_size-1))!=0 ||
+      fat_header->sectors_per_cluster==0 || fat_header->fats==0 || fat_length==0)
+    return -1;
+  root=(le16(fat_header->reserved) + fat_header->fats * fat_length) * sector_size;
+  if(p->partition->upart_type==UP_FAT32)
+  {
+    if(le32(fat_header->root_cluster) < 2)
+      return -1;
+    root+=(uint64_t)(le32(fat_header->root_cluster) - 2) * fat_header->sectors_per_cluster * sector_size;
+  }
+  /* First sector of the two FATs and of the root directory */
+  p->nbr=3;
+  p->size=sector_size;
+  p->offset[0]=p->partition->part_offset + (uint64_t)le16(fat_header->reserved) * sector_size;
+  p->offset[1]=p->offset[0] + (fat_header->fats > 1 ? fat_length * sector_size : 0);
+  p->offset[2]=p->partition->part_offset + root;
+  p->items=0;
+  return 0;
+}
+
+/*@
+  @ requires \valid_read(entry + (0 .. 31));
+  @ assigns \nothing;
+  @*/
+static int pscore_fat_entry(const unsigned char *entry, const uint64_t clusters)
+{
+  unsigned int i;
+  if(entry[0x0B]==0x0F)
+  { /* Long file name, the cluster field is always 0 */
+    return (entry[0x1A]==0 && entry[0x1B]==0);
+  }
+  if((entry[0x0B] & 0xC0)!=0 || entry[0]==' ')
+    return 0;
+  for(i=0; i<11; i++)
+    if(entry[i] < 0x20 && !(i==0 && entry[0]==0x05))
+      return 0;
+  return ((le16(*(const uint16_t *)&entry[0x1A]) | ((uint64_t)le16(*(const uint16_t *)&entry[0x14])<<16)) < clusters + 2);
+}
+
+/* Media byte at the start of the FAT, the FAT copies are identical,
+ * the root directory entries up to the first free one are sane */
+static unsigned int pscore_check_fat(pscore_t *p)
+{
+  const struct fat_boot_sector *fat_header=(const struct fat_boot_sector *)p->header;
+  const unsigned char *fat1=p->meta;
+  const unsigned char *fat2=&p->meta[p->size];
+  const unsigned char *root=&p->meta[2 * p->size];
+  const uint64_t clusters=p->partition->part_size /
+    ((uint64_t)fat_header->sectors_per_cluster * p->size);
+  unsigned int valid=0;
+  unsigned int i;
+  p->items=1;
+  if(fat1[0]==fat_header->media && fat1[1]==0xFF && fat1[2]==0xFF)
+    valid++;
+  if(fat_header->fats > 1)
+  {
+    p->items++;
+    if(memcmp(fat1, fat2, p->size)==0)
+      valid++;
+  }
+  for(i=0; i<p->size && root[i]!=0; i+=32)
+  {
+    p->items++;
+    if(pscore_fat_entry(&root[i], clusters)!=0)
+      valid++;
+  }
+  return valid;
+}
+
+static int pscore_plan(pscore_t *p)
+{
+  switch(p->partition->upart_type)
+  {
+    case UP_EXT2:
+    case UP_EXT3:
+    case UP_EXT4:
+      return pscore_plan_ext2(p);
+    case UP_FAT12:
+    case UP_FAT16:
+    case UP_FAT32:
+      return pscore_plan_fat(p);
+    case UP_NTFS:
+      return pscore_plan_ntfs(p);
+    default:
+      return pscore_plan_xfs(p);
+  }
+}
+
+static unsigned int pscore_check(pscore_t *p)
+{
+  switch(p->partition->upart_type)
+  {
+    case UP_EXT2:
+    case UP_EXT3:
+    case UP_EXT4:
+      return pscore_check_ext2(p);
+    case UP_FAT12:
+    case UP_FAT16:
+    case UP_FAT32:
+      return pscore_check_fat(p);
+    case UP_NTFS:
+      return pscore_check_ntfs(p);
+    default:
+      return pscore_check_xfs(p);
+  }
+}
+
+/* Score the partitions together: the headers of all the candidates are
+ * read by a single batch, then their metadata by a second one */
+static void pscore_run(disk_t *disk, pscore_t *scores, const unsigned int nbr)
+{
+  disk_read_t *reads=(disk_read_t *)MALLOC(nbr * PSCORE_NBR * sizeof(disk_read_t));
+  unsigned int n=0;
+  unsigned int i;
+  for(i=0; i<nbr; i++)
+  {
+    pscore_t *p=&scores[i];
+    uint64_t offset;
+    const unsigned int size=pscore_header(p->partition, &offset);
+    p->header=NULL;
+    p->meta=NULL;
+    p->score=-1;
+    if(size==0)
+      continue;
+    p->score=0;
+    p->header=(unsigned char *)MALLOC(EXT2_SUPERBLOCK_SIZE);
+    memset(p->header, 0, EXT2_SUPERBLOCK_SIZE);
+    reads[n].offset=offset;
+    reads[n].count=size;
+    reads[n].buffer=p->header;
+    n++;
+  }
+  disk_pread_batch(disk, reads, n);
+  n=0;
+  for(i=0; i<nbr; i++)
+  {
+    pscore_t *p=&scores[i];
+    if(p->header==NULL)
+      continue;
+    if(reads[n].res!=(int)reads[n].count)
+    {
+      free(p->header);
+      p->header=NULL;
+    }
+    n++;
+  }
+  /* Metadata */
+  n=0;
+  for(i=0; i<nbr; i++)
+  {
+    pscore_t *p=&scores[i];
+    unsigned int j;
+    if(p->header==NULL || pscore_plan(p)!=0)
+      continue;
+    p->meta=(unsigned char *)MALLOC(p->nbr * p->size);
+    for(j=0; j<p->nbr; j++)
+    {
+      reads[n].offset=p->offset[j];
+      reads[n].count=p->size;
+      reads[n].buffer=&p->meta[j * p->size];
+      n++;
+    }
+  }
+  disk_pread_batch(disk, reads, n);
+  n=0;
+  for(i=0; i<nbr; i++)
+  {
+    pscore_t *p=&scores[i];
+    unsigned int j;
+    unsigned int failed=0;
+    if(p->meta==NULL)
+      continue;
+    for(j=0; j<p->nbr; j++, n++)
+      if(reads[n].res!=(int)reads[n].count)
+	failed++;
+    if(failed==0)
+    {
+      const unsigned int valid=pscore_check(p);
+      if(p->items > 0)
+	p->score=valid * 100 / p->items;
+    }
+    free(p->meta);
+    p->meta=NULL;
+  }
+  for(i=0; i<nbr; i++)
+    free(scores[i].header);
+  free(reads);
+}
+
+int partition_score(disk_t *disk, const partition_t *partition)
+{
+  pscore_t p;
+  p.partition=partition;
+  pscore_run(disk, &p, 1);
+  return p.score;
+}
+
+static int pscore_cmp(const void *a, const void *b)
+{
+  const pscore_t *pa=(const pscore_t *)a;
+  const pscore_t *pb=(const pscore_t *)b;
+  if(pa->score != pb->score)
+    return (pa->score > pb->score ? -1 : 1);
+  if(pa->partition->part_offset != pb->partition->part_offset)
+    return (pa->partition->part_offset < pb->partition->part_offset ? -1 : 1);
+  return 0;
+}
+
+void partition_score_list(disk_t *disk, const list_part_t *list_part)
+{
+  const list_part_t *element;
+  pscore_t *scores;
+  unsigned int nbr=0;
+  unsigned int i;
+  for(element=list_part; element!=NULL; element=element->next)
+    nbr++;
+  if(nbr==0)
+    return;
+  scores=(pscore_t *)MALLOC(nbr * sizeof(pscore_t));
+  for(element=list_part, i=0; element!=NULL; element=element->next, i++)
+    scores[i].partition=element->part;
+  pscore_run(disk, scores, nbr);
+  qsort(scores, nbr, sizeof(pscore_t), pscore_cmp);
+  log_info("\nQuick check of the partitions found\n");
+  for(i=0; i<nbr; i++)
+  {
+    if(scores[i].score < 0)
+      log_info("   - ");
+    else
+      log_info("%3d%% ", scores[i].score);
+    log_partition(disk, scores[i].partition);
+  }
+  free(scores);
+}
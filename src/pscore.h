@@ -0,0 +1,54 @@
+/*
+
+    File: pscore.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PSCORE_H
+#define _PSCORE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Quick check of the partitions found by the deep search: instead of
+ * opening each filesystem, a few key structures are read and checked,
+ * NTFS MFT records 0-15, ext2/3/4 group descriptors, XFS allocation group
+ * headers, FAT tables and root directory.
+ * The score is the percentage of valid structures, -1 if the filesystem
+ * isn't handled */
+
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires \valid_read(partition);
+  @*/
+int partition_score(disk_t *disk, const partition_t *partition);
+
+/* Score every partition of the list, the candidates are checked together
+ * so their reads are grouped, and log them from the best to the worst */
+/*@
+  @ requires \valid(disk);
+  @ requires valid_disk(disk);
+  @ requires valid_list_part(list_part);
+  @*/
+void partition_score_list(disk_t *disk, const list_part_t *list_part);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -40,7 +40,7 @@ static inline alloc_data_t *file_add_data(alloc_data_t *data, const uint64_t off
   if(data->data==content)
     return data;
   {
-    alloc_data_t *datanext=(alloc_data_t*)MALLOC(sizeof(*datanext));
+    alloc_data_t *datanext=alloc_data_new();
     memcpy(datanext, data, sizeof(*datanext));
     data->end=offset-1;
     datanext->start=offset;
@@ -51,53 +51,57 @@ static inline alloc_data_t *file_add_data(alloc_data_t *data, const uint64_t off
   }
 }
 
-/*@
-  @ requires \valid(dst);
-  @ requires \valid_read(src);
-  @ requires \separated(dst, src);
-  @*/
-// assigns  *dst;
-static inline void file_recovery_cpy(file_recovery_t *dst, const file_recovery_t *src)
-{
-  memcpy(dst, src, sizeof(*dst));
-  dst->location.list.prev=&dst->location.list;
-  dst->location.list.next=&dst->location.list;
-}
-
-/* Check if the block looks like an indirect/double-indirect block */
+/* Check if the block block_nbr of the filesystem looks like the
+ * indirect, double or triple indirect block of a non-fragmented file:
+ * the pointers follow each other, the first one is the next block and
+ * they stay inside the filesystem. When next, the following block, is
+ * available, the first pointer of a double/triple indirect block must
+ * point just after it.
+ * On success, *data_blocks is the number of data blocks that follow */
 /*@
   @ requires blocksize >= 8;
   @ requires \valid_read(buffer + (0 .. blocksize-1));
-  @ assigns \result;
+  @ requires next==\null || \valid_read(next + (0 .. blocksize-1));
+  @ requires \valid(data_blocks);
+  @ assigns *data_blocks;
   @*/
-static inline int ind_block(const unsigned char *buffer, const unsigned int blocksize)
+static inline int ind_block(const unsigned char *buffer, const unsigned char *next, const unsigned int blocksize, const uint64_t block_nbr, const uint64_t nbr_blocks, unsigned int *data_blocks)
 {
   const uint32_t *p32=(const uint32_t *)buffer;
+  const unsigned int nbr_ptr=blocksize/4;
   unsigned int i;
-  unsigned int diff=1;	/* IND: Indirect block */
-  if(le32(p32[0])==0)
+  uint64_t diff=1;	/* IND: Indirect block */
+  if((uint64_t)le32(p32[0])!=block_nbr+1)
     return 0;
-  if(le32(p32[1])==le32(p32[0])+blocksize/4+1)
-    diff=blocksize/4+1;	/* DIND: Double Indirect block */
+  if(le32(p32[1])==le32(p32[0])+nbr_ptr+1)
+    diff=nbr_ptr+1;	/* DIND: Double Indirect block */
+  else if((uint64_t)le32(p32[1])==(uint64_t)le32(p32[0])+(uint64_t)nbr_ptr*(nbr_ptr+1)+1)
+    diff=(uint64_t)nbr_ptr*(nbr_ptr+1)+1;	/* TIND: Triple Indirect block */
   /*@
     @ loop assigns i;
     @*/
-  for(i=0;i<blocksize/4-1 && le32(p32[i+1])!=0;i++)
+  for(i=0;i<nbr_ptr-1 && le32(p32[i+1])!=0;i++)
   {
-    if(le32(p32[i+1])!=le32(p32[i])+diff)
+    if((uint64_t)le32(p32[i+1])!=(uint64_t)le32(p32[i])+diff)
     {
       return 0;
     }
   }
+  if((uint64_t)le32(p32[i]) >= nbr_blocks)
+    return 0;
   i++;
+  *data_blocks=(diff==1 ? i : 0);
   /*@
     @ loop assigns i;
     @*/
-  for(;i<blocksize/4 && le32(p32[i])==0;i++);
-  if(i<blocksize/4)
+  for(;i<nbr_ptr && le32(p32[i])==0;i++);
+  if(i<nbr_ptr)
   {
     return 0;
   }
+  /* The next block is the first indirect block it refers to */
+  if(diff > 1 && next!=NULL && (uint64_t)le32(((const uint32_t *)next)[0])!=block_nbr+2)
+    return 0;
   return 1;	/* Ok: ind_block points to non-fragmented block */
 }
 
@@ -72,10 +72,90 @@
 #include "phnc.h"
 #endif
 #include "psearchn.h"
+#include "pstream.h"
+#include "phash.h"
+#include "pindex.h"
+#include "pblockmap.h"
+#include "phits.h"
+#include "pdest.h"
+#include "paffinity.h"
+#include "pprobe.h"
+#include "pprune.h"
+#include "pdepth.h"
+#include "pfilter.h"
+#include "preader.h"
+#include "pcheck.h"
 #include "photorec_check_header.h"
+#include "hdaccess.h"
+#include "srchash.h"
+#include "ptune.h"
+#include "pspec.h"
+#include "pcontrol.h"
 #define READ_SIZE 1024*512
 extern int need_to_stop;
 
+#ifndef DISABLED_FOR_FRAMAC
+/* The track of pspec becomes the file in progress, at the header the
+ * scan has gone back to. Return 1 if the scan can go on at resume. */
+static int photorec_spec_commit(file_recovery_t *file_recovery, struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, alloc_data_t **current_search_space, uint64_t *offset, const uint64_t resume)
+{
+  const file_recovery_t *header=pspec_candidate(list_search_space, *current_search_space, *offset, resume, params);
+  pfstatus_t file_recovered;
+  int64_t blocks;
+  int64_t i;
+  if(header==NULL)
+    return 0;
+  if(photorec_header_found(header, file_recovery, params, options, list_search_space, pspec_header_data(), &file_recovered, *offset)!=PSTATUS_OK)
+  {
+    /* Going back gives the same error */
+    reset_file_recovery(file_recovery);
+    pspec_drop();
+    return 0;
+  }
+  blocks=pspec_commit(file_recovery);
+  if(blocks < 0)
+  {
+    file_recovery_aborted(file_recovery, params, list_search_space);
+    return 0;
+  }
+  for(i=0; i<blocks; i++)
+    file_block_append(file_recovery, list_search_space, current_search_space, offset, params->blocksize, 1);
+  if(options->verbose > 1)
+    log_verbose("%s continued at sector %llu without going back\n", file_recovery->filename,
+	(long long unsigned)((*offset - params->partition->part_offset) / params->disk->sector_size));
+  return 1;
+}
+
+/* Number of blocks of the extent of the file that can be appended at once:
+ * they must be contiguous in the search space and in the read buffer, and
+ * the size limits checked after each block must not be reached before the
+ * last one. buffer_left is at least one block. */
+static unsigned int photorec_extent_blocks(const file_recovery_t *file_recovery, const struct ph_param *params, const alloc_data_t *current_search_space, const uint64_t offset, const unsigned int buffer_left)
+{
+  const unsigned int blocksize=params->blocksize;
+  const uint64_t max_filesize=file_recovery->file_stat->file_hint->max_filesize;
+  const uint64_t left=file_data_extent_left(file_recovery);
+  uint64_t nbr=buffer_left/blocksize;
+  if(left==0)
+    return 1;
+  if(nbr > (left-1)/blocksize)
+    nbr=(left-1)/blocksize;
+  if(nbr > (current_search_space->end + 1 - offset)/blocksize)
+    nbr=(current_search_space->end + 1 - offset)/blocksize;
+  if(max_filesize>0 && file_recovery->file_size < max_filesize &&
+      nbr > (max_filesize - file_recovery->file_size - 1)/blocksize + 1)
+    nbr=(max_filesize - file_recovery->file_size - 1)/blocksize + 1;
+  if(is_fat(params->partition))
+  {
+    if(file_recovery->file_size + 2*blocksize >= PHOTOREC_MAX_SIZE_32)
+      return 1;
+    if(nbr > (PHOTOREC_MAX_SIZE_32 - file_recovery->file_size - blocksize - 1)/blocksize)
+      nbr=(PHOTOREC_MAX_SIZE_32 - file_recovery->file_size - blocksize - 1)/blocksize;
+  }
+  return (nbr > 0 ? nbr : 1);
+}
+#endif
+
 pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
 {
   pstatus_t ind_stop=PSTATUS_OK;
@@ -88,13 +168,26 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
   time_t previous_time;
   time_t next_checkpoint;
   const unsigned int blocksize=params->blocksize; 
-  const unsigned int buffer_size=blocksize + READ_SIZE;
-  /*@ assert buffer_size==blocksize + READ_SIZE; */
+#ifndef DISABLED_FOR_FRAMAC
+  /* Read window measured on the device, READ_SIZE by default */
+  const unsigned int read_window=ptune_read_size(params, blocksize, READ_SIZE);
+#else
+  const unsigned int read_window=READ_SIZE;
+#endif
+  const unsigned int buffer_size=blocksize + read_window;
+  /*@ assert buffer_size==blocksize + read_window; */
   const unsigned int read_size=(blocksize>65536?blocksize:65536);
+  /* Distance between two consecutive window reads when scanning contiguous data */
+  const unsigned int read_step=(read_window > read_size ? (read_window - read_size) / blocksize + 1 : 1) * blocksize;
+  preader_t *reader;
+  srchash_t *srchash=NULL;
   uint64_t offset_before_back=0;
   unsigned int back=0;
+  /* ext2/ext3: end of the data blocks listed by the last indirect block */
+  uint64_t ind_data_end=0;
+  uint64_t ind_file_start=0;
   /*@ assert blocksize == 512; */
-  /*@ assert buffer_size == blocksize + READ_SIZE ; */
+  /*@ assert buffer_size == blocksize + read_window ; */
 #ifdef DISABLED_FOR_FRAMAC
   char buffer_start_tmp[512+READ_SIZE];
 #endif
@@ -106,18 +199,20 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
   file_recovery.blocksize=blocksize;
   /*@ assert valid_file_recovery(&file_recovery); */
 #ifndef DISABLED_FOR_FRAMAC
-  buffer_start=(unsigned char *)MALLOC(buffer_size);
+  paffinity_setup(params);
+  buffer_start=(unsigned char *)MALLOC_IO(buffer_size);
+  paffinity_bind_buffer(buffer_start, buffer_size);
 #else
   buffer_start=&buffer_start_tmp;
 #endif
   /*@ assert \valid((char *)buffer_start + (0 .. buffer_size-1)); */
   buffer_olddata=buffer_start;
   buffer=buffer_olddata+blocksize;
-  /*@ assert \valid(buffer_start + (0 .. blocksize + READ_SIZE-1)); */
-  /*@ assert \valid(buffer + (0 .. READ_SIZE-1)); */
+  /*@ assert \valid(buffer_start + (0 .. blocksize + read_window-1)); */
+  /*@ assert \valid(buffer + (0 .. read_window-1)); */
   start_time=time(NULL);
   previous_time=start_time;
-  next_checkpoint=start_time+5*60;
+  next_checkpoint=regular_session_start(start_time);
   memset(buffer_olddata,0,blocksize);
   current_search_space=td_list_first_entry(&list_search_space->list, alloc_data_t, list);
   offset=set_search_start(params, &current_search_space, list_search_space);
@@ -131,8 +226,31 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	(unsigned long long)((params->partition->part_size-1)/params->disk->sector_size));
   }
 #endif
-  params->disk->pread(params->disk, buffer, READ_SIZE, offset);
+  reader=preader_new(params->disk, read_window);
+#ifndef DISABLED_FOR_FRAMAC
+  /* Only the main scan of the whole partition reads it in order. The
+   * gaps are read by srchash_update() when no read-ahead is pending */
+  if(srchash_enabled() &&
+      (params->status==STATUS_EXT2_ON || params->status==STATUS_EXT2_OFF) &&
+      params->offset_end==PH_INVALID_OFFSET)
+    srchash=srchash_new(params->disk, params->partition->part_offset, params->partition->part_size);
+  if(preader_pread(reader, buffer, offset) == (signed)read_window)
+    srchash_update(srchash, buffer, read_window, offset - params->partition->part_offset);
+#else
+  preader_pread(reader, buffer, offset);
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+  /* While the next window is read, the one after is loaded asynchronously.
+   * The advice is given before the prefetch: the disk layers are not
+   * called by the scan thread while the reader thread is in pread() */
+  disk_advise(params->disk, offset + 2 * (uint64_t)read_step, read_window, TESTDISK_ADVISE_WILLNEED);
+#endif
+  preader_prefetch(reader, offset + read_step);
   header_ignored(NULL);
+  pindex_start(params);
+  phits_start(params);
+  pprune_start(params);
+  pdepth_start();
 #ifndef DISABLED_FOR_FRAMAC
   /*@ loop invariant valid_file_recovery(&file_recovery); */
   while(current_search_space!=list_search_space)
@@ -143,6 +261,8 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
     pfstatus_t file_recovered=PFSTATUS_BAD;
     uint64_t old_offset=offset;
     data_check_t data_check_status=DC_SCAN;
+    int in_extent=0;
+    int spec_committed=0;
 #ifdef DEBUG
     log_debug("sector %llu\n",
         (unsigned long long)((offset-params->partition->part_offset)/params->disk->sector_size));
@@ -155,22 +275,68 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
       log_close();
       exit(1);
     }
+#endif
+#ifndef DISABLED_FOR_FRAMAC
+    /* Shard end reached: let the next shard handle the remaining data */
+    if(offset > params->offset_end && file_recovery.file_stat==NULL)
+    {
+      params->offset=offset;
+      break;
+    }
 #endif
     /*@ assert valid_file_recovery(&file_recovery); */
-    ind_stop=photorec_check_header(&file_recovery, params, options, list_search_space, buffer, &file_recovered, offset);
+    /* On random data, checking a block for a header is cheaper than an
+     * entropy estimate of the same block: there is nothing to gain by
+     * classifying encrypted or compressed areas first. */
+    pindex_scan(params, buffer, offset);
+    pblockmap_scan(params, buffer, offset);
+#ifndef DISABLED_FOR_FRAMAC
+    /* This block belongs to the file being recovered whatever it holds */
+    if(file_recovery.file_stat!=NULL)
+      in_extent=file_data_extent_covers(&file_recovery, blocksize);
+#endif
+    /* The blocks listed by an indirect block belong to the file */
+    if(in_extent==0 &&
+	!(file_recovery.file_stat!=NULL && file_recovery.location.start==ind_file_start &&
+	  offset < ind_data_end))
+    {
+#ifndef DISABLED_FOR_FRAMAC
+      const uint64_t skipped=header_ignored_offset();
+#endif
+      ind_stop=photorec_check_header(&file_recovery, params, options, list_search_space, buffer, &file_recovered, offset);
+#ifndef DISABLED_FOR_FRAMAC
+      pspec_header(&file_recovery, params, buffer, offset, skipped);
+#endif
+    }
     /*@ assert valid_file_recovery(&file_recovery); */
+#ifndef DISABLED_FOR_FRAMAC
+    if(file_recovery.file_stat!=NULL && file_recovery.location.start > params->offset_end)
+    {
+      /* This file belongs to the next shard */
+      file_recovery_aborted(&file_recovery, params, list_search_space);
+      break;
+    }
+#endif
     if(file_recovery.file_stat!=NULL)
     {
     /* try to skip ext2/ext3 indirect block */
+      unsigned int ind_data=0;
       if((params->status==STATUS_EXT2_ON || params->status==STATUS_EXT2_ON_SAVE_EVERYTHING) &&
           file_recovery.file_size >= 12*blocksize &&
-          ind_block(buffer,blocksize)!=0)
+	  !(file_recovery.location.start==ind_file_start && offset < ind_data_end) &&
+          ind_block(buffer, (read_size >= 2*blocksize ? buffer+blocksize : NULL), blocksize,
+	    (offset - params->partition->part_offset)/blocksize,
+	    params->partition->part_size/blocksize, &ind_data)!=0)
       {
+	/* Don't look for an indirect block among its data blocks */
+	ind_file_start=file_recovery.location.start;
+	ind_data_end=offset + (uint64_t)(ind_data + 1) * blocksize;
 	/*@ assert valid_file_recovery(&file_recovery); */
 	file_block_append(&file_recovery, list_search_space, &current_search_space, &offset, blocksize, 0);
 	/*@ assert valid_file_recovery(&file_recovery); */
 	data_check_status=DC_CONTINUE;
 #ifndef DISABLED_FOR_FRAMAC
+	pspec_drop();
         if(options->verbose > 1)
         {
           log_verbose("Skipping sector %10lu/%lu\n",
@@ -182,9 +348,20 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
       }
       else
       {
+	/* The blocks inside the extent of the file are appended at once */
+	unsigned int size=blocksize;
+#ifndef DISABLED_FOR_FRAMAC
+	if(in_extent!=0)
+	  size=photorec_extent_blocks(&file_recovery, params, current_search_space, offset,
+	      buffer_start + buffer_size - buffer - read_size + blocksize) * blocksize;
+#endif
 	if(file_recovery.handle!=NULL)
 	{
-	  if(fwrite(buffer,blocksize,1,file_recovery.handle)<1)
+#ifndef DISABLED_FOR_FRAMAC
+	  if(file_write(&file_recovery, buffer, size, blocksize)<0)
+#else
+	  if(fwrite(buffer,size,1,file_recovery.handle)<1)
+#endif
 	  { 
 #ifndef DISABLED_FOR_FRAMAC
 	    log_critical("Cannot write to file %s after %llu bytes: %s\n", file_recovery.filename, (long long unsigned)file_recovery.file_size, strerror(errno));
@@ -197,21 +374,49 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	    else
 	    {
 	      /* Warn the user */
+#ifndef DISABLED_FOR_FRAMAC
+	      pdest_full(params, file_recovery.filename);
+#endif
 	      ind_stop=PSTATUS_ENOSPC;
 	      params->offset=file_recovery.location.start;
 	    }
 	  }
+#ifndef DISABLED_FOR_FRAMAC
+	  else
+	  {
+	    file_tail_append(&file_recovery, buffer, size, file_recovery.file_size);
+	    pstream_block(&file_recovery, buffer, size);
+	    phash_block(&file_recovery, buffer, size, file_recovery.file_size);
+	  }
+#endif
 	}
 	if(ind_stop==PSTATUS_OK)
 	{
 	  /*@ assert valid_file_recovery(&file_recovery); */
-	  file_block_append(&file_recovery, list_search_space, &current_search_space, &offset, blocksize, 1);
+	  file_block_append(&file_recovery, list_search_space, &current_search_space, &offset, size, 1);
 	  /*@ assert valid_file_recovery(&file_recovery); */
-	  if(file_recovery.data_check!=NULL)
-	    data_check_status=file_recovery.data_check(buffer_olddata,2*blocksize,&file_recovery);
+	  if(file_recovery.data_check!=NULL && in_extent==0)
+	    data_check_status=file_data_check(buffer_olddata,2*blocksize,&file_recovery);
 	  else
 	    data_check_status=DC_CONTINUE;
-	  file_recovery.file_size+=blocksize;
+	  file_recovery.file_size+=size;
+#ifndef DISABLED_FOR_FRAMAC
+	  if(in_extent!=0)
+	    pspec_drop();
+	  else
+	    pspec_block(&file_recovery, params, buffer, old_offset, offset);
+	  /* Continue after the last block of the extent as if the blocks had
+	   * been appended one by one */
+	  while(size > blocksize)
+	  {
+	    size-=blocksize;
+	    buffer_olddata+=blocksize;
+	    buffer+=blocksize;
+	    old_offset+=blocksize;
+	    pindex_scan(params, buffer, old_offset);
+	    pblockmap_scan(params, buffer, old_offset);
+	  }
+#endif
 #ifndef DISABLED_FOR_FRAMAC
 	  if(data_check_status==DC_STOP)
 	  {
@@ -241,9 +446,15 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
       {
 	if(data_check_status==DC_ERROR)
 	  file_recovery.file_size=0;
+#ifndef DISABLED_FOR_FRAMAC
+	file_recovered=pcheck_file_finish(&file_recovery, params, options, list_search_space, reader);
+#else
 	file_recovered=file_finish2(&file_recovery, params, options->paranoid, list_search_space);
+#endif
 	if(options->lowmem > 0)
 	  forget(list_search_space,current_search_space);
+	else
+	  search_space_pack(list_search_space,current_search_space);
       }
     }
     if(ind_stop!=PSTATUS_OK)
@@ -255,6 +466,14 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
       file_recovery_aborted(&file_recovery, params, list_search_space);
       /*@ assert valid_file_recovery(&file_recovery); */
 #ifndef DISABLED_FOR_FRAMAC
+      pcheck_finish(params, list_search_space);
+      srchash_finish(srchash, NULL, 0);
+      forget_restore(list_search_space);
+      pspec_drop();
+      photorec_check_header_reset();
+      pindex_finish(params);
+      phits_finish();
+      preader_free(reader);
       free(buffer_start);
 #endif
       return ind_stop;
@@ -270,6 +489,7 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	      get_prev_file_header(list_search_space, &current_search_space, &offset)==0)
 	  {
 	    back++;
+	    PHOTOREC_PROBE2(backtrack, offset, back);
 	  }
 	  else
 	  {
@@ -279,7 +499,7 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	}
 	else
 	{
-	  get_next_sector(list_search_space, &current_search_space,&offset,blocksize);
+	  pindex_next_sector(list_search_space, &current_search_space,&offset,blocksize);
 	  if(offset > offset_before_back)
 	    back=0;
 	}
@@ -293,11 +513,20 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	  get_prev_file_header(list_search_space, &current_search_space, &offset)==0)
       {
 	back++;
+	PHOTOREC_PROBE2(backtrack, offset, back);
       }
       else
       {
 	back=0;
 	get_prev_location_smart(list_search_space, &current_search_space, &offset, file_recovery.location.start);
+#ifndef DISABLED_FOR_FRAMAC
+	/* The blocks since the header have already been checked */
+	if(photorec_spec_commit(&file_recovery, params, options, list_search_space, &current_search_space, &offset, offset_before_back)!=0)
+	{
+	  file_recovered=PFSTATUS_BAD;
+	  spec_committed=1;
+	}
+#endif
       }
     }
     if(current_search_space==list_search_space)
@@ -312,9 +541,19 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	get_prev_location_smart(list_search_space, &current_search_space, &offset, file_recovery.location.start);
       if(options->lowmem > 0)
 	forget(list_search_space,current_search_space);
+      else
+	search_space_pack(list_search_space,current_search_space);
     }
     buffer_olddata+=blocksize;
     buffer+=blocksize;
+#ifndef DISABLED_FOR_FRAMAC
+    /* Once per read, go back to the blocks given back by a check while
+     * no file is being carved */
+    if(file_recovery.file_stat==NULL &&
+	(current_search_space==list_search_space || buffer+read_size>buffer_start+buffer_size))
+      pcheck_collect(params, list_search_space, &current_search_space, &offset,
+	  (current_search_space==list_search_space ? 1 : 0));
+#endif
     if(file_recovered!=PFSTATUS_BAD ||
         old_offset+blocksize!=offset ||
         buffer+read_size>buffer_start+buffer_size)
@@ -323,6 +562,10 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
         memset(buffer_start,0,blocksize);
       else
         memcpy(buffer_start,buffer_olddata,blocksize);
+#ifndef DISABLED_FOR_FRAMAC
+      if(spec_committed!=0)
+	memcpy(buffer_start, pspec_last_block(), blocksize);
+#endif
       buffer_olddata=buffer_start;
       buffer=buffer_olddata + blocksize;
 #ifndef DISABLED_FOR_FRAMAC
@@ -333,7 +576,13 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	    (unsigned long long)((params->partition->part_size-1)/params->disk->sector_size));
       }
 #endif
-      if(params->disk->pread(params->disk, buffer, READ_SIZE, offset) != READ_SIZE)
+      if(preader_pread(reader, buffer, offset) == (signed)read_window)
+      {
+#ifndef DISABLED_FOR_FRAMAC
+	srchash_update(srchash, buffer, read_window, offset - params->partition->part_offset);
+#endif
+      }
+      else
       {
 #ifdef HAVE_NCURSES
 	wmove(stdscr,11,0);
@@ -342,16 +591,28 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 	    (unsigned long)((offset-params->partition->part_offset)/params->disk->sector_size));
 #endif
       }
+#ifndef DISABLED_FOR_FRAMAC
+      disk_advise(params->disk, offset + 2 * (uint64_t)read_step, read_window, TESTDISK_ADVISE_WILLNEED);
+#endif
+      preader_prefetch(reader, offset + read_step);
+#ifndef DISABLED_FOR_FRAMAC
+      pprune_update(params, read_window);
+      pdepth_update(preader_stall(reader));
+#endif
       if(ind_stop==PSTATUS_OK)
       {
         const time_t current_time=time(NULL);
         if(current_time>previous_time)
         {
+	  int checkpoint=0;
           previous_time=current_time;
 #ifdef HAVE_NCURSES
           ind_stop=photorec_progressbar(stdscr, params->pass, params, offset, current_time);
 #endif
 	  params->offset=offset;
+#ifndef DISABLED_FOR_FRAMAC
+	  checkpoint=pcontrol_poll(params, offset);
+#endif
 	  if(need_to_stop!=0 || ind_stop!=PSTATUS_OK)
 	  {
 #ifndef DISABLED_FOR_FRAMAC
@@ -359,18 +620,51 @@ pstatus_t photorec_aux(struct ph_param *params, const struct ph_options *options
 #endif
 	    file_recovery_aborted(&file_recovery, params, list_search_space);
 #ifndef DISABLED_FOR_FRAMAC
+	    pcheck_finish(params, list_search_space);
+	    srchash_finish(srchash, NULL, 0);
+	    forget_restore(list_search_space);
+	    pspec_drop();
+	    photorec_check_header_reset();
+	    pindex_finish(params);
+	    phits_finish();
+	    preader_free(reader);
 	    free(buffer_start);
 #endif
 	    return PSTATUS_STOP;
 	  }
-	  if(current_time >= next_checkpoint)
+	  if(current_time >= next_checkpoint || checkpoint!=0)
+	  {
+#ifndef DISABLED_FOR_FRAMAC
+	    /* The blocks of the files being checked are claimed only for now */
+	    pcheck_flush(params, list_search_space);
+#endif
+	    /* The disk cache saves its bad sectors with the session, the
+	     * read of the next window must be over */
+	    preader_sync(reader);
 	    next_checkpoint=regular_session_save(list_search_space, params, options, current_time);
+	  }
         }
       }
     }
+#ifndef DISABLED_FOR_FRAMAC
+    /* The track checks the blocks of the file in progress only */
+    if(file_recovery.file_stat==NULL)
+      pspec_drop();
+#endif
     file_recovered_old=file_recovered;
   } /* end while(current_search_space!=list_search_space) */
 #ifndef DISABLED_FOR_FRAMAC
+  pcheck_finish(params, list_search_space);
+  forget_restore(list_search_space);
+  pspec_drop();
+  pspec_log();
+  pfilter_log();
+  photorec_check_header_reset();
+  pindex_finish(params);
+  phits_finish();
+  preader_free(reader);
+  /* The areas after the last block searched are read now */
+  srchash_finish(srchash, params->disk, params->partition->part_offset);
   free(buffer_start);
 #endif
 #endif
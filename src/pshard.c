@@ -0,0 +1,537 @@
+/*
+
+    File: pshard.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_FORK
+#endif
+#if !defined(HAVE_SYS_WAIT_H) || !defined(HAVE_DIRENT_H)
+#undef HAVE_FORK
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_FORK
+#include <sys/wait.h>
+#include <dirent.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "hdpipe.h"
+#include "pblockmap.h"
+#include "log.h"
+#include "psearchn.h"
+#include "pshard.h"
+#include "sessionp.h"
+#include "dfxml.h"
+#include "ppack.h"
+#include "paffinity.h"
+
+/* Smaller shards are not worth a process */
+#define PSHARD_MIN_SIZE		(4*1024*1024)
+#define PSHARD_MAX_WORKERS	64
+#define PSHARD_IO_EXTENTS	4096
+
+#ifdef HAVE_FORK
+static int shard_write(const int fd, const void *buf, size_t size)
+{
+  const char *ptr=(const char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=write(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
+  return 0;
+}
+
+static int shard_read(const int fd, void *buf, size_t size)
+{
+  char *ptr=(char *)buf;
+  while(size > 0)
+  {
+    const ssize_t res=read(fd, ptr, size);
+    if(res < 0 && errno==EINTR)
+      continue;
+    if(res <= 0)
+      return -1;
+    ptr+=res;
+    size-=res;
+  }
+  return 0;
+}
+
+unsigned int shard_search_space_to_array(const alloc_data_t *list_search_space, shard_extent_t **extents)
+{
+  struct td_list_head *search_walker = NULL;
+  unsigned int nbr=0;
+  td_list_for_each(search_walker, &list_search_space->list)
+    nbr++;
+  *extents=(shard_extent_t *)MALLOC((nbr+1)*sizeof(shard_extent_t));
+  nbr=0;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    (*extents)[nbr].start=current_search_space->start;
+    (*extents)[nbr].end=current_search_space->end;
+    (*extents)[nbr].file_stat=current_search_space->file_stat;
+    (*extents)[nbr].data=current_search_space->data;
+    nbr++;
+  }
+  return nbr;
+}
+
+int shard_extents_contain(const shard_extent_t *extents, const unsigned int nbr, const uint64_t offset)
+{
+  unsigned int low=0;
+  unsigned int high=nbr;
+  while(low < high)
+  {
+    const unsigned int mid=low+(high-low)/2;
+    if(extents[mid].end < offset)
+      low=mid+1;
+    else if(extents[mid].start > offset)
+      high=mid;
+    else
+      return 1;
+  }
+  return 0;
+}
+
+/* Data is still unused if no worker has consumed it */
+unsigned int shard_extents_intersect(const shard_extent_t *a, const unsigned int nbr_a, const shard_extent_t *b, const unsigned int nbr_b, shard_extent_t **res)
+{
+  unsigned int i=0;
+  unsigned int j=0;
+  unsigned int nbr=0;
+  *res=(shard_extent_t *)MALLOC((nbr_a+nbr_b+1)*sizeof(shard_extent_t));
+  while(i < nbr_a && j < nbr_b)
+  {
+    const uint64_t start=(a[i].start > b[j].start ? a[i].start : b[j].start);
+    const uint64_t end=(a[i].end < b[j].end ? a[i].end : b[j].end);
+    if(start <= end)
+    {
+      shard_extent_t *new_extent=&(*res)[nbr++];
+      new_extent->start=start;
+      new_extent->end=end;
+      new_extent->file_stat=NULL;
+      /* Keep the header marks set by file_block_truncate_zero() */
+      if(start==a[i].start && a[i].file_stat!=NULL)
+	new_extent->file_stat=a[i].file_stat;
+      else if(start==b[j].start)
+	new_extent->file_stat=b[j].file_stat;
+      new_extent->data=a[i].data;
+    }
+    if(a[i].end < b[j].end)
+      i++;
+    else
+      j++;
+  }
+  return nbr;
+}
+
+void shard_split(const alloc_data_t *list_search_space, shard_t *shards, const unsigned int nbr_shards, const uint64_t shard_size)
+{
+  struct td_list_head *search_walker = NULL;
+  uint64_t done=0;
+  unsigned int k=0;
+  shards[0].start=td_list_first_entry(&list_search_space->list, alloc_data_t, list)->start;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    const uint64_t len=current_search_space->end - current_search_space->start + 1;
+    while(k+1 < nbr_shards && done + len > (k+1)*shard_size)
+    {
+      const uint64_t boundary=current_search_space->start + (k+1)*shard_size - done;
+      shards[k].end=boundary-1;
+      k++;
+      shards[k].start=boundary;
+    }
+    done+=len;
+  }
+  shards[k].end=PH_INVALID_OFFSET;
+}
+
+/* Headers located before the shard belong to the previous workers,
+ * get_prev_file_header() must not go back to them */
+void shard_forget_headers(alloc_data_t *list_search_space, const uint64_t start)
+{
+  struct td_list_head *search_walker = NULL;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    alloc_data_t *current_search_space=td_list_entry(search_walker, alloc_data_t, list);
+    if(current_search_space->start >= start)
+      return ;
+    search_space_set_file_stat(current_search_space, NULL);
+  }
+}
+
+static void shard_child(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const shard_t *shard, const unsigned int nbr_stats)
+{
+  struct td_list_head *search_walker = NULL;
+  shard_report_t report;
+  shard_extent_t *extents;
+  unsigned int i;
+  unsigned int nbr=0;
+  int res;
+  params->offset=shard->start;
+  params->offset_end=shard->end;
+  params->dir_num=shard->dir_num;
+  /* The parent saves the session once the search spaces are merged */
+  session_disable();
+  shard_forget_headers(list_search_space, shard->start);
+  memset(&report, 0, sizeof(report));
+  report.ind_stop=photorec_aux(params, options, list_search_space);
+  report.file_nbr=params->file_nbr;
+  report.dir_num=params->dir_num;
+  report.offset=params->offset;
+  td_list_for_each(search_walker, &list_search_space->list)
+    report.nbr++;
+  res=shard_write(shard->fd, &report, sizeof(report));
+  for(i=0; i<nbr_stats && res==0; i++)
+    res=shard_write(shard->fd, &params->file_stats[i], sizeof(file_stat_t));
+  extents=(shard_extent_t *)MALLOC(PSHARD_IO_EXTENTS*sizeof(shard_extent_t));
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    memset(&extents[nbr], 0, sizeof(shard_extent_t));
+    extents[nbr].start=current_search_space->start;
+    extents[nbr].end=current_search_space->end;
+    extents[nbr].file_stat=current_search_space->file_stat;
+    extents[nbr].data=current_search_space->data;
+    if(++nbr==PSHARD_IO_EXTENTS)
+    {
+      if(res==0)
+	res=shard_write(shard->fd, extents, nbr*sizeof(shard_extent_t));
+      nbr=0;
+    }
+  }
+  if(res==0 && nbr>0)
+    res=shard_write(shard->fd, extents, nbr*sizeof(shard_extent_t));
+  free(extents);
+  close(shard->fd);
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  file_rename_deferred();
+  ppack_close();
+  log_flush();
+  fflush(NULL);
+  _exit(res==0?0:1);
+}
+
+static void shard_wait(shard_t *shard, const unsigned int nbr_stats)
+{
+  int status=0;
+  shard->ok=0;
+  shard->file_stats=(file_stat_t *)MALLOC((nbr_stats+1)*sizeof(file_stat_t));
+  shard->extents=NULL;
+  if(shard_read(shard->fd, &shard->report, sizeof(shard->report))==0 &&
+      shard_read(shard->fd, shard->file_stats, nbr_stats*sizeof(file_stat_t))==0)
+  {
+    shard->extents=(shard_extent_t *)MALLOC((shard->report.nbr+1)*sizeof(shard_extent_t));
+    if(shard_read(shard->fd, shard->extents, shard->report.nbr*sizeof(shard_extent_t))==0)
+      shard->ok=1;
+  }
+  close(shard->fd);
+  while(waitpid(shard->pid, &status, 0) < 0 && errno==EINTR);
+  if(shard->ok==0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+  {
+    log_error("Shard %llu-%llu: worker %d failed, its data is kept in the search space\n",
+	(long long unsigned)shard->start, (long long unsigned)shard->end, (int)shard->pid);
+    shard->ok=0;
+  }
+}
+
+/* Add what a worker has counted since the fork */
+void shard_merge_stats(file_stat_t *file_stat, const file_stat_t *worker, const file_stat_t *base)
+{
+  file_stat->recovered+=worker->recovered - base->recovered;
+  file_stat->header_calls+=worker->header_calls - base->header_calls;
+  file_stat->header_hits+=worker->header_hits - base->header_hits;
+  file_stat->false_positives+=worker->false_positives - base->false_positives;
+  file_stat->header_ns+=worker->header_ns - base->header_ns;
+  file_stat->data_ns+=worker->data_ns - base->data_ns;
+  file_stat->file_ns+=worker->file_ns - base->file_ns;
+}
+
+/* Remove the files a worker found inside data consumed by a previous
+ * worker finishing a file across its shard boundary. */
+void shard_remove_duplicates(struct ph_param *params, const shard_t *shards, const unsigned int nbr_shards, const unsigned int nbr_stats, const shard_extent_t *orig, const unsigned int nbr_orig, const unsigned int dir_first)
+{
+  const char prefix=(params->status==STATUS_EXT2_ON_SAVE_EVERYTHING ||
+      params->status==STATUS_EXT2_OFF_SAVE_EVERYTHING ? 'b' : 'f');
+  unsigned int dir_num;
+  for(dir_num=dir_first; dir_num<=params->dir_num; dir_num++)
+  {
+    char dirname[2048];
+    DIR *dir;
+    struct dirent *entry;
+    snprintf(dirname, sizeof(dirname)-1, "%s.%u", params->recup_dir, dir_num);
+    dir=opendir(dirname);
+    if(dir==NULL)
+      continue;
+    while((entry=readdir(dir))!=NULL)
+    {
+      char *end;
+      uint64_t offset;
+      unsigned int i;
+      unsigned int owner;
+      if(entry->d_name[0]!=prefix || entry->d_name[1]<'0' || entry->d_name[1]>'9')
+	continue;
+      offset=params->partition->part_offset +
+	(uint64_t)strtoull(&entry->d_name[1], &end, 10) * params->disk->sector_size;
+      if(shard_extents_contain(orig, nbr_orig, offset)==0)
+	continue;
+      for(owner=nbr_shards-1; owner>0 && shards[owner].start > offset; owner--);
+      for(i=0; i<owner; i++)
+      {
+	if(shards[i].ok>0 &&
+	    shard_extents_contain(shards[i].extents, shards[i].report.nbr, offset)==0)
+	  break;
+      }
+      if(i<owner)
+      {
+	char filename[4096];
+	snprintf(filename, sizeof(filename)-1, "%s/%s", dirname, entry->d_name);
+	log_info("%s has been found inside a file from the previous shard, removed\n", filename);
+	if(unlink(filename)==0)
+	{
+	  const char *ext=strchr(entry->d_name, '.');
+	  if(params->file_nbr > 0)
+	    params->file_nbr--;
+	  if(ext!=NULL && prefix=='f')
+	  {
+	    for(i=0; i<nbr_stats; i++)
+	    {
+	      if(params->file_stats[i].recovered > 0 &&
+		  params->file_stats[i].file_hint->extension!=NULL &&
+		  strcmp(params->file_stats[i].file_hint->extension, ext+1)==0)
+	      {
+		params->file_stats[i].recovered--;
+		break;
+	      }
+	    }
+	  }
+	}
+      }
+    }
+    closedir(dir);
+  }
+}
+
+void shard_rebuild_search_space(alloc_data_t *list_search_space, const shard_extent_t *extents, const unsigned int nbr)
+{
+  struct td_list_head *search_walker = NULL;
+  unsigned int i;
+  td_list_for_each(search_walker, &list_search_space->list)
+    search_space_set_file_stat(td_list_entry(search_walker, alloc_data_t, list), NULL);
+  free_search_space(list_search_space);
+  for(i=0; i<nbr; i++)
+  {
+    alloc_data_t *new_sp=alloc_data_new();
+    new_sp->start=extents[i].start;
+    new_sp->end=extents[i].end;
+    new_sp->file_stat=NULL;
+    new_sp->data=extents[i].data;
+    td_list_add_tail(&new_sp->list, &list_search_space->list);
+    search_space_set_file_stat(new_sp, extents[i].file_stat);
+  }
+}
+#endif
+
+pstatus_t photorec_shard(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const unsigned int workers)
+{
+#ifdef HAVE_FORK
+  struct td_list_head *search_walker = NULL;
+  shard_t shards[PSHARD_MAX_WORKERS];
+  shard_extent_t *orig;
+  shard_extent_t *merged;
+  file_stat_t *base_stats;
+  const unsigned int base_file_nbr=params->file_nbr;
+  const unsigned int dir_first=params->dir_num;
+  unsigned int nbr_orig;
+  unsigned int nbr_merged;
+  unsigned int nbr_shards=(workers > PSHARD_MAX_WORKERS ? PSHARD_MAX_WORKERS : workers);
+  unsigned int nbr_stats;
+  unsigned int last;
+  unsigned int k;
+  uint64_t total=0;
+  uint64_t shard_size;
+  pstatus_t ind_stop;
+  /* The workers can't share a stream or the block map */
+  if(nbr_shards <= 1 || params->offset!=PH_INVALID_OFFSET || td_list_empty(&list_search_space->list) ||
+      disk_is_pipe(params->disk) > 0 || pblockmap_enabled() > 0)
+    return photorec_aux(params, options, list_search_space);
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    total+=current_search_space->end - current_search_space->start + 1;
+  }
+  if(total / nbr_shards < PSHARD_MIN_SIZE)
+    nbr_shards=total / PSHARD_MIN_SIZE;
+  if(nbr_shards <= 1)
+    return photorec_aux(params, options, list_search_space);
+  shard_size=(total + nbr_shards - 1) / nbr_shards;
+  shard_size=(shard_size + params->blocksize - 1) / params->blocksize * params->blocksize;
+  shard_split(list_search_space, shards, nbr_shards, shard_size);
+  for(nbr_stats=0; params->file_stats[nbr_stats].file_hint!=NULL; nbr_stats++);
+  base_stats=(file_stat_t *)MALLOC((nbr_stats+1)*sizeof(file_stat_t));
+  memcpy(base_stats, params->file_stats, nbr_stats*sizeof(file_stat_t));
+  nbr_orig=shard_search_space_to_array(list_search_space, &orig);
+  /* Each worker writes to its own directory: a file aborted at a shard end
+   * has the same name as the one created by the next worker */
+  shards[0].dir_num=params->dir_num;
+  for(k=1; k<nbr_shards; k++)
+    shards[k].dir_num=photorec_mkdir(params->recup_dir, shards[k-1].dir_num+1);
+  log_info("Sharded scan: %u workers, %llu bytes per shard\n",
+      nbr_shards, (long long unsigned)shard_size);
+  /* The workers inherit the placement */
+  paffinity_setup(params);
+  /* The workers would write the pending report entries a second time */
+#ifdef ENABLE_DFXML
+  xml_flush();
+#endif
+  /* The workers would run the queued renames a second time */
+  file_rename_deferred();
+  /* Each worker creates its own pack */
+  ppack_close();
+  log_flush();
+  fflush(NULL);
+  /* The last shard is carved by this process */
+  for(k=0; k+1<nbr_shards; k++)
+  {
+    int fds[2];
+    if(pipe(fds) < 0)
+      break;
+    shards[k].pid=fork();
+    if(shards[k].pid < 0)
+    {
+      close(fds[0]);
+      close(fds[1]);
+      break;
+    }
+    if(shards[k].pid==0)
+    {
+      unsigned int i;
+      for(i=0; i<k; i++)
+	close(shards[i].fd);
+      close(fds[0]);
+      shards[k].fd=fds[1];
+      paffinity_worker(k);
+      shard_child(params, options, list_search_space, &shards[k], nbr_stats);
+    }
+    close(fds[1]);
+    shards[k].fd=fds[0];
+  }
+  last=k;
+  if(last+1 < nbr_shards)
+    log_warning("Sharded scan: only %u worker%s started\n", last+1, (last==0?"":"s"));
+  shards[last].end=PH_INVALID_OFFSET;
+  params->offset=shards[last].start;
+  params->offset_end=PH_INVALID_OFFSET;
+  params->dir_num=shards[last].dir_num;
+  shard_forget_headers(list_search_space, shards[last].start);
+  paffinity_worker(last);
+  ind_stop=photorec_aux(params, options, list_search_space);
+  paffinity_restore();
+  shards[last].ok=1;
+  shards[last].pid=0;
+  shards[last].file_stats=NULL;
+  memset(&shards[last].report, 0, sizeof(shards[last].report));
+  shards[last].report.ind_stop=ind_stop;
+  shards[last].report.offset=params->offset;
+  shards[last].report.nbr=shard_search_space_to_array(list_search_space, &shards[last].extents);
+  for(k=0; k<last; k++)
+  {
+    unsigned int i;
+    shard_wait(&shards[k], nbr_stats);
+    if(shards[k].ok==0)
+      continue;
+    params->file_nbr+=shards[k].report.file_nbr - base_file_nbr;
+    if(params->dir_num < shards[k].report.dir_num)
+      params->dir_num=shards[k].report.dir_num;
+    for(i=0; i<nbr_stats; i++)
+      shard_merge_stats(&params->file_stats[i], &shards[k].file_stats[i], &base_stats[i]);
+  }
+  shard_remove_duplicates(params, shards, last+1, nbr_stats, orig, nbr_orig, dir_first);
+  /* Merge the search spaces left by each worker */
+  merged=orig;
+  nbr_merged=nbr_orig;
+  for(k=0; k<=last; k++)
+  {
+    if(shards[k].ok>0)
+    {
+      shard_extent_t *tmp;
+      const unsigned int nbr_tmp=shard_extents_intersect(merged, nbr_merged, shards[k].extents, shards[k].report.nbr, &tmp);
+      if(merged!=orig)
+	free(merged);
+      merged=tmp;
+      nbr_merged=nbr_tmp;
+    }
+  }
+  shard_rebuild_search_space(list_search_space, merged, nbr_merged);
+  if(merged!=orig)
+    free(merged);
+  params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
+  ind_stop=PSTATUS_OK;
+  for(k=0; k<=last; k++)
+  {
+    if(ind_stop==PSTATUS_OK && shards[k].ok>0 && shards[k].report.ind_stop!=PSTATUS_OK)
+    {
+      ind_stop=(pstatus_t)shards[k].report.ind_stop;
+      params->offset=shards[k].report.offset;
+    }
+    free(shards[k].file_stats);
+    free(shards[k].extents);
+  }
+  free(orig);
+  free(base_stats);
+  return ind_stop;
+#else
+  (void)workers;
+  return photorec_aux(params, options, list_search_space);
+#endif
+}
@@ -0,0 +1,105 @@
+/*
+
+    File: pshard.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PSHARD_H
+#define _PSHARD_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Split the search space into contiguous shards and carve them with one
+ * photorec_aux() per worker process. A worker keeps going past the end of
+ * its shard until the file in progress is finished; the files the next
+ * worker found inside that data are removed and the search spaces left by
+ * all the workers are intersected.
+ * Falls back to photorec_aux() when workers<=1 or fork() is unavailable. */
+
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @ requires \separated(params, options, list_search_space);
+  @ decreases 0;
+  @ ensures  valid_ph_param(params);
+  @*/
+pstatus_t photorec_shard(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space, const unsigned int workers);
+
+/* Helpers shared with the distributed scan of pcluster.c, only built
+ * when fork() is available */
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  file_stat_t *file_stat;
+  unsigned int data;
+} shard_extent_t;
+
+typedef struct
+{
+  int ind_stop;
+  unsigned int file_nbr;
+  unsigned int dir_num;
+  unsigned int nbr;
+  uint64_t offset;
+} shard_report_t;
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  unsigned int dir_num;
+  pid_t pid;
+  int fd;
+  int ok;
+  shard_report_t report;
+  file_stat_t *file_stats;
+  shard_extent_t *extents;
+} shard_t;
+
+/* Copy the search space in a sorted array, return the number of extents */
+unsigned int shard_search_space_to_array(const alloc_data_t *list_search_space, shard_extent_t **extents);
+
+/* Return 1 if offset is inside one of the sorted extents */
+int shard_extents_contain(const shard_extent_t *extents, const unsigned int nbr, const uint64_t offset);
+
+/* Data is still unused if no worker has consumed it */
+unsigned int shard_extents_intersect(const shard_extent_t *a, const unsigned int nbr_a, const shard_extent_t *b, const unsigned int nbr_b, shard_extent_t **res);
+
+/* Set the start and end of nbr_shards contiguous shards of shard_size bytes,
+ * the last one ends at PH_INVALID_OFFSET */
+void shard_split(const alloc_data_t *list_search_space, shard_t *shards, const unsigned int nbr_shards, const uint64_t shard_size);
+
+void shard_forget_headers(alloc_data_t *list_search_space, const uint64_t start);
+
+/* Add what a worker has counted since base */
+void shard_merge_stats(file_stat_t *file_stat, const file_stat_t *worker, const file_stat_t *base);
+
+/* Remove the files found by a shard inside data consumed by a previous one,
+ * the shards must have ok>0 and their remaining extents to be taken into account */
+void shard_remove_duplicates(struct ph_param *params, const shard_t *shards, const unsigned int nbr_shards, const unsigned int nbr_stats, const shard_extent_t *orig, const unsigned int nbr_orig, const unsigned int dir_first);
+
+void shard_rebuild_search_space(alloc_data_t *list_search_space, const shard_extent_t *extents, const unsigned int nbr);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,281 @@
+/*
+
+    File: pspace.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "log.h"
+#include "pspace.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PSPACE_UNIT		512
+#define PSPACE_CHUNK_UNITS	65536
+/* 2048 runs use as much memory as the bitmap of a chunk */
+#define PSPACE_MAX_RUNS		2048
+
+/* runs==NULL && bitmap==NULL: an extent kept as it is
+ * runs!=NULL: start and length-1, in sectors from start, of each run
+ * bitmap!=NULL: a bit for each sector from start */
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+  file_stat_t *file_stat;
+  uint16_t *runs;
+  uint64_t *bitmap;
+  unsigned int nbr_runs;
+  unsigned int alloc_runs;
+  unsigned int data;
+} pspace_chunk_t;
+
+static TD_THREAD_LOCAL pspace_chunk_t *pspace_chunks=NULL;
+static TD_THREAD_LOCAL unsigned int pspace_nbr=0;
+static TD_THREAD_LOCAL unsigned int pspace_alloc=0;
+static TD_THREAD_LOCAL uint64_t pspace_nbr_extents=0;
+
+static pspace_chunk_t *pspace_new_chunk(void)
+{
+  pspace_chunk_t *chunk;
+  if(pspace_nbr==pspace_alloc)
+  {
+    pspace_alloc=(pspace_alloc < 1024 ? 1024 : 2 * pspace_alloc);
+    pspace_chunks=(pspace_chunk_t *)realloc(pspace_chunks, pspace_alloc * sizeof(pspace_chunk_t));
+    if(pspace_chunks==NULL)
+    {
+      log_critical("pspace_new_chunk: not enough memory\n");
+      exit(1);
+    }
+  }
+  chunk=&pspace_chunks[pspace_nbr++];
+  memset(chunk, 0, sizeof(*chunk));
+  return chunk;
+}
+
+static void pspace_set_bits(uint64_t *bitmap, const unsigned int first, const unsigned int nbr)
+{
+  unsigned int i;
+  for(i=first; i<first+nbr; i++)
+    bitmap[i/64]|=(uint64_t)1<<(i%64);
+}
+
+static void pspace_to_bitmap(pspace_chunk_t *chunk)
+{
+  unsigned int i;
+  chunk->bitmap=(uint64_t *)MALLOC(PSPACE_CHUNK_UNITS/8);
+  memset(chunk->bitmap, 0, PSPACE_CHUNK_UNITS/8);
+  for(i=0; i<chunk->nbr_runs; i++)
+    pspace_set_bits(chunk->bitmap, chunk->runs[2*i], (unsigned int)chunk->runs[2*i+1] + 1);
+  free(chunk->runs);
+  chunk->runs=NULL;
+  chunk->nbr_runs=0;
+  chunk->alloc_runs=0;
+}
+
+static void pspace_add_run(pspace_chunk_t *chunk, const alloc_data_t *extent)
+{
+  const unsigned int first=(extent->start - chunk->start) / PSPACE_UNIT;
+  const unsigned int nbr=(extent->end + 1 - extent->start) / PSPACE_UNIT;
+  chunk->end=extent->end;
+  if(chunk->bitmap!=NULL)
+  {
+    pspace_set_bits(chunk->bitmap, first, nbr);
+    return ;
+  }
+  if(chunk->nbr_runs==chunk->alloc_runs)
+  {
+    chunk->alloc_runs=(chunk->alloc_runs < 4 ? 4 : 2 * chunk->alloc_runs);
+    chunk->runs=(uint16_t *)realloc(chunk->runs, 2 * chunk->alloc_runs * sizeof(uint16_t));
+    if(chunk->runs==NULL)
+    {
+      log_critical("pspace_add_run: not enough memory\n");
+      exit(1);
+    }
+  }
+  chunk->runs[2*chunk->nbr_runs]=first;
+  chunk->runs[2*chunk->nbr_runs+1]=nbr - 1;
+  chunk->nbr_runs++;
+  if(chunk->nbr_runs > PSPACE_MAX_RUNS)
+    pspace_to_bitmap(chunk);
+}
+
+/* A chunk with a single run costs more than the extent itself */
+static void pspace_close(pspace_chunk_t *chunk)
+{
+  if(chunk->runs==NULL || chunk->nbr_runs > 1)
+    return ;
+  free(chunk->runs);
+  chunk->runs=NULL;
+  chunk->nbr_runs=0;
+  chunk->alloc_runs=0;
+  chunk->data=1;
+}
+#endif
+
+void pspace_add(const alloc_data_t *extent)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const uint64_t size=extent->end + 1 - extent->start;
+  pspace_chunk_t *chunk;
+  pspace_nbr_extents++;
+  if(extent->file_stat==NULL && extent->data==1 &&
+      size % PSPACE_UNIT == 0 &&
+      size <= (uint64_t)PSPACE_CHUNK_UNITS * PSPACE_UNIT)
+  {
+    if(pspace_nbr > 0)
+    {
+      chunk=&pspace_chunks[pspace_nbr-1];
+      if((chunk->runs!=NULL || chunk->bitmap!=NULL) &&
+	  extent->start > chunk->end &&
+	  (extent->start - chunk->start) % PSPACE_UNIT == 0 &&
+	  extent->end < chunk->start + (uint64_t)PSPACE_CHUNK_UNITS * PSPACE_UNIT)
+      {
+	pspace_add_run(chunk, extent);
+	return ;
+      }
+      pspace_close(chunk);
+    }
+    chunk=pspace_new_chunk();
+    chunk->start=extent->start;
+    pspace_add_run(chunk, extent);
+    return ;
+  }
+  if(pspace_nbr > 0)
+    pspace_close(&pspace_chunks[pspace_nbr-1]);
+  chunk=pspace_new_chunk();
+  chunk->start=extent->start;
+  chunk->end=extent->end;
+  chunk->file_stat=extent->file_stat;
+  chunk->data=extent->data;
+#endif
+}
+
+void pspace_walk(void (*fnct)(const alloc_data_t *extent, void *arg), void *arg)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  for(i=0; i<pspace_nbr; i++)
+  {
+    const pspace_chunk_t *chunk=&pspace_chunks[i];
+    alloc_data_t extent;
+    extent.file_stat=NULL;
+    extent.data=1;
+    if(chunk->runs!=NULL)
+    {
+      unsigned int j;
+      for(j=0; j<chunk->nbr_runs; j++)
+      {
+	extent.start=chunk->start + (uint64_t)chunk->runs[2*j] * PSPACE_UNIT;
+	extent.end=extent.start + ((uint64_t)chunk->runs[2*j+1] + 1) * PSPACE_UNIT - 1;
+	fnct(&extent, arg);
+      }
+    }
+    else if(chunk->bitmap!=NULL)
+    {
+      unsigned int j=0;
+      while(j < PSPACE_CHUNK_UNITS)
+      {
+	unsigned int k;
+	if(j%64==0 && chunk->bitmap[j/64]==0)
+	{
+	  j+=64;
+	  continue;
+	}
+	if((chunk->bitmap[j/64] & ((uint64_t)1<<(j%64)))==0)
+	{
+	  j++;
+	  continue;
+	}
+	for(k=j+1;
+	    k < PSPACE_CHUNK_UNITS && (chunk->bitmap[k/64] & ((uint64_t)1<<(k%64)))!=0;
+	    k++);
+	extent.start=chunk->start + (uint64_t)j * PSPACE_UNIT;
+	extent.end=chunk->start + (uint64_t)k * PSPACE_UNIT - 1;
+	fnct(&extent, arg);
+	j=k;
+      }
+    }
+    else
+    {
+      extent.start=chunk->start;
+      extent.end=chunk->end;
+      extent.file_stat=chunk->file_stat;
+      extent.data=chunk->data;
+      fnct(&extent, arg);
+    }
+  }
+#endif
+}
+
+uint64_t pspace_extents(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pspace_nbr_extents;
+#else
+  return 0;
+#endif
+}
+
+uint64_t pspace_size(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t size=(uint64_t)pspace_alloc * sizeof(pspace_chunk_t);
+  unsigned int i;
+  for(i=0; i<pspace_nbr; i++)
+  {
+    if(pspace_chunks[i].bitmap!=NULL)
+      size+=PSPACE_CHUNK_UNITS/8;
+    else
+      size+=(uint64_t)pspace_chunks[i].alloc_runs * 2 * sizeof(uint16_t);
+  }
+  return size;
+#else
+  return 0;
+#endif
+}
+
+void pspace_free(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  unsigned int i;
+  for(i=0; i<pspace_nbr; i++)
+  {
+    free(pspace_chunks[i].runs);
+    free(pspace_chunks[i].bitmap);
+  }
+  free(pspace_chunks);
+  pspace_chunks=NULL;
+  pspace_nbr=0;
+  pspace_alloc=0;
+  pspace_nbr_extents=0;
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+
+    File: pspace.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PSPACE_H
+#define _PSPACE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Packed search space: extents moved out of the list, in disk order.
+ * An extent starting with a file header and a long extent are kept as
+ * they are. The other ones are packed in chunks of 65536 sectors, each
+ * chunk holding either the list of its runs or, when the extents are
+ * so small and so many that it's shorter, a bitmap of its sectors.
+ * Adjacent extents of a bitmap come back merged, as
+ * compact_search_space() would merge them. */
+
+/*@
+  @ requires \valid_read(extent);
+  @*/
+void pspace_add(const alloc_data_t *extent);
+
+/* Call fnct for each extent, in the order they have been added */
+void pspace_walk(void (*fnct)(const alloc_data_t *extent, void *arg), void *arg);
+
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t pspace_extents(void);
+
+/* Memory used by the packed extents */
+/*@
+  @ assigns \nothing;
+  @*/
+uint64_t pspace_size(void);
+
+void pspace_free(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,395 @@
+/*
+
+    File: pspec.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "fat.h"
+#include "file_tar.h"
+#include "pnext.h"
+#include "phash.h"
+#include "pstream.h"
+#include "pspec.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Data checked by the track before it's dropped */
+#define PSPEC_MAX_SIZE		(64*1024*1024)
+/* Blocks copied at once by pspec_commit() */
+#define PSPEC_COPY_SIZE		(1024*1024)
+
+#if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_tar)
+extern const file_hint_t file_hint_tar;
+#endif
+extern file_check_list_t file_check_list;
+
+typedef struct
+{
+  int active;
+  /* The file in progress whose blocks are checked again */
+  const file_stat_t *parent_stat;
+  uint64_t parent_start;
+  /* State when the header was found */
+  file_recovery_t header;
+  file_recovery_t file_recovery;
+  uint64_t blocks;
+  uint64_t next;
+  /* Lowest header ignored by the track, 0 if none */
+  uint64_t skipped;
+  unsigned int blocksize;
+  unsigned int read_size;
+  unsigned char *header_data;
+  unsigned char *last_block;
+} pspec_track_t;
+
+static int pspec_on=0;
+static pspec_track_t pspec_track;
+/* Used to give an offset to header_ignored() */
+static file_recovery_t pspec_ignored;
+static unsigned long pspec_nbr_commit=0;
+static unsigned long pspec_nbr_drop=0;
+static uint64_t pspec_blocks_saved=0;
+#endif
+
+void pspec_set(const int enable)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pspec_on=enable;
+#endif
+}
+
+int pspec_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pspec_on;
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+/* header_ignored() only lowers the offset, set it back to a saved value */
+static void pspec_header_ignored_set(const uint64_t offset)
+{
+  header_ignored(NULL);
+  if(offset==0)
+    return ;
+  pspec_ignored.location.start=offset;
+  header_ignored(&pspec_ignored);
+}
+
+/* Same header checks as photorec_check_header(), the new file is
+ * returned in file_recovery_new */
+static int pspec_header_check(const unsigned char *buffer, const unsigned int read_size, const unsigned int blocksize, const uint64_t offset, const file_recovery_t *file_recovery, file_recovery_t *file_recovery_new)
+{
+  const struct td_list_head *tmpl;
+  file_recovery_new->blocksize=blocksize;
+  file_recovery_new->location.start=offset;
+  file_recovery_new->file_stat=NULL;
+#if !defined(SINGLE_FORMAT) || defined(SINGLE_FORMAT_tar)
+  if(file_recovery->file_stat!=NULL && file_recovery->file_stat->file_hint==&file_hint_tar &&
+      is_valid_tar_header((const struct tar_posix_header *)(buffer-0x200)))
+    return 0;
+#endif
+  td_list_for_each(tmpl, &file_check_list.list)
+  {
+    const struct td_list_head *tmp;
+    const file_check_list_t *pos=td_list_entry_const(tmpl, const file_check_list_t, list);
+    const unsigned int c=buffer[pos->offset];
+    if(!file_check_list_used(pos, c))
+      continue;
+    td_list_for_each(tmp, &pos->file_checks[c].list)
+    {
+      const file_check_t *file_check=td_list_entry_const(tmp, const file_check_t, list);
+      if((file_check->length==0 || memcmp(buffer + file_check->offset, file_check->value, file_check->length)==0) &&
+	  file_header_check(file_check, buffer, read_size, 0, file_recovery, file_recovery_new)!=0)
+      {
+	file_recovery_new->file_stat=file_check->file_stat;
+	return (file_check->file_stat->file_hint!=NULL ? 1 : 0);
+      }
+    }
+  }
+  return 0;
+}
+#endif
+
+void pspec_drop(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pspec_track.active==0)
+    return ;
+  if(pspec_track.file_recovery.handle!=NULL)
+    fclose(pspec_track.file_recovery.handle);
+  pspec_track.file_recovery.handle=NULL;
+  pspec_track.active=0;
+  pspec_nbr_drop++;
+#endif
+}
+
+void pspec_header(const file_recovery_t *file_recovery, const struct ph_param *params, const unsigned char *buffer, const uint64_t offset, const uint64_t skipped)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const unsigned int blocksize=params->blocksize;
+  const unsigned int read_size=(blocksize>65536?blocksize:65536);
+  file_recovery_t file_recovery_empty;
+  file_extent_t extent;
+  const uint64_t skipped_new=header_ignored_offset();
+  if(pspec_on==0 || file_recovery->file_stat==NULL || file_recovery->location.start==offset)
+    return ;
+  /* Only the lowest header ignored is searched again */
+  if(skipped_new!=offset || skipped==offset)
+    return ;
+  pspec_drop();
+  /* The indirect blocks of ext2/ext3 are skipped by the file in progress */
+  if(params->status==STATUS_EXT2_ON || params->status==STATUS_EXT2_ON_SAVE_EVERYTHING)
+    return ;
+  memset(&file_recovery_empty, 0, sizeof(file_recovery_empty));
+  reset_file_recovery(&file_recovery_empty);
+  file_recovery_empty.blocksize=blocksize;
+  file_data_extent_save(&extent);
+  if(pspec_header_check(buffer, read_size, blocksize, offset, &file_recovery_empty, &pspec_track.header)==0)
+  {
+    file_data_extent_restore(&extent);
+    pspec_header_ignored_set(skipped_new);
+    return ;
+  }
+  file_data_extent_restore(&extent);
+  pspec_header_ignored_set(skipped_new);
+  if(pspec_track.blocksize!=blocksize || pspec_track.read_size!=read_size)
+  {
+    free(pspec_track.header_data);
+    free(pspec_track.last_block);
+    pspec_track.header_data=(unsigned char *)MALLOC(read_size);
+    pspec_track.last_block=(unsigned char *)MALLOC(blocksize);
+    pspec_track.blocksize=blocksize;
+    pspec_track.read_size=read_size;
+  }
+  file_recovery_cpy(&pspec_track.file_recovery, &pspec_track.header);
+  pspec_track.file_recovery.handle=NULL;
+  if(pspec_track.header.file_stat->file_hint->recover==1)
+  {
+    pspec_track.file_recovery.handle=tmpfile();
+    if(pspec_track.file_recovery.handle==NULL)
+      return ;
+  }
+  memcpy(pspec_track.header_data, buffer, read_size);
+  pspec_track.parent_stat=file_recovery->file_stat;
+  pspec_track.parent_start=file_recovery->location.start;
+  pspec_track.blocks=0;
+  pspec_track.next=offset;
+  pspec_track.skipped=0;
+  pspec_track.active=1;
+#endif
+}
+
+void pspec_block(const file_recovery_t *file_recovery, const struct ph_param *params, const unsigned char *buffer, const uint64_t offset, const uint64_t next)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pspec_track_t *track=&pspec_track;
+  file_recovery_t *fr=&track->file_recovery;
+  const unsigned int blocksize=params->blocksize;
+  const uint64_t skipped=header_ignored_offset();
+  file_extent_t extent;
+  file_extent_t extent_new;
+  data_check_t res=DC_CONTINUE;
+  if(track->active==0)
+    return ;
+  if(file_recovery->file_stat!=track->parent_stat ||
+      file_recovery->location.start!=track->parent_start ||
+      offset!=track->next || blocksize!=track->blocksize)
+  {
+    pspec_drop();
+    return ;
+  }
+  file_data_extent_save(&extent);
+  if(track->blocks > 0)
+  {
+    /* A header found for the track ends it */
+    file_recovery_t file_recovery_new;
+    const int found=pspec_header_check(buffer, track->read_size, blocksize, offset, fr, &file_recovery_new);
+    if(header_ignored_offset()!=skipped)
+    {
+      const uint64_t skipped_track=header_ignored_offset();
+      if(track->skipped==0 || skipped_track < track->skipped)
+	track->skipped=skipped_track;
+      pspec_header_ignored_set(skipped);
+    }
+    if(found!=0)
+    {
+      file_data_extent_restore(&extent);
+      pspec_drop();
+      return ;
+    }
+  }
+  if(fr->handle!=NULL && fwrite(buffer, blocksize, 1, fr->handle)<1)
+  {
+    file_data_extent_restore(&extent);
+    pspec_drop();
+    return ;
+  }
+  memcpy(track->last_block, buffer, blocksize);
+  track->blocks++;
+  track->next=next;
+  if(fr->data_check!=NULL)
+    res=file_data_check(buffer - blocksize, 2*blocksize, fr);
+  fr->file_size+=blocksize;
+  file_data_extent_save(&extent_new);
+  if(extent_new.file_recovery!=extent.file_recovery ||
+      extent_new.start!=extent.start || extent_new.end!=extent.end)
+  {
+    /* The blocks covered by an extent are not checked, give up */
+    file_data_extent_restore(&extent);
+    pspec_drop();
+    return ;
+  }
+  if(res==DC_STOP || res==DC_ERROR ||
+      (fr->file_stat->file_hint->max_filesize>0 && fr->file_size>=fr->file_stat->file_hint->max_filesize) ||
+      (fr->file_size + blocksize >= PHOTOREC_MAX_SIZE_32 && is_fat(params->partition)) ||
+      fr->file_size >= PSPEC_MAX_SIZE)
+  {
+    /* The track would be finished before the file in progress */
+    pspec_drop();
+  }
+#endif
+}
+
+const file_recovery_t *pspec_candidate(const alloc_data_t *list_search_space, alloc_data_t *current_search_space, const uint64_t offset, const uint64_t resume, const struct ph_param *params)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  const pspec_track_t *track=&pspec_track;
+  uint64_t pos=offset;
+  uint64_t i;
+  if(track->active==0)
+    return NULL;
+  if(offset!=track->header.location.start || resume!=track->next ||
+      track->blocks==0 || offset > params->offset_end ||
+      current_search_space==list_search_space)
+  {
+    pspec_drop();
+    return NULL;
+  }
+  /* The blocks of the track must be the next ones of the search space */
+  for(i=0; i<track->blocks && current_search_space!=list_search_space; i++)
+    get_next_sector(list_search_space, &current_search_space, &pos, params->blocksize);
+  if(i<track->blocks || current_search_space==list_search_space || pos!=resume)
+  {
+    pspec_drop();
+    return NULL;
+  }
+  return &track->header;
+#else
+  return NULL;
+#endif
+}
+
+const unsigned char *pspec_header_data(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pspec_track.header_data;
+#else
+  return NULL;
+#endif
+}
+
+int64_t pspec_commit(file_recovery_t *file_recovery)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  pspec_track_t *track=&pspec_track;
+  FILE *tmp=track->file_recovery.handle;
+  const uint64_t size=track->file_recovery.file_size;
+  const int64_t blocks=track->blocks;
+  const uint64_t skipped=track->skipped;
+  uint64_t pos;
+  unsigned char *buffer;
+  /* Keep the name and the handle created by photorec_header_found() */
+  memcpy(track->file_recovery.filename, file_recovery->filename, sizeof(file_recovery->filename));
+  track->file_recovery.handle=file_recovery->handle;
+  file_recovery_cpy(file_recovery, &track->file_recovery);
+  track->file_recovery.handle=tmp;
+  if(file_recovery->handle==NULL || tmp==NULL)
+  {
+    pspec_drop();
+    pspec_header_ignored_set(skipped);
+    pspec_nbr_commit++;
+    pspec_blocks_saved+=blocks;
+    return blocks;
+  }
+  buffer=(unsigned char *)MALLOC(PSPEC_COPY_SIZE);
+  rewind(tmp);
+  for(pos=0; pos<size; )
+  {
+    const unsigned int len=(size - pos < PSPEC_COPY_SIZE ? size - pos : PSPEC_COPY_SIZE);
+    if(fread(buffer, len, 1, tmp)!=1 || fwrite(buffer, len, 1, file_recovery->handle)<1)
+    {
+      log_error("Speculative recovery: cannot copy %s: %s\n", file_recovery->filename, strerror(errno));
+      free(buffer);
+      pspec_drop();
+      return -1;
+    }
+    file_tail_append(file_recovery, buffer, len, pos);
+    pstream_block(file_recovery, buffer, len);
+    phash_block(file_recovery, buffer, len, pos);
+    pos+=len;
+  }
+  free(buffer);
+  pspec_drop();
+  pspec_header_ignored_set(skipped);
+  pspec_nbr_commit++;
+  pspec_blocks_saved+=blocks;
+  return blocks;
+#else
+  return -1;
+#endif
+}
+
+const unsigned char *pspec_last_block(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return pspec_track.last_block;
+#else
+  return NULL;
+#endif
+}
+
+void pspec_log(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  if(pspec_on==0)
+    return ;
+  /* A committed track is also dropped */
+  log_info("Speculative recovery: %lu files continued without going back, %llu blocks not read again, %lu tracks given up\n",
+      pspec_nbr_commit, (long long unsigned)pspec_blocks_saved, pspec_nbr_drop - pspec_nbr_commit);
+#endif
+}
@@ -0,0 +1,101 @@
+/*
+
+    File: pspec.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PSPEC_H
+#define _PSPEC_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Speculative recovery: a header ignored because a file is in progress
+ * is the location get_prev_location_smart() goes back to when this file
+ * is truncated. Instead of reading the blocks again, a second track
+ * starts at the lowest header ignored: it checks the blocks appended to
+ * the file in progress as if no file were in progress, with its own
+ * file_recovery_t, data_check state and a temporary copy of the data.
+ * When the file in progress is truncated and the scan would go back to
+ * the header of the track, the track becomes the file in progress and
+ * the scan goes on where it was.
+ * The track is dropped when the file in progress is recovered without
+ * being truncated, when the track finds its end or a header, or after
+ * PSPEC_MAX_SIZE bytes: the scan goes back as usual. */
+
+/*@
+  @ assigns \nothing;
+  @*/
+void pspec_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pspec_enabled(void);
+
+/* Called after the header checks of the block at offset, skipped is
+ * header_ignored_offset() before them */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(params);
+  @ requires \valid_read(buffer + (0 .. params->blocksize-1));
+  @*/
+void pspec_header(const file_recovery_t *file_recovery, const struct ph_param *params, const unsigned char *buffer, const uint64_t offset, const uint64_t skipped);
+
+/* Called once the block at offset has been appended to the file in
+ * progress, buffer-blocksize holds the previous block, next is the
+ * offset of the next block */
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(params);
+  @*/
+void pspec_block(const file_recovery_t *file_recovery, const struct ph_param *params, const unsigned char *buffer, const uint64_t offset, const uint64_t next);
+
+void pspec_drop(void);
+
+/* Header of the track if it can become the file in progress: the scan
+ * goes back to offset in current_search_space and was at resume.
+ * Drop the track and return NULL otherwise. */
+/*@
+  @ requires \valid_read(list_search_space);
+  @ requires \valid_read(params);
+  @*/
+const file_recovery_t *pspec_candidate(const alloc_data_t *list_search_space, alloc_data_t *current_search_space, const uint64_t offset, const uint64_t resume, const struct ph_param *params);
+
+/* The header block and the following bytes, as given to the header check */
+const unsigned char *pspec_header_data(void);
+
+/* Give the state of the track to file_recovery, as created from the
+ * header by photorec_header_found(), copy the data checked so far to its
+ * handle and drop the track.
+ * Return the number of blocks to append to the file, -1 on write error */
+/*@
+  @ requires \valid(file_recovery);
+  @*/
+int64_t pspec_commit(file_recovery_t *file_recovery);
+
+/* Last block of the track, the data before resume */
+const unsigned char *pspec_last_block(void);
+
+/* Files continued without going back, in the log */
+void pspec_log(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,81 @@
+/*
+
+    File: pstream.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include "types.h"
+#include "common.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "pstream.h"
+
+static pstream_t pstream;
+static int pstream_on=0;
+static int pstream_write_files=1;
+
+void pstream_set(const pstream_t *stream, const int write_files)
+{
+  if(stream==NULL)
+  {
+    pstream_on=0;
+    pstream_write_files=1;
+    return ;
+  }
+  pstream=*stream;
+  pstream_on=1;
+  pstream_write_files=(write_files>0?1:0);
+}
+
+void pstream_set_files(const int write_files)
+{
+  pstream_write_files=(write_files>0?1:0);
+}
+
+int pstream_enabled(void)
+{
+  return pstream_on;
+}
+
+int pstream_files(void)
+{
+  return pstream_write_files;
+}
+
+void pstream_file_start(const file_recovery_t *file_recovery)
+{
+  if(pstream_on>0 && pstream.on_file_start!=NULL)
+    pstream.on_file_start(pstream.opaque, file_recovery);
+}
+
+void pstream_block(const file_recovery_t *file_recovery, const unsigned char *data, const unsigned int len)
+{
+  if(pstream_on>0 && pstream.on_block!=NULL)
+    pstream.on_block(pstream.opaque, file_recovery, data, len);
+}
+
+void pstream_file_finished(const file_recovery_t *file_recovery, const pfstatus_t status)
+{
+  if(pstream_on>0 && pstream.on_file_finished!=NULL)
+    pstream.on_file_finished(pstream.opaque, file_recovery, status);
+}
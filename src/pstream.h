@@ -0,0 +1,84 @@
+/*
+
+    File: pstream.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PSTREAM_H
+#define _PSTREAM_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Stream output for the library: the recovered files are handed to the
+ * caller while they are carved. on_block() gets the blocks as they are
+ * appended to the file, straight from the read buffer; on_file_finished()
+ * gets the final file_size and the byte runs in location. Only the main
+ * carving passes call on_file_start() and on_block(). Must match
+ * testdisk_stream_t in testdisk_api.h */
+typedef struct
+{
+  void (*on_file_start)(void *opaque, const file_recovery_t *file_recovery);
+  void (*on_block)(void *opaque, const file_recovery_t *file_recovery, const unsigned char *data, const unsigned int len);
+  void (*on_file_finished)(void *opaque, const file_recovery_t *file_recovery, const pfstatus_t status);
+  void *opaque;
+} pstream_t;
+
+/* stream==NULL disables the callbacks. When write_files is 0, the files
+ * of the main carving passes are only kept in an anonymous temporary
+ * file, file_check() needs to read them back */
+/*@
+  @ requires stream == \null || \valid_read(stream);
+  @*/
+void pstream_set(const pstream_t *stream, const int write_files);
+
+/* Keep the files in temporary files without any callback, photorec
+ * /nowrite: the report lists their byte runs on the disk */
+void pstream_set_files(const int write_files);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int pstream_enabled(void);
+
+/* 0 when the recovered files are not written to recup_dir */
+/*@
+  @ assigns \nothing;
+  @*/
+int pstream_files(void);
+
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void pstream_file_start(const file_recovery_t *file_recovery);
+
+/*@
+  @ requires \valid_read(file_recovery);
+  @ requires \valid_read(data + (0 .. len-1));
+  @*/
+void pstream_block(const file_recovery_t *file_recovery, const unsigned char *data, const unsigned int len);
+
+/*@
+  @ requires \valid_read(file_recovery);
+  @*/
+void pstream_file_finished(const file_recovery_t *file_recovery, const pfstatus_t status);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
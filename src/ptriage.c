@@ -0,0 +1,604 @@
+/*
+
+    File: ptriage.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "intrf.h"
+#ifdef HAVE_NCURSES
+#include "intrfn.h"
+#endif
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "log.h"
+#include "phnc.h"
+#include "phbs.h"
+#include "psearchn.h"
+#include "ptriage.h"
+
+extern int need_to_stop;
+
+#ifndef DISABLED_FOR_FRAMAC
+#define PTRIAGE_STRATA		256
+#define PTRIAGE_WINDOW_SIZE	(1024*1024)
+/* A stratum whose windows only held wiped blocks is read every
+ * PTRIAGE_EMPTY_RATE rounds */
+#define PTRIAGE_EMPTY_RATE	4
+/* Locations listed for each file format */
+#define PTRIAGE_LOCATIONS	8
+
+#define PTRIAGE_CLASS_UNIFORM	0
+#define PTRIAGE_CLASS_LOW	1
+#define PTRIAGE_CLASS_MID	2
+#define PTRIAGE_CLASS_HIGH	3
+#define PTRIAGE_CLASSES		4
+
+static const char *ptriage_class_name[PTRIAGE_CLASSES]={
+  "wiped", "low entropy", "mid entropy", "high entropy"
+};
+
+typedef struct
+{
+  uint64_t pos;			/* Position in the search space */
+  uint64_t start;		/* Disk offset */
+  uint64_t len;
+} ptriage_extent_t;
+
+typedef struct
+{
+  uint64_t pos;			/* First byte in the search space */
+  uint64_t len;
+  unsigned int slots;		/* Windows in the stratum */
+  unsigned int slot_bits;
+  unsigned int next;		/* Next index of the bit-reversed order */
+  int exhausted;
+  unsigned int windows;		/* Windows read */
+  uint64_t blocks;		/* Blocks read */
+  uint64_t data;		/* Blocks not filled with a single byte */
+  uint64_t cls[PTRIAGE_CLASSES];
+} ptriage_stratum_t;
+
+typedef struct
+{
+  uint64_t offset;
+  unsigned int format;
+} ptriage_hit_t;
+
+typedef struct
+{
+  struct ph_param *params;
+  const ptriage_extent_t *extents;
+  unsigned int nbr_extents;
+  ptriage_stratum_t *strata;
+  unsigned int nbr_strata;
+  unsigned int nbr_formats;
+  /* Headers found per stratum and per format */
+  unsigned int *counts;
+  ptriage_hit_t *hits;
+  unsigned int nbr_hits;
+  unsigned int allocated_hits;
+  unsigned int window_size;
+  unsigned int read_size;
+  unsigned int high_distinct;
+  /* blocksize zeros, the window, read_size bytes after the window */
+  unsigned char *data;
+} ptriage_ctx_t;
+
+static unsigned int ptriage_seconds=0;
+static uint64_t ptriage_bytes=0;
+static int ptriage_recover=0;
+#endif
+
+void ptriage_set(const unsigned int seconds, const uint64_t bytes, const int recover)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  ptriage_seconds=seconds;
+  ptriage_bytes=bytes;
+  ptriage_recover=recover;
+#endif
+}
+
+int ptriage_enabled(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  return (ptriage_seconds > 0 || ptriage_bytes > 0 ? 1 : 0);
+#else
+  return 0;
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+static unsigned int ptriage_extents(const alloc_data_t *list_search_space, ptriage_extent_t **extents, uint64_t *total)
+{
+  struct td_list_head *search_walker = NULL;
+  unsigned int nbr=0;
+  td_list_for_each(search_walker, &list_search_space->list)
+    nbr++;
+  *extents=(ptriage_extent_t *)MALLOC((nbr+1)*sizeof(ptriage_extent_t));
+  *total=0;
+  nbr=0;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    ptriage_extent_t *extent=&(*extents)[nbr++];
+    extent->pos=*total;
+    extent->start=current_search_space->start;
+    extent->len=current_search_space->end - current_search_space->start + 1;
+    *total+=extent->len;
+  }
+  return nbr;
+}
+
+/* Extent holding the search space position pos */
+static const ptriage_extent_t *ptriage_extent(const ptriage_extent_t *extents, const unsigned int nbr, const uint64_t pos)
+{
+  unsigned int low=0;
+  unsigned int high=nbr;
+  while(high - low > 1)
+  {
+    const unsigned int mid=low + (high - low) / 2;
+    if(extents[mid].pos <= pos)
+      low=mid;
+    else
+      high=mid;
+  }
+  return &extents[low];
+}
+
+static unsigned int ptriage_bitrev(unsigned int x, const unsigned int bits)
+{
+  unsigned int res=0;
+  unsigned int i;
+  for(i=0; i<bits; i++)
+  {
+    res=(res << 1) | (x & 1);
+    x>>=1;
+  }
+  return res;
+}
+
+/* Next window of the stratum, or -1 once all of them have been read */
+static int ptriage_next_slot(ptriage_stratum_t *stratum)
+{
+  while(stratum->next < (1U << stratum->slot_bits))
+  {
+    const unsigned int slot=ptriage_bitrev(stratum->next++, stratum->slot_bits);
+    if(slot < stratum->slots)
+      return slot;
+  }
+  stratum->exhausted=1;
+  return -1;
+}
+
+/* Same classes as the scan index: distinct byte values in the block */
+static unsigned int ptriage_class(const unsigned char *block, const unsigned int blocksize, const unsigned int high_distinct)
+{
+  unsigned char seen[256];
+  unsigned int distinct=0;
+  unsigned int i;
+  memset(seen, 0, sizeof(seen));
+  for(i=0; i<blocksize; i++)
+  {
+    if(seen[block[i]]==0)
+    {
+      seen[block[i]]=1;
+      distinct++;
+    }
+  }
+  if(distinct==1)
+    return PTRIAGE_CLASS_UNIFORM;
+  if(distinct >= high_distinct)
+    return PTRIAGE_CLASS_HIGH;
+  if(distinct > 64)
+    return PTRIAGE_CLASS_MID;
+  return PTRIAGE_CLASS_LOW;
+}
+
+static unsigned int ptriage_format(const struct ph_param *params, const file_stat_t *file_stat)
+{
+  return file_stat - params->file_stats;
+}
+
+/* Read size bytes from the disk offset and check their blocks */
+static unsigned int ptriage_piece(ptriage_ctx_t *ctx, const unsigned int k, const uint64_t offset, const unsigned int size)
+{
+  struct ph_param *params=ctx->params;
+  ptriage_stratum_t *stratum=&ctx->strata[k];
+  const unsigned int blocksize=params->blocksize;
+  file_recovery_t file_recovery;
+  unsigned char *buffer=ctx->data + blocksize;
+  unsigned int i;
+  int res;
+  res=params->disk->pread(params->disk, buffer, size + ctx->read_size, offset);
+  if(res < (signed)size)
+    return (res > 0 ? res : 0);
+  memset(buffer + res, 0, size + ctx->read_size - res);
+  memset(ctx->data, 0, blocksize);
+  reset_file_recovery(&file_recovery);
+  file_recovery.blocksize=blocksize;
+  for(i=0; i<size; i+=blocksize)
+  {
+    const file_stat_t *file_stat;
+    const unsigned int cls=ptriage_class(buffer + i, blocksize, ctx->high_distinct);
+    stratum->blocks++;
+    stratum->cls[cls]++;
+    if(cls!=PTRIAGE_CLASS_UNIFORM)
+      stratum->data++;
+    file_stat=phbs_check(buffer + i, ctx->read_size, blocksize, offset + i, &file_recovery);
+    if(file_stat==NULL)
+      continue;
+    ctx->counts[k * ctx->nbr_formats + ptriage_format(params, file_stat)]++;
+    if(ctx->nbr_hits==ctx->allocated_hits)
+    {
+      ctx->allocated_hits=(ctx->allocated_hits==0 ? 256 : ctx->allocated_hits*2);
+      ctx->hits=(ptriage_hit_t *)realloc(ctx->hits, ctx->allocated_hits * sizeof(ptriage_hit_t));
+      if(ctx->hits==NULL)
+      {
+	log_critical("photorec_triage: not enough memory\n");
+	exit(1);
+      }
+    }
+    ctx->hits[ctx->nbr_hits].offset=offset + i;
+    ctx->hits[ctx->nbr_hits].format=ptriage_format(params, file_stat);
+    ctx->nbr_hits++;
+  }
+  return size;
+}
+
+/* Read a window of the stratum, it may span several extents of the
+ * search space, return the number of bytes read */
+static unsigned int ptriage_window(ptriage_ctx_t *ctx, const unsigned int k, const unsigned int slot)
+{
+  const ptriage_stratum_t *stratum=&ctx->strata[k];
+  const unsigned int blocksize=ctx->params->blocksize;
+  const ptriage_extent_t *extent;
+  uint64_t pos=stratum->pos + (uint64_t)slot * ctx->window_size;
+  uint64_t end=pos + ctx->window_size;
+  unsigned int bytes_read=0;
+  if(end > stratum->pos + stratum->len)
+    end=stratum->pos + stratum->len;
+  ctx->strata[k].windows++;
+  extent=ptriage_extent(ctx->extents, ctx->nbr_extents, pos);
+  while(pos < end && extent < &ctx->extents[ctx->nbr_extents])
+  {
+    const uint64_t extent_end=extent->pos + extent->len;
+    unsigned int size=(extent_end < end ? extent_end : end) - pos;
+    size=size / blocksize * blocksize;
+    if(size > 0)
+      bytes_read+=ptriage_piece(ctx, k, extent->start + (pos - extent->pos), size);
+    pos=extent_end;
+    extent++;
+  }
+  return bytes_read;
+}
+
+static uint64_t ptriage_sqrt(const uint64_t x)
+{
+  uint64_t res=x;
+  uint64_t next;
+  if(x < 2)
+    return x;
+  next=(res + x / res) / 2;
+  while(next < res)
+  {
+    res=next;
+    next=(res + x / res) / 2;
+  }
+  return res;
+}
+
+static int ptriage_hit_cmp(const void *a, const void *b)
+{
+  const ptriage_hit_t *ha=(const ptriage_hit_t *)a;
+  const ptriage_hit_t *hb=(const ptriage_hit_t *)b;
+  if(ha->offset!=hb->offset)
+    return (ha->offset < hb->offset ? -1 : 1);
+  return 0;
+}
+
+static void ptriage_line(FILE *f, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Write a line of the report to the log and to f */
+static void ptriage_line(FILE *f, const char *fmt, ...)
+{
+  char line[1024];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  line[sizeof(line)-1]='\0';
+  log_info("%s", line);
+  if(f!=NULL)
+    fputs(line, f);
+}
+
+static void ptriage_report(const ptriage_ctx_t *ctx, const uint64_t total, const uint64_t bytes_read, const time_t elapsed)
+{
+  const struct ph_param *params=ctx->params;
+  const unsigned int blocksize=params->blocksize;
+  const unsigned int sector_size=params->disk->sector_size;
+  const uint64_t part_offset=params->partition->part_offset;
+  char filename[2048];
+  uint64_t sampled_len=0;
+  uint64_t est_data=0;
+  unsigned int f;
+  unsigned int c;
+  unsigned int k;
+  FILE *out;
+  snprintf(filename, sizeof(filename), "%s.%u/triage.txt", params->recup_dir, params->dir_num);
+  out=fopen(filename, "w");
+  if(out==NULL)
+    log_error("Cannot create %s\n", filename);
+  for(k=0; k<ctx->nbr_strata; k++)
+    if(ctx->strata[k].blocks > 0)
+      sampled_len+=ctx->strata[k].len;
+  ptriage_line(out, "Triage: %llu bytes read out of %llu in %lus, %u strata of %llu bytes\n",
+      (long long unsigned)bytes_read, (long long unsigned)total, (long unsigned)elapsed,
+      ctx->nbr_strata, (long long unsigned)ctx->strata[0].len);
+  if(sampled_len==0)
+  {
+    ptriage_line(out, "Triage: nothing could be read\n");
+    if(out!=NULL)
+      fclose(out);
+    return ;
+  }
+  /* The strata not read have the density of the others */
+  ptriage_line(out, "\nVolume\n");
+  for(c=0; c<PTRIAGE_CLASSES; c++)
+  {
+    uint64_t est=0;
+    for(k=0; k<ctx->nbr_strata; k++)
+    {
+      const ptriage_stratum_t *stratum=&ctx->strata[k];
+      if(stratum->blocks > 0)
+	est+=(uint64_t)((double)stratum->len * stratum->cls[c] / stratum->blocks);
+    }
+    est=(uint64_t)((double)est * total / sampled_len);
+    if(c!=PTRIAGE_CLASS_UNIFORM)
+      est_data+=est;
+    ptriage_line(out, "%-13s %12llu MiB %5.1f%%\n", ptriage_class_name[c],
+	(long long unsigned)(est >> 20), 100.0 * est / total);
+  }
+  ptriage_line(out, "\nFormat       Estimate   +/- 95%%   Found Strata Locations (sector)\n");
+  for(f=0; f<ctx->nbr_formats; f++)
+  {
+    double est=0.0;
+    double var=0.0;
+    unsigned int found=0;
+    unsigned int strata=0;
+    unsigned int locations=0;
+    unsigned int i;
+    char list[256];
+    for(k=0; k<ctx->nbr_strata; k++)
+    {
+      const ptriage_stratum_t *stratum=&ctx->strata[k];
+      const unsigned int hits=ctx->counts[k * ctx->nbr_formats + f];
+      if(hits==0)
+	continue;
+      {
+	/* Stratified estimate, the headers are counted as a Poisson process */
+	const double weight=(double)stratum->len / ((double)stratum->blocks * blocksize);
+	const double fpc=(weight > 1.0 ? 1.0 - 1.0 / weight : 0.0);
+	est+=hits * weight;
+	var+=hits * weight * weight * fpc;
+      }
+      found+=hits;
+      strata++;
+    }
+    if(found==0)
+      continue;
+    est=est * total / sampled_len;
+    var=var * total / sampled_len * total / sampled_len;
+    list[0]='\0';
+    for(i=0; i<ctx->nbr_hits && locations<PTRIAGE_LOCATIONS; i++)
+    {
+      if(ctx->hits[i].format==f)
+      {
+	const unsigned int len=strlen(list);
+	snprintf(&list[len], sizeof(list)-len, " %llu",
+	    (long long unsigned)((ctx->hits[i].offset - part_offset) / sector_size));
+	locations++;
+      }
+    }
+    ptriage_line(out, "%-8s %12llu %9llu %7u %6u%s%s\n",
+	params->file_stats[f].file_hint->extension,
+	(long long unsigned)(est + 0.5),
+	(long long unsigned)(1.96 * ptriage_sqrt((uint64_t)var) + 0.5),
+	found, strata, list, (found > locations ? " ..." : ""));
+  }
+  ptriage_line(out, "\nData: %llu MiB, %u headers found\n",
+      (long long unsigned)(est_data >> 20), ctx->nbr_hits);
+  if(out!=NULL)
+    fclose(out);
+}
+
+/* Return 1 if offset is still in the search space */
+static int ptriage_in_search_space(const alloc_data_t *list_search_space, const uint64_t offset)
+{
+  struct td_list_head *search_walker = NULL;
+  td_list_for_each(search_walker, &list_search_space->list)
+  {
+    const alloc_data_t *current_search_space=td_list_entry_const(search_walker, const alloc_data_t, list);
+    if(current_search_space->start <= offset && offset <= current_search_space->end)
+      return 1;
+    if(current_search_space->start > offset)
+      return 0;
+  }
+  return 0;
+}
+
+/* Carve the files whose header was found, the hits are sorted */
+static pstatus_t ptriage_carve(ptriage_ctx_t *ctx, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+  struct ph_param *params=ctx->params;
+  pstatus_t ind_stop=PSTATUS_OK;
+  unsigned int i;
+  for(i=0; i<ctx->nbr_hits && ind_stop==PSTATUS_OK; i++)
+  {
+    /* Already part of a file carved */
+    if(ptriage_in_search_space(list_search_space, ctx->hits[i].offset)==0)
+      continue;
+    params->offset=ctx->hits[i].offset;
+    params->offset_end=ctx->hits[i].offset;
+    ind_stop=photorec_aux(params, options, list_search_space);
+  }
+  params->offset_end=PH_INVALID_OFFSET;
+  return ind_stop;
+}
+#endif
+
+pstatus_t photorec_triage(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  ptriage_ctx_t ctx;
+  ptriage_extent_t *extents;
+  uint64_t total;
+  uint64_t stratum_size;
+  uint64_t bytes_read=0;
+  double not_seen=1.0;
+  const unsigned int blocksize=params->blocksize;
+  const time_t start_time=time(NULL);
+  time_t previous_time=start_time;
+  unsigned int left;
+  unsigned int round;
+  unsigned int k;
+  int stop=0;
+  pstatus_t ind_stop=PSTATUS_OK;
+  params->offset=PH_INVALID_OFFSET;
+  params->offset_end=PH_INVALID_OFFSET;
+  if(td_list_empty(&list_search_space->list))
+  {
+    params->status=STATUS_QUIT;
+    return PSTATUS_OK;
+  }
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.params=params;
+  ctx.nbr_extents=ptriage_extents(list_search_space, &extents, &total);
+  ctx.extents=extents;
+  for(ctx.nbr_formats=0; params->file_stats[ctx.nbr_formats].file_hint!=NULL; ctx.nbr_formats++);
+  ctx.window_size=(blocksize > PTRIAGE_WINDOW_SIZE ? blocksize : PTRIAGE_WINDOW_SIZE / blocksize * blocksize);
+  ctx.read_size=(blocksize > 65536 ? blocksize : 65536);
+  ctx.nbr_strata=(total / ctx.window_size > PTRIAGE_STRATA ? PTRIAGE_STRATA : total / ctx.window_size);
+  if(ctx.nbr_strata==0)
+    ctx.nbr_strata=1;
+  stratum_size=(total + ctx.nbr_strata - 1) / ctx.nbr_strata;
+  stratum_size=(stratum_size + ctx.window_size - 1) / ctx.window_size * ctx.window_size;
+  ctx.strata=(ptriage_stratum_t *)MALLOC(ctx.nbr_strata * sizeof(ptriage_stratum_t));
+  memset(ctx.strata, 0, ctx.nbr_strata * sizeof(ptriage_stratum_t));
+  for(k=0; k<ctx.nbr_strata; k++)
+  {
+    ptriage_stratum_t *stratum=&ctx.strata[k];
+    stratum->pos=(uint64_t)k * stratum_size;
+    if(stratum->pos >= total)
+    {
+      ctx.nbr_strata=k;
+      break;
+    }
+    stratum->len=(total - stratum->pos < stratum_size ? total - stratum->pos : stratum_size);
+    stratum->slots=(stratum->len + ctx.window_size - 1) / ctx.window_size;
+    while((1U << stratum->slot_bits) < stratum->slots)
+      stratum->slot_bits++;
+  }
+  ctx.counts=(unsigned int *)MALLOC(ctx.nbr_strata * (ctx.nbr_formats + 1) * sizeof(unsigned int));
+  memset(ctx.counts, 0, ctx.nbr_strata * (ctx.nbr_formats + 1) * sizeof(unsigned int));
+  ctx.data=(unsigned char *)MALLOC_IO(blocksize + ctx.window_size + ctx.read_size);
+  /* Distinct byte values expected in a block of random data */
+  for(k=0; k<blocksize && k<65536; k++)
+    not_seen*=255.0/256.0;
+  ctx.high_distinct=(unsigned int)(256.0 * (1.0 - not_seen) * 0.85);
+  log_info("Triage scan: %u strata, budget %us %lluMiB\n", ctx.nbr_strata,
+      ptriage_seconds, (long long unsigned)(ptriage_bytes >> 20));
+  left=ctx.nbr_strata;
+  for(round=0; left > 0 && stop==0; round++)
+  {
+    for(k=0; k<ctx.nbr_strata && stop==0; k++)
+    {
+      ptriage_stratum_t *stratum=&ctx.strata[k];
+      int slot;
+      if(stratum->exhausted!=0)
+	continue;
+      if(stratum->windows > 0 && stratum->data==0 && round % PTRIAGE_EMPTY_RATE!=0)
+	continue;
+      slot=ptriage_next_slot(stratum);
+      if(slot < 0)
+      {
+	left--;
+	continue;
+      }
+      bytes_read+=ptriage_window(&ctx, k, slot);
+      {
+	const time_t current_time=time(NULL);
+	if(ptriage_bytes > 0 && bytes_read >= ptriage_bytes)
+	  stop=1;
+	if(ptriage_seconds > 0 && current_time >= start_time + (time_t)ptriage_seconds)
+	  stop=1;
+#ifdef HAVE_NCURSES
+	if(current_time>previous_time)
+	{
+	  previous_time=current_time;
+	  if(photorec_progressbar(stdscr, params->pass, params, stratum->pos, current_time))
+	  {
+	    log_info("PhotoRec has been stopped\n");
+	    need_to_stop=1;
+	  }
+	}
+#else
+	(void)previous_time;
+#endif
+	if(need_to_stop!=0)
+	  stop=1;
+      }
+    }
+  }
+  qsort(ctx.hits, ctx.nbr_hits, sizeof(ptriage_hit_t), ptriage_hit_cmp);
+  ptriage_report(&ctx, total, bytes_read, time(NULL) - start_time);
+  free(ctx.data);
+  free(ctx.counts);
+  free(ctx.strata);
+  free(extents);
+  if(need_to_stop!=0)
+    ind_stop=PSTATUS_STOP;
+  else if(ptriage_recover > 0)
+    ind_stop=ptriage_carve(&ctx, options, list_search_space);
+  free(ctx.hits);
+  params->offset=PH_INVALID_OFFSET;
+  if(ind_stop==PSTATUS_OK)
+    params->status=STATUS_QUIT;
+  return ind_stop;
+#else
+  return photorec_aux(params, options, list_search_space);
+#endif
+}
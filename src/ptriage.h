@@ -0,0 +1,67 @@
+/*
+
+    File: ptriage.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PTRIAGE_H
+#define _PTRIAGE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Triage scan: instead of carving the search space, 1 MiB windows are
+ * read until a time or a byte budget is spent. The search space is split
+ * into up to 256 strata of the same size, each round reads one more
+ * window of each stratum, spread inside the stratum in bit-reversed
+ * order so the windows read so far always cover it evenly. A stratum
+ * whose windows only held wiped blocks is read once every 4 rounds.
+ * Every block of a window goes through the header checks of the sampled
+ * block size estimate. The number of files of each format and the volume
+ * of wiped, low, mid and high entropy data are extrapolated per stratum,
+ * the report is logged and written to recup_dir.N/triage.txt.
+ * When recover is set, the files whose header was found are carved, one
+ * after the other, once the budget is spent. */
+
+/* seconds==0 and bytes==0 disable the triage scan */
+/*@
+  @ assigns \nothing;
+  @*/
+void ptriage_set(const unsigned int seconds, const uint64_t bytes, const int recover);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int ptriage_enabled(void);
+
+/* A single pass: params->status is set to STATUS_QUIT once done */
+/*@
+  @ requires \valid(params);
+  @ requires valid_ph_param(params);
+  @ requires \valid_read(options);
+  @ requires \valid(list_search_space);
+  @ requires \separated(params, options, list_search_space);
+  @ decreases 0;
+  @ ensures  valid_ph_param(params);
+  @*/
+pstatus_t photorec_triage(struct ph_param *params, const struct ph_options *options, alloc_data_t *list_search_space);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
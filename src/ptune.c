@@ -0,0 +1,232 @@
+/*
+
+    File: ptune.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "hdaccess.h"
+#include "hdstats.h"
+#include "log.h"
+#include "ptune.h"
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Time and data budget of each candidate */
+#define PTUNE_TIME		(250*1000*1000)
+#define PTUNE_BYTES		(16*1024*1024)
+/* Each candidate reads fresh data, after the read-ahead of the previous one */
+#define PTUNE_SPAN		(2*PTUNE_BYTES)
+/* Read errors since the measure before measuring again */
+#define PTUNE_ERROR_STORM	64
+#define PTUNE_READ_SIZE_MAX	(4*1024*1024)
+
+static const unsigned int ptune_sizes[]={ 64*1024, 128*1024, 256*1024, 512*1024, 1024*1024, 2*1024*1024, 4*1024*1024 };
+static const unsigned int ptune_depths[]={ 1, 2, 4, 8, 16 };
+
+static unsigned int ptune_size_forced=0;
+static int ptune_depth_forced=-1;
+static char *ptune_device=NULL;
+static uint64_t ptune_part_offset=0;
+static unsigned int ptune_size=0;
+static uint64_t ptune_errors=0;
+
+static uint64_t ptune_disk_errors(void)
+{
+  disk_stats_summary_t summaries[16];
+  const unsigned int nbr=disk_stats_get(summaries, 16);
+  uint64_t errors=0;
+  unsigned int i;
+  for(i=0; i<nbr; i++)
+    errors+=summaries[i].nbr_errors;
+  return errors;
+}
+
+/* Read sequentially from offset with requests of size bytes, return the
+ * throughput in KiB/s, 0 on read error */
+static uint64_t ptune_measure(disk_t *disk, unsigned char *buffer, const uint64_t offset, const unsigned int size, uint64_t *latency)
+{
+  const uint64_t start=disk_stats_clock();
+  uint64_t elapsed=0;
+  uint64_t done=0;
+  unsigned int nbr=0;
+  while(done < PTUNE_BYTES && elapsed < PTUNE_TIME)
+  {
+    if(disk->pread(disk, buffer, size, offset + done) != (signed)size)
+      return 0;
+    done+=size;
+    nbr++;
+    elapsed=disk_stats_clock() - start;
+  }
+  if(elapsed==0)
+    elapsed=1;
+  *latency=elapsed / nbr;
+  return done * 1000000000 / 1024 / elapsed;
+}
+
+/* Smallest candidate within 10% of the best one, -1 if none */
+static int ptune_select(const uint64_t *speed, const unsigned int nbr)
+{
+  uint64_t best=0;
+  unsigned int i;
+  for(i=0; i<nbr; i++)
+    if(best < speed[i])
+      best=speed[i];
+  if(best==0)
+    return -1;
+  for(i=0; i<nbr; i++)
+    if(speed[i] * 10 >= best * 9)
+      return i;
+  return -1;
+}
+
+static void ptune_run(struct ph_param *params, const unsigned int blocksize, const unsigned int size_min)
+{
+  disk_t *disk=params->disk;
+  const unsigned int nbr_sizes=sizeof(ptune_sizes)/sizeof(ptune_sizes[0]);
+  const unsigned int nbr_depths=sizeof(ptune_depths)/sizeof(ptune_depths[0]);
+  const uint64_t span=(uint64_t)(nbr_sizes + nbr_depths) * PTUNE_SPAN;
+  uint64_t speed[sizeof(ptune_sizes)/sizeof(ptune_sizes[0])];
+  uint64_t region=params->partition->part_offset;
+  unsigned char *buffer;
+  unsigned int i;
+  int res;
+  if(ptune_size_forced > 0 && ptune_depth_forced >= 0)
+  {
+    log_info("Read tuning: read window %u KiB, read-ahead %d MiB\n",
+	ptune_size / 1024, ptune_depth_forced);
+    return ;
+  }
+  if(params->partition->part_size < span)
+  {
+    log_info("Read tuning: partition too small, read window %u KiB\n", ptune_size / 1024);
+    return ;
+  }
+  buffer=(unsigned char *)MALLOC_IO(PTUNE_READ_SIZE_MAX);
+  if(ptune_size_forced==0)
+  {
+    for(i=0; i<nbr_sizes; i++, region+=PTUNE_SPAN)
+    {
+      uint64_t latency=0;
+      speed[i]=0;
+      if(ptune_sizes[i] < size_min || ptune_sizes[i] % blocksize != 0)
+	continue;
+      speed[i]=ptune_measure(disk, buffer, region, ptune_sizes[i], &latency);
+      log_info("Read tuning: %4u KiB reads %8llu KiB/s, %llu us per read\n",
+	  ptune_sizes[i] / 1024, (long long unsigned)speed[i],
+	  (long long unsigned)(latency / 1000));
+    }
+    res=ptune_select(speed, nbr_sizes);
+    if(res >= 0)
+      ptune_size=ptune_sizes[res];
+  }
+  if(ptune_depth_forced < 0)
+  {
+    region=params->partition->part_offset + (uint64_t)nbr_sizes * PTUNE_SPAN;
+    for(i=0; i<nbr_depths; i++, region+=PTUNE_SPAN)
+    {
+      uint64_t latency=0;
+      file_set_readahead_depth(ptune_depths[i]);
+      speed[i]=ptune_measure(disk, buffer, region, ptune_size, &latency);
+      log_info("Read tuning: read-ahead %2u MiB %8llu KiB/s\n",
+	  ptune_depths[i], (long long unsigned)speed[i]);
+    }
+    res=ptune_select(speed, nbr_depths);
+    file_set_readahead_depth(res >= 0 ? ptune_depths[res] : 8);
+    log_info("Read tuning: read window %u KiB, read-ahead %u MiB\n",
+	ptune_size / 1024, (res >= 0 ? ptune_depths[res] : 8));
+  }
+  else
+    log_info("Read tuning: read window %u KiB\n", ptune_size / 1024);
+  free(buffer);
+}
+#endif
+
+void ptune_set_read_size(const unsigned int size)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  ptune_size_forced=size;
+#endif
+}
+
+void ptune_set_depth(const int depth)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  ptune_depth_forced=depth;
+  if(depth >= 0)
+    file_set_readahead_depth(depth);
+#endif
+}
+
+unsigned int ptune_read_size(struct ph_param *params, const unsigned int blocksize, const unsigned int default_size)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  /* The carving loop reads at least 64 KiB at a time */
+  const unsigned int size_min=4 * (blocksize > 65536 ? blocksize : 65536);
+  const uint64_t errors=ptune_disk_errors();
+  if(ptune_size_forced > 0)
+  {
+    const unsigned int size=(ptune_size_forced < size_min ? size_min : ptune_size_forced);
+    ptune_size=(size + blocksize - 1) / blocksize * blocksize;
+  }
+  if(ptune_device==NULL || strcmp(ptune_device, params->disk->device)!=0 ||
+      ptune_part_offset!=params->partition->part_offset ||
+      errors >= ptune_errors + PTUNE_ERROR_STORM)
+  {
+    if(ptune_device!=NULL && errors >= ptune_errors + PTUNE_ERROR_STORM)
+      log_info("Read tuning: %llu read errors, measuring again\n",
+	  (long long unsigned)(errors - ptune_errors));
+    free(ptune_device);
+    ptune_device=strdup(params->disk->device);
+    ptune_part_offset=params->partition->part_offset;
+    if(ptune_size_forced==0)
+      ptune_size=default_size;
+    ptune_run(params, blocksize, size_min);
+    ptune_errors=ptune_disk_errors();
+  }
+  /* Tuned with another block size */
+  if(ptune_size < size_min || ptune_size % blocksize != 0)
+    return default_size;
+  return ptune_size;
+#else
+  return default_size;
+#endif
+}
+
+void ptune_reset(void)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  free(ptune_device);
+  ptune_device=NULL;
+  ptune_size=0;
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+
+    File: ptune.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _PTUNE_H
+#define _PTUNE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shape of the reads of the carving loop: the size of the read window
+ * and the read-ahead depth are measured on the device before the first
+ * pass. Each candidate reads its own region of the partition for up to
+ * 250 ms, the smallest value within 10% of the best throughput is kept.
+ * The measure is made again after a burst of read errors. Partitions too
+ * small for the measure keep the default values. */
+
+/* Read window in bytes, 0 to measure it */
+/*@
+  @ assigns \nothing;
+  @*/
+void ptune_set_read_size(const unsigned int size);
+
+/* Number of read-ahead chunks, -1 to measure it */
+/*@
+  @ assigns \nothing;
+  @*/
+void ptune_set_depth(const int depth);
+
+/* Read window of the carving loop for params->disk, a multiple of
+ * blocksize. Measure the device if needed */
+/*@
+  @ requires \valid_read(params);
+  @ requires \valid(params->disk);
+  @ requires \valid_read(params->partition);
+  @ requires blocksize > 0;
+  @*/
+unsigned int ptune_read_size(struct ph_param *params, const unsigned int blocksize, const unsigned int default_size);
+
+/* Forget the measures */
+void ptune_reset(void);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,738 @@
+/*
+
+    File: qcow2.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#if !defined(HAVE_PREAD)
+/* Worker threads share the file descriptor */
+#undef HAVE_PTHREAD
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "qcow2.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define QCOW2_OFLAG_COPIED	(1ULL<<63)
+#define QCOW2_OFLAG_COMPRESSED	(1ULL<<62)
+#define QCOW2_OFLAG_ZERO	1ULL
+#define QCOW2_OFFSET_MASK	0x00fffffffffffe00ULL
+
+#define QCOW2_INCOMPAT_DIRTY		(1ULL<<0)
+#define QCOW2_INCOMPAT_CORRUPT		(1ULL<<1)
+#define QCOW2_INCOMPAT_COMPRESSION	(1ULL<<3)
+
+/* Keep the last L2 tables and the last decompressed clusters. When the
+ * image is read sequentially, the next compressed clusters are inflated
+ * ahead by worker threads. */
+#define QCOW2_L2_CACHE		16
+#define QCOW2_CACHE_CLUSTERS	64
+#define QCOW2_READ_AHEAD	16
+#define QCOW2_MAX_WORKERS	4
+
+extern const arch_fnct_t arch_none;
+
+typedef enum { QCOW2_CLUSTER_EMPTY=0, QCOW2_CLUSTER_LOADING=1, QCOW2_CLUSTER_READY=2 } qcow2_cluster_state_t;
+
+struct qcow2_cluster
+{
+  struct td_list_head list;	/* LRU, most recently used first */
+  uint64_t offset;		/* guest offset */
+  uint64_t entry;		/* L2 entry of the compressed cluster */
+  int status;			/* 0 if inflated, -1 on error */
+  qcow2_cluster_state_t state;
+  unsigned char *buffer;
+};
+
+struct qcow2_l2
+{
+  uint64_t offset;		/* host offset of the table, 0 if unused */
+  unsigned int last_used;
+  uint64_t *table;
+};
+
+struct info_qcow2_struct;
+
+#ifdef HAVE_PTHREAD
+struct qcow2_worker
+{
+  struct info_qcow2_struct *data;
+  unsigned char *cbuffer;	/* compressed data */
+  pthread_t thread;
+};
+#endif
+
+struct info_qcow2_struct
+{
+  int handle;
+  char *file_name;
+  uint64_t size;
+  unsigned int cluster_bits;
+  unsigned int cluster_size;
+  unsigned int l2_bits;
+  uint32_t l1_size;
+  uint64_t *l1_table;
+  struct qcow2_l2 l2[QCOW2_L2_CACHE];
+  unsigned int l2_clock;
+  struct qcow2_cluster clusters[QCOW2_CACHE_CLUSTERS];
+  struct td_list_head lru;
+  uint64_t next_offset;		/* expected offset of a sequential read */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct qcow2_cluster *queue[QCOW2_CACHE_CLUSTERS];
+  unsigned int queue_first;
+  unsigned int queue_nbr;
+  int quit;
+  unsigned int nbr_workers;
+  struct qcow2_worker workers[QCOW2_MAX_WORKERS];
+#endif
+};
+
+static const char *fqcow2_description(disk_t *disk);
+static const char *fqcow2_description_short(disk_t *disk);
+static void fqcow2_clean(disk_t *disk);
+static int fqcow2_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset);
+static int fqcow2_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset);
+static int fqcow2_sync(disk_t *disk);
+
+static inline void qcow2_lock(struct info_qcow2_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+#endif
+}
+
+static inline void qcow2_unlock(struct info_qcow2_struct *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->mutex);
+#endif
+}
+
+static int qcow2_read_at(const int fd, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#ifdef HAVE_PREAD
+  return pread(fd, buffer, count, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return read(fd, buffer, count);
+#endif
+}
+
+/* Inflate the compressed cluster described by entry, raw deflate data */
+static int qcow2_inflate(const struct info_qcow2_struct *data, const uint64_t entry, unsigned char *buffer, unsigned char *cbuffer)
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  const unsigned int x=62 - (data->cluster_bits - 8);
+  const uint64_t host_offset=entry & ((1ULL<<x) - 1);
+  const unsigned int nbr_sectors=((entry & ~(QCOW2_OFLAG_COPIED|QCOW2_OFLAG_COMPRESSED)) >> x) + 1;
+  const unsigned int csize=nbr_sectors * 512 - (host_offset & 511);
+  z_stream stream;
+  int res;
+  /* Compressed data may end before the last sector */
+  res=qcow2_read_at(data->handle, cbuffer, csize, host_offset);
+  if(res <= 0)
+    return -1;
+  memset(&stream, 0, sizeof(stream));
+  if(inflateInit2(&stream, -12) != Z_OK)
+    return -1;
+  stream.next_in=cbuffer;
+  stream.avail_in=res;
+  stream.next_out=buffer;
+  stream.avail_out=data->cluster_size;
+  res=inflate(&stream, Z_FINISH);
+  inflateEnd(&stream);
+  if(res!=Z_STREAM_END && stream.avail_out!=0)
+    return -1;
+  if(stream.avail_out!=0)
+    memset(buffer + data->cluster_size - stream.avail_out, 0, stream.avail_out);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* Return the L2 entry describing the cluster at guest offset,
+ * 0 if the cluster isn't allocated, called with the lock held */
+static int qcow2_l2_entry(struct info_qcow2_struct *data, const uint64_t offset, uint64_t *entry)
+{
+  const uint64_t l1_index=offset >> (data->cluster_bits + data->l2_bits);
+  const unsigned int l2_index=(offset >> data->cluster_bits) & ((1U << data->l2_bits) - 1);
+  uint64_t l2_offset;
+  struct qcow2_l2 *l2=NULL;
+  unsigned int i;
+  if(l1_index >= data->l1_size)
+  {
+    *entry=0;
+    return 0;
+  }
+  l2_offset=be64(data->l1_table[l1_index]) & QCOW2_OFFSET_MASK;
+  if(l2_offset==0)
+  {
+    *entry=0;
+    return 0;
+  }
+  for(i=0; i<QCOW2_L2_CACHE && l2==NULL; i++)
+    if(data->l2[i].offset==l2_offset)
+      l2=&data->l2[i];
+  if(l2==NULL)
+  {
+    l2=&data->l2[0];
+    for(i=1; i<QCOW2_L2_CACHE; i++)
+      if(data->l2[i].last_used < l2->last_used)
+	l2=&data->l2[i];
+    l2->offset=0;
+    if(l2->table==NULL)
+      l2->table=(uint64_t *)MALLOC(data->cluster_size);
+    if(qcow2_read_at(data->handle, l2->table, data->cluster_size, l2_offset) != (int)data->cluster_size)
+    {
+      log_error("%s: can't read qcow2 L2 table at %llu\n", data->file_name, (long long unsigned)l2_offset);
+      return -1;
+    }
+    l2->offset=l2_offset;
+  }
+  l2->last_used=++data->l2_clock;
+  *entry=be64(l2->table[l2_index]);
+  return 0;
+}
+
+static struct qcow2_cluster *qcow2_cluster_lookup(struct info_qcow2_struct *data, const uint64_t offset)
+{
+  unsigned int i;
+  for(i=0; i<QCOW2_CACHE_CLUSTERS; i++)
+  {
+    struct qcow2_cluster *cluster=&data->clusters[i];
+    if(cluster->state!=QCOW2_CLUSTER_EMPTY && cluster->offset==offset)
+      return cluster;
+  }
+  return NULL;
+}
+
+/* Least recently used cluster that is not being inflated */
+static struct qcow2_cluster *qcow2_cluster_victim(struct info_qcow2_struct *data)
+{
+  struct td_list_head *walker;
+  td_list_for_each_prev(walker, &data->lru)
+  {
+    struct qcow2_cluster *cluster=td_list_entry(walker, struct qcow2_cluster, list);
+    if(cluster->state!=QCOW2_CLUSTER_LOADING)
+      return cluster;
+  }
+  return NULL;
+}
+
+#ifdef HAVE_PTHREAD
+static void *qcow2_worker_thread(void *arg)
+{
+  struct qcow2_worker *worker=(struct qcow2_worker *)arg;
+  struct info_qcow2_struct *data=worker->data;
+  pthread_mutex_lock(&data->mutex);
+  while(1)
+  {
+    struct qcow2_cluster *cluster;
+    int res;
+    while(data->queue_nbr==0 && data->quit==0)
+      pthread_cond_wait(&data->cond, &data->mutex);
+    if(data->quit!=0)
+      break;
+    cluster=data->queue[data->queue_first];
+    data->queue_first=(data->queue_first + 1) % QCOW2_CACHE_CLUSTERS;
+    data->queue_nbr--;
+    /* A cluster being inflated is never recycled */
+    pthread_mutex_unlock(&data->mutex);
+    res=qcow2_inflate(data, cluster->entry, cluster->buffer, worker->cbuffer);
+    pthread_mutex_lock(&data->mutex);
+    cluster->status=res;
+    cluster->state=QCOW2_CLUSTER_READY;
+    pthread_cond_broadcast(&data->cond);
+  }
+  pthread_mutex_unlock(&data->mutex);
+  return NULL;
+}
+
+/* Queue the compressed clusters following a sequential read,
+ * called with the lock held */
+static void qcow2_read_ahead(struct info_qcow2_struct *data, const uint64_t cluster_offset)
+{
+  unsigned int i;
+  if(data->nbr_workers==0)
+    return ;
+  for(i=1; i<=QCOW2_READ_AHEAD && data->queue_nbr < QCOW2_CACHE_CLUSTERS; i++)
+  {
+    const uint64_t offset=cluster_offset + ((uint64_t)i << data->cluster_bits);
+    struct qcow2_cluster *cluster;
+    uint64_t entry;
+    if(offset >= data->size)
+      break;
+    if(qcow2_l2_entry(data, offset, &entry) < 0)
+      break;
+    if((entry & QCOW2_OFLAG_COMPRESSED)==0 || qcow2_cluster_lookup(data, offset)!=NULL)
+      continue;
+    cluster=qcow2_cluster_victim(data);
+    if(cluster==NULL)
+      break;
+    cluster->offset=offset;
+    cluster->entry=entry;
+    cluster->status=0;
+    cluster->state=QCOW2_CLUSTER_LOADING;
+    td_list_del(&cluster->list);
+    td_list_add(&cluster->list, &data->lru);
+    data->queue[(data->queue_first + data->queue_nbr) % QCOW2_CACHE_CLUSTERS]=cluster;
+    data->queue_nbr++;
+  }
+  pthread_cond_broadcast(&data->cond);
+}
+#endif
+
+/* Return the inflated cluster at offset, called with the lock held */
+static struct qcow2_cluster *qcow2_cluster_get(struct info_qcow2_struct *data, const uint64_t offset, const uint64_t entry)
+{
+  struct qcow2_cluster *cluster;
+  while(1)
+  {
+    cluster=qcow2_cluster_lookup(data, offset);
+    if(cluster!=NULL)
+    {
+      if(cluster->state==QCOW2_CLUSTER_READY)
+	break;
+#ifdef HAVE_PTHREAD
+      pthread_cond_wait(&data->cond, &data->mutex);
+      continue;
+#endif
+    }
+    cluster=qcow2_cluster_victim(data);
+#ifdef HAVE_PTHREAD
+    if(cluster==NULL)
+    {
+      pthread_cond_wait(&data->cond, &data->mutex);
+      continue;
+    }
+#endif
+    {
+      unsigned char *cbuffer=(unsigned char *)MALLOC(2 * data->cluster_size);
+      int res;
+      cluster->offset=offset;
+      cluster->entry=entry;
+      cluster->state=QCOW2_CLUSTER_LOADING;
+      qcow2_unlock(data);
+      res=qcow2_inflate(data, entry, cluster->buffer, cbuffer);
+      qcow2_lock(data);
+      free(cbuffer);
+      cluster->status=res;
+      cluster->state=QCOW2_CLUSTER_READY;
+#ifdef HAVE_PTHREAD
+      pthread_cond_broadcast(&data->cond);
+#endif
+    }
+    break;
+  }
+  td_list_del(&cluster->list);
+  td_list_add(&cluster->list, &data->lru);
+  return cluster;
+}
+
+static int fqcow2_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_qcow2_struct *data=(struct info_qcow2_struct *)disk->data;
+  unsigned int done=0;
+  if(offset >= data->size)
+    return 0;
+  qcow2_lock(data);
+  while(done < count && offset + done < data->size)
+  {
+    const uint64_t pos=offset + done;
+    const uint64_t cluster_offset=pos >> data->cluster_bits << data->cluster_bits;
+    const unsigned int in_cluster=pos - cluster_offset;
+    unsigned int size=(data->cluster_size - in_cluster < count - done ? data->cluster_size - in_cluster : count - done);
+    uint64_t entry;
+    if(size > data->size - pos)
+      size=data->size - pos;
+    if(qcow2_l2_entry(data, cluster_offset, &entry) < 0)
+      break;
+    if((entry & QCOW2_OFLAG_COMPRESSED)!=0)
+    {
+      const struct qcow2_cluster *cluster=qcow2_cluster_get(data, cluster_offset, entry);
+      if(cluster->status < 0)
+      {
+	log_error("%s: can't inflate qcow2 cluster at %llu\n", data->file_name, (long long unsigned)cluster_offset);
+	break;
+      }
+      memcpy((unsigned char *)buffer + done, cluster->buffer + in_cluster, size);
+    }
+    else if((entry & QCOW2_OFFSET_MASK)==0 || (entry & QCOW2_OFLAG_ZERO)!=0)
+    {
+      /* Unallocated or zero cluster, there is no backing file */
+      memset((unsigned char *)buffer + done, 0, size);
+    }
+    else
+    {
+      int res;
+      qcow2_unlock(data);
+      res=qcow2_read_at(data->handle, (unsigned char *)buffer + done, size, (entry & QCOW2_OFFSET_MASK) + in_cluster);
+      qcow2_lock(data);
+      if(res != (int)size)
+      {
+	log_error("fqcow2_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read err: %s\n",
+	    (unsigned)(count/disk->sector_size), (long unsigned)(pos/disk->sector_size),
+	    offset2cylinder(disk,pos), offset2head(disk,pos), offset2sector(disk,pos),
+	    (res<0 ? strerror(errno) : "short read"));
+	break;
+      }
+    }
+    done+=size;
+  }
+#ifdef HAVE_PTHREAD
+  if(done > 0 && offset==data->next_offset)
+    qcow2_read_ahead(data, (offset + done - 1) >> data->cluster_bits << data->cluster_bits);
+#endif
+  data->next_offset=offset + done;
+  qcow2_unlock(data);
+  if(done==0 && count > 0)
+    return -1;
+  return done;
+}
+
+static int fqcow2_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fqcow2_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fqcow2_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fqcow2_description(disk_t *disk)
+{
+  const struct info_qcow2_struct *data=(const struct info_qcow2_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"Image %s - %s - CHS %lu %u %u (RO)",
+      data->file_name, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *fqcow2_description_short(disk_t *disk)
+{
+  const struct info_qcow2_struct *data=(const struct info_qcow2_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"Image %s - %s (RO)",
+      data->file_name, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void qcow2_cache_init(struct info_qcow2_struct *data)
+{
+  unsigned int i;
+  TD_INIT_LIST_HEAD(&data->lru);
+  for(i=0; i<QCOW2_CACHE_CLUSTERS; i++)
+  {
+    struct qcow2_cluster *cluster=&data->clusters[i];
+    cluster->state=QCOW2_CLUSTER_EMPTY;
+    cluster->buffer=(unsigned char *)MALLOC(data->cluster_size);
+    td_list_add_tail(&cluster->list, &data->lru);
+  }
+  data->next_offset=(uint64_t)-1;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond, NULL);
+  data->queue_first=0;
+  data->queue_nbr=0;
+  data->quit=0;
+  data->nbr_workers=0;
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  for(i=0; i<QCOW2_MAX_WORKERS; i++)
+  {
+    struct qcow2_worker *worker=&data->workers[data->nbr_workers];
+    worker->data=data;
+    worker->cbuffer=(unsigned char *)MALLOC(2 * data->cluster_size);
+    if(pthread_create(&worker->thread, NULL, &qcow2_worker_thread, worker)!=0)
+    {
+      free(worker->cbuffer);
+      break;
+    }
+    data->nbr_workers++;
+  }
+#endif
+#endif
+}
+
+static void qcow2_cache_free(struct info_qcow2_struct *data)
+{
+  unsigned int i;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+  data->quit=1;
+  pthread_cond_broadcast(&data->cond);
+  pthread_mutex_unlock(&data->mutex);
+  for(i=0; i<data->nbr_workers; i++)
+  {
+    pthread_join(data->workers[i].thread, NULL);
+    free(data->workers[i].cbuffer);
+  }
+  data->nbr_workers=0;
+  pthread_cond_destroy(&data->cond);
+  pthread_mutex_destroy(&data->mutex);
+#endif
+  for(i=0; i<QCOW2_CACHE_CLUSTERS; i++)
+    free(data->clusters[i].buffer);
+  for(i=0; i<QCOW2_L2_CACHE; i++)
+    free(data->l2[i].table);
+}
+
+static void fqcow2_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    struct info_qcow2_struct *data=(struct info_qcow2_struct *)disk->data;
+    qcow2_cache_free(data);
+    close(data->handle);
+    free(data->l1_table);
+    free(data->file_name);
+  }
+  generic_clean(disk);
+}
+
+int fqcow2_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg)
+{
+  struct info_qcow2_struct *data;
+  uint64_t pos;
+  uint64_t hole_start=0;
+  int in_hole=0;
+  int nbr=0;
+  if(disk->clean!=&fqcow2_clean)
+  {
+    errno=EINVAL;
+    return -1;
+  }
+  data=(struct info_qcow2_struct *)disk->data;
+  qcow2_lock(data);
+  for(pos=start >> data->cluster_bits << data->cluster_bits;
+      pos <= end && pos < data->size;)
+  {
+    const uint64_t l1_index=pos >> (data->cluster_bits + data->l2_bits);
+    uint64_t next=pos + data->cluster_size;
+    int hole;
+    if(l1_index >= data->l1_size || (be64(data->l1_table[l1_index]) & QCOW2_OFFSET_MASK)==0)
+    {
+      /* No L2 table */
+      hole=1;
+      next=(l1_index + 1) << (data->cluster_bits + data->l2_bits);
+    }
+    else
+    {
+      uint64_t entry;
+      if(qcow2_l2_entry(data, pos, &entry) < 0)
+	break;
+      hole=((entry & QCOW2_OFLAG_COMPRESSED)==0 &&
+	  ((entry & QCOW2_OFFSET_MASK)==0 || (entry & QCOW2_OFLAG_ZERO)!=0));
+    }
+    if(hole!=0 && in_hole==0)
+    {
+      hole_start=(pos < start ? start : pos);
+      in_hole=1;
+    }
+    else if(hole==0 && in_hole!=0)
+    {
+      fnct(hole_start, pos - 1, arg);
+      nbr++;
+      in_hole=0;
+    }
+    pos=next;
+  }
+  qcow2_unlock(data);
+  if(in_hole!=0)
+  {
+    uint64_t hole_end=pos - 1;
+    if(hole_end > end)
+      hole_end=end;
+    if(hole_end > data->size - 1)
+      hole_end=data->size - 1;
+    fnct(hole_start, hole_end, arg);
+    nbr++;
+  }
+  return nbr;
+}
+
+/* Check the header, return -1 if the image can't be read */
+static int qcow2_check_header(const struct qcow2_header *hdr, const char *device)
+{
+  const unsigned int version=be32(hdr->version);
+  const unsigned int cluster_bits=be32(hdr->cluster_bits);
+  if(be32(hdr->magic)!=QCOW2_MAGIC || (version!=2 && version!=3))
+  {
+    log_error("%s: unsupported qcow version %u\n", device, version);
+    return -1;
+  }
+  if(cluster_bits < 9 || cluster_bits > 21)
+  {
+    log_error("%s: invalid qcow2 cluster size\n", device);
+    return -1;
+  }
+  if(be32(hdr->crypt_method)!=0)
+  {
+    log_error("%s: encrypted qcow2 images are not supported\n", device);
+    return -1;
+  }
+  if(be64(hdr->backing_file_offset)!=0)
+  {
+    log_error("%s: qcow2 images with a backing file are not supported\n", device);
+    return -1;
+  }
+  if(version >= 3)
+  {
+    const uint64_t incompatible=be64(hdr->incompatible_features);
+    if((incompatible & QCOW2_INCOMPAT_CORRUPT)!=0)
+      log_warning("%s: qcow2 image is marked as corrupt\n", device);
+    if((incompatible & QCOW2_INCOMPAT_COMPRESSION)!=0 &&
+	be32(hdr->header_length) > offsetof(struct qcow2_header, compression_type) &&
+	hdr->compression_type!=0)
+    {
+      log_error("%s: qcow2 compression type %u is not supported\n", device, hdr->compression_type);
+      return -1;
+    }
+    if((incompatible & ~(QCOW2_INCOMPAT_DIRTY|QCOW2_INCOMPAT_CORRUPT|QCOW2_INCOMPAT_COMPRESSION))!=0)
+    {
+      log_error("%s: unsupported qcow2 features 0x%llx\n", device, (long long unsigned)incompatible);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+disk_t *fqcow2_init(const char *device, const int testdisk_mode)
+{
+  struct qcow2_header hdr;
+  struct info_qcow2_struct *data;
+  disk_t *disk;
+  uint64_t l1_needed;
+  const int fd=open(device, O_RDONLY|O_BINARY);
+  if(fd<0)
+    return NULL;
+  memset(&hdr, 0, sizeof(hdr));
+  if(qcow2_read_at(fd, &hdr, sizeof(hdr), 0) < (int)offsetof(struct qcow2_header, incompatible_features) ||
+      qcow2_check_header(&hdr, device) < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  data=(struct info_qcow2_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->handle=fd;
+  data->cluster_bits=be32(hdr.cluster_bits);
+  data->cluster_size=1U << data->cluster_bits;
+  data->l2_bits=data->cluster_bits - 3;
+  data->size=be64(hdr.size);
+  data->l1_size=be32(hdr.l1_size);
+  l1_needed=(data->size + (1ULL << (data->cluster_bits + data->l2_bits)) - 1) >> (data->cluster_bits + data->l2_bits);
+  if(data->l1_size < l1_needed || data->l1_size > 32*1024*1024/sizeof(uint64_t))
+  {
+    log_error("%s: invalid qcow2 L1 table size %u\n", device, data->l1_size);
+    close(fd);
+    free(data);
+    return NULL;
+  }
+  data->l1_table=(uint64_t *)MALLOC(data->l1_size > 0 ? data->l1_size * sizeof(uint64_t) : sizeof(uint64_t));
+  if(data->l1_size > 0 &&
+      qcow2_read_at(fd, data->l1_table, data->l1_size * sizeof(uint64_t), be64(hdr.l1_table_offset)) != (int)(data->l1_size * sizeof(uint64_t)))
+  {
+    log_error("%s: can't read qcow2 L1 table\n", device);
+    close(fd);
+    free(data->l1_table);
+    free(data);
+    return NULL;
+  }
+  data->file_name=strdup(device);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(data->file_name==NULL || disk->device==NULL)
+  {
+    free(disk->device);
+    free(disk);
+    close(fd);
+    free(data->file_name);
+    free(data->l1_table);
+    free(data);
+    return NULL;
+  }
+  qcow2_cache_init(data);
+  disk->data=data;
+  disk->description=&fqcow2_description;
+  disk->description_short=&fqcow2_description_short;
+  disk->pread=&fqcow2_pread;
+  disk->pwrite=&fqcow2_nopwrite;
+  disk->sync=&fqcow2_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fqcow2_clean;
+  disk->sector_size=DEFAULT_SECTOR_SIZE;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: qcow2 images are opened read-only\n", device);
+  log_info("%s: qcow2 image, cluster size %u\n", device, data->cluster_size);
+  return disk;
+}
+#endif
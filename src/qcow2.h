@@ -0,0 +1,75 @@
+/*
+
+    File: qcow2.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _QCOW2_H
+#define _QCOW2_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QCOW2_MAGIC 0x514649fb	/* "QFI\xfb" */
+
+/* QEMU qcow2 image header, big-endian */
+struct qcow2_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t backing_file_offset;
+  uint32_t backing_file_size;
+  uint32_t cluster_bits;
+  uint64_t size;
+  uint32_t crypt_method;
+  uint32_t l1_size;
+  uint64_t l1_table_offset;
+  uint64_t refcount_table_offset;
+  uint32_t refcount_table_clusters;
+  uint32_t nb_snapshots;
+  uint64_t snapshots_offset;
+  /* version 3 */
+  uint64_t incompatible_features;
+  uint64_t compatible_features;
+  uint64_t autoclear_features;
+  uint32_t refcount_order;
+  uint32_t header_length;
+  uint8_t  compression_type;
+} __attribute__ ((gcc_struct, __packed__));
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open a qcow2 image read-only, NULL if the image can't be used */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fqcow2_init(const char *device, const int testdisk_mode);
+
+/* Report the unallocated and zero clusters of a disk returned by
+ * fqcow2_init(), see disk_find_unmapped() */
+/*@
+  @ requires \valid_read(disk);
+  @ requires valid_disk(disk);
+  @*/
+int fqcow2_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -37,7 +37,6 @@
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
-#include <QCoreApplication>
 #include "types.h"
 #include "common.h"
 #include "intrf.h"
@@ -90,7 +89,6 @@ pstatus_t QPhotorec::photorec_find_blocksize(alloc_data_t *list_search_space)
   if(options->verbose>0)
     info_list_search_space(list_search_space, current_search_space, params->disk->sector_size, 0, options->verbose);
   params->offset=offset;
-  QCoreApplication::processEvents();
   params->disk->pread(params->disk, buffer, READ_SIZE, offset);
   while(current_search_space!=list_search_space)
   {
@@ -194,8 +192,9 @@ pstatus_t QPhotorec::photorec_find_blocksize(alloc_data_t *list_search_space)
         if(current_time>previous_time)
         {
           previous_time=current_time;
-	  QCoreApplication::processEvents();
-          if(stop_the_recovery)
+	  progress_publish();
+	  emit progress();
+          if(stop_the_recovery.loadAcquire()!=0)
 	  {
 	    log_info("PhotoRec has been stopped\n");
 	    current_search_space=list_search_space;
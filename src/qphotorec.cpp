@@ -70,7 +70,8 @@
 #include <QRadioButton>
 #include <QFileDialog>
 #include <QComboBox>
-#include <QTimer>
+#include <QEventLoop>
+#include <QMutexLocker>
 #include <QMessageBox>
 #include <QTextDocument>
 #include "types.h"
@@ -86,6 +87,7 @@
 #include "log.h"
 #include "log_part.h"
 #include "qphotorec.h"
+#include "phits.h"
 
 extern const arch_fnct_t arch_none;
 extern file_enable_t array_file_enable[];
@@ -119,7 +121,9 @@ QPhotorec::QPhotorec(QWidget *my_parent) : QWidget(my_parent)
   options->list_file_format=array_file_enable;
   reset_array_file_enable(options->list_file_format);
 
-  stop_the_recovery=false;
+  stop_the_recovery.storeRelease(0);
+  progress_file_stats=NULL;
+  progress_file_stats_nbr=0;
 
   setWindowIcon( QPixmap( ":res/photorec_64x64.png" ) );
   this->setWindowTitle(tr("QPhotoRec"));
@@ -146,6 +150,7 @@ QPhotorec::~QPhotorec()
 //  session_save(list_search_space, params, options);
   part_free_list(list_part);
   delete_list_disk(list_disk);
+  free(progress_file_stats);
   free(options);
   free(params);
 }
@@ -412,6 +417,13 @@ void QPhotorec::buttons_updateUI()
     case UP_FAT12:
     case UP_FAT16:
     case UP_FAT32:
+    case UP_HFSP:
+    case UP_HFSX:
+    case UP_XFS:
+    case UP_XFS2:
+    case UP_XFS3:
+    case UP_XFS4:
+    case UP_XFS5:
 #if defined(HAVE_LIBNTFS) || defined(HAVE_LIBNTFS3G)
     case UP_NTFS:
 #endif
@@ -636,8 +648,31 @@ void QPhotorec::photorec_info(const file_stat_t *file_stats)
   free(new_file_stats);
 }
 
+void QPhotorec::progress_publish()
+{
+  unsigned int nbr=0;
+  QMutexLocker locker(&progress_mutex);
+  progress_params=*params;
+  if(params->file_stats==NULL)
+    return ;
+  while(params->file_stats[nbr].file_hint!=NULL)
+    nbr++;
+  if(progress_file_stats==NULL || nbr!=progress_file_stats_nbr)
+  {
+    free(progress_file_stats);
+    progress_file_stats=(file_stat_t*)MALLOC((nbr+1)*sizeof(file_stat_t));
+    progress_file_stats_nbr=nbr;
+  }
+  memcpy(progress_file_stats, params->file_stats, (nbr+1)*sizeof(file_stat_t));
+  progress_params.file_stats=progress_file_stats;
+}
+
 void QPhotorec::qphotorec_search_updateUI()
 {
+  QMutexLocker locker(&progress_mutex);
+  /* Only the copy made by progress_publish() is used, the recovery
+   * thread may be updating params */
+  const struct ph_param *params=&progress_params;
   const partition_t *partition=params->partition;
   const unsigned int sector_size=params->disk->sector_size;
   QString tmp;
@@ -688,7 +723,13 @@ void QPhotorec::qphotorec_search_updateUI()
     progress_bar->setMaximum(100);
     progress_bar->setValue((params->offset-partition->part_offset)*100/ partition->part_size);
   }
-  photorec_info(params->file_stats);
+  /* Filling the table allocates an item per cell, skip it when no file
+   * has been recovered since the last refresh */
+  if(params->file_nbr!=filestats_file_nbr)
+  {
+    filestats_file_nbr=params->file_nbr;
+    photorec_info(params->file_stats);
+  }
 }
 
 void QPhotorec::qphotorec_search_setupUI()
@@ -775,27 +816,53 @@ void QPhotorec::qphotorec_search_setupUI()
   connect( button_quit, SIGNAL(clicked()), this, SLOT(stop_and_quit()) );
   connect(this, SIGNAL(finished()), qApp, SLOT(quit()));
 
-  timer = new QTimer(this);
-  timer->setInterval(500);
-  connect(timer, SIGNAL(timeout()), this, SLOT(qphotorec_search_updateUI()));
+  connect(this, SIGNAL(progress()), this, SLOT(qphotorec_search_updateUI()), Qt::QueuedConnection);
 }
 
 void QPhotorec::stop_and_quit()
 {
-  stop_the_recovery=true;
+  stop_the_recovery.storeRelease(1);
   emit finished();
 }
 
+QPhotorecWorker::QPhotorecWorker(QPhotorec *my_qphotorec, alloc_data_t *my_list_search_space, const bool my_find_blocksize) :
+  ind_stop(PSTATUS_OK), qphotorec(my_qphotorec), list_search_space(my_list_search_space), find_blocksize(my_find_blocksize)
+{
+}
+
+void QPhotorecWorker::run()
+{
+  if(find_blocksize)
+    ind_stop=qphotorec->photorec_find_blocksize(list_search_space);
+  else
+    ind_stop=qphotorec->photorec_aux(list_search_space);
+}
+
+pstatus_t QPhotorec::photorec_run(alloc_data_t *list_search_space, const bool find_blocksize)
+{
+  /* The scan doesn't process the window events, this thread does it
+   * until the worker is finished */
+  QPhotorecWorker worker(this, list_search_space, find_blocksize);
+  QEventLoop loop;
+  connect(&worker, SIGNAL(finished()), &loop, SLOT(quit()));
+  worker.start();
+  loop.exec();
+  /* When the application quits, the loop ends early: stop_the_recovery
+   * is already set, the worker stops within a second */
+  worker.wait();
+  return worker.ind_stop;
+}
+
 int QPhotorec::photorec(alloc_data_t *list_search_space)
 {
   pstatus_t ind_stop=PSTATUS_OK;
   const unsigned int blocksize_is_known=params->blocksize;
   params_reset(params, options);
+  filestats_file_nbr=(unsigned int)-1;
   /* make the first recup_dir */
   params->dir_num=photorec_mkdir(params->recup_dir, params->dir_num);
   for(params->pass=0; params->status!=STATUS_QUIT; params->pass++)
   {
-    timer->start();
     switch(params->status)
     {
       case STATUS_UNFORMAT:
@@ -812,7 +879,7 @@ int QPhotorec::photorec(alloc_data_t *list_search_space)
 	  }
 	  else
 	  {
-	    ind_stop=photorec_find_blocksize(list_search_space);
+	    ind_stop=photorec_run(list_search_space, true);
 	    params->blocksize=find_blocksize(list_search_space, params->disk->sector_size, &start_offset);
 	  }
 	  update_blocksize(params->blocksize, list_search_space, start_offset);
@@ -823,10 +890,10 @@ int QPhotorec::photorec(alloc_data_t *list_search_space)
 	/* FIXME */
 	break;
       default:
-	ind_stop=photorec_aux(list_search_space);
+	ind_stop=photorec_run(list_search_space, false);
 	break;
     }
-    timer->stop();
+    progress_publish();
     qphotorec_search_updateUI();
     session_save(list_search_space, params, options);
     switch(ind_stop)
@@ -874,16 +941,21 @@ break;
       case PSTATUS_OK:
 	status_inc(params, options);
 	if(params->status==STATUS_QUIT)
-	  unlink("photorec.ses");
+	  session_remove();
+	else if(params->status!=STATUS_FIND_OFFSET && params->blocksize>0)
+	  compact_search_space(list_search_space, params->blocksize, params->disk->sector_size);
 	break;
       case PSTATUS_STOP:
 	params->status=STATUS_QUIT;
 	break;
     }
     update_stats(params->file_stats, list_search_space);
+    filestats_file_nbr=(unsigned int)-1;
+    progress_publish();
     qphotorec_search_updateUI();
   }
   free_search_space(list_search_space);
+  phits_reset();
   free_header_check();
   free(params->file_stats);
   params->file_stats=NULL;
@@ -24,6 +24,9 @@
 #include <QLineEdit>
 #include <QRadioButton>
 #include <QProgressBar>
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
 #include "types.h"
 #include "common.h"
 #include "filegen.h"
@@ -32,6 +35,7 @@
 class QPhotorec: public QWidget
 {
   	Q_OBJECT
+	friend class QPhotorecWorker;
 
         public:
                 QPhotorec(QWidget *parent = 0);
@@ -65,9 +69,13 @@ class QPhotorec: public QWidget
 		pstatus_t photorec_aux(alloc_data_t *list_search_space);
 		void qphotorec_search_setupUI();
 		void photorec_info(const file_stat_t *file_stats);
+		pstatus_t photorec_run(alloc_data_t *list_search_space, const bool find_blocksize);
+		void progress_publish();
 		void select_disk(disk_t *disk);
 	signals:
 		void finished();
+		/* Emitted by the recovery thread after progress_publish() */
+		void progress();
         private:
 		/* */
 		list_disk_t		*list_disk;
@@ -76,7 +84,8 @@ class QPhotorec: public QWidget
 		partition_t 		*selected_partition;
 		struct ph_param 	*params;
 		struct ph_options 	*options;
-		bool			stop_the_recovery;
+		/* Set by the GUI thread, polled by the recovery thread */
+		QAtomicInt		stop_the_recovery;
 		/* Setup recovery UI */
                 QComboBox 		*HDDlistWidget;
                 QTableWidget 		*PartListWidget;
@@ -91,10 +100,30 @@ class QPhotorec: public QWidget
 		QLabel 			*progress_info;
 		QLabel 			*progress_filefound;
 		QProgressBar 		*progress_bar;
-		QTimer 			*timer;
                 QTableWidget 		*filestatsWidget;
+		/* params->file_nbr when filestatsWidget was filled */
+		unsigned int		filestats_file_nbr;
+		/* Copy of params and of the file stats for the GUI thread */
+		QMutex			progress_mutex;
+		struct ph_param		progress_params;
+		file_stat_t		*progress_file_stats;
+		unsigned int		progress_file_stats_nbr;
 		/* Formats */
 		QListWidget		*formats;
 
 };
+
+/* Run a recovery pass outside of the GUI thread */
+class QPhotorecWorker: public QThread
+{
+        public:
+		QPhotorecWorker(QPhotorec *my_qphotorec, alloc_data_t *my_list_search_space, const bool my_find_blocksize);
+		pstatus_t		ind_stop;
+	protected:
+		void run();
+        private:
+		QPhotorec		*qphotorec;
+		alloc_data_t		*list_search_space;
+		const bool		find_blocksize;
+};
 #endif
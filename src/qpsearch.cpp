@@ -47,7 +47,6 @@
 #include <stdarg.h>
 #include <winbase.h>
 #endif
-#include <QCoreApplication>
 #include "types.h"
 #include "common.h"
 #include "intrf.h"
@@ -65,6 +64,10 @@
 #include "file_found.h"
 #include "psearch.h"
 #include "qphotorec.h"
+#include "pstream.h"
+#include "phash.h"
+#include "phits.h"
+#include "pdest.h"
 #include "photorec_check_header.h"
 #define READ_SIZE 1024*512
 
@@ -95,7 +98,7 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
   buffer=buffer_olddata+blocksize;
   start_time=time(NULL);
   previous_time=start_time;
-  next_checkpoint=start_time+5*60;
+  next_checkpoint=regular_session_start(start_time);
   memset(buffer_olddata,0,blocksize);
   current_search_space=td_list_first_entry(&list_search_space->list, alloc_data_t, list);
   offset=set_search_start(params, &current_search_space, list_search_space);
@@ -109,6 +112,8 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
   }
   params->disk->pread(params->disk, buffer, READ_SIZE, offset);
   header_ignored(NULL);
+  photorec_check_header_reset();
+  phits_start(params);
   while(current_search_space!=list_search_space)
   {
     pfstatus_t file_recovered=PFSTATUS_BAD;
@@ -160,10 +165,16 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
 	    else
 	    {
 	      /* Warn the user */
+	      pdest_full(params, file_recovery.filename);
 	      ind_stop=PSTATUS_ENOSPC;
 	      params->offset=file_recovery.location.start;
 	    }
 	  }
+	  else
+	  {
+	    file_tail_append(&file_recovery, buffer, blocksize, file_recovery.file_size);
+	    phash_block(&file_recovery, buffer, blocksize, file_recovery.file_size);
+	  }
 	}
 	if(ind_stop==PSTATUS_OK)
 	{
@@ -205,6 +216,8 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
     {
       log_info("PhotoRec has been stopped\n");
       file_recovery_aborted(&file_recovery, params, list_search_space);
+      photorec_check_header_reset();
+      phits_finish();
       free(buffer_start);
       return ind_stop;
     }
@@ -289,12 +302,15 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
         if(current_time > previous_time)
         {
           previous_time=current_time;
-	  QCoreApplication::processEvents();
 	  params->offset=offset;
-	  if(stop_the_recovery)
+	  progress_publish();
+	  emit progress();
+	  if(stop_the_recovery.loadAcquire()!=0)
 	  {
 	    log_info("QPhotoRec has been stopped\n");
 	    file_recovery_aborted(&file_recovery, params, list_search_space);
+	    photorec_check_header_reset();
+	    phits_finish();
 	    free(buffer_start);
 	    return PSTATUS_STOP;
 	  }
@@ -305,6 +321,8 @@ pstatus_t QPhotorec::photorec_aux(alloc_data_t *list_search_space)
     }
     file_recovered_old=file_recovered;
   } /* end while(current_search_space!=list_search_space) */
+  photorec_check_header_reset();
+  phits_finish();
   free(buffer_start);
   return ind_stop;
 }
@@ -439,10 +439,12 @@ static int reiser_dir(disk_t *disk_car, const partition_t *partition, dir_data_t
     if((entity=reiserfs_object_create(ls->current_fs,name,1)))
     {
       unsigned int thislen;
-      file_info_t *new_file=(file_info_t *)MALLOC(sizeof(*new_file));
+      char de_name[DIR_NAME_LEN];
+      file_info_t *new_file;
       thislen=(MAX_NAME_LEN(DEFAULT_BLOCK_SIZE)<DIR_NAME_LEN?MAX_NAME_LEN(DEFAULT_BLOCK_SIZE):DIR_NAME_LEN);
-      memcpy(new_file->name,entry.de_name,thislen);
-      new_file->name[thislen-1]='\0';
+      memcpy(de_name,entry.de_name,thislen);
+      de_name[thislen-1]='\0';
+      new_file=file_info_new(dir_list, de_name);
 
       new_file->status=0;
       new_file->st_ino=entity->stat.st_ino;
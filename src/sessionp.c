@@ -42,6 +42,17 @@
 #include <stdlib.h>
 #endif
 #include <errno.h>
+#include <stdarg.h>
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP) && !defined(DISABLED_FOR_FRAMAC)
+#include <sys/mman.h>
+#define SESSION_MMAP
+#endif
 #if defined(__FRAMAC__)
 #include "__fc_builtin.h"
 #endif
@@ -51,10 +62,107 @@
 #include "filegen.h"
 #include "photorec.h"
 #include "sessionp.h"
+#include "crc.h"
+#include "hdcache.h"
 #include "log.h"
+#include "paffinity.h"
 
 #define SESSION_MAXSIZE 40960
 #define SESSION_FILENAME "photorec.ses"
+#define SESSION_FILENAME_TMP "photorec.ses.tmp"
+/* With a writer thread, regular checkpoints are taken every 10 seconds
+ * unless the snapshot itself takes more than 0.5% of the scan time */
+#define SESSION_CHECKPOINT_DELAY 10
+#define SESSION_CHECKPOINT_RATIO 200
+
+/* The free space extents are kept in photorec.sej, a binary journal.
+ * It starts with a full snapshot, each checkpoint appends the edit script
+ * turning the previous extent list into the current one. A checkpoint is
+ * only used if its crc is valid and if its time matches the one written
+ * in photorec.ses. During the brute force pass, each checkpoint is
+ * followed by a record with its progress. */
+#define JOURNAL_FILENAME "photorec.sej"
+#define JOURNAL_FILENAME_TMP "photorec.sej.tmp"
+#define JOURNAL_MAX_DELTAS 64
+
+/* Sectors that failed to read, so a resumed session doesn't retry them */
+#define BAD_SECTORS_FILENAME "photorec.sem"
+
+#define JOURNAL_FULL	1
+#define JOURNAL_DELTA	2
+#define JOURNAL_BF	3
+#define JOURNAL_BF_SIZE	32
+
+#define JOURNAL_OP_KEEP		1
+#define JOURNAL_OP_DROP		2
+#define JOURNAL_OP_INSERT	3
+
+static int session_enabled=1;
+static void (*session_progress)(const struct ph_param *params)=NULL;
+
+#ifndef DISABLED_FOR_FRAMAC
+typedef struct
+{
+  char magic[4];
+  uint32_t type;
+  uint32_t nbr;		/* extents in a snapshot, operations in a delta */
+  uint32_t crc;		/* header with crc=0 followed by the payload */
+  uint64_t time;	/* time written in photorec.ses */
+  uint64_t size;	/* payload size */
+  uint64_t offset;	/* current offset in sectors */
+  uint32_t file_nbr;	/* files recovered so far */
+  uint32_t status;
+} journal_record_t;
+
+typedef struct
+{
+  uint64_t start;
+  uint64_t end;
+} journal_extent_t;
+
+typedef struct
+{
+  unsigned char *data;
+  unsigned int size;
+  unsigned int alloc;
+} journal_buffer_t;
+
+/* State to write at a checkpoint, taken by the scan thread */
+typedef struct
+{
+  journal_extent_t *extents;
+  unsigned int nbr;
+  journal_buffer_t text;	/* photorec.ses without the extents */
+  uint64_t time;
+  uint64_t offset;		/* in sectors */
+  uint32_t file_nbr;
+  uint32_t status;
+  int failed;			/* text is incomplete */
+  int bf_valid;
+  session_bf_t bf;
+} session_snapshot_t;
+
+static const char journal_magic[4]={ 'P', 'S', 'J', '1' };
+/* Extent list written at the last checkpoint */
+static int journal_valid=0;
+static journal_extent_t *journal_extents=NULL;
+static unsigned int journal_nbr=0;
+static unsigned int journal_deltas=0;
+static uint64_t journal_delta_size=0;
+/* Progress of the brute force pass to save, and the one loaded */
+static session_bf_t session_bf;
+static int session_bf_valid=0;
+static session_bf_t session_bf_loaded;
+static int session_bf_loaded_valid=0;
+#endif
+
+#ifdef HAVE_PTHREAD
+/* At most one checkpoint is being written in the background */
+static pthread_t session_writer;
+static pthread_mutex_t session_writer_mutex=PTHREAD_MUTEX_INITIALIZER;
+static int session_writer_started=0;
+static int session_writer_done=0;
+#endif
 
 static int session_save_empty(void)
 {
@@ -84,6 +192,530 @@ static int session_save_empty(void)
   return 0;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+static int journal_buffer_add(journal_buffer_t *buffer, const void *data, const unsigned int len)
+{
+  if(buffer->size + len > buffer->alloc)
+  {
+    unsigned int new_alloc=(buffer->alloc>0?buffer->alloc:4096);
+    unsigned char *new_data;
+    while(new_alloc < buffer->size + len)
+      new_alloc*=2;
+    new_data=(unsigned char *)realloc(buffer->data, new_alloc);
+    if(new_data==NULL)
+      return -1;
+    buffer->data=new_data;
+    buffer->alloc=new_alloc;
+  }
+  memcpy(&buffer->data[buffer->size], data, len);
+  buffer->size+=len;
+  return 0;
+}
+
+static int journal_add_extent(journal_buffer_t *buffer, const journal_extent_t *extent)
+{
+  journal_extent_t tmp;
+  tmp.start=le64(extent->start);
+  tmp.end=le64(extent->end);
+  return journal_buffer_add(buffer, &tmp, sizeof(tmp));
+}
+
+/* Append an operation to the edit script, consecutive operations
+ * of the same kind are merged. *last is the offset of the previous one. */
+static int journal_add_op(journal_buffer_t *buffer, unsigned int *nbr_op, unsigned int *last, const uint32_t op)
+{
+  uint32_t tmp[2];
+  if(*nbr_op > 0)
+  {
+    memcpy(tmp, &buffer->data[*last], sizeof(tmp));
+    if(le32(tmp[0])==op)
+    {
+      tmp[1]=le32(le32(tmp[1])+1);
+      memcpy(&buffer->data[*last], tmp, sizeof(tmp));
+      return 0;
+    }
+  }
+  tmp[0]=le32(op);
+  tmp[1]=le32(1);
+  *last=buffer->size;
+  (*nbr_op)++;
+  return journal_buffer_add(buffer, tmp, sizeof(tmp));
+}
+
+static int journal_extent_cmp(const journal_extent_t *a, const journal_extent_t *b)
+{
+  if(a->start != b->start)
+    return (a->start < b->start ? -1 : 1);
+  if(a->end != b->end)
+    return (a->end < b->end ? -1 : 1);
+  return 0;
+}
+
+/* Build the edit script turning journal_extents into extents */
+static int journal_delta(journal_buffer_t *payload, unsigned int *nbr_op, const journal_extent_t *extents, const unsigned int nbr)
+{
+  unsigned int i=0;
+  unsigned int j=0;
+  unsigned int last=0;
+  *nbr_op=0;
+  while(i<journal_nbr || j<nbr)
+  {
+    int res;
+    if(i>=journal_nbr)
+      res=1;
+    else if(j>=nbr)
+      res=-1;
+    else
+      res=journal_extent_cmp(&journal_extents[i], &extents[j]);
+    if(res==0)
+    {
+      if(journal_add_op(payload, nbr_op, &last, JOURNAL_OP_KEEP)<0)
+	return -1;
+      i++;
+      j++;
+    }
+    else if(res<0)
+    {
+      if(journal_add_op(payload, nbr_op, &last, JOURNAL_OP_DROP)<0)
+	return -1;
+      i++;
+    }
+    else
+    {
+      /* The new extents follow their INSERT operation */
+      if(journal_add_op(payload, nbr_op, &last, JOURNAL_OP_INSERT)<0 ||
+	  journal_add_extent(payload, &extents[j])<0)
+	return -1;
+      j++;
+    }
+  }
+  return 0;
+}
+
+/* Data written to the disk before a rename or before the next record */
+static int session_sync(FILE *handle)
+{
+  if(fflush(handle)!=0)
+    return -1;
+#ifdef HAVE_FSYNC
+  if(fsync(fileno(handle))<0)
+    return -1;
+#endif
+  return 0;
+}
+
+static int journal_write_record(FILE *f_journal, const uint32_t type, const uint32_t nbr, const journal_buffer_t *payload, const session_snapshot_t *snapshot)
+{
+  journal_record_t record;
+  uint32_t crc;
+  memcpy(record.magic, journal_magic, sizeof(record.magic));
+  record.type=le32(type);
+  record.nbr=le32(nbr);
+  record.crc=0;
+  record.time=le64(snapshot->time);
+  record.size=le64((uint64_t)payload->size);
+  record.offset=le64(snapshot->offset);
+  record.file_nbr=le32(snapshot->file_nbr);
+  record.status=le32(snapshot->status);
+  crc=get_crc32(&record, sizeof(record), 0xFFFFFFFF);
+  crc=get_crc32(payload->data, payload->size, crc)^0xFFFFFFFF;
+  record.crc=le32(crc);
+  if(fwrite(&record, sizeof(record), 1, f_journal)!=1)
+    return -1;
+  if(payload->size > 0 && fwrite(payload->data, payload->size, 1, f_journal)!=1)
+    return -1;
+  return session_sync(f_journal);
+}
+
+/* Write a full snapshot in a new file and move it over the journal */
+static int journal_save_full(const journal_extent_t *extents, const unsigned int nbr, const session_snapshot_t *snapshot)
+{
+  FILE *f_journal;
+  journal_buffer_t payload;
+  unsigned int i;
+  int res=0;
+  memset(&payload, 0, sizeof(payload));
+  for(i=0; i<nbr && res==0; i++)
+    res=journal_add_extent(&payload, &extents[i]);
+  if(res<0)
+  {
+    free(payload.data);
+    return -1;
+  }
+  f_journal=fopen(JOURNAL_FILENAME_TMP, "wb");
+  if(!f_journal)
+  {
+    log_critical("Can't create %s file: %s\n", JOURNAL_FILENAME_TMP, strerror(errno));
+    free(payload.data);
+    return -1;
+  }
+  res=journal_write_record(f_journal, JOURNAL_FULL, nbr, &payload, snapshot);
+  free(payload.data);
+  if(fclose(f_journal)!=0)
+    res=-1;
+  if(res<0 || rename(JOURNAL_FILENAME_TMP, JOURNAL_FILENAME)<0)
+  {
+    log_critical("Can't write %s file: %s\n", JOURNAL_FILENAME, strerror(errno));
+    unlink(JOURNAL_FILENAME_TMP);
+    return -1;
+  }
+  journal_deltas=0;
+  journal_delta_size=0;
+  return 0;
+}
+
+/* On success, the journal keeps extents */
+static int journal_save(journal_extent_t *extents, const unsigned int nbr, const session_snapshot_t *snapshot)
+{
+  int res;
+  if(journal_valid!=0 && journal_deltas < JOURNAL_MAX_DELTAS)
+  {
+    journal_buffer_t payload;
+    unsigned int nbr_op;
+    memset(&payload, 0, sizeof(payload));
+    res=journal_delta(&payload, &nbr_op, extents, nbr);
+    /* Compact the journal once the deltas are bigger than a snapshot */
+    if(res==0 &&
+	journal_delta_size + payload.size <= (uint64_t)nbr * sizeof(journal_extent_t))
+    {
+      FILE *f_journal=fopen(JOURNAL_FILENAME, "ab");
+      if(f_journal)
+      {
+	res=journal_write_record(f_journal, JOURNAL_DELTA, nbr_op, &payload, snapshot);
+	if(fclose(f_journal)!=0)
+	  res=-1;
+	if(res==0)
+	{
+	  journal_deltas++;
+	  journal_delta_size+=payload.size;
+	}
+      }
+      else
+	res=-1;
+      free(payload.data);
+      if(res==0)
+      {
+	free(journal_extents);
+	journal_extents=extents;
+	journal_nbr=nbr;
+	return 0;
+      }
+      /* A partial record ends the journal, write a new one */
+    }
+    else
+      free(payload.data);
+  }
+  journal_valid=0;
+  res=journal_save_full(extents, nbr, snapshot);
+  if(res<0)
+    return -1;
+  free(journal_extents);
+  journal_extents=extents;
+  journal_nbr=nbr;
+  journal_valid=1;
+  return 0;
+}
+
+/* Append the progress of the brute force pass after the checkpoint */
+static int journal_save_bf(const session_snapshot_t *snapshot)
+{
+  journal_buffer_t payload;
+  uint32_t tmp32[2];
+  uint64_t tmp64[3];
+  FILE *f_journal;
+  int res;
+  memset(&payload, 0, sizeof(payload));
+  tmp32[0]=le32(snapshot->bf.phase);
+  tmp32[1]=le32((uint32_t)snapshot->bf.blocs_to_skip);
+  tmp64[0]=le64(snapshot->bf.file_start);
+  tmp64[1]=le64(snapshot->bf.file_offset);
+  tmp64[2]=le64(snapshot->bf.offset_error);
+  if(journal_buffer_add(&payload, tmp32, sizeof(tmp32))<0 ||
+      journal_buffer_add(&payload, tmp64, sizeof(tmp64))<0)
+  {
+    free(payload.data);
+    return -1;
+  }
+  f_journal=fopen(JOURNAL_FILENAME, "ab");
+  if(!f_journal)
+  {
+    free(payload.data);
+    return -1;
+  }
+  res=journal_write_record(f_journal, JOURNAL_BF, 0, &payload, snapshot);
+  free(payload.data);
+  if(fclose(f_journal)!=0)
+    res=-1;
+  return res;
+}
+
+static uint32_t journal_get32(const unsigned char *p)
+{
+  uint32_t tmp;
+  memcpy(&tmp, p, sizeof(tmp));
+  return le32(tmp);
+}
+
+static uint64_t journal_get64(const unsigned char *p)
+{
+  uint64_t tmp;
+  memcpy(&tmp, p, sizeof(tmp));
+  return le64(tmp);
+}
+
+/* Apply a record to the extents in *extents, the result is built in
+ * *spare then both arrays are swapped, so replaying a journal doesn't
+ * allocate an array per record. Return -1 if the record is invalid */
+static int journal_replay(const journal_record_t *record, const unsigned char *payload, journal_extent_t **extents, unsigned int *nbr, unsigned int *extents_alloc, journal_extent_t **spare, unsigned int *spare_alloc)
+{
+  const uint64_t size=le64(record->size);
+  const uint32_t nbr_rec=le32(record->nbr);
+  journal_extent_t *new_extents;
+  unsigned int new_nbr=0;
+  uint64_t max_nbr;
+  uint64_t pos=0;
+  unsigned int i=0;
+  unsigned int k;
+  if(le32(record->type)==JOURNAL_FULL)
+  {
+    if(size != (uint64_t)nbr_rec * sizeof(journal_extent_t))
+      return -1;
+    max_nbr=nbr_rec;
+  }
+  else if(le32(record->type)==JOURNAL_DELTA)
+  {
+    /* The result can't be bigger than the old list plus the inserted extents */
+    max_nbr=*nbr + size/sizeof(journal_extent_t);
+  }
+  else
+    return -1;
+  if(max_nbr >= 0xFFFFFFFF / sizeof(journal_extent_t))
+    return -1;
+  if(*spare==NULL || *spare_alloc < max_nbr + 1)
+  {
+    free(*spare);
+    *spare_alloc=max_nbr + 1;
+    *spare=(journal_extent_t *)MALLOC(*spare_alloc * sizeof(journal_extent_t));
+  }
+  new_extents=*spare;
+  if(le32(record->type)==JOURNAL_FULL)
+  {
+    for(k=0; k<nbr_rec; k++)
+    {
+      new_extents[k].start=journal_get64(&payload[k*sizeof(journal_extent_t)]);
+      new_extents[k].end=journal_get64(&payload[k*sizeof(journal_extent_t)+8]);
+    }
+    new_nbr=nbr_rec;
+  }
+  else
+  {
+    for(k=0; k<nbr_rec; k++)
+    {
+      uint32_t op;
+      uint32_t count;
+      if(pos + 8 > size)
+	break;
+      op=journal_get32(&payload[pos]);
+      count=journal_get32(&payload[pos+4]);
+      pos+=8;
+      if(op==JOURNAL_OP_KEEP || op==JOURNAL_OP_DROP)
+      {
+	if(count > *nbr - i)
+	  break;
+	if(op==JOURNAL_OP_KEEP)
+	{
+	  memcpy(&new_extents[new_nbr], &(*extents)[i], count * sizeof(journal_extent_t));
+	  new_nbr+=count;
+	}
+	i+=count;
+      }
+      else if(op==JOURNAL_OP_INSERT)
+      {
+	uint32_t l;
+	if((uint64_t)count * sizeof(journal_extent_t) > size - pos)
+	  break;
+	for(l=0; l<count; l++, pos+=sizeof(journal_extent_t))
+	{
+	  new_extents[new_nbr].start=journal_get64(&payload[pos]);
+	  new_extents[new_nbr].end=journal_get64(&payload[pos+8]);
+	  new_nbr++;
+	}
+      }
+      else
+	break;
+    }
+    if(k!=nbr_rec || pos!=size || i!=*nbr)
+      return -1;
+  }
+  *spare=*extents;
+  *extents=new_extents;
+  *nbr=new_nbr;
+  k=*spare_alloc;
+  *spare_alloc=*extents_alloc;
+  *extents_alloc=k;
+  return 0;
+}
+
+/* Return the size of the valid record at pos, 0 if there is none */
+static uint64_t journal_check_record(const unsigned char *buffer, const uint64_t buffer_size, const uint64_t pos)
+{
+  journal_record_t record;
+  uint64_t size;
+  uint32_t crc;
+  if(pos + sizeof(journal_record_t) > buffer_size)
+    return 0;
+  memcpy(&record, &buffer[pos], sizeof(record));
+  size=le64(record.size);
+  if(memcmp(record.magic, journal_magic, sizeof(record.magic))!=0 ||
+      size > buffer_size - pos - sizeof(journal_record_t))
+    return 0;
+  record.crc=0;
+  crc=get_crc32(&record, sizeof(record), 0xFFFFFFFF);
+  crc=get_crc32(&buffer[pos+sizeof(record)], size, crc)^0xFFFFFFFF;
+  if(crc!=journal_get32(&buffer[pos+12]))
+    return 0;
+  return sizeof(journal_record_t)+size;
+}
+
+/* Replay the journal up to the last checkpoint written with session_time.
+ * The extents are sorted, the list is built in one pass. When this
+ * checkpoint ends the journal, the resumed session keeps appending to it
+ * instead of writing a new snapshot */
+static int journal_load(const uint64_t session_time, alloc_data_t *list_free_space)
+{
+  FILE *f_journal;
+  struct stat stat_rec;
+  unsigned char *buffer;
+  uint64_t buffer_size;
+  uint64_t pos;
+  uint64_t found_end=0;
+  uint64_t record_size;
+  journal_record_t record;
+  journal_extent_t *extents=NULL;
+  unsigned int nbr=0;
+  unsigned int extents_alloc=0;
+  journal_extent_t *spare=NULL;
+  unsigned int spare_alloc=0;
+  unsigned int deltas=0;
+  uint64_t delta_size=0;
+  unsigned int k;
+  int res=0;
+#ifdef SESSION_MMAP
+  int mapped=1;
+#endif
+  f_journal=fopen(JOURNAL_FILENAME, "rb");
+  if(!f_journal)
+    return -1;
+  if(fstat(fileno(f_journal), &stat_rec)<0 || stat_rec.st_size < (off_t)sizeof(journal_record_t))
+  {
+    fclose(f_journal);
+    return -1;
+  }
+  buffer_size=stat_rec.st_size;
+#ifdef SESSION_MMAP
+  buffer=(unsigned char *)mmap(NULL, buffer_size, PROT_READ, MAP_PRIVATE, fileno(f_journal), 0);
+  if(buffer==(unsigned char *)MAP_FAILED)
+#endif
+  {
+#ifdef SESSION_MMAP
+    mapped=0;
+#endif
+    buffer=(unsigned char *)MALLOC(buffer_size);
+    if(fread(buffer, buffer_size, 1, f_journal)!=1)
+    {
+      free(buffer);
+      fclose(f_journal);
+      return -1;
+    }
+  }
+  fclose(f_journal);
+  /* Find the last checkpoint of this session, a later one may belong to
+   * another session */
+  for(pos=0; (record_size=journal_check_record(buffer, buffer_size, pos)) > 0; pos+=record_size)
+  {
+    memcpy(&record, &buffer[pos], sizeof(record));
+    if(le64(record.time)==session_time)
+      found_end=pos+record_size;
+  }
+  session_bf_loaded_valid=0;
+  for(pos=0; pos < found_end && res==0; pos+=sizeof(journal_record_t)+le64(record.size))
+  {
+    memcpy(&record, &buffer[pos], sizeof(record));
+    if(le32(record.type)==JOURNAL_BF)
+    {
+      /* Only the progress written with the checkpoint resumed is used */
+      const unsigned char *payload=&buffer[pos+sizeof(record)];
+      session_bf_loaded_valid=0;
+      if(le64(record.size)==JOURNAL_BF_SIZE && le64(record.time)==session_time)
+      {
+	session_bf_loaded.phase=journal_get32(&payload[0]);
+	session_bf_loaded.blocs_to_skip=(int32_t)journal_get32(&payload[4]);
+	session_bf_loaded.file_start=journal_get64(&payload[8]);
+	session_bf_loaded.file_offset=journal_get64(&payload[16]);
+	session_bf_loaded.offset_error=journal_get64(&payload[24]);
+	session_bf_loaded_valid=1;
+      }
+      continue;
+    }
+    session_bf_loaded_valid=0;
+    res=journal_replay(&record, &buffer[pos+sizeof(record)], &extents, &nbr, &extents_alloc, &spare, &spare_alloc);
+    if(le32(record.type)==JOURNAL_FULL)
+    {
+      deltas=0;
+      delta_size=0;
+    }
+    else
+    {
+      deltas++;
+      delta_size+=le64(record.size);
+    }
+  }
+#ifdef SESSION_MMAP
+  if(mapped)
+    munmap(buffer, buffer_size);
+  else
+#endif
+    free(buffer);
+  free(spare);
+  if(found_end==0 || res<0)
+  {
+    free(extents);
+    session_bf_loaded_valid=0;
+    return -1;
+  }
+  for(k=0; k<nbr; k++)
+  {
+    if(extents[k].start <= extents[k].end)
+    {
+      alloc_data_t *new_free_space;
+      new_free_space=alloc_data_new();
+      /* Temporary storage, values need to be multiplied by sector_size */
+      new_free_space->start=extents[k].start;
+      new_free_space->end=extents[k].end;
+      new_free_space->file_stat=NULL;
+      new_free_space->data=1;
+      td_list_add_tail(&new_free_space->list, &list_free_space->list);
+    }
+  }
+  free(journal_extents);
+  journal_extents=NULL;
+  journal_nbr=0;
+  journal_valid=0;
+  if(found_end==buffer_size)
+  {
+    /* The next checkpoint is a delta from this state */
+    journal_extents=extents;
+    journal_nbr=nbr;
+    journal_deltas=deltas;
+    journal_delta_size=delta_size;
+    journal_valid=1;
+  }
+  else
+    free(extents);
+  return 0;
+}
+#endif
+
 int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_space)
 {
   FILE *f_session;
@@ -92,7 +724,9 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
   int taille;
   struct stat stat_rec;
   unsigned int buffer_size;
-//  time_t my_time;
+#ifndef DISABLED_FOR_FRAMAC
+  uint64_t session_time;
+#endif
   char *info=NULL;
   *cmd_device=NULL;
   *current_cmd=NULL;
@@ -124,7 +758,11 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
   }
   pos++;
   /* load time */
-  strtol(pos,&pos,10); 	// my_time=strtol(pos,&pos,10);
+#ifndef DISABLED_FOR_FRAMAC
+  session_time=strtoull(pos,&pos,10);
+#else
+  strtol(pos,&pos,10);
+#endif
   if(pos==NULL)
   {
     free(buffer);
@@ -159,6 +797,13 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
   *pos='\0';
   pos++;
   *current_cmd=strdup(info);
+#ifndef DISABLED_FOR_FRAMAC
+  if(journal_load(session_time, list_free_space)==0)
+  {
+    free(buffer);
+    return 0;
+  }
+#endif
   while(1)
   {
     uint64_t start=0;
@@ -181,7 +826,7 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
     if(start <= end)
     {
       alloc_data_t *new_free_space;
-      new_free_space=(alloc_data_t*)MALLOC(sizeof(*new_free_space));
+      new_free_space=alloc_data_new();
       /* Temporary storage, values need to be multiplied by sector_size */
       new_free_space->start=start;
       new_free_space->end=end;
@@ -197,157 +842,347 @@ int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_
   }
 }
 
-int session_save(const alloc_data_t *list_free_space, const struct ph_param *params,  const struct ph_options *options)
+#ifndef DISABLED_FOR_FRAMAC
+struct session_extents_struct
 {
-  FILE *f_session;
-  if(params->status==STATUS_QUIT)
-    return 0;
-  f_session=fopen(SESSION_FILENAME,"wb");
-  if(!f_session)
+  journal_extent_t *extents;
+  unsigned int nbr;
+  unsigned int sector_size;
+};
+
+static void session_count_extent(const alloc_data_t *extent, void *arg)
+{
+  (void)extent;
+  ((struct session_extents_struct *)arg)->nbr++;
+}
+
+static void session_add_extent(const alloc_data_t *extent, void *arg)
+{
+  struct session_extents_struct *ctx=(struct session_extents_struct *)arg;
+  ctx->extents[ctx->nbr].start=extent->start/ctx->sector_size;
+  ctx->extents[ctx->nbr].end=extent->end/ctx->sector_size;
+  ctx->nbr++;
+}
+
+static void session_printf(session_snapshot_t *snapshot, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void session_printf(session_snapshot_t *snapshot, const char *format, ...)
+{
+  char line[8192];
+  va_list ap;
+  int len;
+  va_start(ap, format);
+  len=vsnprintf(line, sizeof(line), format, ap);
+  va_end(ap);
+  if(len < 0 || (unsigned int)len >= sizeof(line) ||
+      journal_buffer_add(&snapshot->text, line, len) < 0)
+    snapshot->failed=1;
+}
+
+static void session_snapshot_free(session_snapshot_t *snapshot)
+{
+  free(snapshot->extents);
+  free(snapshot->text.data);
+  free(snapshot);
+}
+
+/* Copy the search space and format photorec.ses, the scan can go on
+ * while the copy is written */
+static session_snapshot_t *session_snapshot_new(const alloc_data_t *list_free_space, const struct ph_param *params, const struct ph_options *options)
+{
+  struct td_list_head *free_walker = NULL;
+  session_snapshot_t *snapshot=(session_snapshot_t *)MALLOC(sizeof(*snapshot));
+  struct session_extents_struct ctx;
+  unsigned int nbr=0;
+  unsigned int i;
+  const file_enable_t *files_enable=options->list_file_format;
+  unsigned int disable=0;
+  unsigned int enable=0;
+  unsigned int enable_by_default=0;
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->time=time(NULL);
+  snapshot->offset=(params->offset==PH_INVALID_OFFSET ? PH_INVALID_OFFSET :
+      params->offset/params->disk->sector_size);
+  snapshot->file_nbr=params->file_nbr;
+  snapshot->status=(uint32_t)params->status;
+  if(session_bf_valid!=0 &&
+      (params->status==STATUS_EXT2_ON_BF || params->status==STATUS_EXT2_OFF_BF))
   {
-#ifndef DISABLED_FOR_FRAMAC
-    log_critical("Can't create photorec.ses file: %s\n",strerror(errno));
-#endif
-    /*@ assert \valid_read(list_free_space); */
-    /*@ assert valid_ph_param(params); */
-    /*@ assert \valid_read(options); */
-    return -1;
+    snapshot->bf_valid=1;
+    memcpy(&snapshot->bf, &session_bf, sizeof(snapshot->bf));
   }
-#ifndef DISABLED_FOR_FRAMAC
+  ctx.extents=NULL;
+  ctx.nbr=0;
+  ctx.sector_size=params->disk->sector_size;
+  /* lowmem: the extents behind the scan cursor may not be in memory */
+  forget_walk(&session_count_extent, &ctx);
+  nbr=ctx.nbr;
+  td_list_for_each(free_walker, &list_free_space->list)
+    nbr++;
+  snapshot->extents=(journal_extent_t *)MALLOC((nbr>0?nbr:1) * sizeof(journal_extent_t));
+  ctx.extents=snapshot->extents;
+  ctx.nbr=0;
+  if(forget_walk(&session_add_extent, &ctx) < 0)
+    ctx.nbr=0;
+  nbr=ctx.nbr;
+  td_list_for_each(free_walker, &list_free_space->list)
+  {
+    const alloc_data_t *current_free_space=td_list_entry_const(free_walker, const alloc_data_t, list);
+    snapshot->extents[nbr].start=current_free_space->start/params->disk->sector_size;
+    snapshot->extents[nbr].end=current_free_space->end/params->disk->sector_size;
+    nbr++;
+  }
+  snapshot->nbr=nbr;
+  session_printf(snapshot, "#%lu\n%s %s,%u,",
+      (unsigned long int)snapshot->time, params->disk->device, params->disk->arch->part_name_option, params->partition->order);
+  if(params->blocksize>0)
+    session_printf(snapshot, "blocksize,%u,", params->blocksize);
+  session_printf(snapshot, "fileopt,");
+  for(i=0;files_enable[i].file_hint!=NULL;i++)
+  {
+    if(files_enable[i].enable==0)
+      disable++;
+    else
+      enable++;
+    if(files_enable[i].enable==files_enable[i].file_hint->enable_by_default)
+      enable_by_default++;
+  }
+  if(enable_by_default >= disable && enable_by_default >= enable)
   {
-    struct td_list_head *free_walker = NULL;
-    unsigned int i;
-    const file_enable_t *files_enable=options->list_file_format;
-    unsigned int disable=0;
-    unsigned int enable=0;
-    unsigned int enable_by_default=0;
-    if(options->verbose>1)
-    {
-      log_trace("session_save\n");
-    }
-    fprintf(f_session,"#%lu\n%s %s,%u,",
-	(unsigned long int)time(NULL), params->disk->device, params->disk->arch->part_name_option, params->partition->order);
-    if(params->blocksize>0)
-      fprintf(f_session,"blocksize,%u,", params->blocksize);
-    fprintf(f_session,"fileopt,");
-    /*@
-      @ loop assigns i, disable, enable, enable_by_default;
-      @*/
     for(i=0;files_enable[i].file_hint!=NULL;i++)
     {
-      if(files_enable[i].enable==0)
-	disable++;
-      else
-	enable++;
-      if(files_enable[i].enable==files_enable[i].file_hint->enable_by_default)
-	enable_by_default++;
-    }
-    if(enable_by_default >= disable && enable_by_default >= enable)
-    {
-      for(i=0;files_enable[i].file_hint!=NULL;i++)
+      if(files_enable[i].enable!=files_enable[i].file_hint->enable_by_default &&
+	  files_enable[i].file_hint->extension!=NULL &&
+	  files_enable[i].file_hint->extension[0]!='\0')
       {
-	if(files_enable[i].enable!=files_enable[i].file_hint->enable_by_default &&
-	      files_enable[i].file_hint->extension!=NULL &&
-	      files_enable[i].file_hint->extension[0]!='\0')
-	{
-	  fprintf(f_session,"%s,%s,", files_enable[i].file_hint->extension,
-	      (files_enable[i].enable!=0?"enable":"disable"));
-	}
+	session_printf(snapshot, "%s,%s,", files_enable[i].file_hint->extension,
+	    (files_enable[i].enable!=0?"enable":"disable"));
       }
     }
-    else if(enable > disable)
+  }
+  else if(enable > disable)
+  {
+    session_printf(snapshot, "everything,enable,");
+    for(i=0;files_enable[i].file_hint!=NULL;i++)
     {
-      fprintf(f_session,"everything,enable,");
-      for(i=0;files_enable[i].file_hint!=NULL;i++)
+      if(files_enable[i].enable==0 &&
+	  files_enable[i].file_hint->extension!=NULL &&
+	  files_enable[i].file_hint->extension[0]!='\0')
       {
-	if(files_enable[i].enable==0 &&
-	      files_enable[i].file_hint->extension!=NULL &&
-	      files_enable[i].file_hint->extension[0]!='\0')
-	{
-	  fprintf(f_session,"%s,disable,", files_enable[i].file_hint->extension);
-	}
+	session_printf(snapshot, "%s,disable,", files_enable[i].file_hint->extension);
       }
     }
-    else
+  }
+  else
+  {
+    session_printf(snapshot, "everything,disable,");
+    for(i=0;files_enable[i].file_hint!=NULL;i++)
     {
-      fprintf(f_session,"everything,disable,");
-      for(i=0;files_enable[i].file_hint!=NULL;i++)
+      if(files_enable[i].enable!=0 &&
+	  files_enable[i].file_hint->extension!=NULL &&
+	  files_enable[i].file_hint->extension[0]!='\0')
       {
-	if(files_enable[i].enable!=0 &&
-	      files_enable[i].file_hint->extension!=NULL &&
-	      files_enable[i].file_hint->extension[0]!='\0')
-	{
-	  fprintf(f_session,"%s,enable,", files_enable[i].file_hint->extension);
-	}
+	session_printf(snapshot, "%s,enable,", files_enable[i].file_hint->extension);
       }
     }
-    /* Save options */
-    fprintf(f_session, "options,");
-    if(options->paranoid==0)
-      fprintf(f_session, "paranoid_no,");
-    else if(options->paranoid==1)
-      fprintf(f_session, "paranoid,");
-    else
-      fprintf(f_session, "paranoid_bf,");
-    if(options->keep_corrupted_file>0)
-      fprintf(f_session, "keep_corrupted_file,");
-    else
-      fprintf(f_session, "keep_corrupted_file_no,");
-    if(options->mode_ext2>0)
-      fprintf(f_session, "mode_ext2,");
-    if(options->expert>0)
-      fprintf(f_session, "expert,");
-    if(options->lowmem>0)
-      fprintf(f_session, "lowmem,");
-    /* Save options - End */
-    if(params->carve_free_space_only>0)
-      fprintf(f_session,"freespace,");
-    else
-      fprintf(f_session,"wholespace,");
-    fprintf(f_session,"search,");
-    switch(params->status)
-    {
-      case STATUS_UNFORMAT:
-        fprintf(f_session, "status=unformat,");
-	break;
-      case STATUS_FIND_OFFSET:
-        fprintf(f_session, "status=find_offset,");
-	break;
-      case STATUS_EXT2_ON_BF:
-	fprintf(f_session, "status=ext2_on_bf,");
-	break;
-      case STATUS_EXT2_ON_SAVE_EVERYTHING:
-	fprintf(f_session, "status=ext2_on_save_everything,");
-	break;
-      case STATUS_EXT2_ON:
-	fprintf(f_session, "status=ext2_on,");
-	break;
-      case STATUS_EXT2_OFF_SAVE_EVERYTHING:
-	fprintf(f_session, "status=ext2_off_save_everything,");
-	break;
-      case STATUS_EXT2_OFF_BF:
-	fprintf(f_session, "status=ext2_off_bf,");
-	break;
-      case STATUS_EXT2_OFF:
-	fprintf(f_session, "status=ext2_off,");
-	break;
-      case STATUS_QUIT:
-        break;
-    }
-    if(params->status!=STATUS_FIND_OFFSET && params->offset!=PH_INVALID_OFFSET)
-      fprintf(f_session, "%llu,",
-	  (long long unsigned)(params->offset/params->disk->sector_size));
-    fprintf(f_session,"inter\n");
-    td_list_for_each(free_walker, &list_free_space->list)
+  }
+  /* Save options */
+  session_printf(snapshot, "options,");
+  if(options->paranoid==0)
+    session_printf(snapshot, "paranoid_no,");
+  else if(options->paranoid==1)
+    session_printf(snapshot, "paranoid,");
+  else
+    session_printf(snapshot, "paranoid_bf,");
+  if(options->keep_corrupted_file>0)
+    session_printf(snapshot, "keep_corrupted_file,");
+  else
+    session_printf(snapshot, "keep_corrupted_file_no,");
+  if(options->mode_ext2>0)
+    session_printf(snapshot, "mode_ext2,");
+  if(options->expert>0)
+    session_printf(snapshot, "expert,");
+  if(options->lowmem>0)
+    session_printf(snapshot, "lowmem,");
+  /* Save options - End */
+  if(params->carve_free_space_only>0)
+    session_printf(snapshot, "freespace,");
+  else
+    session_printf(snapshot, "wholespace,");
+  session_printf(snapshot, "search,");
+  switch(params->status)
+  {
+    case STATUS_UNFORMAT:
+      session_printf(snapshot, "status=unformat,");
+      break;
+    case STATUS_FIND_OFFSET:
+      session_printf(snapshot, "status=find_offset,");
+      break;
+    case STATUS_EXT2_ON_BF:
+      session_printf(snapshot, "status=ext2_on_bf,");
+      break;
+    case STATUS_EXT2_ON_SAVE_EVERYTHING:
+      session_printf(snapshot, "status=ext2_on_save_everything,");
+      break;
+    case STATUS_EXT2_ON:
+      session_printf(snapshot, "status=ext2_on,");
+      break;
+    case STATUS_EXT2_OFF_SAVE_EVERYTHING:
+      session_printf(snapshot, "status=ext2_off_save_everything,");
+      break;
+    case STATUS_EXT2_OFF_BF:
+      session_printf(snapshot, "status=ext2_off_bf,");
+      break;
+    case STATUS_EXT2_OFF:
+      session_printf(snapshot, "status=ext2_off,");
+      break;
+    case STATUS_QUIT:
+      break;
+  }
+  if(params->status!=STATUS_FIND_OFFSET && params->offset!=PH_INVALID_OFFSET)
+    session_printf(snapshot, "%llu,", (long long unsigned)snapshot->offset);
+  session_printf(snapshot, "inter\n");
+  return snapshot;
+}
+
+/* The journal is written first, photorec.ses refers to it by its time.
+ * photorec.ses is replaced atomically */
+static int session_write(session_snapshot_t *snapshot)
+{
+  FILE *f_session;
+  char *buffer;
+  int journal_ok;
+  int res=0;
+  journal_ok=journal_save(snapshot->extents, snapshot->nbr, snapshot);
+  if(journal_ok==0)
+  {
+    snapshot->extents=NULL;
+    /* The next delta is appended after this record, it's still valid */
+    if(snapshot->bf_valid!=0 && journal_save_bf(snapshot)<0)
     {
-      alloc_data_t *current_free_space;
-      current_free_space=td_list_entry(free_walker, alloc_data_t, list);
-      fprintf(f_session,"%llu-%llu\n",
-	  (long long unsigned)(current_free_space->start/params->disk->sector_size),
-	  (long long unsigned)(current_free_space->end/params->disk->sector_size));
+      /* A partial record ends the journal, write a new one next time */
+      log_error("Can't save the brute force progress in %s\n", JOURNAL_FILENAME);
+      journal_valid=0;
     }
   }
+  f_session=fopen(SESSION_FILENAME_TMP,"wb");
+  if(!f_session)
+  {
+    log_critical("Can't create %s file: %s\n", SESSION_FILENAME_TMP, strerror(errno));
+    return -1;
+  }
+  if(fwrite(snapshot->text.data, 1, snapshot->text.size, f_session)!=snapshot->text.size)
+    res=-1;
+  /* Without a journal, the extents are saved in the text file */
+  if(journal_ok<0)
+  {
+    unsigned int i;
+    for(i=0; i<snapshot->nbr && res==0; i++)
+      if(fprintf(f_session, "%llu-%llu\n",
+	    (long long unsigned)snapshot->extents[i].start,
+	    (long long unsigned)snapshot->extents[i].end) < 0)
+	res=-1;
+  }
+  /* Reserve some space */
+  buffer=(char *)MALLOC(SESSION_MAXSIZE);
+  memset(buffer,0,SESSION_MAXSIZE);
+  if(res==0 && fwrite(buffer,1,SESSION_MAXSIZE,f_session)<SESSION_MAXSIZE)
+    res=-1;
+  free(buffer);
+  if(res==0)
+    res=session_sync(f_session);
+  if(fclose(f_session)!=0)
+    res=-1;
+  if(res<0 || rename(SESSION_FILENAME_TMP, SESSION_FILENAME)<0)
+  {
+    log_critical("Can't write %s file: %s\n", SESSION_FILENAME, strerror(errno));
+    unlink(SESSION_FILENAME_TMP);
+    return -1;
+  }
+  return 0;
+}
+
+#ifdef HAVE_PTHREAD
+static void *session_writer_thread(void *arg)
+{
+  session_snapshot_t *snapshot=(session_snapshot_t *)arg;
+  paffinity_writer();
+  session_write(snapshot);
+  session_snapshot_free(snapshot);
+  pthread_mutex_lock(&session_writer_mutex);
+  session_writer_done=1;
+  pthread_mutex_unlock(&session_writer_mutex);
+  return NULL;
+}
+
+/* Wait for the checkpoint being written in the background */
+static void session_writer_wait(void)
+{
+  if(session_writer_started==0)
+    return ;
+  pthread_join(session_writer, NULL);
+  session_writer_started=0;
+}
+
+/* Return 1 if the previous checkpoint is still being written */
+static int session_writer_busy(void)
+{
+  int done;
+  if(session_writer_started==0)
+    return 0;
+  pthread_mutex_lock(&session_writer_mutex);
+  done=session_writer_done;
+  pthread_mutex_unlock(&session_writer_mutex);
+  if(done==0)
+    return 1;
+  session_writer_wait();
+  return 0;
+}
+
+/* The writer thread owns snapshot on success */
+static int session_writer_start(session_snapshot_t *snapshot)
+{
+  session_writer_done=0;
+  if(pthread_create(&session_writer, NULL, &session_writer_thread, snapshot)!=0)
+    return -1;
+  session_writer_started=1;
+  return 0;
+}
+#endif
 #endif
+
+int session_save(const alloc_data_t *list_free_space, const struct ph_param *params,  const struct ph_options *options)
+{
+#ifndef DISABLED_FOR_FRAMAC
+  session_snapshot_t *snapshot;
+  int res;
+#else
+  FILE *f_session;
+#endif
+  if(params->status==STATUS_QUIT || session_enabled==0)
+    return 0;
+#ifndef DISABLED_FOR_FRAMAC
+#ifdef HAVE_PTHREAD
+  /* The checkpoints are written in order */
+  session_writer_wait();
+#endif
+  if(options->verbose>1)
+  {
+    log_trace("session_save\n");
+  }
+  snapshot=session_snapshot_new(list_free_space, params, options);
+  diskcache_save_bad_sectors(params->disk, BAD_SECTORS_FILENAME);
+  res=(snapshot->failed==0 ? session_write(snapshot) : -1);
+  session_snapshot_free(snapshot);
+  return res;
+#else
+  f_session=fopen(SESSION_FILENAME,"wb");
+  if(!f_session)
+  {
+    /*@ assert \valid_read(list_free_space); */
+    /*@ assert valid_ph_param(params); */
+    /*@ assert \valid_read(options); */
+    return -1;
+  }
   { /* Reserve some space */
     int res;
     char *buffer;
@@ -369,14 +1204,140 @@ int session_save(const alloc_data_t *list_free_space, const struct ph_param *par
   /*@ assert valid_ph_param(params); */
   /*@ assert \valid_read(options); */
   return 0;
+#endif
+}
+
+time_t regular_session_start(time_t current_time)
+{
+#ifdef HAVE_PTHREAD
+  return current_time+SESSION_CHECKPOINT_DELAY;
+#else
+  return current_time+5*60;
+#endif
 }
 
 time_t regular_session_save(alloc_data_t *list_free_space, struct ph_param *params,  const struct ph_options *options, time_t current_time)
 {
-  time_t new_time;
-  /* Save current progress */
-  session_save(list_free_space, params, options);
-  new_time=time(NULL);
-  /* If it takes more then 30s to save the session, save every 15 minutes instead of every 5 minutes */
-  return new_time+(current_time+30<new_time?15:5)*60;
+#ifdef HAVE_PTHREAD
+  session_snapshot_t *snapshot;
+  uint64_t start;
+  uint64_t delay;
+#endif
+  if(session_enabled==0 && session_progress!=NULL)
+  {
+    /* A cluster worker reports to the coordinator every minute */
+    session_progress(params);
+    return time(NULL)+60;
+  }
+#ifdef HAVE_PTHREAD
+  if(session_enabled==0 || params->status==STATUS_QUIT)
+    return current_time+SESSION_CHECKPOINT_DELAY;
+  /* Don't wait for the previous checkpoint, take the next one later */
+  if(session_writer_busy()!=0)
+    return current_time+SESSION_CHECKPOINT_DELAY;
+  start=file_profile_clock();
+  snapshot=session_snapshot_new(list_free_space, params, options);
+  diskcache_save_bad_sectors(params->disk, BAD_SECTORS_FILENAME);
+  delay=(file_profile_clock() - start) * SESSION_CHECKPOINT_RATIO / 1000000000;
+  if(snapshot->failed!=0 || session_writer_start(snapshot)<0)
+  {
+    if(snapshot->failed==0)
+      session_write(snapshot);
+    session_snapshot_free(snapshot);
+  }
+  if(delay < SESSION_CHECKPOINT_DELAY)
+    delay=SESSION_CHECKPOINT_DELAY;
+  else if(delay > 15*60)
+    delay=15*60;
+  return time(NULL)+delay;
+#else
+  {
+    time_t new_time;
+    /* Save current progress */
+    session_save(list_free_space, params, options);
+    new_time=time(NULL);
+    /* If it takes more then 30s to save the session, save every 15 minutes instead of every 5 minutes */
+    return new_time+(current_time+30<new_time?15:5)*60;
+  }
+#endif
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+void session_load_bad_sectors(disk_t *disk)
+{
+  diskcache_load_bad_sectors(disk, BAD_SECTORS_FILENAME);
 }
+#endif
+
+void session_remove(void)
+{
+#ifdef HAVE_PTHREAD
+  session_writer_wait();
+#endif
+  unlink(SESSION_FILENAME);
+#ifndef DISABLED_FOR_FRAMAC
+  unlink(JOURNAL_FILENAME);
+  unlink(BAD_SECTORS_FILENAME);
+  free(journal_extents);
+  journal_extents=NULL;
+  journal_nbr=0;
+  journal_valid=0;
+  session_bf_loaded_valid=0;
+#endif
+}
+
+void session_backup(void)
+{
+#ifdef HAVE_PTHREAD
+  session_writer_wait();
+#endif
+  rename(SESSION_FILENAME, "photorec.se2");
+#ifndef DISABLED_FOR_FRAMAC
+  session_bf_loaded_valid=0;
+  rename(JOURNAL_FILENAME, "photorec.sj2");
+  rename(BAD_SECTORS_FILENAME, "photorec.sm2");
+#endif
+}
+
+void session_wait(void)
+{
+#ifdef HAVE_PTHREAD
+  session_writer_wait();
+#endif
+}
+
+void session_disable(void)
+{
+  session_enabled=0;
+#ifdef HAVE_PTHREAD
+  /* A forked worker doesn't have the writer thread of its parent */
+  session_writer_started=0;
+#endif
+}
+
+void session_set_progress(void (*fnct)(const struct ph_param *params))
+{
+  session_progress=fnct;
+}
+
+#ifndef DISABLED_FOR_FRAMAC
+void session_set_bf(const session_bf_t *bf)
+{
+  if(bf==NULL)
+  {
+    session_bf_valid=0;
+    return ;
+  }
+  memcpy(&session_bf, bf, sizeof(session_bf));
+  session_bf_valid=1;
+}
+
+int session_get_bf(session_bf_t *bf)
+{
+  if(session_bf_loaded_valid==0)
+    return -1;
+  memcpy(bf, &session_bf_loaded, sizeof(*bf));
+  session_bf_loaded_valid=0;
+  return 0;
+}
+#endif
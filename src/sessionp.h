@@ -36,6 +36,9 @@ extern "C" {
 // ensures  valid_list_search_space(list_free_space);
 int session_load(char **cmd_device, char **current_cmd, alloc_data_t *list_free_space);
 
+/* session_save() and regular_session_save() save the bad sectors of
+ * the disk cache with the session: no read of the disk may be in
+ * progress in another thread, see preader_sync() */
 /*@
   @ requires \valid_read(list_free_space);
   @ requires valid_ph_param(params);
@@ -52,6 +55,62 @@ int session_save(const alloc_data_t *list_free_space, const struct ph_param *par
   @*/
 time_t regular_session_save(alloc_data_t *list_free_space, struct ph_param *params,  const struct ph_options *options, time_t current_time);
 
+/* Time of the first call to regular_session_save() for a scan starting
+ * at current_time. With a writer thread, the checkpoints are written in
+ * the background every few seconds */
+/*@
+  @ assigns \nothing;
+  @*/
+time_t regular_session_start(time_t current_time);
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Reload the unreadable sectors saved with the session */
+/*@
+  @ requires \valid(disk);
+  @*/
+void session_load_bad_sectors(disk_t *disk);
+#endif
+
+#ifndef DISABLED_FOR_FRAMAC
+/* Progress of the brute force pass, saved in the journal with each
+ * checkpoint taken while the status is ext2_on_bf or ext2_off_bf.
+ * The offsets are in bytes */
+typedef struct
+{
+  unsigned int phase;
+  int blocs_to_skip;		/* candidate of the file being brute forced */
+  uint64_t file_start;		/* header of the file being brute forced */
+  uint64_t file_offset;		/* split offset of the candidate, 0 if none */
+  uint64_t offset_error;	/* offset_error before the candidate */
+} session_bf_t;
+
+/* The progress written with the next checkpoints, NULL once the brute
+ * force pass is over */
+void session_set_bf(const session_bf_t *bf);
+
+/* Return 0 with the progress saved by the session resumed, only once */
+/*@
+  @ requires \valid(bf);
+  @*/
+int session_get_bf(session_bf_t *bf);
+#endif
+
+/* Remove photorec.ses, its journal photorec.sej and photorec.sem */
+void session_remove(void);
+
+/* Rename the session files to photorec.se2, photorec.sj2 and photorec.sm2 */
+void session_backup(void);
+
+/* Wait for the checkpoint being written in the background, if any */
+void session_wait(void);
+
+/* session_save() does nothing after this call, used by the worker processes */
+void session_disable(void);
+
+/* Once the session is disabled, regular_session_save() calls fnct
+ * every minute instead, NULL to stop */
+void session_set_progress(void (*fnct)(const struct ph_param *params));
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
@@ -0,0 +1,517 @@
+/*
+
+    File: splitimg.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "splitimg.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Raw image split in segments, image.001, image.002... as written by
+ * FTK Imager, "split -d" or dc3dd. The segments are found at open time,
+ * their offsets in the image are kept in order and a read spanning
+ * several segments is split. The segments are grouped by the device
+ * they are stored on: when they are spread over several disks or
+ * shares, each group is read by its own thread. */
+#define SPLIT_MAX_GROUPS	16
+/* Room for the segment number after the dot, an unsigned int */
+#define SPLIT_NUMBER_SIZE	16
+
+extern const arch_fnct_t arch_none;
+
+struct split_segment
+{
+  int handle;
+  unsigned int group;
+  uint64_t start;		/* offset of the segment in the image */
+  uint64_t size;
+};
+
+struct split_io
+{
+  unsigned char *buffer;
+  uint64_t offset;		/* offset in the segment */
+  unsigned int seg;
+  unsigned int size;
+};
+
+struct info_split_struct;
+
+struct split_group
+{
+  dev_t dev;
+  struct split_io *io;
+  unsigned int io_nbr;
+  unsigned int io_size;
+  int error;
+  struct info_split_struct *data;
+#ifdef HAVE_PTHREAD
+  unsigned int generation;
+  int thread_ok;
+  pthread_t thread;
+#endif
+};
+
+struct info_split_struct
+{
+  char *file_name;
+  struct split_segment *segment;
+  unsigned int nbr_segments;
+  uint64_t size;
+  struct split_group group[SPLIT_MAX_GROUPS];
+  unsigned int nbr_groups;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t pread_mutex;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_start;
+  pthread_cond_t cond_done;
+  unsigned int generation;
+  unsigned int pending;
+  unsigned int nbr_threads;
+  int quit;
+#endif
+};
+
+static int split_read_at(const int fd, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#ifdef HAVE_PREAD
+  return pread(fd, buffer, count, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return read(fd, buffer, count);
+#endif
+}
+
+/* Segment holding the image offset pos, pos < data->size */
+static unsigned int split_find_segment(const struct info_split_struct *data, const uint64_t pos)
+{
+  unsigned int lo=0;
+  unsigned int hi=data->nbr_segments - 1;
+  while(lo < hi)
+  {
+    const unsigned int mid=lo + (hi - lo + 1) / 2;
+    if(data->segment[mid].start <= pos)
+      lo=mid;
+    else
+      hi=mid - 1;
+  }
+  return lo;
+}
+
+static void split_add_io(struct info_split_struct *data, const unsigned int seg, const uint64_t offset, unsigned char *buffer, const unsigned int size)
+{
+  struct split_group *group=&data->group[data->segment[seg].group];
+  struct split_io *io;
+  if(group->io_nbr==group->io_size)
+  {
+    group->io_size=(group->io_size==0 ? 16 : 2 * group->io_size);
+    group->io=(struct split_io *)realloc(group->io, group->io_size * sizeof(struct split_io));
+    if(group->io==NULL)
+    {
+      log_critical("splitimg: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  io=&group->io[group->io_nbr++];
+  io->buffer=buffer;
+  io->offset=offset;
+  io->seg=seg;
+  io->size=size;
+}
+
+static void split_group_io(struct split_group *group)
+{
+  const struct info_split_struct *data=group->data;
+  unsigned int i;
+  for(i=0; i<group->io_nbr; i++)
+  {
+    const struct split_io *io=&group->io[i];
+    const int res=split_read_at(data->segment[io->seg].handle, io->buffer, io->size, io->offset);
+    if(res != (int)io->size)
+    {
+      log_error("%s: read error in segment %u at %llu\n", data->file_name, io->seg + 1,
+	  (long long unsigned)io->offset);
+      group->error=1;
+    }
+  }
+}
+
+#ifdef HAVE_PTHREAD
+static void *split_thread(void *arg)
+{
+  struct split_group *group=(struct split_group *)arg;
+  struct info_split_struct *data=group->data;
+  pthread_mutex_lock(&data->mutex);
+  while(1)
+  {
+    while(data->quit==0 && group->generation==data->generation)
+      pthread_cond_wait(&data->cond_start, &data->mutex);
+    if(data->quit!=0)
+      break;
+    group->generation=data->generation;
+    pthread_mutex_unlock(&data->mutex);
+    split_group_io(group);
+    pthread_mutex_lock(&data->mutex);
+    if(--data->pending==0)
+      pthread_cond_signal(&data->cond_done);
+  }
+  pthread_mutex_unlock(&data->mutex);
+  return NULL;
+}
+#endif
+
+/* Run the segment reads, a thread by group when more than one group
+ * has something to read */
+static void split_run(struct info_split_struct *data)
+{
+  unsigned int g;
+#ifdef HAVE_PTHREAD
+  unsigned int busy=0;
+  for(g=0; g<data->nbr_groups; g++)
+    if(data->group[g].io_nbr > 0)
+      busy++;
+  if(busy > 1 && data->nbr_threads > 0)
+  {
+    pthread_mutex_lock(&data->mutex);
+    data->pending=data->nbr_threads;
+    data->generation++;
+    pthread_cond_broadcast(&data->cond_start);
+    pthread_mutex_unlock(&data->mutex);
+    for(g=0; g<data->nbr_groups; g++)
+      if(data->group[g].thread_ok==0)
+	split_group_io(&data->group[g]);
+    pthread_mutex_lock(&data->mutex);
+    while(data->pending > 0)
+      pthread_cond_wait(&data->cond_done, &data->mutex);
+    pthread_mutex_unlock(&data->mutex);
+    return ;
+  }
+#endif
+  for(g=0; g<data->nbr_groups; g++)
+    split_group_io(&data->group[g]);
+}
+
+static int fsplit_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_split_struct *data=(struct info_split_struct *)disk->data;
+  unsigned int size=count;
+  unsigned int done=0;
+  unsigned int seg;
+  unsigned int g;
+  int res=0;
+  if(offset >= data->size)
+    return 0;
+  if(size > data->size - offset)
+    size=data->size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->pread_mutex);
+#endif
+  for(g=0; g<data->nbr_groups; g++)
+  {
+    data->group[g].io_nbr=0;
+    data->group[g].error=0;
+  }
+  seg=split_find_segment(data, offset);
+  while(done < size)
+  {
+    const struct split_segment *segment=&data->segment[seg];
+    const uint64_t pos=offset + done;
+    unsigned int piece=size - done;
+    if(piece > segment->start + segment->size - pos)
+      piece=segment->start + segment->size - pos;
+    if(piece > 0)
+      split_add_io(data, seg, pos - segment->start, (unsigned char *)buffer + done, piece);
+    done+=piece;
+    seg++;
+  }
+  split_run(data);
+  for(g=0; g<data->nbr_groups; g++)
+    if(data->group[g].error!=0)
+      res=-1;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->pread_mutex);
+#endif
+  if(res < 0)
+    return -1;
+  return size;
+}
+
+static int fsplit_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fsplit_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fsplit_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fsplit_description(disk_t *disk)
+{
+  const struct info_split_struct *data=(const struct info_split_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  /* With a long file name, the geometry is left out */
+  if(snprintf(disk->description_txt, sizeof(disk->description_txt),"Image %s (%u segments) - %s - CHS %lu %u %u (RO)",
+	data->file_name, data->nbr_segments, buffer_disk_size,
+	disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head) >= (int)sizeof(disk->description_txt))
+    snprintf(disk->description_txt, sizeof(disk->description_txt),"Image %s (%u segments) - %s (RO)",
+	data->file_name, data->nbr_segments, buffer_disk_size);
+  return disk->description_txt;
+}
+
+static const char *fsplit_description_short(disk_t *disk)
+{
+  const struct info_split_struct *data=(const struct info_split_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_short_txt),"Image %s (%u segments) - %s (RO)",
+      data->file_name, data->nbr_segments, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void split_free(struct info_split_struct *data)
+{
+  unsigned int i;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+  data->quit=1;
+  pthread_cond_broadcast(&data->cond_start);
+  pthread_mutex_unlock(&data->mutex);
+  for(i=0; i<data->nbr_groups; i++)
+    if(data->group[i].thread_ok!=0)
+      pthread_join(data->group[i].thread, NULL);
+  pthread_cond_destroy(&data->cond_done);
+  pthread_cond_destroy(&data->cond_start);
+  pthread_mutex_destroy(&data->mutex);
+  pthread_mutex_destroy(&data->pread_mutex);
+#endif
+  for(i=0; i<data->nbr_segments; i++)
+    close(data->segment[i].handle);
+  for(i=0; i<SPLIT_MAX_GROUPS; i++)
+    free(data->group[i].io);
+  free(data->segment);
+  free(data->file_name);
+  free(data);
+}
+
+static void fsplit_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    split_free((struct info_split_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+/* Return the position of the segment number in name, -1 if name doesn't
+ * end with a dot followed by two digits or more */
+static int split_number_pos(const char *name, unsigned int *number)
+{
+  const char *dot=strrchr(name, '.');
+  const char *p;
+  unsigned int value=0;
+  if(dot==NULL || strlen(dot + 1) < 2 || strlen(dot + 1) > 9)
+    return -1;
+  for(p=dot + 1; *p!='\0'; p++)
+  {
+    if(*p<'0' || *p>'9')
+      return -1;
+    value=value * 10 + (*p - '0');
+  }
+  *number=value;
+  return dot + 1 - name;
+}
+
+/* Open the next segment, its number has the same width as the first
+ * one but may grow, image.999 is followed by image.1000 */
+static int split_open_segment(struct info_split_struct *data, const char *name, const unsigned int pos, const unsigned int width, const unsigned int number, const int verbose)
+{
+  struct split_segment *segment;
+  struct stat stat_rec;
+  char *segment_name;
+  unsigned int g;
+  int fd;
+  segment_name=(char *)MALLOC(pos + SPLIT_NUMBER_SIZE);
+  memcpy(segment_name, name, pos);
+  /* A truncated name would open another segment */
+  if(snprintf(segment_name + pos, SPLIT_NUMBER_SIZE, "%0*u", (int)width, number) >= SPLIT_NUMBER_SIZE)
+  {
+    free(segment_name);
+    return -1;
+  }
+  fd=open(segment_name, O_RDONLY|O_BINARY);
+  if(fd < 0)
+  {
+    free(segment_name);
+    return -1;
+  }
+  if(fstat(fd, &stat_rec) < 0 || !S_ISREG(stat_rec.st_mode))
+  {
+    close(fd);
+    free(segment_name);
+    return -1;
+  }
+  if((data->nbr_segments & 15)==0)
+  {
+    data->segment=(struct split_segment *)realloc(data->segment, (data->nbr_segments + 16) * sizeof(struct split_segment));
+    if(data->segment==NULL)
+    {
+      log_critical("splitimg: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for(g=0; g<data->nbr_groups && data->group[g].dev!=stat_rec.st_dev; g++);
+  if(g==data->nbr_groups)
+  {
+    if(data->nbr_groups < SPLIT_MAX_GROUPS)
+    {
+      data->group[g].dev=stat_rec.st_dev;
+      data->group[g].data=data;
+      data->nbr_groups++;
+    }
+    else
+      g=SPLIT_MAX_GROUPS - 1;
+  }
+  segment=&data->segment[data->nbr_segments++];
+  segment->handle=fd;
+  segment->group=g;
+  segment->start=data->size;
+  segment->size=stat_rec.st_size;
+  data->size+=segment->size;
+  if(verbose > 0)
+    log_verbose("%s: segment %u, %llu bytes, group %u\n", segment_name, data->nbr_segments,
+	(long long unsigned)segment->size, g);
+  free(segment_name);
+  return 0;
+}
+
+disk_t *fsplit_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_split_struct *data;
+  disk_t *disk;
+  unsigned int first;
+  unsigned int number;
+  const int pos=split_number_pos(device, &first);
+  if(pos < 0 || first > 1)
+    return NULL;
+  data=(struct info_split_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  for(number=first; split_open_segment(data, device, pos, strlen(device) - pos, number, verbose)==0; number++);
+  if(data->nbr_segments < 2 || data->size==0)
+  {
+    unsigned int i;
+    for(i=0; i<data->nbr_segments; i++)
+      close(data->segment[i].handle);
+    free(data->segment);
+    free(data);
+    return NULL;
+  }
+  data->file_name=strdup(device);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->pread_mutex, NULL);
+  pthread_mutex_init(&data->mutex, NULL);
+  pthread_cond_init(&data->cond_start, NULL);
+  pthread_cond_init(&data->cond_done, NULL);
+  if(data->nbr_groups > 1)
+  {
+    unsigned int g;
+    for(g=0; g<data->nbr_groups; g++)
+    {
+      struct split_group *group=&data->group[g];
+      if(pthread_create(&group->thread, NULL, &split_thread, group)==0)
+      {
+	group->thread_ok=1;
+	data->nbr_threads++;
+      }
+    }
+  }
+#endif
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(data->file_name==NULL || disk->device==NULL)
+  {
+    free(disk->device);
+    free(disk);
+    split_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&fsplit_description;
+  disk->description_short=&fsplit_description_short;
+  disk->pread=&fsplit_pread;
+  disk->pwrite=&fsplit_nopwrite;
+  disk->sync=&fsplit_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fsplit_clean;
+  disk->sector_size=DEFAULT_SECTOR_SIZE;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->size;
+  update_disk_car_fields(disk);
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: split images are opened read-only\n", device);
+  log_info("%s: raw image split in %u segments on %u device%s, %llu bytes\n", device,
+      data->nbr_segments, data->nbr_groups, (data->nbr_groups > 1 ? "s" : ""),
+      (long long unsigned)data->size);
+  return disk;
+}
+#endif
@@ -0,0 +1,306 @@
+/*
+
+    File: srchash.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if defined(DISABLED_FOR_FRAMAC)
+#undef HAVE_PTHREAD
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "log.h"
+#include "pbkdf2.h"
+#include "srchash.h"
+
+#define SRCHASH_NBR		3
+#define SRCHASH_BUFFER_SIZE	(1024*1024)
+#define SRCHASH_BUFFERS		8
+
+struct srchash_buffer
+{
+  unsigned char *data;
+  unsigned int size;
+  unsigned int remaining;	/* workers that haven't hashed it yet */
+};
+
+struct srchash_worker
+{
+  srchash_t *hash;
+  unsigned int digest;
+  uint64_t done;		/* buffers hashed */
+#ifdef HAVE_PTHREAD
+  pthread_t thread;
+#endif
+  int running;
+};
+
+struct srchash
+{
+  disk_t *disk;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t pos;			/* bytes hashed */
+  uint64_t filled;		/* bytes read to fill the gaps */
+  uint64_t zeroes;		/* unreadable bytes hashed as zeroes */
+  hash_ctx_t ctx[SRCHASH_NBR];
+  struct srchash_worker workers[SRCHASH_NBR];
+  unsigned int nbr_threads;
+  struct srchash_buffer buffers[SRCHASH_BUFFERS];
+  uint64_t produced;		/* buffers given to the workers */
+  unsigned int used;		/* bytes in the buffer being filled */
+  unsigned char *gap;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int quit;
+#endif
+};
+
+static const char *srchash_algos[SRCHASH_NBR]={ "md5", "sha1", "sha256" };
+static const char *srchash_labels[SRCHASH_NBR]={ "MD5", "SHA1", "SHA256" };
+
+static int srchash_enable=0;
+
+void srchash_set(const int enable)
+{
+  srchash_enable=(enable > 0 ? 1 : 0);
+}
+
+int srchash_enabled(void)
+{
+  return srchash_enable;
+}
+
+#ifdef HAVE_PTHREAD
+static void *srchash_thread(void *arg)
+{
+  struct srchash_worker *worker=(struct srchash_worker *)arg;
+  srchash_t *hash=worker->hash;
+  pthread_mutex_lock(&hash->mutex);
+  while(1)
+  {
+    struct srchash_buffer *buffer;
+    if(worker->done==hash->produced)
+    {
+      if(hash->quit!=0)
+	break;
+      pthread_cond_wait(&hash->cond, &hash->mutex);
+      continue;
+    }
+    buffer=&hash->buffers[worker->done % SRCHASH_BUFFERS];
+    pthread_mutex_unlock(&hash->mutex);
+    hash_update(&hash->ctx[worker->digest], buffer->data, buffer->size);
+    pthread_mutex_lock(&hash->mutex);
+    buffer->remaining--;
+    worker->done++;
+    pthread_cond_broadcast(&hash->cond);
+  }
+  pthread_mutex_unlock(&hash->mutex);
+  return NULL;
+}
+
+/* Give the buffer being filled to the workers */
+static void srchash_publish(srchash_t *hash)
+{
+  struct srchash_buffer *buffer=&hash->buffers[hash->produced % SRCHASH_BUFFERS];
+  if(hash->used==0)
+    return ;
+  pthread_mutex_lock(&hash->mutex);
+  buffer->size=hash->used;
+  buffer->remaining=hash->nbr_threads;
+  hash->produced++;
+  hash->used=0;
+  pthread_cond_broadcast(&hash->cond);
+  pthread_mutex_unlock(&hash->mutex);
+}
+#endif
+
+/* Hash the next len bytes */
+static void srchash_feed(srchash_t *hash, const unsigned char *data, unsigned int len)
+{
+  unsigned int i;
+  hash->pos+=len;
+  for(i=0; i<SRCHASH_NBR; i++)
+    if(hash->workers[i].running==0)
+      hash_update(&hash->ctx[i], data, len);
+#ifdef HAVE_PTHREAD
+  while(hash->nbr_threads > 0 && len > 0)
+  {
+    struct srchash_buffer *buffer=&hash->buffers[hash->produced % SRCHASH_BUFFERS];
+    unsigned int size=SRCHASH_BUFFER_SIZE - hash->used;
+    if(hash->used==0)
+    {
+      /* Wait for the workers to release this buffer */
+      pthread_mutex_lock(&hash->mutex);
+      while(buffer->remaining > 0)
+	pthread_cond_wait(&hash->cond, &hash->mutex);
+      pthread_mutex_unlock(&hash->mutex);
+    }
+    if(size > len)
+      size=len;
+    memcpy(buffer->data + hash->used, data, size);
+    hash->used+=size;
+    data+=size;
+    len-=size;
+    if(hash->used==SRCHASH_BUFFER_SIZE)
+      srchash_publish(hash);
+  }
+#endif
+}
+
+/* Read and hash the bytes up to end, unreadable sectors are hashed as
+ * zeroes */
+static void srchash_fill(srchash_t *hash, disk_t *disk, const uint64_t offset, const uint64_t end)
+{
+  const unsigned int sector_size=(disk->sector_size > 0 ? disk->sector_size : 512);
+  if(hash->gap==NULL)
+    hash->gap=(unsigned char *)MALLOC(SRCHASH_BUFFER_SIZE);
+  while(hash->pos < end)
+  {
+    const unsigned int size=(end - hash->pos < SRCHASH_BUFFER_SIZE ? end - hash->pos : SRCHASH_BUFFER_SIZE);
+    if(disk->pread(disk, hash->gap, size, offset + hash->pos) != (int)size)
+    {
+      unsigned int i;
+      for(i=0; i<size; i+=sector_size)
+      {
+	const unsigned int count=(size - i < sector_size ? size - i : sector_size);
+	if(disk->pread(disk, hash->gap + i, count, offset + hash->pos + i) != (int)count)
+	{
+	  memset(hash->gap + i, 0, count);
+	  hash->zeroes+=count;
+	}
+      }
+    }
+    hash->filled+=size;
+    srchash_feed(hash, hash->gap, size);
+  }
+}
+
+srchash_t *srchash_new(disk_t *disk, const uint64_t offset, const uint64_t size)
+{
+  srchash_t *hash=(srchash_t *)MALLOC(sizeof(*hash));
+  unsigned int i;
+  memset(hash, 0, sizeof(*hash));
+  hash->disk=disk;
+  hash->offset=offset;
+  hash->size=size;
+  for(i=0; i<SRCHASH_NBR; i++)
+  {
+    hash_init(&hash->ctx[i], srchash_algos[i]);
+    hash->workers[i].hash=hash;
+    hash->workers[i].digest=i;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&hash->mutex, NULL);
+  pthread_cond_init(&hash->cond, NULL);
+  for(i=0; i<SRCHASH_BUFFERS; i++)
+    hash->buffers[i].data=(unsigned char *)MALLOC(SRCHASH_BUFFER_SIZE);
+  /* A digest without a thread is updated by the reader */
+  for(i=0; i<SRCHASH_NBR; i++)
+  {
+    struct srchash_worker *worker=&hash->workers[i];
+    if(pthread_create(&worker->thread, NULL, &srchash_thread, worker)==0)
+    {
+      worker->running=1;
+      hash->nbr_threads++;
+    }
+  }
+#endif
+  return hash;
+}
+
+void srchash_update(srchash_t *hash, const unsigned char *data, const unsigned int len, const uint64_t pos)
+{
+  uint64_t end;
+  if(hash==NULL || pos >= hash->size)
+    return ;
+  if(pos > hash->pos)
+  {
+    if(hash->disk==NULL)
+      return ;
+    srchash_fill(hash, hash->disk, hash->offset, pos);
+  }
+  end=(pos + len < hash->size ? pos + len : hash->size);
+  if(end <= hash->pos)
+    return ;
+  srchash_feed(hash, data + (hash->pos - pos), end - hash->pos);
+}
+
+int srchash_finish(srchash_t *hash, disk_t *disk, const uint64_t offset)
+{
+  unsigned int i;
+  int res;
+  if(hash==NULL)
+    return -1;
+  if(disk!=NULL)
+    srchash_fill(hash, disk, offset, hash->size);
+#ifdef HAVE_PTHREAD
+  if(hash->nbr_threads > 0)
+    srchash_publish(hash);
+  pthread_mutex_lock(&hash->mutex);
+  hash->quit=1;
+  pthread_cond_broadcast(&hash->cond);
+  pthread_mutex_unlock(&hash->mutex);
+  for(i=0; i<SRCHASH_NBR; i++)
+    if(hash->workers[i].running)
+      pthread_join(hash->workers[i].thread, NULL);
+  pthread_cond_destroy(&hash->cond);
+  pthread_mutex_destroy(&hash->mutex);
+  for(i=0; i<SRCHASH_BUFFERS; i++)
+    free(hash->buffers[i].data);
+#endif
+  res=(hash->pos==hash->size ? 0 : -1);
+  if(res < 0)
+    log_info("Source hash incomplete: %llu/%llu bytes hashed\n",
+	(long long unsigned)hash->pos, (long long unsigned)hash->size);
+  else
+  {
+    log_info("Source hash: %llu bytes, %llu bytes read again, %llu unreadable bytes hashed as zeroes\n",
+	(long long unsigned)hash->size, (long long unsigned)hash->filled,
+	(long long unsigned)hash->zeroes);
+    for(i=0; i<SRCHASH_NBR; i++)
+    {
+      unsigned char digest[HASH_MAX_DIGEST];
+      char hex[2*HASH_MAX_DIGEST+1];
+      unsigned int j;
+      hash_final(&hash->ctx[i], digest);
+      for(j=0; j<hash->ctx[i].digest_size; j++)
+	sprintf(&hex[2*j], "%02x", digest[j]);
+      log_info("%-6s %s\n", srchash_labels[i], hex);
+    }
+  }
+  free(hash->gap);
+  free(hash);
+  return res;
+}
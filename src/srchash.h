@@ -0,0 +1,72 @@
+/*
+
+    File: srchash.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _SRCHASH_H
+#define _SRCHASH_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* MD5, SHA-1 and SHA-256 of a source partition, computed while a scan or
+ * an image reads it. The bytes are hashed in order: data before the hash
+ * position has already been hashed and is ignored. When a read lands
+ * after the hash position, the gap is read at once if the hash has a
+ * disk, otherwise the hash position stays there and srchash_finish()
+ * reads what remains. Each digest is updated by its own worker thread. */
+typedef struct srchash srchash_t;
+
+/*@
+  @ assigns \nothing;
+  @*/
+void srchash_set(const int enable);
+
+/*@
+  @ assigns \nothing;
+  @*/
+int srchash_enabled(void);
+
+/* Hash size bytes from offset. disk may be NULL: the gaps aren't read */
+/*@
+  @ requires disk == \null || valid_disk(disk);
+  @*/
+srchash_t *srchash_new(disk_t *disk, const uint64_t offset, const uint64_t size);
+
+/* len bytes have been read at pos, relative to the start of the hashed
+ * area. hash may be NULL */
+/*@
+  @ requires hash == \null || \valid(hash);
+  @ requires \valid_read(data + (0 .. len-1));
+  @*/
+void srchash_update(srchash_t *hash, const unsigned char *data, const unsigned int len, const uint64_t pos);
+
+/* Read the remaining bytes from disk at offset, log the digests and free
+ * hash. With disk NULL, the hash is only logged as incomplete.
+ * Return 0 if the whole area has been hashed */
+/*@
+  @ requires hash == \null || \valid(hash);
+  @ requires disk == \null || valid_disk(disk);
+  @*/
+int srchash_finish(srchash_t *hash, disk_t *disk, const uint64_t offset);
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
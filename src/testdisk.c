@@ -62,6 +62,8 @@
 #include "rfs_dir.h"
 #include "ntfs_dir.h"
 #include "hdcache.h"
+#include "hdshare.h"
+#include "hdstats.h"
 #include "ewf.h"
 #include "log.h"
 #include "hdaccess.h"
@@ -72,6 +74,8 @@
 #include "tlog.h"
 #include "autoset.h"
 #include "hidden.h"
+#include "overlay.h"
+#include "srchash.h"
 
 #ifdef HAVE_SIGACTION
 int need_to_stop=0;
@@ -102,11 +106,16 @@ static void display_help(void)
   printf("\n" \
       "Usage: testdisk [/log] [/debug] [file.dd|file.e01|device]\n"\
       "       testdisk /list  [/log]   [file.dd|file.e01|device]\n" \
+      "       testdisk /overlay_commit|/overlay_discard overlay:sidefile,device\n" \
       "       testdisk /version\n" \
       "\n" \
       "/log          : create a testdisk.log file\n" \
       "/debug        : add debug information\n" \
       "/list         : display current partitions\n" \
+      "/srchash      : compute the MD5, SHA-1 and SHA-256 of the source of an image\n" \
+      "/sharedcache N: share N MiB of the data read with the other processes reading the same source\n" \
+      "/overlay_commit : write the sectors kept in the side file to the device\n" \
+      "/overlay_discard: forget the sectors kept in the side file\n" \
       "\n" \
       "TestDisk checks and recovers lost partitions\n" \
       "It works with :\n" \
@@ -326,8 +335,32 @@ int main( int argc, char **argv )
       run_setlocale=0;
     else if((strcmp(argv[i],"/safe")==0) || (strcmp(argv[i],"-safe")==0))
       safe=1;
+    else if((strcmp(argv[i],"/srchash")==0) || (strcmp(argv[i],"-srchash")==0))
+      srchash_set(1);
+    else if(i+1<argc && ((strcmp(argv[i],"/sharedcache")==0) || (strcmp(argv[i],"-sharedcache")==0)))
+      diskshare_set_size((uint64_t)strtoul(argv[++i], NULL, 10) << 20);
     else if((strcmp(argv[i],"/saveheader")==0) || (strcmp(argv[i],"-saveheader")==0))
       saveheader=1;
+    else if(strcmp(argv[i],"/overlay_commit")==0 || strcmp(argv[i],"-overlay_commit")==0 ||
+	strcmp(argv[i],"/overlay_discard")==0 || strcmp(argv[i],"-overlay_discard")==0)
+    {
+      const int commit=(strcmp(&argv[i][1],"overlay_commit")==0);
+      int res;
+      if(i+1>=argc)
+      {
+	display_help();
+	log_close();
+	return 1;
+      }
+      i++;
+      res=(commit ? overlay_commit(argv[i], verbose) : overlay_discard(argv[i]));
+      if(res < 0)
+	printf("\nUnable to %s %s\n", (commit ? "commit" : "discard"), argv[i]);
+      else if(commit)
+	printf("\n%d sectors written\n", res);
+      log_close();
+      return (res < 0 ? 1 : 0);
+    }
     else if(strcmp(argv[i],"/cmd")==0)
     {
       if(i+2>=argc)
@@ -501,6 +534,7 @@ int main( int argc, char **argv )
   }
   cmd_device=NULL;
   cmd_run=NULL;
+  disk_stats_log_all();
   write_used=delete_list_disk(list_disk);
   log_info("TestDisk exited normally.\n");
   if(log_close()!=0)
@@ -4,6 +4,10 @@
 
 #if defined(DISABLED_FOR_FRAMAC)
 #undef ENABLE_DFXML
+#undef HAVE_FORK
+#endif
+#if !defined(HAVE_SYS_WAIT_H)
+#undef HAVE_FORK
 #endif
 
 #include <stdio.h>
@@ -45,6 +49,10 @@
 #include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
+#ifdef HAVE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
 
 #include "dir.h"
 #include "fat.h"
@@ -70,15 +78,36 @@
 #include "phbs.h"
 #include "file_found.h"
 #include "dfxml.h"
+#include "ppack.h"
+#include "pindex.h"
+#include "pmanifest.h"
+#include "phits.h"
+#include "pstream.h"
 #include "fnctdsk.h"
 #include "hdaccess.h"
 #include "hdcache.h"
+#include "hdpipe.h"
+#include "hdqos.h"
+#include "hdshare.h"
+#include "hdstats.h"
 #include "partauto.h"
 #include "pdisksel.h"
 #include "pfree_whole.h"
 #include "phcli.h"
 #include "poptions.h"
 #include "psearchn.h"
+#include "pcluster.h"
+#include "pshard.h"
+#include "ppriority.h"
+#include "ptriage.h"
+#include "pinventory.h"
+#include "pprune.h"
+#include "preader.h"
+#include "pcheck.h"
+#include "pdepth.h"
+#include "pfilter.h"
+#include "pspec.h"
+#include "paffinity.h"
 #include "godmode.h"
 #include "savehdr.h"
 #include "tload.h"
@@ -88,6 +117,7 @@
 #include "io_redir.h"
 #include "tpartwr.h"
 #include "analyse.h"
+#include "analyse_cache.h"
 #include "fat32.h"
 #include "tntfs.h"
 #include "tdelete.h"
@@ -124,8 +154,34 @@ typedef struct ph_cli_context
     alloc_data_t list_search_space;
     int log_opened;
     int log_errno;
+    unsigned int workers;
+    char* cluster_dir;
+    unsigned int cluster_jobs;
 } ph_cli_context_t;
 
+/* Must match testdisk_batch_job_t and testdisk_batch_stats_t */
+typedef struct
+{
+    const char* device;
+    const char* recup_dir;
+    unsigned int workers;
+    int result;
+    unsigned int file_nbr;
+    uint64_t bytes;
+    time_t elapsed;
+} ph_batch_job_t;
+
+typedef struct
+{
+    unsigned int jobs_done;
+    unsigned int jobs_failed;
+    unsigned int file_nbr;
+    uint64_t bytes;
+    time_t elapsed;
+} ph_batch_stats_t;
+
+typedef int (*ph_batch_setup_t)(ph_cli_context_t* ctx, const ph_batch_job_t* job, void* opaque);
+
 extern const file_enable_t array_file_enable[];
 
 extern const arch_fnct_t arch_none;
@@ -206,7 +262,9 @@ list_disk_t* init_list_disk(const ph_cli_context_t* ctx)
          element_disk != NULL;
          element_disk = element_disk->next)
     {
-        // Init cache
+        // Init cache, the throttling below it
+        if (diskqos_target() > 0)
+            element_disk->disk = new_diskqos(element_disk->disk);
         element_disk->disk = new_diskcache(element_disk->disk, ctx->mode);
     }
 #endif
@@ -226,6 +284,8 @@ disk_t* add_image(ph_cli_context_t* ctx, const char* image_file)
         // Init cache for the new disk
         if (element_disk->disk == disk_car)
         {
+            if (diskqos_target() > 0)
+                element_disk->disk = new_diskqos(element_disk->disk);
             element_disk->disk = new_diskcache(element_disk->disk, ctx->mode);
             break;
         }
@@ -373,6 +433,171 @@ int change_blocksize(ph_cli_context_t* ctx, const unsigned int blocksize)
     return 0;
 }
 
+int change_workers(ph_cli_context_t* ctx, const unsigned int workers)
+{
+    ctx->workers = (workers > 0 ? workers : 1);
+    return 0;
+}
+
+int change_cluster(ph_cli_context_t* ctx, const char* cluster_dir, const unsigned int jobs)
+{
+    free(ctx->cluster_dir);
+    ctx->cluster_dir = (cluster_dir != NULL && jobs > 0 ? strdup(cluster_dir) : NULL);
+    ctx->cluster_jobs = jobs;
+    return 0;
+}
+
+int quit_cluster(ph_cli_context_t* ctx)
+{
+    if (ctx->cluster_dir == NULL)
+        return -1;
+    return photorec_cluster_quit(ctx->cluster_dir);
+}
+
+int run_testdisk_cluster_worker(ph_cli_context_t* ctx, const char* cluster_dir,
+                                const char* node)
+{
+    struct ph_param* params = &ctx->params;
+    const struct ph_options* options = &ctx->options;
+    int res;
+    need_to_stop = 0;
+    /*@ assert valid_read_string(ctx->params.recup_dir); */
+    params_reset(params, options);
+#ifndef DISABLED_FOR_FRAMAC
+    log_partition(params->disk, params->partition);
+#endif
+    res = photorec_cluster_worker(params, options, cluster_dir,
+                                  (node != NULL ? node : "worker"));
+    phits_reset();
+    free_header_check();
+    file_rename_deferred();
+    ppack_close();
+    return res;
+}
+
+void change_profile(ph_cli_context_t* ctx, const int profile)
+{
+    (void)ctx;
+    file_profile = (profile > 0 ? 1 : 0);
+}
+
+void change_stream(ph_cli_context_t* ctx, const pstream_t* stream, const int write_files)
+{
+    (void)ctx;
+    pstream_set(stream, write_files);
+}
+
+void change_index(ph_cli_context_t* ctx, const char* filename)
+{
+    (void)ctx;
+    pindex_set(filename);
+}
+
+void change_manifest(ph_cli_context_t* ctx, const char* filename)
+{
+    (void)ctx;
+    pmanifest_set(filename);
+}
+
+void change_priority(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    ppriority_set(enable);
+}
+
+void change_speculate(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    pspec_set(enable);
+}
+
+void change_triage(ph_cli_context_t* ctx, const unsigned int seconds, const uint64_t bytes, const int recover)
+{
+    (void)ctx;
+    ptriage_set(seconds, bytes, recover);
+}
+
+void change_inventory(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    pinventory_set(enable);
+}
+
+void change_prune(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    pprune_set(enable);
+}
+
+void change_async_check(ph_cli_context_t* ctx, const unsigned int workers)
+{
+    (void)ctx;
+    pcheck_set(workers);
+}
+
+void change_adaptive_check(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    pdepth_set(enable);
+}
+
+int change_filter(ph_cli_context_t* ctx, const char* filter)
+{
+    (void)ctx;
+    return pfilter_set(filter);
+}
+
+void change_qos(ph_cli_context_t* ctx, const unsigned int target_ms)
+{
+    (void)ctx;
+    diskqos_set_target(target_ms * 1000);
+}
+
+void change_placement(ph_cli_context_t* ctx, const char* cpus, const int numa, const int hugepages)
+{
+    (void)ctx;
+    paffinity_set_cpus(cpus);
+    paffinity_set_numa(numa > 0 ? 1 : 0);
+    set_io_hugepages(hugepages > 0 ? 1 : 0);
+}
+
+void compact_search_space_ctx(ph_cli_context_t* ctx)
+{
+    if (ctx->params.disk == NULL || ctx->params.blocksize == 0)
+        return;
+    compact_search_space(&ctx->list_search_space, ctx->params.blocksize,
+                         ctx->params.disk->sector_size);
+}
+
+void change_cache_size(ph_cli_context_t* ctx, const uint64_t cache_size)
+{
+    for (list_disk_t* element_disk = ctx->list_disk;
+         element_disk != NULL;
+         element_disk = element_disk->next)
+    {
+        diskcache_set_size(element_disk->disk, cache_size);
+    }
+}
+
+void change_shared_cache(ph_cli_context_t* ctx, const uint64_t size)
+{
+    (void)ctx;
+    diskshare_set_size(size);
+}
+
+unsigned int get_io_stats(ph_cli_context_t* ctx, disk_stats_summary_t* stats,
+                          const unsigned int max)
+{
+    (void)ctx;
+    return disk_stats_get(stats, max);
+}
+
+int save_io_stats(ph_cli_context_t* ctx, const char* filename)
+{
+    (void)ctx;
+    return disk_stats_save_prometheus(filename);
+}
+
 void change_geometry(ph_cli_context_t* ctx, const unsigned int cylinders,
                      const unsigned int heads_per_cylinder,
                      const unsigned int sectors_per_head,
@@ -446,7 +671,10 @@ ph_cli_context_t* init_testdisk(int argc, char* argv[], const int log_mode, cons
             .list = TD_LIST_HEAD_INIT(ctx->list_search_space.list)
         },
         .log_opened = 0,
-        .log_errno = 0
+        .log_errno = 0,
+        .workers = 1,
+        .cluster_dir = NULL,
+        .cluster_jobs = 0
     };
 
     // TODO
@@ -478,6 +706,7 @@ void finish_testdisk(ph_cli_context_t* ctx)
 #endif
     free(ctx->params.recup_dir);
     free(ctx->params.cmd_device);
+    free(ctx->cluster_dir);
     free(ctx);
 }
 
@@ -565,11 +794,42 @@ int run_testdisk(ph_cli_context_t* ctx)
         case STATUS_EXT2_ON_BF:
         case STATUS_EXT2_OFF_BF:
 #ifndef DISABLED_FOR_FRAMAC
-            ind_stop = photorec_bf(params, options, list_search_space);
+            ind_stop = photorec_bf(params, options, list_search_space,
+                                   (pstream_enabled() > 0 ? 1 : ctx->workers));
 #endif
             break;
         default:
-            ind_stop = photorec_aux(params, options, list_search_space);
+            /* The callbacks must run in this process, the scan index
+             * is built by a single scan */
+            if (ctx->cluster_dir != NULL && pstream_enabled() == 0 && pindex_enabled() == 0 &&
+                pinventory_enabled() == 0)
+            {
+                ind_stop = photorec_cluster(params, options, list_search_space,
+                                            ctx->cluster_dir, ctx->cluster_jobs,
+                                            ctx->workers);
+                break;
+            }
+            /* The headers are listed by this process */
+            if (pinventory_enabled() > 0)
+            {
+                ind_stop = photorec_inventory(params, options, list_search_space);
+                break;
+            }
+            /* The windows are sampled by this process */
+            if (ptriage_enabled() > 0 && disk_is_pipe(params->disk) == 0)
+            {
+                ind_stop = photorec_triage(params, options, list_search_space);
+                break;
+            }
+            /* The regions are carved one after the other by this process */
+            if (ppriority_enabled() > 0)
+            {
+                ind_stop = photorec_priority(params, options, list_search_space);
+                break;
+            }
+            ind_stop = photorec_shard(params, options, list_search_space,
+                                      (pstream_enabled() > 0 || pindex_enabled() > 0 ?
+                                       1 : ctx->workers));
             break;
         }
         session_save(list_search_space, params, options);
@@ -606,7 +866,9 @@ int run_testdisk(ph_cli_context_t* ctx)
         case PSTATUS_OK:
             status_inc(params, options);
             if (params->status == STATUS_QUIT)
-                unlink("photorec.ses");
+                session_remove();
+            else if (params->status != STATUS_FIND_OFFSET && params->blocksize > 0)
+                compact_search_space(list_search_space, params->blocksize, params->disk->sector_size);
             break;
         }
 #ifndef DISABLED_FOR_FRAMAC
@@ -617,7 +879,6 @@ int run_testdisk(ph_cli_context_t* ctx)
                      (unsigned)((current_time-params->real_start_time)/60%60),
                      (unsigned)((current_time-params->real_start_time)%60));
         }
-        update_stats(params->file_stats, list_search_space);
         if (params->pass > 0)
         {
             log_info("Pass %u +%u file%s\n", params->pass, params->file_nbr-old_file_nbr,
@@ -661,7 +922,10 @@ int run_testdisk(ph_cli_context_t* ctx)
         log_critical("Cannot write file, no space left.\n");
         break;
     }
+    phits_reset();
     free_header_check();
+    file_rename_deferred();
+    ppack_close();
 #ifdef ENABLE_DFXML
   xml_shutdown();
   xml_close();
@@ -669,6 +933,199 @@ int run_testdisk(ph_cli_context_t* ctx)
     return 0;
 }
 
+/* ============================================================================
+ * BATCH OPERATIONS - Implementation
+ * ============================================================================ */
+
+/* Carve job->device with the settings of ctx, fills the job results */
+static void batch_job_run(ph_cli_context_t* ctx, ph_batch_job_t* job,
+                          const ph_batch_setup_t setup, void* opaque)
+{
+    const time_t start_time = time(NULL);
+    job->result = -1;
+    if (change_disk(ctx, job->device) == NULL &&
+        (add_image(ctx, job->device) == NULL || change_disk(ctx, job->device) == NULL))
+    {
+        log_error("Batch: cannot open %s\n", job->device);
+        return;
+    }
+    change_recup_dir(ctx, job->recup_dir);
+    change_workers(ctx, job->workers);
+    if (setup != NULL)
+    {
+        if (setup(ctx, job, opaque) != 0)
+            return;
+    }
+    else
+    {
+        /* Whole disk */
+        change_arch(ctx, (char*)"none");
+        if (ctx->list_part == NULL ||
+            change_part(ctx, ctx->list_part->part->order, 0, 0) == NULL)
+            return;
+    }
+    if (ctx->params.partition == NULL)
+        return;
+    job->bytes = ctx->params.partition->part_size;
+    run_testdisk(ctx);
+    job->file_nbr = ctx->params.file_nbr;
+    job->elapsed = time(NULL) - start_time;
+    job->result = 0;
+}
+
+#ifdef HAVE_FORK
+typedef struct
+{
+    pid_t pid;
+    int fd;
+    unsigned int job;
+} batch_slot_t;
+
+/* Wait for one running job and read its results */
+static void batch_reap(batch_slot_t* slots, unsigned int* nbr_slots, ph_batch_job_t* jobs)
+{
+    int status;
+    pid_t pid;
+    unsigned int i;
+    while ((pid = wait(&status)) < 0 && errno == EINTR);
+    if (pid < 0)
+    {
+        /* No child left, should not happen */
+        for (i = 0; i < *nbr_slots; i++)
+            close(slots[i].fd);
+        *nbr_slots = 0;
+        return;
+    }
+    for (i = 0; i < *nbr_slots && slots[i].pid != pid; i++);
+    if (i == *nbr_slots)
+        return;
+    {
+        ph_batch_job_t* job = &jobs[slots[i].job];
+        ph_batch_job_t res;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+            read(slots[i].fd, &res, sizeof(res)) != (ssize_t)sizeof(res))
+        {
+            log_error("Batch: job %s failed\n", job->device);
+            job->result = -1;
+        }
+        else
+        {
+            job->result = res.result;
+            job->file_nbr = res.file_nbr;
+            job->bytes = res.bytes;
+            job->elapsed = res.elapsed;
+        }
+    }
+    close(slots[i].fd);
+    slots[i] = slots[--(*nbr_slots)];
+}
+#endif
+
+int run_testdisk_batch(ph_cli_context_t* ctx, ph_batch_job_t* jobs,
+                       const unsigned int nbr_jobs, const unsigned int max_jobs,
+                       const ph_batch_setup_t setup, void* opaque,
+                       ph_batch_stats_t* stats)
+{
+    const time_t start_time = time(NULL);
+    unsigned int next;
+    for (next = 0; next < nbr_jobs; next++)
+    {
+        jobs[next].result = -1;
+        jobs[next].file_nbr = 0;
+        jobs[next].bytes = 0;
+        jobs[next].elapsed = 0;
+    }
+    need_to_stop = 0;
+#ifdef HAVE_FORK
+    if (max_jobs > 1)
+    {
+        /* Each job runs in its own process, ctx is copied and the file
+         * format tables are shared until written */
+        batch_slot_t* slots = (batch_slot_t*)MALLOC(max_jobs * sizeof(batch_slot_t));
+        unsigned int nbr_slots = 0;
+        log_flush();
+        fflush(NULL);
+        next = 0;
+        while (next < nbr_jobs || nbr_slots > 0)
+        {
+            int fds[2];
+            if (next >= nbr_jobs || nbr_slots >= max_jobs || need_to_stop != 0)
+            {
+                if (nbr_slots == 0)
+                    break;
+                batch_reap(slots, &nbr_slots, jobs);
+                continue;
+            }
+            if (pipe(fds) < 0)
+            {
+                log_error("Batch: pipe() failed: %s\n", strerror(errno));
+                next++;
+                continue;
+            }
+            slots[nbr_slots].pid = fork();
+            if (slots[nbr_slots].pid < 0)
+            {
+                log_error("Batch: fork() failed: %s\n", strerror(errno));
+                close(fds[0]);
+                close(fds[1]);
+                next++;
+                continue;
+            }
+            if (slots[nbr_slots].pid == 0)
+            {
+                ph_batch_job_t* job = &jobs[next];
+                int res;
+                close(fds[0]);
+                batch_job_run(ctx, job, setup, opaque);
+                res = (write(fds[1], job, sizeof(*job)) == (ssize_t)sizeof(*job) ? 0 : 1);
+                close(fds[1]);
+                log_flush();
+                fflush(NULL);
+                _exit(res);
+            }
+            close(fds[1]);
+            slots[nbr_slots].fd = fds[0];
+            slots[nbr_slots].job = next;
+            nbr_slots++;
+            next++;
+        }
+        free(slots);
+    }
+    else
+#endif
+    {
+        for (next = 0; next < nbr_jobs && need_to_stop == 0; next++)
+        {
+            /* The search space of the previous job is already freed */
+            ctx->params.partition = NULL;
+            batch_job_run(ctx, &jobs[next], setup, opaque);
+        }
+    }
+    if (stats != NULL)
+    {
+        stats->jobs_done = 0;
+        stats->jobs_failed = 0;
+        stats->file_nbr = 0;
+        stats->bytes = 0;
+        for (next = 0; next < nbr_jobs; next++)
+        {
+            if (jobs[next].result == 0)
+            {
+                stats->jobs_done++;
+                stats->file_nbr += jobs[next].file_nbr;
+                stats->bytes += jobs[next].bytes;
+            }
+            else
+                stats->jobs_failed++;
+        }
+        stats->elapsed = time(NULL) - start_time;
+    }
+    log_info("Batch: %u jobs, %u files recovered in %us\n", nbr_jobs,
+             (stats != NULL ? stats->file_nbr : 0),
+             (unsigned)(time(NULL) - start_time));
+    return 0;
+}
+
 /* ============================================================================
  * PARTITION STRUCTURE OPERATIONS - Implementation
  * ============================================================================ */
@@ -887,6 +1344,30 @@ int search_partitions(ph_cli_context_t* ctx, int fast_mode, int dump_ind)
     return -1;
 }
 
+void change_analyse_cache(ph_cli_context_t* ctx, const int enable)
+{
+    (void)ctx;
+    analyse_cache_set_enable(enable);
+}
+
+uint64_t get_search_locations(ph_cli_context_t* ctx)
+{
+    (void)ctx;
+    return search_part_locations();
+}
+
+int get_search_progress(ph_cli_context_t* ctx, uint64_t* location, uint64_t* location_max)
+{
+    (void)ctx;
+    return search_part_progress(location, location_max);
+}
+
+void stop_search_partitions(ph_cli_context_t* ctx)
+{
+    (void)ctx;
+    search_part_stop();
+}
+
 int validate_disk_geometry(ph_cli_context_t* ctx)
 {
     if (ctx->params.disk == NULL || ctx->list_part == NULL)
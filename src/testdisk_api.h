@@ -372,6 +372,7 @@ struct testdisk_param
     unsigned int file_nbr; /**< Number of files recovered */
     file_stat_t* file_stats; /**< Recovery statistics by type */
     uint64_t offset; /**< Current recovery offset */
+    uint64_t offset_end; /**< Stop once past this offset and no file is open */
 };
 
 /**
@@ -404,8 +405,37 @@ struct file_stat_struct
     unsigned int not_recovered; /**< Count of failed recoveries */
     unsigned int recovered; /**< Count of successful recoveries */
     const file_hint_t* file_hint; /**< Associated file type */
+    uint64_t header_calls; /**< header_check calls, see change_profile() */
+    uint64_t header_hits; /**< header_check calls that found a header */
+    uint64_t false_positives; /**< Headers whose file was rejected by file_check */
+    uint64_t header_ns; /**< Time spent in header_check (ns) */
+    uint64_t data_ns; /**< Time spent in data_check (ns) */
+    uint64_t file_ns; /**< Time spent in file_check (ns) */
 };
 
+/**
+ * @brief Callbacks receiving the recovered files while they are carved
+ *
+ * on_file_start() is called once the header of a file has been found.
+ * on_block() gets each block appended to the file; data points to the
+ * read buffer and is only valid during the call. The file may later be
+ * truncated below the total length of the blocks.
+ * on_file_finished() gets the final file_size and the byte runs of the
+ * file in file_recovery->location, status is PFSTATUS_BAD when the file
+ * has been rejected.
+ * The brute force passes only call on_file_finished(). Any callback can
+ * be NULL.
+ */
+typedef struct
+{
+    void (*on_file_start)(void* opaque, const file_recovery_t* file_recovery);
+    void (*on_block)(void* opaque, const file_recovery_t* file_recovery,
+                     const unsigned char* data, unsigned int len);
+    void (*on_file_finished)(void* opaque, const file_recovery_t* file_recovery,
+                             pfstatus_t status);
+    void* opaque; /**< Passed to the callbacks */
+} testdisk_stream_t;
+
 /**
  * @brief Search space allocation block
  */
@@ -437,6 +467,7 @@ struct testdisk_cli_context
     alloc_data_t list_search_space; /**< Search space for recovery */
     int log_opened; /**< Log file opened */
     int log_errno; /**< Log file error number */
+    unsigned int workers; /**< Number of processes carving the disk */
 };
 
 /* ============================================================================
@@ -483,6 +514,59 @@ void finish_testdisk(testdisk_cli_context_t* ctx);
  */
 void abort_testdisk(testdisk_cli_context_t* ctx);
 
+/* ============================================================================
+ * BATCH FUNCTIONS - Several disks in one call
+ * ============================================================================ */
+
+/**
+ * @brief One disk or image to carve in a batch
+ */
+typedef struct
+{
+    const char* device; /**< Disk or image file, opened with add_image() if needed */
+    const char* recup_dir; /**< Recovery directory of this job */
+    unsigned int workers; /**< Scan workers of this job, see change_workers() */
+    int result; /**< Set by the batch: 0 on success, -1 if the job failed */
+    unsigned int file_nbr; /**< Set by the batch: number of recovered files */
+    uint64_t bytes; /**< Set by the batch: size of the carved partition */
+    time_t elapsed; /**< Set by the batch: duration of the job in seconds */
+} testdisk_batch_job_t;
+
+/**
+ * @brief Totals of a batch
+ */
+typedef struct
+{
+    unsigned int jobs_done; /**< Jobs with result 0 */
+    unsigned int jobs_failed; /**< Jobs with result -1 */
+    unsigned int file_nbr; /**< Files recovered by the successful jobs */
+    uint64_t bytes; /**< Bytes carved by the successful jobs */
+    time_t elapsed; /**< Duration of the whole batch in seconds */
+} testdisk_batch_stats_t;
+
+/**
+ * @brief Carve several disks or images
+ * @param ctx TestDisk context used as template for every job
+ * @param jobs Jobs to run, their results are filled in
+ * @param nbr_jobs Number of jobs
+ * @param max_jobs Maximum number of jobs running at the same time
+ * @param setup Called in the job before the recovery, NULL to carve the whole disk
+ * @param opaque Passed to setup
+ * @param stats Totals of the batch, can be NULL
+ * @return 0
+ *
+ * With max_jobs greater than 1, each job runs in its own process with a
+ * copy of ctx, so the processes in use are up to max_jobs * workers.
+ * setup() selects the partition table and the partition with change_arch()
+ * and change_part(), it returns non-zero to skip the job. abort_testdisk()
+ * stops launching new jobs, the running ones are finished.
+ */
+int run_testdisk_batch(testdisk_cli_context_t* ctx, testdisk_batch_job_t* jobs,
+                       unsigned int nbr_jobs, unsigned int max_jobs,
+                       int (*setup)(testdisk_cli_context_t* ctx,
+                                    const testdisk_batch_job_t* job, void* opaque),
+                       void* opaque, testdisk_batch_stats_t* stats);
+
 /* ============================================================================
  * CONFIGURATION FUNCTIONS - Disk and Partition Selection
  * ============================================================================ */
@@ -586,6 +670,325 @@ void change_status(testdisk_cli_context_t* ctx, testdisk_status_t status);
  */
 int change_blocksize(testdisk_cli_context_t* ctx, unsigned int blocksize);
 
+/**
+ * @brief Change the number of scan workers
+ * @param ctx TestDisk context
+ * @param workers Number of worker processes (0 or 1 for a single scan)
+ * @return 0 on success, non-zero on error
+ * 
+ * Splits the search space into contiguous shards carved in parallel.
+ * A file crossing a shard boundary is finished by the worker that
+ * found its header; files the next worker found inside it are removed.
+ */
+int change_workers(testdisk_cli_context_t* ctx, unsigned int workers);
+
+/**
+ * @brief Distribute the scan to the nodes sharing a directory
+ * @param ctx TestDisk context
+ * @param cluster_dir Directory shared by the coordinator and the workers, NULL to disable
+ * @param jobs Number of jobs the search space is split into
+ * @return 0 on success, non-zero on error
+ *
+ * run_testdisk() becomes the coordinator: each pass is split into jobs
+ * carved by the nodes running run_testdisk_cluster_worker() and by the
+ * local workers set by change_workers(). The recovery directory must be
+ * on a storage shared by all the nodes, the session is updated as the
+ * results of the jobs arrive and the recovered files of each pass are
+ * listed in cluster_dir/files.<plan id>.
+ */
+int change_cluster(testdisk_cli_context_t* ctx, const char* cluster_dir, unsigned int jobs);
+
+/**
+ * @brief Carve the jobs of a coordinator until quit_cluster() is called
+ * @param ctx TestDisk context, with the same disk, partition, file formats
+ *            and options as the coordinator
+ * @param cluster_dir Directory shared with the coordinator
+ * @param node Name of this node in the progress reports, NULL for "worker"
+ * @return 0 on success, -1 if distributed scans are not supported
+ *
+ * change_recup_dir() must point to the recovery directory of the
+ * coordinator, as seen from this node. abort_testdisk() stops the worker,
+ * its current job is dispatched again.
+ */
+int run_testdisk_cluster_worker(testdisk_cli_context_t* ctx, const char* cluster_dir,
+                                const char* node);
+
+/**
+ * @brief Tell the workers of change_cluster() to exit
+ * @param ctx TestDisk context
+ * @return 0 on success, -1 on error
+ */
+int quit_cluster(testdisk_cli_context_t* ctx);
+
+/**
+ * @brief Enable the per file format profiling counters
+ * @param ctx TestDisk context
+ * @param profile 1 to count and time the file format checks, 0 to stop
+ * 
+ * The counters are kept in ctx->params.file_stats and written to the
+ * log with the recovery statistics.
+ */
+void change_profile(testdisk_cli_context_t* ctx, int profile);
+
+/**
+ * @brief Hand the recovered files to callbacks
+ * @param ctx TestDisk context
+ * @param stream Callbacks, NULL to stop streaming
+ * @param write_files 0 to keep no file in the recovery directory
+ * 
+ * Streaming forces a single worker. Without files, the file checks
+ * still read the data back from an anonymous temporary file and the
+ * files are neither dated nor renamed.
+ */
+void change_stream(testdisk_cli_context_t* ctx, const testdisk_stream_t* stream,
+                   int write_files);
+
+/**
+ * @brief Create or use a scan index
+ * @param ctx TestDisk context
+ * @param filename Index file, NULL to stop using it
+ * 
+ * If the file doesn't match the partition, the blocksize or the enabled
+ * file formats, the main scan records the candidate blocks in it.
+ * Otherwise the scan only reads the candidate blocks and the blocks of
+ * the recovered files. The scan index forces a single worker.
+ */
+void change_index(testdisk_cli_context_t* ctx, const char* filename);
+
+/**
+ * @brief Don't search again the files recovered by a previous run
+ * @param ctx TestDisk context
+ * @param filename report.xml or report.jsonl of the previous run, NULL to stop using it
+ *
+ * The byte runs of the files listed are removed from the search space
+ * when it is initialized: a run with more file formats enabled only
+ * writes the new files and doesn't read the blocks already recovered.
+ * A manifest written for an image of another size is ignored.
+ */
+void change_manifest(testdisk_cli_context_t* ctx, const char* filename);
+
+/**
+ * @brief Search first the areas with the most file signatures
+ * @param ctx TestDisk context
+ * @param enable 1 to sample the search space and carve it by priority
+ * 
+ * The search space is split into up to 256 regions, the regions with
+ * the highest density of file signatures in a few sampled blocks are
+ * carved first, then the others in disk order. The whole search space
+ * is still carved. The priority scan uses a single worker.
+ */
+void change_priority(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Continue with a header found inside a file instead of going back
+ * @param ctx TestDisk context
+ * @param enable 1 to check the blocks of the file in progress a second time
+ *
+ * When a header is ignored because a file is in progress, the following
+ * blocks are also checked as the start of a new file, with their own
+ * data check and a temporary copy of the data. If the file in progress
+ * is truncated, the new file is continued from where the scan is instead
+ * of going back to its header and reading its blocks again. Up to 64 MiB
+ * are checked a second time, the scan goes back as usual past this.
+ */
+void change_speculate(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Estimate the file formats and the data volume in a time budget
+ * @param ctx TestDisk context
+ * @param seconds Time budget, 0 for none
+ * @param bytes Read budget, 0 for none
+ * @param recover 1 to carve the files whose header was found
+ *
+ * Instead of carving the whole search space, 1 MiB windows spread over
+ * up to 256 strata are read until a budget is spent. The number of files
+ * of each format and the volume of wiped, low, mid and high entropy data
+ * are extrapolated, the report is logged and written to
+ * recup_dir.N/triage.txt. seconds==0 and bytes==0 disable the triage.
+ */
+void change_triage(testdisk_cli_context_t* ctx, unsigned int seconds, uint64_t bytes, int recover);
+
+/**
+ * @brief List the file headers without carving the files
+ * @param ctx TestDisk context
+ * @param enable 1 to only run the header checks, 0 to carve the files
+ *
+ * The search space is read sequentially and every block only goes
+ * through the header checks. Each candidate is written to
+ * recup_dir.N/inventory.txt with its sector, its extension and, when the
+ * header gives them, its size and time, followed by the number of
+ * candidates and the known size of each file format.
+ */
+void change_inventory(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Enable the adaptive pruning of the file formats
+ * @param ctx TestDisk context
+ * @param enable 1 for the adaptive mode, 0 for the strict mode (default)
+ *
+ * In adaptive mode, the profiling counters are enabled. A file format
+ * without any header found, whose header_check takes more than 5% of the
+ * scan time, is only checked on the blocks aligned
+ * to 8 blocks. It's checked on every block again once a header is found.
+ * The strict mode never prunes a file format.
+ */
+void change_prune(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Check the large files in other processes while the scan goes on
+ * @param ctx TestDisk context
+ * @param workers Number of checks at the same time, 0 to check them in the scan (default)
+ *
+ * The file_check of a file of 256 KiB or more, whose end has been found
+ * by its data_check, runs in a forked process and its blocks stay
+ * claimed meanwhile. The files are finished in the order they have been
+ * found: a truncated file gives its last blocks back and the scan goes
+ * back to them, a rejected file gives all its blocks back for the next
+ * passes. Not used with the hashes, the stream callbacks or lowmem.
+ */
+void change_async_check(testdisk_cli_context_t* ctx, const unsigned int workers);
+
+/**
+ * @brief Adapt the depth of the file checks to the balance between CPU and disk
+ * @param ctx TestDisk context
+ * @param enable 1 for the adaptive depth, 0 to keep the checks chosen (default)
+ *
+ * Every 2 seconds of the scan, the time waited for the disk is measured.
+ * While it's at least 30% of the time, the JPEG are fully decoded and the
+ * gzip and zip data are inflated to check their CRC. Below 10%, the JPEG
+ * are decoded at 1/8 scale and nothing is inflated. The depth used for
+ * each file is logged. It overrides the deep and scaled JPEG checks.
+ */
+void change_adaptive_check(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Only write the files matching a filter
+ * @param ctx TestDisk context
+ * @param filter Comma separated terms, NULL to remove the filters
+ * @return 0 on success, -1 if the filter is invalid
+ *
+ * The terms are ext=jpg, size with <, <=, >, >=, = and a k, M or G
+ * suffix, date with the same operators and a YYYY-MM-DD day, and known.
+ * All the terms must match, except the ext terms where any of them is
+ * enough. They are checked when the header of a file is found: a file
+ * rejected is still carved so its blocks are not searched again, but it
+ * is not written. A file whose header gives no size or date is kept,
+ * unless known is set.
+ */
+int change_filter(testdisk_cli_context_t* ctx, const char* filter);
+
+/**
+ * @brief Throttle the reads to keep a disk in use responsive
+ * @param ctx TestDisk context
+ * @param target_ms Latency target in milliseconds, 0 to read at full speed (default)
+ *
+ * The disks opened by init_list_disk() or add_image() while a target is
+ * set are read in chunks whose size and spacing follow the measured
+ * latency: the scan backs off as soon as the foreground I/O slows the
+ * disk down, and reads at full speed when it is idle. Once a disk is
+ * throttled, the target can be changed during the scan, 0 stops the
+ * throttling. The cached data isn't throttled.
+ */
+void change_qos(testdisk_cli_context_t* ctx, unsigned int target_ms);
+
+/**
+ * @brief Place the scan on the cores and NUMA nodes of the host
+ * @param ctx TestDisk context
+ * @param cpus Cores of the workers like "0-7,16-23", NULL to not pin them
+ * @param numa 1 to keep the read buffers and threads near the controllers
+ * @param hugepages 1 to back the large read buffers with huge pages (default)
+ *
+ * The workers set by change_workers() are each pinned to one core of
+ * cpus, in turn. With numa, the nodes of the controllers of the disk
+ * and of the recovery directory are read from sysfs: the read buffers
+ * are bound to the node of the disk, the reader threads run on its
+ * cores, the workers too if cpus is NULL, and the session and report
+ * writer threads run on the cores of the node of the recovery
+ * directory. Linux only, ignored elsewhere.
+ */
+void change_placement(testdisk_cli_context_t* ctx, const char* cpus, int numa, int hugepages);
+
+/**
+ * @brief Compact the search space
+ * @param ctx TestDisk context
+ *
+ * Merges the adjacent extents and drops the ones smaller than a block,
+ * the fragmentation is logged. It's also done between the passes.
+ * Nothing is done while the block size is unknown.
+ */
+void compact_search_space_ctx(testdisk_cli_context_t* ctx);
+
+/**
+ * @brief Change the memory budget of the disk block cache
+ * @param ctx TestDisk context
+ * @param cache_size Cache size in bytes
+ * 
+ * Applies to the disks already known by the context. Memory-mapped
+ * image files are not cached.
+ */
+void change_cache_size(testdisk_cli_context_t* ctx, uint64_t cache_size);
+
+/**
+ * @brief Share the data read with the other processes reading the same source
+ * @param ctx TestDisk context
+ * @param size Size of the shared cache in bytes, 0 to disable it (default)
+ *
+ * The disks opened by init_list_disk() or add_image() afterwards look
+ * up their blocks in a shared memory segment named after the device or
+ * the image, and add the blocks they read to it. The size is chosen by
+ * the first process using the source. The reads done with O_DIRECT
+ * don't go through the cache and aren't shared.
+ */
+void change_shared_cache(testdisk_cli_context_t* ctx, uint64_t size);
+
+/**
+ * @brief I/O counters of a disk layer
+ *
+ * Each disk access layer (file, ewf, cache, io_redir) counts its reads.
+ * The latencies are in nanoseconds, the percentiles are the upper bounds
+ * of the histogram buckets, within 12.5%.
+ */
+typedef struct
+{
+    const char* layer;      /**< "file", "ewf", "cache" or "io_redir" */
+    const char* device;
+    uint64_t nbr_reads;
+    uint64_t bytes;
+    uint64_t nbr_errors;    /**< Reads returning less than requested */
+    uint64_t nbr_retries;   /**< Reads split sector by sector after an error */
+    uint64_t nbr_hits;      /**< Cache layer only, in blocks */
+    uint64_t nbr_misses;
+    uint64_t latency_total;
+    uint64_t latency_p50;
+    uint64_t latency_p90;
+    uint64_t latency_p99;
+    uint64_t latency_max;
+} disk_stats_summary_t;
+
+/**
+ * @brief Get the I/O counters of the open disk layers
+ * @param ctx TestDisk context
+ * @param stats Array of max summaries to fill
+ * @param max Size of the array
+ * @return Number of layers, may be greater than max
+ *
+ * The layer and device strings are valid until the disk is closed.
+ * With several workers, only the reads of the calling process are
+ * counted.
+ */
+unsigned int get_io_stats(testdisk_cli_context_t* ctx, disk_stats_summary_t* stats,
+                          unsigned int max);
+
+/**
+ * @brief Write the I/O counters in the Prometheus text format
+ * @param ctx TestDisk context
+ * @param filename Output file, replaced atomically
+ * @return 0 on success, -1 on error
+ *
+ * The file can be exported by the textfile collector of node_exporter.
+ */
+int save_io_stats(testdisk_cli_context_t* ctx, const char* filename);
+
 /* ============================================================================
  * CONFIGURATION FUNCTIONS - File Type Selection
  * ============================================================================ */
@@ -774,6 +1177,41 @@ void write_MBR_code(testdisk_cli_context_t* ctx);
  */
 int search_partitions(testdisk_cli_context_t* ctx, int fast_mode, int dump_ind);
 
+/**
+ * @brief Enable or disable the cache of the partition search results
+ * @param ctx TestDisk context
+ * @param enable 0 to probe every location again and not save the results
+ *
+ * Enabled by default: a new search of the same disk replays the results
+ * of the regions already probed.
+ */
+void change_analyse_cache(testdisk_cli_context_t* ctx, int enable);
+
+/**
+ * @brief Get the number of locations examined by the last partition search
+ * @param ctx TestDisk context
+ * @return Number of locations
+ */
+uint64_t get_search_locations(testdisk_cli_context_t* ctx);
+
+/**
+ * @brief Get the progress of the partition search running in another thread
+ * @param ctx TestDisk context
+ * @param location Set to the offset being probed
+ * @param location_max Set to the offset where the search ends
+ * @return 1 while search_partitions() is running, 0 otherwise
+ */
+int get_search_progress(testdisk_cli_context_t* ctx, uint64_t* location, uint64_t* location_max);
+
+/**
+ * @brief Stop the running partition search
+ * @param ctx TestDisk context
+ *
+ * Can be called from another thread. search_partitions() stops at the
+ * next location and returns the partitions already found.
+ */
+void stop_search_partitions(testdisk_cli_context_t* ctx);
+
 /**
  * @brief Validate disk geometry settings
  * @param ctx TestDisk context
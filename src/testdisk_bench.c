@@ -0,0 +1,676 @@
+/*
+
+    File: testdisk_bench.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Partition search benchmark built on top of libtestdisk.
+ * A sparse disk image is filled with the boot sectors and superblocks of
+ * partitions of mixed types, some of them with a damaged primary boot
+ * sector and a valid backup, behind an empty MBR. The partitions are
+ * searched through the library API and the partitions found are compared
+ * with the ones written. Results are printed as key=value lines, one per
+ * search mode. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "testdisk_api.h"
+
+#define BENCH_SECTOR_SIZE	512
+#define BENCH_HEADS		255
+#define BENCH_SECTORS		63
+#define BENCH_CYLINDER_SIZE	((uint64_t)BENCH_HEADS * BENCH_SECTORS * BENCH_SECTOR_SIZE)
+#define BENCH_MIB		((uint64_t)1024 * 1024)
+#define BENCH_MAX_PARTS		256
+#define BENCH_MAX_LAYERS	8
+
+typedef enum
+{
+  BENCH_FAT32 = 0,
+  BENCH_FAT32_BACKUP,
+  BENCH_NTFS,
+  BENCH_NTFS_BACKUP,
+  BENCH_EXT4,
+  BENCH_EXT4_BACKUP,
+  BENCH_XFS,
+  BENCH_BTRFS,
+  BENCH_LVM2,
+  BENCH_MD,
+  BENCH_NBR_KINDS
+} bench_kind_t;
+
+/* -bak: the primary boot sector or superblock is overwritten by random
+ * data, only the backup is valid */
+static const char *kind_names[BENCH_NBR_KINDS]=
+{
+  "fat32", "fat32-bak", "ntfs", "ntfs-bak", "ext4", "ext4-bak",
+  "xfs", "btrfs", "lvm2", "md"
+};
+
+typedef struct
+{
+  bench_kind_t kind;
+  uint64_t offset;
+  uint64_t size;
+  unsigned int found;
+  unsigned int exact;
+} bench_part_t;
+
+typedef struct
+{
+  unsigned int placed;
+  unsigned int found;
+  unsigned int exact;
+} bench_recall_t;
+
+static bench_part_t parts[BENCH_MAX_PARTS];
+static unsigned int nbr_parts=0;
+
+static void display_help(void)
+{
+  printf("\nUsage: testdisk_bench [options]\n"\
+      "\n" \
+      "  -d <dir>        work directory (default: testdisk_bench.d)\n" \
+      "  -s <MiB>        size of the sparse disk image (default: 8192)\n" \
+      "  -n <parts>      maximum number of partitions (default: 24)\n" \
+      "  -m <mode,...>   search modes, 0 quick, 1 deeper, 2 deepest (default: 0,1)\n" \
+      "  -l <file>       write a debug log of the searches\n" \
+      "  -v              print each partition written and if it has been found\n" \
+      "  -k              keep the disk image\n" \
+      "\n" \
+      "Without partition table hints, the quick search is expected to miss\n" \
+      "the partitions whose primary boot sector is damaged, the deeper search\n" \
+      "to find them using their backup.\n");
+}
+
+static double bench_time(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* xorshift64, the layout must be the same for every run */
+static uint64_t bench_random(uint64_t *state)
+{
+  uint64_t x=*state;
+  x^=x << 13;
+  x^=x >> 7;
+  x^=x << 17;
+  *state=x;
+  return x;
+}
+
+static void fill_random(unsigned char *buffer, const unsigned int size, uint64_t *state)
+{
+  unsigned int i;
+  for(i=0; i + 8 <= size; i+=8)
+  {
+    const uint64_t r=bench_random(state);
+    memcpy(&buffer[i], &r, 8);
+  }
+}
+
+static void put_le16(unsigned char *p, const unsigned int v)
+{
+  p[0]=v & 0xff;
+  p[1]=(v >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char *p, const uint32_t v)
+{
+  put_le16(p, v & 0xffff);
+  put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(unsigned char *p, const uint64_t v)
+{
+  put_le32(p, v & 0xffffffff);
+  put_le32(p + 4, v >> 32);
+}
+
+static void put_be16(unsigned char *p, const unsigned int v)
+{
+  p[0]=(v >> 8) & 0xff;
+  p[1]=v & 0xff;
+}
+
+static void put_be32(unsigned char *p, const uint32_t v)
+{
+  put_be16(p, v >> 16);
+  put_be16(p + 2, v & 0xffff);
+}
+
+static void put_be64(unsigned char *p, const uint64_t v)
+{
+  put_be32(p, v >> 32);
+  put_be32(p + 4, v & 0xffffffff);
+}
+
+static int image_pwrite(FILE *handle, const uint64_t offset, const unsigned char *buffer, const unsigned int size)
+{
+#ifdef HAVE_FSEEKO
+  if(fseeko(handle, offset, SEEK_SET) < 0)
+#else
+  if(fseek(handle, offset, SEEK_SET) < 0)
+#endif
+    return -1;
+  return (fwrite(buffer, size, 1, handle)==1 ? 0 : -1);
+}
+
+static void fat32_boot_sector(unsigned char *b, const bench_part_t *part)
+{
+  const uint32_t total_sect=part->size / BENCH_SECTOR_SIZE;
+  const unsigned int spc=(part->size >= 512 * BENCH_MIB ? 8 : 1);
+  const uint32_t fat_length=((uint64_t)total_sect / spc + 2) * 4 / BENCH_SECTOR_SIZE + 1;
+  memset(b, 0, BENCH_SECTOR_SIZE);
+  b[0]=0xeb; b[1]=0x58; b[2]=0x90;
+  memcpy(&b[3], "MSWIN4.1", 8);
+  put_le16(&b[0x0b], BENCH_SECTOR_SIZE);
+  b[0x0d]=spc;
+  put_le16(&b[0x0e], 32);		/* reserved sectors */
+  b[0x10]=2;				/* fats */
+  b[0x15]=0xf8;				/* media */
+  put_le16(&b[0x18], BENCH_SECTORS);
+  put_le16(&b[0x1a], BENCH_HEADS);
+  put_le32(&b[0x1c], part->offset / BENCH_SECTOR_SIZE);
+  put_le32(&b[0x20], total_sect);
+  put_le32(&b[0x24], fat_length);
+  put_le32(&b[0x2c], 2);		/* root cluster */
+  put_le16(&b[0x30], 1);		/* FS info sector */
+  put_le16(&b[0x32], 6);		/* backup boot sector */
+  b[0x40]=0x80;
+  b[0x42]=0x29;
+  memcpy(&b[0x47], "BENCH      ", 11);
+  memcpy(&b[0x52], "FAT32   ", 8);
+  b[0x1fe]=0x55; b[0x1ff]=0xaa;
+}
+
+static void ntfs_boot_sector(unsigned char *b, const bench_part_t *part)
+{
+  const uint64_t sectors_nbr=part->size / BENCH_SECTOR_SIZE - 1;
+  memset(b, 0, BENCH_SECTOR_SIZE);
+  b[0]=0xeb; b[1]=0x52; b[2]=0x90;
+  memcpy(&b[3], "NTFS    ", 8);
+  put_le16(&b[0x0b], BENCH_SECTOR_SIZE);
+  b[0x0d]=8;				/* sectors per cluster */
+  b[0x15]=0xf8;
+  put_le16(&b[0x18], BENCH_SECTORS);
+  put_le16(&b[0x1a], BENCH_HEADS);
+  put_le32(&b[0x1c], part->offset / BENCH_SECTOR_SIZE);
+  put_le64(&b[0x28], sectors_nbr);
+  put_le64(&b[0x30], 4);		/* MFT cluster */
+  put_le64(&b[0x38], sectors_nbr / 8 / 2);	/* MFT mirror cluster */
+  b[0x40]=0xf6;				/* 1 KiB MFT records */
+  b[0x44]=1;				/* 4 KiB index records */
+  b[0x1fe]=0x55; b[0x1ff]=0xaa;
+}
+
+/* log_block_size 0 for 1 KiB blocks, 2 for 4 KiB blocks */
+static void ext4_superblock(unsigned char *b, const bench_part_t *part, const unsigned int log_block_size, const unsigned int group_nr)
+{
+  const unsigned int blocksize=1024 << log_block_size;
+  const uint32_t blocks=part->size / blocksize;
+  const uint32_t blocks_per_group=8 * blocksize;
+  const uint32_t groups=(blocks + blocks_per_group - 1) / blocks_per_group;
+  memset(b, 0, 1024);
+  put_le32(&b[0], groups * 2048);	/* inodes */
+  put_le32(&b[4], blocks);
+  put_le32(&b[12], blocks / 2);		/* free blocks */
+  put_le32(&b[16], groups * 2048 - 11);	/* free inodes */
+  put_le32(&b[20], (log_block_size==0 ? 1 : 0));	/* first data block */
+  put_le32(&b[24], log_block_size);
+  put_le32(&b[28], log_block_size);
+  put_le32(&b[32], blocks_per_group);
+  put_le32(&b[36], blocks_per_group);
+  put_le32(&b[40], 2048);		/* inodes per group */
+  put_le16(&b[56], 0xef53);
+  put_le16(&b[58], 1);			/* clean */
+  put_le16(&b[60], 1);			/* errors=continue */
+  put_le32(&b[76], 1);			/* dynamic revision */
+  put_le32(&b[84], 11);			/* first inode */
+  put_le16(&b[88], 256);		/* inode size */
+  put_le16(&b[90], group_nr);
+  put_le32(&b[92], 0x3c);		/* has_journal... */
+  put_le32(&b[96], 0x2c2);		/* filetype, extents, 64bit, flex_bg */
+  put_le32(&b[100], 0x73);		/* sparse_super, large_file... */
+  put_le64(&b[104], part->offset);	/* uuid */
+  memcpy(&b[120], "bench", 5);		/* volume name */
+}
+
+static void xfs_superblock(unsigned char *b, const bench_part_t *part)
+{
+  const uint64_t dblocks=part->size / 4096;
+  memset(b, 0, BENCH_SECTOR_SIZE);
+  memcpy(&b[0], "XFSB", 4);
+  put_be32(&b[4], 4096);		/* block size */
+  put_be64(&b[8], dblocks);
+  put_be64(&b[32], part->offset);	/* uuid */
+  put_be32(&b[84], (dblocks + 3) / 4);	/* blocks per AG */
+  put_be32(&b[88], 4);			/* AG count */
+  put_be16(&b[100], 0xb4a4);		/* version 4 with features */
+  put_be16(&b[102], BENCH_SECTOR_SIZE);
+  put_be16(&b[104], 256);		/* inode size */
+  put_be16(&b[106], 16);		/* inodes per block */
+  memcpy(&b[108], "bench", 5);		/* volume name */
+  b[120]=12;				/* block log */
+  b[121]=9;				/* sector log */
+  b[122]=8;				/* inode log */
+  b[123]=4;				/* inodes per block log */
+}
+
+/* Written at 64 KiB */
+static void btrfs_superblock(unsigned char *b, const bench_part_t *part)
+{
+  memset(b, 0, 4096);
+  put_le64(&b[32], part->offset);	/* fsid */
+  put_le64(&b[48], 65536);		/* bytenr */
+  memcpy(&b[64], "_BHRfS_M", 8);
+  put_le64(&b[112], part->size);	/* total bytes */
+  put_le32(&b[144], 4096);		/* sector size */
+  put_le32(&b[148], 16384);		/* node size */
+  put_le64(&b[209], part->size);	/* dev_item.total_bytes */
+  put_le32(&b[233], 4096);		/* dev_item.sector_size */
+  memcpy(&b[299], "bench", 5);		/* label */
+}
+
+/* Label header in the second sector */
+static void lvm2_label(unsigned char *b, const bench_part_t *part)
+{
+  memset(b, 0, BENCH_SECTOR_SIZE);
+  memcpy(&b[0], "LABELONE", 8);
+  put_le64(&b[8], 1);			/* sector */
+  put_le32(&b[0x14], 32);		/* pv header offset */
+  memcpy(&b[0x18], "LVM2 001", 8);
+  memcpy(&b[32], "benchbenchbenchbenchbenchbenchbe", 32);	/* pv uuid */
+  put_le64(&b[64], part->size);		/* device size */
+}
+
+/* Version 1.2 superblock, written at 4 KiB */
+static void md_superblock(unsigned char *b, const bench_part_t *part)
+{
+  memset(b, 0, 4096);
+  put_le32(&b[0], 0xa92b4efc);
+  put_le32(&b[4], 1);			/* major version */
+  put_le64(&b[16], part->offset);	/* set uuid */
+  memcpy(&b[32], "bench:0", 7);		/* set name */
+  put_le32(&b[72], 1);			/* raid1 */
+  put_le64(&b[80], (part->size - 4096) / 512);	/* size in sectors */
+  put_le32(&b[92], 2);			/* raid disks */
+  put_le64(&b[128], 2048);		/* data offset */
+  put_le64(&b[136], (part->size - 1024 * 1024) / 512);	/* data size */
+  put_le64(&b[144], 8);			/* super offset */
+}
+
+static int part_write(FILE *handle, const bench_part_t *part, uint64_t *state)
+{
+  unsigned char b[4096];
+  unsigned char damaged[1024];
+  fill_random(damaged, sizeof(damaged), state);
+  switch(part->kind)
+  {
+    case BENCH_FAT32:
+    case BENCH_FAT32_BACKUP:
+      fat32_boot_sector(b, part);
+      if(image_pwrite(handle, part->offset + 6 * BENCH_SECTOR_SIZE, b, BENCH_SECTOR_SIZE) < 0)
+	return -1;
+      if(part->kind==BENCH_FAT32_BACKUP)
+	return image_pwrite(handle, part->offset, damaged, BENCH_SECTOR_SIZE);
+      return image_pwrite(handle, part->offset, b, BENCH_SECTOR_SIZE);
+    case BENCH_NTFS:
+    case BENCH_NTFS_BACKUP:
+      ntfs_boot_sector(b, part);
+      if(image_pwrite(handle, part->offset + part->size - BENCH_SECTOR_SIZE, b, BENCH_SECTOR_SIZE) < 0)
+	return -1;
+      if(part->kind==BENCH_NTFS_BACKUP)
+	return image_pwrite(handle, part->offset, damaged, BENCH_SECTOR_SIZE);
+      return image_pwrite(handle, part->offset, b, BENCH_SECTOR_SIZE);
+    case BENCH_EXT4:
+      ext4_superblock(b, part, 2, 0);
+      return image_pwrite(handle, part->offset + 1024, b, 1024);
+    case BENCH_EXT4_BACKUP:
+      /* 1 KiB blocks, the backup superblock of group 3 is the one TestDisk
+       * looks for */
+      ext4_superblock(b, part, 0, 1);
+      if(image_pwrite(handle, part->offset + 8193 * 1024, b, 1024) < 0)
+	return -1;
+      ext4_superblock(b, part, 0, 3);
+      if(image_pwrite(handle, part->offset + (3 * 8192 + 1) * 1024, b, 1024) < 0)
+	return -1;
+      return image_pwrite(handle, part->offset + 1024, damaged, 1024);
+    case BENCH_XFS:
+      xfs_superblock(b, part);
+      return image_pwrite(handle, part->offset, b, BENCH_SECTOR_SIZE);
+    case BENCH_BTRFS:
+      btrfs_superblock(b, part);
+      return image_pwrite(handle, part->offset + 65536, b, 4096);
+    case BENCH_LVM2:
+      lvm2_label(b, part);
+      return image_pwrite(handle, part->offset + BENCH_SECTOR_SIZE, b, BENCH_SECTOR_SIZE);
+    case BENCH_MD:
+      md_superblock(b, part);
+      return image_pwrite(handle, part->offset + 4096, b, 4096);
+    case BENCH_NBR_KINDS:
+      break;
+  }
+  return -1;
+}
+
+/* The partitions start on 1 MiB boundaries like the ones created since
+ * Windows Vista, or on cylinder boundaries like the older ones. Their sizes
+ * are multiple of the alignment unit so they are reported unchanged by the
+ * search. */
+static int image_create(const char *image, const uint64_t disk_size, const unsigned int max_parts)
+{
+  unsigned char mbr[BENCH_SECTOR_SIZE];
+  uint64_t state=0x9e3779b97f4a7c15ULL;
+  uint64_t offset=BENCH_MIB;
+  FILE *handle;
+  handle=fopen(image, "wb");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't create %s\n", image);
+    return -1;
+  }
+  memset(mbr, 0, sizeof(mbr));
+  mbr[0x1fe]=0x55;
+  mbr[0x1ff]=0xaa;
+  if(image_pwrite(handle, 0, mbr, sizeof(mbr)) < 0)
+    goto write_error;
+  while(nbr_parts < max_parts && nbr_parts < BENCH_MAX_PARTS)
+  {
+    bench_part_t *part=&parts[nbr_parts];
+    /* every type in turn, the alignment at random */
+    const bench_kind_t kind=(bench_kind_t)(nbr_parts % BENCH_NBR_KINDS);
+    const int cylinder=(kind==BENCH_EXT4_BACKUP || bench_random(&state) % 4==0);
+    const uint64_t size_mib=64 + bench_random(&state) % 449;
+    uint64_t start=offset + (bench_random(&state) % 32) * BENCH_MIB;
+    if(cylinder)
+    {
+      /* 8 cylinders are a multiple of 4 KiB blocks */
+      const uint64_t unit=8 * BENCH_CYLINDER_SIZE;
+      start=(start + BENCH_CYLINDER_SIZE - 1) / BENCH_CYLINDER_SIZE * BENCH_CYLINDER_SIZE;
+      part->size=(size_mib * BENCH_MIB + unit - 1) / unit * unit;
+    }
+    else
+    {
+      start=(start + BENCH_MIB - 1) / BENCH_MIB * BENCH_MIB;
+      part->size=size_mib * BENCH_MIB;
+    }
+    if(start + part->size + BENCH_MIB > disk_size)
+      break;
+    part->kind=kind;
+    part->offset=start;
+    part->found=0;
+    part->exact=0;
+    if(part_write(handle, part, &state) < 0)
+      goto write_error;
+    offset=start + part->size;
+    nbr_parts++;
+  }
+  /* Sparse up to the end of the disk */
+  if(image_pwrite(handle, disk_size - 1, mbr, 1) < 0)
+    goto write_error;
+  if(fclose(handle)!=0)
+  {
+    fprintf(stderr, "Can't write %s\n", image);
+    return -1;
+  }
+  return 0;
+write_error:
+  fprintf(stderr, "Can't write %s\n", image);
+  fclose(handle);
+  return -1;
+}
+
+/* Return the number of partitions found that haven't been written */
+static unsigned int recall_check(const testdisk_cli_context_t *ctx, bench_recall_t *recall, bench_recall_t *kinds)
+{
+  const list_part_t *element;
+  unsigned int extra=0;
+  unsigned int i;
+  memset(recall, 0, sizeof(*recall));
+  memset(kinds, 0, BENCH_NBR_KINDS * sizeof(*kinds));
+  for(i=0; i < nbr_parts; i++)
+  {
+    parts[i].found=0;
+    parts[i].exact=0;
+  }
+  for(element=ctx->list_part; element!=NULL; element=element->next)
+  {
+    const partition_t *partition=element->part;
+    int match=0;
+    for(i=0; i < nbr_parts; i++)
+    {
+      if(parts[i].offset==partition->part_offset)
+      {
+	parts[i].found=1;
+	if(parts[i].size==partition->part_size)
+	  parts[i].exact=1;
+	match=1;
+      }
+    }
+    if(match==0)
+      extra++;
+  }
+  for(i=0; i < nbr_parts; i++)
+  {
+    bench_recall_t *kind=&kinds[parts[i].kind];
+    kind->placed++;
+    kind->found+=parts[i].found;
+    kind->exact+=parts[i].exact;
+    recall->placed++;
+    recall->found+=parts[i].found;
+    recall->exact+=parts[i].exact;
+  }
+  return extra;
+}
+
+static void print_io_stats(testdisk_cli_context_t *ctx)
+{
+  disk_stats_summary_t stats[BENCH_MAX_LAYERS];
+  unsigned int nbr;
+  unsigned int i;
+  nbr=get_io_stats(ctx, stats, BENCH_MAX_LAYERS);
+  if(nbr > BENCH_MAX_LAYERS)
+    nbr=BENCH_MAX_LAYERS;
+  for(i=0; i < nbr; i++)
+  {
+    printf(" %s_reads=%llu %s_bytes=%llu",
+	stats[i].layer, (unsigned long long)stats[i].nbr_reads,
+	stats[i].layer, (unsigned long long)stats[i].bytes);
+    if(strcmp(stats[i].layer, "cache")==0)
+      printf(" cache_hits=%llu cache_misses=%llu",
+	  (unsigned long long)stats[i].nbr_hits,
+	  (unsigned long long)stats[i].nbr_misses);
+  }
+}
+
+static const char *mode_name(const int fast_mode)
+{
+  switch(fast_mode)
+  {
+    case 0:
+      return "quick";
+    case 1:
+      return "deeper";
+    default:
+      return "deepest";
+  }
+}
+
+/* Search the partitions of the image once, without table hints and
+ * without the results of the previous searches */
+static int bench_run(const char *image, const int fast_mode, const char *log_file, const int verbose)
+{
+  char arch_i386[]="partition_i386";
+  testdisk_cli_context_t *ctx;
+  bench_recall_t recall;
+  bench_recall_t kinds[BENCH_NBR_KINDS];
+  unsigned int extra;
+  unsigned int i;
+  uint64_t locations;
+  uint64_t disk_size;
+  double start;
+  double elapsed;
+  int res;
+  ctx=init_testdisk(0, NULL, (log_file!=NULL ? 2 : 0), log_file);
+  if(ctx==NULL)
+    return -1;
+  if(add_image(ctx, image)==NULL || change_disk(ctx, image)==NULL)
+  {
+    fprintf(stderr, "Can't open %s\n", image);
+    finish_testdisk(ctx);
+    return -1;
+  }
+  change_arch(ctx, arch_i386);
+  change_analyse_cache(ctx, 0);
+  part_free_list(ctx->list_part);
+  ctx->list_part=NULL;
+  disk_size=ctx->params.disk->disk_size;
+  start=bench_time();
+  res=search_partitions(ctx, fast_mode, 0);
+  elapsed=bench_time() - start;
+  if(elapsed <= 0.0)
+    elapsed=0.000001;
+  locations=get_search_locations(ctx);
+  extra=recall_check(ctx, &recall, kinds);
+  printf("run mode=%s image=%s bytes=%llu partitions=%u seconds=%.3f locations=%llu locations_s=%.0f",
+      mode_name(fast_mode), image, (unsigned long long)disk_size, nbr_parts,
+      elapsed, (unsigned long long)locations, (double)locations / elapsed);
+  print_io_stats(ctx);
+  printf(" found=%u exact=%u extra=%u recall=%.3f\n",
+      recall.found, recall.exact, extra,
+      (recall.placed > 0 ? (double)recall.exact / recall.placed : 0.0));
+  for(i=0; i < BENCH_NBR_KINDS; i++)
+  {
+    if(kinds[i].placed > 0)
+      printf("kind mode=%s type=%s placed=%u found=%u exact=%u\n",
+	  mode_name(fast_mode), kind_names[i],
+	  kinds[i].placed, kinds[i].found, kinds[i].exact);
+  }
+  if(verbose > 0)
+  {
+    const list_part_t *element;
+    for(i=0; i < nbr_parts; i++)
+      printf("part mode=%s type=%s offset=%llu size=%llu found=%u exact=%u\n",
+	  mode_name(fast_mode), kind_names[parts[i].kind],
+	  (unsigned long long)parts[i].offset, (unsigned long long)parts[i].size,
+	  parts[i].found, parts[i].exact);
+    for(element=ctx->list_part; element!=NULL; element=element->next)
+      printf("search mode=%s offset=%llu size=%llu info=\"%s\"\n",
+	  mode_name(fast_mode),
+	  (unsigned long long)element->part->part_offset,
+	  (unsigned long long)element->part->part_size,
+	  element->part->info);
+  }
+  finish_testdisk(ctx);
+  return (res < 0 && nbr_parts > 0 ? -1 : 0);
+}
+
+int main(int argc, char **argv)
+{
+  const char *work_dir="testdisk_bench.d";
+  const char *log_file=NULL;
+  char *modes=NULL;
+  char default_modes[]="0,1";
+  char image[4096];
+  uint64_t disk_size=8192;
+  unsigned int max_parts=24;
+  int verbose=0;
+  int keep=0;
+  int res=0;
+  int i;
+  char *mode;
+  for(i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "-d")==0 && i+1<argc)
+      work_dir=argv[++i];
+    else if(strcmp(argv[i], "-s")==0 && i+1<argc)
+      disk_size=strtoull(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-n")==0 && i+1<argc)
+      max_parts=strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-m")==0 && i+1<argc)
+      modes=argv[++i];
+    else if(strcmp(argv[i], "-l")==0 && i+1<argc)
+      log_file=argv[++i];
+    else if(strcmp(argv[i], "-v")==0)
+      verbose++;
+    else if(strcmp(argv[i], "-k")==0)
+      keep=1;
+    else if(strcmp(argv[i], "-h")==0 || strcmp(argv[i], "--help")==0)
+    {
+      display_help();
+      return 0;
+    }
+    else
+    {
+      display_help();
+      return 1;
+    }
+  }
+  if(disk_size < 64)
+  {
+    display_help();
+    return 1;
+  }
+  if(mkdir(work_dir, 0775) < 0)
+  {
+    struct stat st;
+    if(stat(work_dir, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+      fprintf(stderr, "Can't create %s\n", work_dir);
+      return 1;
+    }
+  }
+  snprintf(image, sizeof(image), "%s/disk.dd", work_dir);
+  if(image_create(image, disk_size * BENCH_MIB, max_parts) < 0)
+    return 1;
+  if(modes==NULL)
+    modes=default_modes;
+  for(mode=strtok(modes, ","); mode!=NULL && res==0; mode=strtok(NULL, ","))
+    res=bench_run(image, atoi(mode), log_file, verbose);
+  if(keep==0)
+  {
+    unlink(image);
+    rmdir(work_dir);
+  }
+  return (res < 0 ? 1 : 0);
+}
@@ -33,6 +33,7 @@
 #include <ctype.h>
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
 #include "lang.h"
 #include "intrf.h"
 #include "intrfn.h"
@@ -98,6 +99,7 @@ static const char *exFAT_boot_sector_rescan(disk_t *disk, const partition_t *par
   const int size_bs=12 * disk->sector_size;
   int opt_B=0;
   int opt_O=0;
+  disk_read_t reads[2];
 #ifdef HAVE_NCURSES
   aff_copy(stdscr);
   wmove(stdscr,4,0);
@@ -108,8 +110,16 @@ static const char *exFAT_boot_sector_rescan(disk_t *disk, const partition_t *par
 #endif
   log_info("\nexFAT_boot_sector\n");
   log_partition(disk,partition);
+  /* The boot region and the backup boot region that follows it */
+  reads[0].offset=partition->part_offset;
+  reads[0].count=size_bs;
+  reads[0].buffer=buffer_bs;
+  reads[1].offset=partition->part_offset + size_bs;
+  reads[1].count=size_bs;
+  reads[1].buffer=buffer_backup_bs;
+  disk_pread_batch(disk, reads, 2);
   screen_buffer_add("Boot sector\n");
-  if(disk->pread(disk, buffer_bs, size_bs, partition->part_offset) != size_bs)
+  if(reads[0].res != size_bs)
   {
     screen_buffer_add("Bad: can't read exFAT boot record.\n");
     memset(buffer_bs,0,size_bs);
@@ -122,7 +132,7 @@ static const char *exFAT_boot_sector_rescan(disk_t *disk, const partition_t *par
   else
     screen_buffer_add("Bad\n");
   screen_buffer_add("\nBackup boot record\n");
-  if(disk->pread(disk, buffer_backup_bs, size_bs, partition->part_offset + size_bs) != size_bs)
+  if(reads[1].res != size_bs)
   {
     screen_buffer_add("Bad: can't read exFAT backup boot record.\n");
     memset(buffer_backup_bs,0,size_bs);
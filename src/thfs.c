@@ -33,6 +33,7 @@
 #include <ctype.h>
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
 #include "lang.h"
 #include "intrf.h"
 #include "intrfn.h"
@@ -98,6 +99,7 @@ static const char *HFS_HFSP_boot_sector_rescan(disk_t *disk_car, const partition
 {
   int opt_B=0;
   int opt_O=0;
+  disk_read_t reads[2];
 #ifdef HAVE_NCURSES
   aff_copy(stdscr);
   wmove(stdscr,4,0);
@@ -108,8 +110,16 @@ static const char *HFS_HFSP_boot_sector_rescan(disk_t *disk_car, const partition
 #endif
   log_info("\nHFS_HFSP_boot_sector\n");
   log_partition(disk_car,partition);
+  /* The volume header and its backup at the end of the partition */
+  reads[0].offset=partition->part_offset + 0x400;
+  reads[0].count=HFSP_BOOT_SECTOR_SIZE;
+  reads[0].buffer=buffer_bs;
+  reads[1].offset=partition->part_offset + partition->part_size - 0x400;
+  reads[1].count=HFSP_BOOT_SECTOR_SIZE;
+  reads[1].buffer=buffer_backup_bs;
+  disk_pread_batch(disk_car, reads, 2);
   screen_buffer_add("Volume header\n");
-  if(disk_car->pread(disk_car, buffer_bs, HFSP_BOOT_SECTOR_SIZE, partition->part_offset + 0x400) != HFSP_BOOT_SECTOR_SIZE)
+  if(reads[0].res != HFSP_BOOT_SECTOR_SIZE)
   {
     screen_buffer_add("Bad: can't read HFS/HFS+ volume header.\n");
     memset(buffer_bs,0,HFSP_BOOT_SECTOR_SIZE);
@@ -127,7 +137,7 @@ static const char *HFS_HFSP_boot_sector_rescan(disk_t *disk_car, const partition
   else
     screen_buffer_add("Bad\n");
   screen_buffer_add("\nBackup volume header\n");
-  if(disk_car->pread(disk_car, buffer_backup_bs, HFSP_BOOT_SECTOR_SIZE, partition->part_offset + partition->part_size - 0x400) != HFSP_BOOT_SECTOR_SIZE)
+  if(reads[1].res != HFSP_BOOT_SECTOR_SIZE)
   {
     screen_buffer_add("Bad: can't read HFS/HFS+ backup volume header.\n");
     memset(buffer_backup_bs,0,HFSP_BOOT_SECTOR_SIZE);
@@ -32,6 +32,7 @@
 #endif
 #include "types.h"
 #include "common.h"
+#include "hdaccess.h"
 #include "lang.h"
 #include "intrf.h"
 #include "intrfn.h"
@@ -121,6 +122,7 @@ static const char *ntfs_boot_sector_scan(disk_t *disk, const partition_t *partit
   int identical_sectors;
   int opt_B=0;
   int opt_O=0;
+  disk_read_t reads[2];
 #ifdef HAVE_NCURSES
   aff_copy(stdscr);
   wmove(stdscr,4,0);
@@ -131,8 +133,16 @@ static const char *ntfs_boot_sector_scan(disk_t *disk, const partition_t *partit
 #endif
   log_info("\nntfs_boot_sector\n");
   log_partition(disk,partition);
+  /* The boot sector and its backup at the end of the partition */
+  reads[0].offset=partition->part_offset;
+  reads[0].count=NTFS_BOOT_SECTOR_SIZE;
+  reads[0].buffer=buffer_bs;
+  reads[1].offset=partition->part_offset + partition->part_size - disk->sector_size;
+  reads[1].count=NTFS_BOOT_SECTOR_SIZE;
+  reads[1].buffer=buffer_backup_bs;
+  disk_pread_batch(disk, reads, 2);
   screen_buffer_add("Boot sector\n");
-  if(disk->pread(disk, buffer_bs, NTFS_BOOT_SECTOR_SIZE, partition->part_offset) != NTFS_BOOT_SECTOR_SIZE)
+  if(reads[0].res != NTFS_BOOT_SECTOR_SIZE)
   {
     screen_buffer_add("ntfs_boot_sector: Can't read boot sector.\n");
     memset(buffer_bs,0,NTFS_BOOT_SECTOR_SIZE);
@@ -147,7 +157,7 @@ static const char *ntfs_boot_sector_scan(disk_t *disk, const partition_t *partit
     screen_buffer_add("Status: Bad\n");
   }
   screen_buffer_add("\nBackup boot sector\n");
-  if(disk->pread(disk, buffer_backup_bs, NTFS_BOOT_SECTOR_SIZE, partition->part_offset + partition->part_size - disk->sector_size) != NTFS_BOOT_SECTOR_SIZE)
+  if(reads[1].res != NTFS_BOOT_SECTOR_SIZE)
   {
     screen_buffer_add("ntfs_boot_sector: Can't read backup boot sector.\n");
     memset(buffer_backup_bs,0,NTFS_BOOT_SECTOR_SIZE);
@@ -0,0 +1,482 @@
+/*
+
+    File: trace_replay.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+/* Replay an I/O trace recorded with photorec /trace.
+ * The reads are sent to a synthetic disk of the size of the traced one. It
+ * returns zeroes, or the data of /image, and fails where the traced disk
+ * failed. Each read costs the time given by a latency model fitted on the
+ * trace: a fixed cost for a sequential read or for a seek, plus a cost per
+ * byte. The time is simulated, the replay doesn't wait.
+ * As the trace is recorded below the cache, a replay without /cache_size
+ * gives back the traced device time; with /cache_size and /readahead, the
+ * reads go through a cache using these settings first. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "hdcache.h"
+#include "hdstats.h"
+#include "hdtrace.h"
+#include "log.h"
+#include "mapfile.h"
+
+extern const arch_fnct_t arch_none;
+
+typedef struct
+{
+  double seq_ns;		/* fixed cost of a read following the previous one */
+  double seek_ns;		/* fixed cost of any other read */
+  double ns_per_byte;
+  double error_ns;		/* cost of a failed read */
+} replay_model_t;
+
+struct replay_struct
+{
+  disk_t *image;
+  mapfile_t bad;
+  replay_model_t model;
+  uint64_t next_offset;
+  uint64_t nbr_reads;
+  uint64_t nbr_errors;
+  uint64_t bytes;
+  double time_ns;
+};
+
+typedef struct
+{
+  struct disktrace_header header;
+  struct disktrace_record *records;
+  unsigned int nbr;
+  uint64_t nbr_reads;
+  uint64_t nbr_writes;
+  uint64_t bytes;
+  uint64_t time_ns;
+} replay_trace_t;
+
+static int trace_load(replay_trace_t *trace, const char *filename)
+{
+  struct disktrace_record record;
+  unsigned int allocated=0;
+  FILE *handle=fopen(filename, "rb");
+  if(handle==NULL)
+  {
+    fprintf(stderr, "Can't open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  memset(trace, 0, sizeof(*trace));
+  if(fread(&trace->header, sizeof(trace->header), 1, handle)!=1 ||
+      memcmp(trace->header.magic, DISKTRACE_MAGIC, sizeof(trace->header.magic))!=0 ||
+      le32(trace->header.version)!=DISKTRACE_VERSION)
+  {
+    fprintf(stderr, "%s: not an I/O trace\n", filename);
+    fclose(handle);
+    return -1;
+  }
+  trace->header.sector_size=le32(trace->header.sector_size);
+  trace->header.disk_size=le64(trace->header.disk_size);
+  while(fread(&record, sizeof(record), 1, handle)==1)
+  {
+    if(trace->nbr >= allocated)
+    {
+      allocated=(allocated > 0 ? allocated * 2 : 4096);
+      trace->records=(struct disktrace_record *)realloc(trace->records, allocated * sizeof(record));
+      if(trace->records==NULL)
+      {
+	fprintf(stderr, "%s: not enough memory\n", filename);
+	fclose(handle);
+	return -1;
+      }
+    }
+    record.offset=le64(record.offset);
+    record.latency=le64(record.latency);
+    record.count=le32(record.count);
+    record.result=le32(record.result);
+    trace->records[trace->nbr++]=record;
+    if(record.op==DISKTRACE_OP_READ)
+    {
+      trace->nbr_reads++;
+      trace->bytes+=record.count;
+      trace->time_ns+=record.latency;
+    }
+    else
+      trace->nbr_writes++;
+  }
+  fclose(handle);
+  return 0;
+}
+
+/* Fit latency = fixed cost + ns_per_byte * size on the successful reads,
+ * with a fixed cost for the sequential reads and one for the seeks */
+static void model_fit(replay_model_t *model, const replay_trace_t *trace)
+{
+  double n[2]={0, 0}, sx[2]={0, 0}, sy[2]={0, 0}, sxx[2]={0, 0}, sxy[2]={0, 0};
+  double sxx_c=0, sxy_c=0;
+  double error_ns=0;
+  unsigned int nbr_errors=0;
+  uint64_t next_offset=0;
+  unsigned int i;
+  int c;
+  for(i=0; i<trace->nbr; i++)
+  {
+    const struct disktrace_record *record=&trace->records[i];
+    if(record->op!=DISKTRACE_OP_READ)
+      continue;
+    if(record->result < 0 || (uint32_t)record->result < record->count)
+    {
+      error_ns+=record->latency;
+      nbr_errors++;
+    }
+    else
+    {
+      const double x=record->count;
+      const double y=record->latency;
+      c=(record->offset==next_offset ? 0 : 1);
+      n[c]++;
+      sx[c]+=x;
+      sy[c]+=y;
+      sxx[c]+=x*x;
+      sxy[c]+=x*y;
+    }
+    next_offset=record->offset + record->count;
+  }
+  /* Same cost per byte for both kinds of reads */
+  for(c=0; c<2; c++)
+  {
+    if(n[c] > 0)
+    {
+      sxx_c+=sxx[c] - sx[c]*sx[c]/n[c];
+      sxy_c+=sxy[c] - sx[c]*sy[c]/n[c];
+    }
+  }
+  model->ns_per_byte=(sxx_c > 0 && sxy_c > 0 ? sxy_c / sxx_c : 0);
+  for(c=0; c<2; c++)
+  {
+    double fixed=0;
+    if(n[c] > 0)
+    {
+      fixed=(sy[c] - model->ns_per_byte * sx[c]) / n[c];
+      if(fixed < 0)
+	fixed=0;
+    }
+    if(c==0)
+      model->seq_ns=fixed;
+    else
+      model->seek_ns=fixed;
+  }
+  if(n[0] < 1)
+    model->seq_ns=model->seek_ns;
+  if(n[1] < 1)
+    model->seek_ns=model->seq_ns;
+  model->error_ns=(nbr_errors > 0 ? error_ns / nbr_errors : model->seek_ns);
+}
+
+/* The reads that failed are failing again, unless the same sectors have
+ * been read successfully later */
+static void replay_set_errors(struct replay_struct *data, const replay_trace_t *trace)
+{
+  unsigned int i;
+  for(i=0; i<trace->nbr; i++)
+  {
+    const struct disktrace_record *record=&trace->records[i];
+    if(record->op!=DISKTRACE_OP_READ || record->count==0)
+      continue;
+    if(record->result < 0)
+      mapfile_set(&data->bad, record->offset, record->count, MAPFILE_BAD_SECTOR);
+    else if((uint32_t)record->result < record->count)
+      mapfile_set(&data->bad, record->offset + record->result, record->count - record->result, MAPFILE_BAD_SECTOR);
+  }
+  for(i=0; i<trace->nbr; i++)
+  {
+    const struct disktrace_record *record=&trace->records[i];
+    if(record->op==DISKTRACE_OP_READ && record->result > 0)
+      mapfile_set(&data->bad, record->offset, record->result, MAPFILE_FINISHED);
+  }
+}
+
+static int replay_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct replay_struct *data=(struct replay_struct *)disk->data;
+  uint64_t pos;
+  uint64_t size;
+  unsigned int readable=count;
+  int res;
+  data->nbr_reads++;
+  if(mapfile_next(&data->bad, offset, MAPFILE_BAD_SECTOR, &pos, &size)==0 &&
+      pos < offset + count)
+    readable=pos - offset;
+  if(offset >= disk->disk_real_size)
+    readable=0;
+  else if(readable > disk->disk_real_size - offset)
+    readable=disk->disk_real_size - offset;
+  if(data->image!=NULL && readable > 0)
+  {
+    res=data->image->pread(data->image, buffer, readable, offset);
+    if(res < (signed)readable)
+      memset((char *)buffer + (res > 0 ? res : 0), 0, readable - (res > 0 ? res : 0));
+  }
+  else
+    memset(buffer, 0, readable);
+  if(readable < count)
+    memset((char *)buffer + readable, 0, count - readable);
+  data->bytes+=count;
+  data->time_ns+=(offset==data->next_offset ? data->model.seq_ns : data->model.seek_ns) +
+    data->model.ns_per_byte * readable;
+  data->next_offset=offset + count;
+  if(readable < count)
+  {
+    data->nbr_errors++;
+    data->time_ns+=data->model.error_ns;
+    if(readable==0)
+    {
+      errno=EIO;
+      return -1;
+    }
+  }
+  return readable;
+}
+
+static int replay_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("replay_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int replay_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *replay_description(disk_t *disk)
+{
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"Replay %s - %s (RO)",
+      disk->device, buffer_disk_size);
+  return disk->description_txt;
+}
+
+static const char *replay_description_short(disk_t *disk)
+{
+  return replay_description(disk);
+}
+
+static void replay_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    struct replay_struct *data=(struct replay_struct *)disk->data;
+    if(data->image!=NULL)
+      data->image->clean(data->image);
+    mapfile_free(&data->bad);
+    free(data);
+    disk->data=NULL;
+  }
+  free(disk->device);
+  free(disk);
+}
+
+static disk_t *replay_disk_new(const char *filename, const replay_trace_t *trace, const replay_model_t *model, disk_t *image)
+{
+  struct replay_struct *data;
+  disk_t *disk;
+  data=(struct replay_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->image=image;
+  data->model=*model;
+  data->next_offset=(uint64_t)-1;
+  mapfile_init(&data->bad, 0);
+  replay_set_errors(data, trace);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(filename);
+  disk->data=data;
+  disk->description=&replay_description;
+  disk->description_short=&replay_description_short;
+  disk->pread=&replay_pread;
+  disk->pwrite=&replay_nopwrite;
+  disk->sync=&replay_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&replay_clean;
+  disk->sector_size=(trace->header.sector_size > 0 ? trace->header.sector_size : DEFAULT_SECTOR_SIZE);
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=trace->header.disk_size;
+  update_disk_car_fields(disk);
+  return disk;
+}
+
+static void display_help(void)
+{
+  printf("\nUsage: trace_replay [/image file] [/cache_size MiB] [/readahead 512|8k|32k]\n"
+      "                    [/seq_us N] [/seek_us N] [/ns_per_byte N] trace\n"
+      "\n"
+      "Replay the reads of an I/O trace recorded by photorec /trace against a\n"
+      "synthetic disk with the latency model of the trace, and report the\n"
+      "simulated device time. /cache_size adds a cache in front of the disk.\n");
+}
+
+int main(int argc, char **argv)
+{
+  replay_trace_t trace;
+  replay_model_t model;
+  const char *trace_filename=NULL;
+  const char *image_filename=NULL;
+  double seq_us=-1, seek_us=-1, ns_per_byte=-1;
+  unsigned int cache_size=0;
+  int testdisk_mode=TESTDISK_O_RDONLY;
+  disk_t *disk;
+  disk_t *image=NULL;
+  const struct replay_struct *data;
+  unsigned char *buffer;
+  unsigned int buffer_size=0;
+  uint64_t start;
+  uint64_t cpu_ns;
+  uint64_t mismatches=0;
+  unsigned int i;
+  int j;
+  for(j=1; j<argc; j++)
+  {
+    const char *arg=argv[j];
+    if(arg[0]=='-' && arg[1]=='-')
+      arg++;
+    if(j+1<argc && (strcmp(arg, "/image")==0 || strcmp(arg, "-image")==0))
+      image_filename=argv[++j];
+    else if(j+1<argc && (strcmp(arg, "/cache_size")==0 || strcmp(arg, "-cache_size")==0))
+      cache_size=atoi(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/readahead")==0 || strcmp(arg, "-readahead")==0))
+    {
+      j++;
+      if(strcmp(argv[j], "8k")==0)
+	testdisk_mode|=TESTDISK_O_READAHEAD_8K;
+      else if(strcmp(argv[j], "32k")==0)
+	testdisk_mode|=TESTDISK_O_READAHEAD_32K;
+      else if(strcmp(argv[j], "512")!=0)
+      {
+	display_help();
+	return 1;
+      }
+    }
+    else if(j+1<argc && (strcmp(arg, "/seq_us")==0 || strcmp(arg, "-seq_us")==0))
+      seq_us=atof(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/seek_us")==0 || strcmp(arg, "-seek_us")==0))
+      seek_us=atof(argv[++j]);
+    else if(j+1<argc && (strcmp(arg, "/ns_per_byte")==0 || strcmp(arg, "-ns_per_byte")==0))
+      ns_per_byte=atof(argv[++j]);
+    else if(strcmp(arg, "/help")==0 || strcmp(arg, "-help")==0 || strcmp(arg, "-h")==0)
+    {
+      display_help();
+      return 0;
+    }
+    else if(trace_filename==NULL)
+      trace_filename=argv[j];
+    else
+    {
+      display_help();
+      return 1;
+    }
+  }
+  if(trace_filename==NULL)
+  {
+    display_help();
+    return 1;
+  }
+  if(trace_load(&trace, trace_filename) < 0)
+    return 1;
+  model_fit(&model, &trace);
+  if(seq_us >= 0)
+    model.seq_ns=seq_us * 1000;
+  if(seek_us >= 0)
+    model.seek_ns=seek_us * 1000;
+  if(ns_per_byte >= 0)
+    model.ns_per_byte=ns_per_byte;
+  if(image_filename!=NULL)
+  {
+    image=file_test_availability(image_filename, 0, TESTDISK_O_RDONLY);
+    if(image==NULL)
+    {
+      fprintf(stderr, "Can't open %s\n", image_filename);
+      free(trace.records);
+      return 1;
+    }
+  }
+  printf("trace=%s disk_size=%llu sector_size=%u reads=%llu bytes=%llu writes=%llu time_ms=%.3f\n",
+      trace_filename, (long long unsigned)trace.header.disk_size, trace.header.sector_size,
+      (long long unsigned)trace.nbr_reads, (long long unsigned)trace.bytes,
+      (long long unsigned)trace.nbr_writes, (double)trace.time_ns / 1000000);
+  printf("model seq_us=%.3f seek_us=%.3f ns_per_byte=%.4f error_us=%.3f\n",
+      model.seq_ns / 1000, model.seek_ns / 1000, model.ns_per_byte, model.error_ns / 1000);
+  disk=replay_disk_new(trace_filename, &trace, &model, image);
+  data=(const struct replay_struct *)disk->data;
+  if(cache_size > 0)
+  {
+    disk=new_diskcache(disk, testdisk_mode);
+    diskcache_set_size(disk, (uint64_t)cache_size * 1024 * 1024);
+  }
+  for(i=0; i<trace.nbr; i++)
+    if(trace.records[i].op==DISKTRACE_OP_READ && trace.records[i].count > buffer_size)
+      buffer_size=trace.records[i].count;
+  buffer=(unsigned char *)MALLOC(buffer_size > 0 ? buffer_size : 1);
+  start=disk_stats_clock();
+  for(i=0; i<trace.nbr; i++)
+  {
+    const struct disktrace_record *record=&trace.records[i];
+    if(record->op==DISKTRACE_OP_READ &&
+	disk->pread(disk, buffer, record->count, record->offset)!=record->result)
+      mismatches++;
+  }
+  cpu_ns=disk_stats_clock() - start;
+  if(cache_size > 0)
+    printf("replay cache_size=%uMiB readahead=%s", cache_size,
+	((testdisk_mode&TESTDISK_O_READAHEAD_32K)!=0 ? "32k" :
+	 ((testdisk_mode&TESTDISK_O_READAHEAD_8K)!=0 ? "8k" : "512")));
+  else
+    printf("replay cache=none");
+  printf(" requests=%llu device_reads=%llu device_bytes=%llu errors=%llu time_ms=%.3f speedup=%.2f cpu_ms=%.3f result_mismatches=%llu\n",
+      (long long unsigned)trace.nbr_reads,
+      (long long unsigned)data->nbr_reads, (long long unsigned)data->bytes,
+      (long long unsigned)data->nbr_errors, data->time_ns / 1000000,
+      (data->time_ns > 0 ? (double)trace.time_ns / data->time_ns : 0.0),
+      (double)cpu_ns / 1000000, (long long unsigned)mismatches);
+  disk->clean(disk);
+  free(buffer);
+  free(trace.records);
+  return 0;
+}
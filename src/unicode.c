@@ -24,6 +24,16 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(DISABLED_FOR_FRAMAC)
+#include <emmintrin.h>
+#define UNICODE_SSE2
+#elif defined(__ARM_NEON) && defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__ && !defined(DISABLED_FOR_FRAMAC)
+#include <arm_neon.h>
+#define UNICODE_NEON
+#endif
 #include "types.h"
 #include "common.h"
 #include "unicode.h"
@@ -63,3 +73,136 @@ unsigned int str2UCSle(uint16_t *to, const char *from, const unsigned int len)
   return i;
 }
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Copy the leading UTF-16LE characters in 0x01-0x7f to to as ASCII,
+ * return their number. It may stop before the first other character,
+ * the main loop takes care of the remaining ones. */
+static unsigned int UTF16le2utf8_ascii(char *to, const unsigned char *from, const unsigned int len)
+{
+  unsigned int i=0;
+#ifdef UNICODE_SSE2
+  const __m128i zero=_mm_setzero_si128();
+  while(i+8 <= len)
+  {
+    const __m128i v=_mm_loadu_si128((const __m128i *)&from[2*i]);
+    /* unsigned saturation: 0x0100-0x7fff give 0xff, 0x8000-0xffff give 0 */
+    const __m128i p=_mm_packus_epi16(v, v);
+    const unsigned int mask=(_mm_movemask_epi8(p) |
+	_mm_movemask_epi8(_mm_cmpeq_epi8(p, zero))) & 0xff;
+    _mm_storel_epi64((__m128i *)&to[i], p);
+    if(mask!=0)
+      return i + __builtin_ctz(mask);
+    i+=8;
+  }
+#elif defined(UNICODE_NEON)
+  const uint8x8_t high=vdup_n_u8(0x80);
+  const uint8x8_t zero=vdup_n_u8(0);
+  while(i+8 <= len)
+  {
+    const uint16x8_t v=vreinterpretq_u16_u8(vld1q_u8(&from[2*i]));
+    /* unsigned saturation: 0x0100-0xffff give 0xff */
+    const uint8x8_t p=vqmovn_u16(v);
+    const uint64_t mask=vget_lane_u64(vreinterpret_u64_u8(vorr_u8(vcge_u8(p, high), vceq_u8(p, zero))), 0);
+    vst1_u8((uint8_t *)&to[i], p);
+    if(mask!=0)
+      return i + __builtin_ctzll(mask) / 8;
+    i+=8;
+  }
+#else
+  while(i+4 <= len)
+  {
+    uint64_t x;
+    memcpy(&x, &from[2*i], 8);
+    x=le64(x);
+    /* stop on a character >= 0x80 or a NUL */
+    if(((x & 0xff80ff80ff80ff80ULL) |
+	  ((x - 0x0001000100010001ULL) & ~x & 0x8000800080008000ULL)) != 0)
+      return i;
+    to[i]=(char)x;
+    to[i+1]=(char)(x>>16);
+    to[i+2]=(char)(x>>32);
+    to[i+3]=(char)(x>>48);
+    i+=4;
+  }
+#endif
+  return i;
+}
+#endif
+
+int UTF16le2utf8(char *to, const unsigned int to_size, const unsigned char *from, const unsigned int len)
+{
+  unsigned int i=0;
+  unsigned int o=0;
+  /*@
+    @ loop invariant 0 <= i <= len;
+    @ loop invariant 0 <= o < to_size;
+    @ loop assigns i, o, to[0 .. to_size-1];
+    @ loop variant len - i;
+    @*/
+  while(i < len)
+  {
+    unsigned int c;
+#ifndef DISABLED_FOR_FRAMAC
+    {
+      /* The ASCII characters are copied as is, o==i until the first
+       * other character only */
+      const unsigned int max=(len-i < to_size-1-o ? len-i : to_size-1-o);
+      const unsigned int n=UTF16le2utf8_ascii(&to[o], &from[2*i], max);
+      i+=n;
+      o+=n;
+      if(i >= len)
+	break;
+    }
+#endif
+    c=from[2*i] | (from[2*i+1]<<8);
+    if(c==0)
+      break;
+    if(c < 0x80)
+    {
+      if(o + 1 >= to_size)
+	break;
+      to[o++]=(char)c;
+      i++;
+    }
+    else if(c < 0x800)
+    {
+      if(o + 2 >= to_size)
+	break;
+      to[o++]=(char)(0xc0 | (c>>6));
+      to[o++]=(char)(0x80 | (c & 0x3f));
+      i++;
+    }
+    else if(c >= 0xd800 && c < 0xdc00)
+    {
+      unsigned int c2;
+      if(i + 1 >= len)
+	break;
+      c2=from[2*i+2] | (from[2*i+3]<<8);
+      if(c2 < 0xdc00 || c2 >= 0xe000)
+	break;
+      if(o + 4 >= to_size)
+	break;
+      c=0x10000 + ((c - 0xd800)<<10) + (c2 - 0xdc00);
+      to[o++]=(char)(0xf0 | (c>>18));
+      to[o++]=(char)(0x80 | ((c>>12) & 0x3f));
+      to[o++]=(char)(0x80 | ((c>>6) & 0x3f));
+      to[o++]=(char)(0x80 | (c & 0x3f));
+      i+=2;
+    }
+    else if(c >= 0xdc00 && c < 0xe000)
+      break;
+    else
+    {
+      if(o + 3 >= to_size)
+	break;
+      to[o++]=(char)(0xe0 | (c>>12));
+      to[o++]=(char)(0x80 | ((c>>6) & 0x3f));
+      to[o++]=(char)(0x80 | (c & 0x3f));
+      i++;
+    }
+  }
+  to[o]='\0';
+  if(i < len && (from[2*i]!=0 || from[2*i+1]!=0))
+    return -1;
+  return o;
+}
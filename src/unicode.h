@@ -43,6 +43,22 @@ unsigned int UCSle2str(char *to, const uint16_t *from, const unsigned int len);
   @*/
 unsigned int str2UCSle(uint16_t *to, const char *from, const unsigned int len);
 
+/* Convert up to len UTF-16LE characters of from to a NUL terminated
+ * UTF-8 string, the conversion stops at a NUL character.
+ * Return the length of the UTF-8 string, or -1 if from has an unpaired
+ * surrogate or if to_size is too small: to has then the characters
+ * converted so far. */
+/*@
+  @ requires to_size > 0;
+  @ requires \valid(to + ( 0 .. to_size-1));
+  @ requires \valid_read(from + ( 0 .. 2*len-1));
+  @ requires \separated(to + (..), from + (..));
+  @ terminates \true;
+  @ ensures -1 <= \result < to_size;
+  @ assigns to[0 .. to_size-1];
+  @*/
+int UTF16le2utf8(char *to, const unsigned int to_size, const unsigned char *from, const unsigned int len);
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
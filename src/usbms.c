@@ -0,0 +1,715 @@
+/*
+
+    File: usbms.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC) && defined(HAVE_LIBUSB)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#include <errno.h>
+#include <stdint.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(HAVE_LIBUSB_1_0_LIBUSB_H)
+#include <libusb-1.0/libusb.h>
+#else
+#include <libusb.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "usbms.h"
+
+/* USB mass storage, Bulk-Only Transport: each SCSI command is sent in a
+ * 31-byte CBW on the bulk OUT endpoint, the data comes on the bulk IN
+ * endpoint followed by the 13-byte CSW. The device isn't opened through
+ * the kernel, so no root access is needed on Android: the application
+ * gets the permission from the USB host API and gives the file
+ * descriptor.
+ * A READ command transfers up to 1 MiB; its data phase is split into
+ * bulk transfers submitted together so the host controller always has
+ * a buffer queued and the bus doesn't idle between two packets. After a
+ * failed READ, the size by command is halved down to 64 KiB: some cheap
+ * bridges can't do more than 120 KiB. */
+#define USBMS_TIMEOUT		20000	/* ms */
+#define USBMS_MAX_TRANSFER	(1024*1024)
+#define USBMS_MIN_TRANSFER	(64*1024)
+#define USBMS_URB_SIZE		(128*1024)
+#define USBMS_URBS		(USBMS_MAX_TRANSFER/USBMS_URB_SIZE)
+#define USBMS_CBW_SIZE		31
+#define USBMS_CSW_SIZE		13
+#define USBMS_CBW_SIGNATURE	0x43425355
+#define USBMS_CSW_SIGNATURE	0x53425355
+
+extern const arch_fnct_t arch_none;
+
+struct info_usbms_struct
+{
+  char *name;
+  libusb_context *ctx;
+  libusb_device_handle *handle;
+  int interface;
+  unsigned char ep_in;
+  unsigned char ep_out;
+  unsigned int lun;
+  uint16_t vid;
+  uint16_t pid;
+  uint32_t tag;
+  unsigned int sector_size;
+  unsigned int max_transfer;	/* bytes by READ command */
+  uint64_t sectors;
+  unsigned char *scratch;	/* a sector */
+  struct libusb_transfer *urb[USBMS_URBS];
+  int urb_done[USBMS_URBS];
+  char model[40];
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t mutex;
+#endif
+};
+
+static void usbms_put_be32(unsigned char *p, const uint32_t v)
+{
+  p[0]=v>>24;
+  p[1]=v>>16;
+  p[2]=v>>8;
+  p[3]=v;
+}
+
+static uint32_t usbms_get_be32(const unsigned char *p)
+{
+  return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+static void usbms_put_le32(unsigned char *p, const uint32_t v)
+{
+  p[0]=v;
+  p[1]=v>>8;
+  p[2]=v>>16;
+  p[3]=v>>24;
+}
+
+static uint32_t usbms_get_le32(const unsigned char *p)
+{
+  return ((uint32_t)p[3]<<24) | ((uint32_t)p[2]<<16) | ((uint32_t)p[1]<<8) | p[0];
+}
+
+/* Reset Recovery: Bulk-Only Mass Storage Reset, then clear the halt of
+ * both endpoints */
+static void usbms_reset(struct info_usbms_struct *data)
+{
+  log_warning("%s: reset recovery\n", data->name);
+  libusb_control_transfer(data->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+      0xff, 0, data->interface, NULL, 0, USBMS_TIMEOUT);
+  libusb_clear_halt(data->handle, data->ep_in);
+  libusb_clear_halt(data->handle, data->ep_out);
+}
+
+static int usbms_send_cbw(struct info_usbms_struct *data, const unsigned char *cb, const unsigned int cb_len, const unsigned int data_len)
+{
+  unsigned char cbw[USBMS_CBW_SIZE];
+  int transferred=0;
+  int res;
+  memset(cbw, 0, sizeof(cbw));
+  usbms_put_le32(&cbw[0], USBMS_CBW_SIGNATURE);
+  usbms_put_le32(&cbw[4], ++data->tag);
+  usbms_put_le32(&cbw[8], data_len);
+  cbw[12]=(data_len > 0 ? 0x80 : 0x00);	/* data in */
+  cbw[13]=data->lun;
+  cbw[14]=cb_len;
+  memcpy(&cbw[15], cb, cb_len);
+  res=libusb_bulk_transfer(data->handle, data->ep_out, cbw, sizeof(cbw), &transferred, USBMS_TIMEOUT);
+  if(res==LIBUSB_ERROR_PIPE)
+  {
+    libusb_clear_halt(data->handle, data->ep_out);
+    res=libusb_bulk_transfer(data->handle, data->ep_out, cbw, sizeof(cbw), &transferred, USBMS_TIMEOUT);
+  }
+  if(res < 0 || transferred!=USBMS_CBW_SIZE)
+  {
+    log_error("%s: can't send the command 0x%02x: %s\n", data->name, cb[0], libusb_error_name(res));
+    usbms_reset(data);
+    return -1;
+  }
+  return 0;
+}
+
+/* Check the CSW in buffer, return its status */
+static int usbms_check_csw(struct info_usbms_struct *data, const unsigned char *csw, const int len, uint32_t *residue)
+{
+  if(len!=USBMS_CSW_SIZE || usbms_get_le32(&csw[0])!=USBMS_CSW_SIGNATURE ||
+      usbms_get_le32(&csw[4])!=data->tag || csw[12] > 2)
+  {
+    log_error("%s: invalid CSW\n", data->name);
+    usbms_reset(data);
+    return -1;
+  }
+  *residue=usbms_get_le32(&csw[8]);
+  if(csw[12]==2)
+  {
+    log_error("%s: phase error\n", data->name);
+    usbms_reset(data);
+    return -1;
+  }
+  return csw[12];
+}
+
+/* Read the CSW, return its status: 0 passed, 1 failed, -1 on error */
+static int usbms_recv_csw(struct info_usbms_struct *data, uint32_t *residue)
+{
+  unsigned char csw[USBMS_CSW_SIZE];
+  int transferred=0;
+  int res=libusb_bulk_transfer(data->handle, data->ep_in, csw, sizeof(csw), &transferred, USBMS_TIMEOUT);
+  if(res==LIBUSB_ERROR_PIPE)
+  {
+    libusb_clear_halt(data->handle, data->ep_in);
+    res=libusb_bulk_transfer(data->handle, data->ep_in, csw, sizeof(csw), &transferred, USBMS_TIMEOUT);
+  }
+  if(res < 0)
+  {
+    log_error("%s: can't read the CSW: %s\n", data->name, libusb_error_name(res));
+    usbms_reset(data);
+    return -1;
+  }
+  return usbms_check_csw(data, csw, transferred, residue);
+}
+
+/* Run a command whose data phase is short, return the CSW status or -1.
+ * *transferred is the number of bytes received */
+static int usbms_command(struct info_usbms_struct *data, const unsigned char *cb, const unsigned int cb_len, unsigned char *buffer, const unsigned int len, int *transferred)
+{
+  uint32_t residue;
+  *transferred=0;
+  if(usbms_send_cbw(data, cb, cb_len, len) < 0)
+    return -1;
+  if(len > 0)
+  {
+    const int res=libusb_bulk_transfer(data->handle, data->ep_in, buffer, len, transferred, USBMS_TIMEOUT);
+    if(res==LIBUSB_ERROR_PIPE)
+      libusb_clear_halt(data->handle, data->ep_in);
+    else if(res < 0 && res!=LIBUSB_ERROR_OVERFLOW)
+    {
+      log_error("%s: command 0x%02x: %s\n", data->name, cb[0], libusb_error_name(res));
+      usbms_reset(data);
+      return -1;
+    }
+  }
+  return usbms_recv_csw(data, &residue);
+}
+
+/* Return the sense key or -1 */
+static int usbms_request_sense(struct info_usbms_struct *data)
+{
+  unsigned char cb[6];
+  unsigned char sense[18];
+  int transferred;
+  memset(cb, 0, sizeof(cb));
+  memset(sense, 0, sizeof(sense));
+  cb[0]=0x03;
+  cb[4]=sizeof(sense);
+  if(usbms_command(data, cb, sizeof(cb), sense, sizeof(sense), &transferred)!=0 || transferred < 14)
+    return -1;
+  log_info("%s: sense key 0x%x, ASC 0x%02x, ASCQ 0x%02x\n", data->name,
+      sense[2] & 0x0f, sense[12], sense[13]);
+  return sense[2] & 0x0f;
+}
+
+static void LIBUSB_CALL usbms_urb_done(struct libusb_transfer *transfer)
+{
+  *(int *)transfer->user_data=1;
+}
+
+/* READ(10) or READ(16) of n sectors, the data phase uses up to
+ * USBMS_URBS bulk transfers in flight.
+ * Return 0, -2 on a medium error or -1 */
+static int usbms_read_sectors(struct info_usbms_struct *data, unsigned char *buffer, const uint64_t lba, const unsigned int n)
+{
+  const unsigned int len=n * data->sector_size;
+  const unsigned int nbr=(len + USBMS_URB_SIZE - 1) / USBMS_URB_SIZE;
+  unsigned char cb[16];
+  unsigned int cb_len;
+  unsigned int submitted;
+  unsigned int i;
+  unsigned int received=0;
+  int stalled=0;
+  int csw_found=-1;
+  int status;
+  uint32_t residue=0;
+  memset(cb, 0, sizeof(cb));
+  if(lba + n <= 0xffffffff && n <= 0xffff)
+  {
+    cb[0]=0x28;
+    usbms_put_be32(&cb[2], lba);
+    cb[7]=n>>8;
+    cb[8]=n;
+    cb_len=10;
+  }
+  else
+  {
+    cb[0]=0x88;
+    usbms_put_be32(&cb[2], lba>>32);
+    usbms_put_be32(&cb[6], lba);
+    usbms_put_be32(&cb[10], n);
+    cb_len=16;
+  }
+  if(usbms_send_cbw(data, cb, cb_len, len) < 0)
+    return -1;
+  for(submitted=0; submitted<nbr; submitted++)
+  {
+    const unsigned int size=(len - submitted * USBMS_URB_SIZE < USBMS_URB_SIZE ? len - submitted * USBMS_URB_SIZE : USBMS_URB_SIZE);
+    data->urb_done[submitted]=0;
+    libusb_fill_bulk_transfer(data->urb[submitted], data->handle, data->ep_in,
+	buffer + submitted * USBMS_URB_SIZE, size, &usbms_urb_done, &data->urb_done[submitted], USBMS_TIMEOUT);
+    if(libusb_submit_transfer(data->urb[submitted]) < 0)
+      break;
+  }
+  for(i=0; i<submitted; i++)
+  {
+    const struct libusb_transfer *urb=data->urb[i];
+    while(data->urb_done[i]==0)
+      libusb_handle_events_completed(data->ctx, &data->urb_done[i]);
+    if(urb->status==LIBUSB_TRANSFER_COMPLETED && urb->actual_length==urb->length)
+    {
+      received+=urb->actual_length;
+      continue;
+    }
+    /* Short or failed transfer: the data phase ends here */
+    if(urb->status==LIBUSB_TRANSFER_COMPLETED)
+      received+=urb->actual_length;
+    else if(urb->status==LIBUSB_TRANSFER_STALL)
+      stalled=1;
+    for(i++; i<submitted; i++)
+    {
+      const struct libusb_transfer *next=data->urb[i];
+      if(data->urb_done[i]==0)
+	libusb_cancel_transfer(data->urb[i]);
+      while(data->urb_done[i]==0)
+	libusb_handle_events_completed(data->ctx, &data->urb_done[i]);
+      /* The CSW may have been received by the next transfer */
+      if(csw_found < 0 && next->status==LIBUSB_TRANSFER_COMPLETED && next->actual_length==USBMS_CSW_SIZE)
+	csw_found=i;
+    }
+    break;
+  }
+  if(csw_found >= 0)
+    status=usbms_check_csw(data, data->urb[csw_found]->buffer, USBMS_CSW_SIZE, &residue);
+  else
+  {
+    if(stalled!=0)
+      libusb_clear_halt(data->handle, data->ep_in);
+    else if(submitted < nbr && received==submitted * USBMS_URB_SIZE)
+    {
+      log_error("%s: can't submit the bulk transfers\n", data->name);
+      usbms_reset(data);
+      return -1;
+    }
+    status=usbms_recv_csw(data, &residue);
+  }
+  if(status==1)
+  {
+    log_error("%s: READ of %u sectors at %llu failed\n", data->name, n, (long long unsigned)lba);
+    /* MEDIUM ERROR: a bad sector, a smaller READ won't help */
+    return (usbms_request_sense(data)==0x03 ? -2 : -1);
+  }
+  if(status < 0)
+    return -1;
+  if(received!=len || residue!=0)
+  {
+    log_error("%s: READ of %u sectors at %llu: %u bytes received\n", data->name, n,
+	(long long unsigned)lba, received);
+    return -1;
+  }
+  return 0;
+}
+
+static int fusbms_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_usbms_struct *data=(struct info_usbms_struct *)disk->data;
+  const unsigned int sector_size=data->sector_size;
+  unsigned int size=count;
+  unsigned int done=0;
+  if(offset >= disk->disk_real_size)
+    return 0;
+  if(size > disk->disk_real_size - offset)
+    size=disk->disk_real_size - offset;
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&data->mutex);
+#endif
+  while(done < size)
+  {
+    const uint64_t pos=offset + done;
+    const uint64_t lba=pos / sector_size;
+    const unsigned int in_sector=pos % sector_size;
+    if(in_sector==0 && size - done >= sector_size)
+    {
+      unsigned int n=(size - done) / sector_size;
+      int res;
+      if(n > data->max_transfer / sector_size)
+	n=data->max_transfer / sector_size;
+      res=usbms_read_sectors(data, (unsigned char *)buffer + done, lba, n);
+      if(res < 0)
+      {
+	if(res==-1 && n * sector_size > USBMS_MIN_TRANSFER)
+	{
+	  data->max_transfer=(n * sector_size / 2) / sector_size * sector_size;
+	  if(data->max_transfer < USBMS_MIN_TRANSFER)
+	    data->max_transfer=USBMS_MIN_TRANSFER;
+	  log_warning("%s: %u bytes by READ command\n", data->name, data->max_transfer);
+	  continue;
+	}
+	break;
+      }
+      done+=n * sector_size;
+    }
+    else
+    {
+      unsigned int part=sector_size - in_sector;
+      if(part > size - done)
+	part=size - done;
+      if(usbms_read_sectors(data, data->scratch, lba, 1) < 0)
+	break;
+      memcpy((unsigned char *)buffer + done, data->scratch + in_sector, part);
+      done+=part;
+    }
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&data->mutex);
+#endif
+  if(done < size)
+  {
+    log_error("fusbms_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read error\n",
+	(unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+	offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+    return -1;
+  }
+  return size;
+}
+
+static int fusbms_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("fusbms_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int fusbms_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *fusbms_description(disk_t *disk)
+{
+  const struct info_usbms_struct *data=(const struct info_usbms_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"USB %04x:%04x %s - %s - CHS %lu %u %u (RO)",
+      data->vid, data->pid, data->model, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *fusbms_description_short(disk_t *disk)
+{
+  const struct info_usbms_struct *data=(const struct info_usbms_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"USB %04x:%04x %s - %s (RO)",
+      data->vid, data->pid, data->model, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void usbms_free(struct info_usbms_struct *data)
+{
+  unsigned int i;
+  for(i=0; i<USBMS_URBS; i++)
+    if(data->urb[i]!=NULL)
+      libusb_free_transfer(data->urb[i]);
+  if(data->handle!=NULL)
+  {
+    if(data->interface >= 0)
+      libusb_release_interface(data->handle, data->interface);
+    libusb_close(data->handle);
+  }
+  if(data->ctx!=NULL)
+    libusb_exit(data->ctx);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&data->mutex);
+#endif
+  free(data->scratch);
+  free(data->name);
+  free(data);
+}
+
+static void fusbms_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    usbms_free((struct info_usbms_struct *)disk->data);
+    disk->data=NULL;
+  }
+  generic_clean(disk);
+}
+
+/* Find the Bulk-Only SCSI interface and its endpoints */
+static int usbms_find_interface(struct info_usbms_struct *data)
+{
+  libusb_device *dev=libusb_get_device(data->handle);
+  struct libusb_config_descriptor *config;
+  struct libusb_device_descriptor desc;
+  unsigned int i;
+  if(libusb_get_device_descriptor(dev, &desc)==0)
+  {
+    data->vid=desc.idVendor;
+    data->pid=desc.idProduct;
+  }
+  if(libusb_get_active_config_descriptor(dev, &config) < 0)
+    return -1;
+  for(i=0; i<config->bNumInterfaces; i++)
+  {
+    int j;
+    for(j=0; j<config->interface[i].num_altsetting; j++)
+    {
+      const struct libusb_interface_descriptor *alt=&config->interface[i].altsetting[j];
+      unsigned int k;
+      data->ep_in=0;
+      data->ep_out=0;
+      if(alt->bInterfaceClass!=LIBUSB_CLASS_MASS_STORAGE ||
+	  alt->bInterfaceSubClass!=0x06 || alt->bInterfaceProtocol!=0x50)
+	continue;
+      for(k=0; k<alt->bNumEndpoints; k++)
+      {
+	const struct libusb_endpoint_descriptor *ep=&alt->endpoint[k];
+	if((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)!=LIBUSB_TRANSFER_TYPE_BULK)
+	  continue;
+	if((ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)==LIBUSB_ENDPOINT_IN)
+	  data->ep_in=ep->bEndpointAddress;
+	else
+	  data->ep_out=ep->bEndpointAddress;
+      }
+      if(data->ep_in!=0 && data->ep_out!=0)
+      {
+	data->interface=alt->bInterfaceNumber;
+	libusb_free_config_descriptor(config);
+	return 0;
+      }
+    }
+  }
+  libusb_free_config_descriptor(config);
+  return -1;
+}
+
+/* INQUIRY, TEST UNIT READY and READ CAPACITY */
+static int usbms_setup(struct info_usbms_struct *data)
+{
+  unsigned char cb[16];
+  unsigned char buffer[36];
+  int transferred;
+  unsigned int i;
+  memset(cb, 0, sizeof(cb));
+  cb[0]=0x12;
+  cb[4]=sizeof(buffer);
+  memset(buffer, 0, sizeof(buffer));
+  if(usbms_command(data, cb, 6, buffer, sizeof(buffer), &transferred)==0 && transferred >= 32)
+  {
+    memcpy(data->model, &buffer[8], 24);
+    data->model[24]='\0';
+    for(i=24; i>0 && data->model[i-1]==' '; i--)
+      data->model[i-1]='\0';
+  }
+  /* The first commands may report a unit attention */
+  for(i=0; i<5; i++)
+  {
+    memset(cb, 0, sizeof(cb));
+    if(usbms_command(data, cb, 6, NULL, 0, &transferred)==0)
+      break;
+    usbms_request_sense(data);
+  }
+  memset(cb, 0, sizeof(cb));
+  cb[0]=0x25;
+  memset(buffer, 0, sizeof(buffer));
+  if(usbms_command(data, cb, 10, buffer, 8, &transferred)!=0 || transferred < 8)
+  {
+    log_error("%s: READ CAPACITY failed\n", data->name);
+    usbms_request_sense(data);
+    return -1;
+  }
+  data->sectors=(uint64_t)usbms_get_be32(&buffer[0]) + 1;
+  data->sector_size=usbms_get_be32(&buffer[4]);
+  if(data->sectors==0x100000000ULL)
+  {
+    memset(cb, 0, sizeof(cb));
+    cb[0]=0x9e;
+    cb[1]=0x10;
+    cb[13]=32;
+    memset(buffer, 0, sizeof(buffer));
+    if(usbms_command(data, cb, 16, buffer, 32, &transferred)!=0 || transferred < 12)
+    {
+      log_error("%s: READ CAPACITY(16) failed\n", data->name);
+      return -1;
+    }
+    data->sectors=(((uint64_t)usbms_get_be32(&buffer[0])<<32) | usbms_get_be32(&buffer[4])) + 1;
+    data->sector_size=usbms_get_be32(&buffer[8]);
+  }
+  if(data->sector_size < 512 || data->sector_size > USBMS_MIN_TRANSFER ||
+      (data->sector_size & (data->sector_size - 1))!=0)
+  {
+    log_error("%s: unsupported sector size %u\n", data->name, data->sector_size);
+    return -1;
+  }
+  return 0;
+}
+
+static int usbms_open(struct info_usbms_struct *data, const char *spec)
+{
+  if(strncmp(spec, "fd=", 3)==0)
+  {
+#ifdef HAVE_LIBUSB_WRAP_SYS_DEVICE
+    const int fd=atoi(spec + 3);
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000108
+    libusb_set_option(NULL, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
+#elif defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000107
+    libusb_set_option(NULL, LIBUSB_OPTION_WEAK_AUTHORITY);
+#endif
+    if(libusb_init(&data->ctx) < 0)
+      return -1;
+    if(libusb_wrap_sys_device(data->ctx, (intptr_t)fd, &data->handle) < 0)
+    {
+      log_error("%s: can't use the file descriptor %d\n", data->name, fd);
+      return -1;
+    }
+#else
+    log_error("%s: libusb_wrap_sys_device() isn't available\n", data->name);
+    return -1;
+#endif
+  }
+  else
+  {
+    unsigned int vid;
+    unsigned int pid;
+    if(sscanf(spec, "%x:%x", &vid, &pid)!=2)
+      return -1;
+    if(libusb_init(&data->ctx) < 0)
+      return -1;
+    data->handle=libusb_open_device_with_vid_pid(data->ctx, vid, pid);
+    if(data->handle==NULL)
+    {
+      log_error("%s: can't open the USB device %04x:%04x\n", data->name, vid, pid);
+      return -1;
+    }
+  }
+  if(usbms_find_interface(data) < 0)
+  {
+    log_error("%s: no Bulk-Only mass storage interface\n", data->name);
+    data->interface=-1;
+    return -1;
+  }
+  libusb_set_auto_detach_kernel_driver(data->handle, 1);
+  if(libusb_claim_interface(data->handle, data->interface) < 0)
+  {
+    log_error("%s: can't claim the interface %d\n", data->name, data->interface);
+    data->interface=-1;
+    return -1;
+  }
+  return 0;
+}
+
+disk_t *fusbms_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_usbms_struct *data;
+  const char *lun;
+  disk_t *disk;
+  unsigned int i;
+  if(strncmp(device, USBMS_PREFIX, strlen(USBMS_PREFIX))!=0)
+    return NULL;
+  data=(struct info_usbms_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->interface=-1;
+  data->max_transfer=USBMS_MAX_TRANSFER;
+  data->name=strdup(device);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&data->mutex, NULL);
+#endif
+  lun=strchr(device, ',');
+  if(lun!=NULL)
+    data->lun=atoi(lun + 1) & 0x0f;
+  if(data->name==NULL || usbms_open(data, device + strlen(USBMS_PREFIX)) < 0 ||
+      usbms_setup(data) < 0)
+  {
+    usbms_free(data);
+    return NULL;
+  }
+  for(i=0; i<USBMS_URBS; i++)
+  {
+    data->urb[i]=libusb_alloc_transfer(0);
+    if(data->urb[i]==NULL)
+    {
+      usbms_free(data);
+      return NULL;
+    }
+  }
+  data->max_transfer=USBMS_MAX_TRANSFER / data->sector_size * data->sector_size;
+  data->scratch=(unsigned char *)MALLOC(data->sector_size);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(disk->device==NULL)
+  {
+    free(disk);
+    usbms_free(data);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&fusbms_description;
+  disk->description_short=&fusbms_description_short;
+  disk->pread=&fusbms_pread;
+  disk->pwrite=&fusbms_nopwrite;
+  disk->sync=&fusbms_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&fusbms_clean;
+  disk->sector_size=data->sector_size;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=data->sectors * data->sector_size;
+  update_disk_car_fields(disk);
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: USB mass storage devices are opened read-only\n", device);
+  log_info("%s: USB %04x:%04x %s, LUN %u, %llu sectors of %u bytes\n", device,
+      data->vid, data->pid, data->model, data->lun,
+      (long long unsigned)data->sectors, data->sector_size);
+  if(verbose > 0)
+    log_verbose("%s: interface %d, endpoints 0x%02x/0x%02x\n", device,
+	data->interface, data->ep_in, data->ep_out);
+  return disk;
+}
+#endif
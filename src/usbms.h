@@ -0,0 +1,47 @@
+/*
+
+    File: usbms.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _USBMS_H
+#define _USBMS_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Device name of a USB mass storage device driven through libusb:
+ * usb:vid:pid[,lun]	the first device with this ID, in hexadecimal
+ * usb:fd=N[,lun]	file descriptor of a device opened by the Android
+ *			USB host API, UsbDeviceConnection.getFileDescriptor() */
+#define USBMS_PREFIX "usb:"
+
+#if !defined(DISABLED_FOR_FRAMAC) && defined(HAVE_LIBUSB)
+/* Open the USB mass storage device read-only,
+ * NULL if it can't be used */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fusbms_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
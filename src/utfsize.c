@@ -31,9 +31,77 @@
 #include <string.h>
 #endif
 #include <stdio.h>
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(DISABLED_FOR_FRAMAC)
+#include <emmintrin.h>
+#define UTFSIZE_SSE2
+#elif defined(__ARM_NEON) && defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__ && !defined(DISABLED_FOR_FRAMAC)
+#include <arm_neon.h>
+#define UTFSIZE_NEON
+#endif
+#include "types.h"
 #include "log.h"
 #include "utfsize.h"
 
+#ifndef DISABLED_FOR_FRAMAC
+/* Return the number of leading bytes that are plain ASCII characters
+ * accepted by UTFsize(). It may stop before the first rejected byte,
+ * the main loop takes care of the remaining ones. */
+static unsigned int UTFsize_ascii(const unsigned char *buffer, const unsigned int buf_len)
+{
+  unsigned int i=0;
+#ifdef UTFSIZE_SSE2
+  const __m128i space=_mm_set1_epi8(0x20);
+  const __m128i del=_mm_set1_epi8(0x7f);
+  const __m128i tab=_mm_set1_epi8('\t');
+  const __m128i lf=_mm_set1_epi8('\n');
+  const __m128i cr=_mm_set1_epi8('\r');
+  while(i+16 <= buf_len)
+  {
+    const __m128i v=_mm_loadu_si128((const __m128i *)&buffer[i]);
+    /* signed compare: bytes >= 0x80 are below 0x20 too */
+    const __m128i bad=_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+    const __m128i ok=_mm_or_si128(_mm_cmpeq_epi8(v, tab),
+	_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+    const unsigned int mask=_mm_movemask_epi8(_mm_andnot_si128(ok, bad));
+    if(mask!=0)
+      return i + __builtin_ctz(mask);
+    i+=16;
+  }
+#elif defined(UTFSIZE_NEON)
+  const uint8x16_t space=vdupq_n_u8(0x20);
+  const uint8x16_t del=vdupq_n_u8(0x7f);
+  const uint8x16_t tab=vdupq_n_u8('\t');
+  const uint8x16_t lf=vdupq_n_u8('\n');
+  const uint8x16_t cr=vdupq_n_u8('\r');
+  while(i+16 <= buf_len)
+  {
+    const uint8x16_t v=vld1q_u8(&buffer[i]);
+    /* unsigned compare: bytes >= 0x7f are rejected with DEL */
+    const uint8x16_t bad=vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, del));
+    const uint8x16_t ok=vorrq_u8(vceqq_u8(v, tab), vorrq_u8(vceqq_u8(v, lf), vceqq_u8(v, cr)));
+    /* 4 bits by byte, there is no movemask */
+    const uint64_t mask=vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vbicq_u8(bad, ok)), 4)), 0);
+    if(mask!=0)
+      return i + __builtin_ctzll(mask) / 4;
+    i+=16;
+  }
+#else
+  while(i+8 <= buf_len)
+  {
+    uint64_t x;
+    memcpy(&x, &buffer[i], 8);
+    /* stop on a byte >= 0x80, < 0x20 or == 0x7f */
+    if(((x & 0x8080808080808080ULL) |
+	  ((x - 0x2020202020202020ULL) & ~x & 0x8080808080808080ULL) |
+	  (((x ^ 0x7f7f7f7f7f7f7f7fULL) - 0x0101010101010101ULL) & ~(x ^ 0x7f7f7f7f7f7f7f7fULL) & 0x8080808080808080ULL)) != 0)
+      return i;
+    i+=8;
+  }
+#endif
+  return i;
+}
+#endif
+
 int UTFsize(const unsigned char *buffer, const unsigned int buf_len)
 {
   const unsigned char *p=buffer;	/* pointers to actual position in source buffer */
@@ -46,9 +114,16 @@ int UTFsize(const unsigned char *buffer, const unsigned int buf_len)
     @*/
   while(i<buf_len)
   {
+    unsigned char c;
+#ifndef DISABLED_FOR_FRAMAC
+    i+=UTFsize_ascii(p, buf_len-i);
+    p=buffer+i;
+    if(i>=buf_len)
+      break;
+#endif
     /*@ assert i < buf_len; */
     /*@ assert p == buffer + i; */
-    const unsigned char c=*p;
+    c=*p;
     if(c=='\0')
       return i;
     /* Reject some invalid UTF-8 sequences */
@@ -0,0 +1,181 @@
+/*
+
+    File: vdi.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "vdisk.h"
+#include "vdi.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define VDI_VERSION_1_1		0x00010001
+#define VDI_TYPE_DYNAMIC	1
+#define VDI_TYPE_STATIC		2
+#define VDI_BLOCK_FREE		0xffffffff
+#define VDI_BLOCK_ZERO		0xfffffffe
+#define VDI_MAX_BMAP_SIZE	(256*1024*1024)
+
+struct info_vdi_struct
+{
+  int handle;
+  uint64_t size;
+  uint32_t block_size;
+  uint32_t block_extra;
+  uint32_t offset_data;
+  uint32_t nbr_blocks;
+  uint32_t *bmap;
+};
+
+static int vdi_map(void *priv, const uint64_t offset, vdisk_extent_t *res)
+{
+  const struct info_vdi_struct *data=(const struct info_vdi_struct *)priv;
+  uint64_t block=offset / data->block_size;
+  uint32_t entry;
+  if(block >= data->nbr_blocks)
+    return -1;
+  entry=le32(data->bmap[block]);
+  res->handle=data->handle;
+  res->offset=block * data->block_size;
+  res->size=data->block_size;
+  res->host_offset=0;
+  if(entry==VDI_BLOCK_FREE || entry==VDI_BLOCK_ZERO)
+  {
+    res->type=(entry==VDI_BLOCK_FREE ? VDISK_UNALLOCATED : VDISK_ZERO);
+    while(block + 1 < data->nbr_blocks && le32(data->bmap[block + 1])==entry)
+    {
+      block++;
+      res->size+=data->block_size;
+    }
+  }
+  else
+  {
+    res->type=VDISK_DATA;
+    res->host_offset=(uint64_t)data->offset_data +
+      (uint64_t)entry * ((uint64_t)data->block_size + data->block_extra) + data->block_extra;
+  }
+  if(res->offset + res->size > data->size)
+    res->size=data->size - res->offset;
+  return 0;
+}
+
+static void vdi_clean(void *priv)
+{
+  struct info_vdi_struct *data=(struct info_vdi_struct *)priv;
+  close(data->handle);
+  free(data->bmap);
+  free(data);
+}
+
+static const vdisk_format_t vdi_format = {
+  .name = "VDI",
+  .map = &vdi_map,
+  .inflate = NULL,
+  .clean = &vdi_clean
+};
+
+disk_t *fvdi_init(const char *device, const int testdisk_mode)
+{
+  struct vdi_header hdr;
+  struct info_vdi_struct *data;
+  disk_t *disk;
+  uint32_t image_type;
+  uint32_t sector_size;
+  const int fd=open(device, O_RDONLY|O_BINARY);
+  if(fd<0)
+    return NULL;
+  if(vdisk_read_at(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      le32(hdr.signature)!=VDI_SIGNATURE)
+  {
+    close(fd);
+    return NULL;
+  }
+  if(le32(hdr.version)!=VDI_VERSION_1_1)
+  {
+    log_error("%s: unsupported VDI version 0x%08x\n", device, le32(hdr.version));
+    close(fd);
+    return NULL;
+  }
+  image_type=le32(hdr.image_type);
+  if(image_type!=VDI_TYPE_DYNAMIC && image_type!=VDI_TYPE_STATIC)
+  {
+    log_error("%s: VDI differencing images are not supported\n", device);
+    close(fd);
+    return NULL;
+  }
+  data=(struct info_vdi_struct *)MALLOC(sizeof(*data));
+  data->handle=fd;
+  data->size=le64(hdr.disk_size);
+  data->block_size=le32(hdr.block_size);
+  data->block_extra=le32(hdr.block_extra);
+  data->offset_data=le32(hdr.offset_data);
+  data->nbr_blocks=le32(hdr.blocks_in_image);
+  data->bmap=NULL;
+  if(data->block_size < DEFAULT_SECTOR_SIZE || data->block_size % DEFAULT_SECTOR_SIZE!=0 ||
+      data->nbr_blocks==0 || (uint64_t)data->nbr_blocks * sizeof(uint32_t) > VDI_MAX_BMAP_SIZE ||
+      (uint64_t)data->nbr_blocks * data->block_size < data->size)
+  {
+    log_error("%s: invalid VDI block map\n", device);
+    vdi_clean(data);
+    return NULL;
+  }
+  data->bmap=(uint32_t *)MALLOC(data->nbr_blocks * sizeof(uint32_t));
+  if(vdisk_read_at(fd, data->bmap, data->nbr_blocks * sizeof(uint32_t), le32(hdr.offset_bmap)) != (int)(data->nbr_blocks * sizeof(uint32_t)))
+  {
+    log_error("%s: can't read the VDI block map\n", device);
+    vdi_clean(data);
+    return NULL;
+  }
+  sector_size=le32(hdr.sector_size);
+  if(sector_size!=512 && sector_size!=4096)
+    sector_size=DEFAULT_SECTOR_SIZE;
+  disk=vdisk_new(device, &vdi_format, data, data->size, sector_size, NULL);
+  if(disk==NULL)
+    return NULL;
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: VDI images are opened read-only\n", device);
+  log_info("%s: VDI image, block size %u, %u/%u blocks allocated\n", device,
+      data->block_size, le32(hdr.blocks_allocated), data->nbr_blocks);
+  return disk;
+}
+#endif
@@ -0,0 +1,72 @@
+/*
+
+    File: vdi.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _VDI_H
+#define _VDI_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VDI_SIGNATURE 0xbeda107f
+#define VDI_SIGNATURE_OFFSET 0x40
+
+/* VirtualBox disk image header, version 1.1, little-endian */
+struct vdi_header
+{
+  char     text[64];
+  uint32_t signature;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t image_type;
+  uint32_t image_flags;
+  char     description[256];
+  uint32_t offset_bmap;
+  uint32_t offset_data;
+  uint32_t cylinders;
+  uint32_t heads;
+  uint32_t sectors;
+  uint32_t sector_size;
+  uint32_t unused1;
+  uint64_t disk_size;
+  uint32_t block_size;
+  uint32_t block_extra;
+  uint32_t blocks_in_image;
+  uint32_t blocks_allocated;
+  uint8_t  uuid_image[16];
+  uint8_t  uuid_last_snap[16];
+  uint8_t  uuid_link[16];
+  uint8_t  uuid_parent[16];
+} __attribute__ ((gcc_struct, __packed__));
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open read-only a dynamic or fixed VDI image, NULL for a differencing
+ * image or if the image can't be used */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fvdi_init(const char *device, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
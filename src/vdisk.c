@@ -0,0 +1,355 @@
+/*
+
+    File: vdisk.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "fnctdsk.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "vdisk.h"
+
+/* Keep the last inflated grains, a sector read inflates its whole grain */
+#define VDISK_CACHE_GRAINS	16
+
+extern const arch_fnct_t arch_none;
+
+struct vdisk_grain
+{
+  uint64_t offset;		/* guest offset, only if buffer!=NULL */
+  unsigned int size;
+  unsigned int last_used;
+  int status;			/* 0 if inflated, -1 on error */
+  unsigned char *buffer;
+};
+
+struct info_vdisk_struct
+{
+  char *file_name;
+  const vdisk_format_t *format;
+  void *priv;
+  disk_t *parent;
+  uint64_t size;
+  unsigned int grain_clock;
+  struct vdisk_grain grains[VDISK_CACHE_GRAINS];
+};
+
+static const char *vdisk_description(disk_t *disk);
+static const char *vdisk_description_short(disk_t *disk);
+static void vdisk_clean(disk_t *disk);
+static int vdisk_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset);
+static int vdisk_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset);
+static int vdisk_sync(disk_t *disk);
+
+int vdisk_read_at(const int fd, void *buffer, const unsigned int count, const uint64_t offset)
+{
+#ifdef HAVE_PREAD
+  return pread(fd, buffer, count, offset);
+#else
+  if(lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  return read(fd, buffer, count);
+#endif
+}
+
+static const struct vdisk_grain *vdisk_grain_get(struct info_vdisk_struct *data, const vdisk_extent_t *extent)
+{
+  struct vdisk_grain *grain=NULL;
+  unsigned int i;
+  for(i=0; i<VDISK_CACHE_GRAINS && grain==NULL; i++)
+    if(data->grains[i].buffer!=NULL && data->grains[i].offset==extent->offset &&
+	data->grains[i].size==extent->size)
+      grain=&data->grains[i];
+  if(grain==NULL)
+  {
+    grain=&data->grains[0];
+    for(i=1; i<VDISK_CACHE_GRAINS; i++)
+      if(data->grains[i].last_used < grain->last_used)
+	grain=&data->grains[i];
+    if(grain->buffer==NULL || grain->size!=extent->size)
+    {
+      free(grain->buffer);
+      grain->buffer=(unsigned char *)MALLOC(extent->size);
+    }
+    grain->offset=extent->offset;
+    grain->size=extent->size;
+    grain->status=data->format->inflate(data->priv, extent, grain->buffer);
+  }
+  grain->last_used=++data->grain_clock;
+  return grain;
+}
+
+static int vdisk_pread(disk_t *disk, void *buffer, const unsigned int count, const uint64_t offset)
+{
+  struct info_vdisk_struct *data=(struct info_vdisk_struct *)disk->data;
+  unsigned int done=0;
+  if(offset >= data->size)
+    return 0;
+  while(done < count && offset + done < data->size)
+  {
+    const uint64_t pos=offset + done;
+    vdisk_extent_t extent;
+    uint64_t in_extent;
+    unsigned int size;
+    if(data->format->map(data->priv, pos, &extent) < 0 ||
+	extent.offset > pos || extent.offset + extent.size <= pos)
+      break;
+    in_extent=pos - extent.offset;
+    size=(extent.size - in_extent < count - done ? extent.size - in_extent : count - done);
+    if(size > data->size - pos)
+      size=data->size - pos;
+    switch(extent.type)
+    {
+      case VDISK_UNALLOCATED:
+	if(data->parent!=NULL)
+	{
+	  if(data->parent->pread(data->parent, (unsigned char *)buffer + done, size, pos) != (int)size)
+	    memset((unsigned char *)buffer + done, 0, size);
+	}
+	else
+	  memset((unsigned char *)buffer + done, 0, size);
+	break;
+      case VDISK_ZERO:
+	memset((unsigned char *)buffer + done, 0, size);
+	break;
+      case VDISK_COMPRESSED:
+	{
+	  const struct vdisk_grain *grain=vdisk_grain_get(data, &extent);
+	  if(grain->status < 0)
+	  {
+	    log_error("%s: can't inflate %s grain at %llu\n", data->file_name,
+		data->format->name, (long long unsigned)extent.offset);
+	    return (done > 0 ? (int)done : -1);
+	  }
+	  memcpy((unsigned char *)buffer + done, grain->buffer + in_extent, size);
+	}
+	break;
+      case VDISK_DATA:
+	{
+	  const uint64_t host_offset=extent.host_offset + in_extent;
+	  int res;
+	  /* Read the following grains at once when they are stored after
+	   * this one */
+	  while(size < count - done && pos + size < data->size)
+	  {
+	    vdisk_extent_t next;
+	    unsigned int next_size;
+	    if(data->format->map(data->priv, pos + size, &next) < 0 ||
+		next.type!=VDISK_DATA || next.handle!=extent.handle ||
+		next.offset!=pos + size ||
+		next.host_offset!=host_offset + size)
+	      break;
+	    next_size=(next.size < count - done - size ? next.size : count - done - size);
+	    if(next_size > data->size - pos - size)
+	      next_size=data->size - pos - size;
+	    size+=next_size;
+	  }
+	  res=vdisk_read_at(extent.handle, (unsigned char *)buffer + done, size, host_offset);
+	  if(res != (int)size)
+	  {
+	    log_error("vdisk_pread(xxx,%u,buffer,%lu(%u/%u/%u)) read err: %s\n",
+		(unsigned)(count/disk->sector_size), (long unsigned)(pos/disk->sector_size),
+		offset2cylinder(disk,pos), offset2head(disk,pos), offset2sector(disk,pos),
+		(res<0 ? strerror(errno) : "short read"));
+	    /* The end of a truncated image reads as zeroes */
+	    if(res < 0)
+	      return (done > 0 ? (int)done : -1);
+	    memset((unsigned char *)buffer + done + res, 0, size - res);
+	  }
+	}
+	break;
+    }
+    done+=size;
+  }
+  if(done==0 && count > 0)
+    return -1;
+  return done;
+}
+
+static int vdisk_nopwrite(disk_t *disk, const void *buffer, const unsigned int count, const uint64_t offset)
+{
+  log_error("vdisk_nopwrite(xx,%u,buffer,%lu(%u/%u/%u)) write refused\n",
+      (unsigned)(count/disk->sector_size), (long unsigned)(offset/disk->sector_size),
+      offset2cylinder(disk,offset), offset2head(disk,offset), offset2sector(disk,offset));
+  return -1;
+}
+
+static int vdisk_sync(disk_t *disk)
+{
+  errno=EINVAL;
+  return -1;
+}
+
+static const char *vdisk_description(disk_t *disk)
+{
+  const struct info_vdisk_struct *data=(const struct info_vdisk_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_txt, sizeof(disk->description_txt),"Image %s - %s - CHS %lu %u %u (RO)",
+      data->file_name, buffer_disk_size,
+      disk->geom.cylinders, disk->geom.heads_per_cylinder, disk->geom.sectors_per_head);
+  return disk->description_txt;
+}
+
+static const char *vdisk_description_short(disk_t *disk)
+{
+  const struct info_vdisk_struct *data=(const struct info_vdisk_struct *)disk->data;
+  char buffer_disk_size[100];
+  size_to_unit(disk->disk_size, buffer_disk_size);
+  snprintf(disk->description_short_txt, sizeof(disk->description_txt),"Image %s - %s (RO)",
+      data->file_name, buffer_disk_size);
+  return disk->description_short_txt;
+}
+
+static void vdisk_clean(disk_t *disk)
+{
+  if(disk->data!=NULL)
+  {
+    struct info_vdisk_struct *data=(struct info_vdisk_struct *)disk->data;
+    unsigned int i;
+    for(i=0; i<VDISK_CACHE_GRAINS; i++)
+      free(data->grains[i].buffer);
+    data->format->clean(data->priv);
+    if(data->parent!=NULL)
+      data->parent->clean(data->parent);
+    free(data->file_name);
+  }
+  generic_clean(disk);
+}
+
+int vdisk_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg)
+{
+  struct info_vdisk_struct *data;
+  uint64_t pos=start;
+  uint64_t hole_start=0;
+  int in_hole=0;
+  int nbr=0;
+  if(disk->clean!=&vdisk_clean)
+  {
+    errno=EINVAL;
+    return -1;
+  }
+  data=(struct info_vdisk_struct *)disk->data;
+  while(pos <= end && pos < data->size)
+  {
+    vdisk_extent_t extent;
+    uint64_t extent_end;
+    if(data->format->map(data->priv, pos, &extent) < 0 ||
+	extent.offset > pos || extent.offset + extent.size <= pos)
+      break;
+    extent_end=extent.offset + extent.size - 1;
+    if(extent_end > end)
+      extent_end=end;
+    if(extent.type==VDISK_ZERO ||
+	(extent.type==VDISK_UNALLOCATED && data->parent==NULL))
+    {
+      if(in_hole==0)
+	hole_start=pos;
+      in_hole=1;
+    }
+    else
+    {
+      if(in_hole!=0)
+      {
+	fnct(hole_start, pos - 1, arg);
+	nbr++;
+	in_hole=0;
+      }
+      /* Only the holes of the parent are left */
+      if(extent.type==VDISK_UNALLOCATED)
+      {
+	const int res=disk_find_unmapped(data->parent, pos, extent_end, fnct, arg);
+	if(res > 0)
+	  nbr+=res;
+      }
+    }
+    pos=extent_end + 1;
+  }
+  if(in_hole!=0)
+  {
+    fnct(hole_start, pos - 1, arg);
+    nbr++;
+  }
+  return nbr;
+}
+
+disk_t *vdisk_new(const char *device, const vdisk_format_t *format, void *priv, const uint64_t size, const unsigned int sector_size, disk_t *parent)
+{
+  struct info_vdisk_struct *data;
+  disk_t *disk;
+  if(parent!=NULL && parent->disk_size < size)
+    log_warning("%s: the parent image %s is smaller than the %s image\n",
+	device, parent->device, format->name);
+  data=(struct info_vdisk_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->format=format;
+  data->priv=priv;
+  data->parent=parent;
+  data->size=size;
+  data->file_name=strdup(device);
+  disk=(disk_t *)MALLOC(sizeof(*disk));
+  init_disk(disk);
+  disk->arch=&arch_none;
+  disk->device=strdup(device);
+  if(data->file_name==NULL || disk->device==NULL)
+  {
+    free(disk->device);
+    free(disk);
+    free(data->file_name);
+    free(data);
+    format->clean(priv);
+    if(parent!=NULL)
+      parent->clean(parent);
+    return NULL;
+  }
+  disk->data=data;
+  disk->description=&vdisk_description;
+  disk->description_short=&vdisk_description_short;
+  disk->pread=&vdisk_pread;
+  disk->pwrite=&vdisk_nopwrite;
+  disk->sync=&vdisk_sync;
+  disk->access_mode=TESTDISK_O_RDONLY;
+  disk->clean=&vdisk_clean;
+  disk->sector_size=sector_size;
+  disk->geom.cylinders=0;
+  disk->geom.heads_per_cylinder=1;
+  disk->geom.sectors_per_head=1;
+  disk->geom.bytes_per_sector=disk->sector_size;
+  disk->disk_real_size=size;
+  update_disk_car_fields(disk);
+  return disk;
+}
+#endif
@@ -0,0 +1,83 @@
+/*
+
+    File: vdisk.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _VDISK_H
+#define _VDISK_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Common code of the sparse virtual disk images (VMDK, VDI, VHDX): the
+ * format only translates a guest offset into an extent, the reads, the
+ * grain cache, the parent image and the holes are handled here */
+
+typedef enum {
+  VDISK_UNALLOCATED=0,	/* read from the parent image, zeroes without parent */
+  VDISK_ZERO=1,		/* reads as zeroes */
+  VDISK_DATA=2,		/* stored as is at host_offset */
+  VDISK_COMPRESSED=3	/* one compressed grain, see inflate() */
+} vdisk_extent_type_t;
+
+typedef struct
+{
+  vdisk_extent_type_t type;
+  uint64_t offset;		/* guest offset of the extent */
+  uint64_t size;
+  int handle;			/* file holding the data */
+  uint64_t host_offset;		/* DATA: data of offset, COMPRESSED: the grain */
+} vdisk_extent_t;
+
+typedef struct
+{
+  const char *name;
+  /* Describe the extent holding the guest offset, -1 on error */
+  int (*map)(void *priv, const uint64_t offset, vdisk_extent_t *extent);
+  /* Inflate the compressed grain, extent->size bytes, -1 on error */
+  int (*inflate)(void *priv, const vdisk_extent_t *extent, unsigned char *buffer);
+  void (*clean)(void *priv);
+} vdisk_format_t;
+
+/* Create a read-only disk of size bytes, format and priv describe the
+ * image. The disk owns priv and parent, they are freed on error */
+/*@
+  @ requires valid_read_string(device);
+  @ requires \valid_read(format);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *vdisk_new(const char *device, const vdisk_format_t *format, void *priv, const uint64_t size, const unsigned int sector_size, disk_t *parent);
+
+/* Report the areas of a disk returned by vdisk_new() that hold no data,
+ * see disk_find_unmapped(). -1 with errno EINVAL for another disk */
+/*@
+  @ requires \valid_read(disk);
+  @ requires valid_disk(disk);
+  @*/
+int vdisk_find_unmapped(const disk_t *disk, const uint64_t start, const uint64_t end, void (*fnct)(const uint64_t start, const uint64_t end, void *arg), void *arg);
+
+/* pread() on a file, with lseek()/read() when pread isn't available */
+int vdisk_read_at(const int fd, void *buffer, const unsigned int count, const uint64_t offset);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,367 @@
+/*
+
+    File: vhdx.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "vdisk.h"
+#include "vhdx.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define VHDX_HEADER_SIZE	(4*1024)
+#define VHDX_HEADER1_OFFSET	(64*1024)
+#define VHDX_HEADER2_OFFSET	(128*1024)
+#define VHDX_REGION_SIZE	(64*1024)
+#define VHDX_REGION1_OFFSET	(192*1024)
+#define VHDX_REGION2_OFFSET	(256*1024)
+#define VHDX_METADATA_TABLE_SIZE (64*1024)
+#define VHDX_MAX_BAT_SIZE	(256*1024*1024)
+
+#define VHDX_BAT_STATE_MASK	7
+#define VHDX_BAT_NOT_PRESENT	0
+#define VHDX_BAT_UNDEFINED	1
+#define VHDX_BAT_ZERO		2
+#define VHDX_BAT_UNMAPPED	3
+#define VHDX_BAT_FULLY_PRESENT	6
+#define VHDX_BAT_OFFSET_SHIFT	20
+
+#define VHDX_PARAMS_HAS_PARENT	(1U<<1)
+
+static const uint8_t vhdx_bat_guid[16] = {
+  0x66, 0x77, 0xc2, 0x2d, 0x23, 0xf6, 0x00, 0x42, 0x9d, 0x64, 0x11, 0x5e, 0x9b, 0xfd, 0x4a, 0x08 };
+static const uint8_t vhdx_metadata_guid[16] = {
+  0x06, 0xa2, 0x7c, 0x8b, 0x90, 0x47, 0x9a, 0x4b, 0xb8, 0xfe, 0x57, 0x5f, 0x05, 0x0f, 0x88, 0x6e };
+static const uint8_t vhdx_file_parameters_guid[16] = {
+  0x37, 0x67, 0xa1, 0xca, 0x36, 0xfa, 0x43, 0x4d, 0xb3, 0xb6, 0x33, 0xf0, 0xaa, 0x44, 0xe7, 0x6b };
+static const uint8_t vhdx_disk_size_guid[16] = {
+  0x24, 0x42, 0xa5, 0x2f, 0x1b, 0xcd, 0x76, 0x48, 0xb2, 0x11, 0x5d, 0xbe, 0xd8, 0x3b, 0xf4, 0xb8 };
+static const uint8_t vhdx_sector_size_guid[16] = {
+  0x1d, 0xbf, 0x41, 0x81, 0x6f, 0xa9, 0x09, 0x47, 0xba, 0x47, 0xf2, 0x33, 0xa8, 0xfa, 0xab, 0x5f };
+
+struct info_vhdx_struct
+{
+  int handle;
+  uint64_t size;
+  uint32_t block_size;
+  uint32_t chunk_ratio;		/* data blocks per sector bitmap block */
+  uint64_t nbr_blocks;
+  uint64_t nbr_entries;
+  uint64_t *bat;
+};
+
+static uint32_t vhdx_crc32c(const unsigned char *buffer, const unsigned int size)
+{
+  uint32_t crc=0xffffffff;
+  unsigned int i;
+  for(i=0; i<size; i++)
+  {
+    unsigned int j;
+    crc^=buffer[i];
+    for(j=0; j<8; j++)
+      crc=(crc >> 1) ^ (0x82f63b78 & (0U - (crc & 1)));
+  }
+  return ~crc;
+}
+
+/* The checksum is computed with the checksum field set to 0 */
+static int vhdx_check_crc(unsigned char *buffer, const unsigned int size)
+{
+  const uint32_t checksum=le32(*(const uint32_t *)&buffer[4]);
+  memset(&buffer[4], 0, 4);
+  return (vhdx_crc32c(buffer, size)==checksum ? 0 : -1);
+}
+
+static uint64_t vhdx_bat_entry(const struct info_vhdx_struct *data, const uint64_t block)
+{
+  /* A sector bitmap entry follows each chunk of data block entries */
+  const uint64_t index=block + block / data->chunk_ratio;
+  if(index >= data->nbr_entries)
+    return VHDX_BAT_NOT_PRESENT;
+  return le64(data->bat[index]);
+}
+
+/* Blocks trimmed or left undefined may still hold their old data */
+static vdisk_extent_type_t vhdx_block_type(const uint64_t entry)
+{
+  switch(entry & VHDX_BAT_STATE_MASK)
+  {
+    case VHDX_BAT_FULLY_PRESENT:
+      return VDISK_DATA;
+    case VHDX_BAT_UNDEFINED:
+    case VHDX_BAT_UNMAPPED:
+      if((entry >> VHDX_BAT_OFFSET_SHIFT)!=0)
+	return VDISK_DATA;
+      return VDISK_UNALLOCATED;
+    case VHDX_BAT_ZERO:
+      return VDISK_ZERO;
+    default:
+      return VDISK_UNALLOCATED;
+  }
+}
+
+static int vhdx_map(void *priv, const uint64_t offset, vdisk_extent_t *res)
+{
+  const struct info_vhdx_struct *data=(const struct info_vhdx_struct *)priv;
+  uint64_t block=offset / data->block_size;
+  uint64_t entry;
+  if(block >= data->nbr_blocks)
+    return -1;
+  entry=vhdx_bat_entry(data, block);
+  res->handle=data->handle;
+  res->offset=block * data->block_size;
+  res->size=data->block_size;
+  res->host_offset=0;
+  res->type=vhdx_block_type(entry);
+  if(res->type==VDISK_DATA)
+    res->host_offset=(entry >> VHDX_BAT_OFFSET_SHIFT) << 20;
+  else
+  {
+    while(block + 1 < data->nbr_blocks &&
+	vhdx_block_type(vhdx_bat_entry(data, block + 1))==res->type)
+    {
+      block++;
+      res->size+=data->block_size;
+    }
+  }
+  if(res->offset + res->size > data->size)
+    res->size=data->size - res->offset;
+  return 0;
+}
+
+static void vhdx_clean(void *priv)
+{
+  struct info_vhdx_struct *data=(struct info_vhdx_struct *)priv;
+  close(data->handle);
+  free(data->bat);
+  free(data);
+}
+
+static const vdisk_format_t vhdx_format = {
+  .name = "VHDX",
+  .map = &vhdx_map,
+  .inflate = NULL,
+  .clean = &vhdx_clean
+};
+
+/* Use the valid header with the highest sequence number */
+static int vhdx_read_header(const int fd, const char *device, struct vhdx_header *hdr)
+{
+  unsigned char *buffer=(unsigned char *)MALLOC(VHDX_HEADER_SIZE);
+  const uint64_t offsets[2]={ VHDX_HEADER1_OFFSET, VHDX_HEADER2_OFFSET };
+  int found=0;
+  unsigned int i;
+  for(i=0; i<2; i++)
+  {
+    const struct vhdx_header *h=(const struct vhdx_header *)buffer;
+    if(vdisk_read_at(fd, buffer, VHDX_HEADER_SIZE, offsets[i]) != VHDX_HEADER_SIZE ||
+	memcmp(h->signature, "head", 4)!=0 || vhdx_check_crc(buffer, VHDX_HEADER_SIZE) < 0)
+      continue;
+    if(found==0 || le64(h->sequence_number) > le64(hdr->sequence_number))
+      memcpy(hdr, buffer, sizeof(*hdr));
+    found=1;
+  }
+  free(buffer);
+  if(found==0)
+  {
+    log_error("%s: no valid VHDX header\n", device);
+    return -1;
+  }
+  return 0;
+}
+
+/* Find the BAT and the metadata regions */
+static int vhdx_read_regions(const int fd, const char *device, struct vhdx_region_entry *bat, struct vhdx_region_entry *metadata)
+{
+  unsigned char *buffer=(unsigned char *)MALLOC(VHDX_REGION_SIZE);
+  const uint64_t offsets[2]={ VHDX_REGION1_OFFSET, VHDX_REGION2_OFFSET };
+  unsigned int i;
+  for(i=0; i<2; i++)
+  {
+    const struct vhdx_region_table_header *h=(const struct vhdx_region_table_header *)buffer;
+    const struct vhdx_region_entry *entries=(const struct vhdx_region_entry *)(buffer + sizeof(*h));
+    unsigned int j;
+    unsigned int nbr;
+    if(vdisk_read_at(fd, buffer, VHDX_REGION_SIZE, offsets[i]) != VHDX_REGION_SIZE ||
+	memcmp(h->signature, "regi", 4)!=0 || vhdx_check_crc(buffer, VHDX_REGION_SIZE) < 0)
+      continue;
+    nbr=le32(h->entry_count);
+    if(nbr > (VHDX_REGION_SIZE - sizeof(*h)) / sizeof(*entries))
+      continue;
+    memset(bat, 0, sizeof(*bat));
+    memset(metadata, 0, sizeof(*metadata));
+    for(j=0; j<nbr; j++)
+    {
+      if(memcmp(entries[j].guid, vhdx_bat_guid, 16)==0)
+	memcpy(bat, &entries[j], sizeof(*bat));
+      else if(memcmp(entries[j].guid, vhdx_metadata_guid, 16)==0)
+	memcpy(metadata, &entries[j], sizeof(*metadata));
+      else if((le32(entries[j].required) & 1)!=0)
+      {
+	log_error("%s: unknown required VHDX region\n", device);
+	free(buffer);
+	return -1;
+      }
+    }
+    free(buffer);
+    if(bat->length==0 || metadata->length==0)
+    {
+      log_error("%s: VHDX BAT or metadata region missing\n", device);
+      return -1;
+    }
+    return 0;
+  }
+  free(buffer);
+  log_error("%s: no valid VHDX region table\n", device);
+  return -1;
+}
+
+/* Copy the metadata item, -1 if it isn't found */
+static int vhdx_metadata_item(const unsigned char *table, const unsigned int table_size, const int fd, const uint64_t region_offset, const uint8_t *item_id, void *item, const unsigned int item_size)
+{
+  const struct vhdx_metadata_header *h=(const struct vhdx_metadata_header *)table;
+  const struct vhdx_metadata_entry *entries=(const struct vhdx_metadata_entry *)(table + sizeof(*h));
+  const unsigned int nbr=le16(h->entry_count);
+  unsigned int i;
+  if(nbr > (table_size - sizeof(*h)) / sizeof(*entries))
+    return -1;
+  for(i=0; i<nbr; i++)
+  {
+    if(memcmp(entries[i].item_id, item_id, 16)==0 && le32(entries[i].length) >= item_size)
+      return (vdisk_read_at(fd, item, item_size, region_offset + le32(entries[i].offset))==(int)item_size ? 0 : -1);
+  }
+  return -1;
+}
+
+static int vhdx_read_metadata(struct info_vhdx_struct *data, const char *device, const struct vhdx_region_entry *metadata, uint32_t *sector_size)
+{
+  const uint64_t region_offset=le64(metadata->file_offset);
+  unsigned char *table=(unsigned char *)MALLOC(VHDX_METADATA_TABLE_SIZE);
+  uint32_t params[2];
+  uint64_t disk_size;
+  int res=-1;
+  if(vdisk_read_at(data->handle, table, VHDX_METADATA_TABLE_SIZE, region_offset) != VHDX_METADATA_TABLE_SIZE ||
+      memcmp(table, "metadata", 8)!=0)
+    log_error("%s: invalid VHDX metadata table\n", device);
+  else if(vhdx_metadata_item(table, VHDX_METADATA_TABLE_SIZE, data->handle, region_offset, vhdx_file_parameters_guid, params, sizeof(params)) < 0 ||
+      vhdx_metadata_item(table, VHDX_METADATA_TABLE_SIZE, data->handle, region_offset, vhdx_disk_size_guid, &disk_size, sizeof(disk_size)) < 0 ||
+      vhdx_metadata_item(table, VHDX_METADATA_TABLE_SIZE, data->handle, region_offset, vhdx_sector_size_guid, sector_size, sizeof(*sector_size)) < 0)
+    log_error("%s: VHDX metadata item missing\n", device);
+  else if((le32(params[1]) & VHDX_PARAMS_HAS_PARENT)!=0)
+    log_error("%s: VHDX differencing images are not supported\n", device);
+  else
+  {
+    data->block_size=le32(params[0]);
+    data->size=le64(disk_size);
+    *sector_size=le32(*sector_size);
+    /* Block size: 1 MiB to 256 MiB, power of 2 */
+    if(data->block_size < 1024*1024 || data->block_size > 256*1024*1024 ||
+	(data->block_size & (data->block_size - 1))!=0 ||
+	(*sector_size!=512 && *sector_size!=4096))
+      log_error("%s: invalid VHDX block or sector size\n", device);
+    else
+      res=0;
+  }
+  free(table);
+  return res;
+}
+
+disk_t *fvhdx_init(const char *device, const int testdisk_mode)
+{
+  struct vhdx_header hdr;
+  struct vhdx_region_entry bat;
+  struct vhdx_region_entry metadata;
+  struct info_vhdx_struct *data;
+  disk_t *disk;
+  uint32_t sector_size;
+  char signature[8];
+  unsigned int i;
+  const int fd=open(device, O_RDONLY|O_BINARY);
+  if(fd<0)
+    return NULL;
+  if(vdisk_read_at(fd, signature, sizeof(signature), 0) != sizeof(signature) ||
+      memcmp(signature, VHDX_FILE_SIGNATURE, 8)!=0 ||
+      vhdx_read_header(fd, device, &hdr) < 0 ||
+      vhdx_read_regions(fd, device, &bat, &metadata) < 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  for(i=0; i<16 && hdr.log_guid[i]==0; i++);
+  if(i<16)
+    log_warning("%s: the VHDX log hasn't been replayed, the latest writes may be missing\n", device);
+  data=(struct info_vhdx_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  data->handle=fd;
+  if(vhdx_read_metadata(data, device, &metadata, &sector_size) < 0)
+  {
+    vhdx_clean(data);
+    return NULL;
+  }
+  data->chunk_ratio=((uint64_t)1 << 23) * sector_size / data->block_size;
+  data->nbr_blocks=(data->size + data->block_size - 1) / data->block_size;
+  data->nbr_entries=le32(bat.length) / sizeof(uint64_t);
+  if(data->chunk_ratio==0 || data->size==0 ||
+      le32(bat.length) > VHDX_MAX_BAT_SIZE ||
+      data->nbr_entries < data->nbr_blocks + (data->nbr_blocks - 1) / data->chunk_ratio)
+  {
+    log_error("%s: invalid VHDX BAT\n", device);
+    vhdx_clean(data);
+    return NULL;
+  }
+  data->bat=(uint64_t *)MALLOC(data->nbr_entries * sizeof(uint64_t));
+  if(vdisk_read_at(fd, data->bat, data->nbr_entries * sizeof(uint64_t), le64(bat.file_offset)) != (int)(data->nbr_entries * sizeof(uint64_t)))
+  {
+    log_error("%s: can't read the VHDX BAT\n", device);
+    vhdx_clean(data);
+    return NULL;
+  }
+  disk=vdisk_new(device, &vhdx_format, data, data->size, sector_size, NULL);
+  if(disk==NULL)
+    return NULL;
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: VHDX images are opened read-only\n", device);
+  log_info("%s: VHDX image, block size %u\n", device, data->block_size);
+  return disk;
+}
+#endif
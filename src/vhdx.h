@@ -0,0 +1,91 @@
+/*
+
+    File: vhdx.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _VHDX_H
+#define _VHDX_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VHDX_FILE_SIGNATURE "vhdxfile"
+
+/* Structures of a VHDX image, little-endian */
+struct vhdx_header
+{
+  char     signature[4];	/* "head" */
+  uint32_t checksum;		/* CRC-32C of the 4 KiB header */
+  uint64_t sequence_number;
+  uint8_t  file_write_guid[16];
+  uint8_t  data_write_guid[16];
+  uint8_t  log_guid[16];
+  uint16_t log_version;
+  uint16_t version;
+  uint32_t log_length;
+  uint64_t log_offset;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct vhdx_region_table_header
+{
+  char     signature[4];	/* "regi" */
+  uint32_t checksum;		/* CRC-32C of the 64 KiB table */
+  uint32_t entry_count;
+  uint32_t reserved;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct vhdx_region_entry
+{
+  uint8_t  guid[16];
+  uint64_t file_offset;
+  uint32_t length;
+  uint32_t required;
+} __attribute__ ((gcc_struct, __packed__));
+
+struct vhdx_metadata_header
+{
+  char     signature[8];	/* "metadata" */
+  uint16_t reserved;
+  uint16_t entry_count;
+  uint32_t reserved2[5];
+} __attribute__ ((gcc_struct, __packed__));
+
+struct vhdx_metadata_entry
+{
+  uint8_t  item_id[16];
+  uint32_t offset;		/* from the start of the metadata region */
+  uint32_t length;
+  uint32_t flags;
+  uint32_t reserved;
+} __attribute__ ((gcc_struct, __packed__));
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open read-only a fixed or dynamic VHDX image, NULL for a differencing
+ * image or if the image can't be used */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fvhdx_init(const char *device, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -0,0 +1,658 @@
+/*
+
+    File: vmdk.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#if !defined(DISABLED_FOR_FRAMAC)
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <errno.h>
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "hdaccess.h"
+#include "log.h"
+#include "vdisk.h"
+#include "vmdk.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define VMDK4_FLAG_ZERO_GRAIN	(1U<<2)
+#define VMDK4_FLAG_COMPRESS	(1U<<16)
+#define VMDK4_COMPRESSION_DEFLATE 1
+#define VMDK4_GD_AT_END		0xffffffffffffffffULL
+#define VMDK3_GTES_PER_GT	4096
+#define VMDK_MAX_GRAIN_SIZE	(2*1024*1024)
+#define VMDK_MAX_GD_SIZE	(64*1024*1024)
+#define VMDK_MAX_DESCRIPTOR	(1024*1024)
+#define VMDK_GT_CACHE		64
+
+typedef enum { VMDK_EXTENT_ZERO=0, VMDK_EXTENT_FLAT=1, VMDK_EXTENT_SPARSE=2 } vmdk_extent_type_t;
+
+struct vmdk_extent
+{
+  vmdk_extent_type_t type;
+  uint64_t start;		/* guest offset */
+  uint64_t size;
+  int handle;
+  char *file_name;
+  uint64_t flat_offset;
+  /* sparse extent */
+  uint64_t grain_size;
+  unsigned int gt_entries;
+  uint32_t gd_entries;
+  uint32_t *gd;			/* sector of each grain table */
+  int compressed;
+  int zero_grain;
+};
+
+struct vmdk_gt
+{
+  const struct vmdk_extent *extent;	/* NULL if unused */
+  uint32_t gd_index;
+  unsigned int entries;
+  unsigned int last_used;
+  uint32_t *table;
+};
+
+struct info_vmdk_struct
+{
+  unsigned int nbr_extents;
+  struct vmdk_extent *extents;
+  struct vmdk_gt gt[VMDK_GT_CACHE];
+  unsigned int gt_clock;
+  unsigned char *cbuffer;	/* compressed grain */
+};
+
+static const struct vmdk_extent *vmdk_extent_find(const struct info_vmdk_struct *data, const uint64_t offset)
+{
+  unsigned int first=0;
+  unsigned int last=data->nbr_extents;
+  while(first < last)
+  {
+    const unsigned int i=first + (last - first) / 2;
+    const struct vmdk_extent *extent=&data->extents[i];
+    if(offset < extent->start)
+      last=i;
+    else if(offset >= extent->start + extent->size)
+      first=i + 1;
+    else
+      return extent;
+  }
+  return NULL;
+}
+
+static const uint32_t *vmdk_gt_get(struct info_vmdk_struct *data, const struct vmdk_extent *extent, const uint32_t gd_index)
+{
+  const unsigned int gt_size=extent->gt_entries * sizeof(uint32_t);
+  uint64_t gt_offset;
+  struct vmdk_gt *gt=NULL;
+  unsigned int i;
+  for(i=0; i<VMDK_GT_CACHE && gt==NULL; i++)
+    if(data->gt[i].extent==extent && data->gt[i].gd_index==gd_index)
+      gt=&data->gt[i];
+  if(gt==NULL)
+  {
+    gt=&data->gt[0];
+    for(i=1; i<VMDK_GT_CACHE; i++)
+      if(data->gt[i].last_used < gt->last_used)
+	gt=&data->gt[i];
+    gt->extent=NULL;
+    if(gt->table==NULL || gt->entries!=extent->gt_entries)
+    {
+      free(gt->table);
+      gt->table=(uint32_t *)MALLOC(gt_size);
+      gt->entries=extent->gt_entries;
+    }
+    gt_offset=(uint64_t)le32(extent->gd[gd_index]) * DEFAULT_SECTOR_SIZE;
+    if(vdisk_read_at(extent->handle, gt->table, gt_size, gt_offset) != (int)gt_size)
+    {
+      log_error("%s: can't read VMDK grain table at %llu\n", extent->file_name, (long long unsigned)gt_offset);
+      return NULL;
+    }
+    gt->extent=extent;
+    gt->gd_index=gd_index;
+  }
+  gt->last_used=++data->gt_clock;
+  return gt->table;
+}
+
+static int vmdk_sparse_map(struct info_vmdk_struct *data, const struct vmdk_extent *extent, const uint64_t offset, vdisk_extent_t *res)
+{
+  const uint64_t grain=(offset - extent->start) / extent->grain_size;
+  uint64_t gd_index=grain / extent->gt_entries;
+  unsigned int gt_index=grain % extent->gt_entries;
+  const uint32_t *gt;
+  uint32_t entry;
+  if(gd_index >= extent->gd_entries || extent->gd[gd_index]==0)
+  {
+    /* No grain table, merge the following unallocated tables */
+    res->type=VDISK_UNALLOCATED;
+    res->offset=extent->start + gd_index * extent->gt_entries * extent->grain_size;
+    while(gd_index + 1 < extent->gd_entries && extent->gd[gd_index + 1]==0)
+      gd_index++;
+    res->size=extent->start + (gd_index + 1) * extent->gt_entries * extent->grain_size - res->offset;
+    if(gd_index + 1 >= extent->gd_entries)
+      res->size=extent->start + extent->size - res->offset;
+    return 0;
+  }
+  gt=vmdk_gt_get(data, extent, gd_index);
+  if(gt==NULL)
+    return -1;
+  entry=le32(gt[gt_index]);
+  res->offset=extent->start + grain * extent->grain_size;
+  res->size=extent->grain_size;
+  if(entry==0 || (entry==1 && extent->zero_grain!=0))
+  {
+    res->type=(entry==0 ? VDISK_UNALLOCATED : VDISK_ZERO);
+    while(gt_index + 1 < extent->gt_entries && le32(gt[gt_index + 1])==entry)
+    {
+      gt_index++;
+      res->size+=extent->grain_size;
+    }
+  }
+  else
+  {
+    res->type=(extent->compressed!=0 ? VDISK_COMPRESSED : VDISK_DATA);
+    res->host_offset=(uint64_t)entry * DEFAULT_SECTOR_SIZE;
+  }
+  return 0;
+}
+
+static int vmdk_map(void *priv, const uint64_t offset, vdisk_extent_t *res)
+{
+  struct info_vmdk_struct *data=(struct info_vmdk_struct *)priv;
+  const struct vmdk_extent *extent=vmdk_extent_find(data, offset);
+  if(extent==NULL)
+    return -1;
+  res->handle=extent->handle;
+  res->host_offset=0;
+  switch(extent->type)
+  {
+    case VMDK_EXTENT_ZERO:
+      res->type=VDISK_ZERO;
+      res->offset=extent->start;
+      res->size=extent->size;
+      return 0;
+    case VMDK_EXTENT_FLAT:
+      res->type=VDISK_DATA;
+      res->offset=extent->start;
+      res->size=extent->size;
+      res->host_offset=extent->flat_offset;
+      return 0;
+    case VMDK_EXTENT_SPARSE:
+      if(vmdk_sparse_map(data, extent, offset, res) < 0)
+	return -1;
+      /* The descriptor may use less than the capacity of the extent */
+      if(res->offset + res->size > extent->start + extent->size)
+	res->size=extent->start + extent->size - res->offset;
+      return 0;
+  }
+  return -1;
+}
+
+/* A compressed grain starts with its sector number and its size,
+ * followed by zlib data */
+static int vmdk_inflate(void *priv, const vdisk_extent_t *res, unsigned char *buffer)
+{
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+  struct info_vmdk_struct *data=(struct info_vmdk_struct *)priv;
+  const struct vmdk_extent *extent=vmdk_extent_find(data, res->offset);
+  unsigned char marker[12];
+  uint32_t csize;
+  z_stream stream;
+  int res_inflate;
+  if(extent==NULL)
+    return -1;
+  if(vdisk_read_at(res->handle, marker, sizeof(marker), res->host_offset) != sizeof(marker))
+    return -1;
+  if(le64(*(const uint64_t *)marker) * DEFAULT_SECTOR_SIZE != res->offset - extent->start)
+  {
+    log_error("%s: VMDK grain at %llu doesn't match its marker\n", extent->file_name,
+	(long long unsigned)res->host_offset);
+    return -1;
+  }
+  csize=le32(*(const uint32_t *)&marker[8]);
+  if(csize==0 || csize > 2 * extent->grain_size)
+    return -1;
+  if(data->cbuffer==NULL)
+    data->cbuffer=(unsigned char *)MALLOC(2 * VMDK_MAX_GRAIN_SIZE);
+  if(vdisk_read_at(res->handle, data->cbuffer, csize, res->host_offset + sizeof(marker)) != (int)csize)
+    return -1;
+  memset(&stream, 0, sizeof(stream));
+  if(inflateInit(&stream) != Z_OK)
+    return -1;
+  stream.next_in=data->cbuffer;
+  stream.avail_in=csize;
+  stream.next_out=buffer;
+  stream.avail_out=res->size;
+  res_inflate=inflate(&stream, Z_FINISH);
+  inflateEnd(&stream);
+  /* The last grain may be cut by the end of the extent */
+  if(res_inflate!=Z_STREAM_END && stream.avail_out!=0)
+    return -1;
+  if(stream.avail_out!=0)
+    memset(buffer + res->size - stream.avail_out, 0, stream.avail_out);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+static void vmdk_clean(void *priv)
+{
+  struct info_vmdk_struct *data=(struct info_vmdk_struct *)priv;
+  unsigned int i;
+  for(i=0; i<data->nbr_extents; i++)
+  {
+    struct vmdk_extent *extent=&data->extents[i];
+    if(extent->handle >= 0)
+      close(extent->handle);
+    free(extent->file_name);
+    free(extent->gd);
+  }
+  for(i=0; i<VMDK_GT_CACHE; i++)
+    free(data->gt[i].table);
+  free(data->extents);
+  free(data->cbuffer);
+  free(data);
+}
+
+static const vdisk_format_t vmdk_format = {
+  .name = "VMDK",
+  .map = &vmdk_map,
+  .inflate = &vmdk_inflate,
+  .clean = &vmdk_clean
+};
+
+/* Load the grain directory of a KDMV or COWD extent, the header is
+ * read from the file. Return the capacity in bytes, 0 on error */
+static uint64_t vmdk_sparse_open(struct vmdk_extent *extent, char **descriptor)
+{
+  unsigned char buffer[DEFAULT_SECTOR_SIZE];
+  uint64_t capacity;
+  uint64_t gd_offset;
+  if(vdisk_read_at(extent->handle, buffer, sizeof(buffer), 0) != sizeof(buffer))
+    return 0;
+  if(le32(*(const uint32_t *)buffer)==VMDK3_MAGIC)
+  {
+    const struct vmdk3_header *hdr=(const struct vmdk3_header *)buffer;
+    capacity=(uint64_t)le32(hdr->disk_sectors) * DEFAULT_SECTOR_SIZE;
+    extent->grain_size=(uint64_t)le32(hdr->granularity) * DEFAULT_SECTOR_SIZE;
+    extent->gt_entries=VMDK3_GTES_PER_GT;
+    extent->gd_entries=le32(hdr->gd_entries);
+    gd_offset=(uint64_t)le32(hdr->gd_offset) * DEFAULT_SECTOR_SIZE;
+  }
+  else if(le32(*(const uint32_t *)buffer)==VMDK4_MAGIC)
+  {
+    struct vmdk4_header hdr;
+    memcpy(&hdr, buffer, sizeof(hdr));
+    if(le64(hdr.gd_offset)==VMDK4_GD_AT_END)
+    {
+      /* streamOptimized: the header is repeated in the footer, before
+       * the end-of-stream marker */
+      const off_t file_size=lseek(extent->handle, 0, SEEK_END);
+      if(file_size < 3 * DEFAULT_SECTOR_SIZE ||
+	  vdisk_read_at(extent->handle, &hdr, sizeof(hdr), file_size - 2 * DEFAULT_SECTOR_SIZE) != sizeof(hdr) ||
+	  le32(hdr.magic)!=VMDK4_MAGIC || le64(hdr.gd_offset)==VMDK4_GD_AT_END)
+      {
+	log_error("%s: can't find the VMDK footer\n", extent->file_name);
+	return 0;
+      }
+    }
+    if(le32(hdr.version) > 3)
+    {
+      log_error("%s: unsupported VMDK version %u\n", extent->file_name, le32(hdr.version));
+      return 0;
+    }
+    capacity=le64(hdr.capacity) * DEFAULT_SECTOR_SIZE;
+    extent->grain_size=le64(hdr.grain_size) * DEFAULT_SECTOR_SIZE;
+    extent->gt_entries=le32(hdr.num_gtes_per_gt);
+    gd_offset=le64(hdr.gd_offset) * DEFAULT_SECTOR_SIZE;
+    extent->zero_grain=((le32(hdr.flags) & VMDK4_FLAG_ZERO_GRAIN)!=0);
+    if((le32(hdr.flags) & VMDK4_FLAG_COMPRESS)!=0)
+    {
+      if(le16(hdr.compress_algorithm)!=VMDK4_COMPRESSION_DEFLATE)
+      {
+	log_error("%s: unsupported VMDK compression %u\n", extent->file_name, le16(hdr.compress_algorithm));
+	return 0;
+      }
+      extent->compressed=1;
+    }
+    if(extent->grain_size==0 || extent->gt_entries==0 ||
+	extent->grain_size > VMDK_MAX_GRAIN_SIZE || extent->gt_entries > 65536)
+    {
+      log_error("%s: invalid VMDK grain size\n", extent->file_name);
+      return 0;
+    }
+    extent->gd_entries=(capacity / extent->grain_size + extent->gt_entries - 1) / extent->gt_entries;
+    if(descriptor!=NULL && le64(hdr.desc_offset)!=0 && le64(hdr.desc_size)!=0 &&
+	le64(hdr.desc_size) * DEFAULT_SECTOR_SIZE <= VMDK_MAX_DESCRIPTOR)
+    {
+      const unsigned int desc_size=le64(hdr.desc_size) * DEFAULT_SECTOR_SIZE;
+      *descriptor=(char *)MALLOC(desc_size + 1);
+      if(vdisk_read_at(extent->handle, *descriptor, desc_size, le64(hdr.desc_offset) * DEFAULT_SECTOR_SIZE) != (int)desc_size)
+	memset(*descriptor, 0, desc_size);
+      (*descriptor)[desc_size]='\0';
+    }
+  }
+  else
+  {
+    log_error("%s: not a VMDK sparse extent\n", extent->file_name);
+    return 0;
+  }
+  if(extent->grain_size==0 || extent->grain_size > VMDK_MAX_GRAIN_SIZE ||
+      extent->gd_entries==0 || (uint64_t)extent->gd_entries * sizeof(uint32_t) > VMDK_MAX_GD_SIZE ||
+      capacity > (uint64_t)extent->gd_entries * extent->gt_entries * extent->grain_size)
+  {
+    log_error("%s: invalid VMDK grain directory\n", extent->file_name);
+    return 0;
+  }
+  extent->gd=(uint32_t *)MALLOC(extent->gd_entries * sizeof(uint32_t));
+  if(vdisk_read_at(extent->handle, extent->gd, extent->gd_entries * sizeof(uint32_t), gd_offset) != (int)(extent->gd_entries * sizeof(uint32_t)))
+  {
+    log_error("%s: can't read the VMDK grain directory\n", extent->file_name);
+    return 0;
+  }
+  extent->type=VMDK_EXTENT_SPARSE;
+  return capacity;
+}
+
+/* Path of a file named in the descriptor, relative to the descriptor */
+static char *vmdk_path(const char *device, const char *name)
+{
+  const char *sep=strrchr(device, '/');
+  char *path;
+  size_t dir_len;
+#if defined(__CYGWIN__) || defined(__MINGW32__) || defined(DJGPP)
+  const char *sep2=strrchr(device, '\\');
+  if(sep2!=NULL && (sep==NULL || sep2 > sep))
+    sep=sep2;
+  if(name[0]=='\\' || (name[0]!='\0' && name[1]==':'))
+    return strdup(name);
+#endif
+  if(name[0]=='/' || sep==NULL)
+    return strdup(name);
+  dir_len=sep + 1 - device;
+  path=(char *)MALLOC(dir_len + strlen(name) + 1);
+  memcpy(path, device, dir_len);
+  strcpy(path + dir_len, name);
+  return path;
+}
+
+/* Copy the quoted string that follows s, NULL if there is none */
+static char *vmdk_quoted(const char *s)
+{
+  const char *end;
+  char *res;
+  while(*s==' ' || *s=='\t' || *s=='=')
+    s++;
+  if(*s!='"')
+    return NULL;
+  s++;
+  end=strchr(s, '"');
+  if(end==NULL)
+    return NULL;
+  res=(char *)MALLOC(end - s + 1);
+  memcpy(res, s, end - s);
+  res[end - s]='\0';
+  return res;
+}
+
+static int vmdk_add_extent(struct info_vmdk_struct *data, const char *device, const char *line, const int verbose)
+{
+  struct vmdk_extent *extent;
+  char type[32];
+  char *name;
+  char *end;
+  const char *s=line;
+  uint64_t nbr_sectors;
+  uint64_t offset=0;
+  uint64_t start=0;
+  unsigned int i;
+  while(*s!=' ' && *s!='\t' && *s!='\0')
+    s++;
+  nbr_sectors=strtoull(s, &end, 10);
+  s=end;
+  while(*s==' ' || *s=='\t')
+    s++;
+  for(i=0; i<sizeof(type)-1 && *s!=' ' && *s!='\t' && *s!='\0' && *s!='\r' && *s!='\n'; i++, s++)
+    type[i]=*s;
+  type[i]='\0';
+  name=vmdk_quoted(s);
+  if(name!=NULL)
+  {
+    const char *name_end=strchr(strchr(s, '"') + 1, '"') + 1;
+    offset=strtoull(name_end, NULL, 10);
+  }
+  for(i=0; i<data->nbr_extents; i++)
+    start+=data->extents[i].size;
+  data->extents=(struct vmdk_extent *)realloc(data->extents, (data->nbr_extents + 1) * sizeof(struct vmdk_extent));
+  if(data->extents==NULL)
+  {
+    data->nbr_extents=0;
+    free(name);
+    return -1;
+  }
+  extent=&data->extents[data->nbr_extents++];
+  memset(extent, 0, sizeof(*extent));
+  extent->handle=-1;
+  extent->start=start;
+  extent->size=nbr_sectors * DEFAULT_SECTOR_SIZE;
+  if(strncmp(line, "NOACCESS", 8)==0 || strcmp(type, "ZERO")==0)
+  {
+    extent->type=VMDK_EXTENT_ZERO;
+    free(name);
+    return 0;
+  }
+  if(name==NULL)
+  {
+    log_error("%s: invalid VMDK extent %s", device, line);
+    return -1;
+  }
+  extent->file_name=vmdk_path(device, name);
+  free(name);
+  extent->handle=open(extent->file_name, O_RDONLY|O_BINARY);
+  if(extent->handle < 0)
+  {
+    log_error("%s: can't open the VMDK extent %s: %s\n", device, extent->file_name, strerror(errno));
+    return -1;
+  }
+  if(strcmp(type, "FLAT")==0 || strcmp(type, "VMFS")==0 ||
+      strcmp(type, "VMFSRAW")==0 || strcmp(type, "VMFSRDM")==0)
+  {
+    extent->type=VMDK_EXTENT_FLAT;
+    extent->flat_offset=offset * DEFAULT_SECTOR_SIZE;
+  }
+  else if(strcmp(type, "SPARSE")==0 || strcmp(type, "VMFSSPARSE")==0)
+  {
+    if(vmdk_sparse_open(extent, NULL)==0)
+      return -1;
+  }
+  else
+  {
+    log_error("%s: unsupported VMDK extent type %s\n", device, type);
+    return -1;
+  }
+  if(verbose > 0)
+    log_info("%s: VMDK extent %s %s, %llu sectors\n", device, type, extent->file_name,
+	(long long unsigned)nbr_sectors);
+  return 0;
+}
+
+/* Read the extents and the parent named in the descriptor */
+static int vmdk_parse_descriptor(struct info_vmdk_struct *data, const char *device, const char *descriptor, char **parent_name, const int add_extents, const int verbose)
+{
+  const char *line=descriptor;
+  while(line!=NULL && *line!='\0')
+  {
+    while(*line==' ' || *line=='\t')
+      line++;
+    if(strncmp(line, "parentFileNameHint", 18)==0 && *parent_name==NULL)
+      *parent_name=vmdk_quoted(line + 18);
+    else if(add_extents!=0 &&
+	(strncmp(line, "RW ", 3)==0 || strncmp(line, "RDONLY ", 7)==0 || strncmp(line, "NOACCESS ", 9)==0))
+    {
+      if(vmdk_add_extent(data, device, line, verbose) < 0)
+	return -1;
+    }
+    line=strchr(line, '\n');
+    if(line!=NULL)
+      line++;
+  }
+  return 0;
+}
+
+/* A delta link reads the unallocated grains from its parent */
+static disk_t *vmdk_open_parent(const char *device, const char *parent_name, const int verbose, const int testdisk_mode)
+{
+  disk_t *parent;
+  char *path=vmdk_path(device, parent_name);
+  parent=file_test_availability(path, verbose, testdisk_mode & ~TESTDISK_O_RDWR);
+  if(parent==NULL)
+  {
+    /* The hint may be an absolute path on the host that created it */
+    const char *base=parent_name;
+    const char *s;
+    for(s=parent_name; *s!='\0'; s++)
+      if(*s=='/' || *s=='\\')
+	base=s + 1;
+    if(base!=parent_name)
+    {
+      free(path);
+      path=vmdk_path(device, base);
+      parent=file_test_availability(path, verbose, testdisk_mode & ~TESTDISK_O_RDWR);
+    }
+  }
+  if(parent==NULL)
+    log_error("%s: can't open the VMDK parent %s\n", device, path);
+  else
+    log_info("%s: VMDK parent %s\n", device, path);
+  free(path);
+  return parent;
+}
+
+disk_t *fvmdk_init(const char *device, const int verbose, const int testdisk_mode)
+{
+  struct info_vmdk_struct *data;
+  char *descriptor=NULL;
+  char *parent_name=NULL;
+  disk_t *parent=NULL;
+  disk_t *disk;
+  uint64_t size=0;
+  unsigned int i;
+  const int fd=open(device, O_RDONLY|O_BINARY);
+  unsigned char magic[DEFAULT_SECTOR_SIZE];
+  int res;
+  if(fd<0)
+    return NULL;
+  memset(magic, 0, sizeof(magic));
+  res=vdisk_read_at(fd, magic, sizeof(magic), 0);
+  data=(struct info_vmdk_struct *)MALLOC(sizeof(*data));
+  memset(data, 0, sizeof(*data));
+  if(res > 0 && memcmp(magic, VMDK_DESCRIPTOR_SIGNATURE, strlen(VMDK_DESCRIPTOR_SIGNATURE))==0)
+  {
+    const off_t desc_size=lseek(fd, 0, SEEK_END);
+    if(desc_size <= 0 || desc_size > VMDK_MAX_DESCRIPTOR)
+    {
+      close(fd);
+      free(data);
+      return NULL;
+    }
+    descriptor=(char *)MALLOC(desc_size + 1);
+    if(vdisk_read_at(fd, descriptor, desc_size, 0) != (int)desc_size)
+    {
+      close(fd);
+      free(descriptor);
+      free(data);
+      return NULL;
+    }
+    close(fd);
+    descriptor[desc_size]='\0';
+    if(vmdk_parse_descriptor(data, device, descriptor, &parent_name, 1, verbose) < 0 ||
+	data->nbr_extents==0)
+    {
+      free(parent_name);
+      free(descriptor);
+      vmdk_clean(data);
+      return NULL;
+    }
+  }
+  else
+  {
+    /* monolithicSparse or streamOptimized: a single sparse extent */
+    struct vmdk_extent *extent;
+    data->extents=(struct vmdk_extent *)MALLOC(sizeof(struct vmdk_extent));
+    data->nbr_extents=1;
+    extent=&data->extents[0];
+    memset(extent, 0, sizeof(*extent));
+    extent->handle=fd;
+    extent->file_name=strdup(device);
+    extent->size=vmdk_sparse_open(extent, &descriptor);
+    if(extent->size==0)
+    {
+      free(descriptor);
+      vmdk_clean(data);
+      return NULL;
+    }
+    if(descriptor!=NULL)
+      vmdk_parse_descriptor(data, device, descriptor, &parent_name, 0, verbose);
+  }
+  free(descriptor);
+  for(i=0; i<data->nbr_extents; i++)
+    size+=data->extents[i].size;
+  if(parent_name!=NULL)
+  {
+    parent=vmdk_open_parent(device, parent_name, verbose, testdisk_mode);
+    free(parent_name);
+    if(parent==NULL)
+    {
+      vmdk_clean(data);
+      return NULL;
+    }
+  }
+  disk=vdisk_new(device, &vmdk_format, data, size, DEFAULT_SECTOR_SIZE, parent);
+  if(disk==NULL)
+    return NULL;
+  if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
+    log_warning("%s: VMDK images are opened read-only\n", device);
+  log_info("%s: VMDK image, %u extent(s)%s\n", device, data->nbr_extents,
+      (parent!=NULL ? ", delta link" : ""));
+  return disk;
+}
+#endif
@@ -0,0 +1,77 @@
+/*
+
+    File: vmdk.h
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+#ifndef _VMDK_H
+#define _VMDK_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VMDK4_MAGIC 0x564d444b	/* "KDMV" */
+#define VMDK3_MAGIC 0x44574f43	/* "COWD" */
+#define VMDK_DESCRIPTOR_SIGNATURE "# Disk DescriptorFile"
+
+/* Hosted sparse extent header, little-endian */
+struct vmdk4_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint64_t capacity;		/* in sectors */
+  uint64_t grain_size;		/* in sectors */
+  uint64_t desc_offset;		/* embedded descriptor, in sectors */
+  uint64_t desc_size;
+  uint32_t num_gtes_per_gt;
+  uint64_t rgd_offset;
+  uint64_t gd_offset;		/* in sectors, GD_AT_END for streamOptimized */
+  uint64_t grain_offset;
+  uint8_t  unclean_shutdown;
+  char     check_bytes[4];
+  uint16_t compress_algorithm;
+} __attribute__ ((gcc_struct, __packed__));
+
+/* ESX vmfsSparse (COWD) extent header, little-endian */
+struct vmdk3_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t disk_sectors;
+  uint32_t granularity;		/* grain size in sectors */
+  uint32_t gd_offset;		/* in sectors */
+  uint32_t gd_entries;
+  uint32_t free_sector;
+} __attribute__ ((gcc_struct, __packed__));
+
+#if !defined(DISABLED_FOR_FRAMAC)
+/* Open read-only a VMDK image: a sparse extent or a descriptor file
+ * listing the extents. The parent of a delta link is opened too */
+/*@
+  @ requires valid_read_string(device);
+  @ ensures  \result==\null || valid_disk(\result);
+  @*/
+disk_t *fvmdk_init(const char *device, const int verbose, const int testdisk_mode);
+#endif
+
+#ifdef __cplusplus
+} /* closing brace for extern "C" */
+#endif
+#endif
@@ -30,6 +30,9 @@
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>     /* free */
 #endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
 #ifdef HAVE_WINDEF_H
 #include <windef.h>
 #endif
@@ -184,11 +187,41 @@ void disk_get_geometry_win32(CHSgeometry_t *geom, HANDLE handle, const char *dev
 }
 // Try to handle cdrom
 
+/* The drives are opened with FILE_FLAG_NO_BUFFERING|FILE_FLAG_OVERLAPPED:
+ * the data don't go through the Windows file cache, hdcache already keeps
+ * them, and the sequential reads are served from FILE_WIN32_SLOTS chunks
+ * read asynchronously ahead of the current position. */
+#define FILE_WIN32_SLOTS	8
+#define FILE_WIN32_CHUNK	(1024*1024)
+
+#define FILE_WIN32_FREE		0
+#define FILE_WIN32_PENDING	1
+#define FILE_WIN32_DONE		2
+
+typedef struct
+{
+  OVERLAPPED ov;
+  char *buffer;			/* FILE_WIN32_CHUNK bytes, page aligned */
+  uint64_t offset;
+  DWORD size;
+  DWORD nbytes;			/* Bytes read once FILE_WIN32_DONE */
+  int state;
+  unsigned int age;
+} win32_slot_t;
+
 struct info_file_win32_struct
 {
   HANDLE handle;
   char file_name[DISKNAME_MAX];
   int mode;
+  int overlapped;
+  int readahead;
+  unsigned int age;
+  uint64_t readahead_last;
+  /* Sector aligned copy of the unaligned buffers */
+  char *abuffer;
+  unsigned int abuffer_size;
+  win32_slot_t slots[FILE_WIN32_SLOTS];
 };
 
 static uint64_t filewin32_getfilesize(HANDLE handle, const char *device)
@@ -247,17 +280,33 @@ static uint64_t filewin32_setfilepointer(HANDLE handle, const char *device)
   return disk_size;
 }
 
+/* Unbuffered overlapped access first, some drivers refuse it */
+static HANDLE file_win32_open(const char *device, const int mode, int *overlapped)
+{
+  HANDLE handle;
+  handle = CreateFile(device,mode, (FILE_SHARE_WRITE | FILE_SHARE_READ),
+      NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED, NULL);
+  if (handle != INVALID_HANDLE_VALUE)
+  {
+    *overlapped=1;
+    return handle;
+  }
+  *overlapped=0;
+  return CreateFile(device,mode, (FILE_SHARE_WRITE | FILE_SHARE_READ),
+      NULL, OPEN_EXISTING, 0, NULL);
+}
+
 disk_t *file_test_availability_win32(const char *device, const int verbose, int testdisk_mode)
 {
   disk_t *disk_car=NULL;
   HANDLE handle=INVALID_HANDLE_VALUE;
   int mode=0;
+  int overlapped=0;
   int try_readonly=1;
   if((testdisk_mode&TESTDISK_O_RDWR)==TESTDISK_O_RDWR)
   {
     mode = FILE_READ_DATA | FILE_WRITE_DATA;
-    handle = CreateFile(device,mode, (FILE_SHARE_WRITE | FILE_SHARE_READ),
-	NULL, OPEN_EXISTING, 0, NULL);
+    handle = file_win32_open(device, mode, &overlapped);
     if (handle == INVALID_HANDLE_VALUE)
     {
       if(verbose>1)
@@ -285,8 +334,7 @@ disk_t *file_test_availability_win32(const char *device, const int verbose, int
   {
     testdisk_mode&=~TESTDISK_O_RDWR;
     mode = FILE_READ_DATA;
-    handle = CreateFile(device,mode, (FILE_SHARE_WRITE | FILE_SHARE_READ),
-	NULL, OPEN_EXISTING, 0, NULL);
+    handle = file_win32_open(device, mode, &overlapped);
     if (handle == INVALID_HANDLE_VALUE)
     {
       if(verbose>1)
@@ -320,6 +368,8 @@ disk_t *file_test_availability_win32(const char *device, const int verbose, int
     data=(struct info_file_win32_struct *)MALLOC(sizeof(*data));
     data->handle=handle;
     data->mode=mode;
+    data->overlapped=overlapped;
+    data->readahead=(overlapped>0 && (testdisk_mode&TESTDISK_O_READAHEAD_32K)!=0);
     disk_car->data=data;
     disk_car->description=file_win32_description;
     disk_car->description_short=file_win32_description_short;
@@ -395,66 +445,136 @@ static const char *file_win32_description_short(disk_t *disk_car)
   return disk_car->description_short_txt;
 }
 
+static void file_win32_slot_wait(HANDLE handle, win32_slot_t *slot)
+{
+  DWORD nbytes=0;
+  if(slot->state!=FILE_WIN32_PENDING)
+    return ;
+  if(GetOverlappedResult(handle, &slot->ov, &nbytes, TRUE))
+    slot->nbytes=nbytes;
+  else
+    slot->nbytes=0;
+  slot->state=FILE_WIN32_DONE;
+}
+
+static void file_win32_slot_release(struct info_file_win32_struct *data)
+{
+  unsigned int i;
+  for(i=0; i<FILE_WIN32_SLOTS; i++)
+  {
+    win32_slot_t *slot=&data->slots[i];
+    file_win32_slot_wait(data->handle, slot);
+    if(slot->ov.hEvent!=NULL)
+      CloseHandle(slot->ov.hEvent);
+    if(slot->buffer!=NULL)
+      VirtualFree(slot->buffer, 0, MEM_RELEASE);
+    slot->ov.hEvent=NULL;
+    slot->buffer=NULL;
+    slot->state=FILE_WIN32_FREE;
+  }
+}
+
 static void file_win32_clean(disk_t *disk)
 {
   if(disk->data!=NULL)
   {
     struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk->data;
+    if(data->overlapped>0)
+    {
+      CancelIo(data->handle);
+      file_win32_slot_release(data);
+    }
+    if(data->abuffer!=NULL)
+      VirtualFree(data->abuffer, 0, MEM_RELEASE);
     CloseHandle(data->handle);
   }
   generic_clean(disk);
 }
 
+/* Synchronous read or write at offset, the file pointer isn't used so it
+ * works for the overlapped handles too */
+static long int file_win32_io(HANDLE handle, void *buf, const unsigned int count, const uint64_t offset, const int write)
+{
+  OVERLAPPED ov;
+  DWORD nbytes=0;
+  BOOL ret;
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset=(DWORD)offset;
+  ov.OffsetHigh=(DWORD)(offset>>32);
+  ov.hEvent=CreateEvent(NULL, TRUE, FALSE, NULL);
+  if(ov.hEvent==NULL)
+    return -1;
+  if(write)
+    ret=WriteFile(handle, buf, count, &nbytes, &ov);
+  else
+    ret=ReadFile(handle, buf, count, &nbytes, &ov);
+  if(!ret && GetLastError()==ERROR_IO_PENDING)
+    ret=GetOverlappedResult(handle, &ov, &nbytes, TRUE);
+  if(!ret)
+  {
+    const DWORD dw=GetLastError();
+    CloseHandle(ov.hEvent);
+    SetLastError(dw);
+    return (dw==ERROR_HANDLE_EOF ? 0 : -1);
+  }
+  CloseHandle(ov.hEvent);
+  return nbytes;
+}
+
 static unsigned int file_win32_compute_sector_size(HANDLE handle)
 {
-  char *buffer=(char *)MALLOC(4096);
+  /* Page aligned for the unbuffered access */
+  char *buffer=(char *)VirtualAlloc(NULL, 4096, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
   unsigned int sector_size;
+  if(buffer==NULL)
+    return 0;
   for(sector_size=512;sector_size<=4096;sector_size*=2)
   {
-    long int ret;
-    DWORD dwByteRead;
-    ret=ReadFile(handle, buffer,sector_size,&dwByteRead,NULL);
-    if(ret && dwByteRead==sector_size)
+    if(file_win32_io(handle, buffer, sector_size, 0, 0)==(long int)sector_size)
     {
-      free(buffer);
+      VirtualFree(buffer, 0, MEM_RELEASE);
       return sector_size;
     }
   }
-  free(buffer);
+  VirtualFree(buffer, 0, MEM_RELEASE);
   return 0;
 }
 
-static int file_win32_pread_aux(const disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
+/* The unbuffered access needs a sector aligned buffer */
+static char *file_win32_aligned(struct info_file_win32_struct *data, void *buf, const unsigned int count, const unsigned int sector_size)
 {
-  long int ret;
-  HANDLE fd=((const struct info_file_win32_struct *)disk_car->data)->handle;
-  LARGE_INTEGER li;
-  li.QuadPart = offset;
-  li.LowPart = SetFilePointer(fd, li.LowPart, &li.HighPart, FILE_BEGIN);
-  if (li.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
+  if(data->overlapped==0 || ((size_t)buf & (sector_size-1))==0)
+    return (char *)buf;
+  if(data->abuffer_size < count)
   {
-    LPVOID lpMsgBuf;
-    DWORD dw = GetLastError(); 
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-        FORMAT_MESSAGE_FROM_SYSTEM,
-        NULL,
-        dw,
-        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-        (LPTSTR) &lpMsgBuf,
-        0, NULL );
-    log_error("file_win32_pread(%d,%u,buffer,%lu(%u/%u/%u)) seek err %s\n", (int)fd,
-        (unsigned)(count/disk_car->sector_size), (long unsigned int)(offset/disk_car->sector_size),
-        offset2cylinder(disk_car,offset), offset2head(disk_car,offset), offset2sector(disk_car,offset),
-        (char*)lpMsgBuf);
-    LocalFree(lpMsgBuf);
-    return -1;
+    if(data->abuffer!=NULL)
+      VirtualFree(data->abuffer, 0, MEM_RELEASE);
+    data->abuffer_size=128*512;
+    while(data->abuffer_size < count)
+      data->abuffer_size*=2;
+    data->abuffer=(char *)VirtualAlloc(NULL, data->abuffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if(data->abuffer==NULL)
+    {
+      data->abuffer_size=0;
+      return NULL;
+    }
   }
+  return data->abuffer;
+}
+
+static int file_win32_pread_direct(const disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
+{
+  long int ret;
+  struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk_car->data;
+  HANDLE fd=data->handle;
+  char *abuf=file_win32_aligned(data, buf, count, disk_car->sector_size);
+  if(abuf==NULL)
+    ret=-1;
+  else
   {
-    DWORD dwByteRead;
-    ret=ReadFile(fd, buf,count,&dwByteRead,NULL);
-    if(ret)
-      ret=dwByteRead;
+    ret=file_win32_io(fd, abuf, count, offset, 0);
+    if(ret>0 && abuf!=buf)
+      memcpy(buf, abuf, ret);
   }
   if(ret!=(signed)count)
   {
@@ -489,6 +609,160 @@ static int file_win32_pread_aux(const disk_t *disk_car, void *buf, const unsigne
   return ret;
 }
 
+static win32_slot_t *file_win32_slot_find(struct info_file_win32_struct *data, const uint64_t offset)
+{
+  unsigned int i;
+  for(i=0; i<FILE_WIN32_SLOTS; i++)
+    if(data->slots[i].state!=FILE_WIN32_FREE && data->slots[i].offset==offset)
+      return &data->slots[i];
+  return NULL;
+}
+
+/* A free slot or the least recently used one that isn't ahead of
+ * current, the chunk being read. If wait is set, the oldest slot is
+ * reused when they are all busy */
+static win32_slot_t *file_win32_slot_get(struct info_file_win32_struct *data, const uint64_t current, const int wait)
+{
+  win32_slot_t *best=NULL;
+  unsigned int i;
+  for(i=0; i<FILE_WIN32_SLOTS; i++)
+  {
+    win32_slot_t *slot=&data->slots[i];
+    if(slot->state==FILE_WIN32_FREE)
+      return slot;
+    if(slot->state==FILE_WIN32_DONE && slot->offset < current &&
+	(best==NULL || slot->age < best->age))
+      best=slot;
+  }
+  if(best!=NULL || wait==0)
+    return best;
+  for(i=0; i<FILE_WIN32_SLOTS; i++)
+  {
+    win32_slot_t *slot=&data->slots[i];
+    if(best==NULL || slot->age < best->age)
+      best=slot;
+  }
+  file_win32_slot_wait(data->handle, best);
+  return best;
+}
+
+/* Queue the read of the chunk at offset */
+static int file_win32_slot_issue(const disk_t *disk_car, win32_slot_t *slot, const uint64_t offset)
+{
+  struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk_car->data;
+  const uint64_t disk_end=(disk_car->disk_real_size + disk_car->sector_size - 1) /
+    disk_car->sector_size * disk_car->sector_size;
+  if(slot->buffer==NULL)
+  {
+    slot->buffer=(char *)VirtualAlloc(NULL, FILE_WIN32_CHUNK, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if(slot->buffer==NULL)
+      return -1;
+  }
+  if(slot->ov.hEvent==NULL)
+  {
+    slot->ov.hEvent=CreateEvent(NULL, TRUE, FALSE, NULL);
+    if(slot->ov.hEvent==NULL)
+      return -1;
+  }
+  slot->offset=offset;
+  slot->size=FILE_WIN32_CHUNK;
+  if(disk_end > offset && disk_end - offset < FILE_WIN32_CHUNK)
+    slot->size=disk_end - offset;
+  slot->nbytes=0;
+  slot->age=data->age++;
+  slot->ov.Internal=0;
+  slot->ov.InternalHigh=0;
+  slot->ov.Offset=(DWORD)offset;
+  slot->ov.OffsetHigh=(DWORD)(offset>>32);
+  ResetEvent(slot->ov.hEvent);
+  slot->state=FILE_WIN32_PENDING;
+  if(!ReadFile(data->handle, slot->buffer, slot->size, NULL, &slot->ov) &&
+      GetLastError()!=ERROR_IO_PENDING)
+    slot->state=FILE_WIN32_DONE;
+  return 0;
+}
+
+/* Sequential reads: the data are copied from the chunks, the next chunks
+ * are queued so the drive always has several requests in flight */
+static int file_win32_pread_readahead(const disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
+{
+  struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk_car->data;
+  const uint64_t end=offset + count;
+  uint64_t pos=offset;
+  uint64_t chunk;
+  unsigned int i;
+  while(pos < end)
+  {
+    win32_slot_t *slot;
+    unsigned int skip;
+    unsigned int size;
+    chunk=pos / FILE_WIN32_CHUNK * FILE_WIN32_CHUNK;
+    slot=file_win32_slot_find(data, chunk);
+    if(slot==NULL)
+    {
+      slot=file_win32_slot_get(data, chunk, 1);
+      if(file_win32_slot_issue(disk_car, slot, chunk)<0)
+      {
+	slot->state=FILE_WIN32_FREE;
+	break;
+      }
+    }
+    file_win32_slot_wait(data->handle, slot);
+    slot->age=data->age++;
+    skip=pos - chunk;
+    if(slot->nbytes < slot->size || skip >= slot->nbytes)
+    {
+      /* Let file_win32_pread_direct() report the error */
+      slot->state=FILE_WIN32_FREE;
+      break;
+    }
+    size=(end - pos < slot->nbytes - skip ? end - pos : slot->nbytes - skip);
+    memcpy((char *)buf + (pos - offset), slot->buffer + skip, size);
+    pos+=size;
+  }
+  if(pos < end)
+  {
+    const int ret=file_win32_pread_direct(disk_car, (char *)buf + (pos - offset), end - pos, pos);
+    if(ret<=0)
+      return (pos > offset ? (int)(pos - offset) : ret);
+    pos+=ret;
+  }
+  /* Read ahead, without waiting for the pending reads */
+  chunk=(end - 1) / FILE_WIN32_CHUNK * FILE_WIN32_CHUNK;
+  for(i=1; i<FILE_WIN32_SLOTS; i++)
+  {
+    const uint64_t next=chunk + (uint64_t)i * FILE_WIN32_CHUNK;
+    win32_slot_t *slot;
+    if(next >= disk_car->disk_real_size)
+      break;
+    if(file_win32_slot_find(data, next)!=NULL)
+      continue;
+    slot=file_win32_slot_get(data, chunk, 0);
+    if(slot==NULL)
+      break;
+    if(file_win32_slot_issue(disk_car, slot, next)<0)
+    {
+      slot->state=FILE_WIN32_FREE;
+      break;
+    }
+  }
+  return pos - offset;
+}
+
+static int file_win32_pread_aux(const disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
+{
+  struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk_car->data;
+  if(data->readahead>0)
+  {
+    const int sequential=((offset >= data->readahead_last && offset <= data->readahead_last + FILE_WIN32_CHUNK) ||
+	file_win32_slot_find(data, offset / FILE_WIN32_CHUNK * FILE_WIN32_CHUNK)!=NULL);
+    data->readahead_last=offset + count;
+    if(sequential)
+      return file_win32_pread_readahead(disk_car, buf, count, offset);
+  }
+  return file_win32_pread_direct(disk_car, buf, count, offset);
+}
+
 static int file_win32_pread(disk_t *disk_car, void *buf, const unsigned int count, const uint64_t offset)
 {
   return align_pread(&file_win32_pread_aux, disk_car, buf, count, offset);
@@ -497,34 +771,32 @@ static int file_win32_pread(disk_t *disk_car, void *buf, const unsigned int coun
 static int file_win32_pwrite_aux(disk_t *disk_car, const void *buf, const unsigned int count, const uint64_t offset)
 {
   long int ret;
-  HANDLE fd=((const struct info_file_win32_struct *)disk_car->data)->handle;
-  LARGE_INTEGER li;
-  li.QuadPart = offset;
-  li.LowPart = SetFilePointer(fd, li.LowPart, &li.HighPart, FILE_BEGIN);
-  if (li.LowPart == INVALID_SET_FILE_POINTER && GetLastError() != NO_ERROR)
+  struct info_file_win32_struct *data=(struct info_file_win32_struct *)disk_car->data;
+  HANDLE fd=data->handle;
+  char *abuf;
+  if(data->overlapped>0)
   {
-    LPVOID lpMsgBuf;
-    DWORD dw = GetLastError(); 
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | 
-        FORMAT_MESSAGE_FROM_SYSTEM,
-        NULL,
-        dw,
-        MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-        (LPTSTR) &lpMsgBuf,
-        0, NULL );
-    log_error("file_win32_pwrite(%d,%u,buffer,%lu(%u/%u/%u)) seek err %s\n", (int)fd,
-        (unsigned)(count/disk_car->sector_size), (long unsigned int)(offset/disk_car->sector_size),
-        offset2cylinder(disk_car,offset), offset2head(disk_car,offset), offset2sector(disk_car,offset),
-        (char*)lpMsgBuf);
-    LocalFree(lpMsgBuf);
-    return -1;
+    unsigned int i;
+    /* Forget the chunks holding the old data */
+    for(i=0; i<FILE_WIN32_SLOTS; i++)
+    {
+      win32_slot_t *slot=&data->slots[i];
+      if(slot->state!=FILE_WIN32_FREE &&
+	  slot->offset < offset + count && offset < slot->offset + slot->size)
+      {
+	file_win32_slot_wait(fd, slot);
+	slot->state=FILE_WIN32_FREE;
+      }
+    }
   }
+  abuf=file_win32_aligned(data, (void *)buf, count, disk_car->sector_size);
+  if(abuf==NULL)
+    ret=-1;
+  else
   {
-    DWORD dwByteRead;
-    ret=WriteFile(fd, buf,count,&dwByteRead,NULL);
-    if(ret)
-      ret=dwByteRead;
+    if(abuf!=buf)
+      memcpy(abuf, buf, count);
+    ret=file_win32_io(fd, abuf, count, offset, 1);
   }
   disk_car->write_used=1;
   if(ret!=(signed)count)
@@ -109,6 +109,50 @@ struct xfs_sb
 	uint32_t	sb_features2;	/* additonal feature bits */
 } __attribute__ ((gcc_struct, __packed__));
 
+/*
+ * Allocation group free space header, second sector of each allocation group
+ */
+#define	XFS_AGF_MAGIC		0x58414746	/* 'XAGF' */
+#define	XFS_ABTB_MAGIC		0x41425442	/* 'ABTB' free space by block number */
+#define	XFS_ABTB_CRC_MAGIC	0x41423342	/* 'AB3B' */
+#define	NULLAGBLOCK		((xfs_agblock_t)-1)
+/* Short form btree block header */
+#define	XFS_BTREE_SBLOCK_LEN	16
+#define	XFS_BTREE_SBLOCK_CRC_LEN	56
+
+struct xfs_agf
+{
+	uint32_t	agf_magicnum;	/* magic number == XFS_AGF_MAGIC */
+	uint32_t	agf_versionnum;	/* header version == XFS_AGF_VERSION */
+	xfs_agnumber_t	agf_seqno;	/* sequence # starting from 0 */
+	xfs_agblock_t	agf_length;	/* size in blocks of a.g. */
+	xfs_agblock_t	agf_roots[2];	/* bno and cnt btree roots */
+	xfs_agblock_t	agf_rmap_root;
+	uint32_t	agf_levels[2];	/* bno and cnt btree levels */
+	uint32_t	agf_rmap_level;
+	uint32_t	agf_flfirst;	/* first freelist block's index */
+	uint32_t	agf_fllast;	/* last freelist block's index */
+	uint32_t	agf_flcount;	/* count of blocks in freelist */
+	xfs_extlen_t	agf_freeblks;	/* total free blocks */
+	xfs_extlen_t	agf_longest;	/* longest free space */
+} __attribute__ ((gcc_struct, __packed__));
+
+struct xfs_btree_sblock
+{
+	uint32_t	bb_magic;	/* magic number for block type */
+	uint16_t	bb_level;	/* 0 is a leaf */
+	uint16_t	bb_numrecs;	/* current # of data records */
+	xfs_agblock_t	bb_leftsib;	/* left sibling block or NULLAGBLOCK */
+	xfs_agblock_t	bb_rightsib;	/* right sibling block or NULLAGBLOCK */
+} __attribute__ ((gcc_struct, __packed__));
+
+/* Free space record, also the key of the free space btrees */
+struct xfs_alloc_rec
+{
+	xfs_agblock_t	ar_startblock;	/* starting block number */
+	xfs_extlen_t	ar_blockcount;	/* count of free blocks */
+} __attribute__ ((gcc_struct, __packed__));
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
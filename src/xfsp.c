@@ -0,0 +1,181 @@
+/*
+
+    File: xfsp.c
+
+    Copyright (C) 2026 Christophe GRENIER <grenier@cgsecurity.org>
+  
+    This software is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+  
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+  
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write the Free Software Foundation, Inc., 51
+    Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#include "types.h"
+#include "common.h"
+#include "list.h"
+#include "filegen.h"
+#include "photorec.h"
+#include "xfs.h"
+#include "xfsp.h"
+#include "log.h"
+
+struct xfs_used
+{
+  alloc_data_t *list_search_space;
+  uint64_t start;
+  uint64_t end;
+};
+
+static void xfs_set_used(struct xfs_used *used, const uint64_t start, const uint64_t size)
+{
+  if(size==0)
+    return ;
+  if(used->end+1==start)
+  {
+    used->end+=size;
+    return ;
+  }
+  if(used->start != used->end)
+    del_search_space(used->list_search_space, used->start, used->end);
+  used->start=start;
+  used->end=start + size - 1;
+}
+
+/* Walk the free space by block number btree of an allocation group,
+ * the blocks between two free extents are used. Return -1 on error. */
+static int xfs_ag_remove_used_space(disk_t *disk, const uint64_t ag_offset, const unsigned int blocksize, const unsigned int sectsize, struct xfs_used *used, unsigned char *buffer)
+{
+  const struct xfs_agf *agf=(const struct xfs_agf *)buffer;
+  const struct xfs_btree_sblock *bblock=(const struct xfs_btree_sblock *)buffer;
+  xfs_agblock_t ag_length;
+  xfs_agblock_t block;
+  xfs_agblock_t next_free=0;
+  unsigned int level;
+  unsigned int nbr_blocks=0;
+  if(disk->pread(disk, buffer, sectsize, ag_offset + sectsize) != (int)sectsize ||
+      be32(agf->agf_magicnum)!=XFS_AGF_MAGIC)
+    return -1;
+  ag_length=be32(agf->agf_length);
+  block=be32(agf->agf_roots[0]);
+  level=be32(agf->agf_levels[0]);
+  if(level==0)
+    return -1;
+  /* Go down to the leftmost leaf */
+  while(--level > 0)
+  {
+    unsigned int header_len;
+    unsigned int maxrecs;
+    if(block>=ag_length ||
+	disk->pread(disk, buffer, blocksize, ag_offset + (uint64_t)block * blocksize) != (int)blocksize)
+      return -1;
+    if(be32(bblock->bb_magic)==XFS_ABTB_MAGIC)
+      header_len=XFS_BTREE_SBLOCK_LEN;
+    else if(be32(bblock->bb_magic)==XFS_ABTB_CRC_MAGIC)
+      header_len=XFS_BTREE_SBLOCK_CRC_LEN;
+    else
+      return -1;
+    if(be16(bblock->bb_level)!=level || be16(bblock->bb_numrecs)==0)
+      return -1;
+    /* keys[maxrecs] are followed by ptrs[maxrecs] */
+    maxrecs=(blocksize - header_len) / (sizeof(struct xfs_alloc_rec) + sizeof(xfs_agblock_t));
+    block=be32(*(const xfs_agblock_t *)&buffer[header_len + maxrecs * sizeof(struct xfs_alloc_rec)]);
+  }
+  /* Follow the leaves from left to right */
+  while(block!=NULLAGBLOCK)
+  {
+    const struct xfs_alloc_rec *recs;
+    unsigned int header_len;
+    unsigned int numrecs;
+    unsigned int i;
+    if(block>=ag_length || ++nbr_blocks > ag_length ||
+	disk->pread(disk, buffer, blocksize, ag_offset + (uint64_t)block * blocksize) != (int)blocksize)
+      return -1;
+    if(be32(bblock->bb_magic)==XFS_ABTB_MAGIC)
+      header_len=XFS_BTREE_SBLOCK_LEN;
+    else if(be32(bblock->bb_magic)==XFS_ABTB_CRC_MAGIC)
+      header_len=XFS_BTREE_SBLOCK_CRC_LEN;
+    else
+      return -1;
+    numrecs=be16(bblock->bb_numrecs);
+    if(be16(bblock->bb_level)!=0 ||
+	numrecs > (blocksize - header_len) / sizeof(struct xfs_alloc_rec))
+      return -1;
+    recs=(const struct xfs_alloc_rec *)&buffer[header_len];
+    for(i=0; i<numrecs; i++)
+    {
+      const xfs_agblock_t start=be32(recs[i].ar_startblock);
+      const xfs_extlen_t count=be32(recs[i].ar_blockcount);
+      if(start < next_free || (uint64_t)start + count > ag_length)
+	return -1;
+      xfs_set_used(used, ag_offset + (uint64_t)next_free * blocksize, (uint64_t)(start - next_free) * blocksize);
+      next_free=start + count;
+    }
+    block=be32(bblock->bb_rightsib);
+  }
+  xfs_set_used(used, ag_offset + (uint64_t)next_free * blocksize, (uint64_t)(ag_length - next_free) * blocksize);
+  return 0;
+}
+
+unsigned int xfs_remove_used_space(disk_t *disk, const partition_t *partition, alloc_data_t *list_search_space)
+{
+  struct xfs_sb *sb;
+  unsigned char *buffer;
+  struct xfs_used used;
+  unsigned int blocksize;
+  unsigned int sectsize;
+  uint32_t agblocks;
+  uint32_t agcount;
+  uint32_t agno;
+  sb=(struct xfs_sb *)MALLOC(XFS_SUPERBLOCK_SIZE);
+  if(disk->pread(disk, sb, XFS_SUPERBLOCK_SIZE, partition->part_offset) != XFS_SUPERBLOCK_SIZE ||
+      be32(sb->sb_magicnum)!=XFS_SB_MAGIC)
+  {
+    log_error("Can't read XFS superblock.\n");
+    free(sb);
+    return 0;
+  }
+  blocksize=be32(sb->sb_blocksize);
+  sectsize=be16(sb->sb_sectsize);
+  agblocks=be32(sb->sb_agblocks);
+  agcount=be32(sb->sb_agcount);
+  free(sb);
+  if(blocksize<512 || blocksize>65536 || (blocksize&(blocksize-1))!=0 ||
+      sectsize<512 || sectsize>blocksize || (sectsize&(sectsize-1))!=0 ||
+      agblocks==0)
+  {
+    log_error("XFS: invalid superblock.\n");
+    return 0;
+  }
+  log_trace("xfs_remove_used_space\n");
+  buffer=(unsigned char *)MALLOC(blocksize);
+  used.list_search_space=list_search_space;
+  used.start=0;
+  used.end=0;
+  for(agno=0; agno<agcount; agno++)
+  {
+    const uint64_t ag_offset=partition->part_offset + (uint64_t)agno * agblocks * blocksize;
+    if(xfs_ag_remove_used_space(disk, ag_offset, blocksize, sectsize, &used, buffer)<0)
+      log_error("XFS: can't read the free space of allocation group %lu.\n", (long unsigned)agno);
+  }
+  if(used.start != used.end)
+    del_search_space(list_search_space, used.start, used.end);
+  free(buffer);
+  return blocksize;
+}